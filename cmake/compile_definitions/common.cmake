@@ -93,10 +93,16 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/video.h"
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.cpp"
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.h"
+        "${CMAKE_SOURCE_DIR}/src/video_quality.cpp"
+        "${CMAKE_SOURCE_DIR}/src/video_quality.h"
+        "${CMAKE_SOURCE_DIR}/src/web_assets.cpp"
+        "${CMAKE_SOURCE_DIR}/src/web_assets.h"
         "${CMAKE_SOURCE_DIR}/src/input.cpp"
         "${CMAKE_SOURCE_DIR}/src/input.h"
         "${CMAKE_SOURCE_DIR}/src/audio.cpp"
         "${CMAKE_SOURCE_DIR}/src/audio.h"
+        "${CMAKE_SOURCE_DIR}/src/audio_samples.cpp"
+        "${CMAKE_SOURCE_DIR}/src/audio_samples.h"
         "${CMAKE_SOURCE_DIR}/src/platform/common.h"
         "${CMAKE_SOURCE_DIR}/src/process.cpp"
         "${CMAKE_SOURCE_DIR}/src/process.h"
@@ -110,8 +116,26 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/thread_safe.h"
         "${CMAKE_SOURCE_DIR}/src/sync.h"
         "${CMAKE_SOURCE_DIR}/src/round_robin.h"
+        "${CMAKE_SOURCE_DIR}/src/buffer_pool.h"
+        "${CMAKE_SOURCE_DIR}/src/buffer_pool.cpp"
+        "${CMAKE_SOURCE_DIR}/src/encoder_cache.h"
+        "${CMAKE_SOURCE_DIR}/src/encoder_cache.cpp"
+        "${CMAKE_SOURCE_DIR}/src/client_stats.h"
+        "${CMAKE_SOURCE_DIR}/src/client_stats.cpp"
+        "${CMAKE_SOURCE_DIR}/src/frame_scheduler.h"
+        "${CMAKE_SOURCE_DIR}/src/frame_scheduler.cpp"
+        "${CMAKE_SOURCE_DIR}/src/frame_trace.h"
+        "${CMAKE_SOURCE_DIR}/src/hybrid_timer.h"
+        "${CMAKE_SOURCE_DIR}/src/hybrid_timer.cpp"
+        "${CMAKE_SOURCE_DIR}/src/frame_trace.cpp"
+        "${CMAKE_SOURCE_DIR}/src/metrics.h"
+        "${CMAKE_SOURCE_DIR}/src/metrics.cpp"
+        "${CMAKE_SOURCE_DIR}/src/session_recording.h"
+        "${CMAKE_SOURCE_DIR}/src/session_recording.cpp"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.h"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.cpp"
+        "${CMAKE_SOURCE_DIR}/src/thread_affinity.h"
+        "${CMAKE_SOURCE_DIR}/src/thread_affinity.cpp"
         "${CMAKE_SOURCE_DIR}/src/rswrapper.h"
         "${CMAKE_SOURCE_DIR}/src/rswrapper.c"
         ${PLATFORM_TARGET_FILES})
@@ -123,6 +147,8 @@ list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_ASSETS_DIR="${SUNSHINE_ASSETS_DIR_DEF}
 
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_TRAY=${SUNSHINE_TRAY})
 
+list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_LOG_MIN_LEVEL=${SUNSHINE_LOG_MIN_LEVEL})
+
 # Publisher metadata
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_NAME="${SUNSHINE_PUBLISHER_NAME}")
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_WEBSITE="${SUNSHINE_PUBLISHER_WEBSITE}")
@@ -151,4 +177,5 @@ list(APPEND SUNSHINE_EXTERNAL_LIBRARIES
         ${FFMPEG_LIBRARIES}
         ${Boost_LIBRARIES}
         ${OPENSSL_LIBRARIES}
+        ZLIB::ZLIB
         ${PLATFORM_LIBRARIES})
@@ -124,6 +124,89 @@ endif()
 # evdev
 include(dependencies/libevdev_Sunshine)
 
+# io_uring
+if(${SUNSHINE_ENABLE_IO_URING} AND NOT FREEBSD)
+    find_package(PkgConfig REQUIRED)
+    pkg_check_modules(LIBURING liburing>=2.3)
+    if(LIBURING_FOUND)
+        add_compile_definitions(SUNSHINE_BUILD_IO_URING)
+        include_directories(SYSTEM ${LIBURING_INCLUDE_DIRS})
+        list(APPEND PLATFORM_LIBRARIES ${LIBURING_LIBRARIES})
+        list(APPEND PLATFORM_TARGET_FILES
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/uring_send.h"
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/uring_send.cpp")
+        message(STATUS "io_uring send backend enabled")
+    else()
+        message(STATUS "liburing not found, io_uring send backend disabled")
+    endif()
+endif()
+
+# AF_XDP
+if(${SUNSHINE_ENABLE_XDP} AND NOT FREEBSD)
+    include(CheckSymbolExists)
+    check_symbol_exists(XDP_USE_NEED_WAKEUP "linux/if_xdp.h" HAVE_XDP_NEED_WAKEUP)
+    if(HAVE_XDP_NEED_WAKEUP)
+        add_compile_definitions(SUNSHINE_BUILD_XDP)
+        list(APPEND PLATFORM_TARGET_FILES
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp_send.h"
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp_send.cpp")
+        message(STATUS "AF_XDP send backend enabled")
+    else()
+        message(STATUS "linux/if_xdp.h is missing or too old, AF_XDP send backend disabled")
+    endif()
+endif()
+
+# pipewire
+if(${SUNSHINE_ENABLE_PIPEWIRE} AND NOT FREEBSD)
+    find_package(PkgConfig REQUIRED)
+    pkg_check_modules(PIPEWIRE libpipewire-0.3>=0.3.64)
+    if(PIPEWIRE_FOUND)
+        add_compile_definitions(SUNSHINE_BUILD_PIPEWIRE)
+        include_directories(SYSTEM ${PIPEWIRE_INCLUDE_DIRS})
+        list(APPEND PLATFORM_LIBRARIES ${PIPEWIRE_LIBRARIES})
+        list(APPEND PLATFORM_TARGET_FILES
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/pipewire_audio.h"
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/pipewire_audio.cpp")
+        message(STATUS "PipeWire audio capture enabled")
+    else()
+        message(STATUS "libpipewire not found, PipeWire audio capture disabled")
+    endif()
+endif()
+
+# xdg-desktop-portal
+if(${SUNSHINE_ENABLE_PORTAL} AND NOT FREEBSD)
+    find_package(PkgConfig REQUIRED)
+    pkg_check_modules(PIPEWIRE libpipewire-0.3>=0.3.64)
+    pkg_check_modules(GIO gio-unix-2.0)
+    if(PIPEWIRE_FOUND AND GIO_FOUND AND LIBDRM_FOUND)
+        add_compile_definitions(SUNSHINE_BUILD_PORTAL)
+        include_directories(SYSTEM ${PIPEWIRE_INCLUDE_DIRS} ${GIO_INCLUDE_DIRS})
+        list(APPEND PLATFORM_LIBRARIES ${PIPEWIRE_LIBRARIES} ${GIO_LIBRARIES})
+        list(APPEND PLATFORM_TARGET_FILES
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/portalgrab.cpp")
+        message(STATUS "ScreenCast portal capture enabled")
+    else()
+        message(STATUS "libpipewire, gio or libdrm not found, ScreenCast portal capture disabled")
+    endif()
+endif()
+
+# rtkit
+if(NOT FREEBSD)
+    find_package(PkgConfig REQUIRED)
+    pkg_check_modules(GIO gio-unix-2.0)
+    if(GIO_FOUND)
+        add_compile_definitions(SUNSHINE_BUILD_RTKIT)
+        include_directories(SYSTEM ${GIO_INCLUDE_DIRS})
+        list(APPEND PLATFORM_LIBRARIES ${GIO_LIBRARIES})
+        list(APPEND PLATFORM_TARGET_FILES
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/rtkit.h"
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/rtkit.cpp")
+        message(STATUS "Real-time scheduling through rtkit enabled")
+    else()
+        message(STATUS "gio not found, real-time scheduling through rtkit disabled")
+    endif()
+endif()
+
 # vaapi
 if(${SUNSHINE_ENABLE_VAAPI})
     find_package(Libva REQUIRED)
@@ -157,6 +240,8 @@ if(WAYLAND_FOUND)
 
     GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "unstable/xdg-output" xdg-output-unstable-v1)
     GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "unstable/linux-dmabuf" linux-dmabuf-unstable-v1)
+    GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "staging/ext-image-capture-source" ext-image-capture-source-v1)
+    GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "staging/ext-image-copy-capture" ext-image-copy-capture-v1)
     GEN_WAYLAND("${CMAKE_SOURCE_DIR}/third-party/wlr-protocols" "unstable" wlr-screencopy-unstable-v1)
 
     include_directories(
@@ -241,6 +326,8 @@ endif()
 add_subdirectory("${CMAKE_SOURCE_DIR}/third-party/inputtino")
 list(APPEND SUNSHINE_EXTERNAL_LIBRARIES inputtino::libinputtino)
 file(GLOB_RECURSE INPUTTINO_SOURCES
+        ${CMAKE_SOURCE_DIR}/src/platform/linux/input/evdev_batch.h
+        ${CMAKE_SOURCE_DIR}/src/platform/linux/input/evdev_batch.cpp
         ${CMAKE_SOURCE_DIR}/src/platform/linux/input/inputtino*.h
         ${CMAKE_SOURCE_DIR}/src/platform/linux/input/inputtino*.cpp)
 list(APPEND PLATFORM_TARGET_FILES ${INPUTTINO_SOURCES})
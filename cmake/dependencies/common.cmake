@@ -21,6 +21,7 @@ find_package(OpenSSL REQUIRED)
 find_package(PkgConfig REQUIRED)
 find_package(Threads REQUIRED)
 pkg_check_modules(CURL REQUIRED libcurl)
+find_package(ZLIB REQUIRED)
 
 # miniupnp
 pkg_check_modules(MINIUPNP miniupnpc REQUIRED)
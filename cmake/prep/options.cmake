@@ -7,8 +7,14 @@ set(SUNSHINE_PUBLISHER_ISSUE_URL "https://app.lizardbyte.dev/support"
         CACHE STRING "The URL of the publisher's support site or issue tracker.
         If you provide a modified version of Sunshine, we kindly request that you use your own url.")
 
+# The lowest log level the hot path is compiled with, 0 for verbose up to 5 for fatal.
+# Hot path log statements below it compile to nothing, whatever min_log_level is set to.
+set(SUNSHINE_LOG_MIN_LEVEL 0
+        CACHE STRING "The lowest log level of the hot path log statements that are compiled in.")
+
 option(BUILD_DOCS "Build documentation" ON)
 option(BUILD_TESTS "Build tests" ON)
+option(BUILD_BENCHMARKS "Build micro-benchmarks" OFF)
 option(NPM_OFFLINE "Use offline npm packages. You must ensure packages are in your npm cache." OFF)
 
 option(BUILD_WERROR "Enable -Werror flag." OFF)
@@ -60,10 +66,18 @@ elseif(UNIX)  # Linux
             "Enable KMS grab if available." ON)
     option(SUNSHINE_ENABLE_EVDI
             "Enable EVDI virtual display support." ON)
+    option(SUNSHINE_ENABLE_IO_URING
+            "Enable the io_uring send backend if liburing is available." ON)
+    option(SUNSHINE_ENABLE_PIPEWIRE
+            "Enable native PipeWire audio capture if libpipewire is available." ON)
+    option(SUNSHINE_ENABLE_PORTAL
+            "Enable ScreenCast portal capture if gio and libpipewire are available." ON)
     option(SUNSHINE_ENABLE_VAAPI
             "Enable building vaapi specific code." ON)
     option(SUNSHINE_ENABLE_WAYLAND
             "Enable building wayland specific code." ON)
     option(SUNSHINE_ENABLE_X11
             "Enable X11 grab if available." ON)
+    option(SUNSHINE_ENABLE_XDP
+            "Enable the AF_XDP send backend if the kernel headers support it." ON)
 endif()
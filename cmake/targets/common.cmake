@@ -78,6 +78,136 @@ if(BUILD_TESTS)
     add_subdirectory(tests)
 endif()
 
+# benchmarks
+if(BUILD_BENCHMARKS)
+    add_executable(rs_benchmark
+            "${CMAKE_SOURCE_DIR}/tools/rs_benchmark.cpp"
+            "${CMAKE_SOURCE_DIR}/src/rswrapper.c")
+    set_target_properties(rs_benchmark PROPERTIES CXX_STANDARD 23)
+    target_include_directories(rs_benchmark PRIVATE
+            "${CMAKE_SOURCE_DIR}"
+            "${CMAKE_SOURCE_DIR}/third-party/nanors"
+            "${CMAKE_SOURCE_DIR}/third-party/nanors/deps/obl")
+
+    add_executable(queue_benchmark
+            "${CMAKE_SOURCE_DIR}/tools/queue_benchmark.cpp")
+    set_target_properties(queue_benchmark PROPERTIES CXX_STANDARD 23)
+    target_include_directories(queue_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(queue_benchmark ${CMAKE_THREAD_LIBS_INIT})
+
+    add_executable(input_queue_benchmark
+            "${CMAKE_SOURCE_DIR}/tools/input_queue_benchmark.cpp")
+    set_target_properties(input_queue_benchmark PROPERTIES CXX_STANDARD 23)
+    target_include_directories(input_queue_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(input_queue_benchmark ${CMAKE_THREAD_LIBS_INIT})
+
+    add_executable(gcm_benchmark
+            "${CMAKE_SOURCE_DIR}/tools/gcm_benchmark.cpp"
+            "${CMAKE_SOURCE_DIR}/src/crypto.cpp")
+    set_target_properties(gcm_benchmark PROPERTIES CXX_STANDARD 23)
+    target_include_directories(gcm_benchmark PRIVATE "${CMAKE_SOURCE_DIR}" ${OPENSSL_INCLUDE_DIR})
+    target_link_libraries(gcm_benchmark ${OPENSSL_LIBRARIES})
+
+    add_executable(pool_benchmark
+            "${CMAKE_SOURCE_DIR}/tools/pool_benchmark.cpp")
+    set_target_properties(pool_benchmark PROPERTIES CXX_STANDARD 23)
+    target_include_directories(pool_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(pool_benchmark ${CMAKE_THREAD_LIBS_INIT})
+
+    # these run the whole stream pipeline, so they're built from the same sources as sunshine
+    set(BENCH_SUNSHINE_SOURCES ${SUNSHINE_TARGET_FILES})
+    list(REMOVE_ITEM BENCH_SUNSHINE_SOURCES "${CMAKE_SOURCE_DIR}/src/main.cpp")
+    add_executable(bench_sunshine
+            "${CMAKE_SOURCE_DIR}/tools/bench_sunshine.cpp"
+            ${BENCH_SUNSHINE_SOURCES})
+    foreach(dep ${SUNSHINE_TARGET_DEPENDENCIES})
+        add_dependencies(bench_sunshine ${dep})
+    endforeach()
+    set_target_properties(bench_sunshine PROPERTIES CXX_STANDARD 23)
+    target_include_directories(bench_sunshine PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(bench_sunshine ${SUNSHINE_EXTERNAL_LIBRARIES} ${EXTRA_LIBS})
+    target_compile_definitions(bench_sunshine PUBLIC ${SUNSHINE_DEFINITIONS})
+    target_compile_options(bench_sunshine PRIVATE $<$<COMPILE_LANGUAGE:CXX>:${SUNSHINE_COMPILE_OPTIONS}>;$<$<COMPILE_LANGUAGE:CUDA>:${SUNSHINE_COMPILE_OPTIONS_CUDA};-std=c++17>)  # cmake-lint: disable=C0301
+
+    add_executable(bench_stream
+            "${CMAKE_SOURCE_DIR}/tools/bench_stream.cpp"
+            ${BENCH_SUNSHINE_SOURCES})
+    foreach(dep ${SUNSHINE_TARGET_DEPENDENCIES})
+        add_dependencies(bench_stream ${dep})
+    endforeach()
+    set_target_properties(bench_stream PROPERTIES CXX_STANDARD 23)
+    target_include_directories(bench_stream PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(bench_stream ${SUNSHINE_EXTERNAL_LIBRARIES} ${EXTRA_LIBS})
+    target_compile_definitions(bench_stream PUBLIC ${SUNSHINE_DEFINITIONS})
+    target_compile_options(bench_stream PRIVATE $<$<COMPILE_LANGUAGE:CXX>:${SUNSHINE_COMPILE_OPTIONS}>;$<$<COMPILE_LANGUAGE:CUDA>:${SUNSHINE_COMPILE_OPTIONS_CUDA};-std=c++17>)  # cmake-lint: disable=C0301
+
+    add_executable(replay_session
+            "${CMAKE_SOURCE_DIR}/tools/replay_session.cpp"
+            ${BENCH_SUNSHINE_SOURCES})
+    foreach(dep ${SUNSHINE_TARGET_DEPENDENCIES})
+        add_dependencies(replay_session ${dep})
+    endforeach()
+    set_target_properties(replay_session PROPERTIES CXX_STANDARD 23)
+    target_include_directories(replay_session PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(replay_session ${SUNSHINE_EXTERNAL_LIBRARIES} ${EXTRA_LIBS})
+    target_compile_definitions(replay_session PUBLIC ${SUNSHINE_DEFINITIONS})
+    target_compile_options(replay_session PRIVATE $<$<COMPILE_LANGUAGE:CXX>:${SUNSHINE_COMPILE_OPTIONS}>;$<$<COMPILE_LANGUAGE:CUDA>:${SUNSHINE_COMPILE_OPTIONS_CUDA};-std=c++17>)  # cmake-lint: disable=C0301
+
+    add_executable(load_sunshine
+            "${CMAKE_SOURCE_DIR}/tools/load_sunshine.cpp"
+            ${BENCH_SUNSHINE_SOURCES})
+    foreach(dep ${SUNSHINE_TARGET_DEPENDENCIES})
+        add_dependencies(load_sunshine ${dep})
+    endforeach()
+    set_target_properties(load_sunshine PROPERTIES CXX_STANDARD 23)
+    target_include_directories(load_sunshine PRIVATE "${CMAKE_SOURCE_DIR}")
+    target_link_libraries(load_sunshine ${SUNSHINE_EXTERNAL_LIBRARIES} ${EXTRA_LIBS})
+    target_compile_definitions(load_sunshine PUBLIC ${SUNSHINE_DEFINITIONS})
+    target_compile_options(load_sunshine PRIVATE $<$<COMPILE_LANGUAGE:CXX>:${SUNSHINE_COMPILE_OPTIONS}>;$<$<COMPILE_LANGUAGE:CUDA>:${SUNSHINE_COMPILE_OPTIONS_CUDA};-std=c++17>)  # cmake-lint: disable=C0301
+
+    if(CUDA_FOUND)
+        add_executable(cuda_benchmark
+                "${CMAKE_SOURCE_DIR}/tools/cuda_benchmark.cu"
+                ${BENCH_SUNSHINE_SOURCES})
+        foreach(dep ${SUNSHINE_TARGET_DEPENDENCIES})
+            add_dependencies(cuda_benchmark ${dep})
+        endforeach()
+        set_target_properties(cuda_benchmark PROPERTIES CXX_STANDARD 23)
+        target_include_directories(cuda_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+        target_link_libraries(cuda_benchmark ${SUNSHINE_EXTERNAL_LIBRARIES} ${EXTRA_LIBS})
+        target_compile_definitions(cuda_benchmark PUBLIC ${SUNSHINE_DEFINITIONS})
+        target_compile_options(cuda_benchmark PRIVATE $<$<COMPILE_LANGUAGE:CXX>:${SUNSHINE_COMPILE_OPTIONS}>;$<$<COMPILE_LANGUAGE:CUDA>:${SUNSHINE_COMPILE_OPTIONS_CUDA};-std=c++17>)  # cmake-lint: disable=C0301
+    endif()
+
+    if(WIN32)
+        add_executable(send_benchmark
+                "${CMAKE_SOURCE_DIR}/tools/send_benchmark.cpp"
+                "${CMAKE_SOURCE_DIR}/src/platform/windows/rio_send.cpp")
+        set_target_properties(send_benchmark PROPERTIES CXX_STANDARD 23)
+        target_include_directories(send_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+        target_link_libraries(send_benchmark ${CMAKE_THREAD_LIBS_INIT} ws2_32)
+    elseif(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+        add_executable(recv_benchmark
+                "${CMAKE_SOURCE_DIR}/tools/recv_benchmark.cpp")
+        set_target_properties(recv_benchmark PROPERTIES CXX_STANDARD 23)
+
+        add_executable(input_benchmark
+                "${CMAKE_SOURCE_DIR}/tools/input_benchmark.cpp"
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/input/evdev_batch.cpp")
+        set_target_properties(input_benchmark PROPERTIES CXX_STANDARD 23)
+        target_include_directories(input_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+
+        if(HAVE_XDP_NEED_WAKEUP)
+            add_executable(xdp_benchmark
+                    "${CMAKE_SOURCE_DIR}/tools/xdp_benchmark.cpp"
+                    "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp_send.cpp")
+            set_target_properties(xdp_benchmark PROPERTIES CXX_STANDARD 23)
+            target_include_directories(xdp_benchmark PRIVATE "${CMAKE_SOURCE_DIR}")
+            target_link_libraries(xdp_benchmark ${CMAKE_THREAD_LIBS_INIT})
+        endif()
+    endif()
+endif()
+
 # custom compile flags, must be after adding tests
 
 if (NOT BUILD_TESTS)
@@ -172,6 +172,7 @@ function add_arch_deps() {
     'libevdev'
     'libmfx'
     'libnotify'
+    'libpipewire'
     'libpulse'
     'libva'
     'libx11'
@@ -188,6 +189,7 @@ function add_arch_deps() {
     'opus'
     'udev'
     'wayland'
+    'zlib'
   )
 
   if [ "$skip_libva" == 0 ]; then
@@ -228,12 +230,14 @@ function add_debian_based_deps() {
     "libnotify-dev"
     "libnuma-dev"
     "libopus-dev"
+    "libpipewire-0.3-dev"
     "libpulse-dev"
     "libssl-dev"
     "libsystemd-dev"
     "libudev-dev"
     "libwayland-dev"  # Wayland
     "libx11-dev"  # X11
+    "libxcb-damage0-dev"  # X11
     "libxcb-shm0-dev"  # X11
     "libxcb-xfixes0-dev"  # X11
     "libxcb1-dev"  # X11
@@ -246,6 +250,7 @@ function add_debian_based_deps() {
     "udev"
     "wget"  # necessary for cuda install with `run` file
     "xvfb"  # necessary for headless unit testing
+    "zlib1g-dev"  # web-ui compression
   )
 
   if [ "$skip_libva" == 0 ]; then
@@ -312,11 +317,13 @@ function add_fedora_deps() {
     "numactl-devel"
     "openssl-devel"
     "opus-devel"
+    "pipewire-devel"
     "pulseaudio-libs-devel"
     "rpm-build"  # if you want to build an RPM binary package
     "wget"  # necessary for cuda install with `run` file
     "which"  # necessary for cuda install with `run` file
     "xorg-x11-server-Xvfb"  # necessary for headless unit testing
+    "zlib-devel"  # web-ui compression
   )
 
   if [ "$skip_libva" == 0 ]; then
@@ -3,7 +3,15 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <mutex>
 #include <thread>
+#include <tuple>
+#include <vector>
 
 // lib includes
 #include <opus/opus_multistream.h>
@@ -13,14 +21,26 @@
 #include "config.h"
 #include "globals.h"
 #include "logging.h"
+#include "metrics.h"
 #include "platform/common.h"
+#include "thread_affinity.h"
 #include "thread_safe.h"
 #include "utility.h"
 
 namespace audio {
   using namespace std::literals;
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
-  using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+
+  /**
+   * @brief The samples of a frame, along with when they were captured.
+   */
+  struct frame_t {
+    std::vector<float> samples;
+    std::chrono::steady_clock::time_point captured_at;
+  };
+
+  // Samples only flow from the capture thread to each of its encoder threads
+  using sample_queue_t = std::shared_ptr<safe::spsc_queue_t<frame_t>>;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -30,6 +50,31 @@ namespace audio {
 
   constexpr auto SAMPLE_RATE = 48000;
 
+  // The drift is fitted over this window, with a point every interval
+  constexpr auto DRIFT_WINDOW = 120s;
+  constexpr auto DRIFT_POINT_INTERVAL = 1s;
+
+  // Too short a span lets the jitter of the capture dominate
+  constexpr auto DRIFT_MIN_SPAN = 10s;
+
+  // Beyond this, the clocks didn't drift apart, frames were lost or made up
+  constexpr double DRIFT_MAX_OFFSET = 0.1;
+
+  // Real clocks stay well within this, larger estimates aren't corrected for
+  constexpr double DRIFT_MAX_PPM = 1000;
+
+  constexpr auto DRIFT_LOG_INTERVAL = 60s;
+
+  // A fixed queue holds up to 30 frames, 150 ms of 5 ms packets
+  constexpr std::size_t QUEUE_DEPTH = 30;
+
+  // A tuned queue keeps one frame of headroom, and drops at most one frame in a thousand
+  constexpr std::size_t QUEUE_MIN_DEPTH = 2;
+  constexpr double QUEUE_TARGET_DROP_RATE = 0.001;
+
+  // Enough to keep a capture warm for stereo, 5.1 and 7.1
+  constexpr std::size_t MAX_WARM_CAPTURES = 3;
+
   // NOTE: If you adjust the bitrates listed here, make sure to update the
   // corresponding bitrate adjustment logic in rtsp_stream::cmd_announce()
   opus_stream_config_t stream_configs[MAX_STREAM_CONFIG] {
@@ -83,51 +128,625 @@ namespace audio {
     },
   };
 
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
-    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
+  namespace {
+    /**
+     * @brief An Opus encoder shared by every session asking for the same stream from the same capture.
+     */
+    struct encoder_t {
+      using key_t = std::tuple<int, int, std::array<std::uint8_t, 8>, int, bool>;
+
+      struct session_t {
+        void *channel_data;
+        send_packet_cb_t send_packet;
+      };
+
+      opus_stream_config_t stream;
+      std::array<std::uint8_t, 8> mapping;
+      int frame_size;
+      opus_t opus;
+
+      // Fused encoders run on the capture thread and send the packets themselves
+      bool fused;
+      bool failed = false;
+
+      // Reused for every frame, since sessions copy the packet before the next one is encoded
+      std::array<std::uint8_t, 1400> packet;
+      safe::mail_raw_t::queue_t<packet_t> packets = mail::man->queue<packet_t>(mail::audio_packets);
+
+      sample_queue_t samples = std::make_shared<sample_queue_t::element_type>(QUEUE_DEPTH);
+      std::thread thread;
+
+      // The capture thread alone tunes the depth of the queue, if enabled
+      std::optional<queue_tuner_t> queue_tuner;
+
+      // The sessions the packets go to
+      std::mutex lock;
+      std::vector<session_t> sessions;
+
+      // Only the thread encoding the frames logs their encode times
+      logging::time_delta_percentile_logger encode_logger {debug, "Audio: encode time", 20s, &metrics::audio.encode_recent_seconds};
+    };
+
+    /**
+     * @brief An audio capture shared by every session capturing the same sink in the same layout.
+     */
+    struct capture_t {
+      using key_t = std::tuple<std::string, std::array<std::uint8_t, 8>, int, int, bool>;
+
+      key_t key;
+      audio_ctx_ref_t ref;
+      std::unique_ptr<platf::mic_t> mic;
+
+      opus_stream_config_t stream;
+      std::array<std::uint8_t, 8> mapping;
+      int frame_size;
+      bool continuous_audio;
+
+      safe::event_t<bool> shutdown;
+      std::thread thread;
+
+      // Set once the capture thread returns, like after the device failed
+      std::atomic<bool> stopped {false};
+
+      // The encoders the samples go to
+      std::mutex lock;
+      std::map<encoder_t::key_t, std::shared_ptr<encoder_t>> encoders;
+    };
+
+    /**
+     * @brief The captures and encoders of every running session.
+     */
+    struct graph_t {
+      std::mutex lock;
+      std::map<capture_t::key_t, std::shared_ptr<capture_t>> captures;
+
+      // Captures without sessions that keep running for the next one, the most recently used last
+      std::vector<std::shared_ptr<capture_t>> warm;
+
+      int sessions = 0;
+    };
+
+    graph_t &graph() {
+      static graph_t graph;
+      return graph;
     }
 
-    // Encoding takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    std::array<std::uint8_t, 8> copy_mapping(const opus_stream_config_t &stream) {
+      std::array<std::uint8_t, 8> mapping {};
+      std::copy_n(stream.mapping, stream.channelCount, mapping.begin());
+      return mapping;
+    }
 
-    opus_t opus {opus_multistream_encoder_create(
-      stream.sampleRate,
-      stream.channelCount,
-      stream.streams,
-      stream.coupledStreams,
-      stream.mapping,
-      OPUS_APPLICATION_RESTRICTED_LOWDELAY,
-      nullptr
-    )};
+    opus_t make_opus(const opus_stream_config_t &stream) {
+      opus_t opus {opus_multistream_encoder_create(
+        stream.sampleRate,
+        stream.channelCount,
+        stream.streams,
+        stream.coupledStreams,
+        stream.mapping,
+        OPUS_APPLICATION_RESTRICTED_LOWDELAY,
+        nullptr
+      )};
+
+      opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(stream.bitrate));
+      opus_multistream_encoder_ctl(opus.get(), OPUS_SET_VBR(0));
+      if (config::audio.opus_complexity >= 0) {
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_COMPLEXITY(config::audio.opus_complexity));
+      }
 
-    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(stream.bitrate));
-    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_VBR(0));
+      opus_int32 complexity = 0;
+      opus_multistream_encoder_ctl(opus.get(), OPUS_GET_COMPLEXITY(&complexity));
 
-    BOOST_LOG(info) << "Opus initialized: "sv << stream.sampleRate / 1000 << " kHz, "sv
-                    << stream.channelCount << " channels, "sv
-                    << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
+      BOOST_LOG(info) << "Opus initialized: "sv << stream.sampleRate / 1000 << " kHz, "sv
+                      << stream.channelCount << " channels, "sv
+                      << stream.bitrate / 1000 << " kbps (total), LOWDELAY, complexity "sv << complexity;
 
-    auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
-      buffer_t packet {1400};
+      return opus;
+    }
 
-      int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
+    /**
+     * @brief Encode a frame and hand the packet to every session of the encoder.
+     * @return `false` if the frame couldn't be encoded.
+     */
+    bool encode(encoder_t &encoder, const frame_t &frame) {
+      encoder.encode_logger.first_point_now();
+      int bytes = opus_multistream_encode_float(encoder.opus.get(), frame.samples.data(), encoder.frame_size, encoder.packet.data(), encoder.packet.size());
+      encoder.encode_logger.second_point_now_and_log();
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio: "sv << opus_strerror(bytes);
-        packets->stop();
+        return false;
+      }
+
+      std::span<const std::uint8_t> packet {encoder.packet.data(), (std::size_t) bytes};
+
+      // Each session encrypts and numbers its own copy of the packet
+      std::lock_guard lg {encoder.lock};
+      for (auto &session : encoder.sessions) {
+        if (session.send_packet) {
+          session.send_packet(packet, frame.captured_at);
+        } else {
+          packet_t queued {session.channel_data, buffer_t {packet.data(), packet.size()}};
+          queued.captured_at = frame.captured_at;
+          encoder.packets->raise(std::move(queued));
+        }
+      }
+
+      return true;
+    }
+
+    void encodeThread(std::shared_ptr<encoder_t> encoder) {
+      // Encoding takes place on this thread
+      platf::adjust_thread_priority(platf::thread_priority_e::high);
+      thread_affinity::apply(thread_affinity::role_e::audio);
+
+      while (auto frame = encoder->samples->pop()) {
+        if (!encode(*encoder, *frame)) {
+          encoder->packets->stop();
+
+          return;
+        }
+      }
+    }
+
+    /**
+     * @brief Hand a captured frame to every encoder of the capture.
+     */
+    void dispatch(capture_t &capture, frame_t &&frame) {
+      std::lock_guard lg {capture.lock};
+      auto remaining = capture.encoders.size();
+      for (auto &[key, encoder] : capture.encoders) {
+        --remaining;
+        if (encoder->fused) {
+          // Skip the hop to an encoder thread, the packets are sent before the next frame is captured
+          if (!encoder->failed && !encode(*encoder, frame)) {
+            encoder->failed = true;
+          }
+          continue;
+        }
+
+        auto captured_at = frame.captured_at;
+        auto queued = encoder->samples->size();
+        auto raised = remaining == 0 ? encoder->samples->raise(std::move(frame)) : encoder->samples->raise(frame);
+        auto dropped = !raised && encoder->samples->running();
+
+        metrics::audio.queue_depth_frames.observe((double) queued);
+        if (dropped) {
+          metrics::audio.queue_overflows.add();
+        }
+
+        if (encoder->queue_tuner) {
+          encoder->queue_tuner->add(queued, dropped, captured_at);
+          encoder->samples->set_limit(encoder->queue_tuner->depth());
+        }
+        metrics::audio.queue_limit_frames.set((double) encoder->samples->limit());
+      }
+    }
+
+    void captureThread(std::shared_ptr<capture_t> capture) {
+      auto &stream = capture->stream;
+      auto &control = capture->ref->control;
+
+      auto stopped_fg = util::fail_guard([&capture]() {
+        capture->stopped = true;
+      });
+
+      // Capture takes place on this thread
+      platf::adjust_thread_priority(platf::thread_priority_e::critical);
+      thread_affinity::apply(thread_affinity::role_e::audio);
+
+      int samples_per_frame = capture->frame_size * stream.channelCount;
+
+      drift_estimator_t drift {(std::uint32_t) stream.sampleRate};
+      auto next_drift_log = std::chrono::steady_clock::now() + DRIFT_LOG_INTERVAL;
+
+      std::optional<drift_resampler_t> resampler;
+      if (config::audio.drift_compensation) {
+        resampler.emplace(stream.channelCount);
+      }
+
+      // Frames further apart than this left the encoders waiting for samples
+      std::chrono::duration<double> frame_duration {(double) capture->frame_size / stream.sampleRate};
+      std::optional<std::chrono::steady_clock::time_point> last_capture;
+
+      while (!capture->shutdown.peek()) {
+        frame_t frame;
+        frame.samples.resize(samples_per_frame);
+
+        auto status = capture->mic->sample(frame.samples);
+        switch (status) {
+          case platf::capture_e::ok:
+            break;
+          case platf::capture_e::timeout:
+            metrics::audio.capture_timeouts.add();
+            continue;
+          case platf::capture_e::reinit:
+            BOOST_LOG(info) << "Reinitializing audio capture"sv;
+            drift.reset();
+            last_capture.reset();
+            capture->mic.reset();
+            do {
+              capture->mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, capture->frame_size, capture->continuous_audio);
+              if (!capture->mic) {
+                BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
+              }
+            } while (!capture->mic && !capture->shutdown.view(5s));
+            continue;
+          default:
+            // Stop the encoders, the sessions carry on without audio
+            std::lock_guard lg {capture->lock};
+            for (auto &[key, encoder] : capture->encoders) {
+              encoder->samples->stop();
+            }
+            return;
+        }
+
+        frame.captured_at = std::chrono::steady_clock::now();
+
+        if (last_capture) {
+          std::chrono::duration<double> interval = frame.captured_at - *last_capture;
+          metrics::audio.capture_interval_seconds.observe(interval.count());
+          if (interval > frame_duration * 2) {
+            metrics::audio.capture_underruns.add();
+          }
+        }
+        last_capture = frame.captured_at;
+
+        drift.add(capture->frame_size, frame.captured_at);
+        auto ppm = drift.ppm();
+        if (ppm) {
+          metrics::audio.capture_clock_drift_ppm.set(*ppm);
+
+          if (frame.captured_at >= next_drift_log) {
+            BOOST_LOG(debug) << "Audio capture clock drift: "sv << *ppm << " ppm"sv;
+            next_drift_log = frame.captured_at + DRIFT_LOG_INTERVAL;
+          }
+        }
+
+        if (!resampler) {
+          dispatch(*capture, std::move(frame));
+          continue;
+        }
+
+        // Consume the samples as fast as the device produces them, so frames go out at the steady_clock rate
+        resampler->set_ratio(ppm && std::abs(*ppm) <= DRIFT_MAX_PPM ? 1 + *ppm / 1'000'000 : 1.0);
+        resampler->push(frame.samples);
+
+        frame_t resampled;
+        resampled.samples.resize(samples_per_frame);
+        while (resampler->pop(resampled.samples)) {
+          resampled.captured_at = frame.captured_at;
+          dispatch(*capture, std::move(resampled));
+
+          resampled = {};
+          resampled.samples.resize(samples_per_frame);
+        }
+      }
+    }
+
+    void stop(capture_t &capture) {
+      capture.shutdown.raise(true);
+      capture.thread.join();
+    }
 
+    /**
+     * @brief Change the default sink back to the one of the host, if a session changed it.
+     */
+    void restore_default_sink(audio_ctx_t &ctx) {
+      if (!ctx.restore_sink) {
         return;
       }
 
-      packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
+      // Change back to the host sink, unless there was none
+      const std::string &sink = ctx.sink.host.empty() ? config::audio.sink : ctx.sink.host;
+      if (!sink.empty()) {
+        // Best effort, it's allowed to fail
+        ctx.control->set_sink(sink);
+      }
+
+      ctx.restore_sink = false;
     }
+
+    /**
+     * @brief Start sending the packets of a stream to a session.
+     * @details The capture and the encoder are shared with the other sessions asking for the same sink and stream.
+     * @return The capture and the encoder, or `nullptr` if the sink can't be captured.
+     */
+    std::pair<std::shared_ptr<capture_t>, std::shared_ptr<encoder_t>> subscribe(const audio_ctx_ref_t &ref, const std::string &sink, const opus_stream_config_t &stream, int frame_size, bool continuous_audio, void *channel_data, send_packet_cb_t send_packet) {
+      auto &g = graph();
+      std::lock_guard lg {g.lock};
+
+      // Only the first to start a session may change the default sink
+      if (!ref->sink_flag->exchange(true, std::memory_order_acquire)) {
+        // If the selected sink is different than the current one, change sinks.
+        ref->restore_sink = ref->sink.host != sink;
+        if (ref->restore_sink) {
+          if (ref->control->set_sink(sink)) {
+            return {};
+          }
+        }
+      }
+
+      capture_t::key_t capture_key {sink, copy_mapping(stream), stream.channelCount, frame_size, continuous_audio};
+      auto &capture = g.captures[capture_key];
+      if (!capture) {
+        // Take over a capture kept warm since an earlier session, unless it stopped in the meantime
+        auto warm = std::find_if(std::begin(g.warm), std::end(g.warm), [&capture_key](auto &warm) {
+          return warm->key == capture_key;
+        });
+        if (warm != std::end(g.warm)) {
+          auto taken = std::move(*warm);
+          g.warm.erase(warm);
+
+          if (taken->stopped) {
+            stop(*taken);
+          } else {
+            BOOST_LOG(info) << "Reusing the warm audio capture of ["sv << sink << ']';
+            capture = std::move(taken);
+          }
+        }
+      } else {
+        BOOST_LOG(info) << "Sharing the audio capture of ["sv << sink << "] with another session"sv;
+      }
+
+      if (!capture) {
+        auto mic = ref->control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size, continuous_audio);
+        if (!mic) {
+          g.captures.erase(capture_key);
+          return {};
+        }
+
+        capture = std::make_shared<capture_t>();
+        capture->key = capture_key;
+        capture->ref = ref;
+        capture->mic = std::move(mic);
+        capture->stream = stream;
+        capture->mapping = copy_mapping(stream);
+        capture->stream.mapping = capture->mapping.data();
+        capture->frame_size = frame_size;
+        capture->continuous_audio = continuous_audio;
+        capture->thread = std::thread {captureThread, capture};
+      }
+
+      bool fused = (bool) send_packet;
+      encoder_t::key_t encoder_key {stream.streams, stream.coupledStreams, copy_mapping(stream), stream.bitrate, fused};
+
+      std::lock_guard capture_lg {capture->lock};
+      auto &encoder = capture->encoders[encoder_key];
+      if (!encoder) {
+        encoder = std::make_shared<encoder_t>();
+        encoder->stream = stream;
+        encoder->mapping = copy_mapping(stream);
+        encoder->stream.mapping = encoder->mapping.data();
+        encoder->frame_size = frame_size;
+        encoder->opus = make_opus(encoder->stream);
+        encoder->fused = fused;
+        if (!fused) {
+          if (config::audio.queue_auto_tune) {
+            encoder->queue_tuner.emplace(QUEUE_MIN_DEPTH, QUEUE_DEPTH, QUEUE_TARGET_DROP_RATE, std::chrono::steady_clock::now());
+          }
+          encoder->thread = std::thread {encodeThread, encoder};
+        }
+      }
+
+      {
+        std::lock_guard encoder_lg {encoder->lock};
+        encoder->sessions.emplace_back(encoder_t::session_t {channel_data, std::move(send_packet)});
+      }
+      ++g.sessions;
+
+      return {capture, encoder};
+    }
+
+    /**
+     * @brief Stop sending packets to a session, and stop the encoder and the capture when no other session uses them.
+     * @details With `audio_keep_warm`, a capture no session uses keeps running, and the default sink is
+     *          restored by the last session instead of the audio context, since that outlives the sessions.
+     */
+    void unsubscribe(const std::shared_ptr<capture_t> &capture, const std::shared_ptr<encoder_t> &encoder, void *channel_data) {
+      auto &g = graph();
+      std::lock_guard lg {g.lock};
+
+      auto &ctx = *capture->ref.get();
+      if (!--g.sessions && config::audio.keep_warm) {
+        // If the host sink went away, like with its display turned off, it's restored later instead
+        if (is_audio_ctx_sink_available(ctx)) {
+          restore_default_sink(ctx);
+        }
+
+        // The next session may change the default sink again
+        ctx.sink_flag->store(false, std::memory_order_release);
+      }
+
+      {
+        std::lock_guard encoder_lg {encoder->lock};
+        std::erase_if(encoder->sessions, [channel_data](auto &session) {
+          return session.channel_data == channel_data;
+        });
+        if (!encoder->sessions.empty()) {
+          return;
+        }
+      }
+
+      {
+        std::lock_guard capture_lg {capture->lock};
+        std::erase_if(capture->encoders, [&encoder](auto &pair) {
+          return pair.second == encoder;
+        });
+      }
+
+      encoder->samples->stop();
+      if (encoder->thread.joinable()) {
+        encoder->thread.join();
+      }
+
+      {
+        std::lock_guard capture_lg {capture->lock};
+        if (!capture->encoders.empty()) {
+          return;
+        }
+      }
+
+      std::erase_if(g.captures, [&capture](auto &pair) {
+        return pair.second == capture;
+      });
+
+      if (!config::audio.keep_warm || capture->stopped) {
+        stop(*capture);
+        return;
+      }
+
+      // Keep capturing without encoders, so the samples don't pile up in the device until the next session
+      g.warm.emplace_back(capture);
+      if (g.warm.size() > MAX_WARM_CAPTURES) {
+        stop(*g.warm.front());
+        g.warm.erase(std::begin(g.warm));
+      }
+    }
+  }  // namespace
+
+  drift_estimator_t::drift_estimator_t(std::uint32_t sample_rate):
+      _sample_rate {sample_rate} {
   }
 
-  void capture(safe::mail_t mail, config_t config, void *channel_data) {
+  void drift_estimator_t::add(std::size_t frames, std::chrono::steady_clock::time_point now) {
+    // The frames of the first call arrived before the start
+    if (!_start) {
+      _start = now;
+      return;
+    }
+
+    _frames += frames;
+
+    point_t point {
+      std::chrono::duration<double>(now - *_start).count(),
+      (double) _frames / _sample_rate,
+    };
+
+    if (!_points.empty()) {
+      auto &first = _points.front();
+      if (std::abs((point.device - point.steady) - (first.device - first.steady)) > DRIFT_MAX_OFFSET) {
+        BOOST_LOG(debug) << "Audio capture clock jumped, restarting drift estimate"sv;
+        reset();
+        _start = now;
+        return;
+      }
+
+      if (point.steady - _points.back().steady < std::chrono::duration<double>(DRIFT_POINT_INTERVAL).count()) {
+        return;
+      }
+    }
+
+    _points.emplace_back(point);
+    while (point.steady - _points.front().steady > std::chrono::duration<double>(DRIFT_WINDOW).count()) {
+      _points.pop_front();
+    }
+
+    if (point.steady - _points.front().steady < std::chrono::duration<double>(DRIFT_MIN_SPAN).count()) {
+      return;
+    }
+
+    // Least squares fit of the device time against the steady time
+    double mean_steady = 0;
+    double mean_device = 0;
+    for (auto &p : _points) {
+      mean_steady += p.steady;
+      mean_device += p.device;
+    }
+    mean_steady /= _points.size();
+    mean_device /= _points.size();
+
+    double covariance = 0;
+    double variance = 0;
+    for (auto &p : _points) {
+      covariance += (p.steady - mean_steady) * (p.device - mean_device);
+      variance += (p.steady - mean_steady) * (p.steady - mean_steady);
+    }
+
+    _ppm = (covariance / variance - 1) * 1'000'000;
+  }
+
+  void drift_estimator_t::reset() {
+    _start.reset();
+    _frames = 0;
+    _points.clear();
+    _ppm.reset();
+  }
+
+  drift_resampler_t::drift_resampler_t(int channels):
+      _channels {channels} {
+  }
+
+  void drift_resampler_t::push(std::span<const float> samples) {
+    _input.insert(std::end(_input), std::begin(samples), std::end(samples));
+  }
+
+  bool drift_resampler_t::pop(std::span<float> out) {
+    auto frames = out.size() / _channels;
+    auto available = _input.size() / _channels;
+
+    // The last sample is interpolated from up to 2 frames after its position
+    auto last = (std::size_t) (_position + (frames - 1) * _ratio);
+    if (last + 2 >= available) {
+      return false;
+    }
+
+    for (std::size_t x = 0; x < frames; ++x) {
+      auto position = _position + x * _ratio;
+      auto index = (std::size_t) position;
+      auto t = (float) (position - index);
+
+      auto xm1 = &_input[(index - 1) * _channels];
+      auto x0 = xm1 + _channels;
+      auto x1 = x0 + _channels;
+      auto x2 = x1 + _channels;
+      for (int c = 0; c < _channels; ++c) {
+        auto c1 = 0.5f * (x1[c] - xm1[c]);
+        auto c2 = xm1[c] - 2.5f * x0[c] + 2 * x1[c] - 0.5f * x2[c];
+        auto c3 = 0.5f * (x2[c] - xm1[c]) + 1.5f * (x0[c] - x1[c]);
+        out[x * _channels + c] = ((c3 * t + c2) * t + c1) * t + x0[c];
+      }
+    }
+
+    // Keep the frame before the next position around
+    _position += frames * _ratio;
+    auto consumed = (std::size_t) _position - 1;
+    _input.erase(std::begin(_input), std::begin(_input) + consumed * _channels);
+    _position -= consumed;
+
+    return true;
+  }
+
+  queue_tuner_t::queue_tuner_t(std::size_t min_depth, std::size_t max_depth, double target_drop_rate, std::chrono::steady_clock::time_point now):
+      _min_depth {min_depth},
+      _max_depth {max_depth},
+      _target_drop_rate {target_drop_rate},
+      _depth {max_depth},
+      _window_start {now} {
+  }
+
+  void queue_tuner_t::add(std::size_t queued, bool dropped, std::chrono::steady_clock::time_point now) {
+    ++_frames;
+    _dropped += dropped;
+    _watermark = std::max(_watermark, queued + !dropped);
+
+    if (now - _window_start < WINDOW) {
+      return;
+    }
+
+    if (_dropped > _frames * _target_drop_rate) {
+      _depth = std::min(_max_depth, _depth * 2);
+    } else if (_watermark * 2 < _depth) {
+      // Shrink gradually, a single hiccup in the next window shouldn't overflow the queue
+      _depth = std::max({_min_depth, _watermark * 2, _depth * 3 / 4});
+    }
+
+    _window_start = now;
+    _frames = 0;
+    _dropped = 0;
+    _watermark = 0;
+  }
+
+  void capture(safe::mail_t mail, config_t config, void *channel_data, send_packet_cb_t send_packet) {
     auto shutdown_event = mail->event<bool>(mail::shutdown);
     if (!config::audio.stream) {
       shutdown_event->view();
@@ -181,68 +800,65 @@ namespace audio {
       }
     }
 
-    // Only the first to start a session may change the default sink
-    if (!ref->sink_flag->exchange(true, std::memory_order_acquire)) {
-      // If the selected sink is different than the current one, change sinks.
-      ref->restore_sink = ref->sink.host != *sink;
-      if (ref->restore_sink) {
-        if (control->set_sink(*sink)) {
-          return;
-        }
-      }
-    }
-
     auto frame_size = config.packetDuration * stream.sampleRate / 1000;
     bool continuous_audio = config.flags[config_t::CONTINUOUS_AUDIO];
-    auto mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size, continuous_audio);
-    if (!mic) {
+
+    auto [capture, encoder] = subscribe(ref, *sink, stream, frame_size, continuous_audio, channel_data, std::move(send_packet));
+    if (!capture) {
       return;
     }
 
     // Audio is initialized, so we don't want to print the failure message
     init_failure_fg.disable();
 
-    // Capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
-
-    auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
+    shutdown_event->view();
 
-    auto fg = util::fail_guard([&]() {
-      samples->stop();
-      thread.join();
+    unsubscribe(capture, encoder, channel_data);
+  }
 
-      shutdown_event->view();
-    });
+  bool is_valid_packet_duration(int packet_duration) {
+    switch (packet_duration) {
+      case 5:
+      case 10:
+      case 20:
+      case 40:
+      case 60:
+        return true;
+      default:
+        return false;
+    }
+  }
 
-    int samples_per_frame = frame_size * stream.channelCount;
+  void release_warm_captures() {
+    std::vector<std::shared_ptr<capture_t>> warm;
+    {
+      auto &g = graph();
+      std::lock_guard lg {g.lock};
+      warm = std::move(g.warm);
+    }
 
-    while (!shutdown_event->peek()) {
-      std::vector<float> sample_buffer;
-      sample_buffer.resize(samples_per_frame);
+    for (auto &capture : warm) {
+      stop(*capture);
+    }
+  }
 
-      auto status = mic->sample(sample_buffer);
-      switch (status) {
-        case platf::capture_e::ok:
-          break;
-        case platf::capture_e::timeout:
-          continue;
-        case platf::capture_e::reinit:
-          BOOST_LOG(info) << "Reinitializing audio capture"sv;
-          mic.reset();
-          do {
-            mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size, continuous_audio);
-            if (!mic) {
-              BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
-            }
-          } while (!mic && !shutdown_event->view(5s));
-          continue;
-        default:
-          return;
+  std::unique_ptr<platf::deinit_t> init() {
+    class deinit_t: public platf::deinit_t {
+    public:
+      ~deinit_t() override {
+        release_warm_captures();
       }
 
-      samples->raise(std::move(sample_buffer));
+      audio_ctx_ref_t ref;
+    };
+
+    auto deinit = std::make_unique<deinit_t>();
+    if (config::audio.stream && config::audio.keep_warm) {
+      // Load the virtual sinks once, instead of for each session
+      deinit->ref = get_audio_ctx_ref();
     }
+
+    return deinit;
   }
 
   audio_ctx_ref_t get_audio_ctx_ref() {
@@ -305,16 +921,7 @@ namespace audio {
 
   void stop_audio_control(audio_ctx_t &ctx) {
     // restore audio-sink if applicable
-    if (!ctx.restore_sink) {
-      return;
-    }
-
-    // Change back to the host sink, unless there was none
-    const std::string &sink = ctx.sink.host.empty() ? config::audio.sink : ctx.sink.host;
-    if (!sink.empty()) {
-      // Best effort, it's allowed to fail
-      ctx.control->set_sink(sink);
-    }
+    restore_default_sink(ctx);
   }
 
   void apply_surround_params(opus_stream_config_t &stream, const stream_params_t &params) {
@@ -5,11 +5,18 @@
 #pragma once
 
 // local includes
+#include "buffer_pool.h"
 #include "platform/common.h"
 #include "thread_safe.h"
 #include "utility.h"
 
 #include <bitset>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
 
 namespace audio {
   enum stream_config_e : int {
@@ -58,6 +65,14 @@ namespace audio {
     std::bitset<MAX_FLAGS> flags;
   };
 
+  /**
+   * @brief Check if Opus can encode packets of a duration.
+   * @details Opus encodes frames of 2.5, 5, 10, 20, 40 or 60 ms, but the duration is negotiated
+   *          and timestamped in whole milliseconds, which leaves out 2.5 ms.
+   * @param packet_duration The duration of a packet in milliseconds.
+   */
+  bool is_valid_packet_duration(int packet_duration);
+
   struct audio_ctx_t {
     // We want to change the sink for the first stream only
     std::unique_ptr<std::atomic_bool> sink_flag;
@@ -68,11 +83,181 @@ namespace audio {
     platf::sink_t sink;
   };
 
-  using buffer_t = util::buffer_t<std::uint8_t>;
-  using packet_t = std::pair<void *, buffer_t>;
+  using buffer_t = buffer_pool::buffer_t<std::uint8_t>;
   using audio_ctx_ref_t = safe::shared_t<audio_ctx_t>::ptr_t;
 
-  void capture(safe::mail_t mail, config_t config, void *channel_data);
+  /**
+   * @brief An encoded packet, along with the session it goes to.
+   */
+  struct packet_t: std::pair<void *, buffer_t> {
+    using std::pair<void *, buffer_t>::pair;
+
+    std::chrono::steady_clock::time_point captured_at {};  ///< When the samples of the packet were captured
+  };
+
+  /**
+   * @brief Sends an encoded packet of a session right away, on the thread that captured and encoded it.
+   * @param packet The encoded packet, only valid during the call.
+   * @param captured_at When the samples of the packet were captured.
+   */
+  using send_packet_cb_t = std::function<void(std::span<const std::uint8_t> packet, std::chrono::steady_clock::time_point captured_at)>;
+
+  /**
+   * @brief Estimates how fast the clock of a capture device runs compared to `steady_clock`.
+   * @details The number of frames the device delivered is fitted against the time they arrived at
+   *          over a sliding window. A jump in the offset between the two clocks, like after a gap
+   *          in the capture, starts the estimate over.
+   */
+  class drift_estimator_t {
+  public:
+    /**
+     * @param sample_rate The nominal sample rate of the device.
+     */
+    explicit drift_estimator_t(std::uint32_t sample_rate);
+
+    /**
+     * @brief Count frames delivered by the device.
+     * @param frames The number of frames.
+     * @param now The time they arrived at.
+     */
+    void add(std::size_t frames, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Start over, like after the device was reinitialized.
+     */
+    void reset();
+
+    /**
+     * @brief Get the drift of the device clock.
+     * @return The drift in parts per million, positive if the device runs fast, or `std::nullopt` until enough time passed.
+     */
+    std::optional<double> ppm() const {
+      return _ppm;
+    }
+
+  private:
+    struct point_t {
+      double steady;  ///< Seconds since start according to steady_clock
+      double device;  ///< Seconds since start according to the frames delivered
+    };
+
+    std::uint32_t _sample_rate;
+
+    std::optional<std::chrono::steady_clock::time_point> _start;
+    std::uint64_t _frames = 0;
+    std::deque<point_t> _points;
+    std::optional<double> _ppm;
+  };
+
+  /**
+   * @brief Resamples interleaved audio by a ratio close to 1, to make up for the drift of a capture device.
+   * @details Samples are interpolated between the frames around them with a 4-point Hermite spline.
+   *          The last samples of a frame need the first samples of the next one, so the output
+   *          lags the input by about a frame.
+   */
+  class drift_resampler_t {
+  public:
+    /**
+     * @param channels The number of channels.
+     */
+    explicit drift_resampler_t(int channels);
+
+    /**
+     * @brief Set how many input samples make up each output sample.
+     * @param ratio The ratio, above 1 if the device runs fast.
+     */
+    void set_ratio(double ratio) {
+      _ratio = ratio;
+    }
+
+    /**
+     * @brief Add input samples.
+     * @param samples The interleaved samples.
+     */
+    void push(std::span<const float> samples);
+
+    /**
+     * @brief Take an output frame.
+     * @param out The interleaved output samples, filled completely.
+     * @return `false` if there isn't enough input yet.
+     */
+    bool pop(std::span<float> out);
+
+  private:
+    int _channels;
+    double _ratio = 1.0;
+
+    // The position of the next output sample in the input, there is always a frame before it
+    double _position = 1.0;
+    std::vector<float> _input;
+  };
+
+  /**
+   * @brief Sizes the queue between a capture and an encoder to the fewest frames that rarely overflow.
+   * @details Every window, the depth doubles if too many frames were dropped because the queue was
+   *          full. Otherwise it shrinks towards twice the deepest the queue got, so a queue that never
+   *          fills up stops adding latency when the encoder stalls.
+   */
+  class queue_tuner_t {
+  public:
+    static constexpr auto WINDOW = std::chrono::seconds(10);
+
+    /**
+     * @param min_depth The depth never to go below.
+     * @param max_depth The depth never to go above, which is also where the tuning starts.
+     * @param target_drop_rate The fraction of frames that may be dropped.
+     * @param now The time the queue was created.
+     */
+    queue_tuner_t(std::size_t min_depth, std::size_t max_depth, double target_drop_rate, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Count a frame handed to the queue.
+     * @param queued The number of frames in the queue before this one.
+     * @param dropped `true` if the frame was dropped because the queue was full.
+     * @param now The time of the frame.
+     */
+    void add(std::size_t queued, bool dropped, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Get the number of frames the queue should hold.
+     */
+    std::size_t depth() const {
+      return _depth;
+    }
+
+  private:
+    std::size_t _min_depth;
+    std::size_t _max_depth;
+    double _target_drop_rate;
+    std::size_t _depth;
+
+    std::chrono::steady_clock::time_point _window_start;
+    std::uint64_t _frames = 0;
+    std::uint64_t _dropped = 0;
+    std::size_t _watermark = 0;
+  };
+
+  /**
+   * @brief Capture and encode audio for a session until it shuts down.
+   * @param mail The mail of the session.
+   * @param config The audio configuration of the session.
+   * @param channel_data The session, passed along with each packet in `mail::audio_packets`.
+   * @param send_packet If set, packets are encoded and sent by the capture thread instead of going through
+   *                    an encoder thread and `mail::audio_packets`.
+   */
+  void capture(safe::mail_t mail, config_t config, void *channel_data, send_packet_cb_t send_packet = nullptr);
+
+  /**
+   * @brief Keep the audio context and the captures of ended sessions warm, if enabled.
+   * @return The object stopping the warm captures when destroyed.
+   */
+  [[nodiscard]] std::unique_ptr<platf::deinit_t> init();
+
+  /**
+   * @brief Stop the captures kept warm after their sessions ended.
+   * @details Called before the options saved since the last session are applied, since the captures read them.
+   */
+  void release_warm_captures();
 
   /**
    * @brief Get the reference to the audio context.
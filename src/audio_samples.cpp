@@ -0,0 +1,261 @@
+/**
+ * @file src/audio_samples.cpp
+ * @brief Definitions for the vectorized sample conversion shared by the audio capture backends.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define SAMPLES_X86_64
+  #include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  #define SAMPLES_NEON
+  #include <arm_neon.h>
+#endif
+
+// local includes
+#include "audio_samples.h"
+
+namespace audio::samples {
+  namespace {
+    // Full scale integers map to [-1, 1)
+    constexpr float S16_SCALE = 1.0f / 32768;
+    constexpr float S32_SCALE = 1.0f / 2147483648.0f;
+
+    bool supports_def() {
+      return true;
+    }
+
+    void s16_def(const std::int16_t *in, float *out, std::size_t count) {
+      for (std::size_t x = 0; x < count; ++x) {
+        out[x] = in[x] * S16_SCALE;
+      }
+    }
+
+    void s32_def(const std::int32_t *in, float *out, std::size_t count) {
+      for (std::size_t x = 0; x < count; ++x) {
+        out[x] = (float) in[x] * S32_SCALE;
+      }
+    }
+
+    void remap_def(const float *in, float *out, std::size_t frames, int channels, const std::uint8_t *order) {
+      std::array<float, 8> frame;
+      for (std::size_t x = 0; x < frames; ++x, in += channels, out += channels) {
+        std::copy_n(in, channels, frame.begin());
+        for (int c = 0; c < channels; ++c) {
+          out[c] = frame[order[c]];
+        }
+      }
+    }
+
+    void remap8_def(const float *in, float *out, std::size_t frames, const std::uint8_t *order) {
+      remap_def(in, out, frames, 8, order);
+    }
+
+#ifdef SAMPLES_X86_64
+    // SSE2 is part of x86-64, so it needs no check
+    void s16_sse2(const std::int16_t *in, float *out, std::size_t count) {
+      auto scale = _mm_set1_ps(S16_SCALE);
+
+      std::size_t x = 0;
+      for (; x + 8 <= count; x += 8) {
+        auto v = _mm_loadu_si128((const __m128i *) (in + x));
+
+        // Widen with sign extension by shifting each sample down from the high half
+        auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        _mm_storeu_ps(out + x, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+      }
+
+      s16_def(in + x, out + x, count - x);
+    }
+
+    void s32_sse2(const std::int32_t *in, float *out, std::size_t count) {
+      auto scale = _mm_set1_ps(S32_SCALE);
+
+      std::size_t x = 0;
+      for (; x + 4 <= count; x += 4) {
+        auto v = _mm_loadu_si128((const __m128i *) (in + x));
+        _mm_storeu_ps(out + x, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+      }
+
+      s32_def(in + x, out + x, count - x);
+    }
+
+    bool supports_avx2() {
+      return __builtin_cpu_supports("avx2");
+    }
+
+    __attribute__((target("avx2"))) void s16_avx2(const std::int16_t *in, float *out, std::size_t count) {
+      auto scale = _mm256_set1_ps(S16_SCALE);
+
+      std::size_t x = 0;
+      for (; x + 16 <= count; x += 16) {
+        auto v = _mm256_loadu_si256((const __m256i *) (in + x));
+
+        auto lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        auto hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+
+        _mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(out + x + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+      }
+
+      s16_sse2(in + x, out + x, count - x);
+    }
+
+    __attribute__((target("avx2"))) void s32_avx2(const std::int32_t *in, float *out, std::size_t count) {
+      auto scale = _mm256_set1_ps(S32_SCALE);
+
+      std::size_t x = 0;
+      for (; x + 8 <= count; x += 8) {
+        auto v = _mm256_loadu_si256((const __m256i *) (in + x));
+        _mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+      }
+
+      s32_sse2(in + x, out + x, count - x);
+    }
+
+    // A frame of 7.1 fills a register, so reordering it is a single permute
+    __attribute__((target("avx2"))) void remap8_avx2(const float *in, float *out, std::size_t frames, const std::uint8_t *order) {
+      auto index = _mm256_setr_epi32(order[0], order[1], order[2], order[3], order[4], order[5], order[6], order[7]);
+
+      for (std::size_t x = 0; x < frames; ++x) {
+        auto v = _mm256_loadu_ps(in + x * 8);
+        _mm256_storeu_ps(out + x * 8, _mm256_permutevar8x32_ps(v, index));
+      }
+    }
+#endif
+
+#ifdef SAMPLES_NEON
+    // NEON is part of AArch64, so it needs no check
+    void s16_neon(const std::int16_t *in, float *out, std::size_t count) {
+      std::size_t x = 0;
+      for (; x + 8 <= count; x += 8) {
+        auto v = vld1q_s16(in + x);
+
+        // Converting from fixed point with 15 fractional bits scales to [-1, 1)
+        vst1q_f32(out + x, vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(v)), 15));
+        vst1q_f32(out + x + 4, vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(v)), 15));
+      }
+
+      s16_def(in + x, out + x, count - x);
+    }
+
+    void s32_neon(const std::int32_t *in, float *out, std::size_t count) {
+      std::size_t x = 0;
+      for (; x + 4 <= count; x += 4) {
+        vst1q_f32(out + x, vcvtq_n_f32_s32(vld1q_s32(in + x), 31));
+      }
+
+      s32_def(in + x, out + x, count - x);
+    }
+
+    // A frame of 7.1 spans two registers, so each half of the output is a byte lookup into both
+    void remap8_neon(const float *in, float *out, std::size_t frames, const std::uint8_t *order) {
+      std::array<std::uint8_t, 32> bytes;
+      for (int c = 0; c < 8; ++c) {
+        for (int b = 0; b < 4; ++b) {
+          bytes[c * 4 + b] = order[c] * 4 + b;
+        }
+      }
+      auto index_lo = vld1q_u8(bytes.data());
+      auto index_hi = vld1q_u8(bytes.data() + 16);
+
+      for (std::size_t x = 0; x < frames; ++x) {
+        uint8x16x2_t v {{
+          vreinterpretq_u8_f32(vld1q_f32(in + x * 8)),
+          vreinterpretq_u8_f32(vld1q_f32(in + x * 8 + 4)),
+        }};
+
+        auto lo = vqtbl2q_u8(v, index_lo);
+        auto hi = vqtbl2q_u8(v, index_hi);
+        vst1q_f32(out + x * 8, vreinterpretq_f32_u8(lo));
+        vst1q_f32(out + x * 8 + 4, vreinterpretq_f32_u8(hi));
+      }
+    }
+#endif
+
+    // Ordered from most to least preferred
+    constexpr variant_t variant_list[] {
+#ifdef SAMPLES_X86_64
+      {"avx2", supports_avx2, s16_avx2, s32_avx2, remap8_avx2},
+      {"sse2", supports_def, s16_sse2, s32_sse2, remap8_def},
+#endif
+#ifdef SAMPLES_NEON
+      {"neon", supports_def, s16_neon, s32_neon, remap8_neon},
+#endif
+      {"default", supports_def, s16_def, s32_def, remap8_def},
+    };
+
+    const variant_t &selected() {
+      static const variant_t &variant = *std::find_if(std::begin(variant_list), std::end(variant_list), [](const variant_t &variant) {
+        return variant.supported();
+      });
+
+      return variant;
+    }
+  }  // namespace
+
+  std::span<const variant_t> variants() {
+    return variant_list;
+  }
+
+  const char *variant_name() {
+    return selected().name;
+  }
+
+  bool is_identity(const std::uint8_t *order, int channels) {
+    if (!order) {
+      return true;
+    }
+
+    for (int c = 0; c < channels; ++c) {
+      if (order[c] != c) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void to_float(format_e format, const void *in, float *out, std::size_t frames, int channels, const std::uint8_t *order) {
+    auto &variant = selected();
+    auto count = frames * channels;
+    auto remap = !is_identity(order, channels);
+
+    switch (format) {
+      case format_e::f32:
+        // Reordering reads each frame before writing it, so it can go straight from the input
+        if (remap) {
+          if (channels == 8) {
+            variant.remap8((const float *) in, out, frames, order);
+          } else {
+            remap_def((const float *) in, out, frames, channels, order);
+          }
+          return;
+        }
+
+        std::memcpy(out, in, count * sizeof(float));
+        return;
+      case format_e::s16:
+        variant.s16((const std::int16_t *) in, out, count);
+        break;
+      case format_e::s32:
+        variant.s32((const std::int32_t *) in, out, count);
+        break;
+    }
+
+    // Integer samples are reordered in place once they are floats
+    if (remap) {
+      if (channels == 8) {
+        variant.remap8(out, out, frames, order);
+      } else {
+        remap_def(out, out, frames, channels, order);
+      }
+    }
+  }
+}  // namespace audio::samples
@@ -0,0 +1,60 @@
+/**
+ * @file src/audio_samples.h
+ * @brief Declarations for the vectorized sample conversion shared by the audio capture backends.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace audio::samples {
+  enum class format_e : int {
+    f32,  ///< 32-bit float
+    s16,  ///< 16-bit signed integer
+    s32,  ///< 32-bit signed integer, which also covers 24-bit samples in the high bits of 32 bits
+  };
+
+  /**
+   * @brief Sample conversion compiled for a specific instruction set.
+   */
+  struct variant_t {
+    const char *name;  ///< The name of the instruction set
+    bool (*supported)();  ///< Returns true if the CPU supports this variant
+    void (*s16)(const std::int16_t *in, float *out, std::size_t count);  ///< Convert 16-bit samples
+    void (*s32)(const std::int32_t *in, float *out, std::size_t count);  ///< Convert 32-bit samples
+    void (*remap8)(const float *in, float *out, std::size_t frames, const std::uint8_t *order);  ///< Reorder frames of 8 channels, `in` may be `out`
+  };
+
+  /**
+   * @brief Get every variant built for this architecture.
+   * @return The variants, ordered from most to least preferred.
+   */
+  std::span<const variant_t> variants();
+
+  /**
+   * @brief Get the name of the variant used by `to_float()`.
+   */
+  const char *variant_name();
+
+  /**
+   * @brief Check if a channel order leaves every channel where it is.
+   * @param order The channel order, or `nullptr`.
+   * @param channels The number of channels.
+   */
+  bool is_identity(const std::uint8_t *order, int channels);
+
+  /**
+   * @brief Convert interleaved samples to float and put their channels in order.
+   * @details Samples are converted with the widest vector instructions the CPU supports.
+   *          Frames of 8 channels are reordered in vector registers as well.
+   * @param format The format of the input samples.
+   * @param in The input samples.
+   * @param out The output samples, which must not overlap the input.
+   * @param frames The number of frames.
+   * @param channels The number of channels in each frame, at most 8.
+   * @param order For each output channel, the input channel it comes from, or `nullptr` to keep the order.
+   */
+  void to_float(format_e format, const void *in, float *out, std::size_t frames, int channels, const std::uint8_t *order);
+}  // namespace audio::samples
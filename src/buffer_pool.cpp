@@ -0,0 +1,213 @@
+/**
+ * @file src/buffer_pool.cpp
+ * @brief Definitions for the size-classed packet buffer pool.
+ */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <mutex>
+
+// local includes
+#include "buffer_pool.h"
+#include "logging.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace buffer_pool {
+  // Buffers larger than the largest size class bypass the pool
+  constexpr int UNPOOLED = -1;
+
+  constexpr std::size_t CACHE_LINE = 64;
+
+  namespace {
+    struct images_t {
+      std::mutex lock;
+      std::map<std::uint8_t *, platf::pages_t> mappings;
+
+      // How to unpin the images a device tried to pin, empty if that failed
+      std::map<std::uint8_t *, std::function<void()>> unpins;
+    };
+
+    images_t &images() {
+      static images_t images;
+      return images;
+    }
+  }  // namespace
+
+  std::uint8_t *arena_t::allocate(std::size_t size) {
+    size = (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+
+    auto offset = _used.load(std::memory_order_relaxed);
+    do {
+      if (offset + size > _size) {
+        return nullptr;
+      }
+    } while (!_used.compare_exchange_weak(offset, offset + size, std::memory_order_relaxed));
+
+    return _data + offset;
+  }
+
+  pool_t::~pool_t() {
+    for (auto &free : _free) {
+      while (auto buffer = free.pop()) {
+        delete[] buffer;
+      }
+    }
+  }
+
+  std::uint8_t *pool_t::acquire(std::size_t size, int &size_class) {
+    size_class = std::max<int>(MIN_SIZE_CLASS, std::bit_width(std::max<std::size_t>(size, 1) - 1));
+    if (size_class > MAX_SIZE_CLASS) {
+      size_class = UNPOOLED;
+      _allocations.fetch_add(1, std::memory_order_relaxed);
+      return new std::uint8_t[size];
+    }
+
+    auto index = size_class - MIN_SIZE_CLASS;
+    auto buffer = _arena_free[index].pop();
+    if (!buffer) {
+      buffer = _free[index].pop();
+    }
+    if (buffer) {
+      _cached[index].fetch_sub(1, std::memory_order_relaxed);
+      _reuses.fetch_add(1, std::memory_order_relaxed);
+      return buffer;
+    }
+
+    auto &carved = _arena_carved[index];
+    if (_arena && carved.load(std::memory_order_relaxed) < BUFFERS_PER_CLASS && carved.fetch_add(1, std::memory_order_relaxed) < BUFFERS_PER_CLASS) {
+      if (auto buffer = _arena->allocate(std::size_t {1} << size_class)) {
+        _arena_allocations.fetch_add(1, std::memory_order_relaxed);
+        return buffer;
+      }
+    }
+
+    _allocations.fetch_add(1, std::memory_order_relaxed);
+    return new std::uint8_t[std::size_t {1} << size_class];
+  }
+
+  void pool_t::release(std::uint8_t *buffer, int size_class) {
+    if (size_class == UNPOOLED) {
+      delete[] buffer;
+      return;
+    }
+
+    // Count the buffer before publishing it, so a concurrent acquire() can't see the count underflow
+    auto index = size_class - MIN_SIZE_CLASS;
+    _cached[index].fetch_add(1, std::memory_order_relaxed);
+
+    // Arena buffers can't be freed, but their free list always has room for them
+    if (_arena && _arena->contains(buffer)) {
+      _arena_free[index].push(buffer);
+      return;
+    }
+
+    if (!_free[index].push(buffer)) {
+      // More buffers of this size are in flight than we're willing to keep around
+      _cached[index].fetch_sub(1, std::memory_order_relaxed);
+      delete[] buffer;
+    }
+  }
+
+  void pool_t::set_arena(std::uint8_t *data, std::size_t size) {
+    _arena = std::make_unique<arena_t>(data, size);
+  }
+
+  stats_t pool_t::stats() const {
+    stats_t stats {
+      _allocations.load(std::memory_order_relaxed),
+      _arena_allocations.load(std::memory_order_relaxed),
+      _reuses.load(std::memory_order_relaxed),
+      0,
+      0,
+      _arena ? _arena->size() : 0,
+      _arena ? _arena->used() : 0,
+    };
+
+    for (std::size_t x = 0; x < _cached.size(); ++x) {
+      auto cached = _cached[x].load(std::memory_order_relaxed);
+      stats.cached += cached;
+      stats.cached_bytes += cached << (x + MIN_SIZE_CLASS);
+    }
+
+    return stats;
+  }
+
+  pool_t &packets() {
+    // Never destroyed, since packets may still be released while static objects are torn down
+    static auto *pool = new pool_t;
+    return *pool;
+  }
+
+  void init_arena(std::size_t size, bool lock) {
+    if (!size) {
+      return;
+    }
+
+    // Never unmapped, like the pool itself
+    auto pages = platf::map_pages(size, lock);
+    if (!pages) {
+      BOOST_LOG(warning) << "Couldn't map the packet buffer arena, packet buffers will come from the heap"sv;
+      return;
+    }
+
+    packets().set_arena(pages->data, pages->size);
+
+    BOOST_LOG(info) << "Packet buffer arena: "sv << pages->size / (1024 * 1024) << " MiB"sv
+                    << (pages->huge ? ", huge pages"sv : ""sv) << (pages->locked ? ", locked"sv : ""sv);
+  }
+
+  std::uint8_t *alloc_image(std::size_t size) {
+    auto pages = platf::map_pages(size, false);
+    if (!pages) {
+      return new std::uint8_t[size];
+    }
+
+    auto &reg = images();
+    std::lock_guard lg {reg.lock};
+    reg.mappings.emplace(pages->data, *pages);
+
+    return pages->data;
+  }
+
+  void free_image(std::uint8_t *data) {
+    if (!data) {
+      return;
+    }
+
+    {
+      auto &reg = images();
+      std::lock_guard lg {reg.lock};
+      if (auto it = reg.mappings.find(data); it != std::end(reg.mappings)) {
+        if (auto unpin = reg.unpins.extract(data); unpin && unpin.mapped()) {
+          unpin.mapped()();
+        }
+
+        platf::unmap_pages(it->second);
+        reg.mappings.erase(it);
+        return;
+      }
+    }
+
+    delete[] data;
+  }
+
+  bool pin_image(std::uint8_t *data, const std::function<std::function<void()>(std::uint8_t *, std::size_t)> &pin) {
+    auto &reg = images();
+    std::lock_guard lg {reg.lock};
+
+    auto mapping = reg.mappings.find(data);
+    if (mapping == std::end(reg.mappings)) {
+      return false;
+    }
+
+    auto [unpin, inserted] = reg.unpins.try_emplace(data);
+    if (inserted) {
+      unpin->second = pin(data, mapping->second.size);
+    }
+
+    return (bool) unpin->second;
+  }
+}  // namespace buffer_pool
@@ -0,0 +1,311 @@
+/**
+ * @file src/buffer_pool.h
+ * @brief Declarations for the size-classed packet buffer pool.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace buffer_pool {
+
+  /**
+   * @brief A bounded lock-free cache of free objects.
+   * @details Each slot holds at most one object. Claiming a slot is a single atomic exchange,
+   *          so there is no ABA problem and no thread ever waits on another.
+   */
+  template<class T, std::size_t N>
+  class free_list_t {
+  public:
+    /**
+     * @brief Take an object out of the cache.
+     * @return The object, or `nullptr` if the cache is empty.
+     */
+    T *pop() {
+      for (auto &slot : _slots) {
+        if (slot.load(std::memory_order_relaxed)) {
+          if (auto obj = slot.exchange(nullptr, std::memory_order_acquire)) {
+            return obj;
+          }
+        }
+      }
+
+      return nullptr;
+    }
+
+    /**
+     * @brief Put an object in the cache.
+     * @param obj The object.
+     * @return `true` if the object was cached, `false` if the cache is full.
+     */
+    bool push(T *obj) {
+      for (auto &slot : _slots) {
+        T *expected = nullptr;
+        if (slot.compare_exchange_strong(expected, obj, std::memory_order_release, std::memory_order_relaxed)) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+  private:
+    std::array<std::atomic<T *>, N> _slots {};
+  };
+
+  /**
+   * @brief A region of memory that buffers are carved from, and never given back to.
+   */
+  class arena_t {
+  public:
+    arena_t() = default;
+    arena_t(const arena_t &) = delete;
+
+    /**
+     * @param data The region, which must outlive the arena.
+     * @param size The size of the region.
+     */
+    arena_t(std::uint8_t *data, std::size_t size):
+        _data {data},
+        _size {size} {
+    }
+
+    /**
+     * @brief Carve a buffer out of the region.
+     * @param size The size of the buffer.
+     * @return The buffer, aligned to a cache line, or `nullptr` if the region is full.
+     */
+    std::uint8_t *allocate(std::size_t size);
+
+    bool contains(const std::uint8_t *buffer) const {
+      return buffer >= _data && buffer < _data + _size;
+    }
+
+    std::size_t size() const {
+      return _size;
+    }
+
+    std::size_t used() const {
+      return _used.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::uint8_t *_data {};
+    std::size_t _size {};
+    std::atomic<std::size_t> _used {};
+  };
+
+  struct stats_t {
+    std::uint64_t allocations;  ///< Buffers allocated from the heap so far
+    std::uint64_t arena_allocations;  ///< Buffers carved from the arena so far
+    std::uint64_t reuses;  ///< Buffers handed out from the pool so far
+    std::uint64_t cached;  ///< Buffers currently sitting in the pool
+    std::uint64_t cached_bytes;  ///< Bytes currently sitting in the pool
+    std::uint64_t arena_bytes;  ///< Size of the arena
+    std::uint64_t arena_used_bytes;  ///< Bytes carved from the arena so far
+  };
+
+  /**
+   * @brief A pool of byte buffers rounded up to power of two size classes.
+   * @details Given an arena, the pool carves up to `BUFFERS_PER_CLASS` buffers of each size class
+   *          out of it before falling back to the heap, and hands the arena buffers out first.
+   */
+  class pool_t {
+  public:
+    static constexpr int MIN_SIZE_CLASS = 10;  ///< 1 KiB
+    static constexpr int MAX_SIZE_CLASS = 22;  ///< 4 MiB
+    static constexpr std::size_t BUFFERS_PER_CLASS = 16;
+
+    pool_t() = default;
+    pool_t(const pool_t &) = delete;
+    ~pool_t();
+
+    /**
+     * @brief Get a buffer of at least the given size.
+     * @param size The minimum size of the buffer.
+     * @param size_class Receives the size class to pass back to `release()`.
+     * @return The buffer. Its contents are unspecified.
+     */
+    std::uint8_t *acquire(std::size_t size, int &size_class);
+
+    /**
+     * @brief Return a buffer to the pool.
+     * @param buffer The buffer.
+     * @param size_class The size class returned by `acquire()`.
+     */
+    void release(std::uint8_t *buffer, int size_class);
+
+    /**
+     * @brief Carve buffers out of a region of memory from now on.
+     * @details Must be called before the first `acquire()`.
+     * @param data The region, which must outlive the pool and every buffer it hands out.
+     * @param size The size of the region.
+     */
+    void set_arena(std::uint8_t *data, std::size_t size);
+
+    stats_t stats() const;
+
+  private:
+    static constexpr std::size_t SIZE_CLASSES = MAX_SIZE_CLASS - MIN_SIZE_CLASS + 1;
+
+    std::array<free_list_t<std::uint8_t, BUFFERS_PER_CLASS>, SIZE_CLASSES> _free;
+    std::array<std::atomic<std::uint64_t>, SIZE_CLASSES> _cached {};
+
+    // There are never more arena buffers of a size class than their free list has room for
+    std::unique_ptr<arena_t> _arena;
+    std::array<free_list_t<std::uint8_t, BUFFERS_PER_CLASS>, SIZE_CLASSES> _arena_free;
+    std::array<std::atomic<std::size_t>, SIZE_CLASSES> _arena_carved {};
+
+    std::atomic<std::uint64_t> _allocations {};
+    std::atomic<std::uint64_t> _arena_allocations {};
+    std::atomic<std::uint64_t> _reuses {};
+  };
+
+  /**
+   * @brief Get the pool shared by the audio and video packets.
+   */
+  pool_t &packets();
+
+  /**
+   * @brief Back the packet pool with an arena of huge pages, optionally locked in memory.
+   * @details Must be called before the first packet buffer is acquired. Failing to map the arena
+   *          only leaves the pool on the heap.
+   * @param size The size of the arena, 0 to keep the pool on the heap.
+   * @param lock Whether to lock the arena in memory.
+   */
+  void init_arena(std::size_t size, bool lock);
+
+  /**
+   * @brief Allocate a buffer for a captured image, backed by huge pages where possible.
+   * @details Images are too large for the packet pool and are only allocated when capture starts,
+   *          so they get mappings of their own, faulted in up front.
+   * @param size The size of the buffer.
+   * @return The buffer, to pass back to `free_image()`.
+   */
+  std::uint8_t *alloc_image(std::size_t size);
+
+  /**
+   * @brief Free a buffer allocated by `alloc_image()`.
+   * @param data The buffer, or `nullptr`.
+   */
+  void free_image(std::uint8_t *data);
+
+  /**
+   * @brief Pin a buffer allocated by `alloc_image()` for a device to read it by DMA, until it's freed.
+   * @details Only the first call for a buffer pins it, later ones tell whether that worked.
+   *          Buffers that fell back to the heap are never pinned.
+   * @param data The buffer.
+   * @param pin Pins the buffer given its data and the size of its mapping, and returns how to unpin it,
+   *            or an empty function if it couldn't.
+   * @return `true` if the buffer is pinned.
+   */
+  bool pin_image(std::uint8_t *data, const std::function<std::function<void()>(std::uint8_t *, std::size_t)> &pin);
+
+  /**
+   * @brief A fixed-size buffer drawn from the packet pool.
+   * @details This is a drop-in replacement for `util::buffer_t` for trivial element types.
+   *          Unlike `util::buffer_t`, the contents of a new buffer aren't zeroed.
+   */
+  template<class T>
+  class buffer_t {
+    static_assert(std::is_trivially_copyable_v<T>, "pooled buffers hold raw bytes");
+
+  public:
+    buffer_t():
+        _els {0},
+        _size_class {0},
+        _buf {nullptr} {
+    }
+
+    explicit buffer_t(std::size_t elements):
+        _els {elements},
+        _size_class {0},
+        _buf {(T *) packets().acquire(elements * sizeof(T), _size_class)} {
+    }
+
+    buffer_t(const T *data, std::size_t elements):
+        buffer_t(elements) {
+      std::memcpy(_buf, data, elements * sizeof(T));
+    }
+
+    buffer_t(const buffer_t &o):
+        buffer_t(o._buf, o._els) {
+    }
+
+    buffer_t(buffer_t &&o) noexcept:
+        _els {std::exchange(o._els, 0)},
+        _size_class {o._size_class},
+        _buf {std::exchange(o._buf, nullptr)} {
+    }
+
+    buffer_t &operator=(buffer_t &&o) noexcept {
+      std::swap(_els, o._els);
+      std::swap(_buf, o._buf);
+      std::swap(_size_class, o._size_class);
+
+      return *this;
+    }
+
+    ~buffer_t() {
+      if (_buf) {
+        packets().release((std::uint8_t *) _buf, _size_class);
+      }
+    }
+
+    T &operator[](std::size_t el) {
+      return _buf[el];
+    }
+
+    const T &operator[](std::size_t el) const {
+      return _buf[el];
+    }
+
+    std::size_t size() const {
+      return _els;
+    }
+
+    bool empty() const {
+      return _els == 0;
+    }
+
+    void fake_resize(std::size_t els) {
+      _els = els;
+    }
+
+    T *data() {
+      return _buf;
+    }
+
+    const T *data() const {
+      return _buf;
+    }
+
+    T *begin() {
+      return _buf;
+    }
+
+    const T *begin() const {
+      return _buf;
+    }
+
+    T *end() {
+      return _buf + _els;
+    }
+
+    const T *end() const {
+      return _buf + _els;
+    }
+
+  private:
+    std::size_t _els;
+    int _size_class;
+    T *_buf;
+  };
+}  // namespace buffer_pool
@@ -0,0 +1,179 @@
+/**
+ * @file src/client_stats.cpp
+ * @brief Definitions for the persisted link statistics of the paired clients.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <string>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "client_stats.h"
+#include "file_handler.h"
+#include "logging.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace client_stats {
+  namespace {
+    // Sessions of several clients may end, start and be unpaired alongside each other
+    std::mutex stats_lock;
+
+    nlohmann::json read(const std::filesystem::path &file) {
+      auto contents = file_handler::read_file(file.string().c_str());
+      if (contents.empty()) {
+        return nlohmann::json::object();
+      }
+
+      auto tree = nlohmann::json::parse(contents, nullptr, false);
+      if (tree.is_discarded() || !tree.is_object()) {
+        BOOST_LOG(warning) << "Ignoring malformed client statistics: "sv << file.string();
+        return nlohmann::json::object();
+      }
+
+      return tree;
+    }
+
+    void write(const std::filesystem::path &file, const nlohmann::json &tree) {
+      if (file_handler::write_file_atomic(file.string().c_str(), tree.dump(2))) {
+        BOOST_LOG(warning) << "Couldn't write client statistics: "sv << file.string();
+      }
+    }
+
+    std::chrono::system_clock::time_point updated(const nlohmann::json &node) {
+      return std::chrono::system_clock::time_point {std::chrono::seconds {node.at("updated").get<std::int64_t>()}};
+    }
+
+    stats_t parse(const nlohmann::json &node) {
+      return {
+        node.at("bitrate").get<int>(),
+        node.at("loss_rate").get<double>(),
+        node.at("fec_percentage").get<int>(),
+        node.at("link_rate").get<std::uint64_t>(),
+        std::chrono::milliseconds {node.at("rtt_ms").get<std::int64_t>()},
+      };
+    }
+  }  // namespace
+
+  std::filesystem::path default_file() {
+    return platf::appdata() / "client_stats.json"sv;
+  }
+
+  double weight(std::chrono::system_clock::duration age) {
+    if (age > MAX_AGE) {
+      return 0;
+    }
+
+    // Statistics from the future are as good as fresh, the clock was set back
+    auto half_lives = std::chrono::duration<double> {std::max(age, std::chrono::system_clock::duration::zero())} / HALF_LIFE;
+    return std::exp2(-half_lives);
+  }
+
+  double blend(double fallback, double learned, double weight) {
+    return fallback + (learned - fallback) * std::clamp(weight, 0.0, 1.0);
+  }
+
+  std::optional<entry_t> load(const std::filesystem::path &file, std::string_view client_uuid, std::chrono::system_clock::time_point now) {
+    std::lock_guard lg {stats_lock};
+
+    auto tree = read(file);
+    auto clients = tree.find("clients");
+    if (clients == tree.end() || !clients->is_object()) {
+      return std::nullopt;
+    }
+
+    auto node = clients->find(std::string {client_uuid});
+    if (node == clients->end()) {
+      return std::nullopt;
+    }
+
+    try {
+      auto entry_weight = weight(now - updated(*node));
+      if (entry_weight <= 0) {
+        BOOST_LOG(debug) << "Statistics of client ["sv << client_uuid << "] are stale"sv;
+        return std::nullopt;
+      }
+
+      return entry_t {parse(*node), entry_weight};
+    } catch (const nlohmann::json::exception &e) {
+      BOOST_LOG(warning) << "Ignoring malformed statistics of client ["sv << client_uuid << "]: "sv << e.what();
+      return std::nullopt;
+    }
+  }
+
+  void store(const std::filesystem::path &file, std::string_view client_uuid, const stats_t &stats, std::chrono::system_clock::time_point now) {
+    std::lock_guard lg {stats_lock};
+
+    auto tree = read(file);
+    if (!tree["clients"].is_object()) {
+      tree["clients"] = nlohmann::json::object();
+    }
+    auto &clients = tree["clients"];
+
+    // Clients that haven't streamed for too long have nothing left to contribute
+    for (auto it = clients.begin(); it != clients.end();) {
+      try {
+        if (weight(now - updated(*it)) <= 0) {
+          it = clients.erase(it);
+          continue;
+        }
+      } catch (const nlohmann::json::exception &) {
+        it = clients.erase(it);
+        continue;
+      }
+      ++it;
+    }
+
+    // A fresh previous entry counts as much as the session, an old one hardly at all
+    auto blended = stats;
+    auto node = clients.find(std::string {client_uuid});
+    if (node != clients.end()) {
+      try {
+        auto previous = parse(*node);
+        auto share = 1.0 - weight(now - updated(*node)) / 2;
+
+        blended.bitrate = (int) std::lround(blend(previous.bitrate, stats.bitrate, share));
+        blended.loss_rate = blend(previous.loss_rate, stats.loss_rate, share);
+        blended.fec_percentage = (int) std::lround(blend(previous.fec_percentage, stats.fec_percentage, share));
+        blended.link_rate = (std::uint64_t) std::llround(blend((double) previous.link_rate, (double) stats.link_rate, share));
+        blended.rtt = std::chrono::milliseconds {std::llround(blend((double) previous.rtt.count(), (double) stats.rtt.count(), share))};
+      } catch (const nlohmann::json::exception &e) {
+        BOOST_LOG(warning) << "Replacing malformed statistics of client ["sv << client_uuid << "]: "sv << e.what();
+      }
+    }
+
+    clients[std::string {client_uuid}] = {
+      {"updated", std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count()},
+      {"bitrate", blended.bitrate},
+      {"loss_rate", blended.loss_rate},
+      {"fec_percentage", blended.fec_percentage},
+      {"link_rate", blended.link_rate},
+      {"rtt_ms", blended.rtt.count()},
+    };
+
+    write(file, tree);
+  }
+
+  void erase(const std::filesystem::path &file, std::string_view client_uuid) {
+    std::lock_guard lg {stats_lock};
+
+    if (client_uuid.empty()) {
+      std::error_code ec;
+      std::filesystem::remove(file, ec);
+      return;
+    }
+
+    auto tree = read(file);
+    auto clients = tree.find("clients");
+    if (clients == tree.end() || !clients->is_object() || !clients->erase(std::string {client_uuid})) {
+      return;
+    }
+
+    write(file, tree);
+  }
+}  // namespace client_stats
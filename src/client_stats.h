@@ -0,0 +1,83 @@
+/**
+ * @file src/client_stats.h
+ * @brief Declarations for the persisted link statistics of the paired clients.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief Persists what the last sessions of each paired client learned about its link, so the next
+ *        session can start from there instead of from the client's requested bitrate and the global FEC settings.
+ * @details Clients are told apart by the UUID of their paired certificate. The statistics of a session are
+ *          blended into those of the previous ones, which count for less the older they are. Statistics
+ *          lose half their weight every `HALF_LIFE`, and are dropped after `MAX_AGE`.
+ */
+namespace client_stats {
+  constexpr std::chrono::hours HALF_LIFE {24 * 7};
+  constexpr std::chrono::hours MAX_AGE {24 * 30};
+
+  struct stats_t {
+    int bitrate;  ///< The video bitrate the session settled at, in kilobits per second
+    double loss_rate;  ///< Video packets the client lost out of the video shards sent
+    int fec_percentage;  ///< The FEC percentage the session settled at
+    std::uint64_t link_rate;  ///< The rate the link was estimated to take video at, in bits per second
+    std::chrono::milliseconds rtt;  ///< The control stream round trip time
+  };
+
+  struct entry_t {
+    stats_t stats;
+    double weight;  ///< How far to trust the statistics, from 1 when they are fresh down towards 0
+  };
+
+  /**
+   * @brief Get the statistics file in the application data directory.
+   */
+  std::filesystem::path default_file();
+
+  /**
+   * @brief Get the weight of statistics of a given age.
+   * @param age The time since the statistics were stored.
+   * @return The weight, or 0 past `MAX_AGE`.
+   */
+  double weight(std::chrono::system_clock::duration age);
+
+  /**
+   * @brief Blend a value learned in earlier sessions into a default.
+   * @param fallback The value to use without statistics.
+   * @param learned The value the statistics hold.
+   * @param weight The weight of the statistics.
+   * @return The blended value.
+   */
+  double blend(double fallback, double learned, double weight);
+
+  /**
+   * @brief Load the statistics of a client.
+   * @param file The statistics file.
+   * @param client_uuid The UUID of the client.
+   * @param now The current time.
+   * @return The statistics, or `std::nullopt` if there are none that are recent enough.
+   */
+  std::optional<entry_t> load(const std::filesystem::path &file, std::string_view client_uuid, std::chrono::system_clock::time_point now);
+
+  /**
+   * @brief Blend the statistics of a session into those stored for its client.
+   * @param file The statistics file.
+   * @param client_uuid The UUID of the client.
+   * @param stats The statistics of the session.
+   * @param now The time the session ended.
+   */
+  void store(const std::filesystem::path &file, std::string_view client_uuid, const stats_t &stats, std::chrono::system_clock::time_point now);
+
+  /**
+   * @brief Remove the statistics of a client, like when it is unpaired.
+   * @param file The statistics file.
+   * @param client_uuid The UUID of the client, or empty to remove those of every client.
+   */
+  void erase(const std::filesystem::path &file, std::string_view client_uuid);
+}  // namespace client_stats
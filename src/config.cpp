@@ -8,6 +8,9 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -19,6 +22,7 @@
 #include <boost/property_tree/ptree.hpp>
 
 // local includes
+#include "audio.h"
 #include "config.h"
 #include "entry_handler.h"
 #include "file_handler.h"
@@ -26,7 +30,9 @@
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "rtsp.h"
+#include "stream.h"
 #include "utility.h"
+#include "video.h"
 
 #ifdef _WIN32
   #include <shellapi.h>
@@ -64,6 +70,20 @@ namespace config {
       return nvenc::nvenc_two_pass::quarter_resolution;
     }
 
+    nvenc::nvenc_split_frame_encoding split_encode_from_view(const std::string_view &preset) {
+      if (preset == "disabled") {
+        return nvenc::nvenc_split_frame_encoding::disabled;
+      }
+      if (preset == "driver_decides") {
+        return nvenc::nvenc_split_frame_encoding::driver_decides;
+      }
+      if (preset == "enabled") {
+        return nvenc::nvenc_split_frame_encoding::force_enabled;
+      }
+      BOOST_LOG(warning) << "config: unknown nvenc_split_encode value: " << preset;
+      return nvenc::nvenc_split_frame_encoding::driver_decides;
+    }
+
   }  // namespace nv
 
   namespace amd {
@@ -434,6 +454,19 @@ namespace config {
     }
   }  // namespace dd
 
+  video_t::screen_content_e screen_content_from_view(const std::string_view value) {
+#define _CONVERT_2_ARG_(str, val) \
+  if (value == #str##sv) \
+  return video_t::screen_content_e::val
+#define _CONVERT_(x) _CONVERT_2_ARG_(x, x)
+    _CONVERT_(disabled);
+    _CONVERT_(enabled);
+    _CONVERT_2_ARG_(auto, automatic);
+#undef _CONVERT_
+#undef _CONVERT_2_ARG_
+    return video_t::screen_content_e::disabled;  // Default to this if value is invalid
+  }
+
   video_t video {
     28,  // qp
 
@@ -441,6 +474,8 @@ namespace config {
     0,  // av1_mode
 
     2,  // min_threads
+    0,  // max_threads
+    0,  // sws_threads
     {
       "superfast"s,  // preset
       "zerolatency"s,  // tune
@@ -480,14 +515,24 @@ namespace config {
       0,
       1,
       -1,
+      false,
     },  // vt
 
     {
       false,  // strict_rc_buffer
+      false,  // compute_convert
     },  // vaapi
 
+    false,  // dxgi_compute_convert
+    false,  // capture_phase_lock
+
     {},  // capture
+    false,  // evdi_persistent
+    3s,  // evdi_teardown_delay
+    3,  // wgc_frame_pool_size
+    false,  // wgc_window_capture
     {},  // encoder
+    true,  // parallel_encoder_probing
     {},  // adapter_name
     {},  // output_name
 
@@ -505,7 +550,16 @@ namespace config {
     },  // display_device
 
     0,  // max_bitrate
-    0  // minimum_fps_target (0 = framerate)
+    0,  // minimum_fps_target (0 = framerate)
+    false,  // shared_encoding
+    false,  // skip_unchanged_frames
+    0,  // intra_refresh_frames
+    0,  // cursor_roi_qp
+    false,  // dynamic_resolution
+    video_t::screen_content_e::disabled,  // screen_content
+    0,  // preset_budget
+    0,  // quality_sample_interval
+    0  // idle_timeout
   };
 
   audio_t audio {
@@ -513,6 +567,12 @@ namespace config {
     {},  // virtual_sink
     true,  // stream audio
     true,  // install_steam_drivers
+    false,  // fused_pipeline
+    false,  // adaptive_fec
+    false,  // drift_compensation
+    false,  // queue_auto_tune
+    false,  // keep_warm
+    -1,  // opus_complexity
   };
 
   stream_t stream {
@@ -521,6 +581,19 @@ namespace config {
     APPS_JSON_PATH,
 
     20,  // fecPercentage
+    false,  // adaptive_fec
+    false,  // video_retransmission
+    -1,  // fec_threads
+    0,  // video_broadcast_threads
+    0,  // pacing_percentage
+    0,  // frame_size_limit
+    0,  // stale_frame_limit
+    false,  // adaptive_bitrate
+    true,  // warm_start
+    false,  // io_uring_send
+    false,  // kernel_pacing
+    {},  // xdp_interface
+    false,  // registered_io_send
 
     ENCRYPTION_MODE_NEVER,  // lan_encryption_mode
     ENCRYPTION_MODE_OPPORTUNISTIC,  // wan_encryption_mode
@@ -535,6 +608,7 @@ namespace config {
     platf::get_host_name(),  // sunshine_name,
     "sunshine_state.json"s,  // file_state
     {},  // external_ip
+    2,  // worker_threads
   };
 
   input_t input {
@@ -544,8 +618,10 @@ namespace config {
       {0x12, 0xA4},
     },
     -1ms,  // back_button_timeout
+    4ms,  // gamepad_motion_interval
     500ms,  // key_repeat_delay
     std::chrono::duration<double> {1 / 24.9},  // key_repeat_period
+    1ms,  // mouse_move_interval
 
     {
       platf::supported_gamepads(nullptr).front().name.data(),
@@ -555,6 +631,7 @@ namespace config {
     true,  // client gamepads with motion events are emulated as DS4
     true,  // client gamepads with touchpads are emulated as DS4
     true,  // ds5_inputtino_randomize_mac
+    0,  // gamepad_pool_size
 
     true,  // keyboard enabled
     true,  // mouse enabled
@@ -579,7 +656,14 @@ namespace config {
     platf::appdata().string() + "/sunshine.log",  // log file
     false,  // notify_pre_releases
     true,  // system_tray
+    false,  // frame_trace
+    false,  // session_recording
+    false,  // deferred_startup
     {},  // prep commands
+    {},  // thread_affinity
+    false,  // realtime_threads
+    32,  // buffer_arena_size
+    false,  // buffer_arena_lock
   };
 
   bool endline(char ch) {
@@ -833,6 +917,14 @@ namespace config {
     }
   }
 
+  void int_between_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, hot_t<int> &input, const std::pair<int, int> &range) {
+    int temp = input;
+
+    int_between_f(vars, name, temp, range);
+
+    input = temp;
+  }
+
   bool to_bool(std::string &boolean) {
     std::for_each(std::begin(boolean), std::end(boolean), [](char ch) {
       return (char) std::tolower(ch);
@@ -857,6 +949,14 @@ namespace config {
     input = to_bool(tmp);
   }
 
+  void bool_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, hot_t<bool> &input) {
+    bool temp = input;
+
+    bool_f(vars, name, temp);
+
+    input = temp;
+  }
+
   void double_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, double &input) {
     std::string tmp;
     string_f(vars, name, tmp);
@@ -946,8 +1046,14 @@ namespace config {
       auto do_cmd = prep_cmd.get_optional<std::string>("do"s);
       auto undo_cmd = prep_cmd.get_optional<std::string>("undo"s);
       auto elevated = prep_cmd.get_optional<bool>("elevated"s);
+      auto parallel = prep_cmd.get_optional<bool>("parallel"s);
+      auto required = prep_cmd.get_optional<bool>("required"s);
+      auto timeout = prep_cmd.get_optional<int>("timeout"s);
 
-      input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      auto &cmd = input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      cmd.parallel = parallel.value_or(false);
+      cmd.required = required.value_or(true);
+      cmd.timeout = std::chrono::seconds {std::max(timeout.value_or(0), 0)};
     }
   }
 
@@ -1040,28 +1146,17 @@ namespace config {
     return opts;
   }
 
-  void apply_config(std::unordered_map<std::string, std::string> &&vars) {
-#ifndef __ANDROID__
-    // TODO: Android can possibly support this
-    if (!fs::exists(stream.file_apps.c_str())) {
-      fs::copy_file(SUNSHINE_ASSETS_DIR "/apps.json", stream.file_apps);
-      fs::permissions(
-        stream.file_apps,
-        fs::perms::owner_read | fs::perms::owner_write,
-        fs::perm_options::add
-      );
-    }
-#endif
-
-    for (auto &[name, val] : vars) {
-      BOOST_LOG(info) << "config: '"sv << name << "' = "sv << val;
-      modified_config_settings[name] = val;
-    }
-
+  /**
+   * @brief Apply the options to the given config.
+   * @details The parameters shadow the global config, so the options can be built into copies of it.
+   */
+  static void apply_options(std::unordered_map<std::string, std::string> &vars, video_t &video, audio_t &audio, stream_t &stream, nvhttp_t &nvhttp, input_t &input, sunshine_t &sunshine) {
     int_f(vars, "qp", video.qp);
     int_between_f(vars, "hevc_mode", video.hevc_mode, {0, 3});
     int_between_f(vars, "av1_mode", video.av1_mode, {0, 3});
     int_f(vars, "min_threads", video.min_threads);
+    int_between_f(vars, "max_threads", video.max_threads, {0, 256});
+    int_between_f(vars, "sws_threads", video.sws_threads, {0, 64});
     string_f(vars, "sw_preset", video.sw.sw_preset);
     if (!video.sw.sw_preset.empty()) {
       video.sw.svtav1_preset = sw::svtav1_preset_from_view(video.sw.sw_preset);
@@ -1072,7 +1167,11 @@ namespace config {
     int_between_f(vars, "nvenc_vbv_increase", video.nv.vbv_percentage_increase, {0, 400});
     bool_f(vars, "nvenc_spatial_aq", video.nv.adaptive_quantization);
     generic_f(vars, "nvenc_twopass", video.nv.two_pass, nv::twopass_from_view);
+    generic_f(vars, "nvenc_split_encode", video.nv.split_frame_encoding, nv::split_encode_from_view);
     bool_f(vars, "nvenc_h264_cavlc", video.nv.h264_cavlc);
+    bool_f(vars, "nvenc_subframe_output", video.nv.subframe_output);
+    int_between_f(vars, "nvenc_pipeline_depth", video.nv.pipeline_depth, {1, 4});
+    bool_f(vars, "nvenc_ltr_recovery", video.nv.ltr_recovery);
     bool_f(vars, "nvenc_realtime_hags", video.nv_realtime_hags);
     bool_f(vars, "nvenc_opengl_vulkan_on_dxgi", video.nv_opengl_vulkan_on_dxgi);
     bool_f(vars, "nvenc_latency_over_power", video.nv_sunshine_high_power_mode);
@@ -1124,11 +1223,27 @@ namespace config {
     int_f(vars, "vt_software", video.vt.vt_allow_sw, vt::allow_software_from_view);
     int_f(vars, "vt_software", video.vt.vt_require_sw, vt::force_software_from_view);
     int_f(vars, "vt_realtime", video.vt.vt_realtime, vt::rt_from_view);
+    bool_f(vars, "vt_native", video.vt.vt_native);
 
     bool_f(vars, "vaapi_strict_rc_buffer", video.vaapi.strict_rc_buffer);
+    bool_f(vars, "vaapi_compute_convert", video.vaapi.compute_convert);
+
+    bool_f(vars, "dxgi_compute_convert", video.dxgi_compute_convert);
+    bool_f(vars, "capture_phase_lock", video.capture_phase_lock);
 
     string_f(vars, "capture", video.capture);
+    bool_f(vars, "evdi_persistent", video.evdi_persistent);
+    {
+      int value = -1;
+      int_between_f(vars, "evdi_teardown_delay", value, {0, std::numeric_limits<int>::max()});
+      if (value >= 0) {
+        video.evdi_teardown_delay = std::chrono::milliseconds {value};
+      }
+    }
+    int_between_f(vars, "wgc_frame_pool_size", video.wgc_frame_pool_size, {2, 8});
+    bool_f(vars, "wgc_window_capture", video.wgc_window_capture);
     string_f(vars, "encoder", video.encoder);
+    bool_f(vars, "parallel_encoder_probing", video.parallel_encoder_probing);
     string_f(vars, "adapter_name", video.adapter_name);
     string_f(vars, "output_name", video.output_name);
 
@@ -1155,24 +1270,44 @@ namespace config {
 
     int_f(vars, "max_bitrate", video.max_bitrate);
     double_between_f(vars, "minimum_fps_target", video.minimum_fps_target, {0.0, 1000.0});
+    bool_f(vars, "shared_encoding", video.shared_encoding);
+    bool_f(vars, "skip_unchanged_frames", video.skip_unchanged_frames);
+    int_between_f(vars, "intra_refresh_frames", video.intra_refresh_frames, {0, 600});
+    int_between_f(vars, "cursor_roi_qp", video.cursor_roi_qp, {0, 20});
+    bool_f(vars, "dynamic_resolution", video.dynamic_resolution);
+    generic_f(vars, "screen_content", video.screen_content, screen_content_from_view);
+    int_between_f(vars, "preset_budget", video.preset_budget, {0, 100});
+    int_between_f(vars, "quality_sample_interval", video.quality_sample_interval, {0, 10000});
+    int_between_f(vars, "idle_timeout", video.idle_timeout, {0, 3600});
+
+    // The standalone NVENC encoder only sees its own configuration
+    video.nv.intra_refresh_frames = video.intra_refresh_frames;
+    video.nv.qp_delta_map = video.cursor_roi_qp > 0;
 
     path_f(vars, "pkey", nvhttp.pkey);
     path_f(vars, "cert", nvhttp.cert);
     string_f(vars, "sunshine_name", nvhttp.sunshine_name);
-    path_f(vars, "log_path", config::sunshine.log_file);
+    path_f(vars, "log_path", sunshine.log_file);
     path_f(vars, "file_state", nvhttp.file_state);
 
     // Must be run after "file_state"
-    config::sunshine.credentials_file = config::nvhttp.file_state;
-    path_f(vars, "credentials_file", config::sunshine.credentials_file);
+    sunshine.credentials_file = nvhttp.file_state;
+    path_f(vars, "credentials_file", sunshine.credentials_file);
 
     string_f(vars, "external_ip", nvhttp.external_ip);
-    list_prep_cmd_f(vars, "global_prep_cmd", config::sunshine.prep_cmds);
+    int_between_f(vars, "http_worker_threads", nvhttp.worker_threads, {1, 16});
+    list_prep_cmd_f(vars, "global_prep_cmd", sunshine.prep_cmds);
 
     string_f(vars, "audio_sink", audio.sink);
     string_f(vars, "virtual_sink", audio.virtual_sink);
     bool_f(vars, "stream_audio", audio.stream);
     bool_f(vars, "install_steam_audio_drivers", audio.install_steam_drivers);
+    bool_f(vars, "audio_fused_pipeline", audio.fused_pipeline);
+    bool_f(vars, "audio_adaptive_fec", audio.adaptive_fec);
+    bool_f(vars, "audio_drift_compensation", audio.drift_compensation);
+    bool_f(vars, "audio_queue_auto_tune", audio.queue_auto_tune);
+    bool_f(vars, "audio_keep_warm", audio.keep_warm);
+    int_between_f(vars, "audio_opus_complexity", audio.opus_complexity, {-1, 10});
 
     string_restricted_f(vars, "origin_web_ui_allowed", nvhttp.origin_web_ui_allowed, {"pc"sv, "lan"sv, "wan"sv});
 
@@ -1187,6 +1322,19 @@ namespace config {
 
     path_f(vars, "file_apps", stream.file_apps);
     int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
+    bool_f(vars, "adaptive_fec", stream.adaptive_fec);
+    bool_f(vars, "video_retransmission", stream.video_retransmission);
+    int_between_f(vars, "fec_threads", stream.fec_threads, {-1, 16});
+    int_between_f(vars, "video_broadcast_threads", stream.video_broadcast_threads, {0, 16});
+    int_between_f(vars, "pacing_percentage", stream.pacing_percentage, {0, 100});
+    int_between_f(vars, "frame_size_limit", stream.frame_size_limit, {0, 1000});
+    int_between_f(vars, "stale_frame_limit", stream.stale_frame_limit, {0, 1000});
+    bool_f(vars, "adaptive_bitrate", stream.adaptive_bitrate);
+    bool_f(vars, "warm_start", stream.warm_start);
+    bool_f(vars, "io_uring_send", stream.io_uring_send);
+    bool_f(vars, "kernel_pacing", stream.kernel_pacing);
+    string_f(vars, "xdp_interface", stream.xdp_interface);
+    bool_f(vars, "registered_io_send", stream.registered_io_send);
 
     map_int_int_f(vars, "keybindings"s, input.keybindings);
 
@@ -1206,11 +1354,17 @@ namespace config {
       input.back_button_timeout = std::chrono::milliseconds {to};
     }
 
+    to = -1;
+    int_between_f(vars, "gamepad_motion_interval", to, {0, 1000});
+    if (to >= 0) {
+      input.gamepad_motion_interval = std::chrono::milliseconds {to};
+    }
+
     double repeat_frequency {0};
     double_between_f(vars, "key_repeat_frequency", repeat_frequency, {0, std::numeric_limits<double>::max()});
 
     if (repeat_frequency > 0) {
-      config::input.key_repeat_period = std::chrono::duration<double> {1 / repeat_frequency};
+      input.key_repeat_period = std::chrono::duration<double> {1 / repeat_frequency};
     }
 
     to = -1;
@@ -1224,8 +1378,17 @@ namespace config {
     bool_f(vars, "motion_as_ds4", input.motion_as_ds4);
     bool_f(vars, "touchpad_as_ds4", input.touchpad_as_ds4);
     bool_f(vars, "ds5_inputtino_randomize_mac", input.ds5_inputtino_randomize_mac);
+    int_between_f(vars, "gamepad_pool_size", input.gamepad_pool_size, {0, 4});
 
     bool_f(vars, "mouse", input.mouse);
+
+    int move_rate = -1;
+    int_between_f(vars, "mouse_move_rate", move_rate, {0, 100000});
+    if (move_rate == 0) {
+      input.mouse_move_interval = 0ns;
+    } else if (move_rate > 0) {
+      input.mouse_move_interval = std::chrono::nanoseconds {1s} / move_rate;
+    }
     bool_f(vars, "keyboard", input.keyboard);
     bool_f(vars, "controller", input.controller);
 
@@ -1236,6 +1399,19 @@ namespace config {
 
     bool_f(vars, "notify_pre_releases", sunshine.notify_pre_releases);
     bool_f(vars, "system_tray", sunshine.system_tray);
+    bool_f(vars, "frame_trace", sunshine.frame_trace);
+    bool_f(vars, "session_recording", sunshine.session_recording);
+    bool_f(vars, "deferred_startup", sunshine.deferred_startup);
+
+    string_f(vars, "affinity_capture", sunshine.thread_affinity.capture);
+    string_f(vars, "affinity_encode", sunshine.thread_affinity.encode);
+    string_f(vars, "affinity_video_send", sunshine.thread_affinity.video_send);
+    string_f(vars, "affinity_audio", sunshine.thread_affinity.audio);
+    string_f(vars, "affinity_control", sunshine.thread_affinity.control);
+    bool_f(vars, "realtime_threads", sunshine.realtime_threads);
+
+    int_between_f(vars, "buffer_arena_size", sunshine.buffer_arena_size, {0, 1024});
+    bool_f(vars, "buffer_arena_lock", sunshine.buffer_arena_lock);
 
     int port = sunshine.port;
     int_between_f(vars, "port"s, port, {1024 + nvhttp::PORT_HTTPS, 65535 - rtsp_stream::RTSP_SETUP_PORT});
@@ -1247,10 +1423,10 @@ namespace config {
     bool_f(vars, "upnp"s, upnp);
 
     if (upnp) {
-      config::sunshine.flags[config::flag::UPNP].flip();
+      sunshine.flags[config::flag::UPNP].flip();
     }
 
-    string_restricted_f(vars, "locale", config::sunshine.locale, {
+    string_restricted_f(vars, "locale", sunshine.locale, {
                                                                    "bg"sv,  // Bulgarian
                                                                    "cs"sv,  // Czech
                                                                    "de"sv,  // German
@@ -1316,6 +1492,305 @@ namespace config {
     }
   }
 
+  void apply_config(std::unordered_map<std::string, std::string> &&vars) {
+#ifndef __ANDROID__
+    // TODO: Android can possibly support this
+    if (!fs::exists(stream.file_apps.c_str())) {
+      fs::copy_file(SUNSHINE_ASSETS_DIR "/apps.json", stream.file_apps);
+      fs::permissions(
+        stream.file_apps,
+        fs::perms::owner_read | fs::perms::owner_write,
+        fs::perm_options::add
+      );
+    }
+#endif
+
+    for (auto &[name, val] : vars) {
+      BOOST_LOG(info) << "config: '"sv << name << "' = "sv << val;
+      modified_config_settings[name] = val;
+    }
+
+    apply_options(vars, video, audio, stream, nvhttp, input, sunshine);
+  }
+
+  /**
+   * @brief The parts of the config that can change without a restart.
+   */
+  struct reloadable_t {
+    video_t video;
+    audio_t audio;
+    stream_t stream;
+    input_t input;
+  };
+
+  /**
+   * @brief The options that take effect as soon as they're applied, with how to apply each of them.
+   * @details These are `hot_t` values that the running sessions read every time they use them.
+   */
+  static const std::map<std::string_view, void (*)(const reloadable_t &)> hot_options {
+    {"ping_timeout"sv, [](const reloadable_t &options) {
+       stream.ping_timeout = options.stream.ping_timeout;
+     }},
+    {"pacing_percentage"sv, [](const reloadable_t &options) {
+       stream.pacing_percentage = options.stream.pacing_percentage;
+     }},
+    {"frame_size_limit"sv, [](const reloadable_t &options) {
+       stream.frame_size_limit = options.stream.frame_size_limit;
+     }},
+    {"stale_frame_limit"sv, [](const reloadable_t &options) {
+       stream.stale_frame_limit = options.stream.stale_frame_limit;
+     }},
+    {"back_button_timeout"sv, [](const reloadable_t &options) {
+       input.back_button_timeout = options.input.back_button_timeout;
+     }},
+    {"key_repeat_delay"sv, [](const reloadable_t &options) {
+       input.key_repeat_delay = options.input.key_repeat_delay;
+     }},
+    {"key_repeat_frequency"sv, [](const reloadable_t &options) {
+       input.key_repeat_period = options.input.key_repeat_period;
+     }},
+    {"mouse"sv, [](const reloadable_t &options) {
+       input.mouse = options.input.mouse;
+     }},
+    {"mouse_move_rate"sv, [](const reloadable_t &options) {
+       input.mouse_move_interval = options.input.mouse_move_interval;
+     }},
+    {"keyboard"sv, [](const reloadable_t &options) {
+       input.keyboard = options.input.keyboard;
+     }},
+    {"controller"sv, [](const reloadable_t &options) {
+       input.controller = options.input.controller;
+     }},
+    {"always_send_scancodes"sv, [](const reloadable_t &options) {
+       input.always_send_scancodes = options.input.always_send_scancodes;
+     }},
+    {"high_resolution_scrolling"sv, [](const reloadable_t &options) {
+       input.high_resolution_scrolling = options.input.high_resolution_scrolling;
+     }},
+  };
+
+  /**
+   * @brief The options that are only read when a session starts.
+   * @details Every other option is read on startup, or by something that outlives the sessions.
+   */
+  static const std::set<std::string_view> next_session_options {
+    // video
+    "qp"sv,
+    "min_threads"sv,
+    "max_threads"sv,
+    "sws_threads"sv,
+    "sw_preset"sv,
+    "sw_tune"sv,
+    "nvenc_preset"sv,
+    "nvenc_vbv_increase"sv,
+    "nvenc_spatial_aq"sv,
+    "nvenc_twopass"sv,
+    "nvenc_split_encode"sv,
+    "nvenc_h264_cavlc"sv,
+    "nvenc_subframe_output"sv,
+    "nvenc_pipeline_depth"sv,
+    "nvenc_ltr_recovery"sv,
+    "nvenc_realtime_hags"sv,
+    "nvenc_opengl_vulkan_on_dxgi"sv,
+    "nvenc_latency_over_power"sv,
+    "qsv_preset"sv,
+    "qsv_coder"sv,
+    "qsv_slow_hevc"sv,
+    "amd_quality"sv,
+    "amd_rc"sv,
+    "amd_coder"sv,
+    "amd_usage"sv,
+    "amd_preanalysis"sv,
+    "amd_vbaq"sv,
+    "amd_enforce_hrd"sv,
+    "vt_coder"sv,
+    "vt_software"sv,
+    "vt_realtime"sv,
+    "vt_native"sv,
+    "vaapi_strict_rc_buffer"sv,
+    "vaapi_compute_convert"sv,
+    "dxgi_compute_convert"sv,
+    "capture_phase_lock"sv,
+    "evdi_teardown_delay"sv,
+    "wgc_frame_pool_size"sv,
+    "wgc_window_capture"sv,
+    "output_name"sv,
+    "dd_configuration_option"sv,
+    "dd_resolution_option"sv,
+    "dd_manual_resolution"sv,
+    "dd_refresh_rate_option"sv,
+    "dd_manual_refresh_rate"sv,
+    "dd_hdr_option"sv,
+    "dd_config_revert_delay"sv,
+    "dd_config_revert_on_disconnect"sv,
+    "dd_mode_remapping"sv,
+    "dd_wa_hdr_toggle_delay"sv,
+    "max_bitrate"sv,
+    "minimum_fps_target"sv,
+    "shared_encoding"sv,
+    "skip_unchanged_frames"sv,
+    "intra_refresh_frames"sv,
+    "cursor_roi_qp"sv,
+    "dynamic_resolution"sv,
+    "screen_content"sv,
+    "preset_budget"sv,
+    "quality_sample_interval"sv,
+    "idle_timeout"sv,
+
+    // audio
+    "stream_audio"sv,
+    "audio_fused_pipeline"sv,
+    "audio_adaptive_fec"sv,
+    "audio_drift_compensation"sv,
+    "audio_queue_auto_tune"sv,
+    "audio_opus_complexity"sv,
+
+    // stream
+    "lan_encryption_mode"sv,
+    "wan_encryption_mode"sv,
+    "fec_percentage"sv,
+    "adaptive_fec"sv,
+    "video_retransmission"sv,
+    "fec_threads"sv,
+    "video_broadcast_threads"sv,
+    "adaptive_bitrate"sv,
+    "warm_start"sv,
+    "kernel_pacing"sv,
+
+    // input
+    "keybindings"sv,
+    "key_rightalt_to_key_win"sv,
+    "gamepad_motion_interval"sv,
+    "ds4_back_as_touchpad_click"sv,
+    "motion_as_ds4"sv,
+    "touchpad_as_ds4"sv,
+    "native_pen_touch"sv,
+  };
+
+  /**
+   * @brief What the config was built from, to tell which options changed when it's read again.
+   */
+  static struct {
+    std::mutex lock;
+
+    std::unordered_map<std::string, std::string> vars;  ///< The options applied, from the config file and the command line
+    std::unordered_map<std::string, std::string> cmd_vars;  ///< The options of the command line, which override the file
+    std::optional<reloadable_t> defaults;
+
+    std::optional<reloadable_t> pending;  ///< The options waiting for the next session
+  } applied;
+
+  reload_scope_e reload_scope(std::string_view name) {
+    if (hot_options.contains(name)) {
+      return reload_scope_e::hot;
+    }
+    if (next_session_options.contains(name)) {
+      return reload_scope_e::next_session;
+    }
+
+    return reload_scope_e::restart;
+  }
+
+  reload_t reload() {
+    auto vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
+
+    reload_t changed;
+    {
+      std::lock_guard lg {applied.lock};
+      if (!applied.defaults) {
+        return changed;
+      }
+
+      for (auto &[name, value] : applied.cmd_vars) {
+        vars.insert_or_assign(name, value);
+      }
+
+      auto add_changed = [&changed](const std::string &name) {
+        switch (reload_scope(name)) {
+          case reload_scope_e::hot:
+            changed.hot.emplace_back(name);
+            break;
+          case reload_scope_e::next_session:
+            changed.next_session.emplace_back(name);
+            break;
+          case reload_scope_e::restart:
+            changed.restart.emplace_back(name);
+            break;
+        }
+      };
+      for (auto &[name, value] : vars) {
+        auto it = applied.vars.find(name);
+        if (it == std::end(applied.vars) || it->second != value) {
+          add_changed(name);
+        }
+      }
+      for (auto &[name, _] : applied.vars) {
+        if (!vars.contains(name)) {
+          add_changed(name);
+        }
+      }
+
+      // The options that need a restart keep the values they had on startup
+      for (auto &name : changed.restart) {
+        auto it = applied.vars.find(name);
+        if (it != std::end(applied.vars)) {
+          vars.insert_or_assign(name, it->second);
+        } else {
+          vars.erase(name);
+        }
+      }
+
+      for (auto &name : changed.restart) {
+        BOOST_LOG(info) << "config: '"sv << name << "' changed, restart to apply it"sv;
+      }
+      if (changed.hot.empty() && changed.next_session.empty()) {
+        return changed;
+      }
+
+      for (auto *names : {&changed.hot, &changed.next_session}) {
+        for (auto &name : *names) {
+          auto it = vars.find(name);
+          BOOST_LOG(info) << "config: '"sv << name << "' = "sv << (it != std::end(vars) ? it->second : "default"s);
+        }
+      }
+      applied.vars = vars;
+
+      // Build the config from its defaults as on startup, the copies of the rest of it are thrown away
+      auto options = *applied.defaults;
+      auto nvhttp_copy = nvhttp;
+      auto sunshine_copy = sunshine;
+      vars.erase("flags"s);
+      apply_options(vars, options.video, options.audio, options.stream, nvhttp_copy, options.input, sunshine_copy);
+
+      for (auto &name : changed.hot) {
+        hot_options.at(name)(options);
+      }
+      applied.pending = std::move(options);
+    }
+
+    return changed;
+  }
+
+  void apply_pending() {
+    std::lock_guard lg {applied.lock};
+    if (!applied.pending || rtsp_stream::session_count() > 0) {
+      return;
+    }
+
+    // What's kept running between sessions reads the config too, and is started again for the next session
+    ::stream::release_parked_broadcast();
+    ::audio::release_warm_captures();
+    ::video::release_warm_display();
+
+    video = std::move(applied.pending->video);
+    audio = std::move(applied.pending->audio);
+    stream = std::move(applied.pending->stream);
+    input = std::move(applied.pending->input);
+    applied.pending.reset();
+
+    BOOST_LOG(info) << "config: Applied the options waiting for the next session"sv;
+  }
+
   int parse(int argc, char *argv[]) {
     std::unordered_map<std::string, std::string> cmd_vars;
 #ifdef _WIN32
@@ -1388,7 +1863,14 @@ namespace config {
       auto vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
 
       for (auto &[name, value] : cmd_vars) {
-        vars.insert_or_assign(std::move(name), std::move(value));
+        vars.insert_or_assign(name, value);
+      }
+
+      {
+        std::lock_guard lg {applied.lock};
+        applied.vars = vars;
+        applied.cmd_vars = std::move(cmd_vars);
+        applied.defaults = reloadable_t {video, audio, stream, input};
       }
 
       // Apply the config. Note: This will try to create any paths
@@ -5,10 +5,13 @@
 #pragma once
 
 // standard includes
+#include <atomic>
 #include <bitset>
 #include <chrono>
+#include <concepts>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -19,6 +22,42 @@ namespace config {
   // track modified config options
   inline std::unordered_map<std::string, std::string> modified_config_settings;
 
+  /**
+   * @brief An option that can be applied while the sessions are reading it, see `reload_scope_e::hot`.
+   * @details The value is loaded and stored atomically, so the config can be reloaded from another thread.
+   */
+  template<class T>
+  class hot_t {
+  public:
+    hot_t() = default;
+
+    template<class U>
+      requires(!std::same_as<std::remove_cvref_t<U>, hot_t> && std::convertible_to<U, T>)
+    hot_t(U &&value):
+        _value {T(std::forward<U>(value))} {
+    }
+
+    hot_t(const hot_t &other):
+        _value {other.load()} {
+    }
+
+    hot_t &operator=(const hot_t &other) {
+      _value.store(other.load(), std::memory_order_relaxed);
+      return *this;
+    }
+
+    operator T() const {
+      return load();
+    }
+
+    T load() const {
+      return _value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<T> _value {};
+  };
+
   struct video_t {
     // ffmpeg params
     int qp;  // higher == more compression and less quality
@@ -27,6 +66,8 @@ namespace config {
     int av1_mode;
 
     int min_threads;  // Minimum number of threads/slices for CPU encoding
+    int max_threads;  ///< Most threads/slices CPU encoding scales up to, `0` for all CPUs but two
+    int sws_threads;  ///< Threads converting captured frames for CPU encoding, `0` to pick them from the frame height
 
     struct {
       std::string sw_preset;
@@ -74,14 +115,24 @@ namespace config {
       int vt_require_sw;
       int vt_realtime;
       int vt_coder;
+      bool vt_native;
     } vt;
 
     struct {
       bool strict_rc_buffer;
+      bool compute_convert;  ///< Convert to YUV with a single compute shader dispatch instead of two render passes.
     } vaapi;
 
+    bool dxgi_compute_convert;  ///< Convert to NV12/P010 with a single D3D11 compute shader dispatch instead of render passes.
+    bool capture_phase_lock;  ///< Shift the paced Windows captures to just after the game presents a frame.
+
     std::string capture;
+    bool evdi_persistent;  ///< Keep the EVDI virtual display connected between sessions, and only switch its mode.
+    std::chrono::milliseconds evdi_teardown_delay;  ///< Time to keep the EVDI virtual display after the last session ended, for a client reconnecting.
+    int wgc_frame_pool_size;  ///< Number of buffers in the Windows.Graphics.Capture frame pool.
+    bool wgc_window_capture;  ///< Capture the main window of the running app instead of the whole monitor.
     std::string encoder;
+    bool parallel_encoder_probing;  ///< Probe encoders of separate drivers alongside each other.
     std::string adapter_name;
     std::string output_name;
 
@@ -142,6 +193,23 @@ namespace config {
 
     int max_bitrate;  // Maximum bitrate, sets ceiling in kbps for bitrate requested from client
     double minimum_fps_target;  ///< Lowest framerate that will be used when streaming. Range 0-1000, 0 = half of client's requested framerate.
+    bool shared_encoding;  ///< Let sessions with identical video settings share a single encoder.
+    bool skip_unchanged_frames;  ///< Don't encode captured frames that are identical to the previous one.
+    int intra_refresh_frames;  ///< Refresh the picture with intra coded blocks over this many frames instead of IDR frames, 0 to disable.
+    int cursor_roi_qp;  ///< Lower the QP of the region around the mouse cursor by this much, 0 to disable.
+    bool dynamic_resolution;  ///< Encode below the client's resolution while encoding or sending falls behind.
+
+    enum class screen_content_e {
+      disabled,  ///< Encode with the tools of the default presets.
+      enabled,  ///< Enable the screen content coding tools of the encoder.
+      automatic  ///< Enable them while the captured content is mostly static, like a desktop.
+    };
+
+    screen_content_e screen_content;
+
+    int preset_budget;  ///< Encode with faster presets while frames take longer than this percentage of the frame interval to encode, 0 to disable.
+    int quality_sample_interval;  ///< Decode the encoded video and compare every this many frames to their source, 0 to disable.
+    int idle_timeout;  ///< Seconds without input or a changed frame until the capture slows down to a trickle, 0 to disable.
   };
 
   struct audio_t {
@@ -149,6 +217,12 @@ namespace config {
     std::string virtual_sink;
     bool stream;
     bool install_steam_drivers;
+    bool fused_pipeline;
+    bool adaptive_fec;
+    bool drift_compensation;
+    bool queue_auto_tune;
+    bool keep_warm;
+    int opus_complexity;  ///< The Opus encoder complexity, or -1 for the library default.
   };
 
   constexpr int ENCRYPTION_MODE_NEVER = 0;  // Never use video encryption, even if the client supports it
@@ -156,12 +230,57 @@ namespace config {
   constexpr int ENCRYPTION_MODE_MANDATORY = 2;  // Always use video encryption and refuse clients that can't encrypt
 
   struct stream_t {
-    std::chrono::milliseconds ping_timeout;
+    hot_t<std::chrono::milliseconds> ping_timeout;
 
     std::string file_apps;
 
     int fec_percentage;
 
+    // Adapt the FEC percentage of each session to the loss its client reports, starting from fec_percentage
+    bool adaptive_fec;
+
+    // Keep the video shards sent last, to send again those the client reports missing with a NACK
+    bool video_retransmission;
+
+    // Number of worker threads used to generate FEC and encrypt video shards in parallel
+    // with sending them, 0 to do everything on the video broadcast thread, or -1 to only
+    // use workers when the CPU has no AES instructions
+    int fec_threads;
+
+    // Number of threads sending video, with each session sent by one of them, or 0 to pick
+    // it from the number of CPUs
+    int video_broadcast_threads;
+
+    // Percentage of the frame interval to spread the packets of each frame across,
+    // or 0 to send them as fast as the client's link is estimated to take them
+    hot_t<int> pacing_percentage;
+
+    // Percentage of the frame interval the client's link is estimated to take the largest video frame in,
+    // or 0 to leave the size of each frame to the rate control of the encoder
+    hot_t<int> frame_size_limit;
+
+    // Percentage of the frame interval a video frame may wait to be sent while a newer one is queued,
+    // or 0 to send every frame however late it is
+    hot_t<int> stale_frame_limit;
+
+    // Adapt the video bitrate to the loss and backlog on the link, without going above what the client asked for
+    bool adaptive_bitrate;
+
+    // Start the adaptive bitrate, FEC and pacing of a paired client's session from what its last sessions learned
+    bool warm_start;
+
+    // Send video packets with io_uring on Linux, falling back to regular sends when it's unavailable
+    bool io_uring_send;
+
+    // Let the kernel pace video packets from their SO_TXTIME launch times on Linux, falling back to pacing in Sunshine
+    bool kernel_pacing;
+
+    // Network interface to send IPv4 video packets out of with an AF_XDP socket on Linux, or empty to use regular sends
+    std::string xdp_interface;
+
+    // Send video and audio packets with Registered I/O on Windows, falling back to regular sends when it's unavailable
+    bool registered_io_send;
+
     // Video encryption settings for LAN and WAN streams
     int lan_encryption_mode;
     int wan_encryption_mode;
@@ -180,28 +299,33 @@ namespace config {
     std::string file_state;
 
     std::string external_ip;
+
+    int worker_threads;  ///< Threads of each HTTP server running its slow requests, such as app images and log downloads
   };
 
   struct input_t {
     std::unordered_map<int, int> keybindings;
 
-    std::chrono::milliseconds back_button_timeout;
-    std::chrono::milliseconds key_repeat_delay;
-    std::chrono::duration<double> key_repeat_period;
+    hot_t<std::chrono::milliseconds> back_button_timeout;
+    std::chrono::milliseconds gamepad_motion_interval;  ///< Forward a motion sensor at most once per interval, 0 to forward every sample
+    hot_t<std::chrono::milliseconds> key_repeat_delay;
+    hot_t<std::chrono::duration<double>> key_repeat_period;
+    hot_t<std::chrono::nanoseconds> mouse_move_interval;  ///< Coalesce the relative mouse moves within this interval, 0 to send every move
 
     std::string gamepad;
     bool ds4_back_as_touchpad_click;
     bool motion_as_ds4;
     bool touchpad_as_ds4;
     bool ds5_inputtino_randomize_mac;
+    int gamepad_pool_size;  ///< Spare virtual gamepads kept ready for each type in use, 0 to create them on arrival
 
-    bool keyboard;
-    bool mouse;
-    bool controller;
+    hot_t<bool> keyboard;
+    hot_t<bool> mouse;
+    hot_t<bool> controller;
 
-    bool always_send_scancodes;
+    hot_t<bool> always_send_scancodes;
 
-    bool high_resolution_scrolling;
+    hot_t<bool> high_resolution_scrolling;
     bool native_pen_touch;
   };
 
@@ -228,9 +352,14 @@ namespace config {
         elevated(std::move(elevated)) {
     }
 
+    bool operator==(const prep_cmd_t &) const = default;
+
     std::string do_cmd;
     std::string undo_cmd;
     bool elevated;
+    bool parallel {};  ///< Start without waiting for the command before it to finish
+    bool required {true};  ///< Whether the app waits for the command, and isn't started if it fails
+    std::chrono::seconds timeout {};  ///< How long the command may run before it's killed, `0` for no limit
   };
 
   struct sunshine_t {
@@ -257,7 +386,26 @@ namespace config {
     std::string log_file;
     bool notify_pre_releases;
     bool system_tray;
+    bool frame_trace;  ///< Record the time each frame spends in each stage of the stream
+    bool session_recording;  ///< Record the video, control and input packets of each session to replay them
+    bool deferred_startup;  ///< Start the servers before probing encoders, audio and gamepads, and probe them in the background
     std::vector<prep_cmd_t> prep_cmds;
+
+    /**
+     * @brief The CPU sets the streaming threads are pinned to, empty to leave them to the scheduler.
+     * @details See thread_affinity::parse() for the syntax.
+     */
+    struct thread_affinity_t {
+      std::string capture;
+      std::string encode;
+      std::string video_send;
+      std::string audio;
+      std::string control;
+    } thread_affinity;
+    bool realtime_threads;  ///< Run the streaming threads with a real-time scheduling policy where the system allows it
+
+    int buffer_arena_size;  ///< MiB of huge pages the packet buffers are carved from, 0 to use the heap
+    bool buffer_arena_lock;  ///< Lock the packet buffer arena in memory
   };
 
   extern video_t video;
@@ -269,4 +417,46 @@ namespace config {
 
   int parse(int argc, char *argv[]);
   std::unordered_map<std::string, std::string> parse_config(const std::string_view &file_content);
+
+  /**
+   * @brief When a change to an option takes effect without restarting Sunshine.
+   */
+  enum class reload_scope_e {
+    hot,  ///< Applied right away, running sessions read it as they use it
+    next_session,  ///< Applied once no session is streaming, before the next one starts
+    restart,  ///< Only applied when Sunshine restarts
+  };
+
+  /**
+   * @brief Get when a change to an option takes effect.
+   * @param name The name of the option, as in the config file.
+   * @return The scope of the option, `reload_scope_e::restart` for unknown options.
+   */
+  reload_scope_e reload_scope(std::string_view name);
+
+  /**
+   * @brief The options that changed when the config file was read again, by scope.
+   */
+  struct reload_t {
+    std::vector<std::string> hot;
+    std::vector<std::string> next_session;
+    std::vector<std::string> restart;
+  };
+
+  /**
+   * @brief Read the config file again and apply the options that changed, as far as their scope allows.
+   * @return The options that changed since the config was last applied.
+   * @details Hot options are applied right away. The others are built from their defaults like on startup,
+   *          and applied by `apply_pending()` when the next session is launched. Options that need a
+   *          restart keep the values they had on startup.
+   */
+  reload_t reload();
+
+  /**
+   * @brief Apply the options waiting for the next session, unless a session is streaming.
+   * @details The broadcast, the audio captures and the display kept for the next session are stopped first,
+   *          so no thread outside of a session reads the config while it's replaced.
+   *          Only the launch and resume requests call this, under the lock that also covers their reads of the config.
+   */
+  void apply_pending();
 }  // namespace config
@@ -7,10 +7,20 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <limits>
+#include <mutex>
 #include <set>
+#include <system_error>
+#include <vector>
 
 // lib includes
 #include <boost/algorithm/string.hpp>
@@ -26,15 +36,19 @@
 #include "crypto.h"
 #include "display_device.h"
 #include "file_handler.h"
+#include "frame_trace.h"
 #include "globals.h"
 #include "httpcommon.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
 #include "utility.h"
 #include "uuid.h"
+#include "video.h"
+#include "web_assets.h"
 
 using namespace std::literals;
 
@@ -52,6 +66,13 @@ namespace confighttp {
     REMOVE  ///< Remove client
   };
 
+  // The apps as getApps() sends them, kept until they change
+  struct {
+    std::mutex lock;
+    std::uint64_t version = 0;
+    std::string json;
+  } apps_response;
+
   /**
    * @brief Log the request details.
    * @param request The HTTP request object.
@@ -74,16 +95,25 @@ namespace confighttp {
   }
 
   /**
-   * @brief Send a response.
+   * @brief Send a response that is serialized already.
    * @param response The HTTP response object.
-   * @param output_tree The JSON tree to send.
+   * @param output The JSON to send.
    */
-  void send_response(resp_https_t response, const nlohmann::json &output_tree) {
+  void send_response(resp_https_t response, std::string_view output) {
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "application/json");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(output_tree.dump(), headers);
+    response->write(output, headers);
+  }
+
+  /**
+   * @brief Send a response.
+   * @param response The HTTP response object.
+   * @param output_tree The JSON tree to send.
+   */
+  void send_response(resp_https_t response, const nlohmann::json &output_tree) {
+    send_response(response, std::string_view {output_tree.dump()});
   }
 
   /**
@@ -222,6 +252,52 @@ namespace confighttp {
     response->write(code, tree.dump(), headers);
   }
 
+  /**
+   * @brief Send a Web UI file from memory, compressed if the client takes it, or tell the client its copy is current.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param path The path of the file.
+   * @param content_type The MIME type of the file.
+   * @param headers Any headers to add to the usual ones.
+   */
+  void send_file(resp_https_t response, req_https_t request, const fs::path &path, std::string_view content_type, SimpleWeb::CaseInsensitiveMultimap headers = {}) {
+    auto asset = web_assets::get(path, content_type);
+    if (!asset) {
+      not_found(response, request);
+      return;
+    }
+
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    headers.emplace("ETag", asset->etag);
+    headers.emplace("Vary", "Accept-Encoding");
+
+    // Pages are behind authentication, so they aren't kept by shared caches and are always checked for changes
+    if (asset->fingerprinted) {
+      headers.emplace("Cache-Control", "public, max-age=31536000, immutable");
+    } else if (content_type.starts_with("text/html"sv)) {
+      headers.emplace("Cache-Control", "private, no-cache");
+    } else {
+      headers.emplace("Cache-Control", "no-cache");
+    }
+
+    if (auto if_none_match = request->header.find("if-none-match"); if_none_match != request->header.end() && web_assets::matches_etag(if_none_match->second, asset->etag)) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
+    headers.emplace("Content-Type", asset->content_type);
+
+    auto accept_encoding = request->header.find("accept-encoding");
+    if (!asset->gzipped.empty() && accept_encoding != request->header.end() && web_assets::accepts_gzip(accept_encoding->second)) {
+      headers.emplace("Content-Encoding", "gzip");
+      response->write(asset->gzipped, headers);
+      return;
+    }
+
+    response->write(asset->content, headers);
+  }
+
   /**
    * @brief Validate the request content type and send bad request when mismatch.
    * @param response The HTTP response object.
@@ -268,12 +344,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "index.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "index.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -288,12 +359,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "pin.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "pin.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -308,13 +374,9 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "apps.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
     headers.emplace("Access-Control-Allow-Origin", "https://images.igdb.com/");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "apps.html", "text/html; charset=utf-8", std::move(headers));
   }
 
   /**
@@ -329,12 +391,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "clients.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "clients.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -349,12 +406,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "config.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "config.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -369,12 +421,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "password.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "password.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -388,12 +435,7 @@ namespace confighttp {
       send_redirect(response, request, "/");
       return;
     }
-    std::string content = file_handler::read_file(WEB_DIR "welcome.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "welcome.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -408,12 +450,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "troubleshooting.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_file(response, request, WEB_DIR "troubleshooting.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -426,12 +463,7 @@ namespace confighttp {
   void getFaviconImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/sunshine.ico", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/x-icon");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_file(response, request, WEB_DIR "images/sunshine.ico", "image/x-icon");
   }
 
   /**
@@ -444,12 +476,7 @@ namespace confighttp {
   void getSunshineLogoImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/logo-sunshine-45.png", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/png");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_file(response, request, WEB_DIR "images/logo-sunshine-45.png", "image/png");
   }
 
   /**
@@ -497,13 +524,8 @@ namespace confighttp {
       return;
     }
 
-    // if it is, set the content type to the mime type
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", mimeType->second);
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    std::ifstream in(filePath.string(), std::ios::binary);
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    // if it is, send it with the mime type
+    send_file(response, request, filePath, mimeType->second);
   }
 
   /**
@@ -521,8 +543,15 @@ namespace confighttp {
     print_req(request);
 
     try {
-      std::string content = file_handler::read_file(config::stream.file_apps.c_str());
-      nlohmann::json file_tree = nlohmann::json::parse(content);
+      auto apps = proc::load_apps(config::stream.file_apps);
+
+      std::lock_guard lg {apps_response.lock};
+      if (apps_response.version == apps.version) {
+        send_response(response, std::string_view {apps_response.json});
+        return;
+      }
+
+      nlohmann::json file_tree = *apps.tree;
 
       // Legacy versions of Sunshine used strings for boolean and integers, let's convert them
       // List of keys to convert to boolean
@@ -559,7 +588,9 @@ namespace confighttp {
         }
       }
 
-      send_response(response, file_tree);
+      apps_response.version = apps.version;
+      apps_response.json = file_tree.dump();
+      send_response(response, std::string_view {apps_response.json});
     } catch (std::exception &e) {
       BOOST_LOG(warning) << "GetApps: "sv << e.what();
       bad_request(response, request, e.what());
@@ -614,9 +645,6 @@ namespace confighttp {
       // TODO: Input Validation
       nlohmann::json output_tree;
       nlohmann::json input_tree = nlohmann::json::parse(ss);
-      std::string file = file_handler::read_file(config::stream.file_apps.c_str());
-      BOOST_LOG(info) << file;
-      nlohmann::json file_tree = nlohmann::json::parse(file);
 
       if (input_tree["prep-cmd"].empty()) {
         input_tree.erase("prep-cmd");
@@ -626,32 +654,34 @@ namespace confighttp {
         input_tree.erase("detached");
       }
 
-      auto &apps_node = file_tree["apps"];
       int index = input_tree["index"].get<int>();  // this will intentionally cause exception if the provided value is the wrong type
 
       input_tree.erase("index");
 
-      if (index == -1) {
-        apps_node.push_back(input_tree);
-      } else {
-        nlohmann::json newApps = nlohmann::json::array();
-        for (size_t i = 0; i < apps_node.size(); ++i) {
-          if (i == index) {
-            newApps.push_back(input_tree);
-          } else {
-            newApps.push_back(apps_node[i]);
+      // Applied to the apps in memory, the apps file is written shortly after
+      auto changed = proc::edit_apps(config::stream.file_apps, [&](nlohmann::json &file_tree) {
+        auto &apps_node = file_tree["apps"];
+
+        if (index == -1) {
+          apps_node.push_back(input_tree);
+        } else {
+          nlohmann::json newApps = nlohmann::json::array();
+          for (size_t i = 0; i < apps_node.size(); ++i) {
+            if (i == index) {
+              newApps.push_back(input_tree);
+            } else {
+              newApps.push_back(apps_node[i]);
+            }
           }
+          file_tree["apps"] = newApps;
         }
-        file_tree["apps"] = newApps;
-      }
 
-      // Sort the apps array by name
-      std::sort(apps_node.begin(), apps_node.end(), [](const nlohmann::json &a, const nlohmann::json &b) {
-        return a["name"].get<std::string>() < b["name"].get<std::string>();
+        // Sort the apps array by name
+        std::sort(apps_node.begin(), apps_node.end(), [](const nlohmann::json &a, const nlohmann::json &b) {
+          return a["name"].get<std::string>() < b["name"].get<std::string>();
+        });
       });
-
-      file_handler::write_file(config::stream.file_apps.c_str(), file_tree.dump(4));
-      proc::refresh(config::stream.file_apps);
+      nvhttp::apps_changed(changed);
 
       output_tree["status"] = true;
       send_response(response, output_tree);
@@ -685,6 +715,51 @@ namespace confighttp {
     send_response(response, output_tree);
   }
 
+  /**
+   * @brief Get how long the last launch of an app took.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @details Lists the prep commands in the order they were started, with the time each one started at and took.
+   * Commands the app doesn't wait for have no duration until they finish, and no exit code if they were killed.
+   *
+   * @api_examples{/api/apps/launch| GET| null}
+   */
+  void getLaunchTimeline(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto to_ms = [](std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration<double, std::milli> {duration}.count();
+    };
+
+    auto timeline = proc::last_launch();
+
+    nlohmann::json steps = nlohmann::json::array();
+    for (const auto &step : timeline.steps) {
+      steps.push_back({
+        {"cmd", step.cmd},
+        {"parallel", step.parallel},
+        {"required", step.required},
+        {"started_ms", to_ms(step.started)},
+        {"duration_ms", step.duration ? nlohmann::json(to_ms(*step.duration)) : nlohmann::json()},
+        {"exit_code", step.exit_code ? nlohmann::json(*step.exit_code) : nlohmann::json()},
+        {"timed_out", step.timed_out},
+      });
+    }
+
+    nlohmann::json output_tree;
+    output_tree["app_name"] = timeline.app_name;
+    output_tree["launched"] = timeline.launched;
+    output_tree["prep_ms"] = to_ms(timeline.prep);
+    output_tree["duration_ms"] = to_ms(timeline.duration);
+    output_tree["steps"] = steps;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
   /**
    * @brief Delete an application.
    * @param response The HTTP response object.
@@ -703,32 +778,29 @@ namespace confighttp {
 
     try {
       nlohmann::json output_tree;
-      nlohmann::json new_apps = nlohmann::json::array();
-      std::string file = file_handler::read_file(config::stream.file_apps.c_str());
-      nlohmann::json file_tree = nlohmann::json::parse(file);
-      auto &apps_node = file_tree["apps"];
       const int index = std::stoi(request->path_match[1]);
 
-      if (index < 0 || index >= static_cast<int>(apps_node.size())) {
-        std::string error;
-        if (const int max_index = static_cast<int>(apps_node.size()) - 1; max_index < 0) {
-          error = "No applications to delete";
-        } else {
-          error = std::format("'index' {} out of range, max index is {}", index, max_index);
-        }
-        bad_request(response, request, error);
-        return;
-      }
+      auto changed = proc::edit_apps(config::stream.file_apps, [&](nlohmann::json &file_tree) {
+        auto &apps_node = file_tree["apps"];
 
-      for (size_t i = 0; i < apps_node.size(); ++i) {
-        if (i != index) {
-          new_apps.push_back(apps_node[i]);
+        // Nothing changes when the edit throws, and the error is sent back
+        if (index < 0 || index >= static_cast<int>(apps_node.size())) {
+          const int max_index = static_cast<int>(apps_node.size()) - 1;
+          if (max_index < 0) {
+            throw std::out_of_range {"No applications to delete"};
+          }
+          throw std::out_of_range {std::format("'index' {} out of range, max index is {}", index, max_index)};
         }
-      }
-      file_tree["apps"] = new_apps;
 
-      file_handler::write_file(config::stream.file_apps.c_str(), file_tree.dump(4));
-      proc::refresh(config::stream.file_apps);
+        nlohmann::json new_apps = nlohmann::json::array();
+        for (size_t i = 0; i < apps_node.size(); ++i) {
+          if (i != index) {
+            new_apps.push_back(apps_node[i]);
+          }
+        }
+        file_tree["apps"] = new_apps;
+      });
+      nvhttp::apps_changed(changed);
 
       output_tree["status"] = true;
       output_tree["result"] = std::format("application {} deleted", index);
@@ -884,6 +956,10 @@ namespace confighttp {
    *
    * @attention{It is recommended to ONLY save the config settings that differ from the default behavior.}
    *
+   * The settings that changed are applied as far as their scope allows, and listed in the response:
+   * `hot` ones were applied to the running sessions, `next_session` ones are applied before the next session
+   * starts, and `restart` ones need Sunshine to be restarted.
+   *
    * @api_examples{/api/config| POST| {"key":"value"}}
    */
   void saveConfig(resp_https_t response, req_https_t request) {
@@ -913,6 +989,11 @@ namespace confighttp {
         config_stream << k << " = " << (v.is_string() ? v.get<std::string>() : v.dump()) << std::endl;
       }
       file_handler::write_file(config::sunshine.config_file.c_str(), config_stream.str());
+
+      auto changed = config::reload();
+      output_tree["hot"] = changed.hot;
+      output_tree["next_session"] = changed.next_session;
+      output_tree["restart"] = changed.restart;
       output_tree["status"] = true;
       send_response(response, output_tree);
     } catch (std::exception &e) {
@@ -984,10 +1065,45 @@ namespace confighttp {
     }
   }
 
+  // Parts of the log file are sent this much at a time
+  constexpr std::size_t LOG_CHUNK_SIZE = 64 * 1024;
+
+  /**
+   * @brief Send the rest of a part of the log file, a chunk at a time.
+   * @param response The HTTP response object, whose headers were written already.
+   * @param file The log file, at the offset of the next chunk.
+   * @param remaining The number of bytes left to send.
+   */
+  void send_log_chunks(resp_https_t response, std::shared_ptr<std::ifstream> file, std::uint64_t remaining) {
+    if (remaining == 0) {
+      return;
+    }
+
+    std::string chunk(std::min<std::uint64_t>(remaining, LOG_CHUNK_SIZE), '\0');
+    file->read(chunk.data(), chunk.size());
+    chunk.resize(file->gcount());
+    if (chunk.empty()) {
+      // The log file was truncated, so the response can't have the size it announced
+      response->close_connection_after_response = true;
+      return;
+    }
+
+    remaining -= chunk.size();
+    *response << chunk;
+    response->send([response, file, remaining](const SimpleWeb::error_code &ec) {
+      if (!ec) {
+        send_log_chunks(response, file, remaining);
+      }
+    });
+  }
+
   /**
    * @brief Get the logs from the log file.
    * @param response The HTTP response object.
    * @param request The HTTP request object.
+   * @details A part of the log can be asked for with a `Range` header, such as `bytes=-65536` for its
+   * last 64 KiB. The log is sent from disk a chunk at a time. The `X-Log-Next-Line` header holds
+   * the sequence number to follow the log from with `/api/logs/recent`.
    *
    * @api_examples{/api/logs| GET| null}
    */
@@ -998,12 +1114,264 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
+    // Taken before the size of the file, so following the log from here never misses a line
+    auto next_line = logging::recent_lines(std::numeric_limits<std::uint64_t>::max()).first;
+
+    std::error_code ec;
+    std::uint64_t size = fs::file_size(config::sunshine.log_file, ec);
+    if (ec) {
+      size = 0;
+    }
+
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/plain");
+    headers.emplace("Accept-Ranges", "bytes");
+    headers.emplace("X-Log-Next-Line", std::to_string(next_line));
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+
+    std::uint64_t offset = 0;
+    std::uint64_t count = size;
+    auto status = SimpleWeb::StatusCode::success_ok;
+
+    auto range = request->header.find("Range");
+    if (range != std::end(request->header)) {
+      auto part = http::parse_range(range->second, size);
+      if (!part) {
+        headers.emplace("Content-Range", std::format("bytes */{}", size));
+        response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable, headers);
+        return;
+      }
+
+      std::tie(offset, count) = *part;
+      status = SimpleWeb::StatusCode::success_partial_content;
+      headers.emplace("Content-Range", std::format("bytes {}-{}/{}", offset, offset + count - 1, size));
+    }
+
+    auto file = std::make_shared<std::ifstream>(config::sunshine.log_file, std::ios::binary);
+    if (count > 0 && !file->seekg(offset)) {
+      count = 0;
+    }
+
+    headers.emplace("Content-Length", std::to_string(count));
+    response->write(status, headers);
+    send_log_chunks(response, std::move(file), count);
+  }
+
+  /**
+   * @brief Get the lines logged last, to follow the log without reading the log file again.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @details The `since` query parameter is the sequence number of the first line to get, as
+   * returned in `next` by the previous call or in the `X-Log-Next-Line` header of `/api/logs`.
+   * Only the last lines are kept in memory, so older ones are skipped.
+   *
+   * @api_examples{/api/logs/recent?since=0| GET| {"next":2,"lines":["[2025-01-01 00:00:00.000]: Info: ..."]}}
+   */
+  void getRecentLogs(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::uint64_t since = 0;
+    auto args = request->parse_query_string();
+    if (auto it = args.find("since"); it != std::end(args)) {
+      std::from_chars(it->second.data(), it->second.data() + it->second.size(), since);
+    }
+
+    auto [next, lines] = logging::recent_lines(since);
+
+    nlohmann::json output_tree;
+    output_tree["next"] = next;
+    output_tree["lines"] = std::move(lines);
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the streaming metrics.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @details The metrics are in the Prometheus text exposition format. Scrapers authenticate
+   * with the Web UI credentials, using HTTP basic authentication.
+   *
+   * @api_examples{/metrics| GET| null}
+   */
+  void getMetrics(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, metrics::expose(), headers);
+  }
+
+  // How often the telemetry is pushed to its subscribers
+  constexpr auto TELEMETRY_INTERVAL = std::chrono::seconds {1};
+
+  struct telemetry_subscriber_t {
+    explicit telemetry_subscriber_t(resp_https_t response):
+        response {std::move(response)} {
+    }
+
+    resp_https_t response;
+    std::atomic_bool sending {false};
+    std::atomic_bool closed {false};
+  };
+
+  struct telemetry_t {
+    std::mutex lock;
+    std::vector<std::shared_ptr<telemetry_subscriber_t>> subscribers;
+
+    // Only used by the thread pushing the telemetry
+    metrics::session_sampler_t sampler;
+  };
+
+  telemetry_t telemetry;
+
+  /**
+   * @brief Get the percentiles of a summary, in milliseconds.
+   * @param summary The summary.
+   * @return The percentiles, keyed by name.
+   */
+  nlohmann::json percentiles_ms(const metrics::summary_t &summary) {
+    static constexpr std::array<std::string_view, metrics::summary_t::QUANTILES.size()> names {"p50", "p90", "p99", "p999"};
+
+    nlohmann::json percentiles;
+    for (std::size_t x = 0; x < names.size(); ++x) {
+      percentiles[names[x]] = summary.quantile(x) * 1000;
+    }
+    return percentiles;
+  }
+
+  /**
+   * @brief Send the current telemetry to every subscriber.
+   * @details A subscriber still receiving the previous event skips this one, so a slow client never
+   * makes events queue up. The metrics are only read, so the streaming threads never wait on this.
+   */
+  void push_telemetry() {
+    std::vector<std::shared_ptr<telemetry_subscriber_t>> subscribers;
+    {
+      std::lock_guard lg {telemetry.lock};
+      std::erase_if(telemetry.subscribers, [](auto &subscriber) {
+        return subscriber->closed.load();
+      });
+      subscribers = telemetry.subscribers;
+    }
+
+    if (subscribers.empty()) {
+      return;
+    }
+
+    nlohmann::json output_tree;
+    output_tree["sessions"] = nlohmann::json::array();
+    for (auto &stats : telemetry.sampler.sample(std::chrono::steady_clock::now())) {
+      nlohmann::json session;
+      session["id"] = stats.id;
+      session["fps"] = stats.fps;
+      session["bitrate"] = stats.bitrate;
+      session["target_bitrate"] = stats.target_bitrate;
+      session["psnr_db"] = stats.psnr_db;
+      session["ssim"] = stats.ssim;
+      session["packets_lost"] = stats.packets_lost;
+      session["loss_percentage"] = stats.loss_percentage;
+      session["frames_unrecovered"] = stats.frames_unrecovered;
+      session["rtt_ms"] = stats.rtt_seconds * 1000;
+      session["queueing_delay_ms"] = stats.queueing_delay_seconds * 1000;
+      session["ping_jitter_ms"] = stats.ping_jitter_seconds * 1000;
+      session["control_bitrate"] = stats.control_bitrate;
+      session["control_packets_per_second"] = stats.control_packets_per_second;
+      output_tree["sessions"].push_back(std::move(session));
+    }
+    output_tree["latency_ms"]["encode"] = percentiles_ms(metrics::video.encode_recent_seconds);
+    output_tree["latency_ms"]["frame_processing"] = percentiles_ms(metrics::video.frame_processing_latency_recent_seconds);
+    output_tree["latency_ms"]["frame_send"] = percentiles_ms(metrics::video.frame_send_recent_seconds);
+    output_tree["latency_ms"]["control_outbound"] = percentiles_ms(metrics::control.outbound_latency_recent_seconds);
+
+    auto event = "data: " + output_tree.dump() + "\n\n";
+    for (auto &subscriber : subscribers) {
+      if (subscriber->sending.exchange(true)) {
+        continue;
+      }
+
+      *subscriber->response << event;
+      subscriber->response->send([subscriber](const SimpleWeb::error_code &ec) {
+        if (ec) {
+          subscriber->closed = true;
+        }
+        subscriber->sending = false;
+      });
+    }
+  }
+
+  /**
+   * @brief Subscribe to the live telemetry of the streaming sessions.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @details The telemetry is sent as Server-Sent Events, once per second, until the client disconnects.
+   * Each event holds the frame rate, bitrate, loss and control stream traffic of each session since the previous event,
+   * the quality of its video when it's sampled, and the latency percentiles over the last logging interval.
+   *
+   * @api_examples{/api/telemetry| GET| null}
+   */
+  void getTelemetry(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    // The event stream never ends, so the connection can't be kept alive after it
+    response->close_connection_after_response = true;
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/event-stream");
+    headers.emplace("Cache-Control", "no-cache");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(headers);
+
+    auto subscriber = std::make_shared<telemetry_subscriber_t>(response);
+    subscriber->sending = true;
+    response->send([subscriber](const SimpleWeb::error_code &ec) {
+      if (ec) {
+        subscriber->closed = true;
+      }
+      subscriber->sending = false;
+    });
+
+    std::lock_guard lg {telemetry.lock};
+    telemetry.subscribers.emplace_back(std::move(subscriber));
+  }
+
+  /**
+   * @brief Get the spans recorded by the frame tracer.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @details The spans are in the Chrome trace event format, and can be opened in Perfetto.
+   * Spans are only recorded while `frame_trace` is enabled.
+   *
+   * @api_examples{/api/trace| GET| null}
+   */
+  void getTrace(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "application/json");
+    headers.emplace("Content-Disposition", "attachment; filename=\"sunshine-trace.json\"");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, frame_trace::dump(), headers);
   }
 
   /**
@@ -1150,6 +1518,75 @@ namespace confighttp {
     send_response(response, output_tree);
   }
 
+  /**
+   * @brief Get how long the last encoder probe took.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @details Lists the encoders that were probed in priority order, with the time each one started at and took,
+   * and the time spent on each of its codecs and on HDR. Encoders that used cached results have no stages.
+   *
+   * @api_examples{/api/encoder-probe| GET| null}
+   */
+  void getEncoderProbe(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto to_ms = [](std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration<double, std::milli> {duration}.count();
+    };
+
+    auto report = video::last_encoder_probe();
+
+    nlohmann::json encoders = nlohmann::json::array();
+    for (const auto &timing : report.encoders) {
+      nlohmann::json stages = nlohmann::json::object();
+      for (const auto &[stage, duration] : timing.stages) {
+        stages[std::string {stage}] = to_ms(duration);
+      }
+
+      encoders.push_back({
+        {"name", timing.name},
+        {"passed", timing.passed},
+        {"cached", timing.cached},
+        {"started_ms", to_ms(timing.started)},
+        {"duration_ms", to_ms(timing.duration)},
+        {"stages", stages},
+      });
+    }
+
+    nlohmann::json output_tree;
+    output_tree["duration_ms"] = to_ms(report.duration);
+    output_tree["parallel"] = report.parallel;
+    output_tree["encoders"] = encoders;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Reset the persisted encoder probe results.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * @api_examples{/api/reset-encoder-cache| POST| null}
+   */
+  void resetEncoderCache(resp_https_t response, req_https_t request) {
+    if (!check_content_type(response, request, "application/json")) {
+      return;
+    }
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    nlohmann::json output_tree;
+    output_tree["status"] = video::reset_encoder_cache();
+    send_response(response, output_tree);
+  }
+
   /**
    * @brief Restart Sunshine.
    * @param response The HTTP response object.
@@ -1177,7 +1614,16 @@ namespace confighttp {
     auto port_https = net::map_port(PORT_HTTPS);
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
+    // nvhttp::start() reports it if the credentials couldn't be created
+    if (http::wait_for_creds()) {
+      return;
+    }
+
     https_server_t server {config::nvhttp.cert, config::nvhttp.pkey};
+
+    // Declared after the server, so the requests left are done before the server is destroyed
+    http::workers_t workers {config::nvhttp.worker_threads, metrics::confighttp_workers};
+
     server.default_resource["DELETE"] = [](resp_https_t response, req_https_t request) {
       bad_request(response, request);
     };
@@ -1200,24 +1646,31 @@ namespace confighttp {
     server.resource["^/welcome/?$"]["GET"] = getWelcomePage;
     server.resource["^/troubleshooting/?$"]["GET"] = getTroubleshootingPage;
     server.resource["^/api/pin$"]["POST"] = savePin;
-    server.resource["^/api/apps$"]["GET"] = getApps;
-    server.resource["^/api/logs$"]["GET"] = getLogs;
-    server.resource["^/api/apps$"]["POST"] = saveApp;
+    server.resource["^/api/apps$"]["GET"] = workers.handler(getApps);
+    server.resource["^/api/logs$"]["GET"] = workers.handler(getLogs);
+    server.resource["^/api/logs/recent$"]["GET"] = getRecentLogs;
+    server.resource["^/api/trace$"]["GET"] = workers.handler(getTrace);
+    server.resource["^/metrics$"]["GET"] = getMetrics;
+    server.resource["^/api/telemetry$"]["GET"] = getTelemetry;
+    server.resource["^/api/apps$"]["POST"] = workers.handler(saveApp);
     server.resource["^/api/config$"]["GET"] = getConfig;
     server.resource["^/api/config$"]["POST"] = saveConfig;
     server.resource["^/api/configLocale$"]["GET"] = getLocale;
     server.resource["^/api/restart$"]["POST"] = restart;
     server.resource["^/api/reset-display-device-persistence$"]["POST"] = resetDisplayDevicePersistence;
+    server.resource["^/api/reset-encoder-cache$"]["POST"] = resetEncoderCache;
+    server.resource["^/api/encoder-probe$"]["GET"] = getEncoderProbe;
     server.resource["^/api/password$"]["POST"] = savePassword;
-    server.resource["^/api/apps/([0-9]+)$"]["DELETE"] = deleteApp;
+    server.resource["^/api/apps/([0-9]+)$"]["DELETE"] = workers.handler(deleteApp);
     server.resource["^/api/clients/unpair-all$"]["POST"] = unpairAll;
     server.resource["^/api/clients/list$"]["GET"] = getClients;
     server.resource["^/api/clients/unpair$"]["POST"] = unpair;
     server.resource["^/api/apps/close$"]["POST"] = closeApp;
-    server.resource["^/api/covers/upload$"]["POST"] = uploadCover;
+    server.resource["^/api/apps/launch$"]["GET"] = getLaunchTimeline;
+    server.resource["^/api/covers/upload$"]["POST"] = workers.handler(uploadCover);
     server.resource["^/images/sunshine.ico$"]["GET"] = getFaviconImage;
     server.resource["^/images/logo-sunshine-45.png$"]["GET"] = getSunshineLogoImage;
-    server.resource["^/assets\\/.+$"]["GET"] = getNodeModules;
+    server.resource["^/assets\\/.+$"]["GET"] = workers.handler(getNodeModules);
     server.config.reuse_address = true;
     server.config.address = net::af_to_any_address_string(address_family);
     server.config.port = port_https;
@@ -1240,8 +1693,15 @@ namespace confighttp {
     };
     std::thread tcp {accept_and_run, &server};
 
-    // Wait for any event
-    shutdown_event->view();
+    // Wait for any event, pushing the telemetry meanwhile
+    while (!shutdown_event->view(TELEMETRY_INTERVAL)) {
+      push_telemetry();
+    }
+
+    {
+      std::lock_guard lg {telemetry.lock};
+      telemetry.subscribers.clear();
+    }
 
     server.stop();
 
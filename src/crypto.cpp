@@ -2,9 +2,23 @@
  * @file src/crypto.cpp
  * @brief Definitions for cryptography functions.
  */
+// platform includes
+#if defined(__linux__) && defined(__aarch64__)
+  #include <sys/auxv.h>
+#elif defined(__linux__) && defined(__arm__)
+  #include <asm/hwcap.h>
+  #include <sys/auxv.h>
+#elif defined(__FreeBSD__) && defined(__aarch64__)
+  #include <machine/elf.h>
+  #include <sys/auxv.h>
+#endif
+
 // lib includes
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
+#if OPENSSL_VERSION_MAJOR >= 3
+  #include <openssl/core_names.h>
+#endif
 
 // local includes
 #include "crypto.h"
@@ -22,10 +36,13 @@ namespace crypto {
 
     X509_STORE_add_cert(x509_store.get(), cert.get());
     _certs.emplace_back(std::make_pair(std::move(cert), std::move(x509_store)));
+
+    // The certificates that didn't verify aren't remembered, so adding one needs no invalidation
   }
 
   void cert_chain_t::clear() {
     _certs.clear();
+    _verified.clear();
   }
 
   static int openssl_verify_cb(int ok, X509_STORE_CTX *ctx) {
@@ -57,6 +74,13 @@ namespace crypto {
    * @return nullptr if the certificate is valid, otherwise an error string.
    */
   const char *cert_chain_t::verify(x509_t::element_type *cert) {
+    sha256_t fingerprint;
+    unsigned int fingerprint_size = fingerprint.size();
+    auto fingerprinted = X509_digest(cert, EVP_sha256(), fingerprint.data(), &fingerprint_size) == 1;
+    if (fingerprinted && _verified.contains(fingerprint)) {
+      return nullptr;
+    }
+
     int err_code = 0;
     for (auto &[_, x509_store] : _certs) {
       auto fg = util::fail_guard([this]() {
@@ -74,6 +98,9 @@ namespace crypto {
       auto err = X509_verify_cert(_cert_ctx.get());
 
       if (err == 1) {
+        if (fingerprinted) {
+          _verified.emplace(fingerprint);
+        }
         return nullptr;
       }
 
@@ -219,6 +246,87 @@ namespace crypto {
       return encrypt(plaintext, tagged_cipher, tagged_cipher + tag_size, iv);
     }
 
+    int gcm_t::encrypt(const std::string_view &header, std::uint8_t *header_cipher, const std::string_view &payload, std::uint8_t *payload_cipher, std::uint8_t *tag, aes_t *iv) {
+      if (!encrypt_ctx && init_encrypt_gcm(encrypt_ctx, &key, iv, padding)) {
+        return -1;
+      }
+
+      if (EVP_EncryptInit_ex(encrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
+        return -1;
+      }
+
+      int header_outlen, payload_outlen, final_outlen;
+
+      // GCM is a stream mode, so each update produces exactly as many bytes as it consumes
+      if (EVP_EncryptUpdate(encrypt_ctx.get(), header_cipher, &header_outlen, (const std::uint8_t *) header.data(), header.size()) != 1) {
+        return -1;
+      }
+
+      if (EVP_EncryptUpdate(encrypt_ctx.get(), payload_cipher, &payload_outlen, (const std::uint8_t *) payload.data(), payload.size()) != 1) {
+        return -1;
+      }
+
+      if (EVP_EncryptFinal_ex(encrypt_ctx.get(), payload_cipher + payload_outlen, &final_outlen) != 1) {
+        return -1;
+      }
+
+      if (EVP_CIPHER_CTX_ctrl(encrypt_ctx.get(), EVP_CTRL_GCM_GET_TAG, tag_size, tag) != 1) {
+        return -1;
+      }
+
+      return header_outlen + payload_outlen + final_outlen;
+    }
+
+    int gcm_t::encrypt(std::span<const gcm_message_t> messages) {
+      if (messages.empty()) {
+        return 0;
+      }
+
+      if (!encrypt_ctx) {
+        aes_t iv {messages[0].iv, messages[0].iv + 12};
+        if (init_encrypt_gcm(encrypt_ctx, &key, &iv, padding)) {
+          return -1;
+        }
+      }
+
+      auto ctx = encrypt_ctx.get();
+      for (auto &message : messages) {
+        if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, message.iv) != 1) {
+          return -1;
+        }
+
+        int header_outlen, payload_outlen, final_outlen;
+        if (EVP_EncryptUpdate(ctx, message.header_cipher, &header_outlen, (const std::uint8_t *) message.header.data(), message.header.size()) != 1) {
+          return -1;
+        }
+
+        if (EVP_EncryptUpdate(ctx, message.payload_cipher, &payload_outlen, (const std::uint8_t *) message.payload.data(), message.payload.size()) != 1) {
+          return -1;
+        }
+
+        if (EVP_EncryptFinal_ex(ctx, message.payload_cipher + payload_outlen, &final_outlen) != 1) {
+          return -1;
+        }
+
+#if OPENSSL_VERSION_MAJOR >= 3
+        // Fetching the tag as a parameter skips translating the legacy control into one
+        std::array<OSSL_PARAM, 2> params {
+          OSSL_PARAM_construct_octet_string(OSSL_CIPHER_PARAM_AEAD_TAG, message.tag, tag_size),
+          OSSL_PARAM_construct_end(),
+        };
+        if (EVP_CIPHER_CTX_get_params(ctx, params.data()) != 1) {
+          return -1;
+        }
+#else
+        if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tag_size, message.tag) != 1) {
+          return -1;
+        }
+#endif
+      }
+
+      return 0;
+    }
+
     int ecb_t::decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext) {
       auto fg = util::fail_guard([this]() {
         EVP_CIPHER_CTX_reset(decrypt_ctx.get());
@@ -318,6 +426,29 @@ namespace crypto {
 
   }  // namespace cipher
 
+  bool has_aes_acceleration() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#elif defined(__APPLE__)
+    // Every Apple silicon CPU has the ARMv8 crypto extensions
+    return true;
+#elif defined(__linux__) && defined(__aarch64__)
+    auto hwcap = getauxval(AT_HWCAP);
+    return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+#elif defined(__linux__) && defined(__arm__)
+    auto hwcap2 = getauxval(AT_HWCAP2);
+    return (hwcap2 & HWCAP2_AES) && (hwcap2 & HWCAP2_PMULL);
+#elif defined(__FreeBSD__) && defined(__aarch64__)
+    unsigned long hwcap = 0;
+    if (elf_aux_info(AT_HWCAP, &hwcap, sizeof(hwcap))) {
+      return true;
+    }
+    return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+#else
+    return true;
+#endif
+  }
+
   aes_t gen_aes_key(const std::array<uint8_t, 16> &salt, const std::string_view &pin) {
     aes_t key(16);
 
@@ -6,6 +6,8 @@
 
 // standard includes
 #include <array>
+#include <set>
+#include <span>
 
 // lib includes
 #include <openssl/evp.h>
@@ -45,6 +47,12 @@ namespace crypto {
   sha256_t hash(const std::string_view &plaintext);
 
   aes_t gen_aes_key(const std::array<uint8_t, 16> &salt, const std::string_view &pin);
+
+  /**
+   * @brief Check if the CPU has instructions to accelerate AES-GCM.
+   * @return `false` if it has none, so AES-GCM runs much slower. `true` if it has them or if it's unknown.
+   */
+  bool has_aes_acceleration();
   x509_t x509(const std::string_view &x);
   pkey_t pkey(const std::string_view &k);
   std::string pem(x509_t &x509);
@@ -68,11 +76,21 @@ namespace crypto {
 
     void clear();
 
+    /**
+     * @brief Verify a client certificate against the paired ones.
+     * @details Certificates that verified are remembered until the chain changes, so clients
+     *          connecting again don't go through `X509_verify_cert()` for each paired client.
+     * @param cert The certificate to verify.
+     * @return nullptr if the certificate is valid, otherwise an error string.
+     */
     const char *verify(x509_t::element_type *cert);
 
   private:
     std::vector<std::pair<x509_t, x509_store_t>> _certs;
     x509_store_ctx_t _cert_ctx;
+
+    // SHA-256 fingerprints of the certificates that verified
+    std::set<sha256_t> _verified;
   };
 
   namespace cipher {
@@ -104,6 +122,18 @@ namespace crypto {
       int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext);
     };
 
+    /**
+     * @brief A message to encrypt as part of a batch, with its plaintext split across two buffers.
+     */
+    struct gcm_message_t {
+      const std::uint8_t *iv;  ///< The 12 byte initialization vector of the message
+      std::string_view header;
+      std::uint8_t *header_cipher;
+      std::string_view payload;
+      std::uint8_t *payload_cipher;
+      std::uint8_t *tag;
+    };
+
     class gcm_t: public cipher_t {
     public:
       gcm_t() = default;
@@ -132,6 +162,26 @@ namespace crypto {
        */
       int encrypt(const std::string_view &plaintext, std::uint8_t *tagged_cipher, aes_t *iv);
 
+      /**
+       * @brief Encrypts plaintext split across two buffers as a single message using AES GCM mode.
+       * @param header The first part of the plaintext.
+       * @param header_cipher The buffer where the ciphertext of the first part will be written.
+       * @param payload The second part of the plaintext.
+       * @param payload_cipher The buffer where the ciphertext of the second part will be written.
+       * @param tag The buffer where the GCM tag will be written.
+       * @param iv The initialization vector to be used for the encryption.
+       * @return The total length of the ciphertext. Returns -1 in case of an error.
+       */
+      int encrypt(const std::string_view &header, std::uint8_t *header_cipher, const std::string_view &payload, std::uint8_t *payload_cipher, std::uint8_t *tag, aes_t *iv);
+
+      /**
+       * @brief Encrypts a batch of messages using AES GCM mode, like the two buffer overload does with each of them.
+       * @details The cipher context is set up once for the batch, and only the IV is changed between messages.
+       * @param messages The messages to encrypt.
+       * @return 0 on success. Returns -1 in case of an error, which may leave later messages unencrypted.
+       */
+      int encrypt(std::span<const gcm_message_t> messages);
+
       int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv);
     };
 
@@ -12,7 +12,10 @@
 #include <display_device/json.h>
 #include <display_device/retry_scheduler.h>
 #include <display_device/settings_manager_interface.h>
+#include <atomic>
+#include <map>
 #include <mutex>
+#include <optional>
 #include <regex>
 
 // local includes
@@ -40,6 +43,48 @@ namespace display_device {
       std::unique_ptr<RetryScheduler<SettingsManagerInterface>> sm_instance {nullptr};
     } DD_DATA;
 
+    /**
+     * @brief Bumped whenever the configuration is applied or reverted, on whichever thread does it.
+     */
+    std::atomic<std::uint64_t> configuration_generation {0};
+
+    /**
+     * @brief The results reused while an `enumeration_cache_t` lives, guarded by the mutex of `DD_DATA`.
+     */
+    struct enumeration_cache_data_t {
+      int holders {0};
+      std::uint64_t generation {0};
+      std::optional<EnumeratedDeviceList> devices;
+      std::map<std::string, std::string> output_names;
+
+      void clear() {
+        devices.reset();
+        output_names.clear();
+      }
+    };
+
+    enumeration_cache_data_t enumeration_cache_data;
+
+    /**
+     * @brief Get the enumeration cache.
+     * @return The cache, or `nullptr` if nothing holds it.
+     * @note This is function does not lock mutex.
+     */
+    enumeration_cache_data_t *current_enumeration_cache() {
+      auto &cache = enumeration_cache_data;
+      if (cache.holders == 0) {
+        return nullptr;
+      }
+
+      // The devices may have changed since they were cached
+      if (const auto generation {configuration_generation.load(std::memory_order_acquire)}; cache.generation != generation) {
+        cache.generation = generation;
+        cache.clear();
+      }
+
+      return &cache;
+    }
+
     /**
      * @brief Helper class for capturing audio context when the API demands it.
      *
@@ -658,6 +703,7 @@ namespace display_device {
       DD_DATA.sm_instance->schedule([try_once = (option == revert_option_e::try_once), tried_out_devices = std::set<std::string> {}](auto &settings_iface, auto &stop_token) mutable {
         if (try_once) {
           std::ignore = settings_iface.revertSettings();
+          configuration_generation.fetch_add(1, std::memory_order_release);
           stop_token.requestStop();
           return;
         }
@@ -684,7 +730,9 @@ namespace display_device {
         }
 
         using enum SettingsManagerInterface::RevertResult;
-        if (const auto result {settings_iface.revertSettings()}; result == Ok) {
+        const auto result {settings_iface.revertSettings()};
+        configuration_generation.fetch_add(1, std::memory_order_release);
+        if (result == Ok) {
           stop_token.requestStop();
           return;
         } else if (result == ApiTemporarilyUnavailable) {
@@ -752,9 +800,21 @@ namespace display_device {
       return output_name;
     }
 
-    return DD_DATA.sm_instance->execute([&output_name](auto &settings_iface) {
+    auto *cache {current_enumeration_cache()};
+    if (cache) {
+      if (const auto it {cache->output_names.find(output_name)}; it != std::end(cache->output_names)) {
+        return it->second;
+      }
+    }
+
+    auto display_name {DD_DATA.sm_instance->execute([&output_name](auto &settings_iface) {
       return settings_iface.getDisplayName(output_name);
-    });
+    })};
+    if (cache) {
+      cache->output_names.emplace(output_name, display_name);
+    }
+
+    return display_name;
   }
 
   void configure_display(const config::video_t &video_config, const rtsp_stream::launch_session_t &session) {
@@ -783,7 +843,9 @@ namespace display_device {
     DD_DATA.sm_instance->schedule([config](auto &settings_iface, auto &stop_token) {
       // We only want to keep retrying in case of a transient errors.
       // In other cases, when we either fail or succeed we just want to stop...
-      if (settings_iface.applySettings(config) != SettingsManagerInterface::ApplyResult::ApiTemporarilyUnavailable) {
+      const auto result {settings_iface.applySettings(config)};
+      configuration_generation.fetch_add(1, std::memory_order_release);
+      if (result != SettingsManagerInterface::ApplyResult::ApiTemporarilyUnavailable) {
         stop_token.requestStop();
       }
     },
@@ -817,9 +879,33 @@ namespace display_device {
       return {};
     }
 
-    return DD_DATA.sm_instance->execute([](auto &settings_iface) {
+    auto *cache {current_enumeration_cache()};
+    if (cache && cache->devices) {
+      return *cache->devices;
+    }
+
+    auto devices {DD_DATA.sm_instance->execute([](auto &settings_iface) {
       return settings_iface.enumAvailableDevices();
-    });
+    })};
+    if (cache) {
+      cache->devices = devices;
+    }
+
+    return devices;
+  }
+
+  enumeration_cache_t::enumeration_cache_t() {
+    std::lock_guard lock {DD_DATA.mutex};
+    if (enumeration_cache_data.holders++ == 0) {
+      enumeration_cache_data.generation = configuration_generation.load(std::memory_order_acquire);
+    }
+  }
+
+  enumeration_cache_t::~enumeration_cache_t() {
+    std::lock_guard lock {DD_DATA.mutex};
+    if (--enumeration_cache_data.holders == 0) {
+      enumeration_cache_data.clear();
+    }
   }
 
   std::variant<failed_to_parse_tag_t, configuration_disabled_tag_t, SingleDisplayConfiguration> parse_configuration(const config::video_t &video_config, const rtsp_stream::launch_session_t &session) {
@@ -130,6 +130,28 @@ namespace display_device {
    */
   [[nodiscard]] EnumeratedDeviceList enumerate_devices();
 
+  /**
+   * @brief Reuse the enumerated devices and mapped output names while an instance lives.
+   *
+   * Launching a session probes every encoder, and each probe enumerates the devices and maps the output
+   * name again, which asks the OS each time. The cached results are shared by all threads, and dropped
+   * whenever the display configuration is applied or reverted, so they follow the changes made while launching.
+   *
+   * @examples
+   * const enumeration_cache_t enumeration_cache;
+   * const auto devices = enumerate_devices();
+   * const auto same_devices = enumerate_devices();
+   * @examples_end
+   */
+  class enumeration_cache_t {
+  public:
+    enumeration_cache_t();
+    ~enumeration_cache_t();
+
+    enumeration_cache_t(const enumeration_cache_t &) = delete;
+    enumeration_cache_t &operator=(const enumeration_cache_t &) = delete;
+  };
+
   /**
    * @brief A tag structure indicating that configuration parsing has failed.
    */
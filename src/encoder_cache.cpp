@@ -0,0 +1,105 @@
+/**
+ * @file src/encoder_cache.cpp
+ * @brief Definitions for the persisted encoder probe results.
+ */
+// standard includes
+#include <mutex>
+#include <string>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "encoder_cache.h"
+#include "file_handler.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace encoder_cache {
+  namespace {
+    // Probing at startup, revalidation and the web UI may all touch the file
+    std::mutex cache_lock;
+
+    nlohmann::json read(const std::filesystem::path &file) {
+      auto contents = file_handler::read_file(file.string().c_str());
+      if (contents.empty()) {
+        return nlohmann::json::object();
+      }
+
+      auto tree = nlohmann::json::parse(contents, nullptr, false);
+      if (tree.is_discarded() || !tree.is_object()) {
+        BOOST_LOG(warning) << "Ignoring malformed encoder cache: "sv << file.string();
+        return nlohmann::json::object();
+      }
+
+      return tree;
+    }
+  }  // namespace
+
+  std::optional<entry_t> load(const std::filesystem::path &file, std::string_view encoder, std::string_view fingerprint) {
+    std::lock_guard lg {cache_lock};
+
+    auto tree = read(file);
+    auto encoders = tree.find("encoders");
+    if (encoders == tree.end() || !encoders->is_object()) {
+      return std::nullopt;
+    }
+
+    auto node = encoders->find(std::string {encoder});
+    if (node == encoders->end()) {
+      return std::nullopt;
+    }
+
+    try {
+      if (node->at("fingerprint").get<std::string>() != fingerprint) {
+        BOOST_LOG(debug) << "Cached results of encoder ["sv << encoder << "] are stale"sv;
+        return std::nullopt;
+      }
+
+      return entry_t {
+        node->at("passed").get<bool>(),
+        node->at("h264").get<std::uint64_t>(),
+        node->at("hevc").get<std::uint64_t>(),
+        node->at("av1").get<std::uint64_t>(),
+      };
+    } catch (const nlohmann::json::exception &e) {
+      BOOST_LOG(warning) << "Ignoring malformed cached results of encoder ["sv << encoder << "]: "sv << e.what();
+      return std::nullopt;
+    }
+  }
+
+  void store(const std::filesystem::path &file, std::string_view encoder, std::string_view fingerprint, const entry_t &entry) {
+    std::lock_guard lg {cache_lock};
+
+    auto tree = read(file);
+    if (!tree["encoders"].is_object()) {
+      tree["encoders"] = nlohmann::json::object();
+    }
+
+    tree["encoders"][std::string {encoder}] = {
+      {"fingerprint", fingerprint},
+      {"passed", entry.passed},
+      {"h264", entry.h264},
+      {"hevc", entry.hevc},
+      {"av1", entry.av1},
+    };
+
+    if (file_handler::write_file(file.string().c_str(), tree.dump(2))) {
+      BOOST_LOG(warning) << "Couldn't write encoder cache: "sv << file.string();
+    }
+  }
+
+  bool invalidate(const std::filesystem::path &file) {
+    std::lock_guard lg {cache_lock};
+
+    std::error_code ec;
+    std::filesystem::remove(file, ec);
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't remove encoder cache "sv << file.string() << ": "sv << ec.message();
+      return false;
+    }
+
+    return true;
+  }
+}  // namespace encoder_cache
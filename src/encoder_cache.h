@@ -0,0 +1,51 @@
+/**
+ * @file src/encoder_cache.h
+ * @brief Declarations for the persisted encoder probe results.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief Persists the outcome of encoder validation, so it can be reused on the next start.
+ * @details Each encoder's results are stored with a fingerprint of everything that could change them,
+ *          such as the GPUs, their drivers and the displays. Results are only reused while the
+ *          fingerprint matches.
+ */
+namespace encoder_cache {
+  struct entry_t {
+    bool passed;  ///< Whether the encoder passed validation
+    std::uint64_t h264;  ///< H.264 capability flags
+    std::uint64_t hevc;  ///< HEVC capability flags
+    std::uint64_t av1;  ///< AV1 capability flags
+  };
+
+  /**
+   * @brief Load the cached results of an encoder.
+   * @param file The cache file.
+   * @param encoder The name of the encoder.
+   * @param fingerprint The fingerprint the results must have been stored with.
+   * @return The results, or `std::nullopt` if there are none for this fingerprint.
+   */
+  std::optional<entry_t> load(const std::filesystem::path &file, std::string_view encoder, std::string_view fingerprint);
+
+  /**
+   * @brief Store the results of an encoder, replacing any previous results.
+   * @param file The cache file.
+   * @param encoder The name of the encoder.
+   * @param fingerprint The fingerprint of the system the results were obtained on.
+   * @param entry The results.
+   */
+  void store(const std::filesystem::path &file, std::string_view encoder, std::string_view fingerprint, const entry_t &entry);
+
+  /**
+   * @brief Remove all cached results.
+   * @param file The cache file.
+   * @return `true` on success, `false` if the file couldn't be removed.
+   */
+  bool invalidate(const std::filesystem::path &file);
+}  // namespace encoder_cache
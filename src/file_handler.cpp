@@ -6,6 +6,7 @@
 // standard includes
 #include <filesystem>
 #include <fstream>
+#include <system_error>
 
 // local includes
 #include "file_handler.h"
@@ -53,4 +54,34 @@ namespace file_handler {
 
     return 0;
   }
+
+  int write_file_atomic(const char *path, const std::string_view &contents) {
+    auto temp_path = std::filesystem::path {path};
+    temp_path += ".tmp";
+
+    {
+      std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) {
+        return -1;
+      }
+
+      out << contents;
+      out.flush();
+      if (!out) {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        return -1;
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+      BOOST_LOG(error) << "Couldn't replace " << path << ": " << ec.message();
+      std::filesystem::remove(temp_path, ec);
+      return -1;
+    }
+
+    return 0;
+  }
 }  // namespace file_handler
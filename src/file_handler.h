@@ -51,4 +51,16 @@ namespace file_handler {
    * @examples_end
    */
   int write_file(const char *path, const std::string_view &contents);
+
+  /**
+   * @brief Write a file so it holds either its old or its new contents, even if writing is interrupted.
+   * @details The contents are written to a temporary file next to it, which then replaces it.
+   * @param path The path of the file.
+   * @param contents The contents to write.
+   * @return ``0`` on success, ``-1`` on failure.
+   * @examples
+   * int write_status = write_file_atomic("path/to/file", "file contents");
+   * @examples_end
+   */
+  int write_file_atomic(const char *path, const std::string_view &contents);
 }  // namespace file_handler
@@ -0,0 +1,124 @@
+/**
+ * @file src/frame_scheduler.cpp
+ * @brief Definitions for the deadline-driven video frame scheduler.
+ */
+// standard includes
+#include <algorithm>
+#include <cstdlib>
+
+// local includes
+#include "frame_scheduler.h"
+
+using namespace std::literals;
+
+namespace frame_scheduler {
+  void stage_estimate_t::add(std::chrono::nanoseconds duration) {
+    auto sample = std::max<std::int64_t>(duration.count(), 0);
+
+    auto mean = _mean.load(std::memory_order_relaxed);
+    if (mean < 0) {
+      _mean.store(sample, std::memory_order_relaxed);
+      _deviation.store(sample / 2, std::memory_order_relaxed);
+      return;
+    }
+
+    auto deviation = _deviation.load(std::memory_order_relaxed);
+    _deviation.store(deviation + (std::abs(sample - mean) - deviation) / 4, std::memory_order_relaxed);
+    _mean.store(mean + (sample - mean) / 8, std::memory_order_relaxed);
+  }
+
+  std::chrono::nanoseconds stage_estimate_t::mean() const {
+    return std::chrono::nanoseconds {std::max<std::int64_t>(_mean.load(std::memory_order_relaxed), 0)};
+  }
+
+  std::chrono::nanoseconds stage_estimate_t::deviation() const {
+    return std::chrono::nanoseconds {_deviation.load(std::memory_order_relaxed)};
+  }
+
+  std::chrono::nanoseconds stage_estimate_t::budget() const {
+    return mean() + deviation() * 2;
+  }
+
+  scheduler_t::scheduler_t(std::chrono::nanoseconds frame_interval):
+      _frame_interval {std::max(frame_interval, 1ns)} {
+  }
+
+  void scheduler_t::record(stage_e stage, std::chrono::nanoseconds duration) {
+    _stages[(int) stage].add(duration);
+  }
+
+  void scheduler_t::on_captured(clock::time_point captured, clock::time_point now) {
+    record(stage_e::capture, now - captured);
+    _last_capture.store(captured.time_since_epoch().count(), std::memory_order_relaxed);
+  }
+
+  std::chrono::nanoseconds scheduler_t::budget(stage_e stage) const {
+    return _stages[(int) stage].budget();
+  }
+
+  clock::time_point scheduler_t::next_capture(clock::time_point now) const {
+    auto last_capture = _last_capture.load(std::memory_order_relaxed);
+    if (last_capture == clock::duration::min().count()) {
+      return now;
+    }
+
+    // Captures follow the frame interval, even across the frames skipped while the display was idle
+    auto last = clock::time_point {clock::duration {last_capture}};
+    if (now < last) {
+      return last + _frame_interval;
+    }
+
+    return last + _frame_interval * ((now - last) / _frame_interval + 1);
+  }
+
+  clock::time_point scheduler_t::repeat_deadline(clock::time_point last_encode, std::chrono::nanoseconds repeat_interval, bool *deferred) const {
+    auto due = last_encode + repeat_interval;
+    if (deferred) {
+      *deferred = false;
+    }
+
+    if (_last_capture.load(std::memory_order_relaxed) == clock::duration::min().count()) {
+      return due;
+    }
+
+    // A repeat started now would still be going through the pipeline when the next captured frame arrives
+    auto next = next_capture(due);
+    if (next - due < budget(stage_e::encode) + budget(stage_e::send)) {
+      if (deferred) {
+        *deferred = true;
+      }
+
+      return next + budget(stage_e::capture);
+    }
+
+    return due;
+  }
+
+  std::chrono::nanoseconds scheduler_t::slack(clock::time_point captured, clock::time_point now, std::initializer_list<stage_e> remaining) const {
+    auto done = now;
+    for (auto stage : remaining) {
+      done += budget(stage);
+    }
+
+    return captured + _frame_interval - done;
+  }
+
+  capture_phase_t::capture_phase_t(std::chrono::nanoseconds frame_interval):
+      _frame_interval {std::max(frame_interval, 1ns)} {
+  }
+
+  std::chrono::nanoseconds capture_phase_t::update(clock::time_point captured, clock::time_point presented) {
+    // Wrap the error around the frame interval, so a capture just before the next present moves later instead of
+    // nearly a full frame earlier
+    auto error = std::chrono::duration_cast<std::chrono::nanoseconds>(captured - presented - MARGIN) % _frame_interval;
+    if (error > _frame_interval / 2) {
+      error -= _frame_interval;
+    } else if (error <= -_frame_interval / 2) {
+      error += _frame_interval;
+    }
+    _error += (error - _error) / 8;
+
+    auto max_shift = _frame_interval * MAX_SHIFT_PERCENTAGE / 100;
+    return -std::clamp<std::chrono::nanoseconds>(error * GAIN_PERCENTAGE / 100, -max_shift, max_shift);
+  }
+}  // namespace frame_scheduler
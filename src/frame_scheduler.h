@@ -0,0 +1,185 @@
+/**
+ * @file src/frame_scheduler.h
+ * @brief Declarations for the deadline-driven video frame scheduler.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+
+namespace frame_scheduler {
+  using clock = std::chrono::steady_clock;
+
+  enum class stage_e : int {
+    capture,  ///< From the capture of a frame until the encoder picks it up
+    encode,  ///< Converting and encoding a frame
+    send,  ///< Sending the packets of a frame
+  };
+
+  /**
+   * @brief An online estimate of the time a pipeline stage takes.
+   * @details Keeps a smoothed mean and mean deviation of the samples, the same way TCP estimates
+   *          round trip times, so a few slow frames widen the budget without dragging the mean along.
+   * @note Samples must come from a single thread, but the estimate may be read from any thread.
+   */
+  class stage_estimate_t {
+  public:
+    /**
+     * @brief Add a sample.
+     * @param duration The time the stage took.
+     */
+    void add(std::chrono::nanoseconds duration);
+
+    /**
+     * @brief Get the smoothed time the stage takes, or zero before the first sample.
+     */
+    std::chrono::nanoseconds mean() const;
+
+    /**
+     * @brief Get the smoothed deviation from the mean.
+     */
+    std::chrono::nanoseconds deviation() const;
+
+    /**
+     * @brief Get the time to set aside for the stage, which covers nearly all samples.
+     */
+    std::chrono::nanoseconds budget() const;
+
+  private:
+    std::atomic<std::int64_t> _mean {-1};
+    std::atomic<std::int64_t> _deviation {0};
+  };
+
+  /**
+   * @brief Schedules the frames of a stream against the client's frame interval.
+   * @details The scheduler learns how long capturing, encoding and sending a frame take, and how captures
+   *          line up on the frame interval. The encoder asks it how long to wait for a captured frame before
+   *          encoding the last one again, so a frame repeated for the minimum FPS target never holds up a
+   *          captured frame that's due to arrive, and the broadcast thread asks it how much slack a frame had
+   *          before the next one was captured.
+   * @note Each stage must be recorded from a single thread, but the decisions may be read from any thread.
+   */
+  class scheduler_t {
+  public:
+    /**
+     * @param frame_interval The frame interval the client asked for.
+     */
+    explicit scheduler_t(std::chrono::nanoseconds frame_interval);
+
+    /**
+     * @brief Record the time a stage took for a frame.
+     * @param stage The stage.
+     * @param duration The time the stage took.
+     */
+    void record(stage_e stage, std::chrono::nanoseconds duration);
+
+    /**
+     * @brief Record a captured frame reaching the encoder.
+     * @param captured The time the frame was captured.
+     * @param now The time the encoder picked it up.
+     */
+    void on_captured(clock::time_point captured, clock::time_point now);
+
+    /**
+     * @brief Get the time set aside for a stage.
+     * @param stage The stage.
+     */
+    std::chrono::nanoseconds budget(stage_e stage) const;
+
+    /**
+     * @brief Get the time the next frame is expected to be captured, on the cadence of the previous captures.
+     * @param now The current time.
+     * @return The capture time, or `now` if no frame was captured yet.
+     */
+    clock::time_point next_capture(clock::time_point now) const;
+
+    /**
+     * @brief Get the time to stop waiting for a captured frame and encode the last one again.
+     * @details A repeated frame is encoded once the repeat interval has passed since the last encode,
+     *          unless the next captured frame is due before the repeat could be encoded and sent.
+     *          The repeat is then put off until just after that frame is due.
+     * @param last_encode The time the last frame was encoded.
+     * @param repeat_interval The longest time to go without encoding a frame.
+     * @param deferred Receives whether the repeat was put off for a captured frame.
+     * @return The deadline.
+     */
+    clock::time_point repeat_deadline(clock::time_point last_encode, std::chrono::nanoseconds repeat_interval, bool *deferred = nullptr) const;
+
+    /**
+     * @brief Get how long before the next capture a frame is expected to be sent.
+     * @details A negative slack means frames take longer than the frame interval to get out,
+     *          so they queue up behind each other.
+     * @param captured The time the frame was captured.
+     * @param now The time the frame is at the current stage.
+     * @param remaining The stages the frame still has to go through.
+     */
+    std::chrono::nanoseconds slack(clock::time_point captured, clock::time_point now, std::initializer_list<stage_e> remaining) const;
+
+    std::chrono::nanoseconds frame_interval() const {
+      return _frame_interval;
+    }
+
+  private:
+    std::chrono::nanoseconds _frame_interval;
+
+    std::array<stage_estimate_t, 3> _stages;
+
+    // The time since the epoch of the last captured frame, or the minimum duration before the first one
+    std::atomic<clock::rep> _last_capture {clock::duration::min().count()};
+  };
+
+  /**
+   * @brief Locks the phase of a paced capture onto the cadence the game presents frames at.
+   * @details A capture paced on the client's frame interval drifts against the game's presents, so the
+   *          frames it picks up are anywhere from just presented to nearly a frame interval old. Each capture
+   *          that found a new frame compares the age of that frame with a small margin, and moves the next
+   *          captures a fraction of the difference, so they settle just after the game's present.
+   *          The age is taken modulo the frame interval, which keeps games presenting at a rate that
+   *          divides the frame rate locked too.
+   */
+  class capture_phase_t {
+  public:
+    /**
+     * @brief The age to aim for, which leaves room for a late present.
+     */
+    static constexpr std::chrono::nanoseconds MARGIN = std::chrono::milliseconds(1);
+
+    /**
+     * @brief The share of the phase error corrected on each capture.
+     */
+    static constexpr int GAIN_PERCENTAGE = 25;
+
+    /**
+     * @brief The largest correction on a single capture, as a percentage of the frame interval.
+     */
+    static constexpr int MAX_SHIFT_PERCENTAGE = 10;
+
+    /**
+     * @param frame_interval The interval the capture is paced at.
+     */
+    explicit capture_phase_t(std::chrono::nanoseconds frame_interval);
+
+    /**
+     * @brief Record a capture that found a new frame.
+     * @param captured The time of the capture.
+     * @param presented The time the frame was presented.
+     * @return The time to move the next captures by, negative to capture earlier.
+     */
+    std::chrono::nanoseconds update(clock::time_point captured, clock::time_point presented);
+
+    /**
+     * @brief Get the smoothed phase error, positive while captures come late after the present.
+     */
+    std::chrono::nanoseconds error() const {
+      return _error;
+    }
+
+  private:
+    std::chrono::nanoseconds _frame_interval;
+    std::chrono::nanoseconds _error {0};
+  };
+}  // namespace frame_scheduler
@@ -0,0 +1,276 @@
+/**
+ * @file src/frame_trace.cpp
+ * @brief Definitions for the per-frame latency tracer.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "config.h"
+#include "frame_trace.h"
+
+namespace frame_trace {
+  namespace {
+    // Enough for several seconds of a high frame rate stream on the busiest thread
+    constexpr std::size_t RING_SIZE = 16384;
+
+    // Rings of threads that have exited, kept around for the next dump
+    constexpr std::size_t MAX_RETIRED_RINGS = 16;
+
+    /**
+     * @brief A ring of spans written by a single thread and read by any thread.
+     * @details Each slot is guarded by a sequence number, which is odd while the slot is written.
+     *          A reader that sees the sequence number change while reading a slot drops the slot,
+     *          so the writer never waits for a reader.
+     */
+    class ring_t {
+    public:
+      struct span_t {
+        span_e span;
+        std::int64_t frame;
+        clock::rep start;
+        clock::rep end;
+      };
+
+      explicit ring_t(int id):
+          id {id},
+          name {"Thread " + std::to_string(id)} {
+      }
+
+      void push(span_e span, std::int64_t frame, clock::time_point start, clock::time_point end) {
+        auto head = _head.load(std::memory_order_relaxed);
+        auto &slot = _slots[head % RING_SIZE];
+
+        auto seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.span.store((int) span, std::memory_order_relaxed);
+        slot.frame.store(frame, std::memory_order_relaxed);
+        slot.start.store(start.time_since_epoch().count(), std::memory_order_relaxed);
+        slot.end.store(end.time_since_epoch().count(), std::memory_order_relaxed);
+
+        slot.seq.store(seq + 2, std::memory_order_release);
+        _head.store(head + 1, std::memory_order_release);
+      }
+
+      template<class F>
+      void for_each(F &&f) const {
+        auto head = _head.load(std::memory_order_acquire);
+        for (auto x = head > RING_SIZE ? head - RING_SIZE : 0; x < head; ++x) {
+          auto &slot = _slots[x % RING_SIZE];
+
+          auto seq = slot.seq.load(std::memory_order_acquire);
+          if (seq & 1) {
+            continue;
+          }
+
+          span_t span {
+            (span_e) slot.span.load(std::memory_order_relaxed),
+            slot.frame.load(std::memory_order_relaxed),
+            slot.start.load(std::memory_order_relaxed),
+            slot.end.load(std::memory_order_relaxed),
+          };
+
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (slot.seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+          }
+
+          f(span);
+        }
+      }
+
+      const int id;
+      std::string name;  ///< Guarded by the registry lock
+      std::atomic<bool> retired {false};
+
+    private:
+      struct slot_t {
+        std::atomic<std::uint32_t> seq {0};
+        std::atomic<int> span {0};
+        std::atomic<std::int64_t> frame {0};
+        std::atomic<clock::rep> start {0};
+        std::atomic<clock::rep> end {0};
+      };
+
+      std::array<slot_t, RING_SIZE> _slots;
+      std::atomic<std::uint64_t> _head {0};
+    };
+
+    struct registry_t {
+      std::mutex lock;
+      std::deque<std::shared_ptr<ring_t>> rings;
+      int next_id = 1;
+    };
+
+    registry_t &registry() {
+      // Never destroyed, since threads may still exit while static objects are torn down
+      static auto *registry = new registry_t;
+      return *registry;
+    }
+
+    /**
+     * @brief The ring of the calling thread, which is retired when the thread exits.
+     */
+    struct thread_ring_t {
+      ~thread_ring_t() {
+        if (ring) {
+          ring->retired = true;
+        }
+      }
+
+      ring_t &get() {
+        if (!ring) {
+          auto &reg = registry();
+          std::lock_guard lg {reg.lock};
+
+          ring = std::make_shared<ring_t>(reg.next_id++);
+          reg.rings.emplace_back(ring);
+
+          // Forget the oldest rings of exited threads
+          auto retired = (std::size_t) std::count_if(std::begin(reg.rings), std::end(reg.rings), [](auto &ring) {
+            return ring->retired.load();
+          });
+          for (auto it = std::begin(reg.rings); it != std::end(reg.rings) && retired > MAX_RETIRED_RINGS;) {
+            if ((*it)->retired) {
+              it = reg.rings.erase(it);
+              --retired;
+            } else {
+              ++it;
+            }
+          }
+        }
+
+        return *ring;
+      }
+
+      std::shared_ptr<ring_t> ring;
+    };
+
+    thread_local thread_ring_t thread_ring;
+
+    double to_us(clock::rep ticks) {
+      return std::chrono::duration<double, std::micro> {clock::duration {ticks}}.count();
+    }
+  }  // namespace
+
+  std::string_view to_string(span_e span) {
+    switch (span) {
+      case span_e::capture:
+        return "capture";
+      case span_e::convert:
+        return "convert";
+      case span_e::encode:
+        return "encode";
+      case span_e::queue:
+        return "queue";
+      case span_e::fec:
+        return "fec";
+      case span_e::encrypt:
+        return "encrypt";
+      case span_e::send:
+        return "send";
+    }
+
+    return "unknown";
+  }
+
+  bool enabled() {
+    return config::sunshine.frame_trace;
+  }
+
+  void record(span_e span, std::int64_t frame, clock::time_point start, clock::time_point end) {
+    if (!enabled()) {
+      return;
+    }
+
+    thread_ring.get().push(span, frame, start, end);
+  }
+
+  void name_thread(std::string_view name) {
+    if (!enabled()) {
+      return;
+    }
+
+    auto &ring = thread_ring.get();
+
+    std::lock_guard lg {registry().lock};
+    ring.name = name;
+  }
+
+  std::vector<span_t> spans() {
+    std::vector<std::shared_ptr<ring_t>> rings;
+    {
+      auto &reg = registry();
+      std::lock_guard lg {reg.lock};
+      rings.assign(std::begin(reg.rings), std::end(reg.rings));
+    }
+
+    std::vector<span_t> spans;
+    for (auto &ring : rings) {
+      ring->for_each([&](const ring_t::span_t &span) {
+        spans.push_back({
+          span.span,
+          span.frame,
+          clock::time_point {clock::duration {span.start}},
+          clock::time_point {clock::duration {span.end}},
+        });
+      });
+    }
+
+    return spans;
+  }
+
+  std::string dump() {
+    // Only hold the lock while taking the names, so threads can keep starting while the spans are read
+    std::vector<std::pair<std::shared_ptr<ring_t>, std::string>> rings;
+    {
+      auto &reg = registry();
+      std::lock_guard lg {reg.lock};
+      for (auto &ring : reg.rings) {
+        rings.emplace_back(ring, ring->name);
+      }
+    }
+
+    auto events = nlohmann::json::array();
+    for (auto &[ring, name] : rings) {
+      events.push_back({
+        {"name", "thread_name"},
+        {"ph", "M"},
+        {"pid", 1},
+        {"tid", ring->id},
+        {"args", {{"name", name}}},
+      });
+
+      ring->for_each([&](const ring_t::span_t &span) {
+        events.push_back({
+          {"name", to_string(span.span)},
+          {"cat", "video"},
+          {"ph", "X"},
+          {"pid", 1},
+          {"tid", ring->id},
+          {"ts", to_us(span.start)},
+          {"dur", to_us(span.end - span.start)},
+          {"args", {{"frame", span.frame}}},
+        });
+      });
+    }
+
+    nlohmann::json trace;
+    trace["traceEvents"] = std::move(events);
+    trace["displayTimeUnit"] = "ms";
+
+    return trace.dump();
+  }
+}  // namespace frame_trace
@@ -0,0 +1,108 @@
+/**
+ * @file src/frame_trace.h
+ * @brief Declarations for the per-frame latency tracer.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace frame_trace {
+  using clock = std::chrono::steady_clock;
+
+  enum class span_e : int {
+    capture,  ///< From the capture of a frame until the encoder picks it up
+    convert,  ///< Converting a captured image for the encoder
+    encode,  ///< Encoding a frame
+    queue,  ///< From the encoder handing out a packet until the broadcast thread picks it up
+    fec,  ///< Generating the parity shards of a FEC block
+    encrypt,  ///< Stamping the headers of a batch of shards and encrypting them
+    send,  ///< Sending a batch of shards
+  };
+
+  /**
+   * @brief Get the name of a span, as it appears in the trace.
+   * @param span The span.
+   */
+  std::string_view to_string(span_e span);
+
+  /**
+   * @brief Check whether spans are being recorded.
+   */
+  bool enabled();
+
+  /**
+   * @brief Record a span of a frame.
+   * @details Spans go to a ring buffer of the calling thread, so recording never waits on another thread.
+   *          Once the ring is full, the oldest spans of the thread are overwritten.
+   * @param span The span.
+   * @param frame The index of the frame the span belongs to.
+   * @param start The time the span started.
+   * @param end The time the span ended.
+   */
+  void record(span_e span, std::int64_t frame, clock::time_point start, clock::time_point end);
+
+  /**
+   * @brief Name the calling thread in the trace.
+   * @param name The name of the thread.
+   */
+  void name_thread(std::string_view name);
+
+  /**
+   * @brief Get the spans recorded so far.
+   * @details Spans of threads that have exited are kept until enough newer threads have
+   *          recorded spans, so the trace still covers a stream that just ended.
+   * @return The spans in the Chrome trace event format, which can be opened in Perfetto.
+   */
+  std::string dump();
+
+  /**
+   * @brief A span of a frame, as it was recorded.
+   */
+  struct span_t {
+    span_e span;
+    std::int64_t frame;
+    clock::time_point start;
+    clock::time_point end;
+  };
+
+  /**
+   * @brief Get the spans recorded so far, the same ones `dump()` returns.
+   * @return The spans, grouped by the thread that recorded them.
+   */
+  std::vector<span_t> spans();
+
+  /**
+   * @brief Records the span of a frame from its construction until its destruction.
+   */
+  class scoped_span_t {
+  public:
+    /**
+     * @param span The span.
+     * @param frame The index of the frame the span belongs to.
+     */
+    scoped_span_t(span_e span, std::int64_t frame):
+        _span {span},
+        _frame {frame},
+        _start {enabled() ? clock::now() : clock::time_point {}} {
+    }
+
+    scoped_span_t(const scoped_span_t &) = delete;
+    scoped_span_t &operator=(const scoped_span_t &) = delete;
+
+    ~scoped_span_t() {
+      if (_start != clock::time_point {}) {
+        record(_span, _frame, _start, clock::now());
+      }
+    }
+
+  private:
+    span_e _span;
+    std::int64_t _frame;
+    clock::time_point _start;
+  };
+}  // namespace frame_trace
@@ -4,6 +4,11 @@
  */
 #pragma once
 
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <utility>
+
 // local includes
 #include "entry_handler.h"
 #include "thread_pool.h"
@@ -28,33 +33,84 @@ extern bool display_cursor;
 extern nvprefs::nvprefs_interface nvprefs_instance;
 #endif
 
+// The types carried by the mail, only their names are needed here
+namespace audio {
+  struct packet_t;
+}  // namespace audio
+
+namespace input {
+  struct touch_port_t;
+}  // namespace input
+
+namespace platf {
+  struct gamepad_feedback_msg_t;
+}  // namespace platf
+
+namespace video {
+  struct hdr_info_raw_t;
+  struct packet_raw_t;
+}  // namespace video
+
+namespace video_quality {
+  struct sample_t;
+}  // namespace video_quality
+
 /**
  * @brief Handles process-wide communication.
  */
 namespace mail {
-#define MAIL(x) \
-  constexpr auto x = std::string_view { \
+  using frame_range_t = std::pair<std::int64_t, std::int64_t>;
+  using video_packet_t = std::unique_ptr<video::packet_raw_t>;
+
+/**
+ * @brief Every post of a mail, with the type it carries, and the capacity of queues.
+ */
+#define MAIL_POSTS(EVENT, QUEUE) \
+  /* Global mail */ \
+  EVENT(shutdown, bool) \
+  EVENT(broadcast_shutdown, bool) \
+  QUEUE(video_packets, video_packet_t, 32) \
+  QUEUE(audio_packets, audio::packet_t, 32) \
+  EVENT(switch_display, int) \
+\
+  /* Local mail */ \
+  EVENT(touch_port, input::touch_port_t) \
+  EVENT(idr, bool) \
+  EVENT(invalidate_ref_frames, frame_range_t) \
+  EVENT(acknowledged_frame, std::int64_t) \
+  EVENT(bitrate, int) \
+  EVENT(max_frame_size, std::int64_t) \
+  QUEUE(shared_video_packets, video_packet_t, 32) \
+  QUEUE(gamepad_feedback, platf::gamepad_feedback_msg_t, 32) \
+  EVENT(hdr, std::unique_ptr<video::hdr_info_raw_t>) \
+  EVENT(encode_quality, video_quality::sample_t)
+
+  /**
+   * @brief The index of each post in a mail.
+   */
+  enum class post_e : std::size_t {
+#define MAIL(x, ...) x,
+    MAIL_POSTS(MAIL, MAIL)
+#undef MAIL
+  };
+
+#define EVENT(x, T) \
+  constexpr safe::event_id_t<T> x { \
+    (std::size_t) post_e::x, \
     #x \
-  }
+  };
+#define QUEUE(x, T, capacity) \
+  constexpr safe::queue_id_t<T> x { \
+    (std::size_t) post_e::x, \
+    #x, \
+    capacity \
+  };
+  MAIL_POSTS(EVENT, QUEUE)
+#undef EVENT
+#undef QUEUE
 
   /**
    * @brief A process-wide communication mechanism.
    */
   extern safe::mail_t man;
-
-  // Global mail
-  MAIL(shutdown);
-  MAIL(broadcast_shutdown);
-  MAIL(video_packets);
-  MAIL(audio_packets);
-  MAIL(switch_display);
-
-  // Local mail
-  MAIL(touch_port);
-  MAIL(idr);
-  MAIL(invalidate_ref_frames);
-  MAIL(gamepad_feedback);
-  MAIL(hdr);
-#undef MAIL
-
 }  // namespace mail
@@ -5,7 +5,9 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <charconv>
 #include <filesystem>
+#include <future>
 #include <utility>
 
 // lib includes
@@ -43,6 +45,9 @@ namespace http {
   std::string unique_id;
   net::net_e origin_web_ui_allowed;
 
+  // Generating an RSA key takes seconds on slow hosts, so the servers only wait for it when they start
+  std::shared_future<int> creds_created;
+
   int init() {
     bool clean_slate = config::sunshine.flags[config::flag::FRESH_STATE];
     origin_web_ui_allowed = net::from_enum_string(config::nvhttp.origin_web_ui_allowed);
@@ -54,9 +59,9 @@ namespace http {
       config::nvhttp.pkey = (dir / ("pkey-"s + unique_id)).string();
     }
 
-    if ((!fs::exists(config::nvhttp.pkey) || !fs::exists(config::nvhttp.cert)) &&
-        create_creds(config::nvhttp.pkey, config::nvhttp.cert)) {
-      return -1;
+    if (!fs::exists(config::nvhttp.pkey) || !fs::exists(config::nvhttp.cert)) {
+      BOOST_LOG(info) << "Generating the credentials of the host"sv;
+      creds_created = std::async(std::launch::async, create_creds, config::nvhttp.pkey, config::nvhttp.cert).share();
     }
     if (!user_creds_exist(config::sunshine.credentials_file)) {
       BOOST_LOG(info) << "Open the Web UI to set your new username and password and getting started";
@@ -66,6 +71,12 @@ namespace http {
     return 0;
   }
 
+  int wait_for_creds() {
+    // Each server waits on a copy of its own, get() on a single shared_future isn't safe from several threads
+    auto creds = creds_created;
+    return creds.valid() ? creds.get() : 0;
+  }
+
   int save_user_creds(const std::string &file, const std::string &username, const std::string &password, bool run_our_mouth) {
     pt::ptree outputTree;
 
@@ -232,4 +243,54 @@ namespace http {
     curl_url_cleanup(curlu);
     return result;
   }
+
+  std::optional<std::pair<std::uint64_t, std::uint64_t>> parse_range(std::string_view range, std::uint64_t size) {
+    if (!range.starts_with("bytes="sv)) {
+      return std::nullopt;
+    }
+    range.remove_prefix(6);
+
+    auto dash = range.find('-');
+    if (dash == std::string_view::npos || range.find(',') != std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    auto parse = [](std::string_view number) -> std::optional<std::uint64_t> {
+      std::uint64_t value;
+      auto [end, ec] = std::from_chars(number.data(), number.data() + number.size(), value);
+      if (number.empty() || ec != std::errc {} || end != number.data() + number.size()) {
+        return std::nullopt;
+      }
+      return value;
+    };
+
+    auto first = range.substr(0, dash);
+    auto last = range.substr(dash + 1);
+
+    // The last bytes of the resource
+    if (first.empty()) {
+      auto suffix = parse(last);
+      if (!suffix || *suffix == 0 || size == 0) {
+        return std::nullopt;
+      }
+      auto count = std::min(*suffix, size);
+      return std::make_pair(size - count, count);
+    }
+
+    auto offset = parse(first);
+    if (!offset || *offset >= size) {
+      return std::nullopt;
+    }
+
+    auto end = size - 1;
+    if (!last.empty()) {
+      auto last_byte = parse(last);
+      if (!last_byte || *last_byte < *offset) {
+        return std::nullopt;
+      }
+      end = std::min(*last_byte, end);
+    }
+
+    return std::make_pair(*offset, end - *offset + 1);
+  }
 }  // namespace http
@@ -4,17 +4,35 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
 // lib includes
 #include <curl/curl.h>
+#include <Simple-Web-Server/server_http.hpp>
 
 // local includes
+#include "metrics.h"
 #include "network.h"
+#include "thread_pool.h"
 #include "thread_safe.h"
 
 namespace http {
 
   int init();
   int create_creds(const std::string &pkey, const std::string &cert);
+
+  /**
+   * @brief Wait for the credentials of the host, which `init()` generates in the background when they're missing.
+   * @return ``0`` once the credentials exist, ``-1`` if they couldn't be created.
+   */
+  int wait_for_creds();
   int save_user_creds(
     const std::string &file,
     const std::string &username,
@@ -27,6 +45,67 @@ namespace http {
   std::string url_escape(const std::string &url);
   std::string url_get_host(const std::string &url);
 
+  /**
+   * @brief Parse the `Range` header of a request for part of a resource.
+   * @details Only a single range of bytes is supported, as in `bytes=0-499`, `bytes=500-` or `bytes=-500`.
+   * @param range The value of the header.
+   * @param size The size of the resource.
+   * @return The offset and the size of the part, or `std::nullopt` if the range is invalid or can't be satisfied.
+   */
+  std::optional<std::pair<std::uint64_t, std::uint64_t>> parse_range(std::string_view range, std::uint64_t size);
+
+  /**
+   * @brief Runs the slow requests of an HTTP server on threads of their own.
+   * @details The other requests keep running on the thread of the server, so they never wait behind
+   *          a slow one. At most `MAX_QUEUED` requests wait for a worker, the next ones are answered
+   *          with 503 Service Unavailable.
+   */
+  class workers_t {
+  public:
+    static constexpr int MAX_QUEUED = 64;
+
+    /**
+     * @param threads The number of workers.
+     * @param metrics Where to count the time requests wait for a worker.
+     */
+    workers_t(int threads, metrics::http_workers_t &metrics):
+        _pool {threads},
+        _metrics {metrics} {
+    }
+
+    /**
+     * @brief Wrap the handler of a resource, so it runs on a worker.
+     * @param handler The handler, called with the response and the request.
+     * @return The handler to give the server.
+     */
+    template<class F>
+    auto handler(F handler) {
+      return [this, handler](auto response, auto request) {
+        if (_queued.fetch_add(1, std::memory_order_relaxed) >= MAX_QUEUED) {
+          _queued.fetch_sub(1, std::memory_order_relaxed);
+          _metrics.rejected.add();
+
+          SimpleWeb::CaseInsensitiveMultimap headers;
+          headers.emplace("Retry-After", "1");
+          response->write(SimpleWeb::StatusCode::server_error_service_unavailable, headers);
+          return;
+        }
+
+        _pool.push([this, handler, response, request, queued_at = std::chrono::steady_clock::now()]() {
+          _queued.fetch_sub(1, std::memory_order_relaxed);
+          _metrics.queue_seconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - queued_at).count());
+
+          handler(response, request);
+        });
+      };
+    }
+
+  private:
+    thread_pool_util::ThreadPool _pool;
+    metrics::http_workers_t &_metrics;
+    std::atomic<int> _queued {0};
+  };
+
   extern std::string unique_id;
   extern net::net_e origin_web_ui_allowed;
 
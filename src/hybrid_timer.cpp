@@ -0,0 +1,72 @@
+/**
+ * @file src/hybrid_timer.cpp
+ * @brief Definitions for the calibrated sleep-then-spin timer.
+ */
+// standard includes
+#include <algorithm>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #include <immintrin.h>
+#endif
+
+// local includes
+#include "hybrid_timer.h"
+#include "metrics.h"
+
+using namespace std::literals;
+
+namespace hybrid_timer {
+  namespace {
+    /**
+     * @brief Let the other hardware thread of the core run while spinning.
+     */
+    void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+      _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+      asm volatile("yield");
+#else
+      std::this_thread::yield();
+#endif
+    }
+  }  // namespace
+
+  timer_t::timer_t(std::unique_ptr<platf::high_precision_timer> coarse):
+      _coarse {std::move(coarse)},
+      _error_logger {debug, "Network: pacing timer error", "us", 20s, &metrics::video.pacing_timer_error_recent_seconds} {
+  }
+
+  void timer_t::sleep_for(const std::chrono::nanoseconds &duration) {
+    auto start = clock::now();
+    auto deadline = start + duration;
+
+    auto margin = spin_margin();
+    if (duration > margin) {
+      auto coarse_duration = duration - margin;
+      _coarse->sleep_for(coarse_duration);
+
+      _overshoot.add(clock::now() - (start + coarse_duration));
+    }
+
+    auto now = clock::now();
+    while (now < deadline) {
+      cpu_relax();
+      now = clock::now();
+    }
+
+    _error_logger.collect_and_log(std::chrono::duration<double, std::micro>(now - deadline).count());
+  }
+
+  timer_t::operator bool() {
+    return _coarse && *_coarse;
+  }
+
+  std::chrono::nanoseconds timer_t::spin_margin() const {
+    return std::clamp<std::chrono::nanoseconds>(_overshoot.budget(), MIN_SPIN, MAX_SPIN);
+  }
+
+  std::unique_ptr<platf::high_precision_timer> create() {
+    return std::make_unique<timer_t>(platf::create_high_precision_timer());
+  }
+}  // namespace hybrid_timer
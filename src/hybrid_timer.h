@@ -0,0 +1,67 @@
+/**
+ * @file src/hybrid_timer.h
+ * @brief Declarations for the calibrated sleep-then-spin timer.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <memory>
+
+// local includes
+#include "frame_scheduler.h"
+#include "logging.h"
+#include "platform/common.h"
+
+namespace hybrid_timer {
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief The shortest time to spin for, which covers the latency of waking up from a sleep.
+   */
+  constexpr auto MIN_SPIN = std::chrono::microseconds(20);
+
+  /**
+   * @brief The longest time to spin for, so a badly behaved timer can't burn a core.
+   */
+  constexpr auto MAX_SPIN = std::chrono::milliseconds(2);
+
+  /**
+   * @brief Sleeps on a coarse timer, then spins through the last part of the duration.
+   * @details The timer learns how much the coarse timer oversleeps on this host, and wakes up early
+   *          by that much. The time between waking up and the deadline is spent spinning, so sleeps
+   *          end within a microsecond or so of their deadline unless the coarse timer oversleeps by
+   *          more than it ever did before. The error of every sleep is logged and published to
+   *          the metrics.
+   */
+  class timer_t: public platf::high_precision_timer {
+  public:
+    /**
+     * @param coarse The timer to sleep on before spinning.
+     */
+    explicit timer_t(std::unique_ptr<platf::high_precision_timer> coarse);
+
+    void sleep_for(const std::chrono::nanoseconds &duration) override;
+
+    operator bool() override;
+
+    /**
+     * @brief Get how long before the deadline the coarse timer is asked to wake up.
+     */
+    std::chrono::nanoseconds spin_margin() const;
+
+  private:
+    std::unique_ptr<platf::high_precision_timer> _coarse;
+
+    // How much the coarse timer oversleeps
+    frame_scheduler::stage_estimate_t _overshoot;
+
+    logging::percentile_periodic_logger<double> _error_logger;
+  };
+
+  /**
+   * @brief Create a timer that sleeps on the platform's high precision timer.
+   * @return The timer.
+   */
+  std::unique_ptr<platf::high_precision_timer> create();
+}  // namespace hybrid_timer
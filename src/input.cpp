@@ -9,12 +9,19 @@ extern "C" {
 }
 
 // standard includes
+#include <algorithm>
+#include <array>
 #include <bitset>
 #include <chrono>
 #include <cmath>
-#include <list>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 // lib includes
 #include <boost/endian/buffers.hpp>
@@ -23,7 +30,9 @@ extern "C" {
 #include "config.h"
 #include "globals.h"
 #include "input.h"
+#include "input_queue.h"
 #include "logging.h"
+#include "metrics.h"
 #include "platform/common.h"
 #include "thread_pool.h"
 #include "utility.h"
@@ -41,6 +50,9 @@ namespace input {
 #define DISABLE_LEFT_BUTTON_DELAY ((thread_pool_util::ThreadPool::task_id_t) 0x01)
 #define ENABLE_LEFT_BUTTON_DELAY nullptr
 
+  // The most input messages injected together
+  constexpr int MAX_MESSAGES_PER_PASS = 32;
+
   constexpr auto VKEY_SHIFT = 0x10;
   constexpr auto VKEY_LSHIFT = 0xA0;
   constexpr auto VKEY_RSHIFT = 0xA1;
@@ -108,6 +120,31 @@ namespace input {
     return std::clamp(from_netfloat(f), min, max);
   }
 
+  // Input is injected on a thread of its own, so slow tasks of the task_pool don't hold it back.
+  // Key repeats and the other timers that inject input run on it too, keeping injection in order.
+  static thread_pool_util::ThreadPool input_pool;
+
+  // Gamepads are injected on lanes of their own, so a slow virtual gamepad doesn't hold back the mouse, the keyboard
+  // or the other gamepads. A gamepad always uses the same lane, and its timers run there, keeping its input in order.
+  constexpr std::size_t GAMEPAD_LANES = 4;
+  static std::array<thread_pool_util::ThreadPool, GAMEPAD_LANES> gamepad_pools;
+  static_assert(metrics::input_t::LANE_COUNT == 1 + GAMEPAD_LANES);
+
+  // Gamepads send far fewer messages than a mouse
+  constexpr std::size_t GAMEPAD_QUEUE_CAPACITY = 256;
+
+  /**
+   * @brief Get the lane injecting the input of a gamepad.
+   * @param controller The controller number of the gamepad.
+   * @return The index of the lane, which is also the index of its gamepad pool.
+   */
+  constexpr std::size_t gamepad_lane(int controller) {
+    return (std::size_t) controller % GAMEPAD_LANES;
+  }
+
+  // The platform backends create and remove virtual gamepads on one thread at a time
+  static std::mutex gamepad_alloc_lock;
+
   static task_pool_util::TaskPool::task_id_t key_press_repeat_id {};
   static std::unordered_map<key_press_id_t, bool> key_press {};
   static std::array<std::uint8_t, 5> mouse_press {};
@@ -117,11 +154,37 @@ namespace input {
 
   void free_gamepad(platf::input_t &platf_input, int id) {
     platf::gamepad_update(platf_input, id, platf::gamepad_state_t {});
+
+    std::lock_guard lg {gamepad_alloc_lock};
     platf::free_gamepad(platf_input, id);
 
+    // The id may only be reused once the platform is done with it
     free_id(gamepadMask, id);
   }
 
+  /**
+   * @brief Create a virtual gamepad.
+   * @param controller The controller number of the gamepad.
+   * @param arrival The capabilities of the gamepad.
+   * @param feedback_queue The queue of feedback to the client.
+   * @return The global index of the gamepad, or -1 if it couldn't be created.
+   */
+  int alloc_gamepad(std::uint8_t controller, const platf::gamepad_arrival_t &arrival, const platf::feedback_queue_t &feedback_queue) {
+    std::lock_guard lg {gamepad_alloc_lock};
+
+    auto id = alloc_id(gamepadMask);
+    if (id < 0) {
+      return -1;
+    }
+
+    if (platf::alloc_gamepad(platf_input, {id, controller}, arrival, feedback_queue)) {
+      free_id(gamepadMask, id);
+      return -1;
+    }
+
+    return id;
+  }
+
   struct gamepad_t {
     gamepad_t():
         gamepad_state {},
@@ -132,14 +195,43 @@ namespace input {
 
     ~gamepad_t() {
       if (id >= 0) {
-        task_pool.push([id = this->id]() {
+        input_pool.push(thread_pool_util::lane_e::input, [id = this->id]() {
           free_gamepad(platf_input, id);
         });
       }
     }
 
+    /**
+     * @brief Forget the state of a removed gamepad, so the next one in its slot starts from scratch.
+     * @param pool The pool of the gamepad's lane.
+     */
+    void reset(thread_pool_util::ThreadPool &pool) {
+      gamepad_state = {};
+
+      for (auto &sensor : motion) {
+        if (sensor.flush_id) {
+          pool.cancel(sensor.flush_id);
+        }
+        sensor = {};
+      }
+    }
+
+    // The last state sent to the platform, so that states that don't change anything can be skipped
     platf::gamepad_state_t gamepad_state;
 
+    /**
+     * @brief The samples of a motion sensor, sent to the platform at most once per `gamepad_motion_interval`.
+     */
+    struct motion_t {
+      std::optional<platf::gamepad_motion_t> last;  ///< The last sample sent to the platform
+      std::optional<platf::gamepad_motion_t> pending;  ///< The latest sample, waiting for the interval to elapse
+      std::chrono::steady_clock::time_point last_sent;
+      thread_pool_util::ThreadPool::task_id_t flush_id {};
+    };
+
+    // Indexed by the motion type, starting from LI_MOTION_TYPE_ACCEL
+    std::array<motion_t, 2> motion;
+
     thread_pool_util::ThreadPool::task_id_t back_timeout_id;
 
     int id;
@@ -170,9 +262,15 @@ namespace input {
         touch_port_event {std::move(touch_port_event)},
         feedback_queue {std::move(feedback_queue)},
         mouse_left_button_timeout {},
+        mouse_move_flush_id {},
+        pending_mouse_delta {},
         touch_port {{0, 0, 0, 0}, 0, 0, 1.0f},
+        touch_frame {},
         accumulated_vscroll_delta {},
         accumulated_hscroll_delta {} {
+      for (std::size_t x = 0; x < GAMEPAD_LANES; ++x) {
+        gamepad_queues.emplace_back(GAMEPAD_QUEUE_CAPACITY);
+      }
     }
 
     // Keep track of alt+ctrl+shift key combo
@@ -184,13 +282,28 @@ namespace input {
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;
     platf::feedback_queue_t feedback_queue;
 
-    std::list<std::vector<uint8_t>> input_queue;
-    std::mutex input_queue_lock;
+    // The mouse, keyboard, touch and pen input, and the input of the gamepads on each gamepad lane.
+    // A deque, since the queues can't be moved.
+    input_queue_t input_queue;
+    std::deque<input_queue_t> gamepad_queues;
 
     thread_pool_util::ThreadPool::task_id_t mouse_left_button_timeout;
 
+    // Relative mouse moves received within the mouse move interval are added up until it elapses.
+    // The deltas are whole pixels, so adding them up doesn't lose anything.
+    thread_pool_util::ThreadPool::task_id_t mouse_move_flush_id;
+    std::pair<int, int> pending_mouse_delta;
+    std::chrono::steady_clock::time_point mouse_move_sent;
+
     input::touch_port_t touch_port;
 
+    // Touch events of different pointers are collected into a frame, injected together once
+    // the frame ends. A pointer's second event in a frame starts the next one.
+    struct touch_frame_t {
+      contact_batch_t contacts;
+      std::array<platf::touch_input_t, contact_batch_t::MAX_CONTACTS> touches;
+    } touch_frame;
+
     int32_t accumulated_vscroll_delta;
     int32_t accumulated_hscroll_delta;
   };
@@ -441,13 +554,96 @@ namespace input {
     }
   }
 
+  /**
+   * @brief Send the relative mouse moves waiting for the mouse move interval to the platform backend.
+   * @param input The input context pointer.
+   */
+  void flush_mouse_moves(std::shared_ptr<input_t> &input) {
+    if (input->mouse_move_flush_id) {
+      input_pool.cancel(input->mouse_move_flush_id);
+      input->mouse_move_flush_id = nullptr;
+    }
+
+    auto [delta_x, delta_y] = std::exchange(input->pending_mouse_delta, {});
+    if (!delta_x && !delta_y) {
+      return;
+    }
+
+    platf::move_mouse(platf_input, delta_x, delta_y);
+    input->mouse_move_sent = std::chrono::steady_clock::now();
+  }
+
   void passthrough(std::shared_ptr<input_t> &input, PNV_REL_MOUSE_MOVE_PACKET packet) {
     if (!config::input.mouse) {
       return;
     }
 
     input->mouse_left_button_timeout = DISABLE_LEFT_BUTTON_DELAY;
-    platf::move_mouse(platf_input, util::endian::big(packet->deltaX), util::endian::big(packet->deltaY));
+
+    int delta_x = util::endian::big(packet->deltaX);
+    int delta_y = util::endian::big(packet->deltaY);
+
+    auto interval = config::input.mouse_move_interval.load();
+    if (interval == 0ns) {
+      platf::move_mouse(platf_input, delta_x, delta_y);
+      return;
+    }
+
+    // Moves are already waiting for the interval to elapse
+    if (input->mouse_move_flush_id) {
+      input->pending_mouse_delta.first += delta_x;
+      input->pending_mouse_delta.second += delta_y;
+      metrics::input.mouse_moves_coalesced.add();
+      return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - input->mouse_move_sent >= interval) {
+      platf::move_mouse(platf_input, delta_x, delta_y);
+      input->mouse_move_sent = now;
+      return;
+    }
+
+    input->pending_mouse_delta = {delta_x, delta_y};
+
+    auto f = [input]() mutable {
+      input->mouse_move_flush_id = nullptr;
+      flush_mouse_moves(input);
+    };
+
+    input->mouse_move_flush_id = input_pool.pushDelayed(std::move(f), input->mouse_move_sent + interval - now).task_id;
+  }
+
+  /**
+   * @brief Take the latest touch port of the session, if the display changed.
+   * @param input The input context.
+   * @return `true` if a touch port is available.
+   */
+  bool update_touch_port(std::shared_ptr<input_t> &input) {
+    auto &touch_port_event = input->touch_port_event;
+    if (touch_port_event->peek()) {
+      input->touch_port = *touch_port_event->pop();
+    }
+    if (!input->touch_port) {
+      BOOST_LOG(verbose) << "Ignoring early absolute input without a touch port"sv;
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Get the area of the screen the touch port covers.
+   * @param touch_port The touch port.
+   * @return The area of the screen, for the platform backend.
+   */
+  platf::touch_port_t abs_touch_port(const input::touch_port_t &touch_port) {
+    return {
+      touch_port.offset_x,
+      touch_port.offset_y,
+      touch_port.env_width,
+      touch_port.env_height
+    };
   }
 
   /**
@@ -458,16 +654,12 @@ namespace input {
    * @return The host-relative coordinate pair if a touchport is available.
    */
   std::optional<std::pair<float, float>> client_to_touchport(std::shared_ptr<input_t> &input, const std::pair<float, float> &val, const std::pair<float, float> &size) {
-    auto &touch_port_event = input->touch_port_event;
-    auto &touch_port = input->touch_port;
-    if (touch_port_event->peek()) {
-      touch_port = *touch_port_event->pop();
-    }
-    if (!touch_port) {
-      BOOST_LOG(verbose) << "Ignoring early absolute input without a touch port"sv;
+    if (!update_touch_port(input)) {
       return std::nullopt;
     }
 
+    auto &touch_port = input->touch_port;
+
     auto scalarX = touch_port.width / size.first;
     auto scalarY = touch_port.height / size.second;
 
@@ -516,6 +708,47 @@ namespace input {
     return {multiply_polar_by_cartesian_scalar(major, angle, scalar), multiply_polar_by_cartesian_scalar(minor, angle + (M_PI / 2), scalar)};
   }
 
+  void transform_contacts(const touch_port_t &touch_port, contact_batch_t &contacts) {
+    constexpr float CLIENT_SIZE = 65535.f;
+    auto count = std::min(contacts.count, contact_batch_t::MAX_CONTACTS);
+
+    // The same conversion as client_to_touchport(), followed by renormalizing to the touch port.
+    // The client coordinates are within 0.0-65535.0, so clamping to the client's offsets alone is enough.
+    auto scalar_x = touch_port.width / CLIENT_SIZE;
+    auto scalar_y = touch_port.height / CLIENT_SIZE;
+    auto offset_x = touch_port.client_offsetX;
+    auto offset_y = touch_port.client_offsetY;
+    auto range_x = CLIENT_SIZE * scalar_x - 2 * offset_x;
+    auto range_y = CLIENT_SIZE * scalar_y - 2 * offset_y;
+    auto normalize_x = touch_port.scalar_inv / touch_port.env_width;
+    auto normalize_y = touch_port.scalar_inv / touch_port.env_height;
+
+    for (std::size_t i = 0; i < count; ++i) {
+      contacts.x[i] = std::clamp(contacts.x[i] * scalar_x - offset_x, 0.0f, range_x) * normalize_x;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      contacts.y[i] = std::clamp(contacts.y[i] * scalar_y - offset_y, 0.0f, range_y) * normalize_y;
+    }
+
+    // The same scaling as scale_client_contact_area(), with the sine and cosine of the major axis
+    // giving those of the perpendicular minor axis
+    auto area_scalar_x = touch_port.env_width / CLIENT_SIZE;
+    auto area_scalar_y = touch_port.env_height / CLIENT_SIZE;
+    for (std::size_t i = 0; i < count; ++i) {
+      float angle = contacts.rotation[i] == LI_ROT_UNKNOWN ? (M_PI / 4) : (contacts.rotation[i] * (M_PI / 180));
+      auto cos_x = std::cos(angle) * area_scalar_x;
+      auto sin_x = std::sin(angle) * area_scalar_x;
+      auto cos_y = std::cos(angle) * area_scalar_y;
+      auto sin_y = std::sin(angle) * area_scalar_y;
+
+      auto major = contacts.contact_area_major[i];
+      auto minor = contacts.contact_area_minor[i] != 0.0f ? contacts.contact_area_minor[i] : major;
+
+      contacts.contact_area_major[i] = major * std::sqrt(cos_x * cos_x + sin_y * sin_y);
+      contacts.contact_area_minor[i] = minor * std::sqrt(sin_x * sin_x + cos_y * cos_y);
+    }
+  }
+
   void passthrough(std::shared_ptr<input_t> &input, PNV_ABS_MOUSE_MOVE_PACKET packet) {
     if (!config::input.mouse) {
       return;
@@ -597,7 +830,7 @@ namespace input {
         input->mouse_left_button_timeout = nullptr;
       };
 
-      input->mouse_left_button_timeout = task_pool.pushDelayed(std::move(f), 10ms).task_id;
+      input->mouse_left_button_timeout = input_pool.pushDelayed(std::move(f), 10ms).task_id;
 
       return;
     }
@@ -716,7 +949,7 @@ namespace input {
 
     send_key_and_modifiers(key_code, false, flags, synthetic_modifiers);
 
-    key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_period, key_code, flags, synthetic_modifiers).task_id;
+    key_press_repeat_id = input_pool.pushDelayed(repeat_key, config::input.key_repeat_period.load(), key_code, flags, synthetic_modifiers).task_id;
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_KEYBOARD_PACKET packet) {
@@ -752,11 +985,11 @@ namespace input {
         }
 
         if (key_press_repeat_id) {
-          task_pool.cancel(key_press_repeat_id);
+          input_pool.cancel(key_press_repeat_id);
         }
 
-        if (config::input.key_repeat_delay.count() > 0) {
-          key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_delay, keyCode, packet->flags, synthetic_modifiers).task_id;
+        if (config::input.key_repeat_delay.load().count() > 0) {
+          key_press_repeat_id = input_pool.pushDelayed(repeat_key, config::input.key_repeat_delay.load(), keyCode, packet->flags, synthetic_modifiers).task_id;
         }
       } else {
         // Already released
@@ -855,22 +1088,54 @@ namespace input {
       util::endian::little(packet->supportedButtonFlags),
     };
 
-    auto id = alloc_id(gamepadMask);
+    // Allocate a new gamepad
+    auto id = alloc_gamepad(packet->controllerNumber, arrival, input->feedback_queue);
     if (id < 0) {
       return;
     }
 
-    // Allocate a new gamepad
-    if (platf::alloc_gamepad(platf_input, {id, packet->controllerNumber}, arrival, input->feedback_queue)) {
-      free_id(gamepadMask, id);
+    input->gamepads[packet->controllerNumber].id = id;
+  }
+
+  /**
+   * @brief Inject the touch events of the current frame.
+   * @param input The input context pointer.
+   */
+  void flush_touches(std::shared_ptr<input_t> &input) {
+    auto &frame = input->touch_frame;
+    if (!frame.contacts.count) {
       return;
     }
 
-    input->gamepads[packet->controllerNumber].id = id;
+    transform_contacts(input->touch_port, frame.contacts);
+    for (std::size_t i = 0; i < frame.contacts.count; ++i) {
+      auto &touch = frame.touches[i];
+      touch.x = frame.contacts.x[i];
+      touch.y = frame.contacts.y[i];
+      touch.contactAreaMajor = frame.contacts.contact_area_major[i];
+      touch.contactAreaMinor = frame.contacts.contact_area_minor[i];
+    }
+
+    platf::touch_update(input->client_context.get(), abs_touch_port(input->touch_port), std::span {frame.touches.data(), frame.contacts.count});
+    frame.contacts.count = 0;
   }
 
   /**
-   * @brief Called to pass a touch message to the platform backend.
+   * @brief Normalize the rotation of a touch or pen message to the 0-359 degree range.
+   * @param rotation The rotation from the client.
+   * @return The rotation in degrees, or LI_ROT_UNKNOWN.
+   */
+  std::uint16_t normalize_rotation(std::uint16_t rotation) {
+    rotation = util::endian::little(rotation);
+    if (rotation != LI_ROT_UNKNOWN) {
+      rotation %= 360;
+    }
+
+    return rotation;
+  }
+
+  /**
+   * @brief Called to add a touch message to the frame being collected.
    * @param input The input context pointer.
    * @param packet The touch packet.
    */
@@ -879,50 +1144,37 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
-    if (!coords) {
+    if (!update_touch_port(input)) {
       return;
     }
 
-    auto &touch_port = input->touch_port;
-    platf::touch_port_t abs_port {
-      touch_port.offset_x,
-      touch_port.offset_y,
-      touch_port.env_width,
-      touch_port.env_height
-    };
-
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
-
-    // Normalize rotation value to 0-359 degree range
-    auto rotation = util::endian::little(packet->rotation);
-    if (rotation != LI_ROT_UNKNOWN) {
-      rotation %= 360;
+    auto &frame = input->touch_frame;
+    auto pointer_id = util::endian::little(packet->pointerId);
+    auto end = std::begin(frame.touches) + frame.contacts.count;
+    if (frame.contacts.count == contact_batch_t::MAX_CONTACTS || std::any_of(std::begin(frame.touches), end, [pointer_id](const auto &touch) {
+          return touch.pointerId == pointer_id;
+        })) {
+      flush_touches(input);
     }
 
-    // Normalize the contact area based on the touchport
-    auto contact_area = scale_client_contact_area(
-      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f,
-       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f},
-      rotation,
-      {abs_port.width / 65535.f, abs_port.height / 65535.f}
-    );
+    // The coordinates and the contact area are converted to the touch port once the frame is complete
+    auto i = frame.contacts.count++;
+    frame.contacts.x[i] = from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f;
+    frame.contacts.y[i] = from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f;
+    frame.contacts.contact_area_major[i] = from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f;
+    frame.contacts.contact_area_minor[i] = from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f;
+    frame.contacts.rotation[i] = normalize_rotation(packet->rotation);
 
-    platf::touch_input_t touch {
+    frame.touches[i] = platf::touch_input_t {
       packet->eventType,
-      rotation,
-      util::endian::little(packet->pointerId),
-      coords->first,
-      coords->second,
+      frame.contacts.rotation[i],
+      pointer_id,
+      0.0f,
+      0.0f,
       from_clamped_netfloat(packet->pressureOrDistance, 0.0f, 1.0f),
-      contact_area.first,
-      contact_area.second,
+      0.0f,
+      0.0f,
     };
-
-    platf::touch_update(input->client_context.get(), abs_port, touch);
   }
 
   /**
@@ -935,52 +1187,34 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
-    if (!coords) {
+    if (!update_touch_port(input)) {
       return;
     }
 
-    auto &touch_port = input->touch_port;
-    platf::touch_port_t abs_port {
-      touch_port.offset_x,
-      touch_port.offset_y,
-      touch_port.env_width,
-      touch_port.env_height
-    };
-
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
-
-    // Normalize rotation value to 0-359 degree range
-    auto rotation = util::endian::little(packet->rotation);
-    if (rotation != LI_ROT_UNKNOWN) {
-      rotation %= 360;
-    }
-
-    // Normalize the contact area based on the touchport
-    auto contact_area = scale_client_contact_area(
-      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f,
-       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f},
-      rotation,
-      {abs_port.width / 65535.f, abs_port.height / 65535.f}
-    );
+    // The pen is a single contact
+    contact_batch_t contacts;
+    contacts.count = 1;
+    contacts.x[0] = from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f;
+    contacts.y[0] = from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f;
+    contacts.contact_area_major[0] = from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f;
+    contacts.contact_area_minor[0] = from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f;
+    contacts.rotation[0] = normalize_rotation(packet->rotation);
+    transform_contacts(input->touch_port, contacts);
 
     platf::pen_input_t pen {
       packet->eventType,
       packet->toolType,
       packet->penButtons,
       packet->tilt,
-      rotation,
-      coords->first,
-      coords->second,
+      contacts.rotation[0],
+      contacts.x[0],
+      contacts.y[0],
       from_clamped_netfloat(packet->pressureOrDistance, 0.0f, 1.0f),
-      contact_area.first,
-      contact_area.second,
+      contacts.contact_area_major[0],
+      contacts.contact_area_minor[0],
     };
 
-    platf::pen_update(input->client_context.get(), abs_port, pen);
+    platf::pen_update(input->client_context.get(), abs_touch_port(input->touch_port), pen);
   }
 
   /**
@@ -1016,6 +1250,27 @@ namespace input {
     platf::gamepad_touch(platf_input, touch);
   }
 
+  /**
+   * @brief Check if two motion samples carry the same reading.
+   */
+  bool same_motion(const platf::gamepad_motion_t &a, const platf::gamepad_motion_t &b) {
+    return a.motionType == b.motionType && a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+
+  /**
+   * @brief Send a motion sample to the platform backend.
+   * @param sensor The samples of the motion sensor.
+   * @param motion The sample to send.
+   * @param now The current time.
+   */
+  void send_motion(gamepad_t::motion_t &sensor, const platf::gamepad_motion_t &motion, std::chrono::steady_clock::time_point now) {
+    platf::gamepad_motion(platf_input, motion);
+    metrics::input.gamepad_motion_forwarded.add();
+
+    sensor.last = motion;
+    sensor.last_sent = now;
+  }
+
   /**
    * @brief Called to pass a controller motion message to the platform backend.
    * @param input The input context pointer.
@@ -1045,7 +1300,54 @@ namespace input {
       from_netfloat(packet->z),
     };
 
-    platf::gamepad_motion(platf_input, motion);
+    if (motion.motionType < LI_MOTION_TYPE_ACCEL || motion.motionType >= LI_MOTION_TYPE_ACCEL + gamepad.motion.size()) {
+      platf::gamepad_motion(platf_input, motion);
+      return;
+    }
+
+    auto index = motion.motionType - LI_MOTION_TYPE_ACCEL;
+    auto &sensor = gamepad.motion[index];
+
+    // A sample is already waiting for the interval to elapse, the latest one replaces it
+    if (sensor.pending) {
+      sensor.pending = motion;
+      metrics::input.gamepad_motion_coalesced.add();
+      return;
+    }
+
+    if (sensor.last && same_motion(*sensor.last, motion)) {
+      metrics::input.gamepad_motion_suppressed.add();
+      return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto interval = config::input.gamepad_motion_interval;
+    if (sensor.last && now - sensor.last_sent < interval) {
+      sensor.pending = motion;
+
+      auto f = [input, controller = packet->controllerNumber, index]() {
+        auto &gamepad = input->gamepads[controller];
+        auto &sensor = gamepad.motion[index];
+
+        sensor.flush_id = nullptr;
+        if (!sensor.pending) {
+          return;
+        }
+
+        auto motion = *std::exchange(sensor.pending, std::nullopt);
+        if (sensor.last && same_motion(*sensor.last, motion)) {
+          metrics::input.gamepad_motion_suppressed.add();
+          return;
+        }
+
+        send_motion(sensor, motion, std::chrono::steady_clock::now());
+      };
+
+      sensor.flush_id = gamepad_pools[gamepad_lane(packet->controllerNumber)].pushDelayed(std::move(f), sensor.last_sent + interval - now).task_id;
+      return;
+    }
+
+    send_motion(sensor, motion, now);
   }
 
   /**
@@ -1094,21 +1396,17 @@ namespace input {
     // If this is an event for a new gamepad, create the gamepad now. Ideally, the client would
     // send a controller arrival instead of this but it's still supported for legacy clients.
     if ((packet->activeGamepadMask & (1 << packet->controllerNumber)) && gamepad.id < 0) {
-      auto id = alloc_id(gamepadMask);
+      auto id = alloc_gamepad((uint8_t) packet->controllerNumber, {}, input->feedback_queue);
       if (id < 0) {
         return;
       }
 
-      if (platf::alloc_gamepad(platf_input, {id, (uint8_t) packet->controllerNumber}, {}, input->feedback_queue)) {
-        free_id(gamepadMask, id);
-        return;
-      }
-
       gamepad.id = id;
     } else if (!(packet->activeGamepadMask & (1 << packet->controllerNumber)) && gamepad.id >= 0) {
       // If this is the final event for a gamepad being removed, free the gamepad and return.
       free_gamepad(platf_input, gamepad.id);
       gamepad.id = -1;
+      gamepad.reset(gamepad_pools[gamepad_lane(packet->controllerNumber)]);
       return;
     }
 
@@ -1155,7 +1453,7 @@ namespace input {
     if (platf::BACK & bf) {
       if (platf::BACK & bf_new) {
         // Don't emulate home button if timeout < 0
-        if (config::input.back_button_timeout >= 0ms) {
+        if (config::input.back_button_timeout.load() >= 0ms) {
           auto f = [input, controller = packet->controllerNumber]() {
             auto &gamepad = input->gamepads[controller];
 
@@ -1180,15 +1478,22 @@ namespace input {
             gamepad.back_timeout_id = nullptr;
           };
 
-          gamepad.back_timeout_id = task_pool.pushDelayed(std::move(f), config::input.back_button_timeout).task_id;
+          gamepad.back_timeout_id = gamepad_pools[gamepad_lane(packet->controllerNumber)].pushDelayed(std::move(f), config::input.back_button_timeout.load()).task_id;
         }
       } else if (gamepad.back_timeout_id) {
-        task_pool.cancel(gamepad.back_timeout_id);
+        gamepad_pools[gamepad_lane(packet->controllerNumber)].cancel(gamepad.back_timeout_id);
         gamepad.back_timeout_id = nullptr;
       }
     }
 
+    // Nothing changed for the platform, the client resent the state or only changed the forced back button
+    if (gamepad_state == gamepad.gamepad_state) {
+      metrics::input.gamepad_updates_suppressed.add();
+      return;
+    }
+
     platf::gamepad_update(platf_input, gamepad.id, gamepad_state);
+    metrics::input.gamepad_updates_forwarded.add();
 
     gamepad.gamepad_state = gamepad_state;
   }
@@ -1475,121 +1780,252 @@ namespace input {
   }
 
   /**
-   * @brief Called on a thread pool thread to process an input message.
+   * @brief Process the next queued input message, batched with the ones after it where possible.
    * @param input The input context pointer.
+   * @param queue The queue of the lane.
+   * @param lane The lane, 0 for the mouse and keyboard and 1 + the gamepad lane for gamepads.
+   * @return `false` if there was no message to process.
    */
-  void passthrough_next_message(std::shared_ptr<input_t> input) {
+  bool passthrough_queued_message(std::shared_ptr<input_t> &input, input_queue_t &queue, std::size_t lane) {
     // 'entry' backs the 'payload' pointer, so they must remain in scope together
-    std::vector<uint8_t> entry;
+    input_entry_t entry;
     PNV_INPUT_HEADER payload;
+    std::chrono::steady_clock::time_point dequeued;
+    int batched = 0;
 
-    // Lock the input queue while batching, but release it before sending
-    // the input to the OS. This avoids potentially lengthy lock contention
-    // in the control stream thread while input is being processed by the OS.
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-
+    // The front message and the published ones behind it belong to this thread until they're popped,
+    // so they're batched in place while the control stream keeps queueing messages behind them
+    auto front = queue.peek(0);
+    if (!front) {
       // If all entries have already been processed, nothing to do
-      if (input->input_queue.empty()) {
-        return;
+      return false;
+    }
+
+    // Move the first entry, which we will send, so that its slot can be reused once it's popped
+    entry = std::move(*front);
+    payload = (PNV_INPUT_HEADER) entry.data();
+    dequeued = std::chrono::steady_clock::now();
+
+    // Try to batch with the remaining published entries, in place
+    for (std::size_t x = 1; auto batchable_entry = queue.peek(x); ++x) {
+      if (batchable_entry->batched) {
+        continue;
       }
 
-      // Pop off the first entry, which we will send
-      entry = input->input_queue.front();
-      payload = (PNV_INPUT_HEADER) entry.data();
-      input->input_queue.pop_front();
-
-      // Try to batch with remaining items on the queue
-      auto i = input->input_queue.begin();
-      while (i != input->input_queue.end()) {
-        auto batchable_entry = *i;
-        auto batchable_payload = (PNV_INPUT_HEADER) batchable_entry.data();
-
-        auto batch_result = batch(payload, batchable_payload);
-        if (batch_result == batch_result_e::terminate_batch) {
-          // Stop batching
-          break;
-        } else if (batch_result == batch_result_e::batched) {
-          // Erase this entry since it was batched
-          i = input->input_queue.erase(i);
-        } else {
-          // We couldn't batch this entry, but try to batch later entries.
-          i++;
-        }
+      auto batchable_payload = (PNV_INPUT_HEADER) batchable_entry->data();
+
+      auto batch_result = batch(payload, batchable_payload);
+      if (batch_result == batch_result_e::terminate_batch) {
+        // Stop batching
+        break;
+      } else if (batch_result == batch_result_e::batched) {
+        // Skip this entry from now on since it was batched
+        batchable_entry->batched = true;
+        ++batched;
       }
+      // Otherwise we couldn't batch this entry, but try to batch later entries.
     }
 
+    queue.pop_front();
+
     // Print the final input packet
     input::print((void *) payload);
 
+    // Relative mouse moves waiting for the mouse move interval and the touch frame being collected go out
+    // before the input that follows them. Only the gamepads are separate devices, whose order relative
+    // to the mouse doesn't matter.
+    switch (util::endian::little(payload->magic)) {
+      case MULTI_CONTROLLER_MAGIC_GEN5:
+      case SS_CONTROLLER_ARRIVAL_MAGIC:
+      case SS_CONTROLLER_TOUCH_MAGIC:
+      case SS_CONTROLLER_MOTION_MAGIC:
+      case SS_CONTROLLER_BATTERY_MAGIC:
+        break;
+      case MOUSE_MOVE_REL_MAGIC_GEN5:
+        flush_touches(input);
+        break;
+      case SS_TOUCH_MAGIC:
+        flush_mouse_moves(input);
+        break;
+      default:
+        flush_mouse_moves(input);
+        flush_touches(input);
+        break;
+    }
+
     // Send the batched input to the OS
+    auto type = metrics::input_t::TYPE_COUNT;
+    auto inject_start = std::chrono::steady_clock::now();
     switch (util::endian::little(payload->magic)) {
       case MOUSE_MOVE_REL_MAGIC_GEN5:
         passthrough(input, (PNV_REL_MOUSE_MOVE_PACKET) payload);
+        type = metrics::input_t::mouse;
         break;
       case MOUSE_MOVE_ABS_MAGIC:
         passthrough(input, (PNV_ABS_MOUSE_MOVE_PACKET) payload);
+        type = metrics::input_t::mouse;
         break;
       case MOUSE_BUTTON_DOWN_EVENT_MAGIC_GEN5:
       case MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5:
         passthrough(input, (PNV_MOUSE_BUTTON_PACKET) payload);
+        type = metrics::input_t::mouse;
         break;
       case SCROLL_MAGIC_GEN5:
         passthrough(input, (PNV_SCROLL_PACKET) payload);
+        type = metrics::input_t::mouse;
         break;
       case SS_HSCROLL_MAGIC:
         passthrough(input, (PSS_HSCROLL_PACKET) payload);
+        type = metrics::input_t::mouse;
         break;
       case KEY_DOWN_EVENT_MAGIC:
       case KEY_UP_EVENT_MAGIC:
         passthrough(input, (PNV_KEYBOARD_PACKET) payload);
+        type = metrics::input_t::keyboard;
         break;
       case UTF8_TEXT_EVENT_MAGIC:
         passthrough((PNV_UNICODE_PACKET) payload);
+        type = metrics::input_t::keyboard;
         break;
       case MULTI_CONTROLLER_MAGIC_GEN5:
         passthrough(input, (PNV_MULTI_CONTROLLER_PACKET) payload);
+        type = metrics::input_t::gamepad;
         break;
       case SS_TOUCH_MAGIC:
         passthrough(input, (PSS_TOUCH_PACKET) payload);
+        type = metrics::input_t::touch;
         break;
       case SS_PEN_MAGIC:
         passthrough(input, (PSS_PEN_PACKET) payload);
+        type = metrics::input_t::pen;
         break;
       case SS_CONTROLLER_ARRIVAL_MAGIC:
         passthrough(input, (PSS_CONTROLLER_ARRIVAL_PACKET) payload);
+        type = metrics::input_t::gamepad;
         break;
       case SS_CONTROLLER_TOUCH_MAGIC:
         passthrough(input, (PSS_CONTROLLER_TOUCH_PACKET) payload);
+        type = metrics::input_t::gamepad;
         break;
       case SS_CONTROLLER_MOTION_MAGIC:
         passthrough(input, (PSS_CONTROLLER_MOTION_PACKET) payload);
+        type = metrics::input_t::gamepad;
         break;
       case SS_CONTROLLER_BATTERY_MAGIC:
         passthrough(input, (PSS_CONTROLLER_BATTERY_PACKET) payload);
+        type = metrics::input_t::gamepad;
         break;
     }
+
+    auto injected = std::chrono::steady_clock::now();
+    metrics::input.injection_latency_seconds.observe(std::chrono::duration<double> {injected - entry.received}.count());
+    metrics::input.lanes[lane].injection_latency_seconds.observe(std::chrono::duration<double> {injected - entry.received}.count());
+    if (type != metrics::input_t::TYPE_COUNT) {
+      auto &type_metrics = metrics::input.types[type];
+      type_metrics.queue_seconds.observe(std::chrono::duration<double> {dequeued - entry.queued}.count());
+      type_metrics.batched_messages.observe(batched);
+      type_metrics.injection_seconds.observe(std::chrono::duration<double> {injected - inject_start}.count());
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Called on the input thread to process the queued mouse, keyboard, touch and pen messages.
+   * @details The messages that couldn't be batched with each other are still injected together,
+   *          so a burst of different events costs the OS a single injection where it can.
+   *          The tasks queued for the messages processed here find the queue empty.
+   * @param input The input context pointer.
+   */
+  void passthrough_next_message(std::shared_ptr<input_t> input) {
+    platf::begin_input_batch(platf_input);
+    auto fg = util::fail_guard([&input]() {
+      // The touch frame ends with the messages the client sent it with
+      flush_touches(input);
+      platf::end_input_batch(platf_input);
+    });
+
+    // Don't hold back the first messages for too long while a client floods us
+    for (int x = 0; x < MAX_MESSAGES_PER_PASS && passthrough_queued_message(input, input->input_queue, 0); ++x) {
+    }
+  }
+
+  /**
+   * @brief Called on the thread of a gamepad lane to process its queued messages.
+   * @param input The input context pointer.
+   * @param lane The gamepad lane.
+   */
+  void passthrough_next_gamepad_message(std::shared_ptr<input_t> input, std::size_t lane) {
+    for (int x = 0; x < MAX_MESSAGES_PER_PASS && passthrough_queued_message(input, input->gamepad_queues[lane], 1 + lane); ++x) {
+    }
+  }
+
+  /**
+   * @brief Get the controller number an input message is for.
+   * @param input_data The input message.
+   * @return The controller number, or -1 if the message isn't for a gamepad.
+   */
+  int controller_of(const std::vector<std::uint8_t> &input_data) {
+    if (input_data.size() < sizeof(NV_INPUT_HEADER)) {
+      return -1;
+    }
+
+    auto payload = (PNV_INPUT_HEADER) input_data.data();
+    switch (util::endian::little(payload->magic)) {
+      case MULTI_CONTROLLER_MAGIC_GEN5:
+        return input_data.size() >= sizeof(NV_MULTI_CONTROLLER_PACKET) ? ((PNV_MULTI_CONTROLLER_PACKET) payload)->controllerNumber : -1;
+      case SS_CONTROLLER_ARRIVAL_MAGIC:
+        return input_data.size() >= sizeof(SS_CONTROLLER_ARRIVAL_PACKET) ? ((PSS_CONTROLLER_ARRIVAL_PACKET) payload)->controllerNumber : -1;
+      case SS_CONTROLLER_TOUCH_MAGIC:
+        return input_data.size() >= sizeof(SS_CONTROLLER_TOUCH_PACKET) ? ((PSS_CONTROLLER_TOUCH_PACKET) payload)->controllerNumber : -1;
+      case SS_CONTROLLER_MOTION_MAGIC:
+        return input_data.size() >= sizeof(SS_CONTROLLER_MOTION_PACKET) ? ((PSS_CONTROLLER_MOTION_PACKET) payload)->controllerNumber : -1;
+      case SS_CONTROLLER_BATTERY_MAGIC:
+        return input_data.size() >= sizeof(SS_CONTROLLER_BATTERY_PACKET) ? ((PSS_CONTROLLER_BATTERY_PACKET) payload)->controllerNumber : -1;
+      default:
+        return -1;
+    }
   }
 
   /**
    * @brief Called on the control stream thread to queue an input message.
    * @param input The input context pointer.
    * @param input_data The input message.
+   * @param received When the control stream received the message.
    */
-  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data) {
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-      input->input_queue.push_back(std::move(input_data));
+  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data, std::chrono::steady_clock::time_point received) {
+    metrics::input.events.add();
+
+    // Gamepad messages with a negative controller number are rejected on the mouse and keyboard lane
+    auto controller = controller_of(input_data);
+    if (controller >= 0) {
+      auto lane = gamepad_lane(controller);
+      if (!input->gamepad_queues[lane].push_back(std::move(input_data), received)) {
+        metrics::input.queue_overflows.add();
+        return;
+      }
+      gamepad_pools[lane].push(thread_pool_util::lane_e::input, passthrough_next_gamepad_message, input, lane);
+      return;
+    }
+
+    if (!input->input_queue.push_back(std::move(input_data), received)) {
+      metrics::input.queue_overflows.add();
+      return;
     }
-    task_pool.push(passthrough_next_message, input);
+    input_pool.push(thread_pool_util::lane_e::input, passthrough_next_message, input);
   }
 
   void reset(std::shared_ptr<input_t> &input) {
-    task_pool.cancel(key_press_repeat_id);
-    task_pool.cancel(input->mouse_left_button_timeout);
+    input_pool.cancel(key_press_repeat_id);
+    input_pool.cancel(input->mouse_left_button_timeout);
+
+    // Ensure input is synchronous, by using the input_pool
+    input_pool.push(thread_pool_util::lane_e::input, [input]() {
+      input_pool.cancel(input->mouse_move_flush_id);
+      input->mouse_move_flush_id = nullptr;
+      input->pending_mouse_delta = {};
+      input->touch_frame.contacts.count = 0;
 
-    // Ensure input is synchronous, by using the task_pool
-    task_pool.push([]() {
       for (int x = 0; x < mouse_press.size(); ++x) {
         if (mouse_press[x]) {
           platf::button_mouse(platf_input, x, true);
@@ -1611,6 +2047,16 @@ namespace input {
   class deinit_t: public platf::deinit_t {
   public:
     ~deinit_t() override {
+      // Nothing may inject input once it's gone
+      input_pool.stop();
+      for (auto &pool : gamepad_pools) {
+        pool.stop();
+      }
+      input_pool.join();
+      for (auto &pool : gamepad_pools) {
+        pool.join();
+      }
+
       platf_input.reset();
     }
   };
@@ -1618,6 +2064,19 @@ namespace input {
   [[nodiscard]] std::unique_ptr<platf::deinit_t> init() {
     platf_input = platf::input();
 
+    input_pool.start(1);
+    input_pool.push(thread_pool_util::lane_e::input, []() {
+      platf::adjust_thread_priority(platf::thread_priority_e::critical);
+      metrics::add_thread("input"sv);
+    });
+    for (auto &pool : gamepad_pools) {
+      pool.start(1);
+      pool.push(thread_pool_util::lane_e::input, []() {
+        platf::adjust_thread_priority(platf::thread_priority_e::critical);
+        metrics::add_thread("input_gamepad"sv);
+      });
+    }
+
     return std::make_unique<deinit_t>();
   }
 
@@ -1639,7 +2098,7 @@ namespace input {
     );
 
     // Workaround to ensure new frames will be captured when a client connects
-    task_pool.pushDelayed([]() {
+    input_pool.pushDelayed([]() {
       platf::move_mouse(platf_input, 1, 1);
       platf::move_mouse(platf_input, -1, -1);
     },
@@ -5,6 +5,8 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <chrono>
 #include <functional>
 
 // local includes
@@ -16,7 +18,7 @@ namespace input {
 
   void print(void *input);
   void reset(std::shared_ptr<input_t> &input);
-  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data);
+  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data, std::chrono::steady_clock::time_point received);
 
   [[nodiscard]] std::unique_ptr<platf::deinit_t> init();
 
@@ -45,4 +47,33 @@ namespace input {
    * @return The major and minor axis pair.
    */
   std::pair<float, float> scale_client_contact_area(const std::pair<float, float> &val, uint16_t rotation, const std::pair<float, float> &scalar);
+
+  /**
+   * @brief The contacts of a frame of touch or pen input.
+   * @details Each field has an array of its own, so transform_contacts() goes through all contacts at once
+   *          in loops the compiler can vectorize.
+   */
+  struct contact_batch_t {
+    static constexpr std::size_t MAX_CONTACTS = 16;
+
+    std::size_t count {};
+
+    // The coordinates and the contact area axes, from 0.0 to 65535.0 across the client's surface
+    std::array<float, MAX_CONTACTS> x;
+    std::array<float, MAX_CONTACTS> y;
+    std::array<float, MAX_CONTACTS> contact_area_major;
+    std::array<float, MAX_CONTACTS> contact_area_minor;
+
+    // Degrees (0..359) or LI_ROT_UNKNOWN
+    std::array<std::uint16_t, MAX_CONTACTS> rotation;
+  };
+
+  /**
+   * @brief Convert the contacts of a frame to the touch port.
+   * @details The coordinates become normalized 0.0-1.0 coordinates of the touch port, and the contact
+   *          area axes are scaled to its pixels, like scale_client_contact_area() does.
+   * @param touch_port The touch port.
+   * @param contacts The contacts to convert in place.
+   */
+  void transform_contacts(const touch_port_t &touch_port, contact_batch_t &contacts);
 }  // namespace input
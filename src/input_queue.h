@@ -0,0 +1,157 @@
+/**
+ * @file src/input_queue.h
+ * @brief Declarations for the queue of input messages between the control stream and the input thread.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace input {
+  /**
+   * @brief A queued input message.
+   * @details Messages are stored inline, so queueing one doesn't allocate.
+   *          The rare message that doesn't fit keeps its original buffer instead.
+   */
+  struct input_entry_t {
+    static constexpr std::size_t INLINE_SIZE = 128;
+
+    void assign(std::vector<std::uint8_t> &&input_data, std::chrono::steady_clock::time_point received_at) {
+      size = input_data.size();
+      batched = false;
+      received = received_at;
+      queued = std::chrono::steady_clock::now();
+
+      if (size <= INLINE_SIZE) {
+        std::copy_n(input_data.data(), size, inline_data.data());
+      } else {
+        overflow = std::move(input_data);
+      }
+    }
+
+    std::uint8_t *data() {
+      return size <= INLINE_SIZE ? inline_data.data() : overflow.data();
+    }
+
+    alignas(std::max_align_t) std::array<std::uint8_t, INLINE_SIZE> inline_data;
+    std::vector<std::uint8_t> overflow;
+    std::size_t size {};
+
+    // Set once the message has been batched into an earlier one
+    bool batched {};
+
+    // When the control stream received the message, and when it was done decrypting and queued it
+    std::chrono::steady_clock::time_point received;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  /**
+   * @brief A lock-free FIFO of input messages, for any number of producers and a single consumer.
+   * @details Each slot of the ring has a sequence number telling whether it's free or holds a message of the current
+   *          lap. Producers claim a slot by advancing the tail, and publish the message by advancing its sequence
+   *          number. The consumer owns every published message until it pops them, so it can batch messages
+   *          in place while producers keep queueing behind them. The capacity is rounded up to a power of two.
+   *          Since the ring doesn't grow, pushing to a full queue drops the new message.
+   */
+  class input_queue_t {
+  public:
+    explicit input_queue_t(std::size_t capacity = 1024):
+        _slots(std::bit_ceil(std::max<std::size_t>(capacity, 2))),
+        _mask {_slots.size() - 1} {
+      for (std::size_t x = 0; x < _slots.size(); ++x) {
+        _slots[x].sequence.store(x, std::memory_order_relaxed);
+      }
+    }
+
+    std::size_t capacity() const {
+      return _slots.size();
+    }
+
+    /**
+     * @brief Queue a message. This may be called by any thread.
+     * @param input_data The message.
+     * @param received When the control stream received the message.
+     * @return `false` if the message was dropped, because the queue is full.
+     */
+    bool push_back(std::vector<std::uint8_t> &&input_data, std::chrono::steady_clock::time_point received) {
+      auto pos = _tail.load(std::memory_order_relaxed);
+      while (true) {
+        auto &slot = _slots[pos & _mask];
+        auto diff = (std::int64_t) (slot.sequence.load(std::memory_order_acquire) - pos);
+
+        if (diff == 0) {
+          // The slot is free, claim it unless another producer was faster
+          if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            slot.entry.assign(std::move(input_data), received);
+            slot.sequence.store(pos + 1, std::memory_order_release);
+
+            return true;
+          }
+        } else if (diff < 0) {
+          // The consumer hasn't popped the message of the previous lap yet
+          return false;
+        } else {
+          pos = _tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /**
+     * @brief Get a published message by its position in the queue. This may only be called by the consumer.
+     * @param x The position of the message, where 0 is the front of the queue.
+     * @return The message, or `nullptr` if no message at this position or before it is published yet.
+     */
+    input_entry_t *peek(std::size_t x) {
+      if (x >= _slots.size()) {
+        return nullptr;
+      }
+
+      auto pos = _head + x;
+      auto &slot = _slots[pos & _mask];
+      if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return nullptr;
+      }
+
+      return &slot.entry;
+    }
+
+    /**
+     * @brief Check if the front message is published yet. This may only be called by the consumer.
+     */
+    bool empty() {
+      return !peek(0);
+    }
+
+    /**
+     * @brief Remove the front message, along with any batched messages behind it.
+     *        This may only be called by the consumer, with a message at the front.
+     */
+    void pop_front() {
+      do {
+        _slots[_head & _mask].sequence.store(_head + _slots.size(), std::memory_order_release);
+        ++_head;
+      } while (!empty() && peek(0)->batched);
+    }
+
+  private:
+    struct slot_t {
+      std::atomic<std::uint64_t> sequence;
+      input_entry_t entry;
+    };
+
+    std::vector<slot_t> _slots;
+    std::uint64_t _mask;
+
+    // Only the consumer moves the head, so it needn't be atomic
+    alignas(64) std::uint64_t _head {0};
+    alignas(64) std::atomic<std::uint64_t> _tail {0};
+  };
+}  // namespace input
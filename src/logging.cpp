@@ -3,9 +3,14 @@
  * @brief Definitions for logging related functions.
  */
 // standard includes
+#include <algorithm>
+#include <condition_variable>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
 
 // lib includes
 #include <boost/core/null_deleter.hpp>
@@ -36,6 +41,185 @@ namespace bl = boost::log;
 
 boost::shared_ptr<boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>> sink;
 
+namespace {
+  logging::line_ring_t recent;
+
+  /**
+   * @brief Splits what the sink writes into lines and keeps them in `recent`.
+   */
+  class line_ring_buf_t: public std::streambuf {
+  protected:
+    int_type overflow(int_type ch) override {
+      if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+      }
+
+      if (ch == '\n') {
+        recent.push(std::exchange(_line, {}));
+      } else {
+        _line.push_back(traits_type::to_char_type(ch));
+      }
+
+      return ch;
+    }
+
+    std::streamsize xsputn(const char_type *s, std::streamsize count) override {
+      for (std::streamsize x = 0; x < count; ++x) {
+        overflow(traits_type::to_int_type(s[x]));
+      }
+
+      return count;
+    }
+
+  private:
+    std::string _line;
+  };
+
+  using steady_clock = std::chrono::steady_clock;
+
+  // Enough for the events of a few seconds of a high frame rate stream on the busiest thread
+  constexpr std::size_t EVENT_RING_SIZE = 2048;
+
+  constexpr auto EVENT_FLUSH_INTERVAL = 250ms;
+
+  /**
+   * @brief A ring of events written by a single thread and read by the event thread.
+   * @details The writer only moves the head and the reader only moves the tail, so neither waits on the other.
+   */
+  class event_ring_t {
+  public:
+    struct event_t {
+      const char *format;
+      steady_clock::rep time;
+      std::size_t count;
+      std::array<std::int64_t, logging::MAX_EVENT_ARGS> args;
+    };
+
+    void push(const char *format, const std::array<std::int64_t, logging::MAX_EVENT_ARGS> &args, std::size_t count) {
+      auto head = _head.load(std::memory_order_relaxed);
+      if (head - _tail.load(std::memory_order_acquire) == EVENT_RING_SIZE) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+
+      _events[head % EVENT_RING_SIZE] = {format, steady_clock::now().time_since_epoch().count(), count, args};
+      _head.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Hand the pending events to `f`, only ever called by the event thread.
+     * @return The number of events dropped since the last call.
+     */
+    template<class F>
+    std::uint64_t drain(F &&f) {
+      auto head = _head.load(std::memory_order_acquire);
+      auto tail = _tail.load(std::memory_order_relaxed);
+      for (; tail < head; ++tail) {
+        f(_events[tail % EVENT_RING_SIZE]);
+      }
+      _tail.store(tail, std::memory_order_release);
+
+      return _dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<bool> retired {false};
+
+  private:
+    std::array<event_t, EVENT_RING_SIZE> _events;
+    std::atomic<std::uint64_t> _head {0};
+    std::atomic<std::uint64_t> _tail {0};
+    std::atomic<std::uint64_t> _dropped {0};
+  };
+
+  struct event_registry_t {
+    std::mutex lock;
+    std::vector<std::shared_ptr<event_ring_t>> rings;
+  };
+
+  event_registry_t &event_registry() {
+    // Never destroyed, since threads may still exit while static objects are torn down
+    static auto *registry = new event_registry_t;
+    return *registry;
+  }
+
+  /**
+   * @brief The event ring of the calling thread, which is retired when the thread exits.
+   */
+  struct thread_event_ring_t {
+    ~thread_event_ring_t() {
+      if (ring) {
+        ring->retired = true;
+      }
+    }
+
+    event_ring_t &get() {
+      if (!ring) {
+        ring = std::make_shared<event_ring_t>();
+
+        auto &reg = event_registry();
+        std::lock_guard lg {reg.lock};
+        reg.rings.emplace_back(ring);
+      }
+
+      return *ring;
+    }
+
+    std::shared_ptr<event_ring_t> ring;
+  };
+
+  thread_local thread_event_ring_t thread_event_ring;
+
+  /**
+   * @brief Logs the events of all threads.
+   */
+  void flush_events();
+
+  /**
+   * @brief Flushes the events every `EVENT_FLUSH_INTERVAL`, while verbose messages are logged.
+   */
+  class event_thread_t {
+  public:
+    void start() {
+      _stop = false;
+      _thread = std::thread {[this]() {
+        std::unique_lock ul {_lock};
+        while (!_cv.wait_for(ul, EVENT_FLUSH_INTERVAL, [this]() {
+          return _stop;
+        })) {
+          ul.unlock();
+          flush_events();
+          ul.lock();
+        }
+      }};
+    }
+
+    void stop() {
+      if (!_thread.joinable()) {
+        return;
+      }
+
+      {
+        std::lock_guard lg {_lock};
+        _stop = true;
+      }
+      _cv.notify_one();
+      _thread.join();
+
+      // Log what was left since the last flush
+      flush_events();
+    }
+
+  private:
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+
+    std::thread _thread;
+  };
+
+  event_thread_t event_thread;
+}  // namespace
+
 bl::sources::severity_logger<int> verbose(0);  // Dominating output
 bl::sources::severity_logger<int> debug(1);  // Follow what is happening
 bl::sources::severity_logger<int> info(2);  // Should be informed about
@@ -48,12 +232,56 @@ bl::sources::severity_logger<int> tests(10);  // Automatic tests output
 
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", int)
 
+namespace {
+  void flush_events() {
+    std::vector<std::shared_ptr<event_ring_t>> rings;
+    {
+      auto &reg = event_registry();
+      std::lock_guard lg {reg.lock};
+      rings = reg.rings;
+    }
+
+    auto steady_now = steady_clock::now();
+    auto system_now = std::chrono::system_clock::now();
+    for (auto &ring : rings) {
+      // Check first, since a ring is only retired after its last event
+      auto retired = ring->retired.load();
+
+      auto dropped = ring->drain([&](const event_ring_t::event_t &event) {
+        auto time = system_now - std::chrono::duration_cast<std::chrono::system_clock::duration>(steady_now - steady_clock::time_point {steady_clock::duration {event.time}});
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time - std::chrono::time_point_cast<std::chrono::seconds>(time));
+
+        auto t = std::chrono::system_clock::to_time_t(time);
+        auto lt = *std::localtime(&t);
+
+        std::ostringstream message;
+        message << "["sv << std::put_time(&lt, "%H:%M:%S.") << boost::format("%03u") % ms.count() << "] "sv
+                << logging::format_event(event.format, std::span {event.args.data(), event.count});
+        BOOST_LOG(verbose) << message.str();
+      });
+
+      if (dropped) {
+        BOOST_LOG(verbose) << "Dropped "sv << dropped << " events of a thread that logged them faster than they were flushed"sv;
+      }
+
+      if (retired) {
+        auto &reg = event_registry();
+        std::lock_guard lg {reg.lock};
+        std::erase(reg.rings, ring);
+      }
+    }
+  }
+}  // namespace
+
 namespace logging {
+  std::atomic<int> min_level {0};
+
   deinit_t::~deinit_t() {
     deinit();
   }
 
   void deinit() {
+    event_thread.stop();
     log_flush();
     bl::core::get()->remove_sink(sink);
     sink.reset();
@@ -146,6 +374,60 @@ namespace logging {
   };
 #endif
 
+  line_ring_t::line_ring_t(std::size_t capacity):
+      _capacity {capacity} {
+  }
+
+  void line_ring_t::push(std::string line) {
+    std::lock_guard lg {_lock};
+    if (_lines.size() == _capacity) {
+      _lines.pop_front();
+    }
+    _lines.emplace_back(std::move(line));
+    ++_next;
+  }
+
+  std::pair<std::uint64_t, std::vector<std::string>> line_ring_t::since(std::uint64_t first) {
+    std::lock_guard lg {_lock};
+
+    auto oldest = _next - _lines.size();
+    first = std::clamp(first, oldest, _next);
+
+    return {_next, {_lines.begin() + (first - oldest), _lines.end()}};
+  }
+
+  std::pair<std::uint64_t, std::vector<std::string>> recent_lines(std::uint64_t first) {
+    return recent.since(first);
+  }
+
+  std::string format_event(std::string_view format, std::span<const std::int64_t> args) {
+    std::string message;
+    message.reserve(format.size() + args.size() * 8);
+
+    auto next = std::begin(args);
+    while (true) {
+      auto pos = format.find("{}"sv);
+      if (pos == std::string_view::npos) {
+        break;
+      }
+
+      message.append(format.substr(0, pos));
+      if (next != std::end(args)) {
+        message.append(std::to_string(*next++));
+      } else {
+        message.append("{}"sv);
+      }
+      format.remove_prefix(pos + 2);
+    }
+    message.append(format);
+
+    return message;
+  }
+
+  void push_event(const char *format, const std::array<std::int64_t, MAX_EVENT_ARGS> &args, std::size_t count) {
+    thread_event_ring.get().push(format, args, count);
+  }
+
   [[nodiscard]] std::unique_ptr<deinit_t> init(int min_log_level, const std::string &log_file) {
     if (sink) {
       // Deinitialize the logging system before reinitializing it. This can probably only ever be hit in tests.
@@ -165,8 +447,13 @@ namespace logging {
 #endif
 
     sink->locked_backend()->add_stream(boost::make_shared<std::ofstream>(log_file));
+
+    // After the log file, so a line that's kept is already in the file
+    static line_ring_buf_t recent_buf;
+    sink->locked_backend()->add_stream(boost::make_shared<std::ostream>(&recent_buf));
     sink->set_filter(severity >= min_log_level);
     sink->set_formatter(&formatter);
+    min_level = min_log_level;
 
     // Flush after each log record to ensure log file contents on disk isn't stale.
     // This is particularly important when running from a Windows service.
@@ -178,6 +465,11 @@ namespace logging {
     auto android_sink = boost::make_shared<sinks::synchronous_sink<android_sink_backend>>();
     bl::core::get()->add_sink(android_sink);
 #endif
+
+    if (is_enabled(level::verbose)) {
+      event_thread.start();
+    }
+
     return std::make_unique<deinit_t>();
   }
 
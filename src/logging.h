@@ -4,6 +4,18 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
 // lib includes
 #include <boost/log/common.hpp>
 #include <boost/log/sinks.hpp>
@@ -21,12 +33,89 @@ extern boost::log::sources::severity_logger<int> tests;
 #endif
 
 #include "config.h"
+#include "metrics.h"
 #include "stat_trackers.h"
 
+#ifndef SUNSHINE_LOG_MIN_LEVEL
+  /**
+   * @brief The lowest log level of the `SUNSHINE_LOG()` statements and events that are compiled in.
+   */
+  #define SUNSHINE_LOG_MIN_LEVEL 0
+#endif
+
 /**
  * @brief Handles the initialization and deinitialization of the logging system.
  */
 namespace logging {
+  /**
+   * @brief The log levels, named like their loggers.
+   */
+  namespace level {
+    constexpr int verbose = 0;
+    constexpr int debug = 1;
+    constexpr int info = 2;
+    constexpr int warning = 3;
+    constexpr int error = 4;
+    constexpr int fatal = 5;
+#ifdef SUNSHINE_TESTS
+    constexpr int tests = 10;
+#endif
+  }  // namespace level
+
+  /**
+   * @brief The minimum log level that is output, cached from `init()`.
+   */
+  extern std::atomic<int> min_level;
+
+  /**
+   * @brief Check whether a log level is output, without going through Boost.Log.
+   * @param log_level The log level.
+   * @return `true` if records of this level are output.
+   */
+  inline bool is_enabled(int log_level) {
+    return log_level >= SUNSHINE_LOG_MIN_LEVEL && log_level >= min_level.load(std::memory_order_relaxed);
+  }
+
+  constexpr std::size_t MAX_EVENT_ARGS = 8;
+
+  /**
+   * @brief Format an event the way it is logged.
+   * @param format The format of the event, with `{}` where each argument goes.
+   * @param args The arguments.
+   * @return The message.
+   */
+  std::string format_event(std::string_view format, std::span<const std::int64_t> args);
+
+  /**
+   * @brief Keep an event for the logging thread, use `log_event()` instead.
+   * @param format The format of the event, which must outlive the logging system.
+   * @param args The arguments.
+   * @param count The number of arguments.
+   */
+  void push_event(const char *format, const std::array<std::int64_t, MAX_EVENT_ARGS> &args, std::size_t count);
+
+  /**
+   * @brief Log a verbose event of the hot path, such as a frame being sent, without formatting it there.
+   * @details The event goes to a ring of the calling thread, so logging it never allocates or waits on
+   *          another thread. A thread of the logging system formats the events and logs them a few times
+   *          a second, along with the time they happened at. If the ring of a thread fills up in between,
+   *          the new events are dropped, and how many were dropped is logged instead.
+   * @param format A string literal, with `{}` where each argument goes.
+   * @param args Up to `MAX_EVENT_ARGS` integers.
+   * @examples
+   * logging::log_event("Sent frame [{}] in {} shards", frame_index, shards);
+   * @examples_end
+   */
+  template<class... Args>
+  void log_event(const char *format, Args... args) {
+    static_assert(sizeof...(Args) <= MAX_EVENT_ARGS, "Too many arguments for an event");
+
+    if (!is_enabled(level::verbose)) {
+      return;
+    }
+
+    push_event(format, {(std::int64_t) args...}, sizeof...(Args));
+  }
   class deinit_t {
   public:
     /**
@@ -45,6 +134,49 @@ namespace logging {
 
   void formatter(const boost::log::record_view &view, boost::log::formatting_ostream &os);
 
+  /**
+   * @brief Keeps the last lines of the log, so the log can be followed without reading the log file again.
+   * @note This is thread-safe.
+   */
+  class line_ring_t {
+  public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 2000;
+
+    /**
+     * @param capacity The number of lines to keep.
+     */
+    explicit line_ring_t(std::size_t capacity = DEFAULT_CAPACITY);
+
+    /**
+     * @brief Keep a line, dropping the oldest one if the ring is full.
+     * @param line The line, without its line break.
+     */
+    void push(std::string line);
+
+    /**
+     * @brief Get the lines kept from a sequence number on.
+     * @param first The sequence number of the first line to get. Lines that were dropped are skipped.
+     * @return The sequence number the next line will get, and the lines.
+     */
+    std::pair<std::uint64_t, std::vector<std::string>> since(std::uint64_t first);
+
+  private:
+    std::mutex _lock;
+    std::deque<std::string> _lines;
+    std::size_t _capacity;
+    std::uint64_t _next = 0;  ///< The sequence number the next line will get
+  };
+
+  /**
+   * @brief Get the last lines that were logged, as they're written to the log file.
+   * @param first The sequence number of the first line to get.
+   * @return The sequence number the next line will get, and the lines.
+   * @examples
+   * auto [next, lines] = recent_lines(0);
+   * @examples_end
+   */
+  std::pair<std::uint64_t, std::vector<std::string>> recent_lines(std::uint64_t first);
+
   /**
    * @brief Initialize the logging system.
    * @param min_log_level The minimum log level to output.
@@ -106,7 +238,7 @@ namespace logging {
         message(message),
         units(units),
         interval(interval_in_seconds),
-        enabled(config::sunshine.min_log_level <= severity.default_severity()) {
+        enabled(logging::is_enabled(severity.default_severity())) {
     }
 
     void collect_and_log(const T &value) {
@@ -148,8 +280,86 @@ namespace logging {
     stat_trackers::min_max_avg_tracker<T> tracker;
   };
 
+  /**
+   * @brief A helper class for tracking and logging the percentiles of numerical values across a period of time
+   * @details Unlike `min_max_avg_periodic_logger`, this shows how often the outliers happen.
+   *          The percentiles can also be published to a metric, in which case they are tracked
+   *          even when the log level would hide them.
+   * @examples
+   * percentile_periodic_logger<double> logger(debug, "Test time value", "ms", 5s);
+   * logger.collect_and_log(1);
+   * // ...
+   * logger.collect_and_log(2);
+   * // after 5 seconds
+   * logger.collect_and_log(3);
+   * // In the log:
+   * // [2024:01:01:12:00:00]: Debug: Test time value (p50/p90/p99/p99.9/max): 1.00ms/2.00ms/2.00ms/2.00ms/2.00ms
+   * @examples_end
+   */
+  template<typename T>
+  class percentile_periodic_logger {
+  public:
+    percentile_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::string_view units, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20), metrics::summary_t *summary = nullptr):
+        severity(severity),
+        message(message),
+        units(units),
+        interval(interval_in_seconds),
+        enabled(logging::is_enabled(severity.default_severity())),
+        summary(summary),
+        // Keep floating point values apart down to a thousandth of their unit
+        tracker(std::is_floating_point_v<T> ? 0.001 : 1.0) {
+    }
+
+    void collect_and_log(const T &value) {
+      if (is_enabled()) {
+        auto print_info = [&](const stat_trackers::hdr_histogram_t &histogram) {
+          std::array<double, metrics::summary_t::QUANTILES.size()> quantiles;
+          for (std::size_t x = 0; x < quantiles.size(); ++x) {
+            quantiles[x] = histogram.percentile(metrics::summary_t::QUANTILES[x] * 100);
+          }
+
+          if (summary) {
+            summary->publish(quantiles, histogram.count(), histogram.total());
+          }
+
+          if (enabled) {
+            auto f = stat_trackers::two_digits_after_decimal();
+            BOOST_LOG(severity.get()) << message << " (p50/p90/p99/p99.9/max): " << f % quantiles[0] << units << "/" << f % quantiles[1] << units << "/" << f % quantiles[2] << units << "/" << f % quantiles[3] << units << "/" << f % histogram.max() << units;
+          }
+        };
+        tracker.collect_and_callback_on_interval(value, print_info, interval);
+      }
+    }
+
+    void collect_and_log(std::function<T()> func) {
+      if (is_enabled()) {
+        collect_and_log(func());
+      }
+    }
+
+    void reset() {
+      if (is_enabled()) {
+        tracker.reset();
+      }
+    }
+
+    bool is_enabled() const {
+      return enabled || summary;
+    }
+
+  private:
+    std::reference_wrapper<boost::log::sources::severity_logger<int>> severity;
+    std::string message;
+    std::string units;
+    std::chrono::seconds interval;
+    bool enabled;
+    metrics::summary_t *summary;
+    stat_trackers::percentile_tracker<T> tracker;
+  };
+
   /**
    * @brief A helper class for tracking and logging short time intervals across a period of time
+   * @tparam Logger The logger of the time intervals, in milliseconds.
    * @examples
    * time_delta_periodic_logger logger(debug, "Test duration", 5s);
    * logger.first_point_now();
@@ -163,10 +373,18 @@ namespace logging {
    * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg): 1.23ms/3.21ms/2.31ms
    * @examples_end
    */
-  class time_delta_periodic_logger {
+  template<typename Logger>
+  class basic_time_delta_periodic_logger {
   public:
-    time_delta_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20)):
-        logger(severity, message, "ms", interval_in_seconds) {
+    /**
+     * @param severity The severity to log at.
+     * @param message The message to log.
+     * @param interval_in_seconds The interval between logs.
+     * @param args Any further arguments of the logger.
+     */
+    template<typename... Args>
+    basic_time_delta_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20), Args &&...args):
+        logger(severity, message, "ms", interval_in_seconds, std::forward<Args>(args)...) {
     }
 
     void first_point(const std::chrono::steady_clock::time_point &point) {
@@ -204,10 +422,17 @@ namespace logging {
     }
 
   private:
-    std::chrono::steady_clock::time_point point1 = std::chrono::steady_clock::now();
-    min_max_avg_periodic_logger<double> logger;
+    std::chrono::steady_clock::time_point point1;
+    Logger logger;
   };
 
+  using time_delta_periodic_logger = basic_time_delta_periodic_logger<min_max_avg_periodic_logger<double>>;
+
+  /**
+   * @brief A helper class for tracking and logging the percentiles of short time intervals across a period of time
+   */
+  using time_delta_percentile_logger = basic_time_delta_periodic_logger<percentile_periodic_logger<double>>;
+
   /**
    * @brief Enclose string in square brackets.
    * @param input Input string.
@@ -223,3 +448,18 @@ namespace logging {
   std::wstring bracket(const std::wstring &input);
 
 }  // namespace logging
+
+/**
+ * @brief Log like `BOOST_LOG()`, for statements on the hot path.
+ * @details The level is checked against a cached copy of the minimum log level first, so a filtered
+ *          out statement costs a single load and its arguments aren't evaluated. Statements below
+ *          `SUNSHINE_LOG_MIN_LEVEL` compile to nothing.
+ * @param severity The logger, one of `verbose`, `debug`, `info`, `warning`, `error` or `fatal`.
+ * @examples
+ * SUNSHINE_LOG(verbose) << "Received "sv << size << " bytes"sv;
+ * @examples_end
+ */
+#define SUNSHINE_LOG(severity) \
+  if (!logging::is_enabled(logging::level::severity)) { \
+  } else \
+    BOOST_LOG(severity)
@@ -3,12 +3,20 @@
  * @brief Definitions for the main entry point for Sunshine.
  */
 // standard includes
+#include <algorithm>
+#include <chrono>
 #include <codecvt>
 #include <csignal>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <string_view>
+#include <vector>
 
 // local includes
+#include "audio_samples.h"
+#include "buffer_pool.h"
 #include "confighttp.h"
 #include "display_device.h"
 #include "entry_handler.h"
@@ -20,6 +28,7 @@
 #include "process.h"
 #include "system_tray.h"
 #include "upnp.h"
+#include "utility.h"
 #include "video.h"
 
 extern "C" {
@@ -94,6 +103,72 @@ constexpr bool tray_is_enabled = true;
 constexpr bool tray_is_enabled = false;
 #endif
 
+/**
+ * @brief Records when each step of the startup ran and how long it took, to log them once startup is done.
+ * @note This is thread-safe, so steps can run in the background.
+ */
+class startup_timeline_t {
+public:
+  /**
+   * @brief Run a step of the startup and record it.
+   * @param name The name of the step.
+   * @param fn The step.
+   * @return What the step returned.
+   */
+  template<class FN>
+  auto step(std::string_view name, FN &&fn) {
+    auto started = std::chrono::steady_clock::now();
+    auto fg = util::fail_guard([&]() {
+      record(name, started, std::chrono::steady_clock::now());
+    });
+
+    return fn();
+  }
+
+  /**
+   * @brief Record a point of the startup that takes no time.
+   * @param name The name of the point.
+   */
+  void mark(std::string_view name) {
+    auto now = std::chrono::steady_clock::now();
+    record(name, now, now);
+  }
+
+  /**
+   * @brief Log the steps in the order they started.
+   */
+  void log() {
+    std::lock_guard lg {_lock};
+    std::stable_sort(std::begin(_steps), std::end(_steps), [](const auto &a, const auto &b) {
+      return a.started < b.started;
+    });
+
+    auto to_ms = [](std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    };
+
+    for (const auto &step : _steps) {
+      BOOST_LOG(info) << "Startup: "sv << step.name << " at "sv << to_ms(step.started) << "ms, took "sv << to_ms(step.duration) << "ms"sv;
+    }
+  }
+
+private:
+  struct step_t {
+    std::string_view name;
+    std::chrono::steady_clock::duration started;  ///< Since the timeline was created
+    std::chrono::steady_clock::duration duration;
+  };
+
+  void record(std::string_view name, std::chrono::steady_clock::time_point started, std::chrono::steady_clock::time_point finished) {
+    std::lock_guard lg {_lock};
+    _steps.push_back({name, started - _start, finished - started});
+  }
+
+  std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+  std::mutex _lock;
+  std::vector<step_t> _steps;
+};
+
 void mainThreadLoop(const std::shared_ptr<safe::event_t<bool>> &shutdown_event) {
   bool run_loop = false;
 
@@ -116,6 +191,7 @@ void mainThreadLoop(const std::shared_ptr<safe::event_t<bool>> &shutdown_event)
 }
 
 int main(int argc, char *argv[]) {
+  startup_timeline_t timeline;
   lifetime::argv = argv;
 
   task_pool_util::TaskPool::task_id_t force_shutdown = nullptr;
@@ -176,10 +252,18 @@ int main(int argc, char *argv[]) {
     return fn->second(argv[0], config::sunshine.cmd.argc, config::sunshine.cmd.argv);
   }
 
+  // Before probing the encoders, which is the first time packet buffers are needed
+  timeline.step("buffer arena"sv, []() {
+    buffer_pool::init_arena((std::size_t) config::sunshine.buffer_arena_size << 20, config::sunshine.buffer_arena_lock);
+  });
+
   // Adding guard here first as it also performs recovery after crash,
   // otherwise people could theoretically end up without display output.
   // It also should be destroyed before forced shutdown to expedite the cleanup.
-  auto display_device_deinit_guard = display_device::init(platf::appdata() / "display_device.state", config::video);
+  // This stays ahead of the servers even with deferred startup, since a crash may have left the displays changed.
+  auto display_device_deinit_guard = timeline.step("display devices"sv, []() {
+    return display_device::init(platf::appdata() / "display_device.state", config::video);
+  });
   if (!display_device_deinit_guard) {
     BOOST_LOG(error) << "Display device session failed to initialize"sv;
   }
@@ -316,49 +400,74 @@ int main(int argc, char *argv[]) {
 
   proc::refresh(config::stream.file_apps);
 
+  // Missing credentials are generated in the background, while the encoders are probed
+  if (timeline.step("http"sv, http::init)) {
+    BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
+
+#ifdef _WIN32
+    BOOST_LOG(fatal) << "To relaunch Sunshine successfully, use the shortcut in the Start Menu. Do not run Sunshine.exe manually."sv;
+    std::this_thread::sleep_for(10s);
+#endif
+
+    return -1;
+  }
+
   // If any of the following fail, we log an error and continue event though sunshine will not function correctly.
   // This allows access to the UI to fix configuration problems or view the logs.
 
-  auto platf_deinit_guard = platf::init();
+  auto platf_deinit_guard = timeline.step("platform"sv, platf::init);
   if (!platf_deinit_guard) {
     BOOST_LOG(error) << "Platform failed to initialize"sv;
   }
 
-  auto proc_deinit_guard = proc::init();
+  auto proc_deinit_guard = timeline.step("proc"sv, proc::init);
   if (!proc_deinit_guard) {
     BOOST_LOG(error) << "Proc failed to initialize"sv;
   }
 
   reed_solomon_init();
-  auto input_deinit_guard = input::init();
-
-  if (input::probe_gamepads()) {
-    BOOST_LOG(warning) << "No gamepad input is available"sv;
-  }
-
-  if (video::probe_encoders()) {
-    BOOST_LOG(error) << "Video failed to find working encoder"sv;
-  }
+  BOOST_LOG(info) << "Using "sv << reed_solomon_variant_name() << " Reed-Solomon implementation"sv;
+  BOOST_LOG(info) << "Using "sv << audio::samples::variant_name() << " audio sample conversion"sv;
+  auto input_deinit_guard = timeline.step("input"sv, input::init);
+
+  // Audio control loads its sinks while the gamepads and encoders are probed
+  std::unique_ptr<platf::deinit_t> audio_deinit_guard;
+  auto probe_devices = [&timeline, &audio_deinit_guard]() {
+    auto sync_audio = std::async(std::launch::async, [&timeline]() {
+      return timeline.step("audio"sv, audio::init);
+    });
+
+    timeline.step("gamepads"sv, []() {
+      if (input::probe_gamepads()) {
+        BOOST_LOG(warning) << "No gamepad input is available"sv;
+      }
+    });
 
-  if (http::init()) {
-    BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
+    timeline.step("encoders"sv, []() {
+      if (video::probe_encoders()) {
+        BOOST_LOG(error) << "Video failed to find working encoder"sv;
+      }
+    });
 
-#ifdef _WIN32
-    BOOST_LOG(fatal) << "To relaunch Sunshine successfully, use the shortcut in the Start Menu. Do not run Sunshine.exe manually."sv;
-    std::this_thread::sleep_for(10s);
-#endif
+    audio_deinit_guard = sync_audio.get();
+  };
 
-    return -1;
+  // With deferred startup, the devices are probed once the servers are up. A stream launched before
+  // probing is done waits for the encoders, since launching probes them again anyway.
+  if (config::sunshine.deferred_startup) {
+    BOOST_LOG(info) << "Probing encoders, audio and gamepads after the servers start"sv;
+  } else {
+    probe_devices();
   }
 
   std::unique_ptr<platf::deinit_t> mDNS;
-  auto sync_mDNS = std::async(std::launch::async, [&mDNS]() {
-    mDNS = platf::publish::start();
+  auto sync_mDNS = std::async(std::launch::async, [&mDNS, &timeline]() {
+    mDNS = timeline.step("mDNS"sv, platf::publish::start);
   });
 
   std::unique_ptr<platf::deinit_t> upnp_unmap;
-  auto sync_upnp = std::async(std::launch::async, [&upnp_unmap]() {
-    upnp_unmap = upnp::start();
+  auto sync_upnp = std::async(std::launch::async, [&upnp_unmap, &timeline]() {
+    upnp_unmap = timeline.step("UPnP"sv, upnp::start);
   });
 
   // FIXME: Temporary workaround: Simple-Web_server needs to be updated or replaced
@@ -369,6 +478,17 @@ int main(int argc, char *argv[]) {
   std::thread httpThread {nvhttp::start};
   std::thread configThread {confighttp::start};
   std::thread rtspThread {rtsp_stream::start};
+  timeline.mark("servers started"sv);
+
+  auto sync_startup = std::async(std::launch::async, [&timeline, &probe_devices, &sync_mDNS, &sync_upnp]() {
+    if (config::sunshine.deferred_startup) {
+      probe_devices();
+    }
+
+    sync_mDNS.wait();
+    sync_upnp.wait();
+    timeline.log();
+  });
 
 #ifdef _WIN32
   // If we're using the default port and GameStream is enabled, warn the user
@@ -398,6 +518,9 @@ int main(int argc, char *argv[]) {
   configThread.join();
   rtspThread.join();
 
+  nvhttp::flush_state();
+  proc::flush_apps();
+
   task_pool.stop();
   task_pool.join();
 
@@ -0,0 +1,669 @@
+/**
+ * @file src/metrics.cpp
+ * @brief Definitions for the streaming metrics exposed to Prometheus.
+ */
+// standard includes
+#include <algorithm>
+#include <format>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+#include <utility>
+
+// local includes
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace metrics {
+  video_t video;
+  gpu_memory_t gpu_memory;
+  audio_t audio;
+  input_t input;
+  control_t control;
+  http_workers_t nvhttp_workers;
+  http_workers_t confighttp_workers;
+
+  namespace {
+    struct sessions_t {
+      std::mutex lock;
+      std::vector<std::weak_ptr<session_t>> sessions;
+    };
+
+    sessions_t &sessions() {
+      static sessions_t sessions;
+      return sessions;
+    }
+
+    struct thread_cpus_t {
+      std::mutex lock;
+      std::map<std::string, std::pair<std::string, std::size_t>, std::less<>> roles;
+    };
+
+    thread_cpus_t &thread_cpus() {
+      static thread_cpus_t thread_cpus;
+      return thread_cpus;
+    }
+
+    struct device_nodes_t {
+      std::mutex lock;
+      std::map<std::string, int, std::less<>> devices;
+    };
+
+    device_nodes_t &device_nodes() {
+      static device_nodes_t device_nodes;
+      return device_nodes;
+    }
+
+    /**
+     * @brief A streaming thread exposed by `add_thread()`.
+     */
+    struct thread_t {
+      std::string role;
+      int id;  ///< Tells the threads of a role apart, used as the `thread` label
+      std::unique_ptr<platf::thread_handle_t> handle;
+
+      gauge_t frame;  ///< The last video frame the thread worked on
+    };
+
+    struct threads_t {
+      std::mutex lock;
+      std::vector<std::weak_ptr<thread_t>> threads;
+      int next_id = 1;
+    };
+
+    threads_t &threads() {
+      static threads_t threads;
+      return threads;
+    }
+
+    // Keeps the calling thread exposed until it exits
+    thread_local std::shared_ptr<thread_t> this_thread;
+
+    void header(std::string &out, std::string_view name, std::string_view type, std::string_view help) {
+      std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+    }
+
+    void counter(std::string &out, std::string_view name, std::string_view help, const counter_t &counter) {
+      header(out, name, "counter", help);
+      std::format_to(std::back_inserter(out), "{} {}\n", name, counter.value());
+    }
+
+    void gauge(std::string &out, std::string_view name, std::string_view help, const gauge_t &gauge) {
+      header(out, name, "gauge", help);
+      std::format_to(std::back_inserter(out), "{} {}\n", name, gauge.value());
+    }
+
+    void summary(std::string &out, std::string_view name, std::string_view help, const summary_t &summary) {
+      header(out, name, "summary", help);
+      for (std::size_t x = 0; x < summary_t::QUANTILES.size(); ++x) {
+        std::format_to(std::back_inserter(out), "{}{{quantile=\"{}\"}} {}\n", name, summary_t::QUANTILES[x], summary.quantile(x));
+      }
+      std::format_to(std::back_inserter(out), "{}_sum {}\n{}_count {}\n", name, summary.sum(), name, summary.count());
+    }
+
+    /**
+     * @brief Write the samples of a histogram, after the header of its family.
+     * @param labels The labels of the histogram, like `type="mouse"`, or empty.
+     */
+    void histogram_samples(std::string &out, std::string_view name, std::string_view labels, const histogram_t &histogram) {
+      auto separator = labels.empty() ? ""sv : ","sv;
+
+      // Buckets are only read one at a time, so a concurrent observation may land in a bucket
+      // after it was read. The totals are read last, so they never fall behind the buckets.
+      std::uint64_t cumulative = 0;
+      for (std::size_t x = 0; x < histogram.bounds().size(); ++x) {
+        cumulative += histogram.bucket(x);
+        std::format_to(std::back_inserter(out), "{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, separator, histogram.bounds()[x], cumulative);
+      }
+      cumulative += histogram.bucket(histogram.bounds().size());
+
+      auto count = std::max(cumulative, histogram.count());
+      std::format_to(std::back_inserter(out), "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, separator, count);
+      if (labels.empty()) {
+        std::format_to(std::back_inserter(out), "{}_sum {}\n{}_count {}\n", name, histogram.sum(), name, count);
+      } else {
+        std::format_to(std::back_inserter(out), "{}_sum{{{}}} {}\n{}_count{{{}}} {}\n", name, labels, histogram.sum(), name, labels, count);
+      }
+    }
+
+    void histogram(std::string &out, std::string_view name, std::string_view help, const histogram_t &histogram) {
+      header(out, name, "histogram", help);
+      histogram_samples(out, name, {}, histogram);
+    }
+
+    /**
+     * @brief Write a histogram of each type of input messages, as one family with a `type` label.
+     * @param member The histogram of a type.
+     */
+    void input_histograms(std::string &out, std::string_view name, std::string_view help, histogram_t input_type_t::*member) {
+      header(out, name, "histogram", help);
+      for (std::size_t x = 0; x < input_t::TYPE_COUNT; ++x) {
+        histogram_samples(out, name, std::format("type=\"{}\"", input_t::TYPE_NAMES[x]), input.types[x].*member);
+      }
+    }
+  }  // namespace
+
+  histogram_t::histogram_t(std::initializer_list<double> bounds):
+      _bounds {bounds},
+      _buckets {std::make_unique<std::atomic<std::uint64_t>[]>(bounds.size() + 1)} {
+  }
+
+  void histogram_t::observe(double value) {
+    auto bucket = std::lower_bound(std::begin(_bounds), std::end(_bounds), value) - std::begin(_bounds);
+
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t histogram_t::bucket(std::size_t bucket) const {
+    return _buckets[bucket].load(std::memory_order_relaxed);
+  }
+
+  void summary_t::publish(const std::array<double, QUANTILES.size()> &quantiles, std::uint64_t count, double sum) {
+    for (std::size_t x = 0; x < quantiles.size(); ++x) {
+      _quantiles[x].store(quantiles[x] * _scale, std::memory_order_relaxed);
+    }
+    _sum.fetch_add(sum * _scale, std::memory_order_relaxed);
+    _count.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  std::vector<session_sampler_t::stats_t> session_sampler_t::sample(std::chrono::steady_clock::time_point now) {
+    std::vector<stats_t> stats;
+    std::map<std::uint32_t, reading_t> readings;
+
+    auto seconds = std::chrono::duration<double>(now - _last).count();
+    for (auto &session : live_sessions()) {
+      reading_t reading {
+        session->video_frames.value(),
+        session->video_bytes.value(),
+        session->video_fec_data_shards.value() + session->video_fec_parity_shards.value(),
+        session->video_packets_lost.value(),
+        session->video_frames_unrecovered.value(),
+        session->control_bytes.value(),
+        session->control_packets.value(),
+      };
+
+      // Without a previous reading, the deltas are zero
+      auto previous = reading;
+      if (auto it = _readings.find(session->id); it != std::end(_readings) && seconds > 0) {
+        previous = it->second;
+      }
+
+      auto shards = reading.shards - previous.shards;
+      auto packets_lost = reading.packets_lost - previous.packets_lost;
+
+      stats_t session_stats {};
+      session_stats.id = session->id;
+      if (seconds > 0) {
+        session_stats.fps = (reading.frames - previous.frames) / seconds;
+        session_stats.bitrate = (reading.bytes - previous.bytes) * 8 / seconds;
+        session_stats.control_bitrate = (reading.control_bytes - previous.control_bytes) * 8 / seconds;
+        session_stats.control_packets_per_second = (reading.control_packets - previous.control_packets) / seconds;
+      }
+      session_stats.target_bitrate = session->target_bitrate.value();
+      session_stats.psnr_db = session->video_psnr_db.value();
+      session_stats.ssim = session->video_ssim.value();
+      session_stats.packets_lost = packets_lost;
+      session_stats.loss_percentage = shards ? std::min(100.0, packets_lost * 100.0 / shards) : 0.0;
+      session_stats.frames_unrecovered = reading.frames_unrecovered - previous.frames_unrecovered;
+      session_stats.rtt_seconds = session->rtt_seconds.value();
+      session_stats.queueing_delay_seconds = session->queueing_delay_seconds.value();
+      session_stats.ping_jitter_seconds = session->ping_jitter_seconds.value();
+      stats.emplace_back(session_stats);
+
+      readings.emplace(session->id, reading);
+    }
+
+    // Sessions that ended are dropped with the readings of the previous sample
+    _readings = std::move(readings);
+    _last = now;
+
+    return stats;
+  }
+
+  gpu_allocation_t::gpu_allocation_t(gpu_memory_t::stage_e stage, std::int64_t bytes):
+      _stage {stage},
+      _bytes {bytes} {
+    gpu_memory.bytes[_stage].fetch_add(_bytes, std::memory_order_relaxed);
+  }
+
+  gpu_allocation_t::gpu_allocation_t(gpu_allocation_t &&other) noexcept:
+      _stage {other._stage},
+      _bytes {std::exchange(other._bytes, 0)} {
+  }
+
+  gpu_allocation_t &gpu_allocation_t::operator=(gpu_allocation_t &&other) noexcept {
+    std::swap(_stage, other._stage);
+    std::swap(_bytes, other._bytes);
+
+    return *this;
+  }
+
+  gpu_allocation_t::~gpu_allocation_t() {
+    if (_bytes) {
+      gpu_memory.bytes[_stage].fetch_sub(_bytes, std::memory_order_relaxed);
+    }
+  }
+
+  std::shared_ptr<session_t> add_session(std::uint32_t id) {
+    auto session = std::make_shared<session_t>(id);
+
+    auto &reg = sessions();
+    std::lock_guard lg {reg.lock};
+    std::erase_if(reg.sessions, [](auto &session) {
+      return session.expired();
+    });
+    reg.sessions.emplace_back(session);
+
+    return session;
+  }
+
+  std::vector<std::shared_ptr<session_t>> live_sessions() {
+    std::vector<std::shared_ptr<session_t>> live;
+
+    auto &reg = sessions();
+    std::lock_guard lg {reg.lock};
+    for (auto &session : reg.sessions) {
+      if (auto ptr = session.lock()) {
+        live.emplace_back(std::move(ptr));
+      }
+    }
+
+    return live;
+  }
+
+  void set_thread_cpus(std::string_view role, const std::string &cpus, std::size_t count) {
+    auto &reg = thread_cpus();
+    std::lock_guard lg {reg.lock};
+    reg.roles.insert_or_assign(std::string {role}, std::pair {cpus, count});
+  }
+
+  void set_device_node(std::string_view device, int node) {
+    auto &reg = device_nodes();
+    std::lock_guard lg {reg.lock};
+    reg.devices.insert_or_assign(std::string {device}, node);
+  }
+
+  void add_thread(std::string_view role) {
+    if (this_thread) {
+      return;
+    }
+
+    auto handle = platf::current_thread();
+    if (!handle) {
+      return;
+    }
+
+    auto &reg = threads();
+    std::lock_guard lg {reg.lock};
+    std::erase_if(reg.threads, [](auto &thread) {
+      return thread.expired();
+    });
+
+    auto thread = std::make_shared<thread_t>();
+    thread->role = role;
+    thread->id = reg.next_id++;
+    thread->handle = std::move(handle);
+    reg.threads.emplace_back(thread);
+
+    this_thread = std::move(thread);
+  }
+
+  void set_thread_frame(std::int64_t frame) {
+    if (this_thread) {
+      this_thread->frame.set((double) frame);
+    }
+  }
+
+  std::string expose() {
+    std::string out;
+
+    counter(out, "sunshine_video_frames_encoded_total", "Video frames encoded, including repeated frames.", video.frames_encoded);
+    counter(out, "sunshine_video_frames_duplicated_total", "Video frames encoded again without a newly captured image.", video.frames_duplicated);
+    header(out, "sunshine_video_frames_dropped_total", "counter", "Video frames dropped, captured images replaced by the next one before an encoder picked them up, or encoded frames that waited too long to be sent.");
+    std::format_to(std::back_inserter(out), "sunshine_video_frames_dropped_total{{reason=\"replaced\"}} {}\n", video.frames_dropped.value());
+    std::format_to(std::back_inserter(out), "sunshine_video_frames_dropped_total{{reason=\"stale\"}} {}\n", video.frames_dropped_stale.value());
+    counter(out, "sunshine_video_encoder_reinits_total", "Times the capture and encoders were reinitialized.", video.encoder_reinits);
+    counter(out, "sunshine_video_capture_reacquired_total", "Times the capture was lost and reacquired without reinitializing.", video.capture_reacquired);
+    counter(out, "sunshine_video_encoder_stalls_total", "Encode calls that ran past the watchdog timeout.", video.encoder_stalls);
+    counter(out, "sunshine_video_encoder_failovers_total", "Times a failed encoder was started again or replaced by another one.", video.encoder_failovers);
+    counter(out, "sunshine_video_fec_data_shards_total", "Video data shards sent.", video.fec_data_shards);
+    counter(out, "sunshine_video_fec_parity_shards_total", "Video parity shards sent.", video.fec_parity_shards);
+    counter(out, "sunshine_video_idle_periods_total", "Times the stream went idle, with no input or changed frame for the idle timeout.", video.idle_periods);
+    header(out, "sunshine_video_idle_seconds_total", "counter", "Time the stream spent idle, counted when it is active again.");
+    std::format_to(std::back_inserter(out), "sunshine_video_idle_seconds_total {}\n", video.idle_milliseconds.value() / 1000.0);
+    gauge(out, "sunshine_video_idle", "1 while the stream is idle and the capture only trickles frames.", video.idle);
+    histogram(out, "sunshine_video_send_batch_seconds", "Time taken by each batched send of video shards.", video.send_batch_seconds);
+    histogram(out, "sunshine_video_frame_processing_latency_seconds", "Time from the capture of a frame until it is sent.", video.frame_processing_latency_seconds);
+    histogram(out, "sunshine_video_capture_reinit_seconds", "Time taken to get the capture back after it was lost.", video.capture_reinit_seconds);
+    summary(out, "sunshine_video_frame_processing_latency_recent_seconds", "Time from the capture of a frame until it is sent, over the last logging interval.", video.frame_processing_latency_recent_seconds);
+    summary(out, "sunshine_video_frame_send_recent_seconds", "Time taken to send a frame, over the last logging interval.", video.frame_send_recent_seconds);
+    summary(out, "sunshine_video_encode_recent_seconds", "Time taken to encode a frame, over the last logging interval.", video.encode_recent_seconds);
+    summary(out, "sunshine_video_convert_recent_seconds", "Time taken to convert a captured frame for software encoding, over the last logging interval.", video.convert_recent_seconds);
+    summary(out, "sunshine_video_cross_adapter_copy_recent_seconds", "Time taken to copy a frame from the capture adapter to the encoder adapter, over the last logging interval.", video.cross_adapter_copy_recent_seconds);
+    summary(out, "sunshine_video_readback_wait_recent_seconds", "Time the capture waited for a frame to be copied to system memory for software encoding, over the last logging interval. Only reported on Windows.", video.readback_wait_recent_seconds);
+    summary(out, "sunshine_video_capture_latency_recent_seconds", "Time from the display composing a frame until it is delivered to the capture, over the last logging interval. Reported on macOS, and for the paced captures on Windows.", video.capture_latency_recent_seconds);
+    header(out, "sunshine_video_gpu_memory_bytes", "gauge", "GPU memory the video pipeline allocated itself, by the stage it's for. Memory allocated within the drivers and encoders isn't counted.");
+    for (std::size_t x = 0; x < gpu_memory_t::STAGE_COUNT; ++x) {
+      std::format_to(std::back_inserter(out), "sunshine_video_gpu_memory_bytes{{stage=\"{}\"}} {}\n", gpu_memory_t::STAGE_NAMES[x], gpu_memory.bytes[x].load(std::memory_order_relaxed));
+    }
+    summary(out, "sunshine_video_pacing_timer_error_recent_seconds", "Time the pacing timer overslept its deadline by, over the last logging interval.", video.pacing_timer_error_recent_seconds);
+    gauge(out, "sunshine_audio_capture_clock_drift_ppm", "How fast the audio capture device clock runs compared to the system clock, in parts per million.", audio.capture_clock_drift_ppm);
+    counter(out, "sunshine_audio_capture_timeouts_total", "Times the audio capture had no samples ready in time.", audio.capture_timeouts);
+    counter(out, "sunshine_audio_capture_underruns_total", "Audio frames captured more than twice their duration after the previous one.", audio.capture_underruns);
+    counter(out, "sunshine_audio_queue_overflows_total", "Audio frames dropped because the queue of an encoder was full.", audio.queue_overflows);
+    gauge(out, "sunshine_audio_queue_limit_frames", "The number of audio frames the queue of an encoder may hold.", audio.queue_limit_frames);
+    histogram(out, "sunshine_audio_capture_interval_seconds", "Time between two captured audio frames.", audio.capture_interval_seconds);
+    histogram(out, "sunshine_audio_queue_depth_frames", "Audio frames already queued for an encoder when the next one is handed to it.", audio.queue_depth_frames);
+    summary(out, "sunshine_audio_capture_to_send_recent_seconds", "Time from the capture of audio samples until their packet is sent, over the last logging interval.", audio.capture_to_send_recent_seconds);
+    summary(out, "sunshine_audio_capture_latency_recent_seconds", "Time from the system mixing audio samples until they are captured, over the last logging interval. Only reported by ScreenCaptureKit on macOS.", audio.capture_latency_recent_seconds);
+    summary(out, "sunshine_audio_encode_recent_seconds", "Time taken to encode an audio packet, over the last logging interval.", audio.encode_recent_seconds);
+    counter(out, "sunshine_input_events_total", "Input messages received from clients.", input.events);
+    counter(out, "sunshine_input_queue_overflows_total", "Input messages dropped because the OS fell so far behind that the input queue was full.", input.queue_overflows);
+    counter(out, "sunshine_input_mouse_moves_coalesced_total", "Relative mouse moves added to an earlier one waiting for the mouse move interval.", input.mouse_moves_coalesced);
+    header(out, "sunshine_input_gamepad_updates_total", "counter", "Gamepad states received from clients, sent to the virtual gamepads or suppressed because nothing changed.");
+    std::format_to(std::back_inserter(out), "sunshine_input_gamepad_updates_total{{result=\"forwarded\"}} {}\n", input.gamepad_updates_forwarded.value());
+    std::format_to(std::back_inserter(out), "sunshine_input_gamepad_updates_total{{result=\"suppressed\"}} {}\n", input.gamepad_updates_suppressed.value());
+    header(out, "sunshine_input_gamepad_motion_total", "counter", "Motion samples received from clients, sent to the virtual gamepads, suppressed because they repeated the last sample, or coalesced into a later sample.");
+    std::format_to(std::back_inserter(out), "sunshine_input_gamepad_motion_total{{result=\"forwarded\"}} {}\n", input.gamepad_motion_forwarded.value());
+    std::format_to(std::back_inserter(out), "sunshine_input_gamepad_motion_total{{result=\"suppressed\"}} {}\n", input.gamepad_motion_suppressed.value());
+    std::format_to(std::back_inserter(out), "sunshine_input_gamepad_motion_total{{result=\"coalesced\"}} {}\n", input.gamepad_motion_coalesced.value());
+    histogram(out, "sunshine_input_injection_latency_seconds", "Time from the control stream receiving an input message until it is injected into the OS.", input.injection_latency_seconds);
+    header(out, "sunshine_input_lane_injection_latency_seconds", "histogram", "Time from the control stream receiving an input message until it is injected, by the thread injecting it.");
+    for (std::size_t x = 0; x < input_t::LANE_COUNT; ++x) {
+      histogram_samples(out, "sunshine_input_lane_injection_latency_seconds", std::format("lane=\"{}\"", input_t::LANE_NAMES[x]), input.lanes[x].injection_latency_seconds);
+    }
+    input_histograms(out, "sunshine_input_queue_seconds", "Time input messages waited in the input queue.", &input_type_t::queue_seconds);
+    input_histograms(out, "sunshine_input_batched_messages", "Later input messages merged into a message before it was injected.", &input_type_t::batched_messages);
+    input_histograms(out, "sunshine_input_os_injection_seconds", "Time the OS took to take an input message.", &input_type_t::injection_seconds);
+    counter(out, "sunshine_control_messages_total", "Control stream messages received from clients.", control.messages);
+    summary(out, "sunshine_control_message_latency_recent_seconds", "Time from the control stream socket becoming readable until a message is handled, over the last logging interval.", control.message_latency_recent_seconds);
+    summary(out, "sunshine_control_outbound_latency_recent_seconds", "Time from a control stream message being queued until it is sent, over the last logging interval.", control.outbound_latency_recent_seconds);
+    counter(out, "sunshine_nvhttp_worker_rejected_total", "Requests to the GameStream server answered with 503 because too many were waiting for a worker.", nvhttp_workers.rejected);
+    histogram(out, "sunshine_nvhttp_worker_queue_seconds", "Time slow requests to the GameStream server waited for a worker.", nvhttp_workers.queue_seconds);
+    counter(out, "sunshine_confighttp_worker_rejected_total", "Requests to the Web UI server answered with 503 because too many were waiting for a worker.", confighttp_workers.rejected);
+    histogram(out, "sunshine_confighttp_worker_queue_seconds", "Time slow requests to the Web UI server waited for a worker.", confighttp_workers.queue_seconds);
+
+    {
+      auto stats = buffer_pool::packets().stats();
+
+      header(out, "sunshine_buffer_pool_allocations_total", "counter", "Packet buffers allocated because none was cached, from the arena or the heap.");
+      std::format_to(std::back_inserter(out), "sunshine_buffer_pool_allocations_total{{source=\"arena\"}} {}\n", stats.arena_allocations);
+      std::format_to(std::back_inserter(out), "sunshine_buffer_pool_allocations_total{{source=\"heap\"}} {}\n", stats.allocations);
+
+      header(out, "sunshine_buffer_pool_reuses_total", "counter", "Packet buffers handed out again from the cache.");
+      std::format_to(std::back_inserter(out), "sunshine_buffer_pool_reuses_total {}\n", stats.reuses);
+
+      header(out, "sunshine_buffer_arena_bytes", "gauge", "Size of the packet buffer arena, and how much of it packet buffers were carved from.");
+      std::format_to(std::back_inserter(out), "sunshine_buffer_arena_bytes{{state=\"reserved\"}} {}\n", stats.arena_bytes);
+      std::format_to(std::back_inserter(out), "sunshine_buffer_arena_bytes{{state=\"used\"}} {}\n", stats.arena_used_bytes);
+
+      auto faults = platf::page_faults();
+      header(out, "sunshine_page_faults_total", "counter", "Page faults of the process, the minor ones didn't have to read from disk.");
+      std::format_to(std::back_inserter(out), "sunshine_page_faults_total{{kind=\"minor\"}} {}\n", faults.minor);
+      std::format_to(std::back_inserter(out), "sunshine_page_faults_total{{kind=\"major\"}} {}\n", faults.major);
+    }
+
+    {
+      auto &reg = thread_cpus();
+      std::lock_guard lg {reg.lock};
+
+      header(out, "sunshine_thread_cpus", "gauge", "The number of CPUs the streaming threads of a role were last pinned to, listed in the cpus label.");
+      for (auto &[role, cpus] : reg.roles) {
+        std::format_to(std::back_inserter(out), "sunshine_thread_cpus{{role=\"{}\",cpus=\"{}\"}} {}\n", role, cpus.first, cpus.second);
+      }
+    }
+
+    {
+      auto &reg = device_nodes();
+      std::lock_guard lg {reg.lock};
+
+      header(out, "sunshine_device_numa_node", "gauge", "The NUMA node of a device the streaming threads are placed by, -1 if unknown.");
+      for (auto &[device, node] : reg.devices) {
+        std::format_to(std::back_inserter(out), "sunshine_device_numa_node{{device=\"{}\"}} {}\n", device, node);
+      }
+    }
+
+    {
+      std::vector<std::pair<std::shared_ptr<thread_t>, platf::thread_times_t>> samples;
+      {
+        auto &reg = threads();
+        std::lock_guard lg {reg.lock};
+        for (auto &thread : reg.threads) {
+          if (auto ptr = thread.lock()) {
+            samples.emplace_back(std::move(ptr), platf::thread_times_t {});
+          }
+        }
+      }
+
+      // Sample the threads outside of the lock, since that may read a few files each
+      std::erase_if(samples, [](auto &sample) {
+        auto times = sample.first->handle->times();
+        if (!times) {
+          return true;
+        }
+
+        sample.second = *times;
+        return false;
+      });
+
+      auto labels = [](const thread_t &thread) {
+        return std::format("role=\"{}\",thread=\"{}\"", thread.role, thread.id);
+      };
+
+      header(out, "sunshine_thread_cpu_seconds_total", "counter", "CPU time of each streaming thread, in user and kernel mode.");
+      for (auto &[thread, times] : samples) {
+        std::format_to(std::back_inserter(out), "sunshine_thread_cpu_seconds_total{{{}}} {}\n", labels(*thread), std::chrono::duration<double> {times.cpu_time}.count());
+      }
+
+      header(out, "sunshine_thread_cpu_cycles_total", "counter", "CPU cycles spent by each streaming thread. Only reported on Windows.");
+      for (auto &[thread, times] : samples) {
+        if (times.cycles) {
+          std::format_to(std::back_inserter(out), "sunshine_thread_cpu_cycles_total{{{}}} {}\n", labels(*thread), *times.cycles);
+        }
+      }
+
+      header(out, "sunshine_thread_run_delay_seconds_total", "counter", "Time each streaming thread was ready to run but waited for a CPU. Only reported on Linux.");
+      for (auto &[thread, times] : samples) {
+        if (times.run_delay) {
+          std::format_to(std::back_inserter(out), "sunshine_thread_run_delay_seconds_total{{{}}} {}\n", labels(*thread), std::chrono::duration<double> {*times.run_delay}.count());
+        }
+      }
+
+      header(out, "sunshine_thread_realtime_priority", "gauge", "The real-time priority of each streaming thread, 0 with the normal scheduling policy. Only reported on Linux.");
+      for (auto &[thread, times] : samples) {
+        if (times.realtime_priority) {
+          std::format_to(std::back_inserter(out), "sunshine_thread_realtime_priority{{{}}} {}\n", labels(*thread), *times.realtime_priority);
+        }
+      }
+
+      header(out, "sunshine_thread_context_switches_total", "counter", "Times each streaming thread gave up its CPU to wait, or was preempted. Only reported on Linux.");
+      for (auto &[thread, times] : samples) {
+        if (times.voluntary_switches) {
+          std::format_to(std::back_inserter(out), "sunshine_thread_context_switches_total{{{},kind=\"voluntary\"}} {}\n", labels(*thread), *times.voluntary_switches);
+        }
+        if (times.involuntary_switches) {
+          std::format_to(std::back_inserter(out), "sunshine_thread_context_switches_total{{{},kind=\"involuntary\"}} {}\n", labels(*thread), *times.involuntary_switches);
+        }
+      }
+
+      header(out, "sunshine_thread_frame", "gauge", "The last video frame each streaming thread worked on, to line the other samples up with the frame tracer.");
+      for (auto &[thread, times] : samples) {
+        std::format_to(std::back_inserter(out), "sunshine_thread_frame{{{}}} {}\n", labels(*thread), thread->frame.value());
+      }
+    }
+
+    auto live = live_sessions();
+
+    header(out, "sunshine_session_video_target_bitrate_bits", "gauge", "Video bitrate the encoder is asked for.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_target_bitrate_bits{{session=\"{}\"}} {}\n", session->id, session->target_bitrate.value());
+    }
+
+    header(out, "sunshine_session_video_bitrate_changes_total", "counter", "Times the video bitrate was adapted to the link.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_bitrate_changes_total{{session=\"{}\"}} {}\n", session->id, session->bitrate_changes.value());
+    }
+
+    header(out, "sunshine_session_video_psnr_db", "gauge", "Luma PSNR of the decoded video against the frames given to the encoder, over the recent samples.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_psnr_db{{session=\"{}\"}} {}\n", session->id, session->video_psnr_db.value());
+    }
+
+    header(out, "sunshine_session_video_ssim", "gauge", "Luma SSIM of the decoded video against the frames given to the encoder, over the recent samples.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_ssim{{session=\"{}\"}} {}\n", session->id, session->video_ssim.value());
+    }
+
+    header(out, "sunshine_session_video_sent_bytes_total", "counter", "Bytes of video shards sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_sent_bytes_total{{session=\"{}\"}} {}\n", session->id, session->video_bytes.value());
+    }
+
+    header(out, "sunshine_session_video_frames_sent_total", "counter", "Video frames sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_frames_sent_total{{session=\"{}\"}} {}\n", session->id, session->video_frames.value());
+    }
+
+    header(out, "sunshine_session_video_fec_percentage", "gauge", "FEC percentage currently sent with regular video frames.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_fec_percentage{{session=\"{}\"}} {}\n", session->id, session->video_fec_percentage.value());
+    }
+
+    header(out, "sunshine_session_video_fec_data_shards_total", "counter", "Video data shards sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_fec_data_shards_total{{session=\"{}\"}} {}\n", session->id, session->video_fec_data_shards.value());
+    }
+
+    header(out, "sunshine_session_video_fec_parity_shards_total", "counter", "Video parity shards sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_fec_parity_shards_total{{session=\"{}\"}} {}\n", session->id, session->video_fec_parity_shards.value());
+    }
+
+    header(out, "sunshine_session_video_packets_lost_total", "counter", "Video packets the client reported lost, including those recovered by FEC.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_packets_lost_total{{session=\"{}\"}} {}\n", session->id, session->video_packets_lost.value());
+    }
+
+    header(out, "sunshine_session_video_frames_unrecovered_total", "counter", "Video frames the client couldn't recover from FEC.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_frames_unrecovered_total{{session=\"{}\"}} {}\n", session->id, session->video_frames_unrecovered.value());
+    }
+
+    header(out, "sunshine_session_video_idr_frames_avoided_total", "counter", "Reference frame invalidations from the client that weren't passed on to the encoder, since a frame replacing the frames was already sent or on its way.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_idr_frames_avoided_total{{session=\"{}\"}} {}\n", session->id, session->video_idr_frames_avoided.value());
+    }
+
+    header(out, "sunshine_session_video_idr_requests_debounced_total", "counter", "IDR frame requests from the client that weren't passed on to the encoder, since an IDR frame was already sent or on its way.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_idr_requests_debounced_total{{session=\"{}\"}} {}\n", session->id, session->video_idr_requests_debounced.value());
+    }
+
+    header(out, "sunshine_session_video_recovery_frames_total", "counter", "IDR, reference frame invalidation and intra refresh frames sent to answer the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_recovery_frames_total{{session=\"{}\"}} {}\n", session->id, session->video_recovery_frames.value());
+    }
+
+    header(out, "sunshine_session_video_frames_skipped_total", "counter", "Video frames that weren't sent, since the client waited for a frame replacing them.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_frames_skipped_total{{session=\"{}\"}} {}\n", session->id, session->video_frames_skipped.value());
+    }
+
+    header(out, "sunshine_session_video_frames_dropped_stale_total", "counter", "Video frames that weren't sent, since they missed their send deadline while a newer frame was waiting.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_frames_dropped_stale_total{{session=\"{}\"}} {}\n", session->id, session->video_frames_dropped_stale.value());
+    }
+
+    header(out, "sunshine_session_video_nack_shards_requested_total", "counter", "Video shards the client asked to be sent again.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_nack_shards_requested_total{{session=\"{}\"}} {}\n", session->id, session->video_nack_shards_requested.value());
+    }
+
+    header(out, "sunshine_session_video_nack_shards_retransmitted_total", "counter", "Video shards sent again because the client asked for them.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_nack_shards_retransmitted_total{{session=\"{}\"}} {}\n", session->id, session->video_nack_shards_retransmitted.value());
+    }
+
+    header(out, "sunshine_session_video_encryption_seconds_total", "counter", "Time spent encrypting video shards for the client, summed across threads.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_encryption_seconds_total{{session=\"{}\"}} {}\n", session->id, session->video_encryption_nanoseconds.value() / 1e9);
+    }
+
+    header(out, "sunshine_session_audio_packets_sent_total", "counter", "Audio data packets sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_audio_packets_sent_total{{session=\"{}\"}} {}\n", session->id, session->audio_packets.value());
+    }
+
+    header(out, "sunshine_session_audio_fec_parity_shards_sent_total", "counter", "Audio parity shards sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_audio_fec_parity_shards_sent_total{{session=\"{}\"}} {}\n", session->id, session->audio_parity_shards_sent.value());
+    }
+
+    header(out, "sunshine_session_audio_fec_parity_shards", "gauge", "Parity shards currently sent with each audio FEC block.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_audio_fec_parity_shards{{session=\"{}\"}} {}\n", session->id, session->audio_parity_shards.value());
+    }
+
+    header(out, "sunshine_session_loss_reports_total", "counter", "Reports of lost packets or frames from the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_loss_reports_total{{session=\"{}\"}} {}\n", session->id, session->loss_reports.value());
+    }
+
+    header(out, "sunshine_session_gamepad_feedback_sent_total", "counter", "Gamepad feedback messages, like rumble, sent to the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_gamepad_feedback_sent_total{{session=\"{}\"}} {}\n", session->id, session->gamepad_feedback_sent.value());
+    }
+
+    header(out, "sunshine_session_gamepad_feedback_duplicates_total", "counter", "Gamepad feedback from games that wasn't sent, since it didn't change the state sent last.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_gamepad_feedback_duplicates_total{{session=\"{}\"}} {}\n", session->id, session->gamepad_feedback_duplicates.value());
+    }
+
+    header(out, "sunshine_session_gamepad_feedback_coalesced_total", "counter", "Gamepad feedback from games that was replaced by newer feedback before it was sent.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_gamepad_feedback_coalesced_total{{session=\"{}\"}} {}\n", session->id, session->gamepad_feedback_coalesced.value());
+    }
+
+    header(out, "sunshine_session_control_sent_bytes_total", "counter", "Bytes of control stream messages sent to the client, with their encryption header and tag.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_control_sent_bytes_total{{session=\"{}\"}} {}\n", session->id, session->control_bytes.value());
+    }
+
+    header(out, "sunshine_session_control_sent_packets_total", "counter", "Control stream packets sent to the client, one per message.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_control_sent_packets_total{{session=\"{}\"}} {}\n", session->id, session->control_packets.value());
+    }
+
+    header(out, "sunshine_session_rtt_seconds", "gauge", "Round trip time of the control stream.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_rtt_seconds{{session=\"{}\"}} {}\n", session->id, session->rtt_seconds.value());
+    }
+
+    header(out, "sunshine_session_queueing_delay_seconds", "gauge", "Round trip time above the lowest one seen, from queues along the path.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_queueing_delay_seconds{{session=\"{}\"}} {}\n", session->id, session->queueing_delay_seconds.value());
+    }
+
+    header(out, "sunshine_session_ping_jitter_seconds", "gauge", "Interarrival jitter of the video pings from the client.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_ping_jitter_seconds{{session=\"{}\"}} {}\n", session->id, session->ping_jitter_seconds.value());
+    }
+
+    header(out, "sunshine_session_path_mtu_bytes", "gauge", "The path MTU to the client when the video stream started, 0 if the system doesn't tell.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_path_mtu_bytes{{session=\"{}\"}} {}\n", session->id, session->path_mtu_bytes.value());
+    }
+
+    header(out, "sunshine_session_video_datagram_bytes", "gauge", "The size of the IP packets carrying video shards, with the IP and UDP headers.");
+    for (auto &session : live) {
+      std::format_to(std::back_inserter(out), "sunshine_session_video_datagram_bytes{{session=\"{}\"}} {}\n", session->id, session->video_datagram_bytes.value());
+    }
+
+    return out;
+  }
+}  // namespace metrics
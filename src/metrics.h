@@ -0,0 +1,444 @@
+/**
+ * @file src/metrics.h
+ * @brief Declarations for the streaming metrics exposed to Prometheus.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metrics {
+  /**
+   * @brief A value that only goes up.
+   */
+  class counter_t {
+  public:
+    void add(std::uint64_t n = 1) {
+      _value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t value() const {
+      return _value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::uint64_t> _value {0};
+  };
+
+  /**
+   * @brief A value that may go up and down.
+   */
+  class gauge_t {
+  public:
+    void set(double value) {
+      _value.store(value, std::memory_order_relaxed);
+    }
+
+    double value() const {
+      return _value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<double> _value {0.0};
+  };
+
+  /**
+   * @brief Counts observations into buckets of fixed upper bounds.
+   * @details The buckets are allocated once at construction, so observing a value
+   *          is a few relaxed atomic updates that never allocate or block.
+   */
+  class histogram_t {
+  public:
+    /**
+     * @param bounds The upper bounds of the buckets, in increasing order.
+     *               Values above the last bound go to an implicit `+Inf` bucket.
+     */
+    explicit histogram_t(std::initializer_list<double> bounds);
+
+    /**
+     * @brief Count a value.
+     * @param value The value.
+     */
+    void observe(double value);
+
+    const std::vector<double> &bounds() const {
+      return _bounds;
+    }
+
+    /**
+     * @brief Get the number of values in a bucket.
+     * @param bucket The index of the bucket, where `bounds().size()` is the `+Inf` bucket.
+     * @return The number of values above the previous bound and up to the bound of the bucket.
+     */
+    std::uint64_t bucket(std::size_t bucket) const;
+
+    std::uint64_t count() const {
+      return _count.load(std::memory_order_relaxed);
+    }
+
+    double sum() const {
+      return _sum.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<double> _bounds;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> _buckets;
+
+    std::atomic<std::uint64_t> _count {0};
+    std::atomic<double> _sum {0.0};
+  };
+
+  /**
+   * @brief Percentiles of a value over the last window, published by a periodic logger.
+   * @details The count and sum keep adding up across windows, as Prometheus expects of a summary.
+   */
+  class summary_t {
+  public:
+    static constexpr std::array<double, 4> QUANTILES {0.5, 0.9, 0.99, 0.999};
+
+    /**
+     * @param scale The factor from the unit of the published values to the unit of the metric.
+     */
+    explicit summary_t(double scale = 1.0):
+        _scale {scale} {
+    }
+
+    /**
+     * @brief Publish the values of a window.
+     * @param quantiles The values at each of `QUANTILES`.
+     * @param count The number of values in the window.
+     * @param sum The sum of the values in the window.
+     */
+    void publish(const std::array<double, QUANTILES.size()> &quantiles, std::uint64_t count, double sum);
+
+    double quantile(std::size_t quantile) const {
+      return _quantiles[quantile].load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const {
+      return _count.load(std::memory_order_relaxed);
+    }
+
+    double sum() const {
+      return _sum.load(std::memory_order_relaxed);
+    }
+
+  private:
+    double _scale;
+    std::array<std::atomic<double>, QUANTILES.size()> _quantiles {};
+    std::atomic<std::uint64_t> _count {0};
+    std::atomic<double> _sum {0.0};
+  };
+
+  struct video_t {
+    counter_t frames_encoded;  ///< Frames encoded, including repeated frames
+    counter_t frames_duplicated;  ///< Frames encoded again without a newly captured image
+    counter_t frames_dropped;  ///< Captured images replaced by the next one before an encoder picked them up
+    counter_t frames_dropped_stale;  ///< Encoded frames dropped because they waited too long to be sent
+    counter_t encoder_reinits;  ///< Times the capture and encoders were reinitialized
+    counter_t capture_reacquired;  ///< Times the capture was lost and reacquired without reinitializing
+    counter_t encoder_stalls;  ///< Encode calls that ran past the watchdog timeout
+    counter_t encoder_failovers;  ///< Times a failed encoder was started again or replaced by another one
+    counter_t fec_data_shards;  ///< Data shards sent
+    counter_t fec_parity_shards;  ///< Parity shards sent
+    counter_t idle_periods;  ///< Times the stream went idle, with no input or changed frame for the idle timeout
+    counter_t idle_milliseconds;  ///< Time spent idle, counted when the stream is active again
+    gauge_t idle;  ///< 1 while the stream is idle and the capture trickles frames
+
+    histogram_t send_batch_seconds {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025};
+    histogram_t frame_processing_latency_seconds {0.001, 0.002, 0.004, 0.008, 0.012, 0.016, 0.025, 0.033, 0.05, 0.1};
+    histogram_t capture_reinit_seconds {0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};  ///< Time to get the capture back, reacquired or reinitialized
+
+    // Published in milliseconds by the periodic loggers
+    summary_t frame_processing_latency_recent_seconds {0.001};
+    summary_t frame_send_recent_seconds {0.001};
+    summary_t encode_recent_seconds {0.001};
+    summary_t convert_recent_seconds {0.001};
+    summary_t cross_adapter_copy_recent_seconds {0.001};
+    summary_t readback_wait_recent_seconds {0.001};
+    summary_t capture_latency_recent_seconds {0.001};
+
+    // Published in microseconds by the pacing timer
+    summary_t pacing_timer_error_recent_seconds {0.000001};
+  };
+
+  /**
+   * @brief The GPU memory the video pipeline allocated itself, by the stage it's for.
+   * @details Memory the drivers and encoders allocate internally isn't counted.
+   */
+  struct gpu_memory_t {
+    enum stage_e : std::size_t {
+      capture,  ///< Captured images and the copies of the display they're taken from
+      convert,  ///< Textures the images are uploaded or copied to before they're converted
+      encode,  ///< Surfaces the images are converted into for the encoder
+      cursor,  ///< Textures of the cursor
+      STAGE_COUNT,
+    };
+
+    static constexpr std::array<std::string_view, STAGE_COUNT> STAGE_NAMES {"capture", "convert", "encode", "cursor"};
+
+    std::array<std::atomic<std::int64_t>, STAGE_COUNT> bytes {};
+  };
+
+  /**
+   * @brief Counts GPU memory of the video pipeline in `gpu_memory` for as long as it lives.
+   */
+  class gpu_allocation_t {
+  public:
+    gpu_allocation_t() = default;
+
+    /**
+     * @param stage The stage the memory is for.
+     * @param bytes The size of the memory.
+     */
+    gpu_allocation_t(gpu_memory_t::stage_e stage, std::int64_t bytes);
+
+    gpu_allocation_t(gpu_allocation_t &&other) noexcept;
+    gpu_allocation_t &operator=(gpu_allocation_t &&other) noexcept;
+
+    ~gpu_allocation_t();
+
+  private:
+    gpu_memory_t::stage_e _stage {};
+    std::int64_t _bytes {};
+  };
+
+  struct audio_t {
+    gauge_t capture_clock_drift_ppm;  ///< How fast the capture device clock runs compared to steady_clock, in parts per million
+    counter_t capture_timeouts;  ///< Times the capture had no samples ready in time
+    counter_t capture_underruns;  ///< Frames captured more than twice their duration after the previous one
+    counter_t queue_overflows;  ///< Frames dropped because the queue of an encoder was full
+    gauge_t queue_limit_frames;  ///< The number of frames the queue of the last fed encoder may hold
+
+    histogram_t capture_interval_seconds {0.0025, 0.005, 0.0075, 0.01, 0.015, 0.02, 0.03, 0.05, 0.1};
+    histogram_t queue_depth_frames {0, 1, 2, 4, 8, 16, 32};  ///< Frames already queued for an encoder when the next one is handed to it
+
+    // Published in milliseconds by the periodic loggers
+    summary_t capture_to_send_recent_seconds {0.001};
+    summary_t capture_latency_recent_seconds {0.001};
+    summary_t encode_recent_seconds {0.001};
+  };
+
+  /**
+   * @brief The metrics of one type of input messages, exposed with a `type` label.
+   */
+  struct input_type_t {
+    histogram_t queue_seconds {0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.05};  ///< Time a message waited in the input queue
+    histogram_t batched_messages {0, 1, 2, 4, 8, 16, 32, 64};  ///< Later messages merged into a message before it was injected
+    histogram_t injection_seconds {0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.05};  ///< Time the OS took to take a message
+  };
+
+  /**
+   * @brief The metrics of one thread injecting input, exposed with a `lane` label.
+   */
+  struct input_lane_t {
+    histogram_t injection_latency_seconds {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05};  ///< Time from receiving an input message until it was injected
+  };
+
+  struct input_t {
+    counter_t events;  ///< Input messages received from clients
+    counter_t queue_overflows;  ///< Input messages dropped because the input queue was full
+
+    counter_t mouse_moves_coalesced;  ///< Relative mouse moves added to an earlier one within the mouse move interval
+
+    counter_t gamepad_updates_forwarded;  ///< Gamepad states sent to the virtual gamepads
+    counter_t gamepad_updates_suppressed;  ///< Gamepad states dropped because they didn't change anything
+    counter_t gamepad_motion_forwarded;  ///< Motion samples sent to the virtual gamepads
+    counter_t gamepad_motion_suppressed;  ///< Motion samples dropped because they repeated the last one sent
+    counter_t gamepad_motion_coalesced;  ///< Motion samples replaced by a later one within the motion interval
+
+    histogram_t injection_latency_seconds {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05};  ///< Time from receiving an input message until it was injected
+
+    enum type_e : std::size_t {
+      mouse,
+      keyboard,
+      gamepad,
+      touch,
+      pen,
+      TYPE_COUNT,
+    };
+
+    static constexpr std::array<std::string_view, TYPE_COUNT> TYPE_NAMES {"mouse", "keyboard", "gamepad", "touch", "pen"};
+
+    std::array<input_type_t, TYPE_COUNT> types;
+
+    // The lane injecting the mouse, keyboard, touch and pen input, and the gamepad lanes of src/input.cpp
+    static constexpr std::size_t LANE_COUNT = 5;
+
+    static constexpr std::array<std::string_view, LANE_COUNT> LANE_NAMES {"desktop", "gamepad0", "gamepad1", "gamepad2", "gamepad3"};
+
+    std::array<input_lane_t, LANE_COUNT> lanes;
+  };
+
+  struct control_t {
+    counter_t messages;  ///< Control stream messages received from clients
+
+    // Published in milliseconds by the periodic loggers
+    summary_t message_latency_recent_seconds {0.001};
+    summary_t outbound_latency_recent_seconds {0.001};
+  };
+
+  /**
+   * @brief The metrics of the workers running the slow requests of an HTTP server.
+   */
+  struct http_workers_t {
+    counter_t rejected;  ///< Requests answered with 503 because too many were waiting for a worker
+
+    histogram_t queue_seconds {0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5};  ///< Time requests waited for a worker
+  };
+
+  /**
+   * @brief The metrics of a single streaming session.
+   */
+  struct session_t {
+    explicit session_t(std::uint32_t id):
+        id {id} {
+    }
+
+    const std::uint32_t id;
+
+    gauge_t target_bitrate;  ///< The video bitrate the encoder is asked for, in bits per second
+    counter_t bitrate_changes;  ///< Times the video bitrate was adapted to the link
+    counter_t video_bytes;  ///< Bytes of video shards sent
+    counter_t video_frames;  ///< Video frames sent
+    gauge_t video_fec_percentage;  ///< The FEC percentage of regular video frames
+    counter_t video_fec_data_shards;  ///< Video data shards sent
+    counter_t video_fec_parity_shards;  ///< Video parity shards sent
+    counter_t video_packets_lost;  ///< Video packets the client reported lost, whether FEC recovered them or not
+    counter_t video_frames_unrecovered;  ///< Video frames the client couldn't recover and asked to be replaced
+    counter_t video_idr_frames_avoided;  ///< Reference frame invalidations that weren't passed on, since a frame replacing the frames was already sent or on its way
+    counter_t video_idr_requests_debounced;  ///< IDR frame requests that weren't passed on, since one was already sent or on its way
+    counter_t video_recovery_frames;  ///< IDR, invalidation or intra refresh frames sent to answer the client
+    counter_t video_frames_skipped;  ///< Video frames skipped since the client waited for a frame replacing them
+    counter_t video_frames_dropped_stale;  ///< Video frames dropped since they missed their send deadline
+    counter_t video_nack_shards_requested;  ///< Video shards the client asked to be sent again
+    counter_t video_nack_shards_retransmitted;  ///< Video shards sent again, the rest were too old
+    counter_t video_encryption_nanoseconds;  ///< Time spent encrypting video shards, on any thread
+    counter_t audio_packets;  ///< Audio data packets sent
+    counter_t audio_parity_shards_sent;  ///< Audio parity shards sent
+    gauge_t audio_parity_shards;  ///< The number of parity shards sent with each audio FEC block
+    counter_t loss_reports;  ///< Reports of lost packets or frames from the client
+    counter_t gamepad_feedback_sent;  ///< Gamepad feedback messages sent, like rumble
+    counter_t gamepad_feedback_duplicates;  ///< Gamepad feedback dropped since it didn't change the state sent last
+    counter_t gamepad_feedback_coalesced;  ///< Gamepad feedback replaced by newer feedback before it was sent
+    counter_t control_bytes;  ///< Bytes of control stream messages sent, with their encryption header and tag
+    counter_t control_packets;  ///< Control stream packets sent, one per message
+    gauge_t rtt_seconds;  ///< The control stream round trip time
+    gauge_t queueing_delay_seconds;  ///< How far the round trip time is above the lowest one seen
+    gauge_t ping_jitter_seconds;  ///< The jitter of the pings from the client, as received by the kernel
+    gauge_t path_mtu_bytes;  ///< The path MTU to the client when the video stream started, 0 if the system doesn't tell
+    gauge_t video_datagram_bytes;  ///< The size of the IP packets carrying video shards, with the IP and UDP headers
+    gauge_t video_psnr_db;  ///< The luma PSNR of the decoded video against its source, 0 without quality sampling
+    gauge_t video_ssim;  ///< The luma SSIM of the decoded video against its source, 0 without quality sampling
+  };
+
+  /**
+   * @brief Turns the counters of the live sessions into rates over the time between two samples.
+   * @details Only the counters are read, so sampling never blocks the threads that update them.
+   */
+  class session_sampler_t {
+  public:
+    struct stats_t {
+      std::uint32_t id;
+      double fps;  ///< Video frames sent per second
+      double bitrate;  ///< Bits of video sent per second
+      double target_bitrate;  ///< The video bitrate the encoder is asked for, in bits per second
+      std::uint64_t packets_lost;  ///< Video packets the client reported lost since the previous sample
+      double loss_percentage;  ///< Video packets lost out of the video shards sent since the previous sample
+      std::uint64_t frames_unrecovered;  ///< Video frames the client couldn't recover since the previous sample
+      double rtt_seconds;  ///< The control stream round trip time
+      double queueing_delay_seconds;  ///< How far the round trip time is above the lowest one seen
+      double ping_jitter_seconds;  ///< The jitter of the pings from the client
+      double control_bitrate;  ///< Bits of control stream messages sent per second
+      double control_packets_per_second;  ///< Control stream packets sent per second
+      double psnr_db;  ///< The luma PSNR of the decoded video, 0 without quality sampling
+      double ssim;  ///< The luma SSIM of the decoded video, 0 without quality sampling
+    };
+
+    /**
+     * @brief Sample the live sessions.
+     * @param now The time of the sample.
+     * @return The stats of each live session. The rates of a session sampled for the first time are zero.
+     */
+    std::vector<stats_t> sample(std::chrono::steady_clock::time_point now);
+
+  private:
+    struct reading_t {
+      std::uint64_t frames;
+      std::uint64_t bytes;
+      std::uint64_t shards;
+      std::uint64_t packets_lost;
+      std::uint64_t frames_unrecovered;
+      std::uint64_t control_bytes;
+      std::uint64_t control_packets;
+    };
+
+    std::chrono::steady_clock::time_point _last;
+    std::map<std::uint32_t, reading_t> _readings;
+  };
+
+  extern video_t video;
+  extern gpu_memory_t gpu_memory;
+  extern audio_t audio;
+  extern input_t input;
+  extern control_t control;
+  extern http_workers_t nvhttp_workers;
+  extern http_workers_t confighttp_workers;
+
+  /**
+   * @brief Start exposing the metrics of a session.
+   * @param id The launch session ID, used as the `session` label.
+   * @return The metrics of the session, which are exposed until they are destroyed.
+   */
+  std::shared_ptr<session_t> add_session(std::uint32_t id);
+
+  /**
+   * @brief Get the metrics of the sessions still exposed.
+   * @return The metrics of each session, in the order they were added.
+   */
+  std::vector<std::shared_ptr<session_t>> live_sessions();
+
+  /**
+   * @brief Record the CPUs the threads of a role were last pinned to.
+   * @param role The role of the threads, used as the `role` label.
+   * @param cpus The CPUs as a list of ranges, used as the `cpus` label.
+   * @param count The number of CPUs.
+   */
+  void set_thread_cpus(std::string_view role, const std::string &cpus, std::size_t count);
+
+  /**
+   * @brief Record the NUMA node of a device the streaming threads are placed by.
+   * @param device The device, used as the `device` label.
+   * @param node The node, -1 if it's unknown.
+   */
+  void set_device_node(std::string_view device, int node);
+
+  /**
+   * @brief Start exposing the CPU time and scheduling of the calling thread, until it exits.
+   * @details The thread is sampled from the system whenever the metrics are exposed, so this costs the thread nothing.
+   *          Nothing is done if the threads of this system can't be sampled, or if the thread was already added.
+   * @param role The role of the thread, used as the `role` label.
+   */
+  void add_thread(std::string_view role);
+
+  /**
+   * @brief Record the video frame the calling thread works on, to line its samples up with the frame tracer.
+   * @param frame The index of the frame.
+   */
+  void set_thread_frame(std::int64_t frame);
+
+  /**
+   * @brief Get every metric.
+   * @return The metrics in the Prometheus text exposition format.
+   */
+  std::string expose();
+}  // namespace metrics
@@ -6,7 +6,11 @@
 #include "nvenc_base.h"
 
 // standard includes
+#include <algorithm>
+#include <chrono>
 #include <format>
+#include <thread>
+#include <vector>
 
 // local includes
 #include "src/config.h"
@@ -56,6 +60,44 @@ namespace {
     }
   };
 
+  std::string nvenc_status_string(NVENCSTATUS status) {
+    switch (status) {
+#define nvenc_status_case(x) \
+  case x: \
+    return #x;
+      nvenc_status_case(NV_ENC_SUCCESS);
+      nvenc_status_case(NV_ENC_ERR_NO_ENCODE_DEVICE);
+      nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_DEVICE);
+      nvenc_status_case(NV_ENC_ERR_INVALID_ENCODERDEVICE);
+      nvenc_status_case(NV_ENC_ERR_INVALID_DEVICE);
+      nvenc_status_case(NV_ENC_ERR_DEVICE_NOT_EXIST);
+      nvenc_status_case(NV_ENC_ERR_INVALID_PTR);
+      nvenc_status_case(NV_ENC_ERR_INVALID_EVENT);
+      nvenc_status_case(NV_ENC_ERR_INVALID_PARAM);
+      nvenc_status_case(NV_ENC_ERR_INVALID_CALL);
+      nvenc_status_case(NV_ENC_ERR_OUT_OF_MEMORY);
+      nvenc_status_case(NV_ENC_ERR_ENCODER_NOT_INITIALIZED);
+      nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_PARAM);
+      nvenc_status_case(NV_ENC_ERR_LOCK_BUSY);
+      nvenc_status_case(NV_ENC_ERR_NOT_ENOUGH_BUFFER);
+      nvenc_status_case(NV_ENC_ERR_INVALID_VERSION);
+      nvenc_status_case(NV_ENC_ERR_MAP_FAILED);
+      nvenc_status_case(NV_ENC_ERR_NEED_MORE_INPUT);
+      nvenc_status_case(NV_ENC_ERR_ENCODER_BUSY);
+      nvenc_status_case(NV_ENC_ERR_EVENT_NOT_REGISTERD);
+      nvenc_status_case(NV_ENC_ERR_GENERIC);
+      nvenc_status_case(NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY);
+      nvenc_status_case(NV_ENC_ERR_UNIMPLEMENTED);
+      nvenc_status_case(NV_ENC_ERR_RESOURCE_REGISTER_FAILED);
+      nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_REGISTERED);
+      nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_MAPPED);
+      // Newer versions of sdk may add more constants, look for them at the end of NVENCSTATUS enum
+#undef nvenc_status_case
+      default:
+        return std::to_string(status);
+    }
+  }
+
   bool equal_guids(const GUID &guid1, const GUID &guid2) {
     return std::memcmp(&guid1, &guid2, sizeof(GUID)) == 0;
   }
@@ -212,13 +254,38 @@ namespace nvenc {
     }
 
     encoder_params.rfi = get_encoder_cap(NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION);
+    encoder_params.dynamic_bitrate = get_encoder_cap(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE);
+
+    // Sub-frame readback polls the output bitstream, which requires synchronous encoding.
+    // AV1 frames are split into tiles rather than slices, and AV1 decoders don't tolerate the
+    // zero padding of the last packet, which can't be trimmed before the frame size is known.
+    bool subframe_output = config.subframe_output && client_config.videoFormat <= 1;
+
+    // Frames in flight are read back in submission order by a thread blocking on their bitstreams,
+    // which is how synchronous mode pipelines without an event per frame
+    int pipeline_depth = subframe_output ? 1 : config.pipeline_depth;
+    encoder_params.async = async_event_handle && !subframe_output && pipeline_depth <= 1;
+    encoder_params.slices = subframe_output ? std::max(client_config.slicesPerFrame, 4) : client_config.slicesPerFrame;
+    encoder_params.frame_parts = subframe_output ? std::min<int>(encoder_params.slices, 4) : 1;
 
     init_params.presetGUID = quality_preset_guid_from_number(config.quality_preset);
     init_params.tuningInfo = NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY;
     init_params.enablePTD = 1;
-    init_params.enableEncodeAsync = async_event_handle ? 1 : 0;
+    init_params.enableEncodeAsync = encoder_params.async ? 1 : 0;
+    init_params.reportSliceOffsets = subframe_output ? 1 : 0;
+    init_params.enableSubFrameWrite = subframe_output ? 1 : 0;
     init_params.enableWeightedPrediction = config.weighted_prediction && get_encoder_cap(NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION);
 
+    // The driver splits HEVC and AV1 frames into strips encoded at once by each NVENC engine, and puts them back into one frame.
+    // H.264 frames are never split, and sub-frame readback wants the slices of a single engine.
+    if (config.split_frame_encoding == nvenc_split_frame_encoding::disabled || subframe_output) {
+      init_params.splitEncodeMode = NV_ENC_SPLIT_DISABLE_MODE;
+    } else if (config.split_frame_encoding == nvenc_split_frame_encoding::force_enabled) {
+      init_params.splitEncodeMode = NV_ENC_SPLIT_AUTO_FORCED_MODE;
+    } else {
+      init_params.splitEncodeMode = NV_ENC_SPLIT_AUTO_MODE;
+    }
+
     init_params.encodeWidth = encoder_params.width;
     init_params.darWidth = encoder_params.width;
     init_params.encodeHeight = encoder_params.height;
@@ -263,7 +330,7 @@ namespace nvenc {
       format_config.repeatSPSPPS = 1;
       format_config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
       format_config.sliceMode = 3;
-      format_config.sliceModeData = client_config.slicesPerFrame;
+      format_config.sliceModeData = encoder_params.slices;
       if (buffer_is_yuv444()) {
         format_config.chromaFormatIDC = 3;
       }
@@ -285,6 +352,55 @@ namespace nvenc {
       L0_option = NV_ENC_NUM_REF_FRAMES_1;
     };
 
+    // One slot holds the last long-term reference the client received, the other the next one,
+    // and at least one short-term reference is left for the frames in between
+    auto set_ltr_if_enabled = [&](auto &format_config) {
+      constexpr uint32_t ltr_frames = std::tuple_size_v<decltype(encoder_state.ltr_slots)>;
+      if (!config.ltr_recovery) {
+        return;
+      }
+      if (get_encoder_cap(NV_ENC_CAPS_NUM_MAX_LTR_FRAMES) < (int) ltr_frames) {
+        BOOST_LOG(warning) << "NvEnc: gpu doesn't support enough long-term reference frames for recovery";
+        return;
+      }
+      if (encoder_params.ref_frames_in_dpb <= ltr_frames) {
+        BOOST_LOG(warning) << "NvEnc: client reference frame buffer is too small for long-term reference recovery";
+        return;
+      }
+      format_config.enableLTR = 1;
+      format_config.ltrNumFrames = ltr_frames;
+      format_config.ltrTrustMode = 0;
+      encoder_params.ltr_frames = ltr_frames;
+    };
+
+    // The picture is refreshed over the period, over and over, with no IDR frame after the first one
+    auto set_intra_refresh = [&](auto &format_config, uint32_t period) {
+      if (!get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+        return false;
+      }
+      format_config.enableIntraRefresh = 1;
+      format_config.intraRefreshPeriod = period;
+      format_config.intraRefreshCnt = std::max<uint32_t>(period - 1, 1);
+      if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
+        format_config.singleSliceIntraRefresh = 1;
+      } else {
+        BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
+      }
+      return true;
+    };
+
+    auto set_intra_refresh_if_enabled = [&](auto &format_config) {
+      if (config.intra_refresh_frames <= 0) {
+        return false;
+      }
+      if (!set_intra_refresh(format_config, config.intra_refresh_frames)) {
+        BOOST_LOG(warning) << "NvEnc: gpu doesn't support intra refresh, sending IDR frames";
+        return false;
+      }
+      encoder_params.intra_refresh_frames = config.intra_refresh_frames;
+      return true;
+    };
+
     auto set_minqp_if_enabled = [&](int value) {
       if (config.enable_min_qp) {
         enc_config.rcParams.enableMinQP = 1;
@@ -319,8 +435,14 @@ namespace nvenc {
             format_config.entropyCodingMode = NV_ENC_H264_ENTROPY_CODING_MODE_CABAC;
           }
           set_ref_frames(format_config.maxNumRefFrames, format_config.numRefL0, 5);
+          set_ltr_if_enabled(format_config);
+          set_intra_refresh_if_enabled(format_config);
           set_minqp_if_enabled(config.min_qp_h264);
           fill_h264_hevc_vui(format_config.h264VUIParameters);
+          if (config.qp_delta_map) {
+            // The map holds a value per macroblock
+            encoder_params.qp_map_block_size = 16;
+          }
           break;
         }
 
@@ -333,22 +455,19 @@ namespace nvenc {
             format_config.pixelBitDepthMinus8 = 2;
           }
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numRefL0, 5);
+          set_ltr_if_enabled(format_config);
           set_minqp_if_enabled(config.min_qp_hevc);
           fill_h264_hevc_vui(format_config.hevcVUIParameters);
-          if (client_config.enableIntraRefresh == 1) {
-            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
-              format_config.enableIntraRefresh = 1;
-              format_config.intraRefreshPeriod = 300;
-              format_config.intraRefreshCnt = 299;
-              if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
-                format_config.singleSliceIntraRefresh = 1;
-              } else {
-                BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
-              }
-            } else {
+          if (!set_intra_refresh_if_enabled(format_config) && client_config.enableIntraRefresh == 1) {
+            if (!set_intra_refresh(format_config, 300)) {
               BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
             }
           }
+          if (config.qp_delta_map) {
+            // The map holds a value per CTB, so its size is pinned rather than left to the encoder
+            format_config.maxCUSize = NV_ENC_HEVC_CUSIZE_32x32;
+            encoder_params.qp_map_block_size = 32;
+          }
           break;
         }
 
@@ -384,14 +503,24 @@ namespace nvenc {
         }
     }
 
+    if (encoder_params.qp_map_block_size) {
+      enc_config.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+    }
+
     init_params.encodeConfig = &enc_config;
 
+    // Marking a new long-term reference twice a second keeps recovery frames predicting from a recent picture
+    encoder_params.ltr_interval = std::max<uint64_t>(init_params.frameRateNum / init_params.frameRateDen / 2, 1);
+
     if (nvenc_failed(nvenc->nvEncInitializeEncoder(encoder, &init_params))) {
       BOOST_LOG(error) << "NvEnc: NvEncInitializeEncoder() failed: " << last_nvenc_error_string;
       return false;
     }
 
-    if (async_event_handle) {
+    initialized_params = init_params;
+    initialized_config = enc_config;
+
+    if (encoder_params.async) {
       NV_ENC_EVENT_PARAMS event_params = {min_struct_version(NV_ENC_EVENT_PARAMS_VER)};
       event_params.completionEvent = async_event_handle;
       if (nvenc_failed(nvenc->nvEncRegisterAsyncEvent(encoder, &event_params))) {
@@ -411,6 +540,10 @@ namespace nvenc {
       return false;
     }
 
+    if (pipeline_depth > 1 && !create_pipeline(pipeline_depth)) {
+      return false;
+    }
+
     {
       auto f = stat_trackers::two_digits_after_decimal();
       BOOST_LOG(debug) << "NvEnc: requested encoded frame size " << f % (client_config.bitrate / 8. / client_config.framerate) << " kB";
@@ -425,6 +558,12 @@ namespace nvenc {
       if (init_params.enableEncodeAsync) {
         extra += " async";
       }
+      if (init_params.enableSubFrameWrite) {
+        extra += std::format(" sub-frame={}", encoder_params.frame_parts);
+      }
+      if (is_pipelined()) {
+        extra += std::format(" pipeline={}", pipeline.slots.size());
+      }
       if (buffer_is_yuv444()) {
         extra += " yuv444";
       }
@@ -434,12 +573,21 @@ namespace nvenc {
       if (enc_config.rcParams.multiPass != NV_ENC_MULTI_PASS_DISABLED) {
         extra += " two-pass";
       }
+      if (init_params.splitEncodeMode == NV_ENC_SPLIT_AUTO_FORCED_MODE && client_config.videoFormat >= 1) {
+        extra += " split-frame";
+      }
       if (config.vbv_percentage_increase > 0 && get_encoder_cap(NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE)) {
         extra += std::format(" vbv+{}", config.vbv_percentage_increase);
       }
       if (encoder_params.rfi) {
         extra += " rfi";
       }
+      if (encoder_params.ltr_frames) {
+        extra += " ltr-recovery";
+      }
+      if (encoder_params.intra_refresh_frames) {
+        extra += std::format(" intra-refresh={}", encoder_params.intra_refresh_frames);
+      }
       if (init_params.enableWeightedPrediction) {
         extra += " weighted-prediction";
       }
@@ -449,6 +597,9 @@ namespace nvenc {
       if (enc_config.rcParams.enableMinQP) {
         extra += std::format(" qpmin={}", enc_config.rcParams.minQP.qpInterP);
       }
+      if (encoder_params.qp_map_block_size) {
+        extra += " qp-delta-map";
+      }
       if (config.insert_filler_data) {
         extra += " filler-data";
       }
@@ -457,18 +608,20 @@ namespace nvenc {
     }
 
     encoder_state = {};
+    encoder_state.vbv_buffer_size = initialized_config.rcParams.vbvBufferSize;
     fail_guard.disable();
     return true;
   }
 
   void nvenc_base::destroy_encoder() {
+    destroy_pipeline();
     if (output_bitstream) {
       if (nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, output_bitstream))) {
         BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
       }
       output_bitstream = nullptr;
     }
-    if (encoder && async_event_handle) {
+    if (encoder && encoder_params.async) {
       NV_ENC_EVENT_PARAMS event_params = {min_struct_version(NV_ENC_EVENT_PARAMS_VER)};
       event_params.completionEvent = async_event_handle;
       if (nvenc_failed(nvenc->nvEncUnregisterAsyncEvent(encoder, &event_params))) {
@@ -490,9 +643,11 @@ namespace nvenc {
 
     encoder_state = {};
     encoder_params = {};
+    initialized_params = {};
+    initialized_config = {};
   }
 
-  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr) {
+  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr, const std::function<void(nvenc_encoded_frame &&)> &on_part) {
     if (!encoder) {
       return {};
     }
@@ -504,6 +659,9 @@ namespace nvenc {
       BOOST_LOG(error) << "NvEnc: failed to synchronize input buffer";
       return {};
     }
+    auto release_guard = util::fail_guard([&] {
+      release_input_buffer();
+    });
 
     NV_ENC_MAP_INPUT_RESOURCE mapped_input_buffer = {min_struct_version(NV_ENC_MAP_INPUT_RESOURCE_VER)};
     mapped_input_buffer.registeredResource = registered_input_buffer;
@@ -527,7 +685,10 @@ namespace nvenc {
     pic_params.inputBuffer = mapped_input_buffer.mappedResource;
     pic_params.bufferFmt = mapped_input_buffer.mappedBufferFmt;
     pic_params.outputBitstream = output_bitstream;
-    pic_params.completionEvent = async_event_handle;
+    pic_params.completionEvent = encoder_params.async ? async_event_handle : nullptr;
+    set_ltr_params(pic_params, frame_index, force_idr);
+    set_intra_refresh_params(pic_params);
+    set_qp_delta_map_params(pic_params);
 
     if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
       BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
@@ -536,9 +697,18 @@ namespace nvenc {
 
     NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
     lock_bitstream.outputBitstream = output_bitstream;
-    lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
+    lock_bitstream.doNotWait = encoder_params.async ? 1 : 0;
+
+    if (encoder_params.frame_parts > 1) {
+      auto encoded_frame = read_frame_parts(lock_bitstream, on_part);
+      if (!encoded_frame.data.empty()) {
+        encoder_state.last_encoded_frame_index = frame_index;
+      }
+
+      return encoded_frame;
+    }
 
-    if (async_event_handle && !wait_for_async_event(100)) {
+    if (encoder_params.async && !wait_for_async_event(100)) {
       BOOST_LOG(error) << "NvEnc: frame " << frame_index << " encode wait timeout";
       return {};
     }
@@ -550,7 +720,7 @@ namespace nvenc {
 
     auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
     nvenc_encoded_frame encoded_frame {
-      {data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes},
+      {data_pointer, lock_bitstream.bitstreamSizeInBytes},
       lock_bitstream.outputTimeStamp,
       lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
       encoder_state.rfi_needs_confirmation,
@@ -576,8 +746,299 @@ namespace nvenc {
     return encoded_frame;
   }
 
+  bool nvenc_base::submit_frame(uint64_t frame_index, bool force_idr, std::function<void(nvenc_encoded_frame &&)> on_frame) {
+    if (!encoder || !is_pipelined()) {
+      return false;
+    }
+
+    std::unique_lock ul {pipeline.lock};
+    if (!pipeline.cv.wait_for(ul, std::chrono::milliseconds {100}, [&]() {
+          return pipeline.failed || pipeline.submitted - pipeline.completed < pipeline.slots.size();
+        })) {
+      BOOST_LOG(error) << "NvEnc: frame " << frame_index << " pipeline wait timeout";
+      return false;
+    }
+    if (pipeline.failed) {
+      return false;
+    }
+
+    // The completion thread doesn't touch a slot again until it's submitted
+    int slot_index = (int) (pipeline.submitted % pipeline.slots.size());
+    ul.unlock();
+    auto &slot = pipeline.slots[slot_index];
+
+    // The input surface stays mapped until the bitstream of its frame was read
+    if (slot.mapped_input_buffer) {
+      if (nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, slot.mapped_input_buffer))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << last_nvenc_error_string;
+      }
+      slot.mapped_input_buffer = nullptr;
+    }
+
+    if (!synchronize_input_buffer() || !copy_to_pipeline_buffer(slot_index)) {
+      BOOST_LOG(error) << "NvEnc: failed to copy input buffer to pipeline slot " << slot_index;
+      return false;
+    }
+
+    NV_ENC_MAP_INPUT_RESOURCE mapped_input_buffer = {min_struct_version(NV_ENC_MAP_INPUT_RESOURCE_VER)};
+    mapped_input_buffer.registeredResource = slot.input_buffer;
+
+    if (nvenc_failed(nvenc->nvEncMapInputResource(encoder, &mapped_input_buffer))) {
+      BOOST_LOG(error) << "NvEnc: NvEncMapInputResource() failed: " << last_nvenc_error_string;
+      return false;
+    }
+    slot.mapped_input_buffer = mapped_input_buffer.mappedResource;
+
+    NV_ENC_PIC_PARAMS pic_params = {min_struct_version(NV_ENC_PIC_PARAMS_VER, 4, 6)};
+    pic_params.inputWidth = encoder_params.width;
+    pic_params.inputHeight = encoder_params.height;
+    pic_params.encodePicFlags = force_idr ? NV_ENC_PIC_FLAG_FORCEIDR : 0;
+    pic_params.inputTimeStamp = frame_index;
+    pic_params.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+    pic_params.inputBuffer = mapped_input_buffer.mappedResource;
+    pic_params.bufferFmt = mapped_input_buffer.mappedBufferFmt;
+    pic_params.outputBitstream = slot.output_bitstream;
+    set_ltr_params(pic_params, frame_index, force_idr);
+    set_intra_refresh_params(pic_params);
+    set_qp_delta_map_params(pic_params);
+
+    if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    // Invalidation request is fulfilled by this frame, and its video network packet will be marked as such
+    slot.after_ref_frame_invalidation = encoder_state.rfi_needs_confirmation;
+    encoder_state.rfi_needs_confirmation = false;
+    encoder_state.last_encoded_frame_index = frame_index;
+    slot.on_frame = std::move(on_frame);
+
+    ul.lock();
+    ++pipeline.submitted;
+    ul.unlock();
+    pipeline.cv.notify_all();
+
+    return true;
+  }
+
+  bool nvenc_base::create_pipeline(int depth) {
+    for (int x = 0; x < depth; ++x) {
+      auto input_buffer = create_and_register_pipeline_buffer();
+      if (!input_buffer) {
+        if (x == 0) {
+          BOOST_LOG(warning) << "NvEnc: input surface doesn't support pipelined encoding, encoding one frame at a time";
+          return true;
+        }
+
+        return false;
+      }
+
+      auto &slot = pipeline.slots.emplace_back();
+      slot.input_buffer = input_buffer;
+
+      NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream_buffer = {min_struct_version(NV_ENC_CREATE_BITSTREAM_BUFFER_VER)};
+      if (nvenc_failed(nvenc->nvEncCreateBitstreamBuffer(encoder, &create_bitstream_buffer))) {
+        BOOST_LOG(error) << "NvEnc: NvEncCreateBitstreamBuffer() failed: " << last_nvenc_error_string;
+        return false;
+      }
+      slot.output_bitstream = create_bitstream_buffer.bitstreamBuffer;
+    }
+
+    pipeline.submitted = 0;
+    pipeline.completed = 0;
+    pipeline.stop = false;
+    pipeline.failed = false;
+    pipeline.completion_thread = std::thread {&nvenc_base::complete_frames, this};
+
+    return true;
+  }
+
+  void nvenc_base::destroy_pipeline() {
+    if (pipeline.completion_thread.joinable()) {
+      {
+        std::lock_guard lg {pipeline.lock};
+        pipeline.stop = true;
+      }
+      pipeline.cv.notify_all();
+      pipeline.completion_thread.join();
+    }
+
+    if (pipeline.slots.empty()) {
+      return;
+    }
+
+    for (auto &slot : pipeline.slots) {
+      if (slot.mapped_input_buffer && nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, slot.mapped_input_buffer))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << last_nvenc_error_string;
+      }
+      if (slot.output_bitstream && nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, slot.output_bitstream))) {
+        BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
+      }
+      if (slot.input_buffer && nvenc_failed(nvenc->nvEncUnregisterResource(encoder, slot.input_buffer))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnregisterResource() failed: " << last_nvenc_error_string;
+      }
+    }
+    pipeline.slots.clear();
+
+    destroy_pipeline_buffers();
+  }
+
+  void nvenc_base::complete_frames() {
+    // Runs alongside the encoding thread, so it leaves last_nvenc_error_string and the reference frame state alone
+    std::unique_lock ul {pipeline.lock};
+    while (true) {
+      pipeline.cv.wait(ul, [&]() {
+        return pipeline.stop || pipeline.completed < pipeline.submitted;
+      });
+
+      // Frames still in flight are waited for even when stopping, so their buffers can be destroyed
+      if (pipeline.completed == pipeline.submitted) {
+        return;
+      }
+
+      auto &slot = pipeline.slots[pipeline.completed % pipeline.slots.size()];
+      ul.unlock();
+
+      NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
+      lock_bitstream.outputBitstream = slot.output_bitstream;
+
+      // Blocks until the frame is encoded
+      nvenc_encoded_frame encoded_frame;
+      if (auto status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream); status == NV_ENC_SUCCESS) {
+        encoded_frame = {
+          {(uint8_t *) lock_bitstream.bitstreamBufferPtr, lock_bitstream.bitstreamSizeInBytes},
+          lock_bitstream.outputTimeStamp,
+          lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+          slot.after_ref_frame_invalidation,
+        };
+
+        if (status = nvenc->nvEncUnlockBitstream(encoder, slot.output_bitstream); status != NV_ENC_SUCCESS) {
+          BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << nvenc_status_string(status);
+        }
+      } else {
+        BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << nvenc_status_string(status);
+      }
+
+      if (encoded_frame.idr) {
+        BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
+      }
+      encoder_state.frame_size_logger.collect_and_log(encoded_frame.data.size() / 1000.);
+
+      auto on_frame = std::move(slot.on_frame);
+
+      ul.lock();
+      ++pipeline.completed;
+      pipeline.failed |= encoded_frame.data.empty();
+      bool stop = pipeline.stop;
+      ul.unlock();
+      pipeline.cv.notify_all();
+
+      if (!stop && !encoded_frame.data.empty()) {
+        on_frame(std::move(encoded_frame));
+      }
+
+      ul.lock();
+    }
+  }
+
+  nvenc_encoded_frame nvenc_base::read_frame_parts(NV_ENC_LOCK_BITSTREAM &lock_bitstream, const std::function<void(nvenc_encoded_frame &&)> &on_part) {
+    std::vector<uint32_t> slice_offsets(encoder_params.slices);
+    lock_bitstream.sliceOffsets = slice_offsets.data();
+    lock_bitstream.doNotWait = 1;
+
+    // The number of slices from the start of the frame to the end of a part
+    auto part_end_slice = [&](int part) {
+      return (uint32_t) ((part + 1) * encoder_params.slices / encoder_params.frame_parts);
+    };
+
+    std::vector<uint8_t> frame_data;
+    uint32_t part_start = 0;
+    int part = 0;
+
+    auto make_part = [&](uint32_t part_end) {
+      nvenc_encoded_frame encoded_frame {
+        {frame_data.data() + part_start, part_end - part_start},
+        lock_bitstream.outputTimeStamp,
+        lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+        encoder_state.rfi_needs_confirmation,
+        part,
+        encoder_params.frame_parts,
+      };
+
+      part_start = part_end;
+      ++part;
+
+      return encoded_frame;
+    };
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds {100};
+    while (true) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        BOOST_LOG(error) << "NvEnc: sub-frame encode wait timeout";
+        return {};
+      }
+
+      auto status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream);
+      if (status == NV_ENC_ERR_LOCK_BUSY) {
+        // Nothing was written yet. Slices complete within a fraction of the frame time, so don't sleep.
+        std::this_thread::yield();
+        continue;
+      }
+      if (nvenc_failed(status)) {
+        BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << last_nvenc_error_string;
+        return {};
+      }
+
+      // The bitstream only ever holds completed slices, so everything written so far can be handed out
+      auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
+      if (lock_bitstream.bitstreamSizeInBytes > frame_data.size()) {
+        frame_data.insert(frame_data.end(), data_pointer + frame_data.size(), data_pointer + lock_bitstream.bitstreamSizeInBytes);
+      }
+
+      bool frame_complete = lock_bitstream.hwEncodeStatus == 2;
+      auto completed_slices = lock_bitstream.numSlices;
+
+      if (nvenc_failed(nvenc->nvEncUnlockBitstream(encoder, lock_bitstream.outputBitstream))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << last_nvenc_error_string;
+      }
+
+      while (part < encoder_params.frame_parts - 1 && completed_slices >= part_end_slice(part)) {
+        auto end_slice = part_end_slice(part);
+        on_part(make_part(end_slice < completed_slices ? slice_offsets[end_slice] : (uint32_t) frame_data.size()));
+      }
+
+      if (frame_complete) {
+        break;
+      }
+
+      std::this_thread::yield();
+    }
+
+    // Should the frame complete with fewer slices than requested, split the rest of it evenly,
+    // since every part must be sent for the client to reassemble the frame
+    auto frame_size = (uint32_t) frame_data.size();
+    while (part < encoder_params.frame_parts - 1) {
+      auto remaining_parts = encoder_params.frame_parts - part;
+      on_part(make_part(std::min(frame_size, part_start + std::max<uint32_t>((frame_size - part_start) / remaining_parts, 1))));
+    }
+    auto encoded_frame = make_part(frame_size);
+
+    if (encoder_state.rfi_needs_confirmation) {
+      // Invalidation request has been fulfilled, and video network packet will be marked as such
+      encoder_state.rfi_needs_confirmation = false;
+    }
+
+    if (encoded_frame.idr) {
+      BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
+    }
+
+    encoder_state.frame_size_logger.collect_and_log(frame_size / 1000.);
+
+    return encoded_frame;
+  }
+
   bool nvenc_base::invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame) {
-    if (!encoder || !encoder_params.rfi) {
+    if (!encoder || (!encoder_params.rfi && !encoder_params.ltr_frames)) {
       return false;
     }
 
@@ -594,12 +1055,34 @@ namespace nvenc {
       return false;
     }
 
+    if (encoder_params.ltr_frames) {
+      // Long-term references from the lost frames on may not have reached the client, or refer to what didn't
+      for (auto &slot : encoder_state.ltr_slots) {
+        if (slot.marked && slot.frame_index >= first_frame) {
+          slot = {};
+        }
+      }
+
+      if (auto slot = last_acknowledged_ltr(); slot >= 0) {
+        BOOST_LOG(debug) << "NvEnc: rfi request " << first_frame << "-" << last_frame << " recovering from long-term reference " << encoder_state.ltr_slots[slot].frame_index;
+        encoder_state.ltr_recovery_slot = slot;
+        encoder_state.last_rfi_range = {first_frame, encoder_state.last_encoded_frame_index};
+        return true;
+      }
+
+      if (!encoder_params.rfi) {
+        BOOST_LOG(debug) << "NvEnc: no long-term reference to recover from, generating IDR";
+        return false;
+      }
+    }
+
     BOOST_LOG(debug) << "NvEnc: rfi request " << first_frame << "-" << last_frame << " expanding to last encoded frame " << encoder_state.last_encoded_frame_index;
     last_frame = encoder_state.last_encoded_frame_index;
 
     encoder_state.last_rfi_range = {first_frame, last_frame};
 
-    if (last_frame - first_frame + 1 >= encoder_params.ref_frames_in_dpb) {
+    // Long-term references take up part of the reference frame buffer
+    if (last_frame - first_frame + 1 >= encoder_params.ref_frames_in_dpb - encoder_params.ltr_frames) {
       BOOST_LOG(debug) << "NvEnc: rfi request too large, generating IDR";
       return false;
     }
@@ -614,45 +1097,197 @@ namespace nvenc {
     return true;
   }
 
-  bool nvenc_base::nvenc_failed(NVENCSTATUS status) {
-    auto status_string = [](NVENCSTATUS status) -> std::string {
-      switch (status) {
-#define nvenc_status_case(x) \
-  case x: \
-    return #x;
-        nvenc_status_case(NV_ENC_SUCCESS);
-        nvenc_status_case(NV_ENC_ERR_NO_ENCODE_DEVICE);
-        nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_DEVICE);
-        nvenc_status_case(NV_ENC_ERR_INVALID_ENCODERDEVICE);
-        nvenc_status_case(NV_ENC_ERR_INVALID_DEVICE);
-        nvenc_status_case(NV_ENC_ERR_DEVICE_NOT_EXIST);
-        nvenc_status_case(NV_ENC_ERR_INVALID_PTR);
-        nvenc_status_case(NV_ENC_ERR_INVALID_EVENT);
-        nvenc_status_case(NV_ENC_ERR_INVALID_PARAM);
-        nvenc_status_case(NV_ENC_ERR_INVALID_CALL);
-        nvenc_status_case(NV_ENC_ERR_OUT_OF_MEMORY);
-        nvenc_status_case(NV_ENC_ERR_ENCODER_NOT_INITIALIZED);
-        nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_PARAM);
-        nvenc_status_case(NV_ENC_ERR_LOCK_BUSY);
-        nvenc_status_case(NV_ENC_ERR_NOT_ENOUGH_BUFFER);
-        nvenc_status_case(NV_ENC_ERR_INVALID_VERSION);
-        nvenc_status_case(NV_ENC_ERR_MAP_FAILED);
-        nvenc_status_case(NV_ENC_ERR_NEED_MORE_INPUT);
-        nvenc_status_case(NV_ENC_ERR_ENCODER_BUSY);
-        nvenc_status_case(NV_ENC_ERR_EVENT_NOT_REGISTERD);
-        nvenc_status_case(NV_ENC_ERR_GENERIC);
-        nvenc_status_case(NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY);
-        nvenc_status_case(NV_ENC_ERR_UNIMPLEMENTED);
-        nvenc_status_case(NV_ENC_ERR_RESOURCE_REGISTER_FAILED);
-        nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_REGISTERED);
-        nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_MAPPED);
-        // Newer versions of sdk may add more constants, look for them at the end of NVENCSTATUS enum
-#undef nvenc_status_case
-        default:
-          return std::to_string(status);
+  void nvenc_base::acknowledge_frame(uint64_t frame_index) {
+    for (auto &slot : encoder_state.ltr_slots) {
+      if (slot.marked && slot.frame_index <= frame_index) {
+        slot.acknowledged = true;
       }
+    }
+  }
+
+  int nvenc_base::last_acknowledged_ltr() const {
+    int last = -1;
+    for (int x = 0; x < (int) encoder_state.ltr_slots.size(); ++x) {
+      auto &slot = encoder_state.ltr_slots[x];
+      if (slot.acknowledged && (last < 0 || slot.frame_index > encoder_state.ltr_slots[last].frame_index)) {
+        last = x;
+      }
+    }
+
+    return last;
+  }
+
+  void nvenc_base::set_ltr_params(NV_ENC_PIC_PARAMS &pic_params, uint64_t frame_index, bool force_idr) {
+    if (!encoder_params.ltr_frames) {
+      return;
+    }
+
+    // An IDR frame drops every reference, and is the first one to recover from
+    if (force_idr) {
+      encoder_state.ltr_slots = {};
+      encoder_state.ltr_recovery_slot = -1;
+      encoder_state.next_ltr_mark = frame_index;
+    }
+
+    auto set_params = [&](auto &codec_params) {
+      if (encoder_state.ltr_recovery_slot >= 0) {
+        // Predicting from a picture the client holds keeps the recovery frame close to the size of a P-frame
+        codec_params.ltrUseFrames = 1;
+        codec_params.ltrUseFrameBitmap = 1u << encoder_state.ltr_recovery_slot;
+        encoder_state.ltr_recovery_slot = -1;
+        return;
+      }
+
+      if (frame_index < encoder_state.next_ltr_mark) {
+        return;
+      }
+
+      // The last reference the client received is kept until the next one is received too
+      int slot = last_acknowledged_ltr() == 0 ? 1 : 0;
+      codec_params.ltrMarkFrame = 1;
+      codec_params.ltrMarkFrameIdx = slot;
+      encoder_state.ltr_slots[slot] = {frame_index, true, false};
+      encoder_state.next_ltr_mark = frame_index + encoder_params.ltr_interval;
     };
 
+    if (equal_guids(initialized_params.encodeGUID, NV_ENC_CODEC_H264_GUID)) {
+      set_params(pic_params.codecPicParams.h264PicParams);
+    } else {
+      set_params(pic_params.codecPicParams.hevcPicParams);
+    }
+  }
+
+  bool nvenc_base::request_intra_refresh() {
+    if (!encoder || !encoder_params.intra_refresh_frames) {
+      return false;
+    }
+
+    encoder_state.intra_refresh_requested = true;
+    return true;
+  }
+
+  void nvenc_base::set_roi(const std::optional<video::roi_t> &roi) {
+    auto block = encoder_params.qp_map_block_size;
+    if (!encoder || !block) {
+      return;
+    }
+
+    auto &map = encoder_state.qp_delta_map;
+    if (!roi) {
+      map.clear();
+      return;
+    }
+
+    auto columns = (encoder_params.width + block - 1) / block;
+    auto rows = (encoder_params.height + block - 1) / block;
+    map.assign((std::size_t) columns * rows, 0);
+
+    // Every block the region touches gets the delta of the region
+    auto delta = (int8_t) std::clamp(roi->qp_delta, -51, 51);
+    auto right = std::min<uint32_t>((roi->right + block - 1) / block, columns);
+    auto bottom = std::min<uint32_t>((roi->bottom + block - 1) / block, rows);
+    for (auto y = (uint32_t) std::max(roi->top, 0) / block; y < bottom; ++y) {
+      for (auto x = (uint32_t) std::max(roi->left, 0) / block; x < right; ++x) {
+        map[(std::size_t) y * columns + x] = delta;
+      }
+    }
+  }
+
+  void nvenc_base::set_qp_delta_map_params(NV_ENC_PIC_PARAMS &pic_params) {
+    auto &map = encoder_state.qp_delta_map;
+    if (map.empty()) {
+      return;
+    }
+
+    pic_params.qpDeltaMap = map.data();
+    pic_params.qpDeltaMapSize = (uint32_t) map.size();
+  }
+
+  void nvenc_base::set_intra_refresh_params(NV_ENC_PIC_PARAMS &pic_params) {
+    if (!encoder_state.intra_refresh_requested) {
+      return;
+    }
+    encoder_state.intra_refresh_requested = false;
+
+    // Restarting the refresh with this frame heals the picture in a full period, wherever the last one was
+    if (equal_guids(initialized_params.encodeGUID, NV_ENC_CODEC_H264_GUID)) {
+      pic_params.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+    } else {
+      pic_params.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+    }
+  }
+
+  bool nvenc_base::set_bitrate(uint32_t bitrate) {
+    // Frames in flight were submitted with the previous parameters, so a pipelined encoder isn't reconfigured
+    if (!encoder || !encoder_params.dynamic_bitrate || is_pipelined()) {
+      return false;
+    }
+
+    auto config = initialized_config;
+    auto &rc = config.rcParams;
+    auto previous_bitrate = rc.averageBitRate;
+    rc.averageBitRate = bitrate * 1000;
+    if (rc.maxBitRate) {
+      rc.maxBitRate = rc.averageBitRate;
+    }
+    auto vbv_buffer_size = encoder_state.vbv_buffer_size;
+    if (vbv_buffer_size && previous_bitrate) {
+      vbv_buffer_size = (uint32_t) ((uint64_t) vbv_buffer_size * rc.averageBitRate / previous_bitrate);
+    }
+
+    if (!reconfigure_rate_control(config, vbv_buffer_size, encoder_state.max_frame_size)) {
+      return false;
+    }
+
+    BOOST_LOG(debug) << "NvEnc: bitrate changed to " << bitrate << " kbps";
+    return true;
+  }
+
+  bool nvenc_base::set_max_frame_size(uint64_t bits) {
+    // The frame size is limited through the VBV buffer, which a pipelined encoder can't change either
+    if (!encoder || !encoder_params.dynamic_bitrate || is_pipelined() || !encoder_state.vbv_buffer_size) {
+      return false;
+    }
+
+    auto config = initialized_config;
+    if (!reconfigure_rate_control(config, encoder_state.vbv_buffer_size, bits)) {
+      return false;
+    }
+
+    BOOST_LOG(debug) << "NvEnc: VBV buffer limited to " << config.rcParams.vbvBufferSize / 1000 << " kbit";
+    return true;
+  }
+
+  bool nvenc_base::reconfigure_rate_control(NV_ENC_CONFIG &config, uint32_t vbv_buffer_size, uint64_t max_frame_size) {
+    auto &rc = config.rcParams;
+    if (vbv_buffer_size) {
+      rc.vbvBufferSize = vbv_buffer_size;
+
+      // A buffer smaller than an average frame would starve the rate control
+      if (max_frame_size && initialized_params.frameRateNum) {
+        auto average_frame_size = (uint64_t) rc.averageBitRate * initialized_params.frameRateDen / initialized_params.frameRateNum;
+        rc.vbvBufferSize = (uint32_t) std::min<uint64_t>(vbv_buffer_size, std::max(max_frame_size, average_frame_size));
+      }
+    }
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {min_struct_version(NV_ENC_RECONFIGURE_PARAMS_VER)};
+    reconfigure_params.reInitEncodeParams = initialized_params;
+    reconfigure_params.reInitEncodeParams.encodeConfig = &config;
+    reconfigure_params.resetEncoder = 0;
+    reconfigure_params.forceIDR = 0;
+
+    if (nvenc_failed(nvenc->nvEncReconfigureEncoder(encoder, &reconfigure_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncReconfigureEncoder() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    initialized_config = config;
+    encoder_state.vbv_buffer_size = vbv_buffer_size;
+    encoder_state.max_frame_size = max_frame_size;
+    return true;
+  }
+
+  bool nvenc_base::nvenc_failed(NVENCSTATUS status) {
     last_nvenc_error_string.clear();
     if (status != NV_ENC_SUCCESS) {
       /* This API function gives broken strings more often than not
@@ -661,7 +1296,7 @@ namespace nvenc {
         if (!last_nvenc_error_string.empty()) last_nvenc_error_string += " ";
       }
       */
-      last_nvenc_error_string += status_string(status);
+      last_nvenc_error_string += nvenc_status_string(status);
       return true;
     }
 
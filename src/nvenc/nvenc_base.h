@@ -4,6 +4,15 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
 // lib includes
 #include <ffnvcodec/nvEncodeAPI.h>
 
@@ -56,9 +65,28 @@ namespace nvenc {
      *        Afterwards serves as parameter for `invalidate_ref_frames()`.
      *        No restrictions on the first frame index, but later frame indexes must be subsequent.
      * @param force_idr Whether to encode frame as forced IDR.
-     * @return Encoded frame.
+     * @param on_part With sub-frame output, receives every part of the frame but the last as soon as it's encoded.
+     * @return Encoded frame, or its last part with sub-frame output.
+     */
+    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr, const std::function<void(nvenc_encoded_frame &&)> &on_part);
+
+    /**
+     * @brief Whether the encoder was created with more than one frame in flight.
+     *        If so, frames are encoded with `submit_frame()` instead of `encode_frame()`.
+     */
+    bool is_pipelined() const {
+      return !pipeline.slots.empty();
+    }
+
+    /**
+     * @brief Submit the next frame for encoding without waiting for its bitstream.
+     *        Waits only if every pipeline slot is still encoding.
+     * @param frame_index Frame index that uniquely identifies the frame, as with `encode_frame()`.
+     * @param force_idr Whether to encode frame as forced IDR.
+     * @param on_frame Receives the encoded frame on the completion thread, in submission order.
+     * @return `true` on success, `false` on error, including an error of an earlier frame on the completion thread.
      */
-    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr);
+    bool submit_frame(uint64_t frame_index, bool force_idr, std::function<void(nvenc_encoded_frame &&)> on_frame);
 
     /**
      * @brief Perform reference frame invalidation (RFI) procedure.
@@ -69,6 +97,42 @@ namespace nvenc {
      */
     bool invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame);
 
+    /**
+     * @brief Let the encoder know the client received every frame up to this one.
+     *        With long-term reference recovery, the frames marked as long-term references up to it can be recovered from.
+     * @param frame_index The last frame the client received.
+     */
+    void acknowledge_frame(uint64_t frame_index);
+
+    /**
+     * @brief Start refreshing the picture with the next frame, instead of encoding an IDR frame.
+     * @return `true` if the encoder runs rolling intra refresh, `false` if it needs an IDR frame instead.
+     */
+    bool request_intra_refresh();
+
+    /**
+     * @brief Change the bitrate of the encoder without resetting it.
+     *        The VBV buffer is scaled along with the bitrate, so it keeps holding the same number of frames.
+     * @param bitrate The bitrate in kilobits per second.
+     * @return `true` on success, `false` if the encoder can't change its bitrate or on error.
+     */
+    bool set_bitrate(uint32_t bitrate);
+
+    /**
+     * @brief Limit the size of each frame without resetting the encoder, by shrinking its VBV buffer.
+     *        The buffer never gets smaller than an average frame, nor larger than it would be without the limit.
+     * @param bits The size of the largest frame in bits, 0 to lift the limit.
+     * @return `true` on success, `false` if the encoder can't change its VBV buffer or on error.
+     */
+    bool set_max_frame_size(uint64_t bits);
+
+    /**
+     * @brief Change the QP of a region of the next frames with the QP delta map.
+     *        Does nothing unless the encoder was created with `qp_delta_map` for H.264 or HEVC.
+     * @param roi The region, or `std::nullopt` to encode the whole frame alike.
+     */
+    void set_roi(const std::optional<video::roi_t> &roi);
+
   protected:
     /**
      * @brief Required. Used for loading NvEnc library and setting `nvenc` variable with `NvEncodeAPICreateInstance()`.
@@ -94,6 +158,41 @@ namespace nvenc {
       return true;
     }
 
+    /**
+     * @brief Optional. Override if you must perform additional operations on the registered input surface in the end of `encode_frame()`,
+     *        once the encoder is done reading it. Typically used for handing an interop surface back to its API.
+     */
+    virtual void release_input_buffer() {
+    }
+
+    /**
+     * @brief Optional. Override to support more than one frame in flight.
+     *        Create another input surface and register it with `nvenc->nvEncRegisterResource()`.
+     *        Called during `create_encoder()` for every pipeline slot.
+     * @return The registered surface, or `nullptr` on error.
+     */
+    virtual NV_ENC_REGISTERED_PTR create_and_register_pipeline_buffer() {
+      return nullptr;
+    }
+
+    /**
+     * @brief Optional. Must be overridden along with `create_and_register_pipeline_buffer()`.
+     *        Copy the outside-facing input surface into the input surface of a pipeline slot,
+     *        so the next frame can be written to the outside-facing surface while this one is encoded.
+     * @param slot The index of the pipeline slot, in the order the surfaces were created.
+     * @return `true` on success, `false` on error
+     */
+    virtual bool copy_to_pipeline_buffer(int slot) {
+      return false;
+    }
+
+    /**
+     * @brief Optional. Called during `destroy_encoder()` after the pipeline surfaces were unregistered,
+     *        to release what `create_and_register_pipeline_buffer()` created.
+     */
+    virtual void destroy_pipeline_buffers() {
+    }
+
     /**
      * @brief Optional. Override if you want to create encoder in async mode.
      *        In this case must also set `async_event_handle` variable.
@@ -126,6 +225,14 @@ namespace nvenc {
       NV_ENC_BUFFER_FORMAT buffer_format = NV_ENC_BUFFER_FORMAT_UNDEFINED;
       uint32_t ref_frames_in_dpb = 0;
       bool rfi = false;
+      bool async = false;
+      uint32_t slices = 0;
+      int frame_parts = 1;  ///< Parts each frame is handed out in, more than one with sub-frame output
+      bool dynamic_bitrate = false;
+      uint32_t ltr_frames = 0;  ///< Long-term references marked for recovery, 0 without long-term reference recovery
+      uint64_t ltr_interval = 0;  ///< Frames between two long-term reference marks
+      uint32_t intra_refresh_frames = 0;  ///< Frames each intra refresh spans, 0 without rolling intra refresh
+      uint32_t qp_map_block_size = 0;  ///< Pixels each side of a value of the QP delta map covers, 0 without a QP delta map
     } encoder_params;
 
     std::string last_nvenc_error_string;
@@ -141,15 +248,111 @@ namespace nvenc {
                                          ///< Can be set in constructor or `init_library()`, must override `wait_for_async_event()`.
 
   private:
+    /**
+     * @brief Poll the bitstream of the frame being encoded, and hand its parts out as their slices complete.
+     * @param lock_bitstream The lock parameters of the output bitstream.
+     * @param on_part Receives every part of the frame but the last.
+     * @return The last part of the frame, or an empty frame on error.
+     */
+    nvenc_encoded_frame read_frame_parts(NV_ENC_LOCK_BITSTREAM &lock_bitstream, const std::function<void(nvenc_encoded_frame &&)> &on_part);
+
+    /**
+     * @brief Create the pipeline slots and start the completion thread.
+     * @param depth The number of frames in flight.
+     * @return `true` on success, `false` on error.
+     */
+    bool create_pipeline(int depth);
+
+    /**
+     * @brief Wait for the frames in flight, stop the completion thread and destroy the pipeline slots.
+     */
+    void destroy_pipeline();
+
+    /**
+     * @brief Read the bitstreams of the submitted frames in order, handing them out as they complete.
+     */
+    void complete_frames();
+
+    /**
+     * @brief Mark the frame as a long-term reference, or have it predict from one the client received after a loss.
+     * @param pic_params The parameters of the frame.
+     * @param frame_index The index of the frame.
+     * @param force_idr Whether the frame is encoded as forced IDR, which drops every long-term reference.
+     */
+    void set_ltr_params(NV_ENC_PIC_PARAMS &pic_params, uint64_t frame_index, bool force_idr);
+
+    /**
+     * @brief The slot of the most recent long-term reference the client received.
+     * @return The slot, or -1 if the client didn't receive any.
+     */
+    int last_acknowledged_ltr() const;
+
+    /**
+     * @brief Have the frame start a new intra refresh if one was requested.
+     * @param pic_params The parameters of the frame.
+     */
+    void set_intra_refresh_params(NV_ENC_PIC_PARAMS &pic_params);
+
+    /**
+     * @brief Hand the QP delta map to the frame if a region is set.
+     * @param pic_params The parameters of the frame.
+     */
+    void set_qp_delta_map_params(NV_ENC_PIC_PARAMS &pic_params);
+
+    /**
+     * @brief Reconfigure the encoder with new rate control parameters.
+     * @param config The configuration to apply, its VBV buffer is set from the next two parameters.
+     * @param vbv_buffer_size The VBV buffer without the frame size limit, 0 if the encoder picks it.
+     * @param max_frame_size The size of the largest frame in bits, 0 without a limit.
+     * @return `true` on success, `false` on error.
+     */
+    bool reconfigure_rate_control(NV_ENC_CONFIG &config, uint32_t vbv_buffer_size, uint64_t max_frame_size);
+
     NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
     uint32_t minimum_api_version = 0;
 
+    // Kept from create_encoder(), so the encoder can be reconfigured with a few of them changed
+    NV_ENC_INITIALIZE_PARAMS initialized_params = {};
+    NV_ENC_CONFIG initialized_config = {};
+
+    struct ltr_slot_t {
+      uint64_t frame_index = 0;
+      bool marked = false;  ///< A frame was marked as long-term reference in this slot
+      bool acknowledged = false;  ///< The client received the frame
+    };
+
     struct {
       uint64_t last_encoded_frame_index = 0;
       bool rfi_needs_confirmation = false;
       std::pair<uint64_t, uint64_t> last_rfi_range;
+      std::array<ltr_slot_t, 2> ltr_slots;  ///< One holds the last reference the client received, the other the next one
+      uint64_t next_ltr_mark = 0;  ///< The first frame index that may be marked as long-term reference again
+      int ltr_recovery_slot = -1;  ///< The slot the next frame predicts from, -1 if it predicts from the previous frame
+      bool intra_refresh_requested = false;  ///< The next frame starts a new intra refresh
+      uint32_t vbv_buffer_size = 0;  ///< The VBV buffer at the current bitrate before the frame size limit, 0 if the encoder picks it
+      uint64_t max_frame_size = 0;  ///< The size of the largest frame in bits, 0 without a limit
+      std::vector<int8_t> qp_delta_map;  ///< One value per block in raster order, empty while the whole frame is encoded alike
       logging::min_max_avg_periodic_logger<double> frame_size_logger = {debug, "NvEnc: encoded frame sizes in kB", ""};
     } encoder_state;
+
+    struct pipeline_slot_t {
+      NV_ENC_REGISTERED_PTR input_buffer = nullptr;
+      NV_ENC_INPUT_PTR mapped_input_buffer = nullptr;  ///< Mapped until the slot is reused, after its bitstream was read
+      NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
+      bool after_ref_frame_invalidation = false;
+      std::function<void(nvenc_encoded_frame &&)> on_frame;
+    };
+
+    struct {
+      std::vector<pipeline_slot_t> slots;
+      std::mutex lock;
+      std::condition_variable cv;
+      uint64_t submitted = 0;  ///< Frames submitted, the next one goes to `slots[submitted % slots.size()]`
+      uint64_t completed = 0;  ///< Frames whose bitstream was read
+      bool stop = false;
+      bool failed = false;
+      std::thread completion_thread;
+    } pipeline;
   };
 
 }  // namespace nvenc
@@ -12,6 +12,12 @@ namespace nvenc {
     full_resolution,  ///< Better overall statistics, slower and uses more extra vram
   };
 
+  enum class nvenc_split_frame_encoding {
+    disabled,  ///< Encode each frame on a single NVENC engine
+    driver_decides,  ///< Let the driver split frames across engines at high resolutions and frame rates
+    force_enabled,  ///< Split every HEVC and AV1 frame across the NVENC engines of the GPU
+  };
+
   /**
    * @brief NVENC encoder configuration.
    */
@@ -22,6 +28,9 @@ namespace nvenc {
     // Use optional preliminary pass for better motion vectors, bitrate distribution and stricter VBV(HRD), uses CUDA cores
     nvenc_two_pass two_pass = nvenc_two_pass::quarter_resolution;
 
+    // Encode horizontal strips of each HEVC and AV1 frame on separate NVENC engines of GPUs that have several
+    nvenc_split_frame_encoding split_frame_encoding = nvenc_split_frame_encoding::driver_decides;
+
     // Percentage increase of VBV/HRD from the default single frame, allows low-latency variable bitrate
     int vbv_percentage_increase = 0;
 
@@ -48,6 +57,21 @@ namespace nvenc {
 
     // Add filler data to encoded frames to stay at target bitrate, mainly for testing
     bool insert_filler_data = false;
+
+    // Hand out H.264 and HEVC frames in parts as their slices finish encoding, so sending can start before the frame is done
+    bool subframe_output = false;
+
+    // Frames that may be encoding at once, more than one lets the next frame be captured and converted while the last one encodes
+    int pipeline_depth = 1;
+
+    // Mark frames the client received as long-term references, so H.264 and HEVC recover from loss by predicting from one instead of sending an IDR frame
+    bool ltr_recovery = false;
+
+    // Refresh the picture with intra coded blocks over this many frames, over and over, so H.264 and HEVC can do without IDR frames after the first one
+    int intra_refresh_frames = 0;
+
+    // Take a QP delta map with each H.264 and HEVC frame, so regions of interest can be encoded at a higher quality
+    bool qp_delta_map = false;
   };
 
 }  // namespace nvenc
@@ -11,9 +11,10 @@
 
 namespace nvenc {
 
-  nvenc_d3d11_native::nvenc_d3d11_native(ID3D11Device *d3d_device):
+  nvenc_d3d11_native::nvenc_d3d11_native(ID3D11Device *d3d_device, bool unordered_access):
       nvenc_d3d11(NV_ENC_DEVICE_TYPE_DIRECTX),
-      d3d_device(d3d_device) {
+      d3d_device(d3d_device),
+      unordered_access(unordered_access) {
     device = d3d_device;
   }
 
@@ -44,6 +45,9 @@ namespace nvenc {
       desc.SampleDesc.Count = 1;
       desc.Usage = D3D11_USAGE_DEFAULT;
       desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+      if (unordered_access) {
+        desc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+      }
       if (d3d_device->CreateTexture2D(&desc, nullptr, &d3d_input_texture) != S_OK) {
         BOOST_LOG(error) << "NvEnc: couldn't create input texture";
         return false;
@@ -51,24 +55,65 @@ namespace nvenc {
     }
 
     if (!registered_input_buffer) {
-      NV_ENC_REGISTER_RESOURCE register_resource = {min_struct_version(NV_ENC_REGISTER_RESOURCE_VER, 3, 4)};
-      register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
-      register_resource.width = encoder_params.width;
-      register_resource.height = encoder_params.height;
-      register_resource.resourceToRegister = d3d_input_texture.GetInterfacePtr();
-      register_resource.bufferFormat = encoder_params.buffer_format;
-      register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
-
-      if (nvenc_failed(nvenc->nvEncRegisterResource(encoder, &register_resource))) {
-        BOOST_LOG(error) << "NvEnc: NvEncRegisterResource() failed: " << last_nvenc_error_string;
+      registered_input_buffer = register_texture(d3d_input_texture.GetInterfacePtr());
+      if (!registered_input_buffer) {
         return false;
       }
+    }
+
+    return true;
+  }
+
+  NV_ENC_REGISTERED_PTR nvenc_d3d11_native::create_and_register_pipeline_buffer() {
+    if (!d3d_context) {
+      d3d_device->GetImmediateContext(&d3d_context);
+    }
+
+    D3D11_TEXTURE2D_DESC desc;
+    d3d_input_texture->GetDesc(&desc);
+    desc.BindFlags = 0;
+
+    ID3D11Texture2DPtr texture;
+    if (d3d_device->CreateTexture2D(&desc, nullptr, &texture) != S_OK) {
+      BOOST_LOG(error) << "NvEnc: couldn't create pipeline input texture";
+      return nullptr;
+    }
 
-      registered_input_buffer = register_resource.registeredResource;
+    auto registered_buffer = register_texture(texture.GetInterfacePtr());
+    if (registered_buffer) {
+      pipeline_textures.emplace_back(std::move(texture));
     }
 
+    return registered_buffer;
+  }
+
+  bool nvenc_d3d11_native::copy_to_pipeline_buffer(int slot) {
+    // Queued on the context the input texture is written with, so the copy sees the whole frame
+    // and the next frame isn't written before the copy
+    d3d_context->CopyResource(pipeline_textures[slot].GetInterfacePtr(), d3d_input_texture.GetInterfacePtr());
     return true;
   }
 
+  void nvenc_d3d11_native::destroy_pipeline_buffers() {
+    pipeline_textures.clear();
+  }
+
+  NV_ENC_REGISTERED_PTR nvenc_d3d11_native::register_texture(ID3D11Texture2D *texture) {
+    NV_ENC_REGISTER_RESOURCE register_resource = {min_struct_version(NV_ENC_REGISTER_RESOURCE_VER, 3, 4)};
+    register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
+    register_resource.width = encoder_params.width;
+    register_resource.height = encoder_params.height;
+    register_resource.resourceToRegister = texture;
+    register_resource.bufferFormat = encoder_params.buffer_format;
+    register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+
+    if (nvenc_failed(nvenc->nvEncRegisterResource(encoder, &register_resource))) {
+      BOOST_LOG(error) << "NvEnc: NvEncRegisterResource() failed: " << last_nvenc_error_string;
+      return nullptr;
+    }
+
+    return register_resource.registeredResource;
+  }
+
 }  // namespace nvenc
 #endif
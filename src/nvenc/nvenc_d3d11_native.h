@@ -7,6 +7,7 @@
   // standard includes
   #include <comdef.h>
   #include <d3d11.h>
+  #include <vector>
 
   // local includes
   #include "nvenc_d3d11.h"
@@ -20,17 +21,30 @@ namespace nvenc {
   public:
     /**
      * @param d3d_device Direct3D11 device used for encoding.
+     * @param unordered_access Whether the input texture is written by a compute shader.
      */
-    explicit nvenc_d3d11_native(ID3D11Device *d3d_device);
+    explicit nvenc_d3d11_native(ID3D11Device *d3d_device, bool unordered_access = false);
     ~nvenc_d3d11_native();
 
     ID3D11Texture2D *get_input_texture() override;
 
   private:
     bool create_and_register_input_buffer() override;
+    NV_ENC_REGISTERED_PTR create_and_register_pipeline_buffer() override;
+    bool copy_to_pipeline_buffer(int slot) override;
+    void destroy_pipeline_buffers() override;
+
+    /**
+     * @brief Register a texture as an input surface of the encoder.
+     * @return The registered surface, or `nullptr` on error.
+     */
+    NV_ENC_REGISTERED_PTR register_texture(ID3D11Texture2D *texture);
 
     const ID3D11DevicePtr d3d_device;
+    const bool unordered_access;
     ID3D11Texture2DPtr d3d_input_texture;
+    ID3D11DeviceContextPtr d3d_context;
+    std::vector<ID3D11Texture2DPtr> pipeline_textures;  ///< The input surfaces frames are copied to while they encode
   };
 
 }  // namespace nvenc
@@ -153,7 +153,29 @@ namespace nvenc {
         }
       }
 
-      if (!cuda_surface) {
+      // Encoding straight from the CUDA array of the texture saves a full-frame copy per frame,
+      // drivers that can't register the array with NVENC get the copy into linear memory instead
+      if (!registered_input_buffer && !cuda_surface) {
+        CUarray array;
+        if (!map_input_texture(array)) {
+          return false;
+        }
+
+        registered_input_buffer = register_input_array(array);
+        if (!unmap_input_texture()) {
+          return false;
+        }
+
+        if (registered_input_buffer) {
+          zero_copy = true;
+          registered_input_array = array;
+          BOOST_LOG(debug) << "NvEnc: CUDA interop encodes from the input texture without a copy";
+        } else {
+          BOOST_LOG(warning) << "NvEnc: CUDA interop can't encode from the input texture, copying every frame: " << last_nvenc_error_string;
+        }
+      }
+
+      if (!zero_copy && !cuda_surface) {
         if (cuda_failed(cuda_functions.cuMemAllocPitch(
               &cuda_surface,
               &cuda_surface_pitch,
@@ -195,24 +217,36 @@ namespace nvenc {
       return false;
     }
 
-    if (cuda_failed(cuda_functions.cuGraphicsMapResources(1, &cuda_d3d_input_texture, 0))) {
-      BOOST_LOG(error) << "NvEnc: cuGraphicsMapResources() failed: error " << last_cuda_error;
+    CUarray input_texture_array;
+    if (!map_input_texture(input_texture_array)) {
       return false;
     }
 
-    auto unmap = [&]() -> bool {
-      if (cuda_failed(cuda_functions.cuGraphicsUnmapResources(1, &cuda_d3d_input_texture, 0))) {
-        BOOST_LOG(error) << "NvEnc: cuGraphicsUnmapResources() failed: error " << last_cuda_error;
-        return false;
+    auto unmap_guard = util::fail_guard([&]() {
+      unmap_input_texture();
+    });
+
+    if (zero_copy) {
+      // The texture usually maps to the same array every time, but that isn't guaranteed
+      if (input_texture_array != registered_input_array) {
+        BOOST_LOG(debug) << "NvEnc: CUDA array of the input texture changed, registering it again";
+
+        if (nvenc_failed(nvenc->nvEncUnregisterResource(encoder, registered_input_buffer))) {
+          BOOST_LOG(error) << "NvEnc: NvEncUnregisterResource() failed: " << last_nvenc_error_string;
+        }
+        registered_input_array = nullptr;
+
+        registered_input_buffer = register_input_array(input_texture_array);
+        if (!registered_input_buffer) {
+          BOOST_LOG(error) << "NvEnc: NvEncRegisterResource() failed: " << last_nvenc_error_string;
+          return false;
+        }
+        registered_input_array = input_texture_array;
       }
-      return true;
-    };
-    auto unmap_guard = util::fail_guard(unmap);
 
-    CUarray input_texture_array;
-    if (cuda_failed(cuda_functions.cuGraphicsSubResourceGetMappedArray(&input_texture_array, cuda_d3d_input_texture, 0, 0))) {
-      BOOST_LOG(error) << "NvEnc: cuGraphicsSubResourceGetMappedArray() failed: error " << last_cuda_error;
-      return false;
+      // Stays mapped until the frame is encoded
+      unmap_guard.disable();
+      return true;
     }
 
     {
@@ -233,7 +267,62 @@ namespace nvenc {
     }
 
     unmap_guard.disable();
-    return unmap();
+    return unmap_input_texture();
+  }
+
+  void nvenc_d3d11_on_cuda::release_input_buffer() {
+    if (!input_texture_mapped) {
+      return;
+    }
+
+    auto autopop_context = push_context();
+    if (autopop_context) {
+      unmap_input_texture();
+    }
+  }
+
+  bool nvenc_d3d11_on_cuda::map_input_texture(CUarray &array) {
+    if (cuda_failed(cuda_functions.cuGraphicsMapResources(1, &cuda_d3d_input_texture, 0))) {
+      BOOST_LOG(error) << "NvEnc: cuGraphicsMapResources() failed: error " << last_cuda_error;
+      return false;
+    }
+    input_texture_mapped = true;
+
+    if (cuda_failed(cuda_functions.cuGraphicsSubResourceGetMappedArray(&array, cuda_d3d_input_texture, 0, 0))) {
+      BOOST_LOG(error) << "NvEnc: cuGraphicsSubResourceGetMappedArray() failed: error " << last_cuda_error;
+      unmap_input_texture();
+      return false;
+    }
+
+    return true;
+  }
+
+  bool nvenc_d3d11_on_cuda::unmap_input_texture() {
+    input_texture_mapped = false;
+    if (cuda_failed(cuda_functions.cuGraphicsUnmapResources(1, &cuda_d3d_input_texture, 0))) {
+      BOOST_LOG(error) << "NvEnc: cuGraphicsUnmapResources() failed: error " << last_cuda_error;
+      return false;
+    }
+
+    return true;
+  }
+
+  NV_ENC_REGISTERED_PTR nvenc_d3d11_on_cuda::register_input_array(CUarray array) {
+    NV_ENC_REGISTER_RESOURCE register_resource = {min_struct_version(NV_ENC_REGISTER_RESOURCE_VER, 3, 4)};
+    register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_CUDAARRAY;
+    register_resource.width = encoder_params.width;
+    register_resource.height = encoder_params.height;
+    // Planar 16-bit YUV, the width of the array in bytes
+    register_resource.pitch = encoder_params.width * 2;
+    register_resource.resourceToRegister = array;
+    register_resource.bufferFormat = encoder_params.buffer_format;
+    register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+
+    if (nvenc_failed(nvenc->nvEncRegisterResource(encoder, &register_resource))) {
+      return nullptr;
+    }
+
+    return register_resource.registeredResource;
   }
 
   bool nvenc_d3d11_on_cuda::cuda_succeeded(CUresult result) {
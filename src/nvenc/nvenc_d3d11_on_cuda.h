@@ -34,6 +34,23 @@ namespace nvenc {
 
     bool synchronize_input_buffer() override;
 
+    void release_input_buffer() override;
+
+    /**
+     * @brief Map the input texture for CUDA.
+     * @param array Set to the CUDA array of the mapped texture.
+     * @return `true` on success, `false` on error, in which case the texture is left unmapped.
+     */
+    bool map_input_texture(CUarray &array);
+
+    bool unmap_input_texture();
+
+    /**
+     * @brief Register the CUDA array of the mapped input texture with NVENC.
+     * @return The registered surface, or `nullptr` on error.
+     */
+    NV_ENC_REGISTERED_PTR register_input_array(CUarray array);
+
     bool cuda_succeeded(CUresult result);
 
     bool cuda_failed(CUresult result);
@@ -81,6 +98,13 @@ namespace nvenc {
     CUresult last_cuda_error = CUDA_SUCCESS;
     CUcontext cuda_context = nullptr;
     CUgraphicsResource cuda_d3d_input_texture = nullptr;
+    bool input_texture_mapped = false;
+
+    // With zero-copy, NVENC reads the mapped input texture itself
+    bool zero_copy = false;
+    CUarray registered_input_array = nullptr;
+
+    // Otherwise the input texture is copied into linear memory for NVENC to read
     CUdeviceptr cuda_surface = 0;
     size_t cuda_surface_pitch = 0;
   };
@@ -6,7 +6,9 @@
 
 // standard includes
 #include <cstdint>
-#include <vector>
+
+// local includes
+#include "src/buffer_pool.h"
 
 namespace nvenc {
 
@@ -14,10 +16,12 @@ namespace nvenc {
    * @brief Encoded frame.
    */
   struct nvenc_encoded_frame {
-    std::vector<uint8_t> data;
+    buffer_pool::buffer_t<uint8_t> data;
     uint64_t frame_index = 0;
     bool idr = false;
     bool after_ref_frame_invalidation = false;
+    int part_index = 0;  ///< Index of this part within the frame
+    int part_count = 1;  ///< Number of parts the frame is split into, `1` if the data holds the whole frame
   };
 
 }  // namespace nvenc
@@ -6,9 +6,17 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <format>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <system_error>
 #include <utility>
 
 // lib includes
@@ -20,6 +28,7 @@
 #include <Simple-Web-Server/server_http.hpp>
 
 // local includes
+#include "client_stats.h"
 #include "config.h"
 #include "display_device.h"
 #include "file_handler.h"
@@ -36,6 +45,12 @@
 #include "uuid.h"
 #include "video.h"
 
+#ifdef __linux__
+  #ifdef SUNSHINE_BUILD_EVDI
+    #include "platform/linux/evdi.h"
+  #endif
+#endif
+
 using namespace std::literals;
 
 namespace nvhttp {
@@ -47,8 +62,17 @@ namespace nvhttp {
 
   crypto::cert_chain_t cert_chain;
 
+  // The serialized responses of serverinfo and applist
+  response_cache_t responses;
+
+  image_cache_t app_images;
+
   class SunshineHTTPSServer: public SimpleWeb::ServerBase<SunshineHTTPS> {
   public:
+    static constexpr std::string_view SESSION_ID_CONTEXT = "sunshine-nvhttp"sv;
+    static constexpr long SESSION_CACHE_SIZE = 256;
+    static constexpr std::chrono::seconds SESSION_TIMEOUT {std::chrono::hours {1}};
+
     SunshineHTTPSServer(const std::string &certification_file, const std::string &private_key_file):
         ServerBase<SunshineHTTPS>::ServerBase(443),
         context(boost::asio::ssl::context::tls_server) {
@@ -57,9 +81,18 @@ namespace nvhttp {
       context.set_options(boost::asio::ssl::context::no_tlsv1_1);
       context.use_certificate_chain_file(certification_file);
       context.use_private_key_file(private_key_file, boost::asio::ssl::context::pem);
+
+      // Clients tend to open a new connection for each request, so let them resume their TLS session
+      // instead of going through a full handshake each time. Sessions are only resumed within the
+      // same context, and the client certificate of a resumed session is still verified by `verify`.
+      auto ctx = context.native_handle();
+      SSL_CTX_set_session_id_context(ctx, (const unsigned char *) SESSION_ID_CONTEXT.data(), SESSION_ID_CONTEXT.size());
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+      SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT.count());
     }
 
-    std::function<int(SSL *)> verify;
+    std::function<int(SSL *, const boost::asio::ip::tcp::endpoint &)> verify;
     std::function<void(std::shared_ptr<Response>, std::shared_ptr<Request>)> on_verify_failed;
 
   protected:
@@ -104,7 +137,9 @@ namespace nvhttp {
               return;
             }
             if (!ec) {
-              if (verify && !verify(session->connection->socket->native_handle())) {
+              SimpleWeb::error_code endpoint_ec;
+              auto endpoint = session->connection->socket->lowest_layer().remote_endpoint(endpoint_ec);
+              if (verify && !verify(session->connection->socket->native_handle(), endpoint)) {
                 this->write(session, on_verify_failed);
               } else {
                 this->read(session);
@@ -126,6 +161,10 @@ namespace nvhttp {
   struct conf_intern_t {
     std::string servercert;
     std::string pkey;
+
+    // Parsed once, as each pairing signs with the key and sends the signature of the certificate
+    crypto::x509_t servercert_x509;
+    crypto::pkey_t signing_key;
   } conf_intern;
 
   struct named_cert_t {
@@ -140,9 +179,27 @@ namespace nvhttp {
 
   // uniqueID, session
   std::unordered_map<std::string, pair_session_t> map_id_sess;
+
+  // Held while the paired clients or the certificates trusted for them are read or changed, requests run on several threads
+  std::mutex client_root_lock;
   client_t client_root;
   std::atomic<uint32_t> session_id_counter;
 
+  // Connections left open for longer than this launch without the statistics of their client
+  constexpr auto VERIFIED_PEER_TTL = 10min;
+
+  struct verified_peer_t {
+    std::string cert;  ///< The client certificate the connection was verified with, in PEM
+    std::chrono::steady_clock::time_point at;
+  };
+
+  // Held by launch and resume, so pending options aren't applied while another request reads the config
+  std::mutex launch_lock;
+
+  // The verified connections by their remote endpoint, so a request can tell which paired client sent it
+  std::mutex verified_peers_lock;
+  std::map<std::string, verified_peer_t> verified_peers;
+
   using args_t = SimpleWeb::CaseInsensitiveMultimap;
   using resp_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Response>;
   using req_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Request>;
@@ -166,7 +223,26 @@ namespace nvhttp {
     return it->second;
   }
 
-  void save_state() {
+  // Pairing changes are written out after this, so bursts of them are written once
+  constexpr auto STATE_FLUSH_DELAY = 500ms;
+
+  // How often the apps file is checked for changes made outside of the Web UI
+  constexpr auto APPS_FILE_POLL_INTERVAL = 1s;
+
+  struct state_flush_t {
+    // Held while writing, so snapshots reach the file in the order they were taken
+    std::mutex write_lock;
+
+    std::mutex lock;
+    std::optional<client_t> pending;
+    std::string unique_id;
+    bool scheduled = false;
+  } state_flush;
+
+  /**
+   * @brief Write the paired clients to the state file, keeping whatever else it holds.
+   */
+  static void write_state(const client_t &client, const std::string &unique_id) {
     pt::ptree root;
 
     if (fs::exists(config::nvhttp.file_state)) {
@@ -180,9 +256,7 @@ namespace nvhttp {
 
     root.erase("root"s);
 
-    root.put("root.uniqueid", http::unique_id);
-    client_t &client = client_root;
-    pt::ptree node;
+    root.put("root.uniqueid", unique_id);
 
     pt::ptree named_cert_nodes;
     for (auto &named_cert : client.named_devices) {
@@ -194,12 +268,61 @@ namespace nvhttp {
     }
     root.add_child("root.named_devices"s, named_cert_nodes);
 
+    std::ostringstream data;
     try {
-      pt::write_json(config::nvhttp.file_state, root);
+      pt::write_json(data, root);
     } catch (std::exception &e) {
       BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ": "sv << e.what();
       return;
     }
+
+    // A crash while writing must not lose every paired client
+    if (file_handler::write_file_atomic(config::nvhttp.file_state.c_str(), data.str())) {
+      BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state;
+    }
+  }
+
+  void flush_state() {
+    std::lock_guard write_lg {state_flush.write_lock};
+
+    std::optional<client_t> client;
+    std::string unique_id;
+    {
+      std::lock_guard lg {state_flush.lock};
+      state_flush.scheduled = false;
+      client = std::exchange(state_flush.pending, std::nullopt);
+      unique_id = state_flush.unique_id;
+    }
+
+    if (client) {
+      write_state(*client, unique_id);
+    }
+  }
+
+  /**
+   * @brief Write the paired clients shortly after.
+   * @details The client root lock must be held.
+   */
+  void save_state() {
+    std::lock_guard lg {state_flush.lock};
+    state_flush.pending = client_root;
+    state_flush.unique_id = http::unique_id;
+
+    // Pairing requests don't wait on the disk, the thread pool writes the latest snapshot
+    if (!std::exchange(state_flush.scheduled, true)) {
+      task_pool.pushDelayed(flush_state, STATE_FLUSH_DELAY);
+    }
+  }
+
+  /**
+   * @brief Trust the certificates of the paired clients, and only those.
+   * @details The client root lock must be held.
+   */
+  static void load_cert_chain() {
+    cert_chain.clear();
+    for (auto &named_cert : client_root.named_devices) {
+      cert_chain.add(crypto::x509(named_cert.cert));
+    }
   }
 
   void load_state() {
@@ -257,16 +380,13 @@ namespace nvhttp {
       }
     }
 
-    // Empty certificate chain and import certs from file
-    cert_chain.clear();
-    for (auto &named_cert : client.named_devices) {
-      cert_chain.add(crypto::x509(named_cert.cert));
-    }
-
+    std::lock_guard lg {client_root_lock};
     client_root = client;
+    load_cert_chain();
   }
 
   void add_authorized_client(const std::string &name, std::string &&cert) {
+    std::lock_guard lg {client_root_lock};
     client_t &client = client_root;
     named_cert_t named_cert;
     named_cert.name = name;
@@ -279,6 +399,49 @@ namespace nvhttp {
     }
   }
 
+  static std::string peer_key(const boost::asio::ip::tcp::endpoint &endpoint) {
+    return endpoint.address().to_string() + ':' + std::to_string(endpoint.port());
+  }
+
+  static void remember_verified_peer(const boost::asio::ip::tcp::endpoint &endpoint, crypto::x509_t &x509) {
+    auto cert = crypto::pem(x509);
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard lg {verified_peers_lock};
+    std::erase_if(verified_peers, [&](const auto &peer) {
+      return now - peer.second.at > VERIFIED_PEER_TTL;
+    });
+    verified_peers[peer_key(endpoint)] = {std::move(cert), now};
+  }
+
+  /**
+   * @brief Get the UUID of the paired client a request came from.
+   * @param request The request.
+   * @return The UUID, or an empty string if the client isn't known.
+   */
+  static std::string client_uuid(req_https_t request) {
+    std::string cert;
+    {
+      std::lock_guard lg {verified_peers_lock};
+      auto it = verified_peers.find(peer_key(request->remote_endpoint()));
+      if (it == std::end(verified_peers)) {
+        return {};
+      }
+      cert = it->second.cert;
+    }
+
+    // Paired certificates are stored as the client sent them, so they are compared in the same encoding
+    std::lock_guard lg {client_root_lock};
+    for (auto &named_cert : client_root.named_devices) {
+      auto x509 = crypto::x509(named_cert.cert);
+      if (x509 && crypto::pem(x509) == cert) {
+        return named_cert.uuid;
+      }
+    }
+
+    return {};
+  }
+
   std::shared_ptr<rtsp_stream::launch_session_t> make_launch_session(bool host_audio, const args_t &args) {
     auto launch_session = std::make_shared<rtsp_stream::launch_session_t>();
 
@@ -313,6 +476,12 @@ namespace nvhttp {
     launch_session->gcmap = util::from_view(get_arg(args, "gcmap", "0"));
     launch_session->enable_hdr = util::from_view(get_arg(args, "hdrMode", "0"));
 
+    // Sessions can capture other displays than the configured one, the configured one is shared with the sessions that don't pick one
+    launch_session->output_name = get_arg(args, "outputName", "");
+    if (launch_session->output_name == config::video.output_name) {
+      launch_session->output_name.clear();
+    }
+
     // Encrypted RTSP is enabled with client reported corever >= 1
     auto corever = util::from_view(get_arg(args, "corever", "0"));
     if (corever >= 1) {
@@ -337,6 +506,36 @@ namespace nvhttp {
     return launch_session;
   }
 
+  /**
+   * @brief Get the display mode requested by the client at launch.
+   * @param launch_session The launch session.
+   * @return The video configuration, with only the display mode and the display to capture filled in.
+   */
+  video::config_t launch_display_mode(const rtsp_stream::launch_session_t &launch_session) {
+    video::config_t config {};
+    config.width = launch_session.width;
+    config.height = launch_session.height;
+    config.framerate = launch_session.fps;
+    config.dynamicRange = launch_session.enable_hdr ? 1 : 0;
+    config.output_name = launch_session.output_name;
+
+    return config;
+  }
+
+  /**
+   * @brief Start connecting the EVDI virtual display, so it's ready once the client has set up the RTSP session.
+   * @param launch_session The launch session, holding the display mode requested by the client.
+   */
+  void prepare_virtual_display(const rtsp_stream::launch_session_t &launch_session) {
+#ifdef SUNSHINE_BUILD_EVDI
+    if (config::video.capture != "evdi") {
+      return;
+    }
+
+    platf::evdi_prepare_stream_async(launch_display_mode(launch_session));
+#endif
+  }
+
   void remove_session(const pair_session_t &sess) {
     map_id_sess.erase(sess.client.uniqueID);
   }
@@ -388,8 +587,7 @@ namespace nvhttp {
     std::vector<uint8_t> decrypted;
     cipher.decrypt(challenge, decrypted);
 
-    auto x509 = crypto::x509(conf_intern.servercert);
-    auto sign = crypto::signature(x509);
+    auto sign = crypto::signature(conf_intern.servercert_x509);
     auto serversecret = crypto::rand(16);
 
     decrypted.insert(std::end(decrypted), std::begin(sign), std::end(sign));
@@ -435,7 +633,7 @@ namespace nvhttp {
     sess.clienthash = std::move(decrypted);
 
     auto serversecret = sess.serversecret;
-    auto sign = crypto::sign256(crypto::pkey(conf_intern.pkey), serversecret);
+    auto sign = crypto::sign256(conf_intern.signing_key, serversecret);
 
     serversecret.insert(std::end(serversecret), std::begin(sign), std::end(sign));
 
@@ -479,10 +677,10 @@ namespace nvhttp {
 
     // if hash not correct, probably MITM
     bool same_hash = hash.size() == sess.clienthash.size() && std::equal(hash.begin(), hash.end(), sess.clienthash.begin());
-    auto verify = crypto::verify256(crypto::x509(client.cert), secret, sign);
+    auto verify = crypto::verify256(x509, secret, sign);
     if (same_hash && verify) {
       tree.put("root.paired", 1);
-      add_cert->raise(crypto::x509(client.cert));
+      add_cert->raise(std::move(x509));
 
       // The client is now successfully paired and will be authorized to connect
       add_authorized_client(client.name, std::move(client.cert));
@@ -676,57 +874,10 @@ namespace nvhttp {
     return true;
   }
 
-  template<class T>
-  void serverinfo(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
-    print_req<T>(request);
-
-    int pair_status = 0;
-    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      auto args = request->parse_query_string();
-      auto clientID = args.find("uniqueid"s);
-
-      if (clientID != std::end(args)) {
-        pair_status = 1;
-      }
-    }
-
-    auto local_endpoint = request->local_endpoint();
-
-    pt::ptree tree;
-
-    tree.put("root.<xmlattr>.status_code", 200);
-    tree.put("root.hostname", config::nvhttp.sunshine_name);
-
-    tree.put("root.appversion", VERSION);
-    tree.put("root.GfeVersion", GFE_VERSION);
-    tree.put("root.uniqueid", http::unique_id);
-    tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
-    tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
-    tree.put("root.MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
-
-    // Only include the MAC address for requests sent from paired clients over HTTPS.
-    // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
-    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_endpoint.address())));
-    } else {
-      tree.put("root.mac", "00:00:00:00:00:00");
-    }
-
-    // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
-    // always be an IPv4 address. If we return that same IPv6 address here, it will clobber the
-    // stored LAN IPv4 address. To avoid this, we need to return an IPv4 address in this field
-    // when we get a request over IPv6.
-    //
-    // HACK: We should return the IPv4 address of local interface here, but we don't currently
-    // have that implemented. For now, we will emulate the behavior of GFE+GS-IPv6-Forwarder,
-    // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
-    // support know to ignore this bogus address.
-    if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
-      tree.put("root.LocalIP", "127.0.0.1");
-    } else {
-      tree.put("root.LocalIP", net::addr_to_normalized_string(local_endpoint.address()));
-    }
-
+  /**
+   * @brief Get the codecs the encoder that was probed last supports, as `ServerCodecModeSupport` flags.
+   */
+  static uint32_t server_codec_mode_flags() {
     uint32_t codec_mode_flags = SCM_H264;
     if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
       codec_mode_flags |= SCM_H264_HIGH8_444;
@@ -755,22 +906,85 @@ namespace nvhttp {
         codec_mode_flags |= SCM_AV1_HIGH10_444;
       }
     }
-    tree.put("root.ServerCodecModeSupport", codec_mode_flags);
 
+    return codec_mode_flags;
+  }
+
+  template<class T>
+  void serverinfo(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
+    print_req<T>(request);
+
+    int pair_status = 0;
+    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+      auto args = request->parse_query_string();
+      auto clientID = args.find("uniqueid"s);
+
+      if (clientID != std::end(args)) {
+        pair_status = 1;
+      }
+    }
+
+    auto local_address = request->local_endpoint().address();
+    auto codec_mode_flags = server_codec_mode_flags();
     auto current_appid = proc::proc.running();
-    tree.put("root.PairStatus", pair_status);
-    tree.put("root.currentgame", current_appid);
-    tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
 
-    std::ostringstream data;
+    // Clients poll this constantly while they list hosts, and looking up the MAC address isn't cheap
+    auto key = std::format("serverinfo|{}|{}|{}|{}|{}", std::is_same_v<SunshineHTTPS, T>, pair_status, local_address.to_string(), codec_mode_flags, current_appid);
+    auto xml = responses.get(key, [&]() {
+      pt::ptree tree;
 
-    pt::write_xml(data, tree);
-    response->write(data.str());
+      tree.put("root.<xmlattr>.status_code", 200);
+      tree.put("root.hostname", config::nvhttp.sunshine_name);
+
+      tree.put("root.appversion", VERSION);
+      tree.put("root.GfeVersion", GFE_VERSION);
+      tree.put("root.uniqueid", http::unique_id);
+      tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
+      tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
+      tree.put("root.MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
+
+      // Only include the MAC address for requests sent from paired clients over HTTPS.
+      // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
+      if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+        tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_address)));
+      } else {
+        tree.put("root.mac", "00:00:00:00:00:00");
+      }
+
+      // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
+      // always be an IPv4 address. If we return that same IPv6 address here, it will clobber the
+      // stored LAN IPv4 address. To avoid this, we need to return an IPv4 address in this field
+      // when we get a request over IPv6.
+      //
+      // HACK: We should return the IPv4 address of local interface here, but we don't currently
+      // have that implemented. For now, we will emulate the behavior of GFE+GS-IPv6-Forwarder,
+      // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
+      // support know to ignore this bogus address.
+      if (local_address.is_v6() && !local_address.to_v6().is_v4_mapped()) {
+        tree.put("root.LocalIP", "127.0.0.1");
+      } else {
+        tree.put("root.LocalIP", net::addr_to_normalized_string(local_address));
+      }
+
+      tree.put("root.ServerCodecModeSupport", codec_mode_flags);
+
+      tree.put("root.PairStatus", pair_status);
+      tree.put("root.currentgame", current_appid);
+      tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
+
+      std::ostringstream data;
+
+      pt::write_xml(data, tree);
+      return data.str();
+    });
+
+    response->write(*xml);
     response->close_connection_after_response = true;
   }
 
   nlohmann::json get_all_clients() {
     nlohmann::json named_cert_nodes = nlohmann::json::array();
+    std::lock_guard lg {client_root_lock};
     client_t &client = client_root;
     for (auto &named_cert : client.named_devices) {
       nlohmann::json named_cert_node;
@@ -785,34 +999,38 @@ namespace nvhttp {
   void applist(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    auto xml = responses.get(std::format("applist|{}", video::active_hevc_mode), []() {
+      pt::ptree tree;
 
-    auto g = util::fail_guard([&]() {
-      std::ostringstream data;
+      auto &apps = tree.add_child("root", pt::ptree {});
 
-      pt::write_xml(data, tree);
-      response->write(data.str());
-      response->close_connection_after_response = true;
-    });
+      apps.put("<xmlattr>.status_code", 200);
 
-    auto &apps = tree.add_child("root", pt::ptree {});
+      for (auto &proc : proc::proc.get_apps()) {
+        pt::ptree app;
 
-    apps.put("<xmlattr>.status_code", 200);
+        app.put("IsHdrSupported"s, video::active_hevc_mode == 3 ? 1 : 0);
+        app.put("AppTitle"s, proc.name);
+        app.put("ID", proc.id);
 
-    for (auto &proc : proc::proc.get_apps()) {
-      pt::ptree app;
+        apps.push_back(std::make_pair("App", std::move(app)));
+      }
 
-      app.put("IsHdrSupported"s, video::active_hevc_mode == 3 ? 1 : 0);
-      app.put("AppTitle"s, proc.name);
-      app.put("ID", proc.id);
+      std::ostringstream data;
 
-      apps.push_back(std::make_pair("App", std::move(app)));
-    }
+      pt::write_xml(data, tree);
+      return data.str();
+    });
+
+    response->write(*xml);
+    response->close_connection_after_response = true;
   }
 
   void launch(bool &host_audio, resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
+    std::lock_guard launch_lg {launch_lock};
+
     pt::ptree tree;
     bool revert_display_configuration {false};
     auto g = util::fail_guard([&]() {
@@ -856,17 +1074,25 @@ namespace nvhttp {
       return;
     }
 
+    // Settings saved since the last session take effect from this one
+    config::apply_pending();
+
     host_audio = util::from_view(get_arg(args, "localAudioPlayMode"));
     auto launch_session = make_launch_session(host_audio, args);
+    launch_session->client_uuid = client_uuid(request);
 
     if (rtsp_stream::session_count() == 0) {
       // The display should be restored in case something fails as there are no other sessions.
       revert_display_configuration = true;
 
+      // Probing the encoders enumerates the displays over and over, so ask the OS once
+      const display_device::enumeration_cache_t enumeration_cache;
+
       // We want to prepare display only if there are no active sessions at
       // the moment. This should be done before probing encoders as it could
       // change the active displays.
       display_device::configure_display(config::video, *launch_session);
+      prepare_virtual_display(*launch_session);
 
       // Probe encoders again before streaming to ensure our chosen
       // encoder matches the active GPU (which could have changed
@@ -879,6 +1105,9 @@ namespace nvhttp {
 
         return;
       }
+
+      // Open the display while the client sets up the stream
+      video::warm_up_display(launch_display_mode(*launch_session));
     }
 
     auto encryption_mode = net::encryption_mode_for_address(request->remote_endpoint().address());
@@ -924,6 +1153,8 @@ namespace nvhttp {
   void resume(bool &host_audio, resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
+    std::lock_guard launch_lg {launch_lock};
+
     pt::ptree tree;
     auto g = util::fail_guard([&]() {
       std::ostringstream data;
@@ -958,6 +1189,9 @@ namespace nvhttp {
       return;
     }
 
+    // Settings saved since the last session take effect from this one
+    config::apply_pending();
+
     // Newer Moonlight clients send localAudioPlayMode on /resume too,
     // so we should use it if it's present in the args and there are
     // no active sessions we could be interfering with.
@@ -966,12 +1200,17 @@ namespace nvhttp {
       host_audio = util::from_view(get_arg(args, "localAudioPlayMode"));
     }
     const auto launch_session = make_launch_session(host_audio, args);
+    launch_session->client_uuid = client_uuid(request);
 
     if (no_active_sessions) {
+      // Probing the encoders enumerates the displays over and over, so ask the OS once
+      const display_device::enumeration_cache_t enumeration_cache;
+
       // We want to prepare display only if there are no active sessions at
       // the moment. This should be done before probing encoders as it could
       // change the active displays.
       display_device::configure_display(config::video, *launch_session);
+      prepare_virtual_display(*launch_session);
 
       // Probe encoders again before streaming to ensure our chosen
       // encoder matches the active GPU (which could have changed
@@ -984,6 +1223,9 @@ namespace nvhttp {
 
         return;
       }
+
+      // Open the display while the client sets up the stream
+      video::warm_up_display(launch_display_mode(*launch_session));
     }
 
     auto encryption_mode = net::encryption_mode_for_address(request->remote_endpoint().address());
@@ -1043,16 +1285,119 @@ namespace nvhttp {
     auto args = request->parse_query_string();
     auto app_image = proc::proc.get_app_image(util::from_view(get_arg(args, "appid")));
 
-    std::ifstream in(app_image, std::ios::binary);
+    // Clients fetch every cover again whenever they show their app grid
+    auto image = app_images.get(app_image);
+    if (!image) {
+      BOOST_LOG(warning) << "Couldn't read app image "sv << app_image;
+      response->write(SimpleWeb::StatusCode::client_error_not_found);
+      return;
+    }
+
     SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("ETag", image->etag);
+    headers.emplace("Cache-Control", "no-cache");
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != std::end(request->header) && etag_matches(if_none_match->second, image->etag)) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
     headers.emplace("Content-Type", "image/png");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
-    response->close_connection_after_response = true;
+    response->write(SimpleWeb::StatusCode::success_ok, image->data, headers);
+  }
+
+  image_cache_t::image_cache_t(std::size_t max_bytes):
+      _max_bytes {max_bytes} {
+  }
+
+  std::shared_ptr<const image_cache_t::image_t> image_cache_t::get(const fs::path &path) {
+    std::error_code ec;
+    auto modified = fs::last_write_time(path, ec);
+    auto size = ec ? 0 : fs::file_size(path, ec);
+    if (ec) {
+      return nullptr;
+    }
+
+    {
+      std::lock_guard lg {_lock};
+      auto it = _entries.find(path);
+      if (it != std::end(_entries) && it->second.modified == modified && it->second.size == size) {
+        it->second.last_used = ++_uses;
+        return it->second.image;
+      }
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      return nullptr;
+    }
+
+    auto image = std::make_shared<image_t>();
+    image->data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    image->etag = '"' + util::hex(crypto::hash(image->data), true).to_string() + '"';
+
+    std::lock_guard lg {_lock};
+    auto &entry = _entries[path];
+    _bytes -= entry.image ? entry.image->data.size() : 0;
+    entry = {modified, size, image, ++_uses};
+    _bytes += image->data.size();
+
+    // Drop the least recently used images, but always keep the one just read
+    while (_bytes > _max_bytes && _entries.size() > 1) {
+      auto oldest = std::min_element(std::begin(_entries), std::end(_entries), [](const auto &a, const auto &b) {
+        return a.second.last_used < b.second.last_used;
+      });
+      _bytes -= oldest->second.image->data.size();
+      _entries.erase(oldest);
+    }
+
+    return image;
+  }
+
+  bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+    auto strip_weak = [](std::string_view tag) {
+      return tag.starts_with("W/"sv) ? tag.substr(2) : tag;
+    };
+    etag = strip_weak(etag);
+
+    while (!if_none_match.empty()) {
+      auto end = if_none_match.find(',');
+      auto tag = if_none_match.substr(0, end);
+      if_none_match = end == std::string_view::npos ? std::string_view {} : if_none_match.substr(end + 1);
+
+      auto first = tag.find_first_not_of(" \t"sv);
+      if (first == std::string_view::npos) {
+        continue;
+      }
+      tag = tag.substr(first, tag.find_last_not_of(" \t"sv) - first + 1);
+
+      if (tag == "*"sv || strip_weak(tag) == etag) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void refresh_apps() {
+    apps_changed(proc::refresh(config::stream.file_apps));
+  }
+
+  void apps_changed(const std::optional<std::set<std::string>> &changed) {
+    if (!changed || changed->empty()) {
+      return;
+    }
+
+    BOOST_LOG(info) << "Apps changed: "sv << changed->size() << " added, changed or removed"sv;
+    responses.invalidate("applist|"sv);
   }
 
   void setup(const std::string &pkey, const std::string &cert) {
     conf_intern.pkey = pkey;
     conf_intern.servercert = cert;
+    conf_intern.servercert_x509 = crypto::x509(cert);
+    conf_intern.signing_key = crypto::pkey(pkey);
   }
 
   void start() {
@@ -1068,6 +1413,12 @@ namespace nvhttp {
       load_state();
     }
 
+    if (http::wait_for_creds()) {
+      BOOST_LOG(fatal) << "Couldn't create the credentials of the host"sv;
+      shutdown_event->raise(true);
+      return;
+    }
+
     auto pkey = file_handler::read_file(config::nvhttp.pkey.c_str());
     auto cert = file_handler::read_file(config::nvhttp.cert.c_str());
     setup(pkey, cert);
@@ -1081,8 +1432,11 @@ namespace nvhttp {
     https_server_t https_server {config::nvhttp.cert, config::nvhttp.pkey};
     http_server_t http_server;
 
+    // Declared after the servers, so the requests left are done before the servers are destroyed
+    http::workers_t workers {config::nvhttp.worker_threads, metrics::nvhttp_workers};
+
     // Verify certificates after establishing connection
-    https_server.verify = [add_cert](SSL *ssl) {
+    https_server.verify = [add_cert](SSL *ssl, const boost::asio::ip::tcp::endpoint &endpoint) {
       crypto::x509_t x509 {
 #if OPENSSL_VERSION_MAJOR >= 3
         SSL_get1_peer_certificate(ssl)
@@ -1105,6 +1459,7 @@ namespace nvhttp {
         BOOST_LOG(debug) << subject_name << " -- "sv << (verified ? "verified"sv : "denied"sv);
       });
 
+      std::unique_lock client_root_lg {client_root_lock};
       while (add_cert->peek()) {
         char subject_name[256];
 
@@ -1116,6 +1471,7 @@ namespace nvhttp {
       }
 
       auto err_str = cert_chain.verify(x509.get());
+      client_root_lg.unlock();
       if (err_str) {
         BOOST_LOG(warning) << "SSL Verification error :: "sv << err_str;
 
@@ -1123,6 +1479,7 @@ namespace nvhttp {
       }
 
       verified = 1;
+      remember_verified_peer(endpoint, x509);
 
       return verified;
     };
@@ -1147,8 +1504,8 @@ namespace nvhttp {
     https_server.resource["^/pair$"]["GET"] = [&add_cert](auto resp, auto req) {
       pair<SunshineHTTPS>(add_cert, resp, req);
     };
-    https_server.resource["^/applist$"]["GET"] = applist;
-    https_server.resource["^/appasset$"]["GET"] = appasset;
+    https_server.resource["^/applist$"]["GET"] = workers.handler(applist);
+    https_server.resource["^/appasset$"]["GET"] = workers.handler(appasset);
     https_server.resource["^/launch$"]["GET"] = [&host_audio](auto resp, auto req) {
       launch(host_audio, resp, req);
     };
@@ -1188,8 +1545,12 @@ namespace nvhttp {
     std::thread ssl {accept_and_run, &https_server};
     std::thread tcp {accept_and_run, &http_server};
 
-    // Wait for any event
-    shutdown_event->view();
+    // Wait for any event, picking up the changes made to the apps file meanwhile
+    while (!shutdown_event->view(APPS_FILE_POLL_INTERVAL)) {
+      if (proc::changed_since_refresh(config::stream.file_apps)) {
+        refresh_apps();
+      }
+    }
 
     https_server.stop();
     http_server.stop();
@@ -1199,14 +1560,17 @@ namespace nvhttp {
   }
 
   void erase_all_clients() {
+    std::lock_guard lg {client_root_lock};
     client_t client;
     client_root = client;
     cert_chain.clear();
     save_state();
+    client_stats::erase(client_stats::default_file(), {});
   }
 
   bool unpair_client(const std::string_view uuid) {
     bool removed = false;
+    std::unique_lock lg {client_root_lock};
     client_t &client = client_root;
     for (auto it = client.named_devices.begin(); it != client.named_devices.end();) {
       if ((*it).uuid == uuid) {
@@ -1218,7 +1582,12 @@ namespace nvhttp {
     }
 
     save_state();
-    load_state();
+    load_cert_chain();
+    lg.unlock();
+
+    if (removed) {
+      client_stats::erase(client_stats::default_file(), uuid);
+    }
     return removed;
   }
 }  // namespace nvhttp
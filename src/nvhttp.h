@@ -6,7 +6,16 @@
 #pragma once
 
 // standard includes
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <string>
+#include <string_view>
 
 // lib includes
 #include <boost/property_tree/ptree.hpp>
@@ -59,6 +68,177 @@ namespace nvhttp {
    */
   void setup(const std::string &pkey, const std::string &cert);
 
+  /**
+   * @brief Write pairing changes that are still waiting to be written to the state file.
+   * @details Pairing changes are written from the thread pool shortly after they're made. This must
+   *          be called before the thread pool stops, or the last changes could be lost.
+   * @examples
+   * nvhttp::flush_state();
+   * @examples_end
+   */
+  void flush_state();
+
+  /**
+   * @brief Keeps serialized responses of the endpoints clients poll, so polling doesn't rebuild them.
+   * @details Entries are keyed by whatever a response depends on that's cheap to look up on each request.
+   *          Anything else it depends on has to call `invalidate()` when it changes.
+   * @note This is thread-safe.
+   */
+  class response_cache_t {
+  public:
+    static constexpr std::size_t MAX_ENTRIES = 32;
+
+    /**
+     * @brief Get a response, building it if it isn't cached or was invalidated since.
+     * @param key Everything the response depends on, besides what invalidates the cache.
+     * @param build The function building the response on a miss.
+     * @return The response.
+     */
+    template<class F>
+    std::shared_ptr<const std::string> get(const std::string &key, F &&build) {
+      auto generation = _generation.load(std::memory_order_acquire);
+
+      std::uint64_t build_id;
+      {
+        std::lock_guard lg {_lock};
+        auto it = _entries.find(key);
+        if (it != std::end(_entries) && it->second.response && it->second.generation == generation) {
+          ++_hits;
+          return it->second.response;
+        }
+        ++_misses;
+
+        if (_entries.size() >= MAX_ENTRIES) {
+          _entries.clear();
+        }
+        build_id = ++_builds;
+        _entries[key] = {generation, nullptr, build_id};
+      }
+
+      // If the cache is invalidated while building, the response is stale and won't be served again
+      auto response = std::make_shared<const std::string>(build());
+
+      std::lock_guard lg {_lock};
+      auto it = _entries.find(key);
+      if (it != std::end(_entries) && it->second.build_id == build_id) {
+        it->second.response = response;
+      }
+
+      return response;
+    }
+
+    /**
+     * @brief Let every cached response be built again the next time it's requested.
+     */
+    void invalidate() {
+      _generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief Let the cached responses whose key starts with a prefix be built again the next time they're requested.
+     * @param prefix The start of the keys of the responses.
+     */
+    void invalidate(std::string_view prefix) {
+      std::lock_guard lg {_lock};
+      std::erase_if(_entries, [prefix](const auto &entry) {
+        return entry.first.starts_with(prefix);
+      });
+    }
+
+    std::uint64_t hits() {
+      std::lock_guard lg {_lock};
+      return _hits;
+    }
+
+    std::uint64_t misses() {
+      std::lock_guard lg {_lock};
+      return _misses;
+    }
+
+  private:
+    struct entry_t {
+      std::uint64_t generation;
+      std::shared_ptr<const std::string> response;  ///< Empty until the response is built
+      std::uint64_t build_id;
+    };
+
+    std::atomic<std::uint64_t> _generation {0};
+    std::mutex _lock;
+    std::map<std::string, entry_t> _entries;
+    std::uint64_t _builds = 0;
+    std::uint64_t _hits = 0;
+    std::uint64_t _misses = 0;
+  };
+
+  /**
+   * @brief Keeps the app images clients fetch whenever they show their app grid.
+   * @details Images are read again once their file changes, and the least recently used ones are
+   *          dropped once they take more than `MAX_BYTES` together.
+   * @note This is thread-safe.
+   */
+  class image_cache_t {
+  public:
+    static constexpr std::size_t MAX_BYTES = 32 * 1024 * 1024;
+
+    struct image_t {
+      std::string data;
+      std::string etag;  ///< A strong entity tag, quoted
+    };
+
+    /**
+     * @param max_bytes The most bytes of images to keep.
+     */
+    explicit image_cache_t(std::size_t max_bytes = MAX_BYTES);
+
+    /**
+     * @brief Get an image, reading it if it isn't cached or its file changed since.
+     * @param path The path of the image.
+     * @return The image, or `nullptr` if it can't be read.
+     */
+    std::shared_ptr<const image_t> get(const std::filesystem::path &path);
+
+  private:
+    struct entry_t {
+      std::filesystem::file_time_type modified;
+      std::uintmax_t size;
+      std::shared_ptr<const image_t> image;
+      std::uint64_t last_used;
+    };
+
+    std::mutex _lock;
+    std::map<std::filesystem::path, entry_t> _entries;
+    std::size_t _max_bytes;
+    std::size_t _bytes = 0;
+    std::uint64_t _uses = 0;
+  };
+
+  /**
+   * @brief Check whether an `If-None-Match` header matches an entity tag.
+   * @details Uses the weak comparison RFC 9110 asks for, so `W/` prefixes are ignored.
+   * @param if_none_match The value of the header, a list of entity tags or `*`.
+   * @param etag The quoted entity tag of the resource.
+   * @return `true` if the client already has the resource.
+   */
+  bool etag_matches(std::string_view if_none_match, std::string_view etag);
+
+  /**
+   * @brief Parse the apps file again, and let the cached `applist` responses be built again if any app changed.
+   * @details The app images are cached by file, so they are read again once their file changes.
+   * @examples
+   * nvhttp::refresh_apps();
+   * @examples_end
+   */
+  void refresh_apps();
+
+  /**
+   * @brief Let the cached `applist` responses be built again if any app changed.
+   * @param changed The IDs of the apps added, changed or removed, as `proc::refresh()` and `proc::edit_apps()` return them.
+   * @examples
+   * nvhttp::apps_changed(proc::edit_apps(config::stream.file_apps, edit));
+   * @examples_end
+   */
+  void apps_changed(const std::optional<std::set<std::string>> &changed);
+
   class SunshineHTTPS: public SimpleWeb::HTTPS {
   public:
     SunshineHTTPS(boost::asio::io_context &io_context, boost::asio::ssl::context &ctx):
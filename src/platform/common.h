@@ -9,6 +9,7 @@
 #include <filesystem>
 #include <functional>
 #include <mutex>
+#include <span>
 #include <string>
 
 // lib includes
@@ -69,6 +70,10 @@ namespace nvenc {
   class nvenc_base;
 }
 
+namespace vt {
+  class vt_encoder;
+}
+
 namespace platf {
   // Limited by bits in activeGamepadMask
   constexpr auto MAX_GAMEPADS = 16;
@@ -288,6 +293,8 @@ namespace platf {
     std::int16_t lsY;
     std::int16_t rsX;
     std::int16_t rsY;
+
+    bool operator==(const gamepad_state_t &) const = default;
   };
 
   struct gamepad_id_t {
@@ -362,6 +369,19 @@ namespace platf {
     virtual ~deinit_t() = default;
   };
 
+  /**
+   * @brief A cursor the capture keeps out of the pixels, for the encode device to blend in while converting.
+   */
+  struct cursor_sprite_t {
+    // BGRA, with straight alpha
+    std::vector<std::uint8_t> pixels;
+    std::int32_t width;
+    std::int32_t height;
+
+    // Changes along with the pixels, so they're only uploaded once
+    std::uint64_t serial;
+  };
+
   struct img_t: std::enable_shared_from_this<img_t> {
   public:
     img_t() = default;
@@ -379,6 +399,12 @@ namespace platf {
 
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
 
+    // Where the mouse cursor is on the image, if it's visible and the capture backend knows
+    std::optional<util::point_t> cursor;
+
+    // The cursor to blend in with its top left corner at `cursor`, if the capture backend doesn't draw it
+    std::shared_ptr<const cursor_sprite_t> cursor_sprite;
+
     virtual ~img_t() = default;
   };
 
@@ -452,6 +478,12 @@ namespace platf {
     nvenc::nvenc_base *nvenc = nullptr;
   };
 
+  struct vt_encode_device_t: encode_device_t {
+    virtual bool init_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace) = 0;
+
+    vt::vt_encoder *vt = nullptr;
+  };
+
   enum class capture_e : int {
     ok,  ///< Success
     reinit,  ///< Need to reinitialize
@@ -511,6 +543,10 @@ namespace platf {
       return nullptr;
     }
 
+    virtual std::unique_ptr<vt_encode_device_t> make_vt_encode_device(pix_fmt_e pix_fmt) {
+      return nullptr;
+    }
+
     virtual bool is_hdr() {
       return false;
     }
@@ -530,6 +566,26 @@ namespace platf {
       return true;
     }
 
+    /**
+     * @brief Check whether captured images hold their pixels in system memory.
+     * @details The pixels of these images can be read through `img_t::data`, `img_t::row_pitch` and `img_t::pixel_pitch`.
+     * @return `true` if the pixels are in system memory, `false` otherwise.
+     */
+    virtual bool img_in_system_memory() {
+      return false;
+    }
+
+    /**
+     * @brief Try to capture again after `capture_e::reinit`, without opening the display again.
+     * @details This only reacquires what the capture was lost for, like the desktop duplication. The images
+     *          allocated before stay valid, so the mode and the format of the display must not have changed.
+     * @param config The config the display was opened with.
+     * @return `true` if capture can continue with this display, `false` if it must be opened again.
+     */
+    virtual bool reacquire(const ::video::config_t &config) {
+      return false;
+    }
+
     virtual ~display_t() = default;
 
     // Offsets for when streaming a specific monitor. By default, they are 0.
@@ -609,6 +665,13 @@ namespace platf {
    */
   bool needs_encoder_reenumeration();
 
+  /**
+   * @brief Describe the GPUs and their drivers.
+   * @details This is used to tell when persisted encoder probe results may no longer be accurate.
+   * @return A string that changes when a GPU or driver changes.
+   */
+  std::string gpu_fingerprint();
+
   boost::process::v1::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const boost::process::v1::environment &env, FILE *file, std::error_code &ec, boost::process::v1::group *group);
 
   enum class thread_priority_e : int {
@@ -619,6 +682,133 @@ namespace platf {
   };
   void adjust_thread_priority(thread_priority_e priority);
 
+  /**
+   * @brief A logical CPU the scheduler can run threads on.
+   */
+  struct cpu_t {
+    int id;  ///< The number of the CPU in thread affinity masks
+    int core;  ///< The physical core, shared by SMT siblings
+    int cache;  ///< The last level cache, shared by the cores of a CCD or cluster
+    bool efficiency;  ///< Whether this is an efficiency core of a hybrid CPU
+    int node = 0;  ///< The NUMA node, which is the socket on most multi-socket servers
+  };
+
+  /**
+   * @brief Describe the CPUs of the system.
+   * @return The online CPUs, ordered by id.
+   */
+  std::vector<cpu_t> cpu_topology();
+
+  /**
+   * @brief Get the NUMA node a GPU is attached to.
+   * @param adapter_name The adapter from the configuration, empty for the default one.
+   * @return The node, or std::nullopt if the system doesn't tell.
+   */
+  std::optional<int> gpu_numa_node(const std::string &adapter_name);
+
+  /**
+   * @brief Get the NUMA node of the network interface with a local address.
+   * @param address The local address, in normalized form.
+   * @return The node, or std::nullopt if the system doesn't tell.
+   */
+  std::optional<int> interface_numa_node(const std::string_view &address);
+
+  /**
+   * @brief Restrict the calling thread to some CPUs.
+   * @details On macOS, where threads can't be pinned, this only asks the scheduler to favor
+   *          efficiency cores if every CPU is one, and performance cores otherwise.
+   * @param cpus The ids of the CPUs.
+   * @return true on success.
+   */
+  bool set_thread_affinity(const std::vector<int> &cpus);
+
+  /**
+   * @brief Get the CPUs the calling thread may run on.
+   * @return The ids of the CPUs, empty if the system doesn't tell.
+   */
+  std::vector<int> thread_affinity();
+
+  /**
+   * @brief Run the calling thread with a real-time scheduling policy.
+   * @details On Linux, the thread gets SCHED_FIFO if the process may set it, and SCHED_RR from rtkit otherwise.
+   *          A watchdog demotes real-time threads back to the normal policy if they keep a CPU without blocking,
+   *          so a thread stuck in a loop can't lock up the system. Other systems don't let unprivileged processes
+   *          use real-time policies, so nothing changes there.
+   * @param priority The real-time priority, from 1, lowered to the highest the system grants.
+   * @return true if the thread now runs with a real-time policy.
+   */
+  bool set_thread_realtime(int priority);
+
+  /**
+   * @brief The CPU time and scheduling of a thread so far.
+   * @details The fields the system doesn't tell are std::nullopt.
+   */
+  struct thread_times_t {
+    std::chrono::nanoseconds cpu_time;  ///< Time spent running, in user and kernel mode
+    std::optional<std::chrono::nanoseconds> run_delay;  ///< Time spent ready to run but waiting for a CPU
+    std::optional<std::uint64_t> voluntary_switches;  ///< Times the thread gave up its CPU to wait for something
+    std::optional<std::uint64_t> involuntary_switches;  ///< Times the thread was preempted
+    std::optional<std::uint64_t> cycles;  ///< CPU cycles spent running
+    std::optional<int> realtime_priority;  ///< The real-time priority, 0 with a normal scheduling policy
+  };
+
+  /**
+   * @brief A thread that can be sampled from any other thread.
+   */
+  class thread_handle_t {
+  public:
+    virtual ~thread_handle_t() = default;
+
+    /**
+     * @brief Sample the thread.
+     * @return The times of the thread, or std::nullopt if it can't be sampled anymore, such as after it exited.
+     */
+    virtual std::optional<thread_times_t> times() = 0;
+  };
+
+  /**
+   * @brief Get a handle to the calling thread.
+   * @return The handle, or nullptr if the threads of this system can't be sampled.
+   */
+  std::unique_ptr<thread_handle_t> current_thread();
+
+  /**
+   * @brief Anonymous memory mapped outside of the general heap.
+   */
+  struct pages_t {
+    std::uint8_t *data;  ///< The first byte, aligned to a huge page where the system has them
+    std::size_t size;  ///< The size of the mapping
+    bool huge;  ///< Whether the mapping is backed by huge or large pages
+    bool locked;  ///< Whether the mapping is locked in memory
+  };
+
+  /**
+   * @brief Map memory for buffers touched on every frame.
+   * @details The mapping is backed by huge pages where possible: transparent huge pages on Linux,
+   *          large pages on Windows when the user holds the "Lock pages in memory" privilege.
+   *          Its pages are faulted in up front, so using them later doesn't fault.
+   * @param size The minimum size of the mapping.
+   * @param lock Whether to lock the mapping in memory, so it's never paged out.
+   * @return The mapping, or std::nullopt on failure.
+   */
+  std::optional<pages_t> map_pages(std::size_t size, bool lock);
+
+  /**
+   * @brief Unmap memory mapped by `map_pages()`.
+   * @param pages The mapping.
+   */
+  void unmap_pages(const pages_t &pages);
+
+  struct page_faults_t {
+    std::uint64_t minor;  ///< Faults served without I/O, Windows counts every fault here
+    std::uint64_t major;  ///< Faults that had to read from disk
+  };
+
+  /**
+   * @brief Get the number of page faults of the process so far.
+   */
+  page_faults_t page_faults();
+
   // Allow OS-specific actions to be taken to prepare for streaming
   void streaming_will_start();
   void streaming_will_stop();
@@ -664,7 +854,7 @@ namespace platf {
     // One or more data buffers to use for the payloads
     //
     // NB: Data buffers must be aligned to payload size!
-    std::vector<buffer_descriptor_t> &payload_buffers;
+    std::span<const buffer_descriptor_t> payload_buffers;
     size_t payload_size;
 
     // The offset (in header+payload message blocks) in the header and payload
@@ -679,6 +869,12 @@ namespace platf {
     uint16_t target_port;
     boost::asio::ip::address &source_address;
 
+    // If not 0, the blocks are sent in messages of this many blocks, each stamped with the time
+    // to leave at, starting at `txtime` and `txtime_interval` apart. See `enable_socket_txtime()`.
+    size_t txtime_blocks = 0;
+    std::chrono::steady_clock::time_point txtime {};
+    std::chrono::nanoseconds txtime_interval {};
+
     /**
      * @brief Returns a payload buffer descriptor for the given payload offset.
      * @param offset The offset in the total payload data (bytes).
@@ -701,6 +897,50 @@ namespace platf {
 
   bool send_batch(batched_send_info_t &send_info);
 
+  /**
+   * @brief Let the kernel hold back packets sent on a socket until their launch time.
+   * @details Launch times are on `std::chrono::steady_clock`. They're only supported on Linux,
+   *          and only honored by the `fq` qdisc. Other qdiscs send the packets right away.
+   * @param native_socket The native socket handle.
+   * @return `true` if `send_batch()` may be given launch times for this socket.
+   */
+  bool enable_socket_txtime(std::uintptr_t native_socket);
+
+  struct batched_recv_info_t {
+    std::uintptr_t native_socket;
+
+    // `count` buffers of `buffer_size` bytes each, one per datagram
+    char *buffers;
+    std::size_t buffer_size;
+    std::size_t count;
+
+    // Filled with the size and sender of each datagram received
+    std::size_t *sizes;
+    boost::asio::ip::udp::endpoint *peers;
+
+    // If set, filled with the time each datagram was received. See `enable_socket_rx_timestamps()`.
+    std::chrono::steady_clock::time_point *receive_times = nullptr;
+  };
+
+  /**
+   * @brief Let the kernel timestamp datagrams as they arrive on a socket.
+   * @details Without kernel timestamps, `recv_batch()` stamps datagrams with the time they're read,
+   *          which adds the scheduling delay of the receiving thread. They're only supported on Linux.
+   * @param native_socket The native socket handle.
+   * @return `true` if the receive times given by `recv_batch()` come from the kernel.
+   */
+  bool enable_socket_rx_timestamps(std::uintptr_t native_socket);
+
+  /**
+   * @brief Receive the datagrams that are ready on a socket, without blocking.
+   * @details On Linux and FreeBSD the whole batch is received with a single `recvmmsg()`.
+   *          Elsewhere datagrams are received one by one until none are left.
+   *          Datagrams larger than a buffer are truncated.
+   * @param recv_info The buffers to receive into.
+   * @return The number of datagrams received, or -1 on error.
+   */
+  int recv_batch(batched_recv_info_t &recv_info);
+
   struct send_info_t {
     const char *header;
     size_t header_size;
@@ -715,6 +955,14 @@ namespace platf {
 
   bool send(send_info_t &send_info);
 
+  /**
+   * @brief Open a UDP socket for the video or audio stream with a platform specific send path.
+   * @details On Windows, this opens the socket for Registered I/O when it's enabled.
+   * @param v6 Whether to open an IPv6 socket rather than an IPv4 one.
+   * @return The native socket, or `std::nullopt` to open a regular socket.
+   */
+  std::optional<std::uintptr_t> open_stream_socket(bool v6);
+
   enum class qos_data_type_e : int {
     audio,  ///< Audio
     video  ///< Video
@@ -730,6 +978,44 @@ namespace platf {
    */
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging);
 
+  /**
+   * @brief Get the path MTU to a destination, as the system knows it.
+   * @details Nothing is sent, this is the MTU of the route to the destination, lowered by the
+   *          "fragmentation needed" ICMP messages the system got for it so far.
+   * @param address The destination address, which may be an IPv4 address mapped into IPv6.
+   * @param port The destination port.
+   * @return The MTU in bytes, counting the IP and UDP headers, or std::nullopt if the system doesn't tell.
+   */
+  std::optional<int> path_mtu(const boost::asio::ip::address &address, uint16_t port);
+
+  /**
+   * @brief Waits for a socket to become readable, or for another thread to have something to send on it.
+   */
+  class socket_waiter_t {
+  public:
+    virtual ~socket_waiter_t() = default;
+
+    /**
+     * @brief Wait until the socket is readable, `wake()` was called or the timeout expired.
+     * @details A call to `wake()` since the last wait makes the next one return right away.
+     * @param timeout The longest time to wait.
+     */
+    virtual void wait(std::chrono::milliseconds timeout) = 0;
+
+    /**
+     * @brief Wake the waiting thread up. This may be called from any thread.
+     */
+    virtual void wake() = 0;
+  };
+
+  /**
+   * @brief Create a waiter for a socket.
+   * @details On Linux this waits with an eventfd, on macOS with a pipe and on Windows with WinSock event objects.
+   * @param native_socket The native socket handle, which must be non-blocking.
+   * @return The waiter, or `nullptr` on error.
+   */
+  std::unique_ptr<socket_waiter_t> make_socket_waiter(std::uintptr_t native_socket);
+
   /**
    * @brief Open a url in the default web browser.
    * @param url The url to open.
@@ -769,6 +1055,22 @@ namespace platf {
   void gamepad_update(input_t &input, int nr, const gamepad_state_t &gamepad_state);
   void unicode(input_t &input, char *utf8, int size);
 
+  /**
+   * @brief Start collecting the mouse and keyboard events injected on this thread.
+   * @details On platforms where each injection is a separate call into the OS, the events are
+   *          collected and injected in order with as few calls as possible by `end_input_batch()`.
+   *          Other kinds of input flush the collected events before they're injected, so the
+   *          order of events is kept.
+   * @param input The input_t instance to use.
+   */
+  void begin_input_batch(input_t &input);
+
+  /**
+   * @brief Inject the events collected since `begin_input_batch()`.
+   * @param input The input_t instance to use.
+   */
+  void end_input_batch(input_t &input);
+
   typedef deinit_t client_input_t;
 
   /**
@@ -779,12 +1081,12 @@ namespace platf {
   std::unique_ptr<client_input_t> allocate_client_input_context(input_t &input);
 
   /**
-   * @brief Send a touch event to the OS.
+   * @brief Send a frame of touch events to the OS, in a single injection where the OS allows it.
    * @param input The client-specific input context.
    * @param touch_port The current viewport for translating to screen coordinates.
-   * @param touch The touch event.
+   * @param touches The touch events, in the order the client sent them.
    */
-  void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch);
+  void touch_update(client_input_t *input, const touch_port_t &touch_port, std::span<const touch_input_t> touches);
 
   /**
    * @brief Send a pen event to the OS.
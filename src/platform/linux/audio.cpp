@@ -19,6 +19,10 @@
 #include "src/platform/common.h"
 #include "src/thread_safe.h"
 
+#ifdef SUNSHINE_BUILD_PIPEWIRE
+  #include "pipewire_audio.h"
+#endif
+
 namespace platf {
   using namespace std::literals;
 
@@ -456,6 +460,14 @@ namespace platf {
           sink_name = get_default_sink_name();
         }
 
+#ifdef SUNSHINE_BUILD_PIPEWIRE
+        // PipeWire captures the sink directly instead of through the PulseAudio compatibility layer
+        if (auto mic = pipewire::microphone(mapping, channels, sample_rate, frame_size, sink_name)) {
+          return mic;
+        }
+        BOOST_LOG(info) << "Falling back to PulseAudio for audio capture"sv;
+#endif
+
         return ::platf::microphone(mapping, channels, sample_rate, frame_size, get_monitor_name(sink_name));
       }
 
@@ -22,6 +22,7 @@ extern "C" {
 #include "cuda.h"
 #include "graphics.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/utility.h"
 #include "src/video.h"
 #include "wayland.h"
@@ -84,6 +85,7 @@ namespace cuda {
   class img_t: public platf::img_t {
   public:
     tex_t tex;
+    metrics::gpu_allocation_t tex_memory;
   };
 
   int init() {
@@ -120,8 +122,9 @@ namespace cuda {
       this->frame = frame;
 
       auto hwframe_ctx = (AVHWFramesContext *) hw_frames_ctx->data;
-      if (hwframe_ctx->sw_format != AV_PIX_FMT_NV12) {
-        BOOST_LOG(error) << "cuda::cuda_t doesn't support any format other than AV_PIX_FMT_NV12"sv;
+      auto format = format_from_sw_format(hwframe_ctx->sw_format);
+      if (!format) {
+        BOOST_LOG(error) << "cuda::cuda_t doesn't support "sv << av_get_pix_fmt_name(hwframe_ctx->sw_format);
         return -1;
       }
 
@@ -141,15 +144,13 @@ namespace cuda {
 
       cuda_ctx->stream = stream.get();
 
-      auto sws_opt = sws_t::make(width, height, frame->width, frame->height, width * 4);
+      auto sws_opt = sws_t::make(width, height, frame->width, frame->height, width * 4, *format);
       if (!sws_opt) {
         return -1;
       }
 
       sws = std::move(*sws_opt);
 
-      linear_interpolation = width != frame->width || height != frame->height;
-
       return 0;
     }
 
@@ -178,52 +179,86 @@ namespace cuda {
         return;
       }
 
-      sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex->texture.linear, stream.get(), {frame->width, frame->height, 0, 0});
+      sws.convert(planes(), *tex, stream.get(), {frame->width, frame->height, 0, 0});
+    }
+
+    static std::optional<format_e> format_from_sw_format(AVPixelFormat sw_format) {
+      switch (sw_format) {
+        case AV_PIX_FMT_NV12:
+          return format_e::nv12;
+        case AV_PIX_FMT_P010:
+          return format_e::p010;
+        case AV_PIX_FMT_YUV444P:
+          return format_e::yuv444;
+        case AV_PIX_FMT_YUV444P16:
+          return format_e::yuv444p16;
+        default:
+          return std::nullopt;
+      }
+    }
+
+    planes_t planes() const {
+      return {
+        {frame->data[0], frame->data[1], frame->data[2]},
+        {(std::uint32_t) frame->linesize[0], (std::uint32_t) frame->linesize[1], (std::uint32_t) frame->linesize[2]},
+      };
     }
 
-    cudaTextureObject_t tex_obj(const tex_t &tex) const {
-      return linear_interpolation ? tex.texture.linear : tex.texture.point;
+    /**
+     * @brief Log the GPU time of the conversion kernels, as they complete.
+     */
+    void log_kernel_time() {
+      if (auto ms = sws.take_kernel_time(); ms >= 0) {
+        kernel_time_logger.collect_and_log(ms);
+      }
     }
 
+    logging::percentile_periodic_logger<double> kernel_time_logger {debug, "CUDA: RGBA_to_YUV kernel time", "ms"};
+
     stream_t stream;
     frame_t hwframe;
 
     int width, height;
 
-    // When height and width don't change, it's not necessary to use linear interpolation
-    bool linear_interpolation;
-
     sws_t sws;
   };
 
   class cuda_ram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
-      return sws.load_ram(img, tex.array) || sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(tex), stream.get());
-    }
-
-    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
-      if (cuda_t::set_frame(frame, hw_frames_ctx)) {
-        return -1;
+      auto &sprite = img.cursor_sprite;
+      if (sprite && img.cursor) {
+        sws.set_cursor(sprite->pixels.data(), sprite->width, sprite->height, sprite->serial, img.cursor->x, img.cursor->y);
+      } else {
+        sws.set_cursor(nullptr, 0, 0, 0, 0, 0);
       }
 
-      auto tex_opt = tex_t::make(height, width * 4);
-      if (!tex_opt) {
+      if (sws.convert_async(planes(), img, stream.get(), sws.viewport)) {
         return -1;
       }
 
-      tex = std::move(*tex_opt);
-
+      log_kernel_time();
       return 0;
     }
 
-    tex_t tex;
+    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
+      if (cuda_t::set_frame(frame, hw_frames_ctx)) {
+        return -1;
+      }
+
+      return sws.init_pipeline(height, width * 4);
+    }
   };
 
   class cuda_vram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
-      return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(((img_t *) &img)->tex), stream.get());
+      if (sws.convert(planes(), ((img_t *) &img)->tex, stream.get())) {
+        return -1;
+      }
+
+      log_kernel_time();
+      return 0;
     }
   };
 
@@ -383,22 +418,18 @@ namespace cuda {
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
         rgb = egl::create_blank(img);
+        source = &rgb;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        source = imports.import(display.get(), descriptor.sd);
+        if (!source) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
       // Perform the color conversion and scaling in GL
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*source)->tex[0]);
       sws.convert(nv12->buf);
 
       auto fmt_desc = av_pix_fmt_desc_get(sw_format);
@@ -452,6 +483,10 @@ namespace cuda {
     std::uint64_t sequence;
     egl::rgb_t rgb;
 
+    // Captured buffers are imported once, the image of the last one keeps being converted until the next capture
+    egl::import_cache_t imports;
+    egl::rgb_t *source = nullptr;
+
     registered_resource_t y_res;
     registered_resource_t uv_res;
 
@@ -735,8 +770,6 @@ namespace cuda {
         capture_params.eCaptureType = NVFBC_CAPTURE_SHARED_CUDA;
         capture_params.bDisableAutoModesetRecovery = nv_bool(true);
 
-        capture_params.dwSamplingRateMs = 1000 /* ms */ / config.framerate;
-
         if (streamedMonitor != -1) {
           auto &output = status_params->outputs[streamedMonitor];
 
@@ -781,6 +814,8 @@ namespace cuda {
 
         sleep_overshoot_logger.reset();
 
+        // The push model generates frames as fast as the desktop is damaged, so the frame rate is capped here.
+        // A frame generated while sleeping is picked up as soon as snapshot() is called.
         while (true) {
           auto now = std::chrono::steady_clock::now();
           if (next_frame > now) {
@@ -826,16 +861,12 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        // The display server generates a frame whenever it's damaged, so snapshot() can wait for it rather than poll.
+        // Direct capture bypasses the display server, which only works while the driver doesn't composite the cursor.
         cursor_visible = cursor;
-        if (cursor) {
-          capture_params.bPushModel = nv_bool(false);
-          capture_params.bWithCursor = nv_bool(true);
-          capture_params.bAllowDirectCapture = nv_bool(false);
-        } else {
-          capture_params.bPushModel = nv_bool(true);
-          capture_params.bWithCursor = nv_bool(false);
-          capture_params.bAllowDirectCapture = nv_bool(true);
-        }
+        capture_params.bPushModel = nv_bool(true);
+        capture_params.bWithCursor = nv_bool(cursor);
+        capture_params.bAllowDirectCapture = nv_bool(!cursor);
 
         if (handle.capture(capture_params)) {
           return platf::capture_e::error;
@@ -876,8 +907,6 @@ namespace cuda {
           if (!info.bDirectCapture) {
             BOOST_LOG(debug) << "Direct capture failed, trying the extra copy method"sv;
             // Direct capture failed
-            capture_params.bPushModel = nv_bool(false);
-            capture_params.bWithCursor = nv_bool(false);
             capture_params.bAllowDirectCapture = nv_bool(false);
 
             if (handle.stop() || handle.capture(capture_params)) {
@@ -900,9 +929,10 @@ namespace cuda {
         CUdeviceptr device_ptr;
         NVFBC_FRAME_GRAB_INFO info;
 
+        // Take the frame generated since the last one right away, or wait for the next one
         NVFBC_TOCUDA_GRAB_FRAME_PARAMS grab {
           NVFBC_TOCUDA_GRAB_FRAME_PARAMS_VER,
-          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT,
+          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY,
           &device_ptr,
           &info,
           (std::uint32_t) timeout.count(),
@@ -917,6 +947,11 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        // The wait timed out with the last frame, which the encoders already have
+        if (!info.bIsNewFrame) {
+          return platf::capture_e::timeout;
+        }
+
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
@@ -948,6 +983,7 @@ namespace cuda {
         }
 
         img->tex = std::move(*tex_opt);
+        img->tex_memory = {metrics::gpu_memory_t::capture, (std::int64_t) img->row_pitch * img->height};
 
         return img;
       };
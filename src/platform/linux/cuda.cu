@@ -4,6 +4,7 @@
  */
 // standard includes
 #include <chrono>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <optional>
@@ -14,6 +15,7 @@
 
 // local includes
 #include "cuda.h"
+#include "src/buffer_pool.h"
 
 using namespace std::literals;
 
@@ -98,16 +100,6 @@ namespace cuda {
     return 0;
   }
 
-  template<class T>
-  ptr_t make_ptr() {
-    void *p;
-    CU_CHECK_PTR(cudaMalloc(&p, sizeof(T)), "Couldn't allocate color matrix");
-
-    ptr_t ptr {p};
-
-    return ptr;
-  }
-
   void freeCudaPtr_t::operator()(void *ptr) {
     CU_CHECK_IGNORE(cudaFree(ptr), "Couldn't free cuda device pointer");
   }
@@ -128,6 +120,19 @@ namespace cuda {
     return stream_t {stream};
   }
 
+  void freeCudaEvent_t::operator()(cudaEvent_t ptr) {
+    CU_CHECK_IGNORE(cudaEventDestroy(ptr), "Couldn't free cuda event");
+  }
+
+  event_t make_event(bool timing, bool blocking) {
+    cudaEvent_t event;
+
+    auto flags = (timing ? cudaEventDefault : cudaEventDisableTiming) | (blocking ? cudaEventBlockingSync : 0);
+    CU_CHECK_PTR(cudaEventCreateWithFlags(&event, flags), "Couldn't create cuda event");
+
+    return event_t {event};
+  }
+
   inline __device__ float3 bgra_to_rgb(uchar4 vec) {
     return make_float3((float) vec.z, (float) vec.y, (float) vec.x);
   }
@@ -136,34 +141,186 @@ namespace cuda {
     return make_float3(vec.z, vec.y, vec.x);
   }
 
-  inline __device__ float2 calcUV(float3 pixel, const cuda_color_t *const color_matrix) {
-    float4 vec_u = color_matrix->color_vec_u;
-    float4 vec_v = color_matrix->color_vec_v;
+  inline __device__ float2 calcUV(float3 pixel, const cuda_color_t &color_matrix) {
+    float4 vec_u = color_matrix.color_vec_u;
+    float4 vec_v = color_matrix.color_vec_v;
 
     float u = dot(pixel, make_float3(vec_u)) + vec_u.w;
     float v = dot(pixel, make_float3(vec_v)) + vec_v.w;
 
-    u = u * color_matrix->range_uv.x + color_matrix->range_uv.y;
-    v = v * color_matrix->range_uv.x + color_matrix->range_uv.y;
-
     return make_float2(u, v);
   }
 
-  inline __device__ float calcY(float3 pixel, const cuda_color_t *const color_matrix) {
-    float4 vec_y = color_matrix->color_vec_y;
+  inline __device__ float calcY(float3 pixel, const cuda_color_t &color_matrix) {
+    float4 vec_y = color_matrix.color_vec_y;
 
-    return (dot(pixel, make_float3(vec_y)) + vec_y.w) * color_matrix->range_y.x + color_matrix->range_y.y;
+    return dot(pixel, make_float3(vec_y)) + vec_y.w;
   }
 
-  __global__ void RGBA_to_NV12(
+  /**
+   * @brief Catmull-Rom weights of the 4 texels around a sample, from its distance to the second one.
+   */
+  inline __device__ float4 catmull_rom_weights(float t) {
+    return make_float4(
+      t * (-0.5f + t * (1.0f - 0.5f * t)),
+      1.0f + t * t * (-2.5f + 1.5f * t),
+      t * (0.5f + t * (2.0f - 1.5f * t)),
+      t * t * (-0.5f + 0.5f * t)
+    );
+  }
+
+  /**
+   * @brief Sample the 4x4 texels around a point of a texture that uses point interpolation.
+   * @param x, y The point in texels, where the center of texel `(i, j)` is at `(i, j)`.
+   */
+  inline __device__ float3 sample_bicubic(cudaTextureObject_t srcImage, float x, float y) {
+    float baseX = floorf(x);
+    float baseY = floorf(y);
+
+    float4 wx = catmull_rom_weights(x - baseX);
+    float4 wy = catmull_rom_weights(y - baseY);
+
+    const float weightsX[] {wx.x, wx.y, wx.z, wx.w};
+    const float weightsY[] {wy.x, wy.y, wy.z, wy.w};
+
+    // The centers of the texels are at half coordinates in the texture
+    float4 result = make_float4(0.0f);
+    for (int j = 0; j < 4; ++j) {
+      float4 texels = make_float4(0.0f);
+      for (int i = 0; i < 4; ++i) {
+        texels += tex2D<float4>(srcImage, baseX + i - 0.5f, baseY + j - 0.5f) * weightsX[i];
+      }
+      result += texels * weightsY[j];
+    }
+
+    // The negative lobes overshoot on sharp edges
+    return clamp(bgra_to_rgb(result), 0.0f, 1.0f);
+  }
+
+  /**
+   * @brief Blend the cursor over a sample of the source.
+   * @param x, y The point of the sample in pixels of the source.
+   */
+  inline __device__ float3 blend_overlay(float3 rgb, const overlay_t &overlay, float x, float y) {
+    x -= overlay.x;
+    y -= overlay.y;
+
+    if (x < 0.0f || y < 0.0f || x >= overlay.width || y >= overlay.height) {
+      return rgb;
+    }
+
+    float4 cursor = tex2D<float4>(overlay.texture, x, y);
+    return lerp(rgb, bgra_to_rgb(cursor), cursor.w);
+  }
+
+  /**
+   * @brief Sample the source for a pixel of the output, with the cursor blended in.
+   * @param x, y The pixel of the output, relative to the viewport.
+   */
+  template<filter_e filter>
+  inline __device__ float3 sample(cudaTextureObject_t srcImage, const overlay_t &overlay, float x, float y, float scale) {
+    float3 rgb;
+    if constexpr (filter == filter_e::bicubic) {
+      x = (x + 0.5f) * scale;
+      y = (y + 0.5f) * scale;
+      rgb = sample_bicubic(srcImage, x - 0.5f, y - 0.5f);
+    } else {
+      x *= scale;
+      y *= scale;
+      rgb = bgra_to_rgb(tex2D<float4>(srcImage, x, y));
+    }
+
+    return blend_overlay(rgb, overlay, x, y);
+  }
+
+  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+  inline __device__ std::uint8_t unorm8_y(float y) {
+    return y * 245.0f;
+  }
+
+  inline __device__ std::uint8_t unorm8_uv(float uv) {
+    return uv * 256.0f;
+  }
+
+  // 10-bit samples are stored in the high bits of 16-bit words
+  inline __device__ std::uint16_t unorm10(float value) {
+    return (std::uint16_t) (__saturatef(value) * 1023.0f + 0.5f) << 6;
+  }
+
+  template<class T>
+  inline __device__ T *row(const planes_t &planes, int plane, int y) {
+    return (T *) (planes.data[plane] + y * planes.pitch[plane]);
+  }
+
+  /**
+   * @brief Write the 2x2 pixels at `(x, y)`, in the order top left, top right, bottom left and bottom right.
+   */
+  template<format_e format>
+  inline __device__ void write_quad(const planes_t &planes, int x, int y, const float3 (&rgb)[4], const cuda_color_t &color_matrix) {
+    float luma[4];
+    float2 chroma[4];
+    for (int i = 0; i < 4; ++i) {
+      luma[i] = calcY(rgb[i], color_matrix);
+      chroma[i] = calcUV(rgb[i], color_matrix);
+    }
+
+    if constexpr (format == format_e::nv12 || format == format_e::p010) {
+      float2 uv = (chroma[0] + chroma[1] + chroma[2] + chroma[3]) * 0.25f;
+
+      if constexpr (format == format_e::nv12) {
+        auto dstY0 = row<std::uint8_t>(planes, 0, y) + x;
+        auto dstY1 = row<std::uint8_t>(planes, 0, y + 1) + x;
+        auto dstUV = row<std::uint8_t>(planes, 1, y / 2) + x;
+
+        dstUV[0] = unorm8_uv(uv.x);
+        dstUV[1] = unorm8_uv(uv.y);
+        dstY0[0] = unorm8_y(luma[0]);
+        dstY0[1] = unorm8_y(luma[1]);
+        dstY1[0] = unorm8_y(luma[2]);
+        dstY1[1] = unorm8_y(luma[3]);
+      } else {
+        auto dstY0 = row<std::uint16_t>(planes, 0, y) + x;
+        auto dstY1 = row<std::uint16_t>(planes, 0, y + 1) + x;
+        auto dstUV = row<std::uint16_t>(planes, 1, y / 2) + x;
+
+        dstUV[0] = unorm10(uv.x);
+        dstUV[1] = unorm10(uv.y);
+        dstY0[0] = unorm10(luma[0]);
+        dstY0[1] = unorm10(luma[1]);
+        dstY1[0] = unorm10(luma[2]);
+        dstY1[1] = unorm10(luma[3]);
+      }
+    } else {
+      for (int i = 0; i < 4; ++i) {
+        int dstX = x + (i & 1);
+        int dstY = y + (i >> 1);
+
+        if constexpr (format == format_e::yuv444) {
+          row<std::uint8_t>(planes, 0, dstY)[dstX] = unorm8_y(luma[i]);
+          row<std::uint8_t>(planes, 1, dstY)[dstX] = unorm8_uv(chroma[i].x);
+          row<std::uint8_t>(planes, 2, dstY)[dstX] = unorm8_uv(chroma[i].y);
+        } else {
+          row<std::uint16_t>(planes, 0, dstY)[dstX] = unorm10(luma[i]);
+          row<std::uint16_t>(planes, 1, dstY)[dstX] = unorm10(chroma[i].x);
+          row<std::uint16_t>(planes, 2, dstY)[dstX] = unorm10(chroma[i].y);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Scale the captured image and convert it to YUV in one pass.
+   * @details Each thread samples the 2x2 pixels that share a chroma sample in 4:2:0,
+   *          and writes them straight to the frame, without an intermediate RGB image.
+   */
+  template<format_e format, filter_e filter>
+  __global__ void RGBA_to_YUV(
     cudaTextureObject_t srcImage,
-    std::uint8_t *dstY,
-    std::uint8_t *dstUV,
-    std::uint32_t dstPitchY,
-    std::uint32_t dstPitchUV,
+    const planes_t planes,
     float scale,
     const viewport_t viewport,
-    const cuda_color_t *const color_matrix
+    const cuda_color_t color_matrix,
+    const overlay_t overlay
   ) {
     int idX = (threadIdx.x + blockDim.x * blockIdx.x) * 2;
     int idY = (threadIdx.y + blockDim.y * blockIdx.y) * 2;
@@ -175,34 +332,41 @@ namespace cuda {
       return;
     }
 
-    float x = idX * scale;
-    float y = idY * scale;
+    const float3 rgb[4] {
+      sample<filter>(srcImage, overlay, idX, idY, scale),
+      sample<filter>(srcImage, overlay, idX + 1, idY, scale),
+      sample<filter>(srcImage, overlay, idX, idY + 1, scale),
+      sample<filter>(srcImage, overlay, idX + 1, idY + 1, scale),
+    };
 
-    idX += viewport.offsetX;
-    idY += viewport.offsetY;
-
-    uint8_t *dstY0 = dstY + idX + idY * dstPitchY;
-    uint8_t *dstY1 = dstY + idX + (idY + 1) * dstPitchY;
-    dstUV = dstUV + idX + (idY / 2 * dstPitchUV);
-
-    float3 rgb_lt = bgra_to_rgb(tex2D<float4>(srcImage, x, y));
-    float3 rgb_rt = bgra_to_rgb(tex2D<float4>(srcImage, x + scale, y));
-    float3 rgb_lb = bgra_to_rgb(tex2D<float4>(srcImage, x, y + scale));
-    float3 rgb_rb = bgra_to_rgb(tex2D<float4>(srcImage, x + scale, y + scale));
-
-    float2 uv_lt = calcUV(rgb_lt, color_matrix) * 256.0f;
-    float2 uv_rt = calcUV(rgb_rt, color_matrix) * 256.0f;
-    float2 uv_lb = calcUV(rgb_lb, color_matrix) * 256.0f;
-    float2 uv_rb = calcUV(rgb_rb, color_matrix) * 256.0f;
+    write_quad<format>(planes, idX + viewport.offsetX, idY + viewport.offsetY, rgb, color_matrix);
+  }
 
-    float2 uv = (uv_lt + uv_lb + uv_rt + uv_rb) * 0.25f;
+  using kernel_t = void (*)(cudaTextureObject_t, const planes_t, float, const viewport_t, const cuda_color_t, const overlay_t);
+
+  template<format_e format>
+  kernel_t kernel_for(filter_e filter) {
+    switch (filter) {
+      case filter_e::bilinear:
+        return RGBA_to_YUV<format, filter_e::bilinear>;
+      case filter_e::bicubic:
+        return RGBA_to_YUV<format, filter_e::bicubic>;
+      default:
+        return RGBA_to_YUV<format, filter_e::point>;
+    }
+  }
 
-    dstUV[0] = uv.x;
-    dstUV[1] = uv.y;
-    dstY0[0] = calcY(rgb_lt, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
-    dstY0[1] = calcY(rgb_rt, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
-    dstY1[0] = calcY(rgb_lb, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
-    dstY1[1] = calcY(rgb_rb, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+  kernel_t kernel_for(format_e format, filter_e filter) {
+    switch (format) {
+      case format_e::p010:
+        return kernel_for<format_e::p010>(filter);
+      case format_e::yuv444:
+        return kernel_for<format_e::yuv444>(filter);
+      case format_e::yuv444p16:
+        return kernel_for<format_e::yuv444p16>(filter);
+      default:
+        return kernel_for<format_e::nv12>(filter);
+    }
   }
 
   int tex_t::copy(std::uint8_t *src, int height, int pitch) {
@@ -278,9 +442,10 @@ namespace cuda {
     }
   }
 
-  sws_t::sws_t(int in_width, int in_height, int out_width, int out_height, int pitch, int threadsPerBlock, ptr_t &&color_matrix):
+  sws_t::sws_t(int in_width, int in_height, int out_width, int out_height, int pitch, int threadsPerBlock, format_e format):
+      color_matrix {},
       threadsPerBlock {threadsPerBlock},
-      color_matrix {std::move(color_matrix)} {
+      format {format} {
     // Ensure aspect ratio is maintained
     auto scalar = std::fminf(out_width / (float) in_width, out_height / (float) in_height);
     auto out_width_f = in_width * scalar;
@@ -297,45 +462,172 @@ namespace cuda {
     viewport.offsetY = offsetY_f;
 
     scale = 1.0f / scalar;
+
+    if (scale == 1.0f) {
+      filter = filter_e::point;
+    } else if (scale > 1.0f) {
+      filter = filter_e::bicubic;
+    } else {
+      filter = filter_e::bilinear;
+    }
   }
 
-  std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, int pitch) {
+  std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, int pitch, format_e format) {
     cudaDeviceProp props;
     int device;
     CU_CHECK_OPT(cudaGetDevice(&device), "Couldn't get cuda device");
     CU_CHECK_OPT(cudaGetDeviceProperties(&props, device), "Couldn't get cuda device properties");
 
-    auto ptr = make_ptr<cuda_color_t>();
-    if (!ptr) {
+    auto sws = std::make_optional<sws_t>(in_width, in_height, out_width, out_height, pitch, props.maxThreadsPerMultiProcessor / props.maxBlocksPerMultiProcessor, format);
+
+    sws->kernel_start = make_event(true);
+    sws->kernel_end = make_event(true);
+    if (!sws->kernel_start || !sws->kernel_end) {
       return std::nullopt;
     }
 
-    return std::make_optional<sws_t>(in_width, in_height, out_width, out_height, pitch, props.maxThreadsPerMultiProcessor / props.maxBlocksPerMultiProcessor, std::move(ptr));
+    return sws;
   }
 
-  int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream) {
-    return convert(Y, UV, pitchY, pitchUV, texture, stream, viewport);
+  int sws_t::convert(const planes_t &planes, const tex_t &tex, stream_t::pointer stream) {
+    return convert(planes, tex, stream, viewport);
   }
 
-  int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
+  int sws_t::convert(const planes_t &planes, const tex_t &tex, stream_t::pointer stream, const viewport_t &viewport) {
     int threadsX = viewport.width / 2;
     int threadsY = viewport.height / 2;
 
     dim3 block(threadsPerBlock);
     dim3 grid(div_align(threadsX, threadsPerBlock), threadsY);
 
-    RGBA_to_NV12<<<grid, block, 0, stream>>>(texture, Y, UV, pitchY, pitchUV, scale, viewport, (cuda_color_t *) color_matrix.get());
+    // Only time the kernel when the timing of the previous one was taken, so recording never waits on it
+    auto timed = kernel_start && !kernel_timed;
+    if (timed) {
+      CU_CHECK(cudaEventRecord(kernel_start.get(), stream), "Couldn't record start of RGBA_to_YUV");
+    }
+
+    // Bicubic sampling weighs the texels itself, so it fetches them without filtering
+    auto texture = filter == filter_e::bilinear ? tex.texture.linear : tex.texture.point;
+    auto kernel = kernel_for(format, filter);
+    kernel<<<grid, block, 0, stream>>>(texture, planes, scale, viewport, reinterpret_cast<const cuda_color_t &>(color_matrix), overlay);
 
-    return CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_NV12 failed");
+    if (CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_YUV failed")) {
+      return -1;
+    }
+
+    if (timed) {
+      CU_CHECK(cudaEventRecord(kernel_end.get(), stream), "Couldn't record end of RGBA_to_YUV");
+      kernel_timed = true;
+    }
+
+    return 0;
+  }
+
+  int sws_t::init_pipeline(int height, int pitch) {
+    upload_slots.clear();
+    next_upload_slot = 0;
+
+    for (std::size_t x = 0; x < PIPELINE_DEPTH; ++x) {
+      auto tex = tex_t::make(height, pitch);
+      if (!tex) {
+        return -1;
+      }
+
+      // The uploads must not wait on the legacy default stream, or they would wait on the encoder
+      upload_slot_t slot {std::move(*tex), make_stream(cudaStreamNonBlocking), make_event(false, true), make_event()};
+      if (!slot.stream || !slot.uploaded || !slot.converted) {
+        return -1;
+      }
+
+      upload_slots.emplace_back(std::move(slot));
+    }
+
+    return 0;
+  }
+
+  int sws_t::convert_async(const planes_t &planes, platf::img_t &img, stream_t::pointer stream, const viewport_t &viewport) {
+    auto &slot = upload_slots[next_upload_slot];
+    next_upload_slot = (next_upload_slot + 1) % upload_slots.size();
+
+    // Don't overwrite the slot before the conversion that reads it is done
+    CU_CHECK(cudaStreamWaitEvent(slot.stream.get(), slot.converted.get(), 0), "Couldn't wait for conversion of cuda upload slot");
+
+    // Pinned memory is copied by DMA, where pageable memory would first be staged by the CPU
+    auto pinned = buffer_pool::pin_image(img.data, [](std::uint8_t *data, std::size_t size) -> std::function<void()> {
+      if (CU_CHECK_IGNORE(cudaHostRegister(data, size, cudaHostRegisterPortable), "Couldn't pin captured image")) {
+        return {};
+      }
+
+      return [data]() {
+        CU_CHECK_IGNORE(cudaHostUnregister(data), "Couldn't unpin captured image");
+      };
+    });
+
+    CU_CHECK(cudaMemcpy2DToArrayAsync(slot.tex.array, 0, 0, img.data, img.row_pitch, img.width * img.pixel_pitch, img.height, cudaMemcpyHostToDevice, slot.stream.get()), "Couldn't copy to cuda array");
+    CU_CHECK(cudaEventRecord(slot.uploaded.get(), slot.stream.get()), "Couldn't record upload to cuda array");
+
+    // Pageable memory is staged before the copy returns, but the capture may reuse a pinned image
+    // as soon as this returns, so wait for the DMA, sleeping rather than spending the CPU it saves
+    if (pinned) {
+      CU_CHECK(cudaEventSynchronize(slot.uploaded.get()), "Couldn't wait for upload to cuda array");
+    }
+
+    CU_CHECK(cudaStreamWaitEvent(stream, slot.uploaded.get(), 0), "Couldn't wait for upload to cuda array");
+    if (convert(planes, slot.tex, stream, viewport)) {
+      return -1;
+    }
+    CU_CHECK(cudaEventRecord(slot.converted.get(), stream), "Couldn't record conversion of cuda upload slot");
+
+    return 0;
+  }
+
+  float sws_t::take_kernel_time() {
+    if (!kernel_timed || cudaEventQuery(kernel_end.get()) != cudaSuccess) {
+      return -1.0f;
+    }
+
+    kernel_timed = false;
+
+    float ms;
+    if (CU_CHECK_IGNORE(cudaEventElapsedTime(&ms, kernel_start.get(), kernel_end.get()), "Couldn't get time of RGBA_to_YUV")) {
+      return -1.0f;
+    }
+
+    return ms;
   }
 
   void sws_t::apply_colorspace(const video::sunshine_colorspace_t &colorspace) {
-    auto color_p = video::color_vectors_from_colorspace(colorspace, true);
-    CU_CHECK_IGNORE(cudaMemcpy(color_matrix.get(), color_p, sizeof(video::color_t), cudaMemcpyHostToDevice), "Couldn't copy color matrix to cuda");
+    color_matrix = *video::color_vectors_from_colorspace(colorspace, true);
   }
 
   int sws_t::load_ram(platf::img_t &img, cudaArray_t array) {
     return CU_CHECK_IGNORE(cudaMemcpy2DToArray(array, 0, 0, img.data, img.row_pitch, img.width * img.pixel_pitch, img.height, cudaMemcpyHostToDevice), "Couldn't copy to cuda array");
   }
 
+  int sws_t::set_cursor(const std::uint8_t *pixels, int width, int height, std::uint64_t serial, int x, int y) {
+    if (!pixels) {
+      overlay.width = 0;
+      return 0;
+    }
+
+    // The sprite rarely changes, so it gets an array of its size each time it does.
+    // Freeing the previous array waits for the conversions that read it.
+    if (cursor_serial != serial) {
+      auto tex = tex_t::make(height, width);
+      if (!tex) {
+        overlay.width = 0;
+        return -1;
+      }
+
+      cursor_tex = std::move(*tex);
+      CU_CHECK(cudaMemcpy2DToArray(cursor_tex.array, 0, 0, pixels, width * 4, width * 4, height, cudaMemcpyHostToDevice), "Couldn't copy cursor to cuda array");
+      cursor_serial = serial;
+    }
+
+    // The cursor is scaled along with the image, so it's only filtered when the image is
+    overlay = {filter == filter_e::point ? cursor_tex.texture.point : cursor_tex.texture.linear, (float) x, (float) y, (float) width, (float) height};
+
+    return 0;
+  }
+
 }  // namespace cuda
@@ -45,9 +45,11 @@ typedef struct cudaArray *cudaArray_t;
 
   #if !defined(__CUDACC__)
 typedef struct CUstream_st *cudaStream_t;
+typedef struct CUevent_st *cudaEvent_t;
 typedef unsigned long long cudaTextureObject_t;
   #else /* defined(__CUDACC__) */
 typedef __location__(device_builtin) struct CUstream_st *cudaStream_t;
+typedef __location__(device_builtin) struct CUevent_st *cudaEvent_t;
 typedef __location__(device_builtin) unsigned long long cudaTextureObject_t;
   #endif /* !defined(__CUDACC__) */
 
@@ -63,16 +65,67 @@ namespace cuda {
     void operator()(cudaStream_t ptr);
   };
 
+  class freeCudaEvent_t {
+  public:
+    void operator()(cudaEvent_t ptr);
+  };
+
   using ptr_t = std::unique_ptr<void, freeCudaPtr_t>;
   using stream_t = std::unique_ptr<CUstream_st, freeCudaStream_t>;
+  using event_t = std::unique_ptr<CUevent_st, freeCudaEvent_t>;
 
   stream_t make_stream(int flags = 0);
 
+  /**
+   * @brief Create a cuda event.
+   * @param timing Whether the event records a timestamp, which makes recording it slower.
+   * @param blocking Whether waiting for the event from the host sleeps rather than spins.
+   */
+  event_t make_event(bool timing = false, bool blocking = false);
+
   struct viewport_t {
     int width, height;
     int offsetX, offsetY;
   };
 
+  /**
+   * @brief The layout of the frame the conversion kernel writes.
+   */
+  enum class format_e {
+    nv12,  ///< 8-bit luma plane and interleaved chroma plane at half resolution
+    p010,  ///< NV12 layout with 16-bit samples, holding 10 bits in their high bits
+    yuv444,  ///< 8-bit luma and chroma planes at full resolution
+    yuv444p16,  ///< 4:4:4 layout with 16-bit samples, holding 10 bits in their high bits
+  };
+
+  /**
+   * @brief How the conversion kernel samples the captured image when scaling it.
+   */
+  enum class filter_e {
+    point,  ///< Nearest texel, for images that aren't scaled
+    bilinear,  ///< 2x2 texels, with the filtering of the texture unit
+    bicubic,  ///< 4x4 texels with Catmull-Rom weights, which keeps text sharp when downscaling
+  };
+
+  /**
+   * @brief A cursor the conversion kernel blends in, in pixels of the captured image.
+   */
+  struct overlay_t {
+    cudaTextureObject_t texture;
+    float x, y;
+
+    // No width when there is no cursor
+    float width, height;
+  };
+
+  /**
+   * @brief The planes of the frame the conversion kernel writes, as in `AVFrame::data` and `AVFrame::linesize`.
+   */
+  struct planes_t {
+    std::uint8_t *data[3];
+    std::uint32_t pitch[3];
+  };
+
   class tex_t {
   public:
     static std::optional<tex_t> make(int height, int pitch);
@@ -97,31 +150,98 @@ namespace cuda {
   class sws_t {
   public:
     sws_t() = default;
-    sws_t(int in_width, int in_height, int out_width, int out_height, int pitch, int threadsPerBlock, ptr_t &&color_matrix);
+    sws_t(int in_width, int in_height, int out_width, int out_height, int pitch, int threadsPerBlock, format_e format);
 
     /**
      * in_width, in_height -- The width and height of the captured image in pixels
-     * out_width, out_height -- the width and height of the NV12 image in pixels
+     * out_width, out_height -- the width and height of the YUV image in pixels
      *
      * pitch -- The size of a single row of pixels in bytes
+     * format -- The layout of the YUV image
+     *
+     * The filter is picked from the scaling: point when the image isn't scaled,
+     * bicubic when it's downscaled and bilinear when it's upscaled.
      */
-    static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, int pitch);
+    static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, int pitch, format_e format = format_e::nv12);
 
-    // Converts loaded image into a CUDevicePtr
-    int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream);
-    int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport);
+    /**
+     * @brief Scale the loaded image and convert it to YUV in a single pass, so the frame is only read and written once.
+     * @param planes The planes of the YUV image.
+     * @param tex The loaded image, sampled through the texture that matches the filter.
+     */
+    int convert(const planes_t &planes, const tex_t &tex, stream_t::pointer stream);
+    int convert(const planes_t &planes, const tex_t &tex, stream_t::pointer stream, const viewport_t &viewport);
 
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
     int load_ram(platf::img_t &img, cudaArray_t array);
 
-    ptr_t color_matrix;
+    /**
+     * @brief Set the cursor the next conversions blend in, for captures that keep it out of the pixels.
+     * @param pixels The sprite, in BGRA with straight alpha, or `nullptr` to blend no cursor.
+     * @param serial Changes along with the pixels, which are only uploaded when it does.
+     * @param x, y The top left corner of the cursor in the captured image.
+     */
+    int set_cursor(const std::uint8_t *pixels, int width, int height, std::uint64_t serial, int x, int y);
+
+    /**
+     * @brief Allocate the ring of upload slots used by convert_async().
+     * @param height The height of the captured image in pixels.
+     * @param pitch The size of a single row of pixels in bytes.
+     */
+    int init_pipeline(int height, int pitch);
+
+    /**
+     * @brief Upload an image in RAM and convert it, without the host waiting on the GPU.
+     * @details Each image is uploaded into the next slot of a ring, on the stream of that slot.
+     *          The conversion stream waits on an event of the upload, so the upload of a frame
+     *          overlaps the conversion and encode of the previous ones. A slot is only reused
+     *          once the conversion that read it is done. Images from `buffer_pool::alloc_image()`
+     *          are pinned the first time, so they're read by DMA instead of being staged by the CPU.
+     */
+    int convert_async(const planes_t &planes, platf::img_t &img, stream_t::pointer stream, const viewport_t &viewport);
+
+    /**
+     * @brief Get the GPU time of the last conversion kernel, if it completed since the last call.
+     * @details This never waits for the kernel, a kernel that is still running is timed on a later call.
+     * @return The time in milliseconds, or a negative value if no timed kernel completed.
+     */
+    float take_kernel_time();
+
+    struct upload_slot_t {
+      tex_t tex;
+      stream_t stream;
+      event_t uploaded;
+      event_t converted;
+    };
+
+    /**
+     * @brief The number of images that can be uploaded ahead of their conversion.
+     */
+    static constexpr std::size_t PIPELINE_DEPTH = 3;
+
+    std::vector<upload_slot_t> upload_slots;
+    std::size_t next_upload_slot = 0;
+
+    event_t kernel_start;
+    event_t kernel_end;
+    bool kernel_timed = false;
+
+    // Passed to the kernel as a parameter, so every thread reads it from constant memory
+    video::color_t color_matrix;
 
     int threadsPerBlock;
 
     viewport_t viewport;
 
     float scale;
+
+    format_e format;
+    filter_e filter;
+
+    tex_t cursor_tex;
+    std::uint64_t cursor_serial = 0;
+    overlay_t overlay {};
   };
 }  // namespace cuda
 
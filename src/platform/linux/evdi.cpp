@@ -4,17 +4,27 @@
  */
 #include "evdi.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fcntl.h>
+#include <future>
+#include <mutex>
+#include <poll.h>
 #include <thread>
 #include <unistd.h>
 
+#include "cuda.h"
 #include "graphics.h"
 #include "misc.h"
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/video.h"
+#include "vaapi.h"
 
 extern "C" {
 #include <evdi_lib.h>
@@ -24,178 +34,323 @@ using namespace std::literals;
 
 namespace platf {
 
-  namespace {
-    // Global state for virtual display management
-    struct evdi_state_t {
-      evdi_handle handle = EVDI_INVALID_HANDLE;
-      bool is_active = false;
-      int width = 1920;
-      int height = 1080;
-      int refresh_rate = 60;
-      bool hdr_enabled = false;
-    };
+  namespace evdi {
+    namespace {
+      // Standard EDID for 1080p display
+      // This is a basic EDID that will be customized based on client requirements
+      const unsigned char base_edid[] = {
+        0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00,  // Header
+        0x10, 0xAC,  // Manufacturer ID (Dell)
+        0x00, 0x00,  // Product code
+        0x00, 0x00, 0x00, 0x00,  // Serial number
+        0x01,  // Week of manufacture
+        0x1E,  // Year of manufacture (2020)
+        0x01, 0x04,  // EDID version 1.4
+        0xA5,  // Digital input, 8 bits per color
+        0x34, 0x20,  // Screen size (52cm x 32cm)
+        0x78,  // Display gamma 2.2
+        0x3A,  // Features: DPMS, Preferred timing mode, sRGB
+        // Chromaticity coordinates
+        0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26, 0x0F, 0x50, 0x54,
+        // Established timings
+        0x00, 0x00, 0x00,
+        // Standard timing information (8 blocks)
+        0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+        0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+        // Descriptor blocks (4 blocks of 18 bytes each)
+        // Block 1: Preferred timing (1920x1080@60Hz)
+        0x02, 0x3A, 0x80, 0x18, 0x71, 0x38, 0x2D, 0x40,
+        0x58, 0x2C, 0x45, 0x00, 0x09, 0x25, 0x21, 0x00,
+        0x00, 0x1E,
+        // Block 2: Display name
+        0x00, 0x00, 0x00, 0xFC, 0x00,
+        'S', 'u', 'n', 's', 'h', 'i', 'n', 'e', ' ', 'V', 'D', '\n', ' ',
+        // Block 3: Display range limits (24-240 Hz, 30-510 kHz with the +255 offset, up to 2550 MHz, no GTF/CVT)
+        0x00, 0x00, 0x00, 0xFD, 0x08,
+        0x18, 0xF0, 0x1E, 0xFF, 0xFF, 0x01, 0x0A, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+        // Block 4: Dummy
+        0x00, 0x00, 0x00, 0x10, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // Extension flag and checksum
+        0x00, 0x00
+      };
 
-    evdi_state_t evdi_state;
+      // The resolutions offered next to the preferred mode, so the compositor can switch between them
+      constexpr display_mode_t common_resolutions[] {
+        {3840, 2160},
+        {2560, 1440},
+        {1920, 1080},
+        {1280, 720},
+      };
 
-    // Standard EDID for 1080p display
-    // This is a basic EDID that will be customized based on client requirements
-    const unsigned char base_edid[] = {
-      0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00,  // Header
-      0x10, 0xAC,  // Manufacturer ID (Dell)
-      0x00, 0x00,  // Product code
-      0x00, 0x00, 0x00, 0x00,  // Serial number
-      0x01,  // Week of manufacture
-      0x1E,  // Year of manufacture (2020)
-      0x01, 0x04,  // EDID version 1.4
-      0xA5,  // Digital input, 8 bits per color
-      0x34, 0x20,  // Screen size (52cm x 32cm)
-      0x78,  // Display gamma 2.2
-      0x3A,  // Features: DPMS, Preferred timing mode, sRGB
-      // Chromaticity coordinates
-      0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26, 0x0F, 0x50, 0x54,
-      // Established timings
-      0x00, 0x00, 0x00,
-      // Standard timing information (8 blocks)
-      0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-      0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
-      // Descriptor blocks (4 blocks of 18 bytes each)
-      // Block 1: Preferred timing (1920x1080@60Hz)
-      0x02, 0x3A, 0x80, 0x18, 0x71, 0x38, 0x2D, 0x40,
-      0x58, 0x2C, 0x45, 0x00, 0x09, 0x25, 0x21, 0x00,
-      0x00, 0x1E,
-      // Block 2: Display name
-      0x00, 0x00, 0x00, 0xFC, 0x00,
-      'S', 'u', 'n', 's', 'h', 'i', 'n', 'e', ' ', 'V', 'D', '\n', ' ',
-      // Block 3: Display range limits
-      0x00, 0x00, 0x00, 0xFD, 0x00,
-      0x38, 0x4C, 0x1E, 0x53, 0x11, 0x00, 0x0A, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
-      // Block 4: Dummy
-      0x00, 0x00, 0x00, 0x10, 0x00,
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-      // Extension flag and checksum
-      0x00, 0x00
-    };
+      constexpr int DTD_SIZE = 18;
+      constexpr int DISPLAYID_TIMING_SIZE = 20;
 
-    /**
-     * @brief Generate a DTD (Detailed Timing Descriptor) for the given resolution.
-     * Uses CVT (Coordinated Video Timings) reduced blanking formulas.
-     */
-    void generate_dtd(unsigned char *dtd, int width, int height, int refresh_rate) {
-      // CVT reduced blanking timing calculations
-      // These are simplified values - proper CVT would calculate exact timings
-      
-      // For common resolutions, use standard timings
-      // Otherwise, use approximate values based on CVT reduced blanking
-      
-      int h_blank = width / 5;  // Approximate horizontal blanking
-      int v_blank = 30;         // Vertical blanking lines
-      int h_sync = 32;          // H-sync pulse width
-      int v_sync = 4;           // V-sync pulse width
-      
-      int pixel_clock_khz = ((width + h_blank) * (height + v_blank) * refresh_rate) / 1000;
-      
-      // DTD structure (18 bytes):
-      // Bytes 0-1: Pixel clock in 10 kHz units (little endian)
-      dtd[0] = (pixel_clock_khz / 10) & 0xFF;
-      dtd[1] = ((pixel_clock_khz / 10) >> 8) & 0xFF;
-      
-      // Bytes 2-3: Horizontal addressable pixels and blanking
-      dtd[2] = width & 0xFF;
-      dtd[3] = h_blank & 0xFF;
-      dtd[4] = ((width >> 8) & 0x0F) | (((h_blank >> 8) & 0x0F) << 4);
-      
-      // Bytes 5-6: Vertical addressable lines and blanking
-      dtd[5] = height & 0xFF;
-      dtd[6] = v_blank & 0xFF;
-      dtd[7] = ((height >> 8) & 0x0F) | (((v_blank >> 8) & 0x0F) << 4);
-      
-      // Bytes 8-10: Sync pulse parameters
-      int h_sync_offset = (h_blank - h_sync) / 2;
-      int v_sync_offset = 3;
-      
-      dtd[8] = h_sync_offset & 0xFF;
-      dtd[9] = h_sync & 0xFF;
-      dtd[10] = ((v_sync_offset & 0x0F) << 4) | (v_sync & 0x0F);
-      dtd[11] = ((h_sync_offset >> 8) & 0x03) | 
-                (((h_sync >> 8) & 0x03) << 2) |
-                (((v_sync_offset >> 4) & 0x03) << 4) |
-                (((v_sync >> 4) & 0x03) << 6);
-      
-      // Bytes 12-13: Image size (52cm x 32cm - approximate 24" 16:9 display)
-      dtd[12] = 0x20;
-      dtd[13] = 0x34;
-      dtd[14] = 0x00;
-      
-      // Bytes 15-16: Border and flags
-      dtd[15] = 0x00;  // No border
-      dtd[16] = 0x00;  // No border
-      
-      // Byte 17: Flags (digital separate sync, positive polarity)
-      dtd[17] = 0x1E;
-    }
+      // The DTDs that fit in a CTA-861 extension block after its data blocks
+      constexpr std::size_t MAX_EXTENSION_DTDS = 6;
 
-    /**
-     * @brief Generate CTA-861 extension block with HDR metadata.
-     */
-    std::vector<unsigned char> generate_cta861_hdr_extension() {
-      std::vector<unsigned char> ext(128, 0);
-      
-      // CTA Extension Header
-      ext[0] = 0x02;  // CTA-861 Extension Tag
-      ext[1] = 0x03;  // Revision 3
-      ext[2] = 0x00;  // No detailed timing descriptors
-      ext[3] = 0x00;  // No flags
-      
-      // Data Block Collection starts at byte 4
-      int offset = 4;
-      
-      // Video Data Block (VDB) - indicate support for common video formats
-      ext[offset++] = 0x40 | 0x03;  // Video Data Block, length 3
-      ext[offset++] = 0x10;  // VIC 16: 1080p60
-      ext[offset++] = 0x5F;  // VIC 95: 3840x2160p30
-      ext[offset++] = 0x61;  // VIC 97: 3840x2160p60
-      
-      // HDR Static Metadata Data Block
-      ext[offset++] = 0x60 | 0x06;  // Extended tag, length 6
-      ext[offset++] = 0x06;  // Extended tag code for HDR Static Metadata
-      ext[offset++] = 0x03;  // ET: 0 (SDR), 1 (HDR10), 2 (HLG) - support bits 0 and 1
-      ext[offset++] = 0x00;  // Static Metadata Descriptor Type 1
-      // Max Luminance Data: 100 nits = 50 (encoded as 50 + 50 = 100 cd/m²)
-      ext[offset++] = 0x64;  // Desired content max luminance (100 cd/m²)
-      ext[offset++] = 0x5A;  // Desired content max frame-average luminance (90 cd/m²)
-      ext[offset++] = 0x00;  // Desired content min luminance (0.0001 cd/m²)
-      
-      // Colorimetry Data Block
-      ext[offset++] = 0x70 | 0x02;  // Extended tag, length 2
-      ext[offset++] = 0x05;  // Extended tag code for Colorimetry
-      ext[offset++] = 0xC0;  // BT2020 RGB and BT2020 YCC support
-      
-      // Set DTD offset (no DTDs in this extension)
-      ext[2] = offset;
-      
-      // Padding to 127 bytes
-      while (offset < 127) {
-        ext[offset++] = 0x00;
+      // The type I timings that fit in the section of a DisplayID extension block
+      constexpr std::size_t MAX_DISPLAYID_TIMINGS = 5;
+
+      // The physical size reported by the DTDs, matching the screen size of the base EDID
+      constexpr int IMAGE_WIDTH_MM = 520;
+      constexpr int IMAGE_HEIGHT_MM = 320;
+
+      /**
+       * @brief Check whether timings can be described by a DTD.
+       * @details A DTD holds the pixel clock in 16 bits of 10 kHz units, and the sizes in 12 bits.
+       */
+      bool fits_dtd(const timings_t &timings) {
+        return (timings.pixel_clock_khz + 5) / 10 <= 0xFFFF &&
+               timings.h_active <= 0xFFF && timings.h_blank <= 0xFFF &&
+               timings.v_active <= 0xFFF && timings.v_blank <= 0xFFF;
       }
-      
-      // Calculate checksum
-      unsigned char checksum = 0;
-      for (int i = 0; i < 127; i++) {
-        checksum += ext[i];
+
+      /**
+       * @brief Generate a DTD (Detailed Timing Descriptor) for the given timings.
+       * @param dtd The 18 bytes of the descriptor.
+       * @param timings The timings, which must fit in a DTD.
+       */
+      void generate_dtd(unsigned char *dtd, const timings_t &timings) {
+        auto pixel_clock = (timings.pixel_clock_khz + 5) / 10;
+
+        // Bytes 0-1: Pixel clock in 10 kHz units (little endian)
+        dtd[0] = pixel_clock & 0xFF;
+        dtd[1] = (pixel_clock >> 8) & 0xFF;
+
+        // Bytes 2-4: Horizontal addressable pixels and blanking, with their upper 4 bits in byte 4
+        dtd[2] = timings.h_active & 0xFF;
+        dtd[3] = timings.h_blank & 0xFF;
+        dtd[4] = (((timings.h_active >> 8) & 0x0F) << 4) | ((timings.h_blank >> 8) & 0x0F);
+
+        // Bytes 5-7: Vertical addressable lines and blanking, with their upper 4 bits in byte 7
+        dtd[5] = timings.v_active & 0xFF;
+        dtd[6] = timings.v_blank & 0xFF;
+        dtd[7] = (((timings.v_active >> 8) & 0x0F) << 4) | ((timings.v_blank >> 8) & 0x0F);
+
+        // Bytes 8-11: Front porches and sync pulse widths, with their upper bits in byte 11
+        dtd[8] = timings.h_front_porch & 0xFF;
+        dtd[9] = timings.h_sync & 0xFF;
+        dtd[10] = ((timings.v_front_porch & 0x0F) << 4) | (timings.v_sync & 0x0F);
+        dtd[11] = (((timings.h_front_porch >> 8) & 0x03) << 6) |
+                  (((timings.h_sync >> 8) & 0x03) << 4) |
+                  (((timings.v_front_porch >> 4) & 0x03) << 2) |
+                  ((timings.v_sync >> 4) & 0x03);
+
+        // Bytes 12-14: Image size in mm, with their upper 4 bits in byte 14
+        dtd[12] = IMAGE_WIDTH_MM & 0xFF;
+        dtd[13] = IMAGE_HEIGHT_MM & 0xFF;
+        dtd[14] = (((IMAGE_WIDTH_MM >> 8) & 0x0F) << 4) | ((IMAGE_HEIGHT_MM >> 8) & 0x0F);
+
+        // Bytes 15-16: Border and flags
+        dtd[15] = 0x00;  // No border
+        dtd[16] = 0x00;  // No border
+
+        // Byte 17: Flags (digital separate sync, positive H sync and negative V sync, as CVT reduced blanking uses)
+        dtd[17] = 0x1A;
       }
-      ext[127] = (256 - checksum) & 0xFF;
-      
-      return ext;
+
+      /**
+       * @brief Generate a DisplayID type I detailed timing, which holds pixel clocks that a DTD can't.
+       * @param timing The 20 bytes of the timing.
+       * @param timings The timings.
+       * @param preferred Whether to mark the timing as preferred.
+       */
+      void generate_displayid_timing(unsigned char *timing, const timings_t &timings, bool preferred) {
+        // Bytes 0-2: Pixel clock in 10 kHz units, minus one (little endian)
+        auto pixel_clock = (timings.pixel_clock_khz + 5) / 10 - 1;
+        timing[0] = pixel_clock & 0xFF;
+        timing[1] = (pixel_clock >> 8) & 0xFF;
+        timing[2] = (pixel_clock >> 16) & 0xFF;
+
+        // Byte 3: Options (preferred, progressive, no stereo) and the aspect ratio
+        int aspect_ratio = 0x08;  // Undefined
+        if (timings.h_active * 9 == timings.v_active * 16) {
+          aspect_ratio = 0x04;  // 16:9
+        }
+        else if (timings.h_active * 10 == timings.v_active * 16) {
+          aspect_ratio = 0x05;  // 16:10
+        }
+        timing[3] = (preferred ? 0x80 : 0x00) | aspect_ratio;
+
+        // Bytes 4-19: Every size is stored minus one, in 16 bits (little endian)
+        auto put = [timing](int offset, int value) {
+          timing[offset] = (value - 1) & 0xFF;
+          timing[offset + 1] = ((value - 1) >> 8) & 0xFF;
+        };
+        put(4, timings.h_active);
+        put(6, timings.h_blank);
+        put(8, timings.h_front_porch);
+        put(10, timings.h_sync);
+        put(12, timings.v_active);
+        put(14, timings.v_blank);
+        put(16, timings.v_front_porch);
+        put(18, timings.v_sync);
+
+        // The top bit of the front porches is the sync polarity: positive H sync, negative V sync
+        timing[9] |= 0x80;
+      }
+
+      /**
+       * @brief List the modes the EDID offers next to the preferred one.
+       * @param preferred The mode the EDID prefers.
+       * @return The common resolutions at the preferred refresh rate, then at 60 Hz.
+       */
+      std::vector<display_mode_t> extra_modes(const display_mode_t &preferred) {
+        std::vector<display_mode_t> modes;
+        for (auto refresh_rate : {preferred.refresh_rate, 60}) {
+          for (auto &resolution : common_resolutions) {
+            display_mode_t mode {resolution.width, resolution.height, refresh_rate};
+
+            auto same = [&mode](const display_mode_t &other) {
+              return other.width == mode.width && other.height == mode.height && other.refresh_rate == mode.refresh_rate;
+            };
+            if (same(preferred) || std::any_of(std::begin(modes), std::end(modes), same)) {
+              continue;
+            }
+
+            modes.emplace_back(mode);
+          }
+        }
+
+        return modes;
+      }
+
+      /**
+       * @brief Calculate the checksum byte that makes a range of bytes add up to 0.
+       */
+      unsigned char checksum(const unsigned char *begin, const unsigned char *end) {
+        unsigned char sum = 0;
+        for (auto it = begin; it != end; ++it) {
+          sum += *it;
+        }
+        return (256 - sum) & 0xFF;
+      }
+
+      /**
+       * @brief Generate CTA-861 extension block with the extra DTDs, and HDR metadata if enabled.
+       * @param hdr_enabled Whether to add the HDR static metadata and colorimetry blocks.
+       * @param dtds The timings to add as DTDs, as many as fit.
+       */
+      std::vector<unsigned char> generate_cta861_extension(bool hdr_enabled, const std::vector<timings_t> &dtds) {
+        std::vector<unsigned char> ext(128, 0);
+
+        // CTA Extension Header
+        ext[0] = 0x02;  // CTA-861 Extension Tag
+        ext[1] = 0x03;  // Revision 3
+        ext[2] = 0x00;  // No detailed timing descriptors
+        ext[3] = 0x00;  // No flags
+
+        // Data Block Collection starts at byte 4
+        int offset = 4;
+
+        // Video Data Block (VDB) - indicate support for common video formats
+        ext[offset++] = 0x40 | 0x03;  // Video Data Block, length 3
+        ext[offset++] = 0x10;  // VIC 16: 1080p60
+        ext[offset++] = 0x5F;  // VIC 95: 3840x2160p30
+        ext[offset++] = 0x61;  // VIC 97: 3840x2160p60
+
+        if (hdr_enabled) {
+          // HDR Static Metadata Data Block
+          ext[offset++] = 0x60 | 0x06;  // Extended tag, length 6
+          ext[offset++] = 0x06;  // Extended tag code for HDR Static Metadata
+          ext[offset++] = 0x03;  // ET: 0 (SDR), 1 (HDR10), 2 (HLG) - support bits 0 and 1
+          ext[offset++] = 0x00;  // Static Metadata Descriptor Type 1
+          // Max Luminance Data: 100 nits = 50 (encoded as 50 + 50 = 100 cd/m²)
+          ext[offset++] = 0x64;  // Desired content max luminance (100 cd/m²)
+          ext[offset++] = 0x5A;  // Desired content max frame-average luminance (90 cd/m²)
+          ext[offset++] = 0x00;  // Desired content min luminance (0.0001 cd/m²)
+
+          // Colorimetry Data Block
+          ext[offset++] = 0x70 | 0x02;  // Extended tag, length 2
+          ext[offset++] = 0x05;  // Extended tag code for Colorimetry
+          ext[offset++] = 0xC0;  // BT2020 RGB and BT2020 YCC support
+        }
+
+        // DTDs follow the data blocks
+        ext[2] = offset;
+        for (auto &timings : dtds) {
+          if (offset + DTD_SIZE > 127) {
+            break;
+          }
+
+          generate_dtd(&ext[offset], timings);
+          offset += DTD_SIZE;
+        }
+
+        // The rest is padding, up to the checksum
+        ext[127] = checksum(&ext[0], &ext[127]);
+
+        return ext;
+      }
+
+      /**
+       * @brief Generate a DisplayID 1.3 extension block with type I detailed timings.
+       * @param timings The timings to add, as many as fit.
+       * @param preferred The index of the timing to mark as preferred, or -1.
+       */
+      std::vector<unsigned char> generate_displayid_extension(const std::vector<timings_t> &timings, int preferred) {
+        std::vector<unsigned char> ext(128, 0);
+
+        // DisplayID Extension Header, then the header of its section
+        ext[0] = 0x70;  // DisplayID Extension Tag
+        ext[1] = 0x13;  // DisplayID version 1.3
+        ext[3] = 0x00;  // Extension section
+        ext[4] = 0x00;  // No extension sections follow
+
+        // Type I Detailed Timing Data Block
+        auto count = std::min(timings.size(), MAX_DISPLAYID_TIMINGS);
+        int offset = 5;
+        ext[offset++] = 0x03;  // Data block tag
+        ext[offset++] = 0x00;  // Revision 0
+        ext[offset++] = count * DISPLAYID_TIMING_SIZE;
+        for (std::size_t x = 0; x < count; ++x) {
+          generate_displayid_timing(&ext[offset], timings[x], (int) x == preferred);
+          offset += DISPLAYID_TIMING_SIZE;
+        }
+
+        // The section holds the bytes of its data blocks, followed by its own checksum
+        ext[2] = offset - 5;
+        ext[offset] = checksum(&ext[1], &ext[offset]);
+
+        ext[127] = checksum(&ext[0], &ext[127]);
+
+        return ext;
+      }
+    }  // namespace
+
+    timings_t cvt_rb2_timings(const display_mode_t &mode) {
+      // Constants of the CVT 1.2 reduced blanking v2 formula
+      constexpr double RB_MIN_V_BLANK = 460.0;  // Minimum vertical blanking time in µs
+      constexpr int RB_H_BLANK = 80;
+      constexpr int RB_H_FRONT_PORCH = 8;
+      constexpr int RB_H_SYNC = 32;
+      constexpr int RB_V_FRONT_PORCH_MIN = 1;
+      constexpr int RB_V_SYNC = 8;
+      constexpr int RB_V_BACK_PORCH = 6;
+
+      timings_t timings {};
+      timings.h_active = mode.width;
+      timings.h_blank = RB_H_BLANK;
+      timings.h_front_porch = RB_H_FRONT_PORCH;
+      timings.h_sync = RB_H_SYNC;
+
+      // Enough lines of blanking to last the minimum blanking time, at the line period of the mode
+      auto h_period_estimate = (1000000.0 / mode.refresh_rate - RB_MIN_V_BLANK) / mode.height;
+      auto v_blank = (int) (RB_MIN_V_BLANK / h_period_estimate) + 1;
+
+      timings.v_active = mode.height;
+      timings.v_blank = std::max(v_blank, RB_V_FRONT_PORCH_MIN + RB_V_SYNC + RB_V_BACK_PORCH);
+      timings.v_front_porch = timings.v_blank - RB_V_SYNC - RB_V_BACK_PORCH;
+      timings.v_sync = RB_V_SYNC;
+
+      // The pixel clock is rounded down to the 1 kHz clock step
+      std::int64_t total_pixels = (std::int64_t) (timings.h_active + timings.h_blank) * (timings.v_active + timings.v_blank);
+      timings.pixel_clock_khz = (int) (total_pixels * mode.refresh_rate / 1000);
+
+      return timings;
     }
 
-    /**
-     * @brief Generate an EDID based on the requested display mode.
-     * @param width Display width in pixels
-     * @param height Display height in pixels
-     * @param refresh_rate Display refresh rate in Hz
-     * @param hdr_enabled Whether HDR is enabled
-     * @return Vector containing the generated EDID
-     */
     std::vector<unsigned char> generate_edid(int width, int height, int refresh_rate, bool hdr_enabled) {
       std::vector<unsigned char> edid(base_edid, base_edid + sizeof(base_edid));
 
@@ -210,45 +365,121 @@ namespace platf {
         edid[20] = 0xA5;  // Digital input, 8 bits per color (bits 6-4 = 100b)
       }
 
-      // Generate custom DTD (Detailed Timing Descriptor) for the requested resolution
-      // DTD is located at bytes 54-71 (first descriptor block)
-      generate_dtd(&edid[54], width, height, refresh_rate);
-      
-      BOOST_LOG(debug) << "EVDI: Generated custom EDID with DTD for "sv << width << "x"sv << height 
-                       << "@"sv << refresh_rate << "Hz"sv;
+      // Modes that a DTD can't describe go to a DisplayID extension instead
+      std::vector<timings_t> dtds;
+      std::vector<timings_t> displayid;
+      int displayid_preferred = -1;
 
-      // Add HDR metadata extension block when HDR is enabled
-      if (hdr_enabled) {
-        BOOST_LOG(debug) << "EVDI: Generating CTA-861 extension block with HDR static metadata"sv;
-        
-        // Set extension flag in base EDID (byte 126)
-        edid[126] = 0x01;  // 1 extension block follows
-        
-        // Recalculate base EDID checksum
-        unsigned char base_checksum = 0;
-        for (size_t i = 0; i < 127; i++) {
-          base_checksum += edid[i];
-        }
-        edid[127] = (256 - base_checksum) & 0xFF;
-        
-        // Append CTA-861 extension
-        auto cta_ext = generate_cta861_hdr_extension();
-        edid.insert(edid.end(), cta_ext.begin(), cta_ext.end());
-        
-        BOOST_LOG(info) << "EVDI: HDR10 support enabled in EDID (BT.2020, 10-bit color)"sv;
+      // The first DTD is located at bytes 54-71 (first descriptor block), and is the preferred mode
+      display_mode_t preferred {width, height, refresh_rate};
+      auto preferred_timings = cvt_rb2_timings(preferred);
+      if (fits_dtd(preferred_timings)) {
+        generate_dtd(&edid[54], preferred_timings);
       }
       else {
-        // Calculate and update checksum for base EDID only
-        unsigned char checksum = 0;
-        for (size_t i = 0; i < edid.size() - 1; i++) {
-          checksum += edid[i];
+        // The kernel sorts preferred modes of the same size by refresh rate, so the DisplayID timing
+        // comes before the fastest refresh rate of the resolution that still fits in the first DTD
+        displayid_preferred = 0;
+        displayid.emplace_back(preferred_timings);
+
+        auto fallback = cvt_rb2_timings({1920, 1080, 60});
+        for (auto rate = refresh_rate - 1; rate >= 24; --rate) {
+          auto timings = cvt_rb2_timings({width, height, rate});
+          if (fits_dtd(timings)) {
+            fallback = timings;
+            break;
+          }
         }
-        edid[edid.size() - 1] = (256 - checksum) & 0xFF;
+        generate_dtd(&edid[54], fallback);
+      }
+
+      BOOST_LOG(debug) << "EVDI: Generated custom EDID with "sv << (displayid_preferred < 0 ? "DTD"sv : "DisplayID timing"sv)
+                       << " for "sv << width << "x"sv << height << "@"sv << refresh_rate << "Hz"sv
+                       << ", pixel clock "sv << preferred_timings.pixel_clock_khz << " kHz"sv;
+
+      for (auto &mode : extra_modes(preferred)) {
+        auto timings = cvt_rb2_timings(mode);
+        if (fits_dtd(timings) && dtds.size() < MAX_EXTENSION_DTDS) {
+          dtds.emplace_back(timings);
+        }
+        else if (displayid.size() < MAX_DISPLAYID_TIMINGS) {
+          displayid.emplace_back(timings);
+        }
+      }
+
+      // Add an extension block with the other modes, and the HDR metadata when HDR is enabled
+      BOOST_LOG(debug) << "EVDI: Generating CTA-861 extension block with "sv << dtds.size() << " extra modes"sv
+                       << (hdr_enabled ? " and HDR static metadata"sv : ""sv);
+      std::vector<std::vector<unsigned char>> extensions;
+      extensions.emplace_back(generate_cta861_extension(hdr_enabled, dtds));
+
+      if (!displayid.empty()) {
+        BOOST_LOG(debug) << "EVDI: Generating DisplayID extension block with "sv << displayid.size() << " timings"sv;
+        extensions.emplace_back(generate_displayid_extension(displayid, displayid_preferred));
+      }
+
+      // Set extension count in base EDID (byte 126), and recalculate its checksum
+      edid[126] = extensions.size();
+      edid[127] = checksum(&edid[0], &edid[127]);
+
+      for (auto &extension : extensions) {
+        edid.insert(edid.end(), extension.begin(), extension.end());
+      }
+
+      if (hdr_enabled) {
+        BOOST_LOG(info) << "EVDI: HDR10 support enabled in EDID (BT.2020, 10-bit color)"sv;
       }
 
       BOOST_LOG(debug) << "EVDI: Generated EDID size: "sv << edid.size() << " bytes"sv;
       return edid;
     }
+  }  // namespace evdi
+
+  namespace {
+    /**
+     * @brief The buffers registered with the EVDI handle by a capture.
+     * @details Images may be destroyed on other threads, and after the virtual display was destroyed.
+     *          Every use of the handle goes through the lock, and the handle is invalidated on destruction.
+     */
+    struct buffer_registry_t {
+      std::mutex lock;
+      evdi_handle handle = EVDI_INVALID_HANDLE;
+      std::vector<int> buffers;
+    };
+
+    // Global state for virtual display management
+    struct evdi_state_t {
+      evdi_handle handle = EVDI_INVALID_HANDLE;
+      std::atomic<bool> is_active = false;
+      int width = 1920;
+      int height = 1080;
+      int refresh_rate = 60;
+      bool hdr_enabled = false;
+
+      // The mode the EDID of the connected display prefers
+      evdi::display_mode_t edid_mode {};
+
+      // The mode is only reported once, when the compositor sets it
+      bool mode_set = false;
+      int bits_per_pixel = 0;
+
+      // The registry of the native capture, if there is one
+      std::weak_ptr<buffer_registry_t> registry;
+
+      // Buffer IDs are never reused, so a late update can't land in another capture's buffer
+      int next_buffer_id = 0;
+    };
+
+    evdi_state_t evdi_state;
+
+    // A preparation of the virtual display started ahead of the capture
+    std::mutex prepare_lock;
+    std::future<bool> pending_prepare;
+
+    // A teardown deferred until the grace period ends, guarded by prepare_lock
+    std::future<void> pending_teardown;
+    std::condition_variable teardown_cv;
+    bool teardown_cancelled = false;
 
     /**
      * @brief Event handler for mode changes.
@@ -260,6 +491,8 @@ namespace platf {
       evdi_state.width = mode.width;
       evdi_state.height = mode.height;
       evdi_state.refresh_rate = mode.refresh_rate;
+      evdi_state.bits_per_pixel = mode.bits_per_pixel;
+      evdi_state.mode_set = true;
     }
 
     /**
@@ -269,11 +502,75 @@ namespace platf {
       BOOST_LOG(debug) << "EVDI DPMS mode: "sv << dpms_mode;
     }
 
+    /**
+     * @brief What the event handlers report to the capture that handles the events.
+     */
+    struct capture_events_t {
+      // Raised once the requested buffer can be grabbed
+      bool update_ready = false;
+
+      // Raised when the cursor moved or changed, until a frame is captured with it
+      bool cursor_changed = false;
+
+      // The sprite the compositor set, or nullptr while the cursor is hidden
+      std::shared_ptr<const cursor_sprite_t> cursor_sprite;
+      std::int32_t cursor_x = 0;
+      std::int32_t cursor_y = 0;
+
+      std::uint64_t cursor_serial = 0;
+    };
+
     /**
      * @brief Event handler for update ready notifications.
+     * @param user_data Points to the capture_events_t of the capture.
      */
     void update_ready_handler(int buffer_to_be_updated, void *user_data) {
-      // Buffer is ready to be updated
+      ((capture_events_t *) user_data)->update_ready = true;
+    }
+
+    /**
+     * @brief Event handler for a new cursor sprite, only sent once cursor events are enabled.
+     * @param user_data Points to the capture_events_t of the capture.
+     */
+    void cursor_set_handler(struct evdi_cursor_set cursor_set, void *user_data) {
+      auto events = (capture_events_t *) user_data;
+
+      // libevdi allocates the buffer for the handler to free
+      auto free_buffer = util::fail_guard([&]() {
+        free(cursor_set.buffer);
+      });
+
+      // The kernel module only takes ARGB8888 cursors, which read as BGRA in memory
+      events->cursor_changed = true;
+      if (!cursor_set.enabled || !cursor_set.buffer) {
+        events->cursor_sprite.reset();
+        return;
+      }
+
+      auto sprite = std::make_shared<cursor_sprite_t>();
+      sprite->width = cursor_set.width;
+      sprite->height = cursor_set.height;
+      sprite->serial = ++events->cursor_serial;
+
+      auto row_size = sprite->width * 4;
+      sprite->pixels.resize(row_size * sprite->height);
+      for (int y = 0; y < sprite->height; ++y) {
+        std::copy_n((std::uint8_t *) cursor_set.buffer + y * cursor_set.stride, row_size, sprite->pixels.data() + y * row_size);
+      }
+
+      events->cursor_sprite = std::move(sprite);
+    }
+
+    /**
+     * @brief Event handler for cursor moves, only sent once cursor events are enabled.
+     * @param user_data Points to the capture_events_t of the capture.
+     */
+    void cursor_move_handler(struct evdi_cursor_move cursor_move, void *user_data) {
+      auto events = (capture_events_t *) user_data;
+
+      events->cursor_x = cursor_move.x;
+      events->cursor_y = cursor_move.y;
+      events->cursor_changed = true;
     }
 
     /**
@@ -283,6 +580,395 @@ namespace platf {
       BOOST_LOG(debug) << "EVDI CRTC state: "sv << state;
     }
 
+    // libevdi reports at most this many dirty rectangles per grab, merging the rest
+    constexpr int MAX_DIRTY_RECTS = 16;
+
+    // The grabs whose dirty rectangles are kept to bring older images up to date
+    constexpr std::size_t DAMAGE_HISTORY = 8;
+
+    // The compositor sets a mode on the connector some time after it was connected
+    constexpr auto MODE_TIMEOUT = 2s;
+
+    /**
+     * @brief Handle the events of the EVDI device until the compositor sets a mode on the connector.
+     * @param handle The handle of the connected device.
+     * @param timeout How long to wait for the mode.
+     * @return `true` if a mode is set.
+     */
+    bool wait_for_mode(evdi_handle handle, std::chrono::milliseconds timeout) {
+      evdi_event_context events {};
+      events.dpms_handler = dpms_handler;
+      events.mode_changed_handler = mode_changed_handler;
+      events.crtc_state_handler = crtc_state_handler;
+
+      pollfd pfd {evdi_get_event_ready(handle), POLLIN, 0};
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while (!evdi_state.mode_set) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left <= 0ms || poll(&pfd, 1, (int) left.count()) <= 0) {
+          return false;
+        }
+
+        evdi_handle_events(handle, &events);
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Copy a rectangle from one image to another of the same size.
+     */
+    void copy_rect(const img_t &src, img_t &dst, const evdi_rect &rect) {
+      auto x1 = std::clamp(rect.x1, 0, dst.width);
+      auto x2 = std::clamp(rect.x2, x1, dst.width);
+      auto y1 = std::clamp(rect.y1, 0, dst.height);
+      auto y2 = std::clamp(rect.y2, y1, dst.height);
+
+      auto offset = x1 * dst.pixel_pitch;
+      auto size = (x2 - x1) * dst.pixel_pitch;
+      for (auto y = y1; y < y2; ++y) {
+        std::copy_n(src.data + y * src.row_pitch + offset, size, dst.data + y * dst.row_pitch + offset);
+      }
+    }
+
+    /**
+     * @brief An image whose memory is registered with EVDI as a buffer to grab pixels into.
+     */
+    struct evdi_img_t: public img_t {
+      ~evdi_img_t() override {
+        auto registry = this->registry.lock();
+        if (!registry) {
+          return;
+        }
+
+        std::lock_guard lg {registry->lock};
+        if (registry->handle != EVDI_INVALID_HANDLE) {
+          evdi_unregister_buffer(registry->handle, id);
+        }
+        std::erase(registry->buffers, id);
+      }
+
+      std::unique_ptr<std::uint8_t[]> buffer;
+      int id;
+
+      // The grab this image is up to date with, or 0 if it holds no grab
+      std::uint64_t generation = 0;
+
+      std::weak_ptr<buffer_registry_t> registry;
+    };
+
+    /**
+     * @brief Capture the virtual display from the buffers of libevdi, without going through KMS.
+     * @details The kernel only copies the rectangles that changed since the previous grab into a buffer.
+     *          Every image of the pool is a registered buffer, so before an image is grabbed into,
+     *          the rectangles it missed are copied into it from the latest image.
+     *          When the encode device converts on the GPU, cursor events are enabled, which keeps the cursor
+     *          out of the buffers. Moving it then doesn't dirty the frame, it only hands the latest image
+     *          on with the new cursor, for the conversion to blend in. Otherwise the kernel draws the cursor.
+     */
+    class evdi_display_t: public display_t {
+    public:
+      explicit evdi_display_t(mem_type_e mem_type):
+          mem_type {mem_type},
+          registry {std::make_shared<buffer_registry_t>()} {
+        events.dpms_handler = dpms_handler;
+        events.mode_changed_handler = mode_changed_handler;
+        events.update_ready_handler = update_ready_handler;
+        events.crtc_state_handler = crtc_state_handler;
+        events.cursor_set_handler = cursor_set_handler;
+        events.cursor_move_handler = cursor_move_handler;
+        events.user_data = &reported;
+      }
+
+      ~evdi_display_t() override {
+        std::lock_guard lg {registry->lock};
+        if (registry->handle != EVDI_INVALID_HANDLE) {
+          for (auto id : registry->buffers) {
+            evdi_unregister_buffer(registry->handle, id);
+          }
+
+          // A capture through KMS relies on the kernel drawing the cursor
+          if (overlay_cursor) {
+            evdi_enable_cursor_events(registry->handle, false);
+          }
+        }
+        registry->buffers.clear();
+        registry->handle = EVDI_INVALID_HANDLE;
+      }
+
+      int init(const ::video::config_t &config) {
+        if (!evdi_state.registry.expired()) {
+          BOOST_LOG(warning) << "EVDI: The virtual display is already captured from its buffers"sv;
+          return -1;
+        }
+
+        registry->handle = evdi_state.handle;
+        event_fd = evdi_get_event_ready(registry->handle);
+
+        auto deadline = std::chrono::steady_clock::now() + MODE_TIMEOUT;
+        while (!evdi_state.mode_set) {
+          if (!handle_events(deadline)) {
+            BOOST_LOG(warning) << "EVDI: No mode was set on the virtual display"sv;
+            return -1;
+          }
+        }
+
+        if (evdi_state.bits_per_pixel != 32) {
+          BOOST_LOG(warning) << "EVDI: Unsupported mode with "sv << evdi_state.bits_per_pixel << " bits per pixel"sv;
+          return -1;
+        }
+
+        width = evdi_state.width;
+        height = evdi_state.height;
+        env_width = width;
+        env_height = height;
+
+        delay = std::chrono::nanoseconds {1s} / config.framerate;
+
+        // Only the conversions on the GPU blend the cursor in, the software encoder needs it in the pixels
+        overlay_cursor = mem_type == mem_type_e::vaapi || mem_type == mem_type_e::cuda;
+        if (overlay_cursor) {
+          evdi_enable_cursor_events(registry->handle, true);
+        }
+
+        evdi_state.registry = registry;
+
+        return 0;
+      }
+
+      capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+        auto next_frame = std::chrono::steady_clock::now();
+
+        sleep_overshoot_logger.reset();
+
+        while (true) {
+          auto now = std::chrono::steady_clock::now();
+
+          if (next_frame > now) {
+            std::this_thread::sleep_for(next_frame - now);
+            sleep_overshoot_logger.first_point(next_frame);
+            sleep_overshoot_logger.second_point_now_and_log();
+          }
+
+          next_frame += delay;
+          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+            next_frame = now + delay;
+          }
+
+          std::shared_ptr<platf::img_t> img_out;
+          auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+          switch (status) {
+            case platf::capture_e::reinit:
+            case platf::capture_e::error:
+            case platf::capture_e::interrupted:
+              return status;
+            case platf::capture_e::timeout:
+              if (!push_captured_image_cb(std::move(img_out), false)) {
+                return platf::capture_e::ok;
+              }
+              break;
+            case platf::capture_e::ok:
+              if (!push_captured_image_cb(std::move(img_out), true)) {
+                return platf::capture_e::ok;
+              }
+              break;
+            default:
+              BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+              return status;
+          }
+        }
+
+        return capture_e::ok;
+      }
+
+      capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+        auto img = (evdi_img_t *) img_out.get();
+
+        catch_up(*img);
+
+        // Without pending changes, the kernel raises the update ready event once something is drawn
+        reported.update_ready = false;
+        {
+          std::lock_guard lg {registry->lock};
+          if (registry->handle == EVDI_INVALID_HANDLE) {
+            return capture_e::error;
+          }
+
+          reported.update_ready = evdi_request_update(registry->handle, img->id);
+        }
+
+        // A cursor that moved over an unchanged frame only needs the latest image to be handed on
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!reported.update_ready && !(cursor && reported.cursor_changed && latest)) {
+          if (!handle_events(deadline)) {
+            return capture_e::timeout;
+          }
+        }
+
+        if (evdi_state.width != width || evdi_state.height != height || evdi_state.bits_per_pixel != 32) {
+          BOOST_LOG(info) << "EVDI: The mode of the virtual display changed, request reinit"sv;
+          return capture_e::reinit;
+        }
+
+        std::vector<evdi_rect> rects(MAX_DIRTY_RECTS);
+        int num_rects = 0;
+        if (reported.update_ready) {
+          std::lock_guard lg {registry->lock};
+          if (registry->handle == EVDI_INVALID_HANDLE) {
+            return capture_e::error;
+          }
+
+          evdi_grab_pixels(registry->handle, rects.data(), &num_rects);
+        }
+        img->frame_timestamp = std::chrono::steady_clock::now();
+
+        if (num_rects > 0) {
+          rects.resize(num_rects);
+
+          damage.emplace_back(std::move(rects));
+          if (damage.size() > DAMAGE_HISTORY) {
+            damage.pop_front();
+          }
+
+          img->generation = ++generation;
+          latest = img_out;
+        } else if (!(cursor && reported.cursor_changed && latest)) {
+          return capture_e::timeout;
+        }
+
+        if (cursor && reported.cursor_sprite) {
+          img->cursor = util::point_t {(double) reported.cursor_x, (double) reported.cursor_y};
+          img->cursor_sprite = reported.cursor_sprite;
+        } else {
+          img->cursor = std::nullopt;
+          img->cursor_sprite.reset();
+        }
+        reported.cursor_changed = false;
+
+        return capture_e::ok;
+      }
+
+      bool img_in_system_memory() override {
+        return true;
+      }
+
+      std::shared_ptr<img_t> alloc_img() override {
+        auto img = std::make_shared<evdi_img_t>();
+        img->width = width;
+        img->height = height;
+        img->pixel_pitch = 4;
+        img->row_pitch = img->pixel_pitch * width;
+        img->buffer = std::make_unique<std::uint8_t[]>(height * img->row_pitch);
+        img->data = img->buffer.get();
+        img->registry = registry;
+
+        std::lock_guard lg {registry->lock};
+        if (registry->handle == EVDI_INVALID_HANDLE) {
+          return nullptr;
+        }
+
+        img->id = evdi_state.next_buffer_id++;
+
+        evdi_buffer buffer {};
+        buffer.id = img->id;
+        buffer.buffer = img->data;
+        buffer.width = img->width;
+        buffer.height = img->height;
+        buffer.stride = img->row_pitch;
+        evdi_register_buffer(registry->handle, buffer);
+        registry->buffers.emplace_back(img->id);
+
+        return img;
+      }
+
+      int dummy_img(img_t *img) override {
+        std::fill_n(img->data, img->height * img->row_pitch, 0);
+        ((evdi_img_t *) img)->generation = 0;
+
+        return 0;
+      }
+
+      std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+        if (mem_type == mem_type_e::vaapi) {
+          return va::make_avcodec_encode_device(width, height, false);
+        }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+        if (mem_type == mem_type_e::cuda) {
+          return cuda::make_avcodec_encode_device(width, height, false);
+        }
+#endif
+
+        return std::make_unique<avcodec_encode_device_t>();
+      }
+
+    private:
+      /**
+       * @brief Wait for the events of the EVDI device, and handle them.
+       * @param deadline When to stop waiting.
+       * @return `false` if no event came before the deadline.
+       */
+      bool handle_events(std::chrono::steady_clock::time_point deadline) {
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+        pollfd pfd {event_fd, POLLIN, 0};
+        if (poll(&pfd, 1, std::max(0, (int) timeout.count())) <= 0) {
+          return false;
+        }
+
+        std::lock_guard lg {registry->lock};
+        if (registry->handle == EVDI_INVALID_HANDLE) {
+          return false;
+        }
+
+        evdi_handle_events(registry->handle, &events);
+        return true;
+      }
+
+      /**
+       * @brief Copy the rectangles that changed since an image was last grabbed into from the latest image.
+       */
+      void catch_up(evdi_img_t &img) {
+        if (!latest || img.generation == generation) {
+          return;
+        }
+
+        auto missed = generation - img.generation;
+        if (img.generation == 0 || missed > damage.size()) {
+          std::copy_n(latest->data, height * latest->row_pitch, img.data);
+        } else {
+          for (auto it = std::end(damage) - missed; it != std::end(damage); ++it) {
+            for (auto &rect : *it) {
+              copy_rect(*latest, img, rect);
+            }
+          }
+        }
+
+        img.generation = generation;
+      }
+
+      mem_type_e mem_type;
+      std::chrono::nanoseconds delay;
+
+      std::shared_ptr<buffer_registry_t> registry;
+      evdi_selectable event_fd = -1;
+      evdi_event_context events {};
+      capture_events_t reported;
+
+      // Whether cursor events are enabled, so the kernel leaves the cursor out of the buffers
+      bool overlay_cursor = false;
+
+      // The dirty rectangles of the last grabs, the last one being the latest grab
+      std::deque<std::vector<evdi_rect>> damage;
+      std::uint64_t generation = 0;
+      std::shared_ptr<img_t> latest;
+    };
+
   }  // anonymous namespace
 
   std::vector<std::string> evdi_display_names() {
@@ -321,152 +1007,308 @@ namespace platf {
     return evdi_state.is_active;
   }
 
-  bool evdi_prepare_stream(const video::config_t &config) {
-    if (evdi_state.is_active) {
-      BOOST_LOG(warning) << "EVDI virtual display already active"sv;
+  namespace {
+    /**
+     * @brief Adapt the connected virtual display to a session by replacing its EDID, without disconnecting it.
+     * @details The compositor keeps its output, and only does a modeset to the new preferred mode.
+     * @param config The video configuration from the client (resolution, framerate, HDR).
+     * @return true if successful, false otherwise.
+     */
+    bool switch_mode(const video::config_t &config) {
+      evdi::display_mode_t mode {config.width, config.height, config.framerate};
+      bool hdr_enabled = config.dynamicRange > 0;
+
+      if (mode.width == evdi_state.edid_mode.width && mode.height == evdi_state.edid_mode.height &&
+          mode.refresh_rate == evdi_state.edid_mode.refresh_rate && hdr_enabled == evdi_state.hdr_enabled) {
+        BOOST_LOG(debug) << "EVDI: Persistent virtual display already prefers the requested mode"sv;
+        return true;
+      }
+
+      BOOST_LOG(info) << "EVDI: Switching persistent virtual display to "sv
+                      << mode.width << "x"sv << mode.height << "@"sv << mode.refresh_rate << "Hz"
+                      << (hdr_enabled ? " (HDR)"sv : ""sv);
+
+      // An HDR change alone may not change the mode, in which case no mode is reported
+      bool mode_changes = mode.width != evdi_state.width || mode.height != evdi_state.height || mode.refresh_rate != evdi_state.refresh_rate;
+      if (mode_changes) {
+        evdi_state.mode_set = false;
+      }
+
+      auto edid = evdi::generate_edid(mode.width, mode.height, mode.refresh_rate, hdr_enabled);
+      try {
+        // Connecting again replaces the EDID, and the kernel sends a hotplug event for it
+        evdi_connect(evdi_state.handle, edid.data(), edid.size(), 0);
+      }
+      catch (...) {
+        BOOST_LOG(error) << "EVDI: Exception while replacing the EDID of the virtual display"sv;
+        return false;
+      }
+
+      evdi_state.edid_mode = mode;
+      evdi_state.hdr_enabled = hdr_enabled;
+
+      auto start = std::chrono::steady_clock::now();
+      if (!mode_changes) {
+        return true;
+      }
+      if (wait_for_mode(evdi_state.handle, MODE_TIMEOUT)) {
+        BOOST_LOG(debug) << "EVDI: Mode switched after "sv << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms"sv;
+      }
+      else {
+        BOOST_LOG(warning) << "EVDI: The compositor didn't switch the mode of the virtual display yet, continuing anyway"sv;
+      }
+
       return true;
     }
 
-    BOOST_LOG(info) << "Preparing EVDI virtual display for streaming session"sv;
-    BOOST_LOG(debug) << "EVDI: Requested display config: "sv << config.width << "x"sv << config.height 
-                     << "@"sv << config.framerate << "Hz, dynamicRange="sv << config.dynamicRange;
+    /**
+     * @brief Connect the virtual display, and wait until the compositor has set a mode on it.
+     * @param config The video configuration from the client (resolution, framerate, HDR).
+     * @return true if successful, false otherwise.
+     */
+    bool connect_virtual_display(const video::config_t &config) {
+      if (evdi_state.is_active) {
+        if (config::video.evdi_persistent) {
+          return switch_mode(config);
+        }
 
-    // Check if the EVDI kernel module is properly loaded by checking for sysfs interface
-    BOOST_LOG(debug) << "EVDI: Checking if kernel module is properly loaded..."sv;
-    if (access("/sys/devices/evdi", F_OK) != 0) {
-      BOOST_LOG(error) << "EVDI: /sys/devices/evdi does not exist"sv;
-      BOOST_LOG(error) << "EVDI: The evdi kernel module is either not loaded or failed to initialize"sv;
-      BOOST_LOG(error) << "EVDI: Install evdi-dkms package (v1.14.11) and run: sudo modprobe evdi"sv;
-      BOOST_LOG(debug) << "EVDI: After loading, verify with: ls -la /sys/devices/evdi/"sv;
-      BOOST_LOG(debug) << "EVDI: Check kernel logs with: dmesg | grep evdi"sv;
-      return false;
-    }
+        BOOST_LOG(warning) << "EVDI virtual display already active"sv;
+        return true;
+      }
+
+      BOOST_LOG(info) << "Preparing EVDI virtual display for streaming session"sv;
+      BOOST_LOG(debug) << "EVDI: Requested display config: "sv << config.width << "x"sv << config.height 
+                       << "@"sv << config.framerate << "Hz, dynamicRange="sv << config.dynamicRange;
+
+      // Check if the EVDI kernel module is properly loaded by checking for sysfs interface
+      BOOST_LOG(debug) << "EVDI: Checking if kernel module is properly loaded..."sv;
+      if (access("/sys/devices/evdi", F_OK) != 0) {
+        BOOST_LOG(error) << "EVDI: /sys/devices/evdi does not exist"sv;
+        BOOST_LOG(error) << "EVDI: The evdi kernel module is either not loaded or failed to initialize"sv;
+        BOOST_LOG(error) << "EVDI: Install evdi-dkms package (v1.14.11) and run: sudo modprobe evdi"sv;
+        BOOST_LOG(debug) << "EVDI: After loading, verify with: ls -la /sys/devices/evdi/"sv;
+        BOOST_LOG(debug) << "EVDI: Check kernel logs with: dmesg | grep evdi"sv;
+        return false;
+      }
     
-    BOOST_LOG(debug) << "EVDI: Kernel module loaded, searching for available EVDI device nodes..."sv;
-
-    // Iterate through device nodes to find an EVDI device using evdi_check_device()
-    // As per EVDI documentation: "In order to distinguish non-EVDI nodes from a node 
-    // that's created by EVDI kernel module, evdi_check_device function should be used."
-    // We scan /dev/dri/card* devices to find EVDI virtual displays
-    int found_device_index = -1;
-    for (int i = 0; i < 16; i++) {  // Check card0 through card15
-      evdi_device_status status = evdi_check_device(i);
+      BOOST_LOG(debug) << "EVDI: Kernel module loaded, searching for available EVDI device nodes..."sv;
+
+      // Iterate through device nodes to find an EVDI device using evdi_check_device()
+      // As per EVDI documentation: "In order to distinguish non-EVDI nodes from a node 
+      // that's created by EVDI kernel module, evdi_check_device function should be used."
+      // We scan /dev/dri/card* devices to find EVDI virtual displays
+      int found_device_index = -1;
+      for (int i = 0; i < 16; i++) {  // Check card0 through card15
+        evdi_device_status status = evdi_check_device(i);
       
-      if (status == AVAILABLE) {
-        BOOST_LOG(debug) << "EVDI: Found available EVDI device at index "sv << i;
-        found_device_index = i;
-        break;
-      }
-      else if (status == UNRECOGNIZED) {
-        // Not an EVDI device, continue searching
-        continue;
+        if (status == AVAILABLE) {
+          BOOST_LOG(debug) << "EVDI: Found available EVDI device at index "sv << i;
+          found_device_index = i;
+          break;
+        }
+        else if (status == UNRECOGNIZED) {
+          // Not an EVDI device, continue searching
+          continue;
+        }
+        else if (status == NOT_PRESENT) {
+          // Device node doesn't exist
+          continue;
+        }
       }
-      else if (status == NOT_PRESENT) {
-        // Device node doesn't exist
-        continue;
+    
+      if (found_device_index < 0) {
+        BOOST_LOG(error) << "EVDI: No available EVDI device found"sv;
+        BOOST_LOG(error) << "EVDI: The EVDI kernel module may not have created any device nodes"sv;
+        BOOST_LOG(error) << "EVDI: Ensure evdi-dkms is properly installed and the kernel module is loaded"sv;
+        BOOST_LOG(info) << "EVDI: Try: sudo modprobe evdi"sv;
+        BOOST_LOG(debug) << "EVDI: Check device nodes: ls -la /dev/dri/card*"sv;
+        BOOST_LOG(debug) << "EVDI: Check kernel logs: dmesg | grep evdi"sv;
+        return false;
       }
-    }
     
-    if (found_device_index < 0) {
-      BOOST_LOG(error) << "EVDI: No available EVDI device found"sv;
-      BOOST_LOG(error) << "EVDI: The EVDI kernel module may not have created any device nodes"sv;
-      BOOST_LOG(error) << "EVDI: Ensure evdi-dkms is properly installed and the kernel module is loaded"sv;
-      BOOST_LOG(info) << "EVDI: Try: sudo modprobe evdi"sv;
-      BOOST_LOG(debug) << "EVDI: Check device nodes: ls -la /dev/dri/card*"sv;
-      BOOST_LOG(debug) << "EVDI: Check kernel logs: dmesg | grep evdi"sv;
-      return false;
-    }
+      BOOST_LOG(info) << "EVDI: Using EVDI device at index "sv << found_device_index;
     
-    BOOST_LOG(info) << "EVDI: Using EVDI device at index "sv << found_device_index;
+      // Open the EVDI device
+      evdi_handle handle = EVDI_INVALID_HANDLE;
+      try {
+        handle = evdi_open(found_device_index);
+        BOOST_LOG(debug) << "EVDI: evdi_open("sv << found_device_index << ") returned handle="sv << (void*)handle;
+      }
+      catch (const std::exception &e) {
+        BOOST_LOG(error) << "EVDI: Exception in evdi_open(): "sv << e.what();
+        BOOST_LOG(error) << "EVDI: This indicates a problem with the EVDI library or kernel module"sv;
+        return false;
+      }
+      catch (...) {
+        BOOST_LOG(error) << "EVDI: Unknown exception in evdi_open()"sv;
+        BOOST_LOG(error) << "EVDI: This indicates a serious problem with the EVDI library or kernel module"sv;
+        return false;
+      }
     
-    // Open the EVDI device
-    evdi_handle handle = EVDI_INVALID_HANDLE;
-    try {
-      handle = evdi_open(found_device_index);
-      BOOST_LOG(debug) << "EVDI: evdi_open("sv << found_device_index << ") returned handle="sv << (void*)handle;
-    }
-    catch (const std::exception &e) {
-      BOOST_LOG(error) << "EVDI: Exception in evdi_open(): "sv << e.what();
-      BOOST_LOG(error) << "EVDI: This indicates a problem with the EVDI library or kernel module"sv;
-      return false;
-    }
-    catch (...) {
-      BOOST_LOG(error) << "EVDI: Unknown exception in evdi_open()"sv;
-      BOOST_LOG(error) << "EVDI: This indicates a serious problem with the EVDI library or kernel module"sv;
-      return false;
-    }
+      evdi_state.handle = handle;
     
-    evdi_state.handle = handle;
+      if (evdi_state.handle == EVDI_INVALID_HANDLE) {
+        BOOST_LOG(error) << "EVDI: Failed to open EVDI device at index "sv << found_device_index;
+        BOOST_LOG(error) << "EVDI: evdi_open() returned EVDI_INVALID_HANDLE"sv;
+        BOOST_LOG(debug) << "EVDI: Check device permissions: ls -la /dev/dri/card"sv << found_device_index;
+        BOOST_LOG(debug) << "EVDI: Check kernel logs: dmesg | grep evdi"sv;
+        return false;
+      }
     
-    if (evdi_state.handle == EVDI_INVALID_HANDLE) {
-      BOOST_LOG(error) << "EVDI: Failed to open EVDI device at index "sv << found_device_index;
-      BOOST_LOG(error) << "EVDI: evdi_open() returned EVDI_INVALID_HANDLE"sv;
-      BOOST_LOG(debug) << "EVDI: Check device permissions: ls -la /dev/dri/card"sv << found_device_index;
-      BOOST_LOG(debug) << "EVDI: Check kernel logs: dmesg | grep evdi"sv;
-      return false;
+      // Successfully opened EVDI device
+      BOOST_LOG(info) << "EVDI: Opened EVDI virtual display device"sv;
+      BOOST_LOG(debug) << "EVDI: Device handle: "sv << (void*)evdi_state.handle;
+
+      // Configure display parameters from client config
+      evdi_state.width = config.width;
+      evdi_state.height = config.height;
+      evdi_state.refresh_rate = config.framerate;
+
+      // Check if HDR is requested (10-bit color depth)
+      evdi_state.hdr_enabled = (config.dynamicRange > 0);
+
+      // Generate EDID for the requested mode
+      BOOST_LOG(debug) << "EVDI: Generating EDID for "sv << evdi_state.width << "x"sv << evdi_state.height
+                       << "@"sv << evdi_state.refresh_rate << "Hz"sv;
+      auto edid = evdi::generate_edid(evdi_state.width, evdi_state.height,
+                                evdi_state.refresh_rate, evdi_state.hdr_enabled);
+      evdi_state.edid_mode = {evdi_state.width, evdi_state.height, evdi_state.refresh_rate};
+
+      BOOST_LOG(info) << "EVDI: Connecting virtual display: "sv
+                      << evdi_state.width << "x"sv << evdi_state.height
+                      << "@"sv << evdi_state.refresh_rate << "Hz"
+                      << (evdi_state.hdr_enabled ? " (HDR)"sv : ""sv);
+
+      // Connect the display with the EDID
+      BOOST_LOG(debug) << "EVDI: Calling evdi_connect() with "sv << edid.size() << " byte EDID"sv;
+      try {
+        evdi_connect(evdi_state.handle, edid.data(), edid.size(), 0);
+        BOOST_LOG(debug) << "EVDI: evdi_connect() completed successfully"sv;
+      }
+      catch (const std::exception &e) {
+        BOOST_LOG(error) << "EVDI: Exception in evdi_connect(): "sv << e.what();
+        evdi_close(evdi_state.handle);
+        evdi_state.handle = EVDI_INVALID_HANDLE;
+        return false;
+      }
+      catch (...) {
+        BOOST_LOG(error) << "EVDI: Unknown exception in evdi_connect()"sv;
+        evdi_close(evdi_state.handle);
+        evdi_state.handle = EVDI_INVALID_HANDLE;
+        return false;
+      }
+
+      BOOST_LOG(debug) << "EVDI: Waiting for the compositor to set a mode on the virtual display..."sv;
+      auto start = std::chrono::steady_clock::now();
+      if (wait_for_mode(evdi_state.handle, MODE_TIMEOUT)) {
+        BOOST_LOG(debug) << "EVDI: Mode set after "sv << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms"sv;
+      }
+      else {
+        BOOST_LOG(warning) << "EVDI: No mode was set on the virtual display yet, continuing anyway"sv;
+      }
+
+      // Only mark as active once ready, since evdi_display() may be called from another thread
+      evdi_state.is_active = true;
+
+      BOOST_LOG(info) << "EVDI: Virtual display configured successfully"sv;
+      BOOST_LOG(debug) << "EVDI: Display state - width="sv << evdi_state.width 
+                       << ", height="sv << evdi_state.height 
+                       << ", refresh_rate="sv << evdi_state.refresh_rate;
+
+      return true;
     }
-    
-    // Successfully opened EVDI device
-    BOOST_LOG(info) << "EVDI: Opened EVDI virtual display device"sv;
-    BOOST_LOG(debug) << "EVDI: Device handle: "sv << (void*)evdi_state.handle;
-
-    // Configure display parameters from client config
-    evdi_state.width = config.width;
-    evdi_state.height = config.height;
-    evdi_state.refresh_rate = config.framerate;
-
-    // Check if HDR is requested (10-bit color depth)
-    evdi_state.hdr_enabled = (config.dynamicRange > 0);
-
-    // Generate EDID for the requested mode
-    BOOST_LOG(debug) << "EVDI: Generating EDID for "sv << evdi_state.width << "x"sv << evdi_state.height
-                     << "@"sv << evdi_state.refresh_rate << "Hz"sv;
-    auto edid = generate_edid(evdi_state.width, evdi_state.height,
-                              evdi_state.refresh_rate, evdi_state.hdr_enabled);
-
-    BOOST_LOG(info) << "EVDI: Connecting virtual display: "sv
-                    << evdi_state.width << "x"sv << evdi_state.height
-                    << "@"sv << evdi_state.refresh_rate << "Hz"
-                    << (evdi_state.hdr_enabled ? " (HDR)"sv : ""sv);
-
-    // Connect the display with the EDID
-    BOOST_LOG(debug) << "EVDI: Calling evdi_connect() with "sv << edid.size() << " byte EDID"sv;
-    try {
-      evdi_connect(evdi_state.handle, edid.data(), edid.size(), 0);
-      BOOST_LOG(debug) << "EVDI: evdi_connect() completed successfully"sv;
+
+    /**
+     * @brief Cancel a deferred teardown, and keep the virtual display if it's compatible with the new session.
+     * @param config The video configuration of the new session.
+     */
+    void cancel_teardown(const video::config_t &config) {
+      std::future<void> pending;
+      {
+        std::lock_guard lg {prepare_lock};
+        if (!pending_teardown.valid()) {
+          return;
+        }
+
+        teardown_cancelled = true;
+        pending = std::move(pending_teardown);
+      }
+      teardown_cv.notify_all();
+
+      // The grace period may have just ended
+      pending.wait();
+      if (!evdi_state.is_active) {
+        return;
+      }
+
+      if (config.width == evdi_state.edid_mode.width && config.height == evdi_state.edid_mode.height &&
+          config.framerate == evdi_state.edid_mode.refresh_rate && (config.dynamicRange > 0) == evdi_state.hdr_enabled) {
+        BOOST_LOG(info) << "EVDI: Keeping the virtual display of the previous session"sv;
+        return;
+      }
+
+      BOOST_LOG(info) << "EVDI: The virtual display of the previous session doesn't match the new session"sv;
+      evdi_destroy_virtual_display();
     }
-    catch (const std::exception &e) {
-      BOOST_LOG(error) << "EVDI: Exception in evdi_connect(): "sv << e.what();
-      evdi_close(evdi_state.handle);
-      evdi_state.handle = EVDI_INVALID_HANDLE;
-      return false;
+  }  // namespace
+
+  void evdi_prepare_stream_async(const video::config_t &config) {
+    cancel_teardown(config);
+
+    std::lock_guard lg {prepare_lock};
+    if ((evdi_state.is_active && !config::video.evdi_persistent) || (pending_prepare.valid() && pending_prepare.wait_for(0s) != std::future_status::ready)) {
+      return;
     }
-    catch (...) {
-      BOOST_LOG(error) << "EVDI: Unknown exception in evdi_connect()"sv;
-      evdi_close(evdi_state.handle);
-      evdi_state.handle = EVDI_INVALID_HANDLE;
-      return false;
+
+    BOOST_LOG(debug) << "EVDI: Connecting the virtual display in the background"sv;
+    pending_prepare = std::async(std::launch::async, connect_virtual_display, config);
+  }
+
+  void evdi_connect_persistent_display() {
+    if (!config::video.evdi_persistent) {
+      return;
     }
 
-    // Mark as active before waiting for KMS detection
-    evdi_state.is_active = true;
+    BOOST_LOG(info) << "EVDI: Connecting the persistent virtual display"sv;
 
-    BOOST_LOG(info) << "EVDI: Virtual display configured successfully"sv;
-    BOOST_LOG(debug) << "EVDI: Display state - width="sv << evdi_state.width 
-                     << ", height="sv << evdi_state.height 
-                     << ", refresh_rate="sv << evdi_state.refresh_rate;
-    
-    // Wait for KMS to detect the newly configured display
-    // The kernel DRM subsystem needs time to enumerate the new EVDI connector
-    constexpr auto KMS_DETECTION_WAIT_MS = 500;
-    BOOST_LOG(debug) << "EVDI: Waiting "sv << KMS_DETECTION_WAIT_MS << "ms for KMS to detect display..."sv;
-    std::this_thread::sleep_for(std::chrono::milliseconds(KMS_DETECTION_WAIT_MS));
-    BOOST_LOG(debug) << "EVDI: KMS detection wait complete"sv;
-    
-    return true;
+    video::config_t config {};
+    config.width = evdi_state.width;
+    config.height = evdi_state.height;
+    config.framerate = evdi_state.refresh_rate;
+    evdi_prepare_stream_async(config);
+  }
+
+  bool evdi_prepare_stream(const video::config_t &config) {
+    cancel_teardown(config);
+
+    std::future<bool> pending;
+    {
+      std::lock_guard lg {prepare_lock};
+      pending = std::move(pending_prepare);
+    }
+
+    if (pending.valid()) {
+      BOOST_LOG(debug) << "EVDI: Waiting for the virtual display connected in the background"sv;
+      // A persistent display may still have to switch to the client's mode
+      if (pending.get() && evdi_state.is_active && !config::video.evdi_persistent) {
+        return true;
+      }
+    }
+
+    return connect_virtual_display(config);
   }
 
   void evdi_destroy_virtual_display() {
+    // Don't let a preparation in the background connect the display after it was destroyed
+    std::future<bool> pending;
+    {
+      std::lock_guard lg {prepare_lock};
+      pending = std::move(pending_prepare);
+    }
+    if (pending.valid()) {
+      pending.wait();
+    }
+
     if (!evdi_state.is_active) {
       BOOST_LOG(debug) << "EVDI: destroy_virtual_display called but display not active"sv;
       return;
@@ -474,6 +1316,13 @@ namespace platf {
 
     BOOST_LOG(info) << "EVDI: Destroying virtual display"sv;
 
+    // A capture may still hold images registered with the handle
+    if (auto registry = evdi_state.registry.lock()) {
+      std::lock_guard lg {registry->lock};
+      registry->buffers.clear();
+      registry->handle = EVDI_INVALID_HANDLE;
+    }
+
     if (evdi_state.handle != EVDI_INVALID_HANDLE) {
       BOOST_LOG(debug) << "EVDI: Disconnecting and closing device handle"sv;
       try {
@@ -491,29 +1340,66 @@ namespace platf {
     }
 
     evdi_state.is_active = false;
+    evdi_state.mode_set = false;
 
     BOOST_LOG(info) << "EVDI: Virtual display destroyed"sv;
   }
 
+  void evdi_destroy_virtual_display_later(std::chrono::milliseconds delay) {
+    if (delay <= 0ms) {
+      evdi_destroy_virtual_display();
+      return;
+    }
+
+    std::lock_guard lg {prepare_lock};
+    if (pending_teardown.valid() && pending_teardown.wait_for(0s) != std::future_status::ready) {
+      return;
+    }
+
+    BOOST_LOG(debug) << "EVDI: Destroying the virtual display in "sv << delay.count() << "ms, unless a session starts"sv;
+    teardown_cancelled = false;
+    pending_teardown = std::async(std::launch::async, [delay]() {
+      {
+        std::unique_lock ul {prepare_lock};
+        if (teardown_cv.wait_for(ul, delay, []() {
+              return teardown_cancelled;
+            })) {
+          return;
+        }
+      }
+
+      evdi_destroy_virtual_display();
+    });
+  }
+
   std::shared_ptr<display_t> evdi_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
     BOOST_LOG(debug) << "EVDI: evdi_display() called - hwdevice_type="sv << (int)hwdevice_type 
                      << ", display_name='"sv << display_name << "', is_active="sv << evdi_state.is_active;
-    
-#ifndef SUNSHINE_BUILD_DRM
-    BOOST_LOG(error) << "EVDI: EVDI requires KMS/DRM support to be enabled"sv;
-    return nullptr;
-#else
+
     // EVDI virtual display must be explicitly created via evdi_prepare_stream() before calling this
     // During encoder validation at startup, we don't have a display yet - return nullptr gracefully
-    
+
     if (!evdi_state.is_active) {
       // This is expected during encoder validation - encoder will use default capabilities
       BOOST_LOG(debug) << "EVDI: Virtual display not yet created - call evdi_prepare_stream() before streaming"sv;
       return nullptr;
     }
-    
+
     BOOST_LOG(debug) << "EVDI: Using active virtual display"sv;
 
+    // Grab the pixels from libevdi directly, which doesn't need the privileges of KMS capture
+    auto disp = std::make_shared<evdi_display_t>(hwdevice_type);
+    if (!disp->init(config)) {
+      BOOST_LOG(info) << "EVDI: Capturing "sv << disp->width << "x"sv << disp->height << " from the virtual display buffers"sv;
+      return disp;
+    }
+
+#ifndef SUNSHINE_BUILD_DRM
+    BOOST_LOG(error) << "EVDI: Falling back to KMS capture requires KMS/DRM support to be enabled"sv;
+    return nullptr;
+#else
+    BOOST_LOG(warning) << "EVDI: Falling back to KMS capture of the virtual display"sv;
+
     // Use KMS capture to grab from the virtual display
     // The virtual display should now appear as a DRM device that can be captured
     extern std::shared_ptr<display_t> kms_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
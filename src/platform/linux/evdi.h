@@ -4,6 +4,7 @@
  */
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <vector>
@@ -12,6 +13,52 @@
 #include "src/video.h"
 
 namespace platf {
+  namespace evdi {
+    struct display_mode_t {
+      int width;
+      int height;
+      int refresh_rate;
+    };
+
+    /**
+     * @brief The timings of a mode, in pixels and lines.
+     */
+    struct timings_t {
+      int pixel_clock_khz;
+      int h_active;
+      int h_blank;
+      int h_front_porch;
+      int h_sync;
+      int v_active;
+      int v_blank;
+      int v_front_porch;
+      int v_sync;
+    };
+
+    /**
+     * @brief Calculate the timings of a mode with CVT 1.2 reduced blanking v2.
+     * @details Reduced blanking v2 keeps the horizontal blanking fixed at 80 pixels, and gives the
+     *          vertical blanking just enough lines to last 460 µs, which keeps the pixel clock
+     *          low enough for high refresh rates.
+     * @param mode The mode.
+     * @return The timings.
+     */
+    timings_t cvt_rb2_timings(const display_mode_t &mode);
+
+    /**
+     * @brief Generate the EDID of the virtual display.
+     * @details The preferred mode goes in the first DTD, and the common resolutions follow in a
+     *          CTA-861 extension. Modes whose pixel clock is too high for a DTD go in a DisplayID
+     *          extension instead.
+     * @param width The width of the preferred mode.
+     * @param height The height of the preferred mode.
+     * @param refresh_rate The refresh rate of the preferred mode.
+     * @param hdr_enabled Whether to advertise 10-bit color and HDR10.
+     * @return The EDID, with its extension blocks.
+     */
+    std::vector<unsigned char> generate_edid(int width, int height, int refresh_rate, bool hdr_enabled);
+  }  // namespace evdi
+
   /**
    * @brief Get the list of available EVDI virtual display names.
    * @return Vector of display name strings.
@@ -47,9 +94,31 @@ namespace platf {
    */
   bool evdi_prepare_stream(const video::config_t &config);
 
+  /**
+   * @brief Start preparing the EVDI virtual display in the background.
+   * The next call to evdi_prepare_stream() waits for it instead of connecting the display itself,
+   * so the display can be connected while the client sets up the RTSP session.
+   * @param config The video configuration known from the launch request.
+   */
+  void evdi_prepare_stream_async(const video::config_t &config);
+
+  /**
+   * @brief Connect the virtual display right away if it's configured to persist between sessions.
+   * Sessions then only switch the mode of the connected display, instead of connecting a new one.
+   */
+  void evdi_connect_persistent_display();
+
   /**
    * @brief Destroy the virtual display device when streaming stops.
    */
   void evdi_destroy_virtual_display();
 
+  /**
+   * @brief Destroy the virtual display device once a grace period ends without a new session.
+   * A session starting within the grace period keeps the display if it asks for the same mode,
+   * so a client reconnecting right away doesn't have to wait for a new display.
+   * @param delay The grace period, the display is destroyed right away if it's zero.
+   */
+  void evdi_destroy_virtual_display_later(std::chrono::milliseconds delay);
+
 }  // namespace platf
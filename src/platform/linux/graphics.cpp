@@ -4,6 +4,11 @@
  */
 // standard includes
 #include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 // local includes
 #include "graphics.h"
@@ -32,6 +37,30 @@ using namespace std::literals;
 namespace gl {
   GladGLContext ctx;
 
+  namespace {
+    struct program_binary_t {
+      GLenum format;
+      std::vector<std::uint8_t> data;
+    };
+
+    // The binaries of the programs linked so far, so reinitializing the encoder doesn't compile the shaders again
+    std::mutex program_binaries_lock;
+    std::map<std::string, program_binary_t> program_binaries;
+
+    /**
+     * @brief Key a program binary to the driver of the current context, since the binary is only valid for it.
+     */
+    std::string program_binary_key(const std::string &key) {
+      std::string binary_key {(const char *) ctx.GetString(GL_RENDERER)};
+      binary_key += '\n';
+      binary_key += (const char *) ctx.GetString(GL_VERSION);
+      binary_key += '\n';
+      binary_key += key;
+
+      return binary_key;
+    }
+  }  // namespace
+
   void drain_errors(const std::string_view &prefix) {
     GLenum err;
     while ((err = ctx.GetError()) != GL_NO_ERROR) {
@@ -190,6 +219,35 @@ namespace gl {
       ctx.DetachShader(p_handle, frag.handle());
     });
 
+    if (ctx.VERSION_4_1) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    ctx.LinkProgram(program.handle());
+
+    int status = 0;
+    ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+
+    if (!status) {
+      return program.err_str();
+    }
+
+    return program;
+  }
+
+  util::Either<program_t, std::string> program_t::link(const shader_t &comp) {
+    program_t program;
+
+    program._program.el = ctx.CreateProgram();
+
+    ctx.AttachShader(program.handle(), comp.handle());
+
+    auto fg = util::fail_guard([p_handle = program.handle(), &comp]() {
+      ctx.DetachShader(p_handle, comp.handle());
+    });
+
+    if (ctx.VERSION_4_1) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     ctx.LinkProgram(program.handle());
 
     int status = 0;
@@ -202,6 +260,59 @@ namespace gl {
     return program;
   }
 
+  std::optional<program_t> program_t::load(const std::string &key) {
+    if (!ctx.VERSION_4_1) {
+      return std::nullopt;
+    }
+
+    auto binary_key = program_binary_key(key);
+
+    program_binary_t binary;
+    {
+      std::lock_guard lg {program_binaries_lock};
+      auto it = program_binaries.find(binary_key);
+      if (it == std::end(program_binaries)) {
+        return std::nullopt;
+      }
+      binary = it->second;
+    }
+
+    program_t program;
+    program._program.el = ctx.CreateProgram();
+    ctx.ProgramBinary(program.handle(), binary.format, binary.data.data(), binary.data.size());
+
+    int status = 0;
+    ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+
+    if (!status) {
+      // Its info log may well be empty, the driver only tells the binary doesn't fit it anymore
+      BOOST_LOG(debug) << "GL driver rejected a saved program binary, compiling its shaders again"sv;
+      return std::nullopt;
+    }
+
+    return program;
+  }
+
+  void program_t::save(const std::string &key) const {
+    if (!ctx.VERSION_4_1) {
+      return;
+    }
+
+    GLint length = 0;
+    ctx.GetProgramiv(handle(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+      return;
+    }
+
+    program_binary_t binary;
+    binary.data.resize(length);
+    ctx.GetProgramBinary(handle(), length, &length, &binary.format, binary.data.data());
+    binary.data.resize(length);
+
+    std::lock_guard lg {program_binaries_lock};
+    program_binaries.insert_or_assign(program_binary_key(key), std::move(binary));
+  }
+
   void program_t::bind(const buffer_t &buffer) {
     ctx.UseProgram(handle());
     auto i = ctx.GetUniformBlockIndex(handle(), buffer.block());
@@ -588,6 +699,64 @@ namespace egl {
     return rgb;
   }
 
+  namespace {
+    /**
+     * @brief Check whether two descriptors describe the same layout, whatever their file descriptors.
+     */
+    bool same_layout(const surface_descriptor_t &a, const surface_descriptor_t &b) {
+      if (a.width != b.width || a.height != b.height || a.fourcc != b.fourcc || a.modifier != b.modifier) {
+        return false;
+      }
+
+      for (int x = 0; x < 4; ++x) {
+        if ((a.fds[x] < 0) != (b.fds[x] < 0)) {
+          return false;
+        }
+        if (a.fds[x] >= 0 && (a.pitches[x] != b.pitches[x] || a.offsets[x] != b.offsets[x])) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  }  // namespace
+
+  rgb_t *import_cache_t::import(display_t::pointer egl_display, const surface_descriptor_t &sd) {
+    // Every export of a buffer yields the same DMA-BUF while it's open, which is identified by its inode
+    struct stat st;
+    if (sd.fds[0] < 0 || fstat(sd.fds[0], &st)) {
+      _uncached = rgb_t {};
+
+      auto rgb_opt = import_source(egl_display, sd);
+      if (!rgb_opt) {
+        return nullptr;
+      }
+
+      _uncached = std::move(*rgb_opt);
+      return &_uncached;
+    }
+
+    for (auto it = std::begin(_entries); it != std::end(_entries); ++it) {
+      if (it->dev == st.st_dev && it->ino == st.st_ino && same_layout(it->sd, sd)) {
+        _entries.splice(std::begin(_entries), _entries, it);
+        return &_entries.front().rgb;
+      }
+    }
+
+    auto rgb_opt = import_source(egl_display, sd);
+    if (!rgb_opt) {
+      return nullptr;
+    }
+
+    // Buffers that are no longer captured from would otherwise be kept alive by their images
+    if (_entries.size() >= MAX_BUFFERS) {
+      _entries.pop_back();
+    }
+
+    _entries.push_front(entry_t {file_t {dup(sd.fds[0])}, st.st_dev, st.st_ino, sd, std::move(*rgb_opt)});
+    return &_entries.front().rgb;
+  }
+
   std::optional<nv12_t> import_target(display_t::pointer egl_display, std::array<file_t, nv12_img_t::num_fds> &&fds, const surface_descriptor_t &y, const surface_descriptor_t &uv) {
     auto y_attribs = surface_descriptor_to_egl_attribs(y);
     auto uv_attribs = surface_descriptor_to_egl_attribs(uv);
@@ -712,12 +881,82 @@ namespace egl {
 
     program[0].bind(color_matrix);
     program[1].bind(color_matrix);
+    if (compute) {
+      compute_program.bind(color_matrix);
+    }
+  }
+
+  /**
+   * @brief Point the cursor sampler of a conversion shader at the second texture unit.
+   * @param program The conversion shader.
+   * @param cursor_rect_loc Set to the location of the cursor area uniform.
+   * @return 0 on success, -1 if the shader doesn't sample a cursor.
+   */
+  static int bind_cursor(gl::program_t &program, GLint &cursor_rect_loc) {
+    auto loc_cursor = gl::ctx.GetUniformLocation(program.handle(), "cursor");
+    cursor_rect_loc = gl::ctx.GetUniformLocation(program.handle(), "cursor_rect");
+    if (loc_cursor < 0 || cursor_rect_loc < 0) {
+      BOOST_LOG(error) << "Couldn't find uniforms [cursor] and [cursor_rect]"sv;
+      return -1;
+    }
+
+    gl::ctx.UseProgram(program.handle());
+    gl::ctx.Uniform1i(loc_cursor, 1);
+
+    return 0;
+  }
+
+  /**
+   * @brief Build a conversion shader, from the binary of the same shader when one was built before.
+   * @param names The files of the shaders, for the log.
+   * @param sources The sources of the vertex and fragment shader, or of the compute shader alone.
+   * @return The shader, or `std::nullopt` if it doesn't compile or link.
+   */
+  static std::optional<gl::program_t> make_program(const std::vector<std::string_view> &names, const std::vector<std::string> &sources) {
+    std::string key;
+    for (auto &source : sources) {
+      key += source;
+    }
+
+    if (auto program = gl::program_t::load(key)) {
+      BOOST_LOG(debug) << "Reusing the GL program binary of "sv << names.back();
+      return program;
+    }
+
+    GLenum shader_type[2] {
+      GL_VERTEX_SHADER,
+      GL_FRAGMENT_SHADER,
+    };
+
+    std::vector<gl::shader_t> shaders;
+    for (std::size_t x = 0; x < sources.size(); ++x) {
+      auto compiled_source = gl::shader_t::compile(sources[x], sources.size() == 1 ? GL_COMPUTE_SHADER : shader_type[x]);
+      gl_drain_errors;
+
+      if (compiled_source.has_right()) {
+        BOOST_LOG(error) << names[x] << ": "sv << compiled_source.right();
+        return std::nullopt;
+      }
+
+      shaders.emplace_back(std::move(compiled_source.left()));
+    }
+
+    auto program = shaders.size() == 1 ? gl::program_t::link(shaders[0]) : gl::program_t::link(shaders[0], shaders[1]);
+    if (program.has_right()) {
+      BOOST_LOG(error) << "GL linker: "sv << program.right();
+      return std::nullopt;
+    }
+
+    program.left().save(key);
+
+    return std::move(program.left());
   }
 
   std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, gl::tex_t &&tex) {
     sws_t sws;
 
     sws.serial = std::numeric_limits<std::uint64_t>::max();
+    sws.compute = false;
 
     // Ensure aspect ratio is maintained
     auto scalar = std::fminf(out_width / (float) in_width, out_height / (float) in_height);
@@ -739,67 +978,20 @@ namespace egl {
 
     auto width_i = 1.0f / sws.out_width;
 
-    {
-      const char *sources[] {
-        SUNSHINE_SHADERS_DIR "/ConvertUV.frag",
-        SUNSHINE_SHADERS_DIR "/ConvertUV.vert",
-        SUNSHINE_SHADERS_DIR "/ConvertY.frag",
-        SUNSHINE_SHADERS_DIR "/Scene.vert",
-        SUNSHINE_SHADERS_DIR "/Scene.frag",
-      };
-
-      GLenum shader_type[2] {
-        GL_FRAGMENT_SHADER,
-        GL_VERTEX_SHADER,
-      };
-
-      constexpr auto count = sizeof(sources) / sizeof(const char *);
-
-      util::Either<gl::shader_t, std::string> compiled_sources[count];
-
-      bool error_flag = false;
-      for (int x = 0; x < count; ++x) {
-        auto &compiled_source = compiled_sources[x];
-
-        compiled_source = gl::shader_t::compile(file_handler::read_file(sources[x]), shader_type[x % 2]);
-        gl_drain_errors;
-
-        if (compiled_source.has_right()) {
-          BOOST_LOG(error) << sources[x] << ": "sv << compiled_source.right();
-          error_flag = true;
-        }
-      }
-
-      if (error_flag) {
-        return std::nullopt;
-      }
-
-      auto program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[4].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // Cursor - shader
-      sws.program[2] = std::move(program.left());
-
-      program = gl::program_t::link(compiled_sources[1].left(), compiled_sources[0].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // UV - shader
-      sws.program[1] = std::move(program.left());
+    // The Y shader, then the UV shader
+    const char *sources[2][2] {
+      {SUNSHINE_SHADERS_DIR "/Scene.vert", SUNSHINE_SHADERS_DIR "/ConvertY.frag"},
+      {SUNSHINE_SHADERS_DIR "/ConvertUV.vert", SUNSHINE_SHADERS_DIR "/ConvertUV.frag"},
+    };
 
-      program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[2].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
+    for (int x = 0; x < 2; ++x) {
+      auto &names = sources[x];
+      auto program = make_program({names[0], names[1]}, {file_handler::read_file(names[0]), file_handler::read_file(names[1])});
+      if (!program) {
         return std::nullopt;
       }
 
-      // Y - shader
-      sws.program[0] = std::move(program.left());
+      sws.program[x] = std::move(*program);
     }
 
     auto loc_width_i = gl::ctx.GetUniformLocation(sws.program[1].handle(), "width_i");
@@ -827,16 +1019,18 @@ namespace egl {
 
     sws.color_matrix = std::move(*color_matrix);
 
-    sws.tex = std::move(tex);
+    for (int x = 0; x < 2; ++x) {
+      if (bind_cursor(sws.program[x], sws.cursor_rect_loc[x])) {
+        return std::nullopt;
+      }
+    }
+    sws.cursor_rect = {};
 
-    sws.cursor_framebuffer = gl::frame_buf_t::make(1);
-    sws.cursor_framebuffer.bind(&sws.tex[0], &sws.tex[1]);
+    sws.tex = std::move(tex);
 
     sws.program[0].bind(sws.color_matrix);
     sws.program[1].bind(sws.color_matrix);
 
-    gl::ctx.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
     gl_drain_errors;
 
     return sws;
@@ -856,7 +1050,52 @@ namespace egl {
     return convert(fb);
   }
 
-  std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, AVPixelFormat format) {
+  /**
+   * @brief Build the compute shader that writes both planes in a single dispatch.
+   * @param sws The converter, whose color matrix is already set up.
+   * @param high_depth Whether the planes hold more than 8 bits per component.
+   * @return `true` on success, `false` if the render passes must be used instead.
+   */
+  static bool make_compute(sws_t &sws, bool high_depth) {
+    if (!gl::ctx.VERSION_4_3) {
+      BOOST_LOG(info) << "GL 4.3 isn't available, converting with render passes"sv;
+      return false;
+    }
+
+    // The image formats of the planes depend on their bit depth, and must be spelled out in the shader
+    auto source = file_handler::read_file(SUNSHINE_SHADERS_DIR "/ConvertNV12.comp");
+    source.insert(source.find('\n') + 1, high_depth ? "#define Y_FORMAT r16\n#define UV_FORMAT rg16\n"sv : "#define Y_FORMAT r8\n#define UV_FORMAT rg8\n"sv);
+
+    auto program = make_program({SUNSHINE_SHADERS_DIR "/ConvertNV12.comp"}, {std::move(source)});
+    if (!program) {
+      return false;
+    }
+
+    auto loc_out_rect = gl::ctx.GetUniformLocation(program->handle(), "out_rect");
+    if (loc_out_rect < 0) {
+      BOOST_LOG(error) << "Couldn't find uniform [out_rect]"sv;
+      return false;
+    }
+
+    if (bind_cursor(*program, sws.cursor_rect_loc[2])) {
+      return false;
+    }
+
+    sws.compute_program = std::move(*program);
+    sws.compute_program.bind(sws.color_matrix);
+    sws.compute_formats[0] = high_depth ? GL_R16 : GL_R8;
+    sws.compute_formats[1] = high_depth ? GL_RG16 : GL_RG8;
+    sws.compute_out_rect = loc_out_rect;
+    sws.compute = true;
+
+    gl_drain_errors;
+
+    BOOST_LOG(info) << "Converting with a GL compute shader"sv;
+
+    return true;
+  }
+
+  std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, AVPixelFormat format, bool compute) {
     GLint gl_format;
 
     // Decide the bit depth format of the backing texture based the target frame format
@@ -887,14 +1126,44 @@ namespace egl {
     gl::ctx.BindTexture(GL_TEXTURE_2D, tex[0]);
     gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, gl_format, in_width, in_height);
 
-    return make(in_width, in_height, out_width, out_height, std::move(tex));
+    auto sws = make(in_width, in_height, out_width, out_height, std::move(tex));
+    if (sws) {
+      sws->tex_memory = {metrics::gpu_memory_t::convert, (std::int64_t) in_width * in_height * (fmt_desc->comp[0].depth > 10 ? 8 : 4)};
+    }
+    if (sws && compute) {
+      make_compute(*sws, fmt_desc->comp[0].depth > 8);
+    }
+
+    return sws;
   }
 
   void sws_t::load_ram(platf::img_t &img) {
     loaded_texture = tex[0];
+    cursor_rect = {};
 
     gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
     gl::ctx.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img.width, img.height, GL_BGRA, GL_UNSIGNED_BYTE, img.data);
+
+    if (!img.cursor_sprite || !img.cursor) {
+      return;
+    }
+
+    // The capture kept the cursor out of the pixels, so the conversion shaders blend it in
+    auto &sprite = *img.cursor_sprite;
+    if (serial != sprite.serial) {
+      serial = sprite.serial;
+
+      gl::ctx.BindTexture(GL_TEXTURE_2D, tex[1]);
+      gl::ctx.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sprite.width, sprite.height, 0, GL_BGRA, GL_UNSIGNED_BYTE, sprite.pixels.data());
+      gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    cursor_rect = {
+      (float) img.cursor->x / in_width,
+      (float) img.cursor->y / in_height,
+      sprite.width / (float) in_width,
+      sprite.height / (float) in_height,
+    };
   }
 
   void sws_t::load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture) {
@@ -910,53 +1179,42 @@ namespace egl {
       loaded_texture = texture;
     }
 
-    if (img.data) {
-      GLenum attachment = GL_COLOR_ATTACHMENT0;
-
-      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, cursor_framebuffer[0]);
-      gl::ctx.UseProgram(program[2].handle());
-
-      // When a copy has already been made...
-      if (!copy) {
-        gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
-        gl::ctx.DrawBuffers(1, &attachment);
-
-        gl::ctx.Viewport(0, 0, in_width, in_height);
-        gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
+    if (!img.data) {
+      cursor_rect = {};
+      return;
+    }
 
-        loaded_texture = tex[0];
-      }
+    // The cursor is blended in by the conversion shaders, so only a new image needs an upload
+    if (serial != img.serial) {
+      serial = img.serial;
 
       gl::ctx.BindTexture(GL_TEXTURE_2D, tex[1]);
-      if (serial != img.serial) {
-        serial = img.serial;
-
-        gl::ctx.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, img.src_w, img.src_h, 0, GL_BGRA, GL_UNSIGNED_BYTE, img.data);
-      }
-
-      gl::ctx.Enable(GL_BLEND);
-
-      gl::ctx.DrawBuffers(1, &attachment);
-
-#ifndef NDEBUG
-      auto status = gl::ctx.CheckFramebufferStatus(GL_FRAMEBUFFER);
-      if (status != GL_FRAMEBUFFER_COMPLETE) {
-        BOOST_LOG(error) << "Pass Cursor: CheckFramebufferStatus() --> [0x"sv << util::hex(status).to_string_view() << ']';
-        return;
-      }
-#endif
-
-      gl::ctx.Viewport(img.x, img.y, img.width, img.height);
-      gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
-
-      gl::ctx.Disable(GL_BLEND);
-
+      gl::ctx.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, img.src_w, img.src_h, 0, GL_BGRA, GL_UNSIGNED_BYTE, img.data);
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
-      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
     }
+
+    cursor_rect = {
+      img.x / (float) in_width,
+      img.y / (float) in_height,
+      img.width / (float) in_width,
+      img.height / (float) in_height,
+    };
+  }
+
+  /**
+   * @brief Unbind the image and cursor textures sampled by the conversion shaders.
+   */
+  static void unbind_textures() {
+    gl::ctx.ActiveTexture(GL_TEXTURE1);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+    gl::ctx.ActiveTexture(GL_TEXTURE0);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
   }
 
   int sws_t::convert(gl::frame_buf_t &fb) {
+    gl::ctx.ActiveTexture(GL_TEXTURE1);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, tex[1]);
+    gl::ctx.ActiveTexture(GL_TEXTURE0);
     gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
 
     GLenum attachments[] {
@@ -977,11 +1235,43 @@ namespace egl {
 #endif
 
       gl::ctx.UseProgram(program[x].handle());
+      gl::ctx.Uniform4fv(cursor_rect_loc[x], 1, cursor_rect.data());
       gl::ctx.Viewport(offsetX / (x + 1), offsetY / (x + 1), out_width / (x + 1), out_height / (x + 1));
       gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
     }
 
-    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+    unbind_textures();
+
+    gl::ctx.Flush();
+
+    return 0;
+  }
+
+  int sws_t::convert(nv12_t &nv12) {
+    if (!compute) {
+      return convert(nv12->buf);
+    }
+
+    gl::ctx.UseProgram(compute_program.handle());
+    gl::ctx.Uniform4fv(cursor_rect_loc[2], 1, cursor_rect.data());
+    gl::ctx.ActiveTexture(GL_TEXTURE1);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, tex[1]);
+    gl::ctx.ActiveTexture(GL_TEXTURE0);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
+
+    gl::ctx.BindImageTexture(0, nv12->tex[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, compute_formats[0]);
+    gl::ctx.BindImageTexture(1, nv12->tex[1], 0, GL_FALSE, 0, GL_WRITE_ONLY, compute_formats[1]);
+    gl::ctx.Uniform4i(compute_out_rect, offsetX, offsetY, out_width, out_height);
+
+    // Each invocation covers 2x2 pixels, in work groups of 8x8 invocations
+    gl::ctx.DispatchCompute((out_width + 15) / 16, (out_height + 15) / 16, 1);
+
+    // The planes may be rendered into or sampled by GL later on
+    gl::ctx.MemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    gl::ctx.BindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, compute_formats[0]);
+    gl::ctx.BindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, compute_formats[1]);
+    unbind_textures();
 
     gl::ctx.Flush();
 
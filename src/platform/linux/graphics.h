@@ -5,9 +5,14 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <list>
 #include <optional>
 #include <string_view>
 
+// platform includes
+#include <sys/types.h>
+
 // lib includes
 #include <glad/egl.h>
 #include <glad/gl.h>
@@ -15,6 +20,7 @@
 // local includes
 #include "misc.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
 #include "src/video_colorspace.h"
@@ -153,6 +159,20 @@ namespace gl {
     std::string err_str();
 
     static util::Either<program_t, std::string> link(const shader_t &vert, const shader_t &frag);
+    static util::Either<program_t, std::string> link(const shader_t &comp);
+
+    /**
+     * @brief Load a program this process linked before from its binary, without compiling its shaders.
+     * @param key The sources of the shaders of the program.
+     * @return The program, or `std::nullopt` if it wasn't saved for this driver or the driver rejects it.
+     */
+    static std::optional<program_t> load(const std::string &key);
+
+    /**
+     * @brief Save the binary of the program for `load()`, which outlives the GL context.
+     * @param key The sources of the shaders of the program.
+     */
+    void save(const std::string &key) const;
 
     void bind(const buffer_t &buffer);
 
@@ -248,6 +268,41 @@ namespace egl {
 
   rgb_t create_blank(platf::img_t &img);
 
+  /**
+   * @brief Keeps the imported images of the buffers a display is captured from.
+   * @details Compositors cycle through a few scanout buffers, so each of them is only imported
+   *          into EGL once, then reused for as long as it stays among the most recently captured.
+   *          Buffers are told apart by their DMA-BUF, which is kept open along with the image so later
+   *          exports of the buffer yield it again, and by their layout, so a reallocated buffer is imported again.
+   */
+  class import_cache_t {
+  public:
+    static constexpr std::size_t MAX_BUFFERS = 4;
+
+    /**
+     * @brief Get the imported image of a captured buffer, importing it if it isn't cached yet.
+     * @param egl_display The EGL display to import into.
+     * @param sd The surface descriptor of the buffer.
+     * @return The imported image, which stays valid until the next call, or `nullptr` on failure.
+     */
+    rgb_t *import(display_t::pointer egl_display, const surface_descriptor_t &sd);
+
+  private:
+    struct entry_t {
+      file_t dmabuf;
+      dev_t dev;
+      ino_t ino;
+      surface_descriptor_t sd;
+      rgb_t rgb;
+    };
+
+    // Most recently used first
+    std::list<entry_t> _entries;
+
+    // Buffers that can't be identified are imported every time
+    rgb_t _uncached;
+  };
+
   std::optional<nv12_t> import_target(
     display_t::pointer egl_display,
     std::array<file_t, nv12_img_t::num_fds> &&fds,
@@ -300,11 +355,19 @@ namespace egl {
   class sws_t {
   public:
     static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, gl::tex_t &&tex);
-    static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, AVPixelFormat format);
+
+    /**
+     * @brief Create a converter for the given target format.
+     * @param compute Convert with a single compute shader dispatch when the GL context supports it.
+     */
+    static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, AVPixelFormat format, bool compute = false);
 
     // Convert the loaded image into the first two framebuffers
     int convert(gl::frame_buf_t &fb);
 
+    // Convert the loaded image into both planes of the target, with the compute shader if there is one
+    int convert(nv12_t &nv12);
+
     // Make an area of the image black
     int blank(gl::frame_buf_t &fb, int offsetX, int offsetY, int width, int height);
 
@@ -314,17 +377,30 @@ namespace egl {
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
     // The first texture is the monitor image.
-    // The second texture is the cursor image
+    // The second texture is the cursor image, which the conversion shaders blend in
     gl::tex_t tex;
 
-    // The cursor image will be blended into this framebuffer
-    gl::frame_buf_t cursor_framebuffer;
+    // Counts the monitor image texture allocated for this converter
+    metrics::gpu_allocation_t tex_memory;
+
     gl::frame_buf_t copy_framebuffer;
 
-    // Y - shader, UV - shader, Cursor - shader
-    gl::program_t program[3];
+    // Y - shader, UV - shader
+    gl::program_t program[2];
     gl::buffer_t color_matrix;
 
+    // The cursor area of the loaded image in texture coordinates, with no width when there is no cursor
+    std::array<float, 4> cursor_rect;
+
+    // Location of the cursor area uniform in the Y, UV and compute shaders
+    GLint cursor_rect_loc[3];
+
+    // Y and UV - compute shader, only valid if compute is true
+    bool compute;
+    gl::program_t compute_program;
+    GLenum compute_formats[2];
+    GLint compute_out_rect;
+
     int out_width, out_height;
     int in_width, in_height;
     int offsetX, offsetY;
@@ -0,0 +1,151 @@
+/**
+ * @file src/platform/linux/input/evdev_batch.cpp
+ * @brief Definitions for writing batches of events to evdev devices.
+ */
+// standard includes
+#include <cerrno>
+#include <utility>
+
+// platform includes
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// local includes
+#include "evdev_batch.h"
+
+namespace platf::evdev {
+  batch_t::batch_t(int fd):
+      _fd {fd} {
+    _events.reserve(64);
+  }
+
+  batch_t::batch_t(batch_t &&other) noexcept:
+      _fd {std::exchange(other._fd, -1)},
+      _events {std::move(other._events)},
+      _writes {other._writes},
+      _events_written {other._events_written} {
+  }
+
+  batch_t &batch_t::operator=(batch_t &&other) noexcept {
+    std::swap(_fd, other._fd);
+    std::swap(_events, other._events);
+    std::swap(_writes, other._writes);
+    std::swap(_events_written, other._events_written);
+
+    return *this;
+  }
+
+  batch_t::~batch_t() {
+    if (_fd >= 0) {
+      close(_fd);
+    }
+  }
+
+  batch_t batch_t::open(const std::vector<std::string> &nodes, std::uint16_t type) {
+    for (auto &node : nodes) {
+      auto fd = ::open(node.c_str(), O_WRONLY | O_CLOEXEC);
+      if (fd < 0) {
+        continue;
+      }
+
+      unsigned long types = 0;
+      if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), &types) >= 0 && (types & (1UL << type))) {
+        return batch_t {fd};
+      }
+
+      close(fd);
+    }
+
+    return {};
+  }
+
+  void batch_t::add(std::uint16_t type, std::uint16_t code, std::int32_t value) {
+    input_event event {};
+    event.type = type;
+    event.code = code;
+    event.value = value;
+
+    _events.emplace_back(event);
+  }
+
+  void batch_t::sync() {
+    if (!_events.empty() && _events.back().type != EV_SYN) {
+      add(EV_SYN, SYN_REPORT, 0);
+    }
+  }
+
+  int batch_t::flush() {
+    sync();
+    if (_events.empty()) {
+      return 0;
+    }
+
+    auto data = (const char *) _events.data();
+    auto size = _events.size() * sizeof(input_event);
+    auto count = _events.size();
+    _events.clear();
+
+    // evdev takes whole events, so a short write only happens if it stopped at an invalid one
+    ssize_t written;
+    do {
+      written = write(_fd, data, size);
+    } while (written < 0 && errno == EINTR);
+
+    ++_writes;
+    if (written != (ssize_t) size) {
+      return -1;
+    }
+
+    _events_written += count;
+    return 0;
+  }
+
+  void mouse_batch_t::move(int delta_x, int delta_y) {
+    _delta_x += delta_x;
+    _delta_y += delta_y;
+  }
+
+  void mouse_batch_t::scroll(int high_res_distance) {
+    _wheel += high_res_distance / 120;
+    _wheel_high_res += high_res_distance;
+  }
+
+  void mouse_batch_t::hscroll(int high_res_distance) {
+    _hwheel += high_res_distance / 120;
+    _hwheel_high_res += high_res_distance;
+  }
+
+  void mouse_batch_t::button(std::uint16_t code, bool release) {
+    add_motion();
+    _batch.add(EV_KEY, code, release ? 0 : 1);
+    _batch.sync();
+  }
+
+  int mouse_batch_t::flush() {
+    add_motion();
+    return _batch.flush();
+  }
+
+  void mouse_batch_t::add_motion() {
+    if (_delta_x) {
+      _batch.add(EV_REL, REL_X, std::exchange(_delta_x, 0));
+    }
+    if (_delta_y) {
+      _batch.add(EV_REL, REL_Y, std::exchange(_delta_y, 0));
+    }
+    if (_wheel) {
+      _batch.add(EV_REL, REL_WHEEL, std::exchange(_wheel, 0));
+    }
+    if (_wheel_high_res) {
+      _batch.add(EV_REL, REL_WHEEL_HI_RES, std::exchange(_wheel_high_res, 0));
+    }
+    if (_hwheel) {
+      _batch.add(EV_REL, REL_HWHEEL, std::exchange(_hwheel, 0));
+    }
+    if (_hwheel_high_res) {
+      _batch.add(EV_REL, REL_HWHEEL_HI_RES, std::exchange(_hwheel_high_res, 0));
+    }
+    _batch.sync();
+  }
+}  // namespace platf::evdev
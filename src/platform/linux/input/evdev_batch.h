@@ -0,0 +1,142 @@
+/**
+ * @file src/platform/linux/input/evdev_batch.h
+ * @brief Declarations for writing batches of events to evdev devices.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// platform includes
+#include <linux/input.h>
+
+namespace platf::evdev {
+  /**
+   * @brief Events for one evdev device, written with a single `write()` when flushed.
+   * @details Writing to the event node of a uinput device injects the events as if the device had sent them,
+   *          so a whole drain of the input queue costs one syscall instead of one per event.
+   */
+  class batch_t {
+  public:
+    batch_t() = default;
+
+    /**
+     * @param fd A file descriptor open for writing, which the batch closes.
+     */
+    explicit batch_t(int fd);
+
+    batch_t(batch_t &&other) noexcept;
+    batch_t &operator=(batch_t &&other) noexcept;
+    batch_t(const batch_t &) = delete;
+    batch_t &operator=(const batch_t &) = delete;
+
+    ~batch_t();
+
+    /**
+     * @brief Open the first event node of a device that sends a type of events.
+     * @param nodes The event nodes of the device, like `/dev/input/event5`.
+     * @param type The type of events, like `EV_REL`.
+     * @return The batch, which is empty if no node could be opened for writing.
+     */
+    static batch_t open(const std::vector<std::string> &nodes, std::uint16_t type);
+
+    explicit operator bool() const {
+      return _fd >= 0;
+    }
+
+    bool empty() const {
+      return _events.empty();
+    }
+
+    void add(std::uint16_t type, std::uint16_t code, std::int32_t value);
+
+    /**
+     * @brief End the current frame of events with a `SYN_REPORT`, unless it's already ended.
+     */
+    void sync();
+
+    /**
+     * @brief End the current frame, and write every event added since the last flush.
+     * @return 0 on success, -1 if the device didn't take the events.
+     */
+    int flush();
+
+    std::size_t writes() const {
+      return _writes;
+    }
+
+    std::size_t events_written() const {
+      return _events_written;
+    }
+
+  private:
+    int _fd = -1;
+    std::vector<input_event> _events;
+
+    std::size_t _writes = 0;
+    std::size_t _events_written = 0;
+  };
+
+  /**
+   * @brief Relative mouse input for a batch, where the motion and scrolling between button changes
+   *        are merged into one frame like a real mouse reports them.
+   * @details Button changes end the frame they're in, so a click within a single batch still
+   *          reaches applications as a press followed by a release.
+   */
+  class mouse_batch_t {
+  public:
+    mouse_batch_t() = default;
+
+    explicit mouse_batch_t(batch_t &&batch):
+        _batch {std::move(batch)} {
+    }
+
+    explicit operator bool() const {
+      return (bool) _batch;
+    }
+
+    void move(int delta_x, int delta_y);
+
+    /**
+     * @param high_res_distance The distance in 120ths of a notch, like `REL_WHEEL_HI_RES`.
+     */
+    void scroll(int high_res_distance);
+
+    /**
+     * @param high_res_distance The distance in 120ths of a notch, like `REL_HWHEEL_HI_RES`.
+     */
+    void hscroll(int high_res_distance);
+
+    /**
+     * @param code The button, like `BTN_LEFT`.
+     * @param release `true` if the button is released.
+     */
+    void button(std::uint16_t code, bool release);
+
+    /**
+     * @brief Write the events of the batch.
+     * @return 0 on success, -1 if the device didn't take the events.
+     */
+    int flush();
+
+    const batch_t &batch() const {
+      return _batch;
+    }
+
+  private:
+    // Add the pending motion and scrolling to the current frame
+    void add_motion();
+
+    batch_t _batch;
+
+    int _delta_x = 0;
+    int _delta_y = 0;
+    int _wheel = 0;
+    int _wheel_high_res = 0;
+    int _hwheel = 0;
+    int _hwheel_high_res = 0;
+  };
+}  // namespace platf::evdev
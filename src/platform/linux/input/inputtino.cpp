@@ -22,7 +22,10 @@ using namespace std::literals;
 namespace platf {
 
   input_t input() {
-    return {new input_raw_t()};
+    auto raw = new input_raw_t();
+    platf::gamepad::start_spares(raw);
+
+    return {raw};
   }
 
   std::unique_ptr<client_input_t> allocate_client_input_context(input_t &input) {
@@ -61,24 +64,44 @@ namespace platf {
 
   void keyboard_update(input_t &input, uint16_t modcode, bool release, uint8_t flags) {
     auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
     platf::keyboard::update(raw, modcode, release, flags);
   }
 
   void unicode(input_t &input, char *utf8, int size) {
     auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
     platf::keyboard::unicode(raw, utf8, size);
   }
 
-  void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch) {
+  void begin_input_batch(input_t &input) {
+    // Relative mouse events are collected, everything else is written to its uinput device right away
+    auto raw = (input_raw_t *) input.get();
+    platf::mouse::begin_batch(raw);
+  }
+
+  void end_input_batch(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    platf::mouse::end_batch(raw);
+  }
+
+  void touch_update(client_input_t *input, const touch_port_t &touch_port, std::span<const touch_input_t> touches) {
     auto raw = (client_input_raw_t *) input;
-    platf::touch::update(raw, touch_port, touch);
+    platf::mouse::flush(raw->global);
+
+    // inputtino reports every finger on its own
+    for (auto &touch : touches) {
+      platf::touch::update(raw, touch_port, touch);
+    }
   }
 
   void pen_update(client_input_t *input, const touch_port_t &touch_port, const pen_input_t &pen) {
     auto raw = (client_input_raw_t *) input;
+    platf::mouse::flush(raw->global);
     platf::pen::update(raw, touch_port, pen);
   }
 
+  // Gamepads are injected on threads of their own, without an order relative to the mouse, so they leave its batch alone
   int alloc_gamepad(input_t &input, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
     auto raw = (input_raw_t *) input.get();
     return platf::gamepad::alloc(raw, id, metadata, feedback_queue);
@@ -4,15 +4,21 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <mutex>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
 #include <libevdev/libevdev.h>
 
 // local includes
+#include "evdev_batch.h"
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/thread_pool.h"
 #include "src/utility.h"
 
 using namespace std::literals;
@@ -56,11 +62,27 @@ namespace platf {
     inputtino::Result<inputtino::Mouse> mouse;
     inputtino::Result<inputtino::Keyboard> keyboard;
 
+    // Between begin_input_batch() and end_input_batch(), relative mouse events are collected here and
+    // written to the event node of the mouse at once. Opened with the first batch, since udev sets
+    // the permissions of the node after the device is created.
+    evdev::mouse_batch_t mouse_batch;
+    bool mouse_batch_opened = false;
+    bool batching = false;
+
     /**
      * A list of gamepads that are currently connected.
      * The pointer is shared because that state will be shared with background threads that deal with rumble and LED
      */
     std::vector<std::shared_ptr<joypad_state>> gamepads;
+
+    /**
+     * Spare gamepads of each type, created ahead of time because creating a virtual gamepad takes a while.
+     * A gamepad arriving claims one, and spare_pool creates its replacement.
+     * The pool is declared last, so its thread is joined before the spare gamepads are destroyed.
+     */
+    std::mutex spare_gamepads_lock;
+    std::array<std::vector<std::unique_ptr<joypads_t>>, 3> spare_gamepads;
+    thread_pool_util::ThreadPool spare_pool;
   };
 
   struct client_input_raw_t: public client_input_t {
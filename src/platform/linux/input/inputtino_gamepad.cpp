@@ -53,6 +53,118 @@ namespace platf::gamepad {
     return inputtino::PS5Joypad::create({.name = "Sunshine PS5 (virtual) pad", .vendor_id = 0x054C, .product_id = 0x0CE6, .version = 0x8111, .device_phys = device_mac, .device_uniq = device_mac});
   }
 
+  /**
+   * @brief Create a virtual gamepad.
+   * @param type The type of gamepad.
+   * @param globalIndex The global index of the gamepad, which the MAC of a PS5 controller may be based on.
+   * @return The gamepad, or `nullptr` if it couldn't be created.
+   */
+  std::unique_ptr<joypads_t> create(ControllerType type, int globalIndex) {
+    switch (type) {
+      case XboxOneWired:
+        {
+          auto xOne = create_xbox_one();
+          if (!xOne) {
+            BOOST_LOG(warning) << "Unable to create virtual Xbox One controller: " << xOne.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*xOne));
+        }
+      case SwitchProWired:
+        {
+          auto switchPro = create_switch();
+          if (!switchPro) {
+            BOOST_LOG(warning) << "Unable to create virtual Switch Pro controller: " << switchPro.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*switchPro));
+        }
+      case DualSenseWired:
+        {
+          auto ds5 = create_ds5(globalIndex);
+          if (!ds5) {
+            BOOST_LOG(warning) << "Unable to create virtual DualShock 5 controller: " << ds5.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*ds5));
+        }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Check if spare gamepads of a type may be kept.
+   * @details A PS5 controller may get a MAC based on its global index, which isn't known before it's claimed.
+   */
+  bool has_spares(ControllerType type) {
+    return config::input.gamepad_pool_size > 0 && (type != DualSenseWired || config::input.ds5_inputtino_randomize_mac);
+  }
+
+  /**
+   * @brief Claim a spare gamepad.
+   * @return The gamepad, or `nullptr` if there's no spare gamepad of that type.
+   */
+  std::unique_ptr<joypads_t> take_spare(input_raw_t *raw, ControllerType type) {
+    std::lock_guard lg {raw->spare_gamepads_lock};
+
+    auto &spares = raw->spare_gamepads[type];
+    if (spares.empty()) {
+      return nullptr;
+    }
+
+    auto joypad = std::move(spares.back());
+    spares.pop_back();
+
+    BOOST_LOG(debug) << "Claimed a spare virtual gamepad, "sv << spares.size() << " left"sv;
+    return joypad;
+  }
+
+  /**
+   * @brief Create spare gamepads of a type in the background, until there are as many as configured.
+   */
+  void refill_spares(input_raw_t *raw, ControllerType type) {
+    if (!has_spares(type)) {
+      return;
+    }
+
+    // The pool has a single thread, so only one task creates spare gamepads at a time
+    raw->spare_pool.push(thread_pool_util::lane_e::background, [raw, type]() {
+      while (true) {
+        {
+          std::lock_guard lg {raw->spare_gamepads_lock};
+          if (raw->spare_gamepads[type].size() >= (std::size_t) config::input.gamepad_pool_size) {
+            return;
+          }
+        }
+
+        auto joypad = create(type, -1);
+        if (!joypad) {
+          return;
+        }
+
+        std::lock_guard lg {raw->spare_gamepads_lock};
+        raw->spare_gamepads[type].emplace_back(std::move(joypad));
+      }
+    });
+  }
+
+  void start_spares(input_raw_t *raw) {
+    if (config::input.gamepad_pool_size <= 0) {
+      return;
+    }
+
+    raw->spare_pool.start(1);
+
+    // With automatic selection, the spare gamepads of a type are created once it's first used
+    if (config::input.gamepad == "xone"sv) {
+      refill_spares(raw, XboxOneWired);
+    } else if (config::input.gamepad == "ds5"sv) {
+      refill_spares(raw, DualSenseWired);
+    } else if (config::input.gamepad == "switch"sv) {
+      refill_spares(raw, SwitchProWired);
+    }
+  }
+
   int alloc(input_raw_t *raw, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
     ControllerType selectedGamepadType;
 
@@ -104,6 +216,15 @@ namespace platf::gamepad {
       }
     }
 
+    std::unique_ptr<joypads_t> joypad = take_spare(raw, selectedGamepadType);
+    if (!joypad) {
+      joypad = create(selectedGamepadType, id.globalIndex);
+      if (!joypad) {
+        return -1;
+      }
+    }
+    refill_spares(raw, selectedGamepadType);
+
     auto gamepad = std::make_shared<joypad_state>(joypad_state {});
     auto on_rumble_fn = [feedback_queue, idx = id.clientRelativeIndex, gamepad](int low_freq, int high_freq) {
       // Don't resend duplicate rumble data
@@ -116,67 +237,35 @@ namespace platf::gamepad {
       gamepad->last_rumble = msg;
     };
 
-    switch (selectedGamepadType) {
-      case XboxOneWired:
-        {
-          auto xOne = create_xbox_one();
-          if (xOne) {
-            (*xOne).set_on_rumble(on_rumble_fn);
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*xOne));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual Xbox One controller: " << xOne.getErrorMessage();
-            return -1;
-          }
-        }
-      case SwitchProWired:
-        {
-          auto switchPro = create_switch();
-          if (switchPro) {
-            (*switchPro).set_on_rumble(on_rumble_fn);
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*switchPro));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual Switch Pro controller: " << switchPro.getErrorMessage();
-            return -1;
-          }
-        }
-      case DualSenseWired:
-        {
-          auto ds5 = create_ds5(id.globalIndex);
-          if (ds5) {
-            (*ds5).set_on_rumble(on_rumble_fn);
-            (*ds5).set_on_led([feedback_queue, idx = id.clientRelativeIndex, gamepad](int r, int g, int b) {
-              // Don't resend duplicate LED data
-              if (gamepad->last_rgb_led.type == platf::gamepad_feedback_e::set_rgb_led && gamepad->last_rgb_led.data.rgb_led.r == r && gamepad->last_rgb_led.data.rgb_led.g == g && gamepad->last_rgb_led.data.rgb_led.b == b) {
-                return;
-              }
-
-              auto msg = gamepad_feedback_msg_t::make_rgb_led(idx, r, g, b);
-              feedback_queue->raise(msg);
-              gamepad->last_rgb_led = msg;
-            });
-
-            (*ds5).set_on_trigger_effect([feedback_queue, idx = id.clientRelativeIndex](const inputtino::PS5Joypad::TriggerEffect &trigger_effect) {
-              feedback_queue->raise(gamepad_feedback_msg_t::make_adaptive_triggers(idx, trigger_effect.event_flags, trigger_effect.type_left, trigger_effect.type_right, trigger_effect.left, trigger_effect.right));
-            });
-
-            // Activate the motion sensors
-            feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_ACCEL, 100));
-            feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_GYRO, 100));
-
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*ds5));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual DualShock 5 controller: " << ds5.getErrorMessage();
-            return -1;
-          }
+    std::visit([&on_rumble_fn](auto &pad) {
+      pad.set_on_rumble(on_rumble_fn);
+    },
+               *joypad);
+
+    if (auto ds5 = std::get_if<inputtino::PS5Joypad>(joypad.get())) {
+      ds5->set_on_led([feedback_queue, idx = id.clientRelativeIndex, gamepad](int r, int g, int b) {
+        // Don't resend duplicate LED data
+        if (gamepad->last_rgb_led.type == platf::gamepad_feedback_e::set_rgb_led && gamepad->last_rgb_led.data.rgb_led.r == r && gamepad->last_rgb_led.data.rgb_led.g == g && gamepad->last_rgb_led.data.rgb_led.b == b) {
+          return;
         }
+
+        auto msg = gamepad_feedback_msg_t::make_rgb_led(idx, r, g, b);
+        feedback_queue->raise(msg);
+        gamepad->last_rgb_led = msg;
+      });
+
+      ds5->set_on_trigger_effect([feedback_queue, idx = id.clientRelativeIndex](const inputtino::PS5Joypad::TriggerEffect &trigger_effect) {
+        feedback_queue->raise(gamepad_feedback_msg_t::make_adaptive_triggers(idx, trigger_effect.event_flags, trigger_effect.type_left, trigger_effect.type_right, trigger_effect.left, trigger_effect.right));
+      });
+
+      // Activate the motion sensors
+      feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_ACCEL, 100));
+      feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_GYRO, 100));
     }
-    return -1;
+
+    gamepad->joypad = std::move(joypad);
+    raw->gamepads[id.globalIndex] = std::move(gamepad);
+    return 0;
   }
 
   void free(input_raw_t *raw, int nr) {
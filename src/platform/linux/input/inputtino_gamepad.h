@@ -23,6 +23,12 @@ namespace platf::gamepad {
     SwitchProWired  ///< Switch Pro Wired Controller
   };
 
+  /**
+   * @brief Start creating the spare gamepads of the manually selected gamepad type, if any.
+   * @param raw The input context.
+   */
+  void start_spares(input_raw_t *raw);
+
   int alloc(input_raw_t *raw, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue);
 
   void free(input_raw_t *raw, int nr);
@@ -18,14 +18,24 @@
 using namespace std::literals;
 
 namespace platf::mouse {
+  namespace {
+    evdev::mouse_batch_t *batch(input_raw_t *raw) {
+      return raw->batching && raw->mouse_batch ? &raw->mouse_batch : nullptr;
+    }
+  }  // namespace
 
   void move(input_raw_t *raw, int deltaX, int deltaY) {
-    if (raw->mouse) {
+    if (auto mouse_batch = batch(raw)) {
+      mouse_batch->move(deltaX, deltaY);
+    } else if (raw->mouse) {
       (*raw->mouse).move(deltaX, deltaY);
     }
   }
 
   void move_abs(input_raw_t *raw, const touch_port_t &touch_port, float x, float y) {
+    // Absolute motion goes to a device of its own
+    flush(raw);
+
     if (raw->mouse) {
       (*raw->mouse).move_abs(x, y, touch_port.width, touch_port.height);
     }
@@ -34,27 +44,35 @@ namespace platf::mouse {
   void button(input_raw_t *raw, int button, bool release) {
     if (raw->mouse) {
       inputtino::Mouse::MOUSE_BUTTON btn_type;
+      std::uint16_t code;
       switch (button) {
         case BUTTON_LEFT:
           btn_type = inputtino::Mouse::LEFT;
+          code = BTN_LEFT;
           break;
         case BUTTON_MIDDLE:
           btn_type = inputtino::Mouse::MIDDLE;
+          code = BTN_MIDDLE;
           break;
         case BUTTON_RIGHT:
           btn_type = inputtino::Mouse::RIGHT;
+          code = BTN_RIGHT;
           break;
         case BUTTON_X1:
           btn_type = inputtino::Mouse::SIDE;
+          code = BTN_SIDE;
           break;
         case BUTTON_X2:
           btn_type = inputtino::Mouse::EXTRA;
+          code = BTN_EXTRA;
           break;
         default:
           BOOST_LOG(warning) << "Unknown mouse button: " << button;
           return;
       }
-      if (release) {
+      if (auto mouse_batch = batch(raw)) {
+        mouse_batch->button(code, release);
+      } else if (release) {
         (*raw->mouse).release(btn_type);
       } else {
         (*raw->mouse).press(btn_type);
@@ -63,13 +81,17 @@ namespace platf::mouse {
   }
 
   void scroll(input_raw_t *raw, int high_res_distance) {
-    if (raw->mouse) {
+    if (auto mouse_batch = batch(raw)) {
+      mouse_batch->scroll(high_res_distance);
+    } else if (raw->mouse) {
       (*raw->mouse).vertical_scroll(high_res_distance);
     }
   }
 
   void hscroll(input_raw_t *raw, int high_res_distance) {
-    if (raw->mouse) {
+    if (auto mouse_batch = batch(raw)) {
+      mouse_batch->hscroll(high_res_distance);
+    } else if (raw->mouse) {
       (*raw->mouse).horizontal_scroll(high_res_distance);
     }
   }
@@ -83,4 +105,30 @@ namespace platf::mouse {
     }
     return {0, 0};
   }
+
+  void begin_batch(input_raw_t *raw) {
+    if (!raw->mouse_batch_opened && raw->mouse) {
+      raw->mouse_batch_opened = true;
+      raw->mouse_batch = evdev::mouse_batch_t {evdev::batch_t::open((*raw->mouse).get_nodes(), EV_REL)};
+      if (!raw->mouse_batch) {
+        BOOST_LOG(debug) << "Can't write to the event node of the virtual mouse, its events are written one at a time"sv;
+      }
+    }
+
+    raw->batching = true;
+  }
+
+  void flush(input_raw_t *raw) {
+    if (!raw->batching || !raw->mouse_batch || !raw->mouse_batch.flush()) {
+      return;
+    }
+
+    BOOST_LOG(warning) << "The virtual mouse didn't take a batch of events, its events are written one at a time from now on"sv;
+    raw->mouse_batch = {};
+  }
+
+  void end_batch(input_raw_t *raw) {
+    flush(raw);
+    raw->batching = false;
+  }
 }  // namespace platf::mouse
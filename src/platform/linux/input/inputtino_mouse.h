@@ -26,4 +26,17 @@ namespace platf::mouse {
   void hscroll(input_raw_t *raw, int high_res_distance);
 
   util::point_t get_location(input_raw_t *raw);
+
+  /**
+   * @brief Start collecting relative mouse events, if the event node of the mouse can be written to.
+   */
+  void begin_batch(input_raw_t *raw);
+
+  /**
+   * @brief Write the relative mouse events collected so far.
+   * @details Called before events go to any other device too, so events of different devices keep their order.
+   */
+  void flush(input_raw_t *raw);
+
+  void end_batch(input_raw_t *raw);
 }  // namespace platf::mouse
@@ -20,6 +20,7 @@
 // local includes
 #include "cuda.h"
 #include "graphics.h"
+#include "src/buffer_pool.h"
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
@@ -570,7 +571,7 @@ namespace platf {
 
     struct kms_img_t: public img_t {
       ~kms_img_t() override {
-        delete[] data;
+        buffer_pool::free_image(data);
         data = nullptr;
       }
     };
@@ -1064,6 +1065,29 @@ namespace platf {
         }
       }
 
+      /**
+       * @brief Get when the framebuffer on the plane was presented.
+       * @details The plane shows the framebuffer the CRTC latched on its last vblank, which the kernel
+       *          timestamps on the monotonic clock, like the steady clock. Without a recent vblank,
+       *          e.g. while the display is off, it's taken as presented now.
+       */
+      std::chrono::steady_clock::time_point presentation_time() {
+        auto now = std::chrono::steady_clock::now();
+
+        std::uint64_t sequence;
+        std::uint64_t ns;
+        if (drmCrtcGetSequence(card.fd.el, crtc_id, &sequence, &ns)) {
+          return now;
+        }
+
+        std::chrono::steady_clock::time_point presented {std::chrono::nanoseconds {ns}};
+        if (presented > now || now - presented > 100ms) {
+          return now;
+        }
+
+        return presented;
+      }
+
       inline capture_e refresh(file_t *file, egl::surface_descriptor_t *sd, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
         // Check for a change in HDR metadata
         if (connector_id) {
@@ -1075,7 +1099,7 @@ namespace platf {
         }
 
         plane_t plane = drmModeGetPlane(card.fd.el, plane_id);
-        frame_timestamp = std::chrono::steady_clock::now();
+        frame_timestamp = presentation_time();
 
         auto fb = card.fb(plane.get());
         if (!fb) {
@@ -1128,6 +1152,17 @@ namespace platf {
         return capture_e::ok;
       }
 
+      /**
+       * @brief Get where the cursor is on the captured image, the same way it's blended.
+       */
+      std::optional<util::point_t> cursor_position() const {
+        if (!captured_cursor.visible) {
+          return std::nullopt;
+        }
+
+        return util::point_t {(double) (captured_cursor.x - img_offset_x), (double) (captured_cursor.y - img_offset_y)};
+      }
+
       mem_type_e mem_type;
 
       std::chrono::nanoseconds delay;
@@ -1328,6 +1363,7 @@ namespace platf {
         gl::ctx.GetTextureSubImage(rgb->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
 
         img_out->frame_timestamp = frame_timestamp;
+        img_out->cursor = cursor_position();
 
         if (cursor && captured_cursor.visible) {
           blend_cursor(*img_out);
@@ -1336,13 +1372,17 @@ namespace platf {
         return capture_e::ok;
       }
 
+      bool img_in_system_memory() override {
+        return true;
+      }
+
       std::shared_ptr<img_t> alloc_img() override {
         auto img = std::make_shared<kms_img_t>();
         img->width = width;
         img->height = height;
         img->pixel_pitch = 4;
         img->row_pitch = img->pixel_pitch * width;
-        img->data = new std::uint8_t[height * img->row_pitch];
+        img->data = buffer_pool::alloc_image(height * img->row_pitch);
 
         return img;
       }
@@ -1459,6 +1499,7 @@ namespace platf {
         }
 
         img->sequence = ++sequence;
+        img->cursor = cursor_position();
 
         if (cursor && captured_cursor.visible) {
           // Copy new cursor pixel data if it's been updated
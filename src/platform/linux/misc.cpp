@@ -9,10 +9,18 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 // platform includes
 #include <arpa/inet.h>
@@ -21,10 +29,21 @@
 #include <netinet/in.h>
 #include <netinet/udp.h>
 #include <pwd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
 
 #ifdef __FreeBSD__
   #include <net/if_dl.h>  // For sockaddr_dl, LLADDR, and AF_LINK
+  #include <sys/param.h>  // Must come before sys/cpuset.h
+  #include <sys/cpuset.h>
+#else
+  #include <linux/net_tstamp.h>  // For sock_txtime
 #endif
 
 // lib includes
@@ -47,6 +66,18 @@
   #include "evdi.h"
 #endif
 
+#ifdef SUNSHINE_BUILD_IO_URING
+  #include "uring_send.h"
+#endif
+
+#ifdef SUNSHINE_BUILD_XDP
+  #include "xdp_send.h"
+#endif
+
+#ifdef SUNSHINE_BUILD_RTKIT
+  #include "rtkit.h"
+#endif
+
 #ifdef __GNUC__
   #define SUNSHINE_GNUC_EXTENSION __extension__
 #else
@@ -331,16 +362,540 @@ namespace platf {
     // Unimplemented
   }
 
+#ifndef __FreeBSD__
+  namespace {
+    /**
+     * @brief Read a list of CPUs like `0-3,8-11`, as found in sysfs.
+     * @param path The file holding the list.
+     * @return The CPUs, empty if the file can't be read.
+     */
+    std::vector<int> read_cpu_list(const std::filesystem::path &path) {
+      std::ifstream in {path};
+      std::string list;
+      std::getline(in, list);
+
+      std::vector<int> cpus;
+      std::istringstream ranges {list};
+      for (std::string range; std::getline(ranges, range, ',');) {
+        int first;
+        int last;
+        auto count = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (count < 1) {
+          continue;
+        }
+        for (int cpu = first; cpu <= (count == 2 ? last : first); ++cpu) {
+          cpus.emplace_back(cpu);
+        }
+      }
+
+      return cpus;
+    }
+
+    /**
+     * @brief Read a number from a sysfs file.
+     * @return The number, or the default if the file can't be read.
+     */
+    int read_int(const std::filesystem::path &path, int def) {
+      std::ifstream in {path};
+      int value;
+      if (!(in >> value)) {
+        return def;
+      }
+
+      return value;
+    }
+  }  // namespace
+#endif
+
+  std::vector<cpu_t> cpu_topology() {
+    std::vector<cpu_t> cpus;
+
+#ifdef __FreeBSD__
+    // The topology isn't exposed in a simple way, so every CPU is its own core
+    auto count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    for (int id = 0; id < count; ++id) {
+      cpus.emplace_back(cpu_t {id, id, 0, false});
+    }
+#else
+    const std::filesystem::path sys_cpu {"/sys/devices/system/cpu"};
+
+    // On Intel hybrid CPUs, the E-cores are listed by their own PMU
+    auto atom_cpus = read_cpu_list("/sys/devices/cpu_atom/cpus");
+
+    int max_capacity = 0;
+    std::vector<int> capacities;
+    for (auto id : read_cpu_list(sys_cpu / "online")) {
+      auto cpu_dir = sys_cpu / ("cpu" + std::to_string(id));
+
+      cpu_t cpu {id, id, 0, false};
+      if (auto siblings = read_cpu_list(cpu_dir / "topology" / "thread_siblings_list"); !siblings.empty()) {
+        cpu.core = siblings.front();
+      }
+
+      // CPUs sharing the last level cache, like the cores of a CCD, are named after the first of them
+      int cache_level = 0;
+      for (std::error_code ec; auto &index : std::filesystem::directory_iterator {cpu_dir / "cache", ec}) {
+        auto level = read_int(index.path() / "level", 0);
+        auto shared = read_cpu_list(index.path() / "shared_cpu_list");
+        if (level > cache_level && !shared.empty()) {
+          cache_level = level;
+          cpu.cache = shared.front();
+        }
+      }
+
+      cpu.efficiency = std::find(std::begin(atom_cpus), std::end(atom_cpus), id) != std::end(atom_cpus);
+
+      // The CPU links to its NUMA node, as node0, node1...
+      for (std::error_code ec; auto &entry : std::filesystem::directory_iterator {cpu_dir, ec}) {
+        auto name = entry.path().filename().string();
+        if (name.starts_with("node"sv) && name.size() > 4 && std::isdigit((unsigned char) name[4])) {
+          cpu.node = std::stoi(name.substr(4));
+          break;
+        }
+      }
+
+      // Arm big.LITTLE CPUs tell the cores apart by their capacity instead
+      auto capacity = read_int(cpu_dir / "cpu_capacity", 0);
+      max_capacity = std::max(max_capacity, capacity);
+      capacities.emplace_back(capacity);
+
+      cpus.emplace_back(cpu);
+    }
+
+    if (atom_cpus.empty()) {
+      for (std::size_t x = 0; x < cpus.size(); ++x) {
+        cpus[x].efficiency = capacities[x] > 0 && capacities[x] < max_capacity;
+      }
+    }
+#endif
+
+    return cpus;
+  }
+
+  std::optional<int> gpu_numa_node(const std::string &adapter_name) {
+#ifndef __FreeBSD__
+    // The adapter is a render node, like the one VA-API opens by default
+    auto device = std::filesystem::path {adapter_name.empty() ? "/dev/dri/renderD128"s : adapter_name}.filename();
+
+    // Devices without a node, like on single socket systems, have -1
+    auto node = read_int(std::filesystem::path {"/sys/class/drm"} / device / "device" / "numa_node", -1);
+    if (node >= 0) {
+      return node;
+    }
+#endif
+
+    return std::nullopt;
+  }
+
+  std::optional<int> interface_numa_node(const std::string_view &address) {
+#ifndef __FreeBSD__
+    auto ifaddrs = get_ifaddrs();
+    for (auto pos = ifaddrs.get(); pos != nullptr; pos = pos->ifa_next) {
+      if (!pos->ifa_addr || address != from_sockaddr(pos->ifa_addr)) {
+        continue;
+      }
+
+      // Virtual interfaces, like bridges and loopback, have no device
+      auto node = read_int(std::filesystem::path {"/sys/class/net"} / pos->ifa_name / "device" / "numa_node", -1);
+      if (node >= 0) {
+        return node;
+      }
+      break;
+    }
+#endif
+
+    return std::nullopt;
+  }
+
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+#ifdef __FreeBSD__
+    cpuset_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+      CPU_SET(cpu, &set);
+    }
+
+    if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(set), &set)) {
+      BOOST_LOG(warning) << "cpuset_setaffinity() failed: "sv << errno;
+      return false;
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+      CPU_SET(cpu, &set);
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+      BOOST_LOG(warning) << "sched_setaffinity() failed: "sv << errno;
+      return false;
+    }
+#endif
+
+    return true;
+  }
+
+  std::vector<int> thread_affinity() {
+    std::vector<int> cpus;
+
+#ifdef __FreeBSD__
+    cpuset_t set;
+    CPU_ZERO(&set);
+    if (cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(set), &set)) {
+      return cpus;
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set)) {
+      return cpus;
+    }
+#endif
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.emplace_back(cpu);
+      }
+    }
+
+    return cpus;
+  }
+
+#ifndef __FreeBSD__
+  namespace {
+    /**
+     * @brief A thread sampled through procfs, which keeps working for as long as the thread exists.
+     */
+    class proc_thread_t: public thread_handle_t {
+    public:
+      explicit proc_thread_t(pid_t tid):
+          _tid {tid},
+          _task {"/proc/self/task/" + std::to_string(tid)} {
+      }
+
+      std::optional<thread_times_t> times() override {
+        thread_times_t times {};
+
+        // The time spent on a CPU and waiting on a run queue, in nanoseconds
+        std::ifstream schedstat {_task + "/schedstat"};
+        std::uint64_t cpu_time;
+        std::uint64_t run_delay;
+        if (schedstat >> cpu_time >> run_delay) {
+          times.cpu_time = std::chrono::nanoseconds {cpu_time};
+          times.run_delay = std::chrono::nanoseconds {run_delay};
+        } else if (auto ticks = cpu_ticks()) {
+          // Kernels without scheduler statistics still count the user and system time in clock ticks
+          times.cpu_time = std::chrono::nanoseconds {*ticks * 1'000'000'000 / sysconf(_SC_CLK_TCK)};
+        } else {
+          return std::nullopt;
+        }
+
+        std::ifstream status {_task + "/status"};
+        std::string line;
+        while (std::getline(status, line)) {
+          if (line.starts_with("voluntary_ctxt_switches:"sv)) {
+            times.voluntary_switches = std::strtoull(line.c_str() + "voluntary_ctxt_switches:"sv.size(), nullptr, 10);
+          } else if (line.starts_with("nonvoluntary_ctxt_switches:"sv)) {
+            times.involuntary_switches = std::strtoull(line.c_str() + "nonvoluntary_ctxt_switches:"sv.size(), nullptr, 10);
+          }
+        }
+
+        sched_param param {};
+        auto policy = sched_getscheduler(_tid);
+        if (policy >= 0 && !sched_getparam(_tid, &param)) {
+          policy &= ~SCHED_RESET_ON_FORK;
+          times.realtime_priority = policy == SCHED_FIFO || policy == SCHED_RR ? param.sched_priority : 0;
+        }
+
+        return times;
+      }
+
+    private:
+      std::optional<std::uint64_t> cpu_ticks() {
+        std::ifstream stat {_task + "/stat"};
+        std::string line;
+        if (!std::getline(stat, line)) {
+          return std::nullopt;
+        }
+
+        // The name of the thread may hold spaces, the fields after it don't
+        auto name_end = line.rfind(')');
+        if (name_end == std::string::npos) {
+          return std::nullopt;
+        }
+
+        // The user and system times are the 14th and 15th fields, the name is the 2nd
+        std::istringstream fields {line.substr(name_end + 1)};
+        std::string field;
+        for (int x = 3; x < 14; ++x) {
+          fields >> field;
+        }
+
+        std::uint64_t utime;
+        std::uint64_t stime;
+        if (!(fields >> utime >> stime)) {
+          return std::nullopt;
+        }
+
+        return utime + stime;
+      }
+
+      pid_t _tid;
+      std::string _task;
+    };
+
+    // How often the watchdog checks whether the real-time threads blocked
+    constexpr auto REALTIME_WATCHDOG_INTERVAL = 50ms;
+
+    // The share of a watchdog interval a real-time thread may run without blocking before it's demoted
+    constexpr double REALTIME_SPIN_SHARE = 0.9;
+
+    // The watchdog preempts every streaming thread, whose priorities stay below this
+    constexpr int REALTIME_WATCHDOG_PRIORITY = 10;
+
+    /**
+     * @brief Gives threads real-time policies and demotes those that keep a CPU without blocking.
+     * @details rtkit makes a real-time thread that runs past RLIMIT_RTTIME without blocking kill the process,
+     *          so the watchdog demotes spinning threads well before that.
+     */
+    class realtime_t {
+    public:
+      static realtime_t &get() {
+        static realtime_t realtime;
+        return realtime;
+      }
+
+      bool promote(pid_t tid, int priority) {
+        std::lock_guard lg {_lock};
+
+        if (!make_realtime(tid, priority)) {
+          return false;
+        }
+
+        if (!_watching) {
+          std::thread {&realtime_t::watch, this}.detach();
+          _watching = true;
+        }
+
+        proc_thread_t thread {tid};
+        if (auto times = thread.times()) {
+          _threads.emplace_back(watched_t {tid, std::move(thread), *times});
+        }
+
+        return true;
+      }
+
+    private:
+      struct watched_t {
+        pid_t tid;
+        proc_thread_t thread;
+        thread_times_t last;
+      };
+
+      /**
+       * @brief Set a real-time policy, directly if the process may and through rtkit otherwise.
+       */
+      bool make_realtime(pid_t tid, int priority) {
+        priority = std::clamp(priority, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+
+        // Threads started by a real-time thread inherit its policy, but children processes don't
+        sched_param param {priority};
+        if (!sched_setscheduler(tid, SCHED_FIFO | SCHED_RESET_ON_FORK, &param)) {
+          return true;
+        }
+        if (errno != EPERM) {
+          BOOST_LOG(warning) << "sched_setscheduler() failed: "sv << errno;
+          return false;
+        }
+
+#ifdef SUNSHINE_BUILD_RTKIT
+        if (!_rtkit_limits) {
+          _rtkit_limits = rtkit::limits();
+          if (!_rtkit_limits || !limit_rttime(_rtkit_limits->max_rttime_usec)) {
+            BOOST_LOG(warning) << "Neither CAP_SYS_NICE nor rtkit are available, the streaming threads keep a normal scheduling policy"sv;
+            _rtkit_limits = rtkit::limits_t {0, 0};
+          }
+        }
+        if (_rtkit_limits->max_priority <= 0) {
+          return false;
+        }
+
+        return rtkit::make_thread_realtime(tid, std::min(priority, _rtkit_limits->max_priority));
+#else
+        BOOST_LOG(warning) << "Real-time scheduling needs CAP_SYS_NICE, the streaming threads keep a normal scheduling policy"sv;
+        return false;
+#endif
+      }
+
+      /**
+       * @brief Lower RLIMIT_RTTIME to what rtkit accepts.
+       */
+      static bool limit_rttime(std::int64_t max_rttime_usec) {
+        rlimit limit;
+        if (getrlimit(RLIMIT_RTTIME, &limit)) {
+          return false;
+        }
+
+        if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > (rlim_t) max_rttime_usec) {
+          limit.rlim_cur = limit.rlim_max = (rlim_t) max_rttime_usec;
+          if (setrlimit(RLIMIT_RTTIME, &limit)) {
+            BOOST_LOG(warning) << "setrlimit(RLIMIT_RTTIME) failed: "sv << errno;
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      void watch() {
+        // The watchdog must preempt the threads it watches to demote them
+        {
+          std::lock_guard lg {_lock};
+          make_realtime(syscall(SYS_gettid), REALTIME_WATCHDOG_PRIORITY);
+        }
+
+        auto last_check = std::chrono::steady_clock::now();
+        while (true) {
+          std::this_thread::sleep_for(REALTIME_WATCHDOG_INTERVAL);
+          auto now = std::chrono::steady_clock::now();
+          auto interval = now - last_check;
+          last_check = now;
+
+          std::lock_guard lg {_lock};
+          std::erase_if(_threads, [&](watched_t &watched) {
+            auto times = watched.thread.times();
+            if (!times) {
+              return true;
+            }
+
+            auto ran = times->cpu_time - watched.last.cpu_time;
+            auto blocked = times->voluntary_switches != watched.last.voluntary_switches;
+            watched.last = *times;
+
+            if (blocked || ran < interval * REALTIME_SPIN_SHARE) {
+              return false;
+            }
+
+            sched_param param {0};
+            if (sched_setscheduler(watched.tid, SCHED_OTHER, &param)) {
+              BOOST_LOG(error) << "Couldn't demote a real-time thread that keeps a CPU without blocking: "sv << errno;
+            } else {
+              BOOST_LOG(warning) << "Demoted a real-time thread that kept a CPU for "sv << std::chrono::duration_cast<std::chrono::milliseconds>(ran).count() << "ms without blocking"sv;
+            }
+
+            return true;
+          });
+        }
+      }
+
+      std::mutex _lock;
+      std::vector<watched_t> _threads;
+      bool _watching = false;
+
+#ifdef SUNSHINE_BUILD_RTKIT
+      std::optional<rtkit::limits_t> _rtkit_limits;
+#endif
+    };
+  }  // namespace
+#endif
+
+  std::unique_ptr<thread_handle_t> current_thread() {
+#ifdef __FreeBSD__
+    return nullptr;
+#else
+    return std::make_unique<proc_thread_t>(syscall(SYS_gettid));
+#endif
+  }
+
+  bool set_thread_realtime(int priority) {
+#ifdef __FreeBSD__
+    // Unimplemented
+    return false;
+#else
+    return realtime_t::get().promote(syscall(SYS_gettid), priority);
+#endif
+  }
+
+  std::optional<pages_t> map_pages(std::size_t size, bool lock) {
+    // Transparent huge pages only back ranges aligned to a huge page, so map a little more and trim it
+    constexpr std::size_t HUGE_PAGE_SIZE = 2 << 20;
+    size = (std::max<std::size_t>(size, 1) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    auto mapping = (std::uint8_t *) mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      BOOST_LOG(warning) << "mmap() failed: "sv << errno;
+      return std::nullopt;
+    }
+
+    auto data = (std::uint8_t *) (((std::uintptr_t) mapping + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (data > mapping) {
+      munmap(mapping, data - mapping);
+    }
+    munmap(data + size, mapping + HUGE_PAGE_SIZE - data);
+
+    pages_t pages {data, size, false, false};
+
+#ifdef MADV_HUGEPAGE
+    pages.huge = !madvise(data, size, MADV_HUGEPAGE);
+#else
+    // FreeBSD promotes aligned ranges to superpages on its own
+    pages.huge = true;
+#endif
+
+    if (lock) {
+      // Locking also faults every page in
+      pages.locked = !mlock(data, size);
+      if (!pages.locked) {
+        BOOST_LOG(warning) << "mlock() failed, RLIMIT_MEMLOCK may be too low: "sv << errno;
+      }
+    }
+
+    if (!pages.locked) {
+#ifdef MADV_POPULATE_WRITE
+      if (madvise(data, size, MADV_POPULATE_WRITE))
+#endif
+      {
+        for (std::size_t offset = 0; offset < size; offset += 4096) {
+          data[offset] = 0;
+        }
+      }
+    }
+
+    return pages;
+  }
+
+  void unmap_pages(const pages_t &pages) {
+    munmap(pages.data, pages.size);
+  }
+
+  page_faults_t page_faults() {
+    rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage)) {
+      return {};
+    }
+
+    return {(std::uint64_t) usage.ru_minflt, (std::uint64_t) usage.ru_majflt};
+  }
+
+#ifdef SUNSHINE_BUILD_XDP
+  namespace {
+    void forget_xdp_flows();
+  }  // namespace
+#endif
+
   void streaming_will_start() {
     // Nothing to do - virtual display is created on-demand in evdi_display()
   }
 
   void streaming_will_stop() {
 #ifdef SUNSHINE_BUILD_EVDI
-    // Clean up virtual display if it was created
-    if (evdi_is_active()) {
-      evdi_destroy_virtual_display();
+    // Clean up virtual display if it was created, unless it's kept for the next session
+    if (evdi_is_active() && !config::video.evdi_persistent) {
+      evdi_destroy_virtual_display_later(config::video.evdi_teardown_delay);
     }
+#endif
+#ifdef SUNSHINE_BUILD_XDP
+    forget_xdp_flows();
 #endif
   }
 
@@ -419,7 +974,252 @@ namespace platf {
     return saddr_v6;
   }
 
+#ifdef UDP_SEGMENT
+  /**
+   * @brief Fill the iovs of a GSO message covering some of the blocks of a batch.
+   * @param send_info The batch.
+   * @param seg_index The index of the first block of the message in the batch.
+   * @param segs_in_batch The number of blocks in the message.
+   * @param iovs The iovs to fill.
+   * @return The number of iovs filled.
+   */
+  static int fill_gso_iovs(batched_send_info_t &send_info, size_t seg_index, size_t segs_in_batch, struct iovec *iovs) {
+    int iovlen = 0;
+    if (send_info.headers) {
+      // Interleave iovs for headers and payloads
+      for (auto i = 0; i < segs_in_batch; i++) {
+        iovs[iovlen].iov_base = (void *) &send_info.headers[(send_info.block_offset + seg_index + i) * send_info.header_size];
+        iovs[iovlen].iov_len = send_info.header_size;
+        iovlen++;
+        auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + seg_index + i) * send_info.payload_size);
+        iovs[iovlen].iov_base = (void *) payload_desc.buffer;
+        iovs[iovlen].iov_len = send_info.payload_size;
+        iovlen++;
+      }
+    } else {
+      // Translate buffer descriptors into iovs
+      auto payload_offset = (send_info.block_offset + seg_index) * send_info.payload_size;
+      auto payload_length = payload_offset + (segs_in_batch * send_info.payload_size);
+      while (payload_offset < payload_length) {
+        auto payload_desc = send_info.buffer_for_payload_offset(payload_offset);
+        iovs[iovlen].iov_base = (void *) payload_desc.buffer;
+        iovs[iovlen].iov_len = std::min(payload_desc.size, payload_length - payload_offset);
+        payload_offset += iovs[iovlen].iov_len;
+        iovlen++;
+      }
+    }
+
+    return iovlen;
+  }
+#endif
+
+#ifdef SUNSHINE_BUILD_XDP
+  namespace {
+    // Routes and neighbors may change while streaming, so flows are resolved again once in a while
+    constexpr auto XDP_FLOW_LIFETIME = 5s;
+
+    // The flows of sessions that ended aren't used anymore, and are forgotten after a while
+    constexpr auto XDP_FLOW_IDLE_TIME = 30s;
+
+    struct xdp_flow_t {
+      std::optional<xdp::flow_t> flow;
+      std::chrono::steady_clock::time_point resolved;
+      std::chrono::steady_clock::time_point used;
+      bool resolving = false;  ///< Batches keep the last flow while it's resolved again
+    };
+
+    struct xdp_state_t {
+      // Sending isn't thread-safe
+      std::mutex lock;
+      bool initialized = false;
+      std::unique_ptr<xdp::sender_t> sender;
+
+      // Flows are cached so /proc/net/route and /proc/net/arp aren't read and parsed for every batch,
+      // and a stale one is resolved again without holding either lock
+      std::mutex flows_lock;
+      std::map<std::tuple<std::uintptr_t, std::uint32_t, std::uint32_t, std::uint16_t>, xdp_flow_t> flows;
+    };
+
+    xdp_state_t &xdp_state() {
+      static xdp_state_t state;
+      return state;
+    }
+
+    /**
+     * @brief Get an IPv4 address in network byte order, including one mapped into IPv6 by a dual-stack socket.
+     */
+    std::optional<std::uint32_t> to_xdp_address(const boost::asio::ip::address &address) {
+      if (address.is_v4()) {
+        return htonl(address.to_v4().to_uint());
+      }
+
+      if (address.to_v6().is_v4_mapped()) {
+        return htonl(boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6()).to_uint());
+      }
+
+      return std::nullopt;
+    }
+
+    /**
+     * @brief Resolve the flow of a batch.
+     * @return The flow, or `std::nullopt` if the batch can't go out through the AF_XDP socket yet.
+     */
+    std::optional<xdp::flow_t> resolve_xdp_flow(const batched_send_info_t &send_info, std::uint32_t src_ip, std::uint32_t dst_ip) {
+      // The packets carry the source port and DSCP marking of the socket they'd otherwise be sent from
+      auto sockfd = (int) send_info.native_socket;
+      sockaddr_storage local {};
+      socklen_t local_size = sizeof(local);
+      if (getsockname(sockfd, (sockaddr *) &local, &local_size)) {
+        return std::nullopt;
+      }
+      auto src_port = local.ss_family == AF_INET6 ? ((sockaddr_in6 *) &local)->sin6_port : ((sockaddr_in *) &local)->sin_port;
+
+      int tos = 0;
+      socklen_t tos_size = sizeof(tos);
+      getsockopt(sockfd, SOL_IP, IP_TOS, &tos, &tos_size);
+
+      xdp::flow_t flow {};
+      flow.src_ip = src_ip;
+      flow.dst_ip = dst_ip;
+      flow.src_port = ntohs(src_port);
+      flow.dst_port = send_info.target_port;
+      flow.tos = (std::uint8_t) tos;
+
+      // Until the kernel has sent to the next hop, it has no neighbor entry for it yet
+      auto resolved = xdp::resolve_flow(config::stream.xdp_interface, flow);
+      if (!resolved) {
+        BOOST_LOG(debug) << "AF_XDP: "sv << send_info.target_address << " isn't reachable through "sv << config::stream.xdp_interface << " yet, using regular sends"sv;
+      }
+
+      return resolved;
+    }
+
+    /**
+     * @brief Find the flow of a batch, resolving it again once it's stale.
+     * @details Only one batch resolves a stale flow, while the others keep the flow it had.
+     * @return The flow, or `std::nullopt` if the batch can't go out through the AF_XDP socket yet.
+     */
+    std::optional<xdp::flow_t> find_xdp_flow(xdp_state_t &state, const batched_send_info_t &send_info) {
+      auto src_ip = to_xdp_address(send_info.source_address);
+      auto dst_ip = to_xdp_address(send_info.target_address);
+      if (!src_ip || !dst_ip) {
+        return std::nullopt;
+      }
+
+      std::tuple key {send_info.native_socket, *src_ip, *dst_ip, send_info.target_port};
+      auto now = std::chrono::steady_clock::now();
+      {
+        std::lock_guard lg {state.flows_lock};
+        auto &cached = state.flows[key];
+        cached.used = now;
+        if (cached.resolving || (cached.resolved != std::chrono::steady_clock::time_point {} && now - cached.resolved < XDP_FLOW_LIFETIME)) {
+          return cached.flow;
+        }
+        cached.resolving = true;
+
+        std::erase_if(state.flows, [&](auto &pair) {
+          return !pair.second.resolving && now - pair.second.used > XDP_FLOW_IDLE_TIME;
+        });
+      }
+
+      auto flow = resolve_xdp_flow(send_info, *src_ip, *dst_ip);
+
+      std::lock_guard lg {state.flows_lock};
+      auto &cached = state.flows[key];
+      cached.flow = flow;
+      cached.resolved = now;
+      cached.resolving = false;
+      return flow;
+    }
+
+    /**
+     * @brief Forget the flows of every session, once none is streaming anymore.
+     */
+    void forget_xdp_flows() {
+      auto &state = xdp_state();
+
+      std::lock_guard lg {state.flows_lock};
+      std::erase_if(state.flows, [](auto &pair) {
+        return !pair.second.resolving;
+      });
+    }
+
+    /**
+     * @brief Queue packets on the AF_XDP socket if one is configured and the destination is reached through it.
+     * @param send_info The batch.
+     * @param queued Receives the number of blocks queued, the first ones of the batch.
+     * @return The status of the send.
+     */
+    xdp::status_e xdp_send(batched_send_info_t &send_info, std::size_t &queued) {
+      queued = 0;
+
+      // Packets sent through the socket skip the qdisc, which is what honors launch times
+      if (config::stream.xdp_interface.empty() || send_info.txtime_blocks) {
+        return xdp::status_e::unsupported;
+      }
+
+      auto &state = xdp_state();
+      {
+        std::lock_guard lg {state.lock};
+        if (!std::exchange(state.initialized, true)) {
+          state.sender = xdp::sender_t::create(config::stream.xdp_interface, 0);
+          if (!state.sender) {
+            BOOST_LOG(warning) << "AF_XDP: Couldn't bind to "sv << config::stream.xdp_interface << ": "sv << errno << ", falling back to regular sends"sv;
+          } else {
+            BOOST_LOG(info) << "AF_XDP: Sending video through "sv << config::stream.xdp_interface << (state.sender->zero_copy() ? " in zero-copy mode"sv : " in copy mode"sv);
+          }
+        }
+
+        if (!state.sender) {
+          return xdp::status_e::unsupported;
+        }
+      }
+
+      auto flow = find_xdp_flow(state, send_info);
+      if (!flow) {
+        return xdp::status_e::unsupported;
+      }
+
+      // Kept between batches, so sending the packets of a frame doesn't allocate
+      thread_local std::vector<xdp::packet_t> packets;
+      packets.resize(send_info.block_count);
+      for (size_t i = 0; i < send_info.block_count; i++) {
+        auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + i) * send_info.payload_size);
+        if (payload_desc.size < send_info.payload_size) {
+          // A payload straddling two buffers would need to be gathered from both
+          return xdp::status_e::unsupported;
+        }
+
+        packets[i] = {
+          send_info.headers ? &send_info.headers[(send_info.block_offset + i) * send_info.header_size] : nullptr,
+          send_info.headers ? send_info.header_size : 0,
+          payload_desc.buffer,
+          send_info.payload_size,
+        };
+      }
+
+      std::lock_guard lg {state.lock};
+      return state.sender->send(*flow, packets, queued);
+    }
+  }  // namespace
+#endif
+
   bool send_batch(batched_send_info_t &send_info) {
+#ifdef SUNSHINE_BUILD_XDP
+    std::size_t queued;
+    switch (xdp_send(send_info, queued)) {
+      case xdp::status_e::ok:
+        return true;
+      case xdp::status_e::error:
+        // The blocks already queued go out anyway, so only the rest are sent the regular way
+        send_info.block_offset += queued;
+        send_info.block_count -= queued;
+        break;
+      case xdp::status_e::unsupported:
+        break;
+    }
+#endif
+
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
 
@@ -500,41 +1300,144 @@ namespace platf {
     auto const max_iovs_per_msg = send_info.payload_buffers.size() + (send_info.headers ? 1 : 0);
 
 #ifdef UDP_SEGMENT
+    // UDP GSO on Linux currently only supports sending 64K or 64 segments at a time
+    const size_t seg_max = 65536 / 1500;
+    const size_t max_iovs_per_gso_msg = (send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg;
+    auto msg_size = send_info.header_size + send_info.payload_size;
+
+  #ifdef SO_TXTIME
+    if (send_info.txtime_blocks) {
+      // Every message gets its own launch time, so each needs its own control messages
+      union txtime_cmbuf_t {
+        char buf[sizeof(cmbuf.buf) + CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr alignment;
+      };
+
+      auto segs_per_msg = std::min(send_info.txtime_blocks, seg_max);
+      auto msg_count = (send_info.block_count + segs_per_msg - 1) / segs_per_msg;
+      // Kept between batches, so sending the packets of a frame doesn't allocate
+      thread_local std::vector<struct mmsghdr> msgs;
+      thread_local std::vector<struct iovec> iovs;
+      thread_local std::vector<txtime_cmbuf_t> cmbufs;
+      msgs.assign(msg_count, {});
+      iovs.assign(msg_count * (send_info.headers ? std::min(segs_per_msg, send_info.block_count) : 1) * max_iovs_per_msg, {});
+      cmbufs.assign(msg_count, {});  // Must be zeroed for CMSG_NXTHDR()
+
+      auto first_txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_info.txtime.time_since_epoch());
+      for (size_t x = 0, iov_index = 0; x < msg_count; ++x) {
+        auto seg_index = x * segs_per_msg;
+        auto segs_in_batch = std::min(send_info.block_count - seg_index, segs_per_msg);
+
+        auto &hdr = msgs[x].msg_hdr;
+        hdr.msg_name = msg.msg_name;
+        hdr.msg_namelen = msg.msg_namelen;
+        hdr.msg_iov = &iovs[iov_index];
+        hdr.msg_iovlen = fill_gso_iovs(send_info, seg_index, segs_in_batch, hdr.msg_iov);
+        iov_index += hdr.msg_iovlen;
+
+        // Start from the PKTINFO option, then add the segment size and the launch time
+        memcpy(cmbufs[x].buf, cmbuf.buf, cmbuflen);
+        hdr.msg_control = cmbufs[x].buf;
+        hdr.msg_controllen = sizeof(cmbufs[x].buf);
+
+        auto cm = CMSG_FIRSTHDR(&hdr);
+        size_t controllen = cmbuflen;
+        if (segs_in_batch > 1) {
+          cm = CMSG_NXTHDR(&hdr, cm);
+          cm->cmsg_level = SOL_UDP;
+          cm->cmsg_type = UDP_SEGMENT;
+          cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+          *((uint16_t *) CMSG_DATA(cm)) = msg_size;
+          controllen += CMSG_SPACE(sizeof(uint16_t));
+        }
+
+        uint64_t txtime = (first_txtime + send_info.txtime_interval * x).count();
+        cm = CMSG_NXTHDR(&hdr, cm);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_TXTIME;
+        cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+        memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+        controllen += CMSG_SPACE(sizeof(txtime));
+
+        hdr.msg_controllen = controllen;
+      }
+
+      // Queue every message with its launch time at once, the qdisc holds each back until it's due
+      size_t msgs_sent = 0;
+      while (msgs_sent < msg_count) {
+        auto sent = sendmmsg(sockfd, &msgs[msgs_sent], msg_count - msgs_sent, 0);
+        if (sent < 0) {
+          // If there's no send buffer space, wait for some to be available
+          if (errno == EAGAIN) {
+            struct pollfd pfd;
+
+            pfd.fd = sockfd;
+            pfd.events = POLLOUT;
+
+            if (poll(&pfd, 1, -1) != 1) {
+              BOOST_LOG(warning) << "poll() failed: "sv << errno;
+              return false;
+            }
+
+            continue;
+          }
+
+          BOOST_LOG(warning) << "sendmmsg() with launch times failed: "sv << errno;
+          return false;
+        }
+
+        msgs_sent += sent;
+      }
+
+      return true;
+    }
+  #endif
+
+  #ifdef SUNSHINE_BUILD_IO_URING
+    {
+      // Build every GSO message of the batch up front, so they all go out in a single submission
+      auto msg_count = (send_info.block_count + seg_max - 1) / seg_max;
+      thread_local std::vector<struct msghdr> msgs;
+      thread_local std::vector<struct iovec> iovs;
+      msgs.assign(msg_count, msg);
+      iovs.assign(msg_count * max_iovs_per_gso_msg, {});
+
+      // Messages with a single block don't use GSO, so they stop short of the UDP_SEGMENT option
+      msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
+      auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      *((uint16_t *) CMSG_DATA(cm)) = msg_size;
+
+      for (size_t x = 0; x < msg_count; ++x) {
+        auto seg_index = x * seg_max;
+        auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
+
+        msgs[x].msg_iov = &iovs[x * max_iovs_per_gso_msg];
+        msgs[x].msg_iovlen = fill_gso_iovs(send_info, seg_index, segs_in_batch, msgs[x].msg_iov);
+        msgs[x].msg_controllen = segs_in_batch > 1 ? msg.msg_controllen : cmbuflen;
+      }
+
+      switch (uring::sendmsg_batch(sockfd, msgs)) {
+        case uring::status_e::ok:
+          return true;
+        case uring::status_e::error:
+          return false;
+        case uring::status_e::unsupported:
+          break;
+      }
+    }
+  #endif
+
     {
-      // UDP GSO on Linux currently only supports sending 64K or 64 segments at a time
       size_t seg_index = 0;
-      const size_t seg_max = 65536 / 1500;
-      struct iovec iovs[(send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg];
-      auto msg_size = send_info.header_size + send_info.payload_size;
+      struct iovec iovs[max_iovs_per_gso_msg];
       while (seg_index < send_info.block_count) {
-        int iovlen = 0;
         auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
-        if (send_info.headers) {
-          // Interleave iovs for headers and payloads
-          for (auto i = 0; i < segs_in_batch; i++) {
-            iovs[iovlen].iov_base = (void *) &send_info.headers[(send_info.block_offset + seg_index + i) * send_info.header_size];
-            iovs[iovlen].iov_len = send_info.header_size;
-            iovlen++;
-            auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + seg_index + i) * send_info.payload_size);
-            iovs[iovlen].iov_base = (void *) payload_desc.buffer;
-            iovs[iovlen].iov_len = send_info.payload_size;
-            iovlen++;
-          }
-        } else {
-          // Translate buffer descriptors into iovs
-          auto payload_offset = (send_info.block_offset + seg_index) * send_info.payload_size;
-          auto payload_length = payload_offset + (segs_in_batch * send_info.payload_size);
-          while (payload_offset < payload_length) {
-            auto payload_desc = send_info.buffer_for_payload_offset(payload_offset);
-            iovs[iovlen].iov_base = (void *) payload_desc.buffer;
-            iovs[iovlen].iov_len = std::min(payload_desc.size, payload_length - payload_offset);
-            payload_offset += iovs[iovlen].iov_len;
-            iovlen++;
-          }
-        }
 
         msg.msg_iov = iovs;
-        msg.msg_iovlen = iovlen;
+        msg.msg_iovlen = fill_gso_iovs(send_info, seg_index, segs_in_batch, iovs);
 
         // We should not use GSO if the data is <= one full block size
         if (segs_in_batch > 1) {
@@ -587,8 +1490,10 @@ namespace platf {
 
     {
       // If GSO is not supported, use sendmmsg() instead.
-      std::vector<struct mmsghdr> msgs(send_info.block_count);
-      std::vector<struct iovec> iovs(send_info.block_count * (send_info.headers ? 2 : 1));
+      thread_local std::vector<struct mmsghdr> msgs;
+      thread_local std::vector<struct iovec> iovs;
+      msgs.assign(send_info.block_count, {});
+      iovs.assign(send_info.block_count * (send_info.headers ? 2 : 1), {});
       int iov_idx = 0;
       for (size_t i = 0; i < send_info.block_count; i++) {
         msgs[i].msg_len = 0;
@@ -644,6 +1549,23 @@ namespace platf {
     }
   }
 
+  bool enable_socket_txtime(std::uintptr_t native_socket) {
+#if defined(SO_TXTIME) && defined(UDP_SEGMENT)
+    // steady_clock is CLOCK_MONOTONIC, which is also the clock the fq qdisc keeps launch times on
+    struct sock_txtime txtime {};
+    txtime.clockid = CLOCK_MONOTONIC;
+
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+      BOOST_LOG(warning) << "Failed to set SO_TXTIME: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -799,6 +1721,49 @@ namespace platf {
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
    */
+  std::optional<std::uintptr_t> open_stream_socket(bool v6) {
+    return std::nullopt;
+  }
+
+  std::optional<int> path_mtu(const boost::asio::ip::address &address, uint16_t port) {
+#if defined(IP_MTU) && defined(IPV6_MTU)
+    auto v4 = address.is_v4() || address.to_v6().is_v4_mapped();
+    int fd = socket(v4 ? AF_INET : AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+    auto close_fg = util::fail_guard([fd]() {
+      close(fd);
+    });
+
+    // Connecting a UDP socket only picks the route
+    int status;
+    if (v4) {
+      auto address_v4 = address.is_v4() ? address.to_v4() : boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+      auto saddr_v4 = to_sockaddr(address_v4, port);
+      status = connect(fd, (sockaddr *) &saddr_v4, sizeof(saddr_v4));
+    } else {
+      auto saddr_v6 = to_sockaddr(address.to_v6(), port);
+      status = connect(fd, (sockaddr *) &saddr_v6, sizeof(saddr_v6));
+    }
+    if (status) {
+      BOOST_LOG(debug) << "Couldn't find a route to "sv << address.to_string() << ": "sv << errno;
+      return std::nullopt;
+    }
+
+    int mtu;
+    socklen_t size = sizeof(mtu);
+    if (getsockopt(fd, v4 ? IPPROTO_IP : IPPROTO_IPV6, v4 ? IP_MTU : IPV6_MTU, &mtu, &size)) {
+      return std::nullopt;
+    }
+
+    return mtu;
+#else
+    // The path MTU can't be read from a socket
+    return std::nullopt;
+#endif
+  }
+
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging) {
     int sockfd = (int) native_socket;
     std::vector<std::tuple<int, int, int>> reset_options;
@@ -867,6 +1832,143 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  int recv_batch(batched_recv_info_t &recv_info) {
+    constexpr std::size_t MAX_BATCH = 64;
+
+    std::array<mmsghdr, MAX_BATCH> msgs {};
+    std::array<iovec, MAX_BATCH> iovs;
+
+#ifdef SO_TIMESTAMPING
+    // Room for the software, deprecated and hardware timestamps of SCM_TIMESTAMPING
+    union timestamp_cmbuf_t {
+      char buf[CMSG_SPACE(sizeof(struct timespec) * 3)];
+      struct cmsghdr alignment;
+    };
+
+    std::array<timestamp_cmbuf_t, MAX_BATCH> cmbufs;
+#endif
+
+    auto count = std::min(recv_info.count, MAX_BATCH);
+    for (std::size_t x = 0; x < count; ++x) {
+      iovs[x].iov_base = recv_info.buffers + x * recv_info.buffer_size;
+      iovs[x].iov_len = recv_info.buffer_size;
+
+      msgs[x].msg_hdr.msg_name = recv_info.peers[x].data();
+      msgs[x].msg_hdr.msg_namelen = (socklen_t) recv_info.peers[x].capacity();
+      msgs[x].msg_hdr.msg_iov = &iovs[x];
+      msgs[x].msg_hdr.msg_iovlen = 1;
+
+#ifdef SO_TIMESTAMPING
+      if (recv_info.receive_times) {
+        msgs[x].msg_hdr.msg_control = cmbufs[x].buf;
+        msgs[x].msg_hdr.msg_controllen = sizeof(cmbufs[x].buf);
+      }
+#endif
+    }
+
+    auto received = recvmmsg((int) recv_info.native_socket, msgs.data(), count, MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+      // ICMP errors from earlier sends don't mean the socket is broken
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) {
+        return 0;
+      }
+
+      BOOST_LOG(warning) << "recvmmsg() failed: "sv << errno;
+      return -1;
+    }
+
+    for (int x = 0; x < received; ++x) {
+      recv_info.sizes[x] = msgs[x].msg_len;
+      recv_info.peers[x].resize(msgs[x].msg_hdr.msg_namelen);
+    }
+
+    if (recv_info.receive_times) {
+      auto now = std::chrono::steady_clock::now();
+      std::fill_n(recv_info.receive_times, received, now);
+
+#ifdef SO_TIMESTAMPING
+      // Software timestamps are on CLOCK_REALTIME, so they're moved to steady_clock by how long ago they were taken
+      auto realtime_now = std::chrono::system_clock::now();
+      for (int x = 0; x < received; ++x) {
+        for (auto cm = CMSG_FIRSTHDR(&msgs[x].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[x].msg_hdr, cm)) {
+          if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_TIMESTAMPING) {
+            continue;
+          }
+
+          struct timespec ts;
+          memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+          if (!ts.tv_sec && !ts.tv_nsec) {
+            break;
+          }
+
+          auto received_at = std::chrono::system_clock::time_point {std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds {ts.tv_sec} + std::chrono::nanoseconds {ts.tv_nsec})};
+          auto age = std::max(realtime_now - received_at, std::chrono::system_clock::duration::zero());
+          recv_info.receive_times[x] = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+          break;
+        }
+      }
+#endif
+    }
+
+    return received;
+  }
+
+  bool enable_socket_rx_timestamps(std::uintptr_t native_socket) {
+#ifdef SO_TIMESTAMPING
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+      BOOST_LOG(warning) << "Couldn't enable SO_TIMESTAMPING: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  class eventfd_socket_waiter_t: public socket_waiter_t {
+  public:
+    eventfd_socket_waiter_t(int sockfd, int wakefd):
+        sockfd {sockfd},
+        wakefd {wakefd} {
+    }
+
+    ~eventfd_socket_waiter_t() override {
+      close(wakefd);
+    }
+
+    void wait(std::chrono::milliseconds timeout) override {
+      std::array<pollfd, 2> fds {{
+        {sockfd, POLLIN, 0},
+        {wakefd, POLLIN, 0},
+      }};
+
+      if (poll(fds.data(), fds.size(), (int) timeout.count()) > 0 && (fds[1].revents & POLLIN)) {
+        eventfd_t value;
+        eventfd_read(wakefd, &value);
+      }
+    }
+
+    void wake() override {
+      eventfd_write(wakefd, 1);
+    }
+
+  private:
+    int sockfd;
+    int wakefd;
+  };
+
+  std::unique_ptr<socket_waiter_t> make_socket_waiter(std::uintptr_t native_socket) {
+    auto wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd < 0) {
+      BOOST_LOG(error) << "Couldn't create eventfd: "sv << errno;
+      return nullptr;
+    }
+
+    return std::make_unique<eventfd_socket_waiter_t>((int) native_socket, wakefd);
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -890,6 +1992,9 @@ namespace platf {
 #ifdef SUNSHINE_BUILD_DRM
       KMS,  ///< KMS
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+      PORTAL,  ///< ScreenCast portal
+#endif
 #ifdef SUNSHINE_BUILD_X11
       X11,  ///< X11
 #endif
@@ -936,6 +2041,15 @@ namespace platf {
   }
 #endif
 
+#ifdef SUNSHINE_BUILD_PORTAL
+  std::vector<std::string> portal_display_names();
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
+
+  bool verify_portal() {
+    return !portal_display_names().empty();
+  }
+#endif
+
 #ifdef SUNSHINE_BUILD_X11
   std::vector<std::string> x11_display_names();
   std::shared_ptr<display_t> x11_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
@@ -967,6 +2081,11 @@ namespace platf {
       return kms_display_names(hwdevice_type);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      return portal_display_names();
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     if (sources[source::X11]) {
       return x11_display_names();
@@ -984,6 +2103,48 @@ namespace platf {
     return true;
   }
 
+  std::string gpu_fingerprint() {
+    auto read_attribute = [](const fs::path &path) {
+      std::ifstream file {path};
+      std::string value;
+      std::getline(file, value);
+      return value;
+    };
+
+    std::ostringstream fingerprint;
+
+    // GPU drivers that ship with the kernel are versioned with it
+    struct utsname name;
+    if (!uname(&name)) {
+      fingerprint << name.release;
+    }
+
+    std::vector<fs::path> cards;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator {"/sys/class/drm", ec}) {
+      // Skip the connectors of each card, such as card0-DP-1
+      auto filename = entry.path().filename().string();
+      if (filename.starts_with("card") && filename.find('-') == std::string::npos) {
+        cards.emplace_back(entry.path());
+      }
+    }
+    std::sort(std::begin(cards), std::end(cards));
+
+    for (const auto &card : cards) {
+      auto device = card / "device";
+      auto driver = fs::read_symlink(device / "driver", ec).filename().string();
+
+      // Out of tree drivers, like NVIDIA's, report their own version
+      fingerprint << ';' << card.filename().string()
+                  << ':' << read_attribute(device / "vendor")
+                  << ':' << read_attribute(device / "device")
+                  << ':' << driver
+                  << ':' << read_attribute(fs::path {"/sys/module"} / driver / "version");
+    }
+
+    return fingerprint.str();
+  }
+
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
 #ifdef SUNSHINE_BUILD_CUDA
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
@@ -1009,6 +2170,12 @@ namespace platf {
       return kms_display(hwdevice_type, display_name, config);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      BOOST_LOG(info) << "Screencasting with the ScreenCast portal"sv;
+      return portal_display(hwdevice_type, display_name, config);
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     if (sources[source::X11]) {
       BOOST_LOG(info) << "Screencasting with X11"sv;
@@ -1055,6 +2222,7 @@ namespace platf {
       if (verify_evdi_source()) {
         sources[source::EVDI] = true;
         BOOST_LOG(info) << "EVDI virtual display capture is available"sv;
+        evdi_connect_persistent_display();
       }
       else {
         BOOST_LOG(warning) << "EVDI virtual display support was requested but is not available"sv;
@@ -1075,6 +2243,14 @@ namespace platf {
       }
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    // Only picked by default on Wayland, after KMS which doesn't prompt the user
+    if ((config::video.capture.empty() && sources.none() && std::getenv("WAYLAND_DISPLAY")) || config::video.capture == "portal") {
+      if (verify_portal()) {
+        sources[source::PORTAL] = true;
+      }
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     // We enumerate this capture backend regardless of other suitable sources,
     // since it may be needed as a NvFBC fallback for software encoding on X11.
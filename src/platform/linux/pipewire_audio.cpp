@@ -0,0 +1,294 @@
+/**
+ * @file src/platform/linux/pipewire_audio.cpp
+ * @brief Definitions for capturing audio with native PipeWire streams.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <semaphore>
+#include <vector>
+
+// lib includes
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+
+// local includes
+#include "pipewire_audio.h"
+#include "src/logging.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+
+namespace platf::pipewire {
+  namespace {
+    // Same order as position_mapping in audio.cpp
+    constexpr spa_audio_channel position_mapping[] {
+      SPA_AUDIO_CHANNEL_FL,
+      SPA_AUDIO_CHANNEL_FR,
+      SPA_AUDIO_CHANNEL_FC,
+      SPA_AUDIO_CHANNEL_LFE,
+      SPA_AUDIO_CHANNEL_RL,
+      SPA_AUDIO_CHANNEL_RR,
+      SPA_AUDIO_CHANNEL_SL,
+      SPA_AUDIO_CHANNEL_SR,
+    };
+
+    // How long the stream may take to get linked to the sink before falling back to PulseAudio
+    constexpr auto CONNECT_TIMEOUT = 2s;
+
+    // How long sample() waits for data, so the caller can check for shutdown
+    constexpr auto SAMPLE_TIMEOUT = 500ms;
+
+    // The ring buffer holds this much audio, so a late consumer doesn't lose samples
+    constexpr auto RING_DURATION = 200ms;
+
+    using thread_loop_t = util::safe_ptr<pw_thread_loop, pw_thread_loop_destroy>;
+    using stream_t = util::safe_ptr<pw_stream, pw_stream_destroy>;
+
+    class mic_pw_t: public mic_t {
+    public:
+      mic_pw_t(int channels, std::uint32_t sample_rate):
+          _channels {channels} {
+        auto ring_samples = (std::size_t) sample_rate * channels * RING_DURATION.count() / 1000;
+        _ring.resize(std::bit_ceil(ring_samples));
+        _mask = _ring.size() - 1;
+      }
+
+      ~mic_pw_t() override {
+        if (_loop) {
+          pw_thread_loop_stop(_loop.get());
+        }
+
+        // The stream must go before the loop it runs on
+        _stream.reset();
+        _loop.reset();
+      }
+
+      int init(const std::uint8_t *mapping, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &sink_name) {
+        _loop.reset(pw_thread_loop_new("sunshine-audio", nullptr));
+        if (!_loop) {
+          BOOST_LOG(error) << "pw_thread_loop_new() failed"sv;
+          return -1;
+        }
+
+        auto props = pw_properties_new(
+          PW_KEY_MEDIA_TYPE,
+          "Audio",
+          PW_KEY_MEDIA_CATEGORY,
+          "Capture",
+          PW_KEY_MEDIA_ROLE,
+          "Game",
+          PW_KEY_NODE_NAME,
+          "sunshine-record",
+          PW_KEY_STREAM_CAPTURE_SINK,
+          "true",
+          PW_KEY_TARGET_OBJECT,
+          sink_name.c_str(),
+          nullptr
+        );
+
+        // Ask the graph to wake us up once per Opus frame
+        pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%u/%u", frame_size, sample_rate);
+
+        static const pw_stream_events events = []() {
+          pw_stream_events events {};
+          events.version = PW_VERSION_STREAM_EVENTS;
+          events.state_changed = on_state_changed;
+          events.process = on_process;
+          return events;
+        }();
+
+        pw_thread_loop_lock(_loop.get());
+        auto unlock = util::fail_guard([this]() {
+          pw_thread_loop_unlock(_loop.get());
+        });
+
+        _stream.reset(pw_stream_new_simple(pw_thread_loop_get_loop(_loop.get()), "sunshine-record", props, &events, this));
+        if (!_stream) {
+          BOOST_LOG(error) << "pw_stream_new_simple() failed"sv;
+          return -1;
+        }
+
+        spa_audio_info_raw info {};
+        info.format = SPA_AUDIO_FORMAT_F32;
+        info.rate = sample_rate;
+        info.channels = _channels;
+        for (int x = 0; x < _channels; ++x) {
+          info.position[x] = position_mapping[mapping[x]];
+        }
+
+        std::uint8_t buffer[1024];
+        auto builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+        const spa_pod *params[] {spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info)};
+
+        // Running process() on the data thread lets samples through without waking the loop thread
+        auto flags = (pw_stream_flags) (PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS);
+        if (pw_stream_connect(_stream.get(), PW_DIRECTION_INPUT, PW_ID_ANY, flags, params, 1) < 0) {
+          BOOST_LOG(error) << "pw_stream_connect() failed"sv;
+          return -1;
+        }
+
+        if (pw_thread_loop_start(_loop.get()) < 0) {
+          BOOST_LOG(error) << "pw_thread_loop_start() failed"sv;
+          return -1;
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+        while (_state == PW_STREAM_STATE_CONNECTING || _state == PW_STREAM_STATE_PAUSED) {
+          auto remaining = std::chrono::ceil<std::chrono::seconds>(deadline - std::chrono::steady_clock::now());
+          if (remaining <= 0s || pw_thread_loop_timed_wait(_loop.get(), remaining.count()) != 0) {
+            BOOST_LOG(warning) << "Timed out linking the PipeWire stream to ["sv << sink_name << ']';
+            return -1;
+          }
+        }
+
+        if (_state != PW_STREAM_STATE_STREAMING) {
+          BOOST_LOG(warning) << "PipeWire stream failed: "sv << (_error.empty() ? pw_stream_state_as_string(_state) : _error);
+          return -1;
+        }
+
+        BOOST_LOG(info) << "Capturing ["sv << sink_name << "] with PipeWire, quantum "sv << frame_size << '/' << sample_rate;
+
+        return 0;
+      }
+
+      capture_e sample(std::vector<float> &sample_buf) override {
+        auto needed = sample_buf.size();
+
+        auto read = _read.load(std::memory_order_relaxed);
+        while (_write.load(std::memory_order_acquire) - read < needed) {
+          if (_failed.load(std::memory_order_acquire)) {
+            return capture_e::reinit;
+          }
+
+          if (!_data_ready.try_acquire_for(SAMPLE_TIMEOUT)) {
+            return capture_e::timeout;
+          }
+        }
+
+        // The samples wrap around the end of the ring at most once
+        auto offset = read & _mask;
+        auto first = std::min(needed, _ring.size() - offset);
+        std::copy_n(&_ring[offset], first, sample_buf.begin());
+        std::copy_n(_ring.begin(), needed - first, sample_buf.begin() + first);
+        _read.store(read + needed, std::memory_order_release);
+
+        auto captured_at = _captured_at_ns.load(std::memory_order_relaxed);
+        if (captured_at) {
+          capture_latency_logger.collect_and_log([captured_at]() {
+            auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            return (now - captured_at) / 1'000'000.0;
+          });
+        }
+
+        auto overruns = _overruns.exchange(0, std::memory_order_relaxed);
+        if (overruns) {
+          BOOST_LOG(warning) << "Dropped "sv << overruns << " audio samples, because they weren't read in time"sv;
+        }
+
+        return capture_e::ok;
+      }
+
+    private:
+      static void on_state_changed(void *userdata, pw_stream_state, pw_stream_state state, const char *error) {
+        auto self = (mic_pw_t *) userdata;
+
+        self->_state = state;
+        if (error) {
+          self->_error = error;
+        }
+
+        if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+          self->_failed.store(true, std::memory_order_release);
+          self->_data_ready.release();
+        }
+
+        pw_thread_loop_signal(self->_loop.get(), false);
+      }
+
+      /**
+       * @brief Copy the samples of a buffer into the ring buffer, on the data thread.
+       */
+      static void on_process(void *userdata) {
+        auto self = (mic_pw_t *) userdata;
+
+        auto pw_buf = pw_stream_dequeue_buffer(self->_stream.get());
+        if (!pw_buf) {
+          return;
+        }
+
+        auto &data = pw_buf->buffer->datas[0];
+        if (data.data && data.chunk) {
+          auto offset = std::min(data.chunk->offset, data.maxsize);
+          auto size = std::min(data.chunk->size, data.maxsize - offset);
+          self->push((const float *) ((const std::uint8_t *) data.data + offset), size / sizeof(float));
+        }
+
+        pw_time time {};
+        if (pw_stream_get_time_n(self->_stream.get(), &time, sizeof(time)) == 0 && time.now) {
+          // The delay is how long ago the newest sample left the sink
+          auto delay_ns = time.rate.denom ? time.delay * (std::int64_t) SPA_NSEC_PER_SEC * time.rate.num / time.rate.denom : 0;
+          self->_captured_at_ns.store(time.now - delay_ns, std::memory_order_relaxed);
+        }
+
+        pw_stream_queue_buffer(self->_stream.get(), pw_buf);
+
+        self->_data_ready.release();
+      }
+
+      void push(const float *samples, std::size_t count) {
+        auto write = _write.load(std::memory_order_relaxed);
+        auto free = _ring.size() - (write - _read.load(std::memory_order_acquire));
+
+        if (count > free) {
+          _overruns.fetch_add(count - free, std::memory_order_relaxed);
+          count = free;
+        }
+
+        auto offset = write & _mask;
+        auto first = std::min(count, _ring.size() - offset);
+        std::copy_n(samples, first, &_ring[offset]);
+        std::copy_n(samples + first, count - first, _ring.begin());
+        _write.store(write + count, std::memory_order_release);
+      }
+
+      int _channels;
+
+      thread_loop_t _loop;
+      stream_t _stream;
+
+      // Only touched with the loop locked
+      pw_stream_state _state = PW_STREAM_STATE_CONNECTING;
+      std::string _error;
+
+      std::vector<float> _ring;
+      std::size_t _mask;
+      std::atomic<std::size_t> _write {0};
+      std::atomic<std::size_t> _read {0};
+      std::atomic<std::uint64_t> _overruns {0};
+      std::atomic<std::int64_t> _captured_at_ns {0};
+      std::atomic<bool> _failed {false};
+      std::counting_semaphore<> _data_ready {0};
+
+      logging::min_max_avg_periodic_logger<double> capture_latency_logger {debug, "Audio capture latency", "ms"};
+    };
+  }  // namespace
+
+  std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &sink_name) {
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() {
+      pw_init(nullptr, nullptr);
+    });
+
+    auto mic = std::make_unique<mic_pw_t>(channels, sample_rate);
+    if (mic->init(mapping, sample_rate, frame_size, sink_name)) {
+      return nullptr;
+    }
+
+    return mic;
+  }
+}  // namespace platf::pipewire
@@ -0,0 +1,29 @@
+/**
+ * @file src/platform/linux/pipewire_audio.h
+ * @brief Declarations for capturing audio with native PipeWire streams.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace platf::pipewire {
+  /**
+   * @brief Capture the monitor of a sink with a native PipeWire stream.
+   * @details The stream asks the graph for a quantum of `frame_size` samples, so each wakeup delivers
+   *          about one Opus frame. Samples are handed from the PipeWire data thread to `mic_t::sample()`
+   *          through a lock-free ring buffer.
+   * @param mapping The channel mapping of the stream.
+   * @param channels The number of channels.
+   * @param sample_rate The sample rate.
+   * @param frame_size The number of samples per channel in each frame.
+   * @param sink_name The node name of the sink to capture.
+   * @return The microphone, or `nullptr` if PipeWire isn't running or the stream couldn't start.
+   */
+  std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &sink_name);
+}  // namespace platf::pipewire
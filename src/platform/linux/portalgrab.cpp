@@ -0,0 +1,1361 @@
+/**
+ * @file src/platform/linux/portalgrab.cpp
+ * @brief Definitions for capture through the ScreenCast portal and PipeWire.
+ */
+// standard includes
+#include <algorithm>
+#include <condition_variable>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+// lib includes
+#include <drm_fourcc.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <pipewire/pipewire.h>
+#include <spa/buffer/meta.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+
+// local includes
+#include "cuda.h"
+#include "graphics.h"
+#include "src/buffer_pool.h"
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "vaapi.h"
+
+using namespace std::literals;
+
+namespace portal {
+  constexpr auto PORTAL_NAME = "org.freedesktop.portal.Desktop";
+  constexpr auto PORTAL_PATH = "/org/freedesktop/portal/desktop";
+  constexpr auto SCREENCAST_INTERFACE = "org.freedesktop.portal.ScreenCast";
+  constexpr auto REQUEST_INTERFACE = "org.freedesktop.portal.Request";
+  constexpr auto SESSION_INTERFACE = "org.freedesktop.portal.Session";
+
+  // Values of the ScreenCast interface
+  constexpr std::uint32_t SOURCE_TYPE_MONITOR = 1;
+  constexpr std::uint32_t CURSOR_MODE_EMBEDDED = 2;
+  constexpr std::uint32_t CURSOR_MODE_METADATA = 4;
+  constexpr std::uint32_t PERSIST_MODE_PERSISTENT = 2;
+
+  // How long the user gets to pick what to share, the first time the portal asks
+  constexpr auto REQUEST_TIMEOUT = 120s;
+
+  // How long the stream may take to negotiate its format
+  constexpr auto CONNECT_TIMEOUT = 5s;
+
+  // The size of the cursor bitmaps the compositor may send, at most
+  constexpr int MAX_CURSOR_SIZE = 256;
+
+  constexpr std::size_t cursor_meta_size(int width, int height) {
+    return sizeof(spa_meta_cursor) + sizeof(spa_meta_bitmap) + width * height * 4;
+  }
+
+  template<class T>
+  void object_unref(T *object) {
+    g_object_unref(object);
+  }
+
+  using connection_t = util::safe_ptr<GDBusConnection, object_unref<GDBusConnection>>;
+  using fd_list_t = util::safe_ptr<GUnixFDList, object_unref<GUnixFDList>>;
+  using variant_t = util::safe_ptr<GVariant, g_variant_unref>;
+  using error_t = util::safe_ptr<GError, g_error_free>;
+  using main_context_t = util::safe_ptr<GMainContext, g_main_context_unref>;
+
+  using thread_loop_t = util::safe_ptr<pw_thread_loop, pw_thread_loop_destroy>;
+  using pw_context_t = util::safe_ptr<pw_context, pw_context_destroy>;
+  using pw_stream_t = util::safe_ptr<pw_stream, pw_stream_destroy>;
+
+  std::filesystem::path restore_token_path() {
+    return platf::appdata() / "portal_restore_token";
+  }
+
+  std::string load_restore_token() {
+    std::ifstream file {restore_token_path()};
+
+    std::string token;
+    std::getline(file, token);
+    return token;
+  }
+
+  void save_restore_token(const std::string &token) {
+    std::ofstream file {restore_token_path(), std::ios::trunc};
+    file << token;
+    if (!file) {
+      BOOST_LOG(warning) << "Couldn't save the ScreenCast portal restore token, the next session will ask again"sv;
+    }
+  }
+
+  /**
+   * @brief Get a property of the ScreenCast interface.
+   * @return The value, or `nullptr` if the portal doesn't have it.
+   */
+  variant_t screencast_property(GDBusConnection *connection, const char *name) {
+    GError *error_p = nullptr;
+    variant_t reply {g_dbus_connection_call_sync(
+      connection,
+      PORTAL_NAME,
+      PORTAL_PATH,
+      "org.freedesktop.DBus.Properties",
+      "Get",
+      g_variant_new("(ss)", SCREENCAST_INTERFACE, name),
+      G_VARIANT_TYPE("(v)"),
+      G_DBUS_CALL_FLAGS_NONE,
+      -1,
+      nullptr,
+      &error_p
+    )};
+    error_t error {error_p};
+    if (!reply) {
+      BOOST_LOG(debug) << "Couldn't get the ScreenCast portal property "sv << name << ": "sv << error->message;
+      return nullptr;
+    }
+
+    GVariant *value;
+    g_variant_get(reply.get(), "(v)", &value);
+    return variant_t {value};
+  }
+
+  /**
+   * @brief A ScreenCast portal session sharing a single monitor.
+   * @details The monitor the user picked is remembered by the restore token the portal hands out,
+   *          which is saved in the config directory so later sessions don't ask again.
+   */
+  class session_t {
+  public:
+    ~session_t() {
+      if (!handle.empty()) {
+        g_dbus_connection_call_sync(connection.get(), PORTAL_NAME, handle.c_str(), SESSION_INTERFACE, "Close", nullptr, nullptr, G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+      }
+    }
+
+    int init() {
+      GError *error_p = nullptr;
+      connection.reset(g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error_p));
+      error_t error {error_p};
+      if (!connection) {
+        BOOST_LOG(error) << "Couldn't connect to the session bus: "sv << error->message;
+        return -1;
+      }
+
+      // The responses to the requests are dispatched on a context of our own, while waiting for them
+      context.reset(g_main_context_new());
+      g_main_context_push_thread_default(context.get());
+      auto pop_context = util::fail_guard([this]() {
+        g_main_context_pop_thread_default(context.get());
+      });
+
+      std::uint32_t version = 0;
+      if (auto value = screencast_property(connection.get(), "version")) {
+        version = g_variant_get_uint32(value.get());
+      }
+
+      std::uint32_t cursor_modes = 0;
+      if (auto value = screencast_property(connection.get(), "AvailableCursorModes")) {
+        cursor_modes = g_variant_get_uint32(value.get());
+      }
+      cursor_metadata = cursor_modes & CURSOR_MODE_METADATA;
+
+      GVariantBuilder options;
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add(&options, "{sv}", "session_handle_token", g_variant_new_string(next_token().c_str()));
+
+      auto token = next_token();
+      g_variant_builder_add(&options, "{sv}", "handle_token", g_variant_new_string(token.c_str()));
+      auto results = request("CreateSession", g_variant_new("(a{sv})", &options), token);
+      if (!results) {
+        return -1;
+      }
+
+      const char *session_handle;
+      if (!g_variant_lookup(results.get(), "session_handle", "&s", &session_handle)) {
+        BOOST_LOG(error) << "The ScreenCast portal didn't create a session"sv;
+        return -1;
+      }
+      handle = session_handle;
+
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+      token = next_token();
+      g_variant_builder_add(&options, "{sv}", "handle_token", g_variant_new_string(token.c_str()));
+      g_variant_builder_add(&options, "{sv}", "types", g_variant_new_uint32(SOURCE_TYPE_MONITOR));
+      g_variant_builder_add(&options, "{sv}", "multiple", g_variant_new_boolean(false));
+      g_variant_builder_add(&options, "{sv}", "cursor_mode", g_variant_new_uint32(cursor_metadata ? CURSOR_MODE_METADATA : CURSOR_MODE_EMBEDDED));
+
+      // Restoring needs version 4 of the interface
+      if (version >= 4) {
+        g_variant_builder_add(&options, "{sv}", "persist_mode", g_variant_new_uint32(PERSIST_MODE_PERSISTENT));
+
+        auto restore_token = load_restore_token();
+        if (!restore_token.empty()) {
+          g_variant_builder_add(&options, "{sv}", "restore_token", g_variant_new_string(restore_token.c_str()));
+        }
+      }
+
+      if (!request("SelectSources", g_variant_new("(oa{sv})", handle.c_str(), &options), token)) {
+        return -1;
+      }
+
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+      token = next_token();
+      g_variant_builder_add(&options, "{sv}", "handle_token", g_variant_new_string(token.c_str()));
+      results = request("Start", g_variant_new("(osa{sv})", handle.c_str(), "", &options), token);
+      if (!results) {
+        return -1;
+      }
+
+      const char *restore_token;
+      if (g_variant_lookup(results.get(), "restore_token", "&s", &restore_token)) {
+        save_restore_token(restore_token);
+      }
+
+      GVariant *streams_p;
+      if (!g_variant_lookup(results.get(), "streams", "@a(ua{sv})", &streams_p)) {
+        BOOST_LOG(error) << "The ScreenCast portal didn't share any stream"sv;
+        return -1;
+      }
+      variant_t streams {streams_p};
+
+      if (g_variant_n_children(streams.get()) == 0) {
+        BOOST_LOG(error) << "The ScreenCast portal didn't share any stream"sv;
+        return -1;
+      }
+
+      GVariant *properties_p;
+      g_variant_get_child(streams.get(), 0, "(u@a{sv})", &node_id, &properties_p);
+      variant_t properties {properties_p};
+
+      if (!g_variant_lookup(properties.get(), "size", "(ii)", &width, &height)) {
+        width = 0;
+        height = 0;
+      }
+
+      BOOST_LOG(info) << "The ScreenCast portal shares PipeWire node "sv << node_id << (cursor_metadata ? " with the cursor as metadata"sv : " with the cursor embedded"sv);
+
+      return 0;
+    }
+
+    /**
+     * @brief Open the PipeWire remote the shared streams can be connected to.
+     */
+    file_t open_remote() {
+      GVariantBuilder options;
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+
+      GUnixFDList *fd_list_p = nullptr;
+      GError *error_p = nullptr;
+      variant_t reply {g_dbus_connection_call_with_unix_fd_list_sync(
+        connection.get(),
+        PORTAL_NAME,
+        PORTAL_PATH,
+        SCREENCAST_INTERFACE,
+        "OpenPipeWireRemote",
+        g_variant_new("(oa{sv})", handle.c_str(), &options),
+        G_VARIANT_TYPE("(h)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        nullptr,
+        &fd_list_p,
+        nullptr,
+        &error_p
+      )};
+      fd_list_t fd_list {fd_list_p};
+      error_t error {error_p};
+      if (!reply) {
+        BOOST_LOG(error) << "Couldn't open the PipeWire remote of the ScreenCast portal: "sv << error->message;
+        return {};
+      }
+
+      gint32 index;
+      g_variant_get(reply.get(), "(h)", &index);
+
+      GError *fd_error_p = nullptr;
+      file_t fd {g_unix_fd_list_get(fd_list.get(), index, &fd_error_p)};
+      error_t fd_error {fd_error_p};
+      if (fd.el < 0) {
+        BOOST_LOG(error) << "Couldn't get the PipeWire remote of the ScreenCast portal: "sv << fd_error->message;
+      }
+
+      return fd;
+    }
+
+    connection_t connection;
+    std::string handle;
+
+    std::uint32_t node_id;
+    int width;
+    int height;
+    bool cursor_metadata;
+
+  private:
+    std::string next_token() {
+      return "sunshine"s + std::to_string(++token_counter);
+    }
+
+    /**
+     * @brief Call a method of the ScreenCast interface, and wait for the response of the request it makes.
+     * @param method The method.
+     * @param parameters The parameters of the method, with the handle token among its options.
+     * @param token The handle token.
+     * @return The results of the request, or `nullptr` if it failed or the user dismissed it.
+     */
+    variant_t request(const char *method, GVariant *parameters, const std::string &token) {
+      // The path of the request is known up front, so its response can't be missed
+      std::string sender = g_dbus_connection_get_unique_name(connection.get()) + 1;
+      std::replace(std::begin(sender), std::end(sender), '.', '_');
+      auto path = "/org/freedesktop/portal/desktop/request/"s + sender + '/' + token;
+
+      struct response_t {
+        bool done = false;
+        std::uint32_t code = 2;
+        variant_t results;
+      } response;
+
+      auto subscription = g_dbus_connection_signal_subscribe(
+        connection.get(),
+        PORTAL_NAME,
+        REQUEST_INTERFACE,
+        "Response",
+        path.c_str(),
+        nullptr,
+        G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+        [](GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *, GVariant *parameters, gpointer user_data) {
+          auto response = (response_t *) user_data;
+
+          GVariant *results;
+          g_variant_get(parameters, "(u@a{sv})", &response->code, &results);
+          response->results.reset(results);
+          response->done = true;
+        },
+        &response,
+        nullptr
+      );
+      auto unsubscribe = util::fail_guard([&]() {
+        g_dbus_connection_signal_unsubscribe(connection.get(), subscription);
+      });
+
+      GError *error_p = nullptr;
+      variant_t reply {g_dbus_connection_call_sync(connection.get(), PORTAL_NAME, PORTAL_PATH, SCREENCAST_INTERFACE, method, parameters, G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, &error_p)};
+      error_t error {error_p};
+      if (!reply) {
+        BOOST_LOG(error) << "ScreenCast portal "sv << method << " failed: "sv << error->message;
+        return nullptr;
+      }
+
+      bool timed_out = false;
+      auto timeout = g_timeout_source_new_seconds(REQUEST_TIMEOUT.count());
+      g_source_set_callback(
+        timeout,
+        [](gpointer user_data) -> gboolean {
+          *(bool *) user_data = true;
+          return G_SOURCE_REMOVE;
+        },
+        &timed_out,
+        nullptr
+      );
+      g_source_attach(timeout, context.get());
+
+      while (!response.done && !timed_out) {
+        g_main_context_iteration(context.get(), true);
+      }
+
+      g_source_destroy(timeout);
+      g_source_unref(timeout);
+
+      if (!response.done) {
+        BOOST_LOG(error) << "Timed out waiting for the ScreenCast portal to answer "sv << method;
+        return nullptr;
+      }
+
+      if (response.code != 0) {
+        BOOST_LOG(error) << "ScreenCast portal "sv << method << (response.code == 1 ? " was cancelled"sv : " failed"sv);
+        return nullptr;
+      }
+
+      return std::move(response.results);
+    }
+
+    main_context_t context;
+    int token_counter = 0;
+  };
+
+  static std::mutex session_lock;
+  static std::shared_ptr<session_t> current_session;
+
+  /**
+   * @brief Get the portal session, starting it if there isn't one.
+   * @details The session outlives the displays, so reinitializing the capture
+   *          and probing the encoders don't start new sessions.
+   */
+  std::shared_ptr<session_t> get_session() {
+    std::lock_guard lg {session_lock};
+    if (!current_session) {
+      auto session = std::make_shared<session_t>();
+      if (session->init()) {
+        return nullptr;
+      }
+
+      current_session = std::move(session);
+    }
+
+    return current_session;
+  }
+
+  /**
+   * @brief Forget a session once its stream stopped, so the next display starts a new one.
+   */
+  void drop_session(const std::shared_ptr<session_t> &session) {
+    std::lock_guard lg {session_lock};
+    if (current_session == session) {
+      current_session.reset();
+    }
+  }
+
+  constexpr std::uint32_t to_drm_format(spa_video_format format) {
+    switch (format) {
+      case SPA_VIDEO_FORMAT_BGRx:
+        return DRM_FORMAT_XRGB8888;
+      case SPA_VIDEO_FORMAT_BGRA:
+        return DRM_FORMAT_ARGB8888;
+      case SPA_VIDEO_FORMAT_RGBx:
+        return DRM_FORMAT_XBGR8888;
+      case SPA_VIDEO_FORMAT_RGBA:
+        return DRM_FORMAT_ABGR8888;
+      default:
+        return DRM_FORMAT_INVALID;
+    }
+  }
+
+  constexpr bool is_rgb_order(spa_video_format format) {
+    return format == SPA_VIDEO_FORMAT_RGBx || format == SPA_VIDEO_FORMAT_RGBA;
+  }
+
+  // Sorted in order of descending preference, all of them can be imported as RGB textures
+  constexpr spa_video_format formats[] {
+    SPA_VIDEO_FORMAT_BGRx,
+    SPA_VIDEO_FORMAT_BGRA,
+    SPA_VIDEO_FORMAT_RGBx,
+    SPA_VIDEO_FORMAT_RGBA,
+  };
+
+  /**
+   * @brief Get the modifiers EGL can import a DMA-BUF of the given format with, as a 2D texture.
+   * @return The modifiers, ending with the implicit one, or none if DMA-BUFs can't be imported.
+   */
+  std::vector<std::uint64_t> dmabuf_modifiers(egl::display_t::pointer display, std::uint32_t fourcc) {
+    using query_t = EGLBoolean (*)(EGLDisplay, EGLint, EGLint, EGLuint64KHR *, EGLBoolean *, EGLint *);
+    static auto query = (query_t) eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+    if (!query) {
+      return {};
+    }
+
+    EGLint count = 0;
+    if (!query(display, fourcc, 0, nullptr, nullptr, &count) || count < 0) {
+      return {};
+    }
+
+    std::vector<EGLuint64KHR> modifiers(count);
+    std::vector<EGLBoolean> external_only(count);
+    if (count > 0 && !query(display, fourcc, count, modifiers.data(), external_only.data(), &count)) {
+      return {};
+    }
+
+    // Modifiers that are only supported for external textures can't be sampled by the conversion
+    std::vector<std::uint64_t> result;
+    for (EGLint x = 0; x < count; ++x) {
+      if (!external_only[x]) {
+        result.emplace_back(modifiers[x]);
+      }
+    }
+    result.emplace_back(DRM_FORMAT_MOD_INVALID);
+
+    return result;
+  }
+
+  /**
+   * @brief A PipeWire video stream of the portal, holding on to the newest buffer with an image.
+   * @details DMA-BUFs are negotiated with the modifiers EGL can import, so the buffers of the compositor
+   *          are converted without being copied. Shared memory buffers are only used if that fails.
+   *          Buffers that only move the cursor don't replace the image, and the damage the compositor
+   *          reports tells when a new buffer didn't change anything.
+   */
+  class stream_t {
+  public:
+    ~stream_t() {
+      if (_loop) {
+        pw_thread_loop_stop(_loop.get());
+      }
+
+      // The buffers go back to the stream, which must go before the loop it runs on
+      _held = nullptr;
+      _stream.reset();
+      if (_core) {
+        pw_core_disconnect(_core);
+      }
+      _context.reset();
+      _loop.reset();
+    }
+
+    int init(file_t &&remote, std::uint32_t node_id, int width, int height, int framerate, egl::display_t::pointer egl_display, bool allow_shm) {
+      _loop.reset(pw_thread_loop_new("sunshine-video", nullptr));
+      if (!_loop) {
+        BOOST_LOG(error) << "pw_thread_loop_new() failed"sv;
+        return -1;
+      }
+
+      pw_thread_loop_lock(_loop.get());
+      auto unlock = util::fail_guard([this]() {
+        pw_thread_loop_unlock(_loop.get());
+      });
+
+      _context.reset(pw_context_new(pw_thread_loop_get_loop(_loop.get()), nullptr, 0));
+      if (!_context) {
+        BOOST_LOG(error) << "pw_context_new() failed"sv;
+        return -1;
+      }
+
+      // The core takes the file descriptor
+      _core = pw_context_connect_fd(_context.get(), remote.release(), nullptr, 0);
+      if (!_core) {
+        BOOST_LOG(error) << "Couldn't connect to the PipeWire remote of the ScreenCast portal"sv;
+        return -1;
+      }
+
+      static const pw_stream_events events = []() {
+        pw_stream_events events {};
+        events.version = PW_VERSION_STREAM_EVENTS;
+        events.state_changed = on_state_changed;
+        events.param_changed = on_param_changed;
+        events.process = on_process;
+        events.remove_buffer = on_remove_buffer;
+        return events;
+      }();
+
+      auto props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Video", PW_KEY_MEDIA_CATEGORY, "Capture", PW_KEY_MEDIA_ROLE, "Screen", nullptr);
+      _stream.reset(pw_stream_new(_core, "sunshine-video", props));
+      if (!_stream) {
+        BOOST_LOG(error) << "pw_stream_new() failed"sv;
+        return -1;
+      }
+      pw_stream_add_listener(_stream.get(), &_stream_listener, &events, this);
+
+      std::vector<std::uint8_t> buffer(16384);
+      auto builder = SPA_POD_BUILDER_INIT(buffer.data(), (std::uint32_t) buffer.size());
+
+      // Formats with modifiers come first, so DMA-BUFs are preferred over shared memory
+      std::vector<const spa_pod *> params;
+      for (auto format : formats) {
+        auto modifiers = dmabuf_modifiers(egl_display, to_drm_format(format));
+        if (!modifiers.empty()) {
+          params.emplace_back(build_format(&builder, format, modifiers, width, height, framerate));
+        }
+      }
+
+      if (allow_shm) {
+        for (auto format : formats) {
+          params.emplace_back(build_format(&builder, format, {}, width, height, framerate));
+        }
+      } else if (params.empty()) {
+        BOOST_LOG(error) << "EGL can't import DMA-BUFs, the ScreenCast stream can't be encoded from video memory"sv;
+        return -1;
+      }
+
+      auto flags = (pw_stream_flags) (PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS);
+      if (pw_stream_connect(_stream.get(), PW_DIRECTION_INPUT, node_id, flags, params.data(), params.size()) < 0) {
+        BOOST_LOG(error) << "pw_stream_connect() failed"sv;
+        return -1;
+      }
+
+      if (pw_thread_loop_start(_loop.get()) < 0) {
+        BOOST_LOG(error) << "pw_thread_loop_start() failed"sv;
+        return -1;
+      }
+
+      // The size of the frames is only known once the format is negotiated
+      auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+      while (!_format && _state != PW_STREAM_STATE_ERROR && _state != PW_STREAM_STATE_UNCONNECTED) {
+        auto remaining = std::chrono::ceil<std::chrono::seconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining <= 0s || pw_thread_loop_timed_wait(_loop.get(), remaining.count()) != 0) {
+          BOOST_LOG(error) << "Timed out negotiating the format of the ScreenCast stream"sv;
+          return -1;
+        }
+      }
+
+      if (!_format) {
+        BOOST_LOG(error) << "ScreenCast stream failed: "sv << (_error.empty() ? pw_stream_state_as_string(_state) : _error);
+        return -1;
+      }
+
+      return 0;
+    }
+
+    /**
+     * @brief Wait for a new image, or for the cursor to change if it's drawn.
+     * @param lock The lock of the stream, held while the newest buffer is read.
+     * @return `ok` on a change, `timeout` if nothing changed in time, or `reinit` once the stream stopped.
+     */
+    platf::capture_e wait(std::unique_lock<std::mutex> &lock, std::chrono::milliseconds timeout, bool cursor) {
+      lock = std::unique_lock {_lock};
+
+      auto changed = _ready.wait_for(lock, timeout, [&]() {
+        return _failed || _image_sequence != _taken_image_sequence || (cursor && _cursor_sequence != _taken_cursor_sequence);
+      });
+      if (_failed) {
+        return platf::capture_e::reinit;
+      }
+      if (!changed || !_held) {
+        return platf::capture_e::timeout;
+      }
+
+      _taken_image_sequence = _image_sequence;
+      _taken_cursor_sequence = _cursor_sequence;
+
+      return platf::capture_e::ok;
+    }
+
+    std::mutex &mutex() {
+      return _lock;
+    }
+
+    struct cursor_t {
+      bool visible = false;
+      int x, y;
+      int width, height;
+
+      // Premultiplied BGRA
+      std::vector<std::uint8_t> pixels;
+      unsigned long serial = 0;
+    };
+
+    // These are only read with the lock held
+    std::optional<spa_video_info_raw> _format;
+    bool _dmabuf = false;
+    pw_buffer *_held = nullptr;
+    std::chrono::steady_clock::time_point _held_presented;
+    cursor_t _cursor;
+
+  private:
+    static const spa_pod *build_format(spa_pod_builder *builder, spa_video_format format, const std::vector<std::uint64_t> &modifiers, int width, int height, int framerate) {
+      auto default_size = SPA_RECTANGLE((std::uint32_t) std::max(width, 1), (std::uint32_t) std::max(height, 1));
+      auto min_size = SPA_RECTANGLE(1, 1);
+      auto max_size = SPA_RECTANGLE(16384, 16384);
+      auto default_framerate = SPA_FRACTION((std::uint32_t) framerate, 1);
+      auto min_framerate = SPA_FRACTION(0, 1);
+      auto max_framerate = SPA_FRACTION(1000, 1);
+
+      spa_pod_frame frames[2];
+      spa_pod_builder_push_object(builder, &frames[0], SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+      spa_pod_builder_add(builder, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_format, SPA_POD_Id(format), 0);
+
+      // The compositor picks the modifier it allocates its buffers with
+      if (!modifiers.empty()) {
+        spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+        spa_pod_builder_push_choice(builder, &frames[1], SPA_CHOICE_Enum, 0);
+        spa_pod_builder_long(builder, modifiers[0]);
+        for (auto modifier : modifiers) {
+          spa_pod_builder_long(builder, modifier);
+        }
+        spa_pod_builder_pop(builder, &frames[1]);
+      }
+
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(&default_size, &min_size, &max_size), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_framerate, SPA_POD_CHOICE_RANGE_Fraction(&default_framerate, &min_framerate, &max_framerate), 0);
+
+      return (const spa_pod *) spa_pod_builder_pop(builder, &frames[0]);
+    }
+
+    static void on_state_changed(void *userdata, pw_stream_state, pw_stream_state state, const char *error) {
+      auto self = (stream_t *) userdata;
+
+      self->_state = state;
+      if (error) {
+        self->_error = error;
+      }
+
+      if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+        {
+          std::lock_guard lg {self->_lock};
+          self->_failed = true;
+        }
+        self->_ready.notify_all();
+      }
+
+      pw_thread_loop_signal(self->_loop.get(), false);
+    }
+
+    static void on_param_changed(void *userdata, std::uint32_t id, const spa_pod *param) {
+      auto self = (stream_t *) userdata;
+      if (!param || id != SPA_PARAM_Format) {
+        return;
+      }
+
+      std::uint32_t media_type;
+      std::uint32_t media_subtype;
+      if (spa_format_parse(param, &media_type, &media_subtype) < 0 || media_type != SPA_MEDIA_TYPE_video || media_subtype != SPA_MEDIA_SUBTYPE_raw) {
+        return;
+      }
+
+      spa_video_info_raw info {};
+      if (spa_format_video_raw_parse(param, &info) < 0) {
+        return;
+      }
+
+      bool dmabuf = spa_pod_find_prop(param, nullptr, SPA_FORMAT_VIDEO_modifier) != nullptr;
+      BOOST_LOG(info) << "ScreenCast stream format: "sv << info.size.width << 'x' << info.size.height << (dmabuf ? " in DMA-BUFs"sv : " in shared memory"sv);
+
+      {
+        std::lock_guard lg {self->_lock};
+        self->_format = info;
+        self->_dmabuf = dmabuf;
+      }
+
+      std::uint8_t buffer[1024];
+      auto builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+      std::int32_t data_type = dmabuf ? 1 << SPA_DATA_DmaBuf : (1 << SPA_DATA_MemPtr) | (1 << SPA_DATA_MemFd);
+      const spa_pod *params[] {
+        (const spa_pod *) spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers, SPA_PARAM_BUFFERS_dataType, SPA_POD_Int(data_type)),
+        (const spa_pod *) spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta, SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header), SPA_PARAM_META_size, SPA_POD_Int(sizeof(spa_meta_header))),
+        (const spa_pod *) spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta, SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage), SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(sizeof(spa_meta_region) * 16, sizeof(spa_meta_region), sizeof(spa_meta_region) * 16)),
+        (const spa_pod *) spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta, SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Cursor), SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(cursor_meta_size(64, 64), cursor_meta_size(1, 1), cursor_meta_size(MAX_CURSOR_SIZE, MAX_CURSOR_SIZE))),
+      };
+      pw_stream_update_params(self->_stream.get(), params, std::size(params));
+
+      pw_thread_loop_signal(self->_loop.get(), false);
+    }
+
+    /**
+     * @brief Get when the compositor presented the image of a buffer.
+     * @details Compositors timestamp buffers on the monotonic clock, like the steady clock. Buffers
+     *          without a usable timestamp are taken as presented when they were dequeued.
+     */
+    static std::chrono::steady_clock::time_point presentation_time(spa_buffer *buffer) {
+      auto now = std::chrono::steady_clock::now();
+
+      auto header = (spa_meta_header *) spa_buffer_find_meta_data(buffer, SPA_META_Header, sizeof(spa_meta_header));
+      if (!header || header->pts <= 0) {
+        return now;
+      }
+
+      // A timestamp in the future, or from long ago, is on another clock
+      std::chrono::steady_clock::time_point presented {std::chrono::nanoseconds {header->pts}};
+      if (presented > now || now - presented > 1s) {
+        return now;
+      }
+
+      return presented;
+    }
+
+    /**
+     * @brief Check if a buffer holds an image that's different from the last one.
+     */
+    static bool has_new_image(spa_buffer *buffer) {
+      auto &data = buffer->datas[0];
+      if (!data.chunk || data.chunk->size == 0 || (data.chunk->flags & SPA_CHUNK_FLAG_CORRUPTED)) {
+        return false;
+      }
+
+      // Without damage, the compositor only sent the buffer for the cursor
+      auto damage = spa_buffer_find_meta(buffer, SPA_META_VideoDamage);
+      if (!damage) {
+        return true;
+      }
+
+      spa_meta_region *region;
+      spa_meta_for_each(region, damage) {
+        if (!spa_meta_region_is_valid(region)) {
+          break;
+        }
+
+        return true;
+      }
+
+      return false;
+    }
+
+    /**
+     * @brief Take the cursor metadata of a buffer, with the lock held.
+     * @return `true` if the cursor changed.
+     */
+    bool update_cursor(spa_buffer *buffer) {
+      auto cursor = (spa_meta_cursor *) spa_buffer_find_meta_data(buffer, SPA_META_Cursor, sizeof(spa_meta_cursor));
+      if (!cursor) {
+        return false;
+      }
+
+      if (!spa_meta_cursor_is_valid(cursor)) {
+        auto changed = _cursor.visible;
+        _cursor.visible = false;
+        return changed;
+      }
+
+      if (cursor->bitmap_offset >= sizeof(spa_meta_cursor)) {
+        auto bitmap = SPA_PTROFF(cursor, cursor->bitmap_offset, spa_meta_bitmap);
+        auto format = (spa_video_format) bitmap->format;
+
+        if (bitmap->size.width > 0 && bitmap->size.height > 0 && to_drm_format(format) != DRM_FORMAT_INVALID) {
+          _cursor.width = bitmap->size.width;
+          _cursor.height = bitmap->size.height;
+          _cursor.pixels.resize(_cursor.width * _cursor.height * 4);
+
+          auto swap = is_rgb_order(format);
+          auto has_alpha = format == SPA_VIDEO_FORMAT_BGRA || format == SPA_VIDEO_FORMAT_RGBA;
+          auto pixels = SPA_PTROFF(bitmap, bitmap->offset, const std::uint8_t);
+          for (int y = 0; y < _cursor.height; ++y) {
+            auto in = pixels + y * bitmap->stride;
+            auto out = &_cursor.pixels[y * _cursor.width * 4];
+            for (int x = 0; x < _cursor.width; ++x, in += 4, out += 4) {
+              std::uint32_t alpha = has_alpha ? in[3] : 255;
+              out[0] = (in[swap ? 2 : 0] * alpha + 127) / 255;
+              out[1] = (in[1] * alpha + 127) / 255;
+              out[2] = (in[swap ? 0 : 2] * alpha + 127) / 255;
+              out[3] = alpha;
+            }
+          }
+
+          ++_cursor.serial;
+        }
+      }
+
+      _cursor.visible = !_cursor.pixels.empty();
+      _cursor.x = cursor->position.x - cursor->hotspot.x;
+      _cursor.y = cursor->position.y - cursor->hotspot.y;
+
+      return true;
+    }
+
+    static void on_remove_buffer(void *userdata, pw_buffer *pw_buf) {
+      auto self = (stream_t *) userdata;
+
+      std::lock_guard lg {self->_lock};
+      if (self->_held == pw_buf) {
+        self->_held = nullptr;
+      }
+    }
+
+    static void on_process(void *userdata) {
+      auto self = (stream_t *) userdata;
+      auto stream = self->_stream.get();
+
+      bool changed = false;
+      {
+        std::lock_guard lg {self->_lock};
+
+        // Only the newest image is kept, the others go back to the compositor right away
+        while (auto pw_buf = pw_stream_dequeue_buffer(stream)) {
+          if (self->update_cursor(pw_buf->buffer)) {
+            ++self->_cursor_sequence;
+            changed = true;
+          }
+
+          if (!has_new_image(pw_buf->buffer)) {
+            pw_stream_queue_buffer(stream, pw_buf);
+            continue;
+          }
+
+          if (self->_held) {
+            pw_stream_queue_buffer(stream, self->_held);
+          }
+          self->_held = pw_buf;
+          self->_held_presented = presentation_time(pw_buf->buffer);
+          ++self->_image_sequence;
+          changed = true;
+        }
+      }
+
+      if (changed) {
+        self->_ready.notify_all();
+      }
+    }
+
+    thread_loop_t _loop;
+    pw_context_t _context;
+    pw_core *_core = nullptr;
+    pw_stream_t _stream;
+    spa_hook _stream_listener {};
+
+    // Only touched with the loop locked
+    pw_stream_state _state = PW_STREAM_STATE_CONNECTING;
+    std::string _error;
+
+    std::mutex _lock;
+    std::condition_variable _ready;
+    bool _failed = false;
+    std::uint64_t _image_sequence = 0;
+    std::uint64_t _cursor_sequence = 0;
+    std::uint64_t _taken_image_sequence = 0;
+    std::uint64_t _taken_cursor_sequence = 0;
+  };
+
+  struct img_t: public platf::img_t {
+    ~img_t() override {
+      buffer_pool::free_image(data);
+      data = nullptr;
+    }
+  };
+
+  class portal_t: public platf::display_t {
+  public:
+    /**
+     * @param allow_shm Fall back to shared memory buffers when DMA-BUFs can't be negotiated.
+     */
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config, bool allow_shm) {
+      delay = std::chrono::nanoseconds {1s} / config.framerate;
+      mem_type = hwdevice_type;
+
+      if (!gbm::create_device) {
+        BOOST_LOG(warning) << "libgbm not initialized"sv;
+        return -1;
+      }
+
+      // The modifiers are those of the render device the frames are imported on
+      auto render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name.c_str();
+      render_fd.el = open(render_device, O_RDWR);
+      if (render_fd.el < 0) {
+        BOOST_LOG(error) << "Couldn't open render device: "sv << render_device;
+        return -1;
+      }
+
+      gbm.reset(gbm::create_device(render_fd.el));
+      if (!gbm) {
+        BOOST_LOG(error) << "Couldn't create GBM device: ["sv << util::hex(eglGetError()).to_string_view() << ']';
+        return -1;
+      }
+
+      egl_display = egl::make_display(gbm.get());
+      if (!egl_display) {
+        return -1;
+      }
+
+      session = get_session();
+      if (!session) {
+        return -1;
+      }
+
+      auto remote = session->open_remote();
+      if (remote.el < 0 || stream.init(std::move(remote), session->node_id, session->width, session->height, config.framerate, egl_display.get(), allow_shm)) {
+        drop_session(session);
+        return -1;
+      }
+
+      {
+        std::lock_guard lg {stream.mutex()};
+        width = stream._format->size.width;
+        height = stream._format->size.height;
+      }
+      env_width = width;
+      env_height = height;
+
+      BOOST_LOG(info) << "Capturing with the ScreenCast portal"sv;
+      BOOST_LOG(debug) << "Resolution: "sv << width << 'x' << height;
+
+      return 0;
+    }
+
+    /**
+     * @brief Wait for the next image of the stream.
+     * @param lock The lock of the stream, held on success while the newest buffer is read.
+     */
+    platf::capture_e next_buffer(std::unique_lock<std::mutex> &lock, std::chrono::milliseconds timeout, bool cursor) {
+      auto status = stream.wait(lock, timeout, cursor && session->cursor_metadata);
+      if (status == platf::capture_e::reinit) {
+        drop_session(session);
+        return status;
+      }
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      if ((int) stream._format->size.width != width || (int) stream._format->size.height != height) {
+        return platf::capture_e::reinit;
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    /**
+     * @brief Describe the held DMA-BUF, with the file descriptors of the buffer.
+     */
+    void describe_dmabuf(egl::surface_descriptor_t &sd) {
+      auto buffer = stream._held->buffer;
+
+      sd.width = width;
+      sd.height = height;
+      sd.fourcc = to_drm_format(stream._format->format);
+      sd.modifier = stream._format->modifier;
+      std::fill_n(sd.fds, 4, -1);
+      for (std::uint32_t x = 0; x < std::min<std::uint32_t>(buffer->n_datas, 4); ++x) {
+        sd.fds[x] = buffer->datas[x].fd;
+        sd.pitches[x] = buffer->datas[x].chunk->stride;
+        sd.offsets[x] = buffer->datas[x].chunk->offset;
+      }
+    }
+
+    std::optional<util::point_t> cursor_position() const {
+      if (!session->cursor_metadata || !stream._cursor.visible) {
+        return std::nullopt;
+      }
+
+      return util::point_t {(double) stream._cursor.x, (double) stream._cursor.y};
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        switch (status) {
+          case platf::capture_e::reinit:
+          case platf::capture_e::error:
+          case platf::capture_e::interrupted:
+            return status;
+          case platf::capture_e::timeout:
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          case platf::capture_e::ok:
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          default:
+            BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+            return status;
+        }
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    virtual platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) = 0;
+
+    platf::mem_type_e mem_type;
+    std::chrono::nanoseconds delay;
+
+    file_t render_fd;
+    gbm::gbm_t gbm;
+    egl::display_t egl_display;
+
+    std::shared_ptr<session_t> session;
+    stream_t stream;
+  };
+  class portal_ram_t: public portal_t {
+  public:
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+      if (portal_t::init(hwdevice_type, display_name, config, true)) {
+        return -1;
+      }
+
+      auto ctx_opt = egl::make_ctx(egl_display.get());
+      if (!ctx_opt) {
+        return -1;
+      }
+
+      ctx = std::move(*ctx_opt);
+
+      return 0;
+    }
+
+    /**
+     * @brief Copy shared memory frames into the image, as BGRA.
+     */
+    void copy_shm(platf::img_t &img) {
+      auto &data = stream._held->buffer->datas[0];
+      auto swap = is_rgb_order(stream._format->format);
+
+      auto offset = std::min(data.chunk->offset, data.maxsize);
+      auto stride = data.chunk->stride ? data.chunk->stride : width * 4;
+      auto rows = std::min<std::size_t>(height, (data.maxsize - offset) / stride);
+      auto pixels = (const std::uint8_t *) data.data + offset;
+
+      for (std::size_t y = 0; y < rows; ++y) {
+        auto in = pixels + y * stride;
+        auto out = img.data + y * img.row_pitch;
+
+        if (!swap) {
+          std::copy_n(in, width * 4, out);
+          continue;
+        }
+
+        for (int x = 0; x < width; ++x, in += 4, out += 4) {
+          out[0] = in[2];
+          out[1] = in[1];
+          out[2] = in[0];
+          out[3] = in[3];
+        }
+      }
+    }
+
+    /**
+     * @brief Blend the premultiplied cursor into the image.
+     */
+    void blend_cursor(platf::img_t &img) {
+      auto &cursor = stream._cursor;
+
+      auto begin_x = std::max(0, -cursor.x);
+      auto begin_y = std::max(0, -cursor.y);
+      auto end_x = std::min(cursor.width, width - cursor.x);
+      auto end_y = std::min(cursor.height, height - cursor.y);
+
+      for (auto y = begin_y; y < end_y; ++y) {
+        auto in = &cursor.pixels[(y * cursor.width + begin_x) * 4];
+        auto out = img.data + (cursor.y + y) * img.row_pitch + (cursor.x + begin_x) * 4;
+
+        for (auto x = begin_x; x < end_x; ++x, in += 4, out += 4) {
+          std::uint32_t alpha = in[3];
+          out[0] = in[0] + (out[0] * (255 - alpha) + 255 / 2) / 255;
+          out[1] = in[1] + (out[1] * (255 - alpha) + 255 / 2) / 255;
+          out[2] = in[2] + (out[2] * (255 - alpha) + 255 / 2) / 255;
+        }
+      }
+    }
+
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) override {
+      std::unique_lock<std::mutex> lock;
+      auto status = next_buffer(lock, timeout, cursor);
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      // The buffer goes back to the compositor once the lock is released, so it's imported or copied first
+      egl::rgb_t *rgb = nullptr;
+      if (stream._dmabuf) {
+        egl::surface_descriptor_t sd;
+        describe_dmabuf(sd);
+
+        rgb = imports.import(egl_display.get(), sd);
+        if (!rgb) {
+          return platf::capture_e::reinit;
+        }
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+
+      if (rgb) {
+        gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      } else {
+        copy_shm(*img_out);
+      }
+
+      img_out->frame_timestamp = stream._held_presented;
+      img_out->cursor = cursor_position();
+      if (cursor && img_out->cursor) {
+        blend_cursor(*img_out);
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    bool img_in_system_memory() override {
+      return true;
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = buffer_pool::alloc_image(height * img->row_pitch);
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      return 0;
+    }
+
+    egl::ctx_t ctx;
+    egl::import_cache_t imports;
+  };
+
+  class portal_vram_t: public portal_t {
+  public:
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+      return portal_t::init(hwdevice_type, display_name, config, false);
+    }
+
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) override {
+      std::unique_lock<std::mutex> lock;
+      auto status = next_buffer(lock, timeout, cursor);
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+      auto img = (egl::img_descriptor_t *) img_out.get();
+      img->reset();
+
+      ++sequence;
+      img->sequence = sequence;
+      img->frame_timestamp = stream._held_presented;
+
+      // The buffer goes back to the compositor, so the image gets its own file descriptors
+      describe_dmabuf(img->sd);
+      for (auto &fd : img->sd.fds) {
+        if (fd >= 0) {
+          fd = dup(fd);
+        }
+      }
+
+      img->cursor = cursor_position();
+      if (cursor && img->cursor) {
+        auto &captured_cursor = stream._cursor;
+
+        // Copy new cursor pixel data if it's been updated
+        if (img->serial != captured_cursor.serial) {
+          img->buffer = captured_cursor.pixels;
+          img->serial = captured_cursor.serial;
+        }
+
+        img->x = captured_cursor.x;
+        img->y = captured_cursor.y;
+        img->src_w = captured_cursor.width;
+        img->src_h = captured_cursor.height;
+        img->width = captured_cursor.width;
+        img->height = captured_cursor.height;
+        img->pixel_pitch = 4;
+        img->row_pitch = img->pixel_pitch * img->width;
+        img->data = img->buffer.data();
+      } else {
+        img->data = nullptr;
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<egl::img_descriptor_t>();
+
+      img->width = width;
+      img->height = height;
+      img->sequence = 0;
+      img->serial = std::numeric_limits<decltype(img->serial)>::max();
+      img->data = nullptr;
+
+      // File descriptors aren't open
+      std::fill_n(img->sd.fds, 4, -1);
+
+      return img;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, dup(render_fd.el), 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      // Empty images are recognized as dummies by the zero sequence number
+      return 0;
+    }
+
+    std::uint64_t sequence {};
+  };
+}  // namespace portal
+
+namespace platf {
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::cuda) {
+      BOOST_LOG(error) << "Could not initialize display with the given hw device type."sv;
+      return nullptr;
+    }
+
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() {
+      pw_init(nullptr, nullptr);
+    });
+
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::cuda) {
+      auto portal = std::make_shared<portal::portal_vram_t>();
+      if (portal->init(hwdevice_type, display_name, config)) {
+        return nullptr;
+      }
+
+      return portal;
+    }
+
+    auto portal = std::make_shared<portal::portal_ram_t>();
+    if (portal->init(hwdevice_type, display_name, config)) {
+      return nullptr;
+    }
+
+    return portal;
+  }
+
+  std::vector<std::string> portal_display_names() {
+    GError *error_p = nullptr;
+    portal::connection_t connection {g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error_p)};
+    portal::error_t error {error_p};
+    if (!connection) {
+      BOOST_LOG(warning) << "Couldn't connect to the session bus: "sv << error->message;
+      return {};
+    }
+
+    // Which monitor is shared is only known once the user picked it, so the portal is a single display
+    auto source_types = portal::screencast_property(connection.get(), "AvailableSourceTypes");
+    if (!source_types || !(g_variant_get_uint32(source_types.get()) & portal::SOURCE_TYPE_MONITOR)) {
+      BOOST_LOG(warning) << "The ScreenCast portal can't share monitors"sv;
+      return {};
+    }
+
+    return {"portal"s};
+  }
+}  // namespace platf
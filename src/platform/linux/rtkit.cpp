@@ -0,0 +1,118 @@
+/**
+ * @file src/platform/linux/rtkit.cpp
+ * @brief Definitions for getting real-time scheduling from rtkit.
+ */
+// lib includes
+#include <gio/gio.h>
+
+// local includes
+#include "rtkit.h"
+#include "src/logging.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+
+namespace platf::rtkit {
+  namespace {
+    constexpr auto RTKIT_NAME = "org.freedesktop.RealtimeKit1";
+    constexpr auto RTKIT_PATH = "/org/freedesktop/RealtimeKit1";
+    constexpr auto RTKIT_INTERFACE = "org.freedesktop.RealtimeKit1";
+
+    void connection_unref(GDBusConnection *connection) {
+      g_object_unref(connection);
+    }
+
+    using connection_t = util::safe_ptr<GDBusConnection, connection_unref>;
+    using variant_t = util::safe_ptr<GVariant, g_variant_unref>;
+    using error_t = util::safe_ptr<GError, g_error_free>;
+
+    /**
+     * @brief Get the system bus, shared by every caller.
+     * @return The connection, or nullptr if there's no system bus.
+     */
+    GDBusConnection *system_bus() {
+      static connection_t connection = []() {
+        GError *error_p = nullptr;
+        connection_t connection {g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &error_p)};
+        error_t error {error_p};
+        if (!connection) {
+          BOOST_LOG(debug) << "Couldn't connect to the system bus: "sv << error->message;
+        }
+
+        return connection;
+      }();
+
+      return connection.get();
+    }
+
+    variant_t property(GDBusConnection *connection, const char *name) {
+      GError *error_p = nullptr;
+      variant_t reply {g_dbus_connection_call_sync(
+        connection,
+        RTKIT_NAME,
+        RTKIT_PATH,
+        "org.freedesktop.DBus.Properties",
+        "Get",
+        g_variant_new("(ss)", RTKIT_INTERFACE, name),
+        G_VARIANT_TYPE("(v)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        nullptr,
+        &error_p
+      )};
+      error_t error {error_p};
+      if (!reply) {
+        BOOST_LOG(debug) << "Couldn't get the rtkit property "sv << name << ": "sv << error->message;
+        return nullptr;
+      }
+
+      GVariant *value;
+      g_variant_get(reply.get(), "(v)", &value);
+      return variant_t {value};
+    }
+  }  // namespace
+
+  std::optional<limits_t> limits() {
+    auto connection = system_bus();
+    if (!connection) {
+      return std::nullopt;
+    }
+
+    auto max_priority = property(connection, "MaxRealtimePriority");
+    auto max_rttime = property(connection, "RTTimeUSecMax");
+    if (!max_priority || !max_rttime || !g_variant_is_of_type(max_priority.get(), G_VARIANT_TYPE_INT32) || !g_variant_is_of_type(max_rttime.get(), G_VARIANT_TYPE_INT64)) {
+      return std::nullopt;
+    }
+
+    return limits_t {g_variant_get_int32(max_priority.get()), g_variant_get_int64(max_rttime.get())};
+  }
+
+  bool make_thread_realtime(pid_t tid, int priority) {
+    auto connection = system_bus();
+    if (!connection) {
+      return false;
+    }
+
+    GError *error_p = nullptr;
+    variant_t reply {g_dbus_connection_call_sync(
+      connection,
+      RTKIT_NAME,
+      RTKIT_PATH,
+      RTKIT_INTERFACE,
+      "MakeThreadRealtime",
+      g_variant_new("(tu)", (guint64) tid, (guint32) priority),
+      nullptr,
+      G_DBUS_CALL_FLAGS_NONE,
+      -1,
+      nullptr,
+      &error_p
+    )};
+    error_t error {error_p};
+    if (!reply) {
+      BOOST_LOG(warning) << "rtkit refused real-time scheduling: "sv << error->message;
+      return false;
+    }
+
+    return true;
+  }
+}  // namespace platf::rtkit
@@ -0,0 +1,37 @@
+/**
+ * @file src/platform/linux/rtkit.h
+ * @brief Declarations for getting real-time scheduling from rtkit.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <optional>
+
+// platform includes
+#include <sys/types.h>
+
+namespace platf::rtkit {
+  /**
+   * @brief The limits rtkit grants real-time threads within.
+   */
+  struct limits_t {
+    int max_priority;  ///< The highest real-time priority rtkit grants
+    std::int64_t max_rttime_usec;  ///< The highest RLIMIT_RTTIME rtkit accepts, in microseconds
+  };
+
+  /**
+   * @brief Get the limits of rtkit.
+   * @return The limits, or std::nullopt if rtkit isn't running.
+   */
+  std::optional<limits_t> limits();
+
+  /**
+   * @brief Ask rtkit to run a thread of this process with the SCHED_RR policy.
+   * @details rtkit refuses processes without an RLIMIT_RTTIME up to `limits_t::max_rttime_usec`.
+   * @param tid The id of the thread.
+   * @param priority The real-time priority, up to `limits_t::max_priority`.
+   * @return true on success.
+   */
+  bool make_thread_realtime(pid_t tid, int priority);
+}  // namespace platf::rtkit
@@ -0,0 +1,201 @@
+/**
+ * @file src/platform/linux/uring_send.cpp
+ * @brief Definitions for the io_uring UDP send backend.
+ */
+// standard includes
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+
+// platform includes
+#include <liburing.h>
+#include <poll.h>
+
+// local includes
+#include "src/config.h"
+#include "src/logging.h"
+#include "uring_send.h"
+
+using namespace std::literals;
+
+namespace platf::uring {
+  namespace {
+    // Zero-copy sends complete twice, so the completion queue (twice the size of the
+    // submission queue by default) has room for every completion of a full submission.
+    constexpr unsigned QUEUE_DEPTH = 64;
+
+    class ring_t {
+    public:
+      ring_t() {
+        // Keep submitting after a bad message, so every message of a submission completes
+        auto status = io_uring_queue_init(QUEUE_DEPTH, &_ring, IORING_SETUP_SUBMIT_ALL);
+        if (status == -EINVAL) {
+          status = io_uring_queue_init(QUEUE_DEPTH, &_ring, 0);
+        }
+        if (status < 0) {
+          BOOST_LOG(warning) << "io_uring_queue_init() failed: "sv << -status << ", falling back to sendmsg()"sv;
+          return;
+        }
+        _initialized = true;
+
+        if (auto probe = io_uring_get_probe_ring(&_ring)) {
+          _sendmsg = io_uring_opcode_supported(probe, IORING_OP_SENDMSG);
+          _zero_copy = io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC);
+          io_uring_free_probe(probe);
+        }
+
+        if (!_sendmsg) {
+          BOOST_LOG(warning) << "io_uring doesn't support IORING_OP_SENDMSG, falling back to sendmsg()"sv;
+        } else {
+          BOOST_LOG(info) << "Sending with io_uring"sv << (_zero_copy ? " (zero-copy)"sv : ""sv);
+        }
+      }
+
+      ~ring_t() {
+        if (_initialized) {
+          io_uring_queue_exit(&_ring);
+        }
+      }
+
+      ring_t(const ring_t &) = delete;
+      ring_t &operator=(const ring_t &) = delete;
+
+      bool usable() const {
+        return _initialized && _sendmsg;
+      }
+
+      status_e send(int sockfd, std::span<struct msghdr> msgs) {
+        std::vector<std::size_t> pending(msgs.size());
+        for (std::size_t x = 0; x < pending.size(); ++x) {
+          pending[x] = x;
+        }
+
+        std::size_t sent = 0;
+        bool failed = false;
+        while (!pending.empty()) {
+          std::vector<std::size_t> retry;
+          bool would_block = false;
+
+          for (std::size_t first = 0; first < pending.size(); first += QUEUE_DEPTH) {
+            auto count = std::min<std::size_t>(pending.size() - first, QUEUE_DEPTH);
+
+            // The ring is drained after every chunk, so there's always room for a full chunk
+            for (std::size_t x = 0; x < count; ++x) {
+              auto index = pending[first + x];
+              auto sqe = io_uring_get_sqe(&_ring);
+              if (_zero_copy) {
+                io_uring_prep_sendmsg_zc(sqe, sockfd, &msgs[index], 0);
+              } else {
+                io_uring_prep_sendmsg(sqe, sockfd, &msgs[index], 0);
+              }
+              io_uring_sqe_set_data64(sqe, index);
+            }
+
+            if (auto status = io_uring_submit_and_wait(&_ring, 1); status < 0 || (std::size_t) status < count) {
+              // The rings are in an unknown state, so don't touch them again
+              BOOST_LOG(warning) << "io_uring_submit_and_wait() failed: "sv << (status < 0 ? -status : 0);
+              shutdown();
+
+              return sent ? status_e::error : status_e::unsupported;
+            }
+
+            // Wait for the results of every send, and for the kernel to release the buffers of zero-copy sends
+            auto outstanding = count;
+            while (outstanding) {
+              struct io_uring_cqe *cqe;
+              if (auto status = io_uring_wait_cqe(&_ring, &cqe); status < 0) {
+                if (status == -EINTR) {
+                  continue;
+                }
+
+                BOOST_LOG(warning) << "io_uring_wait_cqe() failed: "sv << -status;
+                shutdown();
+
+                return status_e::error;
+              }
+
+              auto index = (std::size_t) io_uring_cqe_get_data64(cqe);
+              auto flags = cqe->flags;
+              auto result = cqe->res;
+              io_uring_cqe_seen(&_ring, cqe);
+
+              if (flags & IORING_CQE_F_NOTIF) {
+                --outstanding;
+                continue;
+              }
+
+              // Successful zero-copy sends are followed by a notification once the buffers are released
+              if (!(flags & IORING_CQE_F_MORE)) {
+                --outstanding;
+              }
+
+              if (result >= 0) {
+                ++sent;
+              } else if (result == -EAGAIN) {
+                would_block = true;
+                retry.push_back(index);
+              } else if (_zero_copy && (result == -EOPNOTSUPP || result == -EINVAL)) {
+                // Not every socket supports zero-copy, but regular sends will work
+                BOOST_LOG(info) << "Zero-copy sends aren't supported on this socket, falling back to regular io_uring sends"sv;
+                _zero_copy = false;
+                retry.push_back(index);
+              } else {
+                BOOST_LOG(verbose) << "io_uring sendmsg() failed: "sv << -result;
+                failed = true;
+              }
+            }
+          }
+
+          if (would_block) {
+            // Wait for send buffer space, like the blocking send paths do
+            struct pollfd pfd;
+
+            pfd.fd = sockfd;
+            pfd.events = POLLOUT;
+
+            if (poll(&pfd, 1, -1) != 1) {
+              BOOST_LOG(warning) << "poll() failed: "sv << errno;
+              return status_e::error;
+            }
+          }
+
+          std::sort(std::begin(retry), std::end(retry));
+          pending = std::move(retry);
+        }
+
+        // If nothing went out, let the caller try the regular send path instead
+        if (failed) {
+          return sent ? status_e::error : status_e::unsupported;
+        }
+
+        return status_e::ok;
+      }
+
+    private:
+      void shutdown() {
+        io_uring_queue_exit(&_ring);
+        _initialized = false;
+      }
+
+      struct io_uring _ring;
+      bool _initialized = false;
+      bool _sendmsg = false;
+      bool _zero_copy = false;
+    };
+  }  // namespace
+
+  status_e sendmsg_batch(int sockfd, std::span<struct msghdr> msgs) {
+    if (!config::stream.io_uring_send) {
+      return status_e::unsupported;
+    }
+
+    // Rings are cheap to keep, but not thread-safe, so each sending thread owns one
+    thread_local ring_t ring;
+    if (!ring.usable()) {
+      return status_e::unsupported;
+    }
+
+    return ring.send(sockfd, msgs);
+  }
+}  // namespace platf::uring
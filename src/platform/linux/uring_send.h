@@ -0,0 +1,31 @@
+/**
+ * @file src/platform/linux/uring_send.h
+ * @brief Declarations for the io_uring UDP send backend.
+ */
+#pragma once
+
+// standard includes
+#include <span>
+
+// platform includes
+#include <sys/socket.h>
+
+namespace platf::uring {
+  enum class status_e : int {
+    ok,  ///< All messages were sent
+    error,  ///< At least one message wasn't sent
+    unsupported,  ///< Nothing was sent, because io_uring can't be used on this thread
+  };
+
+  /**
+   * @brief Send a batch of messages with a single io_uring submission.
+   * @details Each thread lazily sets up its own ring the first time this is called. Messages are sent
+   *          with zero-copy `IORING_OP_SENDMSG_ZC` when the kernel supports it, else with `IORING_OP_SENDMSG`.
+   *          This waits for the kernel to release every buffer before returning, so the caller may
+   *          reuse or free them as soon as it returns.
+   * @param sockfd The socket to send on.
+   * @param msgs The messages to send.
+   * @return The status of the send. On `status_e::unsupported`, the caller should send the messages itself.
+   */
+  status_e sendmsg_batch(int sockfd, std::span<struct msghdr> msgs);
+}  // namespace platf::uring
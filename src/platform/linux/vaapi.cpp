@@ -5,11 +5,14 @@
 // standard includes
 #include <fcntl.h>
 #include <format>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/pixdesc.h>
 #include <va/va.h>
 #include <va/va_drm.h>
@@ -31,6 +34,7 @@ extern "C" {
 #include "misc.h"
 #include "src/config.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -132,6 +136,22 @@ namespace va {
       return 0;
     }
 
+    /**
+     * @brief Determines if an entrypoint supports CBR or VBR rate control.
+     * @param profile The profile of the entrypoint.
+     * @param entrypoint The entrypoint.
+     * @return Boolean value indicating if bitrate control is supported.
+     */
+    bool supports_bitrate_control(VAProfile profile, VAEntrypoint entrypoint) {
+      VAConfigAttrib rc_attr = {VAConfigAttribRateControl};
+      auto status = vaGetConfigAttributes(va_display, profile, entrypoint, &rc_attr, 1);
+      if (status != VA_STATUS_SUCCESS || rc_attr.value == VA_ATTRIB_NOT_SUPPORTED) {
+        return false;
+      }
+
+      return rc_attr.value & (VA_RC_CBR | VA_RC_VBR);
+    }
+
     /**
      * @brief Finds a supported VA entrypoint for the given VA profile.
      * @param profile The profile to match.
@@ -154,9 +174,20 @@ namespace va {
         VAEntrypointEncPicture
       };
       for (auto ep_pref : ep_preferences) {
-        if (std::find(entrypoints.begin(), entrypoints.end(), ep_pref) != entrypoints.end()) {
-          return ep_pref;
+        if (std::find(entrypoints.begin(), entrypoints.end(), ep_pref) == entrypoints.end()) {
+          continue;
+        }
+
+        // The low power entrypoint has a much lower latency, but some drivers expose it
+        // without bitrate control, which would make the encoder fall back to CQP
+        if (ep_pref == VAEntrypointEncSliceLP && !supports_bitrate_control(profile, ep_pref) &&
+            std::find(entrypoints.begin(), entrypoints.end(), VAEntrypointEncSlice) != entrypoints.end() &&
+            supports_bitrate_control(profile, VAEntrypointEncSlice)) {
+          BOOST_LOG(info) << "Skipping LP encoding mode without CBR or VBR support"sv;
+          continue;
         }
+
+        return ep_pref;
       }
 
       return (VAEntrypoint) 0;
@@ -291,20 +322,19 @@ namespace va {
       }
     }
 
-    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
-      this->hwframe.reset(frame);
-      this->frame = frame;
-
-      if (!frame->buf[0]) {
-        if (av_hwframe_get_buffer(hw_frames_ctx_buf, frame, 0)) {
-          BOOST_LOG(error) << "Couldn't get hwframe for VAAPI"sv;
-          return -1;
-        }
-      }
+    void init_hwframes(AVHWFramesContext *frames) override {
+      // The pool only creates its surfaces once the ring takes them, this bounds it to the largest ring
+      frames->initial_pool_size = SURFACE_RING_SIZE;
+    }
 
+    /**
+     * @brief Import a VA surface as an EGL render target.
+     * @param frame The frame of the surface.
+     * @return The render target, or std::nullopt on failure.
+     */
+    std::optional<egl::nv12_t> import_surface(AVFrame *frame) {
       va::DRMPRIMESurfaceDescriptor prime;
       va::VASurfaceID surface = (std::uintptr_t) frame->data[3];
-      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
 
       auto status = vaExportSurfaceHandle(
         this->va_display,
@@ -316,7 +346,7 @@ namespace va {
       if (status) {
         BOOST_LOG(error) << "Couldn't export va surface handle: ["sv << (int) surface << "]: "sv << vaErrorStr(status);
 
-        return -1;
+        return std::nullopt;
       }
 
       // Keep track of file descriptors
@@ -327,7 +357,7 @@ namespace va {
 
       if (prime.num_layers != 2) {
         BOOST_LOG(error) << "Invalid layer count for VA surface: expected 2, got "sv << prime.num_layers;
-        return -1;
+        return std::nullopt;
       }
 
       egl::surface_descriptor_t sds[2] = {};
@@ -352,22 +382,116 @@ namespace va {
         }
       }
 
-      auto nv12_opt = egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
+      return egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
+    }
+
+    /**
+     * @brief Add a surface to the ring, with the properties of the current frame.
+     * @param index Where to add the surface in the ring.
+     * @param target_frame The frame of the surface, or an empty frame to get a new surface from the pool.
+     * @return 0 on success, -1 on failure.
+     */
+    int add_target(std::size_t index, frame_t &&target_frame) {
+      if (!target_frame->buf[0]) {
+        if (av_frame_copy_props(target_frame.get(), frame) < 0) {
+          BOOST_LOG(error) << "Couldn't copy frame properties for VAAPI"sv;
+          return -1;
+        }
+
+        if (av_hwframe_get_buffer(hw_frames_ctx.get(), target_frame.get(), 0)) {
+          BOOST_LOG(error) << "Couldn't get hwframe for VAAPI"sv;
+          return -1;
+        }
+      }
+
+      auto nv12_opt = import_surface(target_frame.get());
       if (!nv12_opt) {
         return -1;
       }
 
-      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, hw_frames_ctx->sw_format);
+      auto frames_ctx = (AVHWFramesContext *) hw_frames_ctx->data;
+      metrics::gpu_allocation_t memory {metrics::gpu_memory_t::encode, av_image_get_buffer_size(frames_ctx->sw_format, frames_ctx->width, frames_ctx->height, 1)};
+
+      targets.emplace(std::begin(targets) + index, target_t {std::move(target_frame), std::move(*nv12_opt), std::move(memory)});
+
+      return 0;
+    }
+
+    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
+      targets.clear();
+      next_target_index = 0;
+
+      hw_frames_ctx.reset(av_buffer_ref(hw_frames_ctx_buf));
+      if (!hw_frames_ctx) {
+        return -1;
+      }
+
+      // The frame given by the encoder is the first surface of the ring, the others share its properties.
+      // The ring starts small and only grows while the encoder still reads the surface it's about to reuse.
+      this->frame = frame;
+      if (add_target(0, frame_t {frame})) {
+        return -1;
+      }
+      for (std::size_t x = 1; x < INITIAL_RING_SIZE; ++x) {
+        if (add_target(x, frame_t {av_frame_alloc()})) {
+          return -1;
+        }
+      }
+
+      auto frames_ctx = (AVHWFramesContext *) hw_frames_ctx->data;
+      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, frames_ctx->sw_format, config::video.vaapi.compute_convert);
       if (!sws_opt) {
         return -1;
       }
 
       this->sws = std::move(*sws_opt);
-      this->nv12 = std::move(*nv12_opt);
 
       return 0;
     }
 
+    /**
+     * @brief Move on to the next surface of the ring, once the encoder is done reading it.
+     * @details The conversion then never renders into a surface that the encoder may be reading.
+     *          The time spent waiting on the encoder is logged.
+     * @return The render target of the surface.
+     */
+    egl::nv12_t &next_target() {
+      auto previous = frame;
+
+      // Rather than wait on the encoder, add a surface in front of the one it's still reading
+      if (targets.size() < SURFACE_RING_SIZE) {
+        VASurfaceStatus surface_status;
+        auto status = vaQuerySurfaceStatus(va_display, (std::uintptr_t) targets[next_target_index].frame->data[3], &surface_status);
+        if (status == VA_STATUS_SUCCESS && surface_status == VASurfaceRendering) {
+          if (add_target(next_target_index, frame_t {av_frame_alloc()})) {
+            BOOST_LOG(warning) << "Couldn't grow the VAAPI surface ring"sv;
+          } else {
+            BOOST_LOG(debug) << "Grew the VAAPI surface ring to "sv << targets.size() << " surfaces"sv;
+          }
+        }
+      }
+
+      auto &target = targets[next_target_index];
+      next_target_index = (next_target_index + 1) % targets.size();
+
+      frame = target.frame.get();
+
+      // Keyframe requests are made on the current frame, before the next image is converted
+      if (frame != previous) {
+        frame->pict_type = previous->pict_type;
+        frame->flags = (frame->flags & ~AV_FRAME_FLAG_KEY) | (previous->flags & AV_FRAME_FLAG_KEY);
+      }
+
+      sync_wait_logger.first_point_now();
+      auto status = vaSyncSurface(va_display, (std::uintptr_t) frame->data[3]);
+      sync_wait_logger.second_point_now_and_log();
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't sync va surface: "sv << vaErrorStr(status);
+      }
+
+      return target.nv12;
+    }
+
     void apply_colorspace() override {
       sws.apply_colorspace(colorspace);
     }
@@ -379,12 +503,31 @@ namespace va {
     egl::display_t display;
     egl::ctx_t ctx;
 
+    /**
+     * @brief The number of surfaces the images are converted into in turn, at most.
+     */
+    static constexpr std::size_t SURFACE_RING_SIZE = 3;
+
+    /**
+     * @brief The number of surfaces the ring starts with.
+     */
+    static constexpr std::size_t INITIAL_RING_SIZE = 2;
+
+    struct target_t {
+      frame_t frame;
+      egl::nv12_t nv12;
+      metrics::gpu_allocation_t memory;
+    };
+
     // This must be destroyed before display_t to ensure the GPU
     // driver is still loaded when vaDestroySurfaces() is called.
-    frame_t hwframe;
+    std::vector<target_t> targets;
+    std::size_t next_target_index = 0;
+    ::video::avcodec_buffer_t hw_frames_ctx;
 
     egl::sws_t sws;
-    egl::nv12_t nv12;
+
+    logging::time_delta_percentile_logger sync_wait_logger {debug, "VAAPI: surface sync wait"};
 
     int width, height;
   };
@@ -394,7 +537,7 @@ namespace va {
     int convert(platf::img_t &img) override {
       sws.load_ram(img);
 
-      sws.convert(nv12->buf);
+      sws.convert(next_target());
       return 0;
     }
   };
@@ -407,23 +550,19 @@ namespace va {
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
         rgb = egl::create_blank(img);
+        source = &rgb;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        source = imports.import(display.get(), descriptor.sd);
+        if (!source) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*source)->tex[0]);
 
-      sws.convert(nv12->buf);
+      sws.convert(next_target());
       return 0;
     }
 
@@ -443,6 +582,10 @@ namespace va {
     std::uint64_t sequence;
     egl::rgb_t rgb;
 
+    // Captured buffers are imported once, the image of the last one keeps being converted until the next capture
+    egl::import_cache_t imports;
+    egl::rgb_t *source = nullptr;
+
     int offset_x, offset_y;
   };
 
@@ -3,7 +3,11 @@
  * @brief Definitions for Wayland capture.
  */
 // standard includes
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
 
 // platform includes
 #include <drm_fourcc.h>
@@ -211,6 +215,16 @@ namespace wl {
       dmabuf_interface = (zwp_linux_dmabuf_v1 *) wl_registry_bind(registry, id, &zwp_linux_dmabuf_v1_interface, version);
 
       this->interface[LINUX_DMABUF] = true;
+    } else if (!std::strcmp(interface, ext_image_copy_capture_manager_v1_interface.name)) {
+      BOOST_LOG(info) << "Found interface: "sv << interface << '(' << id << ") version "sv << version;
+      image_copy_manager = (ext_image_copy_capture_manager_v1 *) wl_registry_bind(registry, id, &ext_image_copy_capture_manager_v1_interface, 1);
+
+      this->interface[EXT_IMAGE_COPY_CAPTURE] = true;
+    } else if (!std::strcmp(interface, ext_output_image_capture_source_manager_v1_interface.name)) {
+      BOOST_LOG(info) << "Found interface: "sv << interface << '(' << id << ") version "sv << version;
+      output_source_manager = (ext_output_image_capture_source_manager_v1 *) wl_registry_bind(registry, id, &ext_output_image_capture_source_manager_v1_interface, 1);
+
+      this->interface[EXT_OUTPUT_IMAGE_CAPTURE_SOURCE] = true;
     }
   }
 
@@ -218,22 +232,31 @@ namespace wl {
     BOOST_LOG(info) << "Delete: "sv << id;
   }
 
-  // Initialize GBM
-  bool dmabuf_t::init_gbm() {
-    if (gbm_device) {
-      return true;
-    }
-
+  /**
+   * @brief Create a GBM device on a render node.
+   * @param dev The device the render node must belong to, or `nullptr` for the first render node.
+   * @return The GBM device, which owns the file descriptor of the render node, or `nullptr` on failure.
+   */
+  static gbm_device *create_gbm_device(const dev_t *dev) {
     // Find render node
     drmDevice *devices[16];
     int n = drmGetDevices2(0, devices, 16);
     if (n <= 0) {
       BOOST_LOG(error) << "No DRM devices found"sv;
-      return false;
+      return nullptr;
+    }
+
+    drmDevicePtr wanted = nullptr;
+    if (dev && drmGetDeviceFromDevId(*dev, 0, &wanted)) {
+      wanted = nullptr;
     }
 
     int drm_fd = -1;
     for (int i = 0; i < n; i++) {
+      if (wanted && !drmDevicesEqual(devices[i], wanted)) {
+        continue;
+      }
+
       if (devices[i]->available_nodes & (1 << DRM_NODE_RENDER)) {
         drm_fd = open(devices[i]->nodes[DRM_NODE_RENDER], O_RDWR);
         if (drm_fd >= 0) {
@@ -242,20 +265,33 @@ namespace wl {
       }
     }
     drmFreeDevices(devices, n);
+    if (wanted) {
+      drmFreeDevice(&wanted);
+    }
 
     if (drm_fd < 0) {
       BOOST_LOG(error) << "Failed to open DRM render node"sv;
-      return false;
+      return nullptr;
     }
 
-    gbm_device = gbm_create_device(drm_fd);
-    if (!gbm_device) {
+    auto device = gbm_create_device(drm_fd);
+    if (!device) {
       close(drm_fd);
       BOOST_LOG(error) << "Failed to create GBM device"sv;
-      return false;
+      return nullptr;
     }
 
-    return true;
+    return device;
+  }
+
+  // Initialize GBM
+  bool dmabuf_t::init_gbm() {
+    if (gbm_device) {
+      return true;
+    }
+
+    gbm_device = create_gbm_device(nullptr);
+    return gbm_device != nullptr;
   }
 
   // Cleanup GBM
@@ -518,6 +554,322 @@ namespace wl {
     std::uint32_t height
   ) {};
 
+  image_copy_t::image_copy_t():
+      status {REINIT},
+      session_listener {
+        &CLASS_CALL(image_copy_t, buffer_size),
+        &CLASS_CALL(image_copy_t, shm_format),
+        &CLASS_CALL(image_copy_t, dmabuf_device),
+        &CLASS_CALL(image_copy_t, dmabuf_format),
+        &CLASS_CALL(image_copy_t, done),
+        &CLASS_CALL(image_copy_t, stopped),
+      },
+      frame_listener {
+        &CLASS_CALL(image_copy_t, transform),
+        &CLASS_CALL(image_copy_t, damage),
+        &CLASS_CALL(image_copy_t, presentation_time),
+        &CLASS_CALL(image_copy_t, ready),
+        &CLASS_CALL(image_copy_t, failed),
+      } {
+    for (auto &buffer : buffers) {
+      std::fill_n(buffer.sd.fds, 4, -1);
+    }
+  }
+
+  image_copy_t::~image_copy_t() {
+    destroy_session();
+    destroy_buffers();
+
+    if (gbm_device) {
+      // We should close the DRM FD, but it's owned by GBM
+      gbm_device_destroy(gbm_device);
+      gbm_device = nullptr;
+    }
+  }
+
+  void image_copy_t::listen(
+    ext_output_image_capture_source_manager_v1 *source_manager,
+    ext_image_copy_capture_manager_v1 *copy_manager,
+    zwp_linux_dmabuf_v1 *dmabuf_interface,
+    wl_output *output,
+    bool blend_cursor
+  ) {
+    destroy_session();
+    destroy_buffers();
+
+    this->dmabuf_interface = dmabuf_interface;
+    this->blend_cursor = blend_cursor;
+    constraints.modifiers.clear();
+    constraints.format = 0;
+
+    source = ext_output_image_capture_source_manager_v1_create_source(source_manager, output);
+    session = ext_image_copy_capture_manager_v1_create_session(
+      copy_manager,
+      source,
+      blend_cursor ? EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS : 0
+    );
+    ext_image_copy_capture_session_v1_add_listener(session, &session_listener, this);
+
+    // Frames can only be captured once the session announced its buffer constraints
+    status = WAITING;
+  }
+
+  void image_copy_t::capture() {
+    if (frame || status == REINIT || !buffers[0].wl_buffer) {
+      return;
+    }
+
+    // Capture into the least recently captured buffer, the others may still be read from
+    auto &buffer = buffers[next_buffer];
+    next_buffer = (next_buffer + 1) % buffers.size();
+
+    frame = ext_image_copy_capture_session_v1_create_frame(session);
+    ext_image_copy_capture_frame_v1_add_listener(frame, &frame_listener, this);
+    ext_image_copy_capture_frame_v1_attach_buffer(frame, buffer.wl_buffer);
+
+    // Only the regions that changed since this buffer was last captured into need to be copied again
+    for (auto &rect : buffer.stale) {
+      ext_image_copy_capture_frame_v1_damage_buffer(frame, rect.x, rect.y, rect.width, rect.height);
+    }
+
+    ext_image_copy_capture_frame_v1_capture(frame);
+
+    pending_buffer = &buffer;
+    pending_damage.clear();
+    status = WAITING;
+  }
+
+  void image_copy_t::buffer_size(ext_image_copy_capture_session_v1 *session, std::uint32_t width, std::uint32_t height) {
+    constraints.width = width;
+    constraints.height = height;
+  }
+
+  void image_copy_t::dmabuf_device(ext_image_copy_capture_session_v1 *session, wl_array *device) {
+    if (device->size != sizeof(dev_t)) {
+      return;
+    }
+
+    std::memcpy(&constraints.device, device->data, sizeof(dev_t));
+    constraints.has_device = true;
+  }
+
+  void image_copy_t::dmabuf_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format, wl_array *modifiers) {
+    // Sorted in order of descending preference, all of them can be imported as RGB textures
+    constexpr std::uint32_t formats[] {
+      DRM_FORMAT_XRGB8888,
+      DRM_FORMAT_ARGB8888,
+      DRM_FORMAT_XBGR8888,
+      DRM_FORMAT_ABGR8888,
+    };
+
+    auto rank = [&](std::uint32_t format) -> std::size_t {
+      return std::find(std::begin(formats), std::end(formats), format) - std::begin(formats);
+    };
+    if (rank(format) == std::size(formats) || (constraints.format && rank(constraints.format) <= rank(format))) {
+      return;
+    }
+
+    BOOST_LOG(debug) << "Image copy capture supports DMA-BUF format: "sv << format;
+
+    constraints.format = format;
+    constraints.modifiers.resize(modifiers->size / sizeof(std::uint64_t));
+    std::memcpy(constraints.modifiers.data(), modifiers->data, constraints.modifiers.size() * sizeof(std::uint64_t));
+  }
+
+  void image_copy_t::done(ext_image_copy_capture_session_v1 *session) {
+    // The constraints may have changed, so the buffers are allocated again
+    destroy_buffers();
+
+    if (!constraints.format) {
+      BOOST_LOG(error) << "Image copy capture offers no supported DMA-BUF format"sv;
+      status = REINIT;
+      return;
+    }
+
+    if (!create_buffers()) {
+      destroy_buffers();
+      status = REINIT;
+      return;
+    }
+
+    // The first frame can be requested now
+    status = WAITING;
+  }
+
+  void image_copy_t::stopped(ext_image_copy_capture_session_v1 *session) {
+    BOOST_LOG(info) << "Image copy capture session stopped"sv;
+    status = REINIT;
+  }
+
+  void image_copy_t::damage(ext_image_copy_capture_frame_v1 *frame, std::int32_t x, std::int32_t y, std::int32_t width, std::int32_t height) {
+    pending_damage.emplace_back(rect_t {x, y, width, height});
+  }
+
+  void image_copy_t::ready(ext_image_copy_capture_frame_v1 *frame) {
+    ext_image_copy_capture_frame_v1_destroy(frame);
+    this->frame = nullptr;
+
+    // The damage of this frame makes the other buffers stale
+    for (auto &buffer : buffers) {
+      if (&buffer == pending_buffer) {
+        buffer.stale.clear();
+        continue;
+      }
+
+      buffer.stale.insert(std::end(buffer.stale), std::begin(pending_damage), std::end(pending_damage));
+      if (buffer.stale.size() > MAX_STALE_RECTS) {
+        auto x1 = std::numeric_limits<std::int32_t>::max();
+        auto y1 = x1;
+        auto x2 = std::numeric_limits<std::int32_t>::min();
+        auto y2 = x2;
+        for (auto &rect : buffer.stale) {
+          x1 = std::min(x1, rect.x);
+          y1 = std::min(y1, rect.y);
+          x2 = std::max(x2, rect.x + rect.width);
+          y2 = std::max(y2, rect.y + rect.height);
+        }
+        buffer.stale.assign({rect_t {x1, y1, x2 - x1, y2 - y1}});
+      }
+    }
+
+    current_buffer = pending_buffer;
+    current_damage = std::move(pending_damage);
+    pending_buffer = nullptr;
+    pending_damage.clear();
+
+    status = READY;
+  }
+
+  void image_copy_t::failed(ext_image_copy_capture_frame_v1 *frame, std::uint32_t reason) {
+    ext_image_copy_capture_frame_v1_destroy(frame);
+    this->frame = nullptr;
+    pending_buffer = nullptr;
+
+    if (reason == EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS) {
+      BOOST_LOG(info) << "Image copy capture buffer constraints changed"sv;
+    } else {
+      BOOST_LOG(error) << "Image copy capture frame failed: "sv << reason;
+    }
+
+    status = REINIT;
+  }
+
+  bool image_copy_t::init_gbm() {
+    if (gbm_device) {
+      return true;
+    }
+
+    // Allocate on the device the compositor wants the buffers on
+    gbm_device = create_gbm_device(constraints.has_device ? &constraints.device : nullptr);
+    return gbm_device != nullptr;
+  }
+
+  bool image_copy_t::create_buffers() {
+    if (!init_gbm()) {
+      BOOST_LOG(error) << "Failed to initialize GBM"sv;
+      return false;
+    }
+
+    // An implicit modifier can't be passed to gbm_bo_create_with_modifiers()
+    std::vector<std::uint64_t> modifiers;
+    std::copy_if(std::begin(constraints.modifiers), std::end(constraints.modifiers), std::back_inserter(modifiers), [](auto modifier) {
+      return modifier != DRM_FORMAT_MOD_INVALID;
+    });
+
+    for (auto &buffer : buffers) {
+      if (modifiers.empty()) {
+        buffer.bo = gbm_bo_create(gbm_device, constraints.width, constraints.height, constraints.format, GBM_BO_USE_RENDERING);
+      } else {
+        buffer.bo = gbm_bo_create_with_modifiers(gbm_device, constraints.width, constraints.height, constraints.format, modifiers.data(), modifiers.size());
+      }
+      if (!buffer.bo) {
+        BOOST_LOG(error) << "Failed to create GBM buffer"sv;
+        return false;
+      }
+
+      auto modifier = gbm_bo_get_modifier(buffer.bo);
+      auto planes = std::min(gbm_bo_get_plane_count(buffer.bo), 4);
+
+      auto &sd = buffer.sd;
+      sd.width = constraints.width;
+      sd.height = constraints.height;
+      sd.fourcc = constraints.format;
+      sd.modifier = modifier;
+
+      auto params = zwp_linux_dmabuf_v1_create_params(dmabuf_interface);
+      for (int plane = 0; plane < planes; ++plane) {
+        sd.fds[plane] = gbm_bo_get_fd_for_plane(buffer.bo, plane);
+        sd.pitches[plane] = gbm_bo_get_stride_for_plane(buffer.bo, plane);
+        sd.offsets[plane] = gbm_bo_get_offset(buffer.bo, plane);
+        if (sd.fds[plane] < 0) {
+          BOOST_LOG(error) << "Failed to get buffer FD"sv;
+          zwp_linux_buffer_params_v1_destroy(params);
+          return false;
+        }
+
+        zwp_linux_buffer_params_v1_add(params, sd.fds[plane], plane, sd.offsets[plane], sd.pitches[plane], modifier >> 32, modifier & 0xffffffff);
+      }
+
+      buffer.wl_buffer = zwp_linux_buffer_params_v1_create_immed(params, constraints.width, constraints.height, constraints.format, 0);
+      zwp_linux_buffer_params_v1_destroy(params);
+      if (!buffer.wl_buffer) {
+        BOOST_LOG(error) << "Failed to create buffer from params"sv;
+        return false;
+      }
+
+      // Nothing was captured into the buffer yet
+      buffer.stale.assign({rect_t {0, 0, (std::int32_t) constraints.width, (std::int32_t) constraints.height}});
+    }
+
+    BOOST_LOG(debug) << "Allocated "sv << buffers.size() << " buffers of "sv << constraints.width << 'x' << constraints.height << " for image copy capture"sv;
+    return true;
+  }
+
+  void image_copy_t::destroy_buffers() {
+    current_buffer = nullptr;
+    current_damage.clear();
+    next_buffer = 0;
+
+    for (auto &buffer : buffers) {
+      if (buffer.wl_buffer) {
+        wl_buffer_destroy(buffer.wl_buffer);
+        buffer.wl_buffer = nullptr;
+      }
+
+      for (auto &fd : buffer.sd.fds) {
+        if (fd >= 0) {
+          close(fd);
+          fd = -1;
+        }
+      }
+
+      if (buffer.bo) {
+        gbm_bo_destroy(buffer.bo);
+        buffer.bo = nullptr;
+      }
+
+      buffer.stale.clear();
+    }
+  }
+
+  void image_copy_t::destroy_session() {
+    if (frame) {
+      ext_image_copy_capture_frame_v1_destroy(frame);
+      frame = nullptr;
+    }
+    pending_buffer = nullptr;
+
+    if (session) {
+      ext_image_copy_capture_session_v1_destroy(session);
+      session = nullptr;
+    }
+
+    if (source) {
+      ext_image_capture_source_v1_destroy(source);
+      source = nullptr;
+    }
+  }
+
   void frame_t::destroy() {
     for (auto x = 0; x < 4; ++x) {
       if (sd.fds[x] >= 0) {
@@ -6,8 +6,11 @@
 
 // standard includes
 #include <bitset>
+#include <vector>
 
 #ifdef SUNSHINE_BUILD_WAYLAND
+  #include <ext-image-capture-source-v1.h>
+  #include <ext-image-copy-capture-v1.h>
   #include <linux-dmabuf-unstable-v1.h>
   #include <wlr-screencopy-unstable-v1.h>
   #include <xdg-output-unstable-v1.h>
@@ -97,6 +100,120 @@ namespace wl {
     bool y_invert {false};
   };
 
+  /**
+   * @brief Captures an output with ext-image-copy-capture-v1 into a fixed pool of GBM buffers.
+   * @details The buffers are allocated once per session and reused for every frame, so they can
+   *          be imported once. The compositor only completes a frame once the output changed,
+   *          and reports the regions that did.
+   */
+  class image_copy_t {
+  public:
+    enum status_e {
+      WAITING,  ///< Waiting for a frame
+      READY,  ///< Frame is ready
+      REINIT,  ///< Reinitialize the capture
+    };
+
+    struct rect_t {
+      std::int32_t x;
+      std::int32_t y;
+      std::int32_t width;
+      std::int32_t height;
+    };
+
+    struct buffer_t {
+      struct gbm_bo *bo {nullptr};
+      struct wl_buffer *wl_buffer {nullptr};
+
+      // Owns the file descriptors of the planes
+      egl::surface_descriptor_t sd;
+
+      // The regions that changed since the buffer was last captured into
+      std::vector<rect_t> stale;
+    };
+
+    static constexpr std::size_t MAX_BUFFERS = 3;
+
+    // Past this many regions, the stale regions of a buffer are merged into their bounding box
+    static constexpr std::size_t MAX_STALE_RECTS = 16;
+
+    image_copy_t();
+    ~image_copy_t();
+
+    image_copy_t(image_copy_t &&) = delete;
+    image_copy_t(const image_copy_t &) = delete;
+    image_copy_t &operator=(const image_copy_t &) = delete;
+    image_copy_t &operator=(image_copy_t &&) = delete;
+
+    /**
+     * @brief Start a capture session of an output.
+     * @param source_manager The manager of output capture sources.
+     * @param copy_manager The image copy capture manager.
+     * @param dmabuf_interface The linux-dmabuf interface to create the buffers with.
+     * @param output The output to capture.
+     * @param blend_cursor Whether the compositor paints the cursor into the frames.
+     */
+    void listen(ext_output_image_capture_source_manager_v1 *source_manager, ext_image_copy_capture_manager_v1 *copy_manager, zwp_linux_dmabuf_v1 *dmabuf_interface, wl_output *output, bool blend_cursor);
+
+    /**
+     * @brief Request the next frame, unless one is still pending.
+     */
+    void capture();
+
+    void buffer_size(ext_image_copy_capture_session_v1 *session, std::uint32_t width, std::uint32_t height);
+    void shm_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format) {}
+    void dmabuf_device(ext_image_copy_capture_session_v1 *session, wl_array *device);
+    void dmabuf_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format, wl_array *modifiers);
+    void done(ext_image_copy_capture_session_v1 *session);
+    void stopped(ext_image_copy_capture_session_v1 *session);
+
+    void transform(ext_image_copy_capture_frame_v1 *frame, std::uint32_t transform) {}
+    void damage(ext_image_copy_capture_frame_v1 *frame, std::int32_t x, std::int32_t y, std::int32_t width, std::int32_t height);
+    void presentation_time(ext_image_copy_capture_frame_v1 *frame, std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec) {}
+    void ready(ext_image_copy_capture_frame_v1 *frame);
+    void failed(ext_image_copy_capture_frame_v1 *frame, std::uint32_t reason);
+
+    status_e status;
+
+    // The buffer of the last frame that was ready, and its damage
+    buffer_t *current_buffer {nullptr};
+    std::vector<rect_t> current_damage;
+
+    bool blend_cursor {false};
+
+  private:
+    bool init_gbm();
+    bool create_buffers();
+    void destroy_buffers();
+    void destroy_session();
+
+    zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
+
+    ext_image_capture_source_v1 *source {nullptr};
+    ext_image_copy_capture_session_v1 *session {nullptr};
+    ext_image_copy_capture_frame_v1 *frame {nullptr};
+
+    ext_image_copy_capture_session_v1_listener session_listener;
+    ext_image_copy_capture_frame_v1_listener frame_listener;
+
+    // The constraints of the buffers, as last announced by the session
+    struct {
+      std::uint32_t width {0};
+      std::uint32_t height {0};
+      std::uint32_t format {0};
+      std::vector<std::uint64_t> modifiers;
+      dev_t device {0};
+      bool has_device {false};
+    } constraints;
+
+    std::array<buffer_t, MAX_BUFFERS> buffers;
+    buffer_t *pending_buffer {nullptr};
+    std::size_t next_buffer {0};
+    std::vector<rect_t> pending_damage;
+
+    struct gbm_device *gbm_device {nullptr};
+  };
+
   class monitor_t {
   public:
     explicit monitor_t(wl_output *output);
@@ -141,6 +258,8 @@ namespace wl {
       XDG_OUTPUT,  ///< xdg-output
       WLR_EXPORT_DMABUF,  ///< screencopy manager
       LINUX_DMABUF,  ///< linux-dmabuf protocol
+      EXT_IMAGE_COPY_CAPTURE,  ///< ext-image-copy-capture manager
+      EXT_OUTPUT_IMAGE_CAPTURE_SOURCE,  ///< ext-image-capture-source manager for outputs
       MAX_INTERFACES,  ///< Maximum number of interfaces
     };
 
@@ -161,6 +280,15 @@ namespace wl {
     zwlr_screencopy_manager_v1 *screencopy_manager {nullptr};
     zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
     zxdg_output_manager_v1 *output_manager {nullptr};
+    ext_image_copy_capture_manager_v1 *image_copy_manager {nullptr};
+    ext_output_image_capture_source_manager_v1 *output_source_manager {nullptr};
+
+    /**
+     * @brief Check if outputs can be captured with ext-image-copy-capture-v1.
+     */
+    bool has_image_copy() const {
+      return interface[EXT_IMAGE_COPY_CAPTURE] && interface[EXT_OUTPUT_IMAGE_CAPTURE_SOURCE] && interface[LINUX_DMABUF];
+    }
 
   private:
     void add_interface(wl_registry *registry, std::uint32_t id, const char *interface, std::uint32_t version);
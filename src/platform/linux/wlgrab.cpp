@@ -3,10 +3,13 @@
  * @brief Definitions for wlgrab capture.
  */
 // standard includes
+#include <optional>
 #include <thread>
+#include <unistd.h>
 
 // local includes
 #include "cuda.h"
+#include "src/buffer_pool.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/video.h"
@@ -21,7 +24,7 @@ namespace wl {
 
   struct img_t: public platf::img_t {
     ~img_t() override {
-      delete[] data;
+      buffer_pool::free_image(data);
       data = nullptr;
     }
   };
@@ -45,8 +48,8 @@ namespace wl {
         return -1;
       }
 
-      if (!interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
-        BOOST_LOG(error) << "Missing Wayland wire for wlr-export-dmabuf"sv;
+      if (!interface.has_image_copy() && !interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
+        BOOST_LOG(error) << "Missing Wayland wire for ext-image-copy-capture or wlr-export-dmabuf"sv;
         return -1;
       }
 
@@ -66,6 +69,23 @@ namespace wl {
 
       output = monitor->output;
 
+      // Prefer capturing into a fixed pool of buffers, which only completes frames when the output changed
+      if (interface.has_image_copy()) {
+        image_copy.listen(interface.output_source_manager, interface.image_copy_manager, interface.dmabuf_interface, output, false);
+        display.roundtrip();
+
+        use_image_copy = image_copy.status != image_copy_t::REINIT;
+        if (!use_image_copy) {
+          if (!interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
+            return -1;
+          }
+
+          BOOST_LOG(warning) << "Falling back to wlr-export-dmabuf"sv;
+        }
+      }
+
+      BOOST_LOG(info) << "Capturing with "sv << (use_image_copy ? "ext-image-copy-capture"sv : "wlr-export-dmabuf"sv);
+
       offset_x = monitor->viewport.offset_x;
       offset_y = monitor->viewport.offset_y;
       width = monitor->viewport.width;
@@ -86,7 +106,53 @@ namespace wl {
       return 0;
     }
 
+    /**
+     * @brief Wait for the next frame of the image copy capture session.
+     * @return `timeout` if the output didn't change, as the compositor only completes frames with damage.
+     */
+    platf::capture_e snapshot_image_copy(std::chrono::milliseconds timeout, bool cursor) {
+      auto to = std::chrono::steady_clock::now() + timeout;
+
+      // The cursor is painted into the frames of a whole session, or of none
+      if (cursor != image_copy.blend_cursor) {
+        image_copy.listen(interface.output_source_manager, interface.image_copy_manager, interface.dmabuf_interface, output, cursor);
+      }
+
+      // A frame that timed out stays pending, so it completes on a later call once the output changes
+      image_copy.capture();
+      while (image_copy.status == image_copy_t::WAITING) {
+        auto remaining_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(to - std::chrono::steady_clock::now());
+        if (remaining_time_ms.count() < 0 || !display.dispatch(remaining_time_ms)) {
+          return platf::capture_e::timeout;
+        }
+
+        // The first frame is only requested once the buffers are allocated
+        image_copy.capture();
+      }
+
+      auto current_buffer = image_copy.current_buffer;
+
+      if (
+        image_copy.status == image_copy_t::REINIT ||
+        !current_buffer ||
+        current_buffer->sd.width != width ||
+        current_buffer->sd.height != height
+      ) {
+        return platf::capture_e::reinit;
+      }
+
+      if (image_copy.current_damage.empty()) {
+        return platf::capture_e::timeout;
+      }
+
+      return platf::capture_e::ok;
+    }
+
     inline platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
+      if (use_image_copy) {
+        return snapshot_image_copy(timeout, cursor);
+      }
+
       auto to = std::chrono::steady_clock::now() + timeout;
 
       // Dispatch events until we get a new frame or the timeout expires
@@ -118,6 +184,8 @@ namespace wl {
     wl::display_t display;
     interface_t interface;
     dmabuf_t dmabuf;
+    image_copy_t image_copy;
+    bool use_image_copy {false};
 
     wl_output *output;
   };
@@ -175,11 +243,17 @@ namespace wl {
         return status;
       }
 
-      auto current_frame = dmabuf.current_frame;
-
-      auto rgb_opt = egl::import_source(egl_display.get(), current_frame->sd);
+      // The buffers of the image copy capture are reused, so they're only imported once
+      std::optional<egl::rgb_t> rgb_opt;
+      egl::rgb_t *rgb;
+      if (use_image_copy) {
+        rgb = imports.import(egl_display.get(), image_copy.current_buffer->sd);
+      } else {
+        rgb_opt = egl::import_source(egl_display.get(), dmabuf.current_frame->sd);
+        rgb = rgb_opt ? &*rgb_opt : nullptr;
+      }
 
-      if (!rgb_opt) {
+      if (!rgb) {
         return platf::capture_e::reinit;
       }
 
@@ -187,7 +261,7 @@ namespace wl {
         return platf::capture_e::interrupted;
       }
 
-      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
       // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
       int w, h;
@@ -195,7 +269,7 @@ namespace wl {
       gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
       BOOST_LOG(debug) << "width and height: w "sv << w << " h "sv << h;
 
-      gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
 
       return platf::capture_e::ok;
@@ -237,19 +311,25 @@ namespace wl {
       return std::make_unique<platf::avcodec_encode_device_t>();
     }
 
+    bool img_in_system_memory() override {
+      return true;
+    }
+
     std::shared_ptr<platf::img_t> alloc_img() override {
       auto img = std::make_shared<img_t>();
       img->width = width;
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->data = buffer_pool::alloc_image(height * img->row_pitch);
 
       return img;
     }
 
     egl::display_t egl_display;
     egl::ctx_t ctx;
+
+    egl::import_cache_t imports;
   };
 
   class wlr_vram_t: public wlr_t {
@@ -311,15 +391,25 @@ namespace wl {
       auto img = (egl::img_descriptor_t *) img_out.get();
       img->reset();
 
-      auto current_frame = dmabuf.current_frame;
-
       ++sequence;
       img->sequence = sequence;
 
-      img->sd = current_frame->sd;
+      if (use_image_copy) {
+        // The buffer is reused by later frames, so the image gets its own file descriptors
+        img->sd = image_copy.current_buffer->sd;
+        for (auto &fd : img->sd.fds) {
+          if (fd >= 0) {
+            fd = dup(fd);
+          }
+        }
+      } else {
+        auto current_frame = dmabuf.current_frame;
 
-      // Prevent dmabuf from closing the file descriptors.
-      std::fill_n(current_frame->sd.fds, 4, -1);
+        img->sd = current_frame->sd;
+
+        // Prevent dmabuf from closing the file descriptors.
+        std::fill_n(current_frame->sd.fds, 4, -1);
+      }
 
       return platf::capture_e::ok;
     }
@@ -407,8 +497,8 @@ namespace platf {
       return {};
     }
 
-    if (!interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
-      BOOST_LOG(warning) << "Missing Wayland wire for wlr-export-dmabuf"sv;
+    if (!interface.has_image_copy() && !interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
+      BOOST_LOG(warning) << "Missing Wayland wire for ext-image-copy-capture or wlr-export-dmabuf"sv;
       return {};
     }
 
@@ -3,6 +3,7 @@
  * @brief Definitions for x11 capture.
  */
 // standard includes
+#include <algorithm>
 #include <fstream>
 #include <thread>
 
@@ -14,6 +15,7 @@
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <xcb/damage.h>
 #include <xcb/shm.h>
 #include <xcb/xfixes.h>
 
@@ -21,6 +23,7 @@
 #include "cuda.h"
 #include "graphics.h"
 #include "misc.h"
+#include "src/buffer_pool.h"
 #include "src/config.h"
 #include "src/globals.h"
 #include "src/logging.h"
@@ -173,6 +176,98 @@ namespace platf {
     _FN(connect, xcb_connection_t *, (const char *displayname, int *screenp));
     _FN(setup_roots_iterator, xcb_screen_iterator_t, (const xcb_setup_t *R));
     _FN(generate_id, std::uint32_t, (xcb_connection_t * c));
+    _FN(flush, int, (xcb_connection_t * c));
+    _FN(poll_for_event, xcb_generic_event_t *, (xcb_connection_t * c));
+    _FN(query_pointer, xcb_query_pointer_cookie_t, (xcb_connection_t * c, xcb_window_t window));
+    _FN(query_pointer_reply, xcb_query_pointer_reply_t *, (xcb_connection_t * c, xcb_query_pointer_cookie_t cookie, xcb_generic_error_t **e));
+
+    namespace damage {
+      static xcb_extension_t *id;
+
+      _FN(query_version, xcb_damage_query_version_cookie_t, (xcb_connection_t * c, uint32_t client_major_version, uint32_t client_minor_version));
+      _FN(query_version_reply, xcb_damage_query_version_reply_t *, (xcb_connection_t * c, xcb_damage_query_version_cookie_t cookie, xcb_generic_error_t **e));
+      _FN(create, xcb_void_cookie_t, (xcb_connection_t * c, xcb_damage_damage_t damage, xcb_drawable_t drawable, uint8_t level));
+      _FN(subtract, xcb_void_cookie_t, (xcb_connection_t * c, xcb_damage_damage_t damage, xcb_xfixes_region_t repair, xcb_xfixes_region_t parts));
+
+      int init() {
+        static void *handle {nullptr};
+        static bool funcs_loaded = false;
+
+        if (funcs_loaded) {
+          return 0;
+        }
+
+        if (!handle) {
+          handle = dyn::handle({"libxcb-damage.so.0", "libxcb-damage.so"});
+          if (!handle) {
+            return -1;
+          }
+        }
+
+        std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+          {(dyn::apiproc *) &id, "xcb_damage_id"},
+          {(dyn::apiproc *) &query_version, "xcb_damage_query_version"},
+          {(dyn::apiproc *) &query_version_reply, "xcb_damage_query_version_reply"},
+          {(dyn::apiproc *) &create, "xcb_damage_create"},
+          {(dyn::apiproc *) &subtract, "xcb_damage_subtract"},
+        };
+
+        if (dyn::load(handle, funcs)) {
+          return -1;
+        }
+
+        funcs_loaded = true;
+        return 0;
+      }
+    }  // namespace damage
+
+    namespace xfixes {
+      static xcb_extension_t *id;
+
+      _FN(query_version, xcb_xfixes_query_version_cookie_t, (xcb_connection_t * c, uint32_t client_major_version, uint32_t client_minor_version));
+      _FN(query_version_reply, xcb_xfixes_query_version_reply_t *, (xcb_connection_t * c, xcb_xfixes_query_version_cookie_t cookie, xcb_generic_error_t **e));
+      _FN(create_region, xcb_void_cookie_t, (xcb_connection_t * c, xcb_xfixes_region_t region, uint32_t rectangles_len, const xcb_rectangle_t *rectangles));
+      _FN(fetch_region, xcb_xfixes_fetch_region_cookie_t, (xcb_connection_t * c, xcb_xfixes_region_t region));
+      _FN(fetch_region_reply, xcb_xfixes_fetch_region_reply_t *, (xcb_connection_t * c, xcb_xfixes_fetch_region_cookie_t cookie, xcb_generic_error_t **e));
+      _FN(fetch_region_rectangles, xcb_rectangle_t *, (const xcb_xfixes_fetch_region_reply_t *R));
+      _FN(fetch_region_rectangles_length, int, (const xcb_xfixes_fetch_region_reply_t *R));
+      _FN(select_cursor_input, xcb_void_cookie_t, (xcb_connection_t * c, xcb_window_t window, uint32_t event_mask));
+
+      int init() {
+        static void *handle {nullptr};
+        static bool funcs_loaded = false;
+
+        if (funcs_loaded) {
+          return 0;
+        }
+
+        if (!handle) {
+          handle = dyn::handle({"libxcb-xfixes.so.0", "libxcb-xfixes.so"});
+          if (!handle) {
+            return -1;
+          }
+        }
+
+        std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+          {(dyn::apiproc *) &id, "xcb_xfixes_id"},
+          {(dyn::apiproc *) &query_version, "xcb_xfixes_query_version"},
+          {(dyn::apiproc *) &query_version_reply, "xcb_xfixes_query_version_reply"},
+          {(dyn::apiproc *) &create_region, "xcb_xfixes_create_region"},
+          {(dyn::apiproc *) &fetch_region, "xcb_xfixes_fetch_region"},
+          {(dyn::apiproc *) &fetch_region_reply, "xcb_xfixes_fetch_region_reply"},
+          {(dyn::apiproc *) &fetch_region_rectangles, "xcb_xfixes_fetch_region_rectangles"},
+          {(dyn::apiproc *) &fetch_region_rectangles_length, "xcb_xfixes_fetch_region_rectangles_length"},
+          {(dyn::apiproc *) &select_cursor_input, "xcb_xfixes_select_cursor_input"},
+        };
+
+        if (dyn::load(handle, funcs)) {
+          return -1;
+        }
+
+        funcs_loaded = true;
+        return 0;
+      }
+    }  // namespace xfixes
 
     int init_shm() {
       static void *handle {nullptr};
@@ -227,6 +322,10 @@ namespace platf {
         {(dyn::apiproc *) &connect, "xcb_connect"},
         {(dyn::apiproc *) &setup_roots_iterator, "xcb_setup_roots_iterator"},
         {(dyn::apiproc *) &generate_id, "xcb_generate_id"},
+        {(dyn::apiproc *) &flush, "xcb_flush"},
+        {(dyn::apiproc *) &poll_for_event, "xcb_poll_for_event"},
+        {(dyn::apiproc *) &query_pointer, "xcb_query_pointer"},
+        {(dyn::apiproc *) &query_pointer_reply, "xcb_query_pointer_reply"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -245,6 +344,8 @@ namespace platf {
 
   using xcb_connect_t = util::dyn_safe_ptr<xcb_connection_t, &xcb::disconnect>;
   using xcb_img_t = util::c_ptr<xcb_shm_get_image_reply_t>;
+  using xcb_event_t = util::c_ptr<xcb_generic_event_t>;
+  using xcb_region_t = util::c_ptr<xcb_xfixes_fetch_region_reply_t>;
 
   using ximg_t = util::safe_ptr<XImage, freeImage>;
   using xcursor_t = util::safe_ptr<XFixesCursorImage, freeX>;
@@ -308,7 +409,7 @@ namespace platf {
 
   struct shm_img_t: public img_t {
     ~shm_img_t() override {
-      delete[] data;
+      buffer_pool::free_image(data);
       data = nullptr;
     }
   };
@@ -532,6 +633,10 @@ namespace platf {
       return capture_e::ok;
     }
 
+    bool img_in_system_memory() override {
+      return true;
+    }
+
     std::shared_ptr<img_t> alloc_img() override {
       return std::make_shared<x11_img_t>();
     }
@@ -579,6 +684,20 @@ namespace platf {
 
     task_pool_util::TaskPool::task_id_t refresh_task_id;
 
+    // XDamage tracking of the root window, disabled when the extensions are missing
+    bool damage_tracking = false;
+    std::uint8_t damage_event;
+    std::uint8_t cursor_event;
+    xcb_damage_damage_t damage;
+    xcb_xfixes_region_t damage_region;
+    std::vector<std::pair<int, int>> bands;
+
+    // The shm segment holds no frame until it has been fetched fully once
+    bool full_refresh = true;
+    bool last_cursor = false;
+    std::int16_t cursor_x = -1;
+    std::int16_t cursor_y = -1;
+
     void delayed_refresh() {
       refresh();
 
@@ -640,19 +759,142 @@ namespace platf {
       return capture_e::ok;
     }
 
+    /**
+     * @brief Drain the pending XDamage and XFixes events.
+     * @param damaged Set when the root window was damaged.
+     * @param cursor_changed Set when the cursor image changed.
+     */
+    void poll_events(bool &damaged, bool &cursor_changed) {
+      while (xcb_event_t event {xcb::poll_for_event(xcb.get())}) {
+        auto type = event->response_type & ~0x80;
+        if (type == damage_event + XCB_DAMAGE_NOTIFY) {
+          damaged = true;
+        } else if (type == cursor_event + XCB_XFIXES_CURSOR_NOTIFY) {
+          cursor_changed = true;
+        }
+      }
+    }
+
+    /**
+     * @brief Check whether the cursor moved since the last frame.
+     * @details XFixes only reports changes of the cursor image, so the position is polled.
+     */
+    bool cursor_moved() {
+      auto cookie = xcb::query_pointer(xcb.get(), display->root);
+      util::c_ptr<xcb_query_pointer_reply_t> pointer {xcb::query_pointer_reply(xcb.get(), cookie, nullptr)};
+      if (!pointer || (pointer->root_x == cursor_x && pointer->root_y == cursor_y)) {
+        return false;
+      }
+
+      cursor_x = pointer->root_x;
+      cursor_y = pointer->root_y;
+      return true;
+    }
+
+    /**
+     * @brief Fetch the rows of the streamed monitor that were damaged into the shm segment.
+     * @details Damaged rectangles are widened to full rows, so each band lands at its own
+     *          offset of the segment without an extra copy.
+     * @return The number of bands fetched, or -1 on error.
+     */
+    int fetch_damage() {
+      xcb::damage::subtract(xcb.get(), damage, XCB_NONE, damage_region);
+
+      xcb_region_t region {xcb::xfixes::fetch_region_reply(xcb.get(), xcb::xfixes::fetch_region(xcb.get(), damage_region), nullptr)};
+      if (!region) {
+        BOOST_LOG(error) << "Could not fetch damaged region"sv;
+        return -1;
+      }
+
+      auto rects = xcb::xfixes::fetch_region_rectangles(region.get());
+      auto count = xcb::xfixes::fetch_region_rectangles_length(region.get());
+
+      bands.clear();
+      for (int x = 0; x < count; ++x) {
+        auto &rect = rects[x];
+        if (rect.x + rect.width <= offset_x || rect.x >= offset_x + width) {
+          continue;
+        }
+
+        auto top = std::max(rect.y - offset_y, 0);
+        auto bottom = std::min(rect.y + rect.height - offset_y, height);
+        if (top < bottom) {
+          bands.emplace_back(top, bottom);
+        }
+      }
+
+      std::sort(std::begin(bands), std::end(bands));
+
+      // Merge overlapping and adjacent bands, then request all of them before waiting for the replies
+      std::vector<xcb_shm_get_image_cookie_t> cookies;
+      for (std::size_t x = 0; x < bands.size();) {
+        auto [top, bottom] = bands[x];
+        for (++x; x < bands.size() && bands[x].first <= bottom; ++x) {
+          bottom = std::max(bottom, bands[x].second);
+        }
+
+        cookies.emplace_back(xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y + top, width, bottom - top, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, top * width * 4));
+      }
+
+      for (auto &cookie : cookies) {
+        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), cookie, nullptr)};
+        if (!img_reply) {
+          BOOST_LOG(error) << "Could not get image reply"sv;
+          return -1;
+        }
+      }
+
+      return (int) cookies.size();
+    }
+
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       // The whole X server changed, so we must reinit everything
       if (xattr.width != env_width || xattr.height != env_height) {
         BOOST_LOG(warning) << "X dimensions changed in SHM mode, request reinit"sv;
         return capture_e::reinit;
       } else {
-        auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
         auto frame_timestamp = std::chrono::steady_clock::now();
 
-        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr)};
-        if (!img_reply) {
-          BOOST_LOG(error) << "Could not get image reply"sv;
-          return capture_e::reinit;
+        bool damaged = false;
+        bool cursor_changed = cursor != last_cursor;
+        last_cursor = cursor;
+
+        if (damage_tracking) {
+          poll_events(damaged, cursor_changed);
+          if (cursor && cursor_moved()) {
+            cursor_changed = true;
+          }
+        }
+
+        if (!damage_tracking || full_refresh) {
+          if (damage_tracking) {
+            // Anything damaged from now on is reported again
+            xcb::damage::subtract(xcb.get(), damage, XCB_NONE, XCB_NONE);
+          }
+
+          auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
+
+          xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr)};
+          if (!img_reply) {
+            BOOST_LOG(error) << "Could not get image reply"sv;
+            return capture_e::reinit;
+          }
+
+          full_refresh = false;
+        } else {
+          if (damaged) {
+            auto fetched = fetch_damage();
+            if (fetched < 0) {
+              return capture_e::reinit;
+            }
+
+            // The damage was outside of the streamed monitor
+            damaged = fetched > 0;
+          }
+
+          if (!damaged && !cursor_changed) {
+            return capture_e::timeout;
+          }
         }
 
         if (!pull_free_image_cb(img_out)) {
@@ -662,6 +904,13 @@ namespace platf {
         std::copy_n((std::uint8_t *) data.data, frame_size(), img_out->data);
         img_out->frame_timestamp = frame_timestamp;
 
+        // The position is only polled while damage is tracked
+        if (cursor && damage_tracking && cursor_x >= 0) {
+          img_out->cursor = util::point_t {(double) (cursor_x - offset_x), (double) (cursor_y - offset_y)};
+        } else {
+          img_out->cursor = std::nullopt;
+        }
+
         if (cursor) {
           blend_cursor(shm_xdisplay.get(), *img_out, offset_x, offset_y);
         }
@@ -676,7 +925,7 @@ namespace platf {
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->data = buffer_pool::alloc_image(height * img->row_pitch);
 
       return img;
     }
@@ -721,9 +970,55 @@ namespace platf {
         return -1;
       }
 
+      damage_tracking = init_damage();
+      if (!damage_tracking) {
+        BOOST_LOG(info) << "XDamage is unavailable, capturing full frames"sv;
+      }
+
       return 0;
     }
 
+    /**
+     * @brief Track the damage of the root window, so unchanged frames need no image request.
+     * @return `true` if both XDamage and XFixes are usable.
+     */
+    bool init_damage() {
+      if (xcb::damage::init() || xcb::xfixes::init()) {
+        return false;
+      }
+
+      auto damage_ext = xcb::get_extension_data(xcb.get(), xcb::damage::id);
+      auto xfixes_ext = xcb::get_extension_data(xcb.get(), xcb::xfixes::id);
+      if (!damage_ext || !damage_ext->present || !xfixes_ext || !xfixes_ext->present) {
+        return false;
+      }
+
+      // Both extensions require the client to announce its version before any other request
+      util::c_ptr<xcb_xfixes_query_version_reply_t> xfixes_version {
+        xcb::xfixes::query_version_reply(xcb.get(), xcb::xfixes::query_version(xcb.get(), XCB_XFIXES_MAJOR_VERSION, XCB_XFIXES_MINOR_VERSION), nullptr)
+      };
+      util::c_ptr<xcb_damage_query_version_reply_t> damage_version {
+        xcb::damage::query_version_reply(xcb.get(), xcb::damage::query_version(xcb.get(), XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION), nullptr)
+      };
+      if (!xfixes_version || xfixes_version->major_version < 2 || !damage_version) {
+        return false;
+      }
+
+      damage_event = damage_ext->first_event;
+      cursor_event = xfixes_ext->first_event;
+
+      damage_region = xcb::generate_id(xcb.get());
+      xcb::xfixes::create_region(xcb.get(), damage_region, 0, nullptr);
+
+      damage = xcb::generate_id(xcb.get());
+      xcb::damage::create(xcb.get(), damage, display->root, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+
+      xcb::xfixes::select_cursor_input(xcb.get(), display->root, XCB_XFIXES_CURSOR_NOTIFY_MASK_DISPLAY_CURSOR);
+      xcb::flush(xcb.get());
+
+      return true;
+    }
+
     std::uint32_t frame_size() {
       return width * height * 4;
     }
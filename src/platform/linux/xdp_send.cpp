@@ -0,0 +1,504 @@
+/**
+ * @file src/platform/linux/xdp_send.cpp
+ * @brief Definitions for the AF_XDP UDP send backend.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <utility>
+
+// platform includes
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// local includes
+#include "xdp_send.h"
+
+#ifndef SOL_XDP
+  #define SOL_XDP 283
+#endif
+
+namespace platf::xdp {
+  namespace {
+    // Half of the UMEM is sent from, the other half keeps the RX queue the socket takes over fed
+    constexpr std::uint32_t TX_FRAME_COUNT = sender_t::FRAME_COUNT / 2;
+    constexpr std::uint32_t FILL_FRAME_COUNT = sender_t::FRAME_COUNT - TX_FRAME_COUNT;
+
+    static_assert(std::has_single_bit(TX_FRAME_COUNT) && std::has_single_bit(FILL_FRAME_COUNT));
+
+    // Sends usually complete within microseconds, but don't hog the core if the NIC falls behind
+    constexpr int SPINS_BEFORE_YIELD = 1000;
+
+    // Give up on a batch if the NIC doesn't complete anything for this long, e.g. because its link is down
+    constexpr auto COMPLETION_TIMEOUT = std::chrono::milliseconds(100);
+
+    constexpr std::uint32_t RTF_UP = 0x0001;
+    constexpr std::uint32_t RTF_GATEWAY = 0x0002;
+    constexpr std::uint32_t RTF_REJECT = 0x0200;
+
+    constexpr std::uint32_t ATF_COM = 0x02;
+
+    /**
+     * @brief Split a line into its whitespace separated fields.
+     */
+    std::vector<std::string_view> split_fields(std::string_view line) {
+      std::vector<std::string_view> fields;
+
+      std::size_t pos = 0;
+      while (true) {
+        pos = line.find_first_not_of(" \t", pos);
+        if (pos == std::string_view::npos) {
+          break;
+        }
+
+        auto end = std::min(line.find_first_of(" \t", pos), line.size());
+        fields.push_back(line.substr(pos, end - pos));
+        pos = end;
+      }
+
+      return fields;
+    }
+
+    /**
+     * @brief Call a function with the fields of every line but the first.
+     */
+    template<class F>
+    void for_each_entry(std::string_view table, F &&f) {
+      bool header = true;
+      while (!table.empty()) {
+        auto end = std::min(table.find('\n'), table.size());
+        auto line = table.substr(0, end);
+        table.remove_prefix(std::min(end + 1, table.size()));
+
+        if (std::exchange(header, false)) {
+          continue;
+        }
+
+        f(split_fields(line));
+      }
+    }
+
+    std::optional<std::uint32_t> parse_number(std::string_view field, int base = 10) {
+      if (base == 16 && (field.starts_with("0x") || field.starts_with("0X"))) {
+        field.remove_prefix(2);
+      }
+
+      std::uint32_t value;
+      auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value, base);
+      if (ec != std::errc {} || ptr != field.data() + field.size()) {
+        return std::nullopt;
+      }
+
+      return value;
+    }
+
+    std::optional<mac_t> parse_mac(std::string_view field) {
+      mac_t mac;
+      for (std::size_t x = 0; x < mac.size(); ++x) {
+        if (field.size() < 2 || (x + 1 < mac.size() && (field.size() < 3 || field[2] != ':'))) {
+          return std::nullopt;
+        }
+
+        auto [ptr, ec] = std::from_chars(field.data(), field.data() + 2, mac[x], 16);
+        if (ec != std::errc {} || ptr != field.data() + 2) {
+          return std::nullopt;
+        }
+
+        field.remove_prefix(std::min<std::size_t>(3, field.size()));
+      }
+
+      return mac;
+    }
+
+    std::string read_file(const std::string &path) {
+      std::ifstream in {path};
+      return {std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {}};
+    }
+
+    /**
+     * @brief Map a ring of the socket.
+     * @param fd The socket.
+     * @param offsets The offsets of the ring in its mapping.
+     * @param size The number of entries of the ring.
+     * @param entry_size The size of each entry.
+     * @param pgoff The offset identifying the ring.
+     */
+    template<class Ring>
+    bool map_ring(int fd, const xdp_ring_offset &offsets, std::uint32_t size, std::size_t entry_size, off_t pgoff, Ring &ring) {
+      ring.map_size = offsets.desc + size * entry_size;
+      ring.map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+      if (ring.map == MAP_FAILED) {
+        ring.map = nullptr;
+        return false;
+      }
+
+      auto base = (std::uint8_t *) ring.map;
+      ring.producer = (std::uint32_t *) (base + offsets.producer);
+      ring.consumer = (std::uint32_t *) (base + offsets.consumer);
+      ring.flags = (std::uint32_t *) (base + offsets.flags);
+      ring.descs = base + offsets.desc;
+      ring.size = size;
+
+      return true;
+    }
+
+    template<class Ring>
+    void unmap_ring(Ring &ring) {
+      if (ring.map) {
+        munmap(ring.map, ring.map_size);
+      }
+    }
+  }  // namespace
+
+  void write_headers(std::uint8_t *out, const flow_t &flow, std::size_t payload_size, std::uint16_t id) {
+    auto eth = out;
+    std::memcpy(eth, flow.dst_mac.data(), flow.dst_mac.size());
+    std::memcpy(eth + 6, flow.src_mac.data(), flow.src_mac.size());
+    eth[12] = 0x08;  // IPv4
+    eth[13] = 0x00;
+
+    auto ip = eth + 14;
+    auto ip_size = 20 + 8 + payload_size;
+    ip[0] = 0x45;  // Version 4, no options
+    ip[1] = flow.tos;
+    ip[2] = (std::uint8_t) (ip_size >> 8);
+    ip[3] = (std::uint8_t) ip_size;
+    ip[4] = (std::uint8_t) (id >> 8);
+    ip[5] = (std::uint8_t) id;
+    ip[6] = 0x40;  // Don't fragment
+    ip[7] = 0;
+    ip[8] = 64;  // TTL
+    ip[9] = IPPROTO_UDP;
+    ip[10] = 0;
+    ip[11] = 0;
+    std::memcpy(ip + 12, &flow.src_ip, 4);
+    std::memcpy(ip + 16, &flow.dst_ip, 4);
+
+    std::uint32_t sum = 0;
+    for (int x = 0; x < 20; x += 2) {
+      sum += (ip[x] << 8) | ip[x + 1];
+    }
+    while (sum >> 16) {
+      sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    ip[10] = (std::uint8_t) (~sum >> 8);
+    ip[11] = (std::uint8_t) ~sum;
+
+    auto udp = ip + 20;
+    auto udp_size = 8 + payload_size;
+    udp[0] = (std::uint8_t) (flow.src_port >> 8);
+    udp[1] = (std::uint8_t) flow.src_port;
+    udp[2] = (std::uint8_t) (flow.dst_port >> 8);
+    udp[3] = (std::uint8_t) flow.dst_port;
+    udp[4] = (std::uint8_t) (udp_size >> 8);
+    udp[5] = (std::uint8_t) udp_size;
+    udp[6] = 0;
+    udp[7] = 0;
+  }
+
+  std::optional<std::uint32_t> find_next_hop(std::string_view routes, std::string_view interface, std::uint32_t destination) {
+    // The addresses are the raw network byte order values, so they're masked as is
+    struct route_t {
+      std::string_view interface;
+      std::uint32_t gateway;
+      std::uint32_t flags;
+      std::uint32_t metric;
+      int prefix;
+    };
+
+    std::optional<route_t> best;
+    for_each_entry(routes, [&](const std::vector<std::string_view> &fields) {
+      if (fields.size() < 8) {
+        return;
+      }
+
+      auto route_destination = parse_number(fields[1], 16);
+      auto gateway = parse_number(fields[2], 16);
+      auto flags = parse_number(fields[3], 16);
+      auto metric = parse_number(fields[6]);
+      auto mask = parse_number(fields[7], 16);
+      if (!route_destination || !gateway || !flags || !metric || !mask) {
+        return;
+      }
+
+      if (!(*flags & RTF_UP) || (*flags & RTF_REJECT) || (destination & *mask) != *route_destination) {
+        return;
+      }
+
+      // The longest prefix wins, then the lowest metric
+      route_t route {fields[0], *gateway, *flags, *metric, std::popcount(*mask)};
+      if (!best || route.prefix > best->prefix || (route.prefix == best->prefix && route.metric < best->metric)) {
+        best = route;
+      }
+    });
+
+    if (!best || best->interface != interface) {
+      return std::nullopt;
+    }
+
+    return (best->flags & RTF_GATEWAY) ? best->gateway : destination;
+  }
+
+  std::optional<mac_t> find_neighbor(std::string_view arp, std::string_view interface, std::uint32_t address) {
+    std::optional<mac_t> neighbor;
+    for_each_entry(arp, [&](const std::vector<std::string_view> &fields) {
+      if (neighbor || fields.size() < 6 || fields[5] != interface) {
+        return;
+      }
+
+      in_addr neighbor_address;
+      if (inet_pton(AF_INET, std::string {fields[0]}.c_str(), &neighbor_address) != 1 || neighbor_address.s_addr != address) {
+        return;
+      }
+
+      // Incomplete entries are still being resolved
+      auto flags = parse_number(fields[2], 16);
+      if (!flags || !(*flags & ATF_COM)) {
+        return;
+      }
+
+      neighbor = parse_mac(fields[3]);
+    });
+
+    return neighbor;
+  }
+
+  std::optional<flow_t> resolve_flow(const std::string &interface, flow_t flow) {
+    auto next_hop = find_next_hop(read_file("/proc/net/route"), interface, flow.dst_ip);
+    if (!next_hop) {
+      return std::nullopt;
+    }
+
+    auto dst_mac = find_neighbor(read_file("/proc/net/arp"), interface, *next_hop);
+    auto src_mac = parse_mac(read_file("/sys/class/net/" + interface + "/address"));
+    if (!dst_mac || !src_mac) {
+      return std::nullopt;
+    }
+
+    flow.dst_mac = *dst_mac;
+    flow.src_mac = *src_mac;
+    return flow;
+  }
+
+  std::unique_ptr<sender_t> sender_t::create(const std::string &interface, std::uint32_t queue) {
+    auto ifindex = if_nametoindex(interface.c_str());
+    if (!ifindex) {
+      return nullptr;
+    }
+
+    // Drivers that can't read from the UMEM directly still avoid the network stack in copy mode,
+    // and kernels before 5.4 don't know about the need_wakeup flag
+    int error = 0;
+    for (auto flags : {XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP, XDP_COPY | XDP_USE_NEED_WAKEUP, XDP_COPY}) {
+      std::unique_ptr<sender_t> sender {new sender_t};
+      if (sender->bind(ifindex, queue, flags)) {
+        return sender;
+      }
+
+      error = errno;
+    }
+
+    errno = error;
+    return nullptr;
+  }
+
+  bool sender_t::bind(unsigned int ifindex, std::uint32_t queue, std::uint16_t flags) {
+    _fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (_fd < 0) {
+      return false;
+    }
+
+    // The UMEM must be page aligned
+    _umem = (std::uint8_t *) mmap(nullptr, FRAME_COUNT * FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (_umem == MAP_FAILED) {
+      _umem = nullptr;
+      return false;
+    }
+
+    xdp_umem_reg reg {};
+    reg.addr = (std::uint64_t) _umem;
+    reg.len = FRAME_COUNT * FRAME_SIZE;
+    reg.chunk_size = FRAME_SIZE;
+    reg.headroom = 0;
+    if (setsockopt(_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))) {
+      return false;
+    }
+
+    auto fill_size = FILL_FRAME_COUNT;
+    auto completion_size = TX_FRAME_COUNT;
+    auto tx_size = TX_FRAME_COUNT;
+    if (setsockopt(_fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) ||
+        setsockopt(_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_size, sizeof(completion_size)) ||
+        setsockopt(_fd, SOL_XDP, XDP_TX_RING, &tx_size, sizeof(tx_size))) {
+      return false;
+    }
+
+    xdp_mmap_offsets offsets {};
+    socklen_t offsets_size = sizeof(offsets);
+    if (getsockopt(_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_size)) {
+      return false;
+    }
+    if (offsets_size < sizeof(offsets)) {
+      // Kernels before 5.4 have no flags in their rings
+      errno = EOPNOTSUPP;
+      return false;
+    }
+
+    if (!map_ring(_fd, offsets.fr, fill_size, sizeof(std::uint64_t), XDP_UMEM_PGOFF_FILL_RING, _fill) ||
+        !map_ring(_fd, offsets.cr, completion_size, sizeof(std::uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING, _completion) ||
+        !map_ring(_fd, offsets.tx, tx_size, sizeof(xdp_desc), XDP_PGOFF_TX_RING, _tx)) {
+      return false;
+    }
+
+    // In zero-copy mode, the queue receives into the frames of the fill ring, even though nothing is redirected to the socket
+    auto fill_addrs = (std::uint64_t *) _fill.descs;
+    for (std::uint32_t x = 0; x < FILL_FRAME_COUNT; ++x) {
+      fill_addrs[x] = (std::uint64_t) (TX_FRAME_COUNT + x) * FRAME_SIZE;
+    }
+    std::atomic_ref {*_fill.producer}.store(*_fill.producer + FILL_FRAME_COUNT, std::memory_order_release);
+
+    sockaddr_xdp address {};
+    address.sxdp_family = AF_XDP;
+    address.sxdp_flags = flags;
+    address.sxdp_ifindex = ifindex;
+    address.sxdp_queue_id = queue;
+    if (::bind(_fd, (const sockaddr *) &address, sizeof(address))) {
+      return false;
+    }
+
+    _zero_copy = flags & XDP_ZEROCOPY;
+    _need_wakeup = flags & XDP_USE_NEED_WAKEUP;
+
+    _free_frames.resize(TX_FRAME_COUNT);
+    for (std::uint32_t x = 0; x < TX_FRAME_COUNT; ++x) {
+      _free_frames[x] = TX_FRAME_COUNT - 1 - x;
+    }
+
+    return true;
+  }
+
+  sender_t::~sender_t() {
+    // Closing the socket stops the NIC from using the UMEM
+    unmap_ring(_tx);
+    unmap_ring(_completion);
+    unmap_ring(_fill);
+
+    if (_fd >= 0) {
+      close(_fd);
+    }
+
+    if (_umem) {
+      munmap(_umem, FRAME_COUNT * FRAME_SIZE);
+    }
+  }
+
+  status_e sender_t::send(const flow_t &flow, std::span<const packet_t> packets, std::size_t &queued) {
+    queued = 0;
+    for (auto &packet : packets) {
+      if (packet.header_size + packet.payload_size > MAX_PACKET_SIZE) {
+        return status_e::unsupported;
+      }
+    }
+
+    // Reclaim what's done already, so frames are mostly reused in order
+    reap_completions();
+
+    auto descs = (xdp_desc *) _tx.descs;
+    auto producer = *_tx.producer;
+
+    while (queued < packets.size()) {
+      // The frames of completed sends go back on the free list, so the TX ring can't run out of room before them
+      std::optional<std::chrono::steady_clock::time_point> deadline;
+      for (int spins = 0; _free_frames.empty(); ++spins) {
+        if (!kick()) {
+          return queued ? status_e::error : status_e::unsupported;
+        }
+
+        reap_completions();
+
+        if (spins >= SPINS_BEFORE_YIELD) {
+          auto now = std::chrono::steady_clock::now();
+          if (!deadline) {
+            deadline = now + COMPLETION_TIMEOUT;
+          } else if (now > *deadline) {
+            return queued ? status_e::error : status_e::unsupported;
+          }
+
+          std::this_thread::yield();
+        }
+      }
+
+      auto count = std::min(_free_frames.size(), packets.size() - queued);
+      for (std::size_t x = 0; x < count; ++x) {
+        auto &packet = packets[queued + x];
+
+        auto frame = _free_frames.back();
+        _free_frames.pop_back();
+
+        auto data = _umem + (std::size_t) frame * FRAME_SIZE;
+        auto size = packet.header_size + packet.payload_size;
+        write_headers(data, flow, size, _next_id++);
+        if (packet.header_size) {
+          std::memcpy(data + HEADERS_SIZE, packet.header, packet.header_size);
+        }
+        std::memcpy(data + HEADERS_SIZE + packet.header_size, packet.payload, packet.payload_size);
+
+        auto &desc = descs[producer++ & (_tx.size - 1)];
+        desc.addr = (std::uint64_t) frame * FRAME_SIZE;
+        desc.len = (std::uint32_t) (HEADERS_SIZE + size);
+        desc.options = 0;
+      }
+
+      // Publish the descriptors only once they're complete
+      std::atomic_ref {*_tx.producer}.store(producer, std::memory_order_release);
+      queued += count;
+
+      if (!kick()) {
+        return status_e::error;
+      }
+    }
+
+    return status_e::ok;
+  }
+
+  void sender_t::reap_completions() {
+    auto producer = std::atomic_ref {*_completion.producer}.load(std::memory_order_acquire);
+    auto consumer = *_completion.consumer;
+    if (producer == consumer) {
+      return;
+    }
+
+    auto addrs = (const std::uint64_t *) _completion.descs;
+    for (; consumer != producer; ++consumer) {
+      _free_frames.push_back((std::uint32_t) (addrs[consumer & (_completion.size - 1)] / FRAME_SIZE));
+    }
+
+    std::atomic_ref {*_completion.consumer}.store(consumer, std::memory_order_release);
+  }
+
+  bool sender_t::kick() {
+    // Unless the driver asks for it, it's already busy working through the TX ring
+    if (_need_wakeup && !(std::atomic_ref {*_tx.flags}.load(std::memory_order_relaxed) & XDP_RING_NEED_WAKEUP)) {
+      return true;
+    }
+
+    if (sendto(_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0) {
+      // These only mean the driver can't take more right now, a stalled NIC is caught by the completion timeout
+      return errno == EAGAIN || errno == EBUSY || errno == ENOBUFS || errno == ENETDOWN;
+    }
+
+    return true;
+  }
+}  // namespace platf::xdp
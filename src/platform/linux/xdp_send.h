@@ -0,0 +1,184 @@
+/**
+ * @file src/platform/linux/xdp_send.h
+ * @brief Declarations for the AF_XDP UDP send backend.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace platf::xdp {
+  enum class status_e : int {
+    ok,  ///< All packets were queued
+    error,  ///< At least one packet wasn't queued
+    unsupported,  ///< Nothing was queued, the caller should send the packets itself
+  };
+
+  /**
+   * @brief A packet to send, made of an optional header followed by a payload.
+   */
+  struct packet_t {
+    const char *header;
+    std::size_t header_size;
+    const char *payload;
+    std::size_t payload_size;
+  };
+
+  using mac_t = std::array<std::uint8_t, 6>;
+
+  /**
+   * @brief The addresses of a UDP flow over IPv4, down to the link layer.
+   */
+  struct flow_t {
+    mac_t src_mac;
+    mac_t dst_mac;  ///< The destination, or the gateway on the way to it
+    std::uint32_t src_ip;  ///< In network byte order
+    std::uint32_t dst_ip;  ///< In network byte order
+    std::uint16_t src_port;
+    std::uint16_t dst_port;
+    std::uint8_t tos;  ///< The DSCP and ECN bits
+  };
+
+  /**
+   * @brief The size of the Ethernet, IPv4 and UDP headers in front of each packet.
+   */
+  constexpr std::size_t HEADERS_SIZE = 14 + 20 + 8;
+
+  /**
+   * @brief Write the Ethernet, IPv4 and UDP headers of a packet.
+   * @details The UDP checksum is left out, which IPv4 allows.
+   * @param out The buffer to write `HEADERS_SIZE` bytes to.
+   * @param flow The flow of the packet.
+   * @param payload_size The size of the UDP payload.
+   * @param id The IPv4 identification of the packet.
+   */
+  void write_headers(std::uint8_t *out, const flow_t &flow, std::size_t payload_size, std::uint16_t id);
+
+  /**
+   * @brief Find the next hop to a destination out of an interface.
+   * @param routes The contents of `/proc/net/route`.
+   * @param interface The interface.
+   * @param destination The destination, in network byte order.
+   * @return The gateway, or the destination itself if it's on link, in network byte order.
+   *         `std::nullopt` if the best route to the destination doesn't go out of the interface.
+   */
+  std::optional<std::uint32_t> find_next_hop(std::string_view routes, std::string_view interface, std::uint32_t destination);
+
+  /**
+   * @brief Find the hardware address of a neighbor on an interface.
+   * @param arp The contents of `/proc/net/arp`.
+   * @param interface The interface.
+   * @param address The address of the neighbor, in network byte order.
+   * @return The hardware address, or `std::nullopt` if the neighbor hasn't been resolved.
+   */
+  std::optional<mac_t> find_neighbor(std::string_view arp, std::string_view interface, std::uint32_t address);
+
+  /**
+   * @brief Resolve the link layer addresses of a flow from the kernel's routes and neighbors.
+   * @param interface The interface to send out of.
+   * @param flow The flow, with everything but the hardware addresses filled in.
+   * @return The flow, or `std::nullopt` if it doesn't go out of the interface or its next hop isn't resolved yet.
+   */
+  std::optional<flow_t> resolve_flow(const std::string &interface, flow_t flow);
+
+  /**
+   * @brief Sends packets through an AF_XDP socket, bypassing the kernel's network stack.
+   * @details Packets are copied behind their Ethernet, IPv4 and UDP headers into frames of a UMEM,
+   *          which the NIC reads straight from when its driver supports zero-copy. A whole batch is
+   *          queued on the TX ring with a single wakeup of the driver, and the frames of completed sends
+   *          are reclaimed from the completion ring when no frame is free. Sending isn't thread-safe.
+   */
+  class sender_t {
+  public:
+    static constexpr std::uint32_t FRAME_COUNT = 4096;
+    static constexpr std::uint32_t FRAME_SIZE = 2048;
+
+    /**
+     * @brief The largest header and payload that fit in a frame behind the network headers.
+     */
+    static constexpr std::size_t MAX_PACKET_SIZE = FRAME_SIZE - HEADERS_SIZE;
+
+    /**
+     * @brief Bind an AF_XDP socket to a queue of an interface.
+     * @details Zero-copy mode is tried first, then copy mode.
+     * @param interface The interface.
+     * @param queue The queue of the interface.
+     * @return The sender, or `nullptr` with `errno` set if the socket couldn't be set up.
+     */
+    static std::unique_ptr<sender_t> create(const std::string &interface, std::uint32_t queue);
+
+    ~sender_t();
+
+    sender_t(const sender_t &) = delete;
+    sender_t &operator=(const sender_t &) = delete;
+
+    /**
+     * @brief Queue packets of a flow.
+     * @details This returns as soon as the packets are queued, the buffers of the packets may be reused right away.
+     * @param flow The flow.
+     * @param packets The packets.
+     * @param queued Receives the number of packets queued, the first ones of `packets`.
+     * @return The status of the send.
+     */
+    status_e send(const flow_t &flow, std::span<const packet_t> packets, std::size_t &queued);
+
+    /**
+     * @brief Check if the NIC reads the frames straight from the UMEM.
+     */
+    bool zero_copy() const {
+      return _zero_copy;
+    }
+
+  private:
+    struct ring_t {
+      std::uint32_t *producer = nullptr;
+      std::uint32_t *consumer = nullptr;
+      std::uint32_t *flags = nullptr;
+      void *descs = nullptr;
+      std::uint32_t size = 0;
+
+      void *map = nullptr;
+      std::size_t map_size = 0;
+    };
+
+    sender_t() = default;
+
+    /**
+     * @brief Set up the socket, its UMEM and its rings, and bind it.
+     * @return `false` with `errno` set on failure.
+     */
+    bool bind(unsigned int ifindex, std::uint32_t queue, std::uint16_t flags);
+
+    /**
+     * @brief Reclaim the frames of completed sends.
+     */
+    void reap_completions();
+
+    /**
+     * @brief Let the driver know there are packets on the TX ring.
+     * @return `false` if the socket is broken.
+     */
+    bool kick();
+
+    int _fd = -1;
+    bool _zero_copy = false;
+    bool _need_wakeup = false;
+
+    std::uint8_t *_umem = nullptr;
+
+    ring_t _fill;
+    ring_t _completion;
+    ring_t _tx;
+
+    std::vector<std::uint32_t> _free_frames;
+    std::uint16_t _next_id = 0;
+  };
+}  // namespace platf::xdp
@@ -13,7 +13,32 @@ struct CaptureSession {
   NSCondition *captureStopped;
 };
 
-@interface AVVideo: NSObject <AVCaptureVideoDataOutputSampleBufferDelegate>
+typedef bool (^FrameCallbackBlock)(CMSampleBufferRef);
+
+/**
+ * @brief What the display needs from a backend capturing it.
+ * @details The frame callback is called for every captured frame until it returns `false`,
+ *          then the semaphore returned by `capture:` is signaled.
+ */
+@protocol VideoCapture <NSObject>
+
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@optional
+
+/**
+ * @brief Check if the last capture ended because the system stopped it, rather than the frame callback.
+ */
+- (BOOL)captureFailed;
+
+@end
+
+@interface AVVideo: NSObject <AVCaptureVideoDataOutputSampleBufferDelegate, VideoCapture>
 
 #define kMaxDisplays 32
 
@@ -23,8 +48,6 @@ struct CaptureSession {
 @property (nonatomic, assign) int frameWidth;
 @property (nonatomic, assign) int frameHeight;
 
-typedef bool (^FrameCallbackBlock)(CMSampleBufferRef);
-
 @property (nonatomic, assign) AVCaptureSession *session;
 @property (nonatomic, assign) NSMapTable<AVCaptureConnection *, AVCaptureVideoDataOutput *> *videoOutputs;
 @property (nonatomic, assign) NSMapTable<AVCaptureConnection *, FrameCallbackBlock> *captureCallbacks;
@@ -2,14 +2,25 @@
  * @file src/platform/macos/display.mm
  * @brief Definitions for display capture on macOS.
  */
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+
+// platform includes
+#include <sys/sysctl.h>
+
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/platform/macos/av_img_t.h"
 #include "src/platform/macos/av_video.h"
 #include "src/platform/macos/misc.h"
 #include "src/platform/macos/nv12_zero_device.h"
+#include "src/platform/macos/sc_video.h"
 
 // Avoid conflict between AVFoundation and libavutil both defining AVMediaType
 #define AVMediaType AVMediaType_FFmpeg
@@ -21,9 +32,34 @@ namespace fs = std::filesystem;
 namespace platf {
   using namespace std::literals;
 
+  /**
+   * @brief Get when the display composed the frame, on the steady clock.
+   * @details Both backends timestamp frames on the host clock when the display presented them,
+   *          rather than when they were delivered, so their latency can be compared.
+   */
+  std::optional<std::chrono::steady_clock::time_point> presentation_time(CMSampleBufferRef sampleBuffer) {
+    auto presented = CMSampleBufferGetPresentationTimeStamp(sampleBuffer);
+    if (!CMTIME_IS_VALID(presented)) {
+      return std::nullopt;
+    }
+
+    auto age = CMTimeGetSeconds(CMTimeSubtract(CMClockGetTime(CMClockGetHostTimeClock()), presented));
+    return std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(std::max(age, 0.0)));
+  }
+
+  /**
+   * @brief Log how long frames took from the display composing them until they were delivered.
+   */
+  void collect_delivery_latency(logging::percentile_periodic_logger<double> &logger, const std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
+    if (frame_timestamp) {
+      logger.collect_and_log(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - *frame_timestamp).count());
+    }
+  }
+
   struct av_display_t: public display_t {
-    AVVideo *av_capture {};
+    id<VideoCapture> av_capture {};
     CGDirectDisplayID display_id {};
+    std::unique_ptr<logging::percentile_periodic_logger<double>> delivery_latency_logger;
 
     ~av_display_t() override {
       [av_capture release];
@@ -31,6 +67,9 @@ namespace platf {
 
     capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
       auto signal = [av_capture capture:^(CMSampleBufferRef sampleBuffer) {
+        auto frame_timestamp = presentation_time(sampleBuffer);
+        collect_delivery_latency(*delivery_latency_logger, frame_timestamp);
+
         auto new_sample_buffer = std::make_shared<av_sample_buf_t>(sampleBuffer);
         auto new_pixel_buffer = std::make_shared<av_pixel_buf_t>(new_sample_buffer->buf);
 
@@ -56,6 +95,7 @@ namespace platf {
         img_out->height = (int) CVPixelBufferGetHeight(new_pixel_buffer->buf);
         img_out->row_pitch = (int) CVPixelBufferGetBytesPerRow(new_pixel_buffer->buf);
         img_out->pixel_pitch = img_out->row_pitch / img_out->width;
+        img_out->frame_timestamp = frame_timestamp;
 
         old_data_retainer = nullptr;
 
@@ -68,9 +108,18 @@ namespace platf {
         return true;
       }];
 
+      if (!signal) {
+        return capture_e::error;
+      }
+
       // FIXME: We should time out if an image isn't returned for a while
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
+      if ([av_capture respondsToSelector:@selector(captureFailed)] && [av_capture captureFailed]) {
+        // The display went away or the permission was revoked
+        return capture_e::reinit;
+      }
+
       return capture_e::ok;
     }
 
@@ -95,6 +144,19 @@ namespace platf {
       }
     }
 
+    std::unique_ptr<vt_encode_device_t> make_vt_encode_device(pix_fmt_e pix_fmt) override {
+      if (pix_fmt != pix_fmt_e::nv12 && pix_fmt != pix_fmt_e::p010) {
+        BOOST_LOG(error) << "Unsupported Pixel Format."sv;
+        return nullptr;
+      }
+
+      auto device = std::make_unique<vt_zero_device>();
+
+      device->init(static_cast<void *>(av_capture), pix_fmt, setResolution, setPixelFormat);
+
+      return device;
+    }
+
     int dummy_img(img_t *img) override {
       if (!platf::is_screen_capture_allowed()) {
         // If we don't have the screen capture permission, this function will hang
@@ -130,6 +192,10 @@ namespace platf {
         return false;
       }];
 
+      if (!signal) {
+        return 1;
+      }
+
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
       return 0;
@@ -143,11 +209,11 @@ namespace platf {
      * height --> the intended capture height
      */
     static void setResolution(void *display, int width, int height) {
-      [static_cast<AVVideo *>(display) setFrameWidth:width frameHeight:height];
+      [static_cast<id<VideoCapture>>(display) setFrameWidth:width frameHeight:height];
     }
 
     static void setPixelFormat(void *display, OSType pixelFormat) {
-      static_cast<AVVideo *>(display).pixelFormat = pixelFormat;
+      static_cast<id<VideoCapture>>(display).pixelFormat = pixelFormat;
     }
   };
 
@@ -177,12 +243,27 @@ namespace platf {
     }
     BOOST_LOG(info) << "Configuring selected display ("sv << display->display_id << ") to stream"sv;
 
-    display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+    // The stream is set up for 8-bit frames only, so HDR stays on AVFoundation
+    const char *backend = nullptr;
+    if (@available(macOS 12.3, *)) {
+      if (config::video.capture != "avf" && !config.dynamicRange && [SCVideo isAvailable]) {
+        display->av_capture = [[SCVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+        backend = "ScreenCaptureKit";
+      }
+    }
+
+    if (!display->av_capture) {
+      display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+      backend = "AVFoundation";
+    }
 
     if (!display->av_capture) {
       BOOST_LOG(error) << "Video setup failed."sv;
       return nullptr;
     }
+    BOOST_LOG(info) << "Capturing the display with "sv << backend;
+
+    display->delivery_latency_logger = std::make_unique<logging::percentile_periodic_logger<double>>(debug, std::string {"Video: "} + backend + " frame delivery latency", "ms", 20s, &metrics::video.capture_latency_recent_seconds);
 
     display->width = display->av_capture.frameWidth;
     display->height = display->av_capture.frameHeight;
@@ -215,4 +296,15 @@ namespace platf {
     // We don't track GPU state, so we will always reenumerate. Fortunately, it is fast on macOS.
     return true;
   }
+
+  std::string gpu_fingerprint() {
+    // GPU drivers are only updated along with macOS itself
+    char os_version[256] {};
+    auto size = sizeof(os_version);
+    if (sysctlbyname("kern.osversion", os_version, &size, nullptr, 0)) {
+      return {};
+    }
+
+    return os_version;
+  }
 }  // namespace platf
@@ -3,9 +3,11 @@
  * @brief Definitions for macOS input handling.
  */
 // standard includes
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
+#include <utility>
 
 // platform includes
 #include <ApplicationServices/ApplicationServices.h>
@@ -26,6 +28,13 @@
  */
 constexpr std::chrono::milliseconds MULTICLICK_DELAY_MS(500);
 
+/**
+ * @brief How long the display geometry is trusted without a reconfiguration callback.
+ * @details The callbacks are only delivered to a thread running its run loop, which the input thread doesn't,
+ *          so the geometry is also refreshed this often.
+ */
+constexpr std::chrono::seconds DISPLAY_GEOMETRY_REFRESH_INTERVAL(1);
+
 namespace platf {
   using namespace std::literals;
 
@@ -35,6 +44,11 @@ namespace platf {
     CGFloat displayScaling {};
     CGEventSourceRef source {};
 
+    // display geometry, refreshed when the displays are reconfigured
+    CGRect display_bounds {};
+    std::atomic<bool> display_geometry_stale {true};
+    std::chrono::steady_clock::time_point display_geometry_refreshed;
+
     // keyboard related stuff
     CGEventRef kb_event {};
     CGEventFlags kb_flags {};
@@ -43,8 +57,53 @@ namespace platf {
     CGEventRef mouse_event {};  // mouse event source
     bool mouse_down[3] {};  // mouse button status
     std::chrono::steady_clock::steady_clock::time_point last_mouse_event[3][2];  // timestamp of last mouse events
+
+    // relative moves of the current input batch, posted as a single move when the batch ends
+    bool batching {};
+    int pending_delta_x {};
+    int pending_delta_y {};
   };
 
+  /**
+   * @brief Mark the display geometry stale, once a reconfiguration of the displays is done.
+   */
+  void display_reconfigured(CGDirectDisplayID display, CGDisplayChangeSummaryFlags flags, void *user_info) {
+    if (flags & kCGDisplayBeginConfigurationFlag) {
+      return;
+    }
+
+    static_cast<macos_input_t *>(user_info)->display_geometry_stale = true;
+  }
+
+  /**
+   * @brief Get the bounds of the streamed display, querying them again only when they may have changed.
+   * @param macos_input The input context, whose scaling is refreshed along with the bounds.
+   */
+  const CGRect &display_bounds(macos_input_t *macos_input) {
+    const auto now = std::chrono::steady_clock::now();
+    if (!macos_input->display_geometry_stale.exchange(false) && now < macos_input->display_geometry_refreshed + DISPLAY_GEOMETRY_REFRESH_INTERVAL) {
+      return macos_input->display_bounds;
+    }
+
+    macos_input->display_bounds = CGDisplayBounds(macos_input->display);
+
+    // Input coordinates are based on the virtual resolution not the physical, so we need the scaling factor
+    const CGDisplayModeRef mode = CGDisplayCopyDisplayMode(macos_input->display);
+    if (mode) {
+      macos_input->displayScaling = ((CGFloat) CGDisplayPixelsWide(macos_input->display)) / ((CGFloat) CGDisplayModeGetPixelWidth(mode));
+      CFRelease(mode);
+    }
+
+    macos_input->display_geometry_refreshed = now;
+    return macos_input->display_bounds;
+  }
+
+  /**
+   * @brief Post the relative moves of the current input batch, before an event that must follow them.
+   * @param input The input context.
+   */
+  void flush_mouse_moves(input_t &input);
+
   // A struct to hold a Windows keycode to Mac virtual keycode mapping.
   struct KeyCodeMap {
     int win_keycode;
@@ -255,6 +314,8 @@ const KeyCodeMap kKeyCodesMap[] = {
       return;
     }
 
+    flush_mouse_moves(input);
+
     auto macos_input = ((macos_input_t *) input.get());
     auto event = macos_input->kb_event;
 
@@ -298,6 +359,15 @@ const KeyCodeMap kKeyCodesMap[] = {
     BOOST_LOG(info) << "unicode: Unicode input not yet implemented for MacOS."sv;
   }
 
+  void begin_input_batch(input_t &input) {
+    static_cast<macos_input_t *>(input.get())->batching = true;
+  }
+
+  void end_input_batch(input_t &input) {
+    flush_mouse_moves(input);
+    static_cast<macos_input_t *>(input.get())->batching = false;
+  }
+
   int alloc_gamepad(input_t &input, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
     BOOST_LOG(info) << "alloc_gamepad: Gamepad not yet implemented for MacOS."sv;
     return -1;
@@ -335,11 +405,10 @@ const KeyCodeMap kKeyCodesMap[] = {
     BOOST_LOG(debug) << "mouse_event: "sv << button << ", type: "sv << type << ", location:"sv << raw_location.x << ":"sv << raw_location.y << " click_count: "sv << click_count;
 
     const auto macos_input = static_cast<macos_input_t *>(input.get());
-    const auto display = macos_input->display;
     const auto event = macos_input->mouse_event;
 
     // get display bounds for current display
-    const CGRect display_bounds = CGDisplayBounds(display);
+    const CGRect &display_bounds = platf::display_bounds(macos_input);
 
     // limit mouse to current display bounds
     const auto location = CGPoint {
@@ -379,15 +448,43 @@ const KeyCodeMap kKeyCodesMap[] = {
     return kCGEventMouseMoved;
   }
 
+  /**
+   * @brief Post a relative move.
+   * @param input The input context.
+   * @param deltaX The horizontal distance.
+   * @param deltaY The vertical distance.
+   */
+  void post_move(input_t &input, const int deltaX, const int deltaY) {
+    const auto current = get_mouse_loc(input);
+
+    const auto location = util::point_t {current.x + deltaX, current.y + deltaY};
+    post_mouse(input, kCGMouseButtonLeft, event_type_mouse(input), location, current, 0);
+  }
+
+  void flush_mouse_moves(input_t &input) {
+    const auto macos_input = static_cast<macos_input_t *>(input.get());
+    if (!macos_input->pending_delta_x && !macos_input->pending_delta_y) {
+      return;
+    }
+
+    post_move(input, std::exchange(macos_input->pending_delta_x, 0), std::exchange(macos_input->pending_delta_y, 0));
+  }
+
   void move_mouse(
     input_t &input,
     const int deltaX,
     const int deltaY
   ) {
-    const auto current = get_mouse_loc(input);
+    const auto macos_input = static_cast<macos_input_t *>(input.get());
 
-    const auto location = util::point_t {current.x + deltaX, current.y + deltaY};
-    post_mouse(input, kCGMouseButtonLeft, event_type_mouse(input), location, current, 0);
+    // Each move queries the cursor and warps it, so the moves of a batch are posted as one
+    if (macos_input->batching) {
+      macos_input->pending_delta_x += deltaX;
+      macos_input->pending_delta_y += deltaY;
+      return;
+    }
+
+    post_move(input, deltaX, deltaY);
   }
 
   void abs_mouse(
@@ -396,12 +493,13 @@ const KeyCodeMap kKeyCodesMap[] = {
     const float x,
     const float y
   ) {
+    flush_mouse_moves(input);
+
     const auto macos_input = static_cast<macos_input_t *>(input.get());
+    const CGRect &display_bounds = platf::display_bounds(macos_input);
     const auto scaling = macos_input->displayScaling;
-    const auto display = macos_input->display;
 
     auto location = util::point_t {x * scaling, y * scaling};
-    CGRect display_bounds = CGDisplayBounds(display);
     // in order to get the correct mouse location for capturing display , we need to add the display bounds to the location
     location.x += display_bounds.origin.x;
     location.y += display_bounds.origin.y;
@@ -413,6 +511,8 @@ const KeyCodeMap kKeyCodesMap[] = {
     CGMouseButton mac_button;
     CGEventType event;
 
+    flush_mouse_moves(input);
+
     const auto macos_input = static_cast<macos_input_t *>(input.get());
 
     switch (button) {
@@ -449,6 +549,8 @@ const KeyCodeMap kKeyCodesMap[] = {
   }
 
   void scroll(input_t &input, const int high_res_distance) {
+    flush_mouse_moves(input);
+
     CGEventRef upEvent = CGEventCreateScrollWheelEvent(
       nullptr,
       kCGScrollEventUnitLine,
@@ -475,12 +577,12 @@ const KeyCodeMap kKeyCodesMap[] = {
   }
 
   /**
-   * @brief Sends a touch event to the OS.
+   * @brief Sends a frame of touch events to the OS.
    * @param input The client-specific input context.
    * @param touch_port The current viewport for translating to screen coordinates.
-   * @param touch The touch event.
+   * @param touches The touch events.
    */
-  void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch) {
+  void touch_update(client_input_t *input, const touch_port_t &touch_port, std::span<const touch_input_t> touches) {
     // Unimplemented feature - platform_caps::pen_touch
   }
 
@@ -547,10 +649,8 @@ const KeyCodeMap kKeyCodesMap[] = {
       }
     }
 
-    // Input coordinates are based on the virtual resolution not the physical, so we need the scaling factor
-    const CGDisplayModeRef mode = CGDisplayCopyDisplayMode(macos_input->display);
-    macos_input->displayScaling = ((CGFloat) CGDisplayPixelsWide(macos_input->display)) / ((CGFloat) CGDisplayModeGetPixelWidth(mode));
-    CFRelease(mode);
+    display_bounds(macos_input);
+    CGDisplayRegisterReconfigurationCallback(display_reconfigured, macos_input);
 
     macos_input->source = CGEventSourceCreate(kCGEventSourceStateHIDSystemState);
 
@@ -568,7 +668,9 @@ const KeyCodeMap kKeyCodesMap[] = {
   }
 
   void freeInput(void *p) {
-    const auto *input = static_cast<macos_input_t *>(p);
+    auto *input = static_cast<macos_input_t *>(p);
+
+    CGDisplayRemoveReconfigurationCallback(display_reconfigured, input);
 
     CFRelease(input->source);
     CFRelease(input->kb_event);
@@ -7,6 +7,7 @@
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/platform/macos/av_audio.h"
+#include "src/platform/macos/sc_audio.h"
 
 namespace platf {
   using namespace std::literals;
@@ -29,10 +30,9 @@ namespace platf {
         byteSampleBuffer = TPCircularBufferTail(&av_audio_capture->audioSampleBuffer, &length);
       }
 
+      // AVFoundation already delivers interleaved floats in the streamed order
       const float *sampleBuffer = (float *) byteSampleBuffer;
-      std::vector<float> vectorBuffer(sampleBuffer, sampleBuffer + sample_size);
-
-      std::copy_n(std::begin(vectorBuffer), sample_size, std::begin(sample_in));
+      std::copy_n(sampleBuffer, sample_size, std::begin(sample_in));
 
       TPCircularBufferConsume(&av_audio_capture->audioSampleBuffer, sample_size * sizeof(float));
 
@@ -40,6 +40,74 @@ namespace platf {
     }
   };
 
+// SCAudio is only created after checking it's available
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability-new"
+  struct sc_mic_t: public mic_t {
+    SCAudio *sc_audio_capture {};
+
+    ~sc_mic_t() override {
+      [sc_audio_capture release];
+    }
+
+    capture_e sample(std::vector<float> &sample_in) override {
+      auto sample_size = sample_in.size();
+
+      uint32_t length = 0;
+      void *byteSampleBuffer = TPCircularBufferTail(&sc_audio_capture->audioSampleBuffer, &length);
+
+      if (length < sample_size * sizeof(float)) {
+        // Nothing comes in while the system is silent, so don't wait for samples forever
+        auto signal = sc_audio_capture.samplesArrivedSignal;
+        [signal lock];
+        auto unlock = util::fail_guard([&]() {
+          [signal unlock];
+        });
+
+        auto deadline = [NSDate dateWithTimeIntervalSinceNow:0.5];
+        while ((byteSampleBuffer = TPCircularBufferTail(&sc_audio_capture->audioSampleBuffer, &length), length < sample_size * sizeof(float))) {
+          if (![signal waitUntilDate:deadline]) {
+            return capture_e::timeout;
+          }
+        }
+      }
+
+      // The ring buffer already holds interleaved floats in the streamed order
+      const float *sampleBuffer = (float *) byteSampleBuffer;
+      std::copy_n(sampleBuffer, sample_size, std::begin(sample_in));
+
+      TPCircularBufferConsume(&sc_audio_capture->audioSampleBuffer, sample_size * sizeof(float));
+
+      return capture_e::ok;
+    }
+  };
+
+  bool system_audio_available() {
+    return [SCAudio isAvailable];
+  }
+
+  /**
+   * @brief Capture the audio of the whole system with ScreenCaptureKit.
+   * @return The capture, or `nullptr` if it couldn't be started.
+   */
+  std::unique_ptr<mic_t> system_audio(int channels, std::uint32_t sample_rate) {
+    auto mic = std::make_unique<sc_mic_t>();
+    mic->sc_audio_capture = [[SCAudio alloc] init];
+
+    if ([mic->sc_audio_capture setupWithSampleRate:sample_rate channels:channels]) {
+      BOOST_LOG(error) << "Failed to capture system audio. Please allow Sunshine to record the screen in System Settings."sv;
+      return nullptr;
+    }
+
+    if (channels > 2) {
+      BOOST_LOG(warning) << "ScreenCaptureKit only captures stereo, the other "sv << channels - 2 << " channels will be silent"sv;
+    }
+
+    BOOST_LOG(info) << "Capturing system audio with ScreenCaptureKit"sv;
+    return mic;
+  }
+#pragma clang diagnostic pop
+
   struct macos_audio_control_t: public audio_control_t {
     AVCaptureDevice *audio_capture_device {};
 
@@ -50,6 +118,11 @@ namespace platf {
     }
 
     std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, bool continuous_audio) override {
+      // Without a loopback device to capture from, capture the system audio itself
+      if (config::audio.sink.empty() && system_audio_available()) {
+        return system_audio(channels, sample_rate);
+      }
+
       auto mic = std::make_unique<av_mic_t>();
       const char *audio_sink = "";
 
@@ -9,6 +9,8 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <array>
 #include <fcntl.h>
 #include <ifaddrs.h>
 
@@ -17,8 +19,16 @@
 #include <dlfcn.h>
 #include <Foundation/Foundation.h>
 #include <mach-o/dyld.h>
+#include <mach/mach.h>
 #include <net/if_dl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sys/mman.h>
+#include <sys/qos.h>
+#include <sys/resource.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -214,6 +224,153 @@ namespace platf {
     // Unimplemented
   }
 
+  namespace {
+    int sysctl_int(const char *name, int def) {
+      int value;
+      size_t size = sizeof(value);
+      if (sysctlbyname(name, &value, &size, nullptr, 0)) {
+        return def;
+      }
+
+      return value;
+    }
+  }  // namespace
+
+  std::vector<cpu_t> cpu_topology() {
+    std::vector<cpu_t> cpus;
+
+    // Apple Silicon lists its performance levels from the fastest, each level being a cluster of cores
+    auto perf_levels = sysctl_int("hw.nperflevels", 1);
+    for (int level = 0; level < perf_levels; ++level) {
+      auto prefix = "hw.perflevel"s + std::to_string(level);
+      auto logical = sysctl_int((prefix + ".logicalcpu").c_str(), level == 0 ? sysctl_int("hw.logicalcpu", 1) : 0);
+      auto physical = sysctl_int((prefix + ".physicalcpu").c_str(), level == 0 ? sysctl_int("hw.physicalcpu", logical) : logical);
+      auto threads_per_core = std::max(1, logical / std::max(1, physical));
+
+      auto first = (int) cpus.size();
+      for (int x = 0; x < logical; ++x) {
+        auto id = first + x;
+        cpus.emplace_back(cpu_t {id, first + x / threads_per_core, first, level > 0});
+      }
+    }
+
+    return cpus;
+  }
+
+  std::optional<int> gpu_numa_node(const std::string &adapter_name) {
+    // Macs have a single node
+    return std::nullopt;
+  }
+
+  std::optional<int> interface_numa_node(const std::string_view &address) {
+    return std::nullopt;
+  }
+
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    auto topology = cpu_topology();
+
+    // Threads can't be pinned, but the QoS class steers them towards performance or efficiency cores
+    auto efficiency = std::all_of(std::begin(cpus), std::end(cpus), [&topology](int id) {
+      return id >= 0 && (std::size_t) id < topology.size() && topology[id].efficiency;
+    });
+
+    if (pthread_set_qos_class_self_np(efficiency ? QOS_CLASS_UTILITY : QOS_CLASS_USER_INTERACTIVE, 0)) {
+      BOOST_LOG(warning) << "pthread_set_qos_class_self_np() failed: "sv << errno;
+      return false;
+    }
+
+    return true;
+  }
+
+  std::vector<int> thread_affinity() {
+    // The scheduler doesn't tell where a thread may run
+    return {};
+  }
+
+  bool set_thread_realtime(int priority) {
+    // Unimplemented
+    return false;
+  }
+
+  namespace {
+    /**
+     * @brief A thread sampled through its Mach port.
+     */
+    class mach_thread_t: public thread_handle_t {
+    public:
+      mach_thread_t():
+          _thread {mach_thread_self()} {
+      }
+
+      ~mach_thread_t() override {
+        mach_port_deallocate(mach_task_self(), _thread);
+      }
+
+      std::optional<thread_times_t> times() override {
+        thread_basic_info_data_t info;
+        mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+        if (thread_info(_thread, THREAD_BASIC_INFO, (thread_info_t) &info, &count) != KERN_SUCCESS) {
+          return std::nullopt;
+        }
+
+        auto to_us = [](time_value_t time) {
+          return (std::int64_t) time.seconds * 1000000 + time.microseconds;
+        };
+
+        // The scheduling of a thread isn't told
+        thread_times_t times {};
+        times.cpu_time = std::chrono::microseconds {to_us(info.user_time) + to_us(info.system_time)};
+        return times;
+      }
+
+    private:
+      mach_port_t _thread;
+    };
+  }  // namespace
+
+  std::unique_ptr<thread_handle_t> current_thread() {
+    return std::make_unique<mach_thread_t>();
+  }
+
+  std::optional<pages_t> map_pages(std::size_t size, bool lock) {
+    // Superpages can't be asked for on Apple silicon, and 16 KiB pages take most of the pressure off the TLB there
+    auto data = (std::uint8_t *) mmap(nullptr, std::max<std::size_t>(size, 1), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (data == MAP_FAILED) {
+      BOOST_LOG(warning) << "mmap() failed: "sv << errno;
+      return std::nullopt;
+    }
+
+    pages_t pages {data, std::max<std::size_t>(size, 1), false, false};
+    if (lock) {
+      // Locking also faults every page in
+      pages.locked = !mlock(data, pages.size);
+      if (!pages.locked) {
+        BOOST_LOG(warning) << "mlock() failed: "sv << errno;
+      }
+    }
+
+    if (!pages.locked) {
+      for (std::size_t offset = 0; offset < pages.size; offset += 4096) {
+        data[offset] = 0;
+      }
+    }
+
+    return pages;
+  }
+
+  void unmap_pages(const pages_t &pages) {
+    munmap(pages.data, pages.size);
+  }
+
+  page_faults_t page_faults() {
+    rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage)) {
+      return {};
+    }
+
+    return {(std::uint64_t) usage.ru_minflt, (std::uint64_t) usage.ru_majflt};
+  }
+
   void streaming_will_start() {
     // Nothing to do
   }
@@ -301,6 +458,11 @@ namespace platf {
     return false;
   }
 
+  bool enable_socket_txtime(std::uintptr_t native_socket) {
+    // macOS has no launch times, Sunshine paces the packets itself
+    return false;
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -438,6 +600,15 @@ namespace platf {
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
    */
+  std::optional<std::uintptr_t> open_stream_socket(bool v6) {
+    return std::nullopt;
+  }
+
+  std::optional<int> path_mtu(const boost::asio::ip::address &address, uint16_t port) {
+    // The path MTU can't be read from a socket
+    return std::nullopt;
+  }
+
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging) {
     int sockfd = (int) native_socket;
     std::vector<std::tuple<int, int, int>> reset_options;
@@ -507,6 +678,88 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  // There is no eventfd on macOS, so the waiter is woken through a pipe
+  int recv_batch(batched_recv_info_t &recv_info) {
+    int received = 0;
+    for (; received < recv_info.count; ++received) {
+      socklen_t namelen = (socklen_t) recv_info.peers[received].capacity();
+      auto bytes = recvfrom((int) recv_info.native_socket, recv_info.buffers + received * recv_info.buffer_size, recv_info.buffer_size, MSG_DONTWAIT, recv_info.peers[received].data(), &namelen);
+      if (bytes < 0) {
+        // ICMP errors from earlier sends don't mean the socket is broken
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) {
+          break;
+        }
+
+        BOOST_LOG(warning) << "recvfrom() failed: "sv << errno;
+        return received ? received : -1;
+      }
+
+      recv_info.sizes[received] = bytes;
+      recv_info.peers[received].resize(namelen);
+    }
+
+    if (recv_info.receive_times) {
+      std::fill_n(recv_info.receive_times, received, std::chrono::steady_clock::now());
+    }
+
+    return received;
+  }
+
+  bool enable_socket_rx_timestamps(std::uintptr_t native_socket) {
+    // Datagrams are stamped with the time they're read instead
+    return false;
+  }
+
+  class pipe_socket_waiter_t: public socket_waiter_t {
+  public:
+    pipe_socket_waiter_t(int sockfd, std::array<int, 2> pipefd):
+        sockfd {sockfd},
+        pipefd {pipefd} {
+    }
+
+    ~pipe_socket_waiter_t() override {
+      close(pipefd[0]);
+      close(pipefd[1]);
+    }
+
+    void wait(std::chrono::milliseconds timeout) override {
+      std::array<pollfd, 2> fds {{
+        {sockfd, POLLIN, 0},
+        {pipefd[0], POLLIN, 0},
+      }};
+
+      if (poll(fds.data(), fds.size(), (int) timeout.count()) > 0 && (fds[1].revents & POLLIN)) {
+        std::array<char, 64> buffer;
+        while (read(pipefd[0], buffer.data(), buffer.size()) > 0);
+      }
+    }
+
+    void wake() override {
+      // A full pipe already wakes the waiter up, so a failed write loses nothing
+      char byte = 0;
+      (void) write(pipefd[1], &byte, 1);
+    }
+
+  private:
+    int sockfd;
+    std::array<int, 2> pipefd;
+  };
+
+  std::unique_ptr<socket_waiter_t> make_socket_waiter(std::uintptr_t native_socket) {
+    std::array<int, 2> pipefd;
+    if (pipe(pipefd.data())) {
+      BOOST_LOG(error) << "Couldn't create pipe: "sv << errno;
+      return nullptr;
+    }
+
+    for (auto fd : pipefd) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return std::make_unique<pipe_socket_waiter_t>((int) native_socket, pipefd);
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
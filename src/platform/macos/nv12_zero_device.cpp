@@ -8,6 +8,7 @@
 // local includes
 #include "src/platform/macos/av_img_t.h"
 #include "src/platform/macos/nv12_zero_device.h"
+#include "src/platform/macos/vt_encoder.h"
 #include "src/video.h"
 
 extern "C" {
@@ -68,4 +69,43 @@ namespace platf {
     return 0;
   }
 
+  vt_zero_device::~vt_zero_device() = default;
+
+  int vt_zero_device::init(void *display, pix_fmt_e pix_fmt, nv12_zero_device::resolution_fn_t resolution_fn, const nv12_zero_device::pixel_format_fn_t &pixel_format_fn) {
+    pixel_format = pix_fmt == pix_fmt_e::nv12 ? kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange : kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange;
+    pixel_format_fn(display, pixel_format);
+
+    this->display = display;
+    this->resolution_fn = std::move(resolution_fn);
+
+    data = this;
+
+    return 0;
+  }
+
+  bool vt_zero_device::init_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace) {
+    // The capture scales to the size of the stream, so its buffers go to the session as they are
+    resolution_fn(display, client_config.width, client_config.height);
+
+    encoder = std::make_unique<vt::vt_encoder>();
+    if (!encoder->create_encoder(client_config, colorspace, pixel_format)) {
+      encoder.reset();
+      return false;
+    }
+
+    vt = encoder.get();
+    return true;
+  }
+
+  int vt_zero_device::convert(platf::img_t &img) {
+    auto *av_img = (av_img_t *) &img;
+    if (!encoder || !av_img->pixel_buffer) {
+      return -1;
+    }
+
+    encoder->set_input(img);
+
+    return 0;
+  }
+
 }  // namespace platf
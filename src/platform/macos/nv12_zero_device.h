@@ -4,6 +4,10 @@
  */
 #pragma once
 
+// standard includes
+#include <cstdint>
+#include <memory>
+
 // local includes
 #include "src/platform/common.h"
 
@@ -33,4 +37,26 @@ namespace platf {
     util::safe_ptr<AVFrame, free_frame> av_frame;
   };
 
+  /**
+   * @brief Hands the captured pixel buffers to a VideoToolbox compression session of our own instead of to FFmpeg.
+   */
+  class vt_zero_device: public vt_encode_device_t {
+    // display holds a pointer to an av_video object, see nv12_zero_device
+    void *display;
+
+  public:
+    ~vt_zero_device() override;
+
+    int init(void *display, pix_fmt_e pix_fmt, nv12_zero_device::resolution_fn_t resolution_fn, const nv12_zero_device::pixel_format_fn_t &pixel_format_fn);
+
+    bool init_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace) override;
+
+    int convert(img_t &img) override;
+
+  private:
+    nv12_zero_device::resolution_fn_t resolution_fn;
+    std::uint32_t pixel_format = 0;
+    std::unique_ptr<vt::vt_encoder> encoder;
+  };
+
 }  // namespace platf
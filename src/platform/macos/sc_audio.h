@@ -0,0 +1,42 @@
+/**
+ * @file src/platform/macos/sc_audio.h
+ * @brief Declarations for system audio capture with ScreenCaptureKit on macOS.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+
+// platform includes
+#import <ScreenCaptureKit/ScreenCaptureKit.h>
+
+// lib includes
+#include "third-party/TPCircularBuffer/TPCircularBuffer.h"
+
+// local includes
+#include "src/logging.h"
+
+/**
+ * @brief Captures the audio of the whole system, without a loopback device.
+ * @details Samples are interleaved straight into the ring buffer as they arrive, so reading them
+ *          out of it is the only other copy.
+ */
+API_AVAILABLE(macos(13.0))
+@interface SCAudio: NSObject <SCStreamOutput> {
+@public
+  TPCircularBuffer audioSampleBuffer;
+  std::unique_ptr<logging::percentile_periodic_logger<double>> latencyLogger;
+  UInt8 channelCount;
+}
+
+@property (nonatomic, assign) SCStream *stream;
+@property (nonatomic, assign) NSCondition *samplesArrivedSignal;
+
+/**
+ * @brief Check if ScreenCaptureKit can capture audio on this system.
+ */
++ (BOOL)isAvailable;
+
+- (int)setupWithSampleRate:(UInt32)sampleRate channels:(UInt8)channels;
+
+@end
@@ -0,0 +1,176 @@
+/**
+ * @file src/platform/macos/sc_audio.mm
+ * @brief Definitions for system audio capture with ScreenCaptureKit on macOS.
+ */
+// standard includes
+#include <array>
+
+// local includes
+#include "src/metrics.h"
+#include "src/utility.h"
+#import "sc_audio.h"
+
+#define kBufferLength 4096
+
+using namespace std::literals;
+
+@implementation SCAudio
+
++ (BOOL)isAvailable {
+  return [[NSProcessInfo processInfo] isOperatingSystemAtLeastVersion:((NSOperatingSystemVersion) {13, 0, 0})];
+}
+
+- (void)dealloc {
+  if (self.stream) {
+    // Wait for the capture to stop, so no more samples come in while the buffer is freed
+    dispatch_semaphore_t stopped = dispatch_semaphore_create(0);
+    [self.stream stopCaptureWithCompletionHandler:^(NSError *stopError) {
+      dispatch_semaphore_signal(stopped);
+    }];
+    dispatch_semaphore_wait(stopped, DISPATCH_TIME_FOREVER);
+
+    [self.stream release];
+  }
+
+  // make sure nothing gets stuck on this signal
+  [self.samplesArrivedSignal signal];
+  [self.samplesArrivedSignal release];
+  TPCircularBufferCleanup(&audioSampleBuffer);
+  [super dealloc];
+}
+
+- (int)setupWithSampleRate:(UInt32)sampleRate channels:(UInt8)channels {
+  // A stream needs content to capture even if only its audio is used, so any display will do
+  __block SCShareableContent *content = nil;
+  __block NSError *captureError = nil;
+  dispatch_semaphore_t done = dispatch_semaphore_create(0);
+  [SCShareableContent getShareableContentWithCompletionHandler:^(SCShareableContent *shareableContent, NSError *contentError) {
+    content = [shareableContent retain];
+    captureError = [contentError retain];
+    dispatch_semaphore_signal(done);
+  }];
+  dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+
+  if (content == nil || content.displays.count == 0) {
+    BOOST_LOG(error) << "ScreenCaptureKit has no display to capture audio from: "sv << (captureError ? [captureError.localizedDescription UTF8String] : "no displays");
+    [content release];
+    [captureError release];
+    return -1;
+  }
+
+  SCContentFilter *filter = [[SCContentFilter alloc] initWithDisplay:content.displays.firstObject excludingWindows:@[]];
+  [content release];
+  [captureError release];
+  captureError = nil;
+
+  SCStreamConfiguration *configuration = [[SCStreamConfiguration alloc] init];
+  configuration.capturesAudio = YES;
+  configuration.excludesCurrentProcessAudio = YES;
+  configuration.sampleRate = sampleRate;
+
+  // Only stereo can be captured, any other channels are left silent
+  configuration.channelCount = MIN(channels, 2);
+
+  // Video can't be turned off, so make it as cheap as possible
+  configuration.width = 2;
+  configuration.height = 2;
+  configuration.minimumFrameInterval = CMTimeMake(1, 1);
+
+  self.stream = [[SCStream alloc] initWithFilter:filter configuration:configuration delegate:nil];
+  [filter release];
+  [configuration release];
+
+  channelCount = channels;
+  latencyLogger = std::make_unique<logging::percentile_periodic_logger<double>>(debug, "Audio: ScreenCaptureKit capture latency", "ms", 20s, &metrics::audio.capture_latency_recent_seconds);
+
+  self.samplesArrivedSignal = [[NSCondition alloc] init];
+  TPCircularBufferInit(&self->audioSampleBuffer, kBufferLength * channels * sizeof(float));
+
+  dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
+  dispatch_queue_t recordingQueue = dispatch_queue_create("systemAudioSamplingQueue", qos);
+
+  if (![self.stream addStreamOutput:self type:SCStreamOutputTypeAudio sampleHandlerQueue:recordingQueue error:&captureError]) {
+    BOOST_LOG(error) << "Couldn't add ScreenCaptureKit audio output: "sv << [captureError.localizedDescription UTF8String];
+    return -1;
+  }
+
+  [self.stream startCaptureWithCompletionHandler:^(NSError *startError) {
+    captureError = [startError retain];
+    dispatch_semaphore_signal(done);
+  }];
+  dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+
+  if (captureError) {
+    BOOST_LOG(error) << "Couldn't start ScreenCaptureKit audio capture: "sv << [captureError.localizedDescription UTF8String];
+    [captureError release];
+    [self.stream release];
+    self.stream = nil;
+    return -1;
+  }
+
+  return 0;
+}
+
+- (void)stream:(SCStream *)stream didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer ofType:(SCStreamOutputType)type {
+  if (type != SCStreamOutputTypeAudio || !CMSampleBufferIsValid(sampleBuffer)) {
+    return;
+  }
+
+  // Room for a buffer per channel, since the samples may not be interleaved
+  struct {
+    AudioBufferList list;
+    std::array<AudioBuffer, 7> more;
+  } buffers;
+
+  CMBlockBufferRef blockBuffer = nullptr;
+  if (CMSampleBufferGetAudioBufferListWithRetainedBlockBuffer(sampleBuffer, nullptr, &buffers.list, sizeof(buffers), nullptr, nullptr, 0, &blockBuffer) != noErr) {
+    return;
+  }
+  auto release_block = util::fail_guard([&]() {
+    CFRelease(blockBuffer);
+  });
+
+  // Find where each channel starts and how far apart its samples are
+  std::array<const float *, 8> sources {};
+  std::array<UInt32, 8> strides {};
+  int sourceChannels = 0;
+  for (UInt32 b = 0; b < buffers.list.mNumberBuffers; ++b) {
+    auto &buffer = buffers.list.mBuffers[b];
+    for (UInt32 c = 0; c < buffer.mNumberChannels && sourceChannels < sources.size(); ++c, ++sourceChannels) {
+      sources[sourceChannels] = (const float *) buffer.mData + c;
+      strides[sourceChannels] = buffer.mNumberChannels;
+    }
+  }
+
+  auto frames = (UInt32) CMSampleBufferGetNumSamples(sampleBuffer);
+  auto bytes = frames * channelCount * sizeof(float);
+
+  uint32_t available = 0;
+  auto out = (float *) TPCircularBufferHead(&self->audioSampleBuffer, &available);
+  if (!out || available < bytes) {
+    // Nothing is reading the samples fast enough, so drop them rather than block the capture
+    return;
+  }
+
+  // Interleave the samples straight into the ring buffer
+  for (UInt32 x = 0; x < frames; ++x) {
+    for (int c = 0; c < channelCount; ++c) {
+      *out++ = c < sourceChannels ? sources[c][x * strides[c]] : 0.0f;
+    }
+  }
+
+  TPCircularBufferProduce(&self->audioSampleBuffer, bytes);
+
+  [self.samplesArrivedSignal lock];
+  [self.samplesArrivedSignal signal];
+  [self.samplesArrivedSignal unlock];
+
+  // The samples are timestamped on the host clock when the system mixed them
+  auto captured = CMSampleBufferGetPresentationTimeStamp(sampleBuffer);
+  if (CMTIME_IS_VALID(captured)) {
+    auto latency = CMTimeSubtract(CMClockGetTime(CMClockGetHostTimeClock()), captured);
+    latencyLogger->collect_and_log(CMTimeGetSeconds(latency) * 1000);
+  }
+}
+
+@end
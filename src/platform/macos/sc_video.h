@@ -0,0 +1,44 @@
+/**
+ * @file src/platform/macos/sc_video.h
+ * @brief Declarations for video capture with ScreenCaptureKit on macOS.
+ */
+#pragma once
+
+// platform includes
+#import <ScreenCaptureKit/ScreenCaptureKit.h>
+
+// local includes
+#import "av_video.h"
+
+/**
+ * @brief Captures a display with ScreenCaptureKit.
+ * @details Frames are delivered in IOSurface backed pixel buffers of the requested size and format,
+ *          which VideoToolbox encodes without copying them. Frames are only delivered when the display changed.
+ */
+API_AVAILABLE(macos(12.3))
+@interface SCVideo: NSObject <SCStreamOutput, SCStreamDelegate, VideoCapture>
+
+@property (nonatomic, assign) CGDirectDisplayID displayID;
+@property (nonatomic, assign) CMTime minFrameDuration;
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+@property (nonatomic, assign) int queueDepth;
+
+@property (nonatomic, assign) SCDisplay *display;
+@property (nonatomic, assign) SCStream *stream;
+@property (nonatomic, copy) FrameCallbackBlock frameCallback;
+@property (nonatomic, assign) dispatch_semaphore_t captureStopped;
+@property (nonatomic, assign) BOOL captureFailed;
+
+/**
+ * @brief Check if ScreenCaptureKit can capture video on this system.
+ */
++ (BOOL)isAvailable;
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@end
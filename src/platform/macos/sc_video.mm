@@ -0,0 +1,225 @@
+/**
+ * @file src/platform/macos/sc_video.mm
+ * @brief Definitions for video capture with ScreenCaptureKit on macOS.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "src/logging.h"
+#import "sc_video.h"
+
+using namespace std::literals;
+
+@implementation SCVideo
+
++ (BOOL)isAvailable {
+  return [[NSProcessInfo processInfo] isOperatingSystemAtLeastVersion:((NSOperatingSystemVersion) {12, 3, 0})];
+}
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate {
+  self = [super init];
+
+  __block SCShareableContent *content = nil;
+  __block NSError *contentError = nil;
+  dispatch_semaphore_t done = dispatch_semaphore_create(0);
+  [SCShareableContent getShareableContentWithCompletionHandler:^(SCShareableContent *shareableContent, NSError *error) {
+    content = [shareableContent retain];
+    contentError = [error retain];
+    dispatch_semaphore_signal(done);
+  }];
+  dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+  dispatch_release(done);
+
+  for (SCDisplay *display in content.displays) {
+    if (display.displayID == displayID) {
+      self.display = [display retain];
+      break;
+    }
+  }
+
+  if (!self.display) {
+    BOOST_LOG(error) << "ScreenCaptureKit can't capture display "sv << displayID << ": "sv << (contentError ? [contentError.localizedDescription UTF8String] : "not found");
+    [content release];
+    [contentError release];
+    [self release];
+    return nil;
+  }
+  [content release];
+  [contentError release];
+
+  CGDisplayModeRef mode = CGDisplayCopyDisplayMode(displayID);
+
+  self.displayID = displayID;
+  self.pixelFormat = kCVPixelFormatType_32BGRA;
+  self.frameWidth = (int) CGDisplayModeGetPixelWidth(mode);
+  self.frameHeight = (int) CGDisplayModeGetPixelHeight(mode);
+  self.minFrameDuration = CMTimeMake(1, frameRate);
+
+  // Captured images keep their surface until they're reused, so the stream needs more surfaces
+  // than the default of 3 to keep delivering frames at high frame rates
+  self.queueDepth = std::clamp(frameRate / 20, 4, 8);
+
+  CFRelease(mode);
+
+  return self;
+}
+
+- (void)dealloc {
+  if (self.stream) {
+    // Wait for the capture to stop, so no more frames are delivered to this object
+    dispatch_semaphore_t stopped = dispatch_semaphore_create(0);
+    [self.stream stopCaptureWithCompletionHandler:^(NSError *stopError) {
+      dispatch_semaphore_signal(stopped);
+    }];
+    dispatch_semaphore_wait(stopped, DISPATCH_TIME_FOREVER);
+    dispatch_release(stopped);
+
+    [self.stream release];
+  }
+
+  if (self.captureStopped) {
+    dispatch_release(self.captureStopped);
+  }
+
+  self.frameCallback = nil;
+  [self.display release];
+  [super dealloc];
+}
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight {
+  self.frameWidth = frameWidth;
+  self.frameHeight = frameHeight;
+}
+
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback {
+  @synchronized(self) {
+    SCContentFilter *filter = [[SCContentFilter alloc] initWithDisplay:self.display excludingWindows:@[]];
+
+    SCStreamConfiguration *configuration = [[SCStreamConfiguration alloc] init];
+    configuration.width = self.frameWidth;
+    configuration.height = self.frameHeight;
+    configuration.pixelFormat = self.pixelFormat;
+    configuration.minimumFrameInterval = self.minFrameDuration;
+    configuration.queueDepth = self.queueDepth;
+    configuration.showsCursor = YES;
+
+    SCStream *stream = [[SCStream alloc] initWithFilter:filter configuration:configuration delegate:self];
+    [filter release];
+    [configuration release];
+
+    dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
+    dispatch_queue_t recordingQueue = dispatch_queue_create("videoCaptureQueue", qos);
+
+    NSError *outputError = nil;
+    BOOL added = [stream addStreamOutput:self type:SCStreamOutputTypeScreen sampleHandlerQueue:recordingQueue error:&outputError];
+    dispatch_release(recordingQueue);
+
+    if (!added) {
+      BOOST_LOG(error) << "Couldn't add ScreenCaptureKit video output: "sv << [outputError.localizedDescription UTF8String];
+      [stream release];
+      return nil;
+    }
+
+    if (self.captureStopped) {
+      dispatch_release(self.captureStopped);
+    }
+    self.captureStopped = dispatch_semaphore_create(0);
+    self.captureFailed = NO;
+    self.frameCallback = frameCallback;
+    self.stream = stream;
+
+    __block NSError *startError = nil;
+    dispatch_semaphore_t started = dispatch_semaphore_create(0);
+    [stream startCaptureWithCompletionHandler:^(NSError *error) {
+      startError = [error retain];
+      dispatch_semaphore_signal(started);
+    }];
+    dispatch_semaphore_wait(started, DISPATCH_TIME_FOREVER);
+    dispatch_release(started);
+
+    if (startError) {
+      BOOST_LOG(error) << "Couldn't start ScreenCaptureKit video capture: "sv << [startError.localizedDescription UTF8String];
+      [startError release];
+      self.stream = nil;
+      self.frameCallback = nil;
+      [stream release];
+      return nil;
+    }
+
+    return self.captureStopped;
+  }
+}
+
+/**
+ * @brief Stop the stream without waiting for it, since this may be called from its own queue.
+ */
+- (void)stopCapture {
+  @synchronized(self) {
+    SCStream *stream = self.stream;
+    if (!stream) {
+      return;
+    }
+
+    self.stream = nil;
+    self.frameCallback = nil;
+
+    dispatch_semaphore_t stopped = self.captureStopped;
+    [stream stopCaptureWithCompletionHandler:^(NSError *stopError) {
+      [stream release];
+      dispatch_semaphore_signal(stopped);
+    }];
+  }
+}
+
+- (void)stream:(SCStream *)stream didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer ofType:(SCStreamOutputType)type {
+  if (type != SCStreamOutputTypeScreen || !CMSampleBufferIsValid(sampleBuffer)) {
+    return;
+  }
+
+  // Idle and blank frames carry no image, they only tell the display didn't change
+  CFArrayRef attachments = CMSampleBufferGetSampleAttachmentsArray(sampleBuffer, false);
+  if (!attachments || CFArrayGetCount(attachments) == 0) {
+    return;
+  }
+
+  NSDictionary *info = (NSDictionary *) CFArrayGetValueAtIndex(attachments, 0);
+  NSNumber *status = info[SCStreamFrameInfoStatus];
+  if (!status || status.integerValue != SCFrameStatusComplete) {
+    return;
+  }
+
+  // The stream may be stopped by the system while the callback runs
+  FrameCallbackBlock callback;
+  @synchronized(self) {
+    callback = [self.frameCallback retain];
+  }
+  if (callback == nil) {
+    return;
+  }
+
+  bool keepCapturing = callback(sampleBuffer);
+  [callback release];
+
+  if (!keepCapturing) {
+    [self stopCapture];
+  }
+}
+
+- (void)stream:(SCStream *)stream didStopWithError:(NSError *)error {
+  BOOST_LOG(error) << "ScreenCaptureKit stopped capturing the display: "sv << [error.localizedDescription UTF8String];
+
+  @synchronized(self) {
+    if (self.stream != stream) {
+      return;
+    }
+
+    self.stream = nil;
+    self.frameCallback = nil;
+    self.captureFailed = YES;
+    [stream release];
+    dispatch_semaphore_signal(self.captureStopped);
+  }
+}
+
+@end
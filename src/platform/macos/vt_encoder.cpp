@@ -0,0 +1,422 @@
+/**
+ * @file src/platform/macos/vt_encoder.cpp
+ * @brief Definitions for the standalone VideoToolbox encoder on macOS.
+ */
+// standard includes
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// platform includes
+#include <VideoToolbox/VideoToolbox.h>
+
+// local includes
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/platform/macos/av_img_t.h"
+#include "src/platform/macos/vt_encoder.h"
+
+namespace vt {
+  namespace {
+    constexpr uint8_t START_CODE[] {0, 0, 0, 1};
+
+    /**
+     * @brief Releases a Core Foundation object when it goes out of scope.
+     */
+    template<class T>
+    class cf_t {
+    public:
+      explicit cf_t(T ref):
+          ref {ref} {
+      }
+
+      ~cf_t() {
+        if (ref) {
+          CFRelease(ref);
+        }
+      }
+
+      cf_t(const cf_t &) = delete;
+      cf_t &operator=(const cf_t &) = delete;
+
+      operator T() const {
+        return ref;
+      }
+
+    private:
+      T ref;
+    };
+
+    cf_t<CFNumberRef> number(int64_t value) {
+      return cf_t {CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &value)};
+    }
+
+    cf_t<CFNumberRef> number(double value) {
+      return cf_t {CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &value)};
+    }
+
+    cf_t<CFMutableDictionaryRef> dictionary() {
+      return cf_t {CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks)};
+    }
+
+    bool set_property(VTCompressionSessionRef session, CFStringRef key, CFTypeRef value) {
+      auto status = VTSessionSetProperty(session, key, value);
+      if (status != noErr) {
+        auto name = CFStringGetCStringPtr(key, kCFStringEncodingUTF8);
+        BOOST_LOG(warning) << "VideoToolbox: couldn't set "sv << (name ? name : "session property") << ": "sv << status;
+        return false;
+      }
+
+      return true;
+    }
+
+    struct color_keys_t {
+      CFStringRef primaries;
+      CFStringRef transfer_function;
+      CFStringRef matrix;
+    };
+
+    color_keys_t color_keys(const video::sunshine_colorspace_t &colorspace) {
+      switch (colorspace.colorspace) {
+        case video::colorspace_e::rec601:
+          return {kCVImageBufferColorPrimaries_SMPTE_C, kCVImageBufferTransferFunction_ITU_R_709_2, kCVImageBufferYCbCrMatrix_ITU_R_601_4};
+        case video::colorspace_e::bt2020sdr:
+          return {kCVImageBufferColorPrimaries_ITU_R_2020, kCVImageBufferTransferFunction_ITU_R_2020, kCVImageBufferYCbCrMatrix_ITU_R_2020};
+        case video::colorspace_e::bt2020:
+          return {kCVImageBufferColorPrimaries_ITU_R_2020, kCVImageBufferTransferFunction_SMPTE_ST_2084_PQ, kCVImageBufferYCbCrMatrix_ITU_R_2020};
+        case video::colorspace_e::rec709:
+        default:
+          return {kCVImageBufferColorPrimaries_ITU_R_709_2, kCVImageBufferTransferFunction_ITU_R_709_2, kCVImageBufferYCbCrMatrix_ITU_R_709_2};
+      }
+    }
+
+    bool is_sync_sample(CMSampleBufferRef sample_buffer) {
+      auto attachments = CMSampleBufferGetSampleAttachmentsArray(sample_buffer, false);
+      if (!attachments || CFArrayGetCount(attachments) == 0) {
+        return true;
+      }
+
+      auto attachment = (CFDictionaryRef) CFArrayGetValueAtIndex(attachments, 0);
+      auto not_sync = (CFBooleanRef) CFDictionaryGetValue(attachment, kCMSampleAttachmentKey_NotSync);
+      return !not_sync || !CFBooleanGetValue(not_sync);
+    }
+
+    std::size_t nal_size(const uint8_t *data, int header_length) {
+      std::size_t size = 0;
+      for (int x = 0; x < header_length; ++x) {
+        size = (size << 8) | data[x];
+      }
+
+      return size;
+    }
+  }  // namespace
+
+  struct vt_encoder::session_t {
+    ~session_t() {
+      if (ref) {
+        VTCompressionSessionCompleteFrames(ref, kCMTimeInvalid);
+        VTCompressionSessionInvalidate(ref);
+        CFRelease(ref);
+      }
+
+      if (input) {
+        CVPixelBufferRelease(input);
+      }
+
+      if (output) {
+        CFRelease(output);
+      }
+    }
+
+    static void on_output(void *session, void *frame, OSStatus status, VTEncodeInfoFlags flags, CMSampleBufferRef sample_buffer) {
+      auto self = (session_t *) session;
+
+      std::lock_guard lg {self->output_lock};
+      if (self->output) {
+        CFRelease(self->output);
+      }
+      self->output = sample_buffer ? (CMSampleBufferRef) CFRetain(sample_buffer) : nullptr;
+      self->output_status = status;
+    }
+
+    bool set_rate_control(uint32_t bitrate) {
+      if (framerate <= 0) {
+        return false;
+      }
+
+      // A data rate limit spanning a single frame keeps every frame close to the average, like a VBV buffer of one frame
+      auto frame_bytes = number((double) bitrate * 1000 / 8 / framerate);
+      auto frame_duration = number(1.0 / framerate);
+      CFTypeRef limits[] {frame_bytes, frame_duration};
+      cf_t data_rate_limits {CFArrayCreate(kCFAllocatorDefault, limits, 2, &kCFTypeArrayCallBacks)};
+
+      return set_property(ref, kVTCompressionPropertyKey_AverageBitRate, number((int64_t) bitrate * 1000)) &&
+             set_property(ref, kVTCompressionPropertyKey_DataRateLimits, data_rate_limits);
+    }
+
+    VTCompressionSessionRef ref = nullptr;
+    CVPixelBufferRef input = nullptr;
+    CMVideoCodecType codec_type = 0;
+    int framerate = 0;
+
+    // The output callback runs on a thread of the session while encode_frame() waits for it
+    std::mutex output_lock;
+    CMSampleBufferRef output = nullptr;
+    OSStatus output_status = noErr;
+  };
+
+  vt_encoder::vt_encoder() = default;
+
+  vt_encoder::~vt_encoder() = default;
+
+  bool vt_encoder::create_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace, std::uint32_t pixel_format) {
+    if (session) {
+      BOOST_LOG(error) << "VideoToolbox: encoder is already created"sv;
+      return false;
+    }
+
+    auto new_session = std::make_unique<session_t>();
+    auto &codec_type = new_session->codec_type;
+    switch (client_config.videoFormat) {
+      case 0:
+        codec_type = kCMVideoCodecType_H264;
+        break;
+      case 1:
+        codec_type = kCMVideoCodecType_HEVC;
+        break;
+      default:
+        BOOST_LOG(error) << "VideoToolbox: the native session only encodes H.264 and HEVC"sv;
+        return false;
+    }
+
+    if (client_config.chromaSamplingType != 0) {
+      BOOST_LOG(error) << "VideoToolbox: the native session doesn't encode YUV 4:4:4"sv;
+      return false;
+    }
+
+    new_session->framerate = client_config.framerate;
+
+    auto specification = dictionary();
+    if (__builtin_available(macOS 11.3, *)) {
+      // Frames are sized to the rate on their own, without waiting on the next ones, and never reordered
+      CFDictionarySetValue(specification, kVTVideoEncoderSpecification_EnableLowLatencyRateControl, kCFBooleanTrue);
+    }
+    if (config::video.vt.vt_require_sw) {
+      CFDictionarySetValue(specification, kVTVideoEncoderSpecification_EnableHardwareAcceleratedVideoEncoder, kCFBooleanFalse);
+    } else if (!config::video.vt.vt_allow_sw) {
+      CFDictionarySetValue(specification, kVTVideoEncoderSpecification_RequireHardwareAcceleratedVideoEncoder, kCFBooleanTrue);
+    }
+
+    // The session takes the IOSurface backed buffers of the capture pool without copying them
+    auto source_attributes = dictionary();
+    auto io_surface_properties = dictionary();
+    CFDictionarySetValue(source_attributes, kCVPixelBufferPixelFormatTypeKey, number((int64_t) pixel_format));
+    CFDictionarySetValue(source_attributes, kCVPixelBufferWidthKey, number((int64_t) client_config.width));
+    CFDictionarySetValue(source_attributes, kCVPixelBufferHeightKey, number((int64_t) client_config.height));
+    CFDictionarySetValue(source_attributes, kCVPixelBufferIOSurfacePropertiesKey, io_surface_properties);
+
+    auto &ref = new_session->ref;
+    auto status = VTCompressionSessionCreate(kCFAllocatorDefault, client_config.width, client_config.height, codec_type, specification, source_attributes, kCFAllocatorDefault, session_t::on_output, new_session.get(), &ref);
+    if (status != noErr && CFDictionaryContainsKey(specification, kVTVideoEncoderSpecification_EnableLowLatencyRateControl)) {
+      // Older releases only run the low latency rate control for H.264
+      BOOST_LOG(warning) << "VideoToolbox: couldn't create a session with low latency rate control: "sv << status;
+      CFDictionaryRemoveValue(specification, kVTVideoEncoderSpecification_EnableLowLatencyRateControl);
+      status = VTCompressionSessionCreate(kCFAllocatorDefault, client_config.width, client_config.height, codec_type, specification, source_attributes, kCFAllocatorDefault, session_t::on_output, new_session.get(), &ref);
+    }
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't create compression session: "sv << status;
+      ref = nullptr;
+      return false;
+    }
+
+    set_property(ref, kVTCompressionPropertyKey_RealTime, config::video.vt.vt_realtime ? kCFBooleanTrue : kCFBooleanFalse);
+    set_property(ref, kVTCompressionPropertyKey_AllowFrameReordering, kCFBooleanFalse);
+    set_property(ref, kVTCompressionPropertyKey_MaxFrameDelayCount, number((int64_t) 0));
+    set_property(ref, kVTCompressionPropertyKey_ExpectedFrameRate, number((int64_t) client_config.framerate));
+    if (__builtin_available(macOS 13.0, *)) {
+      set_property(ref, kVTCompressionPropertyKey_PrioritizeEncodingSpeedOverQuality, kCFBooleanTrue);
+    }
+
+    if (codec_type == kCMVideoCodecType_H264) {
+      set_property(ref, kVTCompressionPropertyKey_ProfileLevel, kVTProfileLevel_H264_High_AutoLevel);
+      if (config::video.vt.vt_coder == 1) {
+        set_property(ref, kVTCompressionPropertyKey_H264EntropyMode, kVTH264EntropyMode_CABAC);
+      } else if (config::video.vt.vt_coder == 2) {
+        set_property(ref, kVTCompressionPropertyKey_H264EntropyMode, kVTH264EntropyMode_CAVLC);
+      }
+    } else {
+      set_property(ref, kVTCompressionPropertyKey_ProfileLevel, colorspace.bit_depth == 10 ? kVTProfileLevel_HEVC_Main10_AutoLevel : kVTProfileLevel_HEVC_Main_AutoLevel);
+    }
+
+    auto colors = color_keys(colorspace);
+    set_property(ref, kVTCompressionPropertyKey_ColorPrimaries, colors.primaries);
+    set_property(ref, kVTCompressionPropertyKey_TransferFunction, colors.transfer_function);
+    set_property(ref, kVTCompressionPropertyKey_YCbCrMatrix, colors.matrix);
+
+    if (!new_session->set_rate_control(client_config.bitrate)) {
+      return false;
+    }
+
+    status = VTCompressionSessionPrepareToEncodeFrames(ref);
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't prepare compression session: "sv << status;
+      return false;
+    }
+
+    BOOST_LOG(info) << "VideoToolbox: created native "sv << (codec_type == kCMVideoCodecType_H264 ? "H.264"sv : "HEVC"sv) << " session"sv;
+    session = std::move(new_session);
+    return true;
+  }
+
+  void vt_encoder::destroy_encoder() {
+    session.reset();
+  }
+
+  void vt_encoder::set_input(platf::img_t &img) {
+    auto &av_img = (platf::av_img_t &) img;
+    if (!session || !av_img.pixel_buffer) {
+      return;
+    }
+
+    auto pixel_buffer = CVPixelBufferRetain(av_img.pixel_buffer->buf);
+    if (session->input) {
+      CVPixelBufferRelease(session->input);
+    }
+    session->input = pixel_buffer;
+  }
+
+  std::optional<vt_encoded_frame> vt_encoder::encode_frame(uint64_t frame_index, bool force_idr) {
+    if (!session || !session->input) {
+      return std::nullopt;
+    }
+
+    auto ref = session->ref;
+    auto codec_type = session->codec_type;
+
+    auto frame_properties = dictionary();
+    if (force_idr) {
+      CFDictionarySetValue(frame_properties, kVTEncodeFrameOptionKey_ForceKeyFrame, kCFBooleanTrue);
+    }
+
+    auto pts = CMTimeMake((int64_t) frame_index, session->framerate);
+    auto status = VTCompressionSessionEncodeFrame(ref, session->input, pts, kCMTimeInvalid, frame_properties, nullptr, nullptr);
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't encode frame: "sv << status;
+      return std::nullopt;
+    }
+
+    // Without a frame delay the session emits the frame right away, this only waits for the callback
+    status = VTCompressionSessionCompleteFrames(ref, pts);
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't complete frame: "sv << status;
+      return std::nullopt;
+    }
+
+    CMSampleBufferRef sample_buffer;
+    {
+      std::lock_guard lg {session->output_lock};
+      sample_buffer = std::exchange(session->output, nullptr);
+      status = session->output_status;
+    }
+    cf_t sample {sample_buffer};
+
+    if (status != noErr) {
+      BOOST_LOG(error) << "VideoToolbox: frame failed to encode: "sv << status;
+      return std::nullopt;
+    }
+
+    vt_encoded_frame encoded_frame;
+    encoded_frame.frame_index = frame_index;
+    if (!sample_buffer) {
+      BOOST_LOG(debug) << "VideoToolbox: dropped frame "sv << frame_index;
+      return encoded_frame;
+    }
+
+    auto block_buffer = CMSampleBufferGetDataBuffer(sample_buffer);
+    auto length = CMBlockBufferGetDataLength(block_buffer);
+
+    char *data = nullptr;
+    std::size_t contiguous_length = 0;
+    std::vector<char> copy;
+    if (CMBlockBufferGetDataPointer(block_buffer, 0, &contiguous_length, nullptr, &data) != kCMBlockBufferNoErr || contiguous_length < length) {
+      copy.resize(length);
+      if (CMBlockBufferCopyDataBytes(block_buffer, 0, length, copy.data()) != kCMBlockBufferNoErr) {
+        BOOST_LOG(error) << "VideoToolbox: couldn't read encoded frame"sv;
+        return std::nullopt;
+      }
+      data = copy.data();
+    }
+
+    encoded_frame.idr = is_sync_sample(sample_buffer);
+
+    auto format = CMSampleBufferGetFormatDescription(sample_buffer);
+    auto get_parameter_set = codec_type == kCMVideoCodecType_H264 ? CMVideoFormatDescriptionGetH264ParameterSetAtIndex : CMVideoFormatDescriptionGetHEVCParameterSetAtIndex;
+
+    std::size_t parameter_set_count = 0;
+    int header_length = 0;
+    if (get_parameter_set(format, 0, nullptr, nullptr, &parameter_set_count, &header_length) != noErr || header_length < 1 || header_length > 4) {
+      BOOST_LOG(error) << "VideoToolbox: couldn't read parameter sets"sv;
+      return std::nullopt;
+    }
+
+    // The client expects Annex B, with the parameter sets ahead of every IDR frame, rather than length prefixed NAL units
+    auto for_each_nal = [&](auto &&on_nal) {
+      if (encoded_frame.idr) {
+        for (std::size_t x = 0; x < parameter_set_count; ++x) {
+          const uint8_t *parameter_set;
+          std::size_t parameter_set_size;
+          if (get_parameter_set(format, x, &parameter_set, &parameter_set_size, nullptr, nullptr) != noErr) {
+            return false;
+          }
+          on_nal(parameter_set, parameter_set_size);
+        }
+      }
+
+      auto bytes = (const uint8_t *) data;
+      for (std::size_t offset = 0; offset < length;) {
+        if (offset + header_length > length) {
+          return false;
+        }
+
+        auto size = nal_size(bytes + offset, header_length);
+        offset += header_length;
+        if (offset + size > length) {
+          return false;
+        }
+
+        on_nal(bytes + offset, size);
+        offset += size;
+      }
+
+      return true;
+    };
+
+    std::size_t annex_b_size = 0;
+    if (!for_each_nal([&](const uint8_t *, std::size_t size) {
+          annex_b_size += sizeof(START_CODE) + size;
+        })) {
+      BOOST_LOG(error) << "VideoToolbox: malformed encoded frame"sv;
+      return std::nullopt;
+    }
+
+    encoded_frame.data = buffer_pool::buffer_t<uint8_t> {annex_b_size};
+    auto next = encoded_frame.data.begin();
+    for_each_nal([&](const uint8_t *nal, std::size_t size) {
+      next = std::copy(std::begin(START_CODE), std::end(START_CODE), next);
+      next = std::copy_n(nal, size, next);
+    });
+
+    return encoded_frame;
+  }
+
+  bool vt_encoder::set_bitrate(uint32_t bitrate) {
+    if (!session || !session->set_rate_control(bitrate)) {
+      return false;
+    }
+
+    BOOST_LOG(debug) << "VideoToolbox: bitrate changed to "sv << bitrate << " kbps"sv;
+    return true;
+  }
+
+}  // namespace vt
@@ -0,0 +1,87 @@
+/**
+ * @file src/platform/macos/vt_encoder.h
+ * @brief Declarations for the standalone VideoToolbox encoder on macOS.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+// local includes
+#include "src/buffer_pool.h"
+#include "src/platform/common.h"
+#include "src/video.h"
+
+/**
+ * @brief Standalone VideoToolbox encoder
+ * @note The VideoToolbox headers stay out of this header, so platform independent code can include it
+ *       without the macros and types of the Apple headers.
+ */
+namespace vt {
+
+  /**
+   * @brief Encoded frame, in Annex B with the parameter sets ahead of IDR frames.
+   */
+  struct vt_encoded_frame {
+    buffer_pool::buffer_t<uint8_t> data;
+    uint64_t frame_index = 0;
+    bool idr = false;
+  };
+
+  /**
+   * @brief Encodes the captured pixel buffers with a compression session of its own instead of through FFmpeg.
+   * @details The session runs the low latency rate control, and emits every frame before the next one is submitted.
+   *          The IOSurface backed pixel buffers of the capture pool are handed to the session as they are.
+   */
+  class vt_encoder {
+  public:
+    vt_encoder();
+    ~vt_encoder();
+
+    vt_encoder(const vt_encoder &) = delete;
+    vt_encoder &operator=(const vt_encoder &) = delete;
+
+    /**
+     * @brief Create the compression session.
+     * @param client_config Stream configuration requested by the client.
+     * @param colorspace YUV colorspace.
+     * @param pixel_format The `OSType` of the pixel buffers the capture delivers.
+     * @return `true` on success, `false` on error
+     */
+    bool create_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace, std::uint32_t pixel_format);
+
+    /**
+     * @brief Destroy the compression session.
+     */
+    void destroy_encoder();
+
+    /**
+     * @brief Set the image the next frame is encoded from.
+     * @param img The captured image, whose pixel buffer is retained until the next one is set.
+     */
+    void set_input(platf::img_t &img);
+
+    /**
+     * @brief Encode the last image that was set.
+     * @param frame_index Frame index that uniquely identifies the frame.
+     * @param force_idr Whether to encode frame as forced IDR.
+     * @return Encoded frame, with empty data if the session dropped the frame, or `std::nullopt` on error.
+     */
+    std::optional<vt_encoded_frame> encode_frame(uint64_t frame_index, bool force_idr);
+
+    /**
+     * @brief Change the bitrate of the session without resetting it.
+     *        The data rate limit is scaled along with the bitrate, so it keeps spanning a single frame.
+     * @param bitrate The bitrate in kilobits per second.
+     * @return `true` on success, `false` on error.
+     */
+    bool set_bitrate(uint32_t bitrate);
+
+  private:
+    struct session_t;
+    std::unique_ptr<session_t> session;
+  };
+
+}  // namespace vt
@@ -5,6 +5,8 @@
 #define INITGUID
 
 // standard includes
+#include <array>
+#include <bit>
 #include <format>
 
 // platform includes
@@ -17,6 +19,7 @@
 
 // local includes
 #include "misc.h"
+#include "src/audio_samples.h"
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
@@ -217,6 +220,7 @@ namespace platf::audio {
   using device_t = util::safe_ptr<IMMDevice, Release<IMMDevice>>;
   using collection_t = util::safe_ptr<IMMDeviceCollection, Release<IMMDeviceCollection>>;
   using audio_client_t = util::safe_ptr<IAudioClient, Release<IAudioClient>>;
+  using audio_client3_t = util::safe_ptr<IAudioClient3, Release<IAudioClient3>>;
   using audio_capture_t = util::safe_ptr<IAudioCaptureClient, Release<IAudioCaptureClient>>;
   using wave_format_t = util::safe_ptr<WAVEFORMATEX, co_task_free<WAVEFORMATEX>>;
   using wstring_t = util::safe_ptr<WCHAR, co_task_free<WCHAR>>;
@@ -276,7 +280,100 @@ namespace platf::audio {
     },
   };
 
-  audio_client_t make_audio_client(device_t &device, const format_t &format) {
+  /**
+   * @brief Initialize a loopback client on the smallest engine period the device supports.
+   * @details The period is only reduced when the mixer already runs at the capture sample rate,
+   *          since the smaller periods can't be combined with the automatic resampling.
+   * @param device The device to capture from.
+   * @param capture_waveformat The format to capture in.
+   * @param mixer_sample_rate The sample rate of the mixer.
+   * @return The initialized client, or `nullptr` to fall back to the default period.
+   */
+  audio_client_t make_low_latency_audio_client(device_t &device, WAVEFORMATEX *capture_waveformat, DWORD mixer_sample_rate) {
+    if (mixer_sample_rate != SAMPLE_RATE) {
+      return nullptr;
+    }
+
+    audio_client3_t audio_client;
+    auto status = device->Activate(
+      __uuidof(IAudioClient3),
+      CLSCTX_ALL,
+      nullptr,
+      (void **) &audio_client
+    );
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "IAudioClient3 isn't available: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    UINT32 default_period, fundamental_period, min_period, max_period;
+    status = audio_client->GetSharedModeEnginePeriod(capture_waveformat, &default_period, &fundamental_period, &min_period, &max_period);
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Couldn't get shared mode engine periods: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    if (min_period >= default_period) {
+      BOOST_LOG(debug) << "Audio device doesn't support engine periods below "sv << default_period << " frames"sv;
+      return nullptr;
+    }
+
+    status = audio_client->InitializeSharedAudioStream(
+      AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+      min_period,
+      capture_waveformat,
+      nullptr
+    );
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Couldn't initialize audio client with an engine period of "sv << min_period << " frames: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "Audio engine period is "sv << min_period << " frames instead of "sv << default_period << " frames"sv;
+
+    return audio_client_t {audio_client.release()};
+  }
+
+  /**
+   * @brief Find where each speaker Sunshine streams is in the channels of a capture format.
+   * @param channel_mask The speakers of the capture format.
+   * @param channel_count The number of channels.
+   * @return For each streamed channel, the captured channel it comes from.
+   */
+  std::array<std::uint8_t, 8> channel_order(DWORD channel_mask, int channel_count) {
+    // The speakers of speaker::map_surround71, with stand-ins for layouts that lack them
+    constexpr std::array<std::pair<DWORD, DWORD>, 8> speakers {{
+      {SPEAKER_FRONT_LEFT, SPEAKER_FRONT_LEFT},
+      {SPEAKER_FRONT_RIGHT, SPEAKER_FRONT_RIGHT},
+      {SPEAKER_FRONT_CENTER, SPEAKER_FRONT_CENTER},
+      {SPEAKER_LOW_FREQUENCY, SPEAKER_LOW_FREQUENCY},
+      {SPEAKER_BACK_LEFT, SPEAKER_SIDE_LEFT},
+      {SPEAKER_BACK_RIGHT, SPEAKER_SIDE_RIGHT},
+      {SPEAKER_SIDE_LEFT, SPEAKER_SIDE_LEFT},
+      {SPEAKER_SIDE_RIGHT, SPEAKER_SIDE_RIGHT},
+    }};
+
+    std::array<std::uint8_t, 8> order {0, 1, 2, 3, 4, 5, 6, 7};
+    if (channel_count != std::popcount(channel_mask)) {
+      return order;
+    }
+
+    // Channels are interleaved in the order of their speaker bits
+    for (int x = 0; x < channel_count; ++x) {
+      auto [speaker, stand_in] = speakers[x];
+      auto bit = (channel_mask & speaker) ? speaker : stand_in;
+      if (!(channel_mask & bit)) {
+        BOOST_LOG(warning) << "Unexpected audio channel mask [0x"sv << util::hex(channel_mask).to_string_view() << "], channels are captured as is"sv;
+        return {0, 1, 2, 3, 4, 5, 6, 7};
+      }
+
+      order[x] = std::popcount(channel_mask & (bit - 1));
+    }
+
+    return order;
+  }
+
+  audio_client_t make_audio_client(device_t &device, const format_t &format, DWORD &channel_mask) {
     audio_client_t audio_client;
     auto status = device->Activate(
       IID_IAudioClient,
@@ -294,6 +391,7 @@ namespace platf::audio {
     WAVEFORMATEXTENSIBLE capture_waveformat =
       create_waveformat(sample_format_e::f32, format.channel_count, format.capture_waveformat_channel_mask);
 
+    DWORD mixer_sample_rate;
     {
       wave_format_t mixer_waveformat;
       status = audio_client->GetMixFormat(&mixer_waveformat);
@@ -313,6 +411,14 @@ namespace platf::audio {
       BOOST_LOG(info) << "Audio mixer format is "sv << mixer_waveformat->wBitsPerSample << "-bit, "sv
                       << mixer_waveformat->nSamplesPerSec << " Hz, "sv
                       << ((mixer_waveformat->nSamplesPerSec != 48000) ? "will be resampled to 48000 by Windows"sv : "no resampling needed"sv);
+      mixer_sample_rate = mixer_waveformat->nSamplesPerSec;
+    }
+
+    channel_mask = capture_waveformat.dwChannelMask;
+
+    if (auto low_latency_client = make_low_latency_audio_client(device, (LPWAVEFORMATEX) &capture_waveformat, mixer_sample_rate)) {
+      BOOST_LOG(info) << "Audio capture format is "sv << logging::bracket(waveformat_to_pretty_string(capture_waveformat));
+      return low_latency_client;
     }
 
     status = audio_client->Initialize(
@@ -495,11 +601,13 @@ namespace platf::audio {
         }
 
         BOOST_LOG(debug) << "Trying audio format ["sv << format.name << ']';
-        audio_client = make_audio_client(device, format);
+        DWORD channel_mask;
+        audio_client = make_audio_client(device, format, channel_mask);
 
         if (audio_client) {
           BOOST_LOG(debug) << "Found audio format ["sv << format.name << ']';
           channels = channels_out;
+          order = channel_order(channel_mask, channels);
           break;
         }
       }
@@ -616,12 +724,13 @@ namespace platf::audio {
         status = audio_capture->GetNextPacketSize(&packet_size)
       ) {
         DWORD buffer_flags;
+        UINT64 qpc_position = 0;
         status = audio_capture->GetBuffer(
           (BYTE **) &sample_aligned.samples,
           &block_aligned.audio_sample_size,
           &buffer_flags,
           nullptr,
-          nullptr
+          &qpc_position
         );
 
         switch (status) {
@@ -634,6 +743,14 @@ namespace platf::audio {
             return capture_e::error;
         }
 
+        if (qpc_position && !(buffer_flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+          // The position of the first frame in the packet is in 100 ns units of the performance counter
+          capture_latency_logger.collect_and_log([&]() {
+            auto now = std::chrono::duration_cast<std::chrono::duration<std::int64_t, std::ratio<1, 10'000'000>>>(qpc_time_difference(qpc_counter(), 0));
+            return (now.count() - (std::int64_t) qpc_position) / 10'000.0;
+          });
+        }
+
         if (buffer_flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
           BOOST_LOG(debug) << "Audio capture signaled buffer discontinuity";
         }
@@ -648,7 +765,7 @@ namespace platf::audio {
         if (buffer_flags & AUDCLNT_BUFFERFLAGS_SILENT) {
           std::fill_n(sample_buf_pos, n, 0);
         } else {
-          std::copy_n(sample_aligned.samples, n, sample_buf_pos);
+          audio::samples::to_float(audio::samples::format_e::f32, sample_aligned.samples, sample_buf_pos, n / channels, channels, order.data());
         }
 
         sample_buf_pos += n;
@@ -683,9 +800,12 @@ namespace platf::audio {
     util::buffer_t<float> sample_buf;
     float *sample_buf_pos;
     int channels;
+    std::array<std::uint8_t, 8> order;
     bool continuous_audio;
 
     HANDLE mmcss_task_handle = nullptr;
+
+    logging::min_max_avg_periodic_logger<double> capture_latency_logger {debug, "Audio capture latency", "ms"};
   };
 
   class audio_control_t: public ::platf::audio_control_t {
@@ -4,6 +4,15 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
 // platform includes
 #include <d3d11.h>
 #include <d3d11_4.h>
@@ -15,6 +24,8 @@
 #include <winrt/windows.graphics.capture.h>
 
 // local includes
+#include "src/logging.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -26,6 +37,11 @@ namespace platf::dxgi {
   // You should have a debugger like WinDbg attached to receive debug messages.
   auto constexpr D3D11_CREATE_DEVICE_FLAGS = 0;
 
+  // The white level assumed for SDR content on HDR displays. We should really get
+  // the user's SDR white level in nits, but there is no API that provides that
+  // information to Win32 apps.
+  auto constexpr SDR_WHITE_NITS = 300.0f;
+
   template<class T>
   void Release(T *dxgi) {
     dxgi->Release();
@@ -36,6 +52,7 @@ namespace platf::dxgi {
   using dxgi1_t = util::safe_ptr<IDXGIDevice1, Release<IDXGIDevice1>>;
   using device_t = util::safe_ptr<ID3D11Device, Release<ID3D11Device>>;
   using device1_t = util::safe_ptr<ID3D11Device1, Release<ID3D11Device1>>;
+  using device3_t = util::safe_ptr<ID3D11Device3, Release<ID3D11Device3>>;
   using device_ctx_t = util::safe_ptr<ID3D11DeviceContext, Release<ID3D11DeviceContext>>;
   using adapter_t = util::safe_ptr<IDXGIAdapter1, Release<IDXGIAdapter1>>;
   using output_t = util::safe_ptr<IDXGIOutput, Release<IDXGIOutput>>;
@@ -50,10 +67,13 @@ namespace platf::dxgi {
   using multithread_t = util::safe_ptr<ID3D11Multithread, Release<ID3D11Multithread>>;
   using vs_t = util::safe_ptr<ID3D11VertexShader, Release<ID3D11VertexShader>>;
   using ps_t = util::safe_ptr<ID3D11PixelShader, Release<ID3D11PixelShader>>;
+  using cs_t = util::safe_ptr<ID3D11ComputeShader, Release<ID3D11ComputeShader>>;
   using blend_t = util::safe_ptr<ID3D11BlendState, Release<ID3D11BlendState>>;
   using input_layout_t = util::safe_ptr<ID3D11InputLayout, Release<ID3D11InputLayout>>;
   using render_target_t = util::safe_ptr<ID3D11RenderTargetView, Release<ID3D11RenderTargetView>>;
   using shader_res_t = util::safe_ptr<ID3D11ShaderResourceView, Release<ID3D11ShaderResourceView>>;
+  using uav_t = util::safe_ptr<ID3D11UnorderedAccessView1, Release<ID3D11UnorderedAccessView1>>;
+  using query_t = util::safe_ptr<ID3D11Query, Release<ID3D11Query>>;
   using buf_t = util::safe_ptr<ID3D11Buffer, Release<ID3D11Buffer>>;
   using raster_state_t = util::safe_ptr<ID3D11RasterizerState, Release<ID3D11RasterizerState>>;
   using sampler_state_t = util::safe_ptr<ID3D11SamplerState, Release<ID3D11SamplerState>>;
@@ -73,6 +93,13 @@ namespace platf::dxgi {
 
   class hwdevice_t;
 
+  /**
+   * @brief Check whether two adapter LUIDs refer to the same adapter.
+   */
+  inline bool is_same_adapter(const LUID &a, const LUID &b) {
+    return a.LowPart == b.LowPart && a.HighPart == b.HighPart;
+  }
+
   struct cursor_t {
     std::vector<std::uint8_t> img_data;
 
@@ -100,6 +127,9 @@ namespace platf::dxgi {
       this->texture = std::move(texture);
       this->texture_width = texture_width;
       this->texture_height = texture_height;
+
+      // Cursor textures are always BGRA
+      memory = {metrics::gpu_memory_t::cursor, (std::int64_t) texture_width * texture_height * 4};
       update_viewport();
     }
 
@@ -139,6 +169,7 @@ namespace platf::dxgi {
     texture2d_t texture;
     LONG texture_width;
     LONG texture_height;
+    metrics::gpu_allocation_t memory;
 
     LONG topleft_x;
     LONG topleft_y;
@@ -162,6 +193,7 @@ namespace platf::dxgi {
 
     factory1_t factory;
     adapter_t adapter;
+    adapter_t encode_adapter;  ///< The adapter the encoders run on, the same as `adapter` unless frames are copied across adapters
     output_t output;
     device_t device;
     device_ctx_t device_ctx;
@@ -180,6 +212,9 @@ namespace platf::dxgi {
 
     std::unique_ptr<high_precision_timer> timer = create_high_precision_timer();
 
+    // The time from the game presenting a frame until a paced capture picks it up
+    logging::percentile_periodic_logger<double> capture_age_logger {debug, "Frame capture age", "ms", std::chrono::seconds(20), &metrics::video.capture_latency_recent_seconds};
+
     typedef enum _D3DKMT_SCHEDULINGPRIORITYCLASS {
       D3DKMT_SCHEDULINGPRIORITYCLASS_IDLE,  ///< Idle priority class
       D3DKMT_SCHEDULINGPRIORITYCLASS_BELOW_NORMAL,  ///< Below normal priority class
@@ -258,8 +293,39 @@ namespace platf::dxgi {
 
     std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override;
 
+    bool img_in_system_memory() override {
+      return true;
+    }
+
+  protected:
+    /**
+     * @brief Create the staging textures for the capture format.
+     * @return 0 on success, -1 on failure.
+     */
+    int create_staging_textures();
+
+    /**
+     * @brief Start copying a captured texture to the next staging texture.
+     * @details The copy is submitted right away, so it runs while the capture thread gets an image to read it into.
+     */
+    void copy_to_staging(ID3D11Texture2D *src);
+
+    /**
+     * @brief Read the staging texture of the latest copy into an image.
+     * @details The staging texture is polled until the GPU finished the copy,
+     *          rather than blocking in the driver with the immediate context held.
+     * @return 0 on success, -1 on failure.
+     */
+    int read_staging(img_t *img);
+
+    // Enough staging textures that a new copy never targets one the driver may still be reading back from
+    static constexpr std::size_t STAGING_RING_SIZE = 3;
+
     D3D11_MAPPED_SUBRESOURCE img_info;
-    texture2d_t texture;
+    std::array<texture2d_t, STAGING_RING_SIZE> staging_textures;
+    std::size_t staging_index = 0;  ///< The staging texture of the latest copy
+
+    logging::percentile_periodic_logger<double> readback_wait_logger {debug, "D3D11: staging readback wait time", "ms", std::chrono::seconds(20), &metrics::video.readback_wait_recent_seconds};
   };
 
   /**
@@ -279,6 +345,14 @@ namespace platf::dxgi {
     std::unique_ptr<nvenc_encode_device_t> make_nvenc_encode_device(pix_fmt_e pix_fmt) override;
 
     std::atomic<uint32_t> next_image_id;
+
+  private:
+    bool check_codec_support(std::string_view name, const ::video::config_t &config);
+
+    // The outcome of check_codec_support() by codec name, video format, dynamic range and chroma sampling,
+    // which only changes with the adapter, so it lasts until the display is reinitialized
+    std::mutex codec_support_lock;
+    std::map<std::tuple<std::string, int, int, int>, bool> codec_support;
   };
 
   /**
@@ -295,7 +369,24 @@ namespace platf::dxgi {
     capture_e reset(dup_t::pointer dup_p = dup_t::pointer());
     capture_e release_frame();
 
+    /**
+     * @brief Duplicate the output again after access to it was lost, like for the secure desktop.
+     * @return `true` if the output was duplicated again with the mode and format it had.
+     */
+    bool reacquire(display_base_t *display, const ::video::config_t &config);
+
+    /**
+     * @brief Get the regions of the desktop image that changed with the acquired frame.
+     * @param frame_info The information about the acquired frame.
+     * @param rects Set to the destinations of the moved regions, followed by the dirty regions.
+     * @return `false` if the regions couldn't be read, in which case the whole image must be assumed to have changed.
+     */
+    bool frame_rects(const DXGI_OUTDUPL_FRAME_INFO &frame_info, std::vector<RECT> &rects);
+
     ~duplication_t();
+
+  private:
+    std::vector<std::uint8_t> metadata;
   };
 
   /**
@@ -306,6 +397,7 @@ namespace platf::dxgi {
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
     capture_e release_snapshot() override;
+    bool reacquire(const ::video::config_t &config) override;
 
     duplication_t dup;
     cursor_t cursor;
@@ -319,6 +411,7 @@ namespace platf::dxgi {
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
     capture_e release_snapshot() override;
+    bool reacquire(const ::video::config_t &config) override;
 
     duplication_t dup;
     sampler_state_t sampler_linear;
@@ -336,6 +429,13 @@ namespace platf::dxgi {
     texture2d_t old_surface_delayed_destruction;
     std::chrono::steady_clock::time_point old_surface_timestamp;
     std::variant<std::monostate, texture2d_t, std::shared_ptr<platf::img_t>> last_frame_variant;
+
+    // The regions that changed with the last frames, the last one being the latest frame
+    std::deque<std::vector<D3D11_BOX>> damage;
+    std::uint64_t generation = 0;
+    // The frame the intermediate surface holds a copy of, 0 if unknown
+    std::uint64_t surface_generation = 0;
+    std::vector<RECT> frame_rects;
   };
 
   /**
@@ -346,12 +446,37 @@ namespace platf::dxgi {
     winrt::Windows::Graphics::Capture::GraphicsCaptureItem item {nullptr};
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool frame_pool {nullptr};
     winrt::Windows::Graphics::Capture::GraphicsCaptureSession capture_session {nullptr};
-    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame produced_frame {nullptr}, consumed_frame {nullptr};
-    SRWLOCK frame_lock = SRWLOCK_INIT;
-    CONDITION_VARIABLE frame_present_cv;
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame consumed_frame {nullptr};
+
+    // The latest frame that wasn't consumed yet, held as its ABI pointer so the frame pool
+    // thread can swap it with a newer frame without waiting for the capture thread
+    std::atomic<void *> produced_frame {nullptr};
+    // Auto-reset event signaled when a frame is produced
+    winrt::handle frame_event;
+
+    // Only used by the frame pool thread
+    std::uint64_t frames_replaced = 0;
+    logging::percentile_periodic_logger<double> delivery_delay_logger {debug, "WGC: frame delivery delay", "ms"};
+
+    // The window of the app captured in place of the monitor, nullptr while capturing the monitor
+    HWND window = nullptr;
+    RECT window_bounds {};
+    std::chrono::steady_clock::time_point next_window_check;
 
     void on_frame_arrived(winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const &sender, winrt::Windows::Foundation::IInspectable const &);
 
+    /**
+     * @brief Check whether the window to capture changed since the capture started.
+     * @return `true` if the window captured closed, moved or was resized, or the app got a window while capturing the monitor.
+     */
+    bool window_changed();
+
+    /**
+     * @brief Take the frame out of the handoff slot.
+     * @return The latest frame that wasn't consumed yet, or `nullptr`.
+     */
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame take_produced_frame();
+
   public:
     wgc_capture_t();
     ~wgc_capture_t();
@@ -4,6 +4,7 @@
  */
 // standard includes
 #include <cmath>
+#include <sstream>
 #include <thread>
 
 // platform includes
@@ -32,6 +33,7 @@ typedef enum _D3DKMT_GPU_PREFERENCE_QUERY_STATE: DWORD {
 #include "misc.h"
 #include "src/config.h"
 #include "src/display_device.h"
+#include "src/frame_scheduler.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/video.h"
@@ -196,6 +198,59 @@ namespace platf::dxgi {
     }
   }
 
+  bool duplication_t::reacquire(display_base_t *display, const ::video::config_t &config) {
+    // The adapters, the outputs or their modes changed, which needs the display opened again
+    if (!display->factory->IsCurrent()) {
+      return false;
+    }
+
+    reset();
+
+    // The images were allocated for the format the display had
+    auto capture_format = display->capture_format;
+    if (init(display, config)) {
+      return false;
+    }
+    display->capture_format = capture_format;
+
+    // A different size is caught by the next snapshot, like after any mode change
+    return true;
+  }
+
+  bool duplication_t::frame_rects(const DXGI_OUTDUPL_FRAME_INFO &frame_info, std::vector<RECT> &rects) {
+    rects.clear();
+    if (!frame_info.TotalMetadataBufferSize) {
+      return true;
+    }
+
+    // Both kinds of regions are read through the same buffer, which is large enough for either
+    metadata.resize(frame_info.TotalMetadataBufferSize);
+
+    UINT size;
+    auto status = dup->GetFrameMoveRects(metadata.size(), (DXGI_OUTDUPL_MOVE_RECT *) metadata.data(), &size);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Couldn't get the moved regions of the frame [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    // The moved content is already at its destination in the desktop image
+    auto move_rects = (DXGI_OUTDUPL_MOVE_RECT *) metadata.data();
+    for (UINT x = 0; x < size / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++x) {
+      rects.emplace_back(move_rects[x].DestinationRect);
+    }
+
+    status = dup->GetFrameDirtyRects(metadata.size(), (RECT *) metadata.data(), &size);
+    if (FAILED(status)) {
+      BOOST_LOG(warning) << "Couldn't get the dirty regions of the frame [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    auto dirty_rects = (RECT *) metadata.data();
+    rects.insert(std::end(rects), dirty_rects, dirty_rects + size / sizeof(RECT));
+
+    return true;
+  }
+
   duplication_t::~duplication_t() {
     release_frame();
   }
@@ -229,6 +284,11 @@ namespace platf::dxgi {
     std::optional<std::chrono::steady_clock::time_point> frame_pacing_group_start;
     uint32_t frame_pacing_group_frames = 0;
 
+    std::optional<frame_scheduler::capture_phase_t> capture_phase;
+    if (config::video.capture_phase_lock) {
+      capture_phase.emplace(std::chrono::nanoseconds(1s) * client_frame_rate_adjusted.Denominator / client_frame_rate_adjusted.Numerator);
+    }
+
     // Keep the display awake during capture. If the display goes to sleep during
     // capture, best case is that capture stops until it powers back on. However,
     // worst case it will trigger us to reinit DD, waking the display back up in
@@ -239,6 +299,7 @@ namespace platf::dxgi {
     });
 
     sleep_overshoot_logger.reset();
+    capture_age_logger.reset();
 
     while (true) {
       // This will return false if the HDR state changes or for any number of other
@@ -270,10 +331,20 @@ namespace platf::dxgi {
           sleep_overshoot_logger.first_point(sleep_target);
           sleep_overshoot_logger.second_point_now_and_log();
 
+          const auto captured = std::chrono::steady_clock::now();
           status = snapshot(pull_free_image_cb, img_out, 0ms, *cursor);
 
           if (status == capture_e::ok && img_out) {
             frame_pacing_group_frames += 1;
+
+            if (img_out->frame_timestamp) {
+              capture_age_logger.collect_and_log(std::chrono::duration<double, std::milli>(captured - *img_out->frame_timestamp).count());
+
+              // Move the rest of the group towards the game's present, the group staying on the frame interval
+              if (capture_phase) {
+                *frame_pacing_group_start += capture_phase->update(captured, *img_out->frame_timestamp);
+              }
+            }
           } else {
             frame_pacing_group_start = std::nullopt;
             frame_pacing_group_frames = 0;
@@ -417,6 +488,69 @@ namespace platf::dxgi {
     return false;
   }
 
+  /**
+   * @brief Get the vendor of the GPUs that can run the configured encoder.
+   * @return The PCI vendor ID, or 0 if any GPU can run it.
+   */
+  UINT encoder_vendor_id() {
+    if (config::video.encoder == "nvenc"sv) {
+      return 0x10de;
+    } else if (config::video.encoder == "amdvce"sv) {
+      return 0x1002;
+    } else if (config::video.encoder == "quicksync"sv) {
+      return 0x8086;
+    }
+
+    return 0;
+  }
+
+  /**
+   * @brief Pick the adapter to encode the frames captured on another adapter.
+   * @details Encoding on the adapter owning the output is cheapest, because frames never leave its memory.
+   *          Frames are only copied to another adapter if it's the one the user named, or if the owner of
+   *          the output can't run the configured encoder and another adapter can.
+   * @param factory The DXGI factory.
+   * @param capture_adapter The adapter owning the captured output.
+   * @param adapter_name The name of the adapter configured by the user, if any.
+   * @return The adapter to encode on, or `nullptr` if the capture adapter disappeared.
+   */
+  adapter_t find_encode_adapter(factory1_t::pointer factory, adapter_t::pointer capture_adapter, const std::wstring &adapter_name) {
+    DXGI_ADAPTER_DESC1 capture_desc;
+    capture_adapter->GetDesc1(&capture_desc);
+
+    auto vendor_id = encoder_vendor_id();
+
+    adapter_t same_adapter;
+    adapter_t other_adapter;
+
+    adapter_t::pointer adapter_p;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      dxgi::adapter_t adapter_tmp {adapter_p};
+
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter_tmp->GetDesc1(&adapter_desc);
+
+      if (is_same_adapter(adapter_desc.AdapterLuid, capture_desc.AdapterLuid)) {
+        same_adapter = std::move(adapter_tmp);
+        continue;
+      }
+
+      if (other_adapter || (adapter_desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE)) {
+        continue;
+      }
+
+      if (!adapter_name.empty()) {
+        if (adapter_desc.Description == adapter_name && capture_desc.Description != adapter_name) {
+          other_adapter = std::move(adapter_tmp);
+        }
+      } else if (vendor_id && capture_desc.VendorId != vendor_id && adapter_desc.VendorId == vendor_id) {
+        other_adapter = std::move(adapter_tmp);
+      }
+    }
+
+    return other_adapter ? std::move(other_adapter) : std::move(same_adapter);
+  }
+
   /**
    * @brief Hook for NtGdiDdDDIGetCachedHybridQueryValue() from win32u.dll.
    * @param gpuPreference A pointer to the location where the preference will be written.
@@ -479,58 +613,61 @@ namespace platf::dxgi {
 
     adapter_t::pointer adapter_p;
     for (int tries = 0; tries < 2; ++tries) {
-      for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
-        dxgi::adapter_t adapter_tmp {adapter_p};
+      // If the named adapter has no output to capture, capture from the one that has it and encode across adapters
+      for (int pass = 0; pass < (adapter_name.empty() ? 1 : 2) && !output; ++pass) {
+        for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+          dxgi::adapter_t adapter_tmp {adapter_p};
 
-        DXGI_ADAPTER_DESC1 adapter_desc;
-        adapter_tmp->GetDesc1(&adapter_desc);
+          DXGI_ADAPTER_DESC1 adapter_desc;
+          adapter_tmp->GetDesc1(&adapter_desc);
 
-        if (!adapter_name.empty() && adapter_desc.Description != adapter_name) {
-          continue;
-        }
-
-        dxgi::output_t::pointer output_p;
-        for (int y = 0; adapter_tmp->EnumOutputs(y, &output_p) != DXGI_ERROR_NOT_FOUND; ++y) {
-          dxgi::output_t output_tmp {output_p};
-
-          DXGI_OUTPUT_DESC desc;
-          output_tmp->GetDesc(&desc);
-
-          if (!output_name.empty() && desc.DeviceName != output_name) {
+          if (pass == 0 && !adapter_name.empty() && adapter_desc.Description != adapter_name) {
             continue;
           }
 
-          if (desc.AttachedToDesktop && test_dxgi_duplication(adapter_tmp, output_tmp, false)) {
-            output = std::move(output_tmp);
-
-            offset_x = desc.DesktopCoordinates.left;
-            offset_y = desc.DesktopCoordinates.top;
-            width = desc.DesktopCoordinates.right - offset_x;
-            height = desc.DesktopCoordinates.bottom - offset_y;
-
-            display_rotation = desc.Rotation;
-            if (display_rotation == DXGI_MODE_ROTATION_ROTATE90 ||
-                display_rotation == DXGI_MODE_ROTATION_ROTATE270) {
-              width_before_rotation = height;
-              height_before_rotation = width;
-            } else {
-              width_before_rotation = width;
-              height_before_rotation = height;
+          dxgi::output_t::pointer output_p;
+          for (int y = 0; adapter_tmp->EnumOutputs(y, &output_p) != DXGI_ERROR_NOT_FOUND; ++y) {
+            dxgi::output_t output_tmp {output_p};
+
+            DXGI_OUTPUT_DESC desc;
+            output_tmp->GetDesc(&desc);
+
+            if (!output_name.empty() && desc.DeviceName != output_name) {
+              continue;
             }
 
-            // left and bottom may be negative, yet absolute mouse coordinates start at 0x0
-            // Ensure offset starts at 0x0
-            offset_x -= GetSystemMetrics(SM_XVIRTUALSCREEN);
-            offset_y -= GetSystemMetrics(SM_YVIRTUALSCREEN);
+            if (desc.AttachedToDesktop && test_dxgi_duplication(adapter_tmp, output_tmp, false)) {
+              output = std::move(output_tmp);
+
+              offset_x = desc.DesktopCoordinates.left;
+              offset_y = desc.DesktopCoordinates.top;
+              width = desc.DesktopCoordinates.right - offset_x;
+              height = desc.DesktopCoordinates.bottom - offset_y;
+
+              display_rotation = desc.Rotation;
+              if (display_rotation == DXGI_MODE_ROTATION_ROTATE90 ||
+                  display_rotation == DXGI_MODE_ROTATION_ROTATE270) {
+                width_before_rotation = height;
+                height_before_rotation = width;
+              } else {
+                width_before_rotation = width;
+                height_before_rotation = height;
+              }
+
+              // left and bottom may be negative, yet absolute mouse coordinates start at 0x0
+              // Ensure offset starts at 0x0
+              offset_x -= GetSystemMetrics(SM_XVIRTUALSCREEN);
+              offset_y -= GetSystemMetrics(SM_YVIRTUALSCREEN);
+
+              break;
+            }
+          }
 
+          if (output) {
+            adapter = std::move(adapter_tmp);
             break;
           }
         }
-
-        if (output) {
-          adapter = std::move(adapter_tmp);
-          break;
-        }
       }
 
       if (output) {
@@ -549,6 +686,12 @@ namespace platf::dxgi {
       return -1;
     }
 
+    encode_adapter = find_encode_adapter(factory.get(), adapter.get(), adapter_name);
+    if (!encode_adapter) {
+      BOOST_LOG(error) << "Failed to locate the adapter of the output device"sv;
+      return -1;
+    }
+
     D3D_FEATURE_LEVEL featureLevels[] {
       D3D_FEATURE_LEVEL_11_1,
       D3D_FEATURE_LEVEL_11_0,
@@ -603,6 +746,14 @@ namespace platf::dxgi {
       << "Offset             : "sv << offset_x << 'x' << offset_y << std::endl
       << "Virtual Desktop    : "sv << env_width << 'x' << env_height;
 
+    DXGI_ADAPTER_DESC encode_adapter_desc;
+    encode_adapter->GetDesc(&encode_adapter_desc);
+    if (is_same_adapter(adapter_desc.AdapterLuid, encode_adapter_desc.AdapterLuid)) {
+      BOOST_LOG(info) << "Capturing and encoding on the same adapter"sv;
+    } else {
+      BOOST_LOG(info) << "Capturing on ["sv << description << "] and encoding on ["sv << to_utf8(encode_adapter_desc.Description) << "], frames are copied across adapters"sv;
+    }
+
     // Bump up thread priority
     {
       const DWORD flags = TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY;
@@ -1134,4 +1285,34 @@ namespace platf {
       return false;
     }
   }
+
+  std::string gpu_fingerprint() {
+    dxgi::factory1_t factory;
+    auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']';
+      return {};
+    }
+
+    std::ostringstream fingerprint;
+
+    dxgi::adapter_t::pointer adapter_p;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      dxgi::adapter_t adapter {adapter_p};
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter->GetDesc1(&adapter_desc);
+
+      // The user mode driver version changes with every driver update
+      LARGE_INTEGER driver_version {};
+      adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driver_version);
+
+      fingerprint << ';' << to_utf8(adapter_desc.Description)
+                  << ':' << util::hex(adapter_desc.VendorId).to_string_view()
+                  << ':' << util::hex(adapter_desc.DeviceId).to_string_view()
+                  << ':' << util::hex(adapter_desc.SubSysId).to_string_view()
+                  << ':' << driver_version.QuadPart;
+    }
+
+    return fingerprint.str();
+  }
 }  // namespace platf
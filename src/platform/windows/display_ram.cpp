@@ -2,9 +2,13 @@
  * @file src/platform/windows/display_ram.cpp
  * @brief Definitions for handling ram.
  */
+// standard includes
+#include <thread>
+
 // local includes
 #include "display.h"
 #include "misc.h"
+#include "src/buffer_pool.h"
 #include "src/logging.h"
 
 namespace platf {
@@ -14,7 +18,7 @@ namespace platf {
 namespace platf::dxgi {
   struct img_t: public ::platf::img_t {
     ~img_t() override {
-      delete[] data;
+      buffer_pool::free_image(data);
       data = nullptr;
     }
   };
@@ -227,25 +231,12 @@ namespace platf::dxgi {
         D3D11_TEXTURE2D_DESC desc;
         src->GetDesc(&desc);
 
-        // If we don't know the capture format yet, grab it from this texture and create the staging texture
+        // If we don't know the capture format yet, grab it from this texture and create the staging textures
         if (capture_format == DXGI_FORMAT_UNKNOWN) {
           capture_format = desc.Format;
           BOOST_LOG(info) << "Capture format ["sv << dxgi_format_to_string(capture_format) << ']';
 
-          D3D11_TEXTURE2D_DESC t {};
-          t.Width = width;
-          t.Height = height;
-          t.MipLevels = 1;
-          t.ArraySize = 1;
-          t.SampleDesc.Count = 1;
-          t.Usage = D3D11_USAGE_STAGING;
-          t.Format = capture_format;
-          t.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-
-          auto status = device->CreateTexture2D(&t, nullptr, &texture);
-
-          if (FAILED(status)) {
-            BOOST_LOG(error) << "Failed to create staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+          if (create_staging_textures()) {
             return capture_e::error;
           }
         }
@@ -264,8 +255,7 @@ namespace platf::dxgi {
           return capture_e::reinit;
         }
 
-        // Copy from GPU to CPU
-        device_ctx->CopyResource(texture.get(), src.get());
+        copy_to_staging(src.get());
       }
     }
 
@@ -282,26 +272,10 @@ namespace platf::dxgi {
         return capture_e::error;
       }
     } else {
-      // Map the staging texture for CPU access (making it inaccessible for the GPU)
-      status = device_ctx->Map(texture.get(), 0, D3D11_MAP_READ, 0, &img_info);
-      if (FAILED(status)) {
-        BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
-
+      // Without a frame update, this reads the latest frame again to draw the cursor over it
+      if (read_staging(img)) {
         return capture_e::error;
       }
-
-      // Now that we know the capture format, we can finish creating the image
-      if (complete_img(img, false)) {
-        device_ctx->Unmap(texture.get(), 0);
-        img_info.pData = nullptr;
-        return capture_e::error;
-      }
-
-      std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
-
-      // Unmap the staging texture to allow GPU access again
-      device_ctx->Unmap(texture.get(), 0);
-      img_info.pData = nullptr;
     }
 
     if (cursor_visible && cursor.visible) {
@@ -310,6 +284,7 @@ namespace platf::dxgi {
 
     if (img) {
       img->frame_timestamp = frame_timestamp;
+      img->cursor = cursor.visible ? std::optional {util::point_t {(double) cursor.x, (double) cursor.y}} : std::nullopt;
     }
 
     return capture_e::ok;
@@ -319,6 +294,68 @@ namespace platf::dxgi {
     return dup.release_frame();
   }
 
+  int display_ram_t::create_staging_textures() {
+    D3D11_TEXTURE2D_DESC t {};
+    t.Width = width;
+    t.Height = height;
+    t.MipLevels = 1;
+    t.ArraySize = 1;
+    t.SampleDesc.Count = 1;
+    t.Usage = D3D11_USAGE_STAGING;
+    t.Format = capture_format;
+    t.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+    for (auto &texture : staging_textures) {
+      auto status = device->CreateTexture2D(&t, nullptr, &texture);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to create staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+    }
+
+    return 0;
+  }
+
+  void display_ram_t::copy_to_staging(ID3D11Texture2D *src) {
+    staging_index = (staging_index + 1) % staging_textures.size();
+
+    // Copy from GPU to CPU
+    device_ctx->CopyResource(staging_textures[staging_index].get(), src);
+    device_ctx->Flush();
+  }
+
+  int display_ram_t::read_staging(platf::img_t *img) {
+    auto &texture = staging_textures[staging_index];
+
+    // Map the staging texture for CPU access (making it inaccessible for the GPU)
+    auto start = std::chrono::steady_clock::now();
+    HRESULT status;
+    while ((status = device_ctx->Map(texture.get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &img_info)) == DXGI_ERROR_WAS_STILL_DRAWING) {
+      std::this_thread::yield();
+    }
+    readback_wait_logger.collect_and_log(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
+      return -1;
+    }
+
+    // Now that we know the capture format, we can finish creating the image
+    if (complete_img(img, false)) {
+      device_ctx->Unmap(texture.get(), 0);
+      img_info.pData = nullptr;
+      return -1;
+    }
+
+    std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
+
+    // Unmap the staging texture to allow GPU access again
+    device_ctx->Unmap(texture.get(), 0);
+    img_info.pData = nullptr;
+
+    return 0;
+  }
+
   std::shared_ptr<platf::img_t> display_ram_t::alloc_img() {
     auto img = std::make_shared<img_t>();
 
@@ -346,12 +383,12 @@ namespace platf::dxgi {
     // Reallocate the image buffer if the pitch changes
     if (!dummy && img->row_pitch != img_info.RowPitch) {
       img->row_pitch = img_info.RowPitch;
-      delete img->data;
+      buffer_pool::free_image(img->data);
       img->data = nullptr;
     }
 
     if (!img->data) {
-      img->data = new std::uint8_t[img->row_pitch * height];
+      img->data = buffer_pool::alloc_image(img->row_pitch * height);
     }
 
     return 0;
@@ -381,6 +418,10 @@ namespace platf::dxgi {
     return 0;
   }
 
+  bool display_ddup_ram_t::reacquire(const ::video::config_t &config) {
+    return dup.reacquire(this, config);
+  }
+
   std::unique_ptr<avcodec_encode_device_t> display_ram_t::make_avcodec_encode_device(pix_fmt_e pix_fmt) {
     return std::make_unique<avcodec_encode_device_t>();
   }
@@ -3,6 +3,8 @@
  * @brief Definitions for handling video ram.
  */
 // standard includes
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 
 // platform includes
@@ -23,6 +25,7 @@ extern "C" {
 #include "misc.h"
 #include "src/config.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/nvenc/nvenc_config.h"
 #include "src/nvenc/nvenc_d3d11_native.h"
 #include "src/nvenc/nvenc_d3d11_on_cuda.h"
@@ -44,6 +47,9 @@ using frame_t = util::safe_ptr<AVFrame, free_frame>;
 
 namespace platf::dxgi {
 
+  // The frames whose changed regions are kept to bring older copies up to date
+  constexpr std::size_t DAMAGE_HISTORY = 8;
+
   template<class T>
   buf_t make_buffer(device_t::pointer device, const T &t) {
     static_assert(sizeof(T) % 16 == 0, "Buffer needs to be aligned on a 16-byte alignment");
@@ -102,6 +108,9 @@ namespace platf::dxgi {
     return blend;
   }
 
+  blob_t convert_yuv420_cs_hlsl;
+  blob_t convert_yuv420_cs_linear_hlsl;
+  blob_t convert_yuv420_cs_perceptual_quantizer_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_linear_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_perceptual_quantizer_hlsl;
@@ -150,6 +159,12 @@ namespace platf::dxgi {
     // DXGI format of this image texture
     DXGI_FORMAT format;
 
+    // Counts capture_texture in the GPU memory of the capture
+    metrics::gpu_allocation_t capture_memory;
+
+    // The desktop frame this image holds a copy of, 0 if unknown or blended with the cursor
+    std::uint64_t generation = 0;
+
     virtual ~img_d3d_t() override {
       if (encoder_texture_handle) {
         CloseHandle(encoder_texture_handle);
@@ -383,6 +398,105 @@ namespace platf::dxgi {
     return compile_shader(file, "main_vs", "vs_5_0");
   }
 
+  blob_t compile_compute_shader(LPCSTR file) {
+    return compile_shader(file, "main_cs", "cs_5_0");
+  }
+
+  /**
+   * @brief Measures the GPU time of the color conversion with timestamp queries.
+   * @details The results are read a few frames later, so the CPU never waits for the GPU.
+   */
+  class gpu_timer_t {
+  public:
+    void init(device_t::pointer device) {
+      if (!logger.is_enabled()) {
+        return;
+      }
+
+      D3D11_QUERY_DESC disjoint_desc {D3D11_QUERY_TIMESTAMP_DISJOINT, 0};
+      D3D11_QUERY_DESC timestamp_desc {D3D11_QUERY_TIMESTAMP, 0};
+      for (auto &set : sets) {
+        HRESULT status;
+        if (FAILED(status = device->CreateQuery(&disjoint_desc, &set.disjoint)) ||
+            FAILED(status = device->CreateQuery(&timestamp_desc, &set.start)) ||
+            FAILED(status = device->CreateQuery(&timestamp_desc, &set.end))) {
+          BOOST_LOG(warning) << "Failed to create timestamp query [0x"sv << util::hex(status).to_string_view() << ']';
+          return;
+        }
+      }
+
+      enabled = true;
+    }
+
+    void begin(device_ctx_t::pointer device_ctx) {
+      if (!enabled) {
+        return;
+      }
+
+      collect(device_ctx);
+
+      // Skip this frame if the oldest queries are still in flight
+      auto &set = sets[next];
+      active = !set.pending;
+      if (active) {
+        device_ctx->Begin(set.disjoint.get());
+        device_ctx->End(set.start.get());
+      }
+    }
+
+    void end(device_ctx_t::pointer device_ctx) {
+      if (!active) {
+        return;
+      }
+
+      auto &set = sets[next];
+      device_ctx->End(set.end.get());
+      device_ctx->End(set.disjoint.get());
+      set.pending = true;
+
+      next = (next + 1) % sets.size();
+      active = false;
+    }
+
+  private:
+    void collect(device_ctx_t::pointer device_ctx) {
+      for (auto &set : sets) {
+        if (!set.pending) {
+          continue;
+        }
+
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        UINT64 start, end;
+        if (device_ctx->GetData(set.disjoint.get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            device_ctx->GetData(set.start.get(), &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            device_ctx->GetData(set.end.get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+          continue;
+        }
+
+        set.pending = false;
+
+        // The timestamps are meaningless if the GPU clock changed in between
+        if (!disjoint.Disjoint && disjoint.Frequency) {
+          logger.collect_and_log((end - start) * 1000.0 / disjoint.Frequency);
+        }
+      }
+    }
+
+    struct query_set_t {
+      query_t disjoint;
+      query_t start;
+      query_t end;
+      bool pending = false;
+    };
+
+    std::array<query_set_t, 4> sets;
+    std::size_t next = 0;
+    bool enabled = false;
+    bool active = false;
+
+    logging::percentile_periodic_logger<double> logger {debug, "D3D11: color conversion GPU time", "ms"};
+  };
+
   class d3d_base_encode_device final {
   public:
     int convert(platf::img_t &img_base) {
@@ -411,6 +525,11 @@ namespace platf::dxgi {
           return -1;
         }
 
+        if (copy_device && copy_across_adapters(img_ctx)) {
+          img_ctx.encoder_mutex->ReleaseSync(0);
+          return -1;
+        }
+
         auto draw = [&](auto &input, auto &y_or_yuv_viewports, auto &uv_viewport) {
           device_ctx->PSSetShaderResources(0, 1, &input);
 
@@ -434,6 +553,20 @@ namespace platf::dxgi {
           }
         };
 
+        // Write both planes in a single compute shader dispatch
+        auto dispatch = [&](auto &input) {
+          device_ctx->CSSetShader(img.format == DXGI_FORMAT_R16G16B16A16_FLOAT ? convert_fp16_cs.get() : convert_cs.get(), nullptr, 0);
+          device_ctx->CSSetShaderResources(0, 1, &input);
+
+          ID3D11UnorderedAccessView *uavs[] {out_Y_uav.get(), out_UV_uav.get()};
+          device_ctx->CSSetUnorderedAccessViews(0, 2, uavs, nullptr);
+          device_ctx->Dispatch(dispatch_groups[0], dispatch_groups[1], 1);
+
+          // The encoder can't read the planes while they are still bound for writing
+          ID3D11UnorderedAccessView *empty_uavs[2] {};
+          device_ctx->CSSetUnorderedAccessViews(0, 2, empty_uavs, nullptr);
+        };
+
         // Clear render target view(s) once so that the aspect ratio mismatch "bars" appear black
         if (!rtvs_cleared) {
           auto black = create_black_texture_for_rtv_clear();
@@ -444,13 +577,20 @@ namespace platf::dxgi {
         }
 
         // Draw captured frame
-        draw(img_ctx.encoder_input_res, out_Y_or_YUV_viewports, out_UV_viewport);
+        timer.begin(device_ctx.get());
+        if (compute) {
+          dispatch(img_ctx.encoder_input_res);
+        } else {
+          draw(img_ctx.encoder_input_res, out_Y_or_YUV_viewports, out_UV_viewport);
+        }
+        timer.end(device_ctx.get());
 
         // Release encoder mutex to allow capture code to reuse this image
         img_ctx.encoder_mutex->ReleaseSync(0);
 
         ID3D11ShaderResourceView *emptyShaderResourceView = nullptr;
         device_ctx->PSSetShaderResources(0, 1, &emptyShaderResourceView);
+        device_ctx->CSSetShaderResources(0, 1, &emptyShaderResourceView);
       }
 
       return 0;
@@ -478,6 +618,7 @@ namespace platf::dxgi {
 
       device_ctx->VSSetConstantBuffers(3, 1, &color_matrix);
       device_ctx->PSSetConstantBuffers(0, 1, &color_matrix);
+      device_ctx->CSSetConstantBuffers(0, 1, &color_matrix);
       this->color_matrix = std::move(color_matrix);
     }
 
@@ -705,6 +846,101 @@ namespace platf::dxgi {
         rtvs_cleared = false;
       }
 
+      if (compute && init_compute_output(rtv_Y_or_YUV_format, rtv_UV_format, offsetX, offsetY, out_width_f, out_height_f, downscaling)) {
+        BOOST_LOG(warning) << "Falling back to render passes for color conversion"sv;
+        compute = false;
+      }
+
+      return 0;
+    }
+
+    /**
+     * @brief Check whether the adapter of the encoder device can convert frames with a compute shader.
+     * @return `true` if the planes of the output format can be written from a compute shader.
+     */
+    bool supports_compute() {
+      if (format != DXGI_FORMAT_NV12 && format != DXGI_FORMAT_P010) {
+        BOOST_LOG(info) << "Compute shader color conversion only supports NV12 and P010"sv;
+        return false;
+      }
+
+      if (device->GetFeatureLevel() < D3D_FEATURE_LEVEL_11_0) {
+        BOOST_LOG(info) << "Compute shader color conversion requires feature level 11_0"sv;
+        return false;
+      }
+
+      D3D11_FEATURE_DATA_FORMAT_SUPPORT support {format};
+      auto status = device->CheckFeatureSupport(D3D11_FEATURE_FORMAT_SUPPORT, &support, sizeof(support));
+      if (FAILED(status) || !(support.OutFormatSupport & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW)) {
+        BOOST_LOG(info) << "Adapter can't write "sv << (format == DXGI_FORMAT_NV12 ? "NV12"sv : "P010"sv) << " from a compute shader"sv;
+        return false;
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Prepare the compute shader and the views of the output planes it writes.
+     * @return 0 on success, -1 if the render passes must be used instead.
+     */
+    int init_compute_output(DXGI_FORMAT Y_format, DXGI_FORMAT UV_format, float offsetX, float offsetY, float out_width_f, float out_height_f, bool downscaling) {
+      HRESULT status;
+
+      auto &cs_hlsl = format == DXGI_FORMAT_P010 && display->is_hdr() ? convert_yuv420_cs_perceptual_quantizer_hlsl : convert_yuv420_cs_linear_hlsl;
+      if (FAILED(status = device->CreateComputeShader(convert_yuv420_cs_hlsl->GetBufferPointer(), convert_yuv420_cs_hlsl->GetBufferSize(), nullptr, &convert_cs)) ||
+          FAILED(status = device->CreateComputeShader(cs_hlsl->GetBufferPointer(), cs_hlsl->GetBufferSize(), nullptr, &convert_fp16_cs))) {
+        BOOST_LOG(error) << "Failed to create compute shader: " << util::log_hex(status);
+        return -1;
+      }
+
+      device3_t device3;
+      status = device->QueryInterface(__uuidof(ID3D11Device3), (void **) &device3);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to query ID3D11Device3 [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      // Each plane of the output texture gets its own view
+      auto create_uav = [&](auto &uav, DXGI_FORMAT uav_format, UINT plane) -> bool {
+        D3D11_UNORDERED_ACCESS_VIEW_DESC1 uav_desc = {};
+        uav_desc.Format = uav_format;
+        uav_desc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+        uav_desc.Texture2D.PlaneSlice = plane;
+
+        auto status = device3->CreateUnorderedAccessView1(output_texture.get(), &uav_desc, &uav);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to create unordered access view: " << util::log_hex(status);
+          return false;
+        }
+
+        return true;
+      };
+
+      if (!create_uav(out_Y_uav, Y_format, 0) || !create_uav(out_UV_uav, UV_format, 1)) {
+        return -1;
+      }
+
+      // The chroma plane needs an even offset
+      int32_t out_rect[] {(int32_t) offsetX & ~1, (int32_t) offsetY & ~1, (int32_t) out_width_f, (int32_t) out_height_f};
+
+      int32_t rotation_modifier = display->display_rotation == DXGI_MODE_ROTATION_UNSPECIFIED ? 0 : display->display_rotation - 1;
+      int32_t convert_data[32 / sizeof(int32_t)] {out_rect[0], out_rect[1], out_rect[2], out_rect[3], -rotation_modifier, downscaling};  // aligned to 16-byte
+      convert_params = make_buffer(device.get(), convert_data);
+      if (!convert_params) {
+        BOOST_LOG(error) << "Failed to create compute shader constant buffer";
+        return -1;
+      }
+
+      device_ctx->CSSetConstantBuffers(0, 1, &color_matrix);
+      device_ctx->CSSetConstantBuffers(1, 1, &convert_params);
+      device_ctx->CSSetSamplers(0, 1, &sampler_linear);
+
+      // Each thread converts a 2x2 block, in groups of 8x8 threads
+      dispatch_groups[0] = (out_rect[2] + 15) / 16;
+      dispatch_groups[1] = (out_rect[3] + 15) / 16;
+
+      BOOST_LOG(info) << "Converting colors with a D3D11 compute shader"sv;
+
       return 0;
     }
 
@@ -795,6 +1031,53 @@ namespace platf::dxgi {
       }
       display = nullptr;
 
+      // A HDR display is captured in scRGB, where SDR white is above 1.0 and highlights go up to the peak luminance
+      // of the display. For SDR streams, the linear shaders bring SDR white down to 1.0 and roll the highlights off
+      // up to the peak instead of clipping everything above 80 nits. SDR displays keep their colors as they are.
+      float tone_map_data[16 / sizeof(float)] {1.0f, 1.0f};  // aligned to 16-byte
+      if (this->display->is_hdr()) {
+        SS_HDR_METADATA metadata;
+        auto peak_nits = this->display->get_hdr_metadata(metadata) && metadata.maxDisplayLuminance ? (float) metadata.maxDisplayLuminance : 1000.0f;
+
+        tone_map_data[0] = 80.0f / SDR_WHITE_NITS;
+        tone_map_data[1] = std::max(peak_nits / SDR_WHITE_NITS, 1.0f);
+      }
+
+      tone_map = make_buffer(device.get(), tone_map_data);
+      if (!tone_map) {
+        BOOST_LOG(error) << "Failed to create tone mapping buffer"sv;
+        return -1;
+      }
+      device_ctx->PSSetConstantBuffers(2, 1, &tone_map);
+      device_ctx->CSSetConstantBuffers(2, 1, &tone_map);
+
+      // A device of another adapter can't open the capture textures, so a device of the capture adapter reads them back
+      DXGI_ADAPTER_DESC capture_adapter_desc;
+      DXGI_ADAPTER_DESC encode_adapter_desc;
+      this->display->adapter->GetDesc(&capture_adapter_desc);
+      adapter_p->GetDesc(&encode_adapter_desc);
+      if (!is_same_adapter(capture_adapter_desc.AdapterLuid, encode_adapter_desc.AdapterLuid)) {
+        status = D3D11CreateDevice(
+          this->display->adapter.get(),
+          D3D_DRIVER_TYPE_UNKNOWN,
+          nullptr,
+          D3D11_CREATE_DEVICE_FLAGS,
+          featureLevels,
+          sizeof(featureLevels) / sizeof(D3D_FEATURE_LEVEL),
+          D3D11_SDK_VERSION,
+          &copy_device,
+          nullptr,
+          &copy_device_ctx
+        );
+
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to create cross-adapter copy D3D11 device [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        BOOST_LOG(info) << "Copying frames across adapters through system memory"sv;
+      }
+
       blend_disable = make_blend(device.get(), false, false);
       if (!blend_disable) {
         return -1;
@@ -819,6 +1102,11 @@ namespace platf::dxgi {
       device_ctx->PSSetSamplers(0, 1, &sampler_linear);
       device_ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
+      // The output texture must be created with D3D11_BIND_UNORDERED_ACCESS for the compute shader
+      compute = config::video.dxgi_compute_convert && supports_compute();
+
+      timer.init(device.get());
+
       return 0;
     }
 
@@ -831,6 +1119,11 @@ namespace platf::dxgi {
       shader_res_t encoder_input_res;
       keyed_mutex_t encoder_mutex;
 
+      // Only used when the capture texture is on another adapter
+      texture2d_t staging_texture;
+      texture2d_t local_texture;
+      metrics::gpu_allocation_t cross_adapter_memory;
+
       std::weak_ptr<const platf::img_t> img_weak;
 
       void reset() {
@@ -838,6 +1131,9 @@ namespace platf::dxgi {
         encoder_texture.reset();
         encoder_input_res.reset();
         encoder_mutex.reset();
+        staging_texture.reset();
+        local_texture.reset();
+        cross_adapter_memory = {};
         img_weak.reset();
       }
     };
@@ -852,8 +1148,11 @@ namespace platf::dxgi {
       // Textures can change when transitioning from a dummy image to a real image.
       img_ctx.reset();
 
+      // The texture can only be opened by a device of the adapter it was created on
+      auto opening_device = copy_device ? copy_device.get() : device.get();
+
       device1_t device1;
-      auto status = device->QueryInterface(__uuidof(ID3D11Device1), (void **) &device1);
+      auto status = opening_device->QueryInterface(__uuidof(ID3D11Device1), (void **) &device1);
       if (FAILED(status)) {
         BOOST_LOG(error) << "Failed to query ID3D11Device1 [0x"sv << util::hex(status).to_string_view() << ']';
         return -1;
@@ -873,8 +1172,37 @@ namespace platf::dxgi {
         return -1;
       }
 
+      if (copy_device) {
+        D3D11_TEXTURE2D_DESC texture_desc;
+        img_ctx.encoder_texture->GetDesc(&texture_desc);
+        texture_desc.Usage = D3D11_USAGE_STAGING;
+        texture_desc.BindFlags = 0;
+        texture_desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        texture_desc.MiscFlags = 0;
+
+        status = copy_device->CreateTexture2D(&texture_desc, nullptr, &img_ctx.staging_texture);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to create cross-adapter staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        texture_desc.Usage = D3D11_USAGE_DEFAULT;
+        texture_desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        texture_desc.CPUAccessFlags = 0;
+
+        status = device->CreateTexture2D(&texture_desc, nullptr, &img_ctx.local_texture);
+        if (FAILED(status)) {
+          BOOST_LOG(error) << "Failed to create cross-adapter encoder texture [0x"sv << util::hex(status).to_string_view() << ']';
+          return -1;
+        }
+
+        // The staging texture is in system memory, but the driver keeps the copies of both on the adapters
+        img_ctx.cross_adapter_memory = {metrics::gpu_memory_t::convert, 2 * (std::int64_t) img.row_pitch * img.height};
+      }
+
       // Create the SRV for the encoder texture
-      status = device->CreateShaderResourceView(img_ctx.encoder_texture.get(), nullptr, &img_ctx.encoder_input_res);
+      auto input_texture = img_ctx.local_texture ? img_ctx.local_texture.get() : img_ctx.encoder_texture.get();
+      status = device->CreateShaderResourceView(input_texture, nullptr, &img_ctx.encoder_input_res);
       if (FAILED(status)) {
         BOOST_LOG(error) << "Failed to create shader resource view for encoding [0x"sv << util::hex(status).to_string_view() << ']';
         return -1;
@@ -887,6 +1215,32 @@ namespace platf::dxgi {
       return 0;
     }
 
+    /**
+     * @brief Copy a captured frame to the encoder adapter through system memory.
+     * @param img_ctx The context of the image, with the encoder mutex held.
+     * @return 0 on success, -1 on failure.
+     */
+    int copy_across_adapters(encoder_img_ctx_t &img_ctx) {
+      auto start = std::chrono::steady_clock::now();
+
+      copy_device_ctx->CopyResource(img_ctx.staging_texture.get(), img_ctx.encoder_texture.get());
+
+      // Mapping waits for the capture adapter to finish the readback
+      D3D11_MAPPED_SUBRESOURCE mapped;
+      auto status = copy_device_ctx->Map(img_ctx.staging_texture.get(), 0, D3D11_MAP_READ, 0, &mapped);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to map cross-adapter staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
+      device_ctx->UpdateSubresource(img_ctx.local_texture.get(), 0, nullptr, mapped.pData, mapped.RowPitch, 0);
+      copy_device_ctx->Unmap(img_ctx.staging_texture.get(), 0);
+
+      cross_adapter_copy_logger.collect_and_log(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+      return 0;
+    }
+
     shader_res_t create_black_texture_for_rtv_clear() {
       constexpr auto width = 32;
       constexpr auto height = 32;
@@ -925,6 +1279,7 @@ namespace platf::dxgi {
 
     buf_t subsample_offset;
     buf_t color_matrix;
+    buf_t tone_map;
 
     blend_t blend_disable;
     sampler_state_t sampler_linear;
@@ -949,6 +1304,22 @@ namespace platf::dxgi {
     ps_t convert_UV_ps;
     ps_t convert_UV_fp16_ps;
 
+    // Y and UV - compute shader, only valid if compute is true
+    bool compute = false;
+    cs_t convert_cs;
+    cs_t convert_fp16_cs;
+    uav_t out_Y_uav;
+    uav_t out_UV_uav;
+    buf_t convert_params;
+    UINT dispatch_groups[2];
+
+    gpu_timer_t timer;
+
+    // Only created when the encoder adapter doesn't own the captured output
+    device_t copy_device;
+    device_ctx_t copy_device_ctx;
+    logging::percentile_periodic_logger<double> cross_adapter_copy_logger {debug, "D3D11: cross-adapter copy time", "ms", 20s, &metrics::video.cross_adapter_copy_recent_seconds};
+
     std::array<D3D11_VIEWPORT, 3> out_Y_or_YUV_viewports, out_Y_or_YUV_viewports_for_clear;
     D3D11_VIEWPORT out_UV_viewport, out_UV_viewport_for_clear;
 
@@ -983,6 +1354,9 @@ namespace platf::dxgi {
 
         // The encoder requires textures with D3D11_BIND_RENDER_TARGET set
         d3d11_frames->BindFlags = D3D11_BIND_RENDER_TARGET;
+        if (base.compute) {
+          d3d11_frames->BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+        }
         d3d11_frames->MiscFlags = 0;
       }
 
@@ -1066,7 +1440,7 @@ namespace platf::dxgi {
       if (pix_fmt == pix_fmt_e::yuv444p16) {
         nvenc_d3d = std::make_unique<nvenc::nvenc_d3d11_on_cuda>(base.device.get());
       } else {
-        nvenc_d3d = std::make_unique<nvenc::nvenc_d3d11_native>(base.device.get());
+        nvenc_d3d = std::make_unique<nvenc::nvenc_d3d11_native>(base.device.get(), base.compute);
       }
       nvenc = nvenc_d3d.get();
 
@@ -1078,8 +1452,12 @@ namespace platf::dxgi {
         return false;
       }
 
+      // A tuned session encodes with a faster preset than the configured one
+      auto nv_config = config::video.nv;
+      nv_config.quality_preset = std::max(nv_config.quality_preset - client_config.presetSteps, 1);
+
       auto nvenc_colorspace = nvenc::nvenc_colorspace_from_sunshine_colorspace(colorspace);
-      if (!nvenc_d3d->create_encoder(config::video.nv, client_config, nvenc_colorspace, buffer_format)) {
+      if (!nvenc_d3d->create_encoder(nv_config, client_config, nvenc_colorspace, buffer_format)) {
         return false;
       }
 
@@ -1154,7 +1532,18 @@ namespace platf::dxgi {
     }
 
     const bool mouse_update_flag = frame_info.LastMouseUpdateTime.QuadPart != 0 || frame_info.PointerShapeBufferSize > 0;
-    const bool frame_update_flag = frame_info.LastPresentTime.QuadPart != 0;
+    bool frame_update_flag = frame_info.LastPresentTime.QuadPart != 0;
+
+    bool full_damage = false;
+    if (frame_update_flag) {
+      full_damage = !dup.frame_rects(frame_info, frame_rects);
+
+      // A present that changed no region leaves the last frame as it is
+      if (!full_damage && frame_rects.empty() && !std::holds_alternative<std::monostate>(last_frame_variant)) {
+        frame_update_flag = false;
+      }
+    }
+
     const bool update_flag = mouse_update_flag || frame_update_flag;
 
     if (!update_flag) {
@@ -1228,6 +1617,27 @@ namespace platf::dxgi {
         BOOST_LOG(info) << "Capture format changed ["sv << dxgi_format_to_string(capture_format) << " -> "sv << dxgi_format_to_string(desc.Format) << ']';
         return capture_e::reinit;
       }
+
+      std::vector<D3D11_BOX> boxes;
+      if (full_damage) {
+        boxes.emplace_back(D3D11_BOX {0, 0, 0, (UINT) width_before_rotation, (UINT) height_before_rotation, 1});
+      } else {
+        for (auto &rect : frame_rects) {
+          auto left = (UINT) std::clamp<LONG>(rect.left, 0, width_before_rotation);
+          auto top = (UINT) std::clamp<LONG>(rect.top, 0, height_before_rotation);
+          auto right = (UINT) std::clamp<LONG>(rect.right, 0, width_before_rotation);
+          auto bottom = (UINT) std::clamp<LONG>(rect.bottom, 0, height_before_rotation);
+          if (left < right && top < bottom) {
+            boxes.emplace_back(D3D11_BOX {left, top, 0, right, bottom, 1});
+          }
+        }
+      }
+
+      damage.emplace_back(std::move(boxes));
+      if (damage.size() > DAMAGE_HISTORY) {
+        damage.pop_front();
+      }
+      ++generation;
     }
 
     enum class lfa {
@@ -1325,6 +1735,23 @@ namespace platf::dxgi {
       return true;
     };
 
+    // Bring a copy of an earlier frame up to date with the regions that changed since,
+    // instead of copying the whole desktop image
+    auto copy_src = [&](ID3D11Texture2D *dst, std::uint64_t &dst_generation) {
+      auto missed = generation - dst_generation;
+      if (dst_generation == 0 || missed > damage.size()) {
+        device_ctx->CopyResource(dst, src.get());
+      } else {
+        for (auto it = std::end(damage) - missed; it != std::end(damage); ++it) {
+          for (auto &box : *it) {
+            device_ctx->CopySubresourceRegion(dst, 0, box.left, box.top, 0, src.get(), 0, &box);
+          }
+        }
+      }
+
+      dst_generation = generation;
+    };
+
     auto get_locked_d3d_img = [&](std::shared_ptr<platf::img_t> &img, bool dummy = false) -> std::tuple<std::shared_ptr<img_d3d_t>, texture_lock_helper> {
       auto d3d_img = std::static_pointer_cast<img_d3d_t>(img);
 
@@ -1373,6 +1800,7 @@ namespace platf::dxgi {
           }
 
           device_ctx->CopyResource(d3d_img->capture_texture.get(), p_surface->get());
+          d3d_img->generation = surface_generation;
 
           // We delay the destruction of intermediate surface in case the mouse cursor reappears shortly.
           old_surface_delayed_destruction.reset(p_surface->release());
@@ -1402,6 +1830,7 @@ namespace platf::dxgi {
           }
 
           device_ctx->CopyResource(surface.get(), d3d_img->capture_texture.get());
+          surface_generation = d3d_img->generation;
           break;
         }
 
@@ -1419,7 +1848,7 @@ namespace platf::dxgi {
             return capture_e::error;
           }
 
-          device_ctx->CopyResource(d3d_img->capture_texture.get(), src.get());
+          copy_src(d3d_img->capture_texture.get(), d3d_img->generation);
           last_frame_variant = img;
           break;
         }
@@ -1433,8 +1862,9 @@ namespace platf::dxgi {
             if (!create_surface(*p_surface)) {
               return capture_e::error;
             }
+            surface_generation = 0;
           }
-          device_ctx->CopyResource(p_surface->get(), src.get());
+          copy_src(p_surface->get(), surface_generation);
           break;
         }
     }
@@ -1506,6 +1936,7 @@ namespace platf::dxgi {
 
           device_ctx->CopyResource(d3d_img->capture_texture.get(), p_surface->get());
           blend_cursor(*d3d_img);
+          d3d_img->generation = 0;
           break;
         }
 
@@ -1529,6 +1960,7 @@ namespace platf::dxgi {
             const float rgb_black[] = {0.0f, 0.0f, 0.0f, 0.0f};
             device_ctx->ClearRenderTargetView(d3d_img->capture_rt.get(), rgb_black);
           }
+          d3d_img->generation = 0;
 
           if (blend_mouse_cursor_flag) {
             blend_cursor(*d3d_img);
@@ -1545,6 +1977,7 @@ namespace platf::dxgi {
 
     if (img_out) {
       img_out->frame_timestamp = frame_timestamp;
+      img_out->cursor = cursor_alpha.visible || cursor_xor.visible ? std::optional {util::point_t {(double) cursor_alpha.topleft_x, (double) cursor_alpha.topleft_y}} : std::nullopt;
     }
 
     return capture_e::ok;
@@ -1599,10 +2032,8 @@ namespace platf::dxgi {
         return -1;
       }
 
-      // Use a 300 nit target for the mouse cursor. We should really get
-      // the user's SDR white level in nits, but there is no API that
-      // provides that information to Win32 apps.
-      float white_multiplier_data[16 / sizeof(float)] {300.0f / 80.f};  // aligned to 16-byte
+      // Use the SDR white level for the mouse cursor
+      float white_multiplier_data[16 / sizeof(float)] {SDR_WHITE_NITS / 80.f};  // aligned to 16-byte
       auto white_multiplier = make_buffer(device.get(), white_multiplier_data);
       if (!white_multiplier) {
         BOOST_LOG(warning) << "Failed to create cursor blending (normalized white) white multiplier constant buffer";
@@ -1633,6 +2064,18 @@ namespace platf::dxgi {
     return 0;
   }
 
+  bool display_ddup_vram_t::reacquire(const ::video::config_t &config) {
+    if (!dup.reacquire(this, config)) {
+      return false;
+    }
+
+    // The regions that changed while the duplication was lost are unknown, so every image gets a full copy
+    damage.clear();
+    ++generation;
+
+    return true;
+  }
+
   /**
    * Get the next frame from the Windows.Graphics.Capture API and copy it into a new snapshot texture.
    * @param pull_free_image_cb call this to get a new free image from the video subsystem.
@@ -1736,6 +2179,7 @@ namespace platf::dxgi {
     img->capture_texture.reset();
     img->capture_rt.reset();
     img->capture_mutex.reset();
+    img->capture_memory = {};
     img->data = nullptr;
     if (img->encoder_texture_handle) {
       CloseHandle(img->encoder_texture_handle);
@@ -1764,6 +2208,7 @@ namespace platf::dxgi {
       BOOST_LOG(error) << "Failed to create img buf texture [0x"sv << util::hex(status).to_string_view() << ']';
       return -1;
     }
+    img->capture_memory = {metrics::gpu_memory_t::capture, (std::int64_t) img->row_pitch * img->height};
 
     status = device->CreateRenderTargetView(img->capture_texture.get(), nullptr, &img->capture_rt);
     if (FAILED(status)) {
@@ -1834,10 +2279,25 @@ namespace platf::dxgi {
    * @param name The FFmpeg codec name (or similar for non-FFmpeg codecs).
    * @param config The codec configuration.
    * @return `true` if supported, `false` otherwise.
+   * @note Probing and every session start ask this again, so the answers are kept for the lifetime of the display.
    */
   bool display_vram_t::is_codec_supported(std::string_view name, const ::video::config_t &config) {
+    std::lock_guard lg {codec_support_lock};
+
+    auto key = std::make_tuple(std::string {name}, config.videoFormat, config.dynamicRange, config.chromaSamplingType);
+    if (auto it = codec_support.find(key); it != std::end(codec_support)) {
+      return it->second;
+    }
+
+    auto supported = check_codec_support(name, config);
+    codec_support.emplace(std::move(key), supported);
+
+    return supported;
+  }
+
+  bool display_vram_t::check_codec_support(std::string_view name, const ::video::config_t &config) {
     DXGI_ADAPTER_DESC adapter_desc;
-    adapter->GetDesc(&adapter_desc);
+    encode_adapter->GetDesc(&adapter_desc);
 
     if (adapter_desc.VendorId == 0x1002) {  // AMD
       // If it's not an AMF encoder, it's not compatible with an AMD GPU
@@ -1915,7 +2375,7 @@ namespace platf::dxgi {
 
   std::unique_ptr<avcodec_encode_device_t> display_vram_t::make_avcodec_encode_device(pix_fmt_e pix_fmt) {
     auto device = std::make_unique<d3d_avcodec_encode_device_t>();
-    if (device->init(shared_from_this(), adapter.get(), pix_fmt) != 0) {
+    if (device->init(shared_from_this(), encode_adapter.get(), pix_fmt) != 0) {
       return nullptr;
     }
     return device;
@@ -1923,7 +2383,7 @@ namespace platf::dxgi {
 
   std::unique_ptr<nvenc_encode_device_t> display_vram_t::make_nvenc_encode_device(pix_fmt_e pix_fmt) {
     auto device = std::make_unique<d3d_nvenc_encode_device_t>();
-    if (!device->init_device(shared_from_this(), adapter.get(), pix_fmt)) {
+    if (!device->init_device(shared_from_this(), encode_adapter.get(), pix_fmt)) {
       return nullptr;
     }
     return device;
@@ -1938,6 +2398,13 @@ namespace platf::dxgi {
 #define compile_pixel_shader_helper(x) \
   if (!(x##_hlsl = compile_pixel_shader(SUNSHINE_SHADERS_DIR "/" #x ".hlsl"))) \
     return -1;
+#define compile_compute_shader_helper(x) \
+  if (!(x##_hlsl = compile_compute_shader(SUNSHINE_SHADERS_DIR "/" #x ".hlsl"))) \
+    return -1;
+
+    compile_compute_shader_helper(convert_yuv420_cs);
+    compile_compute_shader_helper(convert_yuv420_cs_linear);
+    compile_compute_shader_helper(convert_yuv420_cs_perceptual_quantizer);
 
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps);
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_linear);
@@ -1969,6 +2436,7 @@ namespace platf::dxgi {
 
 #undef compile_vertex_shader_helper
 #undef compile_pixel_shader_helper
+#undef compile_compute_shader_helper
 
     return 0;
   }
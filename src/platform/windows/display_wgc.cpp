@@ -8,7 +8,9 @@
 // local includes
 #include "display.h"
 #include "misc.h"
+#include "src/config.h"
 #include "src/logging.h"
+#include "src/process.h"
 
 // Gross hack to work around MINGW-packages#22160
 #define ____FIReference_1_boolean_INTERFACE_DEFINED__
@@ -61,8 +63,98 @@ constexpr auto __mingw_uuidof<winrt::IDirect3DDxgiInterfaceAccess>() -> GUID con
 #endif
 
 namespace platf::dxgi {
-  wgc_capture_t::wgc_capture_t() {
-    InitializeConditionVariable(&frame_present_cv);
+  namespace {
+    constexpr auto WINDOW_CHECK_INTERVAL = 1s;
+
+    // A window WGC refused to capture isn't picked again, or the display would be set up again every second
+    HWND refused_window = nullptr;
+
+    struct window_search_t {
+      HANDLE process_group;
+      DWORD process_id;
+      HWND foreground;
+      HWND found = nullptr;
+      LONGLONG found_area = 0;
+    };
+
+    bool is_app_process(const window_search_t &search, DWORD process_id) {
+      if (process_id == search.process_id) {
+        return true;
+      }
+      if (!search.process_group) {
+        return false;
+      }
+
+      HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, process_id);
+      if (!process) {
+        return false;
+      }
+
+      BOOL in_group = FALSE;
+      auto result = IsProcessInJob(process, search.process_group, &in_group);
+      CloseHandle(process);
+      return result && in_group;
+    }
+
+    BOOL CALLBACK on_window(HWND hwnd, LPARAM param) {
+      auto &search = *(window_search_t *) param;
+
+      // Only visible top level windows, not their dialogs, tool windows or windows DWM hides
+      if (hwnd == refused_window || !IsWindowVisible(hwnd) || IsIconic(hwnd) || GetWindow(hwnd, GW_OWNER) || (GetWindowLongW(hwnd, GWL_EXSTYLE) & WS_EX_TOOLWINDOW)) {
+        return TRUE;
+      }
+      DWORD cloaked = 0;
+      if (SUCCEEDED(DwmGetWindowAttribute(hwnd, DWMWA_CLOAKED, &cloaked, sizeof(cloaked))) && cloaked) {
+        return TRUE;
+      }
+
+      DWORD process_id = 0;
+      GetWindowThreadProcessId(hwnd, &process_id);
+      RECT rect;
+      if (!is_app_process(search, process_id) || !GetWindowRect(hwnd, &rect)) {
+        return TRUE;
+      }
+
+      // The window the user is looking at wins, then the largest one, which splash screens and launchers rarely are
+      if (hwnd == search.foreground) {
+        search.found = hwnd;
+        return FALSE;
+      }
+      auto area = (LONGLONG) (rect.right - rect.left) * (rect.bottom - rect.top);
+      if (area > search.found_area) {
+        search.found = hwnd;
+        search.found_area = area;
+      }
+      return TRUE;
+    }
+
+    /**
+     * @brief Find the main window of the running app.
+     * @return The foreground window if it belongs to a process of the app, else the largest visible window of one, or nullptr.
+     */
+    HWND find_app_window() {
+      auto [process_group, process_id] = proc::proc.app_processes();
+      if (!process_group && !process_id) {
+        return nullptr;
+      }
+
+      window_search_t search {(HANDLE) process_group, process_id, GetForegroundWindow()};
+      EnumWindows(on_window, (LPARAM) &search);
+      return search.found;
+    }
+
+    RECT window_bounds_of(HWND window) {
+      // The extended frame bounds leave out the invisible resize borders, like the captured surface does
+      RECT bounds {};
+      if (FAILED(DwmGetWindowAttribute(window, DWMWA_EXTENDED_FRAME_BOUNDS, &bounds, sizeof(bounds)))) {
+        GetWindowRect(window, &bounds);
+      }
+      return bounds;
+    }
+  }  // namespace
+
+  wgc_capture_t::wgc_capture_t():
+      frame_event {CreateEventW(nullptr, FALSE, FALSE, nullptr)} {
   }
 
   wgc_capture_t::~wgc_capture_t() {
@@ -75,6 +167,20 @@ namespace platf::dxgi {
     item = nullptr;
     capture_session = nullptr;
     frame_pool = nullptr;
+
+    if (auto frame = take_produced_frame()) {
+      frame.Close();
+    }
+
+    if (frames_replaced) {
+      BOOST_LOG(debug) << "WGC: "sv << frames_replaced << " frames were replaced by newer ones before capture picked them up"sv;
+    }
+  }
+
+  winrt::Direct3D11CaptureFrame wgc_capture_t::take_produced_frame() {
+    winrt::Direct3D11CaptureFrame frame {nullptr};
+    winrt::attach_abi(frame, produced_frame.exchange(nullptr, std::memory_order_acq_rel));
+    return frame;
   }
 
   /**
@@ -107,21 +213,61 @@ namespace platf::dxgi {
     uwp_device = d3d_comhandle.as<winrt::IDirect3DDevice>();
     display->output->GetDesc(&output_desc);
 
-    auto monitor_factory = winrt::get_activation_factory<winrt::GraphicsCaptureItem, IGraphicsCaptureItemInterop>();
-    if (monitor_factory == nullptr ||
-        FAILED(status = monitor_factory->CreateForMonitor(output_desc.Monitor, winrt::guid_of<winrt::IGraphicsCaptureItem>(), winrt::put_abi(item)))) {
+    auto item_factory = winrt::get_activation_factory<winrt::GraphicsCaptureItem, IGraphicsCaptureItemInterop>();
+    if (item_factory == nullptr) {
+      BOOST_LOG(error) << "Screen capture is not supported on this device for this release of Windows: failed to acquire display"sv;
+      return -1;
+    }
+
+    if (config::video.wgc_window_capture) {
+      next_window_check = std::chrono::steady_clock::now() + WINDOW_CHECK_INTERVAL;
+
+      window = find_app_window();
+      if (!window) {
+        BOOST_LOG(info) << "WGC: the app has no window to capture yet, capturing the monitor"sv;
+      } else if (FAILED(status = item_factory->CreateForWindow(window, winrt::guid_of<winrt::IGraphicsCaptureItem>(), winrt::put_abi(item)))) {
+        BOOST_LOG(warning) << "WGC: failed to acquire the window of the app, capturing the monitor: [0x"sv << util::hex(status).to_string_view() << ']';
+        refused_window = window;
+        window = nullptr;
+        item = nullptr;
+      }
+    }
+
+    if (!window && FAILED(status = item_factory->CreateForMonitor(output_desc.Monitor, winrt::guid_of<winrt::IGraphicsCaptureItem>(), winrt::put_abi(item)))) {
       BOOST_LOG(error) << "Screen capture is not supported on this device for this release of Windows: failed to acquire display: [0x"sv << util::hex(status).to_string_view() << ']';
       return -1;
     }
 
+    if (window) {
+      // The window is captured at its own size, and scaled to the client's resolution by the encoder
+      auto size = item.Size();
+      window_bounds = window_bounds_of(window);
+      display->width = display->width_before_rotation = size.Width;
+      display->height = display->height_before_rotation = size.Height;
+      display->display_rotation = DXGI_MODE_ROTATION_IDENTITY;
+
+      // Absolute mouse input lands on the window, whose offset starts at 0x0 like those of the monitors
+      display->offset_x = window_bounds.left - GetSystemMetrics(SM_XVIRTUALSCREEN);
+      display->offset_y = window_bounds.top - GetSystemMetrics(SM_YVIRTUALSCREEN);
+
+      BOOST_LOG(info) << "WGC: capturing the window of the app, "sv << size.Width << 'x' << size.Height << " at "sv << display->offset_x << 'x' << display->offset_y;
+    }
+
     if (config.dynamicRange) {
       display->capture_format = DXGI_FORMAT_R16G16B16A16_FLOAT;
     } else {
       display->capture_format = DXGI_FORMAT_B8G8R8A8_UNORM;
     }
 
+    if (!frame_event) {
+      BOOST_LOG(error) << "Failed to create frame event [0x"sv << util::hex(GetLastError()).to_string_view() << ']';
+      return -1;
+    }
+
+    // The capture thread holds one frame and the handoff slot another, so WGC needs
+    // a third buffer to render the next frame into without waiting for either
     try {
-      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), 2, item.Size());
+      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), config::video.wgc_frame_pool_size, item.Size());
       capture_session = frame_pool.CreateCaptureSession(item);
       frame_pool.FrameArrived({this, &wgc_capture_t::on_frame_arrived});
     } catch (winrt::hresult_error &e) {
@@ -158,7 +304,7 @@ namespace platf::dxgi {
   /**
    * This function runs in a separate thread spawned by the frame pool and is a producer of frames.
    * To maintain parity with the original display interface, this frame will be consumed by the capture thread.
-   * Acquire a read-write lock, make the produced frame available to the capture thread, then wake the capture thread.
+   * Swap the produced frame into the handoff slot, releasing the frame it replaces, then wake the capture thread.
    */
   void wgc_capture_t::on_frame_arrived(winrt::Direct3D11CaptureFramePool const &sender, winrt::IInspectable const &) {
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame frame {nullptr};
@@ -168,16 +314,24 @@ namespace platf::dxgi {
       BOOST_LOG(warning) << "Failed to capture frame: "sv << e.code();
       return;
     }
-    if (frame != nullptr) {
-      AcquireSRWLockExclusive(&frame_lock);
-      if (produced_frame) {
-        produced_frame.Close();
-      }
+    if (frame == nullptr) {
+      return;
+    }
 
-      produced_frame = frame;
-      ReleaseSRWLockExclusive(&frame_lock);
-      WakeConditionVariable(&frame_present_cv);
+    // SystemRelativeTime is in QueryPerformanceCounter() ticks, from when the frame was composed
+    delivery_delay_logger.collect_and_log([&]() {
+      return std::chrono::duration<double, std::milli>(qpc_time_difference(qpc_counter(), frame.SystemRelativeTime().count())).count();
+    });
+
+    winrt::Direct3D11CaptureFrame replaced {nullptr};
+    winrt::attach_abi(replaced, produced_frame.exchange(winrt::detach_abi(frame), std::memory_order_acq_rel));
+    if (replaced) {
+      // Return the buffer of the frame nobody picked up to the pool
+      replaced.Close();
+      ++frames_replaced;
     }
+
+    SetEvent(frame_event.get());
   }
 
   /**
@@ -191,22 +345,32 @@ namespace platf::dxgi {
     // this CONSUMER runs in the capture thread
     release_frame();
 
-    AcquireSRWLockExclusive(&frame_lock);
-    if (produced_frame == nullptr && SleepConditionVariableSRW(&frame_present_cv, &frame_lock, timeout.count(), 0) == 0) {
-      ReleaseSRWLockExclusive(&frame_lock);
-      if (GetLastError() == ERROR_TIMEOUT) {
-        return capture_e::timeout;
-      } else {
-        return capture_e::error;
+    if (config::video.wgc_window_capture) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= next_window_check) {
+        next_window_check = now + WINDOW_CHECK_INTERVAL;
+        if (window_changed()) {
+          return capture_e::reinit;
+        }
       }
     }
-    if (produced_frame) {
-      consumed_frame = produced_frame;
-      produced_frame = nullptr;
-    }
-    ReleaseSRWLockExclusive(&frame_lock);
-    if (consumed_frame == nullptr) {  // spurious wakeup
-      return capture_e::timeout;
+
+    consumed_frame = take_produced_frame();
+    if (consumed_frame == nullptr) {
+      switch (WaitForSingleObject(frame_event.get(), timeout.count())) {
+        case WAIT_OBJECT_0:
+          break;
+        case WAIT_TIMEOUT:
+          return capture_e::timeout;
+        default:
+          return capture_e::error;
+      }
+
+      // The event may be left signaled by a frame we already took
+      consumed_frame = take_produced_frame();
+      if (consumed_frame == nullptr) {
+        return capture_e::timeout;
+      }
     }
 
     auto capture_access = consumed_frame.Surface().as<winrt::IDirect3DDxgiInterfaceAccess>();
@@ -226,6 +390,36 @@ namespace platf::dxgi {
     return capture_e::ok;
   }
 
+  bool wgc_capture_t::window_changed() {
+    if (!window) {
+      if (find_app_window()) {
+        BOOST_LOG(info) << "WGC: the app has a window to capture now"sv;
+        return true;
+      }
+      return false;
+    }
+
+    if (!IsWindow(window) || IsIconic(window)) {
+      BOOST_LOG(info) << "WGC: the window of the app is gone, capturing the monitor"sv;
+      return true;
+    }
+
+    auto bounds = window_bounds_of(window);
+    if (!EqualRect(&bounds, &window_bounds)) {
+      BOOST_LOG(info) << "WGC: the window of the app moved or was resized"sv;
+      return true;
+    }
+
+    // Capturing a window the user switched away from doesn't show them what they're looking at
+    auto found = find_app_window();
+    if (found && found != window && found == GetForegroundWindow()) {
+      BOOST_LOG(info) << "WGC: another window of the app is in the foreground"sv;
+      return true;
+    }
+
+    return false;
+  }
+
   int wgc_capture_t::set_cursor_visible(bool x) {
     try {
       if (capture_session.IsCursorCaptureEnabled() != x) {
@@ -242,7 +436,9 @@ namespace platf::dxgi {
       return -1;
     }
 
-    texture.reset();
+    for (auto &texture : staging_textures) {
+      texture.reset();
+    }
     return 0;
   }
 
@@ -254,7 +450,6 @@ namespace platf::dxgi {
    * @param cursor_visible whether to capture the cursor
    */
   capture_e display_wgc_ram_t::snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) {
-    HRESULT status;
     texture2d_t src;
     uint64_t frame_qpc;
     dup.set_cursor_visible(cursor_visible);
@@ -267,25 +462,12 @@ namespace platf::dxgi {
     D3D11_TEXTURE2D_DESC desc;
     src->GetDesc(&desc);
 
-    // Create the staging texture if it doesn't exist. It should match the source in size and format.
-    if (texture == nullptr) {
+    // Create the staging textures if they don't exist. They should match the source in size and format.
+    if (staging_textures[0] == nullptr) {
       capture_format = desc.Format;
       BOOST_LOG(info) << "Capture format ["sv << dxgi_format_to_string(capture_format) << ']';
 
-      D3D11_TEXTURE2D_DESC t {};
-      t.Width = width;
-      t.Height = height;
-      t.MipLevels = 1;
-      t.ArraySize = 1;
-      t.SampleDesc.Count = 1;
-      t.Usage = D3D11_USAGE_STAGING;
-      t.Format = capture_format;
-      t.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-
-      auto status = device->CreateTexture2D(&t, nullptr, &texture);
-
-      if (FAILED(status)) {
-        BOOST_LOG(error) << "Failed to create staging texture [0x"sv << util::hex(status).to_string_view() << ']';
+      if (create_staging_textures()) {
         return capture_e::error;
       }
     }
@@ -303,34 +485,17 @@ namespace platf::dxgi {
       return capture_e::reinit;
     }
 
-    // Copy from GPU to CPU
-    device_ctx->CopyResource(texture.get(), src.get());
+    copy_to_staging(src.get());
 
     if (!pull_free_image_cb(img_out)) {
       return capture_e::interrupted;
     }
     auto img = (img_t *) img_out.get();
 
-    // Map the staging texture for CPU access (making it inaccessible for the GPU)
-    if (FAILED(status = device_ctx->Map(texture.get(), 0, D3D11_MAP_READ, 0, &img_info))) {
-      BOOST_LOG(error) << "Failed to map texture [0x"sv << util::hex(status).to_string_view() << ']';
-
+    if (read_staging(img)) {
       return capture_e::error;
     }
 
-    // Now that we know the capture format, we can finish creating the image
-    if (complete_img(img, false)) {
-      device_ctx->Unmap(texture.get(), 0);
-      img_info.pData = nullptr;
-      return capture_e::error;
-    }
-
-    std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
-
-    // Unmap the staging texture to allow GPU access again
-    device_ctx->Unmap(texture.get(), 0);
-    img_info.pData = nullptr;
-
     if (img) {
       img->frame_timestamp = frame_timestamp;
     }
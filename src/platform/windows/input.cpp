@@ -8,8 +8,10 @@
 #include <Windows.h>
 
 // standard includes
+#include <algorithm>
 #include <cmath>
 #include <thread>
+#include <vector>
 
 // lib includes
 #include <ViGEm/Client.h>
@@ -27,6 +29,10 @@ namespace platf {
 
   thread_local HDESK _lastKnownInputDesktop = nullptr;
 
+  // Mouse and keyboard events collected between begin_input_batch() and end_input_batch()
+  thread_local bool _batching_inputs = false;
+  thread_local std::vector<INPUT> _batched_inputs;
+
   constexpr touch_port_t target_touch_port {
     0,
     0,
@@ -460,19 +466,65 @@ namespace platf {
 
   /**
    * @brief Calls SendInput() and switches input desktops if required.
+   * @param inputs The `INPUT` structs to send.
+   * @param count The number of elements in `inputs`.
+   */
+  void send_inputs(INPUT *inputs, UINT count) {
+    thread_local logging::percentile_periodic_logger<double> send_input_latency_logger {debug, "Input: SendInput() latency", "us"};
+    thread_local logging::min_max_avg_periodic_logger<UINT> send_input_batch_logger {debug, "Input: events per SendInput()", ""};
+
+    send_input_batch_logger.collect_and_log(count);
+
+    while (count) {
+      auto start = std::chrono::steady_clock::now();
+      auto sent = SendInput(count, inputs, sizeof(INPUT));
+      send_input_latency_logger.collect_and_log(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+
+      // Events are only dropped from the point where injection was blocked
+      inputs += sent;
+      count -= sent;
+      if (count) {
+        auto hDesk = syncThreadDesktop();
+        if (_lastKnownInputDesktop != hDesk) {
+          _lastKnownInputDesktop = hDesk;
+          continue;
+        }
+        BOOST_LOG(error) << "Couldn't send input"sv;
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief Send the mouse and keyboard events collected so far.
+   */
+  void flush_batched_inputs() {
+    if (!_batched_inputs.empty()) {
+      send_inputs(_batched_inputs.data(), _batched_inputs.size());
+      _batched_inputs.clear();
+    }
+  }
+
+  /**
+   * @brief Calls SendInput(), or collects the event while a batch is in progress.
    * @param i The `INPUT` struct to send.
    */
   void send_input(INPUT &i) {
-  retry:
-    auto send = SendInput(1, &i, sizeof(INPUT));
-    if (send != 1) {
-      auto hDesk = syncThreadDesktop();
-      if (_lastKnownInputDesktop != hDesk) {
-        _lastKnownInputDesktop = hDesk;
-        goto retry;
-      }
-      BOOST_LOG(error) << "Couldn't send input"sv;
+    if (_batching_inputs) {
+      _batched_inputs.emplace_back(i);
+      return;
     }
+
+    send_inputs(&i, 1);
+  }
+
+  void begin_input_batch(input_t &input) {
+    _batching_inputs = true;
+  }
+
+  void end_input_batch(input_t &input) {
+    _batching_inputs = false;
+    flush_batched_inputs();
   }
 
   /**
@@ -485,6 +537,10 @@ namespace platf {
    * @return true if input was successfully injected.
    */
   bool inject_synthetic_pointer_input(input_raw_t *input, HSYNTHETICPOINTERDEVICE device, const POINTER_TYPE_INFO *pointerInfo, UINT32 count) {
+    // Keep the order of events, and each call injects a single frame of every contact of the device
+    // so updates of the same pointer can't be merged into one call
+    flush_batched_inputs();
+
   retry:
     if (!input->fnInjectSyntheticPointerInput(device, pointerInfo, count)) {
       auto hDesk = syncThreadDesktop();
@@ -888,50 +944,12 @@ namespace platf {
   constexpr auto EDGE_TRIGGERED_POINTER_FLAGS = POINTER_FLAG_DOWN | POINTER_FLAG_UP | POINTER_FLAG_CANCELED | POINTER_FLAG_UPDATE;
 
   /**
-   * @brief Sends a touch event to the OS.
-   * @param input The client-specific input context.
+   * @brief Updates the slot of a touch pointer with a touch event, to be injected with the other touch slots.
+   * @param raw The raw client-specific input context.
    * @param touch_port The current viewport for translating to screen coordinates.
    * @param touch The touch event.
    */
-  void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch) {
-    auto raw = (client_input_raw_t *) input;
-
-    // Bail if we're not running on an OS that supports virtual touch input
-    if (!raw->global->fnCreateSyntheticPointerDevice ||
-        !raw->global->fnInjectSyntheticPointerInput ||
-        !raw->global->fnDestroySyntheticPointerDevice) {
-      BOOST_LOG(warning) << "Touch input requires Windows 10 1809 or later"sv;
-      return;
-    }
-
-    // If there's not already a virtual touch device, create one now
-    if (!raw->touch) {
-      if (touch.eventType != LI_TOUCH_EVENT_CANCEL_ALL) {
-        BOOST_LOG(info) << "Creating virtual touch input device"sv;
-        raw->touch = raw->global->fnCreateSyntheticPointerDevice(PT_TOUCH, ARRAYSIZE(raw->touchInfo), POINTER_FEEDBACK_DEFAULT);
-        if (!raw->touch) {
-          auto err = GetLastError();
-          BOOST_LOG(warning) << "Failed to create virtual touch device: "sv << err;
-          return;
-        }
-      } else {
-        // No need to cancel anything if we had no touch input device
-        return;
-      }
-    }
-
-    // Cancel touch repeat callbacks
-    if (raw->touchRepeatTask) {
-      task_pool.cancel(raw->touchRepeatTask);
-      raw->touchRepeatTask = nullptr;
-    }
-
-    // If this is a special request to cancel all touches, do that and return
-    if (touch.eventType == LI_TOUCH_EVENT_CANCEL_ALL) {
-      cancel_all_active_touches(raw);
-      return;
-    }
-
+  void update_touch_slot(client_input_raw_t *raw, const touch_port_t &touch_port, const touch_input_t &touch) {
     // Find or allocate an entry for this touch pointer ID
     auto pointer = pointer_by_id(raw, touch.pointerId, touch.eventType);
     if (!pointer) {
@@ -997,18 +1015,107 @@ namespace platf {
     } else {
       touchInfo.orientation = 0;
     }
+  }
 
+  /**
+   * @brief Injects the active touch slots, and clears the flags that only apply to this injection.
+   * @param raw The raw client-specific input context.
+   * @return `false` if the injection failed.
+   */
+  bool inject_touch_slots(client_input_raw_t *raw) {
     if (!inject_synthetic_pointer_input(raw->global, raw->touch, raw->touchInfo, raw->activeTouchSlots)) {
       auto err = GetLastError();
       BOOST_LOG(warning) << "Failed to inject virtual touch input: "sv << err;
-      return;
+      return false;
     }
 
     // Clear pointer flags that should only remain set for one frame
-    touchInfo.pointerInfo.pointerFlags &= ~EDGE_TRIGGERED_POINTER_FLAGS;
+    for (UINT32 i = 0; i < raw->activeTouchSlots; i++) {
+      raw->touchInfo[i].touchInfo.pointerInfo.pointerFlags &= ~EDGE_TRIGGERED_POINTER_FLAGS;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Sends a frame of touch events to the OS.
+   * @details The touches are injected together, since InjectSyntheticPointerInput() takes all the active
+   *          pointers at once anyway. Only a pointer's second event within the frame is injected separately.
+   * @param input The client-specific input context.
+   * @param touch_port The current viewport for translating to screen coordinates.
+   * @param touches The touch events.
+   */
+  void touch_update(client_input_t *input, const touch_port_t &touch_port, std::span<const touch_input_t> touches) {
+    auto raw = (client_input_raw_t *) input;
+
+    // Bail if we're not running on an OS that supports virtual touch input
+    if (!raw->global->fnCreateSyntheticPointerDevice ||
+        !raw->global->fnInjectSyntheticPointerInput ||
+        !raw->global->fnDestroySyntheticPointerDevice) {
+      BOOST_LOG(warning) << "Touch input requires Windows 10 1809 or later"sv;
+      return;
+    }
+
+    // If there's not already a virtual touch device, create one now
+    if (!raw->touch) {
+      auto cancel_only = std::all_of(std::begin(touches), std::end(touches), [](const touch_input_t &touch) {
+        return touch.eventType == LI_TOUCH_EVENT_CANCEL_ALL;
+      });
+
+      if (!cancel_only) {
+        BOOST_LOG(info) << "Creating virtual touch input device"sv;
+        raw->touch = raw->global->fnCreateSyntheticPointerDevice(PT_TOUCH, ARRAYSIZE(raw->touchInfo), POINTER_FEEDBACK_DEFAULT);
+        if (!raw->touch) {
+          auto err = GetLastError();
+          BOOST_LOG(warning) << "Failed to create virtual touch device: "sv << err;
+          return;
+        }
+      } else {
+        // No need to cancel anything if we had no touch input device
+        return;
+      }
+    }
+
+    // Cancel touch repeat callbacks
+    if (raw->touchRepeatTask) {
+      task_pool.cancel(raw->touchRepeatTask);
+      raw->touchRepeatTask = nullptr;
+    }
+
+    // The touches since frame_start are in the touch slots, but not injected yet
+    std::size_t frame_start = 0;
+    for (std::size_t i = 0; i < touches.size(); i++) {
+      auto &touch = touches[i];
+
+      auto repeated = std::any_of(std::begin(touches) + frame_start, std::begin(touches) + i, [&touch](const touch_input_t &other) {
+        return other.pointerId == touch.pointerId;
+      });
+      if ((repeated || touch.eventType == LI_TOUCH_EVENT_CANCEL_ALL) && i > frame_start) {
+        if (!inject_touch_slots(raw)) {
+          return;
+        }
+        frame_start = i;
+      }
+
+      // If this is a special request to cancel all touches, do that and carry on with a clean slate
+      if (touch.eventType == LI_TOUCH_EVENT_CANCEL_ALL) {
+        cancel_all_active_touches(raw);
+        frame_start = i + 1;
+        continue;
+      }
+
+      update_touch_slot(raw, touch_port, touch);
+    }
+
+    if (frame_start < touches.size() && !inject_touch_slots(raw)) {
+      return;
+    }
 
     // If we still have an active touch, refresh the touch state periodically
-    if (raw->activeTouchSlots > 1 || touchInfo.pointerInfo.pointerFlags != POINTER_FLAG_NONE) {
+    auto active = std::any_of(raw->touchInfo, raw->touchInfo + raw->activeTouchSlots, [](const POINTER_TYPE_INFO &info) {
+      return info.touchInfo.pointerInfo.pointerFlags != POINTER_FLAG_NONE;
+    });
+    if (active) {
       raw->touchRepeatTask = task_pool.pushDelayed(repeat_touch, ISPI_REPEAT_INTERVAL, raw).task_id;
     }
   }
@@ -3,10 +3,14 @@
  * @brief Miscellaneous definitions for Windows.
  */
 // standard includes
+#include <algorithm>
+#include <array>
 #include <csignal>
 #include <filesystem>
 #include <iomanip>
 #include <iterator>
+#include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
 
@@ -21,6 +25,7 @@
 #include <dwmapi.h>
 #include <iphlpapi.h>
 #include <iterator>
+#include <psapi.h>
 #include <timeapi.h>
 #include <UserEnv.h>
 #include <WinSock2.h>
@@ -40,6 +45,8 @@
 // local includes
 #include "misc.h"
 #include "nvprefs/nvprefs_interface.h"
+#include "rio_send.h"
+#include "src/config.h"
 #include "src/entry_handler.h"
 #include "src/globals.h"
 #include "src/logging.h"
@@ -1048,6 +1055,286 @@ namespace platf {
     }
   }
 
+  std::vector<cpu_t> cpu_topology() {
+    std::vector<cpu_t> cpus;
+
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &size);
+    std::vector<std::uint8_t> buffer(size);
+    if (!GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) buffer.data(), &size)) {
+      BOOST_LOG(warning) << "GetLogicalProcessorInformationEx() failed: "sv << GetLastError();
+      return cpus;
+    }
+
+    // CPUs are numbered across processor groups of 64
+    auto for_each_cpu = [](const GROUP_AFFINITY &affinity, auto &&f) {
+      for (int bit = 0; bit < 64; ++bit) {
+        if (affinity.Mask & ((KAFFINITY) 1 << bit)) {
+          f(affinity.Group * 64 + bit);
+        }
+      }
+    };
+
+    std::map<int, cpu_t> by_id;
+    std::map<int, int> efficiency_classes;
+    int max_efficiency_class = 0;
+    int core = 0;
+    for (DWORD offset = 0; offset < size;) {
+      auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) (buffer.data() + offset);
+      offset += info->Size;
+
+      if (info->Relationship != RelationProcessorCore) {
+        continue;
+      }
+
+      // Higher classes are more performant, hybrid CPUs have E-cores in class 0
+      max_efficiency_class = std::max<int>(max_efficiency_class, info->Processor.EfficiencyClass);
+      for (WORD group = 0; group < info->Processor.GroupCount; ++group) {
+        for_each_cpu(info->Processor.GroupMask[group], [&](int id) {
+          by_id[id] = cpu_t {id, core, 0, false};
+          efficiency_classes[id] = info->Processor.EfficiencyClass;
+        });
+      }
+      ++core;
+    }
+
+    // CPUs sharing the last level cache, like the cores of a CCD, are named after the first of them
+    std::map<int, int> cache_levels;
+    for (DWORD offset = 0; offset < size;) {
+      auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) (buffer.data() + offset);
+      offset += info->Size;
+
+      if (info->Relationship != RelationCache || (info->Cache.Type != CacheUnified && info->Cache.Type != CacheData)) {
+        continue;
+      }
+
+      int first = -1;
+      for_each_cpu(info->Cache.GroupMask, [&](int id) {
+        if (first < 0) {
+          first = id;
+        }
+
+        auto it = by_id.find(id);
+        if (it != std::end(by_id) && info->Cache.Level > cache_levels[id]) {
+          cache_levels[id] = info->Cache.Level;
+          it->second.cache = first;
+        }
+      });
+    }
+
+    // The NUMA nodes, which span a single processor group at most
+    for (DWORD offset = 0; offset < size;) {
+      auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) (buffer.data() + offset);
+      offset += info->Size;
+
+      if (info->Relationship != RelationNumaNode) {
+        continue;
+      }
+
+      for_each_cpu(info->NumaNode.GroupMask, [&](int id) {
+        if (auto it = by_id.find(id); it != std::end(by_id)) {
+          it->second.node = (int) info->NumaNode.NodeNumber;
+        }
+      });
+    }
+
+    for (auto &[id, cpu] : by_id) {
+      cpu.efficiency = max_efficiency_class > 0 && efficiency_classes[id] < max_efficiency_class;
+      cpus.emplace_back(cpu);
+    }
+
+    return cpus;
+  }
+
+  std::optional<int> gpu_numa_node(const std::string &adapter_name) {
+    // DXGI doesn't tell which node an adapter is attached to
+    return std::nullopt;
+  }
+
+  std::optional<int> interface_numa_node(const std::string_view &address) {
+    // Neither does the IP Helper API for network adapters
+    return std::nullopt;
+  }
+
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    if (cpus.empty()) {
+      return false;
+    }
+
+    // A thread runs in a single processor group, the one of the first CPU
+    GROUP_AFFINITY affinity {};
+    affinity.Group = (WORD) (cpus.front() / 64);
+    for (auto cpu : cpus) {
+      if (cpu / 64 == affinity.Group) {
+        affinity.Mask |= (KAFFINITY) 1 << (cpu % 64);
+      }
+    }
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr)) {
+      BOOST_LOG(warning) << "SetThreadGroupAffinity() failed: "sv << GetLastError();
+      return false;
+    }
+
+    return true;
+  }
+
+  std::vector<int> thread_affinity() {
+    std::vector<int> cpus;
+
+    GROUP_AFFINITY affinity {};
+    if (!GetThreadGroupAffinity(GetCurrentThread(), &affinity)) {
+      return cpus;
+    }
+
+    for (int bit = 0; bit < 64; ++bit) {
+      if (affinity.Mask & ((KAFFINITY) 1 << bit)) {
+        cpus.emplace_back(affinity.Group * 64 + bit);
+      }
+    }
+
+    return cpus;
+  }
+
+  bool set_thread_realtime(int priority) {
+    // Threads only get real-time priorities with the whole process, the audio threads get MMCSS priorities instead
+    return false;
+  }
+
+  namespace {
+    /**
+     * @brief Enable the "Lock pages in memory" privilege large pages need, if the user holds it.
+     * @return true if the privilege is enabled.
+     */
+    bool enable_lock_memory_privilege() {
+      HANDLE token;
+      if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+      }
+      auto fg = util::fail_guard([token]() {
+        CloseHandle(token);
+      });
+
+      TOKEN_PRIVILEGES tp {};
+      if (!LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)) {
+        return false;
+      }
+      tp.PrivilegeCount = 1;
+      tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+      // Succeeds without granting anything when the user doesn't hold the privilege
+      return AdjustTokenPrivileges(token, false, &tp, sizeof(tp), nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+    }
+  }  // namespace
+
+  namespace {
+    /**
+     * @brief A thread sampled through a handle of its own, which stays valid after the thread exits.
+     */
+    class win_thread_t: public thread_handle_t {
+    public:
+      explicit win_thread_t(HANDLE thread):
+          _thread {thread} {
+      }
+
+      ~win_thread_t() override {
+        CloseHandle(_thread);
+      }
+
+      std::optional<thread_times_t> times() override {
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(_thread, &creation, &exit, &kernel, &user)) {
+          return std::nullopt;
+        }
+
+        auto to_100ns = [](FILETIME time) {
+          return ((std::uint64_t) time.dwHighDateTime << 32) | time.dwLowDateTime;
+        };
+
+        thread_times_t times {};
+        times.cpu_time = std::chrono::nanoseconds {(to_100ns(kernel) + to_100ns(user)) * 100};
+
+        // GetThreadTimes() only moves at each clock tick, the cycles show shorter bursts of work
+        ULONG64 cycles;
+        if (QueryThreadCycleTime(_thread, &cycles)) {
+          times.cycles = cycles;
+        }
+
+        return times;
+      }
+
+    private:
+      HANDLE _thread;
+    };
+  }  // namespace
+
+  std::unique_ptr<thread_handle_t> current_thread() {
+    HANDLE thread;
+    if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &thread, THREAD_QUERY_LIMITED_INFORMATION, FALSE, 0)) {
+      BOOST_LOG(warning) << "DuplicateHandle() failed: "sv << GetLastError();
+      return nullptr;
+    }
+
+    return std::make_unique<win_thread_t>(thread);
+  }
+
+  std::optional<pages_t> map_pages(std::size_t size, bool lock) {
+    size = std::max<std::size_t>(size, 1);
+
+    // Large pages are always locked, and come in whole large pages
+    static const bool large_pages = enable_lock_memory_privilege();
+    if (auto large_page_size = GetLargePageMinimum(); large_pages && large_page_size) {
+      auto large_size = (size + large_page_size - 1) / large_page_size * large_page_size;
+      if (auto data = VirtualAlloc(nullptr, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE)) {
+        return pages_t {(std::uint8_t *) data, large_size, true, true};
+      }
+
+      BOOST_LOG(debug) << "Couldn't allocate large pages: "sv << GetLastError();
+    }
+
+    auto data = (std::uint8_t *) VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!data) {
+      BOOST_LOG(warning) << "VirtualAlloc() failed: "sv << GetLastError();
+      return std::nullopt;
+    }
+
+    pages_t pages {data, size, false, false};
+    if (lock) {
+      // The working set must be able to hold the locked pages on top of everything else
+      SIZE_T min_working_set, max_working_set;
+      if (GetProcessWorkingSetSize(GetCurrentProcess(), &min_working_set, &max_working_set)) {
+        SetProcessWorkingSetSize(GetCurrentProcess(), min_working_set + size, max_working_set + size);
+      }
+
+      // Locking also faults every page in
+      pages.locked = VirtualLock(data, size);
+      if (!pages.locked) {
+        BOOST_LOG(warning) << "VirtualLock() failed: "sv << GetLastError();
+      }
+    }
+
+    if (!pages.locked) {
+      for (std::size_t offset = 0; offset < size; offset += 4096) {
+        data[offset] = 0;
+      }
+    }
+
+    return pages;
+  }
+
+  void unmap_pages(const pages_t &pages) {
+    VirtualFree(pages.data, 0, MEM_RELEASE);
+  }
+
+  page_faults_t page_faults() {
+    PROCESS_MEMORY_COUNTERS counters {};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+      return {};
+    }
+
+    // Soft and hard faults aren't told apart
+    return {counters.PageFaultCount, 0};
+  }
+
   void streaming_will_start() {
     static std::once_flag load_wlanapi_once_flag;
     std::call_once(load_wlanapi_once_flag, []() {
@@ -1346,6 +1633,94 @@ namespace platf {
     return saddr_v6;
   }
 
+  namespace {
+    struct rio_socket_t {
+      std::mutex lock;
+      std::unique_ptr<rio::sender_t> sender;
+    };
+
+    struct rio_sockets_t {
+      std::mutex lock;
+      std::map<SOCKET, std::shared_ptr<rio_socket_t>> sockets;
+    };
+
+    rio_sockets_t &rio_sockets() {
+      static rio_sockets_t sockets;
+      return sockets;
+    }
+
+    std::shared_ptr<rio_socket_t> find_rio_socket(std::uintptr_t native_socket) {
+      auto &reg = rio_sockets();
+      std::lock_guard lg {reg.lock};
+      if (auto it = reg.sockets.find((SOCKET) native_socket); it != std::end(reg.sockets)) {
+        return it->second;
+      }
+
+      return nullptr;
+    }
+
+    /**
+     * @brief Queue packets with Registered I/O if the socket was opened for it.
+     * @param native_socket The socket.
+     * @param msg The message holding the destination and the control messages to send with every packet.
+     * @param packets The packets.
+     * @return The status of the send.
+     */
+    rio::status_e rio_send(std::uintptr_t native_socket, const WSAMSG &msg, std::span<const rio::packet_t> packets) {
+      auto socket = find_rio_socket(native_socket);
+      if (!socket) {
+        return rio::status_e::unsupported;
+      }
+
+      std::lock_guard lg {socket->lock};
+      auto status = socket->sender->send(msg.name, msg.namelen, msg.Control.buf, msg.Control.len, packets);
+      if (auto failed = socket->sender->take_failed_sends()) {
+        BOOST_LOG(verbose) << "RIO: "sv << failed << " sends failed"sv;
+      }
+
+      return status;
+    }
+  }  // namespace
+
+  std::optional<std::uintptr_t> open_stream_socket(bool v6) {
+    auto &reg = rio_sockets();
+    {
+      // Forget the sockets of previous streams that have been closed since
+      std::lock_guard lg {reg.lock};
+      std::erase_if(reg.sockets, [](auto &entry) {
+        int type;
+        int size = sizeof(type);
+        return getsockopt(entry.first, SOL_SOCKET, SO_TYPE, (char *) &type, &size) == SOCKET_ERROR;
+      });
+    }
+
+    if (!config::stream.registered_io_send) {
+      return std::nullopt;
+    }
+
+    auto socket = rio::open_socket(v6 ? AF_INET6 : AF_INET);
+    if (socket == INVALID_SOCKET) {
+      BOOST_LOG(warning) << "RIO: Couldn't open socket: "sv << WSAGetLastError() << ", falling back to WSASendMsg()"sv;
+      return std::nullopt;
+    }
+
+    auto sender = rio::sender_t::create(socket);
+    if (!sender) {
+      BOOST_LOG(warning) << "RIO: Couldn't set up Registered I/O: "sv << WSAGetLastError() << ", falling back to WSASendMsg()"sv;
+      closesocket(socket);
+      return std::nullopt;
+    }
+
+    auto rio_socket = std::make_shared<rio_socket_t>();
+    rio_socket->sender = std::move(sender);
+
+    std::lock_guard lg {reg.lock};
+    reg.sockets.insert_or_assign(socket, std::move(rio_socket));
+
+    BOOST_LOG(info) << "RIO: Sending with Registered I/O"sv;
+    return (std::uintptr_t) socket;
+  }
+
   // Use UDP segmentation offload if it is supported by the OS. If the NIC is capable, this will use
   // hardware acceleration to reduce CPU usage. Support for USO was introduced in Windows 10 20H1.
   bool send_batch(batched_send_info_t &send_info) {
@@ -1434,6 +1809,33 @@ namespace platf {
       memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
     }
 
+    {
+      // Registered I/O sends every packet on its own, so it only takes the PKTINFO option
+      msg.Control.len = cmbuflen;
+
+      // Kept between batches, so sending the packets of a frame doesn't allocate
+      thread_local std::vector<rio::packet_t> packets;
+      packets.resize(send_info.block_count);
+      for (auto i = 0; i < send_info.block_count; i++) {
+        auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + i) * send_info.payload_size);
+        packets[i] = {
+          send_info.headers ? &send_info.headers[(send_info.block_offset + i) * send_info.header_size] : nullptr,
+          send_info.headers ? send_info.header_size : 0,
+          payload_desc.buffer,
+          send_info.payload_size,
+        };
+      }
+
+      switch (rio_send(send_info.native_socket, msg, packets)) {
+        case rio::status_e::ok:
+          return true;
+        case rio::status_e::error:
+          return false;
+        case rio::status_e::unsupported:
+          break;
+      }
+    }
+
     if (send_info.block_count > 1) {
       cmbuflen += WSA_CMSG_SPACE(sizeof(DWORD));
 
@@ -1451,6 +1853,11 @@ namespace platf {
     return WSASendMsg((SOCKET) send_info.native_socket, &msg, 0, &bytes_sent, nullptr, nullptr) != SOCKET_ERROR;
   }
 
+  bool enable_socket_txtime(std::uintptr_t native_socket) {
+    // Windows has no launch times, Sunshine paces the packets itself
+    return false;
+  }
+
   bool send(send_info_t &send_info) {
     WSAMSG msg;
 
@@ -1521,6 +1928,16 @@ namespace platf {
 
     msg.Control.len = cmbuflen;
 
+    rio::packet_t packet {send_info.header, send_info.header ? send_info.header_size : 0, send_info.payload, send_info.payload_size};
+    switch (rio_send(send_info.native_socket, msg, std::span {&packet, 1})) {
+      case rio::status_e::ok:
+        return true;
+      case rio::status_e::error:
+        return false;
+      case rio::status_e::unsupported:
+        break;
+    }
+
     DWORD bytes_sent;
     if (WSASendMsg((SOCKET) send_info.native_socket, &msg, 0, &bytes_sent, nullptr, nullptr) == SOCKET_ERROR) {
       auto winerr = WSAGetLastError();
@@ -1556,6 +1973,46 @@ namespace platf {
    * @param data_type The type of traffic sent on this socket.
    * @param dscp_tagging Specifies whether to enable DSCP tagging on outgoing traffic.
    */
+  std::optional<int> path_mtu(const boost::asio::ip::address &address, uint16_t port) {
+#if defined(IP_MTU) && defined(IPV6_MTU)
+    auto v4 = address.is_v4() || address.to_v6().is_v4_mapped();
+    auto sock = socket(v4 ? AF_INET : AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+      return std::nullopt;
+    }
+    auto close_fg = util::fail_guard([sock]() {
+      closesocket(sock);
+    });
+
+    // Connecting a UDP socket only picks the route
+    int status;
+    if (v4) {
+      auto address_v4 = address.is_v4() ? address.to_v4() : boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+      auto saddr_v4 = to_sockaddr(address_v4, port);
+      status = connect(sock, (PSOCKADDR) &saddr_v4, sizeof(saddr_v4));
+    } else {
+      auto saddr_v6 = to_sockaddr(address.to_v6(), port);
+      status = connect(sock, (PSOCKADDR) &saddr_v6, sizeof(saddr_v6));
+    }
+    if (status) {
+      BOOST_LOG(debug) << "Couldn't find a route to "sv << address.to_string() << ": "sv << WSAGetLastError();
+      return std::nullopt;
+    }
+
+    // Windows 10 1703 and later tell the MTU of connected sockets
+    DWORD mtu;
+    int size = sizeof(mtu);
+    if (getsockopt(sock, v4 ? IPPROTO_IP : IPPROTO_IPV6, v4 ? IP_MTU : IPV6_MTU, (char *) &mtu, &size)) {
+      return std::nullopt;
+    }
+
+    return (int) mtu;
+#else
+    // The SDK is too old to read the path MTU from a socket
+    return std::nullopt;
+#endif
+  }
+
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging) {
     SOCKADDR_IN saddr_v4;
     SOCKADDR_IN6 saddr_v6;
@@ -1665,6 +2122,111 @@ namespace platf {
     return std::make_unique<qos_t>(flow_id);
   }
 
+  // ENet reads the socket with regular non-overlapped receives, so readiness is signaled
+  // through an event object rather than an I/O completion port
+  int recv_batch(batched_recv_info_t &recv_info) {
+    int received = 0;
+    while (received < recv_info.count) {
+      // The socket may be blocking, so only receive what's already there
+      u_long pending = 0;
+      if (ioctlsocket((SOCKET) recv_info.native_socket, FIONREAD, &pending) == SOCKET_ERROR || !pending) {
+        break;
+      }
+
+      int namelen = (int) recv_info.peers[received].capacity();
+      auto bytes = recvfrom((SOCKET) recv_info.native_socket, recv_info.buffers + received * recv_info.buffer_size, (int) recv_info.buffer_size, 0, recv_info.peers[received].data(), &namelen);
+      if (bytes == SOCKET_ERROR) {
+        auto err = WSAGetLastError();
+
+        // An ICMP error from an earlier send, which doesn't mean the socket is broken
+        if (err == WSAECONNRESET) {
+          continue;
+        }
+
+        // The datagram was truncated to the buffer
+        if (err == WSAEMSGSIZE) {
+          bytes = (int) recv_info.buffer_size;
+        } else {
+          BOOST_LOG(warning) << "recvfrom() failed: "sv << err;
+          return received ? received : -1;
+        }
+      }
+
+      recv_info.sizes[received] = bytes;
+      recv_info.peers[received].resize(namelen);
+      ++received;
+    }
+
+    if (recv_info.receive_times) {
+      std::fill_n(recv_info.receive_times, received, std::chrono::steady_clock::now());
+    }
+
+    return received;
+  }
+
+  bool enable_socket_rx_timestamps(std::uintptr_t native_socket) {
+    // Datagrams are stamped with the time they're read instead
+    return false;
+  }
+
+  class wsa_socket_waiter_t: public socket_waiter_t {
+  public:
+    wsa_socket_waiter_t(SOCKET socket, WSAEVENT socket_event, WSAEVENT wake_event):
+        socket {socket},
+        events {socket_event, wake_event} {
+    }
+
+    ~wsa_socket_waiter_t() override {
+      WSAEventSelect(socket, nullptr, 0);
+      WSACloseEvent(events[0]);
+      WSACloseEvent(events[1]);
+    }
+
+    void wait(std::chrono::milliseconds timeout) override {
+      auto res = WSAWaitForMultipleEvents(events.size(), events.data(), FALSE, (DWORD) timeout.count(), FALSE);
+      if (res == WSA_WAIT_EVENT_0) {
+        // Resets the event, it's signaled again when a datagram arrives after the next receive
+        WSANETWORKEVENTS network_events;
+        WSAEnumNetworkEvents(socket, events[0], &network_events);
+      } else if (res == WSA_WAIT_EVENT_0 + 1) {
+        WSAResetEvent(events[1]);
+      }
+    }
+
+    void wake() override {
+      WSASetEvent(events[1]);
+    }
+
+  private:
+    SOCKET socket;
+    std::array<WSAEVENT, 2> events;
+  };
+
+  std::unique_ptr<socket_waiter_t> make_socket_waiter(std::uintptr_t native_socket) {
+    auto socket_event = WSACreateEvent();
+    auto wake_event = WSACreateEvent();
+    if (socket_event == WSA_INVALID_EVENT || wake_event == WSA_INVALID_EVENT) {
+      BOOST_LOG(error) << "WSACreateEvent() failed: "sv << WSAGetLastError();
+      if (socket_event != WSA_INVALID_EVENT) {
+        WSACloseEvent(socket_event);
+      }
+      if (wake_event != WSA_INVALID_EVENT) {
+        WSACloseEvent(wake_event);
+      }
+      return nullptr;
+    }
+
+    // This also keeps the socket non-blocking, which ENet already made it
+    if (WSAEventSelect((SOCKET) native_socket, socket_event, FD_READ) == SOCKET_ERROR) {
+      BOOST_LOG(error) << "WSAEventSelect() failed: "sv << WSAGetLastError();
+      WSACloseEvent(socket_event);
+      WSACloseEvent(wake_event);
+      return nullptr;
+    }
+
+    return std::make_unique<wsa_socket_waiter_t>((SOCKET) native_socket, socket_event, wake_event);
+  }
+
   int64_t qpc_counter() {
     LARGE_INTEGER performance_counter;
     if (QueryPerformanceCounter(&performance_counter)) {
@@ -2,12 +2,19 @@
  * @file src/platform/windows/publish.cpp
  * @brief Definitions for Windows mDNS service registration.
  */
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 // platform includes
 // WinSock2.h must be included before Windows.h
 // clang-format off
 #include <WinSock2.h>
 #include <Windows.h>
 // clang-format on
+#include <iphlpapi.h>
 #include <WinDNS.h>
 #include <winerror.h>
 
@@ -169,6 +176,9 @@ namespace platf::publish {
     return registered_instance ? 0 : -1;
   }
 
+  // Addresses change in bursts, e.g. when an adapter comes back from sleep and gets a DHCP lease
+  constexpr auto ADDRESS_SETTLE_TIME = 2s;
+
   class mdns_registration_t: public ::platf::deinit_t {
   public:
     mdns_registration_t():
@@ -179,9 +189,31 @@ namespace platf::publish {
       }
 
       BOOST_LOG(info) << "Registered Sunshine mDNS service"sv;
+
+      // The registration keeps announcing the addresses it was made with, so clients don't find the host
+      // at a new address until it's registered again
+      reregister_thread = std::thread {&mdns_registration_t::reregister_proc, this};
+      if (auto status = NotifyUnicastIpAddressChange(AF_UNSPEC, address_changed, this, FALSE, &notification_handle); status != NO_ERROR) {
+        BOOST_LOG(warning) << "NotifyUnicastIpAddressChange() failed: "sv << status;
+        notification_handle = nullptr;
+      }
     }
 
     ~mdns_registration_t() override {
+      // This waits for running callbacks to return
+      if (notification_handle) {
+        CancelMibChangeNotify2(notification_handle);
+      }
+
+      if (reregister_thread.joinable()) {
+        {
+          std::lock_guard lg {lock};
+          stopping = true;
+        }
+        cv.notify_all();
+        reregister_thread.join();
+      }
+
       if (existing_instance) {
         if (service(false, existing_instance)) {
           BOOST_LOG(error) << "Unable to unregister Sunshine mDNS service"sv;
@@ -193,7 +225,63 @@ namespace platf::publish {
     }
 
   private:
+    static VOID NETIOAPI_API_ address_changed(PVOID context, PMIB_UNICASTIPADDRESS_ROW row, MIB_NOTIFICATION_TYPE type) {
+      auto self = (mdns_registration_t *) context;
+      {
+        std::lock_guard lg {self->lock};
+        self->changed = true;
+      }
+      self->cv.notify_all();
+    }
+
+    /**
+     * @brief Register the service again once the addresses stopped changing.
+     */
+    void reregister_proc() {
+      std::unique_lock ul {lock};
+      while (true) {
+        cv.wait(ul, [this]() {
+          return stopping || changed;
+        });
+        if (stopping) {
+          return;
+        }
+
+        changed = false;
+        if (cv.wait_for(ul, ADDRESS_SETTLE_TIME, [this]() {
+              return stopping || changed;
+            })) {
+          continue;
+        }
+
+        ul.unlock();
+        reregister();
+        ul.lock();
+      }
+    }
+
+    void reregister() {
+      BOOST_LOG(info) << "Network addresses changed, registering Sunshine mDNS service again"sv;
+
+      if (existing_instance && service(false, existing_instance)) {
+        // Keep announcing the old addresses rather than nothing
+        BOOST_LOG(warning) << "Unable to unregister Sunshine mDNS service"sv;
+        return;
+      }
+
+      if (service(true, existing_instance)) {
+        BOOST_LOG(error) << "Unable to register Sunshine mDNS service"sv;
+      }
+    }
+
     PDNS_SERVICE_INSTANCE existing_instance;
+
+    HANDLE notification_handle = nullptr;
+    std::thread reregister_thread;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool changed = false;
+    bool stopping = false;
   };
 
   int load_funcs(HMODULE handle) {
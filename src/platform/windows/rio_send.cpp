@@ -0,0 +1,189 @@
+/**
+ * @file src/platform/windows/rio_send.cpp
+ * @brief Definitions for the Registered I/O UDP send backend.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+// platform includes
+#include <WS2tcpip.h>
+
+// local includes
+#include "rio_send.h"
+
+namespace platf::rio {
+  namespace {
+    // Each slot holds the destination, the control messages and the packet of a single send
+    constexpr std::size_t ADDRESS_OFFSET = 0;
+    constexpr std::size_t ADDRESS_SIZE = 32;
+    constexpr std::size_t CONTROL_OFFSET = ADDRESS_OFFSET + ADDRESS_SIZE;
+    constexpr std::size_t CONTROL_SIZE = 64;
+    constexpr std::size_t DATA_OFFSET = CONTROL_OFFSET + CONTROL_SIZE;
+    constexpr std::size_t SLOT_SIZE = 2048;
+
+    static_assert(sizeof(SOCKADDR_INET) <= ADDRESS_SIZE);
+    static_assert(DATA_OFFSET + sender_t::MAX_PACKET_SIZE == SLOT_SIZE);
+
+    // Sends usually complete within microseconds, but don't hog the core if the stack falls behind
+    constexpr int SPINS_BEFORE_YIELD = 1000;
+  }  // namespace
+
+  SOCKET open_socket(int af) {
+    return WSASocketW(af, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+  }
+
+  std::unique_ptr<sender_t> sender_t::create(SOCKET socket) {
+    std::unique_ptr<sender_t> sender {new sender_t};
+
+    GUID function_table_id = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+    if (WSAIoctl(socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &function_table_id, sizeof(function_table_id), &sender->_rio, sizeof(sender->_rio), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+      return nullptr;
+    }
+
+    // Polled by the sending thread, so there's no notification
+    sender->_cq = sender->_rio.RIOCreateCompletionQueue(SLOT_COUNT + 1, nullptr);
+    if (sender->_cq == RIO_INVALID_CQ) {
+      return nullptr;
+    }
+
+    // Receives keep going through the regular socket functions
+    sender->_rq = sender->_rio.RIOCreateRequestQueue(socket, 1, 1, SLOT_COUNT, 1, sender->_cq, sender->_cq, nullptr);
+    if (sender->_rq == RIO_INVALID_RQ) {
+      return nullptr;
+    }
+
+    // Registered buffers must be page aligned
+    sender->_buffer = (char *) VirtualAlloc(nullptr, SLOT_COUNT * SLOT_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!sender->_buffer) {
+      return nullptr;
+    }
+
+    sender->_buffer_id = sender->_rio.RIORegisterBuffer(sender->_buffer, SLOT_COUNT * SLOT_SIZE);
+    if (sender->_buffer_id == RIO_INVALID_BUFFERID) {
+      return nullptr;
+    }
+
+    sender->_free_slots.resize(SLOT_COUNT);
+    for (std::uint32_t x = 0; x < SLOT_COUNT; ++x) {
+      sender->_free_slots[x] = SLOT_COUNT - 1 - x;
+    }
+
+    return sender;
+  }
+
+  sender_t::~sender_t() {
+    // The request queue is freed along with its socket
+    if (_buffer_id != RIO_INVALID_BUFFERID) {
+      _rio.RIODeregisterBuffer(_buffer_id);
+    }
+
+    if (_cq != RIO_INVALID_CQ) {
+      _rio.RIOCloseCompletionQueue(_cq);
+    }
+
+    if (_buffer) {
+      VirtualFree(_buffer, 0, MEM_RELEASE);
+    }
+  }
+
+  status_e sender_t::send(const SOCKADDR *address, int address_size, const char *control, std::size_t control_size, std::span<const packet_t> packets) {
+    if (address_size > (int) ADDRESS_SIZE || control_size > CONTROL_SIZE) {
+      return status_e::unsupported;
+    }
+
+    for (auto &packet : packets) {
+      if (packet.header_size + packet.payload_size > MAX_PACKET_SIZE) {
+        return status_e::unsupported;
+      }
+    }
+
+    // Reclaim what's done already, so failures are counted and slots are mostly reused in order
+    if (!reap_completions()) {
+      return status_e::unsupported;
+    }
+
+    std::size_t queued = 0;
+    bool failed = false;
+    for (auto &packet : packets) {
+      for (int spins = 0; _free_slots.empty(); ++spins) {
+        if (!reap_completions()) {
+          failed = true;
+          break;
+        }
+
+        if (spins >= SPINS_BEFORE_YIELD) {
+          SwitchToThread();
+        } else {
+          YieldProcessor();
+        }
+      }
+
+      if (failed) {
+        break;
+      }
+
+      auto slot = _free_slots.back();
+      auto slot_offset = slot * SLOT_SIZE;
+      auto slot_data = _buffer + slot_offset;
+
+      std::memcpy(slot_data + ADDRESS_OFFSET, address, address_size);
+      if (control_size) {
+        std::memcpy(slot_data + CONTROL_OFFSET, control, control_size);
+      }
+      if (packet.header_size) {
+        std::memcpy(slot_data + DATA_OFFSET, packet.header, packet.header_size);
+      }
+      std::memcpy(slot_data + DATA_OFFSET + packet.header_size, packet.payload, packet.payload_size);
+
+      RIO_BUF data {_buffer_id, (ULONG) (slot_offset + DATA_OFFSET), (ULONG) (packet.header_size + packet.payload_size)};
+      RIO_BUF remote_address {_buffer_id, (ULONG) (slot_offset + ADDRESS_OFFSET), (ULONG) address_size};
+      RIO_BUF control_context {_buffer_id, (ULONG) (slot_offset + CONTROL_OFFSET), (ULONG) control_size};
+
+      // Everything is committed to the kernel at once after the last packet
+      if (!_rio.RIOSendEx(_rq, &data, 1, nullptr, &remote_address, control_size ? &control_context : nullptr, nullptr, RIO_MSG_DEFER, (PVOID) (std::uintptr_t) slot)) {
+        failed = true;
+        break;
+      }
+
+      _free_slots.pop_back();
+      ++queued;
+    }
+
+    if (queued && !_rio.RIOSendEx(_rq, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr)) {
+      return status_e::error;
+    }
+
+    if (failed) {
+      return queued ? status_e::error : status_e::unsupported;
+    }
+
+    return status_e::ok;
+  }
+
+  std::uint64_t sender_t::take_failed_sends() {
+    return std::exchange(_failed_sends, 0);
+  }
+
+  bool sender_t::reap_completions() {
+    std::array<RIORESULT, 256> results;
+
+    auto count = _rio.RIODequeueCompletion(_cq, results.data(), results.size());
+    if (count == RIO_CORRUPT_CQ) {
+      return false;
+    }
+
+    for (ULONG x = 0; x < count; ++x) {
+      if (results[x].Status) {
+        ++_failed_sends;
+      }
+
+      _free_slots.push_back((std::uint32_t) results[x].RequestContext);
+    }
+
+    return true;
+  }
+}  // namespace platf::rio
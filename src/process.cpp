@@ -5,9 +5,17 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <system_error>
 #include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 // lib includes
@@ -25,9 +33,12 @@
 #include "config.h"
 #include "crypto.h"
 #include "display_device.h"
+#include "file_handler.h"
+#include "globals.h"
 #include "logging.h"
 #include "platform/common.h"
 #include "process.h"
+#include "sync.h"
 #include "system_tray.h"
 #include "utility.h"
 
@@ -47,6 +58,80 @@ namespace proc {
 
   proc_t proc;
 
+  // Held while the apps and environment of a proc_t are read or replaced, as they're refreshed while requests read them
+  static std::mutex apps_lock;
+
+  // Saved next to the apps file, so the images of the apps aren't all hashed again on startup
+  image_hash_cache_t image_hashes;
+
+  static sync_util::sync_t<launch_timeline_t> last_launch_timeline;
+
+  launch_timeline_t last_launch() {
+    auto lg = last_launch_timeline.lock();
+    return last_launch_timeline.raw;
+  }
+
+  /**
+   * @brief Whether a prep command runs alongside the command before it.
+   */
+  static bool runs_alongside(const cmd_t &cmd) {
+    return cmd.parallel || !cmd.required;
+  }
+
+  static double to_ms(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli> {duration}.count();
+  }
+
+  /**
+   * @brief Wait for a prep command to exit, and kill it once it ran for longer than its timeout.
+   * @param child The command.
+   * @param cmd The command line, for the logs.
+   * @param timeout How long the command may run, `0` for no limit.
+   * @param started When the command was started.
+   * @param step Where to record how the command ran.
+   * @param stop Kills the command when set, if it's still running.
+   * @return `true` if the command exited with code 0.
+   */
+  static bool wait_prep_cmd(boost::process::v1::child &child, const std::string &cmd, std::chrono::seconds timeout, std::chrono::steady_clock::time_point started, launch_step_t &step, const std::atomic<bool> *stop = nullptr) {
+    std::error_code ec;
+    bool killed = false;
+    while (child.running(ec)) {
+      if (stop && *stop) {
+        BOOST_LOG(warning) << '[' << cmd << "] is still running, killing it"sv;
+        killed = true;
+      } else if (timeout.count() > 0 && std::chrono::steady_clock::now() - started >= timeout) {
+        BOOST_LOG(error) << '[' << cmd << "] didn't exit within "sv << timeout.count() << " seconds, killing it"sv;
+        step.timed_out = true;
+        killed = true;
+      }
+
+      if (killed) {
+        child.terminate(ec);
+        break;
+      }
+
+      std::this_thread::sleep_for(10ms);
+    }
+    step.duration = std::chrono::steady_clock::now() - started;
+
+    if (killed) {
+      return false;
+    }
+    if (ec) {
+      BOOST_LOG(error) << '[' << cmd << "] wait failed with error code ["sv << ec << ']';
+      return false;
+    }
+
+    step.exit_code = child.exit_code();
+    if (*step.exit_code != 0) {
+      BOOST_LOG(error) << '[' << cmd << "] exited with code ["sv << *step.exit_code << ']';
+      return false;
+    }
+
+    BOOST_LOG(info) << '[' << cmd << "] finished in "sv << to_ms(*step.duration) << " ms"sv;
+    return true;
+  }
+
   class deinit_t: public platf::deinit_t {
   public:
     ~deinit_t() {
@@ -141,43 +226,48 @@ namespace proc {
     // Ensure starting from a clean slate
     terminate();
 
-    auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto app) {
-      return app.id == std::to_string(app_id);
-    });
+    {
+      std::lock_guard lg {apps_lock};
+      auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto app) {
+        return app.id == std::to_string(app_id);
+      });
+
+      if (iter == _apps.end()) {
+        BOOST_LOG(error) << "Couldn't find app with ID ["sv << app_id << ']';
+        return 404;
+      }
 
-    if (iter == _apps.end()) {
-      BOOST_LOG(error) << "Couldn't find app with ID ["sv << app_id << ']';
-      return 404;
+      _app = *iter;
+      _app_env = _env;
     }
 
     _app_id = app_id;
-    _app = *iter;
     _app_prep_begin = std::begin(_app.prep_cmds);
     _app_prep_it = _app_prep_begin;
 
     // Add Stream-specific environment variables
-    _env["SUNSHINE_APP_ID"] = std::to_string(_app_id);
-    _env["SUNSHINE_APP_NAME"] = _app.name;
-    _env["SUNSHINE_CLIENT_WIDTH"] = std::to_string(launch_session->width);
-    _env["SUNSHINE_CLIENT_HEIGHT"] = std::to_string(launch_session->height);
-    _env["SUNSHINE_CLIENT_FPS"] = std::to_string(launch_session->fps);
-    _env["SUNSHINE_CLIENT_HDR"] = launch_session->enable_hdr ? "true" : "false";
-    _env["SUNSHINE_CLIENT_GCMAP"] = std::to_string(launch_session->gcmap);
-    _env["SUNSHINE_CLIENT_HOST_AUDIO"] = launch_session->host_audio ? "true" : "false";
-    _env["SUNSHINE_CLIENT_ENABLE_SOPS"] = launch_session->enable_sops ? "true" : "false";
+    _app_env["SUNSHINE_APP_ID"] = std::to_string(_app_id);
+    _app_env["SUNSHINE_APP_NAME"] = _app.name;
+    _app_env["SUNSHINE_CLIENT_WIDTH"] = std::to_string(launch_session->width);
+    _app_env["SUNSHINE_CLIENT_HEIGHT"] = std::to_string(launch_session->height);
+    _app_env["SUNSHINE_CLIENT_FPS"] = std::to_string(launch_session->fps);
+    _app_env["SUNSHINE_CLIENT_HDR"] = launch_session->enable_hdr ? "true" : "false";
+    _app_env["SUNSHINE_CLIENT_GCMAP"] = std::to_string(launch_session->gcmap);
+    _app_env["SUNSHINE_CLIENT_HOST_AUDIO"] = launch_session->host_audio ? "true" : "false";
+    _app_env["SUNSHINE_CLIENT_ENABLE_SOPS"] = launch_session->enable_sops ? "true" : "false";
     int channelCount = launch_session->surround_info & 65535;
     switch (channelCount) {
       case 2:
-        _env["SUNSHINE_CLIENT_AUDIO_CONFIGURATION"] = "2.0";
+        _app_env["SUNSHINE_CLIENT_AUDIO_CONFIGURATION"] = "2.0";
         break;
       case 6:
-        _env["SUNSHINE_CLIENT_AUDIO_CONFIGURATION"] = "5.1";
+        _app_env["SUNSHINE_CLIENT_AUDIO_CONFIGURATION"] = "5.1";
         break;
       case 8:
-        _env["SUNSHINE_CLIENT_AUDIO_CONFIGURATION"] = "7.1";
+        _app_env["SUNSHINE_CLIENT_AUDIO_CONFIGURATION"] = "7.1";
         break;
     }
-    _env["SUNSHINE_CLIENT_AUDIO_SURROUND_PARAMS"] = launch_session->surround_params;
+    _app_env["SUNSHINE_CLIENT_AUDIO_SURROUND_PARAMS"] = launch_session->surround_params;
 
     if (!_app.output.empty() && _app.output != "null"sv) {
 #ifdef _WIN32
@@ -194,12 +284,45 @@ namespace proc {
 #endif
     }
 
+    auto launch_start = std::chrono::steady_clock::now();
+    launch_timeline_t timeline {_app.name, false};
+    auto publish_timeline = [&]() {
+      timeline.duration = std::chrono::steady_clock::now() - launch_start;
+
+      auto lg = last_launch_timeline.lock();
+      last_launch_timeline.raw = std::move(timeline);
+    };
+
     std::error_code ec;
     // Executed when returning from function
     auto fg = util::fail_guard([&]() {
+      publish_timeline();
       terminate();
     });
 
+    struct running_cmd_t {
+      const cmd_t *cmd;
+      boost::process::v1::child child;
+      std::chrono::steady_clock::time_point started;
+      std::size_t step;
+    };
+
+    // The parallel commands still running, waited for before the next command that isn't parallel
+    // and before the app is started
+    std::vector<running_cmd_t> running_cmds;
+
+    // The commands the app doesn't wait for, waited for in the background once the app is started
+    std::vector<running_cmd_t> background_cmds;
+    auto wait_running_cmds = [&]() {
+      bool succeeded = true;
+      for (auto &running_cmd : running_cmds) {
+        succeeded = wait_prep_cmd(running_cmd.child, running_cmd.cmd->do_cmd, running_cmd.cmd->timeout, running_cmd.started, timeline.steps[running_cmd.step]) && succeeded;
+      }
+      running_cmds.clear();
+
+      return succeeded;
+    };
+
     for (; _app_prep_it != std::end(_app.prep_cmds); ++_app_prep_it) {
       auto &cmd = *_app_prep_it;
 
@@ -208,40 +331,51 @@ namespace proc {
         continue;
       }
 
+      if (!runs_alongside(cmd) && !wait_running_cmds()) {
+        return -1;
+      }
+
       boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.do_cmd, _env) :
+                                              find_working_directory(cmd.do_cmd, _app_env) :
                                               boost::filesystem::path(_app.working_dir);
       BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << ']';
-      auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+      auto started = std::chrono::steady_clock::now();
+      auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _app_env, _pipe.get(), ec, nullptr);
+      auto &step = timeline.steps.emplace_back(launch_step_t {cmd.do_cmd, cmd.parallel, cmd.required, started - launch_start});
 
       if (ec) {
         BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
+        step.duration = std::chrono::steady_clock::now() - started;
+
         // We don't want any prep commands failing launch of the desktop.
         // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
         // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
-        if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
+        if (cmd.required && !(_app.cmd.empty() && ec == std::errc::permission_denied)) {
           return -1;
         }
+        continue;
       }
 
-      child.wait(ec);
-      if (ec) {
-        BOOST_LOG(error) << '[' << cmd.do_cmd << "] wait failed with error code ["sv << ec << ']';
-        return -1;
-      }
-      auto ret = child.exit_code();
-      if (ret != 0) {
-        BOOST_LOG(error) << '[' << cmd.do_cmd << "] exited with code ["sv << ret << ']';
+      if (!cmd.required) {
+        background_cmds.emplace_back(running_cmd_t {&cmd, std::move(child), started, timeline.steps.size() - 1});
+      } else if (cmd.parallel) {
+        running_cmds.emplace_back(running_cmd_t {&cmd, std::move(child), started, timeline.steps.size() - 1});
+      } else if (!wait_prep_cmd(child, cmd.do_cmd, cmd.timeout, started, step)) {
         return -1;
       }
     }
 
+    if (!wait_running_cmds()) {
+      return -1;
+    }
+    timeline.prep = std::chrono::steady_clock::now() - launch_start;
+
     for (auto &cmd : _app.detached) {
       boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd, _env) :
+                                              find_working_directory(cmd, _app_env) :
                                               boost::filesystem::path(_app.working_dir);
       BOOST_LOG(info) << "Spawning ["sv << cmd << "] in ["sv << working_dir << ']';
-      auto child = platf::run_command(_app.elevated, true, cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+      auto child = platf::run_command(_app.elevated, true, cmd, working_dir, _app_env, _pipe.get(), ec, nullptr);
       if (ec) {
         BOOST_LOG(warning) << "Couldn't spawn ["sv << cmd << "]: System: "sv << ec.message();
       } else {
@@ -254,10 +388,10 @@ namespace proc {
       placebo = true;
     } else {
       boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(_app.cmd, _env) :
+                                              find_working_directory(_app.cmd, _app_env) :
                                               boost::filesystem::path(_app.working_dir);
       BOOST_LOG(info) << "Executing: ["sv << _app.cmd << "] in ["sv << working_dir << ']';
-      _process = platf::run_command(_app.elevated, true, _app.cmd, working_dir, _env, _pipe.get(), ec, &_process_group);
+      _process = platf::run_command(_app.elevated, true, _app.cmd, working_dir, _app_env, _pipe.get(), ec, &_process_group);
       if (ec) {
         BOOST_LOG(warning) << "Couldn't run ["sv << _app.cmd << "]: System: "sv << ec.message();
         return -1;
@@ -265,8 +399,26 @@ namespace proc {
     }
 
     _app_launch_time = std::chrono::steady_clock::now();
+    timeline.launched = true;
+    BOOST_LOG(info) << "Launched ["sv << _app.name << "] in "sv << to_ms(_app_launch_time - launch_start) << " ms, of which "sv << to_ms(timeline.prep) << " ms waiting for prep commands"sv;
 
     fg.disable();
+    publish_timeline();
+
+    // The undo commands of these commands wait for them to finish
+    _app_prep_stop = std::make_shared<std::atomic<bool>>(false);
+    for (auto &background_cmd : background_cmds) {
+      _app_prep_waiters.emplace_back([background_cmd = std::move(background_cmd), stop = _app_prep_stop]() mutable {
+        launch_step_t step {};
+        wait_prep_cmd(background_cmd.child, background_cmd.cmd->do_cmd, background_cmd.cmd->timeout, background_cmd.started, step, stop.get());
+
+        auto lg = last_launch_timeline.lock();
+        auto &launch_step = last_launch_timeline.raw.steps[background_cmd.step];
+        launch_step.duration = step.duration;
+        launch_step.exit_code = step.exit_code;
+        launch_step.timed_out = step.timed_out;
+      });
+    }
 
     return 0;
   }
@@ -314,29 +466,51 @@ namespace proc {
     _process = boost::process::v1::child();
     _process_group = boost::process::v1::group();
 
-    for (; _app_prep_it != _app_prep_begin; --_app_prep_it) {
-      auto &cmd = *(_app_prep_it - 1);
+    // The undo commands of the commands the app didn't wait for would race with them
+    if (_app_prep_stop) {
+      *_app_prep_stop = true;
+    }
+    for (auto &waiter : _app_prep_waiters) {
+      waiter.join();
+    }
+    _app_prep_waiters.clear();
 
-      if (cmd.undo_cmd.empty()) {
-        continue;
+    while (_app_prep_it != _app_prep_begin) {
+      // The undo commands of commands that ran alongside each other run alongside each other as well
+      auto group_begin = _app_prep_it - 1;
+      while (group_begin != _app_prep_begin && runs_alongside(*group_begin)) {
+        --group_begin;
       }
 
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.undo_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Undo Cmd: ["sv << cmd.undo_cmd << ']';
-      auto child = platf::run_command(cmd.elevated, true, cmd.undo_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+      std::vector<std::tuple<const cmd_t *, boost::process::v1::child, std::chrono::steady_clock::time_point>> undo_cmds;
+      for (auto it = group_begin; it != _app_prep_it; ++it) {
+        auto &cmd = *it;
 
-      if (ec) {
-        BOOST_LOG(warning) << "System: "sv << ec.message();
-      }
+        if (cmd.undo_cmd.empty()) {
+          continue;
+        }
 
-      child.wait();
-      auto ret = child.exit_code();
+        boost::filesystem::path working_dir = _app.working_dir.empty() ?
+                                                find_working_directory(cmd.undo_cmd, _app_env) :
+                                                boost::filesystem::path(_app.working_dir);
+        BOOST_LOG(info) << "Executing Undo Cmd: ["sv << cmd.undo_cmd << ']';
+        auto started = std::chrono::steady_clock::now();
+        auto child = platf::run_command(cmd.elevated, true, cmd.undo_cmd, working_dir, _app_env, _pipe.get(), ec, nullptr);
 
-      if (ret != 0) {
-        BOOST_LOG(warning) << "Return code ["sv << ret << ']';
+        if (ec) {
+          BOOST_LOG(warning) << "System: "sv << ec.message();
+          continue;
+        }
+
+        undo_cmds.emplace_back(&cmd, std::move(child), started);
       }
+
+      for (auto &[cmd, child, started] : undo_cmds) {
+        launch_step_t step {};
+        wait_prep_cmd(child, cmd->undo_cmd, cmd->timeout, started, step);
+      }
+
+      _app_prep_it = group_begin;
     }
 
     _pipe.reset();
@@ -356,11 +530,36 @@ namespace proc {
     _app_id = -1;
   }
 
-  const std::vector<ctx_t> &proc_t::get_apps() const {
-    return _apps;
+  std::set<std::string> proc_t::update(proc_t &&other) {
+    std::set<std::string> changed;
+
+    std::lock_guard lg {apps_lock};
+
+    std::map<std::string_view, const ctx_t *> apps;
+    for (auto &app : _apps) {
+      apps.emplace(app.id, &app);
+    }
+    for (auto &app : other._apps) {
+      auto it = apps.find(app.id);
+      if (it == std::end(apps) || !(*it->second == app)) {
+        changed.insert(app.id);
+      }
+      if (it != std::end(apps)) {
+        apps.erase(it);
+      }
+    }
+    for (auto &[id, _] : apps) {
+      changed.emplace(id);
+    }
+
+    _env = std::move(other._env);
+    _apps = std::move(other._apps);
+
+    return changed;
   }
 
-  std::vector<ctx_t> &proc_t::get_apps() {
+  std::vector<ctx_t> proc_t::get_apps() const {
+    std::lock_guard lg {apps_lock};
     return _apps;
   }
 
@@ -369,10 +568,16 @@ namespace proc {
   // Returns default image if image configuration is not set.
   // Returns http content-type header compatible image type.
   std::string proc_t::get_app_image(int app_id) {
-    auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto app) {
-      return app.id == std::to_string(app_id);
-    });
-    auto app_image_path = iter == _apps.end() ? std::string() : iter->image_path;
+    std::string app_image_path;
+    {
+      std::lock_guard lg {apps_lock};
+      auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto app) {
+        return app.id == std::to_string(app_id);
+      });
+      if (iter != _apps.end()) {
+        app_image_path = iter->image_path;
+      }
+    }
 
     return validate_app_image_path(app_image_path);
   }
@@ -381,6 +586,18 @@ namespace proc {
     return _app.name;
   }
 
+  std::pair<std::uintptr_t, std::uint32_t> proc_t::app_processes() {
+    if (_app_id <= 0 || placebo) {
+      return {0, 0};
+    }
+
+    std::error_code ec;
+    return {
+      _process_group ? (std::uintptr_t) _process_group.native_handle() : 0,
+      _process.valid() && _process.running(ec) ? (std::uint32_t) _process.id() : 0,
+    };
+  }
+
   proc_t::~proc_t() {
     // It's not safe to call terminate() here because our proc_t is a static variable
     // that may be destroyed after the Boost loggers have been destroyed. Instead,
@@ -543,13 +760,147 @@ namespace proc {
     return result.checksum();
   }
 
-  std::tuple<std::string, std::string> calculate_app_id(const std::string &app_name, std::string app_image_path, int index) {
+  std::vector<std::optional<std::string>> image_hash_cache_t::hash(const std::vector<std::string> &paths) {
+    std::lock_guard lg {_lock};
+
+    std::unordered_map<std::string, entry_t> entries;
+    std::vector<std::pair<std::string, entry_t>> to_hash;
+    for (auto &path : paths) {
+      if (path.empty() || entries.count(path)) {
+        continue;
+      }
+
+      std::error_code ec;
+      auto size = std::filesystem::file_size(path, ec);
+      auto mtime = std::filesystem::last_write_time(path, ec);
+      if (ec) {
+        continue;
+      }
+
+      entry_t entry {size, (std::int64_t) mtime.time_since_epoch().count(), {}};
+      auto it = _entries.find(path);
+      if (it != std::end(_entries) && it->second.size == entry.size && it->second.mtime == entry.mtime) {
+        entries.emplace(path, std::move(it->second));
+      } else {
+        to_hash.emplace_back(path, std::move(entry));
+      }
+    }
+
+    if (!to_hash.empty()) {
+      std::atomic<std::size_t> next {0};
+      auto worker = [&]() {
+        for (auto x = next++; x < to_hash.size(); x = next++) {
+          to_hash[x].second.hash = calculate_sha256(to_hash[x].first).value_or(""s);
+        }
+      };
+
+      auto thread_count = std::min<std::size_t>({std::max(std::thread::hardware_concurrency(), 1u), MAX_THREADS, to_hash.size()});
+      std::vector<std::thread> threads;
+      for (std::size_t x = 1; x < thread_count; ++x) {
+        threads.emplace_back(worker);
+      }
+      worker();
+      for (auto &thread : threads) {
+        thread.join();
+      }
+
+      for (auto &[path, entry] : to_hash) {
+        if (!entry.hash.empty()) {
+          entries.emplace(std::move(path), std::move(entry));
+        }
+      }
+    }
+
+    _dirty = _dirty || !to_hash.empty() || entries.size() != _entries.size();
+    _entries = std::move(entries);
+
+    std::vector<std::optional<std::string>> hashes;
+    hashes.reserve(paths.size());
+    for (auto &path : paths) {
+      auto it = _entries.find(path);
+      hashes.emplace_back(it == std::end(_entries) ? std::nullopt : std::make_optional(it->second.hash));
+    }
+
+    return hashes;
+  }
+
+  void image_hash_cache_t::load(const std::string &file_name) {
+    std::lock_guard lg {_lock};
+
+    if (_file_name == file_name) {
+      return;
+    }
+
+    _file_name = file_name;
+    _entries.clear();
+    _dirty = true;
+
+    std::error_code ec;
+    if (!std::filesystem::exists(file_name, ec)) {
+      return;
+    }
+
+    try {
+      pt::ptree tree;
+      pt::read_json(file_name, tree);
+
+      for (auto &[_, image_node] : tree.get_child("images"s)) {
+        _entries.emplace(
+          image_node.get<std::string>("path"s),
+          entry_t {
+            image_node.get<std::uintmax_t>("size"s),
+            image_node.get<std::int64_t>("mtime"s),
+            image_node.get<std::string>("sha256"s),
+          }
+        );
+      }
+      _dirty = false;
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't load app image hashes from ["sv << file_name << "]: "sv << e.what();
+      _entries.clear();
+    }
+  }
+
+  void image_hash_cache_t::save() {
+    std::lock_guard lg {_lock};
+
+    if (!_dirty || _file_name.empty()) {
+      return;
+    }
+
+    pt::ptree images_node;
+    for (auto &[path, entry] : _entries) {
+      pt::ptree image_node;
+      image_node.put("path"s, path);
+      image_node.put("size"s, entry.size);
+      image_node.put("mtime"s, entry.mtime);
+      image_node.put("sha256"s, entry.hash);
+      images_node.push_back(std::make_pair(""s, image_node));
+    }
+
+    pt::ptree tree;
+    tree.add_child("images"s, images_node);
+
+    std::ostringstream out;
+    pt::write_json(out, tree);
+    if (!file_handler::write_file_atomic(_file_name.c_str(), out.str())) {
+      _dirty = false;
+    }
+  }
+
+  /**
+   * @brief Calculate a stable id of an app from its name and the hash of its image.
+   * @param app_name The name of the app.
+   * @param file_path The validated path of the image of the app.
+   * @param file_hash The hash of the image, if it could be read.
+   * @param index The index of the app, to tell apart apps with the same name and image.
+   * @return Tuple of id calculated without index (for use if no collision) and one with.
+   */
+  std::tuple<std::string, std::string> calculate_app_id(const std::string &app_name, const std::string &file_path, const std::optional<std::string> &file_hash, int index) {
     // Generate id by hashing name with image data if present
     std::vector<std::string> to_hash;
     to_hash.push_back(app_name);
-    auto file_path = validate_app_image_path(app_image_path);
     if (file_path != DEFAULT_APP_IMAGE_PATH) {
-      auto file_hash = calculate_sha256(file_path);
       if (file_hash) {
         to_hash.push_back(file_hash.value());
       } else {
@@ -574,11 +925,27 @@ namespace proc {
     return std::make_tuple(id_no_index, id_with_index);
   }
 
-  std::optional<proc::proc_t> parse(const std::string &file_name) {
+  std::tuple<std::string, std::string> calculate_app_id(const std::string &app_name, std::string app_image_path, int index) {
+    auto file_path = validate_app_image_path(app_image_path);
+    std::optional<std::string> file_hash;
+    if (file_path != DEFAULT_APP_IMAGE_PATH) {
+      file_hash = calculate_sha256(file_path);
+    }
+
+    return calculate_app_id(app_name, file_path, file_hash, index);
+  }
+
+  /**
+   * @brief Parse the contents of the apps file.
+   * @param file_name The apps file, next to which the image hashes are kept.
+   * @param contents The contents of the apps file.
+   */
+  static std::optional<proc::proc_t> parse(const std::string &file_name, const std::string &contents) {
     pt::ptree tree;
 
     try {
-      pt::read_json(file_name, tree);
+      std::istringstream in {contents};
+      pt::read_json(in, tree);
 
       auto &apps_node = tree.get_child("apps"s);
       auto &env_vars = tree.get_child("env"s);
@@ -589,9 +956,7 @@ namespace proc {
         this_env[name] = parse_env_val(this_env, val.get_value<std::string>());
       }
 
-      std::set<std::string> ids;
       std::vector<proc::ctx_t> apps;
-      int i = 0;
       for (auto &[_, app_node] : apps_node) {
         proc::ctx_t ctx;
 
@@ -615,11 +980,14 @@ namespace proc {
             auto do_cmd = parse_env_val(this_env, prep_cmd.do_cmd);
             auto undo_cmd = parse_env_val(this_env, prep_cmd.undo_cmd);
 
-            prep_cmds.emplace_back(
+            auto &cmd = prep_cmds.emplace_back(
               std::move(do_cmd),
               std::move(undo_cmd),
               std::move(prep_cmd.elevated)
             );
+            cmd.parallel = prep_cmd.parallel;
+            cmd.required = prep_cmd.required;
+            cmd.timeout = prep_cmd.timeout;
           }
         }
 
@@ -631,12 +999,18 @@ namespace proc {
             auto do_cmd = prep_node.get_optional<std::string>("do"s);
             auto undo_cmd = prep_node.get_optional<std::string>("undo"s);
             auto elevated = prep_node.get_optional<bool>("elevated");
+            auto parallel = prep_node.get_optional<bool>("parallel"s);
+            auto required = prep_node.get_optional<bool>("required"s);
+            auto timeout = prep_node.get_optional<int>("timeout"s);
 
-            prep_cmds.emplace_back(
+            auto &cmd = prep_cmds.emplace_back(
               parse_env_val(this_env, do_cmd.value_or("")),
               parse_env_val(this_env, undo_cmd.value_or("")),
               std::move(elevated.value_or(false))
             );
+            cmd.parallel = parallel.value_or(false);
+            cmd.required = required.value_or(true);
+            cmd.timeout = std::chrono::seconds {std::max(timeout.value_or(0), 0)};
           }
         }
 
@@ -677,7 +1051,32 @@ namespace proc {
         ctx.wait_all = wait_all.value_or(true);
         ctx.exit_timeout = std::chrono::seconds {exit_timeout.value_or(5)};
 
-        auto possible_ids = calculate_app_id(name, ctx.image_path, i++);
+        ctx.name = std::move(name);
+        ctx.prep_cmds = std::move(prep_cmds);
+        ctx.detached = std::move(detached);
+
+        apps.emplace_back(std::move(ctx));
+      }
+
+      // Hash the images of every app at once, so the images that changed are hashed in parallel
+      std::vector<std::string> image_files;
+      std::vector<std::string> images_to_hash;
+      image_files.reserve(apps.size());
+      images_to_hash.reserve(apps.size());
+      for (auto &ctx : apps) {
+        auto &file_path = image_files.emplace_back(validate_app_image_path(ctx.image_path));
+        images_to_hash.emplace_back(file_path == DEFAULT_APP_IMAGE_PATH ? ""s : file_path);
+      }
+
+      image_hashes.load(std::filesystem::path(file_name).replace_filename("app_image_hashes.json").string());
+      auto image_file_hashes = image_hashes.hash(images_to_hash);
+      image_hashes.save();
+
+      std::set<std::string> ids;
+      for (std::size_t x = 0; x < apps.size(); ++x) {
+        auto &ctx = apps[x];
+
+        auto possible_ids = calculate_app_id(ctx.name, image_files[x], image_file_hashes[x], (int) x);
         if (ids.count(std::get<0>(possible_ids)) == 0) {
           // Avoid using index to generate id if possible
           ctx.id = std::get<0>(possible_ids);
@@ -686,12 +1085,6 @@ namespace proc {
           ctx.id = std::get<1>(possible_ids);
         }
         ids.insert(ctx.id);
-
-        ctx.name = std::move(name);
-        ctx.prep_cmds = std::move(prep_cmds);
-        ctx.detached = std::move(detached);
-
-        apps.emplace_back(std::move(ctx));
       }
 
       return proc::proc_t {
@@ -705,11 +1098,179 @@ namespace proc {
     return std::nullopt;
   }
 
-  void refresh(const std::string &file_name) {
-    auto proc_opt = proc::parse(file_name);
+  std::optional<proc::proc_t> parse(const std::string &file_name) {
+    return parse(file_name, file_handler::read_file(file_name.c_str()));
+  }
+
+  namespace {
+    struct file_stamp_t {
+      std::uintmax_t size;
+      std::filesystem::file_time_type modified;
+
+      bool operator==(const file_stamp_t &) const = default;
+    };
+
+    std::optional<file_stamp_t> stamp(const std::string &file_name) {
+      std::error_code ec;
+      auto size = std::filesystem::file_size(file_name, ec);
+      auto modified = std::filesystem::last_write_time(file_name, ec);
+      if (ec) {
+        return std::nullopt;
+      }
+
+      return file_stamp_t {size, modified};
+    }
+
+    // Held while the apps are applied or written, after the write lock and before the apps model lock
+    std::mutex refresh_lock;
+    std::optional<file_stamp_t> refreshed_stamp;
+
+    // Edits are written out after this, so a burst of them from the Web UI is written once
+    constexpr auto APPS_FLUSH_DELAY = 500ms;
+
+    struct apps_model_t {
+      // Held while writing, so edits reach the file in the order they were made
+      std::mutex write_lock;
+
+      std::mutex lock;
+      std::string file_name;
+      std::optional<file_stamp_t> loaded_stamp;
+      std::uint64_t version = 0;
+      std::shared_ptr<const nlohmann::json> tree;
+
+      // The last edit, until it's written
+      std::shared_ptr<const nlohmann::json> pending;
+      bool scheduled = false;
+    } apps_model;
+
+    /**
+     * @brief Replace the apps in memory with those read from the file.
+     * @details The apps model lock must be held.
+     */
+    void set_apps(const std::string &file_name, std::shared_ptr<const nlohmann::json> tree, const std::optional<file_stamp_t> &file_stamp) {
+      apps_model.file_name = file_name;
+      apps_model.loaded_stamp = file_stamp;
+      apps_model.tree = std::move(tree);
+      apps_model.pending = nullptr;
+      ++apps_model.version;
+    }
+
+    /**
+     * @brief Read the apps file again if it changed on disk, unless an edit waits to be written.
+     * @details The apps model lock must be held.
+     */
+    void reload_apps(const std::string &file_name) {
+      if (apps_model.pending && apps_model.file_name == file_name) {
+        return;
+      }
+
+      auto file_stamp = stamp(file_name);
+      if (apps_model.tree && apps_model.file_name == file_name && file_stamp == apps_model.loaded_stamp) {
+        return;
+      }
+
+      auto tree = nlohmann::json::parse(file_handler::read_file(file_name.c_str()));
+      set_apps(file_name, std::make_shared<const nlohmann::json>(std::move(tree)), file_stamp);
+    }
+  }  // namespace
+
+  std::optional<std::set<std::string>> refresh(const std::string &file_name) {
+    std::lock_guard lg {refresh_lock};
+
+    // Taken before parsing, so a change made while parsing is picked up by the next refresh
+    refreshed_stamp = stamp(file_name);
+
+    auto contents = file_handler::read_file(file_name.c_str());
+    {
+      // A change made outside of the Web UI replaces any edit not written yet
+      auto tree = nlohmann::json::parse(contents, nullptr, false);
+
+      std::lock_guard model_lg {apps_model.lock};
+      set_apps(file_name, tree.is_discarded() ? nullptr : std::make_shared<const nlohmann::json>(std::move(tree)), refreshed_stamp);
+    }
+
+    auto proc_opt = proc::parse(file_name, contents);
+    if (!proc_opt) {
+      return std::nullopt;
+    }
+
+    return proc.update(std::move(*proc_opt));
+  }
+
+  bool changed_since_refresh(const std::string &file_name) {
+    std::lock_guard lg {refresh_lock};
+    return stamp(file_name) != refreshed_stamp;
+  }
+
+  apps_snapshot_t load_apps(const std::string &file_name) {
+    std::lock_guard lg {apps_model.lock};
+    reload_apps(file_name);
+
+    return {apps_model.version, apps_model.tree};
+  }
+
+  std::optional<std::set<std::string>> edit_apps(const std::string &file_name, const std::function<void(nlohmann::json &)> &edit) {
+    std::lock_guard lg {refresh_lock};
+
+    std::string contents;
+    {
+      std::lock_guard model_lg {apps_model.lock};
+      reload_apps(file_name);
+
+      auto tree = std::make_shared<nlohmann::json>(*apps_model.tree);
+      edit(*tree);
+
+      contents = tree->dump(4);
+      apps_model.tree = tree;
+      apps_model.pending = tree;
+      ++apps_model.version;
+
+      // The Web UI doesn't wait on the disk, the thread pool writes the latest edit
+      if (!std::exchange(apps_model.scheduled, true)) {
+        task_pool.pushDelayed(flush_apps, APPS_FLUSH_DELAY);
+      }
+    }
+
+    // Applied from memory, parsing what is about to be written
+    auto proc_opt = proc::parse(file_name, contents);
+    if (!proc_opt) {
+      return std::nullopt;
+    }
+
+    return proc.update(std::move(*proc_opt));
+  }
+
+  void flush_apps() {
+    std::lock_guard write_lg {apps_model.write_lock};
+
+    // Held until the stamp is updated, so a refresh can't take the file written here for a change made outside of the Web UI
+    std::lock_guard refresh_lg {refresh_lock};
+
+    std::shared_ptr<const nlohmann::json> tree;
+    std::string file_name;
+    {
+      std::lock_guard lg {apps_model.lock};
+      apps_model.scheduled = false;
+      tree = std::exchange(apps_model.pending, nullptr);
+      file_name = apps_model.file_name;
+    }
+
+    if (!tree) {
+      return;
+    }
+
+    if (file_handler::write_file_atomic(file_name.c_str(), tree->dump(4))) {
+      BOOST_LOG(error) << "Couldn't write "sv << file_name;
+      return;
+    }
+
+    // The apps were applied when they were edited, so writing them isn't a change to pick up
+    auto file_stamp = stamp(file_name);
+    refreshed_stamp = file_stamp;
 
-    if (proc_opt) {
-      proc = std::move(*proc_opt);
+    std::lock_guard model_lg {apps_model.lock};
+    if (apps_model.tree == tree) {
+      apps_model.loaded_stamp = file_stamp;
     }
   }
 }  // namespace proc
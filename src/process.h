@@ -9,11 +9,23 @@
 #endif
 
 // standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/process/v1.hpp>
+#include <nlohmann/json.hpp>
 
 // local includes
 #include "config.h"
@@ -65,8 +77,41 @@ namespace proc {
     bool auto_detach;
     bool wait_all;
     std::chrono::seconds exit_timeout;
+
+    bool operator==(const ctx_t &) const = default;
+  };
+
+  /**
+   * @brief How a prep command ran during the last launch.
+   */
+  struct launch_step_t {
+    std::string cmd;
+    bool parallel;
+    bool required;
+    std::chrono::steady_clock::duration started;  ///< From the start of the launch
+    std::optional<std::chrono::steady_clock::duration> duration;  ///< Empty while the command is still running
+    std::optional<int> exit_code;  ///< Empty if the command couldn't run, was killed or is still running
+    bool timed_out;
+  };
+
+  /**
+   * @brief How long the last launch of an app took.
+   */
+  struct launch_timeline_t {
+    std::string app_name;
+    bool launched;  ///< Whether the app was started
+    std::chrono::steady_clock::duration prep;  ///< Until the prep commands the app waits for finished
+    std::chrono::steady_clock::duration duration;  ///< Until the app was started, or the launch failed
+    std::vector<launch_step_t> steps;  ///< The prep commands that were run, in the order they were started
   };
 
+  /**
+   * @brief Get the timeline of the last launch.
+   * @return The timeline, empty if no app was launched yet.
+   * @details Commands the app doesn't wait for are updated as they finish.
+   */
+  launch_timeline_t last_launch();
+
   class proc_t {
   public:
     KITTY_DEFAULT_CONSTR_MOVE_THROW(proc_t)
@@ -82,6 +127,14 @@ namespace proc {
 
     int execute(int app_id, std::shared_ptr<rtsp_stream::launch_session_t> launch_session);
 
+    /**
+     * @brief Replace the apps with those parsed again, without disturbing the running app.
+     * @param other The apps and environment parsed again.
+     * @return The IDs of the apps added, changed or removed.
+     * @details The running app keeps the copies of its settings and of the environment made when it was launched.
+     */
+    std::set<std::string> update(proc_t &&other);
+
     /**
      * @return `_app_id` if a process is running, otherwise returns `0`
      */
@@ -89,10 +142,21 @@ namespace proc {
 
     ~proc_t();
 
-    const std::vector<ctx_t> &get_apps() const;
-    std::vector<ctx_t> &get_apps();
+    /**
+     * @brief Get a copy of the apps, which can be replaced by `update()` at any time.
+     */
+    std::vector<ctx_t> get_apps() const;
     std::string get_app_image(int app_id);
     std::string get_last_run_app_name();
+
+    /**
+     * @brief Get the processes of the running app, like to find its windows.
+     * @return The native handle of the process group of the app, or 0 if it has none, and the ID of the process
+     *         launched, or 0 if it isn't running anymore.
+     * @details Detached apps and apps without a command have neither.
+     */
+    std::pair<std::uintptr_t, std::uint32_t> app_processes();
+
     void terminate();
 
   private:
@@ -101,6 +165,9 @@ namespace proc {
     boost::process::v1::environment _env;
     std::vector<ctx_t> _apps;
     ctx_t _app;
+
+    // The environment of the running app, with the `SUNSHINE_*` variables set for it
+    boost::process::v1::environment _app_env;
     std::chrono::steady_clock::time_point _app_launch_time;
 
     // If no command associated with _app_id, yet it's still running
@@ -112,8 +179,56 @@ namespace proc {
     file_t _pipe;
     std::vector<cmd_t>::const_iterator _app_prep_it;
     std::vector<cmd_t>::const_iterator _app_prep_begin;
+
+    // Wait for the prep commands the app doesn't wait for, until they finish or the app is terminated
+    std::vector<std::thread> _app_prep_waiters;
+    std::shared_ptr<std::atomic<bool>> _app_prep_stop;
   };
 
+  /**
+   * @brief The SHA-256 of app images, kept until the image changes.
+   * @details An image is only read again when its size or modification time changed, so refreshing
+   * the apps doesn't hash every image again.
+   */
+  class image_hash_cache_t {
+  public:
+    // Most threads used to hash the images that changed
+    static constexpr unsigned MAX_THREADS = 8;
+
+    /**
+     * @brief Get the hash of each image.
+     * @param paths The paths of the images. Empty paths are skipped.
+     * @return The hex SHA-256 of each image, or an empty optional if it couldn't be read.
+     * @details Images not hashed yet are hashed on several threads. Images not in `paths` are forgotten.
+     */
+    std::vector<std::optional<std::string>> hash(const std::vector<std::string> &paths);
+
+    /**
+     * @brief Load the hashes saved to a file, unless they were loaded from it already.
+     * @param file_name The file the hashes were saved to.
+     */
+    void load(const std::string &file_name);
+
+    /**
+     * @brief Save the hashes to the file they were loaded from, if they changed since.
+     */
+    void save();
+
+  private:
+    struct entry_t {
+      std::uintmax_t size;
+      std::int64_t mtime;
+      std::string hash;
+    };
+
+    std::mutex _lock;
+    std::string _file_name;
+    std::unordered_map<std::string, entry_t> _entries;
+    bool _dirty {false};
+  };
+
+  std::optional<std::string> calculate_sha256(const std::string &filename);
+
   /**
    * @brief Calculate a stable id based on name and image data
    * @return Tuple of id calculated without index (for use if no collision) and one with.
@@ -121,9 +236,54 @@ namespace proc {
   std::tuple<std::string, std::string> calculate_app_id(const std::string &app_name, std::string app_image_path, int index);
 
   std::string validate_app_image_path(std::string app_image_path);
-  void refresh(const std::string &file_name);
+
+  /**
+   * @brief Parse the apps file again and apply what changed.
+   * @param file_name The apps file.
+   * @return The IDs of the apps added, changed or removed, or an empty optional if the file couldn't be parsed.
+   */
+  std::optional<std::set<std::string>> refresh(const std::string &file_name);
+
+  /**
+   * @brief Check whether the apps file was modified since it was last parsed by `refresh()`.
+   * @param file_name The apps file.
+   * @return `true` if its size or modification time changed.
+   */
+  bool changed_since_refresh(const std::string &file_name);
   std::optional<proc::proc_t> parse(const std::string &file_name);
 
+  /**
+   * @brief The apps file as last loaded or edited.
+   */
+  struct apps_snapshot_t {
+    std::uint64_t version;  ///< Changes whenever the apps do, so anything built from them can be kept until then
+    std::shared_ptr<const nlohmann::json> tree;
+  };
+
+  /**
+   * @brief Get the apps file from memory, reading it only if it changed on disk since it was loaded.
+   * @param file_name The apps file.
+   * @return The apps file.
+   * @throws nlohmann::json::exception If the file isn't valid JSON.
+   */
+  apps_snapshot_t load_apps(const std::string &file_name);
+
+  /**
+   * @brief Change the apps in memory, apply the change and write the apps file shortly after.
+   * @param file_name The apps file.
+   * @param edit Changes the apps file. Nothing changes if it throws.
+   * @return The IDs of the apps added, changed or removed, or an empty optional if the apps couldn't be parsed.
+   * @throws Whatever `edit` throws, and nlohmann::json::exception if the file isn't valid JSON.
+   */
+  std::optional<std::set<std::string>> edit_apps(const std::string &file_name, const std::function<void(nlohmann::json &)> &edit);
+
+  /**
+   * @brief Write the apps edited since they were last written to the apps file.
+   * @details Edits are written from the thread pool shortly after they're made. This must
+   *          be called before the thread pool stops, or the last edits could be lost.
+   */
+  void flush_apps();
+
   /**
    * @brief Initialize proc functions
    * @return Unique pointer to `deinit_t` to manage cleanup
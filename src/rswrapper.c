@@ -112,42 +112,365 @@
 
 #include "rswrapper.h"
 
+// standard includes
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #include <cpuid.h>
+  #include <immintrin.h>
+#elif defined(__aarch64__)
+  #include <arm_neon.h>
+#endif
+
 reed_solomon_new_t reed_solomon_new_fn;
 reed_solomon_release_t reed_solomon_release_fn;
 reed_solomon_encode_t reed_solomon_encode_fn;
 reed_solomon_decode_t reed_solomon_decode_fn;
 
+static const char *reed_solomon_variant_name_selected;
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+static int cpu_supports_avx512(void) {
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+static int cpu_supports_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+static int cpu_supports_ssse3(void) {
+  return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+static int cpu_supports_def(void) {
+  return 1;
+}
+
+/**
+ * @brief A Reed-Solomon codec whose parity is computed by our own GF(2^8) kernels.
+ * @details Decoding and any partial encode are left to the nanors codec it wraps.
+ */
+typedef struct {
+  reed_solomon *inner;
+  int data_shards;
+  int parity_shards;
+  uint8_t *tables;  ///< The kernel specific multiplication tables of each parity coefficient
+} gf_reed_solomon;
+
+/**
+ * @brief Read the parity coefficients back from a nanors codec.
+ * @details Parity is linear in the data, so encoding `1 << k` in byte `k` of a data shard
+ * yields the product of each of its coefficients with every power of two. Those are all the
+ * kernels need, whatever the field polynomial and coding matrix of nanors.
+ * @return The products as `[parity_shards][data_shards][8]`, or `NULL` on allocation failure.
+ */
+static uint8_t *gf_read_products(reed_solomon *rs, reed_solomon_encode_t encode, int data_shards, int parity_shards) {
+  int total_shards = data_shards + parity_shards;
+  int bs = data_shards * 8;
+
+  uint8_t *buffer = calloc(total_shards, bs);
+  uint8_t **shards = malloc(total_shards * sizeof(uint8_t *));
+  uint8_t *products = malloc(parity_shards * bs);
+  if (!buffer || !shards || !products) {
+    goto fail;
+  }
+
+  for (int x = 0; x < total_shards; ++x) {
+    shards[x] = buffer + x * bs;
+  }
+  for (int d = 0; d < data_shards; ++d) {
+    for (int k = 0; k < 8; ++k) {
+      shards[d][d * 8 + k] = (uint8_t) (1 << k);
+    }
+  }
+
+  if (encode(rs, shards, total_shards, bs)) {
+    goto fail;
+  }
+
+  // Byte d * 8 + k of parity p is the coefficient of data shard d times 2^k
+  memcpy(products, shards[data_shards], parity_shards * bs);
+
+  free(shards);
+  free(buffer);
+  return products;
+
+fail:
+  free(products);
+  free(shards);
+  free(buffer);
+  return NULL;
+}
+
+/**
+ * @brief Wrap a nanors codec and build the tables of a kernel from its coefficients.
+ * @param table_size The size of the table of a single coefficient.
+ * @param build_table Derives the table of a coefficient from its products with each power of two.
+ */
+static reed_solomon *gf_reed_solomon_new(reed_solomon *inner, reed_solomon_encode_t encode, reed_solomon_release_t release, int data_shards, int parity_shards, size_t table_size, void (*build_table)(const uint8_t *products, uint8_t *table)) {
+  if (!inner) {
+    return NULL;
+  }
+
+  gf_reed_solomon *rs = calloc(1, sizeof(gf_reed_solomon));
+  uint8_t *products = gf_read_products(inner, encode, data_shards, parity_shards);
+  uint8_t *tables = malloc(parity_shards * data_shards * table_size);
+  if (!rs || !products || !tables) {
+    free(tables);
+    free(products);
+    free(rs);
+    release(inner);
+    return NULL;
+  }
+
+  for (int x = 0; x < parity_shards * data_shards; ++x) {
+    build_table(products + x * 8, tables + x * table_size);
+  }
+  free(products);
+
+  rs->inner = inner;
+  rs->data_shards = data_shards;
+  rs->parity_shards = parity_shards;
+  rs->tables = tables;
+  return (reed_solomon *) rs;
+}
+
+static void gf_reed_solomon_release(reed_solomon *rs, reed_solomon_release_t release) {
+  gf_reed_solomon *gf = (gf_reed_solomon *) rs;
+  if (!gf) {
+    return;
+  }
+
+  release(gf->inner);
+  free(gf->tables);
+  free(gf);
+}
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+static int cpu_supports_gfni(void) {
+  unsigned int eax, ebx, ecx, edx;
+  return cpu_supports_avx512() && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & bit_GFNI);
+}
+
+/**
+ * @brief Build the GF2P8AFFINEQB matrix multiplying by a coefficient.
+ * @details Row `7 - i` selects the input bits whose products with the coefficient set bit `i`.
+ */
+static void gfni_build_table(const uint8_t *products, uint8_t *table) {
+  uint64_t matrix = 0;
+  for (int i = 0; i < 8; ++i) {
+    for (int k = 0; k < 8; ++k) {
+      if (products[k] & (1 << i)) {
+        matrix |= (uint64_t) 1 << ((7 - i) * 8 + k);
+      }
+    }
+  }
+
+  memcpy(table, &matrix, sizeof(matrix));
+}
+
+static void reed_solomon_init_gfni(void) {
+  reed_solomon_init_avx512();
+}
+
+static reed_solomon *reed_solomon_new_gfni(int data_shards, int parity_shards) {
+  return gf_reed_solomon_new(reed_solomon_new_avx512(data_shards, parity_shards), reed_solomon_encode_avx512, reed_solomon_release_avx512, data_shards, parity_shards, sizeof(uint64_t), gfni_build_table);
+}
+
+static void reed_solomon_release_gfni(reed_solomon *rs) {
+  gf_reed_solomon_release(rs, reed_solomon_release_avx512);
+}
+
+static int reed_solomon_decode_gfni(reed_solomon *rs, uint8_t **shards, uint8_t *marks, int nr_shards, int bs) {
+  return reed_solomon_decode_avx512(((gf_reed_solomon *) rs)->inner, shards, marks, nr_shards, bs);
+}
+
+  #if defined(__clang__)
+    #pragma clang attribute push(__attribute__((target("avx512f,avx512bw,gfni"))), apply_to = function)
+  #else
+    #pragma GCC push_options
+    #pragma GCC target("avx512f,avx512bw,gfni")
+  #endif
+static int reed_solomon_encode_gfni(reed_solomon *rs, uint8_t **shards, int nr_shards, int bs) {
+  gf_reed_solomon *gf = (gf_reed_solomon *) rs;
+  int data_shards = gf->data_shards;
+  int parity_shards = gf->parity_shards;
+  if (nr_shards != data_shards + parity_shards) {
+    return reed_solomon_encode_avx512(gf->inner, shards, nr_shards, bs);
+  }
+
+  const uint64_t *matrices = (const uint64_t *) gf->tables;
+  for (int offset = 0; offset < bs; offset += 64) {
+    // Masked loads and stores handle the tail of the shards without reading past them
+    __mmask64 mask = bs - offset >= 64 ? ~(__mmask64) 0 : ((__mmask64) 1 << (bs - offset)) - 1;
+
+    for (int p = 0; p < parity_shards; ++p) {
+      const uint64_t *row = matrices + p * data_shards;
+
+      __m512i parity = _mm512_setzero_si512();
+      for (int d = 0; d < data_shards; ++d) {
+        __m512i data = _mm512_maskz_loadu_epi8(mask, shards[d] + offset);
+        parity = _mm512_xor_si512(parity, _mm512_gf2p8affine_epi64_epi8(data, _mm512_set1_epi64((long long) row[d]), 0));
+      }
+
+      _mm512_mask_storeu_epi8(shards[data_shards + p] + offset, mask, parity);
+    }
+  }
+
+  return 0;
+}
+  #if defined(__clang__)
+    #pragma clang attribute pop
+  #else
+    #pragma GCC pop_options
+  #endif
+#elif defined(__aarch64__)
+static int cpu_supports_neon(void) {
+  return 1;
+}
+
+/**
+ * @brief Build the split nibble tables multiplying by a coefficient.
+ * @details The first 16 bytes are the products with the low nibble, the next 16 with the high nibble.
+ */
+static void neon_build_table(const uint8_t *products, uint8_t *table) {
+  for (int x = 0; x < 16; ++x) {
+    uint8_t low = 0;
+    uint8_t high = 0;
+    for (int k = 0; k < 4; ++k) {
+      if (x & (1 << k)) {
+        low ^= products[k];
+        high ^= products[k + 4];
+      }
+    }
+
+    table[x] = low;
+    table[x + 16] = high;
+  }
+}
+
+static void reed_solomon_init_neon(void) {
+  reed_solomon_init_def();
+}
+
+static reed_solomon *reed_solomon_new_neon(int data_shards, int parity_shards) {
+  return gf_reed_solomon_new(reed_solomon_new_def(data_shards, parity_shards), reed_solomon_encode_def, reed_solomon_release_def, data_shards, parity_shards, 32, neon_build_table);
+}
+
+static void reed_solomon_release_neon(reed_solomon *rs) {
+  gf_reed_solomon_release(rs, reed_solomon_release_def);
+}
+
+static int reed_solomon_decode_neon(reed_solomon *rs, uint8_t **shards, uint8_t *marks, int nr_shards, int bs) {
+  return reed_solomon_decode_def(((gf_reed_solomon *) rs)->inner, shards, marks, nr_shards, bs);
+}
+
+static int reed_solomon_encode_neon(reed_solomon *rs, uint8_t **shards, int nr_shards, int bs) {
+  gf_reed_solomon *gf = (gf_reed_solomon *) rs;
+  int data_shards = gf->data_shards;
+  int parity_shards = gf->parity_shards;
+  if (nr_shards != data_shards + parity_shards) {
+    return reed_solomon_encode_def(gf->inner, shards, nr_shards, bs);
+  }
+
+  const uint8x16_t nibble = vdupq_n_u8(0x0f);
+
+  int offset = 0;
+  for (; offset + 16 <= bs; offset += 16) {
+    for (int p = 0; p < parity_shards; ++p) {
+      const uint8_t *row = gf->tables + p * data_shards * 32;
+
+      uint8x16_t parity = vdupq_n_u8(0);
+      for (int d = 0; d < data_shards; ++d) {
+        uint8x16_t data = vld1q_u8(shards[d] + offset);
+        uint8x16_t low = vqtbl1q_u8(vld1q_u8(row + d * 32), vandq_u8(data, nibble));
+        uint8x16_t high = vqtbl1q_u8(vld1q_u8(row + d * 32 + 16), vshrq_n_u8(data, 4));
+        parity = veorq_u8(parity, veorq_u8(low, high));
+      }
+
+      vst1q_u8(shards[data_shards + p] + offset, parity);
+    }
+  }
+
+  // The tail of the shards uses the same tables one byte at a time
+  for (; offset < bs; ++offset) {
+    for (int p = 0; p < parity_shards; ++p) {
+      const uint8_t *row = gf->tables + p * data_shards * 32;
+
+      uint8_t parity = 0;
+      for (int d = 0; d < data_shards; ++d) {
+        uint8_t data = shards[d][offset];
+        parity ^= row[d * 32 + (data & 0x0f)] ^ row[d * 32 + 16 + (data >> 4)];
+      }
+
+      shards[data_shards + p][offset] = parity;
+    }
+  }
+
+  return 0;
+}
+#endif
+
+#define REED_SOLOMON_VARIANT(name, isa) \
+  { \
+    name, \
+    cpu_supports##isa, \
+    reed_solomon_init##isa, \
+    reed_solomon_new##isa, \
+    reed_solomon_release##isa, \
+    reed_solomon_encode##isa, \
+    reed_solomon_decode##isa, \
+  }
+
+// Ordered from most to least preferred
+static const reed_solomon_variant_t reed_solomon_variant_list[] = {
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  REED_SOLOMON_VARIANT("gfni", _gfni),
+  REED_SOLOMON_VARIANT("avx512", _avx512),
+  REED_SOLOMON_VARIANT("avx2", _avx2),
+  REED_SOLOMON_VARIANT("ssse3", _ssse3),
+#elif defined(__aarch64__)
+  REED_SOLOMON_VARIANT("neon", _neon),
+#endif
+  // On ARM, the default variant also uses NEON when the compiler targets it
+  REED_SOLOMON_VARIANT("default", _def),
+};
+
+#undef REED_SOLOMON_VARIANT
+
+const reed_solomon_variant_t *reed_solomon_variants(int *count) {
+  *count = sizeof(reed_solomon_variant_list) / sizeof(reed_solomon_variant_list[0]);
+  return reed_solomon_variant_list;
+}
+
+const char *reed_solomon_variant_name(void) {
+  return reed_solomon_variant_name_selected;
+}
+
 /**
  * @brief This initializes the RS function pointers to the best vectorized version available.
  * @details The streaming code will directly invoke these function pointers during encoding.
  */
 void reed_solomon_init(void) {
-#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
-  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
-    reed_solomon_new_fn = reed_solomon_new_avx512;
-    reed_solomon_release_fn = reed_solomon_release_avx512;
-    reed_solomon_encode_fn = reed_solomon_encode_avx512;
-    reed_solomon_decode_fn = reed_solomon_decode_avx512;
-    reed_solomon_init_avx512();
-  } else if (__builtin_cpu_supports("avx2")) {
-    reed_solomon_new_fn = reed_solomon_new_avx2;
-    reed_solomon_release_fn = reed_solomon_release_avx2;
-    reed_solomon_encode_fn = reed_solomon_encode_avx2;
-    reed_solomon_decode_fn = reed_solomon_decode_avx2;
-    reed_solomon_init_avx2();
-  } else if (__builtin_cpu_supports("ssse3")) {
-    reed_solomon_new_fn = reed_solomon_new_ssse3;
-    reed_solomon_release_fn = reed_solomon_release_ssse3;
-    reed_solomon_encode_fn = reed_solomon_encode_ssse3;
-    reed_solomon_decode_fn = reed_solomon_decode_ssse3;
-    reed_solomon_init_ssse3();
-  } else
-#endif
-  {
-    reed_solomon_new_fn = reed_solomon_new_def;
-    reed_solomon_release_fn = reed_solomon_release_def;
-    reed_solomon_encode_fn = reed_solomon_encode_def;
-    reed_solomon_decode_fn = reed_solomon_decode_def;
-    reed_solomon_init_def();
+  int count;
+  const reed_solomon_variant_t *variants = reed_solomon_variants(&count);
+
+  // The default variant is always supported, so this always finds one
+  for (int x = 0; x < count; ++x) {
+    const reed_solomon_variant_t *variant = &variants[x];
+    if (!variant->supported()) {
+      continue;
+    }
+
+    reed_solomon_new_fn = variant->new_fn;
+    reed_solomon_release_fn = variant->release_fn;
+    reed_solomon_encode_fn = variant->encode_fn;
+    reed_solomon_decode_fn = variant->decode_fn;
+    variant->init();
+
+    reed_solomon_variant_name_selected = variant->name;
+    break;
   }
 }
@@ -25,6 +25,33 @@ extern reed_solomon_decode_t reed_solomon_decode_fn;
 #define reed_solomon_encode reed_solomon_encode_fn
 #define reed_solomon_decode reed_solomon_decode_fn
 
+/**
+ * @brief A Reed-Solomon implementation compiled for a specific instruction set.
+ */
+typedef struct {
+  const char *name;  ///< The name of the instruction set
+  int (*supported)(void);  ///< Returns non-zero if the CPU supports this variant
+  void (*init)(void);  ///< Initializes this variant's lookup tables
+  reed_solomon_new_t new_fn;
+  reed_solomon_release_t release_fn;
+  reed_solomon_encode_t encode_fn;
+  reed_solomon_decode_t decode_fn;
+} reed_solomon_variant_t;
+
+/**
+ * @brief Get all compiled Reed-Solomon variants, ordered from most to least preferred.
+ * @details This is mostly useful to benchmark or test variants other than the selected one.
+ * @param count Receives the number of variants.
+ * @return The variants.
+ */
+const reed_solomon_variant_t *reed_solomon_variants(int *count);
+
+/**
+ * @brief Get the name of the variant selected by `reed_solomon_init()`.
+ * @return The name of the selected variant, or `NULL` before initialization.
+ */
+const char *reed_solomon_variant_name(void);
+
 /**
  * @brief This initializes the RS function pointers to the best vectorized version available.
  * @details The streaming code will directly invoke these function pointers during encoding.
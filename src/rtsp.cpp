@@ -13,6 +13,7 @@ extern "C" {
 #include <array>
 #include <cctype>
 #include <format>
+#include <map>
 #include <set>
 #include <unordered_map>
 #include <utility>
@@ -499,7 +500,7 @@ namespace rtsp_stream {
       launch_event.raise(std::move(launch_session));
 
       // Arm the timer to expire this launch session if the client times out
-      raised_timer.expires_after(config::stream.ping_timeout);
+      raised_timer.expires_after(config::stream.ping_timeout.load());
       raised_timer.async_wait([this](const boost::system::error_code &ec) {
         if (!ec) {
           auto discarded = launch_event.pop(0s);
@@ -743,33 +744,42 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
-    OPTION_ITEM option {};
-
-    // I know these string literals will not be modified
-    option.option = const_cast<char *>("CSeq");
-
-    auto seqn_str = std::to_string(req->sequenceNumber);
-    option.content = const_cast<char *>(seqn_str.c_str());
+  /**
+   * @brief What the capabilities advertised in a DESCRIBE response depend on.
+   */
+  struct describe_key_t {
+    std::uint32_t capabilities;
+    int encryption_mode;
+    bool ref_frames_invalidation;
+    int hevc_mode;
+    int av1_mode;
+
+    auto operator<=>(const describe_key_t &) const = default;
+  };
 
+  /**
+   * @brief Build the capabilities advertised in a DESCRIBE response.
+   * @param key The capabilities of the host and the encryption mode of the client.
+   * @return The general, encryption and video attributes.
+   */
+  static std::string describe_capabilities(const describe_key_t &key) {
     std::stringstream ss;
 
     // Tell the client about our supported features
-    ss << "a=x-ss-general.featureFlags:" << (uint32_t) platf::get_capabilities() << std::endl;
+    ss << "a=x-ss-general.featureFlags:" << key.capabilities << std::endl;
 
     // Always request new control stream encryption if the client supports it
     uint32_t encryption_flags_supported = SS_ENC_CONTROL_V2 | SS_ENC_AUDIO;
     uint32_t encryption_flags_requested = SS_ENC_CONTROL_V2;
 
     // Determine the encryption desired for this remote endpoint
-    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
-    if (encryption_mode != config::ENCRYPTION_MODE_NEVER) {
+    if (key.encryption_mode != config::ENCRYPTION_MODE_NEVER) {
       // Advertise support for video encryption if it's not disabled
       encryption_flags_supported |= SS_ENC_VIDEO;
 
       // If it's mandatory, also request it to enable use if the client
       // didn't explicitly opt in, but it otherwise has support.
-      if (encryption_mode == config::ENCRYPTION_MODE_MANDATORY) {
+      if (key.encryption_mode == config::ENCRYPTION_MODE_MANDATORY) {
         encryption_flags_requested |= SS_ENC_VIDEO | SS_ENC_AUDIO;
       }
     }
@@ -778,52 +788,102 @@ namespace rtsp_stream {
     ss << "a=x-ss-general.encryptionSupported:" << encryption_flags_supported << std::endl;
     ss << "a=x-ss-general.encryptionRequested:" << encryption_flags_requested << std::endl;
 
-    if (video::last_encoder_probe_supported_ref_frames_invalidation) {
+    if (key.ref_frames_invalidation) {
       ss << "a=x-nv-video[0].refPicInvalidation:1"sv << std::endl;
     }
 
-    if (video::active_hevc_mode != 1) {
+    if (key.hevc_mode != 1) {
       ss << "sprop-parameter-sets=AAAAAU"sv << std::endl;
     }
 
-    if (video::active_av1_mode != 1) {
+    if (key.av1_mode != 1) {
       ss << "a=rtpmap:98 AV1/90000"sv << std::endl;
     }
 
-    if (!session.surround_params.empty()) {
-      // If we have our own surround parameters, advertise them twice first
-      ss << "a=fmtp:97 surround-params="sv << session.surround_params << std::endl;
-      ss << "a=fmtp:97 surround-params="sv << session.surround_params << std::endl;
-    }
+    return ss.str();
+  }
 
-    for (int x = 0; x < audio::MAX_STREAM_CONFIG; ++x) {
-      auto &stream_config = audio::stream_configs[x];
-      std::uint8_t mapping[platf::speaker::MAX_SPEAKERS];
+  /**
+   * @brief Build the audio stream configurations advertised in a DESCRIBE response.
+   * @details They never change, so they're only built once.
+   */
+  static const std::string &describe_audio() {
+    static const std::string audio = []() {
+      std::stringstream ss;
+
+      for (int x = 0; x < audio::MAX_STREAM_CONFIG; ++x) {
+        auto &stream_config = audio::stream_configs[x];
+        std::uint8_t mapping[platf::speaker::MAX_SPEAKERS];
+
+        auto mapping_p = stream_config.mapping;
+
+        /**
+         * GFE advertises incorrect mapping for normal quality configurations,
+         * as a result, Moonlight rotates all channels from index '3' to the right
+         * To work around this, rotate channels to the left from index '3'
+         */
+        if (x == audio::SURROUND51 || x == audio::SURROUND71) {
+          std::copy_n(mapping_p, stream_config.channelCount, mapping);
+          std::rotate(mapping + 3, mapping + 4, mapping + audio::MAX_STREAM_CONFIG);
+
+          mapping_p = mapping;
+        }
 
-      auto mapping_p = stream_config.mapping;
+        ss << "a=fmtp:97 surround-params="sv << stream_config.channelCount << stream_config.streams << stream_config.coupledStreams;
 
-      /**
-       * GFE advertises incorrect mapping for normal quality configurations,
-       * as a result, Moonlight rotates all channels from index '3' to the right
-       * To work around this, rotate channels to the left from index '3'
-       */
-      if (x == audio::SURROUND51 || x == audio::SURROUND71) {
-        std::copy_n(mapping_p, stream_config.channelCount, mapping);
-        std::rotate(mapping + 3, mapping + 4, mapping + audio::MAX_STREAM_CONFIG);
+        std::for_each_n(mapping_p, stream_config.channelCount, [&ss](std::uint8_t digit) {
+          ss << (char) (digit + '0');
+        });
 
-        mapping_p = mapping;
+        ss << std::endl;
       }
 
-      ss << "a=fmtp:97 surround-params="sv << stream_config.channelCount << stream_config.streams << stream_config.coupledStreams;
+      return ss.str();
+    }();
 
-      std::for_each_n(mapping_p, stream_config.channelCount, [&ss](std::uint8_t digit) {
-        ss << (char) (digit + '0');
-      });
+    return audio;
+  }
+
+  void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+    OPTION_ITEM option {};
+
+    // I know these string literals will not be modified
+    option.option = const_cast<char *>("CSeq");
+
+    auto seqn_str = std::to_string(req->sequenceNumber);
+    option.content = const_cast<char *>(seqn_str.c_str());
+
+    // The capabilities only change when the encoders are probed again, so the response is built once for each
+    // set of them instead of for every client
+    static sync_util::sync_t<std::map<describe_key_t, std::string>> capabilities_cache;
+
+    describe_key_t key {
+      (std::uint32_t) platf::get_capabilities(),
+      net::encryption_mode_for_address(sock.remote_endpoint().address()),
+      video::last_encoder_probe_supported_ref_frames_invalidation,
+      video::active_hevc_mode,
+      video::active_av1_mode,
+    };
 
-      ss << std::endl;
+    std::string payload;
+    {
+      auto lg = capabilities_cache.lock();
+      auto it = capabilities_cache->find(key);
+      if (it == capabilities_cache->end()) {
+        it = capabilities_cache->emplace(key, describe_capabilities(key)).first;
+      }
+      payload = it->second;
     }
 
-    respond(sock, session, &option, 200, "OK", req->sequenceNumber, ss.str());
+    if (!session.surround_params.empty()) {
+      // If we have our own surround parameters, advertise them twice first
+      payload += std::format("a=fmtp:97 surround-params={}\n", session.surround_params);
+      payload += std::format("a=fmtp:97 surround-params={}\n", session.surround_params);
+    }
+
+    payload += describe_audio();
+
+    respond(sock, session, &option, 200, "OK", req->sequenceNumber, payload);
   }
 
   void cmd_setup(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
@@ -962,6 +1022,10 @@ namespace rtsp_stream {
       config.audio.channels = util::from_view(args.at("x-nv-audio.surround.numChannels"sv));
       config.audio.mask = util::from_view(args.at("x-nv-audio.surround.channelMask"sv));
       config.audio.packetDuration = util::from_view(args.at("x-nv-aqos.packetDuration"sv));
+      if (!audio::is_valid_packet_duration(config.audio.packetDuration)) {
+        BOOST_LOG(warning) << "Opus can't encode "sv << config.audio.packetDuration << " ms audio packets, using 5 ms instead"sv;
+        config.audio.packetDuration = 5;
+      }
 
       config.audio.flags[audio::config_t::HIGH_QUALITY] =
         util::from_view(args.at("x-nv-audio.surround.AudioQuality"sv));
@@ -991,6 +1055,7 @@ namespace rtsp_stream {
       config.monitor.dynamicRange = util::from_view(args.at("x-nv-video[0].dynamicRangeMode"sv));
       config.monitor.chromaSamplingType = util::from_view(args.at("x-ss-video[0].chromaSamplingType"sv));
       config.monitor.enableIntraRefresh = util::from_view(args.at("x-ss-video[0].intraRefresh"sv));
+      config.monitor.output_name = session.output_name;
 
       configuredBitrateKbps = util::from_view(args.at("x-ml-video.configuredBitrateKbps"sv));
     } catch (std::out_of_range &) {
@@ -1145,6 +1210,10 @@ namespace rtsp_stream {
       }
 
       server.clear();
+
+      // Nothing kept for a reconnecting client may outlive the server
+      stream::release_parked_broadcast();
+      video::release_warm_display();
     }};
 
     // Wait for shutdown
@@ -25,6 +25,8 @@ namespace rtsp_stream {
 
     bool host_audio;
     std::string unique_id;
+    std::string client_uuid;  ///< The UUID of the paired client, or empty if it isn't known
+    std::string output_name;  ///< The display the client asked to capture, or empty for the configured one
     int width;
     int height;
     int fps;
@@ -0,0 +1,322 @@
+/**
+ * @file src/session_recording.cpp
+ * @brief Definitions for recording streaming sessions to replay them later.
+ */
+// standard includes
+#include <array>
+#include <cstring>
+
+// local includes
+#include "logging.h"
+#include "session_recording.h"
+#include "utility.h"
+
+using namespace std::literals;
+
+namespace session_recording {
+  namespace {
+    constexpr auto MAGIC = "SUNREC"sv;
+
+    // The type, the size of the payload and the time of a record
+    constexpr std::size_t RECORD_HEADER_SIZE = sizeof(std::uint8_t) + sizeof(std::uint32_t) + sizeof(std::int64_t);
+
+    template<class T>
+    void put(std::string &out, T value) {
+      value = util::endian::little(value);
+      out.append((const char *) &value, sizeof(value));
+    }
+
+    void put(std::string &out, std::string_view value) {
+      put(out, (std::uint32_t) value.size());
+      out.append(value);
+    }
+
+    template<class T>
+    bool get(std::string_view &in, T &value) {
+      if (in.size() < sizeof(value)) {
+        return false;
+      }
+
+      std::memcpy(&value, in.data(), sizeof(value));
+      value = util::endian::little(value);
+      in.remove_prefix(sizeof(value));
+      return true;
+    }
+
+    bool get(std::string_view &in, std::string &value) {
+      std::uint32_t size;
+      if (!get(in, size) || in.size() < size) {
+        return false;
+      }
+
+      value.assign(in.substr(0, size));
+      in.remove_prefix(size);
+      return true;
+    }
+
+    // The fields of a config record, in the order they are written
+    auto fields(config_t &config) {
+      auto &monitor = config.monitor;
+      return std::array<int *, 15> {
+        &monitor.width,
+        &monitor.height,
+        &monitor.framerate,
+        &monitor.framerateX100,
+        &monitor.bitrate,
+        &monitor.slicesPerFrame,
+        &monitor.numRefFrames,
+        &monitor.encoderCscMode,
+        &monitor.videoFormat,
+        &monitor.dynamicRange,
+        &monitor.chromaSamplingType,
+        &monitor.enableIntraRefresh,
+        &config.packetsize,
+        &config.min_required_fec_packets,
+        &config.ml_feature_flags,
+      };
+    }
+  }  // namespace
+
+  std::optional<config_t> decode_config(std::string_view payload) {
+    config_t config {};
+    for (auto field : fields(config)) {
+      std::int32_t value;
+      if (!get(payload, value)) {
+        return std::nullopt;
+      }
+
+      *field = value;
+    }
+
+    if (!get(payload, config.encryption_flags)) {
+      return std::nullopt;
+    }
+
+    return config;
+  }
+
+  std::optional<std::pair<video_t, std::string_view>> decode_video(std::string_view payload) {
+    video_t video {};
+
+    std::uint8_t flags;
+    std::int32_t part_index;
+    std::int32_t part_count;
+    std::int64_t capture_delay;
+    std::uint32_t replacements;
+    if (
+      !get(payload, video.frame_index) ||
+      !get(payload, flags) ||
+      !get(payload, part_index) ||
+      !get(payload, part_count) ||
+      !get(payload, capture_delay) ||
+      !get(payload, replacements)
+    ) {
+      return std::nullopt;
+    }
+
+    video.idr = flags & 0x1;
+    video.after_ref_frame_invalidation = flags & 0x2;
+    video.intra_refresh = flags & 0x8;
+    video.part_index = part_index;
+    video.part_count = part_count;
+    if (flags & 0x4) {
+      video.capture_delay = std::chrono::nanoseconds {capture_delay};
+    }
+
+    for (std::uint32_t x = 0; x < replacements; ++x) {
+      auto &[old, _new] = video.replacements.emplace_back();
+      if (!get(payload, old) || !get(payload, _new)) {
+        return std::nullopt;
+      }
+    }
+
+    return std::pair {std::move(video), payload};
+  }
+
+  std::optional<control_t> decode_control(std::string_view payload) {
+    control_t control;
+    if (!get(payload, control.type)) {
+      return std::nullopt;
+    }
+
+    control.payload = payload;
+    return control;
+  }
+
+  std::optional<std::chrono::milliseconds> decode_rtt(std::string_view payload) {
+    std::uint32_t rtt;
+    if (!get(payload, rtt)) {
+      return std::nullopt;
+    }
+
+    return std::chrono::milliseconds {rtt};
+  }
+
+  writer_t::writer_t(const std::filesystem::path &path):
+      _file {path, std::ios::binary | std::ios::trunc},
+      _start {clock::now()} {
+    if (!_file) {
+      BOOST_LOG(error) << "Couldn't create the session recording "sv << path;
+      return;
+    }
+
+    _pending.append(MAGIC);
+    put(_pending, VERSION);
+
+    _thread = std::thread {&writer_t::flush_loop, this};
+  }
+
+  writer_t::~writer_t() {
+    if (!_thread.joinable()) {
+      return;
+    }
+
+    {
+      std::lock_guard lg {_lock};
+      _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+
+    if (_dropped) {
+      BOOST_LOG(warning) << "The disk didn't keep up with the session recording, "sv << _dropped << " records were dropped"sv;
+    }
+  }
+
+  void writer_t::write_config(const config_t &config) {
+    std::string head;
+    auto copy = config;
+    for (auto field : fields(copy)) {
+      put(head, (std::int32_t) *field);
+    }
+    put(head, config.encryption_flags);
+
+    write(record_e::config, clock::now(), head, {});
+  }
+
+  void writer_t::write_video(clock::time_point queued, const video_t &video, std::string_view data) {
+    std::string head;
+    put(head, video.frame_index);
+    put(head, (std::uint8_t) ((video.idr ? 0x1 : 0) | (video.after_ref_frame_invalidation ? 0x2 : 0) | (video.capture_delay ? 0x4 : 0) | (video.intra_refresh ? 0x8 : 0)));
+    put(head, (std::int32_t) video.part_index);
+    put(head, (std::int32_t) video.part_count);
+    put(head, (std::int64_t) video.capture_delay.value_or(0ns).count());
+    put(head, (std::uint32_t) video.replacements.size());
+    for (auto &[old, _new] : video.replacements) {
+      put(head, std::string_view {old});
+      put(head, std::string_view {_new});
+    }
+
+    write(record_e::video, queued, head, data);
+  }
+
+  void writer_t::write_control(std::uint16_t type, std::string_view payload) {
+    std::string head;
+    put(head, type);
+
+    write(record_e::control, clock::now(), head, payload);
+  }
+
+  void writer_t::write_input(std::string_view payload) {
+    write(record_e::input, clock::now(), {}, payload);
+  }
+
+  void writer_t::write_rtt(std::chrono::milliseconds rtt) {
+    std::string head;
+    put(head, (std::uint32_t) rtt.count());
+
+    write(record_e::rtt, clock::now(), head, {});
+  }
+
+  void writer_t::write(record_e type, clock::time_point time, std::string_view head, std::string_view data) {
+    if (!_thread.joinable()) {
+      return;
+    }
+
+    std::string header;
+    put(header, (std::uint8_t) type);
+    put(header, (std::uint32_t) (head.size() + data.size()));
+    put(header, (std::int64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(time - _start).count());
+
+    {
+      std::lock_guard lg {_lock};
+      if (_pending.size() + header.size() + head.size() + data.size() > MAX_PENDING) {
+        ++_dropped;
+        return;
+      }
+
+      // The data of a video packet is only copied once, straight into the pending buffer
+      _pending.append(header);
+      _pending.append(head);
+      _pending.append(data);
+    }
+    _cv.notify_one();
+  }
+
+  void writer_t::flush_loop() {
+    std::string buffer;
+
+    std::unique_lock ul {_lock};
+    while (true) {
+      _cv.wait(ul, [this]() {
+        return _stop || !_pending.empty();
+      });
+
+      if (_pending.empty()) {
+        break;
+      }
+
+      // Write without holding the lock, so recording doesn't wait on the disk
+      buffer.clear();
+      std::swap(buffer, _pending);
+      ul.unlock();
+      _file.write(buffer.data(), (std::streamsize) buffer.size());
+      ul.lock();
+    }
+
+    _file.flush();
+  }
+
+  reader_t::reader_t(const std::filesystem::path &path):
+      _file {path, std::ios::binary} {
+    std::string header(MAGIC.size() + sizeof(VERSION), '\0');
+    if (!_file.read(header.data(), (std::streamsize) header.size())) {
+      return;
+    }
+
+    std::string_view view {header};
+    std::uint16_t version;
+    if (!view.starts_with(MAGIC)) {
+      return;
+    }
+    view.remove_prefix(MAGIC.size());
+
+    _valid = get(view, version) && version == VERSION;
+  }
+
+  std::optional<record_t> reader_t::next() {
+    if (!_valid) {
+      return std::nullopt;
+    }
+
+    std::array<char, RECORD_HEADER_SIZE> header;
+    if (!_file.read(header.data(), header.size())) {
+      return std::nullopt;
+    }
+
+    std::string_view view {header.data(), header.size()};
+    std::uint8_t type;
+    std::uint32_t size;
+    std::int64_t time;
+    get(view, type);
+    get(view, size);
+    get(view, time);
+
+    record_t record {(record_e) type, std::chrono::nanoseconds {time}, std::string(size, '\0')};
+    if (!_file.read(record.payload.data(), size)) {
+      return std::nullopt;
+    }
+
+    return record;
+  }
+}  // namespace session_recording
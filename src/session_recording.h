@@ -0,0 +1,188 @@
+/**
+ * @file src/session_recording.h
+ * @brief Declarations for recording streaming sessions to replay them later.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// local includes
+#include "video.h"
+
+namespace session_recording {
+  using clock = std::chrono::steady_clock;
+
+  constexpr std::uint16_t VERSION = 1;
+
+  enum class record_e : std::uint8_t {
+    config,  ///< The configuration of the session, always the first record
+    video,  ///< A video packet handed to the broadcast thread
+    control,  ///< A control stream message, after decryption
+    input,  ///< An input packet, after decryption
+    rtt,  ///< A new round trip time of the control stream
+  };
+
+  /**
+   * @brief The part of the configuration of a session that shapes its video stream.
+   */
+  struct config_t {
+    video::config_t monitor;
+    int packetsize;
+    int min_required_fec_packets;
+    int ml_feature_flags;
+    std::uint32_t encryption_flags;
+
+    bool operator==(const config_t &) const = default;
+  };
+
+  /**
+   * @brief A video packet, without its encoded data.
+   */
+  struct video_t {
+    std::int64_t frame_index;
+    bool idr;
+    bool after_ref_frame_invalidation;
+    bool intra_refresh;
+    int part_index;
+    int part_count;
+    std::optional<std::chrono::nanoseconds> capture_delay;  ///< From the capture until the packet was handed to the broadcast thread
+    std::vector<std::pair<std::string, std::string>> replacements;  ///< The bytes to replace in an IDR frame, and what to replace them with
+
+    bool operator==(const video_t &) const = default;
+  };
+
+  /**
+   * @brief A control stream message.
+   */
+  struct control_t {
+    std::uint16_t type;
+    std::string_view payload;
+  };
+
+  struct record_t {
+    record_e type;
+    std::chrono::nanoseconds time;  ///< Since the recording started
+    std::string payload;
+  };
+
+  /**
+   * @brief Decode the payload of a config record.
+   * @param payload The payload of the record.
+   * @return The configuration, or `std::nullopt` if the payload is truncated.
+   */
+  std::optional<config_t> decode_config(std::string_view payload);
+
+  /**
+   * @brief Decode the payload of a video record.
+   * @param payload The payload of the record.
+   * @return The packet and its encoded data, or `std::nullopt` if the payload is truncated.
+   */
+  std::optional<std::pair<video_t, std::string_view>> decode_video(std::string_view payload);
+
+  /**
+   * @brief Decode the payload of a control record.
+   * @param payload The payload of the record.
+   * @return The message, pointing into the payload, or `std::nullopt` if the payload is truncated.
+   */
+  std::optional<control_t> decode_control(std::string_view payload);
+
+  /**
+   * @brief Decode the payload of a round trip time record.
+   * @param payload The payload of the record.
+   * @return The round trip time, or `std::nullopt` if the payload is truncated.
+   */
+  std::optional<std::chrono::milliseconds> decode_rtt(std::string_view payload);
+
+  /**
+   * @brief Appends the records of a session to a file.
+   * @details Records are buffered and written by a thread of the writer, so recording never waits on the disk.
+   *          If the disk doesn't keep up, records are dropped once `MAX_PENDING` bytes are waiting.
+   * @note This is thread-safe.
+   */
+  class writer_t {
+  public:
+    static constexpr std::size_t MAX_PENDING = 64 << 20;
+
+    /**
+     * @param path The file to write.
+     */
+    explicit writer_t(const std::filesystem::path &path);
+    ~writer_t();
+
+    writer_t(const writer_t &) = delete;
+    writer_t &operator=(const writer_t &) = delete;
+
+    bool is_open() const {
+      return _thread.joinable();
+    }
+
+    void write_config(const config_t &config);
+
+    /**
+     * @brief Record a video packet.
+     * @param queued The time the packet was handed to the broadcast thread.
+     * @param video The packet.
+     * @param data The encoded data of the packet.
+     */
+    void write_video(clock::time_point queued, const video_t &video, std::string_view data);
+
+    void write_control(std::uint16_t type, std::string_view payload);
+    void write_input(std::string_view payload);
+    void write_rtt(std::chrono::milliseconds rtt);
+
+  private:
+    void write(record_e type, clock::time_point time, std::string_view head, std::string_view data);
+    void flush_loop();
+
+    std::ofstream _file;
+    clock::time_point _start;
+
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::string _pending;
+    std::uint64_t _dropped = 0;
+    bool _stop = false;
+
+    std::thread _thread;
+  };
+
+  /**
+   * @brief Reads the records of a session from a file.
+   */
+  class reader_t {
+  public:
+    /**
+     * @param path The file to read.
+     */
+    explicit reader_t(const std::filesystem::path &path);
+
+    /**
+     * @brief Check whether the file was opened and is a recording this version can read.
+     */
+    bool is_open() const {
+      return _valid;
+    }
+
+    /**
+     * @brief Read the next record.
+     * @return The record, or `std::nullopt` at the end of the file, or if the last record is truncated.
+     */
+    std::optional<record_t> next();
+
+  private:
+    std::ifstream _file;
+    bool _valid = false;
+  };
+}  // namespace session_recording
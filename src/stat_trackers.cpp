@@ -2,6 +2,11 @@
  * @file src/stat_trackers.cpp
  * @brief Definitions for streaming statistic tracking.
  */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
 // local includes
 #include "stat_trackers.h"
 
@@ -15,4 +20,89 @@ namespace stat_trackers {
     return boost::format("%1$.2f");
   }
 
+  namespace {
+    constexpr std::uint64_t SUB_BUCKETS = std::uint64_t {1} << hdr_histogram_t::SUB_BUCKET_BITS;
+    constexpr std::uint64_t MAX_VALUE = (std::uint64_t {1} << hdr_histogram_t::MAX_VALUE_BITS) - 1;
+  }  // namespace
+
+  hdr_histogram_t::hdr_histogram_t(double resolution):
+      _resolution {resolution},
+      _counts(index_of(MAX_VALUE) + 1) {
+  }
+
+  std::size_t hdr_histogram_t::index_of(std::uint64_t value) {
+    // Values below the sub-bucket count each get a bucket, larger ones share
+    // a bucket with the values that only differ in their lowest bits
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+
+    auto shift = std::bit_width(value) - 1 - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+  }
+
+  std::uint64_t hdr_histogram_t::highest_equivalent_value(std::size_t index) {
+    if (index < SUB_BUCKETS) {
+      return index;
+    }
+
+    auto shift = index / SUB_BUCKETS - 1;
+    auto lowest = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lowest + (std::uint64_t {1} << shift) - 1;
+  }
+
+  void hdr_histogram_t::record(double value) {
+    auto scaled = std::max(value / _resolution, 0.0);
+    auto units = scaled >= (double) MAX_VALUE ? MAX_VALUE : (std::uint64_t) std::llround(scaled);
+
+    ++_counts[index_of(units)];
+    ++_count;
+    _min = std::min(_min, units);
+    _max = std::max(_max, units);
+    _total += value;
+  }
+
+  double hdr_histogram_t::percentile(double percentile) const {
+    if (_count == 0) {
+      return 0;
+    }
+
+    auto rank = std::max<std::uint64_t>(1, (std::uint64_t) std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * _count));
+
+    std::uint64_t seen = 0;
+    for (std::size_t x = index_of(_min); x <= index_of(_max); ++x) {
+      seen += _counts[x];
+      if (seen >= rank) {
+        // Never report more than was recorded, which would be off by up to a bucket width
+        return std::min(highest_equivalent_value(x), _max) * _resolution;
+      }
+    }
+
+    return _max * _resolution;
+  }
+
+  double hdr_histogram_t::min() const {
+    return _count ? _min * _resolution : 0;
+  }
+
+  double hdr_histogram_t::max() const {
+    return _max * _resolution;
+  }
+
+  double hdr_histogram_t::mean() const {
+    return _count ? _total / _count : 0;
+  }
+
+  void hdr_histogram_t::reset() {
+    // Only the buckets between the smallest and largest values may have been touched
+    if (_count) {
+      std::fill(std::begin(_counts) + index_of(_min), std::begin(_counts) + index_of(_max) + 1, 0);
+    }
+
+    _count = 0;
+    _min = std::numeric_limits<std::uint64_t>::max();
+    _max = 0;
+    _total = 0;
+  }
+
 }  // namespace stat_trackers
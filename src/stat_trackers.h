@@ -6,8 +6,10 @@
 
 // standard includes
 #include <chrono>
+#include <cstdint>
 #include <functional>
 #include <limits>
+#include <vector>
 
 // lib includes
 #include <boost/format.hpp>
@@ -50,4 +52,94 @@ namespace stat_trackers {
     } data;
   };
 
+  /**
+   * @brief A histogram with buckets of constant relative width, after HdrHistogram.
+   * @details Each power of two is split into 128 buckets, so percentiles are within 1% of the
+   *          recorded values. Recording a value takes a few bit operations, whatever the count.
+   */
+  class hdr_histogram_t {
+  public:
+    static constexpr int SUB_BUCKET_BITS = 7;
+    static constexpr int MAX_VALUE_BITS = 40;
+
+    /**
+     * @param resolution The smallest difference between values that is kept apart.
+     *                   Values up to 2^40 times the resolution are tracked, larger ones are clamped.
+     */
+    explicit hdr_histogram_t(double resolution = 1.0);
+
+    /**
+     * @brief Count a value. Negative values are counted as zero.
+     * @param value The value.
+     */
+    void record(double value);
+
+    /**
+     * @brief Get the value below which a percentage of the recorded values fall.
+     * @param percentile The percentage, from 0 to 100.
+     * @return The value, or zero if nothing was recorded.
+     */
+    double percentile(double percentile) const;
+
+    std::uint64_t count() const {
+      return _count;
+    }
+
+    double min() const;
+    double max() const;
+    double mean() const;
+
+    double total() const {
+      return _total;
+    }
+
+    void reset();
+
+  private:
+    static std::size_t index_of(std::uint64_t value);
+    static std::uint64_t highest_equivalent_value(std::size_t index);
+
+    double _resolution;
+    std::vector<std::uint32_t> _counts;
+    std::uint64_t _count = 0;
+    std::uint64_t _min = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t _max = 0;
+    double _total = 0;
+  };
+
+  /**
+   * @brief Tracks the distribution of a value over a window of time.
+   */
+  template<typename T>
+  class percentile_tracker {
+  public:
+    using callback_function = std::function<void(const hdr_histogram_t &histogram)>;
+
+    /**
+     * @param resolution The smallest difference between values that is kept apart.
+     */
+    explicit percentile_tracker(double resolution):
+        histogram {resolution} {
+    }
+
+    void collect_and_callback_on_interval(T stat, const callback_function &callback, std::chrono::seconds interval_in_seconds) {
+      if (histogram.count() == 0) {
+        last_callback_time = std::chrono::steady_clock::now();
+      } else if (std::chrono::steady_clock::now() > last_callback_time + interval_in_seconds) {
+        callback(histogram);
+        histogram.reset();
+        last_callback_time = std::chrono::steady_clock::now();
+      }
+      histogram.record((double) stat);
+    }
+
+    void reset() {
+      histogram.reset();
+    }
+
+  private:
+    std::chrono::steady_clock::time_point last_callback_time = std::chrono::steady_clock::now();
+    hdr_histogram_t histogram;
+  };
+
 }  // namespace stat_trackers
@@ -4,9 +4,13 @@
  */
 
 // standard includes
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <future>
 #include <queue>
+#include <span>
+#include <thread>
 
 // lib includes
 #include <boost/endian/arithmetic.hpp>
@@ -20,19 +24,27 @@ extern "C" {
 }
 
 // local includes
+#include "buffer_pool.h"
+#include "client_stats.h"
 #include "config.h"
 #include "display_device.h"
+#include "frame_trace.h"
 #include "globals.h"
+#include "hybrid_timer.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "platform/common.h"
 #include "process.h"
+#include "session_recording.h"
 #include "stream.h"
 #include "sync.h"
 #include "system_tray.h"
+#include "thread_affinity.h"
 #include "thread_safe.h"
 #include "utility.h"
+#include "video_quality.h"
 
 #define IDX_START_A 0
 #define IDX_START_B 1
@@ -49,6 +61,7 @@ extern "C" {
 #define IDX_SET_MOTION_EVENT 13
 #define IDX_SET_RGB_LED 14
 #define IDX_SET_ADAPTIVE_TRIGGERS 15
+#define IDX_VIDEO_NACK 16
 
 static const short packetTypes[] = {
   0x0305,  // Start A
@@ -67,6 +80,7 @@ static const short packetTypes[] = {
   0x5501,  // Set motion event (Sunshine protocol extension)
   0x5502,  // Set RGB LED (Sunshine protocol extension)
   0x5503,  // Set Adaptive triggers (Sunshine protocol extension)
+  0x5504,  // Video NACK (Sunshine protocol extension)
 };
 
 namespace asio = boost::asio;
@@ -203,6 +217,12 @@ namespace stream {
     std::uint8_t right[DS_EFFECT_PAYLOAD_SIZE];
   };
 
+  // Sunshine protocol extension, the payload of a video NACK is an array of these
+  struct control_video_nack_range_t {
+    boost::endian::little_uint32_at firstSequenceNumber;
+    boost::endian::little_uint16_at count;
+  };
+
   struct control_hdr_mode_t {
     control_header_v2 header;
 
@@ -239,22 +259,151 @@ namespace stream {
 
   constexpr std::size_t MAX_AUDIO_PACKET_SIZE = 1400;
 
+  // Video shards kept for retransmission, around 100ms of a 200 Mbps stream
+  constexpr std::size_t VIDEO_RETRANSMIT_HISTORY = 2048;
+
+  // Shards sent again for a single NACK, so a bogus one can't make us flood the link
+  constexpr std::size_t MAX_VIDEO_NACK_SHARDS = 256;
+
+  // Shorter sessions end before the controllers settle, so they aren't kept for the next session to start from
+  constexpr auto WARM_START_MIN_SESSION = 30s;
+
   using audio_aes_t = std::array<char, round_to_pkcs7_padded(MAX_AUDIO_PACKET_SIZE)>;
 
   using av_session_id_t = std::variant<asio::ip::address, std::string>;  // IP address or SS-Ping-Payload from RTSP handshake
   using message_queue_t = std::shared_ptr<safe::queue_t<std::pair<udp::endpoint, std::string>>>;
   using message_queue_queue_t = std::shared_ptr<safe::queue_t<std::tuple<socket_e, av_session_id_t, message_queue_t>>>;
+  using delay_queue_t = std::shared_ptr<safe::queue_t<std::pair<std::string, std::shared_ptr<delay::estimate_t>>>>;  // SS-Ping-Payload and the estimate its video pings feed, or `nullptr` to stop
+
+  /**
+   * @brief Finds the session a ping received on a video or audio socket belongs to.
+   */
+  struct ping_sessions_t {
+    struct address_hash_t {
+      std::size_t operator()(const asio::ip::address &address) const {
+        if (address.is_v4()) {
+          return std::hash<std::uint32_t> {}(address.to_v4().to_uint());
+        }
+
+        auto bytes = address.to_v6().to_bytes();
+        return std::hash<std::string_view> {}(std::string_view {(const char *) bytes.data(), bytes.size()});
+      }
+    };
+
+    struct payload_hash_t {
+      using is_transparent = void;
+
+      std::size_t operator()(std::string_view payload) const {
+        return std::hash<std::string_view> {}(payload);
+      }
+    };
+
+    void add(const av_session_id_t &session_id, const message_queue_t &message_queue) {
+      if (auto address = std::get_if<asio::ip::address>(&session_id)) {
+        by_address.emplace(*address, message_queue);
+      } else {
+        by_payload.emplace(std::get<std::string>(session_id), message_queue);
+      }
+    }
+
+    void remove(const av_session_id_t &session_id) {
+      if (auto address = std::get_if<asio::ip::address>(&session_id)) {
+        by_address.erase(*address);
+      } else {
+        by_payload.erase(std::get<std::string>(session_id));
+      }
+    }
+
+    /**
+     * @brief Find the session of a ping.
+     * @param peer The sender of the ping.
+     * @param ping The ping.
+     * @return The message queue of the session, or `nullptr` if the ping matches none.
+     */
+    const message_queue_t *find(const udp::endpoint &peer, std::string_view ping) const {
+      if (ping.size() == 4) {
+        // For legacy PING packets, find the matching session by address.
+        auto it = by_address.find(peer.address());
+        return it != std::end(by_address) ? &it->second : nullptr;
+      }
+
+      if (ping.size() >= sizeof(SS_PING)) {
+        // For new PING packets that include a client identifier, search by payload.
+        // The payload is looked up in place, without copying it into a string first.
+        auto it = by_payload.find(std::string_view {((PSS_PING) ping.data())->payload, sizeof(SS_PING::payload)});
+        return it != std::end(by_payload) ? &it->second : nullptr;
+      }
+
+      return nullptr;
+    }
+
+    std::unordered_map<asio::ip::address, message_queue_t, address_hash_t> by_address;
+    std::unordered_map<std::string, message_queue_t, payload_hash_t, std::equal_to<>> by_payload;
+  };
+
+  /**
+   * @brief The sessions of the control server, indexed by how control stream connections are matched to them.
+   * @details The table is rebuilt as a whole whenever a session is added, connects or is removed,
+   *          which is rare, so looking a session up never waits on a lock.
+   */
+  struct session_table_t {
+    struct entry_t {
+      session_t *session;
+      net::peer_t peer;  ///< `nullptr` until the client connects to the control stream
+
+      // Used for new clients with ML_FF_SESSION_ID_V1, otherwise the address of the legacy client
+      std::optional<std::uint32_t> connect_data;
+      std::string expected_peer_address;
+    };
+
+    /**
+     * @brief Rebuild the indexes from the entries.
+     * @details Sessions waiting for legacy clients from the same address are matched in the order they started.
+     */
+    void index() {
+      by_peer.clear();
+      by_connect_data.clear();
+      by_address.clear();
+
+      for (auto &entry : sessions) {
+        if (entry.peer) {
+          by_peer.emplace(entry.peer, entry.session);
+        } else if (entry.connect_data) {
+          by_connect_data.emplace(*entry.connect_data, entry.session);
+        } else {
+          by_address.emplace(entry.expected_peer_address, entry.session);
+        }
+      }
+    }
+
+    // All active sessions (including those still waiting for a peer to connect)
+    std::vector<entry_t> sessions;
+
+    std::unordered_map<net::peer_t, session_t *> by_peer;
+    std::unordered_map<std::uint32_t, session_t *> by_connect_data;
+    std::unordered_map<std::string, session_t *> by_address;
+  };
 
   // return bytes written on success
   // return -1 on error
-  static inline int encode_audio(bool encrypted, const audio::buffer_t &plaintext, uint8_t *destination, crypto::aes_t &iv, crypto::cipher::cbc_t &cbc) {
+  static inline int encode_audio(bool encrypted, std::span<const std::uint8_t> plaintext, uint8_t *destination, crypto::aes_t &iv, crypto::cipher::cbc_t &cbc) {
     // If encryption isn't enabled
     if (!encrypted) {
       std::copy(std::begin(plaintext), std::end(plaintext), destination);
       return plaintext.size();
     }
 
-    return cbc.encrypt(std::string_view {(char *) std::begin(plaintext), plaintext.size()}, destination, &iv);
+    return cbc.encrypt(std::string_view {(const char *) plaintext.data(), plaintext.size()}, destination, &iv);
+  }
+
+  static void log_packet_pool(const std::string_view &stream_name) {
+    auto stats = buffer_pool::packets().stats();
+    auto faults = platf::page_faults();
+    BOOST_LOG(debug) << "Packet buffer pool after "sv << stream_name << " broadcast: "sv
+                     << stats.allocations << " heap allocations, "sv << stats.arena_allocations << " arena allocations, "sv
+                     << stats.reuses << " reuses, "sv << stats.cached << " buffers ("sv << stats.cached_bytes / 1024 << " KiB) cached, "sv
+                     << stats.arena_used_bytes / 1024 << '/' << stats.arena_bytes / 1024 << " KiB of the arena used, "sv
+                     << faults.minor << " minor and "sv << faults.major << " major page faults"sv;
   }
 
   static inline void while_starting_do_nothing(std::atomic<session::state_e> &state) {
@@ -263,12 +412,82 @@ namespace stream {
     }
   }
 
+  /**
+   * @brief Wakes the control stream thread while it waits for the socket, when there are messages to send.
+   */
+  struct control_wakeup_t {
+    std::unique_ptr<platf::socket_waiter_t> waiter;
+
+    // When the oldest pending wakeup was asked for, in steady_clock ticks, or 0 if none is pending
+    std::atomic<std::chrono::steady_clock::rep> requested {0};
+
+    void wake() {
+      std::chrono::steady_clock::rep none = 0;
+      requested.compare_exchange_strong(none, std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+      waiter->wake();
+    }
+  };
+
   class control_server_t {
   public:
+    // Handle at most this many events in a row, so a flood can't hold up the messages to send
+    static constexpr int MAX_EVENTS_PER_ITERATION = 64;
+
     int bind(net::af_e address_family, std::uint16_t port) {
       _host = net::host_create(address_family, _addr, port);
+      if (!_host) {
+        return -1;
+      }
 
-      return !(bool) _host;
+      if (auto waiter = platf::make_socket_waiter((std::uintptr_t) _host->socket)) {
+        _wakeup = std::make_shared<control_wakeup_t>();
+        _wakeup->waiter = std::move(waiter);
+      } else {
+        BOOST_LOG(warning) << "Control stream can't wait for its socket, falling back to polling"sv;
+      }
+
+      return 0;
+    }
+
+    /**
+     * @brief Wake `iterate()` early, so messages queued from other threads go out right away.
+     */
+    void wake() {
+      if (_wakeup) {
+        _wakeup->wake();
+      }
+    }
+
+    /**
+     * @brief Get a function that wakes `iterate()`, which is safe to call even after the server is gone.
+     */
+    std::function<void()> waker() {
+      if (!_wakeup) {
+        return nullptr;
+      }
+
+      return [wakeup = std::weak_ptr {_wakeup}]() {
+        if (auto ptr = wakeup.lock()) {
+          ptr->wake();
+        }
+      };
+    }
+
+    /**
+     * @brief Take the time the oldest pending wakeup was asked for.
+     * @return The time, or `std::nullopt` if no wakeup is pending.
+     */
+    std::optional<std::chrono::steady_clock::time_point> take_wakeup() {
+      if (!_wakeup) {
+        return std::nullopt;
+      }
+
+      auto requested = _wakeup->requested.exchange(0, std::memory_order_relaxed);
+      if (!requested) {
+        return std::nullopt;
+      }
+
+      return std::chrono::steady_clock::time_point {std::chrono::steady_clock::duration {requested}};
     }
 
     // Get session associated with address.
@@ -281,6 +500,7 @@ namespace stream {
     //   session refers to broadcast_ctx_t
     //   broadcast_ctx_t refers to control_server_t
     // Therefore, iterate is implemented further down the source file
+    // Waits for the socket, a wakeup or the timeout and then handles every event that is ready
     void iterate(std::chrono::milliseconds timeout);
 
     /**
@@ -296,8 +516,32 @@ namespace stream {
       _map_type_cb.emplace(type, std::move(cb));
     }
 
-    int send(const std::string_view &payload, net::peer_t peer) {
-      auto packet = enet_packet_create(payload.data(), payload.size(), ENET_PACKET_FLAG_RELIABLE);
+    /**
+     * @brief Make a reliable packet whose data is a buffer of the packet pool.
+     * @details The buffer goes back to the pool when ENet destroys the packet, once the client acknowledged it.
+     * @param size The size of the packet.
+     * @return The packet, or `nullptr` on error.
+     */
+    static ENetPacket *make_packet(std::size_t size) {
+      int size_class;
+      auto data = buffer_pool::packets().acquire(size, size_class);
+
+      auto packet = enet_packet_create(data, size, ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_NO_ALLOCATE);
+      if (!packet) {
+        buffer_pool::packets().release(data, size_class);
+
+        return nullptr;
+      }
+
+      packet->userData = (void *) (std::intptr_t) size_class;
+      packet->freeCallback = [](ENetPacket *packet) {
+        buffer_pool::packets().release(packet->data, (int) (std::intptr_t) packet->userData);
+      };
+
+      return packet;
+    }
+
+    int send(ENetPacket *packet, net::peer_t peer) {
       if (enet_peer_send(peer, 0, packet)) {
         enet_packet_destroy(packet);
 
@@ -314,21 +558,55 @@ namespace stream {
     // Callbacks
     std::unordered_map<std::uint16_t, std::function<void(session_t *, const std::string_view &)>> _map_type_cb;
 
-    // All active sessions (including those still waiting for a peer to connect)
-    sync_util::sync_t<std::vector<session_t *>> _sessions;
+    /**
+     * @brief Remove sessions from the session table.
+     * @param stopped The sessions to remove.
+     */
+    void remove_sessions(const std::vector<session_t *> &stopped) {
+      _sessions.update([&](session_table_t &table) {
+        std::erase_if(table.sessions, [&](const session_table_t::entry_t &entry) {
+          return std::find(std::begin(stopped), std::end(stopped), entry.session) != std::end(stopped);
+        });
+        table.index();
+      });
+    }
+
+    // Sessions are added by the threads starting them, everything else is done by the control stream thread
+    sync_util::snapshot_t<session_table_t> _sessions;
 
-    // ENet peer to session mapping for sessions with a peer connected
-    sync_util::sync_t<std::map<net::peer_t, session_t *>> _peer_to_session;
+    // When the message being handled was received, for the latency of the input it carries
+    std::chrono::steady_clock::time_point received;
 
     ENetAddress _addr;
     net::host_t _host;
+
+  private:
+    void handle(ENetEvent &event, std::chrono::steady_clock::time_point ready);
+
+    // Null if the socket can't be waited on, in which case ENet polls it
+    std::shared_ptr<control_wakeup_t> _wakeup;
+
+    logging::percentile_periodic_logger<double> _message_latency_logger {debug, "Control: message latency", "ms", 20s, &metrics::control.message_latency_recent_seconds};
+  };
+
+  /**
+   * @brief A video broadcast thread and the packets of the sessions it sends.
+   * @details Each thread paces its own sessions, so a large frame sent to one of them doesn't hold up the others.
+   */
+  struct video_shard_t {
+    safe::mail_raw_t::queue_t<video::packet_t> packets;
+    std::thread thread;
+
+    // Changed by the threads starting and joining sessions
+    std::atomic<int> sessions {0};
   };
 
   struct broadcast_ctx_t {
     message_queue_queue_t message_queue_queue;
+    delay_queue_t delay_queue;
 
     std::thread recv_thread;
-    std::thread video_thread;
+    std::vector<std::unique_ptr<video_shard_t>> video_shards;
     std::thread audio_thread;
     std::thread control_thread;
 
@@ -340,6 +618,14 @@ namespace stream {
     control_server_t control_server;
   };
 
+  /**
+   * @brief A recorded message a replay fed to a session, waiting for the control stream thread.
+   */
+  struct replayed_message_t {
+    std::optional<std::uint16_t> type;  ///< `std::nullopt` for input
+    std::string payload;
+  };
+
   struct session_t {
     config_t config;
 
@@ -367,8 +653,44 @@ namespace stream {
 
       safe::mail_raw_t::event_t<bool> idr_events;
       safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+      safe::mail_raw_t::event_t<int64_t> acknowledged_frame_events;
+
+      // Fed requests by the control stream thread, and the frames answering them by the video broadcast thread
+      recovery::controller_t recovery;
+
+      // The frame whose parts the video broadcast thread drops, since it waited too long to be sent
+      std::int64_t stale_frame = -1;
+
+      // Added to by the video broadcast thread, looked up by the control stream thread
+      pacing::dropped_frames_t dropped_frames;
+
+      // Written from the control stream thread, read by the video broadcast thread
+      std::unique_ptr<pacing::link_estimate_t> link_estimate;
+
+      // Fed by the control stream and receiving threads
+      std::shared_ptr<delay::estimate_t> delay;
+
+      // Fed by the control stream and video broadcast threads, stepped by the control stream thread
+      std::unique_ptr<bitrate_control::controller_t> bitrate_control;
+      std::unique_ptr<video_fec::protection_t> fec_protection;
+      safe::mail_raw_t::event_t<int> bitrate_events;
+
+      // The last frame size limit the control stream thread asked the encoder for, in bits
+      std::uint64_t max_frame_size = 0;
+      safe::mail_raw_t::event_t<int64_t> max_frame_size_events;
+      safe::mail_raw_t::event_t<video_quality::sample_t> quality_events;
+
+      // Filled by the video broadcast thread, read by the control stream thread. Null unless video_retransmission is on
+      std::unique_ptr<retransmit::history_t> history;
+
+      // Send times are recorded by the video broadcast thread, the other stages by the encoder
+      std::unique_ptr<frame_scheduler::scheduler_t> scheduler;
+
+      std::shared_ptr<metrics::session_t> metrics;
 
       std::unique_ptr<platf::deinit_t> qos;
+      // The video broadcast thread sending this session, owned by the broadcast
+      video_shard_t *shard = nullptr;
     } video;
 
     struct {
@@ -381,10 +703,14 @@ namespace stream {
       std::uint32_t timestamp;
       udp::endpoint peer;
 
-      util::buffer_t<char> shards;
+      buffer_pool::buffer_t<char> shards;
       util::buffer_t<uint8_t *> shards_p;
 
       audio_fec_packet_t fec_packet;
+
+      // Written from the control stream thread, read by the thread sending audio
+      std::unique_ptr<audio_fec::protection_t> fec_protection;
+
       std::unique_ptr<platf::deinit_t> qos;
     } audio;
 
@@ -401,11 +727,39 @@ namespace stream {
       std::uint32_t seq;
 
       platf::feedback_queue_t feedback_queue;
+      feedback::coalescer_t feedback;  ///< Only used by the control stream thread
       safe::mail_raw_t::event_t<video::hdr_info_t> hdr_queue;
+
+      // Messages queued during an iteration of the control stream thread, sent together at its end.
+      // The vectors keep their capacity, so queueing doesn't allocate once the session is warmed up.
+      struct {
+        std::string plaintexts;  // The messages back to back
+        std::vector<std::size_t> sizes;
+        std::vector<std::array<std::uint8_t, 12>> ivs;
+        std::vector<crypto::cipher::gcm_message_t> batch;
+        std::vector<ENetPacket *> packets;
+      } outbox;
+
+      // Only used when the session is recorded
+      std::optional<std::chrono::milliseconds> recorded_rtt;
+
+      // Fed by a replay in place of a client, handled by the control stream thread
+      struct {
+        std::mutex lock;
+        std::vector<replayed_message_t> messages;
+        std::optional<std::chrono::milliseconds> rtt;
+      } replay;
     } control;
 
+    // Written from the control stream and video broadcast threads. Null unless session_recording is on
+    std::unique_ptr<session_recording::writer_t> recording;
+
     std::uint32_t launch_session_id;
 
+    // The paired client, whose next session starts from the statistics of this one. Empty if it isn't known
+    std::string client_uuid;
+    std::chrono::steady_clock::time_point started;
+
     safe::mail_raw_t::event_t<bool> shutdown_event;
     safe::signal_t controlEnd;
 
@@ -413,60 +767,136 @@ namespace stream {
   };
 
   /**
-   * First part of cipher must be struct of type control_encrypted_t
-   *
-   * returns empty string_view on failure
-   * returns string_view pointing to payload data
+   * @brief Queue a control stream message, to be sent by `send_control()` at the end of the iteration of the control stream thread.
+   * @param session The session to send the message to.
+   * @param plaintext The message, starting with its `control_header_v2`.
    */
-  template<std::size_t max_payload_size>
-  static inline std::string_view encode_control(session_t *session, const std::string_view &plaintext, std::array<std::uint8_t, max_payload_size> &tagged_cipher) {
-    static_assert(
-      max_payload_size >= sizeof(control_encrypted_t) + sizeof(crypto::cipher::tag_size),
-      "max_payload_size >= sizeof(control_encrypted_t) + sizeof(crypto::cipher::tag_size)"
-    );
-
-    if (session->config.controlProtocolType != 13) {
-      return plaintext;
-    }
-
-    auto seq = session->control.seq++;
-
-    auto &iv = session->control.outgoing_iv;
-    if (session->config.encryptionFlagsEnabled & SS_ENC_CONTROL_V2) {
-      // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-      // Section 8.2.1. The sequence number is our "invocation" field and the 'CH' in the
-      // high bytes is the "fixed" field. Because each client provides their own unique
-      // key, our values in the fixed field need only uniquely identify each independent
-      // use of the client's key with AES-GCM in our code.
-      //
-      // The sequence number is 32 bits long which allows for 2^32 control stream messages
-      // to be sent to each client before the IV repeats.
-      iv.resize(12);
-      std::copy_n((uint8_t *) &seq, sizeof(seq), std::begin(iv));
-      iv[10] = 'H';  // Host originated
-      iv[11] = 'C';  // Control stream
-    } else {
+  static inline void queue_control(session_t *session, const std::string_view &plaintext) {
+    auto &outbox = session->control.outbox;
+
+    outbox.plaintexts.append(plaintext);
+    outbox.sizes.push_back(plaintext.size());
+  }
+
+  /**
+   * @brief Encrypt the control stream messages queued for a session, and hand them to ENet.
+   * @details Each message keeps a packet of its own, since clients expect one message per packet,
+   *          but ENet bundles the packets of a peer into as few datagrams as it can on the next flush.
+   *          The messages of the V2 encryption are encrypted in a single batch with the cipher context of the session.
+   * @param server The control stream server.
+   * @param session The session.
+   * @return The number of messages handed to ENet.
+   */
+  int send_control(control_server_t &server, session_t *session) {
+    auto &outbox = session->control.outbox;
+    if (outbox.sizes.empty()) {
+      return 0;
+    }
+
+    auto clear = util::fail_guard([&]() {
+      outbox.plaintexts.clear();
+      outbox.sizes.clear();
+      outbox.ivs.clear();
+      outbox.batch.clear();
+      outbox.packets.clear();
+    });
+
+    bool encrypted = session->config.controlProtocolType == 13;
+    bool batched = encrypted && (session->config.encryptionFlagsEnabled & SS_ENC_CONTROL_V2);
+
+    // The batch points into the IVs, so they may not move while it's filled
+    outbox.ivs.resize(outbox.sizes.size());
+
+    std::string_view plaintexts = outbox.plaintexts;
+    for (std::size_t x = 0; x < outbox.sizes.size(); ++x) {
+      auto plaintext = plaintexts.substr(0, outbox.sizes[x]);
+      plaintexts.remove_prefix(plaintext.size());
+
+      auto size = encrypted ? sizeof(control_encrypted_t) + crypto::cipher::tag_size + plaintext.size() : plaintext.size();
+      auto packet = control_server_t::make_packet(size);
+      if (!packet) {
+        BOOST_LOG(error) << "Couldn't allocate control stream packet"sv;
+        break;
+      }
+      outbox.packets.push_back(packet);
+
+      if (!encrypted) {
+        std::copy_n(plaintext.data(), plaintext.size(), packet->data);
+        continue;
+      }
+
+      auto seq = session->control.seq++;
+
+      auto header = (control_encrypted_p) packet->data;
+      header->encryptedHeaderType = util::endian::little(0x0001);
+      header->length = util::endian::little<std::uint16_t>(size - sizeof(control_encrypted_t) + sizeof(control_encrypted_t::seq));
+      header->seq = util::endian::little(seq);
+
+      if (batched) {
+        // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+        // Section 8.2.1. The sequence number is our "invocation" field and the 'CH' in the
+        // high bytes is the "fixed" field. Because each client provides their own unique
+        // key, our values in the fixed field need only uniquely identify each independent
+        // use of the client's key with AES-GCM in our code.
+        //
+        // The sequence number is 32 bits long which allows for 2^32 control stream messages
+        // to be sent to each client before the IV repeats.
+        auto &iv = outbox.ivs[x];
+        iv.fill(0);
+        std::copy_n((uint8_t *) &seq, sizeof(seq), std::begin(iv));
+        iv[10] = 'H';  // Host originated
+        iv[11] = 'C';  // Control stream
+
+        // The tag comes first, the message header and payload follow it
+        auto tag = header->payload();
+        outbox.batch.push_back(crypto::cipher::gcm_message_t {
+          iv.data(),
+          plaintext.substr(0, sizeof(control_header_v2)),
+          tag + crypto::cipher::tag_size,
+          plaintext.substr(sizeof(control_header_v2)),
+          tag + crypto::cipher::tag_size + sizeof(control_header_v2),
+          tag,
+        });
+        continue;
+      }
+
       // Nvidia's old style encryption uses a 16-byte IV
+      auto &iv = session->control.outgoing_iv;
       iv.resize(16);
-
       iv[0] = (std::uint8_t) seq;
-    }
 
-    auto packet = (control_encrypted_p) tagged_cipher.data();
+      if (session->control.cipher.encrypt(plaintext, header->payload(), &iv) <= 0) {
+        BOOST_LOG(error) << "Couldn't encrypt control data"sv;
+        outbox.packets.pop_back();
+        enet_packet_destroy(packet);
+        break;
+      }
+    }
 
-    auto bytes = session->control.cipher.encrypt(plaintext, packet->payload(), &iv);
-    if (bytes <= 0) {
+    if (!outbox.batch.empty() && session->control.cipher.encrypt(outbox.batch)) {
       BOOST_LOG(error) << "Couldn't encrypt control data"sv;
-      return {};
+      for (auto packet : outbox.packets) {
+        enet_packet_destroy(packet);
+      }
+
+      return 0;
     }
 
-    std::uint16_t packet_length = bytes + crypto::cipher::tag_size + sizeof(control_encrypted_t::seq);
+    int sent = 0;
+    for (auto packet : outbox.packets) {
+      auto size = packet->dataLength;
+      if (server.send(packet, session->control.peer)) {
+        TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
+        BOOST_LOG(warning) << "Couldn't send control data to ["sv << addr << ':' << port << ']';
+        continue;
+      }
 
-    packet->encryptedHeaderType = util::endian::little(0x0001);
-    packet->length = util::endian::little(packet_length);
-    packet->seq = util::endian::little(seq);
+      session->video.metrics->control_bytes.add(size);
+      session->video.metrics->control_packets.add();
+      ++sent;
+    }
 
-    return std::string_view {(char *) tagged_cipher.data(), packet_length + sizeof(control_encrypted_t) - sizeof(control_encrypted_t::seq)};
+    return sent;
   }
 
   int start_broadcast(broadcast_ctx_t &ctx);
@@ -474,43 +904,80 @@ namespace stream {
 
   static auto broadcast = safe::make_shared<broadcast_ctx_t>(start_broadcast, end_broadcast);
 
-  session_t *control_server_t::get_session(const net::peer_t peer, uint32_t connect_data) {
+  /**
+   * @brief The broadcast of the last session that ended, kept running for a client that reconnects.
+   */
+  struct parked_broadcast_t {
+    std::mutex lock;
+    decltype(broadcast)::ptr_t ref;
+    int generation = 0;
+  };
+
+  // Long enough for a client that lost its connection to reconnect
+  constexpr auto PARKED_BROADCAST_LIFETIME = 5s;
+
+  static parked_broadcast_t parked_broadcast;
+
+  /**
+   * @brief Stop the parked broadcast, unless a newer session parked it since.
+   * @param generation The parking the broadcast was kept by.
+   */
+  static void unpark_broadcast(int generation) {
+    decltype(broadcast)::ptr_t stale;
+
+    std::lock_guard lg {parked_broadcast.lock};
+    if (parked_broadcast.generation == generation) {
+      stale = std::move(parked_broadcast.ref);
+    }
+  }
+
+  /**
+   * @brief Keep the broadcast of the last session running for a while after it ends.
+   * @details Stopping the broadcast closes its sockets and joins its threads, and a reconnecting
+   *          client would have to wait for them to be set up again.
+   */
+  static void park_broadcast(const decltype(broadcast)::ptr_t &ref) {
+    int generation;
     {
-      // Fast path - look up existing session by peer
-      auto lg = _peer_to_session.lock();
-      auto it = _peer_to_session->find(peer);
-      if (it != _peer_to_session->end()) {
-        return it->second;
-      }
+      std::lock_guard lg {parked_broadcast.lock};
+      parked_broadcast.ref = decltype(broadcast)::ptr_t {ref};
+      generation = ++parked_broadcast.generation;
+    }
+
+    task_pool.pushDelayed(unpark_broadcast, PARKED_BROADCAST_LIFETIME, generation);
+  }
+
+  void release_parked_broadcast() {
+    decltype(broadcast)::ptr_t stale;
+
+    std::lock_guard lg {parked_broadcast.lock};
+    stale = std::move(parked_broadcast.ref);
+    ++parked_broadcast.generation;
+  }
+
+  session_t *control_server_t::get_session(const net::peer_t peer, uint32_t connect_data) {
+    auto table = _sessions.load();
+
+    // Fast path - look up existing session by peer
+    if (auto it = table->by_peer.find(peer); it != table->by_peer.end()) {
+      return it->second;
     }
 
     // Slow path - process new session
     TUPLE_2D(peer_port, peer_addr, platf::from_sockaddr_ex((sockaddr *) &peer->address.address));
-    auto lg = _sessions.lock();
-    for (auto pos = std::begin(*_sessions); pos != std::end(*_sessions); ++pos) {
-      auto session_p = *pos;
-
-      // Skip sessions that are already established
-      if (session_p->control.peer) {
-        continue;
-      }
 
-      // Identify the connection by the unique connect data if the client supports it.
-      // Only fall back to IP address matching for clients without session ID support.
-      if (session_p->config.mlFeatureFlags & ML_FF_SESSION_ID_V1) {
-        if (session_p->control.connect_data != connect_data) {
-          continue;
-        } else {
-          BOOST_LOG(debug) << "Initialized new control stream session by connect data match [v2]"sv;
-        }
-      } else {
-        if (session_p->control.expected_peer_address != peer_addr) {
-          continue;
-        } else {
-          BOOST_LOG(debug) << "Initialized new control stream session by IP address match [v1]"sv;
-        }
-      }
+    // Identify the connection by the unique connect data if the client supports it.
+    // Only fall back to IP address matching for clients without session ID support.
+    session_t *session_p = nullptr;
+    if (auto it = table->by_connect_data.find(connect_data); it != table->by_connect_data.end()) {
+      session_p = it->second;
+      BOOST_LOG(debug) << "Initialized new control stream session by connect data match [v2]"sv;
+    } else if (auto address_it = table->by_address.find(peer_addr); address_it != table->by_address.end()) {
+      session_p = address_it->second;
+      BOOST_LOG(debug) << "Initialized new control stream session by IP address match [v1]"sv;
+    }
 
+    if (session_p) {
       // Once the control stream connection is established, RTSP session state can be torn down
       rtsp_stream::launch_session_clear(session_p->launch_session_id);
 
@@ -528,15 +995,23 @@ namespace stream {
       }
 
       BOOST_LOG(debug) << "Control local address ["sv << local_address << ']';
+
+      // The threads sending to the client move to the node of the network interface
+      thread_affinity::set_node(thread_affinity::device_e::nic, platf::interface_numa_node(net::addr_to_normalized_string(session_p->localAddress)));
       BOOST_LOG(debug) << "Control peer address ["sv << peer_addr << ':' << peer_port << ']';
 
-      // Insert this into the map for O(1) lookups in the future
-      auto ptslg = _peer_to_session.lock();
-      _peer_to_session->emplace(peer, session_p);
-      return session_p;
+      // Index it by peer for O(1) lookups in the future
+      _sessions.update([&](session_table_t &table) {
+        for (auto &entry : table.sessions) {
+          if (entry.session == session_p) {
+            entry.peer = peer;
+          }
+        }
+        table.index();
+      });
     }
 
-    return nullptr;
+    return session_p;
   }
 
   /**
@@ -553,6 +1028,11 @@ namespace stream {
       return;
     }
 
+    // Encrypted messages are recorded once decrypted, and input is recorded as plaintext by its handler
+    if (session->recording && type != packetTypes[IDX_ENCRYPTED] && type != packetTypes[IDX_INPUT_DATA]) {
+      session->recording->write_control(type, payload);
+    }
+
     auto cb = _map_type_cb.find(type);
     if (cb == std::end(_map_type_cb)) {
       BOOST_LOG(debug)
@@ -563,220 +1043,842 @@ namespace stream {
     } else {
       cb->second(session, payload);
     }
-  }
+  }
+
+  void control_server_t::iterate(std::chrono::milliseconds timeout) {
+    ENetEvent event;
+
+    if (!_wakeup) {
+      if (enet_host_service(_host.get(), &event, timeout.count()) > 0) {
+        handle(event, std::chrono::steady_clock::now());
+      }
+
+      return;
+    }
+
+    _wakeup->waiter->wait(timeout);
+
+    // Servicing with no timeout also sends what's queued and runs ENet's timers
+    auto ready = std::chrono::steady_clock::now();
+    for (int x = 0; x < MAX_EVENTS_PER_ITERATION && enet_host_service(_host.get(), &event, 0) > 0; ++x) {
+      handle(event, ready);
+    }
+  }
+
+  void control_server_t::handle(ENetEvent &event, std::chrono::steady_clock::time_point ready) {
+    auto session = get_session(event.peer, event.data);
+    if (!session) {
+      BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
+      enet_peer_disconnect_now(event.peer, 0);
+
+      return;
+    }
+
+    session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout.load();
+
+    switch (event.type) {
+      case ENET_EVENT_TYPE_RECEIVE:
+        {
+          net::packet_t packet {event.packet};
+
+          auto type = *(std::uint16_t *) packet->data;
+          std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+
+          received = ready;
+          call(type, session, payload, false);
+
+          metrics::control.messages.add();
+          if (_message_latency_logger.is_enabled()) {
+            _message_latency_logger.collect_and_log(std::chrono::duration<double, std::milli> {std::chrono::steady_clock::now() - ready}.count());
+          }
+        }
+        break;
+      case ENET_EVENT_TYPE_CONNECT:
+        BOOST_LOG(info) << "CLIENT CONNECTED"sv;
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
+        // No more clients to send video data to ^_^
+        if (session->state == session::state_e::RUNNING) {
+          session::stop(*session);
+        }
+        break;
+      case ENET_EVENT_TYPE_NONE:
+        break;
+    }
+  }
+
+  namespace fec {
+    void free_rs(reed_solomon *rs) {
+      reed_solomon_release(rs);
+    }
+
+    rs_cache_t::rs_cache_t(std::size_t capacity):
+        _capacity {std::max<std::size_t>(capacity, 1)} {
+      _entries.reserve(_capacity);
+    }
+
+    reed_solomon *rs_cache_t::get(int data_shards, int parity_shards) {
+      auto it = std::find_if(std::begin(_entries), std::end(_entries), [&](const entry_t &entry) {
+        return entry.data_shards == data_shards && entry.parity_shards == parity_shards;
+      });
+
+      if (it != std::end(_entries)) {
+        ++_hits;
+
+        // Move the entry to the front to mark it as most recently used
+        std::rotate(std::begin(_entries), it, it + 1);
+        return _entries.front().rs.get();
+      }
+
+      ++_misses;
+
+      rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+      if (!rs) {
+        return nullptr;
+      }
+
+      // Evict the least recently used entry if we're full
+      if (_entries.size() >= _capacity) {
+        _entries.pop_back();
+      }
+
+      _entries.insert(std::begin(_entries), entry_t {data_shards, parity_shards, std::move(rs)});
+      return _entries.front().rs.get();
+    }
+
+    struct shard_counts_t {
+      size_t data_shards;
+      size_t parity_shards;
+      size_t percentage;
+    };
+
+    /**
+     * @brief Compute the number of data and parity shards for a FEC block.
+     * @param payload_size The size of the FEC block payload.
+     * @param blocksize The size of each shard.
+     * @param fecpercentage The requested FEC percentage.
+     * @param minparityshards The minimum number of parity shards.
+     * @return The shard counts and the effective FEC percentage.
+     */
+    static shard_counts_t shard_counts(size_t payload_size, size_t blocksize, size_t fecpercentage, size_t minparityshards) {
+      auto data_shards = (payload_size + (blocksize - 1)) / blocksize;
+      auto parity_shards = (data_shards * fecpercentage + 99) / 100;
+
+      // increase the FEC percentage for this frame if the parity shard minimum is not met
+      if (parity_shards < minparityshards && fecpercentage != 0) {
+        parity_shards = minparityshards;
+        fecpercentage = (100 * parity_shards) / data_shards;
+      }
+
+      return {data_shards, parity_shards, fecpercentage};
+    }
+
+    /**
+     * @brief Copy part of a payload that may be split across several buffers.
+     * @param payload The payload buffers.
+     * @param offset The offset in the payload to copy from.
+     * @param size The number of bytes to copy.
+     * @param dest The destination buffer.
+     */
+    static void copy_payload(std::span<const std::string_view> payload, size_t offset, size_t size, char *dest) {
+      for (const auto &buffer : payload) {
+        if (size == 0) {
+          break;
+        }
+
+        if (offset >= buffer.size()) {
+          offset -= buffer.size();
+          continue;
+        }
+
+        auto copy_len = std::min(size, buffer.size() - offset);
+        std::memcpy(dest, buffer.data() + offset, copy_len);
+
+        dest += copy_len;
+        size -= copy_len;
+        offset = 0;
+      }
+    }
+
+    fec_t slice(std::span<const std::string_view> payload, size_t offset, size_t size, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t headersize, size_t prefixsize, bool writable) {
+      auto [data_shards, parity_shards, percentage] = shard_counts(size, blocksize, fecpercentage, minparityshards);
+
+      if (percentage != fecpercentage) {
+        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << percentage << " to meet parity shard minimum"sv << std::endl;
+      }
+
+      auto nr_shards = data_shards + parity_shards;
+      buffer_pool::buffer_t<uint8_t *> shards_p {nr_shards};
+      buffer_pool::buffer_t<uint8_t *> sources_p {nr_shards};
+
+      // Point into the payload buffers for all data shards contained in a single buffer
+      size_t copied_shards = 0;
+      auto buffer = std::begin(payload);
+      size_t buffer_offset = 0;
+      for (auto x = 0; x < data_shards; ++x) {
+        auto shard_offset = offset + x * blocksize;
+        while (buffer != std::end(payload) && shard_offset >= buffer_offset + buffer->size()) {
+          buffer_offset += buffer->size();
+          ++buffer;
+        }
+
+        if (buffer != std::end(payload) && shard_offset + blocksize <= buffer_offset + buffer->size()) {
+          shards_p[x] = (uint8_t *) buffer->data() + (shard_offset - buffer_offset);
+        } else {
+          shards_p[x] = nullptr;
+          ++copied_shards;
+        }
+      }
+
+      // Writable data shards are read from the payload, and written to buffers of their own
+      auto owned_shards = writable ? data_shards : copied_shards;
+      for (auto x = 0; x < data_shards; ++x) {
+        sources_p[x] = shards_p[x];
+      }
+
+      // The remaining data shards are copied before the parity shards to keep the shards in order.
+      // The buffer comes from the packet pool and isn't zeroed, so the final data shard is padded by hand.
+      buffer_pool::buffer_t<char> shards {(owned_shards + parity_shards) * blocksize};
+      for (auto x = 0, next = 0; x < data_shards; ++x) {
+        if (sources_p[x]) {
+          if (writable) {
+            shards_p[x] = (uint8_t *) &shards[next++ * blocksize];
+          }
+          continue;
+        }
+
+        auto shard_offset = x * blocksize;
+        auto shard_size = std::min(blocksize, size - shard_offset);
+        shards_p[x] = (uint8_t *) &shards[next++ * blocksize];
+        sources_p[x] = shards_p[x];
+        copy_payload(payload, offset + shard_offset, shard_size, (char *) shards_p[x]);
+        std::fill_n((char *) shards_p[x] + shard_size, blocksize - shard_size, 0);
+      }
+
+      for (auto x = 0; x < parity_shards; ++x) {
+        shards_p[data_shards + x] = (uint8_t *) &shards[(owned_shards + x) * blocksize];
+        sources_p[data_shards + x] = shards_p[data_shards + x];
+      }
+
+      // Describe the shards with as few buffers as possible, there are never more buffers than shards
+      buffer_pool::buffer_t<platf::buffer_descriptor_t> payload_buffers {nr_shards};
+      size_t buffer_count = 0;
+      for (auto x = 0; x < nr_shards; ++x) {
+        auto data = (const char *) shards_p[x];
+        if (buffer_count > 0 && payload_buffers[buffer_count - 1].buffer + payload_buffers[buffer_count - 1].size == data) {
+          payload_buffers[buffer_count - 1].size += blocksize;
+        } else {
+          payload_buffers[buffer_count++] = {data, blocksize};
+        }
+      }
+      payload_buffers.fake_resize(buffer_count);
+
+      buffer_pool::buffer_t<char> headers {nr_shards * (prefixsize + headersize)};
+      std::fill(std::begin(headers), std::end(headers), 0);
+
+      return {
+        data_shards,
+        nr_shards,
+        percentage,
+        blocksize,
+        headersize,
+        prefixsize,
+        std::move(shards),
+        std::move(headers),
+        std::move(shards_p),
+        std::move(sources_p),
+        std::move(payload_buffers),
+      };
+    }
+
+    void encode(fec_t &fec, rs_cache_t &rs_cache) {
+      if (fec.nr_shards == fec.data_shards) {
+        return;
+      }
+
+      // packets = parity_shards + data_shards
+      auto rs = rs_cache.get(fec.data_shards, fec.nr_shards - fec.data_shards);
+
+      // Each byte of a parity shard only depends on the bytes at the same offset in the data shards,
+      // so encoding the packet headers and payloads separately matches encoding contiguous shards.
+      buffer_pool::buffer_t<uint8_t *> headers_p {fec.nr_shards};
+      for (auto x = 0; x < fec.nr_shards; ++x) {
+        headers_p[x] = (uint8_t *) fec.header(x);
+      }
+
+      reed_solomon_encode(rs, headers_p.begin(), fec.nr_shards, fec.headersize);
+      reed_solomon_encode(rs, fec.sources_p.begin(), fec.nr_shards, fec.blocksize);
+    }
+  }  // namespace fec
+
+  namespace pacing {
+    // Back off hard on loss and gently on queueing delay, then probe upwards slowly
+    constexpr double LOSS_DECREASE = 0.7;
+    constexpr double DELAY_DECREASE = 0.85;
+    constexpr double INCREASE = 1.05;
+
+    // One lost frame is often reported several times, so decrease at most once in this interval
+    constexpr auto MIN_DECREASE_INTERVAL = 100ms;
+
+    // The link must stay clean this long before the estimate grows again
+    constexpr auto INCREASE_HOLD = 2s;
+    constexpr auto INCREASE_INTERVAL = 1s;
+
+    link_estimate_t::link_estimate_t(std::uint64_t min_rate, std::chrono::steady_clock::time_point now, std::optional<std::uint64_t> start_rate):
+        _rate {std::clamp(start_rate.value_or(DEFAULT_RATE), std::min(min_rate, MAX_RATE), MAX_RATE)},
+        _min_rate {std::min(min_rate, MAX_RATE)},
+        _min_rtt {std::chrono::milliseconds::max()},
+        _last_loss {now},
+        _last_decrease {now - INCREASE_HOLD},
+        _last_increase {now} {
+    }
+
+    void link_estimate_t::on_loss(std::chrono::steady_clock::time_point now) {
+      _last_loss = now;
+      decrease(LOSS_DECREASE, now);
+    }
+
+    void link_estimate_t::on_rtt(std::chrono::milliseconds rtt, std::chrono::steady_clock::time_point now, std::chrono::microseconds jitter) {
+      _min_rtt = std::min(_min_rtt, rtt);
+
+      if (rtt > _min_rtt * 2 + 10ms + jitter * 4) {
+        decrease(DELAY_DECREASE, now);
+        return;
+      }
+
+      if (now - _last_loss < INCREASE_HOLD || now - _last_decrease < INCREASE_HOLD || now - _last_increase < INCREASE_INTERVAL) {
+        return;
+      }
+
+      auto rate = std::min<std::uint64_t>(_rate.load(std::memory_order_relaxed) * INCREASE, MAX_RATE);
+      _rate.store(rate, std::memory_order_relaxed);
+      _last_increase = now;
+    }
+
+    void link_estimate_t::decrease(double factor, std::chrono::steady_clock::time_point now) {
+      auto interval = _min_rtt == std::chrono::milliseconds::max() ? MIN_DECREASE_INTERVAL : std::max<std::chrono::milliseconds>(MIN_DECREASE_INTERVAL, _min_rtt * 2);
+      if (now - _last_decrease < interval) {
+        return;
+      }
+
+      auto rate = std::max<std::uint64_t>(_rate.load(std::memory_order_relaxed) * factor, _min_rate);
+      _rate.store(rate, std::memory_order_relaxed);
+      _last_decrease = now;
+
+      BOOST_LOG(verbose) << "Link rate estimate lowered to "sv << rate / 1'000'000 << " Mbps"sv;
+    }
+
+    double packets_in_1ms(std::uint64_t link_rate, std::size_t packet_size, std::size_t frame_packets, std::chrono::nanoseconds frame_interval, int frame_percentage) {
+      //                                  bits  ms
+      auto link_packets_in_1ms = (double) link_rate / 8 / 1000 / packet_size;
+      if (frame_percentage <= 0 || frame_interval.count() <= 0) {
+        return link_packets_in_1ms;
+      }
+
+      auto spread_ms = std::chrono::duration<double, std::milli> {frame_interval}.count() * frame_percentage / 100;
+      auto spread_packets_in_1ms = frame_packets / spread_ms;
+
+      // Never pace a frame so slowly that a single packet takes more than 1ms
+      return std::clamp(spread_packets_in_1ms, std::min(1.0, link_packets_in_1ms), link_packets_in_1ms);
+    }
+
+    std::uint64_t max_frame_size(std::uint64_t link_rate, std::chrono::nanoseconds frame_interval, int frame_percentage, int fec_percentage) {
+      if (frame_percentage <= 0 || frame_interval.count() <= 0) {
+        return 0;
+      }
+
+      auto link_bits = (double) link_rate * frame_interval.count() / 1e9 * frame_percentage / 100;
+      return (std::uint64_t) (link_bits * 100 / (100 + std::max(fec_percentage, 0)));
+    }
+
+    std::chrono::steady_clock::time_point send_deadline(std::optional<std::chrono::steady_clock::time_point> frame_timestamp, std::chrono::steady_clock::time_point queued_timestamp, std::chrono::nanoseconds frame_interval, int frame_percentage) {
+      return frame_timestamp.value_or(queued_timestamp) + frame_interval * frame_percentage / 100;
+    }
+
+    void dropped_frames_t::add(std::int64_t frame_index) {
+      std::lock_guard lg {_lock};
+
+      if (_size > 0) {
+        auto &last = _runs[(_next + MAX_RUNS - 1) % MAX_RUNS];
+        if (last.second + 1 == frame_index) {
+          last.second = frame_index;
+          return;
+        }
+      }
+
+      _runs[_next] = {frame_index, frame_index};
+      _next = (_next + 1) % MAX_RUNS;
+      _size = std::min(_size + 1, MAX_RUNS);
+    }
+
+    bool dropped_frames_t::contains(std::int64_t first_frame, std::int64_t last_frame) const {
+      std::lock_guard lg {_lock};
+
+      for (std::size_t x = 0; x < _size; ++x) {
+        auto &[first, last] = _runs[(_next + MAX_RUNS - 1 - x) % MAX_RUNS];
+        if (first_frame >= first && last_frame <= last) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+  }  // namespace pacing
+
+  namespace delay {
+    // Like RFC 3550, so a single late ping barely moves the jitter
+    constexpr double JITTER_GAIN = 1.0 / 16;
+    constexpr double INTERVAL_GAIN = 1.0 / 8;
+
+    void estimate_t::on_rtt(std::chrono::milliseconds rtt) {
+      _min_rtt = std::min(_min_rtt, rtt);
+
+      _rtt.store(std::chrono::microseconds {rtt}.count(), std::memory_order_relaxed);
+      _queueing_delay.store(std::chrono::microseconds {rtt - _min_rtt}.count(), std::memory_order_relaxed);
+    }
+
+    void estimate_t::seed(std::chrono::milliseconds rtt) {
+      std::int64_t expected = 0;
+      _rtt.compare_exchange_strong(expected, std::chrono::microseconds {rtt}.count(), std::memory_order_relaxed);
+    }
+
+    void estimate_t::on_ping(std::uint32_t sequence, std::chrono::steady_clock::time_point received) {
+      // Reordered or duplicate pings say nothing about the pace, and a long gap means the client stalled
+      if (!_last_sequence || sequence <= *_last_sequence || sequence - *_last_sequence > MAX_SEQUENCE_GAP) {
+        _last_sequence = sequence;
+        _last_received = received;
+        return;
+      }
+
+      auto steps = sequence - *_last_sequence;
+      std::chrono::duration<double, std::micro> elapsed = received - _last_received;
+      _last_sequence = sequence;
+      _last_received = received;
+
+      // The client's ping interval isn't negotiated, so it's learned from the pings themselves
+      auto interval = elapsed / steps;
+      if (_interval.count() == 0) {
+        _interval = interval;
+        return;
+      }
+
+      auto deviation = std::abs((elapsed - _interval * steps).count());
+      _interval += (interval - _interval) * INTERVAL_GAIN;
+
+      _jitter_us += (deviation - _jitter_us) * JITTER_GAIN;
+      _jitter.store((std::int64_t) _jitter_us, std::memory_order_relaxed);
+    }
+  }  // namespace delay
+
+  namespace retransmit {
+    history_t::history_t(std::size_t capacity, std::size_t shard_size):
+        _slots(capacity),
+        _buffer(capacity * shard_size),
+        _shard_size {shard_size} {
+    }
+
+    void history_t::store(std::uint32_t sequence, std::string_view headers, std::string_view payload, std::chrono::steady_clock::time_point now) {
+      sequence &= SEQUENCE_MASK;
+      if (_slots.empty() || headers.size() + payload.size() > _shard_size) {
+        return;
+      }
+
+      auto index = sequence % _slots.size();
+      auto data = &_buffer[index * _shard_size];
+
+      std::lock_guard lg {_lock};
+      std::copy(std::begin(headers), std::end(headers), data);
+      std::copy(std::begin(payload), std::end(payload), data + headers.size());
+      _slots[index] = {sequence, now, headers.size() + payload.size()};
+    }
+
+    std::vector<std::string> history_t::find(std::uint32_t first, std::size_t count, std::chrono::steady_clock::time_point now) {
+      std::vector<std::string> shards;
+      if (_slots.empty()) {
+        return shards;
+      }
+
+      // Older shards would already be overwritten
+      count = std::min(count, _slots.size());
+
+      std::lock_guard lg {_lock};
+      for (std::size_t x = 0; x < count; ++x) {
+        auto sequence = (first + x) & SEQUENCE_MASK;
+        auto index = sequence % _slots.size();
+
+        auto &slot = _slots[index];
+        if (slot.sequence != sequence || now - slot.sent > MAX_AGE) {
+          continue;
+        }
+
+        shards.emplace_back(&_buffer[index * _shard_size], slot.size);
+      }
+
+      return shards;
+    }
+  }  // namespace retransmit
+
+  namespace audio_fec {
+    static_assert(protection_t::MAX_PARITY_SHARDS == RTPA_FEC_SHARDS);
+
+    // Each parity shard is dropped only after the link has been clean this long
+    constexpr auto LOWER_HOLD = 10s;
+
+    protection_t::protection_t(int min_parity_shards, std::chrono::steady_clock::time_point now):
+        _parity_shards {MAX_PARITY_SHARDS},
+        _min_parity_shards {std::clamp(min_parity_shards, 0, MAX_PARITY_SHARDS)},
+        _last_change {now} {
+    }
+
+    void protection_t::on_loss(std::chrono::steady_clock::time_point now) {
+      _last_change = now;
+      if (_parity_shards.exchange(MAX_PARITY_SHARDS, std::memory_order_relaxed) != MAX_PARITY_SHARDS) {
+        BOOST_LOG(debug) << "Audio FEC raised to "sv << MAX_PARITY_SHARDS << " parity shards"sv;
+      }
+    }
+
+    void protection_t::update(std::chrono::steady_clock::time_point now) {
+      auto parity_shards = _parity_shards.load(std::memory_order_relaxed);
+      if (parity_shards <= _min_parity_shards || now - _last_change < LOWER_HOLD) {
+        return;
+      }
+
+      _parity_shards.store(--parity_shards, std::memory_order_relaxed);
+      _last_change = now;
+
+      BOOST_LOG(debug) << "Audio FEC lowered to "sv << parity_shards << " parity shards"sv;
+    }
+  }  // namespace audio_fec
+
+  namespace video_fec {
+    static_assert(MAX_BLOCK_SHARDS == DATA_SHARDS_MAX);
+
+    int fit_percentage(int percentage, std::size_t frame_shards, int max_blocks) {
+      // A block holding D data shards and their parity at F percent has D = (255 * 100) / (100 + F)
+      std::size_t max_data_shards = (MAX_BLOCK_SHARDS * 100) / (100 + percentage);
+      if ((frame_shards + (max_data_shards - 1)) / max_data_shards <= (std::size_t) max_blocks) {
+        return percentage;
+      }
+
+      // Solve it for F with the data shards each block has to hold
+      auto block_shards = (frame_shards + (max_blocks - 1)) / max_blocks;
+      if (block_shards > MAX_BLOCK_SHARDS) {
+        return 0;
+      }
+
+      return std::clamp((int) ((MAX_BLOCK_SHARDS * 100) / block_shards) - 100, 0, percentage);
+    }
+
+    protection_t::protection_t(int percentage, int min_percentage, int max_percentage, std::chrono::steady_clock::time_point now):
+        _percentage {std::clamp(percentage, min_percentage, std::max(min_percentage, max_percentage))},
+        _min_percentage {min_percentage},
+        _max_percentage {std::max(min_percentage, max_percentage)},
+        _window_start {now},
+        _hold_start {now} {
+    }
+
+    void protection_t::on_loss(int lost_packets) {
+      _lost_packets += std::max(lost_packets, 0);
+    }
+
+    void protection_t::on_unrecovered(std::chrono::steady_clock::time_point now) {
+      ++_unrecovered_frames;
+
+      auto percentage = _percentage.load(std::memory_order_relaxed);
+      set(std::max(percentage * 3 / 2, percentage + LOWER_STEP));
+      _hold_start = now;
+    }
+
+    void protection_t::on_sent(std::size_t data_shards, std::size_t parity_shards) {
+      _data_shards.fetch_add(data_shards, std::memory_order_relaxed);
+      _parity_shards.fetch_add(parity_shards, std::memory_order_relaxed);
+    }
+
+    void protection_t::update(std::chrono::steady_clock::time_point now) {
+      if (now - _window_start < WINDOW) {
+        return;
+      }
+      _window_start = now;
+
+      auto lost_packets = std::exchange(_lost_packets, 0);
+      auto unrecovered_frames = std::exchange(_unrecovered_frames, 0);
+      auto data_shards = _data_shards.exchange(0, std::memory_order_relaxed);
+      auto parity_shards = _parity_shards.exchange(0, std::memory_order_relaxed);
+
+      auto percentage = _percentage.load(std::memory_order_relaxed);
+      if (data_shards > 0) {
+        BOOST_LOG(verbose) << "Video FEC: "sv << percentage << "% parity, "sv << parity_shards * 100 / data_shards << "% overhead, "sv
+                           << lost_packets << " packets lost, "sv << unrecovered_frames << " frames unrecovered"sv;
+      }
+
+      auto sent = data_shards + parity_shards;
+      auto target = sent > 0 ? (int) std::ceil(lost_packets * 100 * LOSS_HEADROOM / sent) : 0;
+      if (target >= percentage) {
+        set(target);
+        _hold_start = now;
+      } else if (now - _hold_start >= LOWER_HOLD) {
+        set(std::max(target, percentage - LOWER_STEP));
+        _hold_start = now;
+      }
+    }
+
+    int protection_t::frame_percentage(bool idr, std::size_t frame_shards) {
+      auto percentage = _percentage.load(std::memory_order_relaxed);
+      if (_min_percentage == _max_percentage) {
+        return percentage;
+      }
+
+      // The first frame is an IDR frame, so the average starts with the first regular frame
+      if (idr) {
+        return percentage * 2;
+      }
+
+      auto large = _average_frame_shards > 0 && frame_shards > _average_frame_shards * LARGE_FRAME_FACTOR;
+      _average_frame_shards = _average_frame_shards > 0 ? _average_frame_shards + (frame_shards - _average_frame_shards) / 16 : frame_shards;
+
+      return large ? percentage * 3 / 2 : percentage;
+    }
+
+    void protection_t::set(int percentage) {
+      percentage = std::clamp(percentage, _min_percentage, _max_percentage);
+
+      auto previous = _percentage.exchange(percentage, std::memory_order_relaxed);
+      if (previous != percentage) {
+        BOOST_LOG(debug) << "Video FEC "sv << (percentage > previous ? "raised"sv : "lowered"sv) << " to "sv << percentage << '%';
+      }
+    }
+  }  // namespace video_fec
+
+  namespace bitrate_control {
+    controller_t::controller_t(int min_bitrate, int max_bitrate, std::chrono::steady_clock::time_point now, std::optional<int> start_bitrate):
+        _bitrate {std::clamp(start_bitrate.value_or(max_bitrate), std::clamp(min_bitrate, 1, max_bitrate), max_bitrate)},
+        _min_bitrate {std::clamp(min_bitrate, 1, max_bitrate)},
+        _max_bitrate {max_bitrate},
+        _last_step {now},
+        _last_congestion {now} {
+    }
+
+    void controller_t::on_loss() {
+      ++_losses;
+    }
+
+    void controller_t::on_invalidate() {
+      ++_invalidations;
+    }
+
+    void controller_t::on_backlog() {
+      _late_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void controller_t::on_delay(std::chrono::microseconds queueing_delay, std::chrono::microseconds jitter) {
+      if (queueing_delay > MAX_QUEUEING_DELAY + jitter * 4) {
+        _delayed = true;
+      }
+    }
+
+    std::optional<int> controller_t::update(std::chrono::steady_clock::time_point now) {
+      if (now - _last_step < STEP_INTERVAL) {
+        return std::nullopt;
+      }
+      _last_step = now;
+
+      auto events = std::exchange(_losses, 0) + std::exchange(_invalidations, 0) * 2;
+      if (_late_frames.exchange(0, std::memory_order_relaxed) >= BACKLOG_FRAMES) {
+        ++events;
+      }
+      if (std::exchange(_delayed, false)) {
+        ++events;
+      }
+
+      auto bitrate = _bitrate.load(std::memory_order_relaxed);
+      auto next = bitrate;
+      if (events > 0) {
+        _last_congestion = now;
+
+        auto decrease = std::min(MAX_DECREASE, DECREASE_PER_EVENT * events);
+        next = std::max(_min_bitrate, (int) (bitrate * (1.0 - decrease)));
+      } else if (now - _last_congestion >= RAISE_HOLD) {
+        next = std::min(_max_bitrate, bitrate + std::max(1, (int) (_max_bitrate * INCREASE)));
+      }
+
+      if (next == bitrate) {
+        return std::nullopt;
+      }
+
+      _bitrate.store(next, std::memory_order_relaxed);
+      BOOST_LOG(debug) << "Video bitrate "sv << (next < bitrate ? "lowered"sv : "raised"sv) << " to "sv << next << " kbps"sv;
+
+      return next;
+    }
+  }  // namespace bitrate_control
+
+  namespace feedback {
+    namespace {
+      bool same_state(const platf::gamepad_feedback_msg_t &a, const platf::gamepad_feedback_msg_t &b) {
+        switch (a.type) {
+          case platf::gamepad_feedback_e::rumble:
+            return a.data.rumble.lowfreq == b.data.rumble.lowfreq && a.data.rumble.highfreq == b.data.rumble.highfreq;
+          case platf::gamepad_feedback_e::rumble_triggers:
+            return a.data.rumble_triggers.left_trigger == b.data.rumble_triggers.left_trigger && a.data.rumble_triggers.right_trigger == b.data.rumble_triggers.right_trigger;
+          case platf::gamepad_feedback_e::set_motion_event_state:
+            return a.data.motion_event_state.motion_type == b.data.motion_event_state.motion_type && a.data.motion_event_state.report_rate == b.data.motion_event_state.report_rate;
+          case platf::gamepad_feedback_e::set_rgb_led:
+            return a.data.rgb_led.r == b.data.rgb_led.r && a.data.rgb_led.g == b.data.rgb_led.g && a.data.rgb_led.b == b.data.rgb_led.b;
+          case platf::gamepad_feedback_e::set_adaptive_triggers: {
+            auto &x = a.data.adaptive_triggers;
+            auto &y = b.data.adaptive_triggers;
+            return x.event_flags == y.event_flags && x.type_left == y.type_left && x.type_right == y.type_right && x.left == y.left && x.right == y.right;
+          }
+        }
 
-  void control_server_t::iterate(std::chrono::milliseconds timeout) {
-    ENetEvent event;
-    auto res = enet_host_service(_host.get(), &event, timeout.count());
+        return false;
+      }
+    }  // namespace
 
-    if (res > 0) {
-      auto session = get_session(event.peer, event.data);
-      if (!session) {
-        BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
-        enet_peer_disconnect_now(event.peer, 0);
+    void coalescer_t::push(const platf::gamepad_feedback_msg_t &msg) {
+      auto &entry = _entries[{msg.id, msg.type}];
 
+      // The latest state wins, even if it goes back to the one sent last
+      if (entry.waiting) {
+        ++_coalesced;
+        entry.waiting.reset();
+      }
+
+      if (entry.sent && same_state(*entry.sent, msg)) {
+        ++_duplicates;
         return;
       }
 
-      session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      entry.waiting = msg;
+    }
 
-      switch (event.type) {
-        case ENET_EVENT_TYPE_RECEIVE:
-          {
-            net::packet_t packet {event.packet};
+    std::vector<platf::gamepad_feedback_msg_t> coalescer_t::pop(std::chrono::steady_clock::time_point now) {
+      std::vector<platf::gamepad_feedback_msg_t> due;
+      for (auto &[_, entry] : _entries) {
+        if (!entry.waiting || (entry.sent && now - entry.sent_at < MIN_INTERVAL)) {
+          continue;
+        }
 
-            auto type = *(std::uint16_t *) packet->data;
-            std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+        due.emplace_back(*entry.waiting);
+        entry.sent = std::exchange(entry.waiting, std::nullopt);
+        entry.sent_at = now;
+      }
 
-            call(type, session, payload, false);
-          }
-          break;
-        case ENET_EVENT_TYPE_CONNECT:
-          BOOST_LOG(info) << "CLIENT CONNECTED"sv;
-          break;
-        case ENET_EVENT_TYPE_DISCONNECT:
-          BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
-          // No more clients to send video data to ^_^
-          if (session->state == session::state_e::RUNNING) {
-            session::stop(*session);
-          }
-          break;
-        case ENET_EVENT_TYPE_NONE:
-          break;
+      return due;
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> coalescer_t::next_due() const {
+      std::optional<std::chrono::steady_clock::time_point> next;
+      for (auto &[_, entry] : _entries) {
+        if (!entry.waiting) {
+          continue;
+        }
+
+        auto due = entry.sent ? entry.sent_at + MIN_INTERVAL : std::chrono::steady_clock::time_point {};
+        if (!next || due < *next) {
+          next = due;
+        }
       }
+
+      return next;
     }
-  }
 
-  namespace fec {
-    using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
-      reed_solomon_release(rs);
-    }>;
+    std::uint64_t coalescer_t::duplicates() const {
+      return _duplicates;
+    }
 
-    struct fec_t {
-      size_t data_shards;
-      size_t nr_shards;
-      size_t percentage;
+    std::uint64_t coalescer_t::coalesced() const {
+      return _coalesced;
+    }
+  }  // namespace feedback
 
-      size_t blocksize;
-      size_t prefixsize;
-      util::buffer_t<char> shards;
-      util::buffer_t<char> headers;
-      util::buffer_t<uint8_t *> shards_p;
+  namespace recovery {
+    bool controller_t::waiting(std::chrono::steady_clock::time_point now) const {
+      return _request && !_request->answer && now - _request->at < MAX_WAIT;
+    }
 
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
+    bool controller_t::on_idr_request(std::chrono::steady_clock::time_point now, std::chrono::microseconds round_trip) {
+      std::lock_guard lg {_lock};
 
-      char *data(size_t el) {
-        return (char *) shards_p[el];
+      // The client asked before it could see the IDR frame that is on its way or was just sent
+      if (_request && _request->idr && (waiting(now) || (_request->answer && now - _request->at < round_trip))) {
+        return false;
       }
 
-      char *prefix(size_t el) {
-        return prefixsize ? &headers[el * prefixsize] : nullptr;
+      _request = request_t {true, 0, std::nullopt, now};
+      return true;
+    }
+
+    bool controller_t::on_invalidate(std::int64_t first_frame, std::int64_t last_frame, bool invalidates, std::chrono::steady_clock::time_point now) {
+      std::lock_guard lg {_lock};
+
+      // The frames after an IDR frame don't refer to the lost ones
+      if (last_frame < _last_idr_frame) {
+        return false;
       }
 
-      size_t size() const {
-        return nr_shards;
+      // Neither do the frames after an invalidation of the same frames or of earlier ones
+      if (_request && (_request->idr || first_frame >= _request->first_frame) &&
+          (waiting(now) || (_request->answer && last_frame < *_request->answer))) {
+        return false;
       }
-    };
 
-    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
-      auto payload_size = payload.size();
+      _request = request_t {!invalidates, first_frame, std::nullopt, now};
+      return true;
+    }
 
-      auto pad = payload_size % blocksize != 0;
+    bool controller_t::skip(frame_e frame, std::chrono::steady_clock::time_point now) const {
+      std::lock_guard lg {_lock};
 
-      auto aligned_data_shards = payload_size / blocksize;
-      auto data_shards = aligned_data_shards + (pad ? 1 : 0);
-      auto parity_shards = (data_shards * fecpercentage + 99) / 100;
+      return frame == frame_e::regular && waiting(now);
+    }
 
-      // increase the FEC percentage for this frame if the parity shard minimum is not met
-      if (parity_shards < minparityshards && fecpercentage != 0) {
-        parity_shards = minparityshards;
-        fecpercentage = (100 * parity_shards) / data_shards;
+    bool controller_t::on_sent(std::int64_t frame_index, frame_e frame, std::chrono::steady_clock::time_point now) {
+      std::lock_guard lg {_lock};
 
-        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
+      if (frame == frame_e::idr) {
+        _last_idr_frame = frame_index;
       }
 
-      auto nr_shards = data_shards + parity_shards;
-
-      // If we need to store a zero-padded data shard, allocate that first to
-      // to keep the shards in order and reduce buffer fragmentation
-      auto parity_shard_offset = pad ? 1 : 0;
-      util::buffer_t<char> shards {(parity_shard_offset + parity_shards) * blocksize};
-      util::buffer_t<uint8_t *> shards_p {nr_shards};
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-      payload_buffers.reserve(2);
-
-      // Point into the payload buffer for all except the final padded data shard
-      auto next = std::begin(payload);
-      for (auto x = 0; x < aligned_data_shards; ++x) {
-        shards_p[x] = (uint8_t *) next;
-        next += blocksize;
-      }
-      payload_buffers.emplace_back(std::begin(payload), aligned_data_shards * blocksize);
-
-      // If the last data shard needs to be zero-padded, we must use the shards buffer
-      if (pad) {
-        shards_p[aligned_data_shards] = (uint8_t *) &shards[0];
-
-        // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here
-        // and ends up compiling a horribly slow element-by-element copy loop, so we
-        // help it by using memcpy()/memset() directly.
-        auto copy_len = std::min<size_t>(blocksize, std::end(payload) - next);
-        std::memcpy(shards_p[aligned_data_shards], next, copy_len);
-        if (copy_len < blocksize) {
-          // Zero any additional space after the end of the payload
-          std::memset(shards_p[aligned_data_shards] + copy_len, 0, blocksize - copy_len);
-        }
+      if (frame == frame_e::regular || !_request || _request->answer || (_request->idr && frame == frame_e::invalidation)) {
+        return false;
       }
 
-      // Add a payload buffer describing the shard buffer
-      payload_buffers.emplace_back(std::begin(shards), shards.size());
-
-      if (fecpercentage != 0) {
-        // Point into our allocated buffer for the parity shards
-        for (auto x = 0; x < parity_shards; ++x) {
-          shards_p[data_shards + x] = (uint8_t *) &shards[(parity_shard_offset + x) * blocksize];
-        }
-
-        // packets = parity_shards + data_shards
-        rs_t rs {reed_solomon_new(data_shards, parity_shards)};
-
-        reed_solomon_encode(rs.get(), shards_p.begin(), nr_shards, blocksize);
+      // The frames of an intra refresh still refer to the lost ones until it completes, so they replace nothing later requests could lean on
+      if (frame == frame_e::intra_refresh) {
+        _request.reset();
+        return true;
       }
 
-      return {
-        data_shards,
-        nr_shards,
-        fecpercentage,
-        blocksize,
-        prefixsize,
-        std::move(shards),
-        util::buffer_t<char> {nr_shards * prefixsize},
-        std::move(shards_p),
-        std::move(payload_buffers),
-      };
+      _request->idr = _request->idr || frame == frame_e::idr;
+      _request->answer = frame_index;
+      _request->at = now;
+      return true;
     }
-  }  // namespace fec
+  }  // namespace recovery
 
   /**
-   * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
-   * @param insert_size The number of bytes to insert.
-   * @param slice_size The number of bytes between insertions.
-   * @param data1 The first data buffer.
-   * @param data2 The second data buffer.
+   * @brief Apply replacements to a payload split into a copied head and an untouched tail.
+   * @details Only the payload up to the end of the last replacement is copied into the head,
+   *          so replacing the parameter sets at the start of a large frame doesn't copy the whole frame.
+   * @param head Receives the start of the payload, with the replacements applied.
+   * @param tail The payload, and the rest of it that wasn't copied on return.
+   * @param splices Where the replacements start in the payload, sorted by offset.
    */
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
-    auto data_size = data1.size() + data2.size();
-    auto pad = data_size % slice_size != 0;
-    auto elements = data_size / slice_size + (pad ? 1 : 0);
-
-    std::vector<uint8_t> result;
-    result.resize(elements * insert_size + data_size);
-
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
-    for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
-
-      // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
-      }
-
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
-
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
-      } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
+  void apply_splices(std::vector<uint8_t> &head, std::string_view &tail, const std::vector<video::packet_raw_t::splice_t> &splices) {
+    std::size_t copied = 0;
+    for (auto &splice : splices) {
+      if (splice.offset < copied || splice.offset + splice.old.size() > tail.size()) {
+        continue;
       }
-    }
-
-    return result;
-  }
-
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
-
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
+      head.insert(std::end(head), std::begin(tail) + copied, std::begin(tail) + splice.offset);
+      head.insert(std::end(head), std::begin(splice._new), std::end(splice._new));
+      copied = splice.offset + splice.old.size();
     }
 
-    return replaced;
+    tail.remove_prefix(copied);
   }
 
   /**
@@ -792,7 +1894,6 @@ namespace stream {
       return -1;
     }
 
-    std::string payload;
     if (msg.type == platf::gamepad_feedback_e::rumble) {
       control_rumble_t plaintext;
       plaintext.header.type = packetTypes[IDX_RUMBLE_DATA];
@@ -806,10 +1907,7 @@ namespace stream {
       plaintext.highfreq = util::endian::little(data.highfreq);
 
       BOOST_LOG(verbose) << "Rumble: "sv << msg.id << " :: "sv << util::hex(data.lowfreq).to_string_view() << " :: "sv << util::hex(data.highfreq).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      queue_control(session, util::view(plaintext));
     } else if (msg.type == platf::gamepad_feedback_e::rumble_triggers) {
       control_rumble_triggers_t plaintext;
       plaintext.header.type = packetTypes[IDX_RUMBLE_TRIGGER_DATA];
@@ -822,10 +1920,7 @@ namespace stream {
       plaintext.right = util::endian::little(data.right_trigger);
 
       BOOST_LOG(verbose) << "Rumble triggers: "sv << msg.id << " :: "sv << util::hex(data.left_trigger).to_string_view() << " :: "sv << util::hex(data.right_trigger).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      queue_control(session, util::view(plaintext));
     } else if (msg.type == platf::gamepad_feedback_e::set_motion_event_state) {
       control_set_motion_event_t plaintext;
       plaintext.header.type = packetTypes[IDX_SET_MOTION_EVENT];
@@ -838,10 +1933,7 @@ namespace stream {
       plaintext.type = data.motion_type;
 
       BOOST_LOG(verbose) << "Motion event state: "sv << msg.id << " :: "sv << util::hex(data.report_rate).to_string_view() << " :: "sv << util::hex(data.motion_type).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      queue_control(session, util::view(plaintext));
     } else if (msg.type == platf::gamepad_feedback_e::set_rgb_led) {
       control_set_rgb_led_t plaintext;
       plaintext.header.type = packetTypes[IDX_SET_RGB_LED];
@@ -855,10 +1947,7 @@ namespace stream {
       plaintext.b = data.b;
 
       BOOST_LOG(verbose) << "RGB: "sv << msg.id << " :: "sv << util::hex(data.r).to_string_view() << util::hex(data.g).to_string_view() << util::hex(data.b).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      queue_control(session, util::view(plaintext));
     } else if (msg.type == platf::gamepad_feedback_e::set_adaptive_triggers) {
       control_adaptive_triggers_t plaintext;
       plaintext.header.type = packetTypes[IDX_SET_ADAPTIVE_TRIGGERS];
@@ -871,22 +1960,12 @@ namespace stream {
       plaintext.type_right = msg.data.adaptive_triggers.type_right;
       std::ranges::copy(msg.data.adaptive_triggers.right, plaintext.right);
 
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      queue_control(session, util::view(plaintext));
     } else {
       BOOST_LOG(error) << "Unknown gamepad feedback message type"sv;
       return -1;
     }
 
-    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
-      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
-      BOOST_LOG(warning) << "Couldn't send gamepad feedback to ["sv << addr << ':' << port << ']';
-
-      return -1;
-    }
-
     return 0;
   }
 
@@ -904,24 +1983,101 @@ namespace stream {
     plaintext.enabled = hdr_info->enabled;
     plaintext.metadata = hdr_info->metadata;
 
-    std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-      encrypted_payload;
+    queue_control(session, util::view(plaintext));
+
+    BOOST_LOG(debug) << "Queued HDR mode: " << hdr_info->enabled;
+    return 0;
+  }
 
-    auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
-      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
-      BOOST_LOG(warning) << "Couldn't send HDR mode to ["sv << addr << ':' << port << ']';
+  /**
+   * @brief Handle the client reporting lost video packets or frames.
+   * @details The client doesn't report lost audio packets, so video loss stands in for the loss on the link.
+   */
+  void on_loss(session_t *session) {
+    auto now = std::chrono::steady_clock::now();
 
-      return -1;
+    session->video.link_estimate->on_loss(now);
+    session->audio.fec_protection->on_loss(now);
+    session->video.metrics->loss_reports.add();
+  }
+
+  /**
+   * @brief Handle the client failing to decode a video frame, which it asks to recover from with an IDR frame or by invalidating reference frames.
+   */
+  void on_unrecovered(session_t *session) {
+    session->video.bitrate_control->on_invalidate();
+    session->video.fec_protection->on_unrecovered(std::chrono::steady_clock::now());
+    session->video.metrics->video_frames_unrecovered.add();
+  }
+
+  /**
+   * @brief Get what a video frame does for a client recovering from lost frames.
+   */
+  recovery::frame_e recovery_frame_of(video::packet_raw_t &packet) {
+    if (packet.is_idr()) {
+      return recovery::frame_e::idr;
+    }
+    if (packet.after_ref_frame_invalidation) {
+      return recovery::frame_e::invalidation;
+    }
+    if (packet.intra_refresh) {
+      return recovery::frame_e::intra_refresh;
     }
 
-    BOOST_LOG(debug) << "Sent HDR mode: " << hdr_info->enabled;
-    return 0;
+    return recovery::frame_e::regular;
+  }
+
+  /**
+   * @brief Have the encoder stop referring to frames the client won't decode.
+   * @param session The session.
+   * @param first_frame The first frame of the range.
+   * @param last_frame The last frame of the range.
+   */
+  void invalidate_frames(session_t *session, std::int64_t first_frame, std::int64_t last_frame) {
+    // Encoders without reference frame invalidation answer with an IDR frame
+    auto invalidates = video::last_encoder_probe_supported_ref_frames_invalidation;
+    if (!session->video.recovery.on_invalidate(first_frame, last_frame, invalidates, std::chrono::steady_clock::now())) {
+      BOOST_LOG(debug) << "A frame that was sent or is on its way already replaces frames "sv << first_frame << " to "sv << last_frame;
+      session->video.metrics->video_idr_frames_avoided.add();
+      return;
+    }
+
+    session->video.invalidate_ref_frames_events->raise(std::make_pair(first_frame, last_frame));
+  }
+
+  /**
+   * @brief Handle the control messages and input a replay fed to a session since the last round.
+   * @param server The control server.
+   * @param session The replayed session.
+   * @return The last round trip time of the replay, or `std::nullopt` if there wasn't any yet.
+   */
+  std::optional<std::chrono::milliseconds> handle_replayed(control_server_t *server, session_t *session) {
+    auto &replay = session->control.replay;
+
+    std::vector<replayed_message_t> messages;
+    std::optional<std::chrono::milliseconds> rtt;
+    {
+      std::lock_guard lg {replay.lock};
+      std::swap(messages, replay.messages);
+      rtt = replay.rtt;
+    }
+
+    for (auto &message : messages) {
+      server->received = std::chrono::steady_clock::now();
+      if (message.type) {
+        server->call(*message.type, session, message.payload, true);
+      } else {
+        video::on_input();
+        input::passthrough(session->input, std::vector<std::uint8_t> {std::begin(message.payload), std::end(message.payload)}, server->received);
+      }
+    }
+
+    return rtt;
   }
 
   void controlBroadcastThread(control_server_t *server) {
     server->map(packetTypes[IDX_PERIODIC_PING], [](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
+      SUNSHINE_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
     });
 
     server->map(packetTypes[IDX_START_A], [&](session_t *session, const std::string_view &payload) {
@@ -939,6 +2095,18 @@ namespace stream {
 
       auto lastGoodFrame = stats[3];
 
+      if (count > 0) {
+        on_loss(session);
+        session->video.bitrate_control->on_loss();
+        session->video.fec_protection->on_loss(count);
+        session->video.metrics->video_packets_lost.add(count);
+      }
+
+      // The encoder may recover from the frames the client received instead of sending an IDR frame
+      if (lastGoodFrame > 0) {
+        session->video.acknowledged_frame_events->raise(lastGoodFrame);
+      }
+
       BOOST_LOG(verbose)
         << "type [IDX_LOSS_STATS]"sv << std::endl
         << "---begin stats---" << std::endl
@@ -951,6 +2119,18 @@ namespace stream {
     server->map(packetTypes[IDX_REQUEST_IDR_FRAME], [&](session_t *session, const std::string_view &payload) {
       BOOST_LOG(debug) << "type [IDX_REQUEST_IDR_FRAME]"sv;
 
+      on_loss(session);
+
+      // Asking again doesn't get the IDR frame there sooner, it only adds another one
+      auto &delay = *session->video.delay;
+      auto round_trip = delay.rtt() + delay.jitter() * 4;
+      if (!session->video.recovery.on_idr_request(std::chrono::steady_clock::now(), round_trip)) {
+        BOOST_LOG(debug) << "An IDR frame was already sent or is on its way"sv;
+        session->video.metrics->video_idr_requests_debounced.add();
+        return;
+      }
+
+      on_unrecovered(session);
       session->video.idr_events->raise(true);
     });
 
@@ -964,7 +2144,58 @@ namespace stream {
         << "firstFrame [" << firstFrame << ']' << std::endl
         << "lastFrame [" << lastFrame << ']';
 
-      session->video.invalidate_ref_frames_events->raise(std::make_pair(firstFrame, lastFrame));
+      // Frames dropped on purpose leave a gap the client can't tell from a loss, but the link didn't lose them
+      if (session->video.dropped_frames.contains(firstFrame, lastFrame)) {
+        BOOST_LOG(debug) << "Frames "sv << firstFrame << " to "sv << lastFrame << " were dropped before they were sent"sv;
+      } else {
+        on_loss(session);
+        on_unrecovered(session);
+      }
+      invalidate_frames(session, firstFrame, lastFrame);
+    });
+
+    server->map(packetTypes[IDX_VIDEO_NACK], [&](session_t *session, const std::string_view &payload) {
+      BOOST_LOG(verbose) << "type [IDX_VIDEO_NACK]"sv;
+
+      if (!session->video.history || session->video.peer.port() == 0) {
+        return;
+      }
+
+      auto ranges = (const control_video_nack_range_t *) payload.data();
+      auto range_count = payload.size() / sizeof(control_video_nack_range_t);
+
+      auto now = std::chrono::steady_clock::now();
+      auto peer_address = session->video.peer.address();
+      auto &sock = session->broadcast_ref->video_sock;
+
+      std::size_t requested = 0;
+      std::size_t retransmitted = 0;
+      for (std::size_t x = 0; x < range_count && requested < MAX_VIDEO_NACK_SHARDS; ++x) {
+        auto count = std::min<std::size_t>(ranges[x].count, MAX_VIDEO_NACK_SHARDS - requested);
+        requested += count;
+
+        for (auto &shard : session->video.history->find(ranges[x].firstSequenceNumber, count, now)) {
+          auto send_info = platf::send_info_t {
+            nullptr,
+            0,
+            shard.data(),
+            shard.size(),
+            (uintptr_t) sock.native_handle(),
+            peer_address,
+            session->video.peer.port(),
+            session->localAddress,
+          };
+
+          if (platf::send(send_info)) {
+            ++retransmitted;
+          }
+        }
+      }
+
+      session->video.metrics->video_nack_shards_requested.add(requested);
+      session->video.metrics->video_nack_shards_retransmitted.add(retransmitted);
+
+      BOOST_LOG(verbose) << "Resent "sv << retransmitted << '/' << requested << " video shards"sv;
     });
 
     server->map(packetTypes[IDX_INPUT_DATA], [&](session_t *session, const std::string_view &payload) {
@@ -990,11 +2221,16 @@ namespace stream {
         std::copy(payload.end() - 16, payload.end(), std::begin(iv));
       }
 
-      input::passthrough(session->input, std::move(plaintext));
+      if (session->recording) {
+        session->recording->write_input(std::string_view {(char *) plaintext.data(), plaintext.size()});
+      }
+
+      video::on_input();
+      input::passthrough(session->input, std::move(plaintext), server->received);
     });
 
     server->map(packetTypes[IDX_ENCRYPTED], [server](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
+      SUNSHINE_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
 
       auto header = (control_encrypted_p) (payload.data() - 2);
 
@@ -1053,7 +2289,11 @@ namespace stream {
       // IDX_INPUT_DATA callback will attempt to decrypt unencrypted data, therefore we need pass it directly
       if (type == packetTypes[IDX_INPUT_DATA]) {
         plaintext.erase(std::begin(plaintext), std::begin(plaintext) + 4);
-        input::passthrough(session->input, std::move(plaintext));
+        if (session->recording) {
+          session->recording->write_input(std::string_view {(char *) plaintext.data(), plaintext.size()});
+        }
+        video::on_input();
+        input::passthrough(session->input, std::move(plaintext), server->received);
       } else {
         server->call(type, session, next_payload, true);
       }
@@ -1061,27 +2301,43 @@ namespace stream {
 
     // This thread handles latency-sensitive control messages
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    auto placement = thread_affinity::apply(thread_affinity::role_e::control);
 
     // Check for both the full shutdown event and the shutdown event for this
     // broadcast to ensure we can inform connected clients of our graceful
     // termination when we shut down.
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    logging::percentile_periodic_logger<double> outbound_latency_logger {debug, "Control: outbound latency", "ms", 20s, &metrics::control.outbound_latency_recent_seconds};
+
     while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
       bool has_session_awaiting_peer = false;
 
+      // Sessions tell which network interface they're streamed through
+      thread_affinity::follow(thread_affinity::role_e::control, placement);
+
+      // Wakeups asked for while the sessions are processed are handled on the next round
+      auto wakeup = server->take_wakeup();
+
+      // ENet needs servicing this often for pings and resends, unless a session times out sooner
+      std::chrono::milliseconds timeout = 150ms;
+
+      // Whether messages were handed to ENet that need flushing
+      bool queued = false;
+
       {
-        auto lg = server->_sessions.lock();
+        auto table = server->_sessions.load();
+        std::vector<session_t *> stopped;
 
         auto now = std::chrono::steady_clock::now();
 
-        KITTY_WHILE_LOOP(auto pos = std::begin(*server->_sessions), pos != std::end(*server->_sessions), {
+        for (auto &entry : table->sessions) {
           // Don't perform additional session processing if we're shutting down
           if (shutdown_event->peek() || broadcast_shutdown_event->peek()) {
             break;
           }
 
-          auto session = *pos;
+          auto session = entry.session;
 
           if (now > session->pingTimeout) {
             auto address = session->control.peer ? platf::from_sockaddr((sockaddr *) &session->control.peer->address.address) : session->control.expected_peer_address;
@@ -1090,32 +2346,94 @@ namespace stream {
           }
 
           if (session->state.load(std::memory_order_acquire) == session::state_e::STOPPING) {
-            pos = server->_sessions->erase(pos);
-
-            if (session->control.peer) {
-              {
-                auto ptslg = server->_peer_to_session.lock();
-                server->_peer_to_session->erase(session->control.peer);
-              }
-
-              enet_peer_disconnect_now(session->control.peer, 0);
-            }
-
-            session->controlEnd.raise(true);
+            stopped.push_back(session);
             continue;
           }
 
+          timeout = std::clamp(std::chrono::ceil<std::chrono::milliseconds>(session->pingTimeout - now), 0ms, timeout);
+
           // Remember if we have a session that's waiting for a peer to connect to the
           // control stream. This ensures the clients are properly notified even when
           // the app terminates before they finish connecting.
+          // A replayed session never gets a peer, so it keeps the control stream up like a session waiting for one
           if (!session->control.peer) {
             has_session_awaiting_peer = true;
-          } else {
+          }
+
+          if (session->control.peer || session->config.replay) {
+            // The messages and round trip times of a recording stand in for those of the client
+            std::optional<std::chrono::milliseconds> rtt;
+            if (session->control.peer) {
+              rtt = std::chrono::milliseconds {session->control.peer->roundTripTime};
+            } else {
+              rtt = handle_replayed(server, session);
+            }
+
+            if (rtt) {
+              if (session->recording && rtt != session->control.recorded_rtt) {
+                session->recording->write_rtt(*rtt);
+                session->control.recorded_rtt = rtt;
+              }
+
+              auto &delay = *session->video.delay;
+              delay.on_rtt(*rtt);
+              session->video.link_estimate->on_rtt(*rtt, now, delay.jitter());
+              session->video.bitrate_control->on_delay(delay.queueing_delay(), delay.jitter());
+              session->video.metrics->rtt_seconds.set(std::chrono::duration<double> {delay.rtt()}.count());
+              session->video.metrics->queueing_delay_seconds.set(std::chrono::duration<double> {delay.queueing_delay()}.count());
+              session->video.metrics->ping_jitter_seconds.set(std::chrono::duration<double> {delay.jitter()}.count());
+            }
+            session->audio.fec_protection->update(now);
+            session->video.metrics->audio_parity_shards.set(session->audio.fec_protection->parity_shards());
+            session->video.fec_protection->update(now);
+            session->video.metrics->video_fec_percentage.set(session->video.fec_protection->percentage());
+
+            if (auto bitrate = session->video.bitrate_control->update(now)) {
+              session->video.bitrate_events->raise(*bitrate);
+              session->video.metrics->target_bitrate.set((double) *bitrate * 1000);
+              session->video.metrics->bitrate_changes.add();
+            }
+
+            // A frame the link can't take within part of a frame interval holds up the next ones
+            if (config::stream.frame_size_limit > 0) {
+              auto max_frame_size = pacing::max_frame_size(session->video.link_estimate->rate(), session->video.scheduler->frame_interval(), config::stream.frame_size_limit, session->video.fec_protection->percentage());
+
+              // Small steps of the link estimate aren't worth reconfiguring the encoder for
+              auto last = session->video.max_frame_size;
+              if (max_frame_size * 10 < last * 9 || max_frame_size * 10 > last * 11) {
+                session->video.max_frame_size = max_frame_size;
+                session->video.max_frame_size_events->raise((int64_t) max_frame_size);
+              }
+            }
+
+            // Only raised with quality sampling, by its decoder thread
+            auto &quality_events = session->video.quality_events;
+            if (quality_events->peek()) {
+              if (auto quality = quality_events->pop()) {
+                session->video.metrics->video_psnr_db.set(quality->psnr_db);
+                session->video.metrics->video_ssim.set(quality->ssim);
+              }
+            }
+
+            // Games may set rumble every frame for each gamepad, only the latest state is sent at a bounded rate
+            auto &feedback = session->control.feedback;
+            auto duplicates = feedback.duplicates();
+            auto coalesced = feedback.coalesced();
+
             auto &feedback_queue = session->control.feedback_queue;
             while (feedback_queue->peek()) {
-              auto feedback_msg = feedback_queue->pop();
+              feedback.push(*feedback_queue->pop());
+            }
+
+            for (auto &feedback_msg : feedback.pop(now)) {
+              send_feedback_msg(session, feedback_msg);
+              session->video.metrics->gamepad_feedback_sent.add();
+            }
+            session->video.metrics->gamepad_feedback_duplicates.add(feedback.duplicates() - duplicates);
+            session->video.metrics->gamepad_feedback_coalesced.add(feedback.coalesced() - coalesced);
 
-              send_feedback_msg(session, *feedback_msg);
+            if (auto due = feedback.next_due()) {
+              timeout = std::clamp(std::chrono::ceil<std::chrono::milliseconds>(*due - now), 0ms, timeout);
             }
 
             auto &hdr_queue = session->control.hdr_queue;
@@ -1124,10 +2442,34 @@ namespace stream {
 
               send_hdr_mode(session, std::move(hdr_info));
             }
+
+            if (session->control.peer && send_control(*server, session)) {
+              queued = true;
+            }
+          }
+        }
+
+        // Stopped sessions may only go away once they're out of the table
+        if (!stopped.empty()) {
+          server->remove_sessions(stopped);
+
+          for (auto session : stopped) {
+            if (session->control.peer) {
+              enet_peer_disconnect_now(session->control.peer, 0);
+            }
+
+            session->controlEnd.raise(true);
           }
+        }
+      }
 
-          ++pos;
-        })
+      if (wakeup || queued) {
+        server->flush();
+      }
+      if (wakeup) {
+        if (outbound_latency_logger.is_enabled()) {
+          outbound_latency_logger.collect_and_log(std::chrono::duration<double, std::milli> {std::chrono::steady_clock::now() - *wakeup}.count());
+        }
       }
 
       // Don't break until any pending sessions either expire or connect
@@ -1136,7 +2478,7 @@ namespace stream {
         break;
       }
 
-      server->iterate(150ms);
+      server->iterate(timeout);
     }
 
     // Let all remaining connections know the server is shutting down
@@ -1148,21 +2490,14 @@ namespace stream {
     plaintext.header.payloadLength = sizeof(plaintext.ec);
     plaintext.ec = util::endian::big<uint32_t>(reason);
 
-    std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-      encrypted_payload;
-
-    auto lg = server->_sessions.lock();
-    for (auto pos = std::begin(*server->_sessions); pos != std::end(*server->_sessions); ++pos) {
-      auto session = *pos;
+    auto table = server->_sessions.load();
+    for (auto &entry : table->sessions) {
+      auto session = entry.session;
 
       // We may not have gotten far enough to have an ENet connection yet
       if (session->control.peer) {
-        auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
-
-        if (server->send(payload, session->control.peer)) {
-          TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
-          BOOST_LOG(warning) << "Couldn't send termination code to ["sv << addr << ':' << port << ']';
-        }
+        queue_control(session, util::view(plaintext));
+        send_control(*server, session);
       }
 
       session->shutdown_event->raise(true);
@@ -1173,160 +2508,372 @@ namespace stream {
   }
 
   void recvThread(broadcast_ctx_t &ctx) {
-    std::map<av_session_id_t, message_queue_t> peer_to_video_session;
-    std::map<av_session_id_t, message_queue_t> peer_to_audio_session;
+    // Every ping that's ready is received in one go, so a burst from many sessions costs a single wakeup
+    constexpr std::size_t RECV_BATCH_SIZE = 32;
+    constexpr std::size_t RECV_BUFFER_SIZE = 2048;
+
+    struct receiver_t {
+      udp::socket &sock;
+      std::string_view type_str;
+
+      ping_sessions_t sessions;
 
-    auto &video_sock = ctx.video_sock;
-    auto &audio_sock = ctx.audio_sock;
+      std::vector<char> buffers = std::vector<char>(RECV_BATCH_SIZE * RECV_BUFFER_SIZE);
+      std::array<std::size_t, RECV_BATCH_SIZE> sizes {};
+      std::array<udp::endpoint, RECV_BATCH_SIZE> peers;
+      std::array<std::chrono::steady_clock::time_point, RECV_BATCH_SIZE> receive_times;
+
+      // Video pings keep coming after the session started, at a steady pace the delay estimates are fed with
+      std::unordered_map<std::string, std::shared_ptr<delay::estimate_t>, ping_sessions_t::payload_hash_t, std::equal_to<>> delays;
+    };
+
+    std::array<receiver_t, 2> receivers {{
+      {ctx.video_sock, "VIDEO"sv},
+      {ctx.audio_sock, "AUDIO"sv},
+    }};
 
     auto &message_queue_queue = ctx.message_queue_queue;
+    auto &delay_queue = ctx.delay_queue;
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
 
     auto &io = ctx.io_context;
 
-    udp::endpoint peer;
-
-    std::array<char, 2048> buf[2];
-    std::function<void(const boost::system::error_code, size_t)> recv_func[2];
-
     auto populate_peer_to_session = [&]() {
       while (message_queue_queue->peek()) {
         auto message_queue_opt = message_queue_queue->pop();
         TUPLE_3D_REF(socket_type, session_id, message_queue, *message_queue_opt);
 
-        switch (socket_type) {
-          case socket_e::video:
-            if (message_queue) {
-              peer_to_video_session.emplace(session_id, message_queue);
-            } else {
-              peer_to_video_session.erase(session_id);
-            }
-            break;
-          case socket_e::audio:
-            if (message_queue) {
-              peer_to_audio_session.emplace(session_id, message_queue);
-            } else {
-              peer_to_audio_session.erase(session_id);
+        auto &sessions = receivers[socket_type == socket_e::video ? 0 : 1].sessions;
+        if (message_queue) {
+          sessions.add(session_id, message_queue);
+        } else {
+          sessions.remove(session_id);
+        }
+      }
+
+      while (delay_queue->peek()) {
+        auto delay_opt = delay_queue->pop();
+        TUPLE_2D_REF(payload, delay, *delay_opt);
+
+        auto &delays = receivers[0].delays;
+        if (delay) {
+          delays.insert_or_assign(payload, delay);
+        } else {
+          delays.erase(payload);
+        }
+      }
+    };
+
+    std::function<void(receiver_t &)> receive = [&](receiver_t &receiver) {
+      receiver.sock.async_wait(udp::socket::wait_read, [&receive, &populate_peer_to_session, &receiver](const boost::system::error_code &ec) {
+        if (ec == asio::error::operation_aborted) {
+          return;
+        }
+
+        auto fg = util::fail_guard([&]() {
+          receive(receiver);
+        });
+
+        if (ec) {
+          BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << ec.message();
+          return;
+        }
+
+        populate_peer_to_session();
+
+        platf::batched_recv_info_t recv_info {
+          (std::uintptr_t) receiver.sock.native_handle(),
+          receiver.buffers.data(),
+          RECV_BUFFER_SIZE,
+          RECV_BATCH_SIZE,
+          receiver.sizes.data(),
+          receiver.peers.data(),
+          receiver.receive_times.data(),
+        };
+
+        auto received = platf::recv_batch(recv_info);
+        for (int x = 0; x < received; ++x) {
+          auto &peer = receiver.peers[x];
+          std::string_view ping {receiver.buffers.data() + x * RECV_BUFFER_SIZE, receiver.sizes[x]};
+
+          SUNSHINE_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << receiver.type_str;
+
+          if (!receiver.delays.empty() && ping.size() >= sizeof(SS_PING)) {
+            auto it = receiver.delays.find(std::string_view {((PSS_PING) ping.data())->payload, sizeof(SS_PING::payload)});
+            if (it != std::end(receiver.delays)) {
+              it->second->on_ping(util::endian::big<std::uint32_t>(((PSS_PING) ping.data())->sequenceNumber), receiver.receive_times[x]);
             }
-            break;
+          }
+
+          if (auto message_queue = receiver.sessions.find(peer, ping)) {
+            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << receiver.type_str;
+            (*message_queue)->raise(peer, std::string {ping});
+          }
         }
+      });
+    };
+
+    for (auto &receiver : receivers) {
+      receive(receiver);
+    }
+
+    while (!broadcast_shutdown_event->peek()) {
+      io.run();
+    }
+  }
+
+  fec::fec_t encode_video_fec_block(const video_frame_info_t &frame, int block_index, int lowseq, std::pair<size_t, size_t> fec_block, fec::rs_cache_t &rs_cache) {
+    frame_trace::scoped_span_t span {frame_trace::span_e::fec, frame.frame_index};
+
+    // Encrypted shards are written to buffers of their own, the payload is shared with the other sessions
+    auto prefix_size = frame.encrypted ? sizeof(video_packet_enc_prefix_t) : 0;
+    auto shards = fec::slice(frame.payload, fec_block.first, fec_block.second, frame.payload_blocksize, frame.fec_percentage, frame.min_parity_shards, sizeof(video_packet_raw_t), prefix_size, frame.encrypted);
+    auto packets = shards.data_shards;
+
+    for (int x = 0; x < packets; ++x) {
+      auto *inspect = (video_packet_raw_t *) shards.header(x);
+
+      inspect->packet.frameIndex = frame.frame_index;
+      inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
+
+      // Match multiFecFlags with Moonlight
+      inspect->packet.multiFecFlags = 0x10;
+      inspect->packet.multiFecBlocks = (block_index << 4) | ((frame.fec_blocks_needed - 1) << 6);
+
+      inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
+      if (x == 0) {
+        inspect->packet.flags |= FLAG_SOF;
       }
-    };
+      if (x == packets - 1) {
+        inspect->packet.flags |= FLAG_EOF;
+      }
+    }
 
-    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::map<av_session_id_t, message_queue_t> &peer_to_session) {
-      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec, size_t bytes) {
-        auto fg = util::fail_guard([&]() {
-          sock.async_receive_from(asio::buffer(buf[buf_elem]), peer, 0, recv_func[buf_elem]);
-        });
+    fec::encode(shards, rs_cache);
+    return shards;
+  }
 
-        auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
-        BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+  void finalize_video_shards(const video_frame_info_t &frame, int block_index, int lowseq, fec::fec_t &shards, size_t first, size_t count, crypto::cipher::gcm_t *cipher, std::uint64_t gcm_iv_counter, metrics::session_t &session_metrics) {
+    frame_trace::scoped_span_t span {frame_trace::span_e::encrypt, frame.frame_index};
 
-        populate_peer_to_session();
+    // Reused between calls, so queueing the shards for encryption doesn't allocate
+    thread_local std::vector<crypto::cipher::gcm_message_t> messages;
+    messages.clear();
 
-        // No data, yet no error
-        if (ec == boost::system::errc::connection_refused || ec == boost::system::errc::connection_reset) {
-          return;
-        }
+    for (auto x = first; x < first + count; ++x) {
+      auto *inspect = (video_packet_raw_t *) shards.header(x);
 
-        if (ec || !bytes) {
-          BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << ec.message();
-          return;
-        }
+      inspect->packet.fecInfo =
+        (x << 12 |
+         shards.data_shards << 22 |
+         shards.percentage << 4);
 
-        if (bytes == 4) {
-          // For legacy PING packets, find the matching session by address.
-          auto it = peer_to_session.find(peer.address());
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
-          }
-        } else if (bytes >= sizeof(SS_PING)) {
-          auto ping = (PSS_PING) buf[buf_elem].data();
-
-          // For new PING packets that include a client identifier, search by payload.
-          auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
-          }
-        }
-      };
-    };
+      inspect->rtp.header = 0x80 | FLAG_EXTENSION;
+      inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
+      inspect->rtp.timestamp = util::endian::big<uint32_t>(frame.timestamp);
 
-    recv_func_init(video_sock, 0, peer_to_video_session);
-    recv_func_init(audio_sock, 1, peer_to_audio_session);
+      inspect->packet.multiFecBlocks = (block_index << 4) | ((frame.fec_blocks_needed - 1) << 6);
+      inspect->packet.frameIndex = frame.frame_index;
 
-    video_sock.async_receive_from(asio::buffer(buf[0]), peer, 0, recv_func[0]);
-    audio_sock.async_receive_from(asio::buffer(buf[1]), peer, 0, recv_func[1]);
+      // Encrypt this shard if video encryption is enabled
+      if (cipher) {
+        // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+        // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
+        // high bytes is the "fixed" field. Because each client provides their own unique
+        // key, our values in the fixed field need only uniquely identify each independent
+        // use of the client's key with AES-GCM in our code.
+        //
+        // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
+        // to be sent to each client before the IV repeats.
+        auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
+        auto counter = gcm_iv_counter + x;
+        std::copy_n((uint8_t *) &counter, sizeof(counter), std::begin(prefix->iv));
+        std::fill(std::begin(prefix->iv) + sizeof(counter), std::end(prefix->iv) - 1, 0);
+        prefix->iv[11] = 'V';  // Video stream
+        prefix->frameNumber = frame.frame_index;
+
+        // Encrypt the packet header in place and the payload into the shard of this session, as if they were contiguous
+        messages.push_back({
+          prefix->iv,
+          std::string_view {(char *) inspect, shards.headersize},
+          (uint8_t *) inspect,
+          std::string_view {shards.source(x), shards.blocksize},
+          (uint8_t *) shards.data(x),
+          prefix->tag,
+        });
+      }
+    }
 
-    while (!broadcast_shutdown_event->peek()) {
-      io.run();
+    if (cipher) {
+      auto start = std::chrono::steady_clock::now();
+      if (cipher->encrypt(messages)) {
+        BOOST_LOG(error) << "Failed to encrypt video shards"sv;
+      }
+      session_metrics.video_encryption_nanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+
+  /**
+   * @brief Record a video packet of a session.
+   * @param recording The recording of the session.
+   * @param packet The packet, before any replacements are applied.
+   */
+  void record_video(session_recording::writer_t &recording, video::packet_raw_t &packet) {
+    session_recording::video_t video {};
+    video.frame_index = packet.frame_index();
+    video.idr = packet.is_idr();
+    video.after_ref_frame_invalidation = packet.after_ref_frame_invalidation;
+    video.intra_refresh = packet.intra_refresh;
+    video.part_index = packet.part_index;
+    video.part_count = packet.part_count;
+    if (packet.frame_timestamp) {
+      video.capture_delay = packet.queued_timestamp - *packet.frame_timestamp;
+    }
+    if (packet.replacements) {
+      for (auto &replacement : *packet.replacements) {
+        video.replacements.emplace_back(replacement.old, replacement._new);
+      }
     }
+
+    recording.write_video(packet.queued_timestamp, video, std::string_view {(const char *) packet.data(), packet.data_size()});
   }
 
-  void videoBroadcastThread(udp::socket &sock) {
+  void videoBroadcastThread(udp::socket &sock, video_shard_t *shard) {
     auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
+    auto packets = shard->packets;
     auto video_epoch = std::chrono::steady_clock::now();
 
     // Video traffic is sent on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    auto placement = thread_affinity::apply(thread_affinity::role_e::video_send);
+    frame_trace::name_thread("Video broadcast");
 
-    logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
+    logging::percentile_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms", 20s, &metrics::video.frame_processing_latency_recent_seconds);
 
     logging::time_delta_periodic_logger frame_send_batch_latency_logger(debug, "Network: each send_batch() latency");
     logging::time_delta_periodic_logger frame_fec_latency_logger(debug, "Network: each FEC block latency");
-    logging::time_delta_periodic_logger frame_network_latency_logger(debug, "Network: frame's overall network latency");
+    logging::time_delta_percentile_logger frame_network_latency_logger(debug, "Network: frame's overall network latency", 20s, &metrics::video.frame_send_recent_seconds);
+    logging::min_max_avg_periodic_logger<double> frame_pacing_rate_logger(debug, "Network: frame pacing rate", "Mbps");
+    logging::min_max_avg_periodic_logger<double> frame_send_rate_logger(debug, "Network: frame's achieved send rate", "Mbps");
+    logging::min_max_avg_periodic_logger<double> frame_slack_logger(debug, "Frame scheduler: time from frame sent to next capture", "ms");
+
+    // Reed-Solomon encoders are reused across FEC blocks and frames sent on this thread
+    fec::rs_cache_t rs_cache;
+
+    // FEC and encryption of upcoming shards can be offloaded while this thread keeps sending
+    auto fec_threads = config::stream.fec_threads;
+    if (fec_threads < 0) {
+      // Without AES instructions, encrypting the shards of a frame can take longer than pacing them out
+      fec_threads = 0;
+      if (!crypto::has_aes_acceleration()) {
+        fec_threads = (int) std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+        BOOST_LOG(info) << "The CPU has no AES instructions, video will be encrypted on worker threads"sv;
+      }
+    }
 
-    crypto::aes_t iv(12);
+    std::optional<thread_pool_util::ThreadPool> fec_pool;
+    if (fec_threads > 0) {
+      BOOST_LOG(info) << "Using "sv << fec_threads << " FEC worker threads"sv;
+      fec_pool.emplace(fec_threads);
+    }
 
-    auto timer = platf::create_high_precision_timer();
+    auto timer = hybrid_timer::create();
     if (!timer || !*timer) {
       BOOST_LOG(error) << "Failed to create timer, aborting video broadcast thread";
       return;
     }
 
+    // Stamp each send batch with the time it's due and let the kernel hold it back, instead of sleeping here
+    auto kernel_pacing = config::stream.kernel_pacing && platf::enable_socket_txtime((uintptr_t) sock.native_handle());
+    if (kernel_pacing) {
+      BOOST_LOG(info) << "Pacing video packets with kernel launch times"sv;
+    } else if (config::stream.kernel_pacing) {
+      BOOST_LOG(warning) << "Kernel pacing is unavailable, pacing video packets in Sunshine"sv;
+    }
+
     auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
+    auto dupe_frame_timestamp = ratecontrol_next_frame_start;
+
+    // Scratch space of each frame, which keeps the largest size it grew to so sending doesn't allocate
+    std::vector<uint8_t> payload_head;
+    std::vector<std::future<void>> finalized_batches;
 
     while (auto packet = packets->pop()) {
       if (shutdown_event->peek()) {
         break;
       }
 
+      thread_affinity::follow(thread_affinity::role_e::video_send, placement);
+
       frame_network_latency_logger.first_point_now();
+      auto frame_send_start = std::chrono::steady_clock::now();
+      frame_trace::record(frame_trace::span_e::queue, packet->frame_index(), packet->queued_timestamp, frame_send_start);
+      metrics::set_thread_frame(packet->frame_index());
 
       auto session = (session_t *) packet->channel_data;
       auto lowseq = session->video.lowseq;
 
-      std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+      // Packets are recorded as the encoder handed them out, replacements are applied again when they are replayed
+      if (session->recording) {
+        record_video(*session->recording, *packet);
+      }
+
+      // The client can't decode the frames encoded before the one it waits for to recover, they'd only hold that one up
+      auto recovery_frame = recovery_frame_of(*packet);
+      if (packet->part_index == 0 && session->video.recovery.skip(recovery_frame, frame_send_start)) {
+        session->video.stale_frame = packet->frame_index();
+        session->video.dropped_frames.add(packet->frame_index());
+        session->video.metrics->video_frames_skipped.add();
+      }
+
+      // A frame past its deadline is dropped when a newer one is waiting behind it, unless the client needs it to recover
+      if (packet->part_index == 0 && packet->frame_index() != session->video.stale_frame &&
+          config::stream.stale_frame_limit > 0 && packets->peek() && recovery_frame == recovery::frame_e::regular &&
+          frame_send_start > pacing::send_deadline(packet->frame_timestamp, packet->queued_timestamp, session->video.scheduler->frame_interval(), config::stream.stale_frame_limit)) {
+        session->video.stale_frame = packet->frame_index();
+        session->video.dropped_frames.add(packet->frame_index());
+        session->video.metrics->video_frames_dropped_stale.add();
+        metrics::video.frames_dropped_stale.add();
+        invalidate_frames(session, packet->frame_index(), packet->frame_index());
+      }
+      if (packet->frame_index() == session->video.stale_frame) {
+        continue;
+      }
+
+      std::string_view payload {(const char *) packet->data(), packet->data_size()};
+      payload_head.clear();
 
       // Apply replacements on the packet payload before performing any other operations.
-      // We need to know the final frame size to calculate the last packet size, and we
-      // must avoid matching replacements against the frame header or any other non-video
-      // part of the payload.
-      if (packet->is_idr() && packet->replacements) {
-        for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
-
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
+      // We need to know the final frame size to calculate the last packet size. Only the
+      // start of the payload up to the last replacement is copied, the rest of the frame
+      // is sent straight from the encoder's buffer. The encoder thread already found the
+      // replacements, only replayed packets come without them.
+      if (packet->is_idr() && packet->replacements && !packet->replacements->empty()) {
+        if (packet->splices.empty()) {
+          packet->splices = video::find_splices(payload, *packet->replacements, session->config.monitor.videoFormat == 1);
         }
+        apply_splices(payload_head, payload, packet->splices);
       }
 
+      // A frame sent in parts carries the frame header in its first part only
+      bool frame_parts = packet->part_count > 1;
+      bool has_frame_header = packet->part_index == 0;
+
       video_short_frame_header_t frame_header = {};
       frame_header.headerType = 0x01;  // Short header type
       frame_header.frameType = packet->is_idr()                     ? 2 :
                                packet->after_ref_frame_invalidation ? 5 :
+                               packet->intra_refresh                ? 4 :
                                                                       1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
-      if (frame_header.lastPayloadLen == 0) {
+      frame_header.lastPayloadLen = (payload_head.size() + payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+      if (frame_header.lastPayloadLen == 0 || frame_parts) {
+        // The size of a frame sent in parts isn't known yet, so its last packet keeps its zero padding.
+        // Encoders only send H.264 and HEVC frames in parts, and their decoders tolerate it.
         frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
       }
 
-      if (packet->frame_timestamp) {
+      // Later parts of a frame don't carry the frame header, so only the first part reports the latency
+      if (has_frame_header && packet->frame_timestamp) {
         auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
           const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
           return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
@@ -1335,21 +2882,33 @@ namespace stream {
         uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
         frame_header.frame_processing_latency = latency;
         frame_processing_latency_logger.collect_and_log(latency / 10.);
+        metrics::video.frame_processing_latency_seconds.observe(latency / 10000.);
       } else {
         frame_header.frame_processing_latency = 0;
       }
 
-      auto fecPercentage = config::stream.fec_percentage;
+      // The packet headers are kept apart from the payload, which is split into shards
+      // directly from the frame header, the replaced head and the rest of the frame.
+      const std::array<std::string_view, 3> frame_payload {
+        std::string_view {(char *) &frame_header, has_frame_header ? sizeof(frame_header) : 0},
+        std::string_view {(char *) payload_head.data(), payload_head.size()},
+        payload,
+      };
+      auto frame_payload_size = frame_payload[0].size() + payload_head.size() + payload.size();
 
-      // Insert space for packet headers
       auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
       auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
-
-      payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+      auto frame_shards = (frame_payload_size + (payload_blocksize - 1)) / payload_blocksize;
 
       // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
-      constexpr auto MAX_FEC_BLOCKS = 4;
+      constexpr auto MAX_FEC_BLOCKS = video_fec::MAX_FEC_BLOCKS;
+
+      // Lower the parity of frames too large for their FEC blocks rather than drop it
+      auto fecPercentage = video_fec::fit_percentage(
+        session->video.fec_protection->frame_percentage(packet->is_idr(), frame_shards),
+        frame_shards,
+        frame_parts ? 1 : MAX_FEC_BLOCKS
+      );
 
       // The max number of data shards per block is found by solving this system of equations for D:
       // D = 255 - P
@@ -1362,47 +2921,99 @@ namespace stream {
 
       // Compute the number of FEC blocks needed for this frame using the block size and max shards
       auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
-      auto fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+      auto fec_blocks_needed = (frame_shards * blocksize + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+
+      // The FEC blocks of this packet start at this block of the frame
+      int first_fec_block = 0;
+      int frame_fec_blocks = fec_blocks_needed;
 
-      // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
-      // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
-      if (fec_blocks_needed > MAX_FEC_BLOCKS) {
+      if (frame_parts) {
+        // Each part of the frame has a FEC block of its own, so a part too large for one FEC block can't have FEC
+        if (fec_blocks_needed > 1) {
+          BOOST_LOG(warning) << "Skipping FEC for abnormally large encoded frame part (needed "sv << fec_blocks_needed << " FEC blocks)"sv;
+          fecPercentage = 0;
+        }
+        fec_blocks_needed = 1;
+        first_fec_block = packet->part_index;
+        frame_fec_blocks = packet->part_count;
+      } else if (fec_blocks_needed > MAX_FEC_BLOCKS) {
+        // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
+        // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
         BOOST_LOG(warning) << "Skipping FEC for abnormally large encoded frame (needed "sv << fec_blocks_needed << " FEC blocks)"sv;
         fecPercentage = 0;
         fec_blocks_needed = MAX_FEC_BLOCKS;
+        frame_fec_blocks = MAX_FEC_BLOCKS;
       }
 
-      std::array<std::string_view, MAX_FEC_BLOCKS> fec_blocks;
-      decltype(fec_blocks)::iterator
-        fec_blocks_begin = std::begin(fec_blocks),
-        fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
+      // The offset and size of each FEC block in the frame payload
+      std::array<std::pair<size_t, size_t>, MAX_FEC_BLOCKS> fec_blocks;
 
-      BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+      logging::log_event("Generating {} FEC blocks", fec_blocks_needed);
 
-      // Align individual FEC blocks to blocksize
-      auto unaligned_size = payload.size() / fec_blocks_needed;
-      auto aligned_size = ((unaligned_size + (blocksize - 1)) / blocksize) * blocksize;
+      // Align individual FEC blocks to shard boundaries
+      auto shards_per_fec_block = (frame_shards + (fec_blocks_needed - 1)) / fec_blocks_needed;
 
       // If we exceed the 10-bit FEC packet index (which means our frame exceeded 4096 packets),
       // the frame will be unrecoverable. Log an error for this case.
-      if (aligned_size / blocksize >= 1024) {
-        BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << (aligned_size / blocksize) << " packets)"sv;
+      if (shards_per_fec_block >= 1024) {
+        BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << shards_per_fec_block << " packets)"sv;
       }
 
       // Split the data into aligned FEC blocks
       for (int x = 0; x < fec_blocks_needed; ++x) {
+        auto offset = x * shards_per_fec_block * payload_blocksize;
         if (x == fec_blocks_needed - 1) {
           // The last block must extend to the end of the payload
-          fec_blocks[x] = payload.substr(x * aligned_size);
+          fec_blocks[x] = {offset, frame_payload_size - offset};
         } else {
           // Earlier blocks just extend to the next block offset
-          fec_blocks[x] = payload.substr(x * aligned_size, aligned_size);
+          fec_blocks[x] = {offset, shards_per_fec_block * payload_blocksize};
         }
       }
 
       try {
-        // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
-        size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
+        // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
+        // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
+        // Every part of a frame shares the timestamp of its first part.
+        bool frame_is_dupe = false;
+        if (!packet->frame_timestamp) {
+          packet->frame_timestamp = has_frame_header ? ratecontrol_next_frame_start : dupe_frame_timestamp;
+          dupe_frame_timestamp = *packet->frame_timestamp;
+          frame_is_dupe = true;
+        }
+        using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
+        uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
+
+        // If video encryption is enabled, we allocate space for the encryption header before each shard
+        const video_frame_info_t frame {
+          packet->frame_index(),
+          timestamp,
+          frame_fec_blocks,
+          frame_payload,
+          payload_blocksize,
+          (size_t) fecPercentage,
+          (size_t) session->config.minRequiredFecPackets,
+          (bool) session->video.cipher,
+        };
+
+        // The sequence numbers and IV counters consumed by each FEC block only depend on
+        // the shard counts, so every block can be prepared independently of the others.
+        std::array<int, MAX_FEC_BLOCKS> block_lowseq;
+        std::array<std::uint64_t, MAX_FEC_BLOCKS> block_gcm_iv_counter;
+        size_t frame_packets = 0;
+        for (int x = 0; x < fec_blocks_needed; ++x) {
+          block_lowseq[x] = lowseq + frame_packets;
+          block_gcm_iv_counter[x] = session->video.gcm_iv_counter + frame_packets;
+
+          auto counts = fec::shard_counts(fec_blocks[x].second, payload_blocksize, frame.fec_percentage, frame.min_parity_shards);
+          frame_packets += counts.data_shards + counts.parity_shards;
+        }
+
+        // Pace at the client's estimated link rate, or slower to spread the frame across part of the frame interval
+        auto frame_interval = session->video.scheduler->frame_interval();
+        // Each part of a frame gets its share of the frame interval
+        frame_interval /= packet->part_count;
+        auto ratecontrol_packets_in_1ms = pacing::packets_in_1ms(session->video.link_estimate->rate(), blocksize, frame_packets, frame_interval, config::stream.pacing_percentage);
 
         // Send less than 64K in a single batch.
         // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
@@ -1413,6 +3024,8 @@ namespace stream {
         // unusually small packet size.
         // Generic Segmentation Offload on Linux can't do more than 64.
         send_batch_size = std::min<size_t>(64, send_batch_size);
+        // Don't burst more than a millisecond worth of packets at slow pacing rates
+        send_batch_size = std::clamp<size_t>(std::ceil(ratecontrol_packets_in_1ms), 1, send_batch_size);
 
         // Don't ignore the last ratecontrol group of the previous frame
         auto ratecontrol_frame_start = std::max(ratecontrol_next_frame_start, std::chrono::steady_clock::now());
@@ -1420,39 +3033,80 @@ namespace stream {
         size_t ratecontrol_frame_packets_sent = 0;
         size_t ratecontrol_group_packets_sent = 0;
 
-        auto blockIndex = 0;
-        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
-          auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
-
-          for (int x = 0; x < packets; ++x) {
-            auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
-
-            inspect->packet.frameIndex = packet->frame_index();
-            inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
+        auto wait_all = [](auto &futures) {
+          for (auto &future : futures) {
+            if (future.valid()) {
+              future.wait();
+            }
+          }
+        };
 
-            // Match multiFecFlags with Moonlight
-            inspect->packet.multiFecFlags = 0x10;
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+        // The workers reference this frame's buffers, so never leave before they're done with them
+        std::array<std::future<fec::fec_t>, MAX_FEC_BLOCKS> encoded_blocks;
+        auto fg = util::fail_guard([&]() {
+          wait_all(encoded_blocks);
+        });
 
-            inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
-            if (x == 0) {
-              inspect->packet.flags |= FLAG_SOF;
-            }
-            if (x == packets - 1) {
-              inspect->packet.flags |= FLAG_EOF;
-            }
+        if (fec_pool) {
+          // Start generating parity for every FEC block now, the first one we can send is the first one done
+          for (int x = 0; x < fec_blocks_needed; ++x) {
+            encoded_blocks[x] = fec_pool->push([&frame, block_index = first_fec_block + x, seq = block_lowseq[x], fec_block = fec_blocks[x]]() {
+              thread_local fec::rs_cache_t worker_rs_cache;
+              return encode_video_fec_block(frame, block_index, seq, fec_block, worker_rs_cache);
+            });
           }
+        }
+
+        for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+          auto block_index = first_fec_block + blockIndex;
 
           frame_fec_latency_logger.first_point_now();
-          // If video encryption is enabled, we allocate space for the encryption header before each shard
-          auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
+          auto shards = fec_pool ?
+                          encoded_blocks[blockIndex].get() :
+                          encode_video_fec_block(frame, block_index, block_lowseq[blockIndex], fec_blocks[blockIndex], rs_cache);
           frame_fec_latency_logger.second_point_now_and_log();
 
+          metrics::video.fec_data_shards.add(shards.data_shards);
+          metrics::video.fec_parity_shards.add(shards.size() - shards.data_shards);
+          session->video.metrics->video_fec_data_shards.add(shards.data_shards);
+          session->video.metrics->video_fec_parity_shards.add(shards.size() - shards.data_shards);
+          session->video.fec_protection->on_sent(shards.data_shards, shards.size() - shards.data_shards);
+
+          auto seq = block_lowseq[blockIndex];
+          auto gcm_iv_counter = block_gcm_iv_counter[blockIndex];
+
+          // Let the workers stamp and encrypt the shards one send batch at a time, so the
+          // first batch can go out while the rest of the FEC block is still being encrypted
+          finalized_batches.clear();
+          auto finalized_fg = util::fail_guard([&]() {
+            wait_all(finalized_batches);
+          });
+          if (fec_pool) {
+            for (size_t first = 0; first < shards.size(); first += send_batch_size) {
+              auto count = std::min(send_batch_size, shards.size() - first);
+
+              finalized_batches.emplace_back(fec_pool->push([&frame, &shards, session, block_index, seq, first, count, gcm_iv_counter]() {
+                // Cipher contexts can't be shared between threads, so each worker keeps its own
+                // until a session with another key comes along
+                thread_local std::optional<crypto::cipher::gcm_t> worker_cipher;
+                crypto::cipher::gcm_t *cipher = nullptr;
+                if (session->video.cipher) {
+                  if (!worker_cipher || worker_cipher->key != session->video.cipher->key || worker_cipher->padding != session->video.cipher->padding) {
+                    worker_cipher.emplace(session->video.cipher->key, session->video.cipher->padding);
+                  }
+                  cipher = &*worker_cipher;
+                }
+
+                finalize_video_shards(frame, block_index, seq, shards, first, count, cipher, gcm_iv_counter, *session->video.metrics);
+              }));
+            }
+          }
+
           auto peer_address = session->video.peer.address();
           auto batch_info = platf::batched_send_info_t {
             shards.headers.begin(),
-            shards.prefixsize,
-            shards.payload_buffers,
+            shards.prefixsize + shards.headersize,
+            {shards.payload_buffers.data(), shards.payload_buffers.size()},
             shards.blocksize,
             0,
             0,
@@ -1463,121 +3117,167 @@ namespace stream {
           };
 
           size_t next_shard_to_send = 0;
+          bool finalized = false;
 
-          // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
-          // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
-          bool frame_is_dupe = false;
-          if (!packet->frame_timestamp) {
-            packet->frame_timestamp = ratecontrol_next_frame_start;
-            frame_is_dupe = true;
-          }
-          using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
-          uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
-
-          // set FEC info now that we know for sure what our percentage will be for this frame
-          for (auto x = 0; x < shards.size(); ++x) {
-            auto *inspect = (video_packet_raw_t *) shards.data(x);
-
-            inspect->packet.fecInfo =
-              (x << 12 |
-               shards.data_shards << 22 |
-               shards.percentage << 4);
-
-            inspect->rtp.header = 0x80 | FLAG_EXTENSION;
-            inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
-            inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
-
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-            inspect->packet.frameIndex = packet->frame_index();
-
-            // Encrypt this shard if video encryption is enabled
-            if (session->video.cipher) {
-              // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-              // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
-              // high bytes is the "fixed" field. Because each client provides their own unique
-              // key, our values in the fixed field need only uniquely identify each independent
-              // use of the client's key with AES-GCM in our code.
-              //
-              // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
-              // to be sent to each client before the IV repeats.
-              std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
-              iv[11] = 'V';  // Video stream
-              session->video.gcm_iv_counter++;
-
-              // Encrypt the target buffer in place
-              auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
-              prefix->frameNumber = packet->frame_index();
-              std::copy(std::begin(iv), std::end(iv), prefix->iv);
-              session->video.cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
+          if (kernel_pacing) {
+            // The whole FEC block goes to the kernel at once, so every batch has to be ready first
+            if (fec_pool) {
+              wait_all(finalized_batches);
+            } else {
+              finalize_video_shards(frame, block_index, seq, shards, 0, shards.size(), session->video.cipher ? &*session->video.cipher : nullptr, gcm_iv_counter, *session->video.metrics);
             }
+            finalized = true;
+
+            // Each batch is due when it would have been sent after sleeping, which is in the past for
+            // the first one unless the previous frame is still going out
+            batch_info.block_count = shards.size();
+            batch_info.txtime_blocks = send_batch_size;
+            batch_info.txtime = ratecontrol_frame_start +
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::duration<double, std::milli> {ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms}
+                                );
+            batch_info.txtime_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::duration<double, std::milli> {send_batch_size / ratecontrol_packets_in_1ms}
+            );
+
+            frame_send_batch_latency_logger.first_point_now();
+            auto send_batch_start = std::chrono::steady_clock::now();
+            frame_trace::scoped_span_t send_span {frame_trace::span_e::send, packet->frame_index()};
+            if (platf::send_batch(batch_info)) {
+              frame_send_batch_latency_logger.second_point_now_and_log();
+              metrics::video.send_batch_seconds.observe(std::chrono::duration<double> {std::chrono::steady_clock::now() - send_batch_start}.count());
+              session->video.metrics->video_bytes.add(shards.size() * (shards.prefixsize + shards.headersize + shards.blocksize));
 
-            if (x - next_shard_to_send + 1 >= send_batch_size ||
-                x + 1 == shards.size()) {
-              // Do pacing within the frame.
-              // Also trigger pacing before the first send_batch() of the frame
-              // to account for the last send_batch() of the previous frame.
-              if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
-                  ratecontrol_frame_packets_sent == 0) {
-                auto due = ratecontrol_frame_start +
-                           std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                             ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
-
-                auto now = std::chrono::steady_clock::now();
-                if (now < due) {
-                  timer->sleep_for(due - now);
-                }
+              ratecontrol_frame_packets_sent += shards.size();
+              next_shard_to_send = shards.size();
+            } else {
+              BOOST_LOG(warning) << "Kernel pacing failed, pacing video packets in Sunshine from now on"sv;
+              kernel_pacing = false;
+            }
 
-                ratecontrol_group_packets_sent = 0;
-              }
+            batch_info.txtime_blocks = 0;
+          }
 
-              size_t current_batch_size = x - next_shard_to_send + 1;
-              batch_info.block_offset = next_shard_to_send;
-              batch_info.block_count = current_batch_size;
-
-              frame_send_batch_latency_logger.first_point_now();
-              // Use a batched send if it's supported on this platform
-              if (!platf::send_batch(batch_info)) {
-                // Batched send is not available, so send each packet individually
-                BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
-                for (auto y = 0; y < current_batch_size; y++) {
-                  auto send_info = platf::send_info_t {
-                    shards.prefix(next_shard_to_send + y),
-                    shards.prefixsize,
-                    shards.data(next_shard_to_send + y),
-                    shards.blocksize,
-                    (uintptr_t) sock.native_handle(),
-                    peer_address,
-                    session->video.peer.port(),
-                    session->localAddress,
-                  };
-
-                  platf::send(send_info);
-                }
+          for (size_t batch = 0; next_shard_to_send < shards.size(); ++batch) {
+            size_t current_batch_size = std::min(send_batch_size, shards.size() - next_shard_to_send);
+
+            if (fec_pool) {
+              finalized_batches[batch].get();
+            } else if (!finalized) {
+              finalize_video_shards(frame, block_index, seq, shards, next_shard_to_send, current_batch_size, session->video.cipher ? &*session->video.cipher : nullptr, gcm_iv_counter, *session->video.metrics);
+            }
+
+            // Do pacing within the frame.
+            // Also trigger pacing before the first send_batch() of the frame
+            // to account for the last send_batch() of the previous frame.
+            if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
+                ratecontrol_frame_packets_sent == 0) {
+              auto due = ratecontrol_frame_start +
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::duration<double, std::milli> {ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms}
+                         );
+
+              auto now = std::chrono::steady_clock::now();
+              if (now < due) {
+                timer->sleep_for(due - now);
               }
-              frame_send_batch_latency_logger.second_point_now_and_log();
 
-              ratecontrol_group_packets_sent += current_batch_size;
-              ratecontrol_frame_packets_sent += current_batch_size;
-              next_shard_to_send = x + 1;
+              ratecontrol_group_packets_sent = 0;
+            }
+
+            batch_info.block_offset = next_shard_to_send;
+            batch_info.block_count = current_batch_size;
+
+            frame_send_batch_latency_logger.first_point_now();
+            auto send_batch_start = std::chrono::steady_clock::now();
+            frame_trace::scoped_span_t send_span {frame_trace::span_e::send, packet->frame_index()};
+            // Use a batched send if it's supported on this platform
+            if (!platf::send_batch(batch_info)) {
+              // Batched send is not available, so send each packet individually
+              BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
+              for (auto y = 0; y < current_batch_size; y++) {
+                auto send_info = platf::send_info_t {
+                  shards.prefix(next_shard_to_send + y),
+                  shards.prefixsize + shards.headersize,
+                  shards.data(next_shard_to_send + y),
+                  shards.blocksize,
+                  (uintptr_t) sock.native_handle(),
+                  peer_address,
+                  session->video.peer.port(),
+                  session->localAddress,
+                };
+
+                platf::send(send_info);
+              }
             }
+            frame_send_batch_latency_logger.second_point_now_and_log();
+            metrics::video.send_batch_seconds.observe(std::chrono::duration<double> {std::chrono::steady_clock::now() - send_batch_start}.count());
+            session->video.metrics->video_bytes.add(current_batch_size * (shards.prefixsize + shards.headersize + shards.blocksize));
+
+            ratecontrol_group_packets_sent += current_batch_size;
+            ratecontrol_frame_packets_sent += current_batch_size;
+            next_shard_to_send += current_batch_size;
           }
 
           // remember this in case the next frame comes immediately
           ratecontrol_next_frame_start = ratecontrol_frame_start +
-                                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+                                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                           std::chrono::duration<double, std::milli> {ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms}
+                                         );
 
           frame_network_latency_logger.second_point_now_and_log();
 
-          BOOST_LOG(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
-                             << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
-                             << (frame_is_dupe ? " Dupe" : "")
-                             << (packet->is_idr() ? " Key" : "")
-                             << (packet->after_ref_frame_invalidation ? " RFI" : "");
+          logging::log_event("Sent Frame seq [{}] pts [{}] shards [{}/{}%] dupe [{}] key [{}] rfi [{}]", packet->frame_index(), timestamp, shards.size(), shards.percentage, frame_is_dupe, packet->is_idr(), packet->after_ref_frame_invalidation);
+
+          if (packet->part_index + 1 == packet->part_count && session->video.recovery.on_sent(packet->frame_index(), recovery_frame, std::chrono::steady_clock::now())) {
+            session->video.metrics->video_recovery_frames.add();
+          }
+
+          // The history keeps a copy of the shards as sent: encrypted sessions slice into shards of their own,
+          // and the others point into the shared payload, which nothing writes past the encoder
+          if (session->video.history) {
+            auto sent = std::chrono::steady_clock::now();
+            for (size_t x = 0; x < shards.size(); ++x) {
+              session->video.history->store(
+                seq + x,
+                {shards.prefix(x), shards.prefixsize + shards.headersize},
+                {shards.data(x), shards.blocksize},
+                sent
+              );
+            }
+          }
 
-          ++blockIndex;
+          if (session->video.cipher) {
+            session->video.gcm_iv_counter += shards.size();
+          }
           lowseq += shards.size();
-        });
+        }
+
+        // With kernel pacing, the last packets are still held back until they're due
+        auto frame_sent = std::chrono::steady_clock::now();
+        if (kernel_pacing) {
+          frame_sent = std::max(frame_sent, ratecontrol_next_frame_start);
+        }
+
+        // Bits per microsecond are Mbps
+        auto frame_send_time_us = std::chrono::duration<double, std::micro> {frame_sent - ratecontrol_frame_start}.count();
+        if (frame_send_time_us > 0) {
+          frame_send_rate_logger.collect_and_log(frame_packets * blocksize * 8 / frame_send_time_us);
+        }
+        frame_pacing_rate_logger.collect_and_log(ratecontrol_packets_in_1ms * blocksize * 8 / 1000);
+
+        // A negative slack means frames are queueing up behind each other
+        session->video.scheduler->record(frame_scheduler::stage_e::send, frame_sent - frame_send_start);
+        if (!frame_is_dupe && packet->part_index == packet->part_count - 1) {
+          auto slack = session->video.scheduler->slack(*packet->frame_timestamp, frame_sent, {});
+          frame_slack_logger.collect_and_log(std::chrono::duration<double, std::milli> {slack}.count());
+          if (slack < 0ns) {
+            session->video.bitrate_control->on_backlog();
+          }
+        }
+        if (packet->part_index == packet->part_count - 1) {
+          session->video.metrics->video_frames.add();
+        }
 
         session->video.lowseq = lowseq;
       } catch (const std::exception &e) {
@@ -1586,40 +3286,43 @@ namespace stream {
       }
     }
 
+    BOOST_LOG(debug) << "FEC encoder cache: "sv << rs_cache.hits() << " hits, "sv << rs_cache.misses() << " misses"sv;
+    log_packet_pool("video"sv);
+
     shutdown_event->raise(true);
   }
 
-  void audioBroadcastThread(udp::socket &sock) {
-    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
-
-    audio_packet_t audio_packet;
-    fec::rs_t rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)};
-    crypto::aes_t iv(16);
-
-    // For unknown reasons, the RS parity matrix computed by our RS implementation
-    // doesn't match the one Nvidia uses for audio data. I'm not exactly sure why,
-    // but we can simply replace it with the matrix generated by OpenFEC which
-    // works correctly. This is possible because the data and FEC shard count is
-    // constant and known in advance.
-    const unsigned char parity[] = {0x77, 0x40, 0x38, 0x0e, 0xc7, 0xa7, 0x0d, 0x6c};
-    memcpy(rs.get()->p, parity, sizeof(parity));
-
-    audio_packet.rtp.header = 0x80;
-    audio_packet.rtp.packetType = 97;
-    audio_packet.rtp.ssrc = 0;
-
-    // Audio traffic is sent on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
-
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
-      }
-
-      TUPLE_2D_REF(channel_data, packet_data, *packet);
-      auto session = (session_t *) channel_data;
+  /**
+   * @brief Numbers, encrypts and sends the audio packets of sessions, along with their FEC shards.
+   * @details The FEC shards of a session are only touched by the thread sending its packets.
+   */
+  class audio_sender_t {
+  public:
+    audio_sender_t():
+        rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)},
+        iv(16) {
+      // For unknown reasons, the RS parity matrix computed by our RS implementation
+      // doesn't match the one Nvidia uses for audio data. I'm not exactly sure why,
+      // but we can simply replace it with the matrix generated by OpenFEC which
+      // works correctly. This is possible because the data and FEC shard count is
+      // constant and known in advance.
+      const unsigned char parity[] = {0x77, 0x40, 0x38, 0x0e, 0xc7, 0xa7, 0x0d, 0x6c};
+      memcpy(rs.get()->p, parity, sizeof(parity));
+
+      audio_packet.rtp.header = 0x80;
+      audio_packet.rtp.packetType = 97;
+      audio_packet.rtp.ssrc = 0;
+    }
 
+    /**
+     * @brief Send a packet to a session.
+     * @param sock The audio socket.
+     * @param session The session.
+     * @param packet_data The encoded packet.
+     * @param captured_at When the samples of the packet were captured.
+     * @return 0 on success, -1 if the packet couldn't be encrypted.
+     */
+    int send(udp::socket &sock, session_t *session, std::span<const std::uint8_t> packet_data, std::chrono::steady_clock::time_point captured_at) {
       auto sequenceNumber = session->audio.sequenceNumber;
       auto timestamp = session->audio.timestamp;
 
@@ -1627,13 +3330,14 @@ namespace stream {
 
       auto &shards_p = session->audio.shards_p;
 
+      // The packet is encrypted straight into its FEC shard, which is also what is sent
       auto bytes = encode_audio(session->config.encryptionFlagsEnabled & SS_ENC_AUDIO, packet_data, shards_p[sequenceNumber % RTPA_DATA_SHARDS], iv, session->audio.cipher);
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio packet"sv;
-        break;
+        return -1;
       }
 
-      BOOST_LOG(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
+      logging::log_event("Audio [seq {}, pts {}] ::  send...", sequenceNumber, timestamp);
 
       audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
       audio_packet.rtp.timestamp = util::endian::big(timestamp);
@@ -1654,6 +3358,11 @@ namespace stream {
           session->localAddress,
         };
         platf::send(send_info);
+        session->video.metrics->audio_packets.add();
+
+        if (captured_at != std::chrono::steady_clock::time_point {} && latency_logger.is_enabled()) {
+          latency_logger.collect_and_log(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - captured_at).count());
+        }
 
         auto &fec_packet = session->audio.fec_packet;
         // initialize the FEC header at the beginning of the FEC block
@@ -1663,10 +3372,12 @@ namespace stream {
         }
 
         // generate parity shards at the end of the FEC block
-        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
+        // Only the leading ones are sent while the link is clean, the client recovers with whatever it gets
+        auto parity_shards = session->audio.fec_protection->parity_shards();
+        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0 && parity_shards > 0) {
           reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
 
-          for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+          for (auto x = 0; x < parity_shards; ++x) {
             fec_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
             fec_packet.fecHeader.fecShardIndex = x;
 
@@ -1681,18 +3392,71 @@ namespace stream {
               session->localAddress,
             };
             platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+            logging::log_event("Audio FEC [{} {}] ::  send...", sequenceNumber & ~(RTPA_DATA_SHARDS - 1), x);
           }
+
+          session->video.metrics->audio_parity_shards_sent.add(parity_shards);
         }
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
         std::this_thread::sleep_for(100ms);
       }
+
+      return 0;
+    }
+
+  private:
+    fec::rs_t rs;
+    crypto::aes_t iv;
+    audio_packet_t audio_packet;
+
+    logging::percentile_periodic_logger<double> latency_logger {debug, "Audio: capture to send latency", "ms", 20s, &metrics::audio.capture_to_send_recent_seconds};
+  };
+
+  void audioBroadcastThread(udp::socket &sock) {
+    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
+
+    audio_sender_t sender;
+
+    // Audio traffic is sent on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    auto placement = thread_affinity::apply(thread_affinity::role_e::audio);
+
+    while (auto packet = packets->pop()) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
+      thread_affinity::follow(thread_affinity::role_e::audio, placement);
+
+      auto session = (session_t *) packet->first;
+      auto &packet_data = packet->second;
+      if (sender.send(sock, session, {std::begin(packet_data), packet_data.size()}, packet->captured_at)) {
+        break;
+      }
     }
 
+    log_packet_pool("audio"sv);
+
     shutdown_event->raise(true);
   }
 
+  /**
+   * @brief Open the socket of a streaming server, letting the platform pick how it's sent on.
+   * @param sock The socket.
+   * @param protocol The protocol of the socket.
+   * @param ec Set on error.
+   */
+  void open_stream_socket(udp::socket &sock, const udp &protocol, boost::system::error_code &ec) {
+    if (auto native_socket = platf::open_stream_socket(protocol == udp::v6())) {
+      sock.assign(protocol, *native_socket, ec);
+      return;
+    }
+
+    sock.open(protocol, ec);
+  }
+
   int start_broadcast(broadcast_ctx_t &ctx) {
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
     auto protocol = address_family == net::IPV4 ? udp::v4() : udp::v6();
@@ -1707,7 +3471,7 @@ namespace stream {
     }
 
     boost::system::error_code ec;
-    ctx.video_sock.open(protocol, ec);
+    open_stream_socket(ctx.video_sock, protocol, ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Video server: "sv << ec.message();
 
@@ -1728,7 +3492,7 @@ namespace stream {
       return -1;
     }
 
-    ctx.audio_sock.open(protocol, ec);
+    open_stream_socket(ctx.audio_sock, protocol, ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Audio server: "sv << ec.message();
 
@@ -1743,8 +3507,27 @@ namespace stream {
     }
 
     ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30);
+    ctx.delay_queue = std::make_shared<delay_queue_t::element_type>(30);
+
+    if (platf::enable_socket_rx_timestamps((std::uintptr_t) ctx.video_sock.native_handle())) {
+      BOOST_LOG(debug) << "Video pings are timestamped by the kernel"sv;
+    }
+
+    // The sends on the video socket are serialized by the platform, so the threads share it
+    auto video_threads = config::stream.video_broadcast_threads;
+    if (video_threads == 0) {
+      video_threads = (int) std::clamp(std::thread::hardware_concurrency() / 4, 1u, 4u);
+    }
+    BOOST_LOG(info) << "Sending video from "sv << video_threads << " broadcast thread(s)"sv;
+
+    for (int x = 0; x < video_threads; ++x) {
+      auto shard = std::make_unique<video_shard_t>();
+      shard->packets = std::make_shared<safe::mail_raw_t::queue_t<video::packet_t>::element_type>(mail::man, 32);
+      shard->thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock), shard.get()};
+
+      ctx.video_shards.emplace_back(std::move(shard));
+    }
 
-    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock)};
     ctx.audio_thread = std::thread {audioBroadcastThread, std::ref(ctx.audio_sock)};
     ctx.control_thread = std::thread {controlBroadcastThread, &ctx.control_server};
 
@@ -1757,27 +3540,32 @@ namespace stream {
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
 
     broadcast_shutdown_event->raise(true);
+    ctx.control_server.wake();
 
-    auto video_packets = mail::man->queue<video::packet_t>(mail::video_packets);
     auto audio_packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
 
     // Minimize delay stopping video/audio threads
-    video_packets->stop();
+    for (auto &shard : ctx.video_shards) {
+      shard->packets->stop();
+    }
     audio_packets->stop();
 
     ctx.message_queue_queue->stop();
+    ctx.delay_queue->stop();
     ctx.io_context.stop();
 
     ctx.video_sock.close();
     ctx.audio_sock.close();
 
-    video_packets.reset();
     audio_packets.reset();
 
     BOOST_LOG(debug) << "Waiting for main listening thread to end..."sv;
     ctx.recv_thread.join();
-    BOOST_LOG(debug) << "Waiting for main video thread to end..."sv;
-    ctx.video_thread.join();
+    BOOST_LOG(debug) << "Waiting for main video threads to end..."sv;
+    for (auto &shard : ctx.video_shards) {
+      shard->thread.join();
+    }
+    ctx.video_shards.clear();
     BOOST_LOG(debug) << "Waiting for main audio thread to end..."sv;
     ctx.audio_thread.join();
     BOOST_LOG(debug) << "Waiting for main control thread to end..."sv;
@@ -1810,10 +3598,10 @@ namespace stream {
     auto start_time = std::chrono::steady_clock::now();
     auto current_time = start_time;
 
-    while (current_time - start_time < config::stream.ping_timeout) {
+    while (current_time - start_time < config::stream.ping_timeout.load()) {
       auto delta_time = current_time - start_time;
 
-      auto msg_opt = messages->pop(config::stream.ping_timeout - delta_time);
+      auto msg_opt = messages->pop(config::stream.ping_timeout.load() - delta_time);
       if (!msg_opt) {
         break;
       }
@@ -1857,8 +3645,43 @@ namespace stream {
     auto address = session->video.peer.address();
     session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
 
+    // The client sizes its receive buffers from the packet size it asked for, so it can't be raised here,
+    // but shards larger than the path MTU get fragmented and a single lost fragment loses the whole shard
+    {
+      auto ip_header_size = address.is_v4() || address.to_v6().is_v4_mapped() ? 20 : 40;
+      auto datagram_size = session->config.packetsize + MAX_RTP_HEADER_SIZE + (session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0) + 8 + ip_header_size;
+      session->video.metrics->video_datagram_bytes.set((double) datagram_size);
+
+      if (auto mtu = platf::path_mtu(address, session->video.peer.port())) {
+        session->video.metrics->path_mtu_bytes.set(*mtu);
+
+        if (datagram_size > *mtu) {
+          BOOST_LOG(warning) << "Video packets of "sv << datagram_size << " bytes exceed the path MTU of "sv << *mtu << " bytes to the client and will be fragmented, lower the packet size of the client"sv;
+        } else if (*mtu - datagram_size >= session->config.packetsize) {
+          BOOST_LOG(info) << "The path MTU of "sv << *mtu << " bytes to the client could carry larger video packets than "sv << datagram_size << " bytes"sv;
+        }
+      }
+    }
+
+    // Only pings carrying the session's payload also carry a sequence number
+    if (session->config.mlFeatureFlags & ML_FF_SESSION_ID_V1) {
+      ref->delay_queue->raise(session->video.ping_payload, session->video.delay);
+    }
+    auto delay_fg = util::fail_guard([&]() {
+      if (session->config.mlFeatureFlags & ML_FF_SESSION_ID_V1) {
+        ref->delay_queue->raise(session->video.ping_payload, nullptr);
+      }
+    });
+
+    // The packets of a replay are handed to the broadcast thread by session::replay_video()
+    if (session->config.replay) {
+      BOOST_LOG(debug) << "Start replaying Video"sv;
+      session->shutdown_event->view();
+      return;
+    }
+
     BOOST_LOG(debug) << "Start capturing Video"sv;
-    video::capture(session->mail, session->config.monitor, session);
+    video::capture(session->mail, session->config.monitor, session, session->video.shard->packets, *session->video.scheduler);
   }
 
   void audioThread(session_t *session) {
@@ -1878,8 +3701,17 @@ namespace stream {
     auto address = session->audio.peer.address();
     session->audio.qos = platf::enable_socket_qos(ref->audio_sock.native_handle(), address, session->audio.peer.port(), platf::qos_data_type_e::audio, session->config.audioQosType != 0);
 
+    audio::send_packet_cb_t send_packet;
+    if (config::audio.fused_pipeline) {
+      send_packet = [session, &sock = ref->audio_sock](std::span<const std::uint8_t> packet, std::chrono::steady_clock::time_point captured_at) {
+        // A capture thread sends the packets of all its sessions one at a time
+        thread_local audio_sender_t sender;
+        sender.send(sock, session, packet, captured_at);
+      };
+    }
+
     BOOST_LOG(debug) << "Start capturing Audio"sv;
-    audio::capture(session->mail, session->config.audio, session);
+    audio::capture(session->mail, session->config.audio, session, std::move(send_packet));
   }
 
   namespace session {
@@ -1898,6 +3730,37 @@ namespace stream {
       }
 
       session.shutdown_event->raise(true);
+
+      // Let the control stream thread clean up the session now rather than on its next poll
+      session.broadcast_ref->control_server.wake();
+    }
+
+    /**
+     * @brief Keep what a session learned about its client's link for the client's next session.
+     */
+    static void store_client_stats(session_t &session) {
+      if (!config::stream.warm_start || session.client_uuid.empty() || session.config.replay ||
+          std::chrono::steady_clock::now() - session.started < WARM_START_MIN_SESSION) {
+        return;
+      }
+
+      auto &metrics = *session.video.metrics;
+      auto shards = metrics.video_fec_data_shards.value() + metrics.video_fec_parity_shards.value();
+      if (shards == 0) {
+        return;
+      }
+
+      client_stats::stats_t stats {
+        session.video.bitrate_control->bitrate(),
+        (double) metrics.video_packets_lost.value() / shards,
+        session.video.fec_protection->percentage(),
+        session.video.link_estimate->rate(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(session.video.delay->rtt()),
+      };
+      client_stats::store(client_stats::default_file(), session.client_uuid, stats, std::chrono::system_clock::now());
+
+      BOOST_LOG(debug) << "Stored statistics of client ["sv << session.client_uuid << "]: "sv << stats.bitrate << " kbps, "sv
+                       << stats.loss_rate * 100 << "% loss, "sv << stats.fec_percentage << "% FEC, "sv << stats.rtt.count() << " ms RTT"sv;
     }
 
     void join(session_t &session) {
@@ -1917,10 +3780,12 @@ namespace stream {
 
       BOOST_LOG(debug) << "Waiting for video to end..."sv;
       session.videoThread.join();
+      --session.video.shard->sessions;
       BOOST_LOG(debug) << "Waiting for audio to end..."sv;
       session.audioThread.join();
       BOOST_LOG(debug) << "Waiting for control to end..."sv;
       session.controlEnd.view();
+      store_client_stats(session);
       // Reset input on session stop to avoid stuck repeated keys
       BOOST_LOG(debug) << "Resetting Input..."sv;
       input::reset(session.input);
@@ -1942,6 +3807,18 @@ namespace stream {
         }
 
         platf::streaming_will_stop();
+
+        // Nobody is going to reconnect
+        if (!mail::man->event<bool>(mail::shutdown)->peek()) {
+          park_broadcast(session.broadcast_ref);
+        }
+      }
+
+      if (auto avoided = session.video.metrics->video_idr_frames_avoided.value()) {
+        BOOST_LOG(info) << "Answered "sv << avoided << " reference frame invalidations with a frame that was already sent or on its way"sv;
+      }
+      if (auto debounced = session.video.metrics->video_idr_requests_debounced.value()) {
+        BOOST_LOG(info) << "Answered "sv << debounced << " IDR frame requests with an IDR frame that was already sent or on its way"sv;
       }
 
       BOOST_LOG(debug) << "Session ended"sv;
@@ -1958,11 +3835,20 @@ namespace stream {
       session.control.expected_peer_address = addr_string;
       BOOST_LOG(debug) << "Expecting incoming session connections from "sv << addr_string;
 
-      // Insert this session into the session list
-      {
-        auto lg = session.broadcast_ref->control_server._sessions.lock();
-        session.broadcast_ref->control_server._sessions->push_back(&session);
-      }
+      // Insert this session into the session table
+      session.broadcast_ref->control_server._sessions.update([&](session_table_t &table) {
+        table.sessions.push_back({
+          &session,
+          nullptr,
+          session.config.mlFeatureFlags & ML_FF_SESSION_ID_V1 ? std::optional {session.control.connect_data} : std::nullopt,
+          addr_string,
+        });
+        table.index();
+      });
+
+      // Send feedback and HDR metadata as soon as they're queued
+      session.control.feedback_queue->notify_with(session.broadcast_ref->control_server.waker());
+      session.control.hdr_queue->notify_with(session.broadcast_ref->control_server.waker());
 
       auto addr = boost::asio::ip::make_address(addr_string);
       session.video.peer.address(addr);
@@ -1971,7 +3857,15 @@ namespace stream {
       session.audio.peer.address(addr);
       session.audio.peer.port(0);
 
-      session.pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      session.started = std::chrono::steady_clock::now();
+      session.pingTimeout = session.started + config::stream.ping_timeout.load();
+
+      // Send the session from the video broadcast thread with the fewest sessions
+      auto &shards = session.broadcast_ref->video_shards;
+      session.video.shard = std::min_element(std::begin(shards), std::end(shards), [](auto &a, auto &b) {
+                              return a->sessions < b->sessions;
+                            })->get();
+      ++session.video.shard->sessions;
 
       session.audioThread = std::thread {audioThread, &session};
       session.videoThread = std::thread {videoThread, &session};
@@ -1996,6 +3890,7 @@ namespace stream {
 
       session->shutdown_event = mail->event<bool>(mail::shutdown);
       session->launch_session_id = launch_session.id;
+      session->client_uuid = launch_session.client_uuid;
 
       session->config = config;
 
@@ -2010,8 +3905,81 @@ namespace stream {
 
       session->video.idr_events = mail->event<bool>(mail::idr);
       session->video.invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+      session->video.acknowledged_frame_events = mail->event<int64_t>(mail::acknowledged_frame);
+      session->video.bitrate_events = mail->event<int>(mail::bitrate);
+      session->video.max_frame_size_events = mail->event<int64_t>(mail::max_frame_size);
+      session->video.quality_events = mail->event<video_quality::sample_t>(mail::encode_quality);
       session->video.lowseq = 0;
       session->video.ping_payload = launch_session.av_ping_payload;
+
+      // Start from what the client's last sessions learned about its link, instead of rediscovering it
+      std::optional<client_stats::entry_t> warm_start;
+      if (config::stream.warm_start && !launch_session.client_uuid.empty() && !config.replay) {
+        warm_start = client_stats::load(client_stats::default_file(), launch_session.client_uuid, std::chrono::system_clock::now());
+      }
+
+      // Leave headroom above the video bitrate for FEC and bursty frames
+      std::optional<std::uint64_t> start_link_rate;
+      if (warm_start && warm_start->stats.link_rate > 0) {
+        start_link_rate = (std::uint64_t) client_stats::blend((double) pacing::link_estimate_t::DEFAULT_RATE, (double) warm_start->stats.link_rate, warm_start->weight);
+      }
+      session->video.link_estimate = std::make_unique<pacing::link_estimate_t>((std::uint64_t) config.monitor.bitrate * 1000 * 2, std::chrono::steady_clock::now(), start_link_rate);
+      session->video.delay = std::make_shared<delay::estimate_t>();
+      if (warm_start && warm_start->stats.rtt > 0ms) {
+        session->video.delay->seed(warm_start->stats.rtt);
+      }
+      if (config::stream.video_retransmission) {
+        session->video.history = std::make_unique<retransmit::history_t>(
+          VIDEO_RETRANSMIT_HISTORY,
+          config.packetsize + MAX_RTP_HEADER_SIZE + sizeof(video_packet_enc_prefix_t)
+        );
+      }
+      session->video.scheduler = std::make_unique<frame_scheduler::scheduler_t>(
+        config.monitor.framerateX100 > 0 ?
+          std::chrono::nanoseconds {std::chrono::seconds {100}} / config.monitor.framerateX100 :
+          std::chrono::nanoseconds {std::chrono::seconds {1}} / std::max(config.monitor.framerate, 1)
+      );
+      session->video.metrics = metrics::add_session(launch_session.id);
+
+      // Without adaptive bitrate, the bitrate stays where the client asked for it
+      auto max_bitrate = config::video.max_bitrate > 0 ? std::min(config.monitor.bitrate, config::video.max_bitrate) : config.monitor.bitrate;
+      std::optional<int> start_bitrate;
+      if (warm_start && config::stream.adaptive_bitrate) {
+        start_bitrate = (int) std::lround(client_stats::blend(max_bitrate, std::min(warm_start->stats.bitrate, max_bitrate), warm_start->weight));
+      }
+      session->video.bitrate_control = std::make_unique<bitrate_control::controller_t>(
+        config::stream.adaptive_bitrate ? (int) (max_bitrate * bitrate_control::controller_t::MIN_FRACTION) : max_bitrate,
+        max_bitrate,
+        std::chrono::steady_clock::now(),
+        start_bitrate
+      );
+      session->video.metrics->target_bitrate.set((double) session->video.bitrate_control->bitrate() * 1000);
+
+      // The encoder is created at the bitrate the client asked for, and lowered to the warm start right away
+      if (session->video.bitrate_control->bitrate() < max_bitrate) {
+        session->video.bitrate_events->raise(session->video.bitrate_control->bitrate());
+      }
+
+      // FEC starts from the percentage that covered the client's loss last time
+      auto fec_percentage = config::stream.fec_percentage;
+      if (warm_start && config::stream.adaptive_fec) {
+        auto learned = std::max<double>(warm_start->stats.fec_percentage, warm_start->stats.loss_rate * video_fec::protection_t::LOSS_HEADROOM * 100);
+        fec_percentage = (int) std::lround(client_stats::blend(fec_percentage, learned, warm_start->weight));
+      }
+
+      if (warm_start) {
+        BOOST_LOG(info) << "Starting from the statistics of client ["sv << launch_session.client_uuid << "]: "sv
+                        << session->video.bitrate_control->bitrate() << " kbps, "sv << fec_percentage << "% FEC, weighed "sv << warm_start->weight;
+      }
+
+      // Without adaptive FEC, every frame gets the configured percentage
+      session->video.fec_protection = std::make_unique<video_fec::protection_t>(
+        fec_percentage,
+        config::stream.adaptive_fec ? video_fec::protection_t::MIN_PERCENTAGE : config::stream.fec_percentage,
+        config::stream.adaptive_fec ? std::max(config::stream.fec_percentage, video_fec::protection_t::MAX_PERCENTAGE) : config::stream.fec_percentage,
+        std::chrono::steady_clock::now()
+      );
+      session->video.metrics->video_fec_percentage.set(session->video.fec_protection->percentage());
       if (config.encryptionFlagsEnabled & SS_ENC_VIDEO) {
         BOOST_LOG(info) << "Video encryption enabled"sv;
         session->video.cipher = crypto::cipher::gcm_t {
@@ -2023,7 +3991,8 @@ namespace stream {
 
       constexpr auto max_block_size = crypto::cipher::round_to_pkcs7_padded(2048);
 
-      util::buffer_t<char> shards {RTPA_TOTAL_SHARDS * max_block_size};
+      buffer_pool::buffer_t<char> shards {RTPA_TOTAL_SHARDS * max_block_size};
+      std::fill(std::begin(shards), std::end(shards), 0);
       util::buffer_t<uint8_t *> shards_p {RTPA_TOTAL_SHARDS};
 
       for (auto x = 0; x < RTPA_TOTAL_SHARDS; ++x) {
@@ -2043,6 +4012,12 @@ namespace stream {
       session->audio.fec_packet.fecHeader.payloadType = 97;
       session->audio.fec_packet.fecHeader.ssrc = 0;
 
+      // Without adaptive FEC, every parity shard is always sent
+      session->audio.fec_protection = std::make_unique<audio_fec::protection_t>(
+        config::audio.adaptive_fec ? 0 : audio_fec::protection_t::MAX_PARITY_SHARDS,
+        std::chrono::steady_clock::now()
+      );
+
       session->audio.cipher = crypto::cipher::cbc_t {
         launch_session.gcm_key,
         true
@@ -2053,6 +4028,30 @@ namespace stream {
       session->audio.sequenceNumber = 0;
       session->audio.timestamp = 0;
 
+      // A replay isn't recorded again
+      if (config::sunshine.session_recording && !config.replay) {
+        auto dir = platf::appdata() / "recordings"sv;
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        auto path = dir / ("session-"s + std::to_string(launch_session.id) + '-' + std::to_string(seconds) + ".sunrec");
+        session->recording = std::make_unique<session_recording::writer_t>(path);
+        if (session->recording->is_open()) {
+          BOOST_LOG(info) << "Recording the session to "sv << path;
+
+          session->recording->write_config({
+            config.monitor,
+            config.packetsize,
+            config.minRequiredFecPackets,
+            config.mlFeatureFlags,
+            config.encryptionFlagsEnabled,
+          });
+        } else {
+          session->recording.reset();
+        }
+      }
+
       session->control.peer = nullptr;
       session->state.store(state_e::STOPPED, std::memory_order_relaxed);
 
@@ -2060,5 +4059,31 @@ namespace stream {
 
       return session;
     }
+
+    void replay_video(session_t &session, video::packet_t packet) {
+      packet->channel_data = &session;
+      session.video.shard->packets->raise(std::move(packet));
+    }
+
+    void replay_control(session_t &session, std::uint16_t type, std::string_view payload) {
+      {
+        std::lock_guard lg {session.control.replay.lock};
+        session.control.replay.messages.push_back({type, std::string {payload}});
+      }
+      session.broadcast_ref->control_server.wake();
+    }
+
+    void replay_input(session_t &session, std::string_view payload) {
+      {
+        std::lock_guard lg {session.control.replay.lock};
+        session.control.replay.messages.push_back({std::nullopt, std::string {payload}});
+      }
+      session.broadcast_ref->control_server.wake();
+    }
+
+    void replay_rtt(session_t &session, std::chrono::milliseconds rtt) {
+      std::lock_guard lg {session.control.replay.lock};
+      session.control.replay.rtt = rtt;
+    }
   }  // namespace session
 }  // namespace stream
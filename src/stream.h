@@ -5,14 +5,33 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/asio.hpp>
 
+extern "C" {
+#include "rswrapper.h"
+}
+
 // local includes
 #include "audio.h"
+#include "buffer_pool.h"
 #include "crypto.h"
+#include "metrics.h"
+#include "platform/common.h"
 #include "video.h"
 
 namespace stream {
@@ -36,8 +55,799 @@ namespace stream {
     uint32_t encryptionFlagsEnabled;
 
     std::optional<int> gcmap;
+
+    bool replay = false;  ///< The video, control messages and input come from a recording instead of the client
+  };
+
+  namespace fec {
+    void free_rs(reed_solomon *rs);
+
+    using rs_t = util::safe_ptr<reed_solomon, free_rs>;
+
+    /**
+     * @brief A bounded LRU cache of Reed-Solomon encoders keyed by shard counts.
+     * @details Creating an encoder computes its parity matrix, which costs far more than
+     *          encoding a single FEC block. Consecutive video frames keep hitting the same
+     *          handful of shard geometries, so recently used encoders are kept around.
+     * @note This is not thread-safe. Each sending thread should own its own cache.
+     */
+    class rs_cache_t {
+    public:
+      explicit rs_cache_t(std::size_t capacity = 32);
+
+      /**
+       * @brief Get an encoder for the given shard counts, creating it on a cache miss.
+       * @param data_shards The number of data shards.
+       * @param parity_shards The number of parity shards.
+       * @return The encoder owned by the cache, or `nullptr` if it couldn't be created.
+       */
+      reed_solomon *get(int data_shards, int parity_shards);
+
+      std::uint64_t hits() const {
+        return _hits;
+      }
+
+      std::uint64_t misses() const {
+        return _misses;
+      }
+
+      std::size_t size() const {
+        return _entries.size();
+      }
+
+    private:
+      struct entry_t {
+        int data_shards;
+        int parity_shards;
+        rs_t rs;
+      };
+
+      // Most recently used encoders are kept at the front
+      std::vector<entry_t> _entries;
+      std::size_t _capacity;
+
+      std::uint64_t _hits = 0;
+      std::uint64_t _misses = 0;
+    };
+
+    struct fec_t {
+      size_t data_shards;
+      size_t nr_shards;
+      size_t percentage;
+
+      size_t blocksize;
+      size_t headersize;
+      size_t prefixsize;
+      // Every buffer of a FEC block comes from the packet pool, so sending a frame doesn't allocate
+      buffer_pool::buffer_t<char> shards;
+      buffer_pool::buffer_t<char> headers;
+      buffer_pool::buffer_t<uint8_t *> shards_p;
+
+      // Where the payload of each shard is read from. Only writable data shards differ from the shards sent.
+      buffer_pool::buffer_t<uint8_t *> sources_p;
+
+      buffer_pool::buffer_t<platf::buffer_descriptor_t> payload_buffers;
+
+      /**
+       * @brief Get the payload of a shard, as it's sent.
+       */
+      char *data(size_t el) {
+        return (char *) shards_p[el];
+      }
+
+      /**
+       * @brief Get the payload of a shard before it's encrypted, which parity is computed over.
+       */
+      const char *source(size_t el) {
+        return (const char *) sources_p[el];
+      }
+
+      /**
+       * @brief Get the start of the headers sent before the payload of a shard.
+       * @details The optional prefix comes first, followed by the packet header covered by FEC.
+       */
+      char *prefix(size_t el) {
+        return &headers[el * (prefixsize + headersize)];
+      }
+
+      /**
+       * @brief Get the packet header of a shard.
+       */
+      char *header(size_t el) {
+        return prefix(el) + prefixsize;
+      }
+
+      size_t size() const {
+        return nr_shards;
+      }
+    };
+
+    /**
+     * @brief Split part of a payload into the data shards of a FEC block.
+     * @details Data shards point straight into the payload buffers. Only the shards that straddle
+     *          two buffers and the zero-padded final shard are copied. The payload is never written to,
+     *          since it's the buffer of the encoder shared by every session it streams to.
+     * @param payload The payload, which may be split across several buffers.
+     * @param offset The offset of the FEC block in the payload.
+     * @param size The size of the FEC block.
+     * @param blocksize The size of the payload of each shard.
+     * @param fecpercentage The requested FEC percentage.
+     * @param minparityshards The minimum number of parity shards.
+     * @param headersize The size of the packet header of each shard, which is protected by FEC.
+     * @param prefixsize The size of the prefix before each packet header, which isn't protected by FEC.
+     * @param writable Whether the data shards are written to, like when they're encrypted. Every data shard then
+     *                 gets a buffer of its own, while its payload is read from `source()` until it's written.
+     * @return The shards, with zeroed headers and parity not yet computed.
+     */
+    fec_t slice(std::span<const std::string_view> payload, size_t offset, size_t size, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t headersize, size_t prefixsize, bool writable = false);
+
+    /**
+     * @brief Compute the parity shards of a FEC block.
+     * @details Packet headers and payloads are encoded as if they were contiguous in each shard.
+     *          The parity of the payloads is computed over their sources.
+     * @param fec The shards of the FEC block, with their packet headers already filled in.
+     * @param rs_cache The Reed-Solomon encoder cache of the calling thread.
+     */
+    void encode(fec_t &fec, rs_cache_t &rs_cache);
+  }  // namespace fec
+
+  namespace pacing {
+    /**
+     * @brief Estimates the rate a client's link can take video at from its control stream feedback.
+     * @details The estimate backs off when the client reports lost packets or frames, or when the
+     *          control stream round trip time rises well above its minimum, which means queues are
+     *          building up along the path. It slowly grows again while the link stays clean.
+     * @note Feedback must come from a single thread, but `rate()` may be read from any thread.
+     */
+    class link_estimate_t {
+    public:
+      static constexpr std::uint64_t DEFAULT_RATE = 800'000'000;  ///< 80% of 1Gbps
+      static constexpr std::uint64_t MAX_RATE = 10'000'000'000;  ///< 10Gbps
+
+      /**
+       * @param min_rate The rate the estimate never drops below, in bits per second.
+       * @param now The time the session started.
+       * @param start_rate The rate to start at, in bits per second, instead of `DEFAULT_RATE`.
+       */
+      link_estimate_t(std::uint64_t min_rate, std::chrono::steady_clock::time_point now, std::optional<std::uint64_t> start_rate = std::nullopt);
+
+      /**
+       * @brief Handle the client reporting lost video packets or frames.
+       * @param now The time of the report.
+       */
+      void on_loss(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Handle a new round trip time sample.
+       * @param rtt The round trip time.
+       * @param now The time of the sample.
+       * @param jitter The jitter of the path, which widens the delay the estimate tolerates before backing off.
+       */
+      void on_rtt(std::chrono::milliseconds rtt, std::chrono::steady_clock::time_point now, std::chrono::microseconds jitter = {});
+
+      /**
+       * @brief Get the estimated link rate in bits per second.
+       */
+      std::uint64_t rate() const {
+        return _rate.load(std::memory_order_relaxed);
+      }
+
+    private:
+      void decrease(double factor, std::chrono::steady_clock::time_point now);
+
+      std::atomic<std::uint64_t> _rate;
+      std::uint64_t _min_rate;
+
+      std::chrono::milliseconds _min_rtt;
+      std::chrono::steady_clock::time_point _last_loss;
+      std::chrono::steady_clock::time_point _last_decrease;
+      std::chrono::steady_clock::time_point _last_increase;
+    };
+
+    /**
+     * @brief Get the rate to send the packets of a frame at.
+     * @details Packets are sent at the link rate, unless the frame can be spread across the requested
+     *          percentage of the frame interval at a lower rate.
+     * @param link_rate The estimated link rate in bits per second.
+     * @param packet_size The size of each packet.
+     * @param frame_packets The number of packets in the frame.
+     * @param frame_interval The time between two frames.
+     * @param frame_percentage The percentage of the frame interval to spread the frame across, or 0 to send at the link rate.
+     * @return The number of packets to send each millisecond.
+     */
+    double packets_in_1ms(std::uint64_t link_rate, std::size_t packet_size, std::size_t frame_packets, std::chrono::nanoseconds frame_interval, int frame_percentage);
+
+    /**
+     * @brief Get the largest frame the link can take in part of the frame interval, along with its FEC shards.
+     * @param link_rate The estimated link rate in bits per second.
+     * @param frame_interval The time between two frames.
+     * @param frame_percentage The percentage of the frame interval sending a frame may take.
+     * @param fec_percentage The FEC shards sent for each 100 data shards.
+     * @return The size of the frame in bits, or 0 without a limit.
+     */
+    std::uint64_t max_frame_size(std::uint64_t link_rate, std::chrono::nanoseconds frame_interval, int frame_percentage, int fec_percentage);
+
+    /**
+     * @brief Get the time a frame is displayed too late, if it is sent after it.
+     * @details The time a frame spent being encoded counts along with the time it waited to be sent,
+     *          since both delay it on the client's screen.
+     * @param frame_timestamp When the frame was captured, if the encoder knows it.
+     * @param queued_timestamp When the frame was handed to the broadcast thread, for frames without a capture time.
+     * @param frame_interval The time between two frames.
+     * @param frame_percentage The percentage of the frame interval the frame may take.
+     * @return The deadline.
+     */
+    std::chrono::steady_clock::time_point send_deadline(std::optional<std::chrono::steady_clock::time_point> frame_timestamp, std::chrono::steady_clock::time_point queued_timestamp, std::chrono::nanoseconds frame_interval, int frame_percentage);
+
+    /**
+     * @brief Remembers the last frames the video broadcast thread dropped on purpose.
+     * @details The client sees the gap they leave in the frame indices, and reports it like frames lost
+     *          on the way. Consecutive frames are kept as one run, and only the last `MAX_RUNS` runs are kept,
+     *          which covers the reports of a round trip time.
+     * @note Safe to call from any thread.
+     */
+    class dropped_frames_t {
+    public:
+      static constexpr std::size_t MAX_RUNS = 16;
+
+      /**
+       * @brief Remember a dropped frame.
+       * @param frame_index The index of the frame.
+       */
+      void add(std::int64_t frame_index);
+
+      /**
+       * @brief Check if every frame of a range was dropped on purpose.
+       * @param first_frame The first frame of the range.
+       * @param last_frame The last frame of the range.
+       * @return `true` if the range holds no frame that was sent.
+       */
+      bool contains(std::int64_t first_frame, std::int64_t last_frame) const;
+
+    private:
+      mutable std::mutex _lock;
+      std::array<std::pair<std::int64_t, std::int64_t>, MAX_RUNS> _runs {};
+      std::size_t _next = 0;
+      std::size_t _size = 0;
+    };
+  }  // namespace pacing
+
+  namespace delay {
+    /**
+     * @brief Tracks the round trip time, queueing delay and jitter of a client's path.
+     * @details The queueing delay is how far the control stream round trip time rose above the lowest
+     *          one seen, which is the delay of the path with empty queues. The jitter is estimated from
+     *          the arrival times of the client's video pings like RFC 3550 does from RTP timestamps:
+     *          pings are sent at a steady pace, so any deviation from that pace was picked up on the way.
+     *          Arrival times come from the kernel when the socket stamps datagrams.
+     * @note Round trip times and pings may each come from their own thread, and the estimates may be
+     *       read from any thread.
+     */
+    class estimate_t {
+    public:
+      static constexpr std::uint32_t MAX_SEQUENCE_GAP = 16;  ///< Pings further apart than this aren't compared with each other
+
+      /**
+       * @brief Handle a new round trip time sample.
+       * @param rtt The round trip time.
+       */
+      void on_rtt(std::chrono::milliseconds rtt);
+
+      /**
+       * @brief Start from a round trip time learned in an earlier session, until the first sample comes in.
+       * @details The lowest round trip time isn't seeded, since a worse path now would pass for queueing delay.
+       * @param rtt The round trip time.
+       */
+      void seed(std::chrono::milliseconds rtt);
+
+      /**
+       * @brief Handle a video ping from the client.
+       * @param sequence The sequence number of the ping.
+       * @param received The time the ping was received.
+       */
+      void on_ping(std::uint32_t sequence, std::chrono::steady_clock::time_point received);
+
+      /**
+       * @brief Get the last round trip time.
+       */
+      std::chrono::microseconds rtt() const {
+        return std::chrono::microseconds {_rtt.load(std::memory_order_relaxed)};
+      }
+
+      /**
+       * @brief Get how far the last round trip time was above the lowest one.
+       */
+      std::chrono::microseconds queueing_delay() const {
+        return std::chrono::microseconds {_queueing_delay.load(std::memory_order_relaxed)};
+      }
+
+      /**
+       * @brief Get the jitter of the pings.
+       */
+      std::chrono::microseconds jitter() const {
+        return std::chrono::microseconds {_jitter.load(std::memory_order_relaxed)};
+      }
+
+    private:
+      std::atomic<std::int64_t> _rtt {0};
+      std::atomic<std::int64_t> _queueing_delay {0};
+      std::atomic<std::int64_t> _jitter {0};
+
+      std::chrono::milliseconds _min_rtt {std::chrono::milliseconds::max()};
+
+      std::optional<std::uint32_t> _last_sequence;
+      std::chrono::steady_clock::time_point _last_received;
+      std::chrono::duration<double, std::micro> _interval {};
+      double _jitter_us = 0;
+    };
+  }  // namespace delay
+
+  namespace retransmit {
+    /**
+     * @brief Keeps the video shards sent last, so those a client reports missing can be sent again.
+     * @details Shards are kept exactly as they went out, encryption included, in a ring of slots indexed
+     *          by their sequence number. A slot is overwritten once the sequence numbers wrap around the ring,
+     *          and shards older than `MAX_AGE` aren't sent again, since the client has moved past their frame.
+     * @note This is thread-safe.
+     */
+    class history_t {
+    public:
+      static constexpr auto MAX_AGE = std::chrono::milliseconds {100};
+      static constexpr std::uint32_t SEQUENCE_MASK = 0xFFFFFF;  ///< Video packets carry 24 bits of their sequence number
+
+      /**
+       * @param capacity The number of shards to keep.
+       * @param shard_size The largest size of a shard, headers included.
+       */
+      history_t(std::size_t capacity, std::size_t shard_size);
+
+      /**
+       * @brief Keep a shard that was sent.
+       * @param sequence The sequence number of the shard.
+       * @param headers The headers sent before the payload.
+       * @param payload The payload.
+       * @param now The time the shard was sent.
+       */
+      void store(std::uint32_t sequence, std::string_view headers, std::string_view payload, std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Get the shards of a range of sequence numbers that are still kept.
+       * @param first The sequence number of the first shard.
+       * @param count The number of shards.
+       * @param now The current time.
+       * @return The shards found, in order. Shards that were overwritten or are too old are left out.
+       */
+      std::vector<std::string> find(std::uint32_t first, std::size_t count, std::chrono::steady_clock::time_point now);
+
+    private:
+      struct slot_t {
+        std::optional<std::uint32_t> sequence;
+        std::chrono::steady_clock::time_point sent;
+        std::size_t size = 0;
+      };
+
+      std::mutex _lock;
+      std::vector<slot_t> _slots;
+      std::vector<char> _buffer;
+      std::size_t _shard_size;
+    };
+  }  // namespace retransmit
+
+  namespace audio_fec {
+    /**
+     * @brief Picks how many parity shards to send with each audio FEC block from the client's loss reports.
+     * @details The client decodes audio FEC blocks with a fixed shape and parity matrix, so the block
+     *          itself can't change, but trailing parity shards may be left out. Any reported loss
+     *          restores full protection right away. It is then lowered one shard at a time while the
+     *          link stays clean, down to `min_parity_shards`.
+     * @note Feedback must come from a single thread, but `parity_shards()` may be read from any thread.
+     */
+    class protection_t {
+    public:
+      static constexpr int MAX_PARITY_SHARDS = 2;  ///< RTPA_FEC_SHARDS
+
+      /**
+       * @param min_parity_shards The number of parity shards never to go below.
+       * @param now The time the session started.
+       */
+      protection_t(int min_parity_shards, std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Handle the client reporting lost packets or frames.
+       * @param now The time of the report.
+       */
+      void on_loss(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Lower the protection if the link stayed clean long enough.
+       * @param now The current time.
+       */
+      void update(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Get the number of parity shards to send with each FEC block.
+       */
+      int parity_shards() const {
+        return _parity_shards.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::atomic<int> _parity_shards;
+      int _min_parity_shards;
+
+      std::chrono::steady_clock::time_point _last_change;
+    };
+  }  // namespace audio_fec
+
+  namespace video_fec {
+    static constexpr int MAX_FEC_BLOCKS = 4;  ///< There are 2 bits for the FEC block count
+    static constexpr int MAX_BLOCK_SHARDS = 255;  ///< DATA_SHARDS_MAX, data and parity shards of a FEC block together
+
+    /**
+     * @brief Get the highest FEC percentage up to the requested one that a frame can be sent with.
+     * @details A frame is split into at most `max_blocks` FEC blocks of at most `MAX_BLOCK_SHARDS` shards,
+     *          so the parity of a large frame has to give way for its data to fit.
+     * @param percentage The requested FEC percentage.
+     * @param frame_shards The number of data shards of the frame.
+     * @param max_blocks The number of FEC blocks the frame may be split into.
+     * @return The FEC percentage, or 0 if the frame doesn't fit even without parity.
+     */
+    int fit_percentage(int percentage, std::size_t frame_shards, int max_blocks);
+
+    /**
+     * @brief Picks the FEC percentage of a session's video frames from the client's loss reports.
+     * @details The client reports the video packets it lost, including those FEC recovered. Each `WINDOW`,
+     *          the percentage is raised to `LOSS_HEADROOM` times the share of packets that were lost,
+     *          and a frame the client couldn't recover raises it by half right away. It is only lowered again,
+     *          by `LOWER_STEP` at a time, after staying above what the loss called for during `LOWER_HOLD`.
+     *          IDR frames get twice the percentage and frames much larger than usual half as much again,
+     *          since losing them costs the most.
+     * @note Loss feedback and `update()` must come from a single thread, and `on_sent()` and `frame_percentage()`
+     *       from another one. `percentage()` may be read from any thread.
+     */
+    class protection_t {
+    public:
+      static constexpr int MIN_PERCENTAGE = 5;  ///< The lowest percentage when adapting it
+      static constexpr int MAX_PERCENTAGE = 100;  ///< The highest percentage when adapting it, unless more was configured
+      static constexpr auto WINDOW = std::chrono::seconds {2};
+      static constexpr auto LOWER_HOLD = std::chrono::seconds {10};
+      static constexpr int LOWER_STEP = 5;
+      static constexpr double LOSS_HEADROOM = 4.0;
+      static constexpr double LARGE_FRAME_FACTOR = 2.0;  ///< Frames this many times larger than the average get more parity
+
+      /**
+       * @param percentage The percentage to start at.
+       * @param min_percentage The percentage never to go below.
+       * @param max_percentage The percentage never to go above, the percentage stays fixed if it's the minimum.
+       * @param now The time the session started.
+       */
+      protection_t(int percentage, int min_percentage, int max_percentage, std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Handle the client reporting lost video packets.
+       * @param lost_packets The number of packets lost since the last report.
+       */
+      void on_loss(int lost_packets);
+
+      /**
+       * @brief Handle the client asking for reference frames to be invalidated or for an IDR frame.
+       * @param now The time of the request.
+       */
+      void on_unrecovered(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Count the shards of a FEC block that was sent.
+       * @param data_shards The number of data shards.
+       * @param parity_shards The number of parity shards.
+       */
+      void on_sent(std::size_t data_shards, std::size_t parity_shards);
+
+      /**
+       * @brief Pick the percentage from the loss of the last window, if it's over.
+       * @param now The current time.
+       */
+      void update(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Get the FEC percentage of a frame.
+       * @param idr Whether the frame is an IDR frame.
+       * @param frame_shards The number of data shards of the frame.
+       * @return The FEC percentage, before fitting the frame into its FEC blocks.
+       */
+      int frame_percentage(bool idr, std::size_t frame_shards);
+
+      /**
+       * @brief Get the FEC percentage of regular frames.
+       */
+      int percentage() const {
+        return _percentage.load(std::memory_order_relaxed);
+      }
+
+    private:
+      /**
+       * @brief Set the percentage, clamped within the bounds.
+       * @param percentage The percentage.
+       */
+      void set(int percentage);
+
+      std::atomic<int> _percentage;
+      int _min_percentage;
+      int _max_percentage;
+
+      int _lost_packets = 0;
+      int _unrecovered_frames = 0;
+      std::atomic<std::size_t> _data_shards {0};
+      std::atomic<std::size_t> _parity_shards {0};
+
+      // Only used by the thread sending the frames
+      double _average_frame_shards = 0;
+
+      std::chrono::steady_clock::time_point _window_start;
+      std::chrono::steady_clock::time_point _hold_start;
+    };
+  }  // namespace video_fec
+
+  namespace bitrate_control {
+    /**
+     * @brief Picks the video bitrate from the client's loss reports, reference frame invalidations and send backlog.
+     * @details Congestion is weighed once per `STEP_INTERVAL`. Lost packets count once for each report,
+     *          frames the client couldn't decode count twice, and frames queueing up behind each other before
+     *          they got out count once if there were at least `BACKLOG_FRAMES` of them, as does a queueing
+     *          delay building up along the path. The bitrate is lowered by `DECREASE_PER_EVENT` for each of
+     *          these, but by no more than `MAX_DECREASE` at once. Only after the link stayed clean for
+     *          `RAISE_HOLD` is it raised again, by `INCREASE` of the maximum bitrate each step, so it doesn't
+     *          flap around the rate the link can take.
+     * @note Loss and delay feedback and `update()` must come from a single thread, but `on_backlog()` and `bitrate()`
+     *       may be called from any thread.
+     */
+    class controller_t {
+    public:
+      static constexpr auto STEP_INTERVAL = std::chrono::seconds {1};
+      static constexpr auto RAISE_HOLD = std::chrono::seconds {5};
+      static constexpr int BACKLOG_FRAMES = 3;
+      static constexpr double DECREASE_PER_EVENT = 0.05;
+      static constexpr double MAX_DECREASE = 0.15;
+      static constexpr double INCREASE = 0.05;
+      static constexpr double MIN_FRACTION = 0.2;  ///< The lowest bitrate, as a fraction of the maximum, when adapting it
+      static constexpr auto MAX_QUEUEING_DELAY = std::chrono::milliseconds {20};
+
+      /**
+       * @param min_bitrate The bitrate never to go below, in kilobits per second.
+       * @param max_bitrate The bitrate the client asked for, which is never exceeded, in kilobits per second.
+       * @param now The time the session started.
+       * @param start_bitrate The bitrate to start at, in kilobits per second, instead of the maximum.
+       *        It is raised like after congestion once the link stays clean.
+       */
+      controller_t(int min_bitrate, int max_bitrate, std::chrono::steady_clock::time_point now, std::optional<int> start_bitrate = std::nullopt);
+
+      /**
+       * @brief Handle the client reporting lost video packets.
+       */
+      void on_loss();
+
+      /**
+       * @brief Handle the client asking for reference frames to be invalidated or for an IDR frame.
+       */
+      void on_invalidate();
+
+      /**
+       * @brief Handle a frame that was sent after the next one was captured.
+       */
+      void on_backlog();
+
+      /**
+       * @brief Handle a new estimate of the queueing delay of the path.
+       * @details A delay beyond `MAX_QUEUEING_DELAY`, plus what the jitter of the path accounts for,
+       *          counts once per step, so the bitrate comes down before the queues overflow.
+       * @param queueing_delay How far the round trip time is above its minimum.
+       * @param jitter The jitter of the path.
+       */
+      void on_delay(std::chrono::microseconds queueing_delay, std::chrono::microseconds jitter);
+
+      /**
+       * @brief Change the bitrate from the feedback since the last step, if a step is due.
+       * @param now The current time.
+       * @return The new bitrate in kilobits per second, or `std::nullopt` if it didn't change.
+       */
+      std::optional<int> update(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Get the bitrate in kilobits per second.
+       */
+      int bitrate() const {
+        return _bitrate.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::atomic<int> _bitrate;
+      int _min_bitrate;
+      int _max_bitrate;
+
+      int _losses = 0;
+      int _invalidations = 0;
+      bool _delayed = false;
+      std::atomic<int> _late_frames {0};
+
+      std::chrono::steady_clock::time_point _last_step;
+      std::chrono::steady_clock::time_point _last_congestion;
+    };
+  }  // namespace bitrate_control
+
+  namespace feedback {
+    /**
+     * @brief Sends the gamepad feedback of a session at a bounded rate, keeping only its latest state.
+     * @details Feedback is kept apart for each gamepad and kind, like rumble or the RGB LED. A state equal to the
+     *          one sent last is dropped. Otherwise it's sent right away, unless one of its kind was sent for the
+     *          gamepad less than `MIN_INTERVAL` ago. It then waits for the interval to pass, replaced by any newer
+     *          state in the meantime, so the last state a game sets is always sent.
+     */
+    class coalescer_t {
+    public:
+      static constexpr auto MIN_INTERVAL = std::chrono::milliseconds {20};
+
+      /**
+       * @brief Take feedback from the game.
+       * @param msg The feedback.
+       */
+      void push(const platf::gamepad_feedback_msg_t &msg);
+
+      /**
+       * @brief Take the feedback that is due to be sent.
+       * @param now The current time.
+       * @return The feedback to send, which then counts as sent.
+       */
+      std::vector<platf::gamepad_feedback_msg_t> pop(std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Get when the next waiting feedback is due.
+       * @return The time, or `std::nullopt` if no feedback is waiting.
+       */
+      std::optional<std::chrono::steady_clock::time_point> next_due() const;
+
+      std::uint64_t duplicates() const;  ///< Feedback dropped since it didn't change the state sent last
+      std::uint64_t coalesced() const;  ///< Feedback replaced by newer feedback before it was sent
+
+    private:
+      struct entry_t {
+        std::optional<platf::gamepad_feedback_msg_t> sent;
+        std::chrono::steady_clock::time_point sent_at;
+        std::optional<platf::gamepad_feedback_msg_t> waiting;
+      };
+
+      std::map<std::pair<std::uint16_t, platf::gamepad_feedback_e>, entry_t> _entries;
+      std::uint64_t _duplicates = 0;
+      std::uint64_t _coalesced = 0;
+    };
+  }  // namespace feedback
+
+  namespace recovery {
+    /**
+     * @brief What a video frame does for a client recovering from lost frames.
+     */
+    enum class frame_e {
+      regular,  ///< The frame may refer to the lost frames
+      idr,  ///< An IDR frame, which refers to no other frame
+      invalidation,  ///< The first frame that no longer refers to invalidated frames
+      intra_refresh,  ///< Part of an intra refresh that replaces an IDR frame
+    };
+
+    /**
+     * @brief Decides which of a client's requests to recover from lost frames are passed on to the encoder.
+     * @details A client that loses several frames in a row can ask again before the frame answering its first
+     *          request reached it. Asking for an IDR frame is passed on only if no IDR frame is on its way, or
+     *          was sent less than a round trip time ago. Invalidating a range of frames is passed on only if the
+     *          next IDR or invalidation frame doesn't already replace them, so frames are invalidated rather
+     *          than replaced by an IDR frame whenever the encoder can. A request counts as on its way for no
+     *          longer than `MAX_WAIT`, in case the encoder doesn't answer it.
+     *
+     *          Frames encoded before the answer to a request can't be decoded by the client, so they are
+     *          skipped while the answer is on its way, which gets it to the client sooner.
+     * @note Safe to call from any thread.
+     */
+    class controller_t {
+    public:
+      static constexpr auto MAX_WAIT = std::chrono::milliseconds {250};
+
+      /**
+       * @brief Handle the client asking for an IDR frame.
+       * @param now The current time.
+       * @param round_trip How long the client takes to see a frame that was sent and answer it.
+       * @return `true` if the encoder should be asked for an IDR frame.
+       */
+      bool on_idr_request(std::chrono::steady_clock::time_point now, std::chrono::microseconds round_trip);
+
+      /**
+       * @brief Handle a range of frames the client won't decode.
+       * @param first_frame The first frame of the range.
+       * @param last_frame The last frame of the range.
+       * @param invalidates Whether the encoder can invalidate reference frames, it answers with an IDR frame otherwise.
+       * @param now The current time.
+       * @return `true` if the encoder should be asked to invalidate the range.
+       */
+      bool on_invalidate(std::int64_t first_frame, std::int64_t last_frame, bool invalidates, std::chrono::steady_clock::time_point now);
+
+      /**
+       * @brief Check if a frame should be skipped, since the client waits for a frame that replaces it.
+       * @param frame What the frame does for the client.
+       * @param now The current time.
+       * @return `true` if the frame should be skipped.
+       */
+      bool skip(frame_e frame, std::chrono::steady_clock::time_point now) const;
+
+      /**
+       * @brief Handle a frame that was sent.
+       * @param frame_index The index of the frame.
+       * @param frame What the frame does for the client.
+       * @param now The current time.
+       * @return `true` if the frame answered a request from the client.
+       */
+      bool on_sent(std::int64_t frame_index, frame_e frame, std::chrono::steady_clock::time_point now);
+
+    private:
+      struct request_t {
+        bool idr;
+        std::int64_t first_frame;  ///< The first frame invalidated, the answer refers to none after it
+        std::optional<std::int64_t> answer;  ///< The frame that answered the request, once it's sent
+        std::chrono::steady_clock::time_point at;  ///< When it was requested, then when it was answered
+      };
+
+      bool waiting(std::chrono::steady_clock::time_point now) const;
+
+      mutable std::mutex _lock;
+      std::int64_t _last_idr_frame = -1;
+      std::optional<request_t> _request;
+    };
+  }  // namespace recovery
+
+  /**
+   * @brief Parameters shared by every FEC block of a video frame.
+   */
+  struct video_frame_info_t {
+    int64_t frame_index;
+    uint32_t timestamp;
+    int fec_blocks_needed;
+
+    // The frame payload, excluding packet headers
+    std::array<std::string_view, 3> payload;
+
+    size_t payload_blocksize;
+    size_t fec_percentage;
+    size_t min_parity_shards;
+    bool encrypted;  ///< Whether the shards get an encryption prefix and are written to buffers of their own
   };
 
+  /**
+   * @brief Stamps the video packet headers of a FEC block and generates its parity shards.
+   * @param frame The frame the FEC block belongs to.
+   * @param block_index The index of the FEC block within the frame.
+   * @param lowseq The sequence number of the first shard of the FEC block.
+   * @param fec_block The offset and size of the FEC block in the frame payload.
+   * @param rs_cache The Reed-Solomon encoder cache of the calling thread.
+   * @return The shards of the FEC block.
+   */
+  fec::fec_t encode_video_fec_block(const video_frame_info_t &frame, int block_index, int lowseq, std::pair<size_t, size_t> fec_block, fec::rs_cache_t &rs_cache);
+
+  /**
+   * @brief Stamps the RTP and FEC headers of a range of shards and encrypts them if needed.
+   * @param frame The frame the FEC block belongs to.
+   * @param block_index The index of the FEC block within the frame.
+   * @param lowseq The sequence number of the first shard of the FEC block.
+   * @param shards The shards of the FEC block.
+   * @param first The index of the first shard to finalize.
+   * @param count The number of shards to finalize.
+   * @param cipher The cipher used to encrypt the shards, or `nullptr` if video encryption is disabled.
+   * @param gcm_iv_counter The IV counter of the first shard of the FEC block.
+   * @param session_metrics The metrics of the session, which the time spent encrypting is added to.
+   */
+  void finalize_video_shards(const video_frame_info_t &frame, int block_index, int lowseq, fec::fec_t &shards, size_t first, size_t count, crypto::cipher::gcm_t *cipher, std::uint64_t gcm_iv_counter, metrics::session_t &session_metrics);
+
+  /**
+   * @brief Stop the broadcast kept running after the last session for a reconnecting client.
+   * @details Called on shutdown, so the broadcast threads are joined before the process exits,
+   *          and before the options saved since the last session are applied, since those threads read them.
+   */
+  void release_parked_broadcast();
+
   namespace session {
     enum class state_e : int {
       STOPPED,  ///< The session is stopped
@@ -51,5 +861,34 @@ namespace stream {
     void stop(session_t &session);
     void join(session_t &session);
     state_e state(session_t &session);
+
+    /**
+     * @brief Hand a recorded video packet to the video broadcast thread, as if the session had encoded it.
+     * @param session A session allocated with `config_t::replay`.
+     * @param packet The packet.
+     */
+    void replay_video(session_t &session, video::packet_t packet);
+
+    /**
+     * @brief Have the control stream thread handle a recorded control message, as if the client had sent it.
+     * @param session A session allocated with `config_t::replay`.
+     * @param type The type of the message.
+     * @param payload The payload of the message.
+     */
+    void replay_control(session_t &session, std::uint16_t type, std::string_view payload);
+
+    /**
+     * @brief Have the control stream thread hand recorded input to the input thread, as if the client had sent it.
+     * @param session A session allocated with `config_t::replay`.
+     * @param payload The decrypted input packet.
+     */
+    void replay_input(session_t &session, std::string_view payload);
+
+    /**
+     * @brief Feed a recorded round trip time of the control stream to the session.
+     * @param session A session allocated with `config_t::replay`.
+     * @param rtt The round trip time.
+     */
+    void replay_rtt(session_t &session, std::chrono::milliseconds rtt);
   }  // namespace session
 }  // namespace stream
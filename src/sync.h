@@ -6,6 +6,8 @@
 
 // standard includes
 #include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <utility>
 
@@ -91,4 +93,58 @@ namespace sync_util {
     mutex_t _lock;
   };
 
+  /**
+   * @brief A value that's read without locking and replaced as a whole, RCU style.
+   * @details Writers change a copy of the current value and publish it, under a lock so they don't
+   *          lose each other's changes. Readers get the value published last, which stays valid for as
+   *          long as they hold on to it, even once newer ones are published.
+   */
+  template<class T>
+  class snapshot_t {
+  public:
+    using value_t = T;
+
+    template<class... Args>
+    snapshot_t(Args &&...args):
+        _value {std::make_shared<const value_t>(std::forward<Args>(args)...)} {
+    }
+
+    /**
+     * @brief Get the value published last.
+     */
+    std::shared_ptr<const value_t> load() const {
+#ifdef __cpp_lib_atomic_shared_ptr
+      return _value.load(std::memory_order_acquire);
+#else
+      return std::atomic_load_explicit(&_value, std::memory_order_acquire);
+#endif
+    }
+
+    /**
+     * @brief Publish a changed copy of the value.
+     * @param f Called with the copy to change.
+     */
+    template<class F>
+    void update(F &&f) {
+      std::lock_guard lg {_write_lock};
+
+      auto next = std::make_shared<value_t>(*load());
+      f(*next);
+
+#ifdef __cpp_lib_atomic_shared_ptr
+      _value.store(std::move(next), std::memory_order_release);
+#else
+      std::atomic_store_explicit(&_value, std::shared_ptr<const value_t> {std::move(next)}, std::memory_order_release);
+#endif
+    }
+
+  private:
+#ifdef __cpp_lib_atomic_shared_ptr
+    std::atomic<std::shared_ptr<const value_t>> _value;
+#else
+    std::shared_ptr<const value_t> _value;
+#endif
+    std::mutex _write_lock;
+  };
+
 }  // namespace sync_util
@@ -5,15 +5,19 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstdint>
 #include <deque>
 #include <functional>
 #include <future>
+#include <list>
 #include <mutex>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
-#include <vector>
 
 // local includes
 #include "move_by_copy.h"
@@ -64,8 +68,29 @@ namespace task_pool_util {
     };
 
   protected:
+    /**
+     * Delayed tasks live in a hashed timer wheel: a task due at tick T is kept in slot T % TIMER_SLOTS,
+     * so scheduling, delaying and cancelling a task doesn't depend on the number of pending timers.
+     */
+    static constexpr std::size_t TIMER_SLOTS = 512;
+    typedef std::chrono::milliseconds __timer_tick;
+
+    typedef std::list<std::pair<__time_point, __task>> __timer_list;
+
+    /**
+     * Where a delayed task is stored, slot TIMER_SLOTS being the list of tasks already due.
+     */
+    struct __timer_pos {
+      std::size_t slot;
+      __timer_list::iterator it;
+    };
+
     std::deque<__task> _tasks;
-    std::vector<std::pair<__time_point, __task>> _timer_tasks;
+    std::array<__timer_list, TIMER_SLOTS + 1> _timer_slots;
+    std::unordered_map<task_id_t, __timer_pos> _timer_index;
+
+    // All ticks before this one have been moved to the due list
+    std::int64_t _timer_cursor {};
     std::mutex _task_mutex;
 
   public:
@@ -73,12 +98,16 @@ namespace task_pool_util {
 
     TaskPool(TaskPool &&other) noexcept:
         _tasks {std::move(other._tasks)},
-        _timer_tasks {std::move(other._timer_tasks)} {
+        _timer_slots {std::move(other._timer_slots)},
+        _timer_index {std::move(other._timer_index)},
+        _timer_cursor {other._timer_cursor} {
     }
 
     TaskPool &operator=(TaskPool &&other) noexcept {
       std::swap(_tasks, other._tasks);
-      std::swap(_timer_tasks, other._timer_tasks);
+      std::swap(_timer_slots, other._timer_slots);
+      std::swap(_timer_index, other._timer_index);
+      std::swap(_timer_cursor, other._timer_cursor);
 
       return *this;
     }
@@ -107,14 +136,15 @@ namespace task_pool_util {
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.cbegin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        if (std::get<0>(*it) < task.first) {
-          break;
-        }
+      if (_timer_index.empty()) {
+        _timer_cursor = tick(std::chrono::steady_clock::now());
       }
 
-      _timer_tasks.emplace(it, task.first, std::move(task.second));
+      task_id_t task_id = &*task.second;
+
+      auto slot = timer_slot(task.first);
+      auto it = _timer_slots[slot].emplace(_timer_slots[slot].end(), task.first, std::move(task.second));
+      _timer_index.emplace(task_id, __timer_pos {slot, it});
     }
 
     /**
@@ -158,62 +188,48 @@ namespace task_pool_util {
     void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          std::get<0>(*it) = std::chrono::steady_clock::now() + duration;
-
-          break;
-        }
-      }
-
-      if (it == _timer_tasks.cend()) {
+      auto pos = _timer_index.find(task_id);
+      if (pos == std::end(_timer_index)) {
         return;
       }
 
-      // smaller time goes to the back
-      auto prev = it - 1;
-      while (it > _timer_tasks.cbegin()) {
-        if (std::get<0>(*it) > std::get<0>(*prev)) {
-          std::swap(*it, *prev);
-        }
+      auto &[slot, it] = pos->second;
+      it->first = std::chrono::steady_clock::now() + duration;
 
-        --prev;
-        --it;
-      }
+      auto new_slot = timer_slot(it->first);
+      _timer_slots[new_slot].splice(_timer_slots[new_slot].end(), _timer_slots[slot], it);
+      slot = new_slot;
     }
 
     bool cancel(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          _timer_tasks.erase(it);
-
-          return true;
-        }
+      auto pos = _timer_index.find(task_id);
+      if (pos == std::end(_timer_index)) {
+        return false;
       }
 
-      return false;
+      _timer_slots[pos->second.slot].erase(pos->second.it);
+      _timer_index.erase(pos);
+
+      return true;
     }
 
     std::optional<std::pair<__time_point, __task>> pop(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto pos = std::find_if(std::begin(_timer_tasks), std::end(_timer_tasks), [&task_id](const auto &t) {
-        return t.second.get() == task_id;
-      });
-
-      if (pos == std::end(_timer_tasks)) {
+      auto pos = _timer_index.find(task_id);
+      if (pos == std::end(_timer_index)) {
         return std::nullopt;
       }
 
-      return std::move(*pos);
+      auto &[slot, it] = pos->second;
+      auto task = std::move(*it);
+
+      _timer_slots[slot].erase(it);
+      _timer_index.erase(pos);
+
+      return task;
     }
 
     std::optional<__task> pop() {
@@ -225,9 +241,13 @@ namespace task_pool_util {
         return task;
       }
 
-      if (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now()) {
-        __task task = std::move(std::get<1>(_timer_tasks.back()));
-        _timer_tasks.pop_back();
+      advance(std::chrono::steady_clock::now());
+
+      auto &due = _timer_slots[TIMER_SLOTS];
+      if (!due.empty()) {
+        __task task = std::move(due.front().second);
+        _timer_index.erase(&*task);
+        due.pop_front();
         return task;
       }
 
@@ -237,20 +257,98 @@ namespace task_pool_util {
     bool ready() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      return !_tasks.empty() || (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now());
+      if (!_tasks.empty()) {
+        return true;
+      }
+
+      advance(std::chrono::steady_clock::now());
+
+      return !_timer_slots[TIMER_SLOTS].empty();
     }
 
     std::optional<__time_point> next() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      if (_timer_tasks.empty()) {
+      if (_timer_index.empty()) {
         return std::nullopt;
       }
 
-      return std::get<0>(_timer_tasks.back());
+      if (!_timer_slots[TIMER_SLOTS].empty()) {
+        return _timer_slots[TIMER_SLOTS].front().first;
+      }
+
+      // The first slot holding a task for this turn of the wheel has the earliest task
+      for (std::size_t x = 0; x < TIMER_SLOTS; ++x) {
+        auto t = _timer_cursor + (std::int64_t) x;
+
+        std::optional<__time_point> earliest;
+        for (auto &[time_point, _] : _timer_slots[t % TIMER_SLOTS]) {
+          if (tick(time_point) <= t && (!earliest || time_point < *earliest)) {
+            earliest = time_point;
+          }
+        }
+
+        if (earliest) {
+          return earliest;
+        }
+      }
+
+      // Every task is at least a full turn away
+      std::optional<__time_point> earliest;
+      for (std::size_t x = 0; x < TIMER_SLOTS; ++x) {
+        for (auto &[time_point, _] : _timer_slots[x]) {
+          if (!earliest || time_point < *earliest) {
+            earliest = time_point;
+          }
+        }
+      }
+
+      return earliest;
     }
 
   private:
+    static std::int64_t tick(__time_point time_point) {
+      return std::chrono::duration_cast<__timer_tick>(time_point.time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Get the slot a task due at time_point belongs in.
+     * @details Tasks due before the cursor are kept in the cursor slot, so they're picked up on the next advance.
+     */
+    std::size_t timer_slot(__time_point time_point) const {
+      return std::max(tick(time_point), _timer_cursor) % TIMER_SLOTS;
+    }
+
+    /**
+     * @brief Move every task due at `now` to the due list.
+     * @details At most one full turn of the wheel is visited, however long ago the last advance was.
+     */
+    void advance(__time_point now) {
+      if (_timer_index.size() == _timer_slots[TIMER_SLOTS].size()) {
+        _timer_cursor = tick(now);
+        return;
+      }
+
+      auto now_tick = tick(now);
+      auto first = std::max(_timer_cursor, now_tick - (std::int64_t) TIMER_SLOTS + 1);
+
+      auto &due = _timer_slots[TIMER_SLOTS];
+      for (auto t = first; t <= now_tick; ++t) {
+        auto &list = _timer_slots[t % TIMER_SLOTS];
+
+        for (auto it = std::begin(list); it != std::end(list);) {
+          auto current = it++;
+          if (current->first <= now) {
+            _timer_index[&*current->second].slot = TIMER_SLOTS;
+            due.splice(std::end(due), list, current);
+          }
+        }
+      }
+
+      _timer_cursor = std::max(_timer_cursor, now_tick);
+    }
+
+  protected:
     template<class Function>
     std::unique_ptr<_ImplBase> toRunnable(Function &&f) {
       return std::make_unique<_Impl<Function>>(std::forward<Function &&>(f));
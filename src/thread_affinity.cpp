@@ -0,0 +1,367 @@
+/**
+ * @file src/thread_affinity.cpp
+ * @brief Definitions for pinning the streaming threads to CPUs.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <mutex>
+#include <set>
+
+// local includes
+#include "config.h"
+#include "logging.h"
+#include "metrics.h"
+#include "thread_affinity.h"
+
+using namespace std::literals;
+
+namespace thread_affinity {
+  namespace {
+    const std::string &cpu_set(role_e role) {
+      auto &affinity = config::sunshine.thread_affinity;
+
+      switch (role) {
+        case role_e::capture:
+          return affinity.capture;
+        case role_e::encode:
+          return affinity.encode;
+        case role_e::video_send:
+          return affinity.video_send;
+        case role_e::audio:
+          return affinity.audio;
+        case role_e::control:
+          break;
+      }
+
+      return affinity.control;
+    }
+
+    /**
+     * @brief Get the real-time priority of a role, 0 for roles keeping the normal policy.
+     * @details Audio has the tightest deadlines, so it preempts the other roles. Encoding keeps the normal
+     *          policy, since software encoders keep every CPU they're given busy.
+     */
+    int realtime_priority(role_e role) {
+      switch (role) {
+        case role_e::audio:
+          return 8;
+        case role_e::capture:
+        case role_e::control:
+          return 6;
+        case role_e::video_send:
+          return 4;
+        case role_e::encode:
+          break;
+      }
+
+      return 0;
+    }
+
+    const std::vector<platf::cpu_t> &topology() {
+      static const auto topology = platf::cpu_topology();
+
+      return topology;
+    }
+
+    // Bumped whenever the node of a device changes, for threads to pin themselves again
+    std::atomic<int> placement_generation {0};
+
+    std::mutex locality_lock;
+    locality_t current_locality;
+
+    locality_t locality() {
+      std::lock_guard lg {locality_lock};
+      return current_locality;
+    }
+
+    std::string_view cpu_set_of(role_e role) {
+      auto &spec = cpu_set(role);
+      return spec.empty() ? default_cpu_set(role, topology()) : std::string_view {spec};
+    }
+
+    std::optional<int> to_int(std::string_view str) {
+      int value;
+      auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+      if (ec != std::errc {} || ptr != str.data() + str.size() || value < 0) {
+        return std::nullopt;
+      }
+
+      return value;
+    }
+  }  // namespace
+
+  std::string_view to_string(role_e role) {
+    switch (role) {
+      case role_e::capture:
+        return "capture"sv;
+      case role_e::encode:
+        return "encode"sv;
+      case role_e::video_send:
+        return "video_send"sv;
+      case role_e::audio:
+        return "audio"sv;
+      case role_e::control:
+        break;
+    }
+
+    return "control"sv;
+  }
+
+  std::string_view to_string(device_e device) {
+    switch (device) {
+      case device_e::gpu:
+        return "gpu"sv;
+      case device_e::nic:
+        break;
+    }
+
+    return "nic"sv;
+  }
+
+  std::optional<std::vector<int>> parse(std::string_view spec, const std::vector<platf::cpu_t> &topology, const locality_t &locality) {
+    std::set<int> ids;
+    bool nosmt = false;
+
+    // The last level caches, numbered by their first CPU
+    std::vector<int> caches;
+    for (auto &cpu : topology) {
+      if (std::find(std::begin(caches), std::end(caches), cpu.cache) == std::end(caches)) {
+        caches.emplace_back(cpu.cache);
+      }
+    }
+    std::sort(std::begin(caches), std::end(caches));
+
+    auto add_if = [&](auto &&pred) {
+      for (auto &cpu : topology) {
+        if (pred(cpu)) {
+          ids.emplace(cpu.id);
+        }
+      }
+    };
+
+    while (!spec.empty()) {
+      auto comma = spec.find(',');
+      auto item = spec.substr(0, comma);
+      spec = comma == std::string_view::npos ? std::string_view {} : spec.substr(comma + 1);
+
+      std::string token;
+      for (auto ch : item) {
+        if (!std::isspace((unsigned char) ch)) {
+          token += (char) std::tolower((unsigned char) ch);
+        }
+      }
+
+      if (token.empty()) {
+        continue;
+      }
+
+      if (token == "nosmt"sv) {
+        nosmt = true;
+      } else if (token == "performance"sv) {
+        add_if([](auto &cpu) {
+          return !cpu.efficiency;
+        });
+      } else if (token == "efficiency"sv) {
+        add_if([](auto &cpu) {
+          return cpu.efficiency;
+        });
+      } else if (token == "gpu"sv || token == "nic"sv) {
+        auto node = token == "gpu"sv ? locality.gpu : locality.nic;
+        add_if([node](auto &cpu) {
+          return node && cpu.node == *node;
+        });
+      } else if (token.starts_with("node"sv)) {
+        auto node = to_int(std::string_view {token}.substr(4));
+        auto exists = node && std::any_of(std::begin(topology), std::end(topology), [&](auto &cpu) {
+          return cpu.node == *node;
+        });
+        if (!exists) {
+          return std::nullopt;
+        }
+
+        add_if([node](auto &cpu) {
+          return cpu.node == *node;
+        });
+      } else if (token.starts_with("ccd"sv)) {
+        auto index = to_int(std::string_view {token}.substr(3));
+        if (!index || (std::size_t) *index >= caches.size()) {
+          return std::nullopt;
+        }
+
+        add_if([cache = caches[*index]](auto &cpu) {
+          return cpu.cache == cache;
+        });
+      } else {
+        auto dash = token.find('-');
+        auto first = to_int(std::string_view {token}.substr(0, dash));
+        auto last = dash == std::string::npos ? first : to_int(std::string_view {token}.substr(dash + 1));
+        if (!first || !last || *first > *last) {
+          return std::nullopt;
+        }
+
+        for (auto id = *first; id <= *last; ++id) {
+          auto exists = std::any_of(std::begin(topology), std::end(topology), [id](auto &cpu) {
+            return cpu.id == id;
+          });
+          if (!exists) {
+            return std::nullopt;
+          }
+
+          ids.emplace(id);
+        }
+      }
+    }
+
+    // nosmt on its own picks from every CPU
+    if (nosmt && ids.empty()) {
+      add_if([](auto &) {
+        return true;
+      });
+    }
+
+    std::vector<int> cpus;
+    std::set<int> cores;
+    for (auto &cpu : topology) {
+      if (ids.contains(cpu.id) && (!nosmt || cores.emplace(cpu.core).second)) {
+        cpus.emplace_back(cpu.id);
+      }
+    }
+
+    return cpus;
+  }
+
+  std::string format(const std::vector<int> &cpus) {
+    std::string list;
+
+    for (std::size_t x = 0; x < cpus.size();) {
+      auto first = x;
+      while (x + 1 < cpus.size() && cpus[x + 1] == cpus[x] + 1) {
+        ++x;
+      }
+
+      if (!list.empty()) {
+        list += ',';
+      }
+      list += std::to_string(cpus[first]);
+      if (x > first) {
+        list += '-';
+        list += std::to_string(cpus[x]);
+      }
+
+      ++x;
+    }
+
+    return list;
+  }
+
+  std::string_view default_cpu_set(role_e role, const std::vector<platf::cpu_t> &topology) {
+    auto multiple_nodes = std::any_of(std::begin(topology), std::end(topology), [&](auto &cpu) {
+      return cpu.node != topology.front().node;
+    });
+    if (!multiple_nodes) {
+      return {};
+    }
+
+    switch (role) {
+      case role_e::capture:
+      case role_e::encode:
+        return "gpu"sv;
+      case role_e::video_send:
+      case role_e::audio:
+      case role_e::control:
+        break;
+    }
+
+    return "nic"sv;
+  }
+
+  void set_node(device_e device, std::optional<int> node) {
+    {
+      std::lock_guard lg {locality_lock};
+      auto &current = device == device_e::gpu ? current_locality.gpu : current_locality.nic;
+      if (current == node) {
+        return;
+      }
+
+      current = node;
+    }
+
+    if (node) {
+      BOOST_LOG(info) << "The "sv << (device == device_e::gpu ? "encoder GPU"sv : "network interface"sv) << " is on NUMA node "sv << *node;
+    }
+    metrics::set_device_node(to_string(device), node.value_or(-1));
+
+    ++placement_generation;
+  }
+
+  void follow(role_e role, int &generation) {
+    if (generation == placement_generation.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    generation = apply(role);
+  }
+
+  int apply(role_e role) {
+    metrics::add_thread(to_string(role));
+
+    // Read before the locality, so a change in between pins the thread again on the next follow()
+    auto generation = placement_generation.load();
+
+    if (auto priority = realtime_priority(role); config::sunshine.realtime_threads && priority > 0 && platf::set_thread_realtime(priority)) {
+      BOOST_LOG(debug) << "Running a "sv << to_string(role) << " thread with real-time priority "sv << priority;
+    }
+
+    auto spec = cpu_set_of(role);
+    if (spec.empty()) {
+      return generation;
+    }
+
+    auto cpus = parse(spec, topology(), locality());
+    if (!cpus) {
+      BOOST_LOG(warning) << "Invalid CPU set for the "sv << to_string(role) << " threads: "sv << spec;
+      return generation;
+    }
+    if (cpus->empty()) {
+      // The default sets only apply once the node of the device is known
+      if (cpu_set(role).empty()) {
+        return generation;
+      }
+
+      BOOST_LOG(warning) << "No CPU matches the CPU set of the "sv << to_string(role) << " threads: "sv << spec;
+      return generation;
+    }
+
+    if (!platf::set_thread_affinity(*cpus)) {
+      return generation;
+    }
+
+    // Report where the thread actually ended up, unless the system only takes a hint
+    auto placement = platf::thread_affinity();
+    if (placement.empty()) {
+      BOOST_LOG(info) << "Steering a "sv << to_string(role) << " thread towards CPUs "sv << format(*cpus);
+      placement = std::move(*cpus);
+    } else {
+      BOOST_LOG(info) << "Pinned a "sv << to_string(role) << " thread to CPUs "sv << format(placement);
+    }
+
+    metrics::set_thread_cpus(to_string(role), format(placement), placement.size());
+    return generation;
+  }
+
+  void pin(role_e role) {
+    auto spec = cpu_set_of(role);
+    if (spec.empty()) {
+      return;
+    }
+
+    // apply() already warned about sets that don't match any CPU
+    auto cpus = parse(spec, topology(), locality());
+    if (cpus && !cpus->empty()) {
+      platf::set_thread_affinity(*cpus);
+    }
+  }
+}  // namespace thread_affinity
@@ -0,0 +1,117 @@
+/**
+ * @file src/thread_affinity.h
+ * @brief Declarations for pinning the streaming threads to CPUs.
+ */
+#pragma once
+
+// standard includes
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace thread_affinity {
+  enum class role_e : int {
+    capture,  ///< Capturing video
+    encode,  ///< Encoding video
+    video_send,  ///< Sending video
+    audio,  ///< Capturing, encoding and sending audio
+    control,  ///< Handling the control stream
+  };
+
+  enum class device_e : int {
+    gpu,  ///< The GPU the encoder runs on
+    nic,  ///< The network interface the last session connected through
+  };
+
+  /**
+   * @brief The NUMA nodes of the devices the streaming threads move frames to.
+   */
+  struct locality_t {
+    std::optional<int> gpu;
+    std::optional<int> nic;
+  };
+
+  /**
+   * @brief Get the name of a role, as used in the logs and the `role` label.
+   * @param role The role.
+   */
+  std::string_view to_string(role_e role);
+
+  /**
+   * @brief Get the name of a device, as used in the logs and the `device` label.
+   * @param device The device.
+   */
+  std::string_view to_string(device_e device);
+
+  /**
+   * @brief Turn a CPU set from the configuration into CPUs.
+   * @details The set is a comma separated list of CPU numbers like `2`, ranges like `4-7`, `performance`
+   *          or `efficiency` for the cores of a hybrid CPU, and `ccd0`, `ccd1`... for the CPUs sharing
+   *          the first, second... last level cache. `node0`, `node1`... are the CPUs of a NUMA node, and
+   *          `gpu` and `nic` those of the node of the encoder GPU and of the network interface, which add
+   *          nothing while the node is unknown. `nosmt` keeps a single CPU of each physical core.
+   * @param spec The CPU set.
+   * @param topology The CPUs of the system.
+   * @param locality The NUMA nodes of the devices.
+   * @return The ids of the CPUs in order, or std::nullopt if the set isn't valid.
+   */
+  std::optional<std::vector<int>> parse(std::string_view spec, const std::vector<platf::cpu_t> &topology, const locality_t &locality = {});
+
+  /**
+   * @brief Get the CPU set of a role without one in the configuration.
+   * @details On systems with several NUMA nodes, the threads handling frames stay on the node of the device they
+   *          hand them to: capture and encoding on the node of the GPU, the others on the node of the network
+   *          interface. Memory is allocated on the node of the thread first touching it, so the buffers of
+   *          these threads stay there too. Elsewhere, the threads are left to the scheduler.
+   * @param role The role.
+   * @param topology The CPUs of the system.
+   * @return The CPU set, empty to leave the threads to the scheduler.
+   */
+  std::string_view default_cpu_set(role_e role, const std::vector<platf::cpu_t> &topology);
+
+  /**
+   * @brief Set the NUMA node of a device, which CPU sets like `gpu` and `nic` follow.
+   * @details The node is logged when it changes, and exposed as the `sunshine_device_numa_node` metric.
+   * @param device The device.
+   * @param node The node, or std::nullopt if it's unknown.
+   */
+  void set_node(device_e device, std::optional<int> node);
+
+  /**
+   * @brief Pin the calling thread again if the NUMA node of a device changed since it was last pinned.
+   * @details This is for threads started before the devices of a session were known, like the shared
+   *          video send threads, and is cheap enough to call for every packet.
+   * @param role The role of the calling thread.
+   * @param generation The placement the thread was last pinned for, initially 0.
+   */
+  void follow(role_e role, int &generation);
+
+  /**
+   * @brief Format CPUs as a list of ranges, like `0-3,8`.
+   * @param cpus The ids of the CPUs in order.
+   */
+  std::string format(const std::vector<int> &cpus);
+
+  /**
+   * @brief Pin the calling thread to the CPUs configured for its role.
+   * @details The CPUs the thread ends up on are logged and exposed as the `sunshine_thread_cpus` metric.
+   *          Roles without a CPU set get their default_cpu_set(), and nothing is pinned if it's empty, but
+   *          the CPU time and scheduling of the thread are exposed either way. With `realtime_threads`, the
+   *          thread also gets the real-time priority of its role.
+   * @param role The role of the calling thread.
+   * @return The placement the thread was pinned for, to pass to follow().
+   */
+  int apply(role_e role);
+
+  /**
+   * @brief Pin the calling thread to the CPUs configured for a role, without logging or exposing it.
+   * @details This is for short-lived threads starting threads of the role, which inherit where they
+   *          run on Linux, like the threads of a software encoder opened ahead of its session.
+   * @param role The role of the threads started by the calling thread.
+   */
+  void pin(role_e role);
+}  // namespace thread_affinity
@@ -5,26 +5,67 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
 #include <thread>
 
 // local includes
 #include "task_pool.h"
 
 namespace thread_pool_util {
+  /**
+   * @brief The priority of a task, workers run every input task they can find before any control task, and so on.
+   */
+  enum class lane_e {
+    input,  ///< Injecting input from the clients.
+    control,  ///< Handling requests and sessions, the default.
+    background,  ///< Work nobody waits on, like flushing state to disk.
+  };
+
   /**
    * Allow threads to execute unhindered while keeping full control over the threads.
+   *
+   * Each worker has its own queue for every lane. Tasks are spread across the workers, and a worker without
+   * work steals from the others, so workers don't all contend on a single lock. Delayed tasks are kept by
+   * the TaskPool, and run as soon as they're due, before any lane.
    */
   class ThreadPool: public task_pool_util::TaskPool {
   public:
     typedef TaskPool::__task __task;
 
+    static constexpr std::size_t LANES = 3;
+
   private:
+    struct worker_t {
+      std::mutex lock;
+      std::array<std::deque<__task>, LANES> lanes;
+
+      // Lets other workers skip this one without taking its lock
+      std::atomic<std::size_t> queued {};
+    };
+
     std::vector<std::thread> _thread;
+    std::unique_ptr<worker_t[]> _workers;
+    std::size_t _worker_count {};
+    std::atomic<std::size_t> _next_worker {};
 
+    // Idle workers wait on _cv, except one of them that waits on _timer_cv for the next delayed task
     std::condition_variable _cv;
+    std::condition_variable _timer_cv;
     std::mutex _lock;
+    std::atomic<int> _idle {};
+    bool _timer_waiting {false};
+
+    // No delayed task is due before this time, but one might be due later
+    std::atomic<__time_point::rep> _timer_hint {std::numeric_limits<__time_point::rep>::max()};
 
-    bool _continue;
+    std::atomic<bool> _continue;
+
+    inline static thread_local const ThreadPool *_current_pool {};
+    inline static thread_local std::size_t _current_worker {};
 
   public:
     ThreadPool():
@@ -32,11 +73,8 @@ namespace thread_pool_util {
     }
 
     explicit ThreadPool(int threads):
-        _thread(threads),
-        _continue {true} {
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
-      }
+        _continue {false} {
+      start(threads);
     }
 
     ~ThreadPool() noexcept {
@@ -50,17 +88,67 @@ namespace thread_pool_util {
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      std::lock_guard lg(_lock);
-      auto future = TaskPool::push(std::forward<Function>(newTask), std::forward<Args>(args)...);
+      return push(lane_e::control, std::forward<Function>(newTask), std::forward<Args>(args)...);
+    }
+
+    /**
+     * @param lane The priority of the task.
+     * @param newTask The task to run.
+     * @param args The arguments of the task.
+     * @return The future result of the task.
+     */
+    template<class Function, class... Args>
+    auto push(lane_e lane, Function &&newTask, Args &&...args) {
+      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+
+      using __return = std::invoke_result_t<Function, Args &&...>;
+      using task_t = std::packaged_task<__return()>;
+
+      // Tasks pushed before the workers are started wait in the TaskPool
+      if (!_workers) {
+        std::lock_guard lg(_lock);
+        auto future = TaskPool::push(std::forward<Function>(newTask), std::forward<Args>(args)...);
+        _timer_hint = std::numeric_limits<__time_point::rep>::min();
+
+        return future;
+      }
+
+      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        return std::apply(task, std::move(tuple_args));
+      };
+
+      task_t task(std::move(bind));
+      auto future = task.get_future();
+
+      // A worker keeps the tasks it pushes, other threads spread them across the workers
+      auto index = _current_pool == this ? _current_worker : _next_worker.fetch_add(1, std::memory_order_relaxed) % _worker_count;
+      {
+        auto &worker = _workers[index];
+        std::lock_guard lg(worker.lock);
+        worker.lanes[(std::size_t) lane].emplace_back(toRunnable(std::move(task)));
+        ++worker.queued;
+      }
+
+      // Wake a single worker, and only when one is waiting
+      if (_idle.load() > 0) {
+        std::lock_guard lg(_lock);
+        if (_idle.load() > (_timer_waiting ? 1 : 0)) {
+          _cv.notify_one();
+        } else {
+          _timer_cv.notify_one();
+        }
+      }
 
-      _cv.notify_one();
       return future;
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_lock);
 
+      auto time_point = task.first;
       TaskPool::pushDelayed(std::move(task));
+
+      update_timer_hint(time_point);
     }
 
     template<class Function, class X, class Y, class... Args>
@@ -68,18 +156,31 @@ namespace thread_pool_util {
       std::lock_guard lg(_lock);
       auto future = TaskPool::pushDelayed(std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
 
-      // Update all timers for wait_until
-      _cv.notify_all();
+      if (auto time_point = TaskPool::next()) {
+        update_timer_hint(*time_point);
+      }
       return future;
     }
 
+    template<class X, class Y>
+    void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
+      std::lock_guard lg(_lock);
+      TaskPool::delay(task_id, duration);
+
+      if (auto time_point = TaskPool::next()) {
+        update_timer_hint(*time_point);
+      }
+    }
+
     void start(int threads) {
+      _workers = std::make_unique<worker_t[]>(threads);
+      _worker_count = threads;
       _continue = true;
 
       _thread.resize(threads);
 
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
+      for (std::size_t x = 0; x < _thread.size(); ++x) {
+        _thread[x] = std::thread(&ThreadPool::_main, this, x);
       }
     }
 
@@ -88,6 +189,7 @@ namespace thread_pool_util {
 
       _continue = false;
       _cv.notify_all();
+      _timer_cv.notify_all();
     }
 
     void join() {
@@ -97,33 +199,127 @@ namespace thread_pool_util {
     }
 
   public:
-    void _main() {
+    void _main(std::size_t index) {
+      _current_pool = this;
+      _current_worker = index;
+
       while (_continue) {
-        if (auto task = this->pop()) {
+        if (auto task = pop(index)) {
           (*task)->run();
+          continue;
+        }
+
+        std::unique_lock uniq_lock(_lock);
+
+        // Workers pushing a task wake a worker only if they see it idle, so look again once counted as idle
+        ++_idle;
+        auto fg = util::fail_guard([this]() {
+          --_idle;
+        });
+
+        if (!_continue || has_tasks()) {
+          continue;
+        }
+
+        auto timer_hint = _timer_hint.load();
+        if (_timer_waiting || timer_hint == std::numeric_limits<__time_point::rep>::max()) {
+          _cv.wait(uniq_lock);
         } else {
-          std::unique_lock uniq_lock(_lock);
+          _timer_waiting = true;
+          _timer_cv.wait_until(uniq_lock, __time_point {__time_point::duration {timer_hint}});
+          _timer_waiting = false;
+        }
+      }
 
-          if (ready()) {
-            continue;
-          }
+      // Execute remaining tasks
+      while (auto task = pop(index)) {
+        (*task)->run();
+      }
+
+      _current_pool = nullptr;
+    }
+
+  private:
+    /**
+     * @brief Lower the time of the next delayed task, and wake a worker to wait for it.
+     * @details Must be called with _lock held.
+     */
+    void update_timer_hint(__time_point time_point) {
+      auto rep = time_point.time_since_epoch().count();
+      if (rep >= _timer_hint.load()) {
+        return;
+      }
 
-          if (!_continue) {
-            break;
+      _timer_hint = rep;
+      if (_timer_waiting) {
+        _timer_cv.notify_one();
+      } else if (_idle.load() > 0) {
+        _cv.notify_one();
+      }
+    }
+
+    /**
+     * @return true if a delayed task might be due.
+     */
+    bool timer_due() {
+      auto timer_hint = _timer_hint.load(std::memory_order_relaxed);
+
+      return timer_hint != std::numeric_limits<__time_point::rep>::max() && std::chrono::steady_clock::now().time_since_epoch().count() >= timer_hint;
+    }
+
+    /**
+     * @brief Get the next task for a worker: a delayed task that is due, then its own queue and then the
+     * queues of the other workers, one lane after the other.
+     * @param index The index of the worker.
+     */
+    std::optional<__task> pop(std::size_t index) {
+      if (timer_due()) {
+        if (auto task = TaskPool::pop()) {
+          return task;
+        }
+
+        std::lock_guard lg(_lock);
+        auto time_point = TaskPool::next();
+        _timer_hint = time_point ? time_point->time_since_epoch().count() : std::numeric_limits<__time_point::rep>::max();
+      }
+
+      for (std::size_t lane = 0; lane < LANES; ++lane) {
+        for (std::size_t x = 0; x < _worker_count; ++x) {
+          auto &worker = _workers[(index + x) % _worker_count];
+          if (worker.queued.load(std::memory_order_relaxed) == 0) {
+            continue;
           }
 
-          if (auto tp = next()) {
-            _cv.wait_until(uniq_lock, *tp);
-          } else {
-            _cv.wait(uniq_lock);
+          std::lock_guard lg(worker.lock);
+          auto &tasks = worker.lanes[lane];
+          if (!tasks.empty()) {
+            __task task = std::move(tasks.front());
+            tasks.pop_front();
+            --worker.queued;
+            return task;
           }
         }
       }
 
-      // Execute remaining tasks
-      while (auto task = this->pop()) {
-        (*task)->run();
+      return std::nullopt;
+    }
+
+    /**
+     * @return true if a worker would find a task.
+     */
+    bool has_tasks() {
+      if (timer_due()) {
+        return true;
       }
+
+      // Counted as idle before looking, so a task pushed after this either shows up here or wakes a worker
+      for (std::size_t x = 0; x < _worker_count; ++x) {
+        if (_workers[x].queued.load() > 0) {
+          return true;
+        }
+      }
+
+      return false;
     }
   };
 }  // namespace thread_pool_util
@@ -5,12 +5,20 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 // local includes
@@ -24,18 +32,35 @@ namespace safe {
 
     template<class... Args>
     void raise(Args &&...args) {
-      std::lock_guard lg {_lock};
-      if (!_continue) {
-        return;
+      std::function<void()> notify;
+      {
+        std::lock_guard lg {_lock};
+        if (!_continue) {
+          return;
+        }
+
+        if constexpr (std::is_same_v<std::optional<T>, status_t>) {
+          _status = std::make_optional<T>(std::forward<Args>(args)...);
+        } else {
+          _status = status_t {std::forward<Args>(args)...};
+        }
+
+        _cv.notify_all();
+        notify = _notify;
       }
 
-      if constexpr (std::is_same_v<std::optional<T>, status_t>) {
-        _status = std::make_optional<T>(std::forward<Args>(args)...);
-      } else {
-        _status = status_t {std::forward<Args>(args)...};
+      if (notify) {
+        notify();
       }
+    }
 
-      _cv.notify_all();
+    /**
+     * @brief Call a function after each raise, for consumers that wait on something other than this event.
+     * @param notify The function, called on the raising thread without holding the lock.
+     */
+    void notify_with(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+      _notify = std::move(notify);
     }
 
     // pop and view should not be used interchangeably
@@ -143,6 +168,7 @@ namespace safe {
   private:
     bool _continue {true};
     status_t _status {util::false_v<status_t>};
+    std::function<void()> _notify;
 
     std::condition_variable _cv;
     std::mutex _lock;
@@ -260,19 +286,36 @@ namespace safe {
 
     template<class... Args>
     void raise(Args &&...args) {
-      std::lock_guard ul {_lock};
+      std::function<void()> notify;
+      {
+        std::lock_guard ul {_lock};
 
-      if (!_continue) {
-        return;
-      }
+        if (!_continue) {
+          return;
+        }
+
+        if (_queue.size() == _max_elements) {
+          _queue.clear();
+        }
 
-      if (_queue.size() == _max_elements) {
-        _queue.clear();
+        _queue.emplace_back(std::forward<Args>(args)...);
+
+        _cv.notify_all();
+        notify = _notify;
       }
 
-      _queue.emplace_back(std::forward<Args>(args)...);
+      if (notify) {
+        notify();
+      }
+    }
 
-      _cv.notify_all();
+    /**
+     * @brief Call a function after each raise, for consumers that wait on something other than this queue.
+     * @param notify The function, called on the raising thread without holding the lock.
+     */
+    void notify_with(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+      _notify = std::move(notify);
     }
 
     bool peek() {
@@ -339,6 +382,7 @@ namespace safe {
   private:
     bool _continue {true};
     std::uint32_t _max_elements;
+    std::function<void()> _notify;
 
     std::mutex _lock;
     std::condition_variable _cv;
@@ -346,6 +390,181 @@ namespace safe {
     std::vector<T> _queue;
   };
 
+  /**
+   * @brief A lock-free ring buffer queue for exactly one producer and one consumer thread.
+   * @details This has the same interface as `queue_t`. `raise()` never takes a lock, unless the consumer is parked.
+   *          `pop()` spins for a short while before parking on a condition variable, so a consumer that keeps up
+   *          with the producer never sleeps. The capacity is rounded up to a power of two. Since only the consumer
+   *          may remove elements, raising to a full queue drops the new element instead of clearing the queue.
+   *          The producer may lower the limit of elements below the capacity without reallocating the ring.
+   */
+  template<class T>
+  class spsc_queue_t {
+  public:
+    using status_t = util::optional_t<T>;
+
+    /**
+     * @brief The number of times `pop()` checks for an element before parking, on machines with several CPUs.
+     */
+    static constexpr int SPIN_COUNT = 1024;
+
+    spsc_queue_t(std::uint32_t max_elements = 32):
+        _ring(std::bit_ceil(std::max<std::uint32_t>(max_elements, 1))),
+        _mask {_ring.size() - 1},
+        _limit {_ring.size()} {
+    }
+
+    /**
+     * @brief Queue an element.
+     * @return `false` if the element was dropped, because the queue is full or stopped.
+     */
+    template<class... Args>
+    bool raise(Args &&...args) {
+      if (!_continue.load(std::memory_order_relaxed)) {
+        return false;
+      }
+
+      auto tail = _tail.load(std::memory_order_relaxed);
+      if (tail - _head.load(std::memory_order_acquire) >= _limit) {
+        return false;
+      }
+
+      _ring[tail & _mask] = T(std::forward<Args>(args)...);
+
+      // Publishing the element and checking for a parked consumer must not be reordered, see wait()
+      _tail.store(tail + 1, std::memory_order_seq_cst);
+      if (_waiting.load(std::memory_order_seq_cst)) {
+        std::lock_guard lg {_lock};
+        _cv.notify_one();
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Get the number of queued elements.
+     * @note On the producer thread, this may only overestimate, since the consumer takes elements at any time.
+     */
+    std::size_t size() const {
+      return _tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const {
+      return _ring.size();
+    }
+
+    /**
+     * @brief Set how many elements may be queued before new ones are dropped.
+     * @details Elements already queued above the limit stay queued. This may only be called by the producer.
+     * @param limit The limit, clamped to `[1, capacity()]`.
+     */
+    void set_limit(std::size_t limit) {
+      _limit = std::clamp<std::size_t>(limit, 1, _ring.size());
+    }
+
+    std::size_t limit() const {
+      return _limit;
+    }
+
+    bool peek() {
+      return _continue && !empty();
+    }
+
+    template<class Rep, class Period>
+    status_t pop(std::chrono::duration<Rep, Period> delay) {
+      if (!wait(std::chrono::steady_clock::now() + delay)) {
+        return util::false_v<status_t>;
+      }
+
+      return take();
+    }
+
+    status_t pop() {
+      if (!wait(std::nullopt)) {
+        return util::false_v<status_t>;
+      }
+
+      return take();
+    }
+
+    void stop() {
+      std::lock_guard lg {_lock};
+
+      _continue = false;
+
+      _cv.notify_all();
+    }
+
+    [[nodiscard]] bool running() const {
+      return _continue;
+    }
+
+  private:
+    bool empty() const {
+      return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_seq_cst);
+    }
+
+    bool wait(const std::optional<std::chrono::steady_clock::time_point> &deadline) {
+      // Spinning only keeps the producer from running when there's a single CPU
+      static const int spin_count = std::thread::hardware_concurrency() > 1 ? SPIN_COUNT : 0;
+
+      for (int x = 0; x < spin_count; ++x) {
+        if (!_continue) {
+          return false;
+        }
+
+        if (!empty()) {
+          return true;
+        }
+      }
+
+      std::unique_lock ul {_lock};
+
+      // Either raise() sees that we're parked, or we see the element it published
+      _waiting.store(true, std::memory_order_seq_cst);
+      auto fg = util::fail_guard([this]() {
+        _waiting.store(false, std::memory_order_relaxed);
+      });
+
+      auto ready = [this]() {
+        return !_continue || !empty();
+      };
+
+      if (deadline) {
+        _cv.wait_until(ul, *deadline, ready);
+      } else {
+        _cv.wait(ul, ready);
+      }
+
+      return _continue && !empty();
+    }
+
+    status_t take() {
+      auto head = _head.load(std::memory_order_relaxed);
+
+      status_t val {std::move(_ring[head & _mask])};
+      _head.store(head + 1, std::memory_order_release);
+
+      return val;
+    }
+
+    std::atomic<bool> _continue {true};
+    std::atomic<bool> _waiting {false};
+
+    std::vector<T> _ring;
+    std::size_t _mask;
+
+    // Only the producer reads and writes the limit
+    std::size_t _limit;
+
+    // Keep the indices on separate cache lines, since each is written by a different thread
+    alignas(64) std::atomic<std::uint64_t> _head {0};
+    alignas(64) std::atomic<std::uint64_t> _tail {0};
+
+    std::mutex _lock;
+    std::condition_variable _cv;
+  };
+
   template<class T>
   class shared_t {
   public:
@@ -455,12 +674,60 @@ namespace safe {
     construct_f _construct;
     destruct_f _destruct;
 
-    std::array<std::uint8_t, sizeof(element_type)> _object_buf;
+    alignas(element_type) std::array<std::uint8_t, sizeof(element_type)> _object_buf;
 
-    std::uint32_t _count;
+    std::uint32_t _count {0};
     std::mutex _lock;
   };
 
+  /**
+   * @brief A `shared_t` for each key, so the users of the same key share one value.
+   * @details The value of a key is constructed when the first reference to it is taken, and destructed
+   *          once the last one is released, like with `shared_t`.
+   */
+  template<class K, class T>
+  class shared_map_t {
+  public:
+    using key_type = K;
+    using element_type = T;
+
+    using construct_f = std::function<int(element_type &, const key_type &)>;
+    using destruct_f = std::function<void(element_type &)>;
+    using ptr_t = typename shared_t<element_type>::ptr_t;
+
+    template<class FC, class FD>
+    shared_map_t(FC &&fc, FD &&fd):
+        _construct {std::forward<FC>(fc)},
+        _destruct {std::forward<FD>(fd)} {
+    }
+
+    /**
+     * @brief Take a reference to the value of a key, constructing it if there is none.
+     * @return The reference, or an empty one if the value couldn't be constructed.
+     */
+    [[nodiscard]] ptr_t ref(const key_type &key) {
+      std::lock_guard lg {_lock};
+
+      // The values are never removed, so those taken a reference to stay where they are
+      auto it = _values.find(key);
+      if (it == std::end(_values)) {
+        auto construct = [this, key](element_type &value) {
+          return _construct(value, key);
+        };
+        it = _values.try_emplace(key, std::move(construct), _destruct).first;
+      }
+
+      return it->second.ref();
+    }
+
+  private:
+    construct_f _construct;
+    destruct_f _destruct;
+
+    std::mutex _lock;
+    std::map<key_type, shared_t<element_type>> _values;
+  };
+
   template<class T, class F_Construct, class F_Destruct>
   auto make_shared(F_Construct &&fc, F_Destruct &&fd) {
     return shared_t<T> {
@@ -474,7 +741,24 @@ namespace safe {
   class mail_raw_t;
   using mail_t = std::shared_ptr<mail_raw_t>;
 
-  void cleanup(mail_raw_t *);
+  /**
+   * @brief Identifies an event of a mail, and the type of its values.
+   */
+  template<class T>
+  struct event_id_t {
+    std::size_t index;  ///< The index of the post in the mail
+    std::string_view name;
+  };
+
+  /**
+   * @brief Identifies a queue of a mail, the type of its elements and how many it holds.
+   */
+  template<class T>
+  struct queue_id_t {
+    std::size_t index;  ///< The index of the post in the mail
+    std::string_view name;
+    std::uint32_t capacity;  ///< The number of elements the queue holds before it's cleared
+  };
 
   template<class T>
   class post_t: public T {
@@ -486,17 +770,14 @@ namespace safe {
     }
 
     mail_t mail;
-
-    ~post_t() {
-      cleanup(mail.get());
-    }
   };
 
-  template<class T>
-  inline auto lock(const std::weak_ptr<void> &wp) {
-    return std::reinterpret_pointer_cast<typename T::element_type>(wp.lock());
-  }
-
+  /**
+   * @brief Posts that threads communicate through, created when they're first asked for.
+   * @details Posts are identified by the ids in `mail`, which carry the type of the post, so asking
+   *          for a post with another type doesn't compile. A post is found by its index, so threads
+   *          should still keep the posts they use rather than asking for them repeatedly.
+   */
   class mail_raw_t: public std::enable_shared_from_this<mail_raw_t> {
   public:
     template<class T>
@@ -506,55 +787,37 @@ namespace safe {
     using queue_t = std::shared_ptr<post_t<queue_t<T>>>;
 
     template<class T>
-    event_t<T> event(const std::string_view &id) {
-      std::lock_guard lg {mutex};
-
-      auto it = id_to_post.find(id);
-      if (it != std::end(id_to_post)) {
-        return lock<event_t<T>>(it->second);
-      }
-
-      auto post = std::make_shared<typename event_t<T>::element_type>(shared_from_this());
-      id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> {std::string {id}, post});
-
-      return post;
+    event_t<T> event(const event_id_t<T> &id) {
+      return post<typename event_t<T>::element_type>(id.index);
     }
 
     template<class T>
-    queue_t<T> queue(const std::string_view &id) {
-      std::lock_guard lg {mutex};
-
-      auto it = id_to_post.find(id);
-      if (it != std::end(id_to_post)) {
-        return lock<queue_t<T>>(it->second);
-      }
-
-      auto post = std::make_shared<typename queue_t<T>::element_type>(shared_from_this(), 32);
-      id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> {std::string {id}, post});
-
-      return post;
+    queue_t<T> queue(const queue_id_t<T> &id) {
+      return post<typename queue_t<T>::element_type>(id.index, id.capacity);
     }
 
-    void cleanup() {
+  private:
+    template<class P, class... Args>
+    std::shared_ptr<P> post(std::size_t index, Args &&...args) {
       std::lock_guard lg {mutex};
 
-      for (auto it = std::begin(id_to_post); it != std::end(id_to_post); ++it) {
-        auto &weak = it->second;
-
-        if (weak.expired()) {
-          id_to_post.erase(it);
+      if (index >= posts.size()) {
+        posts.resize(index + 1);
+      }
 
-          return;
-        }
+      // The type of the post is part of its id, so the cast is safe
+      if (auto existing = posts[index].lock()) {
+        return std::static_pointer_cast<P>(existing);
       }
+
+      auto created = std::make_shared<P>(shared_from_this(), std::forward<Args>(args)...);
+      posts[index] = created;
+
+      return created;
     }
 
     std::mutex mutex;
 
-    std::map<std::string, std::weak_ptr<void>, std::less<>> id_to_post;
+    std::vector<std::weak_ptr<void>> posts;
   };
-
-  inline void cleanup(mail_raw_t *mail) {
-    mail->cleanup();
-  }
 }  // namespace safe
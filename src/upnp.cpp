@@ -3,15 +3,21 @@
  * @brief Definitions for UPnP port mapping.
  */
 // standard includes
+#include <chrono>
+#include <filesystem>
+#include <future>
 #include <stddef.h>  // workaround for type_t error in miniupnpc 2.3.3, see https://github.com/miniupnp/miniupnp/commit/e263ab6f56c382e10fed31347ec68095d691a0e8
+#include <vector>
 
 // lib includes
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/upnpcommands.h>
+#include <nlohmann/json.hpp>
 
 // local includes
 #include "config.h"
 #include "confighttp.h"
+#include "file_handler.h"
 #include "globals.h"
 #include "logging.h"
 #include "network.h"
@@ -50,6 +56,52 @@ namespace upnp {
     return "Unknown status"sv;
   }
 
+  static std::filesystem::path igd_cache_file() {
+    return platf::appdata() / "upnp_igd.json"sv;
+  }
+
+  /**
+   * @brief Load the root description URL of the IGD that was used last.
+   * @return The URL, or an empty string if there is none.
+   */
+  static std::string load_igd_url() {
+    auto file = igd_cache_file();
+    auto contents = file_handler::read_file(file.string().c_str());
+    if (contents.empty()) {
+      return {};
+    }
+
+    auto tree = nlohmann::json::parse(contents, nullptr, false);
+    if (tree.is_discarded() || !tree.is_object()) {
+      BOOST_LOG(warning) << "Ignoring malformed UPnP IGD cache: "sv << file.string();
+      return {};
+    }
+
+    auto url = tree.find("rootdesc");
+    if (url == tree.end() || !url->is_string()) {
+      return {};
+    }
+
+    return url->get<std::string>();
+  }
+
+  /**
+   * @brief Store the root description URL of the IGD, so the next start can skip discovering it.
+   * @param url The URL.
+   */
+  static void store_igd_url(const std::string &url) {
+    nlohmann::json tree {{"rootdesc", url}};
+
+    auto file = igd_cache_file();
+    if (file_handler::write_file(file.string().c_str(), tree.dump(2))) {
+      BOOST_LOG(warning) << "Couldn't write UPnP IGD cache: "sv << file.string();
+    }
+  }
+
+  static std::int64_t milliseconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
   /**
    * This function is a wrapper around UPNP_GetValidIGD() that returns the status code. There is a pre-processor
    * check to determine which version of the function to call based on the version of the MiniUPnPc library.
@@ -295,6 +347,55 @@ namespace upnp {
       }
     }
 
+    /**
+     * @brief Find the IGD, trying the one that worked last before discovering the devices.
+     * @details Discovery waits for every device on the network to answer, while fetching the
+     *          description of a known IGD only takes a round trip.
+     * @param urls urls_t of the IGD.
+     * @param data IGDdatas of the IGD.
+     * @param lan_addr The local IP address the IGD is reached from.
+     * @return `true` if a valid IGD was found.
+     */
+    bool find_igd(urls_t &urls, IGDdatas &data, std::array<char, INET6_ADDRESS_STRLEN> &lan_addr) {
+      auto start = std::chrono::steady_clock::now();
+
+      if (!igd_url.empty()) {
+        urls_t known_urls;
+        if (UPNP_GetIGDFromUrl(igd_url.c_str(), &known_urls.el, &data, lan_addr.data(), lan_addr.size())) {
+          BOOST_LOG(debug) << "Reached known IGD device "sv << igd_url << " in "sv << milliseconds_since(start) << "ms"sv;
+          urls = std::move(known_urls);
+          return true;
+        }
+
+        BOOST_LOG(debug) << "Known IGD device "sv << igd_url << " isn't reachable anymore, discovering devices"sv;
+        igd_url.clear();
+        start = std::chrono::steady_clock::now();
+      }
+
+      int err = 0;
+      device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
+      if (!device || err) {
+        BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
+        return false;
+      }
+
+      for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
+        BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+      }
+
+      auto status = upnp::UPNP_GetValidIGDStatus(device, &urls, &data, lan_addr);
+      if (status != 1 && status != 2) {
+        BOOST_LOG(error) << status_string(status);
+        return false;
+      }
+
+      BOOST_LOG(debug) << "Found valid IGD device: "sv << urls->rootdescURL << " in "sv << milliseconds_since(start) << "ms"sv;
+
+      igd_url = urls->rootdescURL;
+      store_igd_url(igd_url);
+      return true;
+    }
+
     /**
      * @brief Maintains UPnP port forwarding rules
      */
@@ -305,53 +406,56 @@ namespace upnp {
       urls_t mapped_urls;
       auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
+      igd_url = load_igd_url();
+
       // Refresh UPnP rules every few minutes. They can be lost if the router reboots,
       // WAN IP address changes, or various other conditions.
       do {
-        int err = 0;
-        device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
-        if (!device || err) {
-          BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
-          mapped = false;
-          continue;
-        }
+        auto start = std::chrono::steady_clock::now();
 
-        for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
-          BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+        // The IPv6 pinholes are opened through a separate discovery, which doesn't have to wait for the IPv4 mappings
+        std::future<bool> pinholes;
+        if (address_family == net::af_e::BOTH) {
+          pinholes = std::async(std::launch::async, &deinit_t::create_ipv6_pinholes, this);
         }
 
         std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
 
         urls_t urls;
-        auto status = upnp::UPNP_GetValidIGDStatus(device, &urls, &data, lan_addr);
-        if (status != 1 && status != 2) {
-          BOOST_LOG(error) << status_string(status);
-          mapped = false;
-          continue;
-        }
+        if (find_igd(urls, data, lan_addr)) {
+          std::string lan_addr_str {lan_addr.data()};
 
-        std::string lan_addr_str {lan_addr.data()};
+          // Each mapping is a few round trips to the IGD, so they're made alongside each other
+          std::vector<std::future<bool>> results;
+          for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
+            results.emplace_back(std::async(std::launch::async, &deinit_t::map_upnp_port, this, std::cref(data), std::cref(urls), std::cref(lan_addr_str), std::cref(*it)));
+          }
 
-        BOOST_LOG(debug) << "Found valid IGD device: "sv << urls->rootdescURL;
+          int failed = 0;
+          for (auto &result : results) {
+            failed += !result.get();
+          }
 
-        for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
-          map_upnp_port(data, urls, lan_addr_str, *it);
-        }
+          if (!mapped) {
+            BOOST_LOG(info) << "Completed UPnP port mappings to "sv << lan_addr_str << " via "sv << urls->rootdescURL
+                            << " in "sv << milliseconds_since(start) << "ms"sv
+                            << (failed ? " ("s + std::to_string(failed) + " failed)"s : ""s);
+          } else {
+            BOOST_LOG(debug) << "Renewed UPnP port mappings in "sv << milliseconds_since(start) << "ms"sv;
+          }
 
-        if (!mapped) {
-          BOOST_LOG(info) << "Completed UPnP port mappings to "sv << lan_addr_str << " via "sv << urls->rootdescURL;
+          mapped = true;
+          mapped_urls = std::move(urls);
+        } else {
+          mapped = false;
         }
 
         // If we are listening on IPv6 and the IGD has an IPv6 firewall enabled, try to create IPv6 firewall pinholes
-        if (address_family == net::af_e::BOTH) {
-          if (create_ipv6_pinholes() && !mapped) {
-            // Only log the first time through
-            BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
-          }
+        if (pinholes.valid() && pinholes.get() && !mapped_ipv6) {
+          // Only log the first time through
+          BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
+          mapped_ipv6 = true;
         }
-
-        mapped = true;
-        mapped_urls = std::move(urls);
       } while (!shutdown_event->view(REFRESH_INTERVAL));
 
       if (mapped) {
@@ -361,6 +465,10 @@ namespace upnp {
       }
     }
 
+    // The root description URL of the IGD the ports are mapped on
+    std::string igd_url;
+    bool mapped_ipv6 = false;
+
     std::vector<mapping_t> mappings;
     std::thread upnp_thread;
   };
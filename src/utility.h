@@ -967,6 +967,8 @@ namespace util {
     double x;
     double y;
 
+    friend bool operator==(const point_t &, const point_t &) = default;
+
     friend std::ostream &operator<<(std::ostream &os, const point_t &p) {
       return (os << "Point(x: " << p.x << ", y: " << p.y << ")");
     }
@@ -3,9 +3,18 @@
  * @brief Definitions for video.
  */
 // standard includes
+#include <algorithm>
 #include <atomic>
 #include <bitset>
-#include <list>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <thread>
 
 // lib includes
@@ -22,13 +31,23 @@ extern "C" {
 #include "cbs.h"
 #include "config.h"
 #include "display_device.h"
+#include "encoder_cache.h"
+#include "frame_trace.h"
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
+#include "rtsp.h"
 #include "sync.h"
+#include "thread_affinity.h"
 #include "video.h"
+#include "video_quality.h"
+
+#ifdef __APPLE__
+  #include "platform/macos/vt_encoder.h"
+#endif
 
 #ifdef __linux__
   #ifdef SUNSHINE_BUILD_EVDI
@@ -139,7 +158,8 @@ namespace video {
       sws_input_frame->data[0] = img.data;
       sws_input_frame->linesize[0] = img.row_pitch;
 
-      // Perform color conversion and scaling to the final size
+      // Perform color conversion and scaling to the final size, each thread converting a band of rows
+      convert_logger.first_point_now();
       auto status = sws_scale_frame(sws.get(), requires_padding ? sws_output_frame.get() : sw_frame.get(), sws_input_frame.get());
       if (status < 0) {
         char string[AV_ERROR_MAX_STRING_SIZE];
@@ -162,6 +182,7 @@ namespace video {
           }
         }
       }
+      convert_logger.second_point_now_and_log();
 
       // If frame is not a software frame, it means we still need to transfer from main memory
       // to vram memory
@@ -260,7 +281,7 @@ namespace video {
       av_dict_set_int(&options, "dsth", sws_output_frame->height, 0);
       av_dict_set_int(&options, "dst_format", sws_output_frame->format, 0);
       av_dict_set_int(&options, "sws_flags", SWS_LANCZOS | SWS_ACCURATE_RND, 0);
-      av_dict_set_int(&options, "threads", config::video.min_threads, 0);
+      av_dict_set_int(&options, "threads", conversion_threads(out_height), 0);
 
       auto status = av_opt_set_dict(sws.get(), &options);
       av_dict_free(&options);
@@ -280,6 +301,23 @@ namespace video {
       return 0;
     }
 
+    /**
+     * @brief Get the number of threads converting frames of a height.
+     * @details This is the `sws_threads` option, or with `0` a thread every 270 rows, which keeps
+     *          the bands large enough to be worth a thread. It's no fewer than `min_threads`,
+     *          which used to be the count, and leaves two CPUs for capturing and sending.
+     */
+    static int conversion_threads(int height) {
+      auto threads = config::video.sws_threads;
+      if (threads <= 0) {
+        auto cpus = std::max((int) std::thread::hardware_concurrency() - 2, 1);
+        threads = std::min(std::max(height / 270, config::video.min_threads), cpus);
+      }
+
+      BOOST_LOG(info) << "Converting frames for software encoding with "sv << threads << " threads"sv;
+      return threads;
+    }
+
     // Store ownership when frame is hw_frame
     avcodec_frame_t hw_frame;
 
@@ -291,6 +329,8 @@ namespace video {
     // Offset of input image to output frame in pixels
     int offsetW;
     int offsetH;
+
+    logging::time_delta_percentile_logger convert_logger {debug, "Video: software color conversion time", 20s, &metrics::video.convert_recent_seconds};
   };
 
   enum flag_e : uint32_t {
@@ -312,10 +352,14 @@ namespace video {
   public:
     avcodec_encode_session_t() = default;
 
-    avcodec_encode_session_t(avcodec_ctx_t &&avcodec_ctx, std::unique_ptr<platf::avcodec_encode_device_t> encode_device, int inject):
+    avcodec_encode_session_t(avcodec_ctx_t &&avcodec_ctx, std::unique_ptr<platf::avcodec_encode_device_t> encode_device, int inject, int intra_refresh_frames):
         avcodec_ctx {std::move(avcodec_ctx)},
         device {std::move(encode_device)},
-        inject {inject} {
+        inject {inject},
+        intra_refresh_frames {intra_refresh_frames} {
+      if (this->avcodec_ctx) {
+        rc_buffer_size = this->avcodec_ctx->rc_buffer_size;
+      }
     }
 
     avcodec_encode_session_t(avcodec_encode_session_t &&other) noexcept = default;
@@ -337,10 +381,15 @@ namespace video {
       device = std::move(other.device);
       avcodec_ctx = std::move(other.avcodec_ctx);
       replacements = std::move(other.replacements);
+      splices = std::move(other.splices);
       sps = std::move(other.sps);
       vps = std::move(other.vps);
 
       inject = other.inject;
+      intra_refresh_frames = other.intra_refresh_frames;
+      rc_buffer_size = other.rc_buffer_size;
+      max_frame_size = other.max_frame_size;
+      quality_sampler = other.quality_sampler;
 
       return *this;
     }
@@ -373,16 +422,119 @@ namespace video {
       request_idr_frame();
     }
 
+    void acknowledge_frame(int64_t frame_index) override {
+    }
+
+    bool request_intra_refresh() override {
+      // The refresh runs continuously, so the picture heals within a period from any frame
+      return intra_refresh_frames > 0;
+    }
+
+    bool set_bitrate(int bitrate) override {
+      if (!reconfigurable()) {
+        return false;
+      }
+
+      // Scale every rate control parameter together, so the VBR offset and the buffer length in frames are kept
+      auto ctx = avcodec_ctx.get();
+      auto scale = (double) bitrate * 1000 / ctx->rc_max_rate;
+      ctx->rc_max_rate = (int64_t) bitrate * 1000;
+      ctx->bit_rate = (int64_t) (ctx->bit_rate * scale);
+      if (ctx->rc_min_rate > 0) {
+        ctx->rc_min_rate = ctx->bit_rate;
+      }
+      if (ctx->rc_buffer_size > 0) {
+        rc_buffer_size = (int) (rc_buffer_size * scale);
+        apply_max_frame_size();
+      }
+
+      return true;
+    }
+
+    bool set_max_frame_size(int64_t bits) override {
+      if (!reconfigurable() || avcodec_ctx->rc_buffer_size <= 0) {
+        return false;
+      }
+
+      max_frame_size = bits;
+      apply_max_frame_size();
+      return true;
+    }
+
+    void set_roi(const std::optional<roi_t> &roi) override {
+      if (!device || !device->frame) {
+        return;
+      }
+
+      // The side data stays on the frame, so every frame after this one is encoded with the region
+      auto frame = device->frame;
+      av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+      if (!roi) {
+        return;
+      }
+
+      auto side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, sizeof(AVRegionOfInterest));
+      if (!side_data) {
+        return;
+      }
+
+      auto region = (AVRegionOfInterest *) side_data->data;
+      region->self_size = sizeof(AVRegionOfInterest);
+      region->top = roi->top;
+      region->bottom = roi->bottom;
+      region->left = roi->left;
+      region->right = roi->right;
+
+      // Encoders scale the offset by their QP range, which is 51 at 8 bits
+      region->qoffset = AVRational {roi->qp_delta, 51};
+    }
+
+    bool reconfigurable() const {
+      auto ctx = avcodec_ctx.get();
+      if (!ctx || !ctx->codec || ctx->rc_max_rate <= 0) {
+        return false;
+      }
+
+      // Only these encoders pick up rate control changes between frames, the others ignore them
+      std::string_view name {ctx->codec->name};
+      return name == "libx264"sv || name.ends_with("_nvenc"sv);
+    }
+
+    void apply_max_frame_size() {
+      auto ctx = avcodec_ctx.get();
+      if (max_frame_size <= 0 || ctx->framerate.num <= 0) {
+        ctx->rc_buffer_size = rc_buffer_size;
+        return;
+      }
+
+      // A buffer smaller than an average frame would starve the rate control
+      auto average_frame_size = av_rescale(ctx->rc_max_rate, ctx->framerate.den, ctx->framerate.num);
+      ctx->rc_buffer_size = (int) std::min<int64_t>(rc_buffer_size, std::max(max_frame_size, average_frame_size));
+    }
+
     avcodec_ctx_t avcodec_ctx;
     std::unique_ptr<platf::avcodec_encode_device_t> device;
 
     std::vector<packet_raw_t::replace_t> replacements;
 
+    // Where the replacements were in the last IDR frame
+    std::vector<packet_raw_t::splice_t> splices;
+
     cbs::nal_t sps;
     cbs::nal_t vps;
 
     // inject sps/vps data into idr pictures
     int inject;
+
+    // The rate control buffer the encoder was opened with, scaled with the bitrate, before the frame size limit
+    int rc_buffer_size = 0;
+    int64_t max_frame_size = 0;
+
+    // Frames each rolling intra refresh spans, 0 without rolling intra refresh
+    int intra_refresh_frames = 0;
+
+    // Owned by the encoding thread, which outlives the session
+    video_quality::sampler_t *quality_sampler = nullptr;
   };
 
   class nvenc_encode_session_t: public encode_session_t {
@@ -411,17 +563,68 @@ namespace video {
         return;
       }
 
-      if (!device->nvenc->invalidate_ref_frames(first_frame, last_frame)) {
+      // The frame after the invalidation is marked as such, so the client resumes decoding from the refresh
+      if (!device->nvenc->invalidate_ref_frames(first_frame, last_frame) && !device->nvenc->request_intra_refresh()) {
         force_idr = true;
       }
     }
 
-    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index) {
+    void acknowledge_frame(int64_t frame_index) override {
+      if (!device || !device->nvenc) {
+        return;
+      }
+
+      device->nvenc->acknowledge_frame(frame_index);
+    }
+
+    bool request_intra_refresh() override {
+      return device && device->nvenc && device->nvenc->request_intra_refresh();
+    }
+
+    bool set_bitrate(int bitrate) override {
+      if (!device || !device->nvenc) {
+        return false;
+      }
+
+      return device->nvenc->set_bitrate(bitrate);
+    }
+
+    bool set_max_frame_size(int64_t bits) override {
+      if (!device || !device->nvenc) {
+        return false;
+      }
+
+      return device->nvenc->set_max_frame_size((uint64_t) bits);
+    }
+
+    void set_roi(const std::optional<roi_t> &roi) override {
+      if (!device || !device->nvenc) {
+        return;
+      }
+
+      device->nvenc->set_roi(roi);
+    }
+
+    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index, const std::function<void(nvenc::nvenc_encoded_frame &&)> &on_part) {
       if (!device || !device->nvenc) {
         return {};
       }
 
-      auto result = device->nvenc->encode_frame(frame_index, force_idr);
+      auto result = device->nvenc->encode_frame(frame_index, force_idr, on_part);
+      force_idr = false;
+      return result;
+    }
+
+    bool is_pipelined() const {
+      return device && device->nvenc && device->nvenc->is_pipelined();
+    }
+
+    bool submit_frame(uint64_t frame_index, std::function<void(nvenc::nvenc_encoded_frame &&)> on_frame) {
+      if (!device || !device->nvenc) {
+        return false;
+      }
+
+      auto result = device->nvenc->submit_frame(frame_index, force_idr, std::move(on_frame));
       force_idr = false;
       return result;
     }
@@ -431,6 +634,72 @@ namespace video {
     bool force_idr = false;
   };
 
+#ifdef __APPLE__
+  class vt_encode_session_t: public encode_session_t {
+  public:
+    vt_encode_session_t(std::unique_ptr<platf::vt_encode_device_t> encode_device):
+        device(std::move(encode_device)) {
+    }
+
+    int convert(platf::img_t &img) override {
+      if (!device) {
+        return -1;
+      }
+      return device->convert(img);
+    }
+
+    void request_idr_frame() override {
+      force_idr = true;
+    }
+
+    void request_normal_frame() override {
+      force_idr = false;
+    }
+
+    void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
+      // The session can't drop references, so the client resumes decoding from an IDR frame
+      force_idr = true;
+    }
+
+    void acknowledge_frame(int64_t frame_index) override {
+    }
+
+    bool request_intra_refresh() override {
+      return false;
+    }
+
+    bool set_bitrate(int bitrate) override {
+      return device && device->vt && device->vt->set_bitrate(bitrate);
+    }
+
+    bool set_max_frame_size(int64_t bits) override {
+      // The data rate limit already holds every frame to an average one, which is as small as the limit gets
+      return device && device->vt;
+    }
+
+    void set_roi(const std::optional<roi_t> &roi) override {
+    }
+
+    std::optional<vt::vt_encoded_frame> encode_frame(uint64_t frame_index) {
+      if (!device || !device->vt) {
+        return std::nullopt;
+      }
+
+      auto result = device->vt->encode_frame(frame_index, force_idr);
+
+      // An IDR frame the session dropped is still owed to the client
+      if (result && !result->data.empty()) {
+        force_idr = false;
+      }
+      return result;
+    }
+
+  private:
+    std::unique_ptr<platf::vt_encode_device_t> device;
+    bool force_idr = false;
+  };
+#endif
+
   struct sync_session_ctx_t {
     safe::signal_t *join_event;
     safe::mail_raw_t::event_t<bool> shutdown_event;
@@ -442,11 +711,18 @@ namespace video {
     config_t config;
     int frame_nr;
     void *channel_data;
+    frame_scheduler::scheduler_t *scheduler;
   };
 
   struct sync_session_t {
     sync_session_ctx_t *ctx;
     std::unique_ptr<encode_session_t> session;
+
+    // Sessions with identical video settings that get the packets of this session's encoder
+    std::vector<sync_session_ctx_t *> followers;
+
+    // Replayed to the followers when they join
+    hdr_info_raw_t hdr_info {false};
   };
 
   using encode_session_ctx_queue_t = safe::queue_t<sync_session_ctx_t>;
@@ -457,6 +733,25 @@ namespace video {
     config_t config;
   };
 
+  /**
+   * @brief Hands a display switch over from the capture thread to the encoders.
+   * @details The capture thread opens the next display while it keeps capturing the current one, and publishes it
+   *          as the standby display. Encoders build their next session for it in the background. Once the capture
+   *          thread stopped capturing the current display, it bumps the generation and waits for every encoder to
+   *          acknowledge that it stopped using the current display before capturing the next one.
+   */
+  struct display_switch_t {
+    sync_util::sync_t<std::shared_ptr<platf::display_t>> standby;  ///< The next display, or `nullptr` if no switch is pending
+    std::atomic<int> prepared {0};  ///< Encoders that are prepared for the switch to the standby display
+    std::atomic<int> generation {0};  ///< Bumped by the capture thread each time it switches displays
+    std::atomic<int> acknowledged {0};  ///< Encoders that stopped using the previous display since the last switch
+
+    std::shared_ptr<platf::display_t> next() {
+      auto lg = standby.lock();
+      return standby.raw;
+    }
+  };
+
   struct capture_thread_async_ctx_t {
     std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue;
     std::thread capture_thread;
@@ -464,21 +759,66 @@ namespace video {
     safe::signal_t reinit_event;
     const encoder_t *encoder_p;
     sync_util::sync_t<std::weak_ptr<platf::display_t>> display_wp;
+    display_switch_t display_switch;
   };
 
   struct capture_thread_sync_ctx_t {
     encode_session_ctx_queue_t encode_session_ctx_queue {30};
   };
 
+  /**
+   * @brief Whether the stream is idle, shared by the capture thread, the encoders and the input of the clients.
+   */
+  struct idle_state_t {
+    std::atomic<std::chrono::steady_clock::rep> last_input {0};  ///< When a client last sent input, since the epoch of the clock
+    std::atomic_bool idle {false};  ///< Set by the capture thread, so the encoders trickle along with it
+
+    // Input ends the wait of the capture thread between two trickled frames
+    std::mutex lock;
+    std::condition_variable input;
+  };
+
+  idle_state_t idle_state;
+
   int start_capture_sync(capture_thread_sync_ctx_t &ctx);
   void end_capture_sync(capture_thread_sync_ctx_t &ctx);
-  int start_capture_async(capture_thread_async_ctx_t &ctx);
+  int start_capture_async(capture_thread_async_ctx_t &ctx, const std::string &output_name);
   void end_capture_async(capture_thread_async_ctx_t &ctx);
 
   // Keep a reference counter to ensure the capture thread only runs when other threads have a reference to the capture thread
-  auto capture_thread_async = safe::make_shared<capture_thread_async_ctx_t>(start_capture_async, end_capture_async);
+  // Sessions capturing the same display share its capture thread, by the output name they picked
+  safe::shared_map_t<std::string, capture_thread_async_ctx_t> capture_threads_async {start_capture_async, end_capture_async};
   auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
 
+  /**
+   * @brief An encoder whose packets are sent to every session subscribed to it.
+   */
+  struct shared_encoder_t {
+    config_t config;
+
+    // The events of the session running the encoder, other subscribers forward their requests to them
+    safe::mail_raw_t::event_t<bool> idr_events;
+    safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+
+    // Replayed to sessions that subscribe after the encoder started
+    input::touch_port_t touch_port;
+    hdr_info_raw_t hdr_info {false};
+
+    // Cleared when the session running the encoder stops it
+    std::atomic<bool> running {true};
+
+    struct subscriber_t {
+      void *channel_data;
+      safe::mail_raw_t::queue_t<packet_t> packets;  ///< The queue of the video broadcast thread sending the session
+    };
+
+    // Every subscribed session, starting with the session running the encoder
+    sync_util::sync_t<std::vector<subscriber_t>> subscribers;
+  };
+
+  // Encoders that sessions with an identical config can subscribe to
+  sync_util::sync_t<std::vector<std::shared_ptr<shared_encoder_t>>> shared_encoders;
+
 #ifdef _WIN32
   encoder_t nvenc {
     "nvenc"sv,
@@ -668,6 +1008,9 @@ namespace video {
         {"low_power"s, 1},
         {"recovery_point_sei"s, 0},
         {"pic_timing_sei"s, 0},
+        {"transform_skip"s, [](const config_t &cfg) {
+           return cfg.screenContent ? "1"s : ""s;
+         }},
       },
       {
         // SDR-specific options
@@ -754,6 +1097,15 @@ namespace video {
         {"rc"s, &config::video.amd.amd_rc_av1},
         {"usage"s, &config::video.amd.amd_usage_av1},
         {"enforce_hrd"s, &config::video.amd.amd_enforce_hrd},
+        {"screen_content_tools"s, [](const config_t &cfg) {
+           return cfg.screenContent ? "1"s : ""s;
+         }},
+        {"palette_mode"s, [](const config_t &cfg) {
+           return cfg.screenContent ? "1"s : ""s;
+         }},
+        {"force_integer_mv"s, [](const config_t &cfg) {
+           return cfg.screenContent ? "1"s : ""s;
+         }},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
@@ -851,7 +1203,10 @@ namespace video {
       // force I frames to be key frames, and set max bitrate to default to work
       // around a FFmpeg bug with CBR mode.
       {
-        {"svtav1-params"s, "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0"s},
+        {"svtav1-params"s, [](const config_t &cfg) {
+           // SVT-AV1 otherwise decides on palette and intra block copy from its own detection
+           return "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0"s + (cfg.screenContent ? ":scm=1"s : ""s);
+         }},
         {"preset"s, &config::video.sw.svtav1_preset},
       },
       {},  // SDR-specific options
@@ -1053,11 +1408,47 @@ namespace video {
   bool last_encoder_probe_supported_ref_frames_invalidation = false;
   std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec = {};
 
+  // Serializes probing, since cached probe results are revalidated in the background
+  static std::mutex probe_lock;
+
+  // Set when the last probe used cached results for any encoder
+  static std::atomic<bool> probe_used_cache = false;
+
+  // Set when the next probe must validate every encoder instead of using cached results
+  static std::atomic<bool> revalidation_pending = false;
+
+  // The fingerprint each encoder was last validated with, to store its refined capabilities under
+  static sync_util::sync_t<std::map<std::string_view, std::string>> encoder_fingerprints;
+
+  // The timings of the last probe that validated encoders
+  static sync_util::sync_t<encoder_probe_report_t> last_probe_report;
+
+  // The encoders that passed the last probe, in the order they're chosen in
+  static sync_util::sync_t<std::vector<const encoder_t *>> validated_encoders;
+
+  static std::filesystem::path encoder_cache_file() {
+    return platf::appdata() / "encoder_cache.json"sv;
+  }
+
+  static display_source_t display_source;
+
+  void set_display_source(display_source_t source) {
+    display_source = std::move(source);
+  }
+
+  static std::vector<std::string> list_displays(platf::mem_type_e type) {
+    return display_source.names ? display_source.names(type) : platf::display_names(type);
+  }
+
+  static std::shared_ptr<platf::display_t> open_display(platf::mem_type_e type, const std::string &display_name, const config_t &config) {
+    return display_source.open ? display_source.open(type, display_name, config) : platf::display(type, display_name, config);
+  }
+
   void reset_display(std::shared_ptr<platf::display_t> &disp, const platf::mem_type_e &type, const std::string &display_name, const config_t &config) {
     // We try this twice, in case we still get an error on reinitialization
     for (int x = 0; x < 2; ++x) {
       disp.reset();
-      disp = platf::display(type, display_name, config);
+      disp = open_display(type, display_name, config);
       if (disp) {
         break;
       }
@@ -1073,10 +1464,11 @@ namespace video {
    * @param dev_type The encoder device type used for display lookup.
    * @param display_names The list of display names to repopulate.
    * @param current_display_index The current display index or -1 if not yet known.
+   * @param requested_output_name The display the session picked, or empty for the configured one.
    */
-  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index) {
+  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index, const std::string &requested_output_name) {
     // It is possible that the output name may be empty even if it wasn't before (device disconnected) or vice-versa
-    const auto output_name {display_device::map_output_name(config::video.output_name)};
+    const auto output_name {display_device::map_output_name(requested_output_name.empty() ? config::video.output_name : requested_output_name)};
     std::string current_display_name;
 
     // If we have a current display index, let's start with that
@@ -1086,7 +1478,7 @@ namespace video {
 
     // Refresh the display names
     auto old_display_names = std::move(display_names);
-    display_names = platf::display_names(dev_type);
+    display_names = list_displays(dev_type);
 
     // If we now have no displays, let's put the old display array back and fail
     if (display_names.empty() && !old_display_names.empty()) {
@@ -1121,911 +1513,2340 @@ namespace video {
     }
   }
 
-#ifdef SUNSHINE_BUILD_EVDI
   /**
-   * @brief Prepares the EVDI virtual display for streaming if EVDI is configured
-   * @param client_config The client configuration containing resolution, framerate, and HDR settings
-   * @return true if preparation succeeded or wasn't needed, false if preparation failed
+   * @brief A display opened by `warm_up_display()` for the capture to take over.
    */
-  bool prepare_evdi_display(const config_t &client_config) {
-    BOOST_LOG(debug) << "EVDI: Checking if preparation needed - capture='"sv << config::video.capture 
-                     << "'"sv << ", is_active="sv << platf::evdi_is_active();
-    
-    if (config::video.capture == "evdi" && !platf::evdi_is_active()) {
-      constexpr auto KMS_DETECTION_WAIT_MS = std::chrono::milliseconds(500);
-      
-      BOOST_LOG(info) << "EVDI: Preparing virtual display for streaming session"sv;
-      BOOST_LOG(debug) << "EVDI: Client config: "sv << client_config.width << "x"sv 
-                       << client_config.height << "@"sv << client_config.framerate 
-                       << "Hz, HDR="sv << (client_config.dynamicRange > 0);
-      
-      if (!platf::evdi_prepare_stream(client_config)) {
-        BOOST_LOG(error) << "EVDI: Failed to prepare virtual display - streaming cannot start"sv;
-        return false;
-      }
-      
-      // Wait for the system to recognize the new display
-      BOOST_LOG(debug) << "EVDI: Waiting "sv << KMS_DETECTION_WAIT_MS.count() << "ms for KMS to detect new display"sv;
-      std::this_thread::sleep_for(KMS_DETECTION_WAIT_MS);
-    }
-    else {
-      BOOST_LOG(debug) << "EVDI: Preparation skipped - capture method is not 'evdi' or EVDI is already active"sv;
-    }
-    
-    return true;
-  }
-#endif
+  struct warm_display_t {
+    struct opened_t {
+      std::vector<std::string> display_names;  ///< The displays that were found when opening it
+      int display_p;  ///< The index of the opened display in `display_names`
+      std::shared_ptr<platf::display_t> disp;
+    };
 
-  void captureThread(
-    std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
-    sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
-    safe::signal_t &reinit_event,
-    const encoder_t &encoder
-  ) {
-    std::vector<capture_ctx_t> capture_ctxs;
+    std::mutex lock;
+    std::shared_future<opened_t> opened;
+    platf::mem_type_e dev_type;
+    config_t config;
+    int generation = 0;
+  };
 
-    auto fg = util::fail_guard([&]() {
-      capture_ctx_queue->stop();
+  // Long enough for the client to get from the launch request through the RTSP handshake
+  constexpr auto WARM_DISPLAY_LIFETIME = 10s;
 
-      // Stop all sessions listening to this thread
-      for (auto &capture_ctx : capture_ctxs) {
-        capture_ctx.images->stop();
-      }
-      for (auto &capture_ctx : capture_ctx_queue->unsafe()) {
-        capture_ctx.images->stop();
-      }
-    });
+  static warm_display_t warm_display;
 
-    auto switch_display_event = mail::man->event<int>(mail::switch_display);
+  // Long enough for a client that lost its connection to reconnect
+  constexpr auto PARKED_DISPLAY_LIFETIME = 5s;
 
-    // Wait for the initial capture context or a request to stop the queue
-    auto initial_capture_ctx = capture_ctx_queue->pop();
-    if (!initial_capture_ctx) {
-      return;
+  /**
+   * @brief Check whether a display opened for one mode can be captured for another.
+   */
+  static bool same_display_mode(const config_t &a, const config_t &b) {
+    return a.width == b.width &&
+           a.height == b.height &&
+           a.framerate == b.framerate &&
+           a.dynamicRange == b.dynamicRange;
+  }
+
+  /**
+   * @brief Open the display the capture would pick, the same way it does.
+   */
+  static warm_display_t::opened_t open_warm_display(platf::mem_type_e dev_type, config_t config) {
+    std::vector<std::string> display_names;
+    int display_p = -1;
+    refresh_displays(dev_type, display_names, display_p, config.output_name);
+
+    auto disp = open_display(dev_type, display_names[display_p], config);
+    return {std::move(display_names), display_p, std::move(disp)};
+  }
+
+  /**
+   * @brief Close the display opened by `warm_up_display()` if the capture didn't take it over.
+   * @param generation The warm-up the display was opened by, so a newer one is left alone.
+   */
+  static void close_warm_display(int generation) {
+    std::shared_future<warm_display_t::opened_t> stale;
+
+    std::lock_guard lg {warm_display.lock};
+    if (warm_display.generation == generation) {
+      stale = std::move(warm_display.opened);
     }
-    capture_ctxs.emplace_back(std::move(*initial_capture_ctx));
+  }
 
+  void warm_up_display(const config_t &config) {
 #ifdef SUNSHINE_BUILD_EVDI
-    // Explicitly prepare EVDI virtual display for streaming if EVDI is selected
-    if (!prepare_evdi_display(capture_ctxs.front().config)) {
+    // The virtual display only switches to the client's mode once the capture starts
+    if (config::video.capture == "evdi") {
       return;
     }
 #endif
 
-    // Get all the monitor names now, rather than at boot, to
-    // get the most up-to-date list available monitors
-    std::vector<std::string> display_names;
-    int display_p = -1;
-    refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
-    auto disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
-    if (!disp) {
+    if (!chosen_encoder) {
       return;
     }
-    display_wp = disp;
 
-    constexpr auto capture_buffer_size = 12;
-    std::list<std::shared_ptr<platf::img_t>> imgs(capture_buffer_size);
-
-    std::vector<std::optional<std::chrono::steady_clock::time_point>> imgs_used_timestamps;
-    const std::chrono::seconds trim_timeot = 3s;
-    auto trim_imgs = [&]() {
-      // count allocated and used within current pool
-      size_t allocated_count = 0;
-      size_t used_count = 0;
-      for (const auto &img : imgs) {
-        if (img) {
-          allocated_count += 1;
-          if (img.use_count() > 1) {
-            used_count += 1;
-          }
-        }
-      }
+    auto dev_type = chosen_encoder->platform_formats->dev_type;
 
-      // remember the timestamp of currently used count
-      const auto now = std::chrono::steady_clock::now();
-      if (imgs_used_timestamps.size() <= used_count) {
-        imgs_used_timestamps.resize(used_count + 1);
-      }
-      imgs_used_timestamps[used_count] = now;
+    int generation;
+    {
+      std::lock_guard lg {warm_display.lock};
 
-      // decide whether to trim allocated unused above the currently used count
-      // based on last used timestamp and universal timeout
-      size_t trim_target = used_count;
-      for (size_t i = used_count; i < imgs_used_timestamps.size(); i++) {
-        if (imgs_used_timestamps[i] && now - *imgs_used_timestamps[i] < trim_timeot) {
-          trim_target = i;
-        }
+      // The display kept after the last stream is already open for this mode
+      auto parked = warm_display.opened.valid() && warm_display.opened.wait_for(0s) == std::future_status::ready;
+      if (parked && warm_display.dev_type == dev_type && same_display_mode(warm_display.config, config)) {
+        generation = ++warm_display.generation;
+        task_pool.pushDelayed(close_warm_display, WARM_DISPLAY_LIFETIME, generation);
+        return;
       }
 
-      // trim allocated unused above the newly decided trim target
-      if (allocated_count > trim_target) {
-        size_t to_trim = allocated_count - trim_target;
-        // prioritize trimming least recently used
-        for (auto it = imgs.rbegin(); it != imgs.rend(); it++) {
-          auto &img = *it;
-          if (img && img.use_count() == 1) {
-            img.reset();
-            to_trim -= 1;
-            if (to_trim == 0) {
-              break;
-            }
-          }
-        }
-        // forget timestamps that no longer relevant
-        imgs_used_timestamps.resize(trim_target + 1);
-      }
-    };
+      warm_display.opened = std::async(std::launch::async, open_warm_display, dev_type, config).share();
+      warm_display.dev_type = dev_type;
+      warm_display.config = config;
+      generation = ++warm_display.generation;
+    }
 
-    auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
-      img_out.reset();
-      while (capture_ctx_queue->running()) {
-        // pick first allocated but unused
-        for (auto it = imgs.begin(); it != imgs.end(); it++) {
-          if (*it && it->use_count() == 1) {
-            img_out = *it;
-            if (it != imgs.begin()) {
-              // move image to the front of the list to prioritize its reusal
-              imgs.erase(it);
-              imgs.push_front(img_out);
-            }
-            break;
-          }
-        }
-        // otherwise pick first unallocated
-        if (!img_out) {
-          for (auto it = imgs.begin(); it != imgs.end(); it++) {
-            if (!*it) {
-              // allocate image
-              *it = disp->alloc_img();
-              img_out = *it;
-              if (it != imgs.begin()) {
-                // move image to the front of the list to prioritize its reusal
-                imgs.erase(it);
-                imgs.push_front(img_out);
-              }
-              break;
-            }
-          }
-        }
-        if (img_out) {
-          // trim allocated but unused portion of the pool based on timeouts
-          trim_imgs();
-          img_out->frame_timestamp.reset();
-          return true;
-        } else {
-          // sleep and retry if image pool is full
-          std::this_thread::sleep_for(1ms);
-        }
+    BOOST_LOG(debug) << "Opening the display ahead of the stream"sv;
+
+    // Don't keep the display open if the client never gets to the capture
+    task_pool.pushDelayed(close_warm_display, WARM_DISPLAY_LIFETIME, generation);
+  }
+
+  /**
+   * @brief Take over the display opened by `warm_up_display()`, waiting for it to open if needed.
+   * @details A display opened for another mode is closed, so the caller can open its own. The display
+   *          comes with the list of displays it was picked from moments ago, so the caller doesn't
+   *          have to enumerate them again.
+   * @param dev_type The encoder device type the display is needed for.
+   * @param config The video configuration from the client.
+   * @param display_names Set to the list of displays the display was picked from.
+   * @param display_p Set to the index of the display in `display_names`.
+   * @return The display, or `nullptr` if none was opened for it.
+   */
+  static std::shared_ptr<platf::display_t> take_warm_display(platf::mem_type_e dev_type, const config_t &config, std::vector<std::string> &display_names, int &display_p) {
+    std::shared_future<warm_display_t::opened_t> opened;
+    platf::mem_type_e warm_dev_type;
+    config_t warm_config;
+    {
+      std::lock_guard lg {warm_display.lock};
+      if (!warm_display.opened.valid()) {
+        return nullptr;
       }
-      return false;
-    };
 
-    // Capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+      opened = std::move(warm_display.opened);
+      warm_dev_type = warm_display.dev_type;
+      warm_config = warm_display.config;
+    }
 
-    while (capture_ctx_queue->running()) {
-      bool artificial_reinit = false;
+    auto &warm = opened.get();
 
-      auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
-        KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
-          if (!capture_ctx->images->running()) {
-            capture_ctx = capture_ctxs.erase(capture_ctx);
+    // Clients only tell the exact refresh rate once the stream is set up
+    auto same_mode =
+      same_display_mode(config, warm_config) &&
+      (config.framerateX100 == 0 || config.framerateX100 == config.framerate * 100);
+    if (!warm.disp || dev_type != warm_dev_type || !same_mode || config.output_name != warm_config.output_name) {
+      BOOST_LOG(debug) << "The display opened ahead of the stream doesn't match it, closing it"sv;
+      return nullptr;
+    }
 
-            continue;
-          }
+    BOOST_LOG(debug) << "Taking over the display opened ahead of the stream"sv;
+    display_names = warm.display_names;
+    display_p = warm.display_p;
+    return warm.disp;
+  }
 
-          if (frame_captured) {
-            capture_ctx->images->raise(img);
-          }
+  /**
+   * @brief Keep the display of a stream that ended open for a while, so a reconnecting client can take it over.
+   * @details Closing and reopening a display can take seconds on some platforms, which would be most
+   *          of the time it takes a client to reconnect after losing its connection.
+   */
+  static void park_display(platf::mem_type_e dev_type, const config_t &config, std::vector<std::string> display_names, int display_p, std::shared_ptr<platf::display_t> disp) {
+#ifdef SUNSHINE_BUILD_EVDI
+    // The virtual display only switches to the client's mode once the capture starts
+    if (config::video.capture == "evdi") {
+      return;
+    }
+#endif
 
-          ++capture_ctx;
-        })
+    // Nobody is going to reconnect
+    if (mail::man->event<bool>(mail::shutdown)->peek()) {
+      return;
+    }
 
-        if (!capture_ctx_queue->running()) {
-          return false;
-        }
+    std::promise<warm_display_t::opened_t> opened;
+    opened.set_value({std::move(display_names), display_p, std::move(disp)});
 
-        while (capture_ctx_queue->peek()) {
-          capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
-        }
+    int generation;
+    {
+      std::lock_guard lg {warm_display.lock};
+      warm_display.opened = opened.get_future().share();
+      warm_display.dev_type = dev_type;
+      warm_display.config = config;
+      generation = ++warm_display.generation;
+    }
 
-        if (switch_display_event->peek()) {
-          artificial_reinit = true;
-          return false;
-        }
+    BOOST_LOG(debug) << "Keeping the display open for a reconnecting client"sv;
+    task_pool.pushDelayed(close_warm_display, PARKED_DISPLAY_LIFETIME, generation);
+  }
 
-        return true;
-      };
+  void release_warm_display() {
+    std::shared_future<warm_display_t::opened_t> stale;
 
-      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
+    std::lock_guard lg {warm_display.lock};
+    stale = std::move(warm_display.opened);
+    ++warm_display.generation;
+  }
 
-      if (artificial_reinit && status != platf::capture_e::error) {
-        status = platf::capture_e::reinit;
+  void on_input() {
+    idle_state.last_input = std::chrono::steady_clock::now().time_since_epoch().count();
 
-        artificial_reinit = false;
+    // The capture thread only waits while idle, and reads the time of the input before it does
+    if (idle_state.idle) {
+      std::lock_guard lg {idle_state.lock};
+      idle_state.input.notify_all();
+    }
+  }
+
+#ifdef SUNSHINE_BUILD_EVDI
+  /**
+   * @brief Prepares the EVDI virtual display for streaming if EVDI is configured
+   * @param client_config The client configuration containing resolution, framerate, and HDR settings
+   * @return true if preparation succeeded or wasn't needed, false if preparation failed
+   */
+  bool prepare_evdi_display(const config_t &client_config) {
+    BOOST_LOG(debug) << "EVDI: Checking if preparation needed - capture='"sv << config::video.capture 
+                     << "'"sv << ", is_active="sv << platf::evdi_is_active();
+    
+    // A persistent virtual display stays active, but may have to switch to the client's mode
+    if (config::video.capture == "evdi" && (!platf::evdi_is_active() || config::video.evdi_persistent)) {
+      BOOST_LOG(info) << "EVDI: Preparing virtual display for streaming session"sv;
+      BOOST_LOG(debug) << "EVDI: Client config: "sv << client_config.width << "x"sv 
+                       << client_config.height << "@"sv << client_config.framerate 
+                       << "Hz, HDR="sv << (client_config.dynamicRange > 0);
+      
+      if (!platf::evdi_prepare_stream(client_config)) {
+        BOOST_LOG(error) << "EVDI: Failed to prepare virtual display - streaming cannot start"sv;
+        return false;
       }
+    }
+    else {
+      BOOST_LOG(debug) << "EVDI: Preparation skipped - capture method is not 'evdi' or EVDI is already active"sv;
+    }
+    
+    return true;
+  }
+#endif
 
-      switch (status) {
-        case platf::capture_e::reinit:
-          {
-            reinit_event.raise(true);
+  /**
+   * @brief A pool of the images that the capture thread hands to the encoders.
+   * @details Images are lent out through a `shared_ptr` whose deleter puts them back into the pool,
+   *          so getting a free image is O(1) and a full pool waits for the next image to come back
+   *          instead of polling. Free images above the highest number of images used at once in the
+   *          last few seconds are released, least recently used first.
+   */
+  class capture_img_pool_t: public std::enable_shared_from_this<capture_img_pool_t> {
+  public:
+    static constexpr auto TRIM_TIMEOUT = 3s;
 
-            // Some classes of images contain references to the display --> display won't delete unless img is deleted
-            for (auto &img : imgs) {
-              img.reset();
-            }
+    explicit capture_img_pool_t(std::size_t capacity):
+        _capacity {capacity} {
+    }
 
-            // display_wp is modified in this thread only
-            // Wait for the other shared_ptr's of display to be destroyed.
-            // New displays will only be created in this thread.
-            while (display_wp->use_count() != 1) {
-              // Free images that weren't consumed by the encoders. These can reference the display and prevent
-              // the ref count from reaching 1. We do this here rather than on the encoder thread to avoid race
-              // conditions where the encoding loop might free a good frame after reinitializing if we capture
-              // a new frame here before the encoder has finished reinitializing.
-              KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
-                if (!capture_ctx->images->running()) {
-                  capture_ctx = capture_ctxs.erase(capture_ctx);
-                  continue;
-                }
-
-                while (capture_ctx->images->peek()) {
-                  capture_ctx->images->pop();
-                }
-
-                ++capture_ctx;
-              });
+    /**
+     * @brief Get a free image, allocating one if the pool isn't full yet.
+     * @param disp The display to allocate images from.
+     * @param running Returns `false` once waiting for an image should stop.
+     * @return The image, or `nullptr` if `running` returned `false` or the allocation failed.
+     */
+    template<class F>
+    std::shared_ptr<platf::img_t> acquire(platf::display_t &disp, F &&running) {
+      std::shared_ptr<platf::img_t> img;
+      std::uint64_t generation;
+      std::vector<std::shared_ptr<platf::img_t>> trimmed;
 
-              std::this_thread::sleep_for(20ms);
+      {
+        std::unique_lock ul {_lock};
+        while (!img) {
+          if (!_free.empty()) {
+            // The most recently used image is the most likely to still be in the caches
+            img = std::move(_free.back());
+            _free.pop_back();
+          } else if (_allocated < _capacity) {
+            ++_allocated;
+
+            ul.unlock();
+            img = disp.alloc_img();
+            ul.lock();
+
+            if (!img) {
+              --_allocated;
+              return nullptr;
             }
+          } else {
+            // Wake up now and then, since `running` may change without an image coming back
+            _cv.wait_for(ul, 100ms, [this]() {
+              return !_free.empty();
+            });
 
-            while (capture_ctx_queue->running()) {
-              // Release the display before reenumerating displays, since some capture backends
-              // only support a single display session per device/application.
-              disp.reset();
+            if (!running()) {
+              return nullptr;
+            }
+          }
+        }
 
-              // Refresh display names since a display removal might have caused the reinitialization
-              refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
+        trim(trimmed);
+        generation = _generation;
+      }
 
-              // Process any pending display switch with the new list of displays
-              if (switch_display_event->peek()) {
-                display_p = std::clamp(*switch_display_event->pop(), 0, (int) display_names.size() - 1);
-              }
+      auto raw = img.get();
+      return std::shared_ptr<platf::img_t>(raw, [pool = shared_from_this(), img = std::move(img), generation](platf::img_t *) mutable {
+        pool->release(std::move(img), generation);
+      });
+    }
 
-              // reset_display() will sleep between retries
-              reset_display(disp, encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
-              if (disp) {
-                break;
-              }
-            }
-            if (!disp) {
-              return;
-            }
+    /**
+     * @brief Release the free images, and let images that are still in use be released once they come back.
+     */
+    void clear() {
+      std::vector<std::shared_ptr<platf::img_t>> free;
 
-            display_wp = disp;
+      {
+        std::lock_guard lg {_lock};
+        _allocated -= _free.size();
+        free = std::move(_free);
+        _free.clear();
 
-            reinit_event.reset();
-            continue;
-          }
-        case platf::capture_e::error:
-        case platf::capture_e::ok:
-        case platf::capture_e::timeout:
-        case platf::capture_e::interrupted:
-          return;
-        default:
-          BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
-          return;
+        ++_generation;
       }
     }
-  }
-
-  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    auto &frame = session.device->frame;
-    frame->pts = frame_nr;
 
-    auto &ctx = session.avcodec_ctx;
+  private:
+    void release(std::shared_ptr<platf::img_t> &&img, std::uint64_t generation) {
+      {
+        std::lock_guard lg {_lock};
+        if (generation == _generation) {
+          _free.push_back(std::move(img));
+          _cv.notify_one();
 
-    auto &sps = session.sps;
-    auto &vps = session.vps;
+          return;
+        }
 
-    // send the frame to the encoder
-    auto ret = avcodec_send_frame(ctx.get(), frame);
-    if (ret < 0) {
-      char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
-      BOOST_LOG(error) << "Could not send a frame for encoding: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret);
+        // The pool was cleared while this image was in use
+        --_allocated;
+      }
 
-      return -1;
+      img.reset();
     }
 
-    while (ret >= 0) {
-      auto packet = std::make_unique<packet_raw_avcodec>();
-      auto av_packet = packet.get()->av_packet;
+    /**
+     * @brief Remove free images that haven't been needed for a while.
+     * @param trimmed Receives the removed images, so they can be freed outside the lock.
+     */
+    void trim(std::vector<std::shared_ptr<platf::img_t>> &trimmed) {
+      auto used_count = _allocated - _free.size();
 
-      ret = avcodec_receive_packet(ctx.get(), av_packet);
-      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-        return 0;
-      } else if (ret < 0) {
-        return ret;
+      // remember the timestamp of currently used count
+      const auto now = std::chrono::steady_clock::now();
+      if (_used_timestamps.size() <= used_count) {
+        _used_timestamps.resize(used_count + 1);
       }
+      _used_timestamps[used_count] = now;
 
-      if (av_packet->flags & AV_PKT_FLAG_KEY) {
-        BOOST_LOG(debug) << "Frame "sv << frame_nr << ": IDR Keyframe (AV_FRAME_FLAG_KEY)"sv;
+      // decide whether to trim allocated unused above the currently used count
+      // based on last used timestamp and universal timeout
+      auto trim_target = used_count;
+      for (auto i = used_count; i < _used_timestamps.size(); i++) {
+        if (_used_timestamps[i] && now - *_used_timestamps[i] < TRIM_TIMEOUT) {
+          trim_target = i;
+        }
       }
 
-      if ((frame->flags & AV_FRAME_FLAG_KEY) && !(av_packet->flags & AV_PKT_FLAG_KEY)) {
-        BOOST_LOG(error) << "Encoder did not produce IDR frame when requested!"sv;
+      // trim allocated unused above the newly decided trim target, least recently used first
+      if (_allocated > trim_target) {
+        auto to_trim = std::min(_allocated - trim_target, _free.size());
+        std::move(std::begin(_free), std::begin(_free) + to_trim, std::back_inserter(trimmed));
+        _free.erase(std::begin(_free), std::begin(_free) + to_trim);
+        _allocated -= to_trim;
+
+        // forget timestamps that no longer relevant
+        _used_timestamps.resize(trim_target + 1);
       }
+    }
 
-      if (session.inject) {
-        if (session.inject == 1) {
-          auto h264 = cbs::make_sps_h264(ctx.get(), av_packet);
+    std::mutex _lock;
+    std::condition_variable _cv;
 
-          sps = std::move(h264.sps);
-        } else {
-          auto hevc = cbs::make_sps_hevc(ctx.get(), av_packet);
+    // Free images, the most recently used last
+    std::vector<std::shared_ptr<platf::img_t>> _free;
 
-          sps = std::move(hevc.sps);
-          vps = std::move(hevc.vps);
+    std::size_t _capacity;
+    std::size_t _allocated {};
+    std::uint64_t _generation {};
 
-          session.replacements.emplace_back(
-            std::string_view((char *) std::begin(vps.old), vps.old.size()),
-            std::string_view((char *) std::begin(vps._new), vps._new.size())
-          );
-        }
+    std::vector<std::optional<std::chrono::steady_clock::time_point>> _used_timestamps;
+  };
 
-        session.inject = 0;
+  /**
+   * @brief Check whether two captured images hold the same pixels, and the same cursor if it's blended in later.
+   * @param a The first image, in system memory.
+   * @param b The second image, in system memory.
+   * @return `true` if every pixel is the same, `false` otherwise.
+   */
+  bool same_pixels(const platf::img_t &a, const platf::img_t &b) {
+    // The same buffer has been captured into again, so there's nothing left to compare with
+    if (!a.data || !b.data || a.data == b.data || a.width != b.width || a.height != b.height || a.pixel_pitch != b.pixel_pitch) {
+      return false;
+    }
 
-        session.replacements.emplace_back(
-          std::string_view((char *) std::begin(sps.old), sps.old.size()),
-          std::string_view((char *) std::begin(sps._new), sps._new.size())
-        );
-      }
+    // A cursor blended in by the encode device moves without changing the pixels
+    if (a.cursor_sprite != b.cursor_sprite || (a.cursor_sprite && a.cursor != b.cursor)) {
+      return false;
+    }
 
-      if (av_packet && av_packet->pts == frame_nr) {
-        packet->frame_timestamp = frame_timestamp;
+    // memcmp() is vectorized by the C library, and stops at the first change
+    auto row_size = (std::size_t) a.width * a.pixel_pitch;
+    for (std::int32_t y = 0; y < a.height; ++y) {
+      if (std::memcmp(a.data + (std::size_t) y * a.row_pitch, b.data + (std::size_t) y * b.row_pitch, row_size)) {
+        return false;
       }
-
-      packet->replacements = &session.replacements;
-      packet->channel_data = channel_data;
-      packets->raise(std::move(packet));
     }
 
-    return 0;
+    return true;
   }
 
-  int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    auto encoded_frame = session.encode_frame(frame_nr);
-    if (encoded_frame.data.empty()) {
-      BOOST_LOG(error) << "NvENC returned empty packet";
+  /**
+   * @brief A display opened by the capture thread ahead of a display switch.
+   */
+  struct next_display_t {
+    std::vector<std::string> display_names;
+    int display_p;
+    std::shared_ptr<platf::display_t> disp;
+  };
+
+  void captureThread(
+    std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
+    sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
+    safe::signal_t &reinit_event,
+    display_switch_t &display_switch,
+    const encoder_t &encoder,
+    const std::string &output_name
+  ) {
+    std::vector<capture_ctx_t> capture_ctxs;
+
+    auto fg = util::fail_guard([&]() {
+      display_switch.standby = nullptr;
+      capture_ctx_queue->stop();
+
+      // Stop all sessions listening to this thread
+      for (auto &capture_ctx : capture_ctxs) {
+        capture_ctx.images->stop();
+      }
+      for (auto &capture_ctx : capture_ctx_queue->unsafe()) {
+        capture_ctx.images->stop();
+      }
+    });
+
+    auto switch_display_event = mail::man->event<int>(mail::switch_display);
+
+    // Wait for the initial capture context or a request to stop the queue
+    auto initial_capture_ctx = capture_ctx_queue->pop();
+    if (!initial_capture_ctx) {
+      return;
+    }
+    capture_ctxs.emplace_back(std::move(*initial_capture_ctx));
+
+#ifdef SUNSHINE_BUILD_EVDI
+    // Explicitly prepare EVDI virtual display for streaming if EVDI is selected, it's the configured display
+    if (output_name.empty() && !prepare_evdi_display(capture_ctxs.front().config)) {
+      return;
+    }
+#endif
+
+    // Get all the monitor names now, rather than at boot, to
+    // get the most up-to-date list available monitors
+    std::vector<std::string> display_names;
+    int display_p = -1;
+    auto display_config = capture_ctxs.front().config;
+
+    // A reconnecting client expects the display it would pick itself, not the one switched to
+    bool display_switched = false;
+    auto disp = take_warm_display(encoder.platform_formats->dev_type, display_config, display_names, display_p);
+    if (!disp) {
+      refresh_displays(encoder.platform_formats->dev_type, display_names, display_p, output_name);
+      disp = open_display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+    }
+    if (!disp) {
+      return;
+    }
+    display_wp = disp;
+
+    constexpr auto capture_buffer_size = 12;
+    auto imgs = std::make_shared<capture_img_pool_t>(capture_buffer_size);
+
+    auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+      img_out = imgs->acquire(*disp, [&]() {
+        return capture_ctx_queue->running();
+      });
+      if (!img_out) {
+        return false;
+      }
+
+      img_out->frame_timestamp.reset();
+      return true;
+    };
+
+    // Paces the attempts to get the capture back, and whether to try the fast path
+    reinit_backoff_t reinit_backoff;
+
+    // Wait for the other shared_ptr's of a display to be destroyed.
+    auto wait_for_display_release = [&](const std::shared_ptr<platf::display_t> &display) {
+      while (display.use_count() != 1) {
+        // Free images that weren't consumed by the encoders. These can reference the display and prevent
+        // the ref count from reaching 1. We do this here rather than on the encoder thread to avoid race
+        // conditions where the encoding loop might free a good frame after reinitializing if we capture
+        // a new frame here before the encoder has finished reinitializing.
+        KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
+          if (!capture_ctx->images->running()) {
+            capture_ctx = capture_ctxs.erase(capture_ctx);
+            continue;
+          }
+
+          while (capture_ctx->images->peek()) {
+            capture_ctx->images->pop();
+          }
+
+          ++capture_ctx;
+        });
+
+        std::this_thread::sleep_for(20ms);
+      }
+    };
+
+    // Count the encoders that still listen to this thread
+    auto running_capture_ctxs = [&]() {
+      std::erase_if(capture_ctxs, [](const capture_ctx_t &capture_ctx) {
+        return !capture_ctx.images->running();
+      });
+
+      return (int) capture_ctxs.size();
+    };
+
+    // A display switch opens the next display while the current one keeps capturing, so the encoders
+    // can build their next session in the meantime. Backends that fail to open a second display get
+    // the display switch as a reinitialization instead.
+    constexpr auto standby_timeout = 1s;
+    bool standby_unsupported = false;
+    std::future<next_display_t> next_display_future;
+    next_display_t next_display {};
+    std::chrono::steady_clock::time_point standby_deadline;
+
+    auto prepare_next_display = [&]() {
+      if (!next_display_future.valid() && !next_display.disp && !capture_ctxs.empty() && switch_display_event->peek()) {
+        auto requested_p = *switch_display_event->pop();
+
+        next_display_future = std::async(std::launch::async, [&encoder, requested_p, next = next_display_t {display_names, display_p, nullptr}, config = capture_ctxs.front().config, output_name]() mutable {
+          // Refresh display names, the same way a reinitialization does
+          refresh_displays(encoder.platform_formats->dev_type, next.display_names, next.display_p, output_name);
+          next.display_p = std::clamp(requested_p, 0, (int) next.display_names.size() - 1);
+          next.disp = open_display(encoder.platform_formats->dev_type, next.display_names[next.display_p], config);
+
+          return next;
+        });
+      }
+
+      if (next_display_future.valid() && next_display_future.wait_for(0s) == std::future_status::ready) {
+        next_display = next_display_future.get();
+        if (!next_display.disp) {
+          BOOST_LOG(info) << "Unable to open the next display alongside the current one, reinitializing to switch displays"sv;
+          standby_unsupported = true;
+          switch_display_event->raise(next_display.display_p);
+
+          return;
+        }
+
+        display_switch.prepared = 0;
+        display_switch.standby = next_display.disp;
+        standby_deadline = std::chrono::steady_clock::now() + standby_timeout;
+      }
+    };
+
+    // Unchanged frames aren't handed to the encoders, which repeat the last frame for the minimum FPS target instead
+    logging::time_delta_periodic_logger frame_compare_logger(debug, "Unchanged frame detection");
+    std::shared_ptr<platf::img_t> last_frame;
+
+    // Without input or a changed frame for a while, a frame is only captured every trickle interval
+    idle_detector_t idle_detector {std::chrono::seconds {config::video.idle_timeout}};
+    std::chrono::steady_clock::time_point idle_since;
+    auto leave_idle = [&]() {
+      if (!idle_state.idle) {
+        return;
+      }
+
+      idle_state.idle = false;
+      metrics::video.idle.set(0);
+      metrics::video.idle_milliseconds.add(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - idle_since).count());
+      BOOST_LOG(info) << "Stream active again, capturing at the full frame rate"sv;
+    };
+    auto idle_fg = util::fail_guard(leave_idle);
+
+    // Capture takes place on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::apply(thread_affinity::role_e::capture);
+
+    while (capture_ctx_queue->running()) {
+      bool artificial_reinit = false;
+      bool standby_switch = false;
+      bool skip_unchanged_frames = config::video.skip_unchanged_frames && disp->img_in_system_memory();
+
+      auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (skip_unchanged_frames && frame_captured && img) {
+          frame_compare_logger.first_point_now();
+          if (last_frame && same_pixels(*last_frame, *img)) {
+            frame_captured = false;
+          } else {
+            last_frame = img;
+          }
+          frame_compare_logger.second_point_now_and_log();
+        }
+
+        KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
+          if (!capture_ctx->images->running()) {
+            capture_ctx = capture_ctxs.erase(capture_ctx);
+
+            continue;
+          }
+
+          if (frame_captured) {
+            // The encoder never saw the previous image
+            if (capture_ctx->images->peek()) {
+              metrics::video.frames_dropped.add();
+            }
+            capture_ctx->images->raise(img);
+          }
+
+          ++capture_ctx;
+        })
+
+        if (!capture_ctx_queue->running()) {
+          return false;
+        }
+
+        while (capture_ctx_queue->peek()) {
+          capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
+
+          // The display may not change for a long time, so new encoders start from the last frame
+          if (last_frame) {
+            capture_ctxs.back().images->raise(last_frame);
+          }
+        }
+
+        if (!standby_unsupported) {
+          prepare_next_display();
+        }
+
+        if (next_display.disp && (display_switch.prepared >= running_capture_ctxs() || std::chrono::steady_clock::now() >= standby_deadline)) {
+          standby_switch = true;
+          return false;
+        }
+
+        if (standby_unsupported && switch_display_event->peek()) {
+          artificial_reinit = true;
+          return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto last_input = idle_state.last_input.load();
+        if (!idle_detector.update(now, frame_captured, std::chrono::steady_clock::time_point {std::chrono::steady_clock::duration {last_input}})) {
+          leave_idle();
+          return true;
+        }
+
+        if (!idle_state.idle) {
+          idle_state.idle = true;
+          idle_since = now;
+          metrics::video.idle.set(1);
+          metrics::video.idle_periods.add();
+          BOOST_LOG(info) << "No input or changed frame for "sv << config::video.idle_timeout << " seconds, capturing a frame every "sv
+                          << idle_detector_t::TRICKLE_INTERVAL.count() << " ms"sv;
+        }
+
+        std::unique_lock ul {idle_state.lock};
+        idle_state.input.wait_for(ul, idle_detector_t::TRICKLE_INTERVAL, [&]() {
+          return idle_state.last_input != last_input;
+        });
+
+        return true;
+      };
+
+      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
+
+      // The last frame references the display, and won't match the next display anyway
+      last_frame.reset();
+
+      if (standby_switch && status != platf::capture_e::error) {
+        auto stall_start = std::chrono::steady_clock::now();
+
+        // Encoders that haven't started listening yet must acknowledge the switch too
+        while (capture_ctx_queue->peek()) {
+          capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
+        }
+
+        // Encoders that start a session from now on get the next display
+        display_wp = next_display.disp;
+        display_switch.standby = nullptr;
+
+        // No image of the current display will follow, so the encoders can swap to their standby session
+        display_switch.acknowledged = 0;
+        ++display_switch.generation;
+
+        auto deadline = std::chrono::steady_clock::now() + standby_timeout;
+        while (display_switch.acknowledged < running_capture_ctxs() && std::chrono::steady_clock::now() < deadline) {
+          std::this_thread::sleep_for(1ms);
+        }
+
+        imgs->clear();
+
+        // An encoder that didn't acknowledge might still convert images with a session for the current display
+        bool acknowledged = display_switch.acknowledged >= running_capture_ctxs();
+        if (!acknowledged) {
+          BOOST_LOG(warning) << "Encoders didn't acknowledge the display switch in time, reinitializing"sv;
+          reinit_event.raise(true);
+          wait_for_display_release(disp);
+        }
+
+        // Images of the current display left behind by sessions that don't encode themselves
+        for (auto &capture_ctx : capture_ctxs) {
+          while (capture_ctx.images->peek()) {
+            capture_ctx.images->pop();
+          }
+        }
+
+        disp = std::move(next_display.disp);
+        display_switched = true;
+        display_names = std::move(next_display.display_names);
+        display_p = next_display.display_p;
+
+        if (!acknowledged) {
+          reinit_event.reset();
+        }
+
+        auto stall = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - stall_start);
+        BOOST_LOG(info) << "Switched to display ["sv << display_names[display_p] << "], capture stalled for "sv << stall.count() << "ms"sv;
+        continue;
+      }
+
+      // Opening another display is the point of an artificial reinitialization
+      auto switching = artificial_reinit && status != platf::capture_e::error;
+      if (switching) {
+        status = platf::capture_e::reinit;
+
+        artificial_reinit = false;
+      }
+
+      switch (status) {
+        case platf::capture_e::reinit:
+          {
+            auto stall_start = std::chrono::steady_clock::now();
+
+            // The fast path keeps the display and its images, so the encoders don't notice
+            if (reinit_backoff.start(stall_start)) {
+              if (!switching && !next_display.disp && !switch_display_event->peek() && disp->reacquire(display_config)) {
+                auto now = std::chrono::steady_clock::now();
+                reinit_backoff.recovered(now);
+                metrics::video.capture_reacquired.add();
+                metrics::video.capture_reinit_seconds.observe(std::chrono::duration<double> {now - stall_start}.count());
+
+                auto stall = std::chrono::duration_cast<std::chrono::milliseconds>(now - stall_start);
+                BOOST_LOG(info) << "Capture reacquired, capture stalled for "sv << stall.count() << "ms"sv;
+                continue;
+              }
+            } else if (!switching) {
+              // The capture was lost again right after it came back, like while a secure desktop is shown
+              std::this_thread::sleep_for(reinit_backoff.next_delay());
+            }
+
+            reinit_event.raise(true);
+            metrics::video.encoder_reinits.add();
+
+            // A display opened for a pending display switch is replaced by the reinitialized display
+            if (next_display.disp) {
+              switch_display_event->raise(next_display.display_p);
+              next_display = {};
+              display_switch.standby = nullptr;
+            }
+
+            // Some classes of images contain references to the display --> display won't delete unless img is deleted
+            imgs->clear();
+
+            // display_wp is modified in this thread only
+            // Wait for the other shared_ptr's of display to be destroyed.
+            // New displays will only be created in this thread.
+            wait_for_display_release(disp);
+
+            while (capture_ctx_queue->running()) {
+              // Release the display before reenumerating displays, since some capture backends
+              // only support a single display session per device/application.
+              disp.reset();
+
+              // Refresh display names since a display removal might have caused the reinitialization
+              refresh_displays(encoder.platform_formats->dev_type, display_names, display_p, output_name);
+
+              // Process any pending display switch with the new list of displays
+              if (switch_display_event->peek()) {
+                display_p = std::clamp(*switch_display_event->pop(), 0, (int) display_names.size() - 1);
+                display_switched = true;
+              }
+
+              display_config = capture_ctxs.front().config;
+              disp = open_display(encoder.platform_formats->dev_type, display_names[display_p], display_config);
+              if (disp) {
+                break;
+              }
+
+              std::this_thread::sleep_for(reinit_backoff.next_delay());
+            }
+            if (!disp) {
+              return;
+            }
+
+            display_wp = disp;
+
+            reinit_event.reset();
+
+            auto now = std::chrono::steady_clock::now();
+            reinit_backoff.recovered(now);
+            metrics::video.capture_reinit_seconds.observe(std::chrono::duration<double> {now - stall_start}.count());
+
+            auto stall = std::chrono::duration_cast<std::chrono::milliseconds>(now - stall_start);
+            BOOST_LOG(info) << "Display reinitialized, capture stalled for "sv << stall.count() << "ms"sv;
+            continue;
+          }
+        case platf::capture_e::error:
+          return;
+        case platf::capture_e::ok:
+        case platf::capture_e::timeout:
+        case platf::capture_e::interrupted:
+          // The last session ended, rather than the capture failing
+          if (!capture_ctx_queue->running() && !display_switched) {
+            park_display(encoder.platform_formats->dev_type, display_config, std::move(display_names), display_p, std::move(disp));
+          }
+          return;
+        default:
+          BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+          return;
+      }
+    }
+  }
+
+  std::vector<packet_raw_t::splice_t> find_splices(std::string_view payload, const std::vector<packet_raw_t::replace_t> &replacements, bool hevc) {
+    constexpr auto start_code = "\x00\x00\x01"sv;
+
+    std::vector<packet_raw_t::splice_t> splices;
+    for (auto start = payload.find(start_code); start != std::string_view::npos && splices.size() < replacements.size(); start = payload.find(start_code, start + start_code.size())) {
+      if (start + start_code.size() >= payload.size()) {
+        break;
+      }
+
+      // Nothing but slices follows the first slice
+      auto header = (std::uint8_t) payload[start + start_code.size()];
+      auto type = hevc ? (header >> 1) & 0x3F : header & 0x1F;
+      if (hevc ? type < 32 : (type >= 1 && type <= 5)) {
+        break;
+      }
+
+      for (auto &replacement : replacements) {
+        // The replacement may begin with the zero byte of a 4 byte start code
+        auto lead = replacement.old.find(start_code);
+        if (lead == std::string_view::npos || lead > start || !payload.substr(start - lead).starts_with(replacement.old)) {
+          continue;
+        }
+
+        splices.push_back({start - lead, replacement.old, replacement._new});
+        break;
+      }
+    }
+
+    return splices;
+  }
+
+  bool splices_match(std::string_view payload, const std::vector<packet_raw_t::splice_t> &splices) {
+    if (splices.empty()) {
+      return false;
+    }
+
+    for (auto &splice : splices) {
+      if (splice.offset > payload.size() || !payload.substr(splice.offset).starts_with(splice.old)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp, bool intra_refresh) {
+    auto &frame = session.device->frame;
+    frame->pts = frame_nr;
+
+    auto &ctx = session.avcodec_ctx;
+
+    auto &sps = session.sps;
+    auto &vps = session.vps;
+
+    if (session.quality_sampler) {
+      session.quality_sampler->submit_frame(frame_nr, frame);
+    }
+
+    // send the frame to the encoder
+    auto ret = avcodec_send_frame(ctx.get(), frame);
+    if (ret < 0) {
+      char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+      BOOST_LOG(error) << "Could not send a frame for encoding: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret);
+
       return -1;
     }
 
-    if (frame_nr != encoded_frame.frame_index) {
-      BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
+    while (ret >= 0) {
+      auto packet = std::make_unique<packet_raw_avcodec>();
+      auto av_packet = packet.get()->av_packet;
+
+      ret = avcodec_receive_packet(ctx.get(), av_packet);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        return 0;
+      } else if (ret < 0) {
+        return ret;
+      }
+
+      if (av_packet->flags & AV_PKT_FLAG_KEY) {
+        BOOST_LOG(debug) << "Frame "sv << frame_nr << ": IDR Keyframe (AV_FRAME_FLAG_KEY)"sv;
+      }
+
+      if ((frame->flags & AV_FRAME_FLAG_KEY) && !(av_packet->flags & AV_PKT_FLAG_KEY)) {
+        BOOST_LOG(error) << "Encoder did not produce IDR frame when requested!"sv;
+      }
+
+      if (session.inject) {
+        if (session.inject == 1) {
+          auto h264 = cbs::make_sps_h264(ctx.get(), av_packet);
+
+          sps = std::move(h264.sps);
+        } else {
+          auto hevc = cbs::make_sps_hevc(ctx.get(), av_packet);
+
+          sps = std::move(hevc.sps);
+          vps = std::move(hevc.vps);
+
+          session.replacements.emplace_back(
+            std::string_view((char *) std::begin(vps.old), vps.old.size()),
+            std::string_view((char *) std::begin(vps._new), vps._new.size())
+          );
+        }
+
+        session.inject = 0;
+
+        session.replacements.emplace_back(
+          std::string_view((char *) std::begin(sps.old), sps.old.size()),
+          std::string_view((char *) std::begin(sps._new), sps._new.size())
+        );
+      }
+
+      if (av_packet && av_packet->pts == frame_nr) {
+        packet->frame_timestamp = frame_timestamp;
+      }
+
+      // The parameter sets are found here, so the broadcast thread only has to copy the start of the frame
+      if (packet->is_idr() && !session.replacements.empty()) {
+        std::string_view payload {(char *) av_packet->data, (std::size_t) av_packet->size};
+        if (!splices_match(payload, session.splices)) {
+          session.splices = find_splices(payload, session.replacements, ctx->codec_id == AV_CODEC_ID_HEVC);
+        }
+        packet->splices = session.splices;
+      }
+
+      if (session.quality_sampler) {
+        session.quality_sampler->submit_packet(av_packet);
+      }
+
+      packet->replacements = &session.replacements;
+      packet->channel_data = channel_data;
+      packet->intra_refresh = intra_refresh;
+      packets->raise(std::move(packet));
+    }
+
+    return 0;
+  }
+
+  int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp, bool intra_refresh) {
+    auto raise_packet = [packets, channel_data, frame_timestamp, intra_refresh](nvenc::nvenc_encoded_frame &&encoded_frame) {
+      auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+      packet->channel_data = channel_data;
+      packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
+      packet->intra_refresh = intra_refresh;
+      packet->frame_timestamp = frame_timestamp;
+      packet->part_index = encoded_frame.part_index;
+      packet->part_count = encoded_frame.part_count;
+      packets->raise(std::move(packet));
+    };
+
+    // The completion thread raises the packet once the frame is encoded, while the next frame is captured and converted
+    if (session.is_pipelined()) {
+      return session.submit_frame(frame_nr, std::move(raise_packet)) ? 0 : -1;
+    }
+
+    // With sub-frame output, the first parts of the frame are on their way before the last one is encoded
+    auto encoded_frame = session.encode_frame(frame_nr, raise_packet);
+    if (encoded_frame.data.empty()) {
+      BOOST_LOG(error) << "NvENC returned empty packet";
+      return -1;
+    }
+
+    if (frame_nr != encoded_frame.frame_index) {
+      BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
+    }
+
+    raise_packet(std::move(encoded_frame));
+
+    return 0;
+  }
+
+#ifdef __APPLE__
+  int encode_vt(int64_t frame_nr, vt_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp, bool intra_refresh) {
+    auto encoded_frame = session.encode_frame(frame_nr);
+    if (!encoded_frame) {
+      return -1;
+    }
+
+    // The client recovers from a frame the session dropped like from a lost one
+    if (encoded_frame->data.empty()) {
+      return 0;
+    }
+
+    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame->data), encoded_frame->frame_index, encoded_frame->idr);
+    packet->channel_data = channel_data;
+    packet->intra_refresh = intra_refresh;
+    packet->frame_timestamp = frame_timestamp;
+    packets->raise(std::move(packet));
+
+    return 0;
+  }
+#endif
+
+  int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp, bool intra_refresh = false) {
+    if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
+      return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp, intra_refresh);
+    } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
+      return encode_nvenc(frame_nr, *nvenc_session, packets, channel_data, frame_timestamp, intra_refresh);
+    }
+#ifdef __APPLE__
+    else if (auto vt_session = dynamic_cast<vt_encode_session_t *>(&session)) {
+      return encode_vt(frame_nr, *vt_session, packets, channel_data, frame_timestamp, intra_refresh);
+    }
+#endif
+
+    return -1;
+  }
+
+  std::unique_ptr<avcodec_encode_session_t> make_avcodec_encode_session(
+    platf::display_t *disp,
+    const encoder_t &encoder,
+    const config_t &config,
+    int width,
+    int height,
+    std::unique_ptr<platf::avcodec_encode_device_t> encode_device
+  ) {
+    auto platform_formats = dynamic_cast<const encoder_platform_formats_avcodec *>(encoder.platform_formats.get());
+    if (!platform_formats) {
+      return nullptr;
+    }
+
+    bool hardware = platform_formats->avcodec_base_dev_type != AV_HWDEVICE_TYPE_NONE;
+
+    auto &video_format = encoder.codec_from_config(config);
+    if (!video_format[encoder_t::PASSED] || !disp->is_codec_supported(video_format.name, config)) {
+      BOOST_LOG(error) << encoder.name << ": "sv << video_format.name << " mode not supported"sv;
+      return nullptr;
+    }
+
+    if (config.dynamicRange && !video_format[encoder_t::DYNAMIC_RANGE]) {
+      BOOST_LOG(error) << video_format.name << ": dynamic range not supported"sv;
+      return nullptr;
+    }
+
+    if (config.chromaSamplingType == 1 && !video_format[encoder_t::YUV444]) {
+      BOOST_LOG(error) << video_format.name << ": YUV 4:4:4 not supported"sv;
+      return nullptr;
+    }
+
+    auto codec = avcodec_find_encoder_by_name(video_format.name.c_str());
+    if (!codec) {
+      BOOST_LOG(error) << "Couldn't open ["sv << video_format.name << ']';
+
+      return nullptr;
+    }
+
+    auto colorspace = encode_device->colorspace;
+    auto sw_fmt = (colorspace.bit_depth == 8 && config.chromaSamplingType == 0)  ? platform_formats->avcodec_pix_fmt_8bit :
+                  (colorspace.bit_depth == 8 && config.chromaSamplingType == 1)  ? platform_formats->avcodec_pix_fmt_yuv444_8bit :
+                  (colorspace.bit_depth == 10 && config.chromaSamplingType == 0) ? platform_formats->avcodec_pix_fmt_10bit :
+                  (colorspace.bit_depth == 10 && config.chromaSamplingType == 1) ? platform_formats->avcodec_pix_fmt_yuv444_10bit :
+                                                                                   AV_PIX_FMT_NONE;
+
+    // Allow up to 1 retry to apply the set of fallback options.
+    //
+    // Note: If we later end up needing multiple sets of
+    // fallback options, we may need to allow more retries
+    // to try applying each set.
+    avcodec_ctx_t ctx;
+    int intra_refresh_frames = 0;
+    for (int retries = 0; retries < 2; retries++) {
+      ctx.reset(avcodec_alloc_context3(codec));
+      ctx->width = config.width;
+      ctx->height = config.height;
+      ctx->time_base = AVRational {1, config.framerate};
+      ctx->framerate = AVRational {config.framerate, 1};
+      if (config.framerateX100 > 0) {
+        AVRational fps = video::framerateX100_to_rational(config.framerateX100);
+        ctx->framerate = fps;
+        ctx->time_base = AVRational {fps.den, fps.num};
+      }
+
+      switch (config.videoFormat) {
+        case 0:
+          // 10-bit h264 encoding is not supported by our streaming protocol
+          assert(!config.dynamicRange);
+          ctx->profile = (config.chromaSamplingType == 1) ? AV_PROFILE_H264_HIGH_444_PREDICTIVE : AV_PROFILE_H264_HIGH;
+          break;
+
+        case 1:
+          if (config.chromaSamplingType == 1) {
+            // HEVC uses the same RExt profile for both 8 and 10 bit YUV 4:4:4 encoding
+            ctx->profile = AV_PROFILE_HEVC_REXT;
+          } else {
+            ctx->profile = config.dynamicRange ? AV_PROFILE_HEVC_MAIN_10 : AV_PROFILE_HEVC_MAIN;
+          }
+          break;
+
+        case 2:
+          // AV1 supports both 8 and 10 bit encoding with the same Main profile
+          // but YUV 4:4:4 sampling requires High profile
+          ctx->profile = (config.chromaSamplingType == 1) ? AV_PROFILE_AV1_HIGH : AV_PROFILE_AV1_MAIN;
+          break;
+      }
+
+      // B-frames delay decoder output, so never use them
+      ctx->max_b_frames = 0;
+
+      // Use an infinite GOP length since I-frames are generated on demand
+      ctx->gop_size = encoder.flags & LIMITED_GOP_SIZE ?
+                        std::numeric_limits<std::int16_t>::max() :
+                        std::numeric_limits<int>::max();
+
+      ctx->keyint_min = std::numeric_limits<int>::max();
+
+      // Some client decoders have limits on the number of reference frames
+      if (config.numRefFrames) {
+        if (video_format[encoder_t::REF_FRAMES_RESTRICT]) {
+          ctx->refs = config.numRefFrames;
+        } else {
+          BOOST_LOG(warning) << "Client requested reference frame limit, but encoder doesn't support it!"sv;
+        }
+      }
+
+      // We forcefully reset the flags to avoid clash on reuse of AVCodecContext
+      ctx->flags = 0;
+      ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP | AV_CODEC_FLAG_LOW_DELAY;
+
+      ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+
+      auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
+
+      ctx->color_range = avcodec_colorspace.range;
+      ctx->color_primaries = avcodec_colorspace.primaries;
+      ctx->color_trc = avcodec_colorspace.transfer_function;
+      ctx->colorspace = avcodec_colorspace.matrix;
+
+      // Used by cbs::make_sps_hevc
+      ctx->sw_pix_fmt = sw_fmt;
+
+      if (hardware) {
+        avcodec_buffer_t encoding_stream_context;
+
+        ctx->pix_fmt = platform_formats->avcodec_dev_pix_fmt;
+
+        // Create the base hwdevice context
+        auto buf_or_error = platform_formats->init_avcodec_hardware_input_buffer(encode_device.get());
+        if (buf_or_error.has_right()) {
+          return nullptr;
+        }
+        encoding_stream_context = std::move(buf_or_error.left());
+
+        // If this encoder requires derivation from the base, derive the desired type
+        if (platform_formats->avcodec_derived_dev_type != AV_HWDEVICE_TYPE_NONE) {
+          avcodec_buffer_t derived_context;
+
+          // Allow the hwdevice to prepare for this type of context to be derived
+          if (encode_device->prepare_to_derive_context(platform_formats->avcodec_derived_dev_type)) {
+            return nullptr;
+          }
+
+          auto err = av_hwdevice_ctx_create_derived(&derived_context, platform_formats->avcodec_derived_dev_type, encoding_stream_context.get(), 0);
+          if (err) {
+            char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+            BOOST_LOG(error) << "Failed to derive device context: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
+
+            return nullptr;
+          }
+
+          encoding_stream_context = std::move(derived_context);
+        }
+
+        // Initialize avcodec hardware frames
+        {
+          avcodec_buffer_t frame_ref {av_hwframe_ctx_alloc(encoding_stream_context.get())};
+
+          auto frame_ctx = (AVHWFramesContext *) frame_ref->data;
+          frame_ctx->format = ctx->pix_fmt;
+          frame_ctx->sw_format = sw_fmt;
+          frame_ctx->height = ctx->height;
+          frame_ctx->width = ctx->width;
+          frame_ctx->initial_pool_size = 0;
+
+          // Allow the hwdevice to modify hwframe context parameters
+          encode_device->init_hwframes(frame_ctx);
+
+          if (auto err = av_hwframe_ctx_init(frame_ref.get()); err < 0) {
+            return nullptr;
+          }
+
+          ctx->hw_frames_ctx = av_buffer_ref(frame_ref.get());
+        }
+
+        ctx->slices = config.slicesPerFrame;
+      } else /* software */ {
+        ctx->pix_fmt = sw_fmt;
+
+        // Clients will request for the fewest slices per frame to get the
+        // most efficient encode, but we may want to provide more slices than
+        // requested to ensure we have enough parallelism for good performance.
+        ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+      }
+
+      if (encoder.flags & SINGLE_SLICE_ONLY) {
+        ctx->slices = 1;
+      }
+
+      ctx->thread_type = FF_THREAD_SLICE;
+      ctx->thread_count = ctx->slices;
+
+      AVDictionary *options {nullptr};
+      auto handle_option = [&options, &config](const encoder_t::option_t &option) {
+        std::visit(
+          util::overloaded {
+            [&](int v) {
+              av_dict_set_int(&options, option.name.c_str(), v, 0);
+            },
+            [&](int *v) {
+              av_dict_set_int(&options, option.name.c_str(), *v, 0);
+            },
+            [&](std::optional<int> *v) {
+              if (*v) {
+                av_dict_set_int(&options, option.name.c_str(), **v, 0);
+              }
+            },
+            [&](const std::function<int()> &v) {
+              av_dict_set_int(&options, option.name.c_str(), v(), 0);
+            },
+            [&](const std::string &v) {
+              av_dict_set(&options, option.name.c_str(), v.c_str(), 0);
+            },
+            [&](std::string *v) {
+              if (!v->empty()) {
+                av_dict_set(&options, option.name.c_str(), v->c_str(), 0);
+              }
+            },
+            [&](const std::function<const std::string(const config_t &cfg)> &v) {
+              if (auto value = v(config); !value.empty()) {
+                av_dict_set(&options, option.name.c_str(), value.c_str(), 0);
+              }
+            }
+          },
+          option.value
+        );
+      };
+
+      // Apply common options, then format-specific overrides
+      for (auto &option : video_format.common_options) {
+        handle_option(option);
+      }
+      for (auto &option : (config.dynamicRange ? video_format.hdr_options : video_format.sdr_options)) {
+        handle_option(option);
+      }
+      if (config.chromaSamplingType == 1) {
+        for (auto &option : (config.dynamicRange ? video_format.hdr444_options : video_format.sdr444_options)) {
+          handle_option(option);
+        }
+      }
+      if (retries > 0) {
+        for (auto &option : video_format.fallback_options) {
+          handle_option(option);
+        }
+      }
+
+      // A tuned session encodes with a faster preset than the configured one
+      if (config.presetSteps > 0) {
+        if (auto preset = av_dict_get(options, "preset", nullptr, 0)) {
+          auto faster = faster_preset(video_format.name, preset->value, config.presetSteps);
+          BOOST_LOG(info) << "Encoding with preset "sv << faster << " instead of "sv << preset->value;
+          av_dict_set(&options, "preset", faster.c_str(), 0);
+        }
+      }
+
+      auto bitrate = ((config::video.max_bitrate > 0) ? std::min(config.bitrate, config::video.max_bitrate) : config.bitrate) * 1000;
+      BOOST_LOG(info) << "Streaming bitrate is " << bitrate;
+      ctx->rc_max_rate = bitrate;
+      ctx->bit_rate = bitrate;
+
+      if (encoder.flags & CBR_WITH_VBR) {
+        // Ensure rc_max_bitrate != bit_rate to force VBR mode
+        ctx->bit_rate--;
+      } else {
+        ctx->rc_min_rate = bitrate;
+      }
+
+      if (encoder.flags & RELAXED_COMPLIANCE) {
+        ctx->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+      }
+
+      if (!(encoder.flags & NO_RC_BUF_LIMIT)) {
+        if (!hardware && (ctx->slices > 1 || config.videoFormat == 1)) {
+          // Use a larger rc_buffer_size for software encoding when slices are enabled,
+          // because libx264 can severely degrade quality if the buffer is too small.
+          // libx265 encounters this issue more frequently, so always scale the
+          // buffer by 1.5x for software HEVC encoding.
+          ctx->rc_buffer_size = bitrate / ((config.framerate * 10) / 15);
+        } else {
+          ctx->rc_buffer_size = bitrate / config.framerate;
+
+#ifndef __APPLE__
+          if (encoder.name == "nvenc" && config::video.nv_legacy.vbv_percentage_increase > 0) {
+            ctx->rc_buffer_size += ctx->rc_buffer_size * config::video.nv_legacy.vbv_percentage_increase / 100;
+          }
+#endif
+        }
+      }
+
+      // Heal the picture with intra coded blocks over several frames instead of IDR frames
+      std::string_view intra_refresh_option;
+      if (config::video.intra_refresh_frames > 0 && config.videoFormat <= 1) {
+        if (video_format.name == "libx264"sv || video_format.name == "h264_nvenc"sv || video_format.name == "hevc_nvenc"sv) {
+          // These encoders refresh the picture once per GOP
+          intra_refresh_option = "intra-refresh"sv;
+          av_dict_set_int(&options, "intra-refresh", 1, 0);
+          ctx->gop_size = config::video.intra_refresh_frames;
+        } else if (video_format.name == "h264_qsv"sv || video_format.name == "hevc_qsv"sv) {
+          intra_refresh_option = "int_ref_type"sv;
+          av_dict_set(&options, "int_ref_type", "vertical", 0);
+          av_dict_set_int(&options, "int_ref_cycle_size", config::video.intra_refresh_frames, 0);
+          av_dict_set_int(&options, "int_ref_cycle_dist", config::video.intra_refresh_frames, 0);
+        }
+      }
+
+      // Allow the encoding device a final opportunity to set/unset or override any options
+      encode_device->init_codec_options(ctx.get(), &options);
+
+      if (auto status = avcodec_open2(ctx.get(), codec, &options)) {
+        char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+
+        if (!video_format.fallback_options.empty() && retries == 0) {
+          BOOST_LOG(info)
+            << "Retrying with fallback configuration options for ["sv << video_format.name << "] after error: "sv
+            << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+
+          continue;
+        } else {
+          BOOST_LOG(error)
+            << "Could not open codec ["sv
+            << video_format.name << "]: "sv
+            << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+
+          return nullptr;
+        }
+      }
+
+      // Options the encoder didn't recognize are left in the dictionary
+      if (!intra_refresh_option.empty()) {
+        if (av_dict_get(options, intra_refresh_option.data(), nullptr, 0)) {
+          BOOST_LOG(warning) << '[' << video_format.name << "] doesn't support intra refresh, sending IDR frames"sv;
+        } else {
+          intra_refresh_frames = config::video.intra_refresh_frames;
+        }
+      }
+      av_dict_free(&options);
+
+      // Successfully opened the codec
+      break;
+    }
+
+    avcodec_frame_t frame {av_frame_alloc()};
+    frame->format = ctx->pix_fmt;
+    frame->width = ctx->width;
+    frame->height = ctx->height;
+    frame->color_range = ctx->color_range;
+    frame->color_primaries = ctx->color_primaries;
+    frame->color_trc = ctx->color_trc;
+    frame->colorspace = ctx->colorspace;
+    frame->chroma_location = ctx->chroma_sample_location;
+
+    // Attach HDR metadata to the AVFrame
+    if (colorspace_is_hdr(colorspace)) {
+      SS_HDR_METADATA hdr_metadata;
+      if (disp->get_hdr_metadata(hdr_metadata)) {
+        auto mdm = av_mastering_display_metadata_create_side_data(frame.get());
+
+        mdm->display_primaries[0][0] = av_make_q(hdr_metadata.displayPrimaries[0].x, 50000);
+        mdm->display_primaries[0][1] = av_make_q(hdr_metadata.displayPrimaries[0].y, 50000);
+        mdm->display_primaries[1][0] = av_make_q(hdr_metadata.displayPrimaries[1].x, 50000);
+        mdm->display_primaries[1][1] = av_make_q(hdr_metadata.displayPrimaries[1].y, 50000);
+        mdm->display_primaries[2][0] = av_make_q(hdr_metadata.displayPrimaries[2].x, 50000);
+        mdm->display_primaries[2][1] = av_make_q(hdr_metadata.displayPrimaries[2].y, 50000);
+
+        mdm->white_point[0] = av_make_q(hdr_metadata.whitePoint.x, 50000);
+        mdm->white_point[1] = av_make_q(hdr_metadata.whitePoint.y, 50000);
+
+        mdm->min_luminance = av_make_q(hdr_metadata.minDisplayLuminance, 10000);
+        mdm->max_luminance = av_make_q(hdr_metadata.maxDisplayLuminance, 1);
+
+        mdm->has_luminance = hdr_metadata.maxDisplayLuminance != 0 ? 1 : 0;
+        mdm->has_primaries = hdr_metadata.displayPrimaries[0].x != 0 ? 1 : 0;
+
+        if (hdr_metadata.maxContentLightLevel != 0 || hdr_metadata.maxFrameAverageLightLevel != 0) {
+          auto clm = av_content_light_metadata_create_side_data(frame.get());
+
+          clm->MaxCLL = hdr_metadata.maxContentLightLevel;
+          clm->MaxFALL = hdr_metadata.maxFrameAverageLightLevel;
+        }
+      } else {
+        BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
+      }
     }
 
-    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
-    packet->channel_data = channel_data;
-    packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
-    packet->frame_timestamp = frame_timestamp;
-    packets->raise(std::move(packet));
+    std::unique_ptr<platf::avcodec_encode_device_t> encode_device_final;
 
-    return 0;
-  }
+    if (!encode_device->data) {
+      auto software_encode_device = std::make_unique<avcodec_software_encode_device_t>();
 
-  int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
-      return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp);
-    } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
-      return encode_nvenc(frame_nr, *nvenc_session, packets, channel_data, frame_timestamp);
+      if (software_encode_device->init(width, height, frame.get(), sw_fmt, hardware)) {
+        return nullptr;
+      }
+      software_encode_device->colorspace = colorspace;
+
+      encode_device_final = std::move(software_encode_device);
+    } else {
+      encode_device_final = std::move(encode_device);
     }
 
-    return -1;
+    if (encode_device_final->set_frame(frame.release(), ctx->hw_frames_ctx)) {
+      return nullptr;
+    }
+
+    encode_device_final->apply_colorspace();
+
+    auto session = std::make_unique<avcodec_encode_session_t>(
+      std::move(ctx),
+      std::move(encode_device_final),
+
+      // 0 ==> don't inject, 1 ==> inject for h264, 2 ==> inject for hevc
+      config.videoFormat <= 1 ? (1 - (int) video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat) : 0,
+      intra_refresh_frames
+    );
+
+    return session;
   }
 
-  std::unique_ptr<avcodec_encode_session_t> make_avcodec_encode_session(
-    platf::display_t *disp,
-    const encoder_t &encoder,
-    const config_t &config,
-    int width,
-    int height,
-    std::unique_ptr<platf::avcodec_encode_device_t> encode_device
-  ) {
-    auto platform_formats = dynamic_cast<const encoder_platform_formats_avcodec *>(encoder.platform_formats.get());
-    if (!platform_formats) {
+  std::unique_ptr<nvenc_encode_session_t> make_nvenc_encode_session(const config_t &client_config, std::unique_ptr<platf::nvenc_encode_device_t> encode_device) {
+    if (!encode_device->init_encoder(client_config, encode_device->colorspace)) {
       return nullptr;
     }
 
-    bool hardware = platform_formats->avcodec_base_dev_type != AV_HWDEVICE_TYPE_NONE;
+    return std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
+  }
 
-    auto &video_format = encoder.codec_from_config(config);
-    if (!video_format[encoder_t::PASSED] || !disp->is_codec_supported(video_format.name, config)) {
-      BOOST_LOG(error) << encoder.name << ": "sv << video_format.name << " mode not supported"sv;
+#ifdef __APPLE__
+  std::unique_ptr<vt_encode_session_t> make_vt_encode_session(const config_t &client_config, std::unique_ptr<platf::vt_encode_device_t> encode_device) {
+    if (!encode_device->init_encoder(client_config, encode_device->colorspace)) {
       return nullptr;
     }
 
-    if (config.dynamicRange && !video_format[encoder_t::DYNAMIC_RANGE]) {
-      BOOST_LOG(error) << video_format.name << ": dynamic range not supported"sv;
-      return nullptr;
+    return std::make_unique<vt_encode_session_t>(std::move(encode_device));
+  }
+#endif
+
+  std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
+    if (dynamic_cast<platf::avcodec_encode_device_t *>(encode_device.get())) {
+      auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
+      return make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
+    } else if (dynamic_cast<platf::nvenc_encode_device_t *>(encode_device.get())) {
+      auto nvenc_encode_device = boost::dynamic_pointer_cast<platf::nvenc_encode_device_t>(std::move(encode_device));
+      return make_nvenc_encode_session(config, std::move(nvenc_encode_device));
+    }
+#ifdef __APPLE__
+    else if (dynamic_cast<platf::vt_encode_device_t *>(encode_device.get())) {
+      auto vt_encode_device = boost::dynamic_pointer_cast<platf::vt_encode_device_t>(std::move(encode_device));
+      return make_vt_encode_session(config, std::move(vt_encode_device));
     }
+#endif
 
-    if (config.chromaSamplingType == 1 && !video_format[encoder_t::YUV444]) {
-      BOOST_LOG(error) << video_format.name << ": YUV 4:4:4 not supported"sv;
-      return nullptr;
+    return nullptr;
+  }
+
+  /**
+   * @brief Send a packet from a shared encoder to every subscribed session.
+   * @param shared The shared encoder.
+   * @param packet The packet.
+   */
+  void fan_out(shared_encoder_t &shared, packet_t &&packet) {
+    std::shared_ptr<packet_raw_t> shared_packet {std::move(packet)};
+
+    auto lg = shared.subscribers.lock();
+    for (auto &subscriber : shared.subscribers.raw) {
+      subscriber.packets->raise(std::make_unique<packet_raw_shared>(shared_packet, subscriber.channel_data));
     }
+  }
 
-    auto codec = avcodec_find_encoder_by_name(video_format.name.c_str());
-    if (!codec) {
-      BOOST_LOG(error) << "Couldn't open ["sv << video_format.name << ']';
+  void teardown_encode_session(const encoder_t &encoder, std::unique_ptr<encode_session_t> &&session) {
+    // As a workaround for NVENC hangs and to generally speed up encoder reinit,
+    // we will complete the encoder teardown in a separate thread if supported.
+    // This will move expensive processing off the encoder thread to allow us
+    // to restart encoding as soon as possible. For cases where the NVENC driver
+    // hang occurs, this thread may probably never exit, but it will allow
+    // streaming to continue without requiring a full restart of Sunshine.
+    if (encoder.flags & ASYNC_TEARDOWN) {
+      std::thread encoder_teardown_thread {[session = std::move(session)]() mutable {
+        BOOST_LOG(info) << "Starting async encoder teardown";
+        session.reset();
+        BOOST_LOG(info) << "Async encoder teardown complete";
+      }};
+      encoder_teardown_thread.detach();
+    } else {
+      session.reset();
+    }
+  }
 
-      return nullptr;
+  /**
+   * @brief An encode session built in the background for the display the capture thread is about to switch to.
+   */
+  struct standby_session_t {
+    std::shared_ptr<platf::display_t> disp;
+    std::unique_ptr<encode_session_t> session;
+    input::touch_port_t touch_port;
+    hdr_info_t hdr_info;
+  };
+
+  standby_session_t make_standby_session(std::shared_ptr<platf::display_t> disp, const encoder_t &encoder, const config_t &config);
+
+  /**
+   * @brief Get how many presets faster than the configured one an encoder has.
+   * @param encoder The encoder.
+   * @param config The config of the session.
+   * @return The number of faster presets, 0 if the encoder has no presets.
+   */
+  int max_preset_steps(const encoder_t &encoder, const config_t &config) {
+#ifdef _WIN32
+    // NVENC is configured directly rather than through FFmpeg, with its presets numbered from 1 to 7
+    if (&encoder == &nvenc) {
+      return config::video.nv.quality_preset - 1;
     }
+#endif
 
-    auto colorspace = encode_device->colorspace;
-    auto sw_fmt = (colorspace.bit_depth == 8 && config.chromaSamplingType == 0)  ? platform_formats->avcodec_pix_fmt_8bit :
-                  (colorspace.bit_depth == 8 && config.chromaSamplingType == 1)  ? platform_formats->avcodec_pix_fmt_yuv444_8bit :
-                  (colorspace.bit_depth == 10 && config.chromaSamplingType == 0) ? platform_formats->avcodec_pix_fmt_10bit :
-                  (colorspace.bit_depth == 10 && config.chromaSamplingType == 1) ? platform_formats->avcodec_pix_fmt_yuv444_10bit :
-                                                                                   AV_PIX_FMT_NONE;
+    auto &codec = encoder.codec_from_config(config);
 
-    // Allow up to 1 retry to apply the set of fallback options.
-    //
-    // Note: If we later end up needing multiple sets of
-    // fallback options, we may need to allow more retries
-    // to try applying each set.
-    avcodec_ctx_t ctx;
-    for (int retries = 0; retries < 2; retries++) {
-      ctx.reset(avcodec_alloc_context3(codec));
-      ctx->width = config.width;
-      ctx->height = config.height;
-      ctx->time_base = AVRational {1, config.framerate};
-      ctx->framerate = AVRational {config.framerate, 1};
-      if (config.framerateX100 > 0) {
-        AVRational fps = video::framerateX100_to_rational(config.framerateX100);
-        ctx->framerate = fps;
-        ctx->time_base = AVRational {fps.den, fps.num};
+    std::string preset;
+    for (auto &option : codec.common_options) {
+      if (option.name != "preset"sv) {
+        continue;
+      }
+
+      std::visit(
+        util::overloaded {
+          [&](int *v) {
+            preset = std::to_string(*v);
+          },
+          [&](std::optional<int> *v) {
+            if (*v) {
+              preset = std::to_string(**v);
+            }
+          },
+          [&](std::string *v) {
+            preset = *v;
+          },
+          [&](auto &) {
+          }
+        },
+        option.value
+      );
+    }
+
+    int steps = 0;
+    while (steps < 16 && faster_preset(codec.name, preset, steps + 1) != faster_preset(codec.name, preset, steps)) {
+      ++steps;
+    }
+
+    return steps;
+  }
+
+  /**
+   * @return `true` if the encoder failed or stalled, and should be replaced.
+   */
+  bool encode_run(
+    int &frame_nr,  // Store progress of the frame number
+    int &display_generation,  // Store the display generation the session encodes
+    safe::mail_t mail,
+    img_event_t images,
+    config_t config,
+    std::shared_ptr<platf::display_t> disp,
+    std::unique_ptr<platf::encode_device_t> encode_device,
+    safe::signal_t &reinit_event,
+    display_switch_t &display_switch,
+    const encoder_t &encoder,
+    void *channel_data,
+    safe::mail_raw_t::queue_t<packet_t> packets,
+    frame_scheduler::scheduler_t &scheduler,
+    encoder_watchdog_t &watchdog,
+    shared_encoder_t *shared = nullptr
+  ) {
+    // With automatic screen content coding, sessions start with the tools of the default presets
+    config.screenContent = config::video.screen_content == config::video_t::screen_content_e::enabled;
+
+    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    if (!session) {
+      return true;
+    }
+
+    auto fail_guard = util::fail_guard([&encoder, &session] {
+      teardown_encode_session(encoder, std::move(session));
+    });
+
+    frame_trace::name_thread("Video encoder");
+
+    // The session for the next display is built while this one keeps encoding
+    bool prepared_display_switch = false;
+    std::future<standby_session_t> standby_session;
+
+    // With dynamic resolution, the session for the next resolution is built the same way,
+    // but a shared encoder keeps the resolution its subscribers joined at
+    auto dynamic_resolution = config::video.dynamic_resolution && !shared;
+    auto client_width = config.width;
+    auto client_height = config.height;
+
+    // Only one of the controllers below steps at a time, the first one in the order they're updated in
+    auto tuning_hold = std::make_shared<hysteresis_t::hold_t>();
+    resolution_scaler_t resolution_scaler {scheduler.frame_interval(), tuning_hold};
+
+    // A software encoder gets more threads while its frames take too long to encode, the same way
+    auto scale_threads = &encoder == &software && !shared;
+    auto session_threads = [&config]() {
+      return std::max(config.slicesPerFrame, config::video.min_threads);
+    };
+    thread_scaler_t thread_scaler {scheduler.frame_interval(), session_threads(), thread_scaler_t::max_threads(session_threads(), config.height), tuning_hold};
+
+    // The preset is tuned to the encode time the same way, unless the encoder is shared too
+    auto preset_steps = config::video.preset_budget > 0 && !shared ? max_preset_steps(encoder, config) : 0;
+    auto tune_preset = preset_steps > 0;
+    preset_tuner_t preset_tuner {scheduler.frame_interval(), config::video.preset_budget, preset_steps, tuning_hold};
+
+    // Static content switches the screen content coding tools on the same way, unless the encoder is shared too
+    // or has none of these tools, which would only restart it for nothing
+    auto &codec_name = encoder.codec_from_config(config).name;
+    auto has_screen_content_tools = codec_name == "av1_amf"sv || codec_name == "hevc_qsv"sv || codec_name == "libsvtav1"sv;
+    auto detect_screen_content = config::video.screen_content == config::video_t::screen_content_e::automatic && has_screen_content_tools && !shared;
+    content_detector_t content_detector;
+
+    // The session with the next resolution or screen content coding tools, built while this one keeps encoding
+    std::future<std::pair<config_t, standby_session_t>> reconfigured_session;
+
+    // set max frame time based on client-requested target framerate.
+    double minimum_fps_target = (config::video.minimum_fps_target > 0.0) ? config::video.minimum_fps_target : config.framerate;
+    std::chrono::duration<double, std::milli> max_frametime {1000.0 / minimum_fps_target};
+    BOOST_LOG(info) << "Minimum FPS target set to ~"sv << (minimum_fps_target / 2) << "fps ("sv << max_frametime.count() * 2 << "ms)"sv;
+
+    // The scheduler puts a repeated frame off when a captured frame is due before it could get out
+    auto repeat_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(max_frametime);
+    auto last_encode = std::chrono::steady_clock::now();
+    logging::min_max_avg_periodic_logger<double> repeat_deadline_logger(debug, "Frame scheduler: wait for captured frame", "ms");
+    logging::min_max_avg_periodic_logger<double> encode_slack_logger(debug, "Frame scheduler: expected time from frame sent to next capture", "ms");
+    logging::time_delta_percentile_logger encode_latency_logger(debug, "Frame encode latency", 20s, &metrics::video.encode_recent_seconds);
+
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto idr_events = mail->event<bool>(mail::idr);
+    auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+    auto acknowledged_frame_events = mail->event<int64_t>(mail::acknowledged_frame);
+    auto bitrate_events = mail->event<int>(mail::bitrate);
+    auto max_frame_size_events = mail->event<int64_t>(mail::max_frame_size);
+    auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
+    auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
+
+    // Packets from a shared encoder are encoded once, then handed to every subscribed session
+    auto encoded_packets = shared ? mail->queue<packet_t>(mail::shared_video_packets) : packets;
+
+    // The bitrate the session asked for last, which outlives the encode session across display switches
+    std::optional<int> requested_bitrate;
+    std::optional<int64_t> requested_max_frame_size;
+    bool logged_fixed_bitrate = false;
+
+    // The frames up to this one are part of an intra refresh that replaced an IDR frame
+    int64_t intra_refresh_end = 0;
+
+    // The region around the cursor the encoder was last given
+    std::optional<roi_t> last_roi;
+
+    // The quality of the video is sampled against the frames given to the encoder, unless the encoder is shared
+    std::unique_ptr<video_quality::sampler_t> quality_sampler;
+    if (config::video.quality_sample_interval > 0 && !shared) {
+      if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(session.get())) {
+        auto quality_event = mail->event<video_quality::sample_t>(mail::encode_quality);
+        quality_sampler = video_quality::sampler_t::make(avcodec_session->avcodec_ctx.get(), config::video.quality_sample_interval, [quality_event](const video_quality::sample_t &sample) {
+          quality_event->raise(sample);
+        });
+        avcodec_session->quality_sampler = quality_sampler.get();
+      }
+    }
+
+    // Carry what was asked of the last session over to the next one
+    auto restore_session_state = [&]() {
+      // The next session starts at the bitrate the client asked for
+      if (requested_bitrate) {
+        session->set_bitrate(*requested_bitrate);
+      }
+      if (requested_max_frame_size) {
+        session->set_max_frame_size(*requested_max_frame_size);
+      }
+
+      // The next session is given the region with the next image
+      last_roi = std::nullopt;
+
+      // The sampler starts over at the first IDR frame of the next session
+      if (quality_sampler) {
+        quality_sampler->restart();
+        if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(session.get())) {
+          avcodec_session->quality_sampler = quality_sampler.get();
+        }
+      }
+    };
+
+    {
+      // Load a dummy image into the AVFrame to ensure we have something to encode
+      // even if we timeout waiting on the first frame. This is a relatively large
+      // allocation which can be freed immediately after convert(), so we do this
+      // in a separate scope.
+      auto dummy_img = disp->alloc_img();
+      if (!dummy_img || disp->dummy_img(dummy_img.get()) || session->convert(*dummy_img)) {
+        return false;
+      }
+    }
+
+    while (true) {
+      // Break out of the encoding loop if any of the following are true:
+      // a) The stream is ending
+      // b) Sunshine is quitting
+      // c) The capture side is waiting to reinit and we've encoded at least one frame
+      //
+      // If we have to reinit before we have received any captured frames, we will encode
+      // the blank dummy frame just to let Moonlight know that we're alive.
+      if (shutdown_event->peek() || !images->running() || (reinit_event.peek() && frame_nr > 1)) {
+        break;
       }
 
-      switch (config.videoFormat) {
-        case 0:
-          // 10-bit h264 encoding is not supported by our streaming protocol
-          assert(!config.dynamicRange);
-          ctx->profile = (config.chromaSamplingType == 1) ? AV_PROFILE_H264_HIGH_444_PREDICTIVE : AV_PROFILE_H264_HIGH;
-          break;
+      bool requested_idr_frame = false;
+      bool switched_display = false;
 
-        case 1:
-          if (config.chromaSamplingType == 1) {
-            // HEVC uses the same RExt profile for both 8 and 10 bit YUV 4:4:4 encoding
-            ctx->profile = AV_PROFILE_HEVC_REXT;
+      if (!prepared_display_switch) {
+        if (auto next_disp = display_switch.next()) {
+          prepared_display_switch = true;
+
+          // Sessions subscribed to a shared encoder would need their touch port and HDR state replayed, so a shared encoder is restarted instead
+          if (shared) {
+            ++display_switch.prepared;
           } else {
-            ctx->profile = config.dynamicRange ? AV_PROFILE_HEVC_MAIN_10 : AV_PROFILE_HEVC_MAIN;
-          }
-          break;
+            standby_session = std::async(std::launch::async, [&display_switch, &encoder, config, next_disp]() {
+              auto fg = util::fail_guard([&]() {
+                ++display_switch.prepared;
+              });
 
-        case 2:
-          // AV1 supports both 8 and 10 bit encoding with the same Main profile
-          // but YUV 4:4:4 sampling requires High profile
-          ctx->profile = (config.chromaSamplingType == 1) ? AV_PROFILE_AV1_HIGH : AV_PROFILE_AV1_MAIN;
-          break;
+              return make_standby_session(next_disp, encoder, config);
+            });
+          }
+        }
       }
 
-      // B-frames delay decoder output, so never use them
-      ctx->max_b_frames = 0;
-
-      // Use an infinite GOP length since I-frames are generated on demand
-      ctx->gop_size = encoder.flags & LIMITED_GOP_SIZE ?
-                        std::numeric_limits<std::int16_t>::max() :
-                        std::numeric_limits<int>::max();
+      // The session for the next resolution or screen content coding tools is ready
+      if (reconfigured_session.valid() && (prepared_display_switch || reconfigured_session.wait_for(0s) == std::future_status::ready)) {
+        auto [next_config, next] = reconfigured_session.get();
+
+        if (!next.session) {
+          if (next_config.screenContent != config.screenContent) {
+            BOOST_LOG(warning) << "Screen content coding: couldn't create an encoder "sv << (next_config.screenContent ? "with"sv : "without"sv) << " screen content tools"sv;
+            detect_screen_content = false;
+          } else if (next_config.slicesPerFrame != config.slicesPerFrame) {
+            BOOST_LOG(warning) << "Encoder threads: couldn't create an encoder with "sv << next_config.slicesPerFrame << " threads, staying at "sv << session_threads();
+            scale_threads = false;
+          } else if (next_config.presetSteps != config.presetSteps) {
+            BOOST_LOG(warning) << "Preset tuning: couldn't create an encoder "sv << next_config.presetSteps << " presets faster than configured, staying at "sv << config.presetSteps;
+            tune_preset = false;
+          } else {
+            BOOST_LOG(warning) << "Dynamic resolution: couldn't create an encoder at "sv << next_config.width << 'x' << next_config.height << ", staying at "sv << config.width << 'x' << config.height;
+            dynamic_resolution = false;
+          }
+        } else if (prepared_display_switch) {
+          // The next display is encoded the way its standby session was built
+          teardown_encode_session(encoder, std::move(next.session));
+        } else {
+          if (next_config.screenContent != config.screenContent) {
+            BOOST_LOG(info) << "Screen content coding: "sv << (next_config.screenContent ? "enabled"sv : "disabled"sv);
+          } else if (next_config.slicesPerFrame != config.slicesPerFrame) {
+            BOOST_LOG(info) << "Encoder threads: encoding with "sv << next_config.slicesPerFrame << " threads"sv;
+          } else if (next_config.presetSteps != config.presetSteps) {
+            BOOST_LOG(info) << "Preset tuning: encoding "sv << next_config.presetSteps << " presets faster than configured"sv;
+          } else {
+            BOOST_LOG(info) << "Dynamic resolution: encoding at "sv << next_config.width << 'x' << next_config.height;
+          }
 
-      ctx->keyint_min = std::numeric_limits<int>::max();
+          teardown_encode_session(encoder, std::move(session));
+          session = std::move(next.session);
+          config = next_config;
+          touch_port_event->raise(next.touch_port);
 
-      // Some client decoders have limits on the number of reference frames
-      if (config.numRefFrames) {
-        if (video_format[encoder_t::REF_FRAMES_RESTRICT]) {
-          ctx->refs = config.numRefFrames;
-        } else {
-          BOOST_LOG(warning) << "Client requested reference frame limit, but encoder doesn't support it!"sv;
+          // The first frame of the next session is an IDR frame carrying its parameter sets
+          requested_idr_frame = true;
+          restore_session_state();
         }
       }
 
-      // We forcefully reset the flags to avoid clash on reuse of AVCodecContext
-      ctx->flags = 0;
-      ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP | AV_CODEC_FLAG_LOW_DELAY;
+      // The capture thread stopped capturing the display of this session
+      if (display_switch.generation != display_generation) {
+        display_generation = display_switch.generation;
+        prepared_display_switch = false;
 
-      ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+        // Images of the previous display can't be converted by the next session
+        while (images->peek()) {
+          images->pop();
+        }
 
-      auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
+        auto next = standby_session.valid() ? standby_session.get() : standby_session_t {};
+        if (!next.session) {
+          // Start over with the next display
+          ++display_switch.acknowledged;
+          break;
+        }
 
-      ctx->color_range = avcodec_colorspace.range;
-      ctx->color_primaries = avcodec_colorspace.primaries;
-      ctx->color_trc = avcodec_colorspace.transfer_function;
-      ctx->colorspace = avcodec_colorspace.matrix;
+        teardown_encode_session(encoder, std::move(session));
+        session = std::move(next.session);
+        disp = std::move(next.disp);
+        ++display_switch.acknowledged;
 
-      // Used by cbs::make_sps_hevc
-      ctx->sw_pix_fmt = sw_fmt;
+        touch_port_event->raise(next.touch_port);
+        hdr_event->raise(std::move(next.hdr_info));
 
-      if (hardware) {
-        avcodec_buffer_t encoding_stream_context;
+        // Nothing encoded by the next session can be decoded before its first IDR frame
+        requested_idr_frame = true;
+        switched_display = true;
 
-        ctx->pix_fmt = platform_formats->avcodec_dev_pix_fmt;
+        restore_session_state();
+      }
 
-        // Create the base hwdevice context
-        auto buf_or_error = platform_formats->init_avcodec_hardware_input_buffer(encode_device.get());
-        if (buf_or_error.has_right()) {
-          return nullptr;
+      while (invalidate_ref_frames_events->peek()) {
+        if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
+          session->invalidate_ref_frames(frames->first, frames->second);
         }
-        encoding_stream_context = std::move(buf_or_error.left());
+      }
 
-        // If this encoder requires derivation from the base, derive the desired type
-        if (platform_formats->avcodec_derived_dev_type != AV_HWDEVICE_TYPE_NONE) {
-          avcodec_buffer_t derived_context;
+      // A shared encoder can only rely on what every subscribed session received, so its frames aren't acknowledged
+      if (acknowledged_frame_events->peek()) {
+        if (auto frame_index = acknowledged_frame_events->pop(); frame_index && !shared) {
+          session->acknowledge_frame(*frame_index);
+        }
+      }
 
-          // Allow the hwdevice to prepare for this type of context to be derived
-          if (encode_device->prepare_to_derive_context(platform_formats->avcodec_derived_dev_type)) {
-            return nullptr;
+      // The bitrate of a shared encoder is what every subscribed session asked for, so it isn't changed for one of them
+      if (bitrate_events->peek()) {
+        if (auto bitrate = bitrate_events->pop(); bitrate && !shared) {
+          requested_bitrate = *bitrate;
+          if (!session->set_bitrate(*bitrate) && !logged_fixed_bitrate) {
+            BOOST_LOG(info) << "Encoder can't change its bitrate while streaming, keeping "sv << config.bitrate << " kbps"sv;
+            logged_fixed_bitrate = true;
           }
+        }
+      }
 
-          auto err = av_hwdevice_ctx_create_derived(&derived_context, platform_formats->avcodec_derived_dev_type, encoding_stream_context.get(), 0);
-          if (err) {
-            char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
-            BOOST_LOG(error) << "Failed to derive device context: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
-
-            return nullptr;
-          }
+      // Like its bitrate, the frame size of a shared encoder isn't limited for one session
+      // Encoders that can't change their rate control on the fly keep the frame sizes they started with
+      if (max_frame_size_events->peek()) {
+        if (auto max_frame_size = max_frame_size_events->pop(); max_frame_size && !shared) {
+          requested_max_frame_size = *max_frame_size;
+          session->set_max_frame_size(*max_frame_size);
+        }
+      }
 
-          encoding_stream_context = std::move(derived_context);
+      // Rolling intra refresh heals the picture of the client over the next frames, but a session
+      // joining a shared encoder hasn't decoded anything yet and needs an IDR frame
+      if (idr_events->peek()) {
+        idr_events->pop();
+        if (!requested_idr_frame && !shared && frame_nr > 1 && session->request_intra_refresh()) {
+          intra_refresh_end = frame_nr + config::video.intra_refresh_frames;
+        } else {
+          requested_idr_frame = true;
         }
+      }
 
-        // Initialize avcodec hardware frames
-        {
-          avcodec_buffer_t frame_ref {av_hwframe_ctx_alloc(encoding_stream_context.get())};
+      if (requested_idr_frame) {
+        session->request_idr_frame();
+        intra_refresh_end = 0;
+      }
 
-          auto frame_ctx = (AVHWFramesContext *) frame_ref->data;
-          frame_ctx->format = ctx->pix_fmt;
-          frame_ctx->sw_format = sw_fmt;
-          frame_ctx->height = ctx->height;
-          frame_ctx->width = ctx->width;
-          frame_ctx->initial_pool_size = 0;
+      std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+      auto encode_start = std::chrono::steady_clock::now();
+      bool repeated = true;
 
-          // Allow the hwdevice to modify hwframe context parameters
-          encode_device->init_hwframes(frame_ctx);
+      // Encode at a minimum FPS to avoid image quality issues with static content
+      // After a display switch, wait for the first image of the next display rather than encoding the dummy image
+      // While the stream is idle, repeated frames trickle along with the capture
+      if (!requested_idr_frame || switched_display || images->peek()) {
+        auto interval = idle_state.idle ? std::max<std::chrono::nanoseconds>(repeat_interval, idle_detector_t::TRICKLE_INTERVAL) : repeat_interval;
+        auto repeat_deadline = scheduler.repeat_deadline(last_encode, interval);
+        repeat_deadline_logger.collect_and_log(std::chrono::duration<double, std::milli> {repeat_deadline - last_encode}.count());
+
+        auto img = images->pop(std::max(repeat_deadline - encode_start, std::chrono::nanoseconds::zero()));
+        encode_start = std::chrono::steady_clock::now();
+        if (img) {
+          repeated = false;
+          frame_timestamp = img->frame_timestamp;
+          if (frame_timestamp) {
+            frame_trace::record(frame_trace::span_e::capture, frame_nr, *frame_timestamp, encode_start);
+            scheduler.on_captured(*frame_timestamp, encode_start);
 
-          if (auto err = av_hwframe_ctx_init(frame_ref.get()); err < 0) {
-            return nullptr;
+            auto slack = scheduler.slack(*frame_timestamp, encode_start, {frame_scheduler::stage_e::encode, frame_scheduler::stage_e::send});
+            encode_slack_logger.collect_and_log(std::chrono::duration<double, std::milli> {slack}.count());
           }
 
-          ctx->hw_frames_ctx = av_buffer_ref(frame_ref.get());
-        }
+          frame_trace::scoped_span_t convert_span {frame_trace::span_e::convert, frame_nr};
+          if (session->convert(*img)) {
+            BOOST_LOG(error) << "Could not convert image"sv;
+            return false;
+          }
 
-        ctx->slices = config.slicesPerFrame;
-      } else /* software */ {
-        ctx->pix_fmt = sw_fmt;
+          if (config::video.cursor_roi_qp > 0) {
+            std::optional<roi_t> roi;
+            if (img->cursor) {
+              roi = cursor_roi(*img->cursor, img->width, img->height, config.width, config.height, config::video.cursor_roi_qp);
+            }
 
-        // Clients will request for the fewest slices per frame to get the
-        // most efficient encode, but we may want to provide more slices than
-        // requested to ensure we have enough parallelism for good performance.
-        ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+            // Repeated frames keep the region, and it's only handed to the encoder again when it moves
+            if (roi != last_roi) {
+              session->set_roi(roi);
+              last_roi = roi;
+            }
+          }
+        } else if (!images->running()) {
+          break;
+        }
       }
 
-      if (encoder.flags & SINGLE_SLICE_ONLY) {
-        ctx->slices = 1;
+      {
+        frame_trace::scoped_span_t encode_span {frame_trace::span_e::encode, frame_nr};
+        metrics::set_thread_frame(frame_nr);
+        auto intra_refresh = frame_nr < intra_refresh_end;
+        watchdog.start(std::chrono::steady_clock::now());
+        auto failed = encode(frame_nr++, *session, encoded_packets, channel_data, frame_timestamp, intra_refresh);
+        if (watchdog.finish(std::chrono::steady_clock::now())) {
+          BOOST_LOG(error) << "Encoder ["sv << encoder.name << "] stalled"sv;
+          return true;
+        }
+        if (failed) {
+          BOOST_LOG(error) << "Could not encode video packet"sv;
+          return true;
+        }
       }
 
-      ctx->thread_type = FF_THREAD_SLICE;
-      ctx->thread_count = ctx->slices;
-
-      AVDictionary *options {nullptr};
-      auto handle_option = [&options, &config](const encoder_t::option_t &option) {
-        std::visit(
-          util::overloaded {
-            [&](int v) {
-              av_dict_set_int(&options, option.name.c_str(), v, 0);
-            },
-            [&](int *v) {
-              av_dict_set_int(&options, option.name.c_str(), *v, 0);
-            },
-            [&](std::optional<int> *v) {
-              if (*v) {
-                av_dict_set_int(&options, option.name.c_str(), **v, 0);
-              }
-            },
-            [&](const std::function<int()> &v) {
-              av_dict_set_int(&options, option.name.c_str(), v(), 0);
-            },
-            [&](const std::string &v) {
-              av_dict_set(&options, option.name.c_str(), v.c_str(), 0);
-            },
-            [&](std::string *v) {
-              if (!v->empty()) {
-                av_dict_set(&options, option.name.c_str(), v->c_str(), 0);
-              }
-            },
-            [&](const std::function<const std::string(const config_t &cfg)> &v) {
-              av_dict_set(&options, option.name.c_str(), v(config).c_str(), 0);
-            }
-          },
-          option.value
-        );
-      };
-
-      // Apply common options, then format-specific overrides
-      for (auto &option : video_format.common_options) {
-        handle_option(option);
+      metrics::video.frames_encoded.add();
+      if (repeated) {
+        metrics::video.frames_duplicated.add();
       }
-      for (auto &option : (config.dynamicRange ? video_format.hdr_options : video_format.sdr_options)) {
-        handle_option(option);
-      }
-      if (config.chromaSamplingType == 1) {
-        for (auto &option : (config.dynamicRange ? video_format.hdr444_options : video_format.sdr444_options)) {
-          handle_option(option);
+
+      last_encode = std::chrono::steady_clock::now();
+      scheduler.record(frame_scheduler::stage_e::encode, last_encode - encode_start);
+
+      if (scale_threads) {
+        // The software encoder encodes as many slices as the session asks for, or min_threads
+        auto threads = thread_scaler.update(last_encode, scheduler.budget(frame_scheduler::stage_e::encode));
+        if (!reconfigured_session.valid() && !prepared_display_switch && threads != session_threads()) {
+          auto next_config = config;
+          next_config.slicesPerFrame = threads;
+          reconfigured_session = std::async(std::launch::async, [&encoder, next_config, disp]() {
+            return std::pair {next_config, make_standby_session(disp, encoder, next_config)};
+          });
         }
       }
-      if (retries > 0) {
-        for (auto &option : video_format.fallback_options) {
-          handle_option(option);
+
+      if (tune_preset) {
+        auto steps = preset_tuner.update(last_encode, scheduler.budget(frame_scheduler::stage_e::encode));
+        if (!reconfigured_session.valid() && !prepared_display_switch && steps != config.presetSteps) {
+          auto next_config = config;
+          next_config.presetSteps = steps;
+          reconfigured_session = std::async(std::launch::async, [&encoder, next_config, disp]() {
+            return std::pair {next_config, make_standby_session(disp, encoder, next_config)};
+          });
         }
       }
 
-      auto bitrate = ((config::video.max_bitrate > 0) ? std::min(config.bitrate, config::video.max_bitrate) : config.bitrate) * 1000;
-      BOOST_LOG(info) << "Streaming bitrate is " << bitrate;
-      ctx->rc_max_rate = bitrate;
-      ctx->bit_rate = bitrate;
+      if (dynamic_resolution) {
+        auto scale = resolution_scaler.update(last_encode, scheduler.budget(frame_scheduler::stage_e::encode), scheduler.budget(frame_scheduler::stage_e::send));
 
-      if (encoder.flags & CBR_WITH_VBR) {
-        // Ensure rc_max_bitrate != bit_rate to force VBR mode
-        ctx->bit_rate--;
-      } else {
-        ctx->rc_min_rate = bitrate;
+        auto scaled_config = config;
+        scaled_config.width = resolution_scaler_t::scaled_dimension(client_width, scale);
+        scaled_config.height = resolution_scaler_t::scaled_dimension(client_height, scale);
+        if (!reconfigured_session.valid() && !prepared_display_switch && (scaled_config.width != config.width || scaled_config.height != config.height)) {
+          reconfigured_session = std::async(std::launch::async, [&encoder, scaled_config, disp]() {
+            return std::pair {scaled_config, make_standby_session(disp, encoder, scaled_config)};
+          });
+        }
       }
 
-      if (encoder.flags & RELAXED_COMPLIANCE) {
-        ctx->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+      if (detect_screen_content) {
+        auto is_static = content_detector.update(last_encode, !repeated);
+        if (!reconfigured_session.valid() && !prepared_display_switch && is_static != config.screenContent) {
+          auto next_config = config;
+          next_config.screenContent = is_static;
+          reconfigured_session = std::async(std::launch::async, [&encoder, next_config, disp]() {
+            return std::pair {next_config, make_standby_session(disp, encoder, next_config)};
+          });
+        }
       }
+      encode_latency_logger.first_point(encode_start);
+      encode_latency_logger.second_point_and_log(last_encode);
 
-      if (!(encoder.flags & NO_RC_BUF_LIMIT)) {
-        if (!hardware && (ctx->slices > 1 || config.videoFormat == 1)) {
-          // Use a larger rc_buffer_size for software encoding when slices are enabled,
-          // because libx264 can severely degrade quality if the buffer is too small.
-          // libx265 encounters this issue more frequently, so always scale the
-          // buffer by 1.5x for software HEVC encoding.
-          ctx->rc_buffer_size = bitrate / ((config.framerate * 10) / 15);
-        } else {
-          ctx->rc_buffer_size = bitrate / config.framerate;
-
-#ifndef __APPLE__
-          if (encoder.name == "nvenc" && config::video.nv_legacy.vbv_percentage_increase > 0) {
-            ctx->rc_buffer_size += ctx->rc_buffer_size * config::video.nv_legacy.vbv_percentage_increase / 100;
+      if (shared) {
+        while (encoded_packets->peek()) {
+          if (auto packet = encoded_packets->pop(0ms)) {
+            fan_out(*shared, std::move(packet));
           }
-#endif
         }
       }
 
-      // Allow the encoding device a final opportunity to set/unset or override any options
-      encode_device->init_codec_options(ctx.get(), &options);
+      session->request_normal_frame();
+    }
+
+    return false;
+  }
+
+  std::optional<roi_t> cursor_roi(util::point_t cursor, int img_width, int img_height, int frame_width, int frame_height, int qp_delta) {
+    if (cursor.x < 0 || cursor.y < 0 || cursor.x >= img_width || cursor.y >= img_height) {
+      return std::nullopt;
+    }
+
+    auto scalar = std::fmin((double) frame_width / img_width, (double) frame_height / img_height);
+    auto x = (int) ((frame_width - img_width * scalar) / 2 + cursor.x * scalar);
+    auto y = (int) ((frame_height - img_height * scalar) / 2 + cursor.y * scalar);
+
+    auto half_size = std::max(frame_height / 8, 1);
+    return roi_t {
+      std::max(x - half_size, 0),
+      std::max(y - half_size, 0),
+      std::min(x + half_size, frame_width),
+      std::min(y + half_size, frame_height),
+      -qp_delta,
+    };
+  }
+
+  hysteresis_t::hysteresis_t(clock::duration overloaded_delay, clock::duration headroom_delay, clock::duration hold_time, std::shared_ptr<hold_t> hold):
+      _overloaded_delay {overloaded_delay},
+      _headroom_delay {headroom_delay},
+      _hold_time {hold_time},
+      _hold {hold ? std::move(hold) : std::make_shared<hold_t>()} {
+  }
+
+  hysteresis_t::step_e hysteresis_t::update(clock::time_point now, bool overloaded, bool headroom) {
+    // The estimates still reflect the encoder from before the last step, whichever controller took it
+    if (now < _hold->until) {
+      _overloaded_since = std::nullopt;
+      _headroom_since = std::nullopt;
+      return step_e::none;
+    }
+
+    if (!overloaded) {
+      _overloaded_since = std::nullopt;
+    } else if (!_overloaded_since) {
+      _overloaded_since = now;
+    }
+
+    if (!headroom) {
+      _headroom_since = std::nullopt;
+    } else if (!_headroom_since) {
+      _headroom_since = now;
+    }
+
+    step_e step;
+    if (_overloaded_since && now - *_overloaded_since >= _overloaded_delay) {
+      step = step_e::overloaded;
+    } else if (_headroom_since && now - *_headroom_since >= _headroom_delay) {
+      step = step_e::headroom;
+    } else {
+      return step_e::none;
+    }
+
+    _overloaded_since = std::nullopt;
+    _headroom_since = std::nullopt;
+    _hold->until = now + _hold_time;
+    return step;
+  }
+
+  resolution_scaler_t::resolution_scaler_t(std::chrono::nanoseconds frame_interval, std::shared_ptr<hysteresis_t::hold_t> hold):
+      _frame_interval {frame_interval},
+      _hysteresis {STEP_DOWN_DELAY, STEP_UP_DELAY, HOLD_TIME, std::move(hold)} {
+  }
+
+  int resolution_scaler_t::update(clock::time_point now, std::chrono::nanoseconds encode_time, std::chrono::nanoseconds send_time) {
+    auto load = std::max(encode_time, send_time);
+
+    auto overloaded = _step + 1 < SCALES.size() && load * 100 > _frame_interval * OVERLOAD_PERCENTAGE;
+
+    // Both stages scale about with the number of pixels
+    auto headroom = false;
+    if (_step > 0) {
+      auto next = (double) SCALES[_step - 1] / SCALES[_step];
+      headroom = load * next * next * 100 < _frame_interval * HEADROOM_PERCENTAGE;
+    }
+
+    switch (_hysteresis.update(now, overloaded, headroom)) {
+      case hysteresis_t::step_e::overloaded:
+        ++_step;
+        break;
+      case hysteresis_t::step_e::headroom:
+        --_step;
+        break;
+      case hysteresis_t::step_e::none:
+        break;
+    }
+
+    return scale();
+  }
 
-      if (auto status = avcodec_open2(ctx.get(), codec, &options)) {
-        char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+  int resolution_scaler_t::scaled_dimension(int dimension, int scale) {
+    if (scale >= 100) {
+      return dimension;
+    }
 
-        if (!video_format.fallback_options.empty() && retries == 0) {
-          BOOST_LOG(info)
-            << "Retrying with fallback configuration options for ["sv << video_format.name << "] after error: "sv
-            << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+    return std::max(dimension * scale / 100 / 8 * 8, 8);
+  }
 
-          continue;
-        } else {
-          BOOST_LOG(error)
-            << "Could not open codec ["sv
-            << video_format.name << "]: "sv
-            << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+  thread_scaler_t::thread_scaler_t(std::chrono::nanoseconds frame_interval, int min_threads, int max_threads, std::shared_ptr<hysteresis_t::hold_t> hold):
+      _frame_interval {frame_interval},
+      _min_threads {min_threads},
+      _max_threads {std::max(max_threads, min_threads)},
+      _threads {min_threads},
+      _hysteresis {STEP_UP_DELAY, STEP_DOWN_DELAY, HOLD_TIME, std::move(hold)} {
+  }
 
-          return nullptr;
-        }
-      }
+  int thread_scaler_t::update(clock::time_point now, std::chrono::nanoseconds encode_time) {
+    auto overloaded = _threads < _max_threads && encode_time * 100 > _frame_interval * OVERLOAD_PERCENTAGE;
 
-      // Successfully opened the codec
-      break;
+    // Slices are encoded about in parallel, so half the threads take about twice as long
+    auto headroom = _threads > _min_threads && encode_time * 2 * 100 < _frame_interval * HEADROOM_PERCENTAGE;
+
+    switch (_hysteresis.update(now, overloaded, headroom)) {
+      case hysteresis_t::step_e::overloaded:
+        _threads = std::min(_threads * 2, _max_threads);
+        break;
+      case hysteresis_t::step_e::headroom:
+        _threads = std::max(_threads / 2, _min_threads);
+        break;
+      case hysteresis_t::step_e::none:
+        break;
     }
 
-    avcodec_frame_t frame {av_frame_alloc()};
-    frame->format = ctx->pix_fmt;
-    frame->width = ctx->width;
-    frame->height = ctx->height;
-    frame->color_range = ctx->color_range;
-    frame->color_primaries = ctx->color_primaries;
-    frame->color_trc = ctx->color_trc;
-    frame->colorspace = ctx->colorspace;
-    frame->chroma_location = ctx->chroma_sample_location;
+    return _threads;
+  }
 
-    // Attach HDR metadata to the AVFrame
-    if (colorspace_is_hdr(colorspace)) {
-      SS_HDR_METADATA hdr_metadata;
-      if (disp->get_hdr_metadata(hdr_metadata)) {
-        auto mdm = av_mastering_display_metadata_create_side_data(frame.get());
+  int thread_scaler_t::max_threads(int min_threads, int height) {
+    auto threads = config::video.max_threads;
+    if (threads <= 0) {
+      threads = (int) std::thread::hardware_concurrency() - 2;
+    }
 
-        mdm->display_primaries[0][0] = av_make_q(hdr_metadata.displayPrimaries[0].x, 50000);
-        mdm->display_primaries[0][1] = av_make_q(hdr_metadata.displayPrimaries[0].y, 50000);
-        mdm->display_primaries[1][0] = av_make_q(hdr_metadata.displayPrimaries[1].x, 50000);
-        mdm->display_primaries[1][1] = av_make_q(hdr_metadata.displayPrimaries[1].y, 50000);
-        mdm->display_primaries[2][0] = av_make_q(hdr_metadata.displayPrimaries[2].x, 50000);
-        mdm->display_primaries[2][1] = av_make_q(hdr_metadata.displayPrimaries[2].y, 50000);
+    return std::max(std::min(threads, height / 64), min_threads);
+  }
 
-        mdm->white_point[0] = av_make_q(hdr_metadata.whitePoint.x, 50000);
-        mdm->white_point[1] = av_make_q(hdr_metadata.whitePoint.y, 50000);
+  preset_tuner_t::preset_tuner_t(std::chrono::nanoseconds frame_interval, int budget_percentage, int max_steps, std::shared_ptr<hysteresis_t::hold_t> hold):
+      _budget {frame_interval * budget_percentage / 100},
+      _max_steps {max_steps},
+      _hysteresis {STEP_FASTER_DELAY, STEP_SLOWER_DELAY, HOLD_TIME, std::move(hold)} {
+  }
 
-        mdm->min_luminance = av_make_q(hdr_metadata.minDisplayLuminance, 10000);
-        mdm->max_luminance = av_make_q(hdr_metadata.maxDisplayLuminance, 1);
+  int preset_tuner_t::update(clock::time_point now, std::chrono::nanoseconds encode_time) {
+    auto overloaded = _steps < _max_steps && encode_time > _budget;
 
-        mdm->has_luminance = hdr_metadata.maxDisplayLuminance != 0 ? 1 : 0;
-        mdm->has_primaries = hdr_metadata.displayPrimaries[0].x != 0 ? 1 : 0;
+    // How much slower the next preset is depends on the encoder, so it takes plenty of headroom
+    auto headroom = _steps > 0 && encode_time * 100 < _budget * HEADROOM_PERCENTAGE;
 
-        if (hdr_metadata.maxContentLightLevel != 0 || hdr_metadata.maxFrameAverageLightLevel != 0) {
-          auto clm = av_content_light_metadata_create_side_data(frame.get());
+    switch (_hysteresis.update(now, overloaded, headroom)) {
+      case hysteresis_t::step_e::overloaded:
+        ++_steps;
+        break;
+      case hysteresis_t::step_e::headroom:
+        --_steps;
+        break;
+      case hysteresis_t::step_e::none:
+        break;
+    }
 
-          clm->MaxCLL = hdr_metadata.maxContentLightLevel;
-          clm->MaxFALL = hdr_metadata.maxFrameAverageLightLevel;
-        }
-      } else {
-        BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
+    return _steps;
+  }
+
+  std::string faster_preset(std::string_view codec_name, std::string_view preset, int steps) {
+    // Presets numbered from the slowest to the fastest one, which NVENC counts down
+    auto faster_number = [&](int slowest, int fastest) {
+      int number;
+      auto [_, ec] = std::from_chars(preset.data(), preset.data() + preset.size(), number);
+      if (ec != std::errc {} || number < std::min(slowest, fastest) || number > std::max(slowest, fastest)) {
+        return std::string {preset};
       }
-    }
 
-    std::unique_ptr<platf::avcodec_encode_device_t> encode_device_final;
+      return std::to_string(fastest > slowest ? std::min(number + steps, fastest) : std::max(number - steps, fastest));
+    };
 
-    if (!encode_device->data) {
-      auto software_encode_device = std::make_unique<avcodec_software_encode_device_t>();
+    if (codec_name == "libx264"sv || codec_name == "libx265"sv) {
+      static constexpr std::array presets {"ultrafast"sv, "superfast"sv, "veryfast"sv, "faster"sv, "fast"sv, "medium"sv, "slow"sv, "slower"sv, "veryslow"sv, "placebo"sv};
 
-      if (software_encode_device->init(width, height, frame.get(), sw_fmt, hardware)) {
-        return nullptr;
+      auto it = std::find(std::begin(presets), std::end(presets), preset);
+      if (it == std::end(presets)) {
+        return std::string {preset};
       }
-      software_encode_device->colorspace = colorspace;
 
-      encode_device_final = std::move(software_encode_device);
-    } else {
-      encode_device_final = std::move(encode_device);
+      return std::string {presets[std::max<int>(it - std::begin(presets) - steps, 0)]};
     }
-
-    if (encode_device_final->set_frame(frame.release(), ctx->hw_frames_ctx)) {
-      return nullptr;
+    if (codec_name == "libsvtav1"sv) {
+      return faster_number(0, 13);
+    }
+    if (codec_name.ends_with("_qsv"sv)) {
+      return faster_number(1, 7);
+    }
+    if (codec_name.ends_with("_nvenc"sv)) {
+      // p7 to p1 are 18 to 12, anything below them is a legacy preset
+      return faster_number(18, 12);
     }
 
-    encode_device_final->apply_colorspace();
+    return std::string {preset};
+  }
 
-    auto session = std::make_unique<avcodec_encode_session_t>(
-      std::move(ctx),
-      std::move(encode_device_final),
+  reinit_backoff_t::reinit_backoff_t(std::uint32_t seed):
+      _random {seed} {
+  }
 
-      // 0 ==> don't inject, 1 ==> inject for h264, 2 ==> inject for hevc
-      config.videoFormat <= 1 ? (1 - (int) video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat) : 0
-    );
+  bool reinit_backoff_t::start(clock::time_point now) {
+    if (_recovered_at && now - *_recovered_at < STABLE_TIME) {
+      return false;
+    }
 
-    return session;
+    _attempts = 0;
+    return true;
   }
 
-  std::unique_ptr<nvenc_encode_session_t> make_nvenc_encode_session(const config_t &client_config, std::unique_ptr<platf::nvenc_encode_device_t> encode_device) {
-    if (!encode_device->init_encoder(client_config, encode_device->colorspace)) {
-      return nullptr;
-    }
+  std::chrono::milliseconds reinit_backoff_t::next_delay() {
+    auto delay = std::min<std::chrono::milliseconds>(MIN_DELAY * (1 << std::min(_attempts, 16)), MAX_DELAY);
+    ++_attempts;
 
-    return std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
+    std::uniform_int_distribution<int> jitter {100 - JITTER_PERCENTAGE, 100 + JITTER_PERCENTAGE};
+    return delay * jitter(_random) / 100;
   }
 
-  std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
-    if (dynamic_cast<platf::avcodec_encode_device_t *>(encode_device.get())) {
-      auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
-      return make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
-    } else if (dynamic_cast<platf::nvenc_encode_device_t *>(encode_device.get())) {
-      auto nvenc_encode_device = boost::dynamic_pointer_cast<platf::nvenc_encode_device_t>(std::move(encode_device));
-      return make_nvenc_encode_session(config, std::move(nvenc_encode_device));
+  void reinit_backoff_t::recovered(clock::time_point now) {
+    _recovered_at = now;
+  }
+
+  void encoder_watchdog_t::start(clock::time_point now) {
+    _started = now.time_since_epoch().count();
+  }
+
+  bool encoder_watchdog_t::finish(clock::time_point now) {
+    auto started = _started.exchange(IDLE);
+    if (started != IDLE && now - clock::time_point {clock::duration {started}} > STALL_TIMEOUT) {
+      _stalled = true;
     }
 
-    return nullptr;
+    return _stalled;
   }
 
-  void encode_run(
-    int &frame_nr,  // Store progress of the frame number
-    safe::mail_t mail,
-    img_event_t images,
-    config_t config,
-    std::shared_ptr<platf::display_t> disp,
-    std::unique_ptr<platf::encode_device_t> encode_device,
-    safe::signal_t &reinit_event,
-    const encoder_t &encoder,
-    void *channel_data
-  ) {
-    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
-    if (!session) {
-      return;
+  std::optional<std::chrono::nanoseconds> encoder_watchdog_t::check(clock::time_point now) {
+    auto started = _started.load();
+    if (started == IDLE) {
+      return std::nullopt;
     }
 
-    // As a workaround for NVENC hangs and to generally speed up encoder reinit,
-    // we will complete the encoder teardown in a separate thread if supported.
-    // This will move expensive processing off the encoder thread to allow us
-    // to restart encoding as soon as possible. For cases where the NVENC driver
-    // hang occurs, this thread may probably never exit, but it will allow
-    // streaming to continue without requiring a full restart of Sunshine.
-    auto fail_guard = util::fail_guard([&encoder, &session] {
-      if (encoder.flags & ASYNC_TEARDOWN) {
-        std::thread encoder_teardown_thread {[session = std::move(session)]() mutable {
-          BOOST_LOG(info) << "Starting async encoder teardown";
-          session.reset();
-          BOOST_LOG(info) << "Async encoder teardown complete";
-        }};
-        encoder_teardown_thread.detach();
-      }
-    });
+    auto running = now - clock::time_point {clock::duration {started}};
+    if (running <= STALL_TIMEOUT || _stalled.exchange(true)) {
+      return std::nullopt;
+    }
 
-    // set max frame time based on client-requested target framerate.
-    double minimum_fps_target = (config::video.minimum_fps_target > 0.0) ? config::video.minimum_fps_target : config.framerate;
-    std::chrono::duration<double, std::milli> max_frametime {1000.0 / minimum_fps_target};
-    BOOST_LOG(info) << "Minimum FPS target set to ~"sv << (minimum_fps_target / 2) << "fps ("sv << max_frametime.count() * 2 << "ms)"sv;
+    return running;
+  }
 
-    auto shutdown_event = mail->event<bool>(mail::shutdown);
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
-    auto idr_events = mail->event<bool>(mail::idr);
-    auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+  void encoder_watchdog_t::reset() {
+    _started = IDLE;
+    _stalled = false;
+  }
 
-    {
-      // Load a dummy image into the AVFrame to ensure we have something to encode
-      // even if we timeout waiting on the first frame. This is a relatively large
-      // allocation which can be freed immediately after convert(), so we do this
-      // in a separate scope.
-      auto dummy_img = disp->alloc_img();
-      if (!dummy_img || disp->dummy_img(dummy_img.get()) || session->convert(*dummy_img)) {
-        return;
-      }
+  encoder_watchdog_t::failover_t encoder_watchdog_t::on_failure(clock::time_point now, bool has_next_encoder) {
+    auto retried = _last_failure && now - *_last_failure < RETRY_WINDOW;
+
+    _last_failure = now;
+    _restarts = retried ? _restarts + 1 : 0;
+    if (!retried) {
+      return {action_e::reinit, std::chrono::milliseconds::zero()};
     }
 
-    while (true) {
-      // Break out of the encoding loop if any of the following are true:
-      // a) The stream is ending
-      // b) Sunshine is quitting
-      // c) The capture side is waiting to reinit and we've encoded at least one frame
-      //
-      // If we have to reinit before we have received any captured frames, we will encode
-      // the blank dummy frame just to let Moonlight know that we're alive.
-      if (shutdown_event->peek() || !images->running() || (reinit_event.peek() && frame_nr > 1)) {
-        break;
-      }
+    // The next encoder starts with a retry of its own
+    if (has_next_encoder) {
+      _last_failure = std::nullopt;
+      _restarts = 0;
+      return {action_e::next_encoder, std::chrono::milliseconds::zero()};
+    }
 
-      bool requested_idr_frame = false;
+    if (_restarts >= MAX_RESTARTS) {
+      return {action_e::give_up, std::chrono::milliseconds::zero()};
+    }
 
-      while (invalidate_ref_frames_events->peek()) {
-        if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
-          session->invalidate_ref_frames(frames->first, frames->second);
-        }
-      }
+    return {action_e::reinit, std::min<std::chrono::milliseconds>(MIN_RESTART_DELAY * (1 << (_restarts - 1)), MAX_RESTART_DELAY)};
+  }
 
-      if (idr_events->peek()) {
-        requested_idr_frame = true;
-        idr_events->pop();
-      }
+  bool content_detector_t::update(clock::time_point now, bool captured) {
+    if (_frames == 0) {
+      _window_start = now;
+    }
+    ++_frames;
+    _captured += captured;
 
-      if (requested_idr_frame) {
-        session->request_idr_frame();
-      }
+    if (now - _window_start < WINDOW) {
+      return _static;
+    }
 
-      std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+    auto percentage = _captured * 100 / _frames;
+    _frames = 0;
+    _captured = 0;
 
-      // Encode at a minimum FPS to avoid image quality issues with static content
-      if (!requested_idr_frame || images->peek()) {
-        if (auto img = images->pop(max_frametime)) {
-          frame_timestamp = img->frame_timestamp;
-          if (session->convert(*img)) {
-            BOOST_LOG(error) << "Could not convert image"sv;
-            return;
-          }
-        } else if (!images->running()) {
-          break;
-        }
-      }
+    if (now < _hold_until) {
+      return _static;
+    }
 
-      if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp)) {
-        BOOST_LOG(error) << "Could not encode video packet"sv;
-        return;
-      }
+    if (_static ? percentage > MOTION_PERCENTAGE : percentage < STATIC_PERCENTAGE) {
+      _static = !_static;
+      _hold_until = now + HOLD_TIME;
+    }
 
-      session->request_normal_frame();
+    return _static;
+  }
+
+  bool idle_detector_t::update(clock::time_point now, bool changed, clock::time_point last_input) {
+    if (changed || !_last_change) {
+      _last_change = now;
     }
+
+    return _timeout > 0ns && now - std::max(*_last_change, last_input) >= _timeout;
   }
 
   input::touch_port_t make_port(platf::display_t *display, const config_t &config) {
@@ -2096,6 +3917,12 @@ namespace video {
       BOOST_LOG(info) << "Color range: " << (colorspace.full_range ? "JPEG" : "MPEG");
     }
 
+#ifdef __APPLE__
+    // The session of our own takes the same captured pixel buffers as the one FFmpeg would open
+    if (&encoder == &videotoolbox && config::video.vt.vt_native) {
+      result = disp.make_vt_encode_device(pix_fmt);
+    } else
+#endif
     if (dynamic_cast<const encoder_platform_formats_avcodec *>(encoder.platform_formats.get())) {
       result = disp.make_avcodec_encode_device(pix_fmt);
     } else if (dynamic_cast<const encoder_platform_formats_nvenc *>(encoder.platform_formats.get())) {
@@ -2109,6 +3936,50 @@ namespace video {
     return result;
   }
 
+  hdr_info_t make_hdr_info(platf::display_t &disp, const platf::encode_device_t &encode_device) {
+    hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
+    if (colorspace_is_hdr(encode_device.colorspace)) {
+      if (disp.get_hdr_metadata(hdr_info->metadata)) {
+        hdr_info->enabled = true;
+      } else {
+        BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
+      }
+    }
+
+    return hdr_info;
+  }
+
+  standby_session_t make_standby_session(std::shared_ptr<platf::display_t> disp, const encoder_t &encoder, const config_t &config) {
+    standby_session_t standby;
+
+    // The threads of the encoder library start on the CPUs of the thread opening it
+    thread_affinity::pin(thread_affinity::role_e::encode);
+
+    auto encode_device = make_encode_device(*disp, encoder, config);
+    if (!encode_device) {
+      return standby;
+    }
+
+    standby.touch_port = make_port(disp.get(), config);
+    standby.hdr_info = make_hdr_info(*disp, *encode_device);
+
+    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    if (!session) {
+      return standby;
+    }
+
+    // Like a new session, start with the dummy image in case the first frame of the next display is late
+    auto dummy_img = disp->alloc_img();
+    if (!dummy_img || disp->dummy_img(dummy_img.get()) || session->convert(*dummy_img)) {
+      return standby;
+    }
+
+    standby.disp = std::move(disp);
+    standby.session = std::move(session);
+
+    return standby;
+  }
+
   std::optional<sync_session_t> make_synced_session(platf::display_t *disp, const encoder_t &encoder, platf::img_t &img, sync_session_ctx_t &ctx) {
     sync_session_t encode_session;
 
@@ -2131,6 +4002,7 @@ namespace video {
         BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
       }
     }
+    encode_session.hdr_info = *hdr_info;
     ctx.hdr_events->raise(std::move(hdr_info));
 
     auto session = make_encode_session(disp, encoder, ctx.config, img.width, img.height, std::move(encode_device));
@@ -2178,8 +4050,17 @@ namespace video {
 #endif
 
     while (encode_session_ctx_queue.running()) {
+      // The display opened ahead of the stream was picked from displays enumerated moments ago
+      if (!switch_display_event->peek()) {
+        disp = take_warm_display(encoder.platform_formats->dev_type, synced_session_ctxs.front()->config, display_names, display_p);
+        if (disp) {
+          break;
+        }
+      }
+
       // Refresh display names since a display removal might have caused the reinitialization
-      refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
+      // Encoders that can't run alongside each other capture the display the first session picked for all of them
+      refresh_displays(encoder.platform_formats->dev_type, display_names, display_p, synced_session_ctxs.front()->config.output_name);
 
       // Process any pending display switch with the new list of displays
       if (switch_display_event->peek()) {
@@ -2211,7 +4092,37 @@ namespace video {
     }
 
     std::vector<sync_session_t> synced_sessions;
+
+    // A session with the same video settings as a running one follows its encoder instead,
+    // so each frame is converted and encoded once for both
+    auto follow_synced_session = [&](sync_session_ctx_t &ctx) {
+      if (!config::video.shared_encoding) {
+        return false;
+      }
+
+      auto pos = std::find_if(std::begin(synced_sessions), std::end(synced_sessions), [&ctx](const sync_session_t &synced_session) {
+        return synced_session.ctx->config == ctx.config;
+      });
+      if (pos == std::end(synced_sessions)) {
+        return false;
+      }
+
+      ctx.touch_port_events->raise(make_port(disp.get(), ctx.config));
+      ctx.hdr_events->raise(std::make_unique<hdr_info_raw_t>(pos->hdr_info));
+
+      pos->followers.push_back(&ctx);
+      BOOST_LOG(info) << "Sharing an encoder with "sv << pos->followers.size() << " other session(s)"sv;
+
+      // Nothing can be decoded by the new session before the next IDR frame
+      pos->session->request_idr_frame();
+      return true;
+    };
+
     for (auto &ctx : synced_session_ctxs) {
+      if (follow_synced_session(*ctx)) {
+        continue;
+      }
+
       auto synced_session = make_synced_session(disp.get(), encoder, *img, *ctx);
       if (!synced_session) {
         return encode_e::error;
@@ -2220,6 +4131,10 @@ namespace video {
       synced_sessions.emplace_back(std::move(*synced_session));
     }
 
+    // The packets of an encoder with followers are gathered here, then handed to each of its sessions
+    auto shared_mail = std::make_shared<safe::mail_raw_t>();
+    auto shared_packets = shared_mail->queue<packet_t>(mail::shared_video_packets);
+
     auto ec = platf::capture_e::ok;
     while (encode_session_ctx_queue.running()) {
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
@@ -2230,6 +4145,9 @@ namespace video {
           }
 
           synced_session_ctxs.emplace_back(std::make_unique<sync_session_ctx_t>(std::move(*encode_session_ctx)));
+          if (follow_synced_session(*synced_session_ctxs.back())) {
+            continue;
+          }
 
           auto encode_session = make_synced_session(disp.get(), encoder, *img, *synced_session_ctxs.back());
           if (!encode_session) {
@@ -2240,17 +4158,31 @@ namespace video {
           synced_sessions.emplace_back(std::move(*encode_session));
         }
 
+        auto remove_ctx = [&synced_session_ctxs](sync_session_ctx_t *ctx) {
+          // Let waiting thread know it can delete shutdown_event
+          ctx->join_event->raise(true);
+
+          synced_session_ctxs.erase(std::find_if(std::begin(synced_session_ctxs), std::end(synced_session_ctxs), [&ctx_p = ctx](auto &ctx) {
+            return ctx.get() == ctx_p;
+          }));
+        };
+
         KITTY_WHILE_LOOP(auto pos = std::begin(synced_sessions), pos != std::end(synced_sessions), {
           auto ctx = pos->ctx;
           if (ctx->shutdown_event->peek()) {
-            // Let waiting thread know it can delete shutdown_event
-            ctx->join_event->raise(true);
+            auto frame_nr = ctx->frame_nr;
+            remove_ctx(ctx);
+
+            // The encoder keeps running for its followers, so they don't have to wait for a new one
+            if (!pos->followers.empty()) {
+              pos->ctx = pos->followers.front();
+              pos->ctx->frame_nr = frame_nr;
+              pos->followers.erase(std::begin(pos->followers));
+
+              continue;
+            }
 
             pos = synced_sessions.erase(pos);
-            synced_session_ctxs.erase(std::find_if(std::begin(synced_session_ctxs), std::end(synced_session_ctxs), [&ctx_p = ctx](auto &ctx) {
-              return ctx.get() == ctx_p;
-            }));
-
             if (synced_sessions.empty()) {
               return false;
             }
@@ -2258,16 +4190,39 @@ namespace video {
             continue;
           }
 
+          std::erase_if(pos->followers, [&remove_ctx](sync_session_ctx_t *follower) {
+            if (!follower->shutdown_event->peek()) {
+              return false;
+            }
+
+            remove_ctx(follower);
+            return true;
+          });
+
+          auto idr_requested = false;
+          for (auto requester : pos->followers) {
+            if (requester->idr_events->peek()) {
+              requester->idr_events->pop();
+              idr_requested = true;
+            }
+          }
           if (ctx->idr_events->peek()) {
-            pos->session->request_idr_frame();
             ctx->idr_events->pop();
+            idr_requested = true;
+          }
+          if (idr_requested) {
+            pos->session->request_idr_frame();
           }
 
-          if (frame_captured && pos->session->convert(*img)) {
-            BOOST_LOG(error) << "Could not convert image"sv;
-            ctx->shutdown_event->raise(true);
+          auto encode_start = std::chrono::steady_clock::now();
+          if (frame_captured) {
+            frame_trace::scoped_span_t convert_span {frame_trace::span_e::convert, ctx->frame_nr};
+            if (pos->session->convert(*img)) {
+              BOOST_LOG(error) << "Could not convert image"sv;
+              ctx->shutdown_event->raise(true);
 
-            continue;
+              continue;
+            }
           }
 
           std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
@@ -2275,13 +4230,42 @@ namespace video {
             frame_timestamp = img->frame_timestamp;
           }
 
-          if (encode(ctx->frame_nr++, *pos->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
+          if (frame_captured && frame_timestamp) {
+            frame_trace::record(frame_trace::span_e::capture, ctx->frame_nr, *frame_timestamp, encode_start);
+          }
+
+          frame_trace::scoped_span_t encode_span {frame_trace::span_e::encode, ctx->frame_nr};
+          metrics::set_thread_frame(ctx->frame_nr);
+          if (encode(ctx->frame_nr++, *pos->session, pos->followers.empty() ? ctx->packets : shared_packets, ctx->channel_data, frame_timestamp)) {
             BOOST_LOG(error) << "Could not encode video packet"sv;
             ctx->shutdown_event->raise(true);
 
             continue;
           }
 
+          // Each session gets its own FEC, encryption and sequence numbers in the broadcast thread
+          while (shared_packets->peek()) {
+            if (auto packet = shared_packets->pop(0ms)) {
+              std::shared_ptr<packet_raw_t> shared_packet {std::move(packet)};
+
+              ctx->packets->raise(std::make_unique<packet_raw_shared>(shared_packet, ctx->channel_data));
+              for (auto follower : pos->followers) {
+                follower->packets->raise(std::make_unique<packet_raw_shared>(shared_packet, follower->channel_data));
+              }
+            }
+          }
+
+          metrics::video.frames_encoded.add();
+          if (!frame_captured) {
+            metrics::video.frames_duplicated.add();
+          }
+
+          // Captures are paced by the backend here, so the scheduler only learns the stage costs
+          ctx->scheduler->record(frame_scheduler::stage_e::encode, std::chrono::steady_clock::now() - encode_start);
+          if (frame_captured && frame_timestamp) {
+            ctx->scheduler->on_captured(*frame_timestamp, encode_start);
+          }
+
           pos->session->request_normal_frame();
 
           ++pos;
@@ -2337,16 +4321,126 @@ namespace video {
 
     // Encoding and capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::apply(thread_affinity::role_e::encode);
 
     std::vector<std::string> display_names;
     int display_p = -1;
-    while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p) == encode_e::reinit) {}
+    while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p) == encode_e::reinit) {
+      metrics::video.encoder_reinits.add();
+    }
+  }
+
+  /**
+   * @brief Find a running shared encoder for the given config.
+   * @param config The encoding config of the session.
+   * @return The shared encoder, or `nullptr` if there isn't one.
+   */
+  std::shared_ptr<shared_encoder_t> find_shared_encoder(const config_t &config) {
+    auto lg = shared_encoders.lock();
+    for (auto &shared : shared_encoders.raw) {
+      if (shared->running && shared->config == config) {
+        return shared;
+      }
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * @brief Receive the packets of a shared encoder until the session or the encoder stops.
+   * @param shared The shared encoder.
+   * @param mail The mail of the session.
+   * @param channel_data The channel data of the session.
+   * @param packets The queue of the video broadcast thread sending the session.
+   * @param display_switch The display switch state of the capture thread.
+   * @param display_generation The display generation the session is on.
+   */
+  void follow_shared_encoder(shared_encoder_t &shared, safe::mail_t &mail, void *channel_data, const safe::mail_raw_t::queue_t<packet_t> &packets, display_switch_t &display_switch, int &display_generation) {
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto idr_events = mail->event<bool>(mail::idr);
+    auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+
+    mail->event<input::touch_port_t>(mail::touch_port)->raise(shared.touch_port);
+    mail->event<hdr_info_t>(mail::hdr)->raise(std::make_unique<hdr_info_raw_t>(shared.hdr_info));
+
+    {
+      auto lg = shared.subscribers.lock();
+      shared.subscribers.raw.push_back({channel_data, packets});
+    }
+    auto fg = util::fail_guard([&]() {
+      auto lg = shared.subscribers.lock();
+      std::erase_if(shared.subscribers.raw, [channel_data](const auto &subscriber) {
+        return subscriber.channel_data == channel_data;
+      });
+    });
+
+    BOOST_LOG(info) << "Sharing an encoder with "sv << shared.subscribers.raw.size() - 1 << " other session(s)"sv;
+
+    // Nothing can be decoded by the new session before the next IDR frame
+    shared.idr_events->raise(true);
+
+    // The encoder serves every subscriber, so requests from this session go to the session running it
+    bool prepared_display_switch = false;
+    while (!shutdown_event->peek() && shared.running) {
+      // The session running the encoder handles display switches, there's nothing to prepare here
+      if (!prepared_display_switch && display_switch.next()) {
+        prepared_display_switch = true;
+        ++display_switch.prepared;
+      }
+
+      if (display_switch.generation != display_generation) {
+        display_generation = display_switch.generation;
+        prepared_display_switch = false;
+        ++display_switch.acknowledged;
+      }
+
+      if (idr_events->peek()) {
+        idr_events->pop();
+        shared.idr_events->raise(true);
+      }
+
+      while (invalidate_ref_frames_events->peek()) {
+        if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
+          shared.invalidate_ref_frames_events->raise(*frames);
+        }
+      }
+
+      std::this_thread::sleep_for(5ms);
+    }
+  }
+
+  /**
+   * @brief Find the encoder to fail over to from one that keeps failing.
+   * @return The next encoder that passed validation and takes images from the same capture, or `nullptr`.
+   */
+  const encoder_t *next_validated_encoder(const encoder_t &failed, const config_t &config) {
+    auto lg = validated_encoders.lock();
+
+    auto it = std::find(std::begin(validated_encoders.raw), std::end(validated_encoders.raw), &failed);
+    if (it == std::end(validated_encoders.raw)) {
+      return nullptr;
+    }
+
+    auto next = std::find_if(std::next(it), std::end(validated_encoders.raw), [&](const encoder_t *encoder) {
+      auto &codec = encoder->codec_from_config(config);
+
+      // The client was told what the stream is, so the next encoder has to encode the same
+      return (encoder->flags & PARALLEL_ENCODING) &&
+             encoder->platform_formats->dev_type == failed.platform_formats->dev_type &&
+             codec[encoder_t::PASSED] &&
+             (!config.dynamicRange || codec[encoder_t::DYNAMIC_RANGE]) &&
+             (!config.chromaSamplingType || codec[encoder_t::YUV444]);
+    });
+
+    return next == std::end(validated_encoders.raw) ? nullptr : *next;
   }
 
   void capture_async(
     safe::mail_t mail,
     config_t &config,
-    void *channel_data
+    void *channel_data,
+    safe::mail_raw_t::queue_t<packet_t> packets,
+    frame_scheduler::scheduler_t &scheduler
   ) {
     auto shutdown_event = mail->event<bool>(mail::shutdown);
 
@@ -2356,7 +4450,7 @@ namespace video {
       shutdown_event->raise(true);
     });
 
-    auto ref = capture_thread_async.ref();
+    auto ref = capture_threads_async.ref(config.output_name);
     if (!ref) {
       return;
     }
@@ -2368,19 +4462,64 @@ namespace video {
     }
 
     int frame_nr = 1;
+    int display_generation = ref->display_switch.generation;
 
     auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
     auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
 
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::apply(thread_affinity::role_e::encode);
+
+    // After a shared encoder stops, give the session running it a chance to start a new one before starting our own
+    std::chrono::steady_clock::time_point shared_encoder_grace_period {};
+
+    // The capture thread provides images for the encoder it was started with, which a failing one can be swapped for
+    auto encoder = ref->encoder_p;
+
+    encoder_watchdog_t watchdog;
+    std::atomic<bool> watching = true;
+    std::thread watchdog_thread {[&]() {
+      while (watching) {
+        std::this_thread::sleep_for(100ms);
+
+        if (auto running = watchdog.check(std::chrono::steady_clock::now())) {
+          BOOST_LOG(error) << "Encoder hasn't finished a frame in "sv << std::chrono::duration_cast<std::chrono::milliseconds>(*running).count() << "ms"sv;
+          metrics::video.encoder_stalls.add();
+        }
+      }
+    }};
+    auto watchdog_fg = util::fail_guard([&]() {
+      watching = false;
+      watchdog_thread.join();
+    });
 
     while (!shutdown_event->peek() && images->running()) {
+      // Without a session, a display switch has nothing to wait for
+      if (int generation = ref->display_switch.generation; generation != display_generation) {
+        display_generation = generation;
+        ++ref->display_switch.acknowledged;
+      }
+
       // Wait for the main capture event when the display is being reinitialized
       if (ref->reinit_event.peek()) {
         std::this_thread::sleep_for(20ms);
         continue;
       }
+
+      if (config::video.shared_encoding) {
+        if (auto shared = find_shared_encoder(config)) {
+          follow_shared_encoder(*shared, mail, channel_data, packets, ref->display_switch, display_generation);
+
+          shared_encoder_grace_period = std::chrono::steady_clock::now() + 1s;
+          continue;
+        }
+
+        if (std::chrono::steady_clock::now() < shared_encoder_grace_period) {
+          std::this_thread::sleep_for(20ms);
+          continue;
+        }
+      }
       // Wait for the display to be ready
       std::shared_ptr<platf::display_t> display;
       {
@@ -2392,64 +4531,116 @@ namespace video {
         display = ref->display_wp->lock();
       }
 
-      auto &encoder = *chosen_encoder;
-
-      auto encode_device = make_encode_device(*display, encoder, config);
+      auto encode_device = make_encode_device(*display, *encoder, config);
       if (!encode_device) {
         return;
       }
 
       // absolute mouse coordinates require that the dimensions of the screen are known
-      touch_port_event->raise(make_port(display.get(), config));
+      auto touch_port = make_port(display.get(), config);
+      touch_port_event->raise(touch_port);
 
       // Update client with our current HDR display state
-      hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
-      if (colorspace_is_hdr(encode_device->colorspace)) {
-        if (display->get_hdr_metadata(hdr_info->metadata)) {
-          hdr_info->enabled = true;
-        } else {
-          BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
-        }
+      auto hdr_info = make_hdr_info(*display, *encode_device);
+
+      // Let sessions with the same config subscribe to this encoder instead of starting their own
+      std::shared_ptr<shared_encoder_t> shared;
+      if (config::video.shared_encoding) {
+        shared = std::make_shared<shared_encoder_t>();
+        shared->config = config;
+        shared->idr_events = mail->event<bool>(mail::idr);
+        shared->invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+        shared->touch_port = touch_port;
+        shared->hdr_info = *hdr_info;
+        shared->subscribers.raw.push_back({channel_data, packets});
+
+        auto lg = shared_encoders.lock();
+        shared_encoders.raw.push_back(shared);
       }
+      auto shared_fg = util::fail_guard([&]() {
+        if (!shared) {
+          return;
+        }
+
+        // Subscribers will find another encoder, or start their own
+        shared->running = false;
+
+        auto lg = shared_encoders.lock();
+        std::erase(shared_encoders.raw, shared);
+      });
+
       hdr_event->raise(std::move(hdr_info));
 
-      encode_run(
+      watchdog.reset();
+      auto failed = encode_run(
         frame_nr,
+        display_generation,
         mail,
         images,
         config,
         display,
         std::move(encode_device),
         ref->reinit_event,
-        *ref->encoder_p,
-        channel_data
+        ref->display_switch,
+        *encoder,
+        channel_data,
+        packets,
+        scheduler,
+        watchdog,
+        shared.get()
       );
+      if (!failed || shutdown_event->peek()) {
+        continue;
+      }
+
+      auto next = next_validated_encoder(*encoder, config);
+      auto failover = watchdog.on_failure(std::chrono::steady_clock::now(), next != nullptr);
+      if (failover.action == encoder_watchdog_t::action_e::give_up) {
+        BOOST_LOG(error) << "Encoder ["sv << encoder->name << "] kept failing and no other encoder is left, ending the session"sv;
+        return;
+      }
+
+      // The new encoder starts with an IDR frame, so the client doesn't need to ask for one
+      metrics::video.encoder_failovers.add();
+      if (failover.action == encoder_watchdog_t::action_e::next_encoder) {
+        BOOST_LOG(warning) << "Encoder ["sv << encoder->name << "] failed again, switching to ["sv << next->name << ']';
+        encoder = next;
+        continue;
+      }
+
+      BOOST_LOG(warning) << "Encoder ["sv << encoder->name << "] failed, starting it again in "sv << failover.delay.count() << "ms"sv;
+      if (failover.delay > 0ms && shutdown_event->view(failover.delay)) {
+        return;
+      }
     }
   }
 
   void capture(
     safe::mail_t mail,
     config_t config,
-    void *channel_data
+    void *channel_data,
+    safe::mail_raw_t::queue_t<packet_t> packets,
+    frame_scheduler::scheduler_t &scheduler
   ) {
     auto idr_events = mail->event<bool>(mail::idr);
 
     idr_events->raise(true);
     if (chosen_encoder->flags & PARALLEL_ENCODING) {
-      capture_async(std::move(mail), config, channel_data);
+      capture_async(std::move(mail), config, channel_data, std::move(packets), scheduler);
     } else {
       safe::signal_t join_event;
       auto ref = capture_thread_sync.ref();
       ref->encode_session_ctx_queue.raise(sync_session_ctx_t {
         &join_event,
         mail->event<bool>(mail::shutdown),
-        mail::man->queue<packet_t>(mail::video_packets),
+        std::move(packets),
         std::move(idr_events),
         mail->event<hdr_info_t>(mail::hdr),
         mail->event<input::touch_port_t>(mail::touch_port),
         config,
         1,
         channel_data,
+        &scheduler,
       });
 
       // Wait for join signal
@@ -2482,7 +4673,9 @@ namespace video {
 
     session->request_idr_frame();
 
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+    // Encoders are validated alongside each other, so each validation gets its own queue
+    auto probe_mail = std::make_shared<safe::mail_raw_t>();
+    auto packets = probe_mail->queue<packet_t>(mail::video_packets);
     while (!packets->peek()) {
       if (encode(1, *session, packets, nullptr, {})) {
         return -1;
@@ -2513,10 +4706,25 @@ namespace video {
     return flag;
   }
 
-  bool validate_encoder(encoder_t &encoder, bool expect_failure) {
+  bool validate_encoder(encoder_t &encoder, bool expect_failure, bool *deferred, probe_stages_t *stages) {
     const auto output_name {display_device::map_output_name(config::video.output_name)};
     std::shared_ptr<platf::display_t> disp;
 
+    if (deferred) {
+      *deferred = false;
+    }
+
+    auto stage_start = std::chrono::steady_clock::now();
+    auto end_stage = [&](std::string_view name) {
+      if (!stages) {
+        return;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      stages->emplace_back(name, now - stage_start);
+      stage_start = now;
+    };
+
     BOOST_LOG(info) << "Trying encoder ["sv << encoder.name << ']';
     auto fg = util::fail_guard([&]() {
       BOOST_LOG(info) << "Encoder ["sv << encoder.name << "] failed"sv;
@@ -2577,12 +4785,18 @@ namespace video {
       } else {
         encoder.av1.capabilities.reset();
       }
+
+      if (deferred) {
+        *deferred = true;
+      }
       
+      end_stage("h264"sv);
       fg.disable();
       return true;
     }
     
     if (!disp->is_codec_supported(encoder.h264.name, config_autoselect)) {
+      end_stage("h264"sv);
       fg.disable();
       BOOST_LOG(info) << "Encoder ["sv << encoder.name << "] is not supported on this GPU"sv;
       return false;
@@ -2593,6 +4807,7 @@ namespace video {
     auto max_ref_frames_h264 = expect_failure ? -1 : validate_config(disp, encoder, config_max_ref_frames);
     auto autoselect_h264 = max_ref_frames_h264 >= 0 ? max_ref_frames_h264 : validate_config(disp, encoder, config_autoselect);
     if (autoselect_h264 < 0) {
+      end_stage("h264"sv);
       return false;
     } else if (expect_failure) {
       // We expected failure, but actually succeeded. Do the max_ref_frames probe we skipped.
@@ -2609,6 +4824,7 @@ namespace video {
 
     encoder.h264[encoder_t::REF_FRAMES_RESTRICT] = max_ref_frames_h264 >= 0;
     encoder.h264[encoder_t::PASSED] = true;
+    end_stage("h264"sv);
 
     if (test_hevc) {
       config_max_ref_frames.videoFormat = 1;
@@ -2637,6 +4853,7 @@ namespace video {
       // Clear all cap bits for HEVC if we didn't probe it
       encoder.hevc.capabilities.reset();
     }
+    end_stage("hevc"sv);
 
     if (test_av1) {
       config_max_ref_frames.videoFormat = 2;
@@ -2665,6 +4882,7 @@ namespace video {
       // Clear all cap bits for AV1 if we didn't probe it
       encoder.av1.capabilities.reset();
     }
+    end_stage("av1"sv);
 
     // Test HDR and YUV444 support
     {
@@ -2682,6 +4900,7 @@ namespace video {
       // Reset the display since we're switching from SDR to HDR
       reset_display(disp, encoder.platform_formats->dev_type, output_name, generic_hdr_config);
       if (!disp) {
+        end_stage("hdr"sv);
         return false;
       }
 
@@ -2723,6 +4942,7 @@ namespace video {
       test_hdr_and_yuv444(encoder.hevc, 1);
       test_hdr_and_yuv444(encoder.av1, 2);
     }
+    end_stage("hdr"sv);
 
     encoder.h264[encoder_t::VUI_PARAMETERS] = encoder.h264[encoder_t::VUI_PARAMETERS] && !config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE];
     encoder.hevc[encoder_t::VUI_PARAMETERS] = encoder.hevc[encoder_t::VUI_PARAMETERS] && !config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE];
@@ -2853,10 +5073,187 @@ namespace video {
     }
     
     BOOST_LOG(info) << "Phase 2 encoder validation complete"sv;
+
+    // Let the next start use the refined capabilities instead of the deferred defaults
+    std::optional<std::string> fingerprint;
+    {
+      auto lg = encoder_fingerprints.lock();
+      if (auto it = encoder_fingerprints.raw.find(encoder.name); it != encoder_fingerprints.raw.end()) {
+        fingerprint = it->second;
+      }
+    }
+    if (fingerprint) {
+      encoder_cache::store(encoder_cache_file(), encoder.name, *fingerprint, {
+        true,
+        encoder.h264.capabilities.to_ullong(),
+        encoder.hevc.capabilities.to_ullong(),
+        encoder.av1.capabilities.to_ullong(),
+      });
+    }
+
     return true;
   }
 
+  /**
+   * @brief Describe everything, other than the encoder's own display names, that can change the outcome of validating an encoder.
+   * @return The fingerprint.
+   */
+  std::string system_fingerprint() {
+    std::ostringstream fingerprint;
+    fingerprint << PROJECT_VERSION
+                << '|' << platf::gpu_fingerprint()
+                << '|' << config::video.adapter_name
+                << '|' << display_device::map_output_name(config::video.output_name)
+                << '|' << config::video.capture
+                << '|' << active_hevc_mode
+                << '|' << active_av1_mode
+                << '|' << config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE];
+
+    return fingerprint.str();
+  }
+
+  /**
+   * @brief Validate an encoder, or use its cached results if nothing changed since they were stored.
+   * @param encoder The encoder to validate.
+   * @param expect_failure Whether the encoder is expected to fail validation.
+   * @param fingerprint The fingerprint the results are cached with.
+   * @param use_cache Whether cached results may be used.
+   * @param cached Receives whether cached results were used.
+   * @param stages Receives the time spent on each step of the validation, if the encoder was validated.
+   * @return `true` if the encoder passed validation.
+   */
+  bool validate_encoder_cached(encoder_t &encoder, bool expect_failure, const std::string &fingerprint, bool use_cache, bool &cached, probe_stages_t &stages) {
+    cached = false;
+
+    {
+      auto lg = encoder_fingerprints.lock();
+      encoder_fingerprints.raw[encoder.name] = fingerprint;
+    }
+
+    if (use_cache) {
+      if (auto entry = encoder_cache::load(encoder_cache_file(), encoder.name, fingerprint)) {
+        BOOST_LOG(info) << "Using cached probe results for encoder ["sv << encoder.name << ']';
+
+        encoder.h264.capabilities = entry->h264;
+        encoder.hevc.capabilities = entry->hevc;
+        encoder.av1.capabilities = entry->av1;
+
+        probe_used_cache = true;
+        cached = true;
+        return entry->passed;
+      }
+    }
+
+    bool deferred;
+    auto passed = validate_encoder(encoder, expect_failure, &deferred, &stages);
+
+    // Deferred results are only defaults until a display is available
+    if (!deferred) {
+      encoder_cache::store(encoder_cache_file(), encoder.name, fingerprint, {
+        passed,
+        encoder.h264.capabilities.to_ullong(),
+        encoder.hevc.capabilities.to_ullong(),
+        encoder.av1.capabilities.to_ullong(),
+      });
+    }
+
+    return passed;
+  }
+
+  /**
+   * @brief Get the group an encoder is probed in, when encoders are probed alongside each other.
+   * @details Encoders of a group are probed one after the other. On Linux, encoders of different memory types
+   *          capture and encode through separate drivers and devices, so each memory type gets its own group.
+   *          Elsewhere, every encoder captures through the same API, so they all share a group.
+   * @param encoder The encoder.
+   * @return The group.
+   */
+  static platf::mem_type_e probe_group(const encoder_t &encoder) {
+#ifdef __linux__
+    return encoder.platform_formats->dev_type;
+#else
+    return platf::mem_type_e::unknown;
+#endif
+  }
+
+  /**
+   * @brief Log how long probing each encoder took.
+   * @param report The timings of the probe.
+   */
+  static void log_probe_report(const encoder_probe_report_t &report) {
+    auto to_ms = [](std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    };
+
+    for (const auto &timing : report.encoders) {
+      std::ostringstream stages;
+      for (const auto &[stage, duration] : timing.stages) {
+        stages << ' ' << stage << ' ' << to_ms(duration) << "ms"sv;
+      }
+
+      BOOST_LOG(info) << "Encoder ["sv << timing.name << "] "sv << (timing.passed ? "passed"sv : "failed"sv)
+                      << " in "sv << to_ms(timing.duration) << "ms, started at "sv << to_ms(timing.started) << "ms"sv
+                      << (timing.cached ? " (cached)"sv : stages.str());
+    }
+
+    BOOST_LOG(info) << "Probed "sv << report.encoders.size() << " encoders in "sv << to_ms(report.duration) << "ms"sv
+                    << (report.parallel ? ", alongside each other"sv : ""sv);
+  }
+
+  encoder_probe_report_t last_encoder_probe() {
+    auto lg = last_probe_report.lock();
+    return last_probe_report.raw;
+  }
+
+  int probe_encoders_locked();
+
+  /**
+   * @brief Probe every encoder again in the background, to catch changes that the fingerprints don't cover.
+   * @details This only happens once per run, since probing afterwards refreshes the cache anyway.
+   */
+  void schedule_revalidation() {
+    static bool scheduled = false;
+    if (scheduled) {
+      return;
+    }
+    scheduled = true;
+
+    std::thread {[]() {
+      // Let startup finish before competing for the GPU
+      auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+      if (shutdown_event->view(30s)) {
+        return;
+      }
+
+      std::lock_guard lg {probe_lock};
+
+      // Probing isn't safe while streaming, so leave it to the next probe
+      revalidation_pending = true;
+      if (rtsp_stream::session_count() > 0) {
+        BOOST_LOG(info) << "Postponing revalidation of cached encoder probe results until the next stream"sv;
+        return;
+      }
+
+      BOOST_LOG(info) << "Revalidating cached encoder probe results"sv;
+      if (probe_encoders_locked()) {
+        BOOST_LOG(warning) << "Revalidation of cached encoder probe results failed"sv;
+      }
+    }}.detach();
+  }
+
+  bool reset_encoder_cache() {
+    revalidation_pending = true;
+
+    return encoder_cache::invalidate(encoder_cache_file());
+  }
+
   int probe_encoders() {
+    std::lock_guard lg {probe_lock};
+
+    return probe_encoders_locked();
+  }
+
+  int probe_encoders_locked() {
     if (!allow_encoder_probing()) {
       // Error already logged
       return -1;
@@ -2865,7 +5262,7 @@ namespace video {
     auto encoder_list = encoders;
 
     // If we already have a good encoder, check to see if another probe is required
-    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration()) {
+    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration() && !revalidation_pending) {
       return 0;
     }
 
@@ -2876,6 +5273,129 @@ namespace video {
     active_av1_mode = config::video.av1_mode;
     last_encoder_probe_supported_ref_frames_invalidation = false;
 
+    auto use_cache = !revalidation_pending.exchange(false);
+    probe_used_cache = false;
+
+    // Display names are the only part of the fingerprint that depends on the encoder
+    const auto fingerprint = system_fingerprint();
+
+    struct probe_t {
+      bool expect_failure;
+      bool requested = false;  ///< Whether the encoder may be validated
+      std::optional<bool> passed;
+      encoder_probe_timing_t timing;
+    };
+
+    // If we've used a previous encoder and it's not this one, we expect this encoder to
+    // fail to validate. It will use a slightly different order of checks to more quickly
+    // eliminate failing encoders.
+    std::map<encoder_t *, probe_t> probes;
+    std::map<platf::mem_type_e, std::vector<encoder_t *>> groups;
+    for (auto encoder : encoder_list) {
+      probes[encoder].expect_failure = previous_encoder && previous_encoder != encoder;
+      groups[config::video.parallel_encoder_probing ? probe_group(*encoder) : platf::mem_type_e::unknown].emplace_back(encoder);
+    }
+
+    BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
+
+    // Each group validates its encoders one after the other, on a thread of its own. Encoders are only
+    // validated once selection asks for them, except for the first encoder of each group, which starts
+    // right away when the groups can run alongside each other.
+    if (groups.size() > 1 && config::video.encoder.empty()) {
+      for (auto &entry : groups) {
+        probes.at(entry.second.front()).requested = true;
+      }
+    }
+
+    std::mutex probes_lock;
+    std::condition_variable probes_cv;
+    bool probes_done = false;
+
+    const auto probe_start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (auto &entry : groups) {
+      workers.emplace_back([&, pending = entry.second]() mutable {
+        std::map<platf::mem_type_e, std::string> fingerprints;
+        while (!pending.empty()) {
+          // Validate the encoder with the highest priority that selection asked for
+          auto next = std::end(pending);
+          {
+            std::unique_lock ul {probes_lock};
+            probes_cv.wait(ul, [&]() {
+              next = std::find_if(std::begin(pending), std::end(pending), [&](encoder_t *encoder) {
+                return probes.at(encoder).requested;
+              });
+
+              return probes_done || next != std::end(pending);
+            });
+
+            if (probes_done) {
+              return;
+            }
+          }
+
+          auto encoder = *next;
+          auto &probe = probes.at(encoder);
+          pending.erase(next);
+
+          auto dev_type = encoder->platform_formats->dev_type;
+          auto it = fingerprints.find(dev_type);
+          if (it == fingerprints.end()) {
+            std::ostringstream display_fingerprint;
+            display_fingerprint << fingerprint;
+            for (const auto &name : list_displays(dev_type)) {
+              display_fingerprint << '|' << name;
+            }
+
+            it = fingerprints.emplace(dev_type, display_fingerprint.str()).first;
+          }
+
+          encoder_probe_timing_t timing {std::string {encoder->name}};
+          auto started = std::chrono::steady_clock::now();
+          timing.started = started - probe_start;
+          timing.passed = validate_encoder_cached(*encoder, probe.expect_failure, it->second, use_cache, timing.cached, timing.stages);
+          timing.duration = std::chrono::steady_clock::now() - started;
+
+          {
+            std::lock_guard lg {probes_lock};
+            probe.passed = timing.passed;
+            probe.timing = std::move(timing);
+          }
+          probes_cv.notify_all();
+        }
+      });
+    }
+
+    // Once an encoder is chosen, the groups stop after the encoders they're already validating
+    auto finish_probes = [&]() {
+      {
+        std::lock_guard lg {probes_lock};
+        probes_done = true;
+      }
+      probes_cv.notify_all();
+
+      for (auto &worker : workers) {
+        worker.join();
+      }
+      workers.clear();
+    };
+    auto finish_probes_fg = util::fail_guard([&]() {
+      finish_probes();
+    });
+
+    auto validate = [&](encoder_t &encoder) {
+      auto &probe = probes.at(&encoder);
+
+      std::unique_lock ul {probes_lock};
+      probe.requested = true;
+      probes_cv.notify_all();
+      probes_cv.wait(ul, [&]() {
+        return probe.passed.has_value();
+      });
+
+      return *probe.passed;
+    };
+
     auto adjust_encoder_constraints = [&](encoder_t *encoder) {
       // If we can't satisfy both the encoder and codec requirement, prefer the encoder over codec support
       if (active_hevc_mode == 3 && !encoder->hevc[encoder_t::DYNAMIC_RANGE]) {
@@ -2902,14 +5422,11 @@ namespace video {
 
         if (encoder->name == config::video.encoder) {
           // Remove the encoder from the list entirely if it fails validation
-          if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+          if (!validate(*encoder)) {
             pos = encoder_list.erase(pos);
             break;
           }
 
-          // We will return an encoder here even if it fails one of the codec requirements specified by the user
-          adjust_encoder_constraints(encoder);
-
           chosen_encoder = encoder;
           break;
         }
@@ -2922,15 +5439,13 @@ namespace video {
       }
     }
 
-    BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
-
     // If we haven't found an encoder yet, but we want one with specific codec support, search for that now.
     if (chosen_encoder == nullptr && (active_hevc_mode >= 2 || active_av1_mode >= 2)) {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
 
         // Remove the encoder from the list entirely if it fails validation
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!validate(*encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2964,22 +5479,49 @@ namespace video {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
 
-        // If we've used a previous encoder and it's not this one, we expect this encoder to
-        // fail to validate. It will use a slightly different order of checks to more quickly
-        // eliminate failing encoders.
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        // Remove the encoder from the list entirely if it fails validation
+        if (!validate(*encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
 
-        // We will return an encoder here even if it fails one of the codec requirements specified by the user
-        adjust_encoder_constraints(encoder);
-
         chosen_encoder = encoder;
         break;
       });
     }
 
+    finish_probes_fg.disable();
+    finish_probes();
+
+    encoder_probe_report_t report {std::chrono::steady_clock::now() - probe_start, groups.size() > 1};
+    std::vector<const encoder_t *> passed;
+    for (auto encoder : encoders) {
+      if (auto it = probes.find(encoder); it != probes.end() && it->second.passed) {
+        if (*it->second.passed) {
+          passed.emplace_back(encoder);
+        }
+        report.encoders.emplace_back(std::move(it->second.timing));
+      }
+    }
+    {
+      auto lg = validated_encoders.lock();
+      validated_encoders.raw = std::move(passed);
+    }
+    log_probe_report(report);
+    {
+      auto lg = last_probe_report.lock();
+      last_probe_report.raw = std::move(report);
+    }
+
+    // The encoders that weren't chosen are no longer being validated, so the codec modes can change
+    if (chosen_encoder) {
+      // We will return an encoder here even if it fails one of the codec requirements specified by the user
+      adjust_encoder_constraints(chosen_encoder);
+
+      // The capture and encoding threads move to the node of the GPU
+      thread_affinity::set_node(thread_affinity::device_e::gpu, platf::gpu_numa_node(config::video.adapter_name));
+    }
+
     if (chosen_encoder == nullptr) {
       const auto output_name {display_device::map_output_name(config::video.output_name)};
       BOOST_LOG(fatal) << "Unable to find display or encoder during startup."sv;
@@ -3043,6 +5585,10 @@ namespace video {
       active_av1_mode = encoder.av1[encoder_t::PASSED] ? (encoder.av1[encoder_t::DYNAMIC_RANGE] ? 3 : 2) : 1;
     }
 
+    if (probe_used_cache) {
+      schedule_revalidation();
+    }
+
     return 0;
   }
 
@@ -3133,7 +5679,7 @@ namespace video {
   }
 #endif
 
-  int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx) {
+  int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx, const std::string &output_name) {
     capture_thread_ctx.encoder_p = chosen_encoder;
     capture_thread_ctx.reinit_event.reset();
 
@@ -3144,7 +5690,9 @@ namespace video {
       capture_thread_ctx.capture_ctx_queue,
       std::ref(capture_thread_ctx.display_wp),
       std::ref(capture_thread_ctx.reinit_event),
-      std::ref(*capture_thread_ctx.encoder_p)
+      std::ref(capture_thread_ctx.display_switch),
+      std::ref(*capture_thread_ctx.encoder_p),
+      output_name
     };
 
     return 0;
@@ -4,7 +4,24 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
 // local includes
+#include "buffer_pool.h"
+#include "frame_scheduler.h"
 #include "input.h"
 #include "platform/common.h"
 #include "thread_safe.h"
@@ -43,6 +60,12 @@ namespace video {
     int chromaSamplingType;  // 0 - 4:2:0, 1 - 4:4:4
 
     int enableIntraRefresh;  // 0 - disabled, 1 - enabled
+
+    bool screenContent = false;  // Enable the screen content coding tools of the encoder, chosen by the host
+    int presetSteps = 0;  // How many presets faster than the configured one to encode with, chosen by the host
+    std::string output_name;  // The display to capture, empty for the configured one, chosen by the host
+
+    bool operator==(const config_t &) const = default;
   };
 
   platf::mem_type_e map_base_dev_type(AVHWDeviceType type);
@@ -198,6 +221,19 @@ namespace video {
     uint32_t flags;
   };
 
+  /**
+   * @brief A region of a frame to encode at a different quality than the rest.
+   */
+  struct roi_t {
+    int left;  ///< In pixels of the encoded frame
+    int top;
+    int right;  ///< Excluded from the region
+    int bottom;
+    int qp_delta;  ///< Added to the QP of the region, negative for a higher quality
+
+    bool operator==(const roi_t &) const = default;
+  };
+
   struct encode_session_t {
     virtual ~encode_session_t() = default;
 
@@ -208,6 +244,40 @@ namespace video {
     virtual void request_normal_frame() = 0;
 
     virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+
+    /**
+     * @brief Let the encoder know the client received every frame up to this one.
+     * @param frame_index The last frame the client received.
+     */
+    virtual void acknowledge_frame(int64_t frame_index) = 0;
+
+    /**
+     * @brief Have the encoder heal the picture over the next frames instead of encoding an IDR frame.
+     * @return `true` if the encoder runs rolling intra refresh, `false` if it needs an IDR frame instead.
+     */
+    virtual bool request_intra_refresh() = 0;
+
+    /**
+     * @brief Change the bitrate of the encoder while it keeps encoding.
+     * @param bitrate The bitrate in kilobits per second.
+     * @return `true` if the encoder took the bitrate, `false` if it can't change it on the fly.
+     */
+    virtual bool set_bitrate(int bitrate) = 0;
+
+    /**
+     * @brief Limit the size of each frame while the encoder keeps encoding.
+     * @details The limit never goes below the size of an average frame at the bitrate of the encoder.
+     * @param bits The size of the largest frame in bits.
+     * @return `true` if the encoder took the limit, `false` if it can't change it on the fly.
+     */
+    virtual bool set_max_frame_size(int64_t bits) = 0;
+
+    /**
+     * @brief Encode a region of the next frames at a different quality, until the region changes again.
+     * @details Encoders that can't vary the quality across a frame ignore it.
+     * @param roi The region, or `std::nullopt` to encode the whole frame alike.
+     */
+    virtual void set_roi(const std::optional<roi_t> &roi) = 0;
   };
 
   // encoders
@@ -237,7 +307,7 @@ namespace video {
 
     virtual int64_t frame_index() = 0;
 
-    virtual uint8_t *data() = 0;
+    virtual const uint8_t *data() = 0;
 
     virtual size_t data_size() = 0;
 
@@ -253,10 +323,29 @@ namespace video {
       }
     };
 
+    /**
+     * @brief Where a replacement starts in an IDR frame.
+     */
+    struct splice_t {
+      std::size_t offset;
+      std::string_view old;
+      std::string_view _new;
+    };
+
     std::vector<replace_t> *replacements = nullptr;
+    std::vector<splice_t> splices;  ///< The replacements the encoder thread found in this IDR frame, sorted by offset
     void *channel_data = nullptr;
     bool after_ref_frame_invalidation = false;
+    bool intra_refresh = false;  ///< Part of an intra refresh that replaces an IDR frame the client asked for
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+
+    // The time the packet was handed to the broadcast thread, for tracing the time it waits there
+    std::chrono::steady_clock::time_point queued_timestamp = std::chrono::steady_clock::now();
+
+    // Encoders with sub-frame output hand a frame out in several packets with the same frame index,
+    // each of them sent in its own FEC block as soon as it's encoded
+    int part_index = 0;
+    int part_count = 1;
   };
 
   struct packet_raw_avcodec: packet_raw_t {
@@ -276,7 +365,7 @@ namespace video {
       return av_packet->pts;
     }
 
-    uint8_t *data() override {
+    const uint8_t *data() override {
       return av_packet->data;
     }
 
@@ -288,7 +377,7 @@ namespace video {
   };
 
   struct packet_raw_generic: packet_raw_t {
-    packet_raw_generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr):
+    packet_raw_generic(buffer_pool::buffer_t<uint8_t> &&frame_data, int64_t frame_index, bool idr):
         frame_data {std::move(frame_data)},
         index {frame_index},
         idr {idr} {
@@ -302,7 +391,7 @@ namespace video {
       return index;
     }
 
-    uint8_t *data() override {
+    const uint8_t *data() override {
       return frame_data.data();
     }
 
@@ -310,11 +399,49 @@ namespace video {
       return frame_data.size();
     }
 
-    std::vector<uint8_t> frame_data;
+    buffer_pool::buffer_t<uint8_t> frame_data;
     int64_t index;
     bool idr;
   };
 
+  /**
+   * @brief A packet from an encoder shared by several sessions.
+   * @details Every subscribed session gets its own copy of the packet metadata,
+   *          while the encoded data itself is only referenced. The broadcast thread of
+   *          every session reads it concurrently, so it is read-only past the encoder.
+   */
+  struct packet_raw_shared: packet_raw_t {
+    packet_raw_shared(std::shared_ptr<packet_raw_t> packet, void *channel_data):
+        packet {std::move(packet)} {
+      this->replacements = this->packet->replacements;
+      this->splices = this->packet->splices;
+      this->channel_data = channel_data;
+      this->after_ref_frame_invalidation = this->packet->after_ref_frame_invalidation;
+      this->intra_refresh = this->packet->intra_refresh;
+      this->frame_timestamp = this->packet->frame_timestamp;
+      this->part_index = this->packet->part_index;
+      this->part_count = this->packet->part_count;
+    }
+
+    bool is_idr() override {
+      return packet->is_idr();
+    }
+
+    int64_t frame_index() override {
+      return packet->frame_index();
+    }
+
+    const uint8_t *data() override {
+      return packet->data();
+    }
+
+    size_t data_size() override {
+      return packet->data_size();
+    }
+
+    std::shared_ptr<packet_raw_t> packet;
+  };
+
   using packet_t = std::unique_ptr<packet_raw_t>;
 
   struct hdr_info_raw_t {
@@ -336,13 +463,37 @@ namespace video {
   extern bool last_encoder_probe_supported_ref_frames_invalidation;
   extern std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec;  // 0 - H.264, 1 - HEVC, 2 - AV1
 
+  /**
+   * @brief Capture and encode video for a session until it ends.
+   * @param mail The mail of the session.
+   * @param config The encoding config of the session.
+   * @param channel_data The channel data of the session, attached to its packets.
+   * @param packets The queue of the video broadcast thread sending the session.
+   * @param scheduler The frame scheduler of the session.
+   */
   void capture(
     safe::mail_t mail,
     config_t config,
-    void *channel_data
+    void *channel_data,
+    safe::mail_raw_t::queue_t<packet_t> packets,
+    frame_scheduler::scheduler_t &scheduler
   );
 
-  bool validate_encoder(encoder_t &encoder, bool expect_failure);
+  /**
+   * @brief The time spent on each step of validating an encoder.
+   * @details The steps are `h264`, `hevc`, `av1` and `hdr`, in that order. The H.264 step includes opening the display.
+   */
+  using probe_stages_t = std::vector<std::pair<std::string_view, std::chrono::steady_clock::duration>>;
+
+  /**
+   * @brief Validate an encoder by opening test encoding sessions.
+   * @param encoder The encoder to validate.
+   * @param expect_failure Whether the encoder is expected to fail, which reorders the tests to fail faster.
+   * @param deferred Receives whether validation was deferred because no display was available.
+   * @param stages Receives the time spent on each step that was reached.
+   * @return `true` if the encoder passed validation.
+   */
+  bool validate_encoder(encoder_t &encoder, bool expect_failure, bool *deferred = nullptr, probe_stages_t *stages = nullptr);
 
   /**
    * @brief Refine encoder capabilities with actual display.
@@ -355,16 +506,520 @@ namespace video {
    */
   bool refine_encoder_capabilities(encoder_t &encoder, platf::display_t *disp, const config_t &config);
 
+  /**
+   * @brief The displays to capture from, in place of the displays of the platform.
+   */
+  struct display_source_t {
+    std::function<std::vector<std::string>(platf::mem_type_e)> names;  ///< Lists the displays, like `platf::display_names()`
+    std::function<std::shared_ptr<platf::display_t>(platf::mem_type_e, const std::string &, const config_t &)> open;  ///< Opens a display, like `platf::display()`
+  };
+
+  /**
+   * @brief Capture and probe encoders from other displays than the ones of the platform.
+   * @details Lets the whole pipeline run headless, on a synthetic display.
+   * @param source The displays to capture from, or an empty source to go back to the displays of the platform.
+   * @warning This is only safe to call when there is no client actively streaming.
+   */
+  void set_display_source(display_source_t source);
+
   /**
    * @brief Probe encoders and select the preferred encoder.
    * This is called once at startup and each time a stream is launched to
    * ensure the best encoder is selected. Encoder availability can change
    * at runtime due to all sorts of things from driver updates to eGPUs.
+   * Validation results are persisted and reused while the GPUs, drivers,
+   * displays and relevant settings are unchanged. Reused results are
+   * revalidated in the background once per run. On Linux, encoders of
+   * different drivers are validated alongside each other, while the
+   * encoder is still chosen in the same order of preference.
    *
    * @warning This is only safe to call when there is no client actively streaming.
    */
   int probe_encoders();
 
+  /**
+   * @brief How long probing an encoder took.
+   */
+  struct encoder_probe_timing_t {
+    std::string name;
+    bool passed;
+    bool cached;  ///< Whether the results of a previous run were used instead of validating the encoder
+    std::chrono::steady_clock::duration started;  ///< From the start of the probe
+    std::chrono::steady_clock::duration duration;
+    probe_stages_t stages;
+  };
+
+  /**
+   * @brief How long the last probe took.
+   */
+  struct encoder_probe_report_t {
+    std::chrono::steady_clock::duration duration;
+    bool parallel;  ///< Whether independent encoders were probed alongside each other
+    std::vector<encoder_probe_timing_t> encoders;  ///< The encoders that were probed, in priority order
+  };
+
+  /**
+   * @brief Get the timings of the last probe that validated encoders.
+   * @return The report, empty if no encoder was probed yet.
+   */
+  encoder_probe_report_t last_encoder_probe();
+
+  /**
+   * @brief Start opening the display for a stream that's about to start, ahead of the client asking for it.
+   * @details Opening a display can take a while, so it's done in the background while the client goes
+   *          through the RTSP handshake. The capture takes the display over if the client then asks for
+   *          the same mode, otherwise it's closed first. It's closed as well if no capture starts soon.
+   * @param config The video configuration, with only the display mode the client asked for at launch filled in.
+   * @warning This is only safe to call after `probe_encoders()`, when there is no client actively streaming.
+   */
+  void warm_up_display(const config_t &config);
+
+  /**
+   * @brief Close the display opened ahead of a stream, or kept open after one for a reconnecting client.
+   * @details Called on shutdown, so no display outlives the platform it was opened with, and before the
+   *          options saved since the last session are applied, so the next session opens its display with them.
+   */
+  void release_warm_display();
+
+  /**
+   * @brief Tell the capture that a client sent input.
+   * @details An idle stream goes back to its full frame rate at once, rather than at its next trickled capture.
+   */
+  void on_input();
+
+  /**
+   * @brief Remove the persisted encoder probe results.
+   * @details The next probe validates every encoder again, instead of reusing the results of a previous run.
+   * @return `true` on success, `false` if the cache couldn't be removed.
+   */
+  bool reset_encoder_cache();
+
+  /**
+   * @brief Find the parameter sets to replace in an IDR frame.
+   * @details Parameter sets come before the coded slices of an access unit, so only the NAL units up to the
+   *          first slice are looked at, and the search never goes through the picture itself.
+   * @param payload The IDR frame, in Annex B format.
+   * @param replacements The parameter sets to replace, with their start codes, and what to replace them with.
+   * @param hevc Whether the frame is HEVC rather than H.264.
+   * @return Where each replacement found starts, sorted by offset.
+   */
+  std::vector<packet_raw_t::splice_t> find_splices(std::string_view payload, const std::vector<packet_raw_t::replace_t> &replacements, bool hevc);
+
+  /**
+   * @brief Check whether the replacements found in an earlier IDR frame are at the same place in this one.
+   * @details Encoders lay out the parameter sets of each IDR frame the same way, so they rarely need to be found again.
+   * @param payload The IDR frame.
+   * @param splices The replacements found in the earlier frame.
+   * @return `true` if every replacement is where it was.
+   */
+  bool splices_match(std::string_view payload, const std::vector<packet_raw_t::splice_t> &splices);
+
+  /**
+   * @brief Get the region around the mouse cursor in the encoded frame.
+   * @details The region is a square a quarter of the height of the frame, centered on the cursor. The captured
+   *          image is scaled into the frame keeping its aspect ratio, centered, the way it's converted.
+   * @param cursor Where the cursor is on the captured image.
+   * @param img_width The width of the captured image.
+   * @param img_height The height of the captured image.
+   * @param frame_width The width of the encoded frame.
+   * @param frame_height The height of the encoded frame.
+   * @param qp_delta How much to lower the QP of the region.
+   * @return The region, clipped to the frame, or `std::nullopt` if the cursor is off the image.
+   */
+  std::optional<roi_t> cursor_roi(util::point_t cursor, int img_width, int img_height, int frame_width, int frame_height, int qp_delta);
+
+  /**
+   * @brief Tells a controller of the encoder when to step, once its load was too high or low enough for long enough.
+   * @details Each step is followed by a hold time without another, so the estimates settle on the new encoder.
+   *          The controllers of the same encoder share their hold, since the estimates of the others reflect the
+   *          encoder from before the step too. Only the first of them to step within a hold window does.
+   */
+  class hysteresis_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    enum class step_e {
+      none,  ///< Keep the encoder as it is
+      overloaded,  ///< The load was too high for long enough
+      headroom,  ///< The load was low enough for long enough
+    };
+
+    /**
+     * @brief The time until which the controllers sharing it don't step.
+     */
+    struct hold_t {
+      clock::time_point until;
+    };
+
+    /**
+     * @param overloaded_delay How long the load has to be too high to step.
+     * @param headroom_delay How long the load has to be low enough to step.
+     * @param hold_time How long to hold after a step.
+     * @param hold The hold shared with the other controllers of the encoder, or `nullptr` for a hold of its own.
+     */
+    hysteresis_t(clock::duration overloaded_delay, clock::duration headroom_delay, clock::duration hold_time, std::shared_ptr<hold_t> hold = nullptr);
+
+    /**
+     * @brief Take the load of the last frame into account.
+     * @param now The current time.
+     * @param overloaded Whether the load is too high, and the controller has a step left to relieve it.
+     * @param headroom Whether the load is low enough, and the controller has a step left to use it.
+     * @return The step to take, which starts the hold.
+     */
+    step_e update(clock::time_point now, bool overloaded, bool headroom);
+
+  private:
+    clock::duration _overloaded_delay;
+    clock::duration _headroom_delay;
+    clock::duration _hold_time;
+    std::shared_ptr<hold_t> _hold;
+
+    std::optional<clock::time_point> _overloaded_since;
+    std::optional<clock::time_point> _headroom_since;
+  };
+
+  /**
+   * @brief Picks the resolution to encode at below the client's when encoding or sending falls behind.
+   * @details The resolution steps down once frames have taken most of the frame interval to encode or
+   *          send for a second, and steps back up once they would fit comfortably at the higher resolution
+   *          for several seconds. Each step is followed by a few seconds without another, so the estimates
+   *          settle on the new resolution.
+   */
+  class resolution_scaler_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::array<int, 3> SCALES {100, 75, 50};  ///< In percent of the client's resolution
+    static constexpr auto OVERLOAD_PERCENTAGE = 90;  ///< Of the frame interval, to step down
+    static constexpr auto HEADROOM_PERCENTAGE = 60;  ///< Of the frame interval at the next resolution, to step up
+    static constexpr auto STEP_DOWN_DELAY = std::chrono::seconds {1};
+    static constexpr auto STEP_UP_DELAY = std::chrono::seconds {5};
+    static constexpr auto HOLD_TIME = std::chrono::seconds {3};
+
+    /**
+     * @param frame_interval The frame interval the client asked for.
+     * @param hold The hold shared with the other controllers of the encoder.
+     */
+    explicit resolution_scaler_t(std::chrono::nanoseconds frame_interval, std::shared_ptr<hysteresis_t::hold_t> hold = nullptr);
+
+    /**
+     * @brief Take the load of the last frame into account.
+     * @param now The current time.
+     * @param encode_time The time set aside for encoding a frame.
+     * @param send_time The time set aside for sending a frame.
+     * @return The scale to encode at, in percent of the client's resolution.
+     */
+    int update(clock::time_point now, std::chrono::nanoseconds encode_time, std::chrono::nanoseconds send_time);
+
+    int scale() const {
+      return SCALES[_step];
+    }
+
+    /**
+     * @brief Scale a dimension of the client's resolution, keeping it a multiple of 8.
+     * @param dimension The width or height the client asked for.
+     * @param scale The scale in percent.
+     */
+    static int scaled_dimension(int dimension, int scale);
+
+  private:
+    std::chrono::nanoseconds _frame_interval;
+    std::size_t _step = 0;
+
+    hysteresis_t _hysteresis;
+  };
+
+  /**
+   * @brief Picks the number of threads of a software encoder from the time its frames take to encode.
+   * @details Each thread encodes slices of the same frame, since every frame thread would hold frames back by
+   *          another frame interval. The count doubles once frames have taken most of the frame interval to
+   *          encode for a second, and halves once they would still fit comfortably with half the threads for
+   *          several seconds, since every slice costs some compression. It reacts before the resolution scaler
+   *          does. Each change is followed by a few seconds without another, so the estimate settles on the new encoder.
+   */
+  class thread_scaler_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto OVERLOAD_PERCENTAGE = 75;  ///< Of the frame interval, to double the threads
+    static constexpr auto HEADROOM_PERCENTAGE = 40;  ///< Of the frame interval with half the threads, to halve them
+    static constexpr auto STEP_UP_DELAY = std::chrono::seconds {1};
+    static constexpr auto STEP_DOWN_DELAY = std::chrono::seconds {10};
+    static constexpr auto HOLD_TIME = std::chrono::seconds {3};
+
+    /**
+     * @param frame_interval The frame interval the client asked for.
+     * @param min_threads The threads to start with, and the fewest to go down to.
+     * @param max_threads The most threads to go up to.
+     * @param hold The hold shared with the other controllers of the encoder.
+     */
+    thread_scaler_t(std::chrono::nanoseconds frame_interval, int min_threads, int max_threads, std::shared_ptr<hysteresis_t::hold_t> hold = nullptr);
+
+    /**
+     * @brief Take the encode time of the last frame into account.
+     * @param now The current time.
+     * @param encode_time The time set aside for encoding a frame.
+     * @return The number of threads to encode with.
+     */
+    int update(clock::time_point now, std::chrono::nanoseconds encode_time);
+
+    int threads() const {
+      return _threads;
+    }
+
+    /**
+     * @brief Get the most threads a software encoder may use for a frame height.
+     * @details This is the `max_threads` option, or with `0` every CPU but two left for capturing and sending,
+     *          and no more than a slice every 64 rows.
+     * @param min_threads The fewest threads the encoder uses.
+     * @param height The height of the encoded frames.
+     */
+    static int max_threads(int min_threads, int height);
+
+  private:
+    std::chrono::nanoseconds _frame_interval;
+    int _min_threads;
+    int _max_threads;
+    int _threads;
+
+    hysteresis_t _hysteresis;
+  };
+
+  /**
+   * @brief Picks the slowest encoder preset whose frames still encode within a budget of the frame interval.
+   * @details Sessions start with the configured preset, which is the slowest one tried. The preset steps to a
+   *          faster one once frames have taken longer than the budget to encode for a second, like in the first
+   *          seconds of a demanding session or when a game starts loading the GPU. It steps back to a slower
+   *          one once frames have fit well within the budget for several seconds. Each step needs a new encoder,
+   *          so it's followed by a few seconds without another, while the estimate settles on the new preset.
+   */
+  class preset_tuner_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto HEADROOM_PERCENTAGE = 50;  ///< Of the budget, to step back to a slower preset
+    static constexpr auto STEP_FASTER_DELAY = std::chrono::seconds {1};
+    static constexpr auto STEP_SLOWER_DELAY = std::chrono::seconds {10};
+    static constexpr auto HOLD_TIME = std::chrono::seconds {3};
+
+    /**
+     * @param frame_interval The frame interval the client asked for.
+     * @param budget_percentage The percentage of the frame interval encoding a frame may take.
+     * @param max_steps The most presets to go faster than the configured one.
+     * @param hold The hold shared with the other controllers of the encoder.
+     */
+    preset_tuner_t(std::chrono::nanoseconds frame_interval, int budget_percentage, int max_steps, std::shared_ptr<hysteresis_t::hold_t> hold = nullptr);
+
+    /**
+     * @brief Take the encode time of the last frame into account.
+     * @param now The current time.
+     * @param encode_time The time set aside for encoding a frame.
+     * @return How many presets faster than the configured one to encode with.
+     */
+    int update(clock::time_point now, std::chrono::nanoseconds encode_time);
+
+    int steps() const {
+      return _steps;
+    }
+
+  private:
+    std::chrono::nanoseconds _budget;
+    int _max_steps;
+    int _steps = 0;
+
+    hysteresis_t _hysteresis;
+  };
+
+  /**
+   * @brief Get a preset of an encoder that is faster than another one.
+   * @param codec_name The name of the codec, like `libx264` or `hevc_nvenc`.
+   * @param preset The value of the `preset` option.
+   * @param steps How many presets faster to go.
+   * @return The faster preset, or the fastest one there is. Presets of other codecs come back unchanged.
+   * @examples
+   * auto preset = faster_preset("libx264", "medium", 2);  // "faster"
+   * @examples_end
+   */
+  std::string faster_preset(std::string_view codec_name, std::string_view preset, int steps);
+
+  /**
+   * @brief Paces the attempts to get the capture back after it was lost.
+   * @details The capture being lost seconds after it last came back starts with the fast path, which only
+   *          reacquires the capture of the display it has. The capture being lost again soon after, or a display
+   *          that can't be opened, waits longer and longer between attempts. That way a secure desktop or a
+   *          fullscreen transition that takes a while doesn't keep the CPU and the GPU busy. The delays are
+   *          jittered, so captures of several displays don't retry in lockstep.
+   */
+  class reinit_backoff_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto MIN_DELAY = std::chrono::milliseconds {50};
+    static constexpr auto MAX_DELAY = std::chrono::seconds {2};
+    static constexpr auto JITTER_PERCENTAGE = 25;
+    static constexpr auto STABLE_TIME = std::chrono::seconds {5};  ///< Of capture, for the next loss to start over
+
+    explicit reinit_backoff_t(std::uint32_t seed = std::random_device {}());
+
+    /**
+     * @brief Start getting the capture back.
+     * @return `true` if the fast path is worth a try.
+     */
+    bool start(clock::time_point now);
+
+    /**
+     * @brief Get the time to wait before the next attempt, which is longer each time until the capture is back.
+     */
+    std::chrono::milliseconds next_delay();
+
+    /**
+     * @brief Mark the capture as running again.
+     */
+    void recovered(clock::time_point now);
+
+  private:
+    std::minstd_rand _random;
+    int _attempts = 0;
+    std::optional<clock::time_point> _recovered_at;
+  };
+
+  /**
+   * @brief Notices an encoder that stopped finishing frames, and decides what replaces it.
+   * @details The encoding thread marks the start and the end of each encode call, and a thread of its own checks
+   *          on the call in progress. A call can't be interrupted inside the driver, so an encoder that stalled
+   *          is replaced once the call returns. The first failure gets a new instance of the same encoder, which
+   *          is enough after the driver reset the device. Another failure soon after moves on to the next encoder.
+   *          Without a next encoder, the last one is started again after longer and longer delays, and the session
+   *          ends once it kept failing that way, like a session can't be started for an encoder that doesn't open.
+   */
+  class encoder_watchdog_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto STALL_TIMEOUT = std::chrono::seconds {2};
+    static constexpr auto RETRY_WINDOW = std::chrono::seconds {30};  ///< Failures further apart get the same encoder again
+    static constexpr auto MAX_RESTARTS = 5;  ///< Of the last encoder failing again, before the session ends
+    static constexpr auto MIN_RESTART_DELAY = std::chrono::milliseconds {250};
+    static constexpr auto MAX_RESTART_DELAY = std::chrono::seconds {4};
+
+    enum class action_e {
+      reinit,  ///< Start a new instance of the same encoder
+      next_encoder,  ///< Move on to the next encoder that passed validation
+      give_up,  ///< End the session, no encoder is left to try
+    };
+
+    struct failover_t {
+      action_e action;
+      std::chrono::milliseconds delay;  ///< To wait before the encoder is started again
+    };
+
+    /**
+     * @brief Mark the start of an encode call, from the encoding thread.
+     */
+    void start(clock::time_point now);
+
+    /**
+     * @brief Mark the end of an encode call, from the encoding thread.
+     * @return `true` if the encoder stalled, during this call or while the watchdog was looking.
+     */
+    bool finish(clock::time_point now);
+
+    /**
+     * @brief Check on the encode call in progress, from the watchdog thread.
+     * @return How long the call has been running, the first time it runs past the timeout.
+     */
+    std::optional<std::chrono::nanoseconds> check(clock::time_point now);
+
+    /**
+     * @brief Forget the stall, for a new encoder.
+     */
+    void reset();
+
+    /**
+     * @brief Decide what replaces an encoder that failed.
+     * @param now The time the encoder failed.
+     * @param has_next_encoder Whether another encoder passed validation for the session.
+     */
+    failover_t on_failure(clock::time_point now, bool has_next_encoder);
+
+  private:
+    static constexpr auto IDLE = std::numeric_limits<clock::rep>::min();
+
+    std::atomic<clock::rep> _started {IDLE};
+    std::atomic<bool> _stalled {false};
+
+    std::optional<clock::time_point> _last_failure;
+    int _restarts = 0;
+  };
+
+  /**
+   * @brief Tells static content, like a desktop, from motion, like a game, by how often the capture has a new image.
+   * @details The captured content is static once fewer than a quarter of the frames encoded over a couple of
+   *          seconds were new images rather than repeats, and stops being static once more than half of them
+   *          were. A switch needs a new encoder, so switches are at least several seconds apart.
+   */
+  class content_detector_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto WINDOW = std::chrono::seconds {2};
+    static constexpr auto STATIC_PERCENTAGE = 25;  ///< Of the frames that were new images, below which the content is static
+    static constexpr auto MOTION_PERCENTAGE = 50;  ///< Of the frames that were new images, above which it isn't anymore
+    static constexpr auto HOLD_TIME = std::chrono::seconds {10};
+
+    /**
+     * @brief Take the last encoded frame into account.
+     * @param now The current time.
+     * @param captured Whether the frame was a new image rather than a repeat of the last one.
+     * @return `true` if the content is static.
+     */
+    bool update(clock::time_point now, bool captured);
+
+    bool is_static() const {
+      return _static;
+    }
+
+  private:
+    clock::time_point _window_start;
+    int _frames = 0;
+    int _captured = 0;
+
+    bool _static = false;
+    clock::time_point _hold_until;
+  };
+
+  /**
+   * @brief Tells when nobody is using the stream, like when the client is minimized, by the lack of input and changed frames.
+   * @details The stream is idle once there was neither input from a client nor a changed frame for the timeout,
+   *          and stops being idle at the next one. While idle, the capture and the encoders only trickle frames.
+   */
+  class idle_detector_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto TRICKLE_INTERVAL = std::chrono::milliseconds {500};  ///< Between two frames while idle
+
+    /**
+     * @param timeout The time without activity until the stream is idle, zero to never go idle.
+     */
+    explicit idle_detector_t(std::chrono::nanoseconds timeout):
+        _timeout {timeout} {
+    }
+
+    /**
+     * @brief Take the last captured frame into account.
+     * @param now The current time.
+     * @param changed Whether the frame differed from the previous one.
+     * @param last_input When a client last sent input.
+     * @return `true` if the stream is idle.
+     */
+    bool update(clock::time_point now, bool changed, clock::time_point last_input);
+
+  private:
+    std::chrono::nanoseconds _timeout;
+    std::optional<clock::time_point> _last_change;
+  };
+
   // Several NTSC standard refresh rates are hardcoded here, because their
   // true rate requires a denominator of 1001. ffmpeg's av_d2q() would assume it could
   // reduce 29.97 to 2997/100 but this would be slightly wrong. We also include
@@ -55,8 +55,9 @@ namespace video {
    * @param colorspace Targeted YUV colorspace.
    * @param unorm_output Whether the matrix should produce output in UNORM or UINT range.
    * @return `const color_t*` that contains RGB->YUV transformation vectors.
-   *         Components `range_y` and `range_uv` are there for backwards compatibility
-   *         and can be ignored in the computation.
+   *         The vectors of every supported colorspace are computed at compile time, so this only picks one.
+   *         Components `range_y` and `range_uv` are there for backwards compatibility,
+   *         they're always the identity and the converters don't apply them.
    */
   const color_t *color_vectors_from_colorspace(const sunshine_colorspace_t &colorspace, bool unorm_output);
 }  // namespace video
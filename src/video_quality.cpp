@@ -0,0 +1,328 @@
+/**
+ * @file src/video_quality.cpp
+ * @brief Definitions for sampling the quality of the encoded video.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <optional>
+
+// lib includes
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+}
+
+// local includes
+#include "logging.h"
+#include "platform/common.h"
+#include "video_quality.h"
+
+using namespace std::literals;
+
+namespace video_quality {
+  // The comparisons the published quality is averaged over
+  constexpr std::size_t RECENT_SAMPLES = 8;
+
+  // Packets waiting for the decoder, which starts over at the next IDR frame once they don't fit
+  constexpr std::uint32_t MAX_QUEUED_PACKETS = 30;
+
+  // Frames waiting for their packet to be decoded
+  constexpr std::size_t MAX_REFERENCES = 2;
+
+  namespace {
+    int sample_at(const plane_t &plane, int x, int y) {
+      auto row = plane.data + (std::size_t) y * plane.pitch;
+      if (plane.bytes_per_sample == 1) {
+        return row[x];
+      }
+
+      return (row[x * 2] | row[x * 2 + 1] << 8) >> plane.shift;
+    }
+
+    /**
+     * @brief Get the luma plane of a frame in system memory.
+     */
+    std::optional<plane_t> luma(const AVFrame *frame, int width, int height) {
+      auto desc = av_pix_fmt_desc_get((AVPixelFormat) frame->format);
+      if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_RGB)) || desc->comp[0].depth > 16) {
+        return std::nullopt;
+      }
+
+      auto &comp = desc->comp[0];
+      return plane_t {
+        frame->data[comp.plane] + comp.offset,
+        frame->linesize[comp.plane],
+        width,
+        height,
+        comp.depth > 8 ? 2 : 1,
+        comp.shift,
+      };
+    }
+
+    /**
+     * @brief Copy a frame out of the encoder, downloading it from the device if need be.
+     */
+    AVFrame *copy_frame(const AVFrame *frame) {
+      auto copy = av_frame_alloc();
+      if (!copy) {
+        return nullptr;
+      }
+
+      int status;
+      if (frame->hw_frames_ctx) {
+        status = av_hwframe_transfer_data(copy, frame, 0);
+      } else {
+        copy->format = frame->format;
+        copy->width = frame->width;
+        copy->height = frame->height;
+        status = av_frame_get_buffer(copy, 0);
+        if (status >= 0) {
+          status = av_frame_copy(copy, frame);
+        }
+      }
+
+      if (status < 0) {
+        av_frame_free(&copy);
+      }
+
+      return copy;
+    }
+  }  // namespace
+
+  double psnr(const plane_t &source, const plane_t &image, int depth) {
+    std::uint64_t squared_error = 0;
+    for (int y = 0; y < source.height; ++y) {
+      for (int x = 0; x < source.width; ++x) {
+        std::int64_t error = sample_at(source, x, y) - sample_at(image, x, y);
+        squared_error += error * error;
+      }
+    }
+
+    auto samples = (double) source.width * source.height;
+    if (!squared_error || !samples) {
+      return 100.0;
+    }
+
+    double peak = (1 << depth) - 1;
+    return std::min(100.0, 10.0 * std::log10(peak * peak * samples / squared_error));
+  }
+
+  double ssim(const plane_t &source, const plane_t &image, int depth) {
+    constexpr int WINDOW = 8;
+    constexpr int STEP = 4;
+    constexpr double N = WINDOW * WINDOW;
+
+    double peak = (1 << depth) - 1;
+    const double c1 = 0.01 * peak * 0.01 * peak;
+    const double c2 = 0.03 * peak * 0.03 * peak;
+
+    double total = 0;
+    int windows = 0;
+    for (int y = 0; y + WINDOW <= source.height; y += STEP) {
+      for (int x = 0; x + WINDOW <= source.width; x += STEP) {
+        std::int64_t sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+        for (int wy = y; wy < y + WINDOW; ++wy) {
+          for (int wx = x; wx < x + WINDOW; ++wx) {
+            std::int64_t a = sample_at(source, wx, wy);
+            std::int64_t b = sample_at(image, wx, wy);
+            sum_a += a;
+            sum_b += b;
+            sum_aa += a * a;
+            sum_bb += b * b;
+            sum_ab += a * b;
+          }
+        }
+
+        auto mean_a = sum_a / N;
+        auto mean_b = sum_b / N;
+        auto var_a = sum_aa / N - mean_a * mean_a;
+        auto var_b = sum_bb / N - mean_b * mean_b;
+        auto cov = sum_ab / N - mean_a * mean_b;
+
+        total += ((2 * mean_a * mean_b + c1) * (2 * cov + c2)) / ((mean_a * mean_a + mean_b * mean_b + c1) * (var_a + var_b + c2));
+        ++windows;
+      }
+    }
+
+    return windows ? total / windows : 1.0;
+  }
+
+  void sampler_t::free_packet(AVPacket *packet) {
+    av_packet_free(&packet);
+  }
+
+  void sampler_t::free_frame(AVFrame *frame) {
+    av_frame_free(&frame);
+  }
+
+  void sampler_t::free_ctx(AVCodecContext *ctx) {
+    avcodec_free_context(&ctx);
+  }
+
+  std::unique_ptr<sampler_t> sampler_t::make(const AVCodecContext *encoder, int interval, publish_f publish) {
+    auto codec = avcodec_find_decoder(encoder->codec_id);
+    if (!codec) {
+      BOOST_LOG(warning) << "Quality sampling: no decoder for "sv << avcodec_get_name(encoder->codec_id);
+      return nullptr;
+    }
+
+    ctx_t decoder {avcodec_alloc_context3(codec)};
+    if (!decoder) {
+      return nullptr;
+    }
+
+    // The encoder gets the rest of the cores
+    decoder->thread_count = 2;
+    decoder->thread_type = FF_THREAD_SLICE;
+    decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+    if (avcodec_open2(decoder.get(), codec, nullptr) < 0) {
+      BOOST_LOG(warning) << "Quality sampling: couldn't open the "sv << codec->name << " decoder"sv;
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "Quality sampling: comparing every "sv << interval << " frames with the "sv << codec->name << " decoder"sv;
+    return std::unique_ptr<sampler_t> {new sampler_t {std::move(decoder), interval, std::move(publish)}};
+  }
+
+  sampler_t::sampler_t(ctx_t &&decoder, int interval, publish_f &&publish):
+      _decoder {std::move(decoder)},
+      _interval {interval},
+      _publish {std::move(publish)},
+      _work {MAX_QUEUED_PACKETS},
+      _decoded {av_frame_alloc()} {
+    _thread = std::thread {&sampler_t::run, this};
+  }
+
+  sampler_t::~sampler_t() {
+    _work.stop();
+    _thread.join();
+  }
+
+  void sampler_t::submit_frame(std::int64_t frame_nr, const AVFrame *frame) {
+    if (frame_nr % _interval || !_synced.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    {
+      std::lock_guard lg {_references_lock};
+      if (_references.size() >= MAX_REFERENCES) {
+        return;
+      }
+    }
+
+    frame_t copy {copy_frame(frame)};
+    if (!copy) {
+      return;
+    }
+
+    std::lock_guard lg {_references_lock};
+    _references.emplace_back(frame_nr, std::move(copy));
+  }
+
+  void sampler_t::submit_packet(const AVPacket *packet) {
+    // A reference would share the buffer the broadcast threads send from, so the decoder gets a copy of its own
+    packet_t ref {av_packet_alloc()};
+    if (!ref || av_packet_ref(ref.get(), packet) < 0 || av_packet_make_writable(ref.get()) < 0) {
+      // The decoder finds the gap and waits for the next IDR frame
+      ++_seq;
+      return;
+    }
+
+    _work.raise(work_t {_seq++, std::move(ref)});
+  }
+
+  void sampler_t::restart() {
+    _work.raise(work_t {_seq++, nullptr});
+  }
+
+  void sampler_t::run() {
+    platf::adjust_thread_priority(platf::thread_priority_e::low);
+
+    std::uint64_t next_seq = 0;
+    bool synced = false;
+    auto desync = [&]() {
+      synced = false;
+      _synced.store(false, std::memory_order_relaxed);
+      avcodec_flush_buffers(_decoder.get());
+
+      std::lock_guard lg {_references_lock};
+      _references.clear();
+    };
+
+    while (auto work = _work.pop()) {
+      // The queue was cleared when it overflowed, so the next packets can't be decoded before an IDR frame
+      if (work->seq != next_seq) {
+        desync();
+      }
+      next_seq = work->seq + 1;
+
+      if (!work->packet) {
+        desync();
+        continue;
+      }
+
+      if (!synced) {
+        if (!(work->packet->flags & AV_PKT_FLAG_KEY)) {
+          continue;
+        }
+
+        synced = true;
+        _synced.store(true, std::memory_order_relaxed);
+      }
+
+      if (avcodec_send_packet(_decoder.get(), work->packet.get()) < 0) {
+        BOOST_LOG(debug) << "Quality sampling: couldn't decode a packet"sv;
+        desync();
+        continue;
+      }
+
+      while (avcodec_receive_frame(_decoder.get(), _decoded.get()) == 0) {
+        compare(_decoded.get());
+        av_frame_unref(_decoded.get());
+      }
+    }
+  }
+
+  void sampler_t::compare(const AVFrame *decoded) {
+    frame_t reference;
+    {
+      std::lock_guard lg {_references_lock};
+
+      // References of frames that were decoded without being compared are dropped
+      while (!_references.empty() && _references.front().first < decoded->pts) {
+        _references.pop_front();
+      }
+      if (_references.empty() || _references.front().first != decoded->pts) {
+        return;
+      }
+
+      reference = std::move(_references.front().second);
+      _references.pop_front();
+    }
+
+    // The encoder may have padded its frames, the decoder crops them
+    auto width = std::min(reference->width, decoded->width);
+    auto height = std::min(reference->height, decoded->height);
+
+    auto source = luma(reference.get(), width, height);
+    auto image = luma(decoded, width, height);
+    if (!source || !image) {
+      return;
+    }
+
+    auto depth = av_pix_fmt_desc_get((AVPixelFormat) reference->format)->comp[0].depth;
+
+    _recent.push_back(sample_t {psnr(*source, *image, depth), ssim(*source, *image, depth)});
+    if (_recent.size() > RECENT_SAMPLES) {
+      _recent.pop_front();
+    }
+
+    auto total = std::accumulate(std::begin(_recent), std::end(_recent), sample_t {}, [](sample_t total, const sample_t &sample) {
+      return sample_t {total.psnr_db + sample.psnr_db, total.ssim + sample.ssim};
+    });
+    _publish(sample_t {total.psnr_db / _recent.size(), total.ssim / _recent.size()});
+  }
+}  // namespace video_quality
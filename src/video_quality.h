@@ -0,0 +1,145 @@
+/**
+ * @file src/video_quality.h
+ * @brief Declarations for sampling the quality of the encoded video.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// lib includes
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// local includes
+#include "thread_safe.h"
+#include "utility.h"
+
+namespace video_quality {
+
+  /**
+   * @brief A plane of samples of an image.
+   */
+  struct plane_t {
+    const std::uint8_t *data;
+    int pitch;  ///< Bytes from the start of a row to the next
+    int width;
+    int height;
+    int bytes_per_sample;  ///< 1, or 2 for little endian samples
+    int shift;  ///< How many bits a sample is shifted up by within its bytes, like in P010
+  };
+
+  /**
+   * @brief Get the peak signal to noise ratio of an image against its source.
+   * @param source The source plane.
+   * @param image The plane to measure, of the same size.
+   * @param depth The bit depth of the samples.
+   * @return The PSNR in dB, or 100 dB for identical planes.
+   */
+  double psnr(const plane_t &source, const plane_t &image, int depth);
+
+  /**
+   * @brief Get the structural similarity of an image to its source.
+   * @details The SSIM is averaged over windows of 8x8 samples, 4 samples apart.
+   * @param source The source plane.
+   * @param image The plane to measure, of the same size.
+   * @param depth The bit depth of the samples.
+   * @return The SSIM, from 0 to 1 for identical planes.
+   */
+  double ssim(const plane_t &source, const plane_t &image, int depth);
+
+  /**
+   * @brief The quality of the encoded video, averaged over the recent comparisons.
+   */
+  struct sample_t {
+    double psnr_db;  ///< Luma PSNR
+    double ssim;  ///< Luma SSIM
+  };
+
+  /**
+   * @brief Decodes the packets of an encoder and compares every Nth frame to the frame it was encoded from.
+   * @details Frames depend on the ones before them, so every packet is decoded, with a software decoder on
+   *          a low priority thread of its own. A decoder falling behind drops packets and waits for the next
+   *          IDR frame. Only the frames that are compared are copied out of the encoder, on its thread,
+   *          and only while the decoder keeps up.
+   */
+  class sampler_t {
+  public:
+    using publish_f = std::function<void(const sample_t &)>;
+
+    /**
+     * @brief Start sampling the output of an encoder.
+     * @param encoder The context of the encoder.
+     * @param interval Compare every this many frames.
+     * @param publish Called on the thread of the sampler with the quality after each comparison.
+     * @return The sampler, or `nullptr` if there is no decoder for the codec.
+     */
+    static std::unique_ptr<sampler_t> make(const AVCodecContext *encoder, int interval, publish_f publish);
+
+    ~sampler_t();
+
+    /**
+     * @brief Keep a copy of the frame handed to the encoder, if it's one to compare.
+     * @param frame_nr The number of the frame, which the encoder keeps as the timestamp of its packet.
+     * @param frame The frame, in system or device memory.
+     */
+    void submit_frame(std::int64_t frame_nr, const AVFrame *frame);
+
+    /**
+     * @brief Queue a packet out of the encoder for decoding.
+     * @param packet The packet, which is copied.
+     */
+    void submit_packet(const AVPacket *packet);
+
+    /**
+     * @brief Start over with the packets of another encoder of the same codec, from its first IDR frame.
+     */
+    void restart();
+
+  private:
+    static void free_packet(AVPacket *packet);
+    static void free_frame(AVFrame *frame);
+    static void free_ctx(AVCodecContext *ctx);
+
+    using packet_t = util::safe_ptr<AVPacket, free_packet>;
+    using frame_t = util::safe_ptr<AVFrame, free_frame>;
+    using ctx_t = util::safe_ptr<AVCodecContext, free_ctx>;
+
+    struct work_t {
+      std::uint64_t seq;  ///< Tells the decoder it missed packets
+      packet_t packet;  ///< `nullptr` to start over
+    };
+
+    sampler_t(ctx_t &&decoder, int interval, publish_f &&publish);
+
+    void run();
+    void compare(const AVFrame *decoded);
+
+    ctx_t _decoder;
+    int _interval;
+    publish_f _publish;
+
+    std::uint64_t _seq {};  ///< Only used by the encoder thread
+    safe::queue_t<work_t> _work;
+
+    // Set by the decoder thread, so the encoder thread doesn't copy frames that won't be compared
+    std::atomic_bool _synced {false};
+
+    std::mutex _references_lock;
+    std::deque<std::pair<std::int64_t, frame_t>> _references;
+
+    // Only used by the decoder thread
+    frame_t _decoded;
+    std::deque<sample_t> _recent;
+
+    std::thread _thread;
+  };
+}  // namespace video_quality
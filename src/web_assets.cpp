@@ -0,0 +1,213 @@
+/**
+ * @file src/web_assets.cpp
+ * @brief Definitions for the in-memory cache of the Web UI files.
+ */
+// standard includes
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <system_error>
+
+// lib includes
+#include <zlib.h>
+
+// local includes
+#include "crypto.h"
+#include "logging.h"
+#include "utility.h"
+#include "web_assets.h"
+
+using namespace std::literals;
+
+namespace web_assets {
+  namespace {
+    // Pages and assets are served from several server threads
+    std::mutex cache_lock;
+    std::map<std::filesystem::path, std::shared_ptr<const asset_t>> cache;
+
+    std::string_view trim(std::string_view value) {
+      while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+      }
+      while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+      }
+
+      return value;
+    }
+
+    bool iequals(std::string_view a, std::string_view b) {
+      return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower((unsigned char) x) == std::tolower((unsigned char) y);
+      });
+    }
+
+    /**
+     * @brief Call a function with each element of a comma separated header value.
+     */
+    template<class F>
+    void for_each_element(std::string_view value, F &&f) {
+      while (!value.empty()) {
+        auto comma = value.find(',');
+        f(trim(value.substr(0, comma)));
+
+        if (comma == std::string_view::npos) {
+          break;
+        }
+        value.remove_prefix(comma + 1);
+      }
+    }
+
+    std::shared_ptr<asset_t> read(const std::filesystem::path &path, std::string_view content_type, std::filesystem::file_time_type modified) {
+      std::ifstream in(path, std::ios::binary);
+      if (!in) {
+        return nullptr;
+      }
+
+      auto asset = std::make_shared<asset_t>();
+      asset->content_type = content_type;
+      asset->content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      asset->modified = modified;
+      asset->fingerprinted = is_fingerprinted(path.filename().string());
+
+      auto hash = crypto::hash(asset->content);
+      asset->etag = "W/\""s + util::hex(hash, true).to_string().substr(0, 16) + '"';
+
+      // Images and fonts are compressed already, this only keeps the compression that pays off
+      auto gzipped = gzip(asset->content);
+      if (!gzipped.empty() && gzipped.size() * 10 < asset->content.size() * 9) {
+        asset->gzipped = std::move(gzipped);
+      }
+
+      BOOST_LOG(debug) << "Cached "sv << path.string() << ": "sv << asset->content.size() << " bytes, "sv
+                       << (asset->gzipped.empty() ? asset->content.size() : asset->gzipped.size()) << " bytes sent"sv;
+
+      return asset;
+    }
+  }  // namespace
+
+  std::shared_ptr<const asset_t> get(const std::filesystem::path &path, std::string_view content_type) {
+    std::error_code ec;
+    auto modified = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+      BOOST_LOG(debug) << "Missing file: "sv << path.string();
+      return nullptr;
+    }
+
+    {
+      std::lock_guard lg {cache_lock};
+      auto it = cache.find(path);
+      if (it != std::end(cache) && it->second->modified == modified && it->second->content_type == content_type) {
+        return it->second;
+      }
+    }
+
+    // Read and compress outside the lock, the worst case being the same file read twice
+    auto asset = read(path, content_type, modified);
+    if (!asset) {
+      return nullptr;
+    }
+
+    std::lock_guard lg {cache_lock};
+    cache[path] = asset;
+
+    return asset;
+  }
+
+  void clear() {
+    std::lock_guard lg {cache_lock};
+    cache.clear();
+  }
+
+  std::string gzip(std::string_view data) {
+    z_stream stream {};
+
+    // A window of 15 bits, with 16 added for a gzip header instead of a zlib one
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return {};
+    }
+
+    std::string out(deflateBound(&stream, (uLong) data.size()), '\0');
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = (uInt) data.size();
+    stream.next_out = (Bytef *) out.data();
+    stream.avail_out = (uInt) out.size();
+
+    auto status = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END) {
+      return {};
+    }
+
+    return out;
+  }
+
+  bool accepts_gzip(std::string_view accept_encoding) {
+    std::optional<bool> named;
+    bool wildcard = false;
+    for_each_element(accept_encoding, [&](std::string_view element) {
+      auto semicolon = element.find(';');
+      auto coding = trim(element.substr(0, semicolon));
+
+      // "gzip;q=0" turns it off, any other quality leaves it on
+      bool refused = false;
+      if (semicolon != std::string_view::npos) {
+        auto parameter = trim(element.substr(semicolon + 1));
+        if (parameter.size() > 2 && std::tolower((unsigned char) parameter[0]) == 'q' && parameter[1] == '=') {
+          refused = parameter.substr(2).find_first_not_of("0."sv) == std::string_view::npos;
+        }
+      }
+
+      if (iequals(coding, "gzip"sv)) {
+        named = !refused;
+      } else if (coding == "*"sv) {
+        wildcard = !refused;
+      }
+    });
+
+    // Naming gzip wins over the wildcard
+    return named.value_or(wildcard);
+  }
+
+  bool matches_etag(std::string_view if_none_match, std::string_view etag) {
+    // If-None-Match compares ETags weakly
+    if (etag.starts_with("W/"sv)) {
+      etag.remove_prefix(2);
+    }
+
+    bool matched = false;
+    for_each_element(if_none_match, [&](std::string_view element) {
+      if (element.starts_with("W/"sv)) {
+        element.remove_prefix(2);
+      }
+
+      matched = matched || element == "*"sv || element == etag;
+    });
+
+    return matched;
+  }
+
+  bool is_fingerprinted(std::string_view filename) {
+    constexpr std::size_t hash_size = 8;
+
+    auto dot = filename.rfind('.');
+    if (dot == std::string_view::npos || dot < hash_size + 2) {
+      return false;
+    }
+
+    auto stem = filename.substr(0, dot);
+    if (stem[stem.size() - hash_size - 1] != '-') {
+      return false;
+    }
+
+    auto hash = stem.substr(stem.size() - hash_size);
+    return std::ranges::all_of(hash, [](char c) {
+      return std::isalnum((unsigned char) c) || c == '_' || c == '-';
+    });
+  }
+}  // namespace web_assets
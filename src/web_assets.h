@@ -0,0 +1,74 @@
+/**
+ * @file src/web_assets.h
+ * @brief Declarations for the in-memory cache of the Web UI files.
+ */
+#pragma once
+
+// standard includes
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Keeps the files of the Web UI in memory, along with their compressed form and their ETag.
+ * @details Files are read on first use, and read again when they changed on disk.
+ */
+namespace web_assets {
+  struct asset_t {
+    std::string content_type;
+    std::string content;
+    std::string gzipped;  ///< Empty if compressing doesn't make the file smaller
+    std::string etag;  ///< A weak ETag, since the compressed and uncompressed content share it
+    bool fingerprinted;  ///< Whether the name of the file changes with its contents, so it can be cached for good
+    std::filesystem::file_time_type modified;
+  };
+
+  /**
+   * @brief Get a file from the cache, reading it if it isn't cached yet or changed since.
+   * @param path The path of the file.
+   * @param content_type The MIME type to serve the file with.
+   * @return The file, or `nullptr` if it can't be read.
+   */
+  std::shared_ptr<const asset_t> get(const std::filesystem::path &path, std::string_view content_type);
+
+  /**
+   * @brief Drop every cached file.
+   */
+  void clear();
+
+  /**
+   * @brief Compress data in the gzip format.
+   * @param data The data to compress.
+   * @return The compressed data, or an empty string on failure.
+   */
+  std::string gzip(std::string_view data);
+
+  /**
+   * @brief Check if a client takes gzip compressed responses.
+   * @param accept_encoding The value of the `Accept-Encoding` header.
+   * @return `true` if gzip is listed without a quality of 0.
+   * @examples
+   * bool gzip = accepts_gzip("gzip, deflate, br");
+   * @examples_end
+   */
+  bool accepts_gzip(std::string_view accept_encoding);
+
+  /**
+   * @brief Check if the copy a client has is still current.
+   * @param if_none_match The value of the `If-None-Match` header.
+   * @param etag The ETag of the file.
+   * @return `true` if one of the listed ETags matches, weak or not.
+   */
+  bool matches_etag(std::string_view if_none_match, std::string_view etag);
+
+  /**
+   * @brief Check if a file name carries a hash of its contents, like the files Vite generates.
+   * @param filename The name of the file.
+   * @return `true` if the name ends with a hash of 8 characters before the extension.
+   * @examples
+   * bool fingerprinted = is_fingerprinted("index-BKm3TJ_a.js");
+   * @examples_end
+   */
+  bool is_fingerprinted(std::string_view filename);
+}  // namespace web_assets
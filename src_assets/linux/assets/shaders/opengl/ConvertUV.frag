@@ -5,6 +5,10 @@ precision lowp float;
 #endif
 
 uniform sampler2D image;
+uniform sampler2D cursor;
+
+// The cursor area in texture coordinates of the image as (x, y, width, height), with no width when hidden
+uniform highp vec4 cursor_rect;
 
 layout(shared) uniform ColorMatrix {
   vec4 color_vec_y;
@@ -17,19 +21,30 @@ layout(shared) uniform ColorMatrix {
 in vec3 uuv;
 layout(location = 0) out vec2 color;
 
+vec3 sample_rgb(highp vec2 pos) {
+  vec3 rgb = texture(image, pos).rgb;
+
+  if (cursor_rect.z > 0.0) {
+    highp vec2 cursor_pos = (pos - cursor_rect.xy) / cursor_rect.zw;
+    if (all(greaterThanEqual(cursor_pos, vec2(0.0))) && all(lessThan(cursor_pos, vec2(1.0)))) {
+      vec4 overlay = textureLod(cursor, cursor_pos, 0.0);
+      rgb = mix(rgb, overlay.rgb, overlay.a);
+    }
+  }
+
+  return rgb;
+}
+
 //--------------------------------------------------------------------------------------
 // Pixel Shader
 //--------------------------------------------------------------------------------------
 void main() {
-  vec3 rgb_left  = texture(image, uuv.xz).rgb;
-  vec3 rgb_right = texture(image, uuv.yz).rgb;
+  vec3 rgb_left  = sample_rgb(uuv.xz);
+  vec3 rgb_right = sample_rgb(uuv.yz);
   vec3 rgb       = (rgb_left + rgb_right) * 0.5;
 
   float u = dot(color_vec_u.xyz, rgb) + color_vec_u.w;
   float v = dot(color_vec_v.xyz, rgb) + color_vec_v.w;
 
-  u = u * range_uv.x + range_uv.y;
-  v = v * range_uv.x + range_uv.y;
-
   color = vec2(u, v);
 }
\ No newline at end of file
@@ -5,6 +5,10 @@ precision lowp float;
 #endif
 
 uniform sampler2D image;
+uniform sampler2D cursor;
+
+// The cursor area in texture coordinates of the image as (x, y, width, height), with no width when hidden
+uniform highp vec4 cursor_rect;
 
 layout(shared) uniform ColorMatrix {
   vec4 color_vec_y;
@@ -17,10 +21,22 @@ layout(shared) uniform ColorMatrix {
 in vec2 tex;
 layout(location = 0) out float color;
 
+vec3 sample_rgb(highp vec2 pos) {
+	vec3 rgb = texture(image, pos).rgb;
+
+	if (cursor_rect.z > 0.0) {
+		highp vec2 cursor_pos = (pos - cursor_rect.xy) / cursor_rect.zw;
+		if (all(greaterThanEqual(cursor_pos, vec2(0.0))) && all(lessThan(cursor_pos, vec2(1.0)))) {
+			vec4 overlay = textureLod(cursor, cursor_pos, 0.0);
+			rgb = mix(rgb, overlay.rgb, overlay.a);
+		}
+	}
+
+	return rgb;
+}
+
 void main()
 {
-	vec3 rgb = texture(image, tex).rgb;
-	float y = dot(color_vec_y.xyz, rgb) + color_vec_y.w;
-
-	color = y * range_y.x + range_y.y;
+	vec3 rgb = sample_rgb(tex);
+	color = dot(color_vec_y.xyz, rgb) + color_vec_y.w;
 }
\ No newline at end of file
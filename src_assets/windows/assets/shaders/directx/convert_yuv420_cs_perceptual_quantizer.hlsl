@@ -0,0 +1,3 @@
+#include "include/convert_perceptual_quantizer_base.hlsl"
+
+#include "include/convert_yuv420_cs_base.hlsl"
@@ -1,6 +1,11 @@
 #include "include/common.hlsl"
 
+cbuffer tone_map_cbuffer : register(b2) {
+    float white_scale; // brings SDR white to 1.0
+    float peak; // the peak of the display after white_scale, which ends up at 1.0
+};
+
 float3 CONVERT_FUNCTION(float3 input)
 {
-    return ApplySRGBCurve(saturate(input));
+    return ApplySRGBCurve(saturate(ToneMapHighlights(max(input * white_scale, 0), peak)));
 }
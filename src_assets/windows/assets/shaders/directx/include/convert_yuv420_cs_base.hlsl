@@ -0,0 +1,93 @@
+Texture2D image : register(t0);
+SamplerState def_sampler : register(s0);
+
+RWTexture2D<float> y_plane : register(u0);
+RWTexture2D<float2> uv_plane : register(u1);
+
+cbuffer color_matrix_cbuffer : register(b0) {
+    float4 color_vec_y;
+    float4 color_vec_u;
+    float4 color_vec_v;
+    float2 range_y;
+    float2 range_uv;
+};
+
+cbuffer convert_cbuffer : register(b1) {
+    // The offset and size of the converted area in the Y plane
+    int4 out_rect;
+    int rotate_texture_steps;
+    // Average six samples for each chroma value, like the type0s pixel shaders
+    int downscaling;
+};
+
+// Map a position in the converted area, in Y plane pixels, to a coordinate in the captured texture
+float2 tex_coord_from_pos(float2 pos)
+{
+    float2 tex_coord = pos / out_rect.zw;
+
+    if (rotate_texture_steps != 0) {
+        float rotation_radians = radians(90 * rotate_texture_steps);
+        float2x2 rotation_matrix = round(float2x2(cos(rotation_radians), -sin(rotation_radians),
+                                                  sin(rotation_radians), cos(rotation_radians)));
+        float2 rotation_center = { 0.5, 0.5 };
+        tex_coord = rotation_center + mul(rotation_matrix, tex_coord - rotation_center);
+    }
+
+    return tex_coord;
+}
+
+float3 sample_rgb(float2 pos)
+{
+    return image.SampleLevel(def_sampler, tex_coord_from_pos(pos), 0).rgb;
+}
+
+// Each thread converts a 2x2 block of the Y plane, and the UV sample it shares
+[numthreads(8, 8, 1)]
+void main_cs(uint3 id : SV_DispatchThreadID)
+{
+    int2 pos = int2(id.xy) * 2;
+    if (pos.x >= out_rect.z || pos.y >= out_rect.w) {
+        return;
+    }
+
+    [unroll]
+    for (int y = 0; y < 2; ++y) {
+        [unroll]
+        for (int x = 0; x < 2; ++x) {
+            int2 p = pos + int2(x, y);
+            if (p.x < out_rect.z && p.y < out_rect.w) {
+                float3 rgb = CONVERT_FUNCTION(sample_rgb(p + 0.5));
+                float luma = dot(color_vec_y.xyz, rgb) + color_vec_y.w;
+
+                y_plane[out_rect.xy + p] = luma;
+            }
+        }
+    }
+
+    // Chroma is sited on the left column of the block and centered vertically, like the pixel shaders
+    float2 center = pos + 1.0;
+    float3 rgb;
+    if (downscaling) {
+        float3 right_center_left = float3(center.x + 0.5, center.x - 0.5, center.x - 1.5);
+        float2 top_bottom = float2(center.y - 0.5, center.y + 0.5);
+
+        rgb = sample_rgb(float2(right_center_left.y, top_bottom.x)); // top-center
+        rgb += sample_rgb(float2(right_center_left.y, top_bottom.y)); // bottom-center
+        rgb *= 2;
+        rgb += sample_rgb(float2(right_center_left.x, top_bottom.x)); // top-right
+        rgb += sample_rgb(float2(right_center_left.z, top_bottom.x)); // top-left
+        rgb += sample_rgb(float2(right_center_left.x, top_bottom.y)); // bottom-right
+        rgb += sample_rgb(float2(right_center_left.z, top_bottom.y)); // bottom-left
+        rgb = CONVERT_FUNCTION(rgb * (1./8));
+    }
+    else {
+        float3 rgb_right = sample_rgb(center);
+        float3 rgb_left = sample_rgb(float2(center.x - 1, center.y));
+        rgb = CONVERT_FUNCTION((rgb_left + rgb_right) * 0.5);
+    }
+
+    float u = dot(color_vec_u.xyz, rgb) + color_vec_u.w;
+    float v = dot(color_vec_v.xyz, rgb) + color_vec_v.w;
+
+    uv_plane[out_rect.xy / 2 + int2(id.xy)] = float2(u, v);
+}
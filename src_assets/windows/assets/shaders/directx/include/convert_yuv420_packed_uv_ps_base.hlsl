@@ -37,8 +37,5 @@ float2 main_ps(vertex_t input) : SV_Target
     float u = dot(color_vec_u.xyz, rgb) + color_vec_u.w;
     float v = dot(color_vec_v.xyz, rgb) + color_vec_v.w;
 
-    u = u * range_uv.x + range_uv.y;
-    v = v * range_uv.x + range_uv.y;
-
     return float2(u, v);
 }
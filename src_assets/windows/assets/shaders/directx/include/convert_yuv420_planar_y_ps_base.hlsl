@@ -15,7 +15,5 @@ float main_ps(vertex_t input) : SV_Target
 {
     float3 rgb = CONVERT_FUNCTION(image.Sample(def_sampler, input.tex_coord, 0).rgb);
 
-    float y = dot(color_vec_y.xyz, rgb) + color_vec_y.w;
-
-    return y * range_y.x + range_y.y;
+    return dot(color_vec_y.xyz, rgb) + color_vec_y.w;
 }
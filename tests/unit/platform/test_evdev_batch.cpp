@@ -0,0 +1,62 @@
+/**
+ * @file tests/unit/platform/test_evdev_batch.cpp
+ * @brief Test src/platform/linux/input/evdev_batch.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef __linux__
+  #include <array>
+  #include <src/platform/linux/input/evdev_batch.h>
+  #include <unistd.h>
+  #include <vector>
+
+namespace {
+  std::vector<std::array<int, 3>> read_events(int fd) {
+    std::array<input_event, 64> events;
+    auto size = read(fd, events.data(), sizeof(events));
+
+    std::vector<std::array<int, 3>> read;
+    for (std::size_t x = 0; size > 0 && x < size / sizeof(input_event); ++x) {
+      read.push_back({events[x].type, events[x].code, events[x].value});
+    }
+    return read;
+  }
+}  // namespace
+
+TEST(EvdevBatchTests, MergesMotionBetweenButtonChanges) {
+  std::array<int, 2> fds;
+  ASSERT_EQ(pipe(fds.data()), 0);
+
+  platf::evdev::mouse_batch_t batch {platf::evdev::batch_t {fds[1]}};
+  batch.move(1, 2);
+  batch.move(3, 4);
+  batch.button(BTN_LEFT, false);
+  batch.button(BTN_LEFT, true);
+  batch.scroll(120);
+  batch.scroll(-60);
+  ASSERT_EQ(batch.flush(), 0);
+
+  // A click keeps its press and release in frames of their own
+  std::vector<std::array<int, 3>> expected {
+    {EV_REL, REL_X, 4},
+    {EV_REL, REL_Y, 6},
+    {EV_SYN, SYN_REPORT, 0},
+    {EV_KEY, BTN_LEFT, 1},
+    {EV_SYN, SYN_REPORT, 0},
+    {EV_KEY, BTN_LEFT, 0},
+    {EV_SYN, SYN_REPORT, 0},
+    {EV_REL, REL_WHEEL, 1},
+    {EV_REL, REL_WHEEL_HI_RES, 60},
+    {EV_SYN, SYN_REPORT, 0},
+  };
+  EXPECT_EQ(read_events(fds[0]), expected);
+  EXPECT_EQ(batch.batch().writes(), 1u);
+  EXPECT_EQ(batch.batch().events_written(), expected.size());
+
+  // Nothing is written for an empty batch
+  ASSERT_EQ(batch.flush(), 0);
+  EXPECT_EQ(batch.batch().writes(), 1u);
+
+  close(fds[0]);
+}
+#endif
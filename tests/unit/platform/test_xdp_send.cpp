@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/platform/test_xdp_send.cpp
+ * @brief Test src/platform/linux/xdp_send.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef SUNSHINE_BUILD_XDP
+  #include <arpa/inet.h>
+  #include <array>
+  #include <cstring>
+  #include <src/platform/linux/xdp_send.h>
+
+namespace {
+  std::uint32_t ip(const char *address) {
+    in_addr addr;
+    inet_pton(AF_INET, address, &addr);
+    return addr.s_addr;
+  }
+
+  constexpr auto ROUTES =
+    "Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask\t\tMTU\tWindow\tIRTT\n"
+    "eth0\t00000000\t0101A8C0\t0003\t0\t0\t100\t00000000\t0\t0\t0\n"
+    "eth0\t0001A8C0\t00000000\t0001\t0\t0\t100\t00FFFFFF\t0\t0\t0\n"
+    "eth1\t000A0A0A\t00000000\t0001\t0\t0\t0\t00FFFFFF\t0\t0\t0\n"
+    "eth1\t00000000\t010A0A0A\t0003\t0\t0\t600\t00000000\t0\t0\t0\n";
+
+  constexpr auto ARP =
+    "IP address       HW type     Flags       HW address            Mask     Device\n"
+    "10.10.10.20      0x1         0x2         02:00:00:00:00:14     *        eth1\n"
+    "10.10.10.30      0x1         0x0         00:00:00:00:00:00     *        eth1\n"
+    "192.168.1.1      0x1         0x2         02:00:00:00:01:01     *        eth0\n";
+}  // namespace
+
+TEST(XdpSendTest, WritesHeaders) {
+  platf::xdp::flow_t flow {};
+  flow.src_mac = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+  flow.dst_mac = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+  flow.src_ip = ip("10.10.10.1");
+  flow.dst_ip = ip("10.10.10.20");
+  flow.src_port = 47998;
+  flow.dst_port = 50000;
+  flow.tos = 40 << 2;
+
+  std::array<std::uint8_t, platf::xdp::HEADERS_SIZE> headers;
+  platf::xdp::write_headers(headers.data(), flow, 1000, 7);
+
+  EXPECT_EQ(std::memcmp(headers.data(), flow.dst_mac.data(), 6), 0);
+  EXPECT_EQ(std::memcmp(headers.data() + 6, flow.src_mac.data(), 6), 0);
+  EXPECT_EQ((headers[12] << 8) | headers[13], 0x0800);
+
+  auto ip_header = headers.data() + 14;
+  EXPECT_EQ(ip_header[0], 0x45);
+  EXPECT_EQ(ip_header[1], flow.tos);
+  EXPECT_EQ((ip_header[2] << 8) | ip_header[3], 20 + 8 + 1000);
+  EXPECT_EQ((ip_header[4] << 8) | ip_header[5], 7);
+  EXPECT_EQ(ip_header[9], IPPROTO_UDP);
+
+  // A valid header sums up to 0xFFFF, checksum included
+  std::uint32_t sum = 0;
+  for (int x = 0; x < 20; x += 2) {
+    sum += (ip_header[x] << 8) | ip_header[x + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  EXPECT_EQ(sum, 0xFFFF);
+
+  auto udp_header = ip_header + 20;
+  EXPECT_EQ((udp_header[0] << 8) | udp_header[1], 47998);
+  EXPECT_EQ((udp_header[2] << 8) | udp_header[3], 50000);
+  EXPECT_EQ((udp_header[4] << 8) | udp_header[5], 8 + 1000);
+}
+
+TEST(XdpSendTest, FindsNextHop) {
+  // On link through the interface
+  EXPECT_EQ(platf::xdp::find_next_hop(ROUTES, "eth1", ip("10.10.10.20")), ip("10.10.10.20"));
+
+  // The default route through eth0 has the lowest metric
+  EXPECT_EQ(platf::xdp::find_next_hop(ROUTES, "eth0", ip("8.8.8.8")), ip("192.168.1.1"));
+  EXPECT_EQ(platf::xdp::find_next_hop(ROUTES, "eth1", ip("8.8.8.8")), std::nullopt);
+
+  // The longest prefix wins over the default route
+  EXPECT_EQ(platf::xdp::find_next_hop(ROUTES, "eth0", ip("10.10.10.20")), std::nullopt);
+}
+
+TEST(XdpSendTest, FindsNeighbor) {
+  platf::xdp::mac_t expected {0x02, 0x00, 0x00, 0x00, 0x00, 0x14};
+  EXPECT_EQ(platf::xdp::find_neighbor(ARP, "eth1", ip("10.10.10.20")), expected);
+
+  // Not on the interface, or not resolved yet
+  EXPECT_EQ(platf::xdp::find_neighbor(ARP, "eth0", ip("10.10.10.20")), std::nullopt);
+  EXPECT_EQ(platf::xdp::find_neighbor(ARP, "eth1", ip("10.10.10.30")), std::nullopt);
+  EXPECT_EQ(platf::xdp::find_neighbor(ARP, "eth1", ip("10.10.10.40")), std::nullopt);
+}
+#else
+// AF_XDP support not enabled, provide a placeholder test
+TEST(XdpSendTest, NotEnabled) {
+  GTEST_SKIP() << "AF_XDP support not enabled in this build";
+}
+#endif
@@ -5,6 +5,10 @@
 #include "../tests_common.h"
 
 #include <src/audio.h>
+#include <src/audio_samples.h>
+
+#include <algorithm>
+#include <numeric>
 
 using namespace audio;
 
@@ -66,3 +70,308 @@ TEST_P(AudioTest, TestEncode) {
   timer.join();
   capture.join();
 }
+
+TEST_P(AudioTest, TestSharedEncode) {
+  int session_a;
+  int session_b;
+  auto mail_a = std::make_shared<safe::mail_raw_t>();
+  auto mail_b = std::make_shared<safe::mail_raw_t>();
+
+  // Both sessions ask for the same stream, so they share a capture and an encoder
+  std::thread capture_a([&] {
+    audio::capture(mail_a, m_config, &session_a);
+  });
+  std::thread capture_b([&] {
+    audio::capture(mail_b, m_config, &session_b);
+  });
+
+  int packets_a = 0;
+  int packets_b = 0;
+  const auto packets = mail::man->queue<packet_t>(mail::audio_packets);
+  const auto deadline = std::chrono::steady_clock::now() + 200ms;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (const auto packet = packets->pop(10ms)) {
+      if (packet->first == &session_a) {
+        ++packets_a;
+      } else if (packet->first == &session_b) {
+        ++packets_b;
+      }
+    }
+  }
+
+  mail_a->event<bool>(mail::shutdown)->raise(true);
+  mail_b->event<bool>(mail::shutdown)->raise(true);
+  capture_a.join();
+  capture_b.join();
+
+  // Without an audio device there is nothing to share
+  if (packets_a || packets_b) {
+    EXPECT_GT(packets_a, 0);
+    EXPECT_GT(packets_b, 0);
+  }
+}
+
+TEST_P(AudioTest, TestPacketJitter) {
+  int session;
+  std::thread capture([&] {
+    audio::capture(m_mail, m_config, &session);
+  });
+
+  std::vector<std::chrono::steady_clock::time_point> arrivals;
+  const auto packets = mail::man->queue<packet_t>(mail::audio_packets);
+  const auto deadline = std::chrono::steady_clock::now() + 500ms;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (const auto packet = packets->pop(10ms); packet && packet->first == &session) {
+      arrivals.push_back(std::chrono::steady_clock::now());
+    }
+  }
+
+  m_mail->event<bool>(mail::shutdown)->raise(true);
+  capture.join();
+
+  // Without an audio device there is nothing to time
+  if (arrivals.size() < 10) {
+    return;
+  }
+
+  // Skip the first packets, the capture may deliver what it buffered before the first one all at once
+  std::vector<double> intervals;
+  for (std::size_t x = 5; x < arrivals.size(); ++x) {
+    intervals.push_back(std::chrono::duration<double, std::milli>(arrivals[x] - arrivals[x - 1]).count());
+  }
+
+  auto average = std::accumulate(intervals.begin(), intervals.end(), 0.0) / intervals.size();
+  auto worst = *std::max_element(intervals.begin(), intervals.end());
+  BOOST_LOG(tests) << "Audio packet interval: "sv << average << " ms on average, at most "sv << worst << " ms"sv;
+
+  // Packets come out as often as they were captured, without stalls in the encoder
+  EXPECT_NEAR(average, m_config.packetDuration, m_config.packetDuration * 0.5);
+  EXPECT_LT(worst, 100.0);
+}
+
+TEST(AudioPacketDurationTests, AcceptsOpusFrameSizes) {
+  for (auto duration : {5, 10, 20, 40, 60}) {
+    EXPECT_TRUE(is_valid_packet_duration(duration)) << duration;
+  }
+
+  for (auto duration : {0, 2, 3, 7, 15, 80}) {
+    EXPECT_FALSE(is_valid_packet_duration(duration)) << duration;
+  }
+}
+
+namespace {
+  // One second of 7.1 at 48 kHz
+  constexpr std::size_t FRAMES = 48000;
+  constexpr int CHANNELS = 8;
+
+  // What the reordering of a layout with side speakers before back speakers looks like
+  constexpr std::uint8_t ORDER[CHANNELS] {0, 1, 2, 3, 6, 7, 4, 5};
+}  // namespace
+
+TEST(AudioSamplesTests, VariantsMatchDefault) {
+  std::vector<std::int16_t> s16(FRAMES * CHANNELS + 3);
+  std::vector<std::int32_t> s32(s16.size());
+  std::vector<float> f32(s16.size());
+  for (std::size_t x = 0; x < s16.size(); ++x) {
+    s16[x] = (std::int16_t) (x * 7919);
+    s32[x] = (std::int32_t) (x * 2654435761u);
+    f32[x] = (float) x;
+  }
+
+  auto &reference = audio::samples::variants().back();
+  ASSERT_STREQ(reference.name, "default");
+
+  std::vector<float> expected(s16.size());
+  std::vector<float> actual(s16.size());
+  for (auto &variant : audio::samples::variants()) {
+    if (!variant.supported()) {
+      continue;
+    }
+
+    // Odd counts cover the scalar tails
+    reference.s16(s16.data(), expected.data(), s16.size());
+    variant.s16(s16.data(), actual.data(), s16.size());
+    EXPECT_EQ(actual, expected) << variant.name;
+
+    reference.s32(s32.data(), expected.data(), s32.size());
+    variant.s32(s32.data(), actual.data(), s32.size());
+    EXPECT_EQ(actual, expected) << variant.name;
+
+    reference.remap8(f32.data(), expected.data(), FRAMES, ORDER);
+    variant.remap8(f32.data(), actual.data(), FRAMES, ORDER);
+    EXPECT_EQ(actual, expected) << variant.name;
+  }
+}
+
+TEST(AudioSamplesTests, ConvertsAndReorders) {
+  const std::int16_t s16[CHANNELS] {-32768, 16384, 0, 1, 2, 3, 4, 5};
+
+  float out[CHANNELS];
+  audio::samples::to_float(audio::samples::format_e::s16, s16, out, 1, CHANNELS, ORDER);
+  EXPECT_FLOAT_EQ(out[0], -1.0f);
+  EXPECT_FLOAT_EQ(out[1], 0.5f);
+  EXPECT_FLOAT_EQ(out[4], 4 / 32768.0f);
+  EXPECT_FLOAT_EQ(out[6], 2 / 32768.0f);
+
+  const float f32[6] {0, 1, 2, 3, 4, 5};
+  const std::uint8_t order[6] {1, 0, 2, 3, 5, 4};
+  audio::samples::to_float(audio::samples::format_e::f32, f32, out, 1, 6, order);
+  EXPECT_EQ(std::vector<float>(out, out + 6), (std::vector<float> {1, 0, 2, 3, 5, 4}));
+
+  EXPECT_TRUE(audio::samples::is_identity(nullptr, CHANNELS));
+  EXPECT_TRUE(audio::samples::is_identity(platf::speaker::map_surround71, CHANNELS));
+  EXPECT_FALSE(audio::samples::is_identity(ORDER, CHANNELS));
+}
+
+TEST(AudioSamplesTests, Benchmark71) {
+  std::vector<std::int32_t> s32(FRAMES * CHANNELS);
+  std::vector<float> f32(s32.size());
+  for (std::size_t x = 0; x < s32.size(); ++x) {
+    s32[x] = (std::int32_t) (x * 2654435761u);
+    f32[x] = (float) x;
+  }
+
+  std::vector<float> out(s32.size());
+  auto time = [&](auto &&convert) {
+    constexpr int ROUNDS = 20;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int x = 0; x < ROUNDS; ++x) {
+      convert();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+  };
+
+  for (auto &variant : audio::samples::variants()) {
+    if (!variant.supported()) {
+      continue;
+    }
+
+    auto convert_us = time([&]() {
+      variant.s32(s32.data(), out.data(), s32.size());
+    });
+    auto remap_us = time([&]() {
+      variant.remap8(f32.data(), out.data(), FRAMES, ORDER);
+    });
+
+    BOOST_LOG(tests) << variant.name << ": "sv << convert_us << " us to convert and "sv << remap_us << " us to reorder one second of 7.1"sv;
+  }
+}
+
+TEST(DriftEstimatorTests, MeasuresFastDevice) {
+  audio::drift_estimator_t drift {48000};
+
+  // 240 frames every 5 ms from a device running 100 ppm fast
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < 20 * 200; ++x) {
+    drift.add(240, start + std::chrono::microseconds {(std::int64_t) (x * 5000 / 1.0001)});
+    if (x < 9 * 200) {
+      ASSERT_FALSE(drift.ppm());
+    }
+  }
+
+  ASSERT_TRUE(drift.ppm());
+  EXPECT_NEAR(*drift.ppm(), 100, 5);
+}
+
+TEST(DriftEstimatorTests, RestartsAfterGap) {
+  audio::drift_estimator_t drift {48000};
+
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < 20 * 200; ++x) {
+    drift.add(240, start + std::chrono::milliseconds {x * 5});
+  }
+  ASSERT_TRUE(drift.ppm());
+  EXPECT_NEAR(*drift.ppm(), 0, 5);
+
+  // Nothing was captured for a second
+  drift.add(240, start + std::chrono::seconds {21});
+  EXPECT_FALSE(drift.ppm());
+}
+
+TEST(DriftResamplerTests, PassesThroughAtUnitRatio) {
+  constexpr int channels = 2;
+  constexpr std::size_t frame_size = 240;
+
+  audio::drift_resampler_t resampler {channels};
+
+  std::vector<float> in(frame_size * channels);
+  std::vector<float> out(frame_size * channels);
+  std::vector<float> produced;
+  for (int chunk = 0; chunk < 4; ++chunk) {
+    for (std::size_t x = 0; x < in.size(); ++x) {
+      in[x] = (float) (chunk * in.size() + x);
+    }
+    resampler.push(in);
+
+    while (resampler.pop(out)) {
+      produced.insert(std::end(produced), std::begin(out), std::end(out));
+    }
+  }
+
+  // Everything after the first frame comes out unchanged, a frame behind
+  ASSERT_EQ(produced.size(), 3 * frame_size * channels);
+  for (std::size_t x = 0; x < produced.size(); ++x) {
+    ASSERT_FLOAT_EQ(produced[x], (float) (x + channels));
+  }
+}
+
+TEST(DriftResamplerTests, ConsumesInputAtRatio) {
+  constexpr std::size_t frame_size = 240;
+
+  audio::drift_resampler_t resampler {1};
+  resampler.set_ratio(1.01);
+
+  // A ramp stays a ramp, just steeper
+  std::vector<float> in(frame_size);
+  std::vector<float> out(frame_size);
+  std::size_t frames_in = 0;
+  std::size_t frames_out = 0;
+  for (int chunk = 0; chunk < 200; ++chunk) {
+    for (auto &sample : in) {
+      sample = (float) frames_in++;
+    }
+    resampler.push(in);
+
+    while (resampler.pop(out)) {
+      for (std::size_t x = 1; x < out.size(); ++x) {
+        ASSERT_NEAR(out[x] - out[x - 1], 1.01, 0.01);
+      }
+      frames_out += out.size();
+    }
+  }
+
+  EXPECT_NEAR((double) frames_in / frames_out, 1.01, 0.01);
+}
+
+TEST(QueueTunerTests, ShrinksTowardsWatermark) {
+  auto now = std::chrono::steady_clock::now();
+  queue_tuner_t tuner {2, 32, 0.001, now};
+  EXPECT_EQ(tuner.depth(), 32);
+
+  // An encoder that keeps up never has more than a frame queued
+  for (int window = 0; window < 20; ++window) {
+    now += queue_tuner_t::WINDOW;
+    tuner.add(1, false, now);
+  }
+  EXPECT_EQ(tuner.depth(), 4);
+}
+
+TEST(QueueTunerTests, GrowsOnOverflow) {
+  auto now = std::chrono::steady_clock::now();
+  queue_tuner_t tuner {2, 32, 0.001, now};
+
+  for (int window = 0; window < 20; ++window) {
+    now += queue_tuner_t::WINDOW;
+    tuner.add(0, false, now);
+  }
+  EXPECT_EQ(tuner.depth(), 2);
+
+  // Dropping more than one frame in a thousand doubles the depth
+  for (int x = 0; x < 999; ++x) {
+    tuner.add(1, false, now);
+  }
+  tuner.add(2, true, now);
+  tuner.add(2, true, now + queue_tuner_t::WINDOW);
+  EXPECT_EQ(tuner.depth(), 4);
+}
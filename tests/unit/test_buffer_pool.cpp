@@ -0,0 +1,238 @@
+/**
+ * @file tests/unit/test_buffer_pool.cpp
+ * @brief Test src/buffer_pool.*
+ */
+#include "../tests_common.h"
+
+#include <src/buffer_pool.h>
+
+TEST(BufferPoolTests, ReleasedBufferIsReused) {
+  buffer_pool::pool_t pool;
+
+  int size_class;
+  auto buffer = pool.acquire(1400, size_class);
+  pool.release(buffer, size_class);
+
+  int reused_size_class;
+  EXPECT_EQ(pool.acquire(1200, reused_size_class), buffer);
+  EXPECT_EQ(reused_size_class, size_class);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.allocations, 1);
+  EXPECT_EQ(stats.reuses, 1);
+  EXPECT_EQ(stats.cached, 0);
+
+  pool.release(buffer, reused_size_class);
+}
+
+TEST(BufferPoolTests, SizeIsRoundedUpToSizeClass) {
+  buffer_pool::pool_t pool;
+
+  int size_class;
+  auto small = pool.acquire(1, size_class);
+  EXPECT_EQ(size_class, buffer_pool::pool_t::MIN_SIZE_CLASS);
+  pool.release(small, size_class);
+
+  auto exact = pool.acquire(4096, size_class);
+  EXPECT_EQ(size_class, 12);
+  pool.release(exact, size_class);
+
+  auto rounded = pool.acquire(4097, size_class);
+  EXPECT_EQ(size_class, 13);
+  pool.release(rounded, size_class);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.cached, 3);
+  EXPECT_EQ(stats.cached_bytes, 1024 + 4096 + 8192);
+}
+
+TEST(BufferPoolTests, OversizedBufferBypassesPool) {
+  buffer_pool::pool_t pool;
+
+  int size_class;
+  auto buffer = pool.acquire((std::size_t {1} << buffer_pool::pool_t::MAX_SIZE_CLASS) + 1, size_class);
+  pool.release(buffer, size_class);
+
+  EXPECT_EQ(pool.stats().cached, 0);
+}
+
+TEST(BufferPoolTests, FullSizeClassFreesBuffers) {
+  buffer_pool::pool_t pool;
+
+  std::vector<std::uint8_t *> buffers;
+  int size_class;
+  for (std::size_t x = 0; x < buffer_pool::pool_t::BUFFERS_PER_CLASS + 4; ++x) {
+    buffers.push_back(pool.acquire(1400, size_class));
+  }
+  for (auto buffer : buffers) {
+    pool.release(buffer, size_class);
+  }
+
+  EXPECT_EQ(pool.stats().cached, buffer_pool::pool_t::BUFFERS_PER_CLASS);
+}
+
+TEST(BufferPoolTests, ArenaAllocationsAreAlignedAndBounded) {
+  std::vector<std::uint8_t> region(256);
+  buffer_pool::arena_t arena {region.data(), region.size()};
+
+  auto first = arena.allocate(1);
+  auto second = arena.allocate(100);
+  EXPECT_EQ(first, region.data());
+  EXPECT_EQ(second, region.data() + 64);
+  EXPECT_TRUE(arena.contains(second));
+  EXPECT_FALSE(arena.contains(region.data() + region.size()));
+
+  EXPECT_EQ(arena.allocate(128), nullptr);
+  EXPECT_EQ(arena.allocate(64), region.data() + 192);
+  EXPECT_EQ(arena.used(), region.size());
+}
+
+TEST(BufferPoolTests, ArenaBuffersComeFirst) {
+  std::vector<std::uint8_t> region(1 << 20);
+  buffer_pool::pool_t pool;
+  pool.set_arena(region.data(), region.size());
+
+  int size_class;
+  auto buffer = pool.acquire(1400, size_class);
+  EXPECT_GE(buffer, region.data());
+  EXPECT_LT(buffer, region.data() + region.size());
+  pool.release(buffer, size_class);
+
+  EXPECT_EQ(pool.acquire(1400, size_class), buffer);
+  pool.release(buffer, size_class);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.arena_allocations, 1);
+  EXPECT_EQ(stats.allocations, 0);
+  EXPECT_EQ(stats.arena_bytes, region.size());
+  EXPECT_EQ(stats.arena_used_bytes, 2048);
+}
+
+TEST(BufferPoolTests, ArenaKeepsBuffersPerClassThenFallsBackToHeap) {
+  std::vector<std::uint8_t> region(1 << 20);
+  buffer_pool::pool_t pool;
+  pool.set_arena(region.data(), region.size());
+
+  std::vector<std::uint8_t *> buffers;
+  int size_class;
+  for (std::size_t x = 0; x < buffer_pool::pool_t::BUFFERS_PER_CLASS + 4; ++x) {
+    buffers.push_back(pool.acquire(1400, size_class));
+  }
+
+  auto in_arena = std::count_if(std::begin(buffers), std::end(buffers), [&region](auto buffer) {
+    return buffer >= region.data() && buffer < region.data() + region.size();
+  });
+  EXPECT_EQ(in_arena, buffer_pool::pool_t::BUFFERS_PER_CLASS);
+
+  for (auto buffer : buffers) {
+    pool.release(buffer, size_class);
+  }
+
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.arena_allocations, buffer_pool::pool_t::BUFFERS_PER_CLASS);
+  EXPECT_EQ(stats.allocations, 4);
+  EXPECT_EQ(stats.cached, buffer_pool::pool_t::BUFFERS_PER_CLASS + 4);
+}
+
+TEST(BufferPoolTests, FullArenaFallsBackToHeap) {
+  std::vector<std::uint8_t> region(2048);
+  buffer_pool::pool_t pool;
+  pool.set_arena(region.data(), region.size());
+
+  int size_class;
+  auto arena_buffer = pool.acquire(1400, size_class);
+  auto heap_buffer = pool.acquire(1400, size_class);
+  EXPECT_EQ(arena_buffer, region.data());
+  EXPECT_NE(heap_buffer, nullptr);
+
+  pool.release(arena_buffer, size_class);
+  pool.release(heap_buffer, size_class);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.arena_allocations, 1);
+  EXPECT_EQ(stats.allocations, 1);
+}
+
+TEST(BufferPoolTests, ImageBuffersAreWritable) {
+  constexpr std::size_t size = 1920 * 1080 * 4;
+
+  auto image = buffer_pool::alloc_image(size);
+  ASSERT_NE(image, nullptr);
+  std::memset(image, 0xAB, size);
+  EXPECT_EQ(image[size - 1], 0xAB);
+
+  buffer_pool::free_image(image);
+  buffer_pool::free_image(nullptr);
+}
+
+TEST(BufferPoolTests, PinsImageBuffersOnceUntilFreed) {
+  constexpr std::size_t size = 1920 * 1080 * 4;
+
+  auto image = buffer_pool::alloc_image(size);
+  ASSERT_NE(image, nullptr);
+
+  int pins = 0;
+  int unpins = 0;
+  auto pin = [&](std::uint8_t *data, std::size_t mapped) -> std::function<void()> {
+    ++pins;
+    EXPECT_EQ(data, image);
+    EXPECT_GE(mapped, size);
+
+    return [&unpins]() {
+      ++unpins;
+    };
+  };
+
+  if (!buffer_pool::pin_image(image, pin)) {
+    // Images that fell back to the heap are never pinned
+    EXPECT_EQ(pins, 0);
+    buffer_pool::free_image(image);
+    return;
+  }
+
+  EXPECT_TRUE(buffer_pool::pin_image(image, pin));
+  EXPECT_EQ(pins, 1);
+  EXPECT_EQ(unpins, 0);
+
+  buffer_pool::free_image(image);
+  EXPECT_EQ(unpins, 1);
+}
+
+TEST(BufferPoolTests, DoesntRetryPinningImageBuffers) {
+  auto image = buffer_pool::alloc_image(4096);
+  ASSERT_NE(image, nullptr);
+
+  int pins = 0;
+  auto pin = [&pins](std::uint8_t *, std::size_t) -> std::function<void()> {
+    ++pins;
+    return {};
+  };
+
+  EXPECT_FALSE(buffer_pool::pin_image(image, pin));
+  EXPECT_FALSE(buffer_pool::pin_image(image, pin));
+  EXPECT_LE(pins, 1);
+
+  std::uint8_t other[16];
+  EXPECT_FALSE(buffer_pool::pin_image(other, pin));
+  EXPECT_LE(pins, 1);
+
+  buffer_pool::free_image(image);
+}
+
+TEST(BufferPoolTests, BufferCopiesAndMoves) {
+  const std::uint8_t bytes[] {1, 2, 3, 4};
+
+  buffer_pool::buffer_t<std::uint8_t> buffer {bytes, sizeof(bytes)};
+  buffer.fake_resize(3);
+
+  auto copy = buffer;
+  ASSERT_EQ(copy.size(), 3);
+  EXPECT_NE(copy.data(), buffer.data());
+  EXPECT_EQ(std::vector<std::uint8_t>(copy.begin(), copy.end()), (std::vector<std::uint8_t> {1, 2, 3}));
+
+  auto data = buffer.data();
+  auto moved = std::move(buffer);
+  EXPECT_EQ(moved.data(), data);
+  EXPECT_EQ(moved.size(), 3);
+  EXPECT_TRUE(buffer.empty());
+}
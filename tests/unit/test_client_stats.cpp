@@ -0,0 +1,103 @@
+/**
+ * @file tests/unit/test_client_stats.cpp
+ * @brief Test src/client_stats.*
+ */
+#include "../tests_common.h"
+
+#include <src/client_stats.h>
+#include <src/file_handler.h>
+
+using namespace std::literals;
+
+struct ClientStatsTest: testing::Test {
+  void SetUp() override {
+    file = std::filesystem::temp_directory_path() / "sunshine_test_client_stats.json";
+    client_stats::erase(file, {});
+  }
+
+  void TearDown() override {
+    client_stats::erase(file, {});
+  }
+
+  std::filesystem::path file;
+  std::chrono::system_clock::time_point now {std::chrono::seconds {1'700'000'000}};
+};
+
+TEST_F(ClientStatsTest, StoredStatsAreLoaded) {
+  client_stats::store(file, "client-a", {8000, 0.01, 15, 200'000'000, 12ms}, now);
+  client_stats::store(file, "client-b", {20000, 0, 5, 800'000'000, 2ms}, now);
+
+  auto entry = client_stats::load(file, "client-a", now);
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(entry->stats.bitrate, 8000);
+  EXPECT_DOUBLE_EQ(entry->stats.loss_rate, 0.01);
+  EXPECT_EQ(entry->stats.fec_percentage, 15);
+  EXPECT_EQ(entry->stats.link_rate, 200'000'000u);
+  EXPECT_EQ(entry->stats.rtt, 12ms);
+  EXPECT_DOUBLE_EQ(entry->weight, 1);
+
+  entry = client_stats::load(file, "client-b", now);
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(entry->stats.bitrate, 20000);
+
+  EXPECT_FALSE(client_stats::load(file, "client-c", now));
+}
+
+TEST_F(ClientStatsTest, StatsDecayWithAge) {
+  client_stats::store(file, "client-a", {8000, 0.01, 15, 200'000'000, 12ms}, now);
+
+  auto entry = client_stats::load(file, "client-a", now + client_stats::HALF_LIFE);
+  ASSERT_TRUE(entry);
+  EXPECT_NEAR(entry->weight, 0.5, 0.001);
+
+  EXPECT_FALSE(client_stats::load(file, "client-a", now + client_stats::MAX_AGE + 1h));
+
+  // A learned value pulls the default towards it as far as its weight goes
+  EXPECT_DOUBLE_EQ(client_stats::blend(20000, 8000, 1), 8000);
+  EXPECT_DOUBLE_EQ(client_stats::blend(20000, 8000, 0.5), 14000);
+  EXPECT_DOUBLE_EQ(client_stats::blend(20000, 8000, 0), 20000);
+}
+
+TEST_F(ClientStatsTest, SessionsAreBlended) {
+  client_stats::store(file, "client-a", {8000, 0.02, 20, 200'000'000, 10ms}, now);
+
+  // A fresh previous entry counts as much as the session
+  client_stats::store(file, "client-a", {12000, 0, 10, 400'000'000, 20ms}, now);
+  auto entry = client_stats::load(file, "client-a", now);
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(entry->stats.bitrate, 10000);
+  EXPECT_DOUBLE_EQ(entry->stats.loss_rate, 0.01);
+  EXPECT_EQ(entry->stats.fec_percentage, 15);
+  EXPECT_EQ(entry->stats.link_rate, 300'000'000u);
+  EXPECT_EQ(entry->stats.rtt, 15ms);
+
+  // A stale previous entry is replaced
+  client_stats::store(file, "client-a", {4000, 0.1, 30, 100'000'000, 40ms}, now + client_stats::MAX_AGE + 1h);
+  entry = client_stats::load(file, "client-a", now + client_stats::MAX_AGE + 1h);
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(entry->stats.bitrate, 4000);
+}
+
+TEST_F(ClientStatsTest, EraseRemovesStats) {
+  client_stats::store(file, "client-a", {8000, 0.01, 15, 200'000'000, 12ms}, now);
+  client_stats::store(file, "client-b", {20000, 0, 5, 800'000'000, 2ms}, now);
+
+  client_stats::erase(file, "client-a");
+  EXPECT_FALSE(client_stats::load(file, "client-a", now));
+  EXPECT_TRUE(client_stats::load(file, "client-b", now));
+
+  client_stats::erase(file, {});
+  EXPECT_FALSE(client_stats::load(file, "client-b", now));
+}
+
+TEST_F(ClientStatsTest, MalformedFileIsIgnored) {
+  file_handler::write_file(file.string().c_str(), "{\"clients\": {\"client-a\": {\"updated\": \"never\"}}}");
+  EXPECT_FALSE(client_stats::load(file, "client-a", now));
+
+  file_handler::write_file(file.string().c_str(), "not json");
+  EXPECT_FALSE(client_stats::load(file, "client-a", now));
+
+  // A malformed file is replaced by the next store
+  client_stats::store(file, "client-a", {8000, 0.01, 15, 200'000'000, 12ms}, now);
+  EXPECT_TRUE(client_stats::load(file, "client-a", now));
+}
@@ -0,0 +1,47 @@
+/**
+ * @file tests/unit/test_config.cpp
+ * @brief Test src/config.*.
+ */
+#include "../tests_common.h"
+
+#include <src/config.h>
+
+#include <atomic>
+#include <thread>
+
+TEST(ConfigTests, ClassifiesOptionsByReloadScope) {
+  // Read by the running sessions whenever they use them
+  EXPECT_EQ(config::reload_scope("mouse"), config::reload_scope_e::hot);
+  EXPECT_EQ(config::reload_scope("frame_size_limit"), config::reload_scope_e::hot);
+
+  // Read when a session starts
+  EXPECT_EQ(config::reload_scope("max_bitrate"), config::reload_scope_e::next_session);
+  EXPECT_EQ(config::reload_scope("fec_percentage"), config::reload_scope_e::next_session);
+
+  // Read on startup
+  EXPECT_EQ(config::reload_scope("port"), config::reload_scope_e::restart);
+  EXPECT_EQ(config::reload_scope("encoder"), config::reload_scope_e::restart);
+  EXPECT_EQ(config::reload_scope("not_an_option"), config::reload_scope_e::restart);
+}
+
+TEST(ConfigTests, HotOptionsCanBeAppliedWhileRead) {
+  config::hot_t<int> option {1};
+
+  // Like a session reading the option while the config is reloaded
+  std::atomic<bool> done = false;
+  std::thread reader {[&]() {
+    while (!done) {
+      int value = option;
+      EXPECT_TRUE(value == 1 || value == 2);
+    }
+  }};
+
+  for (int x = 0; x < 10000; ++x) {
+    option = x % 2 + 1;
+  }
+  done = true;
+  reader.join();
+
+  config::hot_t<int> copy = option;
+  ASSERT_EQ(copy.load(), 2);
+}
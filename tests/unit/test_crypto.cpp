@@ -0,0 +1,73 @@
+/**
+ * @file tests/unit/test_crypto.cpp
+ * @brief Test src/crypto.*
+ */
+#include "../tests_common.h"
+
+#include <src/crypto.h>
+
+TEST(CertChainTests, RemembersVerifiedCertificatesUntilCleared) {
+  auto paired = crypto::gen_creds("Paired", 2048);
+  auto other = crypto::gen_creds("Other", 2048);
+
+  crypto::cert_chain_t chain;
+  chain.add(crypto::x509(paired.x509));
+
+  auto paired_cert = crypto::x509(paired.x509);
+  auto other_cert = crypto::x509(other.x509);
+  EXPECT_EQ(chain.verify(paired_cert.get()), nullptr);
+  EXPECT_EQ(chain.verify(paired_cert.get()), nullptr);
+  EXPECT_NE(chain.verify(other_cert.get()), nullptr);
+
+  // Unpairing clears the chain, and the certificate must not verify from memory
+  chain.clear();
+  EXPECT_NE(chain.verify(paired_cert.get()), nullptr);
+
+  chain.add(crypto::x509(other.x509));
+  EXPECT_EQ(chain.verify(other_cert.get()), nullptr);
+}
+
+TEST(GcmTests, BatchMatchesSingleMessages) {
+  crypto::aes_t key(16, 0x42);
+  crypto::cipher::gcm_t single {key, false};
+  crypto::cipher::gcm_t batched {key, false};
+
+  constexpr int MESSAGES = 8;
+  std::vector<std::array<std::uint8_t, 12>> ivs(MESSAGES);
+  std::vector<std::vector<std::uint8_t>> headers(MESSAGES, std::vector<std::uint8_t>(20));
+  std::vector<std::vector<std::uint8_t>> payloads(MESSAGES, std::vector<std::uint8_t>(1400));
+  for (int x = 0; x < MESSAGES; ++x) {
+    ivs[x].fill(0);
+    ivs[x][0] = x;
+    ivs[x][11] = 'V';
+    std::fill(std::begin(headers[x]), std::end(headers[x]), x);
+    std::fill(std::begin(payloads[x]), std::end(payloads[x]), x + 100);
+  }
+
+  // Encrypted in place, like the video shards
+  auto batch_headers = headers;
+  auto batch_payloads = payloads;
+  std::vector<std::array<std::uint8_t, crypto::cipher::tag_size>> batch_tags(MESSAGES);
+  std::vector<crypto::cipher::gcm_message_t> messages;
+  for (int x = 0; x < MESSAGES; ++x) {
+    messages.push_back({
+      ivs[x].data(),
+      std::string_view {(char *) batch_headers[x].data(), batch_headers[x].size()},
+      batch_headers[x].data(),
+      std::string_view {(char *) batch_payloads[x].data(), batch_payloads[x].size()},
+      batch_payloads[x].data(),
+      batch_tags[x].data(),
+    });
+  }
+  ASSERT_EQ(batched.encrypt(messages), 0);
+
+  for (int x = 0; x < MESSAGES; ++x) {
+    crypto::aes_t iv {std::begin(ivs[x]), std::end(ivs[x])};
+    std::array<std::uint8_t, crypto::cipher::tag_size> tag;
+    ASSERT_EQ(single.encrypt(std::string_view {(char *) headers[x].data(), headers[x].size()}, headers[x].data(), std::string_view {(char *) payloads[x].data(), payloads[x].size()}, payloads[x].data(), tag.data(), &iv), 1420);
+
+    EXPECT_EQ(batch_headers[x], headers[x]);
+    EXPECT_EQ(batch_payloads[x], payloads[x]);
+    EXPECT_EQ(batch_tags[x], tag);
+  }
+}
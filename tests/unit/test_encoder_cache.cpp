@@ -0,0 +1,63 @@
+/**
+ * @file tests/unit/test_encoder_cache.cpp
+ * @brief Test src/encoder_cache.*
+ */
+#include "../tests_common.h"
+
+#include <src/encoder_cache.h>
+#include <src/file_handler.h>
+
+struct EncoderCacheTest: testing::Test {
+  void SetUp() override {
+    file = std::filesystem::temp_directory_path() / "sunshine_test_encoder_cache.json";
+    encoder_cache::invalidate(file);
+  }
+
+  void TearDown() override {
+    encoder_cache::invalidate(file);
+  }
+
+  std::filesystem::path file;
+};
+
+TEST_F(EncoderCacheTest, StoredResultsAreLoaded) {
+  encoder_cache::store(file, "nvenc", "gpu-a", {true, 0x1f, 0x0f, 0});
+  encoder_cache::store(file, "software", "gpu-a", {false, 0, 0, 0});
+
+  auto entry = encoder_cache::load(file, "nvenc", "gpu-a");
+  ASSERT_TRUE(entry);
+  EXPECT_TRUE(entry->passed);
+  EXPECT_EQ(entry->h264, 0x1fu);
+  EXPECT_EQ(entry->hevc, 0x0fu);
+  EXPECT_EQ(entry->av1, 0u);
+
+  entry = encoder_cache::load(file, "software", "gpu-a");
+  ASSERT_TRUE(entry);
+  EXPECT_FALSE(entry->passed);
+}
+
+TEST_F(EncoderCacheTest, StaleResultsAreIgnored) {
+  encoder_cache::store(file, "nvenc", "gpu-a", {true, 0x1f, 0x0f, 0});
+
+  EXPECT_FALSE(encoder_cache::load(file, "nvenc", "gpu-b"));
+  EXPECT_FALSE(encoder_cache::load(file, "vaapi", "gpu-a"));
+}
+
+TEST_F(EncoderCacheTest, InvalidateRemovesResults) {
+  encoder_cache::store(file, "nvenc", "gpu-a", {true, 0x1f, 0x0f, 0});
+
+  EXPECT_TRUE(encoder_cache::invalidate(file));
+  EXPECT_FALSE(encoder_cache::load(file, "nvenc", "gpu-a"));
+}
+
+TEST_F(EncoderCacheTest, MalformedFileIsIgnored) {
+  file_handler::write_file(file.string().c_str(), "{\"encoders\": {\"nvenc\": {\"fingerprint\": 1}}}");
+  EXPECT_FALSE(encoder_cache::load(file, "nvenc", "gpu-a"));
+
+  file_handler::write_file(file.string().c_str(), "not json");
+  EXPECT_FALSE(encoder_cache::load(file, "nvenc", "gpu-a"));
+
+  // A malformed file is replaced by the next store
+  encoder_cache::store(file, "nvenc", "gpu-a", {true, 1, 0, 0});
+  EXPECT_TRUE(encoder_cache::load(file, "nvenc", "gpu-a"));
+}
@@ -7,6 +7,7 @@
 #ifdef SUNSHINE_BUILD_EVDI
   #include <src/platform/linux/evdi.h>
   #include <src/video.h>
+  #include <tuple>
 
 namespace {
   /**
@@ -74,6 +75,102 @@ namespace {
     
     ASSERT_TRUE(true);
   }
+
+  /**
+   * @brief Get the extension blocks of an EDID with the given tag.
+   */
+  std::vector<const unsigned char *> extension_blocks(const std::vector<unsigned char> &edid, unsigned char tag) {
+    std::vector<const unsigned char *> blocks;
+    for (std::size_t offset = 128; offset + 128 <= edid.size(); offset += 128) {
+      if (edid[offset] == tag) {
+        blocks.emplace_back(&edid[offset]);
+      }
+    }
+    return blocks;
+  }
+
+  /**
+   * @brief Test the CVT-RB v2 timings against the values of the VESA CVT calculator.
+   */
+  TEST(EVDITest, CvtRb2Timings) {
+    auto timings = platf::evdi::cvt_rb2_timings({1920, 1080, 60});
+    EXPECT_EQ(timings.pixel_clock_khz, 133320);
+    EXPECT_EQ(timings.h_active + timings.h_blank, 2000);
+    EXPECT_EQ(timings.h_front_porch, 8);
+    EXPECT_EQ(timings.h_sync, 32);
+    EXPECT_EQ(timings.v_active + timings.v_blank, 1111);
+    EXPECT_EQ(timings.v_front_porch, 17);
+    EXPECT_EQ(timings.v_sync, 8);
+
+    // High refresh rates need more lines of blanking to last the same time
+    timings = platf::evdi::cvt_rb2_timings({3840, 2160, 120});
+    EXPECT_EQ(timings.v_active + timings.v_blank, 2287);
+    EXPECT_EQ(timings.pixel_clock_khz, 1075804);
+  }
+
+  /**
+   * @brief Test that every block of the EDID adds up to 0, as its checksum requires.
+   */
+  TEST(EVDITest, EdidChecksums) {
+    for (auto [width, height, refresh_rate] : {std::tuple {1920, 1080, 60}, {2560, 1440, 144}, {3840, 2160, 120}, {7680, 4320, 60}}) {
+      for (auto hdr_enabled : {false, true}) {
+        auto edid = platf::evdi::generate_edid(width, height, refresh_rate, hdr_enabled);
+        ASSERT_EQ(edid.size(), 128 * (1 + edid[126]));
+
+        for (std::size_t offset = 0; offset < edid.size(); offset += 128) {
+          unsigned char sum = 0;
+          for (std::size_t x = offset; x < offset + 128; ++x) {
+            sum += edid[x];
+          }
+          EXPECT_EQ(sum, 0) << width << "x" << height << "@" << refresh_rate << " block " << offset / 128;
+        }
+
+        for (auto block : extension_blocks(edid, 0x70)) {
+          unsigned char sum = 0;
+          for (int x = 1; x <= 5 + block[2]; ++x) {
+            sum += block[x];
+          }
+          EXPECT_EQ(sum, 0) << width << "x" << height << "@" << refresh_rate << " DisplayID section";
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Test that a mode that fits in a DTD is the first DTD of the EDID.
+   */
+  TEST(EVDITest, EdidPreferredDtd) {
+    auto edid = platf::evdi::generate_edid(1920, 1080, 60, false);
+
+    EXPECT_EQ(edid[54] | (edid[55] << 8), 13332);
+    EXPECT_EQ(edid[56] | ((edid[58] & 0xF0) << 4), 1920);
+    EXPECT_EQ(edid[57] | ((edid[58] & 0x0F) << 8), 80);
+    EXPECT_EQ(edid[59] | ((edid[61] & 0xF0) << 4), 1080);
+    EXPECT_EQ(edid[60] | ((edid[61] & 0x0F) << 8), 31);
+    EXPECT_TRUE(extension_blocks(edid, 0x70).empty());
+  }
+
+  /**
+   * @brief Test that a mode whose pixel clock is too high for a DTD is a preferred DisplayID timing.
+   */
+  TEST(EVDITest, EdidPreferredDisplayIdTiming) {
+    auto edid = platf::evdi::generate_edid(3840, 2160, 120, false);
+
+    auto blocks = extension_blocks(edid, 0x70);
+    ASSERT_EQ(blocks.size(), 1);
+
+    auto timing = blocks[0] + 8;
+    ASSERT_EQ(blocks[0][5], 0x03);
+    EXPECT_EQ(timing[0] | (timing[1] << 8) | (timing[2] << 16), 107580 - 1);
+    EXPECT_EQ(timing[3] & 0x80, 0x80);
+    EXPECT_EQ((timing[4] | (timing[5] << 8)) + 1, 3840);
+    EXPECT_EQ((timing[12] | (timing[13] << 8)) + 1, 2160);
+
+    // The first DTD still holds the resolution, at a refresh rate that fits
+    EXPECT_EQ(edid[56] | ((edid[58] & 0xF0) << 4), 3840);
+    EXPECT_LE(edid[54] | (edid[55] << 8), 0xFFFF);
+    EXPECT_GT(edid[54] | (edid[55] << 8), 0);
+  }
 }  // namespace
 
 #else
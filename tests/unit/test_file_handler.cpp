@@ -4,6 +4,7 @@
  */
 #include "../tests_common.h"
 
+#include <filesystem>
 #include <format>
 #include <src/file_handler.h>
 
@@ -94,3 +95,16 @@ TEST(FileHandlerTests, ReadMissingFileTest) {
   // read missing file
   EXPECT_EQ(file_handler::read_file("non-existing-file.txt"), "");
 }
+
+TEST(FileHandlerTests, WriteFileAtomicReplacesFileTest) {
+  const std::string fileName = "write_file_atomic_test.txt";
+  EXPECT_EQ(file_handler::write_file_atomic(fileName.c_str(), "old contents"), 0);
+  EXPECT_EQ(file_handler::write_file_atomic(fileName.c_str(), "new"), 0);
+
+  EXPECT_EQ(file_handler::read_file(fileName.c_str()), "new");
+  EXPECT_FALSE(std::filesystem::exists(fileName + ".tmp"));
+}
+
+TEST(FileHandlerTests, WriteFileAtomicMissingDirectoryTest) {
+  EXPECT_EQ(file_handler::write_file_atomic("non-existing-directory/file.txt", "contents"), -1);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file tests/unit/test_frame_scheduler.cpp
+ * @brief Test src/frame_scheduler.*
+ */
+#include "../tests_common.h"
+
+#include <src/frame_scheduler.h>
+
+using namespace std::literals;
+using frame_scheduler::stage_e;
+
+TEST(FrameSchedulerTests, StageEstimateConvergesOnSamples) {
+  frame_scheduler::stage_estimate_t estimate;
+  EXPECT_EQ(estimate.mean(), 0ns);
+  EXPECT_EQ(estimate.budget(), 0ns);
+
+  estimate.add(4ms);
+  EXPECT_EQ(estimate.mean(), 4ms);
+  EXPECT_EQ(estimate.budget(), 8ms);
+
+  for (int x = 0; x < 200; ++x) {
+    estimate.add(2ms);
+  }
+  EXPECT_NEAR(estimate.mean().count(), 2'000'000, 10'000);
+  EXPECT_LT(estimate.deviation(), 10us);
+}
+
+TEST(FrameSchedulerTests, StageEstimateBudgetCoversJitter) {
+  frame_scheduler::stage_estimate_t estimate;
+  for (int x = 0; x < 200; ++x) {
+    estimate.add(x % 2 ? 3ms : 1ms);
+  }
+
+  EXPECT_GT(estimate.budget(), 3ms);
+}
+
+TEST(FrameSchedulerTests, NextCaptureFollowsCadence) {
+  frame_scheduler::scheduler_t scheduler {10ms};
+  auto start = frame_scheduler::clock::now();
+
+  EXPECT_EQ(scheduler.next_capture(start), start);
+
+  scheduler.on_captured(start, start + 1ms);
+  EXPECT_EQ(scheduler.next_capture(start + 3ms), start + 10ms);
+  EXPECT_EQ(scheduler.next_capture(start + 10ms), start + 20ms);
+  EXPECT_EQ(scheduler.next_capture(start + 55ms), start + 60ms);
+  EXPECT_EQ(scheduler.budget(stage_e::capture), 2ms);
+}
+
+TEST(FrameSchedulerTests, RepeatIsDueWithoutCaptures) {
+  frame_scheduler::scheduler_t scheduler {10ms};
+  auto start = frame_scheduler::clock::now();
+
+  bool deferred = true;
+  EXPECT_EQ(scheduler.repeat_deadline(start, 100ms, &deferred), start + 100ms);
+  EXPECT_FALSE(deferred);
+}
+
+TEST(FrameSchedulerTests, RepeatWaitsForDueCapture) {
+  frame_scheduler::scheduler_t scheduler {10ms};
+  auto start = frame_scheduler::clock::now();
+
+  scheduler.on_captured(start, start);
+  scheduler.record(stage_e::encode, 2ms);
+  scheduler.record(stage_e::send, 1ms);
+
+  // The repeat would be due 1ms before the capture at 100ms
+  bool deferred = false;
+  EXPECT_EQ(scheduler.repeat_deadline(start, 99ms, &deferred), start + 100ms);
+  EXPECT_TRUE(deferred);
+
+  // The repeat has plenty of time to get out before the capture at 110ms
+  EXPECT_EQ(scheduler.repeat_deadline(start, 101ms, &deferred), start + 101ms);
+  EXPECT_FALSE(deferred);
+}
+
+TEST(FrameSchedulerTests, SlackAccountsForRemainingStages) {
+  frame_scheduler::scheduler_t scheduler {10ms};
+  auto start = frame_scheduler::clock::now();
+
+  scheduler.record(stage_e::encode, 2ms);
+  scheduler.record(stage_e::send, 1ms);
+
+  EXPECT_EQ(scheduler.slack(start, start + 1ms, {stage_e::encode, stage_e::send}), 3ms);
+  EXPECT_EQ(scheduler.slack(start, start + 8ms, {stage_e::send}), 0ns);
+  EXPECT_LT(scheduler.slack(start, start + 9ms, {stage_e::send}), 0ns);
+}
+
+TEST(FrameSchedulerTests, CapturePhaseSettlesAfterPresent) {
+  frame_scheduler::capture_phase_t phase {10ms};
+  auto start = frame_scheduler::clock::now();
+
+  // The game presents at 3ms into each interval, the capture starts 9ms in
+  auto capture = start + 9ms;
+  auto age = 0ns;
+  for (int x = 0; x < 100; ++x) {
+    auto presented = start + 10ms * x + 3ms;
+    if (presented > capture) {
+      presented -= 10ms;
+    }
+
+    age = capture - presented;
+    capture += 10ms + phase.update(capture, presented);
+  }
+
+  EXPECT_NEAR(age.count(), frame_scheduler::capture_phase_t::MARGIN.count(), 10'000);
+  EXPECT_LT(std::abs(phase.error().count()), 10'000);
+}
+
+TEST(FrameSchedulerTests, CapturePhaseWrapsAroundTheInterval) {
+  frame_scheduler::capture_phase_t phase {10ms};
+  auto start = frame_scheduler::clock::now();
+
+  // Late by 2ms moves earlier, capped at a tenth of the interval
+  EXPECT_EQ(phase.update(start + 3ms, start), -500us);
+  EXPECT_EQ(phase.update(start + 6ms, start), -1ms);
+
+  // Just before the next present moves later instead of nearly a frame earlier
+  EXPECT_EQ(phase.update(start + 10ms, start + 1ms), 500us);
+  EXPECT_EQ(phase.update(start + 1ms, start), 0ns);
+}
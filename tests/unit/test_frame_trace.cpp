@@ -0,0 +1,140 @@
+/**
+ * @file tests/unit/test_frame_trace.cpp
+ * @brief Test src/frame_trace.*
+ */
+#include "../tests_common.h"
+
+#include <nlohmann/json.hpp>
+#include <src/config.h>
+#include <src/frame_trace.h>
+#include <thread>
+
+using namespace std::literals;
+using frame_trace::span_e;
+
+class FrameTraceTest: public ::testing::Test {
+protected:
+  void SetUp() override {
+    config::sunshine.frame_trace = true;
+  }
+
+  void TearDown() override {
+    config::sunshine.frame_trace = false;
+  }
+
+  /**
+   * @brief Get the spans of a frame from the trace, since other tests may have recorded spans too.
+   */
+  static std::vector<nlohmann::json> spans_of(std::int64_t frame) {
+    auto trace = nlohmann::json::parse(frame_trace::dump());
+
+    std::vector<nlohmann::json> spans;
+    for (auto &event : trace["traceEvents"]) {
+      if (event["ph"] == "X" && event["args"]["frame"] == frame) {
+        spans.emplace_back(event);
+      }
+    }
+
+    return spans;
+  }
+
+  static std::string thread_name(const nlohmann::json &span) {
+    auto trace = nlohmann::json::parse(frame_trace::dump());
+    for (auto &event : trace["traceEvents"]) {
+      if (event["ph"] == "M" && event["tid"] == span["tid"]) {
+        return event["args"]["name"];
+      }
+    }
+
+    return {};
+  }
+};
+
+TEST_F(FrameTraceTest, RecordsNothingWhileDisabled) {
+  config::sunshine.frame_trace = false;
+
+  auto now = frame_trace::clock::now();
+  frame_trace::record(span_e::encode, 1'000'001, now, now + 1ms);
+  {
+    frame_trace::scoped_span_t span {span_e::send, 1'000'001};
+  }
+
+  EXPECT_TRUE(spans_of(1'000'001).empty());
+}
+
+TEST_F(FrameTraceTest, RecordsSpansInChromeTraceFormat) {
+  auto start = frame_trace::clock::now();
+  frame_trace::record(span_e::capture, 1'000'002, start, start + 1500us);
+  frame_trace::record(span_e::encode, 1'000'002, start + 2ms, start + 5ms);
+
+  auto spans = spans_of(1'000'002);
+  ASSERT_EQ(spans.size(), 2);
+
+  EXPECT_EQ(spans[0]["name"], "capture");
+  EXPECT_DOUBLE_EQ(spans[0]["dur"].get<double>(), 1500.0);
+  EXPECT_EQ(spans[1]["name"], "encode");
+  EXPECT_DOUBLE_EQ(spans[1]["dur"].get<double>(), 3000.0);
+  EXPECT_DOUBLE_EQ(spans[1]["ts"].get<double>() - spans[0]["ts"].get<double>(), 2000.0);
+  EXPECT_EQ(spans[0]["tid"], spans[1]["tid"]);
+}
+
+TEST_F(FrameTraceTest, ScopedSpanCoversItsLifetime) {
+  {
+    frame_trace::scoped_span_t span {span_e::fec, 1'000'003};
+    std::this_thread::sleep_for(2ms);
+  }
+
+  auto spans = spans_of(1'000'003);
+  ASSERT_EQ(spans.size(), 1);
+  EXPECT_EQ(spans[0]["name"], "fec");
+  EXPECT_GE(spans[0]["dur"].get<double>(), 2000.0);
+}
+
+TEST_F(FrameTraceTest, KeepsSpansOfExitedThreads) {
+  std::thread {[]() {
+    frame_trace::name_thread("Video broadcast");
+
+    auto now = frame_trace::clock::now();
+    frame_trace::record(span_e::send, 1'000'004, now, now + 1ms);
+  }}.join();
+
+  auto now = frame_trace::clock::now();
+  frame_trace::record(span_e::encode, 1'000'004, now, now + 1ms);
+
+  auto spans = spans_of(1'000'004);
+  ASSERT_EQ(spans.size(), 2);
+  EXPECT_NE(spans[0]["tid"], spans[1]["tid"]);
+
+  auto send = spans[0]["name"] == "send" ? spans[0] : spans[1];
+  EXPECT_EQ(thread_name(send), "Video broadcast");
+}
+
+TEST_F(FrameTraceTest, OverwritesOldestSpansWhenFull) {
+  auto now = frame_trace::clock::now();
+  frame_trace::record(span_e::queue, 1'000'005, now, now + 1ms);
+  for (int x = 0; x < 20'000; ++x) {
+    frame_trace::record(span_e::send, 1'000'006, now, now + 1us);
+  }
+
+  EXPECT_TRUE(spans_of(1'000'005).empty());
+  auto spans = spans_of(1'000'006);
+  EXPECT_FALSE(spans.empty());
+  EXPECT_LT(spans.size(), 20'000);
+}
+
+TEST_F(FrameTraceTest, ListsRecordedSpans) {
+  auto start = frame_trace::clock::now();
+  frame_trace::record(span_e::convert, 1'000'007, start, start + 2ms);
+
+  std::vector<frame_trace::span_t> spans;
+  for (auto &span : frame_trace::spans()) {
+    if (span.frame == 1'000'007) {
+      spans.emplace_back(span);
+    }
+  }
+
+  ASSERT_EQ(spans.size(), 1);
+  EXPECT_EQ(spans[0].span, span_e::convert);
+  EXPECT_EQ(spans[0].start, start);
+  EXPECT_EQ(spans[0].end, start + 2ms);
+}
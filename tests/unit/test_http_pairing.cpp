@@ -265,3 +265,41 @@ TEST(PairingTest, OutOfOrderCalls) {
   getservercert(sess, tree, "test");
   ASSERT_FALSE(tree.get<int>("root.paired") == 1);
 }
+
+TEST(PairingTest, Benchmark) {
+  constexpr int ROUNDS = 100;
+
+  setup(PRIVATE_KEY, PUBLIC_CERT);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < ROUNDS; ++x) {
+    boost::property_tree::ptree tree;
+    pair_session_t sess {
+      .client = {
+        .uniqueID = "1234",
+        .cert = PUBLIC_CERT,
+        .name = "test"
+      },
+      .async_insert_pin = {.salt = "ff5dc6eda99339a8a0793e216c4257c4"}
+    };
+
+    getservercert(sess, tree, "5338");
+    clientchallenge(sess, tree, util::from_hex_vec("741CD3D6890C16DA39D53BCA0893AAF0", true));
+    serverchallengeresp(sess, tree, util::from_hex_vec("920BABAE9F7599AA1CA8EC87FB3454C91872A7D8D5127DDC176C2FDAE635CF7A", true));
+    sess.serverchallenge = util::from_hex_vec("AAAAAAAAAAAAAAAA", true);
+
+    auto add_cert = std::make_shared<safe::queue_t<crypto::x509_t>>(30);
+    clientpairingsecret(
+      sess,
+      add_cert,
+      tree,
+      util::from_hex_vec("000102030405060708090A0B0C0D0EFF"
+                         "9BB74D8DE2FF006C3F47FC45EFDAA97D433783AFAB3ACD85CA7ED2330BB2A7BD18A5B044AF8CAC177116FAE8A6E8E44653A8944A0F8EA138B2E013756D847D2C4FC52F736E2E7E9B4154712B18F8307B2A161E010F0587744163E42ECA9EA548FC435756EDCF1FEB94037631ABB72B29DDAC0EA5E61F2DBFCC3B20AA021473CC85AC98D88052CA6618ED1701EFBF142C18D5E779A3155B84DF65057D4823EC194E6DF14006793E8D7A3DCCE20A911636C4E01ECA8B54B9DE9F256F15DE9A980EA024B30D77579140D45EC220C738164BDEEEBF7364AE94A5FF9B784B40F2E640CE8603017DEEAC7B2AD77B807C643B7B349C110FE15F94C7B3D37FF15FDFBE26",
+                         true)
+    );
+    ASSERT_EQ(tree.get<int>("root.paired"), 1);
+  }
+  auto us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+
+  BOOST_LOG(tests) << "Pairing round trip: " << us << " us";
+}
@@ -5,6 +5,10 @@
 // test imports
 #include "../tests_common.h"
 
+// standard imports
+#include <atomic>
+#include <future>
+
 // lib imports
 #include <curl/curl.h>
 
@@ -71,3 +75,76 @@ INSTANTIATE_TEST_SUITE_P(
     std::make_tuple(URL_2, "hello-redirect.txt")
   )
 );
+
+struct ParseRangeTest: testing::TestWithParam<std::tuple<std::string, std::optional<std::pair<std::uint64_t, std::uint64_t>>>> {};
+
+TEST_P(ParseRangeTest, Run) {
+  const auto &[range, expected] = GetParam();
+  ASSERT_EQ(http::parse_range(range, 1000), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  ParseRangeTests,
+  ParseRangeTest,
+  testing::Values(
+    std::make_tuple("bytes=0-499", std::make_pair(0, 500)),
+    std::make_tuple("bytes=500-", std::make_pair(500, 500)),
+    std::make_tuple("bytes=900-2000", std::make_pair(900, 100)),
+    std::make_tuple("bytes=-100", std::make_pair(900, 100)),
+    std::make_tuple("bytes=-5000", std::make_pair(0, 1000)),
+    std::make_tuple("bytes=1000-", std::nullopt),
+    std::make_tuple("bytes=500-400", std::nullopt),
+    std::make_tuple("bytes=0-1,5-6", std::nullopt),
+    std::make_tuple("bytes=-0", std::nullopt),
+    std::make_tuple("bytes=a-b", std::nullopt),
+    std::make_tuple("items=0-1", std::nullopt)
+  )
+);
+
+struct fake_response_t {
+  void write(SimpleWeb::StatusCode status, const SimpleWeb::CaseInsensitiveMultimap &) {
+    this->status = status;
+  }
+
+  std::optional<SimpleWeb::StatusCode> status;
+};
+
+TEST(WorkersTests, RejectsRequestsBeyondQueue) {
+  metrics::http_workers_t metrics;
+  auto rejected = metrics.rejected.value();
+
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> started;
+  std::atomic<int> handled {0};
+
+  {
+    http::workers_t workers {1, metrics};
+    auto blocking = workers.handler([&](auto, auto) {
+      started.set_value();
+      released.wait();
+      ++handled;
+    });
+    auto counting = workers.handler([&](auto, auto) {
+      ++handled;
+    });
+
+    // Keep the only worker busy, then fill the queue
+    blocking(std::make_shared<fake_response_t>(), nullptr);
+    started.get_future().wait();
+    for (int x = 0; x < http::workers_t::MAX_QUEUED; ++x) {
+      counting(std::make_shared<fake_response_t>(), nullptr);
+    }
+
+    auto response = std::make_shared<fake_response_t>();
+    counting(response, nullptr);
+    EXPECT_EQ(response->status, SimpleWeb::StatusCode::server_error_service_unavailable);
+    EXPECT_EQ(metrics.rejected.value(), rejected + 1);
+
+    release.set_value();
+  }
+
+  // The requests left are handled before the workers are destroyed
+  EXPECT_EQ(handled, http::workers_t::MAX_QUEUED + 1);
+  EXPECT_EQ(metrics.queue_seconds.count(), http::workers_t::MAX_QUEUED + 1);
+}
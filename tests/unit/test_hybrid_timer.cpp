@@ -0,0 +1,79 @@
+/**
+ * @file tests/unit/test_hybrid_timer.cpp
+ * @brief Test src/hybrid_timer.*
+ */
+#include "../tests_common.h"
+
+#include <src/hybrid_timer.h>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief A coarse timer that always oversleeps by the same amount.
+   */
+  class oversleeping_timer_t: public platf::high_precision_timer {
+  public:
+    oversleeping_timer_t(std::chrono::nanoseconds overshoot, std::vector<std::chrono::nanoseconds> &requests):
+        overshoot {overshoot},
+        requests {requests} {
+    }
+
+    void sleep_for(const std::chrono::nanoseconds &duration) override {
+      requests.emplace_back(duration);
+
+      // Busy wait, so the test doesn't depend on the precision of the host's own timers
+      auto deadline = hybrid_timer::clock::now() + duration + overshoot;
+      while (hybrid_timer::clock::now() < deadline) {
+      }
+    }
+
+    operator bool() override {
+      return true;
+    }
+
+    std::chrono::nanoseconds overshoot;
+    std::vector<std::chrono::nanoseconds> &requests;
+  };
+}  // namespace
+
+TEST(HybridTimerTests, SpinsThroughShortSleeps) {
+  std::vector<std::chrono::nanoseconds> requests;
+  hybrid_timer::timer_t timer {std::make_unique<oversleeping_timer_t>(0ns, requests)};
+
+  auto start = hybrid_timer::clock::now();
+  timer.sleep_for(hybrid_timer::MIN_SPIN / 2);
+
+  EXPECT_GE(hybrid_timer::clock::now() - start, hybrid_timer::MIN_SPIN / 2);
+  EXPECT_TRUE(requests.empty());
+}
+
+TEST(HybridTimerTests, LearnsToWakeUpBeforeTheOvershoot) {
+  std::vector<std::chrono::nanoseconds> requests;
+  hybrid_timer::timer_t timer {std::make_unique<oversleeping_timer_t>(300us, requests)};
+
+  for (int x = 0; x < 50; ++x) {
+    timer.sleep_for(1ms);
+  }
+
+  // The margin settles around the overshoot, and the coarse timer is asked to wake up that much early
+  EXPECT_GE(timer.spin_margin(), 300us);
+  EXPECT_LT(timer.spin_margin(), 400us);
+  EXPECT_LE(requests.back(), 700us);
+
+  // Once calibrated, sleeps end close to their deadline despite the overshoot
+  auto start = hybrid_timer::clock::now();
+  timer.sleep_for(1ms);
+  auto elapsed = hybrid_timer::clock::now() - start;
+  EXPECT_GE(elapsed, 1ms);
+  EXPECT_LT(elapsed, 1ms + 200us);
+}
+
+TEST(HybridTimerTests, CapsTheSpinMargin) {
+  std::vector<std::chrono::nanoseconds> requests;
+  hybrid_timer::timer_t timer {std::make_unique<oversleeping_timer_t>(5ms, requests)};
+
+  timer.sleep_for(6ms);
+  EXPECT_EQ(timer.spin_margin(), hybrid_timer::MAX_SPIN);
+}
@@ -0,0 +1,137 @@
+/**
+ * @file tests/unit/test_input_queue.cpp
+ * @brief Test src/input_queue.*
+ */
+#include "../tests_common.h"
+
+#include <array>
+#include <cstring>
+#include <src/input_queue.h>
+#include <thread>
+
+namespace {
+  std::vector<std::uint8_t> message(std::uint8_t value, std::size_t size = 4) {
+    return std::vector<std::uint8_t>(size, value);
+  }
+}  // namespace
+
+TEST(InputQueueTests, PopsInOrder) {
+  input::input_queue_t queue {4};
+  auto now = std::chrono::steady_clock::now();
+
+  for (std::uint8_t x = 0; x < 10; ++x) {
+    EXPECT_TRUE(queue.push_back(message(x), now));
+    EXPECT_TRUE(queue.push_back(message(x + 100), now));
+
+    ASSERT_FALSE(queue.empty());
+    EXPECT_EQ(queue.peek(0)->data()[0], x);
+    EXPECT_EQ(queue.peek(1)->data()[0], x + 100);
+    EXPECT_EQ(queue.peek(2), nullptr);
+
+    queue.pop_front();
+    EXPECT_EQ(queue.peek(0)->data()[0], x + 100);
+    queue.pop_front();
+  }
+
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(InputQueueTests, FullQueueDropsNewMessages) {
+  input::input_queue_t queue {3};
+  auto now = std::chrono::steady_clock::now();
+
+  // The capacity is rounded up to a power of two
+  ASSERT_EQ(queue.capacity(), 4);
+  for (std::uint8_t x = 0; x < 4; ++x) {
+    EXPECT_TRUE(queue.push_back(message(x), now));
+  }
+  EXPECT_FALSE(queue.push_back(message(4), now));
+
+  queue.pop_front();
+  EXPECT_TRUE(queue.push_back(message(5), now));
+  for (std::uint8_t x : {1, 2, 3, 5}) {
+    ASSERT_FALSE(queue.empty());
+    EXPECT_EQ(queue.peek(0)->data()[0], x);
+    queue.pop_front();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(InputQueueTests, PopSkipsBatchedMessages) {
+  input::input_queue_t queue;
+  auto now = std::chrono::steady_clock::now();
+
+  for (std::uint8_t x = 0; x < 5; ++x) {
+    queue.push_back(message(x), now);
+  }
+
+  // Messages batched behind one that couldn't be batched are skipped once they reach the front
+  queue.peek(1)->batched = true;
+  queue.peek(3)->batched = true;
+
+  queue.pop_front();
+  EXPECT_EQ(queue.peek(0)->data()[0], 2);
+  queue.pop_front();
+  EXPECT_EQ(queue.peek(0)->data()[0], 4);
+  queue.pop_front();
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(InputQueueTests, KeepsLargeMessages) {
+  input::input_queue_t queue;
+  auto now = std::chrono::steady_clock::now();
+
+  queue.push_back(message(7, input::input_entry_t::INLINE_SIZE + 1), now);
+
+  auto entry = queue.peek(0);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->size, input::input_entry_t::INLINE_SIZE + 1);
+  EXPECT_EQ(entry->data()[input::input_entry_t::INLINE_SIZE], 7);
+  EXPECT_EQ(entry->received, now);
+}
+
+TEST(InputQueueTests, DeliversMessagesOfConcurrentProducers) {
+  constexpr int PRODUCERS = 4;
+  constexpr int MESSAGES = 10000;
+
+  input::input_queue_t queue {64};
+
+  std::vector<std::thread> producers;
+  for (int x = 0; x < PRODUCERS; ++x) {
+    producers.emplace_back([&queue, x]() {
+      for (int y = 0; y < MESSAGES; ++y) {
+        std::vector<std::uint8_t> data(sizeof(int) * 2);
+        std::memcpy(data.data(), &x, sizeof(int));
+        std::memcpy(data.data() + sizeof(int), &y, sizeof(int));
+
+        while (!queue.push_back(std::vector<std::uint8_t> {data}, std::chrono::steady_clock::now())) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // Every producer's messages arrive in the order it queued them
+  std::array<int, PRODUCERS> next {};
+  for (int received = 0; received < PRODUCERS * MESSAGES;) {
+    auto entry = queue.peek(0);
+    if (!entry) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    int producer;
+    int sequence;
+    std::memcpy(&producer, entry->data(), sizeof(int));
+    std::memcpy(&sequence, entry->data() + sizeof(int), sizeof(int));
+    ASSERT_EQ(sequence, next[producer]++);
+
+    queue.pop_front();
+    ++received;
+  }
+
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(queue.empty());
+}
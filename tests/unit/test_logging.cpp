@@ -5,9 +5,14 @@
 #include "../tests_common.h"
 #include "../tests_log_checker.h"
 
+#include <algorithm>
 #include <format>
 #include <random>
 #include <src/logging.h>
+#include <src/utility.h>
+#include <thread>
+
+using namespace std::literals;
 
 namespace {
   std::array log_levels = {
@@ -45,3 +50,79 @@ TEST_P(LogLevelsTest, PutMessage) {
 
   ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
 }
+
+TEST(LineRingTests, KeepsLastLines) {
+  logging::line_ring_t ring {3};
+  for (int x = 0; x < 5; ++x) {
+    ring.push(std::to_string(x));
+  }
+
+  auto [next, lines] = ring.since(0);
+  ASSERT_EQ(next, 5);
+  ASSERT_EQ(lines, (std::vector<std::string> {"2", "3", "4"}));
+
+  std::tie(next, lines) = ring.since(4);
+  ASSERT_EQ(lines, std::vector<std::string> {"4"});
+
+  std::tie(next, lines) = ring.since(next);
+  ASSERT_EQ(next, 5);
+  ASSERT_TRUE(lines.empty());
+}
+
+TEST(LineRingTests, FollowsLog) {
+  auto [first, _] = logging::recent_lines(0);
+
+  std::random_device rand_dev;
+  std::mt19937_64 rand_gen(rand_dev());
+  auto test_message = std::format("{}{}", rand_gen(), rand_gen());
+  BOOST_LOG(info) << test_message;
+  logging::log_flush();
+
+  auto [next, lines] = logging::recent_lines(first);
+  ASSERT_GT(next, first);
+  ASSERT_TRUE(std::ranges::any_of(lines, [&](const std::string &line) {
+    return line.ends_with("Info: " + test_message);
+  }));
+}
+
+TEST(HotPathLoggingTests, SkipsFilteredStatements) {
+  auto previous = logging::min_level.exchange(logging::level::info);
+  auto guard = util::fail_guard([previous]() {
+    logging::min_level = previous;
+  });
+
+  int evaluated = 0;
+  auto value = [&]() {
+    return ++evaluated;
+  };
+
+  SUNSHINE_LOG(debug) << value();
+  ASSERT_EQ(evaluated, 0);
+
+  SUNSHINE_LOG(info) << value();
+  ASSERT_EQ(evaluated, 1);
+}
+
+TEST(HotPathLoggingTests, FormatsEvents) {
+  std::array<std::int64_t, 2> args {42, -1};
+  ASSERT_EQ(logging::format_event("Frame [{}] shards [{}]", args), "Frame [42] shards [-1]");
+  ASSERT_EQ(logging::format_event("{}{}", args), "42-1");
+  ASSERT_EQ(logging::format_event("Frame [{}] [{}] [{}]", args), "Frame [42] [-1] [{}]");
+  ASSERT_EQ(logging::format_event("No arguments", {}), "No arguments");
+}
+
+TEST(HotPathLoggingTests, LogsEvents) {
+  std::random_device rand_dev;
+  std::mt19937_64 rand_gen(rand_dev());
+  auto test_value = (std::int64_t) (rand_gen() >> 1);
+  logging::log_event("Test event [{}]", test_value);
+
+  // The events are logged by another thread, a few times a second
+  auto test_message = std::format("Test event [{}]", test_value);
+  for (int x = 0; x < 40 && !log_checker::line_contains(log_file, test_message); ++x) {
+    std::this_thread::sleep_for(50ms);
+    logging::log_flush();
+  }
+
+  ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
+}
@@ -0,0 +1,305 @@
+/**
+ * @file tests/unit/test_metrics.cpp
+ * @brief Test src/metrics.*
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <format>
+#include <mutex>
+#include <src/metrics.h>
+#include <thread>
+
+TEST(MetricsTests, HistogramCountsValuesIntoBuckets) {
+  metrics::histogram_t histogram {1.0, 2.0, 4.0};
+
+  histogram.observe(0.5);
+  histogram.observe(1.0);
+  histogram.observe(3.0);
+  histogram.observe(10.0);
+
+  EXPECT_EQ(histogram.bucket(0), 2);
+  EXPECT_EQ(histogram.bucket(1), 0);
+  EXPECT_EQ(histogram.bucket(2), 1);
+  EXPECT_EQ(histogram.bucket(3), 1);
+  EXPECT_EQ(histogram.count(), 4);
+  EXPECT_DOUBLE_EQ(histogram.sum(), 14.5);
+}
+
+TEST(MetricsTests, HistogramCountsConcurrentObservations) {
+  metrics::histogram_t histogram {1.0};
+
+  std::vector<std::thread> threads;
+  for (int x = 0; x < 4; ++x) {
+    threads.emplace_back([&histogram]() {
+      for (int y = 0; y < 10000; ++y) {
+        histogram.observe(y % 2 ? 0.5 : 2.0);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(histogram.bucket(0), 20000);
+  EXPECT_EQ(histogram.bucket(1), 20000);
+  EXPECT_EQ(histogram.count(), 40000);
+}
+
+TEST(MetricsTests, ExposesCumulativeHistogramBuckets) {
+  auto before = metrics::video.send_batch_seconds.count();
+  metrics::video.send_batch_seconds.observe(0.0002);
+  metrics::video.send_batch_seconds.observe(1.0);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_video_send_batch_seconds histogram\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_video_send_batch_seconds_bucket{le=\"+Inf\"} " + std::to_string(before + 2) + "\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_video_send_batch_seconds_count " + std::to_string(before + 2) + "\n"), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesCounters) {
+  auto before = metrics::input.events.value();
+  metrics::input.events.add(3);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_input_events_total counter\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_events_total " + std::to_string(before + 3) + "\n"), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesInputInjectionLatency) {
+  auto before = metrics::input.injection_latency_seconds.count();
+  metrics::input.injection_latency_seconds.observe(0.0003);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_input_injection_latency_seconds histogram\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_injection_latency_seconds_count " + std::to_string(before + 1) + "\n"), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesInputHistogramsByType) {
+  auto &gamepad = metrics::input.types[metrics::input_t::gamepad];
+  auto before = gamepad.batched_messages.count();
+  gamepad.batched_messages.observe(3);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_input_batched_messages histogram\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_batched_messages_bucket{type=\"gamepad\",le=\"+Inf\"} " + std::to_string(before + 1) + "\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_batched_messages_count{type=\"gamepad\"} " + std::to_string(before + 1) + "\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_os_injection_seconds_count{type=\"mouse\"} "), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesInjectionLatencyByLane) {
+  auto &lane = metrics::input.lanes[2];
+  auto before = lane.injection_latency_seconds.count();
+  lane.injection_latency_seconds.observe(0.002);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_input_lane_injection_latency_seconds histogram\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_lane_injection_latency_seconds_count{lane=\"gamepad1\"} " + std::to_string(before + 1) + "\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_lane_injection_latency_seconds_count{lane=\"desktop\"} "), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesGamepadEventsByResult) {
+  auto suppressed = metrics::input.gamepad_updates_suppressed.value();
+  auto coalesced = metrics::input.gamepad_motion_coalesced.value();
+  metrics::input.gamepad_updates_suppressed.add();
+  metrics::input.gamepad_motion_coalesced.add(2);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_input_gamepad_updates_total counter\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_gamepad_updates_total{result=\"suppressed\"} " + std::to_string(suppressed + 1) + "\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_gamepad_updates_total{result=\"forwarded\"} "), std::string::npos);
+  EXPECT_NE(text.find("sunshine_input_gamepad_motion_total{result=\"coalesced\"} " + std::to_string(coalesced + 2) + "\n"), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesDroppedFramesByReason) {
+  auto replaced = metrics::video.frames_dropped.value();
+  auto stale = metrics::video.frames_dropped_stale.value();
+  metrics::video.frames_dropped_stale.add();
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_video_frames_dropped_total counter\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_video_frames_dropped_total{reason=\"replaced\"} " + std::to_string(replaced) + "\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_video_frames_dropped_total{reason=\"stale\"} " + std::to_string(stale + 1) + "\n"), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesIdleTimeInSeconds) {
+  auto before = metrics::video.idle_milliseconds.value();
+  metrics::video.idle_milliseconds.add(1500);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("# TYPE sunshine_video_idle_seconds_total counter\n"), std::string::npos);
+  EXPECT_NE(text.find(std::format("sunshine_video_idle_seconds_total {}\n", (before + 1500) / 1000.0)), std::string::npos);
+  EXPECT_NE(text.find("# TYPE sunshine_video_idle gauge\n"), std::string::npos);
+}
+
+TEST(MetricsTests, CountsGpuMemoryWhileAllocated) {
+  auto &bytes = metrics::gpu_memory.bytes[metrics::gpu_memory_t::convert];
+  auto before = bytes.load();
+
+  {
+    metrics::gpu_allocation_t allocation {metrics::gpu_memory_t::convert, 4096};
+    auto moved = std::move(allocation);
+    EXPECT_EQ(bytes.load(), before + 4096);
+
+    auto text = metrics::expose();
+    EXPECT_NE(text.find("# TYPE sunshine_video_gpu_memory_bytes gauge\n"), std::string::npos);
+    EXPECT_NE(text.find("sunshine_video_gpu_memory_bytes{stage=\"convert\"} " + std::to_string(before + 4096) + "\n"), std::string::npos);
+  }
+
+  EXPECT_EQ(bytes.load(), before);
+}
+
+TEST(MetricsTests, ExposesSessionsUntilDestroyed) {
+  auto session = metrics::add_session(4242);
+  session->target_bitrate.set(12'345'678);
+  session->bitrate_changes.add(2);
+  session->video_bytes.add(1500);
+  session->video_frames.add();
+  session->video_fec_percentage.set(15);
+  session->video_frames_unrecovered.add();
+  session->video_idr_frames_avoided.add(4);
+  session->video_idr_requests_debounced.add(2);
+  session->video_recovery_frames.add(5);
+  session->video_frames_dropped_stale.add(6);
+  session->video_nack_shards_requested.add(3);
+  session->video_nack_shards_retransmitted.add(2);
+  session->video_encryption_nanoseconds.add(1'500'000);
+  session->audio_parity_shards.set(1);
+  session->loss_reports.add();
+  session->gamepad_feedback_duplicates.add(3);
+  session->control_bytes.add(120);
+  session->control_packets.add(2);
+  session->rtt_seconds.set(0.004);
+  session->ping_jitter_seconds.set(0.0005);
+  session->path_mtu_bytes.set(1500);
+  session->video_datagram_bytes.set(1464);
+  session->video_psnr_db.set(42.5);
+  session->video_ssim.set(0.98);
+
+  auto text = metrics::expose();
+  EXPECT_NE(text.find("sunshine_session_video_target_bitrate_bits{session=\"4242\"} 12345678\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_bitrate_changes_total{session=\"4242\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_sent_bytes_total{session=\"4242\"} 1500\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_frames_sent_total{session=\"4242\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_fec_percentage{session=\"4242\"} 15\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_frames_unrecovered_total{session=\"4242\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_idr_frames_avoided_total{session=\"4242\"} 4\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_idr_requests_debounced_total{session=\"4242\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_recovery_frames_total{session=\"4242\"} 5\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_frames_dropped_stale_total{session=\"4242\"} 6\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_nack_shards_requested_total{session=\"4242\"} 3\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_nack_shards_retransmitted_total{session=\"4242\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_encryption_seconds_total{session=\"4242\"} 0.0015\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_audio_fec_parity_shards{session=\"4242\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_loss_reports_total{session=\"4242\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_gamepad_feedback_duplicates_total{session=\"4242\"} 3\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_control_sent_bytes_total{session=\"4242\"} 120\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_control_sent_packets_total{session=\"4242\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_rtt_seconds{session=\"4242\"} 0.004\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_ping_jitter_seconds{session=\"4242\"} 0.0005\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_path_mtu_bytes{session=\"4242\"} 1500\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_datagram_bytes{session=\"4242\"} 1464\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_psnr_db{session=\"4242\"} 42.5\n"), std::string::npos);
+  EXPECT_NE(text.find("sunshine_session_video_ssim{session=\"4242\"} 0.98\n"), std::string::npos);
+
+  session.reset();
+  EXPECT_EQ(metrics::expose().find("session=\"4242\""), std::string::npos);
+}
+
+TEST(MetricsTests, ExposesThreadsUntilTheyExit) {
+  if (!platf::current_thread()) {
+    GTEST_SKIP() << "The threads of this system can't be sampled";
+  }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  bool added = false;
+  bool done = false;
+
+  std::thread thread {[&]() {
+    metrics::add_thread("test_role");
+    metrics::set_thread_frame(77);
+
+    std::unique_lock ul {lock};
+    added = true;
+    cv.notify_all();
+    cv.wait(ul, [&]() {
+      return done;
+    });
+  }};
+
+  {
+    std::unique_lock ul {lock};
+    cv.wait(ul, [&]() {
+      return added;
+    });
+  }
+
+  auto text = metrics::expose();
+  auto cpu_seconds = text.find("sunshine_thread_cpu_seconds_total{role=\"test_role\",thread=\"");
+  EXPECT_NE(cpu_seconds, std::string::npos);
+  auto frame = text.find("sunshine_thread_frame{role=\"test_role\",thread=\"");
+  ASSERT_NE(frame, std::string::npos);
+  EXPECT_EQ(text.substr(text.find(' ', frame), 4), " 77\n");
+#ifdef __linux__
+  auto realtime_priority = text.find("sunshine_thread_realtime_priority{role=\"test_role\",thread=\"");
+  ASSERT_NE(realtime_priority, std::string::npos);
+  EXPECT_EQ(text.substr(text.find(' ', realtime_priority), 3), " 0\n");
+#endif
+
+  {
+    std::lock_guard lg {lock};
+    done = true;
+  }
+  cv.notify_all();
+  thread.join();
+
+  EXPECT_EQ(metrics::expose().find("role=\"test_role\""), std::string::npos);
+}
+
+TEST(MetricsTests, SamplesSessionRates) {
+  auto session = metrics::add_session(4343);
+  metrics::session_sampler_t sampler;
+
+  auto now = std::chrono::steady_clock::now();
+  session->video_frames.add(10);
+  session->video_bytes.add(1000);
+
+  auto find = [](const std::vector<metrics::session_sampler_t::stats_t> &stats) {
+    auto it = std::find_if(std::begin(stats), std::end(stats), [](auto &stats) {
+      return stats.id == 4343;
+    });
+    EXPECT_NE(it, std::end(stats));
+    return it == std::end(stats) ? metrics::session_sampler_t::stats_t {} : *it;
+  };
+
+  // Nothing to compare the first sample to
+  auto first = find(sampler.sample(now));
+  EXPECT_EQ(first.fps, 0);
+  EXPECT_EQ(first.bitrate, 0);
+
+  session->video_frames.add(60);
+  session->video_bytes.add(125'000);
+  session->video_fec_data_shards.add(90);
+  session->video_fec_parity_shards.add(10);
+  session->video_packets_lost.add(5);
+  session->target_bitrate.set(2'000'000);
+  session->control_bytes.add(500);
+  session->control_packets.add(10);
+
+  auto second = find(sampler.sample(now + std::chrono::milliseconds {500}));
+  EXPECT_DOUBLE_EQ(second.fps, 120);
+  EXPECT_DOUBLE_EQ(second.bitrate, 2'000'000);
+  EXPECT_DOUBLE_EQ(second.target_bitrate, 2'000'000);
+  EXPECT_EQ(second.packets_lost, 5);
+  EXPECT_DOUBLE_EQ(second.loss_percentage, 5);
+  EXPECT_DOUBLE_EQ(second.control_bitrate, 8'000);
+  EXPECT_DOUBLE_EQ(second.control_packets_per_second, 20);
+
+  session.reset();
+  auto stats = sampler.sample(now + std::chrono::seconds {1});
+  EXPECT_TRUE(std::none_of(std::begin(stats), std::end(stats), [](auto &stats) {
+    return stats.id == 4343;
+  }));
+}
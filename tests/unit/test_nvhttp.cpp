@@ -0,0 +1,141 @@
+/**
+ * @file tests/unit/test_nvhttp.cpp
+ * @brief Test src/nvhttp.*
+ */
+#include "../tests_common.h"
+
+#include <filesystem>
+#include <fstream>
+#include <src/nvhttp.h>
+
+TEST(ResponseCacheTests, BuildsEachKeyOnce) {
+  nvhttp::response_cache_t cache;
+  int builds = 0;
+  auto build = [&]() {
+    return std::to_string(++builds);
+  };
+
+  ASSERT_EQ(*cache.get("a", build), "1");
+  ASSERT_EQ(*cache.get("a", build), "1");
+  ASSERT_EQ(*cache.get("b", build), "2");
+
+  ASSERT_EQ(cache.hits(), 1);
+  ASSERT_EQ(cache.misses(), 2);
+}
+
+TEST(ResponseCacheTests, RebuildsAfterInvalidate) {
+  nvhttp::response_cache_t cache;
+  int builds = 0;
+  auto build = [&]() {
+    return std::to_string(++builds);
+  };
+
+  auto first = cache.get("a", build);
+  cache.invalidate();
+  ASSERT_EQ(*cache.get("a", build), "2");
+
+  // Responses already handed out stay valid
+  ASSERT_EQ(*first, "1");
+}
+
+TEST(ResponseCacheTests, DoesNotKeepResponseInvalidatedWhileBuilding) {
+  nvhttp::response_cache_t cache;
+
+  auto stale = cache.get("a", [&]() {
+    cache.invalidate();
+    return std::string {"stale"};
+  });
+  auto fresh = cache.get("a", []() {
+    return std::string {"fresh"};
+  });
+
+  ASSERT_EQ(*stale, "stale");
+  ASSERT_EQ(*fresh, "fresh");
+}
+
+TEST(ResponseCacheTests, InvalidatesKeysWithPrefix) {
+  nvhttp::response_cache_t cache;
+  int builds = 0;
+  auto build = [&]() {
+    return std::to_string(++builds);
+  };
+
+  cache.get("applist|1", build);
+  cache.get("serverinfo|1", build);
+  cache.invalidate("applist|");
+
+  EXPECT_EQ(*cache.get("applist|1", build), "3");
+  EXPECT_EQ(*cache.get("serverinfo|1", build), "2");
+
+  // A response being built when its key is invalidated isn't kept
+  auto stale = cache.get("applist|2", [&]() {
+    cache.invalidate("applist|");
+    return std::string {"stale"};
+  });
+  EXPECT_EQ(*stale, "stale");
+  EXPECT_EQ(*cache.get("applist|2", build), "4");
+}
+
+struct ImageCacheTest: testing::Test {
+  void SetUp() override {
+    directory = std::filesystem::temp_directory_path() / "sunshine_test_image_cache";
+    std::filesystem::create_directories(directory);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(directory);
+  }
+
+  std::filesystem::path write(const std::string &name, const std::string &contents) {
+    auto path = directory / name;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << contents;
+    return path;
+  }
+
+  std::filesystem::path directory;
+};
+
+TEST_F(ImageCacheTest, KeepsImageUntilFileChanges) {
+  nvhttp::image_cache_t cache;
+  auto path = write("a.png", "first");
+
+  auto image = cache.get(path);
+  ASSERT_TRUE(image);
+  EXPECT_EQ(image->data, "first");
+  EXPECT_EQ(cache.get(path), image);
+
+  write("a.png", "second image");
+  auto changed = cache.get(path);
+  ASSERT_TRUE(changed);
+  EXPECT_EQ(changed->data, "second image");
+  EXPECT_NE(changed->etag, image->etag);
+
+  EXPECT_FALSE(cache.get(directory / "missing.png"));
+}
+
+TEST_F(ImageCacheTest, DropsLeastRecentlyUsedImages) {
+  nvhttp::image_cache_t cache {10};
+  auto a = write("a.png", "aaaa");
+  auto b = write("b.png", "bbbb");
+  auto c = write("c.png", "cccc");
+
+  auto image_a = cache.get(a);
+  auto image_b = cache.get(b);
+  EXPECT_EQ(cache.get(a), image_a);
+
+  // b was used least recently
+  cache.get(c);
+  EXPECT_EQ(cache.get(a), image_a);
+  EXPECT_NE(cache.get(b), image_b);
+}
+
+TEST(EtagTests, MatchesIfNoneMatch) {
+  EXPECT_TRUE(nvhttp::etag_matches("\"abc\"", "\"abc\""));
+  EXPECT_TRUE(nvhttp::etag_matches("\"xyz\", W/\"abc\"", "\"abc\""));
+  EXPECT_TRUE(nvhttp::etag_matches("*", "\"abc\""));
+
+  EXPECT_FALSE(nvhttp::etag_matches("\"abcd\"", "\"abc\""));
+  EXPECT_FALSE(nvhttp::etag_matches("", "\"abc\""));
+  EXPECT_FALSE(nvhttp::etag_matches(" , ", "\"abc\""));
+}
@@ -0,0 +1,234 @@
+/**
+ * @file tests/unit/test_process.cpp
+ * @brief Test src/process.*
+ */
+#include "../tests_common.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <src/process.h>
+#include <thread>
+
+using namespace std::literals;
+
+struct ImageHashCacheTest: testing::Test {
+  void SetUp() override {
+    directory = std::filesystem::temp_directory_path() / "sunshine_test_image_hashes";
+    std::filesystem::create_directories(directory);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(directory);
+  }
+
+  std::string write(const std::string &name, const std::string &contents) {
+    auto path = directory / name;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << contents;
+    return path.string();
+  }
+
+  std::filesystem::path directory;
+};
+
+TEST_F(ImageHashCacheTest, HashesImages) {
+  proc::image_hash_cache_t cache;
+  auto a = write("a.png", "a");
+  auto b = write("b.png", "b");
+
+  auto hashes = cache.hash({a, "", b, (directory / "missing.png").string()});
+  ASSERT_EQ(hashes.size(), 4);
+  EXPECT_EQ(hashes[0], proc::calculate_sha256(a));
+  EXPECT_EQ(hashes[1], std::nullopt);
+  EXPECT_EQ(hashes[2], proc::calculate_sha256(b));
+  EXPECT_EQ(hashes[3], std::nullopt);
+}
+
+TEST_F(ImageHashCacheTest, HashesImageAgainWhenItChanges) {
+  proc::image_hash_cache_t cache;
+  auto a = write("a.png", "first");
+
+  auto first = cache.hash({a});
+  write("a.png", "second image");
+  auto second = cache.hash({a});
+
+  EXPECT_NE(first[0], second[0]);
+  EXPECT_EQ(second[0], proc::calculate_sha256(a));
+}
+
+TEST_F(ImageHashCacheTest, KeepsHashesAcrossRestarts) {
+  auto file_name = (directory / "app_image_hashes.json").string();
+  auto a = write("a.png", "a");
+
+  {
+    proc::image_hash_cache_t cache;
+    cache.load(file_name);
+    cache.hash({a});
+    cache.save();
+  }
+  ASSERT_TRUE(std::filesystem::exists(file_name));
+
+  // A hash loaded from the file is trusted as long as the image looks the same
+  std::string saved;
+  {
+    std::ifstream in(file_name);
+    saved.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  auto hash = *proc::calculate_sha256(a);
+  auto pos = saved.find(hash);
+  ASSERT_NE(pos, std::string::npos);
+  saved.replace(pos, hash.size(), std::string(hash.size(), '0'));
+  {
+    std::ofstream out(file_name, std::ios::trunc);
+    out << saved;
+  }
+
+  proc::image_hash_cache_t cache;
+  cache.load(file_name);
+  EXPECT_EQ(cache.hash({a})[0], std::string(hash.size(), '0'));
+}
+
+TEST(ProcTests, UpdateReportsChangedApps) {
+  auto app = [](const std::string &id, const std::string &cmd) {
+    proc::ctx_t ctx {};
+    ctx.id = id;
+    ctx.name = "App " + id;
+    ctx.cmd = cmd;
+    return ctx;
+  };
+
+  proc::proc_t proc {boost::process::v1::environment {}, {app("1", "a"), app("2", "b"), app("3", "c")}};
+  auto changed = proc.update({boost::process::v1::environment {}, {app("1", "a"), app("2", "changed"), app("4", "d")}});
+
+  EXPECT_EQ(changed, (std::set<std::string> {"2", "3", "4"}));
+  ASSERT_EQ(proc.get_apps().size(), 3);
+  EXPECT_EQ(proc.get_apps()[1].cmd, "changed");
+
+  EXPECT_TRUE(proc.update({boost::process::v1::environment {}, {app("1", "a"), app("2", "changed"), app("4", "d")}}).empty());
+}
+
+TEST(ProcTests, AppsCanBeReadWhileUpdated) {
+  auto apps = [](std::size_t count) {
+    std::vector<proc::ctx_t> apps(count);
+    for (std::size_t x = 0; x < count; ++x) {
+      apps[x].id = std::to_string(x);
+      apps[x].name = "App " + apps[x].id;
+    }
+    return apps;
+  };
+
+  proc::proc_t proc {boost::process::v1::environment {}, apps(1)};
+
+  std::atomic<bool> done {false};
+  std::thread updater {[&]() {
+    for (std::size_t x = 0; x < 1000; ++x) {
+      proc.update({boost::process::v1::environment {}, apps(x % 8 + 1)});
+    }
+    done = true;
+  }};
+
+  // Each copy is one of the lists of apps, never a mix of two of them
+  while (!done) {
+    auto copy = proc.get_apps();
+    if (copy.empty()) {
+      ADD_FAILURE() << "Read an empty list of apps";
+      break;
+    }
+    EXPECT_EQ(copy.back().id, std::to_string(copy.size() - 1));
+  }
+
+  updater.join();
+}
+
+TEST(ProcTests, EditsAppsInMemoryAndWritesThemLater) {
+  auto directory = std::filesystem::temp_directory_path() / "sunshine_test_apps_model";
+  std::filesystem::create_directories(directory);
+  auto file_name = (directory / "apps.json").string();
+  {
+    std::ofstream out(file_name, std::ios::trunc);
+    out << R"({"env": {}, "apps": [{"name": "Desktop"}]})";
+  }
+
+  ASSERT_TRUE(proc::refresh(file_name));
+  auto loaded = proc::load_apps(file_name);
+  ASSERT_NE(loaded.tree, nullptr);
+  EXPECT_EQ(loaded.tree->at("apps").size(), 1);
+  EXPECT_EQ(proc::load_apps(file_name).version, loaded.version);
+
+  auto changed = proc::edit_apps(file_name, [](nlohmann::json &tree) {
+    tree["apps"].push_back({{"name", "Steam"}});
+  });
+  ASSERT_TRUE(changed);
+  EXPECT_EQ(changed->size(), 1);
+
+  // Served from memory before the file is written
+  auto edited = proc::load_apps(file_name);
+  EXPECT_NE(edited.version, loaded.version);
+  EXPECT_EQ(edited.tree->at("apps").size(), 2);
+
+  // An edit that throws changes nothing
+  EXPECT_THROW(proc::edit_apps(file_name, [](nlohmann::json &tree) {
+    tree["apps"].clear();
+    throw std::out_of_range {"no such app"};
+  }), std::out_of_range);
+  EXPECT_EQ(proc::load_apps(file_name).version, edited.version);
+
+  proc::flush_apps();
+  EXPECT_FALSE(proc::changed_since_refresh(file_name));
+  EXPECT_EQ(nlohmann::json::parse(std::ifstream {file_name})["apps"].size(), 2);
+  EXPECT_EQ(proc::load_apps(file_name).version, edited.version);
+
+  std::filesystem::remove_all(directory);
+}
+
+#ifndef _WIN32
+namespace {
+  proc::ctx_t desktop_with_prep_cmds(std::vector<proc::cmd_t> &&prep_cmds) {
+    proc::ctx_t ctx {};
+    ctx.id = "1";
+    ctx.name = "Desktop";
+    ctx.prep_cmds = std::move(prep_cmds);
+    return ctx;
+  }
+
+  proc::cmd_t prep_cmd(std::string &&do_cmd, bool parallel, std::chrono::seconds timeout = {}) {
+    proc::cmd_t cmd {std::move(do_cmd), false};
+    cmd.parallel = parallel;
+    cmd.timeout = timeout;
+    return cmd;
+  }
+}  // namespace
+
+TEST(ProcTests, RunsParallelPrepCommandsAlongsideEachOther) {
+  std::vector<proc::cmd_t> prep_cmds;
+  prep_cmds.emplace_back(prep_cmd("sleep 0.5", false));
+  prep_cmds.emplace_back(prep_cmd("sleep 0.5", true));
+
+  proc::proc_t proc {boost::process::v1::environment {}, {desktop_with_prep_cmds(std::move(prep_cmds))}};
+  ASSERT_EQ(proc.execute(1, std::make_shared<rtsp_stream::launch_session_t>()), 0);
+  proc.terminate();
+
+  auto timeline = proc::last_launch();
+  EXPECT_TRUE(timeline.launched);
+  ASSERT_EQ(timeline.steps.size(), 2);
+  EXPECT_EQ(timeline.steps[0].exit_code, 0);
+  EXPECT_EQ(timeline.steps[1].exit_code, 0);
+  EXPECT_LT(timeline.prep, 900ms);
+}
+
+TEST(ProcTests, KillsPrepCommandsThatTimeOut) {
+  std::vector<proc::cmd_t> prep_cmds;
+  prep_cmds.emplace_back(prep_cmd("sleep 10", false, 1s));
+
+  proc::proc_t proc {boost::process::v1::environment {}, {desktop_with_prep_cmds(std::move(prep_cmds))}};
+  EXPECT_EQ(proc.execute(1, std::make_shared<rtsp_stream::launch_session_t>()), -1);
+
+  auto timeline = proc::last_launch();
+  EXPECT_FALSE(timeline.launched);
+  ASSERT_EQ(timeline.steps.size(), 1);
+  EXPECT_TRUE(timeline.steps[0].timed_out);
+  EXPECT_EQ(timeline.steps[0].exit_code, std::nullopt);
+  EXPECT_LT(timeline.duration, 5s);
+}
+#endif
@@ -2,6 +2,10 @@
  * @file tests/unit/test_rswrapper.cpp
  * @brief Test src/rswrapper.*
  */
+// standard includes
+#include <algorithm>
+#include <vector>
+
 extern "C" {
 #include <src/rswrapper.h>
 }
@@ -34,3 +38,77 @@ TEST(ReedSolomonWrapperTests, EncodeTest) {
 
   reed_solomon_release(rs);
 }
+
+TEST(ReedSolomonWrapperTests, VariantsMatchTest) {
+  reed_solomon_init();
+  ASSERT_NE(reed_solomon_variant_name(), nullptr);
+
+  constexpr int dataShards = 20;
+  constexpr int parityShards = 4;
+  constexpr int totalShards = dataShards + parityShards;
+
+  auto shard_ptrs = [](std::vector<uint8_t> &buffer, int blockSize) {
+    std::vector<uint8_t *> shardPtrs(totalShards);
+    for (int x = 0; x < totalShards; ++x) {
+      shardPtrs[x] = &buffer[x * blockSize];
+    }
+
+    return shardPtrs;
+  };
+
+  auto encode = [&](const reed_solomon_variant_t &variant, int blockSize, std::vector<uint8_t> &buffer) {
+    buffer.assign(totalShards * blockSize, 0);
+    for (size_t x = 0; x < (size_t) dataShards * blockSize; ++x) {
+      buffer[x] = (uint8_t) (x * 7 + 3);
+    }
+
+    variant.init();
+    auto rs = variant.new_fn(dataShards, parityShards);
+    ASSERT_NE(rs, nullptr);
+
+    auto shardPtrs = shard_ptrs(buffer, blockSize);
+    EXPECT_EQ(variant.encode_fn(rs, shardPtrs.data(), totalShards, blockSize), 0);
+    variant.release_fn(rs);
+  };
+
+  // As many data shards as there are parity shards are lost, the decode has to bring them all back
+  auto decode = [&](const reed_solomon_variant_t &variant, int blockSize, std::vector<uint8_t> &buffer) {
+    uint8_t marks[totalShards] = {};
+    for (int x : {0, 7, 13, dataShards - 1}) {
+      std::fill_n(&buffer[x * blockSize], blockSize, 0);
+      marks[x] = 1;
+    }
+
+    variant.init();
+    auto rs = variant.new_fn(dataShards, parityShards);
+    ASSERT_NE(rs, nullptr);
+
+    auto shardPtrs = shard_ptrs(buffer, blockSize);
+    EXPECT_EQ(variant.decode_fn(rs, shardPtrs.data(), marks, totalShards, blockSize), 0);
+    variant.release_fn(rs);
+  };
+
+  int count;
+  auto variants = reed_solomon_variants(&count);
+  ASSERT_GT(count, 0);
+
+  // The odd block size covers the tail handling of the vector kernels
+  for (int blockSize : {1024, 1037}) {
+    // The last variant is the portable fallback that every other one must agree with
+    std::vector<uint8_t> expected;
+    ASSERT_NO_FATAL_FAILURE(encode(variants[count - 1], blockSize, expected));
+    for (int x = 0; x < count; ++x) {
+      if (!variants[x].supported()) {
+        continue;
+      }
+
+      std::vector<uint8_t> buffer;
+      ASSERT_NO_FATAL_FAILURE(encode(variants[x], blockSize, buffer));
+      ASSERT_EQ(buffer, expected) << "Mismatched parity for " << variants[x].name << " with " << blockSize << " byte blocks";
+
+      // Only the data shards are recovered
+      ASSERT_NO_FATAL_FAILURE(decode(variants[x], blockSize, buffer));
+      ASSERT_TRUE(std::equal(buffer.begin(), buffer.begin() + dataShards * blockSize, expected.begin())) << "Mismatched recovered data for " << variants[x].name << " with " << blockSize << " byte blocks";
+    }
+  }
+}
@@ -0,0 +1,108 @@
+/**
+ * @file tests/unit/test_session_recording.cpp
+ * @brief Test src/session_recording.*
+ */
+#include "../tests_common.h"
+
+#include <src/session_recording.h>
+
+using namespace std::literals;
+
+namespace {
+  std::filesystem::path recording_path() {
+    return std::filesystem::temp_directory_path() / ("test_session_recording_"s + ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".sunrec");
+  }
+}  // namespace
+
+TEST(SessionRecordingTests, ReadsBackRecords) {
+  auto path = recording_path();
+
+  session_recording::config_t config {};
+  config.monitor.width = 2560;
+  config.monitor.height = 1440;
+  config.monitor.framerate = 120;
+  config.monitor.videoFormat = 1;
+  config.packetsize = 1392;
+  config.min_required_fec_packets = 2;
+  config.encryption_flags = 0x1;
+
+  session_recording::video_t video {};
+  video.frame_index = 42;
+  video.idr = true;
+  video.part_count = 2;
+  video.capture_delay = 3ms;
+  video.replacements.emplace_back("\x00\x01"s, "\x02\x03\x04"s);
+
+  auto queued = session_recording::clock::now();
+  {
+    session_recording::writer_t writer {path};
+    ASSERT_TRUE(writer.is_open());
+
+    writer.write_config(config);
+    writer.write_video(queued, video, "frame data"sv);
+    writer.write_control(0x0302, "\x10\x20"sv);
+    writer.write_input("input"sv);
+    writer.write_rtt(12ms);
+  }
+
+  session_recording::reader_t reader {path};
+  ASSERT_TRUE(reader.is_open());
+
+  auto record = reader.next();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, session_recording::record_e::config);
+  EXPECT_EQ(session_recording::decode_config(record->payload), config);
+
+  record = reader.next();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, session_recording::record_e::video);
+  auto decoded = session_recording::decode_video(record->payload);
+  ASSERT_TRUE(decoded);
+  EXPECT_EQ(decoded->first, video);
+  EXPECT_EQ(decoded->second, "frame data"sv);
+
+  record = reader.next();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, session_recording::record_e::control);
+  auto control = session_recording::decode_control(record->payload);
+  ASSERT_TRUE(control);
+  EXPECT_EQ(control->type, 0x0302);
+  EXPECT_EQ(control->payload, "\x10\x20"sv);
+
+  record = reader.next();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, session_recording::record_e::input);
+  EXPECT_EQ(record->payload, "input"sv);
+
+  auto last_time = record->time;
+  record = reader.next();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, session_recording::record_e::rtt);
+  EXPECT_EQ(session_recording::decode_rtt(record->payload), 12ms);
+  EXPECT_GE(record->time, last_time);
+
+  EXPECT_FALSE(reader.next());
+
+  std::filesystem::remove(path);
+}
+
+TEST(SessionRecordingTests, RejectsTruncatedPayloads) {
+  EXPECT_FALSE(session_recording::decode_config("\x01\x00\x00\x00"sv));
+  EXPECT_FALSE(session_recording::decode_video("\x2a\x00\x00\x00"sv));
+  EXPECT_FALSE(session_recording::decode_control("\x01"sv));
+  EXPECT_FALSE(session_recording::decode_rtt(""sv));
+}
+
+TEST(SessionRecordingTests, RejectsOtherFiles) {
+  auto path = recording_path();
+  {
+    std::ofstream file {path, std::ios::binary};
+    file << "not a recording";
+  }
+
+  session_recording::reader_t reader {path};
+  EXPECT_FALSE(reader.is_open());
+  EXPECT_FALSE(reader.next());
+
+  std::filesystem::remove(path);
+}
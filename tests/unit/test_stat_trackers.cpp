@@ -0,0 +1,103 @@
+/**
+ * @file tests/unit/test_stat_trackers.cpp
+ * @brief Test src/stat_trackers.*
+ */
+#include "../tests_common.h"
+
+#include <src/stat_trackers.h>
+#include <thread>
+
+using namespace std::literals;
+
+TEST(StatTrackersTests, HdrHistogramIsEmptyAtFirst) {
+  stat_trackers::hdr_histogram_t histogram;
+
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.percentile(50), 0);
+  EXPECT_EQ(histogram.min(), 0);
+  EXPECT_EQ(histogram.max(), 0);
+  EXPECT_EQ(histogram.mean(), 0);
+}
+
+TEST(StatTrackersTests, HdrHistogramKeepsSmallValuesExact) {
+  stat_trackers::hdr_histogram_t histogram;
+  for (int x = 1; x <= 100; ++x) {
+    histogram.record(x);
+  }
+
+  EXPECT_EQ(histogram.count(), 100);
+  EXPECT_EQ(histogram.percentile(50), 50);
+  EXPECT_EQ(histogram.percentile(90), 90);
+  EXPECT_EQ(histogram.percentile(99), 99);
+  EXPECT_EQ(histogram.percentile(100), 100);
+  EXPECT_EQ(histogram.min(), 1);
+  EXPECT_EQ(histogram.max(), 100);
+  EXPECT_DOUBLE_EQ(histogram.mean(), 50.5);
+}
+
+TEST(StatTrackersTests, HdrHistogramPercentilesAreWithinOnePercent) {
+  stat_trackers::hdr_histogram_t histogram {0.001};
+  for (int x = 1; x <= 100000; ++x) {
+    histogram.record(x * 0.01);
+  }
+
+  for (auto percentile : {50.0, 90.0, 99.0, 99.9}) {
+    auto expected = percentile * 10;
+    EXPECT_NEAR(histogram.percentile(percentile), expected, expected * 0.01) << percentile;
+  }
+  EXPECT_NEAR(histogram.max(), 1000.0, 0.001);
+}
+
+TEST(StatTrackersTests, HdrHistogramShowsRareSpikes) {
+  stat_trackers::hdr_histogram_t histogram {0.001};
+  for (int x = 0; x < 995; ++x) {
+    histogram.record(2.0);
+  }
+  for (int x = 0; x < 5; ++x) {
+    histogram.record(40.0);
+  }
+
+  EXPECT_NEAR(histogram.percentile(99), 2.0, 0.02);
+  EXPECT_NEAR(histogram.percentile(99.9), 40.0, 0.4);
+  EXPECT_NEAR(histogram.mean(), 2.19, 0.001);
+}
+
+TEST(StatTrackersTests, HdrHistogramClampsOutOfRangeValues) {
+  stat_trackers::hdr_histogram_t histogram;
+  histogram.record(-5);
+  histogram.record(1e18);
+
+  EXPECT_EQ(histogram.min(), 0);
+  EXPECT_EQ(histogram.max(), (double) ((std::uint64_t {1} << stat_trackers::hdr_histogram_t::MAX_VALUE_BITS) - 1));
+  EXPECT_EQ(histogram.percentile(50), 0);
+}
+
+TEST(StatTrackersTests, HdrHistogramResets) {
+  stat_trackers::hdr_histogram_t histogram;
+  histogram.record(1000);
+  histogram.reset();
+  histogram.record(3);
+
+  EXPECT_EQ(histogram.count(), 1);
+  EXPECT_EQ(histogram.percentile(100), 3);
+  EXPECT_EQ(histogram.max(), 3);
+}
+
+TEST(StatTrackersTests, PercentileTrackerCallsBackOnInterval) {
+  stat_trackers::percentile_tracker<int> tracker {1.0};
+
+  int calls = 0;
+  auto callback = [&](const stat_trackers::hdr_histogram_t &histogram) {
+    ++calls;
+    EXPECT_EQ(histogram.count(), 1);
+    EXPECT_EQ(histogram.percentile(100), 5);
+  };
+
+  tracker.collect_and_callback_on_interval(5, callback, 0s);
+  EXPECT_EQ(calls, 0);
+
+  // The values collected so far are reported before the next one is collected
+  std::this_thread::sleep_for(1ms);
+  tracker.collect_and_callback_on_interval(7, callback, 0s);
+  EXPECT_EQ(calls, 1);
+}
@@ -3,37 +3,874 @@
  * @brief Test src/stream.*
  */
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "../tests_common.h"
+
+#include <src/stream.h>
+
 namespace stream {
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  void apply_splices(std::vector<uint8_t> &head, std::string_view &tail, const std::vector<video::packet_raw_t::splice_t> &splices);
 }
 
-#include "../tests_common.h"
+TEST(ApplySplicesTests, CopiesOnlyUpToLastSplice) {
+  std::string payload = "aaOLDaaOTHERbbbbbbbb";
+  std::vector<uint8_t> head;
+  std::string_view tail = payload;
+
+  stream::apply_splices(head, tail, {{2, "OLD", "NEW!"}, {7, "OTHER", "O"}});
+
+  ASSERT_EQ(std::string((char *) head.data(), head.size()), "aaNEW!aaO");
+  ASSERT_EQ(tail, "bbbbbbbb");
+  ASSERT_EQ(tail.data(), payload.data() + 12);
+}
+
+TEST(ApplySplicesTests, SkipsSplicesPastPayload) {
+  std::string payload = "aaaabbbb";
+  std::vector<uint8_t> head;
+  std::string_view tail = payload;
+
+  stream::apply_splices(head, tail, {{6, "OLD", "NEW"}});
+
+  ASSERT_TRUE(head.empty());
+  ASSERT_EQ(tail.data(), payload.data());
+  ASSERT_EQ(tail.size(), payload.size());
+}
+
+TEST(FecSliceTests, DataShardsPointIntoPayload) {
+  constexpr size_t blocksize = 16;
+
+  char frame_header[4] = {1, 2, 3, 4};
+  std::vector<char> frame(100);
+  for (size_t x = 0; x < frame.size(); ++x) {
+    frame[x] = (char) x;
+  }
+
+  std::string_view payload[] = {
+    {frame_header, sizeof(frame_header)},
+    {frame.data(), frame.size()},
+  };
+  auto payload_size = sizeof(frame_header) + frame.size();
+
+  auto shards = stream::fec::slice(payload, 0, payload_size, blocksize, 0, 0, 8, 0);
+  ASSERT_EQ(shards.data_shards, (payload_size + blocksize - 1) / blocksize);
+  ASSERT_EQ(shards.size(), shards.data_shards);
+
+  // The first shard straddles the frame header and the final shard is padded, so they're copied
+  for (size_t x = 1; x < shards.data_shards - 1; ++x) {
+    ASSERT_EQ(shards.data(x), frame.data() + x * blocksize - sizeof(frame_header));
+  }
+
+  std::string expected {frame_header, sizeof(frame_header)};
+  expected.append(frame.data(), frame.size());
+  expected.resize(shards.data_shards * blocksize, '\0');
+  for (size_t x = 0; x < shards.data_shards; ++x) {
+    ASSERT_EQ(std::string_view(shards.data(x), blocksize), std::string_view(expected).substr(x * blocksize, blocksize));
+  }
+}
+
+TEST(FecSliceTests, WritableShardsLeavePayloadUntouched) {
+  reed_solomon_init();
+
+  constexpr size_t blocksize = 16;
+
+  std::vector<char> frame(100);
+  for (size_t x = 0; x < frame.size(); ++x) {
+    frame[x] = (char) x;
+  }
+  auto original = frame;
+  std::string_view payload[] = {{frame.data(), frame.size()}};
+
+  stream::fec::rs_cache_t rs_cache;
+  auto plain = stream::fec::slice(payload, 0, frame.size(), blocksize, 20, 2, 8, 0);
+  auto writable = stream::fec::slice(payload, 0, frame.size(), blocksize, 20, 2, 8, 0, true);
+  stream::fec::encode(plain, rs_cache);
+  stream::fec::encode(writable, rs_cache);
+
+  for (size_t x = 0; x < writable.data_shards; ++x) {
+    // The final shard is padded, so it's copied and read from its own buffer
+    if (x < writable.data_shards - 1) {
+      ASSERT_EQ(writable.source(x), frame.data() + x * blocksize);
+    }
+    ASSERT_EQ(std::string_view(writable.source(x), blocksize), std::string_view(plain.data(x), blocksize));
+
+    // Every data shard has a buffer of its own to write to
+    ASSERT_TRUE(writable.data(x) < frame.data() || writable.data(x) >= frame.data() + frame.size());
+    std::memset(writable.data(x), 0xFF, blocksize);
+  }
+
+  // Parity is computed over the payload, which writing the shards doesn't change
+  for (size_t x = writable.data_shards; x < writable.size(); ++x) {
+    ASSERT_EQ(std::string_view(writable.data(x), blocksize), std::string_view(plain.data(x), blocksize));
+  }
+  ASSERT_EQ(frame, original);
+}
+
+TEST(FecSliceTests, SplitParityMatchesContiguousShards) {
+  reed_solomon_init();
+
+  constexpr size_t headersize = 32;
+  constexpr size_t blocksize = 200;
+
+  std::vector<char> frame(3000);
+  for (size_t x = 0; x < frame.size(); ++x) {
+    frame[x] = (char) (x * 13 + 1);
+  }
+  std::string_view payload[] = {{frame.data(), frame.size()}};
+
+  stream::fec::rs_cache_t rs_cache;
+  auto shards = stream::fec::slice(payload, 0, frame.size(), blocksize, 20, 2, headersize, 0);
+  for (size_t x = 0; x < shards.data_shards; ++x) {
+    std::memset(shards.header(x), (int) x + 1, headersize);
+  }
+
+  // Build the same shards with each header followed by its payload
+  std::vector<std::vector<uint8_t>> contiguous(shards.size(), std::vector<uint8_t>(headersize + blocksize));
+  std::vector<uint8_t *> contiguous_p;
+  for (size_t x = 0; x < shards.size(); ++x) {
+    if (x < shards.data_shards) {
+      std::memcpy(contiguous[x].data(), shards.header(x), headersize);
+      std::memcpy(contiguous[x].data() + headersize, shards.data(x), blocksize);
+    }
+    contiguous_p.push_back(contiguous[x].data());
+  }
+
+  stream::fec::encode(shards, rs_cache);
+
+  stream::fec::rs_t rs {reed_solomon_new(shards.data_shards, shards.size() - shards.data_shards)};
+  reed_solomon_encode(rs.get(), contiguous_p.data(), shards.size(), headersize + blocksize);
+
+  for (size_t x = shards.data_shards; x < shards.size(); ++x) {
+    ASSERT_EQ(std::memcmp(contiguous[x].data(), shards.header(x), headersize), 0);
+    ASSERT_EQ(std::memcmp(contiguous[x].data() + headersize, shards.data(x), blocksize), 0);
+  }
+}
+
+TEST(FecSliceTests, DoesntAllocateAfterWarmUp) {
+  reed_solomon_init();
+
+  constexpr size_t headersize = 32;
+  constexpr size_t prefixsize = 32;
+  constexpr size_t blocksize = 1024;
+
+  char frame_header[8] {};
+  std::vector<char> frame(40000, 'x');
+  std::string_view payload[] = {
+    {frame_header, sizeof(frame_header)},
+    {frame.data(), frame.size()},
+  };
+
+  stream::fec::rs_cache_t rs_cache;
+  auto send_frame = [&]() {
+    // Two FEC blocks in flight at once, like the broadcast thread with FEC workers
+    auto first = stream::fec::slice(payload, 0, 20 * blocksize, blocksize, 20, 2, headersize, prefixsize);
+    auto second = stream::fec::slice(payload, 20 * blocksize, sizeof(frame_header) + frame.size() - 20 * blocksize, blocksize, 20, 2, headersize, prefixsize);
+    stream::fec::encode(first, rs_cache);
+    stream::fec::encode(second, rs_cache);
+  };
+
+  // The first frame fills the packet pool and the Reed-Solomon encoder cache
+  send_frame();
+
+  // Every buffer of a FEC block comes from the packet pool, and only a cache miss creates an encoder
+  auto allocations = buffer_pool::packets().stats().allocations;
+  auto misses = rs_cache.misses();
+  for (int x = 0; x < 10; ++x) {
+    send_frame();
+  }
+
+  EXPECT_EQ(buffer_pool::packets().stats().allocations, allocations);
+  EXPECT_EQ(rs_cache.misses(), misses);
+}
+
+TEST(VideoShardsTests, SessionsSharingAPacketGetTheirOwnShards) {
+  reed_solomon_init();
+
+  constexpr size_t blocksize = 256;
+
+  std::vector<uint8_t> frame(5000);
+  for (size_t x = 0; x < frame.size(); ++x) {
+    frame[x] = (uint8_t) (x * 7 + 1);
+  }
+
+  auto make_packet = [&]() {
+    buffer_pool::buffer_t<uint8_t> data {frame.size()};
+    std::copy(std::begin(frame), std::end(frame), data.begin());
+    return std::make_shared<video::packet_raw_generic>(std::move(data), 1, true);
+  };
+
+  crypto::aes_t key(16, 0x42);
+  stream::fec::rs_cache_t rs_cache;
+  metrics::session_t session_metrics {1};
+
+  // Build and finalize every shard of the frame for a session, like its broadcast thread
+  auto send = [&](video::packet_raw_t &packet, bool encrypted, stream::retransmit::history_t *history = nullptr) {
+    const stream::video_frame_info_t info {
+      packet.frame_index(),
+      1000,
+      1,
+      {std::string_view {}, std::string_view {}, std::string_view {(const char *) packet.data(), packet.data_size()}},
+      blocksize,
+      20,
+      2,
+      encrypted,
+    };
+
+    crypto::cipher::gcm_t cipher {key, false};
+    auto shards = stream::encode_video_fec_block(info, 0, 0, {0, packet.data_size()}, rs_cache);
+    stream::finalize_video_shards(info, 0, 0, shards, 0, shards.size(), encrypted ? &cipher : nullptr, 0, session_metrics);
+
+    std::string sent;
+    for (size_t x = 0; x < shards.size(); ++x) {
+      sent.append(shards.prefix(x), shards.prefixsize + shards.headersize);
+      sent.append(shards.data(x), shards.blocksize);
+      if (history) {
+        history->store(x, {shards.prefix(x), shards.prefixsize + shards.headersize}, {shards.data(x), shards.blocksize}, std::chrono::steady_clock::now());
+      }
+    }
+    return sent;
+  };
+
+  // Each session alone on a packet of its own
+  auto encrypted_expected = send(*make_packet(), true);
+  auto plain_expected = send(*make_packet(), false);
+
+  // Both sessions on the packet of a shared encoder, the encrypted one first
+  auto encoded = make_packet();
+  video::packet_raw_shared encrypted_packet {encoded, nullptr};
+  video::packet_raw_shared plain_packet {encoded, nullptr};
+  stream::retransmit::history_t encrypted_history {64, 1024};
+  stream::retransmit::history_t plain_history {64, 1024};
+  ASSERT_EQ(send(encrypted_packet, true, &encrypted_history), encrypted_expected);
+  ASSERT_EQ(send(plain_packet, false, &plain_history), plain_expected);
+  ASSERT_EQ(send(encrypted_packet, true), encrypted_expected);
+
+  // The shards kept to be sent again are still the ones each session sent
+  auto join = [](const std::vector<std::string> &shards) {
+    std::string joined;
+    for (auto &shard : shards) {
+      joined += shard;
+    }
+    return joined;
+  };
+  auto now = std::chrono::steady_clock::now();
+  ASSERT_EQ(join(encrypted_history.find(0, 64, now)), encrypted_expected);
+  ASSERT_EQ(join(plain_history.find(0, 64, now)), plain_expected);
+
+  // The data and parity shards matched the ones of the sessions alone, and the packet is as the encoder left it
+  ASSERT_TRUE(std::equal(std::begin(frame), std::end(frame), encoded->data()));
+}
+
+TEST(ReedSolomonCacheTests, ReusesEncoderForSameShape) {
+  reed_solomon_init();
+
+  stream::fec::rs_cache_t cache;
+  auto first = cache.get(10, 2);
+  auto second = cache.get(10, 2);
+
+  ASSERT_NE(first, nullptr);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(cache.hits(), 1);
+  ASSERT_EQ(cache.misses(), 1);
+  ASSERT_EQ(cache.size(), 1);
+}
+
+TEST(ReedSolomonCacheTests, EvictsLeastRecentlyUsed) {
+  reed_solomon_init();
+
+  stream::fec::rs_cache_t cache {2};
+  cache.get(1, 1);
+  cache.get(2, 1);
+  cache.get(1, 1);  // (2, 1) is now the least recently used
+  cache.get(3, 1);
+
+  ASSERT_EQ(cache.size(), 2);
+  ASSERT_EQ(cache.misses(), 3);
+
+  cache.get(1, 1);
+  ASSERT_EQ(cache.hits(), 2);
+
+  cache.get(2, 1);
+  ASSERT_EQ(cache.misses(), 4);
+}
+
+TEST(ReedSolomonCacheTests, CachedEncoderProducesIdenticalParity) {
+  reed_solomon_init();
+
+  constexpr int data_shards = 10;
+  constexpr int parity_shards = 3;
+  constexpr int total_shards = data_shards + parity_shards;
+  constexpr int block_size = 64;
+
+  auto encode = [&](reed_solomon *rs, int seed) {
+    std::vector<uint8_t> buffer(total_shards * block_size);
+    for (std::size_t x = 0; x < data_shards * block_size; ++x) {
+      buffer[x] = (uint8_t) (x * 31 + seed);
+    }
+
+    std::vector<uint8_t *> shards(total_shards);
+    for (int x = 0; x < total_shards; ++x) {
+      shards[x] = &buffer[x * block_size];
+    }
+
+    EXPECT_EQ(reed_solomon_encode(rs, shards.data(), total_shards, block_size), 0);
+    return buffer;
+  };
+
+  stream::fec::rs_cache_t cache;
+  for (int seed = 0; seed < 3; ++seed) {
+    stream::fec::rs_t fresh {reed_solomon_new(data_shards, parity_shards)};
+    ASSERT_EQ(encode(cache.get(data_shards, parity_shards), seed), encode(fresh.get(), seed));
+  }
+
+  ASSERT_EQ(cache.hits(), 2);
+  ASSERT_EQ(cache.misses(), 1);
+}
+
+TEST(LinkEstimateTests, BacksOffOnLossAtMostOncePerInterval) {
+  auto now = std::chrono::steady_clock::now();
+  stream::pacing::link_estimate_t estimate {100'000'000, now};
+  ASSERT_EQ(estimate.rate(), stream::pacing::link_estimate_t::DEFAULT_RATE);
+
+  estimate.on_loss(now);
+  auto lowered = estimate.rate();
+  ASSERT_LT(lowered, stream::pacing::link_estimate_t::DEFAULT_RATE);
+
+  // The same lost frame is often reported more than once
+  estimate.on_loss(now + std::chrono::milliseconds {10});
+  ASSERT_EQ(estimate.rate(), lowered);
+
+  for (int x = 1; x <= 20; ++x) {
+    estimate.on_loss(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(estimate.rate(), 100'000'000);
+}
+
+TEST(LinkEstimateTests, GrowsWhileLinkIsClean) {
+  auto now = std::chrono::steady_clock::now();
+  stream::pacing::link_estimate_t estimate {100'000'000, now};
+
+  // Nothing grows right after the session starts
+  estimate.on_rtt(std::chrono::milliseconds {2}, now + std::chrono::seconds {1});
+  ASSERT_EQ(estimate.rate(), stream::pacing::link_estimate_t::DEFAULT_RATE);
+
+  for (int x = 2; x <= 200; ++x) {
+    estimate.on_rtt(std::chrono::milliseconds {2}, now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(estimate.rate(), stream::pacing::link_estimate_t::MAX_RATE);
+}
+
+TEST(LinkEstimateTests, StartsFromLearnedRate) {
+  auto now = std::chrono::steady_clock::now();
+
+  ASSERT_EQ((stream::pacing::link_estimate_t {100'000'000, now, 300'000'000}.rate()), 300'000'000);
+
+  // Never below the minimum, nor above the maximum
+  ASSERT_EQ((stream::pacing::link_estimate_t {100'000'000, now, 1'000'000}.rate()), 100'000'000);
+  ASSERT_EQ((stream::pacing::link_estimate_t {100'000'000, now, 100'000'000'000}.rate()), stream::pacing::link_estimate_t::MAX_RATE);
+}
+
+TEST(LinkEstimateTests, BacksOffOnQueueingDelay) {
+  auto now = std::chrono::steady_clock::now();
+  stream::pacing::link_estimate_t estimate {100'000'000, now};
+
+  estimate.on_rtt(std::chrono::milliseconds {2}, now);
+  estimate.on_rtt(std::chrono::milliseconds {40}, now + std::chrono::seconds {1});
+  ASSERT_LT(estimate.rate(), stream::pacing::link_estimate_t::DEFAULT_RATE);
+}
+
+TEST(LinkEstimateTests, ToleratesDelayWithinJitter) {
+  auto now = std::chrono::steady_clock::now();
+  stream::pacing::link_estimate_t estimate {100'000'000, now};
+
+  estimate.on_rtt(std::chrono::milliseconds {2}, now);
+  estimate.on_rtt(std::chrono::milliseconds {40}, now + std::chrono::seconds {1}, std::chrono::milliseconds {10});
+  ASSERT_EQ(estimate.rate(), stream::pacing::link_estimate_t::DEFAULT_RATE);
+}
+
+TEST(DelayEstimateTests, MeasuresQueueingDelayAboveMinimum) {
+  stream::delay::estimate_t estimate;
+
+  estimate.on_rtt(std::chrono::milliseconds {10});
+  estimate.on_rtt(std::chrono::milliseconds {4});
+  ASSERT_EQ(estimate.queueing_delay(), std::chrono::microseconds {0});
+
+  estimate.on_rtt(std::chrono::milliseconds {29});
+  ASSERT_EQ(estimate.rtt(), std::chrono::milliseconds {29});
+  ASSERT_EQ(estimate.queueing_delay(), std::chrono::milliseconds {25});
+}
+
+TEST(DelayEstimateTests, SeedsRoundTripUntilFirstSample) {
+  stream::delay::estimate_t estimate;
+
+  estimate.seed(std::chrono::milliseconds {12});
+  ASSERT_EQ(estimate.rtt(), std::chrono::milliseconds {12});
+
+  // The seed isn't the lowest round trip time, so a slower path now isn't taken for queueing delay
+  estimate.on_rtt(std::chrono::milliseconds {30});
+  ASSERT_EQ(estimate.rtt(), std::chrono::milliseconds {30});
+  ASSERT_EQ(estimate.queueing_delay(), std::chrono::microseconds {0});
+
+  estimate.seed(std::chrono::milliseconds {12});
+  ASSERT_EQ(estimate.rtt(), std::chrono::milliseconds {30});
+}
+
+TEST(DelayEstimateTests, SteadyPingsHaveNoJitter) {
+  auto now = std::chrono::steady_clock::now();
+  stream::delay::estimate_t estimate;
+
+  for (std::uint32_t x = 1; x <= 50; ++x) {
+    estimate.on_ping(x, now + std::chrono::milliseconds {500} * x);
+  }
+  ASSERT_EQ(estimate.jitter(), std::chrono::microseconds {0});
+
+  // A lost ping doesn't count as a late one
+  estimate.on_ping(52, now + std::chrono::milliseconds {500} * 52);
+  ASSERT_EQ(estimate.jitter(), std::chrono::microseconds {0});
+}
+
+TEST(DelayEstimateTests, FollowsJitteryPings) {
+  auto now = std::chrono::steady_clock::now();
+  stream::delay::estimate_t estimate;
 
-TEST(ConcatAndInsertTests, ConcatNoInsertionTest) {
-  char b1[] = {'a', 'b'};
-  char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(0, 2, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
-  auto expected = std::vector<uint8_t> {'a', 'b', 'c', 'd', 'e'};
-  ASSERT_EQ(res, expected);
+  // Every other ping is held up by 4ms on the way
+  for (std::uint32_t x = 1; x <= 200; ++x) {
+    estimate.on_ping(x, now + std::chrono::milliseconds {500} * x + std::chrono::milliseconds {x % 2 ? 4 : 0});
+  }
+  ASSERT_GT(estimate.jitter(), std::chrono::milliseconds {3});
+  ASSERT_LT(estimate.jitter(), std::chrono::milliseconds {5});
+
+  // Reordered pings and long gaps are skipped instead of counting as huge deviations
+  auto jitter = estimate.jitter();
+  estimate.on_ping(150, now + std::chrono::seconds {101});
+  estimate.on_ping(1000, now + std::chrono::seconds {500});
+  ASSERT_EQ(estimate.jitter(), jitter);
+}
+
+TEST(RetransmitHistoryTests, FindsStoredShards) {
+  auto now = std::chrono::steady_clock::now();
+  stream::retransmit::history_t history {8, 16};
+
+  for (std::uint32_t x = 0; x < 4; ++x) {
+    history.store(100 + x, std::string_view {"h"}, std::to_string(x), now);
+  }
+
+  auto shards = history.find(101, 2, now);
+  ASSERT_EQ(shards, (std::vector<std::string> {"h1", "h2"}));
+
+  // Shards never sent are left out
+  shards = history.find(102, 4, now);
+  ASSERT_EQ(shards, (std::vector<std::string> {"h2", "h3"}));
+}
+
+TEST(RetransmitHistoryTests, SkipsOverwrittenAndOldShards) {
+  auto now = std::chrono::steady_clock::now();
+  stream::retransmit::history_t history {8, 16};
+
+  for (std::uint32_t x = 0; x < 12; ++x) {
+    history.store(x, {}, std::to_string(x), now);
+  }
+
+  // The first shards were overwritten when the sequence numbers wrapped around the ring
+  ASSERT_EQ(history.find(0, 4, now), std::vector<std::string> {});
+  ASSERT_EQ(history.find(4, 8, now).size(), 8);
+
+  // The client has moved past the frame of old shards
+  ASSERT_EQ(history.find(4, 8, now + stream::retransmit::history_t::MAX_AGE + std::chrono::milliseconds {1}), std::vector<std::string> {});
+
+  // Shards too large for a slot aren't kept
+  history.store(12, "header", "payload of 15 b", now);
+  ASSERT_EQ(history.find(12, 1, now), std::vector<std::string> {});
+}
+
+TEST(RetransmitHistoryTests, FollowsSequenceNumberWrap) {
+  auto now = std::chrono::steady_clock::now();
+  stream::retransmit::history_t history {8, 16};
+
+  history.store(0xFFFFFF, {}, "a", now);
+  history.store(0x1000000, {}, "b", now);
+
+  ASSERT_EQ(history.find(0xFFFFFF, 2, now), (std::vector<std::string> {"a", "b"}));
+}
+
+TEST(AudioFecTests, LowersProtectionWhileLinkIsClean) {
+  auto now = std::chrono::steady_clock::now();
+  stream::audio_fec::protection_t protection {0, now};
+  ASSERT_EQ(protection.parity_shards(), stream::audio_fec::protection_t::MAX_PARITY_SHARDS);
+
+  protection.update(now + std::chrono::seconds {1});
+  ASSERT_EQ(protection.parity_shards(), stream::audio_fec::protection_t::MAX_PARITY_SHARDS);
+
+  // One shard at a time
+  protection.update(now + std::chrono::seconds {10});
+  ASSERT_EQ(protection.parity_shards(), 1);
+  protection.update(now + std::chrono::seconds {11});
+  ASSERT_EQ(protection.parity_shards(), 1);
+
+  for (int x = 20; x <= 100; x += 10) {
+    protection.update(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(protection.parity_shards(), 0);
+}
+
+TEST(AudioFecTests, RestoresProtectionOnLoss) {
+  auto now = std::chrono::steady_clock::now();
+  stream::audio_fec::protection_t protection {0, now};
+
+  protection.update(now + std::chrono::seconds {10});
+  protection.update(now + std::chrono::seconds {20});
+  ASSERT_EQ(protection.parity_shards(), 0);
+
+  protection.on_loss(now + std::chrono::seconds {21});
+  ASSERT_EQ(protection.parity_shards(), stream::audio_fec::protection_t::MAX_PARITY_SHARDS);
+
+  // The hold starts over from the loss
+  protection.update(now + std::chrono::seconds {30});
+  ASSERT_EQ(protection.parity_shards(), stream::audio_fec::protection_t::MAX_PARITY_SHARDS);
+}
+
+TEST(AudioFecTests, KeepsMinimumProtection) {
+  auto now = std::chrono::steady_clock::now();
+  stream::audio_fec::protection_t protection {stream::audio_fec::protection_t::MAX_PARITY_SHARDS, now};
+
+  for (int x = 10; x <= 100; x += 10) {
+    protection.update(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(protection.parity_shards(), stream::audio_fec::protection_t::MAX_PARITY_SHARDS);
+}
+
+TEST(VideoFecTests, FitsLargeFramesIntoFecBlocks) {
+  using namespace stream::video_fec;
+
+  // 200 shards fit in a single block at 20%
+  ASSERT_EQ(fit_percentage(20, 200, MAX_FEC_BLOCKS), 20);
+  ASSERT_EQ(fit_percentage(20, 200, 1), 20);
+
+  // 250 data shards only leave room for 5 parity shards in a block
+  ASSERT_EQ(fit_percentage(20, 250, 1), 2);
+
+  // 1000 shards fit in 4 blocks of 250
+  ASSERT_EQ(fit_percentage(20, 1000, MAX_FEC_BLOCKS), 2);
+
+  // Frames too large for every block get no parity at all
+  ASSERT_EQ(fit_percentage(20, 1100, MAX_FEC_BLOCKS), 0);
+  ASSERT_EQ(fit_percentage(20, 300, 1), 0);
 }
 
-TEST(ConcatAndInsertTests, ConcatLargeStrideTest) {
-  char b1[] = {'a', 'b'};
-  char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(1, sizeof(b1) + sizeof(b2) + 1, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
-  auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 'd', 'e'};
-  ASSERT_EQ(res, expected);
+TEST(VideoFecTests, FollowsReportedLoss) {
+  using protection_t = stream::video_fec::protection_t;
+  auto now = std::chrono::steady_clock::now();
+  protection_t protection {20, protection_t::MIN_PERCENTAGE, protection_t::MAX_PERCENTAGE, now};
+
+  // 100 packets lost out of 1000 sent calls for 40% with the loss headroom
+  protection.on_sent(800, 200);
+  protection.on_loss(100);
+  protection.update(now + std::chrono::seconds {1});
+  ASSERT_EQ(protection.percentage(), 20);
+  protection.update(now + protection_t::WINDOW);
+  ASSERT_EQ(protection.percentage(), 40);
+
+  // A frame the client couldn't recover raises it right away
+  protection.on_unrecovered(now + std::chrono::seconds {3});
+  ASSERT_EQ(protection.percentage(), 60);
+
+  // Clean windows only lower it after the hold, a step at a time
+  for (int x = 4; x < 13; ++x) {
+    protection.on_sent(1000, 600);
+    protection.update(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(protection.percentage(), 60);
+  protection.update(now + std::chrono::seconds {14});
+  ASSERT_EQ(protection.percentage(), 60 - protection_t::LOWER_STEP);
+
+  for (int x = 15; x < 300; ++x) {
+    protection.update(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(protection.percentage(), protection_t::MIN_PERCENTAGE);
 }
 
-TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
-  char b1[] = {'a', 'b'};
-  char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(1, 1, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
-  auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
-  ASSERT_EQ(res, expected);
+TEST(VideoFecTests, ProtectsKeyAndLargeFramesMore) {
+  using protection_t = stream::video_fec::protection_t;
+  auto now = std::chrono::steady_clock::now();
+  protection_t protection {20, protection_t::MIN_PERCENTAGE, protection_t::MAX_PERCENTAGE, now};
+
+  ASSERT_EQ(protection.frame_percentage(true, 200), 40);
+  for (int x = 0; x < 10; ++x) {
+    ASSERT_EQ(protection.frame_percentage(false, 20), 20);
+  }
+  ASSERT_EQ(protection.frame_percentage(false, 100), 30);
+}
+
+TEST(VideoFecTests, KeepsConfiguredPercentageWithoutRange) {
+  using protection_t = stream::video_fec::protection_t;
+  auto now = std::chrono::steady_clock::now();
+  protection_t protection {20, 20, 20, now};
+
+  protection.on_sent(100, 20);
+  protection.on_loss(50);
+  protection.on_unrecovered(now);
+  protection.update(now + protection_t::WINDOW);
+  ASSERT_EQ(protection.percentage(), 20);
+  ASSERT_EQ(protection.frame_percentage(true, 100), 20);
+}
+
+TEST(BitrateControlTests, LowersBitrateInBoundedSteps) {
+  using controller_t = stream::bitrate_control::controller_t;
+  auto now = std::chrono::steady_clock::now();
+  controller_t controller {2000, 10000, now};
+
+  // Feedback is only weighed once per step interval
+  controller.on_loss();
+  ASSERT_FALSE(controller.update(now + std::chrono::milliseconds {500}));
+
+  auto bitrate = controller.update(now + std::chrono::seconds {1});
+  ASSERT_EQ(bitrate, 9500);
+  ASSERT_EQ(controller.bitrate(), 9500);
+
+  // However much loss is reported, a single step is bounded
+  for (int x = 0; x < 10; ++x) {
+    controller.on_invalidate();
+  }
+  ASSERT_EQ(controller.update(now + std::chrono::seconds {2}), 8075);
+
+  for (int x = 3; x < 30; ++x) {
+    controller.on_loss();
+    controller.on_invalidate();
+    controller.update(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(controller.bitrate(), 2000);
+}
+
+TEST(BitrateControlTests, IgnoresOccasionalLateFrames) {
+  using controller_t = stream::bitrate_control::controller_t;
+  auto now = std::chrono::steady_clock::now();
+  controller_t controller {2000, 10000, now};
+
+  for (int x = 1; x < controller_t::BACKLOG_FRAMES; ++x) {
+    controller.on_backlog();
+  }
+  ASSERT_FALSE(controller.update(now + std::chrono::seconds {1}));
+
+  for (int x = 0; x < controller_t::BACKLOG_FRAMES; ++x) {
+    controller.on_backlog();
+  }
+  ASSERT_EQ(controller.update(now + std::chrono::seconds {2}), 9500);
+}
+
+TEST(BitrateControlTests, LowersBitrateOnQueueingDelay) {
+  using controller_t = stream::bitrate_control::controller_t;
+  auto now = std::chrono::steady_clock::now();
+  controller_t controller {2000, 10000, now};
+
+  // A delay the jitter of the path accounts for isn't congestion
+  controller.on_delay(std::chrono::milliseconds {30}, std::chrono::milliseconds {5});
+  ASSERT_FALSE(controller.update(now + std::chrono::seconds {1}));
+
+  // However often it's reported within a step, a delay counts once
+  for (int x = 0; x < 10; ++x) {
+    controller.on_delay(std::chrono::milliseconds {30}, std::chrono::microseconds {500});
+  }
+  ASSERT_EQ(controller.update(now + std::chrono::seconds {2}), 9500);
+  ASSERT_FALSE(controller.update(now + std::chrono::seconds {3}));
+}
+
+TEST(BitrateControlTests, RaisesBitrateAfterHold) {
+  using controller_t = stream::bitrate_control::controller_t;
+  auto now = std::chrono::steady_clock::now();
+  controller_t controller {2000, 10000, now};
+
+  controller.on_loss();
+  controller.on_loss();
+  controller.on_loss();
+  ASSERT_EQ(controller.update(now + std::chrono::seconds {1}), 8500);
+
+  // The link has to stay clean for the whole hold first
+  for (int x = 2; x < 6; ++x) {
+    ASSERT_FALSE(controller.update(now + std::chrono::seconds {x}));
+  }
+  ASSERT_EQ(controller.update(now + std::chrono::seconds {6}), 9000);
+
+  // Never above the bitrate the client asked for
+  for (int x = 7; x < 20; ++x) {
+    controller.update(now + std::chrono::seconds {x});
+  }
+  ASSERT_EQ(controller.bitrate(), 10000);
+}
+
+TEST(BitrateControlTests, WarmStartsWithinRange) {
+  using controller_t = stream::bitrate_control::controller_t;
+  auto now = std::chrono::steady_clock::now();
+
+  controller_t controller {2000, 10000, now, 6000};
+  ASSERT_EQ(controller.bitrate(), 6000);
+
+  // A clean link raises it like after congestion
+  ASSERT_FALSE(controller.update(now + std::chrono::seconds {1}));
+  ASSERT_EQ(controller.update(now + std::chrono::seconds {5}), 6500);
+
+  ASSERT_EQ((controller_t {2000, 10000, now, 500}.bitrate()), 2000);
+  ASSERT_EQ((controller_t {2000, 10000, now, 20000}.bitrate()), 10000);
+}
+
+TEST(BitrateControlTests, KeepsBitrateWithoutRange) {
+  using controller_t = stream::bitrate_control::controller_t;
+  auto now = std::chrono::steady_clock::now();
+  controller_t controller {10000, 10000, now};
+
+  controller.on_loss();
+  controller.on_invalidate();
+  ASSERT_FALSE(controller.update(now + std::chrono::seconds {1}));
+  ASSERT_EQ(controller.bitrate(), 10000);
+}
+
+TEST(PacingTests, SendsAtLinkRateWithoutFramePercentage) {
+  // 800 Mbps with 1000 byte packets is 100 packets per millisecond
+  ASSERT_DOUBLE_EQ(stream::pacing::packets_in_1ms(800'000'000, 1000, 10, std::chrono::milliseconds {16}, 0), 100);
+}
+
+TEST(PacingTests, SpreadsFrameAcrossFrameInterval) {
+  // 80 packets across half of a 16ms frame interval
+  ASSERT_DOUBLE_EQ(stream::pacing::packets_in_1ms(800'000'000, 1000, 80, std::chrono::milliseconds {16}, 50), 10);
+
+  // Frames too large to spread at a lower rate go out at the link rate
+  ASSERT_DOUBLE_EQ(stream::pacing::packets_in_1ms(800'000'000, 1000, 8000, std::chrono::milliseconds {16}, 50), 100);
+
+  // Tiny frames still go out at a packet per millisecond
+  ASSERT_DOUBLE_EQ(stream::pacing::packets_in_1ms(800'000'000, 1000, 2, std::chrono::milliseconds {16}, 50), 1);
+}
+
+TEST(PacingTests, CapsFrameSizeToLinkBudget) {
+  ASSERT_EQ(stream::pacing::max_frame_size(100'000'000, std::chrono::milliseconds {10}, 0, 20), 0);
+
+  // 100 Mbps for half of a 10ms frame interval is 500 Kb
+  ASSERT_EQ(stream::pacing::max_frame_size(100'000'000, std::chrono::milliseconds {10}, 50, 0), 500'000);
+
+  // The FEC shards of the frame take their share of the link
+  ASSERT_EQ(stream::pacing::max_frame_size(100'000'000, std::chrono::milliseconds {10}, 50, 25), 400'000);
+}
+
+TEST(PacingTests, CountsEncodeTimeTowardsSendDeadline) {
+  auto captured = std::chrono::steady_clock::now();
+  auto queued = captured + std::chrono::milliseconds {5};
+  std::chrono::nanoseconds interval = std::chrono::milliseconds {16};
+
+  ASSERT_EQ(stream::pacing::send_deadline(captured, queued, interval, 150), captured + std::chrono::milliseconds {24});
+  ASSERT_EQ(stream::pacing::send_deadline(std::nullopt, queued, interval, 50), queued + std::chrono::milliseconds {8});
+}
+
+TEST(PacingTests, RemembersRunsOfDroppedFrames) {
+  stream::pacing::dropped_frames_t dropped;
+  for (std::int64_t frame_index : {10, 11, 12, 20}) {
+    dropped.add(frame_index);
+  }
+
+  ASSERT_TRUE(dropped.contains(10, 12));
+  ASSERT_TRUE(dropped.contains(11, 11));
+  ASSERT_TRUE(dropped.contains(20, 20));
+  ASSERT_FALSE(dropped.contains(12, 13));
+  ASSERT_FALSE(dropped.contains(9, 10));
+
+  // Only the last runs are kept
+  for (std::int64_t x = 0; x < (std::int64_t) stream::pacing::dropped_frames_t::MAX_RUNS; ++x) {
+    dropped.add(100 + x * 2);
+  }
+  ASSERT_FALSE(dropped.contains(20, 20));
+  ASSERT_TRUE(dropped.contains(100, 100));
+}
+
+TEST(FeedbackCoalescerTests, SendsLatestStateAtBoundedRate) {
+  using platf::gamepad_feedback_msg_t;
+  stream::feedback::coalescer_t coalescer;
+  auto now = std::chrono::steady_clock::now();
+
+  // The first state of each gamepad goes out right away
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(0, 100, 200));
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(1, 100, 200));
+  coalescer.push(gamepad_feedback_msg_t::make_rgb_led(0, 1, 2, 3));
+  ASSERT_EQ(coalescer.pop(now).size(), 3);
+  ASSERT_FALSE(coalescer.next_due());
+
+  // Within the interval, only the latest state waits
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(0, 300, 400));
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(0, 500, 600));
+  ASSERT_TRUE(coalescer.pop(now + std::chrono::milliseconds {5}).empty());
+  ASSERT_EQ(coalescer.next_due(), now + stream::feedback::coalescer_t::MIN_INTERVAL);
+  ASSERT_EQ(coalescer.coalesced(), 1);
+
+  auto due = coalescer.pop(now + stream::feedback::coalescer_t::MIN_INTERVAL);
+  ASSERT_EQ(due.size(), 1);
+  ASSERT_EQ(due[0].data.rumble.lowfreq, 500);
+  ASSERT_EQ(due[0].data.rumble.highfreq, 600);
+
+  // The state sent last isn't sent again
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(0, 500, 600));
+  coalescer.push(gamepad_feedback_msg_t::make_rgb_led(0, 1, 2, 3));
+  ASSERT_FALSE(coalescer.next_due());
+  ASSERT_EQ(coalescer.duplicates(), 2);
+
+  // Going back to the state sent last drops the one waiting
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(1, 0, 0));
+  coalescer.push(gamepad_feedback_msg_t::make_rumble(1, 100, 200));
+  ASSERT_TRUE(coalescer.pop(now + std::chrono::seconds {1}).empty());
+}
+
+TEST(RecoveryControllerTests, DebouncesIdrRequestsUntilTheClientSawTheFrame) {
+  using stream::recovery::frame_e;
+  stream::recovery::controller_t recovery;
+  auto now = std::chrono::steady_clock::now();
+  auto round_trip = std::chrono::milliseconds {30};
+
+  ASSERT_TRUE(recovery.on_idr_request(now, round_trip));
+  ASSERT_FALSE(recovery.on_idr_request(now + std::chrono::milliseconds {10}, round_trip));
+
+  // Frames encoded before the IDR frame are skipped while it's on its way
+  ASSERT_TRUE(recovery.skip(frame_e::regular, now + std::chrono::milliseconds {10}));
+  ASSERT_FALSE(recovery.skip(frame_e::idr, now + std::chrono::milliseconds {10}));
+  ASSERT_TRUE(recovery.on_sent(100, frame_e::idr, now + std::chrono::milliseconds {20}));
+  ASSERT_FALSE(recovery.skip(frame_e::regular, now + std::chrono::milliseconds {20}));
+
+  // The client asked before it could see the IDR frame
+  ASSERT_FALSE(recovery.on_idr_request(now + std::chrono::milliseconds {40}, round_trip));
+  ASSERT_FALSE(recovery.on_invalidate(95, 99, true, now + std::chrono::milliseconds {40}));
+  ASSERT_TRUE(recovery.on_idr_request(now + std::chrono::milliseconds {60}, round_trip));
+
+  // A request the encoder never answers doesn't hold the stream up
+  ASSERT_FALSE(recovery.skip(frame_e::regular, now + std::chrono::milliseconds {60} + stream::recovery::controller_t::MAX_WAIT));
+  ASSERT_TRUE(recovery.on_idr_request(now + std::chrono::milliseconds {60} + stream::recovery::controller_t::MAX_WAIT, round_trip));
+}
+
+TEST(RecoveryControllerTests, PassesOnInvalidationsTheNextFrameDoesNotCover) {
+  using stream::recovery::frame_e;
+  stream::recovery::controller_t recovery;
+  auto now = std::chrono::steady_clock::now();
+
+  ASSERT_TRUE(recovery.on_invalidate(10, 12, true, now));
+
+  // The client lost more frames after the first ones
+  ASSERT_FALSE(recovery.on_invalidate(10, 14, true, now));
+  ASSERT_FALSE(recovery.on_invalidate(13, 14, true, now));
+  ASSERT_TRUE(recovery.skip(frame_e::regular, now));
+  ASSERT_FALSE(recovery.on_sent(15, frame_e::regular, now));
+  ASSERT_TRUE(recovery.on_sent(16, frame_e::invalidation, now));
+
+  ASSERT_FALSE(recovery.on_invalidate(15, 15, true, now));
+  ASSERT_TRUE(recovery.on_invalidate(16, 17, true, now));
+
+  // An earlier frame may still be referred to by the answer of the last invalidation
+  ASSERT_TRUE(recovery.on_invalidate(8, 17, true, now));
+
+  // Encoders that can't invalidate answer with an IDR frame, which replaces every frame before it
+  ASSERT_TRUE(recovery.on_sent(18, frame_e::idr, now));
+  ASSERT_FALSE(recovery.on_invalidate(2, 17, false, now));
+  ASSERT_TRUE(recovery.on_invalidate(18, 19, false, now));
+  ASSERT_FALSE(recovery.on_invalidate(21, 22, true, now));
+  ASSERT_FALSE(recovery.on_idr_request(now, std::chrono::milliseconds {30}));
 }
@@ -0,0 +1,47 @@
+/**
+ * @file tests/unit/test_sync.cpp
+ * @brief Test src/sync.*
+ */
+#include "../tests_common.h"
+
+#include <src/sync.h>
+#include <thread>
+#include <vector>
+
+TEST(SnapshotTests, ReadersKeepTheirSnapshot) {
+  sync_util::snapshot_t<std::vector<int>> snapshot {std::vector<int> {1, 2}};
+
+  auto before = snapshot.load();
+  snapshot.update([](std::vector<int> &value) {
+    value.push_back(3);
+  });
+
+  EXPECT_EQ(*before, (std::vector<int> {1, 2}));
+  EXPECT_EQ(*snapshot.load(), (std::vector<int> {1, 2, 3}));
+}
+
+TEST(SnapshotTests, ConcurrentUpdatesAreNotLost) {
+  sync_util::snapshot_t<std::vector<int>> snapshot;
+
+  std::vector<std::thread> writers;
+  for (int x = 0; x < 4; ++x) {
+    writers.emplace_back([&snapshot, x]() {
+      for (int y = 0; y < 100; ++y) {
+        snapshot.update([&](std::vector<int> &value) {
+          value.push_back(x * 100 + y);
+        });
+      }
+    });
+  }
+
+  // Readers always see a whole published value
+  for (int x = 0; x < 100; ++x) {
+    auto value = snapshot.load();
+    EXPECT_LE(value->size(), 400);
+  }
+
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  EXPECT_EQ(snapshot.load()->size(), 400);
+}
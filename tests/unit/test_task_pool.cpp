@@ -0,0 +1,114 @@
+/**
+ * @file tests/unit/test_task_pool.cpp
+ * @brief Test src/task_pool.*
+ */
+#include "../tests_common.h"
+
+#include <src/task_pool.h>
+
+using namespace std::literals;
+
+TEST(TaskPoolTests, RunsTasksInOrder) {
+  task_pool_util::TaskPool pool;
+  std::vector<int> order;
+
+  pool.pushDelayed([&]() { order.push_back(2); }, 4ms);
+  pool.pushDelayed([&]() { order.push_back(1); }, 1ms);
+  pool.pushDelayed([&]() { order.push_back(3); }, 700ms);
+  pool.push([&]() { order.push_back(0); });
+
+  EXPECT_TRUE(pool.ready());
+  (*pool.pop())->run();
+
+  std::this_thread::sleep_for(10ms);
+  while (auto task = pool.pop()) {
+    (*task)->run();
+  }
+  EXPECT_EQ(order, (std::vector<int> {0, 1, 2}));
+
+  EXPECT_FALSE(pool.ready());
+  ASSERT_TRUE(pool.next());
+  EXPECT_GT(*pool.next(), std::chrono::steady_clock::now() + 500ms);
+}
+
+TEST(TaskPoolTests, NextReturnsEarliestTask) {
+  task_pool_util::TaskPool pool;
+
+  // Further than a full turn of the wheel
+  auto far = pool.pushDelayed([]() {}, 10min);
+  ASSERT_TRUE(pool.next());
+  EXPECT_GT(*pool.next(), std::chrono::steady_clock::now() + 9min);
+
+  auto near = pool.pushDelayed([]() {}, 100ms);
+  EXPECT_LT(*pool.next(), std::chrono::steady_clock::now() + 1s);
+
+  EXPECT_TRUE(pool.cancel(near.task_id));
+  EXPECT_GT(*pool.next(), std::chrono::steady_clock::now() + 9min);
+
+  EXPECT_TRUE(pool.cancel(far.task_id));
+  EXPECT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTests, CancelsAndDelaysTasks) {
+  task_pool_util::TaskPool pool;
+  int runs = 0;
+
+  auto cancelled = pool.pushDelayed([&]() { ++runs; }, 0ms);
+  auto delayed = pool.pushDelayed([&]() { ++runs; }, 0ms);
+
+  EXPECT_TRUE(pool.cancel(cancelled.task_id));
+  EXPECT_FALSE(pool.cancel(cancelled.task_id));
+
+  pool.delay(delayed.task_id, 10min);
+  EXPECT_FALSE(pool.ready());
+  EXPECT_FALSE(pool.pop());
+
+  pool.delay(delayed.task_id, 0ms);
+  auto task = pool.pop();
+  ASSERT_TRUE(task);
+  (*task)->run();
+  EXPECT_EQ(runs, 1);
+
+  // A task that already ran can't be cancelled
+  EXPECT_FALSE(pool.cancel(delayed.task_id));
+  EXPECT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTests, PopsTaskById) {
+  task_pool_util::TaskPool pool;
+
+  auto timer = pool.pushDelayed([]() { return 5; }, 10min);
+
+  auto task = pool.pop(timer.task_id);
+  ASSERT_TRUE(task);
+  task->second->run();
+  EXPECT_EQ(timer.future.get(), 5);
+
+  EXPECT_FALSE(pool.pop(timer.task_id));
+  EXPECT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTests, Benchmark) {
+  constexpr int TASKS = 10000;
+
+  task_pool_util::TaskPool pool;
+  std::vector<task_pool_util::TaskPool::task_id_t> task_ids;
+  task_ids.reserve(TASKS);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < TASKS; ++x) {
+    task_ids.emplace_back(pool.pushDelayed([]() {}, std::chrono::milliseconds {x % 5000}).task_id);
+  }
+  for (auto task_id : task_ids) {
+    pool.delay(task_id, 10s);
+  }
+  for (auto task_id : task_ids) {
+    pool.cancel(task_id);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  BOOST_LOG(tests) << "Scheduled, delayed and cancelled " << TASKS << " tasks in "
+                   << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << " us";
+
+  EXPECT_FALSE(pool.next());
+}
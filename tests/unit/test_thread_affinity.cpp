@@ -0,0 +1,90 @@
+/**
+ * @file tests/unit/test_thread_affinity.cpp
+ * @brief Test src/thread_affinity.*
+ */
+#include "../tests_common.h"
+
+#include <src/thread_affinity.h>
+
+namespace {
+  // A hybrid CPU with two SMT P-cores per L3 cache, and two E-cores sharing a cache
+  const std::vector<platf::cpu_t> TOPOLOGY {
+    {0, 0, 0, false},
+    {1, 0, 0, false},
+    {2, 2, 0, false},
+    {3, 2, 0, false},
+    {4, 4, 4, false},
+    {5, 4, 4, false},
+    {6, 6, 4, false},
+    {7, 6, 4, false},
+    {8, 8, 8, true},
+    {9, 9, 8, true},
+  };
+
+  // Two sockets of two SMT cores each
+  const std::vector<platf::cpu_t> NUMA_TOPOLOGY {
+    {0, 0, 0, false, 0},
+    {1, 1, 0, false, 0},
+    {2, 0, 0, false, 0},
+    {3, 1, 0, false, 0},
+    {4, 4, 4, false, 1},
+    {5, 5, 4, false, 1},
+    {6, 4, 4, false, 1},
+    {7, 5, 4, false, 1},
+  };
+}  // namespace
+
+TEST(ThreadAffinityTests, ParsesCpuLists) {
+  EXPECT_EQ(thread_affinity::parse("", TOPOLOGY), std::vector<int> {});
+  EXPECT_EQ(thread_affinity::parse("3", TOPOLOGY), (std::vector<int> {3}));
+  EXPECT_EQ(thread_affinity::parse(" 8, 0-2 ,2", TOPOLOGY), (std::vector<int> {0, 1, 2, 8}));
+
+  EXPECT_EQ(thread_affinity::parse("10", TOPOLOGY), std::nullopt);
+  EXPECT_EQ(thread_affinity::parse("3-1", TOPOLOGY), std::nullopt);
+  EXPECT_EQ(thread_affinity::parse("1-", TOPOLOGY), std::nullopt);
+  EXPECT_EQ(thread_affinity::parse("cores", TOPOLOGY), std::nullopt);
+}
+
+TEST(ThreadAffinityTests, ParsesCoreKinds) {
+  EXPECT_EQ(thread_affinity::parse("efficiency", TOPOLOGY), (std::vector<int> {8, 9}));
+  EXPECT_EQ(thread_affinity::parse("Performance", TOPOLOGY), (std::vector<int> {0, 1, 2, 3, 4, 5, 6, 7}));
+  EXPECT_EQ(thread_affinity::parse("performance,nosmt", TOPOLOGY), (std::vector<int> {0, 2, 4, 6}));
+  EXPECT_EQ(thread_affinity::parse("nosmt", TOPOLOGY), (std::vector<int> {0, 2, 4, 6, 8, 9}));
+
+  EXPECT_EQ(thread_affinity::parse("ccd1", TOPOLOGY), (std::vector<int> {4, 5, 6, 7}));
+  EXPECT_EQ(thread_affinity::parse("ccd0,ccd2", TOPOLOGY), (std::vector<int> {0, 1, 2, 3, 8, 9}));
+  EXPECT_EQ(thread_affinity::parse("ccd3", TOPOLOGY), std::nullopt);
+}
+
+TEST(ThreadAffinityTests, FormatsCpuRanges) {
+  EXPECT_EQ(thread_affinity::format({}), "");
+  EXPECT_EQ(thread_affinity::format({3}), "3");
+  EXPECT_EQ(thread_affinity::format({0, 1, 2, 3, 8, 10, 11}), "0-3,8,10-11");
+}
+
+TEST(ThreadAffinityTests, ParsesNumaNodes) {
+  EXPECT_EQ(thread_affinity::parse("node1", NUMA_TOPOLOGY), (std::vector<int> {4, 5, 6, 7}));
+  EXPECT_EQ(thread_affinity::parse("node0,nosmt", NUMA_TOPOLOGY), (std::vector<int> {0, 1}));
+  EXPECT_EQ(thread_affinity::parse("node2", NUMA_TOPOLOGY), std::nullopt);
+  EXPECT_EQ(thread_affinity::parse("node", NUMA_TOPOLOGY), std::nullopt);
+
+  // The nodes of the devices add nothing until they're known
+  thread_affinity::locality_t locality {1, std::nullopt};
+  EXPECT_EQ(thread_affinity::parse("gpu", NUMA_TOPOLOGY, locality), (std::vector<int> {4, 5, 6, 7}));
+  EXPECT_EQ(thread_affinity::parse("nic", NUMA_TOPOLOGY, locality), std::vector<int> {});
+  EXPECT_EQ(thread_affinity::parse("nic,3", NUMA_TOPOLOGY, locality), (std::vector<int> {3}));
+  EXPECT_EQ(thread_affinity::parse("gpu", NUMA_TOPOLOGY), std::vector<int> {});
+}
+
+TEST(ThreadAffinityTests, PlacesThreadsByTheirDevicesOnNumaSystems) {
+  using thread_affinity::role_e;
+
+  EXPECT_EQ(thread_affinity::default_cpu_set(role_e::capture, NUMA_TOPOLOGY), "gpu");
+  EXPECT_EQ(thread_affinity::default_cpu_set(role_e::encode, NUMA_TOPOLOGY), "gpu");
+  EXPECT_EQ(thread_affinity::default_cpu_set(role_e::video_send, NUMA_TOPOLOGY), "nic");
+  EXPECT_EQ(thread_affinity::default_cpu_set(role_e::audio, NUMA_TOPOLOGY), "nic");
+  EXPECT_EQ(thread_affinity::default_cpu_set(role_e::control, NUMA_TOPOLOGY), "nic");
+
+  // A single node leaves every thread to the scheduler
+  EXPECT_EQ(thread_affinity::default_cpu_set(role_e::encode, TOPOLOGY), "");
+}
@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_thread_pool.cpp
+ * @brief Test src/thread_pool.*
+ */
+#include "../tests_common.h"
+
+#include <src/thread_pool.h>
+
+using namespace std::literals;
+
+TEST(ThreadPoolTests, RunsHigherLanesFirst) {
+  thread_pool_util::ThreadPool pool {1};
+  std::promise<void> release;
+  std::vector<int> order;
+
+  // Keep the only worker busy while the other tasks are queued
+  pool.push([future = release.get_future()]() mutable {
+    future.wait();
+  });
+  pool.push(thread_pool_util::lane_e::background, [&]() {
+    order.push_back(2);
+  });
+  pool.push([&]() {
+    order.push_back(1);
+  });
+  pool.push(thread_pool_util::lane_e::input, [&]() {
+    order.push_back(0);
+  });
+
+  release.set_value();
+  pool.stop();
+  pool.join();
+
+  EXPECT_EQ(order, (std::vector<int> {0, 1, 2}));
+}
+
+TEST(ThreadPoolTests, StealsTasksFromBusyWorkers) {
+  thread_pool_util::ThreadPool pool {2};
+
+  // The tasks go to the queue of the worker waiting on them, so only the other worker can run them
+  auto outer = pool.push([&pool]() {
+    std::vector<std::future<int>> futures;
+    for (int x = 0; x < 10; ++x) {
+      futures.emplace_back(pool.push([x]() {
+        return x;
+      }));
+    }
+
+    int sum = 0;
+    for (auto &future : futures) {
+      if (future.wait_for(5s) != std::future_status::ready) {
+        return -1;
+      }
+      sum += future.get();
+    }
+    return sum;
+  });
+
+  ASSERT_EQ(outer.wait_for(10s), std::future_status::ready);
+  EXPECT_EQ(outer.get(), 45);
+}
+
+TEST(ThreadPoolTests, RunsDelayedTasks) {
+  thread_pool_util::ThreadPool pool {2};
+  std::atomic<int> cancelled_runs {0};
+
+  auto count_run = [&]() {
+    ++cancelled_runs;
+  };
+  auto first = []() {
+    return 1;
+  };
+  auto second = []() {
+    return 2;
+  };
+
+  auto cancelled = pool.pushDelayed(count_run, 20ms);
+  auto later = pool.pushDelayed(second, 50ms);
+  auto sooner = pool.pushDelayed(first, 10ms);
+  EXPECT_TRUE(pool.cancel(cancelled.task_id));
+
+  ASSERT_EQ(sooner.future.wait_for(5s), std::future_status::ready);
+  EXPECT_EQ(sooner.future.get(), 1);
+
+  ASSERT_EQ(later.future.wait_for(5s), std::future_status::ready);
+  EXPECT_EQ(later.future.get(), 2);
+  EXPECT_EQ(cancelled_runs, 0);
+}
+
+TEST(ThreadPoolTests, RunsTasksPushedBeforeStart) {
+  thread_pool_util::ThreadPool pool;
+
+  auto future = pool.push([]() {
+    return 3;
+  });
+  pool.start(1);
+
+  ASSERT_EQ(future.wait_for(5s), std::future_status::ready);
+  EXPECT_EQ(future.get(), 3);
+}
@@ -0,0 +1,187 @@
+/**
+ * @file tests/unit/test_thread_safe.cpp
+ * @brief Test src/thread_safe.*
+ */
+#include "../tests_common.h"
+
+#include <map>
+#include <src/thread_safe.h>
+#include <string>
+#include <thread>
+
+using namespace std::literals;
+
+TEST(SpscQueueTests, PopsInOrder) {
+  safe::spsc_queue_t<int> queue {4};
+
+  for (int x = 0; x < 10; ++x) {
+    queue.raise(x);
+    queue.raise(x + 100);
+
+    EXPECT_EQ(queue.pop(0ms), x);
+    EXPECT_EQ(queue.pop(0ms), x + 100);
+  }
+
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST(SpscQueueTests, FullQueueDropsNewElements) {
+  safe::spsc_queue_t<int> queue {3};
+
+  // The capacity is rounded up to a power of two
+  for (int x = 0; x < 6; ++x) {
+    queue.raise(x);
+  }
+
+  for (int x = 0; x < 4; ++x) {
+    EXPECT_EQ(queue.pop(0ms), x);
+  }
+  EXPECT_FALSE(queue.pop(0ms));
+}
+
+TEST(SpscQueueTests, LimitDropsNewElements) {
+  safe::spsc_queue_t<int> queue {8};
+
+  queue.set_limit(2);
+  EXPECT_TRUE(queue.raise(0));
+  EXPECT_TRUE(queue.raise(1));
+  EXPECT_FALSE(queue.raise(2));
+  EXPECT_EQ(queue.size(), 2);
+
+  // Lowering the limit keeps what was queued, raising it makes room again
+  queue.set_limit(1);
+  EXPECT_FALSE(queue.raise(3));
+  queue.set_limit(100);
+  EXPECT_EQ(queue.limit(), queue.capacity());
+  EXPECT_TRUE(queue.raise(4));
+
+  EXPECT_EQ(queue.pop(0ms), 0);
+  EXPECT_EQ(queue.pop(0ms), 1);
+  EXPECT_EQ(queue.pop(0ms), 4);
+  EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(SpscQueueTests, PopTimesOut) {
+  safe::spsc_queue_t<std::unique_ptr<int>> queue;
+
+  EXPECT_EQ(queue.pop(1ms), nullptr);
+  EXPECT_TRUE(queue.running());
+}
+
+TEST(SpscQueueTests, StopWakesParkedConsumer) {
+  safe::spsc_queue_t<std::vector<float>> queue;
+
+  std::thread consumer {[&queue]() {
+    EXPECT_FALSE(queue.pop());
+  }};
+
+  std::this_thread::sleep_for(10ms);
+  queue.stop();
+  consumer.join();
+
+  queue.raise(std::vector<float>(1));
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST(SpscQueueTests, ElementsCrossThreads) {
+  safe::spsc_queue_t<int> requests;
+  safe::spsc_queue_t<int> responses;
+  constexpr int count = 10000;
+
+  std::thread echo {[&]() {
+    while (auto value = requests.pop()) {
+      responses.raise(*value);
+    }
+  }};
+
+  for (int x = 0; x < count; ++x) {
+    requests.raise(x);
+
+    // Sleep now and then, so the echo thread parks instead of spinning
+    if (x % 1000 == 0) {
+      std::this_thread::sleep_for(1ms);
+    }
+
+    auto value = responses.pop(1s);
+    ASSERT_TRUE(value);
+    EXPECT_EQ(*value, x);
+  }
+
+  requests.stop();
+  echo.join();
+}
+
+TEST(NotifyTests, RaiseCallsNotify) {
+  safe::queue_t<int> queue;
+  safe::event_t<int> event;
+
+  int notified = 0;
+  queue.notify_with([&notified]() {
+    ++notified;
+  });
+  event.notify_with([&notified]() {
+    ++notified;
+  });
+
+  queue.raise(1);
+  queue.raise(2);
+  event.raise(3);
+  EXPECT_EQ(notified, 3);
+  EXPECT_EQ(queue.pop(0ms), 1);
+  EXPECT_EQ(event.pop(0ms), 3);
+
+  // Nothing is notified once stopped, since nothing was raised
+  queue.stop();
+  queue.raise(4);
+  EXPECT_EQ(notified, 3);
+}
+
+TEST(SharedMapTests, SharesOneValueForEachKey) {
+  std::map<std::string, int> constructed;
+  int destructed = 0;
+  safe::shared_map_t<std::string, std::string> values {
+    [&](std::string &value, const std::string &key) {
+      value = key;
+      ++constructed[key];
+      return 0;
+    },
+    [&](std::string &) {
+      ++destructed;
+    },
+  };
+
+  {
+    // Like four sessions capturing two displays
+    auto a1 = values.ref("A");
+    auto b1 = values.ref("B");
+    auto a2 = values.ref("A");
+    auto b2 = values.ref("B");
+    ASSERT_TRUE(a1 && a2 && b1 && b2);
+
+    EXPECT_EQ(a1.get(), a2.get());
+    EXPECT_EQ(*b1.get(), "B");
+    EXPECT_EQ(constructed, (std::map<std::string, int> {{"A", 1}, {"B", 1}}));
+
+    // The value lives on for as long as any of its users does
+    a1.release();
+    EXPECT_EQ(destructed, 0);
+  }
+  EXPECT_EQ(destructed, 2);
+
+  // Taking a reference again constructs the value again
+  auto a = values.ref("A");
+  EXPECT_EQ(constructed["A"], 2);
+}
+
+TEST(SharedMapTests, FailedConstructionGivesNoReference) {
+  safe::shared_map_t<std::string, int> values {
+    [](int &, const std::string &key) {
+      return key == "missing" ? -1 : 0;
+    },
+    [](int &) {
+    },
+  };
+
+  EXPECT_FALSE(values.ref("missing"));
+  EXPECT_TRUE(values.ref("present"));
+}
@@ -0,0 +1,66 @@
+/**
+ * @file tests/unit/test_touch.cpp
+ * @brief Test the touch and pen transforms of src/input.*.
+ */
+#include "../tests_common.h"
+
+#include <src/input.h>
+
+namespace {
+  input::touch_port_t make_touch_port() {
+    input::touch_port_t touch_port;
+    touch_port.offset_x = 0;
+    touch_port.offset_y = 0;
+    touch_port.width = 1920;
+    touch_port.height = 1200;
+    touch_port.env_width = 1920;
+    touch_port.env_height = 1080;
+
+    // A 16:10 client streaming a 16:9 display, letterboxed at the top and bottom
+    touch_port.client_offsetX = 0.0f;
+    touch_port.client_offsetY = 60.0f;
+    touch_port.scalar_inv = 1.0f;
+
+    return touch_port;
+  }
+}  // namespace
+
+TEST(TouchTests, TransformsCoordinatesToTheTouchPort) {
+  auto touch_port = make_touch_port();
+
+  input::contact_batch_t contacts;
+  contacts.count = 3;
+  contacts.x = {0.0f, 32767.5f, 65535.0f};
+  contacts.y = {0.0f, 32767.5f, 65535.0f};
+
+  input::transform_contacts(touch_port, contacts);
+
+  // The letterbox is clamped to the edges of the display
+  EXPECT_FLOAT_EQ(contacts.x[0], 0.0f);
+  EXPECT_FLOAT_EQ(contacts.y[0], 0.0f);
+  EXPECT_FLOAT_EQ(contacts.x[1], 0.5f);
+  EXPECT_FLOAT_EQ(contacts.y[1], 0.5f);
+  EXPECT_FLOAT_EQ(contacts.x[2], 1.0f);
+  EXPECT_FLOAT_EQ(contacts.y[2], 1.0f);
+}
+
+TEST(TouchTests, ScalesContactAreasLikeSingleContacts) {
+  auto touch_port = make_touch_port();
+
+  input::contact_batch_t contacts;
+  contacts.count = 4;
+  contacts.contact_area_major = {1000.0f, 2000.0f, 3000.0f, 500.0f};
+  contacts.contact_area_minor = {500.0f, 0.0f, 1500.0f, 250.0f};
+  contacts.rotation = {0, 30, 135, LI_ROT_UNKNOWN};
+
+  auto expected = contacts;
+  input::transform_contacts(touch_port, contacts);
+
+  std::pair<float, float> scalar {touch_port.env_width / 65535.f, touch_port.env_height / 65535.f};
+  for (std::size_t i = 0; i < expected.count; ++i) {
+    auto area = input::scale_client_contact_area({expected.contact_area_major[i], expected.contact_area_minor[i]}, expected.rotation[i], scalar);
+
+    EXPECT_NEAR(contacts.contact_area_major[i], area.first, area.first * 1e-5f);
+    EXPECT_NEAR(contacts.contact_area_minor[i], area.second, area.second * 1e-5f);
+  }
+}
@@ -9,7 +9,7 @@
 struct EncoderTest: PlatformTestSuite, testing::WithParamInterface<video::encoder_t *> {
   void SetUp() override {
     auto &encoder = *GetParam();
-    if (!video::validate_encoder(encoder, false)) {
+    if (!video::validate_encoder(encoder, false, nullptr, &stages)) {
       // Encoder failed validation,
       // if it's software - fail, otherwise skip
       if (encoder.name == "software") {
@@ -19,6 +19,8 @@ struct EncoderTest: PlatformTestSuite, testing::WithParamInterface<video::encode
       }
     }
   }
+
+  video::probe_stages_t stages;
 };
 
 INSTANTIATE_TEST_SUITE_P(
@@ -49,6 +51,21 @@ TEST_P(EncoderTest, ValidateEncoder) {
   // todo:: test something besides fixture setup
 }
 
+TEST_P(EncoderTest, ReportsProbeStages) {
+  std::vector<std::string_view> names;
+  for (const auto &[name, duration] : stages) {
+    EXPECT_GE(duration.count(), 0);
+    names.emplace_back(name);
+  }
+
+  // Validation deferred for lack of a display stops after the first stage
+  ASSERT_FALSE(names.empty());
+  EXPECT_EQ(names.front(), "h264");
+  if (names.size() > 1) {
+    EXPECT_EQ(names, (std::vector<std::string_view> {"h264", "hevc", "av1", "hdr"}));
+  }
+}
+
 struct FramerateX100Test: testing::TestWithParam<std::tuple<std::int32_t, AVRational>> {};
 
 TEST_P(FramerateX100Test, Run) {
@@ -76,3 +93,418 @@ INSTANTIATE_TEST_SUITE_P(
     std::make_tuple(9498, AVRational {4749, 50})  // from my LG 27GN950
   )
 );
+
+TEST(FindSplicesTests, FindsParameterSetsBeforeFirstSlice) {
+  using namespace std::literals;
+
+  // H.264 SPS with a 4 byte start code, PPS, IDR slice, then a slice that looks like an SPS
+  auto sps = "\x00\x00\x00\x01\x67\x42\x00"sv;
+  auto pps = "\x00\x00\x01\x68\xCE"sv;
+  auto frame = std::string {sps} + std::string {pps} + "\x00\x00\x01\x65\x88\x84"s + std::string {sps};
+
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back(sps, "\x00\x00\x00\x01\x67\x42\x00\xFF"sv);
+
+  auto splices = video::find_splices(frame, replacements, false);
+  ASSERT_EQ(splices.size(), 1);
+  ASSERT_EQ(splices[0].offset, 0);
+  ASSERT_TRUE(video::splices_match(frame, splices));
+
+  // The parameter sets moved, so they have to be found again
+  auto moved = "\x00\x00\x01\x09\xF0"s + frame;
+  ASSERT_FALSE(video::splices_match(moved, splices));
+  splices = video::find_splices(moved, replacements, false);
+  ASSERT_EQ(splices.size(), 1);
+  ASSERT_EQ(splices[0].offset, 5);
+
+  // Nothing is looked for past the first slice
+  ASSERT_TRUE(video::find_splices("\x00\x00\x01\x65\x88"s + frame, replacements, false).empty());
+}
+
+TEST(CursorRoiTests, CentersRegionOnCursor) {
+  // A quarter of the frame height around the cursor
+  ASSERT_EQ(video::cursor_roi({960, 540}, 1920, 1080, 1920, 1080, 5), (video::roi_t {825, 405, 1095, 675, -5}));
+
+  // Scaled down with the image
+  ASSERT_EQ(video::cursor_roi({1920, 1080}, 3840, 2160, 1920, 1080, 5), (video::roi_t {825, 405, 1095, 675, -5}));
+
+  // Clipped to the frame, past the black bars of a 5:4 image in a 16:9 frame
+  ASSERT_EQ(video::cursor_roi({0, 0}, 1280, 1024, 1920, 1080, 5), (video::roi_t {150, 0, 420, 135, -5}));
+
+  // Not on the image
+  ASSERT_FALSE(video::cursor_roi({1920, 0}, 1920, 1080, 1920, 1080, 5));
+  ASSERT_FALSE(video::cursor_roi({-1, 10}, 1920, 1080, 1920, 1080, 5));
+}
+
+TEST(HysteresisTests, StepsOnceTheLoadLastedAndHoldsAfterwards) {
+  using namespace std::literals;
+  using step_e = video::hysteresis_t::step_e;
+
+  video::hysteresis_t hysteresis {1s, 5s, 3s};
+  auto now = video::hysteresis_t::clock::now();
+
+  // A load that doesn't last starts over
+  ASSERT_EQ(hysteresis.update(now, true, false), step_e::none);
+  ASSERT_EQ(hysteresis.update(now + 500ms, false, false), step_e::none);
+  ASSERT_EQ(hysteresis.update(now + 1s, true, false), step_e::none);
+  ASSERT_EQ(hysteresis.update(now + 2s, true, false), step_e::overloaded);
+
+  // Nothing steps while the estimates settle, and the load is only counted from the end of the hold
+  now += 2s;
+  ASSERT_EQ(hysteresis.update(now + 1s, true, false), step_e::none);
+  ASSERT_EQ(hysteresis.update(now + 3s, false, true), step_e::none);
+  ASSERT_EQ(hysteresis.update(now + 7s, false, true), step_e::none);
+  ASSERT_EQ(hysteresis.update(now + 8s, false, true), step_e::headroom);
+}
+
+TEST(HysteresisTests, ControllersSharingAHoldStepOneAtATime) {
+  using namespace std::literals;
+
+  auto hold = std::make_shared<video::hysteresis_t::hold_t>();
+  video::thread_scaler_t thread_scaler {16ms, 2, 4, hold};
+  video::resolution_scaler_t resolution_scaler {16ms, hold};
+  auto now = video::hysteresis_t::clock::now();
+
+  // Both are overloaded for a second, and only the first one updated steps
+  ASSERT_EQ(thread_scaler.update(now, 15ms), 2);
+  ASSERT_EQ(resolution_scaler.update(now, 15ms, 2ms), 100);
+  ASSERT_EQ(thread_scaler.update(now + 1s, 15ms), 4);
+  ASSERT_EQ(resolution_scaler.update(now + 1s, 15ms, 2ms), 100);
+
+  // The other one counts the load again from the end of the hold
+  now += 1s;
+  ASSERT_EQ(thread_scaler.update(now + 3s, 15ms), 4);
+  ASSERT_EQ(resolution_scaler.update(now + 3s, 15ms, 2ms), 100);
+  ASSERT_EQ(thread_scaler.update(now + 4s, 15ms), 4);
+  ASSERT_EQ(resolution_scaler.update(now + 4s, 15ms, 2ms), 75);
+}
+
+TEST(ResolutionScalerTests, StepsDownUnderLoadAndBackUpWithHeadroom) {
+  using namespace std::literals;
+
+  video::resolution_scaler_t scaler {16ms};
+  auto now = video::resolution_scaler_t::clock::now();
+
+  // A slow frame alone doesn't change the resolution
+  ASSERT_EQ(scaler.update(now, 15ms, 2ms), 100);
+  ASSERT_EQ(scaler.update(now + 500ms, 15ms, 2ms), 100);
+  ASSERT_EQ(scaler.update(now + 1s, 15ms, 2ms), 75);
+
+  // Nothing changes while the estimates settle on the new resolution
+  now += 1s;
+  ASSERT_EQ(scaler.update(now + 2s, 15ms, 15ms), 75);
+  ASSERT_EQ(scaler.update(now + 3s, 15ms, 15ms), 75);
+  ASSERT_EQ(scaler.update(now + 4s, 15ms, 15ms), 50);
+
+  // 4 ms at half the resolution would take 9 ms at 75%, which fits
+  now += 4s;
+  ASSERT_EQ(scaler.update(now + 3s, 4ms, 2ms), 50);
+  ASSERT_EQ(scaler.update(now + 8s, 4ms, 2ms), 75);
+
+  // 8 ms at 75% would take about 14 ms at full resolution, which doesn't
+  now += 8s;
+  ASSERT_EQ(scaler.update(now + 3s, 8ms, 2ms), 75);
+  ASSERT_EQ(scaler.update(now + 10s, 8ms, 2ms), 75);
+}
+
+TEST(ResolutionScalerTests, ScalesDimensionsToMultiplesOf8) {
+  ASSERT_EQ(video::resolution_scaler_t::scaled_dimension(1366, 100), 1366);
+  ASSERT_EQ(video::resolution_scaler_t::scaled_dimension(1920, 75), 1440);
+  ASSERT_EQ(video::resolution_scaler_t::scaled_dimension(1366, 75), 1024);
+  ASSERT_EQ(video::resolution_scaler_t::scaled_dimension(1080, 50), 536);
+}
+
+TEST(ThreadScalerTests, StaysWithinTheThreadBounds) {
+  using namespace std::literals;
+
+  video::thread_scaler_t scaler {16ms, 3, 8};
+  auto now = video::thread_scaler_t::clock::now();
+
+  // Doubling 6 threads would go past the most there may be
+  ASSERT_EQ(scaler.update(now, 14ms), 3);
+  ASSERT_EQ(scaler.update(now + 1s, 14ms), 6);
+  now += 1s;
+  ASSERT_EQ(scaler.update(now + 3s, 14ms), 6);
+  ASSERT_EQ(scaler.update(now + 4s, 14ms), 8);
+
+  // Without more threads to add, the load doesn't count toward a step
+  now += 4s;
+  ASSERT_EQ(scaler.update(now + 3s, 14ms), 8);
+  ASSERT_EQ(scaler.update(now + 4s, 2ms), 8);
+  ASSERT_EQ(scaler.update(now + 14s, 2ms), 4);
+
+  // Halving 4 threads would go below the fewest there may be
+  now += 14s;
+  ASSERT_EQ(scaler.update(now + 3s, 2ms), 4);
+  ASSERT_EQ(scaler.update(now + 13s, 2ms), 3);
+  ASSERT_EQ(scaler.update(now + 30s, 2ms), 3);
+}
+
+TEST(ThreadScalerTests, ChangesTheThreadsFromTheSliceEncodeTime) {
+  using namespace std::literals;
+
+  video::thread_scaler_t scaler {16ms, 2, 8};
+  auto now = video::thread_scaler_t::clock::now();
+
+  // 11 ms is below 75% of the frame interval, so the session keeps its encoder
+  ASSERT_EQ(scaler.update(now, 11ms), 2);
+  ASSERT_EQ(scaler.update(now + 2s, 11ms), 2);
+
+  // 13 ms isn't, and the new thread count is what the encoder is started again with
+  now += 2s;
+  ASSERT_EQ(scaler.update(now, 13ms), 2);
+  ASSERT_EQ(scaler.update(now + 1s, 13ms), 4);
+
+  // 4 ms would take about 8 ms with half the threads, which is more than 40% of the frame interval
+  now += 1s;
+  ASSERT_EQ(scaler.update(now + 3s, 4ms), 4);
+  ASSERT_EQ(scaler.update(now + 13s, 4ms), 4);
+
+  // 3 ms would take about 6 ms, which isn't
+  now += 13s;
+  ASSERT_EQ(scaler.update(now, 3ms), 4);
+  ASSERT_EQ(scaler.update(now + 10s, 3ms), 2);
+}
+
+TEST(PresetTunerTests, StepsToFasterPresetsUnderLoadAndBackWithHeadroom) {
+  using namespace std::literals;
+
+  video::preset_tuner_t tuner {16ms, 50, 2};
+  auto now = video::preset_tuner_t::clock::now();
+
+  // Frames over the budget of 8 ms for a second step to a faster preset
+  ASSERT_EQ(tuner.update(now, 10ms), 0);
+  ASSERT_EQ(tuner.update(now + 500ms, 10ms), 0);
+  ASSERT_EQ(tuner.update(now + 1s, 10ms), 1);
+
+  // Nothing changes while the estimate settles on the new preset
+  now += 1s;
+  ASSERT_EQ(tuner.update(now + 2s, 10ms), 1);
+  ASSERT_EQ(tuner.update(now + 3s, 10ms), 1);
+  ASSERT_EQ(tuner.update(now + 4s, 10ms), 2);
+
+  // There is no faster preset
+  now += 4s;
+  ASSERT_EQ(tuner.update(now + 3s, 10ms), 2);
+  ASSERT_EQ(tuner.update(now + 5s, 10ms), 2);
+
+  // 5 ms is more than half of the budget, which isn't enough to go back
+  now += 5s;
+  ASSERT_EQ(tuner.update(now, 5ms), 2);
+  ASSERT_EQ(tuner.update(now + 15s, 5ms), 2);
+
+  now += 15s;
+  ASSERT_EQ(tuner.update(now, 3ms), 2);
+  ASSERT_EQ(tuner.update(now + 10s, 3ms), 1);
+}
+
+TEST(ReinitBackoffTests, WaitsLongerUntilTheCaptureStaysBack) {
+  using namespace std::literals;
+  using backoff_t = video::reinit_backoff_t;
+
+  backoff_t backoff {1};
+  auto now = backoff_t::clock::now();
+
+  // The first loss tries the fast path, then waits longer after each failed attempt
+  ASSERT_TRUE(backoff.start(now));
+  auto expected = std::chrono::milliseconds {backoff_t::MIN_DELAY};
+  for (int x = 0; x < 8; ++x) {
+    auto delay = backoff.next_delay();
+    ASSERT_GE(delay, expected * (100 - backoff_t::JITTER_PERCENTAGE) / 100);
+    ASSERT_LE(delay, expected * (100 + backoff_t::JITTER_PERCENTAGE) / 100);
+
+    expected = std::min<std::chrono::milliseconds>(expected * 2, backoff_t::MAX_DELAY);
+  }
+
+  // Losing the capture right after it came back keeps waiting as long
+  backoff.recovered(now);
+  ASSERT_FALSE(backoff.start(now + 1s));
+  ASSERT_GE(backoff.next_delay(), backoff_t::MAX_DELAY * (100 - backoff_t::JITTER_PERCENTAGE) / 100);
+
+  // Once it stayed back for a while, the next loss starts over
+  backoff.recovered(now + 2s);
+  ASSERT_TRUE(backoff.start(now + 10s));
+  ASSERT_LE(backoff.next_delay(), backoff_t::MIN_DELAY * (100 + backoff_t::JITTER_PERCENTAGE) / 100);
+}
+
+TEST(EncoderWatchdogTests, NoticesStalledEncodeCalls) {
+  using namespace std::literals;
+
+  video::encoder_watchdog_t watchdog;
+  auto now = video::encoder_watchdog_t::clock::now();
+
+  // Nothing to check between frames
+  ASSERT_FALSE(watchdog.check(now + 10s));
+
+  watchdog.start(now);
+  ASSERT_FALSE(watchdog.check(now + 1s));
+  ASSERT_FALSE(watchdog.finish(now + 1s));
+
+  // A call still running past the timeout is reported once
+  now += 1s;
+  watchdog.start(now);
+  ASSERT_EQ(watchdog.check(now + 3s), 3s);
+  ASSERT_FALSE(watchdog.check(now + 4s));
+  ASSERT_TRUE(watchdog.finish(now + 5s));
+
+  // A call that ran past the timeout between two checks counts too
+  watchdog.reset();
+  now += 5s;
+  watchdog.start(now);
+  ASSERT_TRUE(watchdog.finish(now + 3s));
+}
+
+TEST(EncoderWatchdogTests, RetriesTheSameEncoderBeforeTheNextOne) {
+  using namespace std::literals;
+  using action_e = video::encoder_watchdog_t::action_e;
+
+  video::encoder_watchdog_t watchdog;
+  auto now = video::encoder_watchdog_t::clock::now();
+
+  ASSERT_EQ(watchdog.on_failure(now, true).action, action_e::reinit);
+  ASSERT_EQ(watchdog.on_failure(now + 10s, true).action, action_e::next_encoder);
+
+  // The next encoder gets a retry of its own
+  ASSERT_EQ(watchdog.on_failure(now + 20s, true).action, action_e::reinit);
+
+  // Failures far apart don't add up
+  ASSERT_EQ(watchdog.on_failure(now + 60s, true).action, action_e::reinit);
+  ASSERT_EQ(watchdog.on_failure(now + 80s, true).action, action_e::next_encoder);
+}
+
+TEST(EncoderWatchdogTests, GivesUpOnEncodersThatNeverStart) {
+  using namespace std::literals;
+  using action_e = video::encoder_watchdog_t::action_e;
+
+  video::encoder_watchdog_t watchdog;
+  auto now = video::encoder_watchdog_t::clock::now();
+
+  // Two encoders passed validation, and neither gets an encode session
+  std::vector<std::string_view> encoders {"nvenc", "software"};
+  std::vector<std::string_view> started;
+  auto make_encode_session = [&](std::string_view encoder) {
+    started.push_back(encoder);
+    return std::unique_ptr<video::encode_session_t> {};
+  };
+
+  // Like capture_async(), which ends the session once the watchdog gives up
+  std::size_t encoder = 0;
+  std::vector<std::chrono::milliseconds> delays;
+  while (!make_encode_session(encoders[encoder])) {
+    auto failover = watchdog.on_failure(now, encoder + 1 < encoders.size());
+    if (failover.action == action_e::give_up) {
+      break;
+    }
+
+    if (failover.action == action_e::next_encoder) {
+      ++encoder;
+    } else {
+      delays.push_back(failover.delay);
+    }
+    now += failover.delay;
+  }
+
+  // Each encoder got a retry, then the last one was started again a few more times, further and further apart
+  ASSERT_EQ(std::count(std::begin(started), std::end(started), "nvenc"), 2);
+  ASSERT_EQ(std::count(std::begin(started), std::end(started), "software"), video::encoder_watchdog_t::MAX_RESTARTS + 1);
+  ASSERT_EQ(delays, (std::vector<std::chrono::milliseconds> {0ms, 0ms, 250ms, 500ms, 1000ms, 2000ms}));
+}
+
+TEST(EncoderWatchdogTests, FailuresFarApartNeverGiveUp) {
+  using namespace std::literals;
+  using action_e = video::encoder_watchdog_t::action_e;
+
+  video::encoder_watchdog_t watchdog;
+  auto now = video::encoder_watchdog_t::clock::now();
+
+  for (int x = 0; x < video::encoder_watchdog_t::MAX_RESTARTS * 2; ++x) {
+    now += video::encoder_watchdog_t::RETRY_WINDOW;
+
+    auto failover = watchdog.on_failure(now, false);
+    ASSERT_EQ(failover.action, action_e::reinit);
+    ASSERT_EQ(failover.delay, 0ms);
+  }
+}
+
+struct FasterPresetTest: testing::TestWithParam<std::tuple<std::string_view, std::string_view, int, std::string_view>> {};
+
+TEST_P(FasterPresetTest, Run) {
+  auto [codec_name, preset, steps, expected] = GetParam();
+  ASSERT_EQ(video::faster_preset(codec_name, preset, steps), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  FasterPresetTests,
+  FasterPresetTest,
+  testing::Values(
+    std::make_tuple("libx264", "medium", 2, "faster"),
+    std::make_tuple("libx265", "superfast", 3, "ultrafast"),
+    std::make_tuple("libsvtav1", "11", 1, "12"),
+    std::make_tuple("libsvtav1", "12", 4, "13"),
+    std::make_tuple("hevc_qsv", "4", 2, "6"),
+    std::make_tuple("h264_nvenc", "16", 1, "15"),
+    std::make_tuple("av1_nvenc", "13", 3, "12"),
+    std::make_tuple("h264_nvenc", "5", 1, "5"),
+    std::make_tuple("h264_vaapi", "1", 1, "1"),
+    std::make_tuple("libx264", "unknown", 1, "unknown")
+  )
+);
+
+TEST(ContentDetectorTests, SwitchesBetweenStaticContentAndMotion) {
+  using namespace std::literals;
+
+  video::content_detector_t detector;
+  auto now = video::content_detector_t::clock::now();
+
+  // Encode frames at 60 fps, with a new image every so many of them
+  auto feed = [&](std::chrono::milliseconds duration, int captured_every) {
+    auto is_static = false;
+    for (auto x = 0; x * 16ms < duration; ++x) {
+      is_static = detector.update(now, x % captured_every == 0);
+      now += 16ms;
+    }
+    return is_static;
+  };
+
+  // A game has a new image for every frame, a desktop only now and then
+  ASSERT_FALSE(feed(4s, 1));
+  ASSERT_TRUE(feed(4s, 10));
+
+  // Motion right after a switch waits for the next encoder to have been worth it
+  ASSERT_TRUE(feed(4s, 1));
+  ASSERT_FALSE(feed(10s, 1));
+
+  // A video at half the frame rate isn't static either
+  ASSERT_FALSE(feed(20s, 2));
+}
+
+TEST(IdleDetectorTests, GoesIdleWithoutInputOrChangedFrames) {
+  using namespace std::literals;
+
+  video::idle_detector_t detector {10s};
+  auto now = video::idle_detector_t::clock::now();
+  video::idle_detector_t::clock::time_point last_input {};
+
+  ASSERT_FALSE(detector.update(now, true, last_input));
+  ASSERT_FALSE(detector.update(now + 9s, false, last_input));
+  ASSERT_TRUE(detector.update(now + 10s, false, last_input));
+
+  // Input brings the stream back at once, and it goes idle again after another timeout without any
+  last_input = now + 12s;
+  ASSERT_FALSE(detector.update(now + 12s, false, last_input));
+  ASSERT_TRUE(detector.update(now + 22s, false, last_input));
+
+  // So does a changed frame
+  ASSERT_FALSE(detector.update(now + 30s, true, last_input));
+  ASSERT_TRUE(detector.update(now + 40s, false, last_input));
+}
+
+TEST(IdleDetectorTests, NeverGoesIdleWithoutTimeout) {
+  using namespace std::literals;
+
+  video::idle_detector_t detector {0s};
+  auto now = video::idle_detector_t::clock::now();
+
+  ASSERT_FALSE(detector.update(now, false, {}));
+  ASSERT_FALSE(detector.update(now + 1h, false, {}));
+}
@@ -0,0 +1,67 @@
+/**
+ * @file tests/unit/test_video_quality.cpp
+ * @brief Test src/video_quality.*
+ */
+#include "../tests_common.h"
+
+#include <cmath>
+#include <src/video_quality.h>
+#include <vector>
+
+namespace {
+  video_quality::plane_t plane_of(const std::vector<std::uint8_t> &data, int width, int height, int bytes_per_sample = 1, int shift = 0) {
+    return {data.data(), width * bytes_per_sample, width, height, bytes_per_sample, shift};
+  }
+}  // namespace
+
+TEST(VideoQualityTests, IdenticalPlanesArePerfect) {
+  std::vector<std::uint8_t> source(32 * 16);
+  for (std::size_t x = 0; x < source.size(); ++x) {
+    source[x] = x * 7 % 256;
+  }
+
+  auto plane = plane_of(source, 32, 16);
+  EXPECT_DOUBLE_EQ(video_quality::psnr(plane, plane, 8), 100.0);
+  EXPECT_NEAR(video_quality::ssim(plane, plane, 8), 1.0, 1e-9);
+}
+
+TEST(VideoQualityTests, PsnrFollowsTheMeanSquaredError) {
+  std::vector<std::uint8_t> source(16 * 16, 100);
+  std::vector<std::uint8_t> image(16 * 16, 110);
+
+  // A mean squared error of 100
+  EXPECT_NEAR(video_quality::psnr(plane_of(source, 16, 16), plane_of(image, 16, 16), 8), 10.0 * std::log10(255.0 * 255.0 / 100.0), 1e-9);
+}
+
+TEST(VideoQualityTests, SsimDropsWithNoise) {
+  std::vector<std::uint8_t> source(64 * 64);
+  std::vector<std::uint8_t> slightly(source.size());
+  std::vector<std::uint8_t> heavily(source.size());
+  for (std::size_t x = 0; x < source.size(); ++x) {
+    source[x] = (x % 64) * 4;
+    slightly[x] = source[x] + (x % 3 == 0 ? 4 : 0);
+    heavily[x] = source[x] ^ (x * 37 % 64);
+  }
+
+  auto slight = video_quality::ssim(plane_of(source, 64, 64), plane_of(slightly, 64, 64), 8);
+  auto heavy = video_quality::ssim(plane_of(source, 64, 64), plane_of(heavily, 64, 64), 8);
+  EXPECT_LT(slight, 1.0);
+  EXPECT_GT(slight, 0.9);
+  EXPECT_LT(heavy, slight);
+}
+
+TEST(VideoQualityTests, ShiftedSamplesMatchUnshiftedOnes) {
+  // 10 bit samples in the high bits, like P010, and in the low bits, like the planar formats decoders output
+  std::vector<std::uint8_t> high(8 * 8 * 2);
+  std::vector<std::uint8_t> low(8 * 8 * 2);
+  for (int x = 0; x < 8 * 8; ++x) {
+    std::uint16_t sample = x * 16;
+    std::uint16_t shifted = sample << 6;
+    high[x * 2] = shifted & 0xFF;
+    high[x * 2 + 1] = shifted >> 8;
+    low[x * 2] = sample & 0xFF;
+    low[x * 2 + 1] = sample >> 8;
+  }
+
+  EXPECT_DOUBLE_EQ(video_quality::psnr(plane_of(high, 8, 8, 2, 6), plane_of(low, 8, 8, 2, 0), 10), 100.0);
+}
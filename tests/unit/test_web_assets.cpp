@@ -0,0 +1,134 @@
+/**
+ * @file tests/unit/test_web_assets.cpp
+ * @brief Test src/web_assets.*.
+ */
+#include "../tests_common.h"
+
+#include <filesystem>
+#include <fstream>
+#include <zlib.h>
+
+#include <src/web_assets.h>
+
+namespace {
+  std::string gunzip(const std::string &data) {
+    z_stream stream {};
+    inflateInit2(&stream, 15 + 16);
+
+    std::string out(1 << 20, '\0');
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = (uInt) data.size();
+    stream.next_out = (Bytef *) out.data();
+    stream.avail_out = (uInt) out.size();
+
+    auto status = inflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    inflateEnd(&stream);
+
+    return status == Z_STREAM_END ? out : std::string {};
+  }
+}  // namespace
+
+TEST(WebAssetsTest, GzipRoundTrips) {
+  std::string page;
+  for (int x = 0; x < 1000; ++x) {
+    page += "<div class=\"card\">" + std::to_string(x) + "</div>\n";
+  }
+
+  auto gzipped = web_assets::gzip(page);
+  ASSERT_FALSE(gzipped.empty());
+  EXPECT_LT(gzipped.size(), page.size() / 4);
+  EXPECT_EQ(gunzip(gzipped), page);
+}
+
+struct WebAssetsAcceptsGzipTest: testing::TestWithParam<std::tuple<std::string, bool>> {};
+
+TEST_P(WebAssetsAcceptsGzipTest, Run) {
+  auto [accept_encoding, expected] = GetParam();
+  EXPECT_EQ(web_assets::accepts_gzip(accept_encoding), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  WebAssetsTests,
+  WebAssetsAcceptsGzipTest,
+  testing::Values(
+    std::make_tuple("gzip, deflate, br, zstd", true),
+    std::make_tuple("br;q=1.0, GZIP;q=0.5", true),
+    std::make_tuple("gzip;q=0", false),
+    std::make_tuple("gzip;q=0.0, *", false),
+    std::make_tuple("*", true),
+    std::make_tuple("identity", false),
+    std::make_tuple("", false)
+  )
+);
+
+struct WebAssetsMatchesEtagTest: testing::TestWithParam<std::tuple<std::string, bool>> {};
+
+TEST_P(WebAssetsMatchesEtagTest, Run) {
+  auto [if_none_match, expected] = GetParam();
+  EXPECT_EQ(web_assets::matches_etag(if_none_match, R"(W/"0123456789abcdef")"), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  WebAssetsTests,
+  WebAssetsMatchesEtagTest,
+  testing::Values(
+    std::make_tuple(R"(W/"0123456789abcdef")", true),
+    std::make_tuple(R"("0123456789abcdef")", true),
+    std::make_tuple(R"("other", W/"0123456789abcdef")", true),
+    std::make_tuple("*", true),
+    std::make_tuple(R"("0123456789abcdee")", false),
+    std::make_tuple("", false)
+  )
+);
+
+struct WebAssetsFingerprintedTest: testing::TestWithParam<std::tuple<std::string, bool>> {};
+
+TEST_P(WebAssetsFingerprintedTest, Run) {
+  auto [filename, expected] = GetParam();
+  EXPECT_EQ(web_assets::is_fingerprinted(filename), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  WebAssetsTests,
+  WebAssetsFingerprintedTest,
+  testing::Values(
+    std::make_tuple("index-BKm3TJ_a.js", true),
+    std::make_tuple("bootstrap.min-D2-x_9Qa.css", true),
+    std::make_tuple("en.json", false),
+    std::make_tuple("logo-sunshine-45.png", false),
+    std::make_tuple("index.html", false)
+  )
+);
+
+TEST(WebAssetsTest, CachesUntilTheFileChanges) {
+  auto path = std::filesystem::temp_directory_path() / "sunshine_test_web_assets.html";
+  std::string page(4096, 'a');
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << page;
+  }
+
+  auto asset = web_assets::get(path, "text/html; charset=utf-8");
+  ASSERT_NE(asset, nullptr);
+  EXPECT_EQ(asset->content, page);
+  EXPECT_EQ(gunzip(asset->gzipped), page);
+  EXPECT_FALSE(asset->fingerprinted);
+  EXPECT_EQ(web_assets::get(path, "text/html; charset=utf-8"), asset);
+
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "changed";
+  }
+  std::filesystem::last_write_time(path, asset->modified + std::chrono::seconds(1));
+
+  auto changed = web_assets::get(path, "text/html; charset=utf-8");
+  ASSERT_NE(changed, nullptr);
+  EXPECT_EQ(changed->content, "changed");
+  EXPECT_TRUE(changed->gzipped.empty());
+  EXPECT_NE(changed->etag, asset->etag);
+
+  web_assets::clear();
+  std::filesystem::remove(path);
+  EXPECT_EQ(web_assets::get(path, "text/html; charset=utf-8"), nullptr);
+}
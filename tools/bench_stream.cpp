@@ -0,0 +1,316 @@
+/**
+ * @file tools/bench_stream.cpp
+ * @brief Measures the functions the video, audio and control broadcasts spend their time in for each packet,
+ * across frame sizes, packet sizes and FEC percentages, and reports them as a table or as JSON.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern "C" {
+  // clang-format off
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include "src/rswrapper.h"
+  // clang-format on
+}
+
+// local includes
+#include "src/crypto.h"
+#include "src/logging.h"
+#include "src/stream.h"
+#include "src/video.h"
+
+using namespace std::literals;
+
+namespace stream {
+  void apply_splices(std::vector<uint8_t> &head, std::string_view &tail, const std::vector<video::packet_raw_t::splice_t> &splices);
+}
+
+namespace {
+  constexpr auto MIN_DURATION = 250ms;
+
+  // Like Moonlight asks for by default
+  constexpr std::size_t MIN_PARITY_SHARDS = 2;
+
+  // P-frames at low and high bitrates up to IDR frames at high resolutions
+  constexpr std::size_t FRAME_SIZES[] = {10 * 1024, 50 * 1024, 250 * 1024, 1024 * 1024, 2 * 1024 * 1024};
+  constexpr std::size_t PACKET_SIZES[] = {1024, 1392};
+  constexpr std::size_t FEC_PERCENTAGES[] = {0, 20, 50};
+
+  // The packet headers of a video shard, as the video broadcast lays them out
+  struct video_packet_raw_t {
+    RTP_PACKET rtp;
+    char reserved[4];
+
+    NV_VIDEO_PACKET packet;
+  };
+
+  struct result_t {
+    std::string name;
+    std::size_t size;  ///< The size of the frame or message each call handles
+    std::size_t packet_size;
+    std::size_t fec_percentage;
+    double ns_per_op;
+    double mb_per_s;
+  };
+
+  std::vector<result_t> results;
+
+  /**
+   * @brief Run a function until it took long enough to time, and record the time per call.
+   * @param name The name of the benchmark.
+   * @param size The number of payload bytes each call handles.
+   * @param packet_size The packet size, or 0 if it doesn't apply.
+   * @param fec_percentage The FEC percentage.
+   * @param fn The function to time.
+   */
+  template<class F>
+  void run(const char *name, std::size_t size, std::size_t packet_size, std::size_t fec_percentage, F &&fn) {
+    // Warm up the caches and the buffer pool before measuring
+    fn();
+
+    std::uint64_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    do {
+      fn();
+      ++iterations;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed < MIN_DURATION);
+
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    results.push_back({
+      name,
+      size,
+      packet_size,
+      fec_percentage,
+      seconds * 1e9 / iterations,
+      (double) iterations * size / seconds / 1e6,
+    });
+  }
+
+  /**
+   * @brief Split a frame into FEC blocks the way the video broadcast does.
+   * @return The offset and size of each FEC block in the frame.
+   */
+  std::vector<std::pair<std::size_t, std::size_t>> plan_fec_blocks(std::size_t frame_size, std::size_t blocksize, std::size_t &fec_percentage) {
+    auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
+    auto frame_shards = (frame_size + (payload_blocksize - 1)) / payload_blocksize;
+
+    fec_percentage = stream::video_fec::fit_percentage((int) fec_percentage, frame_shards, stream::video_fec::MAX_FEC_BLOCKS);
+
+    auto max_data_shards_per_fec_block = (stream::video_fec::MAX_BLOCK_SHARDS * 100) / (100 + fec_percentage);
+    auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
+    auto fec_blocks_needed = std::min<std::size_t>((frame_shards * blocksize + (max_data_per_fec_block - 1)) / max_data_per_fec_block, stream::video_fec::MAX_FEC_BLOCKS);
+    auto shards_per_fec_block = (frame_shards + (fec_blocks_needed - 1)) / fec_blocks_needed;
+
+    std::vector<std::pair<std::size_t, std::size_t>> blocks;
+    for (std::size_t x = 0; x < fec_blocks_needed; ++x) {
+      auto offset = x * shards_per_fec_block * payload_blocksize;
+      auto size = x == fec_blocks_needed - 1 ? frame_size - offset : shards_per_fec_block * payload_blocksize;
+      blocks.emplace_back(offset, size);
+    }
+
+    return blocks;
+  }
+
+  /**
+   * @brief Stamp the video packet headers of the data shards of a FEC block, like the video broadcast does.
+   */
+  void stamp_headers(stream::fec::fec_t &shards, int block_index, int fec_blocks, std::uint32_t lowseq) {
+    auto packets = shards.data_shards;
+
+    for (std::size_t x = 0; x < packets; ++x) {
+      auto *inspect = (video_packet_raw_t *) shards.header(x);
+
+      inspect->packet.frameIndex = 1;
+      inspect->packet.streamPacketIndex = (lowseq + x) << 8;
+      inspect->packet.multiFecFlags = 0x10;
+      inspect->packet.multiFecBlocks = (block_index << 4) | ((fec_blocks - 1) << 6);
+
+      inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
+      if (x == 0) {
+        inspect->packet.flags |= FLAG_SOF;
+      }
+      if (x == packets - 1) {
+        inspect->packet.flags |= FLAG_EOF;
+      }
+    }
+  }
+
+  /**
+   * @brief Measure preparing the FEC blocks of a video frame.
+   * @details The frame comes in a payload split across two buffers, like a frame with its header replaced.
+   */
+  void bench_video(const std::vector<std::uint8_t> &frame, std::size_t packet_size, std::size_t requested_percentage) {
+    auto blocksize = packet_size + MAX_RTP_HEADER_SIZE;
+    auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
+
+    auto fec_percentage = requested_percentage;
+    auto blocks = plan_fec_blocks(frame.size(), blocksize, fec_percentage);
+
+    auto head_size = std::min<std::size_t>(frame.size(), 100);
+    std::array<std::string_view, 2> payload {
+      std::string_view {(const char *) frame.data(), head_size},
+      std::string_view {(const char *) frame.data() + head_size, frame.size() - head_size},
+    };
+
+    stream::fec::rs_cache_t rs_cache;
+
+    run("slice", frame.size(), packet_size, requested_percentage, [&]() {
+      for (auto &[offset, size] : blocks) {
+        auto shards = stream::fec::slice(payload, offset, size, payload_blocksize, fec_percentage, MIN_PARITY_SHARDS, sizeof(video_packet_raw_t), 0);
+      }
+    });
+
+    // The shards are sliced once, so only the stamping and the parity are timed
+    std::vector<stream::fec::fec_t> sliced;
+    for (auto &[offset, size] : blocks) {
+      sliced.emplace_back(stream::fec::slice(payload, offset, size, payload_blocksize, fec_percentage, MIN_PARITY_SHARDS, sizeof(video_packet_raw_t), 0));
+    }
+
+    run("stamp_headers", frame.size(), packet_size, requested_percentage, [&]() {
+      std::uint32_t lowseq = 0;
+      for (std::size_t x = 0; x < sliced.size(); ++x) {
+        stamp_headers(sliced[x], (int) x, (int) sliced.size(), lowseq);
+        lowseq += sliced[x].size();
+      }
+    });
+
+    if (fec_percentage == 0) {
+      return;
+    }
+
+    run("fec_encode", frame.size(), packet_size, requested_percentage, [&]() {
+      for (auto &shards : sliced) {
+        stream::fec::encode(shards, rs_cache);
+      }
+    });
+  }
+
+  /**
+   * @brief Measure replacing the headers at the start of an IDR frame.
+   */
+  void bench_splices(const std::vector<std::uint8_t> &frame) {
+    std::string_view original {(const char *) frame.data(), frame.size()};
+
+    // The VUI of the SPS and the PPS, near the start of the frame
+    std::string replacement(40, 'n');
+    std::vector<video::packet_raw_t::splice_t> splices {
+      {20, original.substr(20, 32), replacement},
+      {80, original.substr(80, 8), std::string_view {replacement}.substr(0, 10)},
+    };
+
+    std::vector<std::uint8_t> head;
+    run("apply_splices", frame.size(), 0, 0, [&]() {
+      head.clear();
+      auto tail = original;
+      stream::apply_splices(head, tail, splices);
+    });
+  }
+
+  /**
+   * @brief Measure encrypting audio packets and control messages, like `encode_audio()` and `send_control()`.
+   */
+  void bench_ciphers() {
+    crypto::aes_t key(16, 0x42);
+
+    // An Opus packet of 5 ms at a high bitrate, padded to the block size
+    std::vector<std::uint8_t> audio_packet(240, 0x55);
+    std::vector<std::uint8_t> audio_cipher(audio_packet.size() + 32);
+    crypto::cipher::cbc_t cbc {key, true};
+    crypto::aes_t audio_iv(16);
+
+    run("encode_audio", audio_packet.size(), 0, 0, [&]() {
+      ++audio_iv[0];
+      cbc.encrypt(std::string_view {(const char *) audio_packet.data(), audio_packet.size()}, audio_cipher.data(), &audio_iv);
+    });
+
+    // A periodic ping and a rumble message
+    for (std::size_t size : {8, 64}) {
+      std::vector<std::uint8_t> message(size, 0x33);
+      std::vector<std::uint8_t> tagged_cipher(size + crypto::cipher::tag_size + 16);
+      crypto::cipher::gcm_t gcm {key, false};
+      crypto::aes_t control_iv(12);
+      std::uint32_t seq = 0;
+
+      run("encode_control", message.size(), 0, 0, [&]() {
+        ++seq;
+        std::memcpy(control_iv.data(), &seq, sizeof(seq));
+        control_iv[10] = 'H';
+        control_iv[11] = 'C';
+        gcm.encrypt(std::string_view {(const char *) message.data(), message.size()}, tagged_cipher.data(), &control_iv);
+      });
+    }
+  }
+
+  void print_table() {
+    std::printf("%-16s %10s %8s %5s %14s %12s\n", "benchmark", "size", "packet", "fec", "ns/op", "MB/s");
+    for (auto &result : results) {
+      std::printf("%-16s %10zu %8zu %4zu%% %14.0f %12.1f\n", result.name.c_str(), result.size, result.packet_size, result.fec_percentage, result.ns_per_op, result.mb_per_s);
+    }
+  }
+
+  void print_json() {
+    std::printf("{\n  \"benchmarks\": [\n");
+    for (std::size_t x = 0; x < results.size(); ++x) {
+      auto &result = results[x];
+      std::printf(
+        "    {\"name\": \"%s\", \"size\": %zu, \"packet_size\": %zu, \"fec_percentage\": %zu, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f}%s\n",
+        result.name.c_str(),
+        result.size,
+        result.packet_size,
+        result.fec_percentage,
+        result.ns_per_op,
+        result.mb_per_s,
+        x + 1 == results.size() ? "" : ","
+      );
+    }
+    std::printf("  ]\n}\n");
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  bool json = argc > 1 && argv[1] == "--json"sv;
+  if (argc > 2 || (argc == 2 && !json)) {
+    std::printf("Usage: %s [--json]\n", argv[0]);
+    return 1;
+  }
+
+  auto log_deinit_guard = logging::init(3, "bench_stream.log");
+  reed_solomon_init();
+
+  std::minstd_rand rand;
+  for (auto frame_size : FRAME_SIZES) {
+    std::vector<std::uint8_t> frame(frame_size);
+    for (auto &byte : frame) {
+      byte = (std::uint8_t) rand();
+    }
+
+    for (auto packet_size : PACKET_SIZES) {
+      for (auto fec_percentage : FEC_PERCENTAGES) {
+        bench_video(frame, packet_size, fec_percentage);
+      }
+    }
+
+    bench_splices(frame);
+  }
+
+  bench_ciphers();
+
+  if (json) {
+    print_json();
+  } else {
+    print_table();
+  }
+
+  return 0;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file tools/bench_sunshine.cpp
+ * @brief Streams a synthetic display through the whole video pipeline to a loopback client, and reports the time
+ * spent in each stage, the throughput and the CPU time per frame.
+ */
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  // clang-format off
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include "src/rswrapper.h"
+  // clang-format on
+}
+
+// local includes
+#include "src/buffer_pool.h"
+#include "src/config.h"
+#include "src/crypto.h"
+#include "src/frame_trace.h"
+#include "src/globals.h"
+#include "src/input.h"
+#include "src/logging.h"
+#include "src/network.h"
+#include "src/platform/common.h"
+#include "src/rtsp.h"
+#include "src/stream.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "tools/loopback_client.h"
+#include "tools/synthetic_display.h"
+
+using namespace std::literals;
+
+namespace {
+  using steady_clock = std::chrono::steady_clock;
+
+  struct options_t {
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int codec = 0;  ///< 0 - H.264, 1 - HEVC, 2 - AV1, like video::config_t::videoFormat
+    int bitrate = 20000;  ///< In Kbps
+    int packetsize = 1392;
+    std::optional<int> fec;  ///< Overrides the fec_percentage option
+    bool encrypt = true;
+    std::chrono::seconds warmup = 2s;
+    std::chrono::seconds duration = 10s;
+  };
+
+  void print_usage(const char *name) {
+    std::printf(
+      "Usage: %s [options] [sunshine.conf] [name=value...]\n"
+      "  --width <pixels>        Width of the synthetic display and the stream (1920)\n"
+      "  --height <pixels>       Height of the synthetic display and the stream (1080)\n"
+      "  --fps <fps>             Frame rate of the stream (60)\n"
+      "  --codec <codec>         h264, hevc or av1 (h264)\n"
+      "  --bitrate <kbps>        Bitrate of the stream (20000)\n"
+      "  --packet-size <bytes>   Size of the video packets the client asks for (1392)\n"
+      "  --fec <percentage>      FEC percentage, in place of the fec_percentage option\n"
+      "  --no-encrypt            Don't encrypt the video packets\n"
+      "  --warmup <seconds>      Time streamed before measuring (2)\n"
+      "  --duration <seconds>    Time measured (10)\n"
+      "The other arguments configure Sunshine the same way they do on its command line.\n",
+      name
+    );
+  }
+
+  /**
+   * @brief Take the options of the benchmark out of the command line.
+   * @param argc The number of arguments.
+   * @param argv The arguments.
+   * @param options Receives the options.
+   * @param config_args Receives the arguments left for the configuration of Sunshine.
+   * @return `false` if the command line isn't valid.
+   */
+  bool parse_options(int argc, char *argv[], options_t &options, std::vector<char *> &config_args) {
+    config_args.emplace_back(argv[0]);
+
+    for (int x = 1; x < argc; ++x) {
+      std::string_view arg {argv[x]};
+      if (!arg.starts_with("--"sv)) {
+        config_args.emplace_back(argv[x]);
+        continue;
+      }
+
+      if (arg == "--no-encrypt"sv) {
+        options.encrypt = false;
+        continue;
+      }
+
+      if (x + 1 == argc) {
+        return false;
+      }
+      std::string_view value {argv[++x]};
+
+      if (arg == "--codec"sv) {
+        if (value == "h264"sv) {
+          options.codec = 0;
+        } else if (value == "hevc"sv) {
+          options.codec = 1;
+        } else if (value == "av1"sv) {
+          options.codec = 2;
+        } else {
+          return false;
+        }
+        continue;
+      }
+
+      auto number = std::atoi(value.data());
+      if (number <= 0 && !(arg == "--fec"sv && value == "0"sv)) {
+        return false;
+      }
+
+      if (arg == "--width"sv) {
+        options.width = number;
+      } else if (arg == "--height"sv) {
+        options.height = number;
+      } else if (arg == "--fps"sv) {
+        options.fps = number;
+      } else if (arg == "--bitrate"sv) {
+        options.bitrate = number;
+      } else if (arg == "--packet-size"sv) {
+        options.packetsize = number;
+      } else if (arg == "--fec"sv) {
+        options.fec = std::min(number, 255);
+      } else if (arg == "--warmup"sv) {
+        options.warmup = std::chrono::seconds {number};
+      } else if (arg == "--duration"sv) {
+        options.duration = std::chrono::seconds {number};
+      } else {
+        return false;
+      }
+    }
+
+    return true;
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  std::vector<char *> config_args;
+  if (!parse_options(argc, argv, options, config_args)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  mail::man = std::make_shared<safe::mail_raw_t>();
+
+  if (config::parse((int) config_args.size(), config_args.data())) {
+    return 1;
+  }
+
+  // The benchmark measures video, and there's no control stream to keep the session alive
+  config::sunshine.frame_trace = true;
+  config::audio.stream = false;
+  config::stream.ping_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(options.warmup + options.duration + 1min);
+  if (options.fec) {
+    config::stream.fec_percentage = *options.fec;
+  }
+
+  // Keep the log of Sunshine itself untouched
+  auto log_deinit_guard = logging::init(config::sunshine.min_log_level, "bench_sunshine.log");
+
+  buffer_pool::init_arena((std::size_t) config::sunshine.buffer_arena_size << 20, config::sunshine.buffer_arena_lock);
+  task_pool.start(1);
+  auto fg = util::fail_guard([]() {
+    task_pool.stop();
+    task_pool.join();
+  });
+
+  auto platf_deinit_guard = platf::init();
+  reed_solomon_init();
+  auto input_deinit_guard = input::init();
+
+  video::set_display_source({
+    [](platf::mem_type_e) {
+      return std::vector<std::string> {"synthetic"s};
+    },
+    [&options](platf::mem_type_e type, const std::string &, const video::config_t &config) -> std::shared_ptr<platf::display_t> {
+      return std::make_shared<synthetic::display_t>(type, options.width, options.height, config.framerate);
+    },
+  });
+
+  if (video::probe_encoders()) {
+    std::fprintf(stderr, "No working encoder, see bench_sunshine.log\n");
+    return 1;
+  }
+  if ((options.codec == 1 && video::active_hevc_mode == 1) || (options.codec == 2 && video::active_av1_mode == 1)) {
+    std::fprintf(stderr, "The encoder doesn't support the codec\n");
+    return 1;
+  }
+
+  rtsp_stream::launch_session_t launch_session {};
+  launch_session.id = 1;
+  auto key = crypto::rand(16);
+  launch_session.gcm_key.assign(std::begin(key), std::end(key));
+  launch_session.iv.resize(16);
+  launch_session.av_ping_payload = util::hex_vec(crypto::rand(8));
+  launch_session.control_connect_data = 1;
+
+  stream::config_t config {};
+  config.monitor.width = options.width;
+  config.monitor.height = options.height;
+  config.monitor.framerate = options.fps;
+  config.monitor.framerateX100 = options.fps * 100;
+  config.monitor.bitrate = options.bitrate;
+  config.monitor.slicesPerFrame = 1;
+  config.monitor.numRefFrames = 1;
+  config.monitor.encoderCscMode = 1 << 1;  // BT.709, limited range
+  config.monitor.videoFormat = options.codec;
+  config.audio.packetDuration = 5;
+  config.audio.channels = 2;
+  config.audio.mask = 0x3;
+  config.packetsize = options.packetsize;
+  config.minRequiredFecPackets = 2;
+  config.mlFeatureFlags = ML_FF_SESSION_ID_V1;
+  config.encryptionFlagsEnabled = options.encrypt ? SS_ENC_VIDEO : 0;
+
+  auto session = stream::session::alloc(config, launch_session);
+  loopback::receiver_t receiver {launch_session, options.encrypt};
+  if (stream::session::start(*session, "127.0.0.1")) {
+    std::fprintf(stderr, "Failed to start the session, see bench_sunshine.log\n");
+    return 1;
+  }
+  receiver.start();
+
+  loopback::span_collector_t collector;
+  auto wait = [&](steady_clock::duration duration) {
+    for (auto deadline = steady_clock::now() + duration; steady_clock::now() < deadline;) {
+      std::this_thread::sleep_for(std::min<steady_clock::duration>(500ms, deadline - steady_clock::now()));
+      collector.collect();
+    }
+  };
+
+  auto first_frame_deadline = steady_clock::now() + 10s;
+  while (receiver.frames_received() == 0 && steady_clock::now() < first_frame_deadline) {
+    std::this_thread::sleep_for(10ms);
+  }
+  if (receiver.frames_received() == 0) {
+    std::fprintf(stderr, "No frame received, see bench_sunshine.log\n");
+  }
+
+  wait(options.warmup);
+
+  auto window_start = steady_clock::now();
+  auto cpu_start = loopback::cpu_time();
+  wait(options.duration);
+  auto window_end = steady_clock::now();
+  auto cpu_end = loopback::cpu_time();
+
+  stream::session::stop(*session);
+  stream::session::join(*session);
+  session.reset();
+  collector.collect();
+
+  auto &received = receiver.stop();
+  video::set_display_source({});
+
+  // Only frames captured inside the window are measured
+  std::map<frame_trace::span_e, std::vector<double>> stages;
+  std::vector<double> totals;
+  int captured = 0;
+  int lost = 0;
+  std::size_t bytes = 0;
+  for (auto &[frame_index, frame] : collector.by_frame()) {
+    if (!frame.captured || *frame.captured < window_start || *frame.captured >= window_end) {
+      continue;
+    }
+
+    ++captured;
+    for (auto &[span, duration] : frame.spans) {
+      stages[span].emplace_back(loopback::to_ms(duration));
+    }
+
+    auto it = received.find(frame_index);
+    if (it == std::end(received) || !it->second.received) {
+      ++lost;
+      continue;
+    }
+
+    bytes += it->second.bytes;
+    totals.emplace_back(loopback::to_ms(*it->second.received - *frame.captured));
+  }
+
+  auto seconds = std::chrono::duration<double> {window_end - window_start}.count();
+
+  std::printf("%dx%d at %d fps, %s, %d Kbps, %d%% FEC, %s, %s encoder\n", options.width, options.height, options.fps, options.codec == 0 ? "H.264" : options.codec == 1 ? "HEVC" : "AV1", options.bitrate, config::stream.fec_percentage, options.encrypt ? "encrypted" : "not encrypted", config::video.encoder.empty() ? "default" : config::video.encoder.c_str());
+  std::printf("%-10s %9s %9s %9s %9s\n", "stage", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (auto &[span, values] : stages) {
+    loopback::print_percentiles(frame_trace::to_string(span), values);
+  }
+  loopback::print_percentiles("total", totals);
+
+  std::printf("%.1f fps captured, %.1f fps received, %d of %d frames lost\n", captured / seconds, (captured - lost) / seconds, lost, captured);
+  std::printf("%.1f Mbps of video, %llu packets, %llu failed to decrypt\n", bytes * 8 / seconds / 1e6, (unsigned long long) receiver.packets(), (unsigned long long) receiver.decrypt_failures());
+  if (captured > 0) {
+    std::printf("%.3f ms of CPU per frame\n", std::chrono::duration<double, std::milli> {cpu_end - cpu_start}.count() / captured);
+  }
+
+  return 0;
+}
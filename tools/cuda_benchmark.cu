@@ -0,0 +1,183 @@
+/**
+ * @file tools/cuda_benchmark.cu
+ * @brief Measures the GPU time of the CUDA conversion kernel for each output format and scaling filter.
+ */
+// standard includes
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// local includes
+#include "src/platform/linux/cuda.h"
+
+namespace {
+  constexpr int ITERATIONS = 200;
+
+  struct format_t {
+    const char *name;
+    cuda::format_e format;
+    int bytes_per_sample;
+    bool yuv444;
+  };
+
+  constexpr format_t formats[] {
+    {"nv12", cuda::format_e::nv12, 1, false},
+    {"p010", cuda::format_e::p010, 2, false},
+    {"yuv444", cuda::format_e::yuv444, 1, true},
+    {"yuv444p16", cuda::format_e::yuv444p16, 2, true},
+  };
+
+  struct filter_t {
+    const char *name;
+    cuda::filter_e filter;
+  };
+
+  constexpr filter_t filters[] {
+    {"point", cuda::filter_e::point},
+    {"bilinear", cuda::filter_e::bilinear},
+    {"bicubic", cuda::filter_e::bicubic},
+  };
+
+  bool check(cudaError_t result, const char *what) {
+    if (result) {
+      std::fprintf(stderr, "%s: %s\n", what, cudaGetErrorString(result));
+      return true;
+    }
+
+    return false;
+  }
+
+  /**
+   * @brief The planes of a frame in device memory.
+   */
+  struct frame_t {
+    cuda::planes_t planes {};
+    std::vector<cuda::ptr_t> buffers;
+  };
+
+  bool alloc_frame(frame_t &frame, const format_t &format, int width, int height) {
+    // 4:2:0 interleaves both chroma samples in a plane of half the height
+    const int plane_count = format.yuv444 ? 3 : 2;
+    for (int plane = 0; plane < plane_count; ++plane) {
+      const int plane_height = format.yuv444 || plane == 0 ? height : height / 2;
+
+      void *data;
+      std::size_t pitch;
+      if (check(cudaMallocPitch(&data, &pitch, width * format.bytes_per_sample, plane_height), "Couldn't allocate frame")) {
+        return false;
+      }
+
+      frame.buffers.emplace_back(data);
+      frame.planes.data[plane] = (std::uint8_t *) data;
+      frame.planes.pitch[plane] = pitch;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Time the kernel for a format and filter, in milliseconds per frame.
+   */
+  float run(const cuda::tex_t &tex, int in_width, int in_height, int out_width, int out_height, const format_t &format, cuda::filter_e filter, cuda::stream_t::pointer stream) {
+    auto sws = cuda::sws_t::make(in_width, in_height, out_width, out_height, in_width * 4, format.format);
+    frame_t frame;
+    if (!sws || !alloc_frame(frame, format, out_width, out_height)) {
+      return -1.0f;
+    }
+
+    video::sunshine_colorspace_t colorspace {video::colorspace_e::rec709, false, format.bytes_per_sample == 2 ? 10u : 8u};
+    sws->apply_colorspace(colorspace);
+
+    // The filter that the scaling would pick is overridden, so each variant is timed at every scale
+    sws->filter = filter;
+
+    // The first conversion loads the kernel
+    if (sws->convert(frame.planes, tex, stream)) {
+      return -1.0f;
+    }
+
+    auto start = cuda::make_event(true);
+    auto end = cuda::make_event(true);
+    if (!start || !end) {
+      return -1.0f;
+    }
+
+    cudaEventRecord(start.get(), stream);
+    for (int x = 0; x < ITERATIONS; ++x) {
+      if (sws->convert(frame.planes, tex, stream)) {
+        return -1.0f;
+      }
+    }
+    cudaEventRecord(end.get(), stream);
+
+    float ms;
+    if (check(cudaEventSynchronize(end.get()), "Couldn't wait for the kernels") ||
+        check(cudaEventElapsedTime(&ms, start.get(), end.get()), "Couldn't time the kernels")) {
+      return -1.0f;
+    }
+
+    return ms / ITERATIONS;
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int in_width = 3840;
+  int in_height = 2160;
+  if (argc == 3) {
+    in_width = std::atoi(argv[1]);
+    in_height = std::atoi(argv[2]);
+  } else if (argc != 1) {
+    std::printf("Usage: %s [<capture width> <capture height>]\n", argv[0]);
+    return 1;
+  }
+
+  auto tex = cuda::tex_t::make(in_height, in_width * 4);
+  auto stream = cuda::make_stream();
+  if (!tex || !stream) {
+    return 1;
+  }
+
+  // A gradient with a sharp edge in every row, so the filters read what they would on a desktop
+  std::vector<std::uint8_t> image(in_width * 4 * in_height);
+  for (int y = 0; y < in_height; ++y) {
+    for (int x = 0; x < in_width; ++x) {
+      auto pixel = &image[(y * in_width + x) * 4];
+      pixel[0] = x * 255 / in_width;
+      pixel[1] = y * 255 / in_height;
+      pixel[2] = (x / 8) % 2 ? 255 : 0;
+      pixel[3] = 255;
+    }
+  }
+  if (check(cudaMemcpy2DToArray(tex->array, 0, 0, image.data(), in_width * 4, in_width * 4, in_height, cudaMemcpyHostToDevice), "Couldn't upload the image")) {
+    return 1;
+  }
+
+  const struct {
+    int width;
+    int height;
+  } outputs[] {
+    {in_width, in_height},
+    {in_width / 2, in_height / 2},
+    {in_width * 2 / 3, in_height * 2 / 3},
+  };
+
+  std::printf("Capture: %dx%d, %d frames per variant\n", in_width, in_height, ITERATIONS);
+  std::printf("%-10s %-9s %-11s %10s %10s\n", "format", "filter", "output", "ms/frame", "frames/s");
+  for (auto &output : outputs) {
+    for (auto &format : formats) {
+      for (auto &filter : filters) {
+        auto ms = run(*tex, in_width, in_height, output.width, output.height, format, filter.filter, stream.get());
+        if (ms < 0) {
+          return 1;
+        }
+
+        char size[32];
+        std::snprintf(size, sizeof(size), "%dx%d", output.width, output.height);
+        std::printf("%-10s %-9s %-11s %10.3f %10.0f\n", format.name, filter.name, size, ms, 1000.0f / ms);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file tools/gcm_benchmark.cpp
+ * @brief Measures the throughput of encrypting video shards with AES-GCM, with a cipher context created for each
+ * send batch and one call per shard like the video broadcast used to, against a reused context and one call per batch.
+ */
+// standard includes
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// local includes
+#include "src/crypto.h"
+
+namespace {
+  constexpr int FRAMES = 2000;
+  constexpr std::size_t SHARDS = 300;
+  constexpr std::size_t BATCH_SIZE = 64;
+  constexpr std::size_t HEADER_SIZE = 20;
+  constexpr std::size_t PAYLOAD_SIZE = 1400;
+
+  struct shard_t {
+    std::array<std::uint8_t, 12> iv;
+    std::array<std::uint8_t, crypto::cipher::tag_size> tag;
+    std::array<std::uint8_t, HEADER_SIZE> header;
+    std::array<std::uint8_t, PAYLOAD_SIZE> payload;
+  };
+
+  void set_iv(shard_t &shard, std::uint64_t counter) {
+    shard.iv.fill(0);
+    std::memcpy(shard.iv.data(), &counter, sizeof(counter));
+    shard.iv[11] = 'V';
+  }
+
+  double run_per_shard(const crypto::aes_t &key, std::vector<shard_t> &shards) {
+    crypto::aes_t iv(12);
+    std::uint64_t counter = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < FRAMES; ++frame) {
+      for (std::size_t first = 0; first < SHARDS; first += BATCH_SIZE) {
+        crypto::cipher::gcm_t cipher {key, false};
+
+        for (auto x = first; x < std::min(first + BATCH_SIZE, SHARDS); ++x) {
+          auto &shard = shards[x];
+          set_iv(shard, counter++);
+          std::copy(std::begin(shard.iv), std::end(shard.iv), std::begin(iv));
+
+          cipher.encrypt(
+            std::string_view {(char *) shard.header.data(), shard.header.size()},
+            shard.header.data(),
+            std::string_view {(char *) shard.payload.data(), shard.payload.size()},
+            shard.payload.data(),
+            shard.tag.data(),
+            &iv
+          );
+        }
+      }
+    }
+
+    return std::chrono::duration<double> {std::chrono::steady_clock::now() - start}.count();
+  }
+
+  double run_batched(const crypto::aes_t &key, std::vector<shard_t> &shards) {
+    crypto::cipher::gcm_t cipher {key, false};
+    std::vector<crypto::cipher::gcm_message_t> messages;
+    std::uint64_t counter = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < FRAMES; ++frame) {
+      for (std::size_t first = 0; first < SHARDS; first += BATCH_SIZE) {
+        messages.clear();
+
+        for (auto x = first; x < std::min(first + BATCH_SIZE, SHARDS); ++x) {
+          auto &shard = shards[x];
+          set_iv(shard, counter++);
+
+          messages.push_back({
+            shard.iv.data(),
+            std::string_view {(char *) shard.header.data(), shard.header.size()},
+            shard.header.data(),
+            std::string_view {(char *) shard.payload.data(), shard.payload.size()},
+            shard.payload.data(),
+            shard.tag.data(),
+          });
+        }
+
+        cipher.encrypt(messages);
+      }
+    }
+
+    return std::chrono::duration<double> {std::chrono::steady_clock::now() - start}.count();
+  }
+
+  void report(const char *name, double seconds) {
+    auto shards = (double) FRAMES * SHARDS;
+    auto bits = shards * (HEADER_SIZE + PAYLOAD_SIZE) * 8;
+
+    std::printf("%-10s %10.0f ns/shard %10.0f Mbps\n", name, seconds * 1e9 / shards, bits / seconds / 1e6);
+  }
+}  // namespace
+
+int main() {
+  crypto::aes_t key(16, 0x42);
+  std::vector<shard_t> shards(SHARDS);
+
+  // Warm up the caches and the CPU clock
+  run_batched(key, shards);
+
+  report("per-shard", run_per_shard(key, shards));
+  report("batched", run_batched(key, shards));
+
+  return 0;
+}
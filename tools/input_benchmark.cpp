@@ -0,0 +1,124 @@
+/**
+ * @file tools/input_benchmark.cpp
+ * @brief Counts the syscalls and measures the time spent writing bursts of mouse input, one event per `write()`
+ * like libevdev does, against a batch per burst.
+ */
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// platform includes
+#include <fcntl.h>
+#include <unistd.h>
+
+// local includes
+#include "src/platform/linux/input/evdev_batch.h"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int BURSTS = 100000;
+
+  /**
+   * @brief The messages of a burst the input thread drains at once, like a fast moving mouse that clicks and scrolls.
+   */
+  template<class Move, class Scroll, class Button>
+  void burst(Move &&move, Scroll &&scroll, Button &&button) {
+    for (int x = 0; x < 8; ++x) {
+      move(3, -2);
+    }
+    button(BTN_LEFT, false);
+    button(BTN_LEFT, true);
+    scroll(120);
+    scroll(120);
+  }
+
+  struct result_t {
+    double ns_per_burst;
+    double writes_per_burst;
+  };
+
+  /**
+   * @brief Write every event, SYN_REPORT included, with its own syscall.
+   */
+  result_t run_unbatched(int fd) {
+    std::size_t writes = 0;
+    auto write_event = [&](std::uint16_t type, std::uint16_t code, std::int32_t value) {
+      input_event event {};
+      event.type = type;
+      event.code = code;
+      event.value = value;
+      if (write(fd, &event, sizeof(event)) == sizeof(event)) {
+        ++writes;
+      }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int x = 0; x < BURSTS; ++x) {
+      burst(
+        [&](int delta_x, int delta_y) {
+          write_event(EV_REL, REL_X, delta_x);
+          write_event(EV_REL, REL_Y, delta_y);
+          write_event(EV_SYN, SYN_REPORT, 0);
+        },
+        [&](int high_res_distance) {
+          write_event(EV_REL, REL_WHEEL, high_res_distance / 120);
+          write_event(EV_REL, REL_WHEEL_HI_RES, high_res_distance);
+          write_event(EV_SYN, SYN_REPORT, 0);
+        },
+        [&](std::uint16_t code, bool release) {
+          write_event(EV_KEY, code, release ? 0 : 1);
+          write_event(EV_SYN, SYN_REPORT, 0);
+        }
+      );
+    }
+    auto elapsed = std::chrono::duration<double, std::nano> {std::chrono::steady_clock::now() - start};
+
+    return {elapsed.count() / BURSTS, (double) writes / BURSTS};
+  }
+
+  result_t run_batched(int fd) {
+    platf::evdev::mouse_batch_t batch {platf::evdev::batch_t {dup(fd)}};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int x = 0; x < BURSTS; ++x) {
+      burst(
+        [&](int delta_x, int delta_y) {
+          batch.move(delta_x, delta_y);
+        },
+        [&](int high_res_distance) {
+          batch.scroll(high_res_distance);
+        },
+        [&](std::uint16_t code, bool release) {
+          batch.button(code, release);
+        }
+      );
+      batch.flush();
+    }
+    auto elapsed = std::chrono::duration<double, std::nano> {std::chrono::steady_clock::now() - start};
+
+    return {elapsed.count() / BURSTS, (double) batch.batch().writes() / BURSTS};
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // Writing to the event node of a virtual mouse injects the events, /dev/null only counts the syscalls
+  auto path = argc > 1 ? argv[1] : "/dev/null";
+  auto fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::fprintf(stderr, "Couldn't open %s for writing\n", path);
+    return 1;
+  }
+
+  auto unbatched = run_unbatched(fd);
+  auto batched = run_batched(fd);
+  close(fd);
+
+  std::printf("%-10s %12s %14s\n", "mode", "ns/burst", "writes/burst");
+  std::printf("%-10s %12.0f %14.1f\n", "unbatched", unbatched.ns_per_burst, unbatched.writes_per_burst);
+  std::printf("%-10s %12.0f %14.1f\n", "batched", batched.ns_per_burst, batched.writes_per_burst);
+
+  return 0;
+}
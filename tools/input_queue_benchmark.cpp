@@ -0,0 +1,147 @@
+/**
+ * @file tools/input_queue_benchmark.cpp
+ * @brief Measures how long the control stream waits to queue input messages at the rate of an 8 kHz mouse,
+ * with the input thread batching the queue under a lock like it used to, against the lock-free queue.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/input_queue.h"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int MESSAGES = 40000;
+  constexpr auto INTERVAL = 125us;  // 8 kHz
+
+  // What the OS takes to inject a message, during which the input thread doesn't touch the queue
+  constexpr auto INJECTION_TIME = 20us;
+
+  // Keeps the batching scan from being optimized away
+  volatile std::uint64_t checksum_sink;
+
+  void spin_until(std::chrono::steady_clock::time_point time_point) {
+    while (std::chrono::steady_clock::now() < time_point) {
+    }
+  }
+
+  /**
+   * @brief The input queue as it used to be, a ring the producer and the batching consumer share under a mutex.
+   */
+  class locked_queue_t {
+  public:
+    bool push_back(std::vector<std::uint8_t> &&input_data, std::chrono::steady_clock::time_point received) {
+      std::lock_guard lg {_lock};
+      _entries.emplace_back().assign(std::move(input_data), received);
+
+      return true;
+    }
+
+    template<class Batch>
+    bool drain(Batch &&batch) {
+      std::lock_guard lg {_lock};
+      if (_entries.empty()) {
+        return false;
+      }
+
+      for (std::size_t x = 1; x < _entries.size(); ++x) {
+        batch(_entries[x]);
+      }
+      _entries.pop_front();
+
+      return true;
+    }
+
+  private:
+    std::mutex _lock;
+    std::deque<input::input_entry_t> _entries;
+  };
+
+  class lock_free_queue_t {
+  public:
+    bool push_back(std::vector<std::uint8_t> &&input_data, std::chrono::steady_clock::time_point received) {
+      return _queue.push_back(std::move(input_data), received);
+    }
+
+    template<class Batch>
+    bool drain(Batch &&batch) {
+      if (_queue.empty()) {
+        return false;
+      }
+
+      for (std::size_t x = 1; auto entry = _queue.peek(x); ++x) {
+        batch(*entry);
+      }
+      _queue.pop_front();
+
+      return true;
+    }
+
+  private:
+    input::input_queue_t _queue;
+  };
+
+  /**
+   * @brief Queue messages at 8 kHz while another thread drains them, and report the time each push took.
+   */
+  template<class Q>
+  void run(const char *name) {
+    Q queue;
+    std::atomic<bool> done {false};
+
+    std::thread consumer {[&]() {
+      std::uint64_t checksum = 0;
+      auto batch = [&checksum](input::input_entry_t &entry) {
+        checksum += entry.data()[0];
+      };
+
+      while (!done.load(std::memory_order_relaxed)) {
+        if (queue.drain(batch)) {
+          spin_until(std::chrono::steady_clock::now() + INJECTION_TIME);
+        }
+      }
+
+      checksum_sink = checksum;
+    }};
+
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(MESSAGES);
+
+    auto next = std::chrono::steady_clock::now();
+    for (int x = 0; x < MESSAGES; ++x) {
+      next += INTERVAL;
+      spin_until(next);
+
+      std::vector<std::uint8_t> data(32, (std::uint8_t) x);
+      auto start = std::chrono::steady_clock::now();
+      queue.push_back(std::move(data), start);
+      latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    done = true;
+    consumer.join();
+
+    std::sort(std::begin(latencies), std::end(latencies));
+    auto percentile = [&latencies](double p) {
+      return latencies[(std::size_t) (p * (latencies.size() - 1))] / 1000.0;
+    };
+
+    std::printf("%-10s %10.2f us p50 %10.2f us p99 %10.2f us p99.9 %10.2f us max\n", name, percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0));
+  }
+}  // namespace
+
+int main() {
+  run<locked_queue_t>("locked");
+  run<lock_free_queue_t>("lock-free");
+
+  return 0;
+}
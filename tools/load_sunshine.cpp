@@ -0,0 +1,400 @@
+/**
+ * @file tools/load_sunshine.cpp
+ * @brief Ramps up sessions of a synthetic display to loopback clients one at a time, and reports the frame rate,
+ * the missing frames, the throughput and the latency of each client as the host takes on more of them.
+ */
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  // clang-format off
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include "src/rswrapper.h"
+  // clang-format on
+}
+
+// local includes
+#include "src/buffer_pool.h"
+#include "src/config.h"
+#include "src/crypto.h"
+#include "src/globals.h"
+#include "src/input.h"
+#include "src/logging.h"
+#include "src/network.h"
+#include "src/platform/common.h"
+#include "src/rtsp.h"
+#include "src/stream.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "tools/loopback_client.h"
+#include "tools/synthetic_display.h"
+
+using namespace std::literals;
+
+namespace {
+  using steady_clock = std::chrono::steady_clock;
+
+  struct options_t {
+    int clients = 4;
+    int displays = 1;  ///< Synthetic displays the clients are spread over, each captured by a thread of its own
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int codec = 0;  ///< 0 - H.264, 1 - HEVC, 2 - AV1, like video::config_t::videoFormat
+    int bitrate = 20000;  ///< In Kbps
+    int packetsize = 1392;
+    std::optional<int> fec;  ///< Overrides the fec_percentage option
+    double loss = 0;  ///< Share of the video packets each client drops
+    int input_rate = 0;  ///< Mouse motion messages each client sends per second
+    bool encrypt = true;
+    std::chrono::seconds ramp = 10s;
+    std::chrono::seconds settle = 2s;
+  };
+
+  void print_usage(const char *name) {
+    std::printf(
+      "Usage: %s [options] [sunshine.conf] [name=value...]\n"
+      "  --clients <count>       Clients to ramp up to, one at a time (4)\n"
+      "  --displays <count>      Synthetic displays the clients capture, taking turns (1)\n"
+      "  --ramp <seconds>        Time between two clients joining (10)\n"
+      "  --settle <seconds>      Time after a client joins before measuring (2)\n"
+      "  --width <pixels>        Width of the synthetic display and the streams (1920)\n"
+      "  --height <pixels>       Height of the synthetic display and the streams (1080)\n"
+      "  --fps <fps>             Frame rate of the streams (60)\n"
+      "  --codec <codec>         h264, hevc or av1 (h264)\n"
+      "  --bitrate <kbps>        Bitrate of the streams (20000)\n"
+      "  --packet-size <bytes>   Size of the video packets the clients ask for (1392)\n"
+      "  --fec <percentage>      FEC percentage, in place of the fec_percentage option\n"
+      "  --loss <percentage>     Video packets each client drops and reports as lost (0)\n"
+      "  --input-rate <count>    Mouse motion messages each client sends per second, which moves the pointer (0)\n"
+      "  --no-encrypt            Don't encrypt the video packets and the control streams, nor send input\n"
+      "The other arguments configure Sunshine the same way they do on its command line.\n",
+      name
+    );
+  }
+
+  /**
+   * @brief Take the options of the load test out of the command line.
+   * @param argc The number of arguments.
+   * @param argv The arguments.
+   * @param options Receives the options.
+   * @param config_args Receives the arguments left for the configuration of Sunshine.
+   * @return `false` if the command line isn't valid.
+   */
+  bool parse_options(int argc, char *argv[], options_t &options, std::vector<char *> &config_args) {
+    config_args.emplace_back(argv[0]);
+
+    for (int x = 1; x < argc; ++x) {
+      std::string_view arg {argv[x]};
+      if (!arg.starts_with("--"sv)) {
+        config_args.emplace_back(argv[x]);
+        continue;
+      }
+
+      if (arg == "--no-encrypt"sv) {
+        options.encrypt = false;
+        continue;
+      }
+
+      if (x + 1 == argc) {
+        return false;
+      }
+      std::string_view value {argv[++x]};
+
+      if (arg == "--codec"sv) {
+        if (value == "h264"sv) {
+          options.codec = 0;
+        } else if (value == "hevc"sv) {
+          options.codec = 1;
+        } else if (value == "av1"sv) {
+          options.codec = 2;
+        } else {
+          return false;
+        }
+        continue;
+      }
+
+      if (arg == "--loss"sv) {
+        auto percentage = std::atof(value.data());
+        if (percentage < 0 || percentage > 100) {
+          return false;
+        }
+        options.loss = percentage / 100;
+        continue;
+      }
+
+      auto number = std::atoi(value.data());
+      auto may_be_zero = arg == "--fec"sv || arg == "--input-rate"sv || arg == "--settle"sv;
+      if (number <= 0 && !(may_be_zero && value == "0"sv)) {
+        return false;
+      }
+
+      if (arg == "--clients"sv) {
+        options.clients = number;
+      } else if (arg == "--displays"sv) {
+        options.displays = number;
+      } else if (arg == "--ramp"sv) {
+        options.ramp = std::chrono::seconds {number};
+      } else if (arg == "--settle"sv) {
+        options.settle = std::chrono::seconds {number};
+      } else if (arg == "--width"sv) {
+        options.width = number;
+      } else if (arg == "--height"sv) {
+        options.height = number;
+      } else if (arg == "--fps"sv) {
+        options.fps = number;
+      } else if (arg == "--bitrate"sv) {
+        options.bitrate = number;
+      } else if (arg == "--packet-size"sv) {
+        options.packetsize = number;
+      } else if (arg == "--fec"sv) {
+        options.fec = std::min(number, 255);
+      } else if (arg == "--input-rate"sv) {
+        options.input_rate = number;
+      } else {
+        return false;
+      }
+    }
+
+    return options.settle < options.ramp;
+  }
+
+  /**
+   * @brief A simulated client, with a session of its own like a client that launched an app would get.
+   */
+  struct client_t {
+    rtsp_stream::launch_session_t launch_session {};
+    stream::config_t config {};
+    std::shared_ptr<stream::session_t> session;
+    std::unique_ptr<loopback::receiver_t> receiver;
+    std::unique_ptr<loopback::control_client_t> control;
+  };
+
+  /**
+   * @brief The window a ramp step is measured over, once the client that joined last has settled.
+   */
+  struct step_t {
+    int clients;
+    steady_clock::time_point start;
+    steady_clock::time_point end;
+    std::chrono::microseconds cpu;
+  };
+
+  std::unique_ptr<client_t> make_client(const options_t &options, std::uint32_t id) {
+    auto client = std::make_unique<client_t>();
+
+    auto &launch_session = client->launch_session;
+    launch_session.id = id;
+    auto key = crypto::rand(16);
+    launch_session.gcm_key.assign(std::begin(key), std::end(key));
+    launch_session.iv.resize(16);
+    launch_session.av_ping_payload = util::hex_vec(crypto::rand(8));
+    launch_session.control_connect_data = id;
+
+    auto &config = client->config;
+    config.monitor.width = options.width;
+    config.monitor.height = options.height;
+    config.monitor.framerate = options.fps;
+    config.monitor.framerateX100 = options.fps * 100;
+    config.monitor.bitrate = options.bitrate;
+    config.monitor.slicesPerFrame = 1;
+    config.monitor.numRefFrames = 1;
+    config.monitor.encoderCscMode = 1 << 1;  // BT.709, limited range
+    config.monitor.videoFormat = options.codec;
+
+    // The first display is the configured one, the others are picked like a client asking for them at launch
+    if (auto display = (id - 1) % options.displays) {
+      config.monitor.output_name = "synthetic-" + std::to_string(display);
+    }
+    config.audio.packetDuration = 5;
+    config.audio.channels = 2;
+    config.audio.mask = 0x3;
+    config.packetsize = options.packetsize;
+    config.minRequiredFecPackets = 2;
+    config.mlFeatureFlags = ML_FF_SESSION_ID_V1;
+    if (options.encrypt) {
+      config.controlProtocolType = 13;
+      config.encryptionFlagsEnabled = SS_ENC_VIDEO | SS_ENC_CONTROL_V2;
+    }
+
+    client->session = stream::session::alloc(config, launch_session);
+    client->receiver = std::make_unique<loopback::receiver_t>(launch_session, options.encrypt, options.loss);
+    client->control = std::make_unique<loopback::control_client_t>(launch_session, options.encrypt);
+
+    return client;
+  }
+
+  double percentile(std::vector<double> &values, double q) {
+    return values[std::min(values.size() - 1, (std::size_t) (q * values.size()))];
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  std::vector<char *> config_args;
+  if (!parse_options(argc, argv, options, config_args)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  mail::man = std::make_shared<safe::mail_raw_t>();
+
+  if (config::parse((int) config_args.size(), config_args.data())) {
+    return 1;
+  }
+
+  // The control stream of each client keeps its session alive, and the load test measures video
+  config::audio.stream = false;
+  if (options.fec) {
+    config::stream.fec_percentage = *options.fec;
+  }
+
+  // Keep the log of Sunshine itself untouched
+  auto log_deinit_guard = logging::init(config::sunshine.min_log_level, "load_sunshine.log");
+
+  buffer_pool::init_arena((std::size_t) config::sunshine.buffer_arena_size << 20, config::sunshine.buffer_arena_lock);
+  task_pool.start(1);
+  auto fg = util::fail_guard([]() {
+    task_pool.stop();
+    task_pool.join();
+  });
+
+  auto platf_deinit_guard = platf::init();
+  reed_solomon_init();
+  auto input_deinit_guard = input::init();
+
+  video::set_display_source({
+    [&options](platf::mem_type_e) {
+      std::vector<std::string> names {"synthetic"s};
+      for (int x = 1; x < options.displays; ++x) {
+        names.emplace_back("synthetic-" + std::to_string(x));
+      }
+      return names;
+    },
+    [&options](platf::mem_type_e type, const std::string &, const video::config_t &config) -> std::shared_ptr<platf::display_t> {
+      return std::make_shared<synthetic::display_t>(type, options.width, options.height, config.framerate);
+    },
+  });
+
+  if (video::probe_encoders()) {
+    std::fprintf(stderr, "No working encoder, see load_sunshine.log\n");
+    return 1;
+  }
+  if ((options.codec == 1 && video::active_hevc_mode == 1) || (options.codec == 2 && video::active_av1_mode == 1)) {
+    std::fprintf(stderr, "The encoder doesn't support the codec\n");
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<client_t>> clients;
+  std::vector<step_t> steps;
+  for (int x = 0; x < options.clients; ++x) {
+    auto &client = *clients.emplace_back(make_client(options, (std::uint32_t) x + 1));
+    if (stream::session::start(*client.session, "127.0.0.1")) {
+      std::fprintf(stderr, "Failed to start the session of client %d, see load_sunshine.log\n", x + 1);
+      clients.pop_back();
+      break;
+    }
+    client.receiver->start();
+
+    if (!client.control->connect(5s)) {
+      std::fprintf(stderr, "Client %d couldn't connect to the control stream, see load_sunshine.log\n", x + 1);
+    }
+    client.control->start(*client.receiver, options.input_rate);
+
+    auto joined = steady_clock::now();
+    std::this_thread::sleep_for(options.settle);
+
+    auto window_start = steady_clock::now();
+    auto cpu_start = loopback::cpu_time();
+    std::this_thread::sleep_until(joined + options.ramp);
+    steps.emplace_back(step_t {(int) clients.size(), window_start, steady_clock::now(), loopback::cpu_time() - cpu_start});
+
+    std::fprintf(stderr, "%d of %d clients streaming\n", (int) clients.size(), options.clients);
+  }
+
+  // The sessions stop the control streams of their clients from here on
+  std::vector<bool> disconnected;
+  for (auto &client : clients) {
+    disconnected.emplace_back(client->control->disconnected());
+    stream::session::stop(*client->session);
+  }
+  for (auto &client : clients) {
+    client->control->stop();
+    stream::session::join(*client->session);
+    client->session.reset();
+  }
+
+  std::vector<const std::map<std::uint32_t, loopback::receiver_t::frame_t> *> received;
+  for (auto &client : clients) {
+    received.emplace_back(&client->receiver->stop());
+  }
+  video::set_display_source({});
+
+  std::printf("%dx%d at %d fps on %d display%s, %s, %d Kbps, %d%% FEC, %.1f%% loss, %d input messages per second, %s, %s encoder\n", options.width, options.height, options.fps, options.displays, options.displays == 1 ? "" : "s", options.codec == 0 ? "H.264" : options.codec == 1 ? "HEVC" : "AV1", options.bitrate, config::stream.fec_percentage, options.loss * 100, options.input_rate, options.encrypt ? "encrypted" : "not encrypted", config::video.encoder.empty() ? "default" : config::video.encoder.c_str());
+
+  for (auto &step : steps) {
+    auto seconds = std::chrono::duration<double> {step.end - step.start}.count();
+
+    std::printf("\n%d client%s, %.0f%% of a core\n", step.clients, step.clients == 1 ? "" : "s", std::chrono::duration<double> {step.cpu}.count() / seconds * 100);
+    std::printf("%-10s %9s %9s %9s %9s %9s %9s %9s\n", "client", "fps", "missing", "Mbps", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+    double total_bytes = 0;
+    for (int x = 0; x < step.clients; ++x) {
+      // Frames are measured once received, and those missing in between were never put back together
+      int frames = 0;
+      std::size_t bytes = 0;
+      std::optional<std::uint32_t> first_index;
+      std::uint32_t last_index = 0;
+      std::vector<double> latencies;
+      for (auto &[frame_index, frame] : *received[x]) {
+        if (!frame.received || *frame.received < step.start || *frame.received >= step.end) {
+          continue;
+        }
+
+        ++frames;
+        bytes += frame.bytes;
+        if (!first_index) {
+          first_index = frame_index;
+        }
+        last_index = frame_index;
+
+        if (frame.host_latency) {
+          latencies.emplace_back(loopback::to_ms(*frame.host_latency + (*frame.received - *frame.first)));
+        }
+      }
+      total_bytes += bytes;
+
+      auto missing = first_index ? (int) (last_index - *first_index + 1) - frames : 0;
+      auto name = "client " + std::to_string(x + 1);
+      std::printf("%-10s %9.1f %9d %9.1f", name.c_str(), frames / seconds, missing, bytes * 8 / seconds / 1e6);
+      if (latencies.empty()) {
+        std::printf("\n");
+        continue;
+      }
+
+      std::sort(std::begin(latencies), std::end(latencies));
+      std::printf(" %9.3f %9.3f %9.3f %9.3f\n", percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), latencies.back());
+    }
+
+    std::printf("%.1f Mbps of video in total\n", total_bytes * 8 / seconds / 1e6);
+  }
+
+  std::printf("\n");
+  for (std::size_t x = 0; x < clients.size(); ++x) {
+    auto &client = *clients[x];
+    std::printf("client %d: %llu packets, %llu dropped, %llu failed to decrypt, %llu control messages%s\n", (int) x + 1, (unsigned long long) client.receiver->packets(), (unsigned long long) client.receiver->dropped(), (unsigned long long) client.receiver->decrypt_failures(), (unsigned long long) client.control->messages_sent(), disconnected[x] ? ", disconnected early" : "");
+  }
+
+  return 0;
+}
@@ -0,0 +1,593 @@
+/**
+ * @file tools/loopback_client.h
+ * @brief A client receiving the video of a session and keeping its control stream alive on the loopback interface,
+ * and the reporting shared by the tools streaming to it.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// lib includes
+#include <boost/asio.hpp>
+#include <enet/enet.h>
+
+// platform includes
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <sys/resource.h>
+#endif
+
+extern "C" {
+#include <moonlight-common-c/src/Input.h>
+#include <moonlight-common-c/src/Limelight-internal.h>
+}
+
+// local includes
+#include "src/crypto.h"
+#include "src/frame_trace.h"
+#include "src/network.h"
+#include "src/rtsp.h"
+#include "src/stream.h"
+#include "src/utility.h"
+
+namespace loopback {
+  using namespace std::literals;
+  using boost::asio::ip::udp;
+  using steady_clock = std::chrono::steady_clock;
+
+  // The headers of a video packet, as the video broadcast thread lays them out
+  struct video_packet_raw_t {
+    RTP_PACKET rtp;
+    char reserved[4];
+
+    NV_VIDEO_PACKET packet;
+  };
+
+  struct video_packet_enc_prefix_t {
+    std::uint8_t iv[12];
+    std::uint32_t frameNumber;
+    std::uint8_t tag[16];
+  };
+
+  // The header of an encrypted control stream message, as the control server reads it
+#pragma pack(push, 1)
+  struct control_encrypted_t {
+    std::uint16_t encryptedHeaderType;
+    std::uint16_t length;
+    std::uint32_t seq;
+  };
+#pragma pack(pop)
+
+  // The control stream message types, as in the packetTypes of src/stream.cpp
+  namespace control_type {
+    constexpr std::uint16_t encrypted = 0x0001;
+    constexpr std::uint16_t periodic_ping = 0x0200;
+    constexpr std::uint16_t loss_stats = 0x0201;
+    constexpr std::uint16_t input_data = 0x0206;
+    constexpr std::uint16_t invalidate_ref_frames = 0x0301;
+  }  // namespace control_type
+
+  /**
+   * @brief A client that pings the streams of a session, then decrypts the video packets and puts the frames back together.
+   * @details A frame counts as received once each of its FEC blocks has as many packets as data shards,
+   *          which is when the client could recover it. A share of the video packets can be dropped on arrival,
+   *          the way a lossy link would.
+   */
+  class receiver_t {
+  public:
+    struct frame_t {
+      std::array<int, stream::video_fec::MAX_FEC_BLOCKS> data_shards {};
+      std::array<int, stream::video_fec::MAX_FEC_BLOCKS> packets {};
+      int fec_blocks = 0;
+      std::size_t bytes = 0;
+      std::optional<steady_clock::time_point> first;  ///< When the first packet of the frame arrived
+      std::optional<steady_clock::duration> host_latency;  ///< From the capture until the host sent the frame, as its frame header has it
+      std::optional<steady_clock::time_point> received;
+    };
+
+    /**
+     * @param launch_session The launch session of the session to receive.
+     * @param encrypted Whether the video packets are encrypted.
+     * @param loss The share of video packets to drop, from 0 to 1.
+     */
+    receiver_t(const rtsp_stream::launch_session_t &launch_session, bool encrypted, double loss = 0):
+        _socket {_io, udp::endpoint {boost::asio::ip::make_address("127.0.0.1"), 0}},
+        _timer {_io},
+        _video {boost::asio::ip::make_address("127.0.0.1"), net::map_port(stream::VIDEO_STREAM_PORT)},
+        _audio {boost::asio::ip::make_address("127.0.0.1"), net::map_port(stream::AUDIO_STREAM_PORT)} {
+      std::copy_n(launch_session.av_ping_payload.data(), sizeof(_ping.payload), _ping.payload);
+      if (encrypted) {
+        _cipher = crypto::cipher::gcm_t {launch_session.gcm_key, false};
+      }
+      if (loss > 0) {
+        _loss = std::bernoulli_distribution {std::min(loss, 1.0)};
+        _random.seed(launch_session.control_connect_data);
+      }
+
+      // Keep the packets of a whole frame while this thread is busy decrypting
+      _socket.set_option(udp::socket::receive_buffer_size {8 << 20});
+    }
+
+    void start() {
+      ping();
+      receive();
+      _thread = std::thread {[this]() {
+        _io.run();
+      }};
+    }
+
+    /**
+     * @brief Stop receiving.
+     * @return The frames by frame index.
+     */
+    const std::map<std::uint32_t, frame_t> &stop() {
+      _io.stop();
+      _thread.join();
+      return _frames;
+    }
+
+    int frames_received() const {
+      return _frames_received.load();
+    }
+
+    std::uint64_t packets() const {
+      return _packets;
+    }
+
+    std::uint64_t decrypt_failures() const {
+      return _decrypt_failures;
+    }
+
+    /**
+     * @brief Get the video packets dropped on purpose so far.
+     */
+    std::uint64_t dropped() const {
+      return _dropped.load();
+    }
+
+    /**
+     * @brief Get the index of the last frame received.
+     */
+    std::uint32_t last_frame() const {
+      return _last_frame.load();
+    }
+
+    /**
+     * @brief Take the frames skipped since the last call, like a client that asks to invalidate them would.
+     * @return The first and last frame index skipped, or `std::nullopt` if none were.
+     */
+    std::optional<std::pair<std::uint32_t, std::uint32_t>> take_skipped() {
+      std::lock_guard lg {_skipped_lock};
+      return std::exchange(_skipped, std::nullopt);
+    }
+
+  private:
+    void ping() {
+      // Both streams wait for a ping before they start, and the ping carries the payload of the session
+      _ping.sequenceNumber = util::endian::big(_ping_sequence++);
+      boost::system::error_code ec;
+      _socket.send_to(boost::asio::buffer(&_ping, sizeof(_ping)), _video, 0, ec);
+      _socket.send_to(boost::asio::buffer(&_ping, sizeof(_ping)), _audio, 0, ec);
+
+      _timer.expires_after(100ms);
+      _timer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) {
+          ping();
+        }
+      });
+    }
+
+    void receive() {
+      _socket.async_receive_from(boost::asio::buffer(_buffer), _peer, [this](const boost::system::error_code &ec, std::size_t size) {
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        if (!ec && _peer.port() == _video.port()) {
+          if (_loss && (*_loss)(_random)) {
+            ++_dropped;
+          } else {
+            on_packet(steady_clock::now(), std::string_view {_buffer.data(), size});
+          }
+        }
+
+        receive();
+      });
+    }
+
+    void on_packet(steady_clock::time_point now, std::string_view packet) {
+      if (_cipher) {
+        if (packet.size() < sizeof(video_packet_enc_prefix_t) + sizeof(video_packet_raw_t)) {
+          return;
+        }
+
+        auto *prefix = (const video_packet_enc_prefix_t *) packet.data();
+        crypto::aes_t iv(std::begin(prefix->iv), std::end(prefix->iv));
+        if (_cipher->decrypt(packet.substr(offsetof(video_packet_enc_prefix_t, tag)), _plaintext, &iv)) {
+          ++_decrypt_failures;
+          return;
+        }
+
+        packet = std::string_view {(const char *) _plaintext.data(), _plaintext.size()};
+      }
+
+      if (packet.size() < sizeof(video_packet_raw_t)) {
+        return;
+      }
+
+      ++_packets;
+
+      auto *header = (const video_packet_raw_t *) packet.data();
+      auto fec_info = header->packet.fecInfo;
+      auto shard_index = (int) ((fec_info >> 12) & 0x3FF);
+      auto data_shards = (int) ((fec_info >> 22) & 0x3FF);
+      auto block_index = (header->packet.multiFecBlocks >> 4) & 0x3;
+      auto last_block = (header->packet.multiFecBlocks >> 6) & 0x3;
+
+      auto frame_index = header->packet.frameIndex;
+      auto &frame = _frames[frame_index];
+      if (frame.received) {
+        return;
+      }
+
+      if (!frame.first) {
+        frame.first = now;
+      }
+      frame.fec_blocks = last_block + 1;
+      frame.data_shards[block_index] = data_shards;
+      ++frame.packets[block_index];
+      if (shard_index < data_shards) {
+        frame.bytes += packet.size() - sizeof(video_packet_raw_t);
+      }
+
+      // The first shard of a frame starts with its short frame header, which carries the latency of the host in 1/10 ms
+      auto payload = packet.substr(sizeof(video_packet_raw_t));
+      if (block_index == 0 && shard_index == 0 && (header->packet.flags & FLAG_SOF) && payload.size() >= 3 && payload[0] == 0x01) {
+        auto latency = (std::uint16_t) ((std::uint8_t) payload[1] | (std::uint8_t) payload[2] << 8);
+        if (latency > 0) {
+          frame.host_latency = std::chrono::microseconds {latency * 100};
+        }
+      }
+
+      for (int x = 0; x < frame.fec_blocks; ++x) {
+        if (frame.data_shards[x] == 0 || frame.packets[x] < frame.data_shards[x]) {
+          return;
+        }
+      }
+
+      frame.received = now;
+
+      // Frames received late don't go back in time, and those in between the last one and this one were skipped
+      auto last_frame = _last_frame.load();
+      if (_frames_received == 0 || (std::int32_t) (frame_index - last_frame) > 0) {
+        if (_frames_received > 0 && frame_index - last_frame > 1) {
+          std::lock_guard lg {_skipped_lock};
+          _skipped = std::pair {_skipped ? _skipped->first : last_frame + 1, frame_index - 1};
+        }
+        _last_frame = frame_index;
+      }
+      ++_frames_received;
+    }
+
+    boost::asio::io_context _io;
+    udp::socket _socket;
+    boost::asio::steady_timer _timer;
+    std::thread _thread;
+
+    udp::endpoint _video;
+    udp::endpoint _audio;
+    udp::endpoint _peer;
+
+    SS_PING _ping {};
+    std::uint32_t _ping_sequence = 0;
+
+    std::optional<crypto::cipher::gcm_t> _cipher;
+    std::optional<std::bernoulli_distribution> _loss;
+    std::minstd_rand _random;
+    std::array<char, 4096> _buffer;
+    std::vector<std::uint8_t> _plaintext;
+
+    // Only touched by the receiving thread until it's stopped
+    std::map<std::uint32_t, frame_t> _frames;
+    std::uint64_t _packets = 0;
+    std::uint64_t _decrypt_failures = 0;
+
+    std::atomic<int> _frames_received {0};
+    std::atomic<std::uint64_t> _dropped {0};
+    std::atomic<std::uint32_t> _last_frame {0};
+
+    std::mutex _skipped_lock;
+    std::optional<std::pair<std::uint32_t, std::uint32_t>> _skipped;
+  };
+
+  /**
+   * @brief A client keeping the control stream of a session alive, and reporting what its receiver lost the way Moonlight does.
+   * @details It pings every 100 ms, reports the packets the receiver dropped and the last frame it received every 50 ms,
+   *          asks to invalidate the frames the receiver skipped, and can send relative mouse motion which moves the
+   *          pointer back and forth. The messages are encrypted the way the version 2 of the control stream encryption does.
+   */
+  class control_client_t {
+  public:
+    static constexpr auto PING_INTERVAL = 100ms;
+    static constexpr auto LOSS_REPORT_INTERVAL = 50ms;
+
+    /**
+     * @param launch_session The launch session of the session to connect to.
+     * @param encrypted Whether the session encrypts its control stream.
+     */
+    control_client_t(const rtsp_stream::launch_session_t &launch_session, bool encrypted):
+        _connect_data {launch_session.control_connect_data} {
+      if (encrypted) {
+        _cipher = crypto::cipher::gcm_t {launch_session.gcm_key, false};
+      }
+    }
+
+    ~control_client_t() {
+      stop();
+    }
+
+    /**
+     * @brief Connect to the control server of the session.
+     * @param timeout How long to wait for the server to accept the connection.
+     * @return `true` once connected.
+     */
+    bool connect(std::chrono::milliseconds timeout) {
+      ENetAddress address;
+      enet_address_set_host(&address, "127.0.0.1");
+      enet_address_set_port(&address, net::map_port(stream::CONTROL_PORT));
+
+      _host = net::host_t {enet_host_create(AF_INET, nullptr, 1, 1, 0, 0)};
+      if (!_host) {
+        return false;
+      }
+
+      _peer = enet_host_connect(_host.get(), &address, 1, _connect_data);
+      ENetEvent event;
+      return _peer && enet_host_service(_host.get(), &event, (enet_uint32) timeout.count()) > 0 && event.type == ENET_EVENT_TYPE_CONNECT;
+    }
+
+    /**
+     * @brief Start reporting for a receiver.
+     * @param receiver The receiver of the session, which must outlive the client or its `stop()`.
+     * @param input_rate The mouse motion messages to send per second, or 0 for none.
+     */
+    void start(receiver_t &receiver, int input_rate) {
+      _thread = std::thread {[this, &receiver, input_rate]() {
+        run(receiver, input_rate);
+      }};
+    }
+
+    /**
+     * @brief Stop reporting and disconnect, which ends the session.
+     */
+    void stop() {
+      _stop = true;
+      if (_thread.joinable()) {
+        _thread.join();
+      }
+      _host.reset();
+    }
+
+    std::uint64_t messages_sent() const {
+      return _messages_sent.load();
+    }
+
+    bool disconnected() const {
+      return _disconnected.load();
+    }
+
+  private:
+    void run(receiver_t &receiver, int input_rate) {
+      auto next_ping = steady_clock::now();
+      auto next_report = next_ping;
+      auto next_input = next_ping;
+      auto input_interval = input_rate > 0 ? std::chrono::nanoseconds {1s} / input_rate : std::chrono::nanoseconds::max();
+      std::uint64_t reported_dropped = 0;
+      std::int16_t delta = 1;
+
+      while (!_stop) {
+        ENetEvent event;
+        if (enet_host_service(_host.get(), &event, 1) > 0) {
+          if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
+            _disconnected = true;
+            return;
+          }
+          if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+            net::packet_t packet {event.packet};
+          }
+        }
+
+        auto now = steady_clock::now();
+        if (now >= next_ping) {
+          send(control_type::periodic_ping, {});
+          next_ping += PING_INTERVAL;
+        }
+
+        if (now >= next_report) {
+          auto dropped = receiver.dropped();
+          std::array<std::int32_t, 8> stats {
+            (std::int32_t) (dropped - reported_dropped),
+            (std::int32_t) std::chrono::milliseconds {LOSS_REPORT_INTERVAL}.count(),
+            1000,
+            (std::int32_t) receiver.last_frame(),
+            0,
+            0,
+            0,
+            0x14,
+          };
+          reported_dropped = dropped;
+          send(control_type::loss_stats, std::string_view {(const char *) stats.data(), sizeof(stats)});
+
+          if (auto skipped = receiver.take_skipped()) {
+            std::array<std::int64_t, 3> frames {skipped->first, skipped->second, 0};
+            send(control_type::invalidate_ref_frames, std::string_view {(const char *) frames.data(), sizeof(frames)});
+          }
+          next_report += LOSS_REPORT_INTERVAL;
+        }
+
+        // Moonlight only sends input on the encrypted control stream, the plain one takes the legacy input encryption
+        if (_cipher && now >= next_input) {
+          NV_REL_MOUSE_MOVE_PACKET packet {};
+          packet.header.size = util::endian::big<std::uint32_t>(sizeof(packet) - sizeof(packet.header.size));
+          packet.header.magic = util::endian::little<std::uint32_t>(MOUSE_MOVE_REL_MAGIC_GEN5);
+          packet.deltaX = util::endian::big<std::int16_t>(delta);
+          delta = -delta;
+          send(control_type::input_data, std::string_view {(const char *) &packet, sizeof(packet)});
+          next_input = now + input_interval;
+        }
+      }
+    }
+
+    void send(std::uint16_t type, std::string_view payload) {
+      std::vector<std::uint8_t> message;
+      if (!_cipher) {
+        message.resize(sizeof(type) + payload.size());
+        auto le_type = util::endian::little(type);
+        std::memcpy(message.data(), &le_type, sizeof(le_type));
+        std::copy(std::begin(payload), std::end(payload), message.data() + sizeof(type));
+      } else {
+        // The version 2 header of the message, which is encrypted along with its payload
+        std::vector<std::uint8_t> plaintext(sizeof(std::uint16_t) * 2 + payload.size());
+        std::uint16_t header[] {util::endian::little(type), util::endian::little((std::uint16_t) payload.size())};
+        std::memcpy(plaintext.data(), header, sizeof(header));
+        std::copy(std::begin(payload), std::end(payload), plaintext.data() + sizeof(header));
+
+        // The client originated counterpart of the IV the host builds
+        auto seq = _seq++;
+        crypto::aes_t iv(12);
+        std::copy_n((const std::uint8_t *) &seq, sizeof(seq), std::begin(iv));
+        iv[10] = 'C';
+        iv[11] = 'C';
+
+        message.resize(sizeof(control_encrypted_t) + crypto::cipher::tag_size + plaintext.size());
+        auto bytes = _cipher->encrypt(std::string_view {(const char *) plaintext.data(), plaintext.size()}, message.data() + sizeof(control_encrypted_t), &iv);
+        if (bytes <= 0) {
+          return;
+        }
+
+        control_encrypted_t encrypted {
+          util::endian::little(control_type::encrypted),
+          util::endian::little((std::uint16_t) (sizeof(seq) + bytes)),
+          util::endian::little(seq),
+        };
+        std::memcpy(message.data(), &encrypted, sizeof(encrypted));
+      }
+
+      auto packet = enet_packet_create(message.data(), message.size(), ENET_PACKET_FLAG_RELIABLE);
+      if (enet_peer_send(_peer, 0, packet)) {
+        enet_packet_destroy(packet);
+        return;
+      }
+      ++_messages_sent;
+    }
+
+    std::uint32_t _connect_data;
+    std::optional<crypto::cipher::gcm_t> _cipher;
+    std::uint32_t _seq = 0;
+
+    net::host_t _host;
+    ENetPeer *_peer = nullptr;
+    std::thread _thread;
+
+    std::atomic<bool> _stop {false};
+    std::atomic<bool> _disconnected {false};
+    std::atomic<std::uint64_t> _messages_sent {0};
+  };
+
+  /**
+   * @brief Keep the spans of the frame tracer before the rings of the busiest threads wrap around.
+   */
+  class span_collector_t {
+  public:
+    void collect() {
+      for (auto &span : frame_trace::spans()) {
+        _spans.emplace(std::tuple {span.span, span.frame, span.start}, span.end);
+      }
+    }
+
+    /**
+     * @brief Get the spans of each frame.
+     * @return For each frame index, the time spent in each span, and the start of its capture and queue spans.
+     */
+    auto by_frame() const {
+      struct frame_t {
+        std::map<frame_trace::span_e, steady_clock::duration> spans;
+        std::optional<steady_clock::time_point> captured;
+        std::optional<steady_clock::time_point> queued;
+      };
+
+      std::map<std::uint32_t, frame_t> frames;
+      for (auto &[key, end] : _spans) {
+        auto &[span, frame_index, start] = key;
+
+        // Frame indexes wrap around the same way as on the wire
+        auto &frame = frames[(std::uint32_t) frame_index];
+        frame.spans[span] += end - start;
+        if (span == frame_trace::span_e::capture) {
+          frame.captured = start;
+        } else if (span == frame_trace::span_e::queue) {
+          frame.queued = start;
+        }
+      }
+
+      return frames;
+    }
+
+  private:
+    std::map<std::tuple<frame_trace::span_e, std::int64_t, steady_clock::time_point>, steady_clock::time_point> _spans;
+  };
+
+  inline std::chrono::microseconds cpu_time() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+    auto to_us = [](FILETIME time) {
+      return (((std::uint64_t) time.dwHighDateTime << 32) | time.dwLowDateTime) / 10;
+    };
+
+    return std::chrono::microseconds {to_us(kernel) + to_us(user)};
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return std::chrono::seconds {usage.ru_utime.tv_sec + usage.ru_stime.tv_sec} +
+           std::chrono::microseconds {usage.ru_utime.tv_usec + usage.ru_stime.tv_usec};
+#endif
+  }
+
+  inline double to_ms(steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli> {duration}.count();
+  }
+
+  inline void print_percentiles(std::string_view name, std::vector<double> values) {
+    if (values.empty()) {
+      return;
+    }
+
+    std::sort(std::begin(values), std::end(values));
+    auto at = [&](double q) {
+      return values[std::min(values.size() - 1, (std::size_t) (q * values.size()))];
+    };
+
+    std::printf("%-10.*s %9.3f %9.3f %9.3f %9.3f\n", (int) name.size(), name.data(), at(0.5), at(0.9), at(0.99), values.back());
+  }
+}  // namespace loopback
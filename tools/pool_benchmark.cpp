@@ -0,0 +1,134 @@
+/**
+ * @file tools/pool_benchmark.cpp
+ * @brief Measures the throughput and latency of the thread pool when several threads push tasks at once.
+ */
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/thread_pool.h"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int TASKS = 200000;
+
+  /**
+   * @brief A pool with all workers taking tasks from the single queue of the TaskPool, to compare against.
+   */
+  class single_queue_pool_t: public task_pool_util::TaskPool {
+  public:
+    explicit single_queue_pool_t(int threads) {
+      for (int x = 0; x < threads; ++x) {
+        _thread.emplace_back(&single_queue_pool_t::_main, this);
+      }
+    }
+
+    ~single_queue_pool_t() {
+      {
+        std::lock_guard lg(_lock);
+        _continue = false;
+        _cv.notify_all();
+      }
+
+      for (auto &t : _thread) {
+        t.join();
+      }
+    }
+
+    template<class Function>
+    auto push(Function &&newTask) {
+      std::lock_guard lg(_lock);
+      auto future = TaskPool::push(std::forward<Function>(newTask));
+
+      _cv.notify_one();
+      return future;
+    }
+
+  private:
+    void _main() {
+      while (true) {
+        if (auto task = pop()) {
+          (*task)->run();
+          continue;
+        }
+
+        std::unique_lock uniq_lock(_lock);
+        if (ready()) {
+          continue;
+        }
+
+        if (!_continue) {
+          break;
+        }
+
+        _cv.wait(uniq_lock);
+      }
+    }
+
+    std::vector<std::thread> _thread;
+    std::condition_variable _cv;
+    std::mutex _lock;
+    bool _continue {true};
+  };
+
+  /**
+   * @brief Push tiny tasks from several threads at once and report the throughput and the queueing latency.
+   * @param name The name of the pool.
+   * @param workers The number of workers.
+   * @param producers The number of threads pushing tasks.
+   */
+  template<class P>
+  void run(const char *name, int workers, int producers) {
+    std::vector<std::int64_t> latencies(TASKS);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+      P pool {workers};
+
+      for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+          for (int x = p; x < TASKS; x += producers) {
+            pool.push([&latencies, x, pushed = std::chrono::steady_clock::now()]() {
+              latencies[x] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pushed).count();
+            });
+          }
+        });
+      }
+
+      for (auto &t : threads) {
+        t.join();
+      }
+
+      // The pool runs the remaining tasks before it is destroyed
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(std::begin(latencies), std::end(latencies));
+    auto percentile = [&latencies](double p) {
+      return latencies[(std::size_t) (p * (latencies.size() - 1))] / 1000.0;
+    };
+
+    std::printf("%-14s %2d workers %2d producers %8.2f Mtasks/s %10.2f us p50 %10.2f us p99\n", name, workers, producers, TASKS / elapsed / 1e6, percentile(0.5), percentile(0.99));
+  }
+}  // namespace
+
+int main() {
+  auto threads = (int) std::max(2u, std::thread::hardware_concurrency());
+
+  for (auto workers : {1, 4, threads}) {
+    for (auto producers : {1, 4}) {
+      run<single_queue_pool_t>("single queue", workers, producers);
+      run<thread_pool_util::ThreadPool>("work stealing", workers, producers);
+    }
+  }
+
+  return 0;
+}
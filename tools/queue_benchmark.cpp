@@ -0,0 +1,82 @@
+/**
+ * @file tools/queue_benchmark.cpp
+ * @brief Measures the hand-off latency of the thread-safe queues between two threads.
+ */
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/thread_safe.h"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int ROUND_TRIPS = 100000;
+
+  /**
+   * @brief Bounce a timestamp between two threads and report the one-way latency.
+   * @param name The name of the queue type.
+   * @param interval The time between raised elements, to measure a consumer that parks between elements.
+   */
+  template<template<class> class Q>
+  void run(const char *name, std::chrono::microseconds interval) {
+    Q<std::chrono::steady_clock::time_point> requests;
+    Q<std::chrono::steady_clock::time_point> responses;
+
+    std::thread echo {[&]() {
+      while (requests.pop()) {
+        responses.raise(std::chrono::steady_clock::now());
+      }
+    }};
+
+    auto round_trips = interval == 0us ? ROUND_TRIPS : ROUND_TRIPS / 100;
+
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(round_trips);
+    for (int x = 0; x < round_trips; ++x) {
+      if (interval > 0us) {
+        std::this_thread::sleep_for(interval);
+      }
+
+      auto sent = std::chrono::steady_clock::now();
+      requests.raise(sent);
+      auto received = responses.pop();
+      if (!received) {
+        break;
+      }
+
+      latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(*received - sent).count());
+    }
+
+    requests.stop();
+    echo.join();
+
+    std::sort(std::begin(latencies), std::end(latencies));
+    auto percentile = [&latencies](double p) {
+      return latencies[(std::size_t) (p * (latencies.size() - 1))] / 1000.0;
+    };
+
+    std::printf("%-12s %6lld us gap %10.2f us p50 %10.2f us p99 %10.2f us max\n", name, (long long) interval.count(), percentile(0.5), percentile(0.99), percentile(1.0));
+  }
+
+  template<class T>
+  using queue_t = safe::queue_t<T>;
+
+  template<class T>
+  using spsc_queue_t = safe::spsc_queue_t<T>;
+}  // namespace
+
+int main() {
+  // Back to back elements, and roughly the gap between audio packets and video frames
+  for (auto interval : {0us, 1000us, 5000us}) {
+    run<queue_t>("queue_t", interval);
+    run<spsc_queue_t>("spsc_queue_t", interval);
+  }
+
+  return 0;
+}
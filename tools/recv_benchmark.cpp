@@ -0,0 +1,196 @@
+/**
+ * @file tools/recv_benchmark.cpp
+ * @brief Compares the cost of receiving pings from many sessions one at a time and in recvmmsg() batches.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// platform includes
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+  constexpr int SESSIONS = 32;
+  constexpr int ROUNDS = 20000;
+
+  // Like SS_PING, a client identifier followed by a sequence number
+  constexpr std::size_t PAYLOAD_SIZE = 16;
+  constexpr std::size_t PING_SIZE = PAYLOAD_SIZE + sizeof(std::uint32_t);
+
+  constexpr std::size_t BATCH_SIZE = 32;
+  constexpr std::size_t BUFFER_SIZE = 2048;
+
+  // Like av_session_id_t, with the address of a legacy ping or the payload of a new one
+  using session_id_t = std::variant<std::uint32_t, std::string>;
+
+  struct payload_hash_t {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view payload) const {
+      return std::hash<std::string_view> {}(payload);
+    }
+  };
+
+  std::string payload_of(int session) {
+    std::string payload(PAYLOAD_SIZE, '\0');
+    std::snprintf(payload.data(), payload.size(), "session%08d", session);
+    return payload;
+  }
+
+  std::uint64_t thread_cpu_time_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (std::uint64_t) ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+  }
+
+  /**
+   * @brief Receive pings with one recvfrom() each and find their session in a std::map, like stream::recvThread() used to.
+   */
+  int receive_unbatched(int sock, const std::map<session_id_t, int> &sessions, std::vector<int> &hits) {
+    std::array<char, BUFFER_SIZE> buf;
+    sockaddr_storage peer;
+
+    int received = 0;
+    while (true) {
+      socklen_t peer_size = sizeof(peer);
+      auto bytes = recvfrom(sock, buf.data(), buf.size(), MSG_DONTWAIT, (sockaddr *) &peer, &peer_size);
+      if (bytes < 0) {
+        return received;
+      }
+
+      auto it = sessions.find(std::string {buf.data(), PAYLOAD_SIZE});
+      if (it != std::end(sessions)) {
+        ++hits[it->second];
+      }
+      ++received;
+    }
+  }
+
+  /**
+   * @brief Receive pings with recvmmsg() and find their session in a hash map without copying the payload, like platf::recv_batch().
+   */
+  int receive_batched(int sock, const std::unordered_map<std::string, int, payload_hash_t, std::equal_to<>> &sessions, std::vector<int> &hits) {
+    static std::vector<char> buffers(BATCH_SIZE * BUFFER_SIZE);
+    std::array<mmsghdr, BATCH_SIZE> msgs {};
+    std::array<iovec, BATCH_SIZE> iovs;
+    std::array<sockaddr_storage, BATCH_SIZE> peers;
+
+    int received = 0;
+    while (true) {
+      for (std::size_t x = 0; x < BATCH_SIZE; ++x) {
+        iovs[x] = {buffers.data() + x * BUFFER_SIZE, BUFFER_SIZE};
+        msgs[x].msg_hdr.msg_name = &peers[x];
+        msgs[x].msg_hdr.msg_namelen = sizeof(peers[x]);
+        msgs[x].msg_hdr.msg_iov = &iovs[x];
+        msgs[x].msg_hdr.msg_iovlen = 1;
+      }
+
+      auto count = recvmmsg(sock, msgs.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+      if (count <= 0) {
+        return received;
+      }
+
+      for (int x = 0; x < count; ++x) {
+        auto it = sessions.find(std::string_view {buffers.data() + x * BUFFER_SIZE, PAYLOAD_SIZE});
+        if (it != std::end(sessions)) {
+          ++hits[it->second];
+        }
+      }
+      received += count;
+    }
+  }
+
+  /**
+   * @brief Have every session send a ping, then receive them all, and report the cost per ping.
+   * @param name The name of the receive path.
+   * @param server The socket the pings are sent to.
+   * @param address The address of the server socket.
+   * @param clients The socket of each session.
+   * @param receive The function receiving every ping that's ready.
+   */
+  void run(const char *name, int server, const sockaddr_in &address, const std::vector<int> &clients, const std::function<int(int, std::vector<int> &)> &receive) {
+    std::vector<int> hits(SESSIONS);
+    std::array<char, PING_SIZE> ping {};
+
+    std::uint64_t pings = 0;
+    std::chrono::steady_clock::duration receive_time {};
+    std::uint64_t receive_cpu = 0;
+
+    for (int round = 0; round < ROUNDS; ++round) {
+      for (int session = 0; session < SESSIONS; ++session) {
+        auto payload = payload_of(session);
+        std::memcpy(ping.data(), payload.data(), PAYLOAD_SIZE);
+        std::memcpy(ping.data() + PAYLOAD_SIZE, &round, sizeof(round));
+        sendto(clients[session], ping.data(), ping.size(), 0, (const sockaddr *) &address, sizeof(address));
+      }
+
+      auto cpu_start = thread_cpu_time_ns();
+      auto start = std::chrono::steady_clock::now();
+      pings += receive(server, hits);
+      receive_time += std::chrono::steady_clock::now() - start;
+      receive_cpu += thread_cpu_time_ns() - cpu_start;
+    }
+
+    auto matched = std::count_if(std::begin(hits), std::end(hits), [](int hit) {
+      return hit == ROUNDS;
+    });
+
+    std::printf("%-22s %8.1f ns/ping  %8.1f ns CPU/ping  %llu pings  %d/%d sessions matched every ping\n", name, std::chrono::duration<double, std::nano>(receive_time).count() / pings, (double) receive_cpu / pings, (unsigned long long) pings, (int) matched, SESSIONS);
+  }
+}  // namespace
+
+int main() {
+  // Receive on loopback, so the network itself isn't part of the measurement
+  auto server = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  int rcvbuf = 4 * 1024 * 1024;
+  setsockopt(server, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(server, (const sockaddr *) &address, sizeof(address));
+  socklen_t address_size = sizeof(address);
+  getsockname(server, (sockaddr *) &address, &address_size);
+
+  std::vector<int> clients;
+  std::map<session_id_t, int> sessions_by_id;
+  std::unordered_map<std::string, int, payload_hash_t, std::equal_to<>> sessions_by_payload;
+  for (int session = 0; session < SESSIONS; ++session) {
+    clients.push_back(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+    sessions_by_id.emplace(payload_of(session), session);
+    sessions_by_payload.emplace(payload_of(session), session);
+  }
+
+  // Alternate the runs, so neither gets an unfair share of a warm cache
+  for (int x = 0; x < 3; ++x) {
+    run("recvfrom+std::map", server, address, clients, [&](int sock, std::vector<int> &hits) {
+      return receive_unbatched(sock, sessions_by_id, hits);
+    });
+    run("recvmmsg+unordered_map", server, address, clients, [&](int sock, std::vector<int> &hits) {
+      return receive_batched(sock, sessions_by_payload, hits);
+    });
+    std::printf("\n");
+  }
+
+  for (auto client : clients) {
+    close(client);
+  }
+  close(server);
+
+  return 0;
+}
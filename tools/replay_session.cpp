@@ -0,0 +1,332 @@
+/**
+ * @file tools/replay_session.cpp
+ * @brief Streams a recorded session again to a loopback client, feeding the recorded control messages and round trip
+ * times to the adaptive controllers, and reports the time spent in each stage of the network path.
+ */
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+  // clang-format off
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include "src/rswrapper.h"
+  // clang-format on
+}
+
+// local includes
+#include "src/buffer_pool.h"
+#include "src/config.h"
+#include "src/crypto.h"
+#include "src/frame_trace.h"
+#include "src/globals.h"
+#include "src/input.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/rtsp.h"
+#include "src/session_recording.h"
+#include "src/stream.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "tools/loopback_client.h"
+
+using namespace std::literals;
+
+namespace {
+  using steady_clock = std::chrono::steady_clock;
+
+  struct options_t {
+    const char *recording = nullptr;
+    double speed = 1.0;
+    bool input = false;
+  };
+
+  void print_usage(const char *name) {
+    std::printf(
+      "Usage: %s [options] <recording> [sunshine.conf] [name=value...]\n"
+      "  --speed <factor>        How many times faster than recorded to replay the session (1)\n"
+      "  --input                 Replay the recorded input too, on this computer\n"
+      "The other arguments configure Sunshine the same way they do on its command line.\n",
+      name
+    );
+  }
+
+  /**
+   * @brief Take the options of the tool out of the command line.
+   * @param argc The number of arguments.
+   * @param argv The arguments.
+   * @param options Receives the options.
+   * @param config_args Receives the arguments left for the configuration of Sunshine.
+   * @return `false` if the command line isn't valid.
+   */
+  bool parse_options(int argc, char *argv[], options_t &options, std::vector<char *> &config_args) {
+    config_args.emplace_back(argv[0]);
+
+    for (int x = 1; x < argc; ++x) {
+      std::string_view arg {argv[x]};
+      if (!arg.starts_with("--"sv)) {
+        if (!options.recording) {
+          options.recording = argv[x];
+        } else {
+          config_args.emplace_back(argv[x]);
+        }
+        continue;
+      }
+
+      if (arg == "--input"sv) {
+        options.input = true;
+        continue;
+      }
+
+      if (arg == "--speed"sv && x + 1 < argc) {
+        options.speed = std::atof(argv[++x]);
+        if (options.speed <= 0) {
+          return false;
+        }
+        continue;
+      }
+
+      return false;
+    }
+
+    return options.recording != nullptr;
+  }
+
+  /**
+   * @brief A recorded video packet, owning its data and replacements.
+   */
+  struct replayed_packet_t: video::packet_raw_t {
+    replayed_packet_t(session_recording::video_t &&video, std::string_view data):
+        recorded {std::move(video)},
+        frame_data {data} {
+      for (auto &[old, _new] : recorded.replacements) {
+        replacement_views.emplace_back(old, _new);
+      }
+      if (!replacement_views.empty()) {
+        replacements = &replacement_views;
+      }
+
+      after_ref_frame_invalidation = recorded.after_ref_frame_invalidation;
+      intra_refresh = recorded.intra_refresh;
+      part_index = recorded.part_index;
+      part_count = recorded.part_count;
+
+      // The frame is as late as it was when it was recorded
+      if (recorded.capture_delay) {
+        frame_timestamp = queued_timestamp - *recorded.capture_delay;
+      }
+    }
+
+    bool is_idr() override {
+      return recorded.idr;
+    }
+
+    int64_t frame_index() override {
+      return recorded.frame_index;
+    }
+
+    const uint8_t *data() override {
+      return (uint8_t *) frame_data.data();
+    }
+
+    size_t data_size() override {
+      return frame_data.size();
+    }
+
+    session_recording::video_t recorded;
+    std::string frame_data;
+    std::vector<replace_t> replacement_views;
+  };
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  std::vector<char *> config_args;
+  if (!parse_options(argc, argv, options, config_args)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  session_recording::reader_t reader {options.recording};
+  auto first = reader.next();
+  std::optional<session_recording::config_t> recorded;
+  if (first && first->type == session_recording::record_e::config) {
+    recorded = session_recording::decode_config(first->payload);
+  }
+  if (!reader.is_open() || !recorded) {
+    std::fprintf(stderr, "%s isn't a session recording\n", options.recording);
+    return 1;
+  }
+
+  mail::man = std::make_shared<safe::mail_raw_t>();
+
+  if (config::parse((int) config_args.size(), config_args.data())) {
+    return 1;
+  }
+
+  // The replay measures video, and there's no control stream to keep the session alive
+  config::sunshine.frame_trace = true;
+  config::audio.stream = false;
+  config::stream.ping_timeout = 24h;
+
+  // Keep the log of Sunshine itself untouched
+  auto log_deinit_guard = logging::init(config::sunshine.min_log_level, "replay_session.log");
+
+  buffer_pool::init_arena((std::size_t) config::sunshine.buffer_arena_size << 20, config::sunshine.buffer_arena_lock);
+  task_pool.start(1);
+  auto fg = util::fail_guard([]() {
+    task_pool.stop();
+    task_pool.join();
+  });
+
+  auto platf_deinit_guard = platf::init();
+  reed_solomon_init();
+  auto input_deinit_guard = input::init();
+
+  rtsp_stream::launch_session_t launch_session {};
+  launch_session.id = 1;
+  auto key = crypto::rand(16);
+  launch_session.gcm_key.assign(std::begin(key), std::end(key));
+  launch_session.iv.resize(16);
+  launch_session.av_ping_payload = util::hex_vec(crypto::rand(8));
+  launch_session.control_connect_data = 1;
+
+  // The loopback client pings with the payload of the session, and only decrypts video
+  auto encrypt = (recorded->encryption_flags & SS_ENC_VIDEO) != 0;
+
+  stream::config_t config {};
+  config.monitor = recorded->monitor;
+  config.audio.packetDuration = 5;
+  config.audio.channels = 2;
+  config.audio.mask = 0x3;
+  config.packetsize = recorded->packetsize;
+  config.minRequiredFecPackets = recorded->min_required_fec_packets;
+  config.mlFeatureFlags = recorded->ml_feature_flags | ML_FF_SESSION_ID_V1;
+  config.encryptionFlagsEnabled = encrypt ? SS_ENC_VIDEO : 0;
+  config.replay = true;
+
+  auto session = stream::session::alloc(config, launch_session);
+  loopback::receiver_t receiver {launch_session, encrypt};
+  if (stream::session::start(*session, "127.0.0.1")) {
+    std::fprintf(stderr, "Failed to start the session, see replay_session.log\n");
+    return 1;
+  }
+  receiver.start();
+
+  // Packets handed out before the client's first ping reached the video stream would have nowhere to go
+  std::this_thread::sleep_for(1s);
+
+  loopback::span_collector_t collector;
+  auto next_collect = steady_clock::now();
+
+  int frames_pushed = 0;
+  int control_messages = 0;
+  int input_packets = 0;
+
+  auto start = steady_clock::now();
+  auto cpu_start = loopback::cpu_time();
+  while (auto record = reader.next()) {
+    auto due = start + std::chrono::duration_cast<steady_clock::duration>(record->time / options.speed);
+    while (steady_clock::now() < due) {
+      // Keep the spans before the rings of the busiest threads wrap around
+      if (steady_clock::now() >= next_collect) {
+        collector.collect();
+        next_collect = steady_clock::now() + 500ms;
+      }
+
+      std::this_thread::sleep_until(std::min(due, next_collect));
+    }
+
+    switch (record->type) {
+      case session_recording::record_e::video:
+        if (auto video = session_recording::decode_video(record->payload)) {
+          frames_pushed += video->first.part_index == 0;
+          stream::session::replay_video(*session, std::make_unique<replayed_packet_t>(std::move(video->first), video->second));
+        }
+        break;
+      case session_recording::record_e::control:
+        if (auto control = session_recording::decode_control(record->payload)) {
+          ++control_messages;
+          stream::session::replay_control(*session, control->type, control->payload);
+        }
+        break;
+      case session_recording::record_e::input:
+        if (options.input) {
+          ++input_packets;
+          stream::session::replay_input(*session, record->payload);
+        }
+        break;
+      case session_recording::record_e::rtt:
+        if (auto rtt = session_recording::decode_rtt(record->payload)) {
+          stream::session::replay_rtt(*session, *rtt);
+        }
+        break;
+      case session_recording::record_e::config:
+        break;
+    }
+  }
+  auto end = steady_clock::now();
+  auto cpu_end = loopback::cpu_time();
+
+  // Let the last frames go out
+  std::this_thread::sleep_for(500ms);
+
+  stream::session::stop(*session);
+  stream::session::join(*session);
+  session.reset();
+  collector.collect();
+
+  auto &received = receiver.stop();
+
+  std::map<frame_trace::span_e, std::vector<double>> stages;
+  std::vector<double> totals;
+  int sent = 0;
+  int lost = 0;
+  std::size_t bytes = 0;
+  for (auto &[frame_index, frame] : collector.by_frame()) {
+    if (!frame.queued) {
+      continue;
+    }
+
+    ++sent;
+    for (auto &[span, duration] : frame.spans) {
+      stages[span].emplace_back(loopback::to_ms(duration));
+    }
+
+    auto it = received.find(frame_index);
+    if (it == std::end(received) || !it->second.received) {
+      ++lost;
+      continue;
+    }
+
+    bytes += it->second.bytes;
+    totals.emplace_back(loopback::to_ms(*it->second.received - *frame.queued));
+  }
+
+  auto seconds = std::chrono::duration<double> {end - start}.count();
+
+  std::printf("%dx%d at %d fps, %d Kbps, replayed at %gx, %s\n", config.monitor.width, config.monitor.height, config.monitor.framerate, config.monitor.bitrate, options.speed, encrypt ? "encrypted" : "not encrypted");
+  std::printf("%-10s %9s %9s %9s %9s\n", "stage", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (auto &[span, values] : stages) {
+    loopback::print_percentiles(frame_trace::to_string(span), values);
+  }
+  loopback::print_percentiles("total", totals);
+
+  std::printf("%d frames replayed, %d sent, %d lost, %d control messages, %d input packets\n", frames_pushed, sent, lost, control_messages, input_packets);
+  std::printf("%.1f Mbps of video, %llu packets, %llu failed to decrypt\n", bytes * 8 / seconds / 1e6, (unsigned long long) receiver.packets(), (unsigned long long) receiver.decrypt_failures());
+  if (sent > 0) {
+    std::printf("%.3f ms of CPU per frame\n", std::chrono::duration<double, std::milli> {cpu_end - cpu_start}.count() / sent);
+  }
+
+  return 0;
+}
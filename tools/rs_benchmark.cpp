@@ -0,0 +1,91 @@
+/**
+ * @file tools/rs_benchmark.cpp
+ * @brief Measures the Reed-Solomon encoding throughput of each compiled instruction set variant.
+ */
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// local includes
+extern "C" {
+#include "src/rswrapper.h"
+}
+
+namespace {
+  // Video shards are the negotiated packet size plus room for the RTP header
+  constexpr int BLOCK_SIZE = 1408;
+  constexpr int FEC_PERCENTAGE = 20;
+
+  constexpr auto MIN_DURATION = std::chrono::milliseconds(250);
+
+  /**
+   * @brief Encode a FEC block repeatedly and report the data throughput.
+   * @param variant The variant to measure.
+   * @param data_shards The number of data shards in the FEC block.
+   * @param parity_shards The number of parity shards in the FEC block.
+   */
+  void run(const reed_solomon_variant_t &variant, int data_shards, int parity_shards) {
+    auto nr_shards = data_shards + parity_shards;
+
+    std::vector<std::uint8_t> buffer(nr_shards * BLOCK_SIZE);
+    std::minstd_rand rand;
+    for (auto &byte : buffer) {
+      byte = (std::uint8_t) rand();
+    }
+
+    std::vector<std::uint8_t *> shards(nr_shards);
+    for (int x = 0; x < nr_shards; ++x) {
+      shards[x] = &buffer[x * BLOCK_SIZE];
+    }
+
+    auto rs = variant.new_fn(data_shards, parity_shards);
+
+    // Warm up the caches before measuring
+    variant.encode_fn(rs, shards.data(), nr_shards, BLOCK_SIZE);
+
+    std::uint64_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    do {
+      variant.encode_fn(rs, shards.data(), nr_shards, BLOCK_SIZE);
+      ++iterations;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed < MIN_DURATION);
+
+    variant.release_fn(rs);
+
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    auto gbps = (double) iterations * data_shards * BLOCK_SIZE / seconds / 1e9;
+    auto us_per_block = seconds * 1e6 / iterations;
+
+    std::printf("%-8s %4d/%-4d %8.2f GB/s %10.2f us/block\n", variant.name, data_shards, parity_shards, gbps, us_per_block);
+  }
+}  // namespace
+
+int main() {
+  reed_solomon_init();
+  std::printf("Selected variant: %s\n\n", reed_solomon_variant_name());
+
+  // Typical frame sizes, up to the largest FEC block allowed at 20% parity
+  const int geometries[] = {4, 16, 64, 128, 212};
+
+  int count;
+  auto variants = reed_solomon_variants(&count);
+  for (int x = 0; x < count; ++x) {
+    auto &variant = variants[x];
+    if (!variant.supported()) {
+      std::printf("%-8s not supported by this CPU\n", variant.name);
+      continue;
+    }
+
+    variant.init();
+    for (auto data_shards : geometries) {
+      run(variant, data_shards, (data_shards * FEC_PERCENTAGE + 99) / 100);
+    }
+  }
+
+  return 0;
+}
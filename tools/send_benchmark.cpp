@@ -0,0 +1,207 @@
+/**
+ * @file tools/send_benchmark.cpp
+ * @brief Compares the cost of sending video-sized bursts of UDP packets with WSASendMsg() and Registered I/O.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// platform includes
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <MSWSock.h>
+
+// local includes
+#include "src/platform/windows/rio_send.h"
+
+using namespace std::literals;
+
+namespace {
+  // The default Moonlight packet size, plus the RTP and video headers
+  constexpr std::size_t PACKET_SIZE = 1416;
+  constexpr int FPS = 60;
+  constexpr auto DURATION = 3s;
+
+  // Like videoBroadcastThread(), stay below 64K per batch
+  constexpr std::size_t BATCH_SIZE = 64 * 1024 / PACKET_SIZE;
+
+  using send_fn = std::function<bool(SOCKET, const SOCKADDR_IN &, const char *, std::size_t)>;
+
+  /**
+   * @brief Send a batch with a single WSASendMsg() using UDP segmentation offload, like platf::send_batch().
+   */
+  bool send_uso(SOCKET sock, const SOCKADDR_IN &address, const char *data, std::size_t count) {
+    WSABUF buf {(ULONG) (count * PACKET_SIZE), (char *) data};
+
+    char cmbuf[WSA_CMSG_SPACE(sizeof(DWORD))] = {};
+    WSAMSG msg {(PSOCKADDR) &address, sizeof(address), &buf, 1, {sizeof(cmbuf), cmbuf}, 0};
+
+    auto cm = WSA_CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = IPPROTO_UDP;
+    cm->cmsg_type = UDP_SEND_MSG_SIZE;
+    cm->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+    *((DWORD *) WSA_CMSG_DATA(cm)) = PACKET_SIZE;
+
+    DWORD bytes_sent;
+    return WSASendMsg(sock, &msg, 0, &bytes_sent, nullptr, nullptr) != SOCKET_ERROR;
+  }
+
+  /**
+   * @brief Send a batch with one WSASendMsg() per packet, like the fallback when USO is unavailable.
+   */
+  bool send_unbatched(SOCKET sock, const SOCKADDR_IN &address, const char *data, std::size_t count) {
+    for (std::size_t x = 0; x < count; ++x) {
+      WSABUF buf {(ULONG) PACKET_SIZE, (char *) data + x * PACKET_SIZE};
+      WSAMSG msg {(PSOCKADDR) &address, sizeof(address), &buf, 1, {0, nullptr}, 0};
+
+      DWORD bytes_sent;
+      if (WSASendMsg(sock, &msg, 0, &bytes_sent, nullptr, nullptr) == SOCKET_ERROR) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  std::uint64_t thread_cpu_time_100ns() {
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+
+    auto to_u64 = [](const FILETIME &time) {
+      return ((std::uint64_t) time.dwHighDateTime << 32) | time.dwLowDateTime;
+    };
+    return to_u64(kernel) + to_u64(user);
+  }
+
+  /**
+   * @brief Send frames at a bitrate to a local receiver and report the cost of sending them.
+   * @param name The name of the send path.
+   * @param sock The socket to send on.
+   * @param address The address of the receiver.
+   * @param send The function sending a batch.
+   * @param mbps The bitrate, or 0 to send as fast as possible.
+   * @param received The number of packets the receiver got so far.
+   */
+  void run(const char *name, SOCKET sock, const SOCKADDR_IN &address, const send_fn &send, int mbps, std::atomic<std::uint64_t> &received) {
+    // Unpaced runs send 1 MB frames back to back
+    auto frame_bytes = mbps ? (std::size_t) mbps * 1'000'000 / 8 / FPS : 1024 * 1024;
+    auto frame_packets = (frame_bytes + PACKET_SIZE - 1) / PACKET_SIZE;
+
+    std::vector<char> frame(frame_packets * PACKET_SIZE, 'x');
+
+    auto received_before = received.load();
+    auto cpu_before = thread_cpu_time_100ns();
+
+    std::uint64_t frames = 0;
+    std::uint64_t packets = 0;
+    std::chrono::steady_clock::duration send_time {};
+    bool failed = false;
+
+    auto start = std::chrono::steady_clock::now();
+    auto next_frame = start;
+    while (std::chrono::steady_clock::now() - start < DURATION && !failed) {
+      auto send_start = std::chrono::steady_clock::now();
+      for (std::size_t first = 0; first < frame_packets; first += BATCH_SIZE) {
+        auto count = std::min(BATCH_SIZE, frame_packets - first);
+        if (!send(sock, address, &frame[first * PACKET_SIZE], count)) {
+          failed = true;
+          break;
+        }
+        packets += count;
+      }
+      send_time += std::chrono::steady_clock::now() - send_start;
+      ++frames;
+
+      if (mbps) {
+        next_frame += std::chrono::nanoseconds {1s} / FPS;
+        std::this_thread::sleep_until(next_frame);
+      }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Give the receiver a moment to drain its buffer
+    std::this_thread::sleep_for(100ms);
+
+    if (failed) {
+      std::printf("%-14s %5d Mbps  send failed: %d\n", name, mbps, WSAGetLastError());
+      return;
+    }
+
+    auto cpu = (thread_cpu_time_100ns() - cpu_before) / 1e7;
+    auto sent_mbps = packets * PACKET_SIZE * 8 / elapsed / 1e6;
+    auto us_per_frame = std::chrono::duration<double, std::micro>(send_time).count() / frames;
+    auto delivered = 100.0 * (received.load() - received_before) / packets;
+
+    std::printf("%-14s %5d Mbps  %8.1f Mbps sent  %8.1f us/frame  %6.1f%% CPU  %6.1f%% delivered\n", name, mbps, sent_mbps, us_per_frame, 100 * cpu / elapsed, delivered);
+  }
+}  // namespace
+
+int main() {
+  WSADATA wsa_data;
+  WSAStartup(MAKEWORD(2, 2), &wsa_data);
+
+  // Receive on loopback, so the network itself isn't part of the measurement
+  auto receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  int rcvbuf = 64 * 1024 * 1024;
+  setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, (const char *) &rcvbuf, sizeof(rcvbuf));
+
+  SOCKADDR_IN address {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(receiver, (PSOCKADDR) &address, sizeof(address));
+  int address_size = sizeof(address);
+  getsockname(receiver, (PSOCKADDR) &address, &address_size);
+
+  std::atomic<std::uint64_t> received {0};
+  std::thread receive_thread {[&]() {
+    std::vector<char> buf(64 * 1024);
+    while (recv(receiver, buf.data(), (int) buf.size(), 0) > 0) {
+      received.fetch_add(1, std::memory_order_relaxed);
+    }
+  }};
+
+  auto wsa_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  int sndbuf = 1024 * 1024;
+  setsockopt(wsa_sock, SOL_SOCKET, SO_SNDBUF, (const char *) &sndbuf, sizeof(sndbuf));
+
+  auto rio_sock = platf::rio::open_socket(AF_INET);
+  setsockopt(rio_sock, SOL_SOCKET, SO_SNDBUF, (const char *) &sndbuf, sizeof(sndbuf));
+  auto sender = rio_sock != INVALID_SOCKET ? platf::rio::sender_t::create(rio_sock) : nullptr;
+  if (!sender) {
+    std::printf("Registered I/O isn't available: %d\n", WSAGetLastError());
+  }
+
+  auto send_rio = [&sender](SOCKET, const SOCKADDR_IN &address, const char *data, std::size_t count) {
+    std::vector<platf::rio::packet_t> packets(count);
+    for (std::size_t x = 0; x < count; ++x) {
+      packets[x] = {nullptr, 0, data + x * PACKET_SIZE, PACKET_SIZE};
+    }
+
+    return sender->send((const SOCKADDR *) &address, sizeof(address), nullptr, 0, packets) == platf::rio::status_e::ok;
+  };
+
+  for (auto mbps : {150, 300, 500, 1000, 0}) {
+    run("WSASendMsg+USO", wsa_sock, address, send_uso, mbps, received);
+    run("WSASendMsg", wsa_sock, address, send_unbatched, mbps, received);
+    if (sender) {
+      run("RIO", rio_sock, address, send_rio, mbps, received);
+    }
+    std::printf("\n");
+  }
+
+  closesocket(receiver);
+  receive_thread.join();
+
+  sender.reset();
+  closesocket(rio_sock);
+  closesocket(wsa_sock);
+  WSACleanup();
+
+  return 0;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file tools/synthetic_display.h
+ * @brief A display drawing a moving pattern, for the tools streaming through the whole video pipeline without a real display.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// local includes
+#include "src/buffer_pool.h"
+#include "src/platform/common.h"
+
+#ifdef SUNSHINE_BUILD_VAAPI
+  #include "src/platform/linux/vaapi.h"
+#endif
+#ifdef SUNSHINE_BUILD_CUDA
+  #include "src/platform/linux/cuda.h"
+#endif
+
+namespace synthetic {
+  using namespace std::literals;
+  using steady_clock = std::chrono::steady_clock;
+
+  struct img_t: public platf::img_t {
+    ~img_t() override {
+      buffer_pool::free_image(data);
+      data = nullptr;
+    }
+  };
+
+  /**
+   * @brief A display drawing a moving pattern in system memory, at the frame rate the client asks for.
+   */
+  class display_t: public platf::display_t {
+  public:
+    display_t(platf::mem_type_e mem_type, int width, int height, int framerate):
+        _mem_type {mem_type},
+        _delay {std::chrono::nanoseconds {1s} / std::max(framerate, 1)} {
+      this->width = env_width = width;
+      this->height = env_height = height;
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += _delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + _delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+
+        draw(*img_out);
+        img_out->frame_timestamp = steady_clock::now();
+
+        if (!push_captured_image_cb(std::move(img_out), true)) {
+          return platf::capture_e::ok;
+        }
+      }
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = buffer_pool::alloc_image(height * img->row_pitch);
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      std::fill_n(img->data, img->height * img->row_pitch, 0);
+      return 0;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (_mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (_mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    bool img_in_system_memory() override {
+      return true;
+    }
+
+  private:
+    /**
+     * @brief Draw a gradient scrolling across the whole image, with a square of noise moving over it.
+     * @details The gradient gives the encoder motion to follow, the noise gives it detail it can't predict.
+     */
+    void draw(platf::img_t &img) {
+      auto shift = (std::uint32_t) _frame * 4;
+      for (int y = 0; y < img.height; ++y) {
+        auto *row = (std::uint32_t *) (img.data + y * img.row_pitch);
+        for (int x = 0; x < img.width; ++x) {
+          auto value = (std::uint32_t) (x + y) + shift;
+          row[x] = (value & 0xFF) | ((value >> 1) & 0xFF) << 8 | ((value >> 2) & 0xFF) << 16;
+        }
+      }
+
+      constexpr int NOISE_SIZE = 256;
+      auto noise_width = std::min(NOISE_SIZE, img.width);
+      auto noise_height = std::min(NOISE_SIZE, img.height);
+      auto left = (int) ((_frame * 8) % (img.width - noise_width + 1));
+      auto top = (int) ((_frame * 4) % (img.height - noise_height + 1));
+      for (int y = top; y < top + noise_height; ++y) {
+        auto *row = (std::uint32_t *) (img.data + y * img.row_pitch);
+        for (int x = left; x < left + noise_width; ++x) {
+          _noise ^= _noise << 13;
+          _noise ^= _noise >> 17;
+          _noise ^= _noise << 5;
+          row[x] = _noise & 0xFFFFFF;
+        }
+      }
+
+      ++_frame;
+    }
+
+    platf::mem_type_e _mem_type;
+    std::chrono::nanoseconds _delay;
+    std::uint64_t _frame = 0;
+    std::uint32_t _noise = 0x12345678;
+  };
+}  // namespace synthetic
@@ -0,0 +1,225 @@
+/**
+ * @file tools/xdp_benchmark.cpp
+ * @brief Compares the throughput of sending video shards to many sessions with UDP GSO and through an AF_XDP socket.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// platform includes
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// local includes
+#include "src/platform/linux/xdp_send.h"
+
+namespace {
+  constexpr std::array<int, 3> SESSION_COUNTS {1, 4, 16};
+  constexpr int FRAMES = 2000;
+
+  // Like a frame of a high bitrate stream, split into shards of the usual packet size
+  constexpr std::size_t SHARDS_PER_FRAME = 64;
+  constexpr std::size_t SHARD_SIZE = 1400;
+
+  // Like platf::send_batch(), which stays under the 64K limit of a GSO message
+  constexpr std::size_t SEGMENTS_PER_MESSAGE = 65536 / 1500;
+
+  constexpr std::uint16_t BASE_PORT = 47998;
+
+  std::uint64_t thread_cpu_time_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (std::uint64_t) ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+  }
+
+  sockaddr_in address_of(in_addr ip, std::uint16_t port) {
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_addr = ip;
+    address.sin_port = htons(port);
+    return address;
+  }
+
+  /**
+   * @brief Send a frame with GSO messages of up to SEGMENTS_PER_MESSAGE shards each.
+   */
+  bool send_gso(int sock, const sockaddr_in &destination, const std::vector<char> &frame) {
+    for (std::size_t shard = 0; shard < SHARDS_PER_FRAME; shard += SEGMENTS_PER_MESSAGE) {
+      auto segments = std::min(SHARDS_PER_FRAME - shard, SEGMENTS_PER_MESSAGE);
+
+      iovec iov {(void *) (frame.data() + shard * SHARD_SIZE), segments * SHARD_SIZE};
+
+      union {
+        char buf[CMSG_SPACE(sizeof(std::uint16_t))];
+        cmsghdr alignment;
+      } cmbuf {};
+
+      msghdr msg {};
+      msg.msg_name = (void *) &destination;
+      msg.msg_namelen = sizeof(destination);
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = cmbuf.buf;
+      msg.msg_controllen = sizeof(cmbuf.buf);
+
+      auto cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+      std::uint16_t segment_size = SHARD_SIZE;
+      std::memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+
+      while (sendmsg(sock, &msg, 0) < 0) {
+        if (errno != ENOBUFS && errno != EAGAIN) {
+          std::fprintf(stderr, "sendmsg() failed: %d\n", errno);
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Send FRAMES frames to each session, one frame per session at a time, and report the throughput.
+   * @param name The name of the send path.
+   * @param sessions The number of sessions.
+   * @param send The function sending a frame to a session.
+   */
+  void run(const char *name, int sessions, const std::function<bool(int, const std::vector<char> &)> &send) {
+    std::vector<char> frame(SHARDS_PER_FRAME * SHARD_SIZE, 'x');
+
+    auto cpu_start = thread_cpu_time_ns();
+    auto start = std::chrono::steady_clock::now();
+    for (int x = 0; x < FRAMES; ++x) {
+      for (int session = 0; session < sessions; ++session) {
+        if (!send(session, frame)) {
+          return;
+        }
+      }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto cpu = thread_cpu_time_ns() - cpu_start;
+
+    auto packets = (double) FRAMES * sessions * SHARDS_PER_FRAME;
+    std::printf("%-8s %2d sessions  %8.2f Gbit/s  %8.2f Mpackets/s  %8.1f ns CPU/packet\n", name, sessions, packets * SHARD_SIZE * 8 / elapsed / 1e9, packets / elapsed / 1e6, cpu / packets);
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::fprintf(stderr, "Usage: %s <interface> <destination IPv4 address>\n", argv[0]);
+    std::fprintf(stderr, "The destination should drop UDP packets to ports %u and up, or count them.\n", BASE_PORT);
+    return 1;
+  }
+
+  std::string interface = argv[1];
+  in_addr destination;
+  if (inet_pton(AF_INET, argv[2], &destination) != 1) {
+    std::fprintf(stderr, "Invalid destination: %s\n", argv[2]);
+    return 1;
+  }
+
+  auto max_sessions = *std::max_element(std::begin(SESSION_COUNTS), std::end(SESSION_COUNTS));
+
+  // Let the kernel pick the source address, like the local address of the RTSP connection of a session
+  sockaddr_in source {};
+  {
+    auto probe = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    auto remote = address_of(destination, BASE_PORT);
+    socklen_t source_size = sizeof(source);
+    if (probe < 0 || connect(probe, (const sockaddr *) &remote, sizeof(remote)) || getsockname(probe, (sockaddr *) &source, &source_size)) {
+      std::fprintf(stderr, "No route to %s: %d\n", argv[2], errno);
+      return 1;
+    }
+    close(probe);
+  }
+
+  // Like the video sockets of the sessions, which aren't connected
+  std::vector<int> sockets;
+  std::vector<sockaddr_in> destinations;
+  std::vector<platf::xdp::flow_t> flows;
+  for (int session = 0; session < max_sessions; ++session) {
+    auto sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    auto local = address_of(source.sin_addr, 0);
+    socklen_t local_size = sizeof(local);
+    if (sock < 0 || bind(sock, (const sockaddr *) &local, sizeof(local)) || getsockname(sock, (sockaddr *) &local, &local_size)) {
+      std::fprintf(stderr, "Couldn't bind a socket: %d\n", errno);
+      return 1;
+    }
+    sockets.push_back(sock);
+    destinations.push_back(address_of(destination, BASE_PORT + session));
+
+    platf::xdp::flow_t flow {};
+    flow.src_ip = local.sin_addr.s_addr;
+    flow.dst_ip = destination.s_addr;
+    flow.src_port = ntohs(local.sin_port);
+    flow.dst_port = BASE_PORT + session;
+    flows.push_back(flow);
+  }
+
+  // Sending through the kernel first makes it resolve the next hop
+  std::vector<char> probe(SHARD_SIZE);
+  sendto(sockets[0], probe.data(), probe.size(), 0, (const sockaddr *) &destinations[0], sizeof(destinations[0]));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  for (auto &flow : flows) {
+    auto resolved = platf::xdp::resolve_flow(interface, flow);
+    if (!resolved) {
+      std::fprintf(stderr, "%s isn't reached through %s, or its next hop isn't resolved\n", argv[2], interface.c_str());
+      return 1;
+    }
+    flow = *resolved;
+  }
+
+  auto sender = platf::xdp::sender_t::create(interface, 0);
+  if (!sender) {
+    std::fprintf(stderr, "Couldn't bind an AF_XDP socket to %s: %d\n", interface.c_str(), errno);
+    return 1;
+  }
+  std::printf("AF_XDP socket bound in %s mode\n\n", sender->zero_copy() ? "zero-copy" : "copy");
+
+  std::vector<platf::xdp::packet_t> packets(SHARDS_PER_FRAME);
+
+  // Alternate the runs, so neither gets an unfair share of a warm cache
+  for (auto sessions : SESSION_COUNTS) {
+    run("GSO", sessions, [&](int session, const std::vector<char> &frame) {
+      return send_gso(sockets[session], destinations[session], frame);
+    });
+    run("AF_XDP", sessions, [&](int session, const std::vector<char> &frame) {
+      for (std::size_t x = 0; x < SHARDS_PER_FRAME; ++x) {
+        packets[x] = {nullptr, 0, frame.data() + x * SHARD_SIZE, SHARD_SIZE};
+      }
+
+      std::size_t queued;
+      if (sender->send(flows[session], packets, queued) != platf::xdp::status_e::ok) {
+        std::fprintf(stderr, "AF_XDP send failed\n");
+        return false;
+      }
+
+      return true;
+    });
+    std::printf("\n");
+  }
+
+  for (auto sock : sockets) {
+    close(sock);
+  }
+
+  return 0;
+}